@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <arch/dma_pool.hpp>
+
+namespace dma_core {
+
+// DMA pool that serves small buffers from per-size-class free lists.
+// Each slab is physically contiguous and its physical address is resolved once
+// when the slab is allocated; see physicalOf(). Buffers never cross a slab,
+// hence they are always physically contiguous.
+// Buffers that are larger than the largest size class are forwarded to a contiguous_pool.
+//
+// The pool is not thread-safe; threads that allocate concurrently need their own pools.
+// Slabs are kept for reuse until the pool is destructed.
+struct SlabPool final : arch::dma_pool {
+	// Size classes are powers of two in [minSize, maxSize].
+	static constexpr int minShift = 6;
+	static constexpr int maxShift = 14;
+	static constexpr size_t minSize = size_t{1} << minShift;
+	static constexpr size_t maxSize = size_t{1} << maxShift;
+
+	static constexpr size_t slabSize = 64 * 1024;
+
+	SlabPool();
+
+	SlabPool(const SlabPool &) = delete;
+
+	~SlabPool();
+
+	SlabPool &operator= (const SlabPool &) = delete;
+
+	void *allocate(size_t size, size_t count, size_t align) override;
+	void deallocate(void *pointer, size_t size, size_t count, size_t align) override;
+
+private:
+	struct FreeObject {
+		FreeObject *next;
+	};
+
+	// Returns the size class index or -1 for buffers that go to the fallback pool.
+	static int classOf(size_t size, size_t align);
+
+	void refill_(int index);
+
+	FreeObject *freeLists_[maxShift - minShift + 1] = {};
+	// Base addresses of all slabs of this pool.
+	std::vector<void *> slabs_;
+
+	arch::contiguous_pool fallback_;
+};
+
+// Returns the physical address of DMA memory. Pointers into slabs of a SlabPool
+// are translated without a system call; everything else uses helPointerPhysical().
+uintptr_t physicalOf(const void *pointer);
+
+} // namespace dma_core
@@ -0,0 +1,103 @@
+#include <map>
+#include <shared_mutex>
+
+#include <core/dma/slab-pool.hpp>
+#include <helix/memory.hpp>
+
+namespace dma_core {
+
+namespace {
+	// Maps the virtual base address of each slab (of all pools) to its physical address.
+	std::shared_mutex registryMutex;
+	std::map<uintptr_t, uintptr_t> slabRegistry;
+}
+
+SlabPool::SlabPool() = default;
+
+SlabPool::~SlabPool() {
+	{
+		std::unique_lock lock{registryMutex};
+		for(auto slab : slabs_)
+			slabRegistry.erase(reinterpret_cast<uintptr_t>(slab));
+	}
+	for(auto slab : slabs_)
+		HEL_CHECK(helUnmapMemory(kHelNullHandle, slab, slabSize));
+}
+
+int SlabPool::classOf(size_t size, size_t align) {
+	// Objects of a class are aligned to their size (but at most to the page size).
+	if(size < align)
+		size = align;
+	if(size > maxSize || align > 0x1000)
+		return -1;
+	int shift = minShift;
+	while((size_t{1} << shift) < size)
+		shift++;
+	return shift - minShift;
+}
+
+void *SlabPool::allocate(size_t size, size_t count, size_t align) {
+	auto index = classOf(size * count, align);
+	if(index < 0)
+		return fallback_.allocate(size, count, align);
+
+	if(!freeLists_[index])
+		refill_(index);
+	auto object = freeLists_[index];
+	freeLists_[index] = object->next;
+	return object;
+}
+
+void SlabPool::deallocate(void *pointer, size_t size, size_t count, size_t align) {
+	auto index = classOf(size * count, align);
+	if(index < 0) {
+		fallback_.deallocate(pointer, size, count, align);
+		return;
+	}
+
+	auto object = static_cast<FreeObject *>(pointer);
+	object->next = freeLists_[index];
+	freeLists_[index] = object;
+}
+
+void SlabPool::refill_(int index) {
+	HelHandle memory;
+	void *window;
+	HEL_CHECK(helAllocateMemory(slabSize, kHelAllocContinuous, nullptr, &memory));
+	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
+			0, slabSize, kHelMapProtRead | kHelMapProtWrite, &window));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, memory));
+
+	slabs_.push_back(window);
+
+	{
+		std::unique_lock lock{registryMutex};
+		slabRegistry.emplace(reinterpret_cast<uintptr_t>(window), helix::ptrToPhysical(window));
+	}
+
+	// Carve the slab into objects; push them in reverse such that allocation
+	// proceeds in address order.
+	size_t objectSize = size_t{1} << (index + minShift);
+	auto base = static_cast<char *>(window);
+	for(size_t offset = slabSize; offset; offset -= objectSize) {
+		auto object = reinterpret_cast<FreeObject *>(base + offset - objectSize);
+		object->next = freeLists_[index];
+		freeLists_[index] = object;
+	}
+}
+
+uintptr_t physicalOf(const void *pointer) {
+	auto address = reinterpret_cast<uintptr_t>(pointer);
+	{
+		std::shared_lock lock{registryMutex};
+		auto it = slabRegistry.upper_bound(address);
+		if(it != slabRegistry.begin()) {
+			--it;
+			if(address - it->first < SlabPool::slabSize)
+				return it->second + (address - it->first);
+		}
+	}
+	return helix::ptrToPhysical(pointer);
+}
+
+} // namespace dma_core
@@ -192,6 +192,11 @@ public:
 
 	std::unique_ptr<AtomicState> atomicState();
 
+	// Commits the (captured) configuration once all earlier commits that affect one of
+	// the given CRTCs have completed, and waits until the new configuration is applied.
+	async::result<void> commitInOrder(Configuration *config,
+			std::unique_ptr<AtomicState> &state, std::vector<Crtc *> crtcs);
+
 	uint64_t installMapping(drm_core::BufferObject *bo);
 
 	void setupMinDimensions(uint32_t width, uint32_t height);
@@ -299,8 +304,11 @@ struct File {
 	}
 
 private:
-	async::detached _retirePageFlip(std::unique_ptr<Configuration> config,
-			uint64_t cookie, uint32_t crtc_id);
+	// Commits in the background, i.e., without blocking the ioctl() that requested the
+	// commit. If an event is given, it is posted once the commit completed.
+	async::detached _commitNonblocking(std::unique_ptr<Configuration> config,
+			std::unique_ptr<AtomicState> state, std::vector<Crtc *> crtcs,
+			std::optional<Event> event);
 
 	std::shared_ptr<Device> _device;
 
@@ -413,6 +421,9 @@ public:
 
 	int index;
 
+	// Held while a commit on this CRTC is in progress, see Device::commitInOrder().
+	async::mutex commitMutex;
+
 private:
 	std::shared_ptr<CrtcState> _drmState;
 };
@@ -498,6 +509,16 @@ private:
 	std::shared_ptr<ConnectorState> _drmState;
 };
 
+/**
+ * Damaged region of a framebuffer in pixels; x2 and y2 are exclusive.
+ */
+struct DamageRect {
+	uint32_t x1;
+	uint32_t y1;
+	uint32_t x2;
+	uint32_t y2;
+};
+
 /**
  * Holds all info relating to a framebuffer, such as size and pixel format.
  */
@@ -508,7 +529,9 @@ protected:
 	~FrameBuffer() = default;
 
 public:
-	virtual void notifyDirty() = 0;
+	// Called on DRM_IOCTL_MODE_DIRTYFB. Drivers only need to update the given regions
+	// (which are not clipped to the framebuffer); an empty list means the entire framebuffer.
+	virtual void notifyDirty(const std::vector<DamageRect> &clips) = 0;
 };
 
 struct Plane : ModeObject {
@@ -572,6 +595,11 @@ struct AtomicState {
 	std::shared_ptr<ConnectorState> connector(uint32_t id);
 
 	std::unordered_map<uint32_t, std::shared_ptr<CrtcState>>& crtc_states(void);
+	std::unordered_map<uint32_t, std::shared_ptr<PlaneState>>& plane_states(void);
+
+	// True if the state only touches cursor planes. States are only created for objects
+	// that are assigned to, hence drivers can skip CRTC and primary plane work in this case.
+	bool cursorOnly();
 
 private:
 	Device *_device;
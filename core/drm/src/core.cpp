@@ -1,6 +1,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <algorithm>
 #include <deque>
 #include <experimental/optional>
 #include <optional>
@@ -137,6 +138,10 @@ drm_core::Device::Device() {
 		bool validate(const Assignment&) override {
 			return true;
 		};
+
+		void writeToState(const Assignment assignment, std::unique_ptr<AtomicState> &state) override {
+			state->plane(assignment.object->id())->crtc_x = assignment.intValue;
+		}
 	};
 	registerProperty(_crtcXProperty = std::make_shared<CrtcXProperty>());
 
@@ -147,6 +152,10 @@ drm_core::Device::Device() {
 		bool validate(const Assignment&) override {
 			return true;
 		};
+
+		void writeToState(const Assignment assignment, std::unique_ptr<AtomicState> &state) override {
+			state->plane(assignment.object->id())->crtc_y = assignment.intValue;
+		}
 	};
 	registerProperty(_crtcYProperty = std::make_shared<CrtcYProperty>());
 
@@ -235,6 +244,10 @@ drm_core::Device::Device() {
 		bool validate(const Assignment&) override {
 			return true;
 		};
+
+		void writeToState(const Assignment assignment, std::unique_ptr<AtomicState> &state) override {
+			state->plane(assignment.object->id())->crtc_w = assignment.intValue;
+		}
 	};
 	registerProperty(_crtcWProperty = std::make_shared<CrtcWProperty>());
 
@@ -245,6 +258,10 @@ drm_core::Device::Device() {
 		bool validate(const Assignment&) override {
 			return true;
 		};
+
+		void writeToState(const Assignment assignment, std::unique_ptr<AtomicState> &state) override {
+			state->plane(assignment.object->id())->crtc_h = assignment.intValue;
+		}
 	};
 	registerProperty(_crtcHProperty = std::make_shared<CrtcHProperty>());
 }
@@ -267,6 +284,24 @@ const std::vector<drm_core::Crtc *> &drm_core::Device::getCrtcs() {
 	return _crtcs;
 }
 
+async::result<void> drm_core::Device::commitInOrder(Configuration *config,
+		std::unique_ptr<AtomicState> &state, std::vector<Crtc *> crtcs) {
+	// Lock the CRTCs in a fixed order to avoid deadlocks between commits that affect
+	// more than one CRTC. async::mutex is fair, hence commits are applied in order.
+	std::sort(crtcs.begin(), crtcs.end(), [] (Crtc *a, Crtc *b) {
+		return a->id() < b->id();
+	});
+	crtcs.erase(std::unique(crtcs.begin(), crtcs.end()), crtcs.end());
+	for(auto crtc : crtcs)
+		co_await crtc->commitMutex.async_lock();
+
+	config->commit(state);
+	co_await config->waitForCompletion();
+
+	for(auto crtc : crtcs)
+		crtc->commitMutex.unlock();
+}
+
 const std::vector<drm_core::Encoder *> &drm_core::Device::getEncoders() {
 	return _encoders;
 }
@@ -872,6 +907,20 @@ std::unordered_map<uint32_t, std::shared_ptr<drm_core::CrtcState>>& drm_core::At
 	return _crtcStates;
 }
 
+std::unordered_map<uint32_t, std::shared_ptr<drm_core::PlaneState>>& drm_core::AtomicState::plane_states(void) {
+	return _planeStates;
+}
+
+bool drm_core::AtomicState::cursorOnly() {
+	if(!_crtcStates.empty() || !_connectorStates.empty())
+		return false;
+	for(auto &[id, plane_state] : _planeStates) {
+		if(plane_state->plane->type() != Plane::PlaneType::CURSOR)
+			return false;
+	}
+	return true;
+}
+
 // ----------------------------------------------------------------
 // File
 // ----------------------------------------------------------------
@@ -1012,6 +1061,8 @@ drm_core::File::ioctl(void *object, managarm::fs::CntRequest req,
 			resp.set_drm_value(1);
 		}else if(req.drm_capability() == DRM_CAP_CRTC_IN_VBLANK_EVENT) {
 			resp.set_drm_value(1);
+		}else if(req.drm_capability() == DRM_CAP_ASYNC_PAGE_FLIP) {
+			resp.set_drm_value(1);
 		}else if(req.drm_capability() == DRM_CAP_CURSOR_WIDTH) {
 			resp.set_drm_value(0);
 		}else if(req.drm_capability() == DRM_CAP_CURSOR_HEIGHT) {
@@ -1300,9 +1351,7 @@ drm_core::File::ioctl(void *object, managarm::fs::CntRequest req,
 		auto state = self->_device->atomicState();
 		auto valid = config->capture(assignments, state);
 		assert(valid);
-		config->commit(state);
-
-		co_await config->waitForCompletion();
+		co_await self->_device->commitInOrder(config.get(), state, {crtc});
 
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 
@@ -1330,9 +1379,11 @@ drm_core::File::ioctl(void *object, managarm::fs::CntRequest req,
 		auto state = self->_device->atomicState();
 		auto valid = config->capture(assignments, state);
 		assert(valid);
-		config->commit(state);
 
-		self->_retirePageFlip(std::move(config), req.drm_cookie(), crtc->id());
+		// Page flips never block; flips on the same CRTC are queued. Since flips are not
+		// synchronized to vblank, DRM_MODE_PAGE_FLIP_ASYNC requires no special handling.
+		self->_commitNonblocking(std::move(config), std::move(state), {crtc},
+				Event{req.drm_cookie(), crtc->id(), 0});
 
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 
@@ -1349,9 +1400,22 @@ drm_core::File::ioctl(void *object, managarm::fs::CntRequest req,
 		assert(obj);
 		auto fb = obj->asFrameBuffer();
 		assert(fb);
-		fb->notifyDirty();
+
+		std::vector<drm_core::DamageRect> clips;
+		for(auto &clip : req.drm_clips()) {
+			auto x1 = std::max(clip.x1(), 0);
+			auto y1 = std::max(clip.y1(), 0);
+			if(clip.x2() <= x1 || clip.y2() <= y1)
+				continue;
+			clips.push_back({static_cast<uint32_t>(x1), static_cast<uint32_t>(y1),
+					static_cast<uint32_t>(clip.x2()), static_cast<uint32_t>(clip.y2())});
+		}
+		// If all clips are empty, there is nothing to update.
+		if(!clips.empty() || req.drm_clips().empty())
+			fb->notifyDirty(clips);
 
 		resp.set_error(managarm::fs::Errors::SUCCESS);
+
 		auto ser = resp.SerializeAsString();
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 			helix::action(&send_resp, ser.data(), ser.size()));
@@ -1410,9 +1474,7 @@ drm_core::File::ioctl(void *object, managarm::fs::CntRequest req,
 		auto state = self->_device->atomicState();
 		auto valid = config->capture(assignments, state);
 		assert(valid);
-		config->commit(state);
-
-		co_await config->waitForCompletion();
+		co_await self->_device->commitInOrder(config.get(), state, {crtc});
 
 		auto ser = resp.SerializeAsString();
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
@@ -1661,13 +1723,28 @@ drm_core::File::ioctl(void *object, managarm::fs::CntRequest req,
 		}
 
 		if(!(req.drm_flags() & DRM_MODE_ATOMIC_TEST_ONLY)) {
-			config->commit(state);
-			co_await config->waitForCompletion();
-		}
+			std::optional<Event> event;
+			if(req.drm_flags() & DRM_MODE_PAGE_FLIP_EVENT) {
+				assert(crtc_ids.size() == 1);
+				event = Event{req.drm_cookie(), crtc_ids.front(), 0};
+			}
 
-		if(req.drm_flags() & DRM_MODE_PAGE_FLIP_EVENT) {
-			assert(crtc_ids.size() == 1);
-			self->_retirePageFlip(std::move(config), req.drm_cookie(), crtc_ids.front());
+			// Commits that do not name a CRTC (e.g., plane-only updates) are ordered
+			// against all CRTCs.
+			std::vector<Crtc *> crtcs;
+			for(auto id : crtc_ids)
+				crtcs.push_back(self->_device->findObject(id)->asCrtc());
+			if(crtcs.empty())
+				crtcs = self->_device->getCrtcs();
+
+			if(req.drm_flags() & DRM_MODE_ATOMIC_NONBLOCK) {
+				self->_commitNonblocking(std::move(config), std::move(state),
+						std::move(crtcs), event);
+			}else{
+				co_await self->_device->commitInOrder(config.get(), state, std::move(crtcs));
+				if(event)
+					self->postEvent(*event);
+			}
 		}
 
 		resp.set_error(managarm::fs::Errors::SUCCESS);
@@ -1716,14 +1793,13 @@ drm_core::File::pollStatus(void *object) {
 }
 
 async::detached
-drm_core::File::_retirePageFlip(std::unique_ptr<drm_core::Configuration> config,
-			uint64_t cookie, uint32_t crtc_id) {
-	co_await config->waitForCompletion();
+drm_core::File::_commitNonblocking(std::unique_ptr<drm_core::Configuration> config,
+		std::unique_ptr<drm_core::AtomicState> state, std::vector<drm_core::Crtc *> crtcs,
+		std::optional<drm_core::Event> event) {
+	co_await _device->commitInOrder(config.get(), state, std::move(crtcs));
 
-	Event event;
-	event.cookie = cookie;
-	event.crtcId = crtc_id;
-	postEvent(event);
+	if(event)
+		postEvent(*event);
 }
 
 namespace drm_core {
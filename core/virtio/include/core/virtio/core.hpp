@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <deque>
 #include <vector>
 
 #include <arch/dma_structs.hpp>
@@ -71,9 +72,30 @@ enum {
 	// Bits of the spec::Descriptor::flags field.
 	VIRTQ_DESC_F_NEXT = 1, // descriptor is part of a chain
 	VIRTQ_DESC_F_WRITE = 2, // buffer is written by device
+	VIRTQ_DESC_F_INDIRECT = 4, // buffer contains an indirect descriptor table
 
 	// Bits of the spec::UsedRing::flags field.
-	VIRTQ_USED_F_NO_NOTIFY = 1 // no need to notify the device
+	VIRTQ_USED_F_NO_NOTIFY = 1, // no need to notify the device
+
+	// Additional bits of the spec::PackedDescriptor::flags field.
+	VIRTQ_DESC_F_AVAIL = 1 << 7,
+	VIRTQ_DESC_F_USED = 1 << 15
+};
+
+// Values of the spec::EventSuppression::flags field.
+enum {
+	RING_EVENT_FLAGS_ENABLE = 0,
+	RING_EVENT_FLAGS_DISABLE = 1,
+	// Only notify for the descriptor given by offWrap (requires VIRTIO_F_EVENT_IDX).
+	RING_EVENT_FLAGS_DESC = 2
+};
+
+// Device-independent feature bits.
+enum {
+	VIRTIO_F_INDIRECT_DESC = 28,
+	VIRTIO_F_EVENT_IDX = 29,
+	VIRTIO_F_RING_PACKED = 34,
+	VIRTIO_F_IN_ORDER = 35
 };
 
 namespace spec {
@@ -121,9 +143,26 @@ namespace spec {
 
 		arch::scalar_variable<uint16_t> eventIndex;
 	};
+
+	// Packed virtqs use a single ring of these descriptors for both directions.
+	struct PackedDescriptor {
+		arch::scalar_variable<uint64_t> address;
+		arch::scalar_variable<uint32_t> length;
+		arch::scalar_variable<uint16_t> id;
+		arch::scalar_variable<uint16_t> flags;
+	};
+	static_assert(sizeof(PackedDescriptor) == 16);
+
+	struct EventSuppression {
+		// Ring offset in bits 0-14, wrap counter in bit 15.
+		arch::scalar_variable<uint16_t> offWrap;
+		arch::scalar_variable<uint16_t> flags;
+	};
+	static_assert(sizeof(EventSuppression) == 4);
 };
 
 struct DeviceSpace;
+struct IndirectChain;
 struct Queue;
 
 // --------------------------------------------------------
@@ -182,7 +221,7 @@ struct DeviceSpace {
 		} else {
 			static_assert(sizeof(typename RT::rep_type) == 4,
 					"Unsupported size for DeviceSpace::load()");
-			auto v = _transport->loadConfig16(r.offset());
+			auto v = _transport->loadConfig32(r.offset());
 			return static_cast<typename RT::rep_type>(v);
 		}
 	}
@@ -237,6 +276,10 @@ struct Handle {
 
 	void setupLink(Handle other);
 
+	// Makes this descriptor refer to an indirect descriptor table.
+	// Requires VIRTIO_F_INDIRECT_DESC to be negotiated.
+	void setupIndirect(IndirectChain &chain);
+
 private:
 	Queue *_queue;
 	size_t _tableIndex;
@@ -277,22 +320,76 @@ private:
 	Handle _back;
 };
 
+// Helper class to fill an indirect descriptor table.
+// The whole table only occupies a single descriptor of the virtq (see Handle::setupIndirect()).
+// The table memory must be physically contiguous and outlive the request.
+struct IndirectChain {
+	IndirectChain(spec::Descriptor *table, size_t max_entries)
+	: _table{table}, _maxEntries{max_entries}, _numEntries{0} { }
+
+	IndirectChain(const IndirectChain &) = delete;
+
+	IndirectChain &operator= (const IndirectChain &) = delete;
+
+	spec::Descriptor *table() {
+		return _table;
+	}
+
+	size_t size() {
+		return _numEntries;
+	}
+
+	size_t capacity() {
+		return _maxEntries;
+	}
+
+	// Appends a buffer to the table; the same remarks as for Handle::setupBuffer() apply.
+	void setupBuffer(HostToDeviceType, arch::dma_buffer_view view);
+	void setupBuffer(DeviceToHostType, arch::dma_buffer_view view);
+
+private:
+	spec::Descriptor *_append(arch::dma_buffer_view view);
+
+	spec::Descriptor *_table;
+	size_t _maxEntries;
+	size_t _numEntries;
+};
+
 // Helper functions that obtain descriptor from a queue as needed.
 async::result<void> scatterGather(HostToDeviceType, Chain &chain, Queue *queue,
 		arch::dma_buffer_view view);
 async::result<void> scatterGather(DeviceToHostType, Chain &chain, Queue *queue,
 		arch::dma_buffer_view view);
 
+// Same as above but for indirect tables. The caller needs to ensure that the table is large enough.
+void scatterGather(HostToDeviceType, IndirectChain &chain, arch::dma_buffer_view view);
+void scatterGather(DeviceToHostType, IndirectChain &chain, arch::dma_buffer_view view);
+
 struct Request {
 	void (*complete)(Request *);
+
+	// Number of bytes that the device wrote to the descriptor chain.
+	// Set before complete() is called.
+	size_t bytesWritten = 0;
 };
 
 // Represents a single virtq.
+// Depending on the negotiated features, the virtq either uses the split layout
+// (descriptor table, available ring and used ring) or the packed layout
+// (a single descriptor ring). Handles always refer to descriptors of a split-style table;
+// for packed virtqs, this table is private to the driver and its chains are copied
+// to the ring by postDescriptor().
 struct Queue {
 	friend struct Handle;
 
 	Queue(unsigned int queue_index, size_t queue_size, spec::Descriptor *table,
-			spec::AvailableRing *available, spec::UsedRing *used);
+			spec::AvailableRing *available, spec::UsedRing *used, bool event_index);
+
+	// If in_order is true, the device uses buffers in the order in which they were posted
+	// (i.e., VIRTIO_F_IN_ORDER was negotiated).
+	Queue(unsigned int queue_index, size_t queue_size, spec::PackedDescriptor *ring,
+			spec::EventSuppression *driver_event, spec::EventSuppression *device_event,
+			bool event_index, bool in_order);
 protected:
 	~Queue() = default;
 
@@ -301,6 +398,10 @@ public:
 		return _queueIndex;
 	}
 
+	bool isPacked() {
+		return _packed;
+	}
+
 	// Returns the number of descriptors in this virtq.
 	size_t numDescriptors() {
 		return _queueSize;
@@ -315,6 +416,8 @@ public:
 			void (*complete)(Request *));
 
 	// Notifies the device that new descriptors have been posted.
+	// Multiple descriptors can be posted before calling notify() to batch notifications.
+	// If VIRTIO_F_EVENT_IDX was negotiated, the device is only notified if it asked for it.
 	void notify();
 
 	auto submitDescriptor(Handle descriptor) {
@@ -340,18 +443,49 @@ protected:
 	virtual void notifyTransport() = 0;
 
 private:
+	void _postPacked(Handle handle);
+	void _notifyPacked();
+	void _processPacked();
+
+	// Returns the descriptors of a chain to _descriptorStack.
+	// Returns the number of descriptors in the chain.
+	size_t _freeChain(size_t table_index);
+
 	// Index of this queue as part of its owning device.
 	unsigned int _queueIndex;
 
 	// Number of descriptors in this queue.
 	size_t _queueSize;
 
+	bool _packed;
+
 	// Pointers to different data structures of this virtq.
+	// For packed virtqs, _table points to _shadowTable.
 	spec::Descriptor *_table;
-	spec::AvailableRing *_availableRing;
-	spec::UsedRing *_usedRing;
-	spec::AvailableExtra *_availableExtra;
-	spec::UsedExtra *_usedExtra;
+	spec::AvailableRing *_availableRing = nullptr;
+	spec::UsedRing *_usedRing = nullptr;
+	spec::AvailableExtra *_availableExtra = nullptr;
+	spec::UsedExtra *_usedExtra = nullptr;
+
+	// Data structures of packed virtqs.
+	std::vector<spec::Descriptor> _shadowTable;
+	spec::PackedDescriptor *_ring = nullptr;
+	spec::EventSuppression *_driverEvent = nullptr;
+	spec::EventSuppression *_deviceEvent = nullptr;
+
+	// Next ring positions that the driver writes to / reads from and their wrap counters.
+	uint16_t _availPosition = 0;
+	bool _availWrap = true;
+	uint16_t _usedPosition = 0;
+	bool _usedWrap = true;
+
+	// Number of descriptors that were written to the ring since the last notify().
+	uint16_t _numAdded = 0;
+
+	bool _inOrder = false;
+
+	// For in-order virtqs: heads of the posted chains, in the order in which they were posted.
+	std::deque<uint16_t> _postedHeads;
 
 	// Keeps track of unused descriptor indices.
 	std::vector<uint16_t> _descriptorStack;
@@ -362,6 +496,12 @@ private:
 
 	// Keeps track of which entries in the used ring have already been processed.
 	uint16_t _progressHead;
+
+	// Whether VIRTIO_F_EVENT_IDX was negotiated.
+	bool _useEventIndex;
+
+	// Value of the available ring's headIndex at the time of the last notify().
+	uint16_t _notifiedHead;
 };
 
 } // namespace virtio_core
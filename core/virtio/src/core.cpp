@@ -1,8 +1,12 @@
 
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
 #include <iostream>
 #include <optional>
+#include <thread>
 
+#include <core/dma/slab-pool.hpp>
 #include <core/virtio/core.hpp>
 #include <fafnir/dsl.hpp>
 #include <protocols/kernlet/compiler.hpp>
@@ -106,13 +110,16 @@ private:
 	arch::io_space _legacySpace;
 	helix::UniqueDescriptor _irq;
 
+	bool _eventIndex = false;
+
 	std::vector<std::unique_ptr<LegacyPciQueue>> _queues;
 };
 
 struct LegacyPciQueue final : Queue {
 	LegacyPciQueue(LegacyPciTransport *transport,
 			unsigned int queue_index, size_t queue_size,
-			spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used);
+			spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
+			bool event_index);
 
 protected:
 	void notifyTransport() override;
@@ -154,7 +161,10 @@ void LegacyPciTransport::acknowledgeDriverFeature(unsigned int feature) {
 }
 
 void LegacyPciTransport::finalizeFeatures() {
-	// Does nothing for now.
+	if(checkDeviceFeature(VIRTIO_F_EVENT_IDX)) {
+		acknowledgeDriverFeature(VIRTIO_F_EVENT_IDX);
+		_eventIndex = true;
+	}
 }
 
 void LegacyPciTransport::claimQueues(unsigned int max_index) {
@@ -199,7 +209,7 @@ Queue *LegacyPciTransport::setupQueue(unsigned int queue_index) {
 	auto available = reinterpret_cast<spec::AvailableRing *>((char *)window + available_offset);
 	auto used = reinterpret_cast<spec::UsedRing *>((char *)window + used_offset);
 	_queues[queue_index] = std::make_unique<LegacyPciQueue>(this, queue_index, queue_size,
-			table, available, used);
+			table, available, used, _eventIndex);
 
 	// Hand the queue to the device.
 	uintptr_t table_physical;
@@ -250,8 +260,10 @@ async::detached LegacyPciTransport::_processIrqs() {
 
 LegacyPciQueue::LegacyPciQueue(LegacyPciTransport *transport,
 		unsigned int queue_index, size_t queue_size,
-		spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used)
-: Queue{queue_index, queue_size, table, available, used}, _transport{transport} { }
+		spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
+		bool event_index)
+: Queue{queue_index, queue_size, table, available, used, event_index},
+		_transport{transport} { }
 
 void LegacyPciQueue::notifyTransport() {
 	_transport->_legacySpace.store(PCI_L_QUEUE_NOTIFY, queueIndex());
@@ -273,11 +285,10 @@ struct StandardPciTransport : Transport {
 	friend struct StandardPciQueue;
 
 	StandardPciTransport(protocols::hw::Device hw_device,
-			bool useMsi,
 			Mapping common_mapping, Mapping notify_mapping,
 			Mapping isr_mapping, Mapping device_mapping,
 			unsigned int notify_multiplier, helix::UniqueDescriptor irq,
-			helix::UniqueDescriptor queueMsi);
+			std::vector<helix::UniqueDescriptor> queue_msis);
 
 	protocols::hw::Device &hwDevice() override {
 		return _hwDevice;
@@ -302,8 +313,14 @@ private:
 	arch::mem_space _isrSpace() { return arch::mem_space{_isrMapping.get()}; }
 	arch::mem_space _deviceSpace() { return arch::mem_space{_deviceMapping.get()}; }
 
+	Queue *_setupPackedQueue(unsigned int queue_index, size_t queue_size,
+			unsigned int notify_index);
+
+	// Assigns an MSI-X vector to the currently selected queue and enables it.
+	void _enableQueue(unsigned int queue_index);
+
 	async::detached _processIrqs();
-	async::detached _processQueueMsi();
+	async::detached _processQueueMsi(unsigned int vector);
 
 	protocols::hw::Device _hwDevice;
 	bool _useMsi;
@@ -313,8 +330,12 @@ private:
 	Mapping _deviceMapping;
 	unsigned int _notifyMultiplier;
 	helix::UniqueDescriptor _irq;
-	helix::UniqueDescriptor _queueMsi;
-
+	// One descriptor per MSI-X vector; queues are distributed over the vectors.
+	std::vector<helix::UniqueDescriptor> _queueMsis;
+	std::vector<std::vector<StandardPciQueue *>> _msiQueues;
+	bool _eventIndex = false;
+	bool _packed = false;
+	bool _inOrder = false;
 
 	std::vector<std::unique_ptr<StandardPciQueue>> _queues;
 };
@@ -323,6 +344,12 @@ struct StandardPciQueue final : Queue {
 	StandardPciQueue(StandardPciTransport *transport,
 			unsigned int queue_index, size_t queue_size,
 			spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
+			bool event_index, arch::scalar_register<uint16_t> notify_register);
+
+	StandardPciQueue(StandardPciTransport *transport,
+			unsigned int queue_index, size_t queue_size,
+			spec::PackedDescriptor *ring, spec::EventSuppression *driver_event,
+			spec::EventSuppression *device_event, bool event_index, bool in_order,
 			arch::scalar_register<uint16_t> notify_register);
 
 protected:
@@ -334,17 +361,16 @@ private:
 };
 
 StandardPciTransport::StandardPciTransport(protocols::hw::Device hw_device,
-		bool useMsi,
 		Mapping common_mapping, Mapping notify_mapping,
 		Mapping isr_mapping, Mapping device_mapping,
 		unsigned int notify_multiplier, helix::UniqueDescriptor irq,
-		helix::UniqueDescriptor queueMsi)
+		std::vector<helix::UniqueDescriptor> queue_msis)
 : _hwDevice{std::move(hw_device)},
-		_useMsi{useMsi},
+		_useMsi{!queue_msis.empty()},
 		_commonMapping{std::move(common_mapping)}, _notifyMapping{std::move(notify_mapping)},
 		_isrMapping{std::move(isr_mapping)}, _deviceMapping{std::move(device_mapping)},
 		_notifyMultiplier{notify_multiplier}, _irq{std::move(irq)},
-		_queueMsi{std::move(queueMsi)} { }
+		_queueMsis{std::move(queue_msis)}, _msiQueues(_queueMsis.size()) { }
 
 uint8_t StandardPciTransport::loadConfig8(size_t offset) {
 	return _deviceSpace().load(arch::scalar_register<uint8_t>(offset));
@@ -374,6 +400,22 @@ void StandardPciTransport::finalizeFeatures() {
 	assert(checkDeviceFeature(32));
 	acknowledgeDriverFeature(32);
 
+	if(checkDeviceFeature(VIRTIO_F_EVENT_IDX)) {
+		acknowledgeDriverFeature(VIRTIO_F_EVENT_IDX);
+		_eventIndex = true;
+	}
+
+	// Prefer packed virtqs: driver and device exchange descriptors through a single ring.
+	if(checkDeviceFeature(VIRTIO_F_RING_PACKED)) {
+		acknowledgeDriverFeature(VIRTIO_F_RING_PACKED);
+		_packed = true;
+
+		if(checkDeviceFeature(VIRTIO_F_IN_ORDER)) {
+			acknowledgeDriverFeature(VIRTIO_F_IN_ORDER);
+			_inOrder = true;
+		}
+	}
+
 	_commonSpace().store(PCI_DEVICE_STATUS, _commonSpace().load(PCI_DEVICE_STATUS) | FEATURES_OK);
 	auto confirm = _commonSpace().load(PCI_DEVICE_STATUS);
 	assert(confirm & FEATURES_OK);
@@ -392,6 +434,9 @@ Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
 	auto notify_index = _commonSpace().load(PCI_QUEUE_NOTIFY);
 	assert(queue_size);
 
+	if(_packed)
+		return _setupPackedQueue(queue_index, queue_size, notify_index);
+
 	// TODO: Ensure that the queue size is indeed a power of 2.
 
 	// Determine the queue size in bytes.
@@ -422,7 +467,7 @@ Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
 	auto available = reinterpret_cast<spec::AvailableRing *>((char *)window + available_offset);
 	auto used = reinterpret_cast<spec::UsedRing *>((char *)window + used_offset);
 	_queues[queue_index] = std::make_unique<StandardPciQueue>(this, queue_index, queue_size,
-			table, available, used,
+			table, available, used, _eventIndex,
 			arch::scalar_register<uint16_t>{_notifyMultiplier * notify_index});
 
 	// Hand the queue to the device.
@@ -437,24 +482,84 @@ Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
 	_commonSpace().store(PCI_QUEUE_USED[0], used_physical);
 	_commonSpace().store(PCI_QUEUE_USED[1], used_physical >> 32);
 
-	// Setup MSI-X.
+	_enableQueue(queue_index);
+
+	return _queues[queue_index].get();
+}
+
+Queue *StandardPciTransport::_setupPackedQueue(unsigned int queue_index,
+		size_t queue_size, unsigned int notify_index) {
+	// The event suppression structures follow the descriptor ring.
+	// Packed virtqs do not require the queue size to be a power of 2.
+	auto driver_event_offset = queue_size * sizeof(spec::PackedDescriptor);
+	auto device_event_offset = driver_event_offset + sizeof(spec::EventSuppression);
+	auto region_size = device_event_offset + sizeof(spec::EventSuppression);
+
+	// Allocate physical memory for the virtq structs.
+	assert(region_size < 0x4000); // FIXME: do not hardcode 0x4000
+	HelHandle memory;
+	void *window;
+	HEL_CHECK(helAllocateMemory(0x4000, kHelAllocContinuous, nullptr, &memory));
+	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
+			0, 0x4000, kHelMapProtRead | kHelMapProtWrite, &window));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, memory));
+
+	auto ring = reinterpret_cast<spec::PackedDescriptor *>((char *)window);
+	auto driver_event = reinterpret_cast<spec::EventSuppression *>(
+			(char *)window + driver_event_offset);
+	auto device_event = reinterpret_cast<spec::EventSuppression *>(
+			(char *)window + device_event_offset);
+	_queues[queue_index] = std::make_unique<StandardPciQueue>(this, queue_index, queue_size,
+			ring, driver_event, device_event, _eventIndex, _inOrder,
+			arch::scalar_register<uint16_t>{_notifyMultiplier * notify_index});
+
+	// Hand the queue to the device. For packed virtqs, the available and used
+	// registers hold the driver and device event suppression areas.
+	uintptr_t ring_physical, driver_event_physical, device_event_physical;
+	HEL_CHECK(helPointerPhysical(ring, &ring_physical));
+	HEL_CHECK(helPointerPhysical(driver_event, &driver_event_physical));
+	HEL_CHECK(helPointerPhysical(device_event, &device_event_physical));
+	_commonSpace().store(PCI_QUEUE_TABLE[0], ring_physical);
+	_commonSpace().store(PCI_QUEUE_TABLE[1], ring_physical >> 32);
+	_commonSpace().store(PCI_QUEUE_AVAILABLE[0], driver_event_physical);
+	_commonSpace().store(PCI_QUEUE_AVAILABLE[1], driver_event_physical >> 32);
+	_commonSpace().store(PCI_QUEUE_USED[0], device_event_physical);
+	_commonSpace().store(PCI_QUEUE_USED[1], device_event_physical >> 32);
+
+	_enableQueue(queue_index);
+
+	return _queues[queue_index].get();
+}
+
+void StandardPciTransport::_enableQueue(unsigned int queue_index) {
+	// Setup MSI-X. If there are fewer vectors than queues, queues share vectors round-robin.
 	if(_useMsi) {
-		_commonSpace().store(PCI_QUEUE_MSIX_VECTOR, 0);
-		if(_commonSpace().load(PCI_QUEUE_MSIX_VECTOR) != 0)
+		auto vector = queue_index % _queueMsis.size();
+		_commonSpace().store(PCI_QUEUE_MSIX_VECTOR, vector);
+		if(_commonSpace().load(PCI_QUEUE_MSIX_VECTOR) != vector)
 			throw std::runtime_error("Device failed to allocate MSI-X interrupt");
+		_msiQueues[vector].push_back(_queues[queue_index].get());
 	}
 
 	_commonSpace().store(PCI_QUEUE_ENABLE, 1);
-
-	return _queues[queue_index].get();
 }
 
 void StandardPciTransport::runDevice() {
 	// Finally set the DRIVER_OK bit to finish the configuration.
 	_commonSpace().store(PCI_DEVICE_STATUS, _commonSpace().load(PCI_DEVICE_STATUS) | DRIVER_OK);
 
-	if(_useMsi)
-		_processQueueMsi();
+	if(_useMsi) {
+		// Spread the vectors over the CPUs such that the completions of different
+		// queues are handled in parallel. Failure is not fatal, not all IRQ
+		// controllers support affinity.
+		auto num_cpus = std::max(std::thread::hardware_concurrency(), 1u);
+		for(unsigned int i = 0; i < _queueMsis.size(); i++) {
+			if(_msiQueues[i].empty())
+				continue;
+			helSetIrqAffinity(_queueMsis[i].getHandle(), i % num_cpus);
+			_processQueueMsi(i);
+		}
+	}
 	_processIrqs();
 }
 
@@ -562,16 +667,18 @@ async::detached StandardPciTransport::_processIrqs() {
 #endif
 }
 
-async::detached StandardPciTransport::_processQueueMsi() {
+async::detached StandardPciTransport::_processQueueMsi(unsigned int vector) {
+	auto &msi = _queueMsis[vector];
 	uint64_t sequence = 0;
 	while(true) {
-		auto await = co_await helix_ng::awaitEvent(_queueMsi, sequence);
+		auto await = co_await helix_ng::awaitEvent(msi, sequence);
 		HEL_CHECK(await.error());
 		sequence = await.sequence();
 
-		HEL_CHECK(helAcknowledgeIrq(_queueMsi.getHandle(), kHelAckAcknowledge, sequence));
+		HEL_CHECK(helAcknowledgeIrq(msi.getHandle(), kHelAckAcknowledge, sequence));
 
-		for(auto &queue : _queues)
+		// Only the queues that are bound to this vector can have completions.
+		for(auto queue : _msiQueues[vector])
 			queue->processInterrupt();
 	}
 }
@@ -579,8 +686,16 @@ async::detached StandardPciTransport::_processQueueMsi() {
 StandardPciQueue::StandardPciQueue(StandardPciTransport *transport,
 		unsigned int queue_index, size_t queue_size,
 		spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
+		bool event_index, arch::scalar_register<uint16_t> notify_register)
+: Queue{queue_index, queue_size, table, available, used, event_index},
+		_transport{transport}, _notifyRegister{notify_register} { }
+
+StandardPciQueue::StandardPciQueue(StandardPciTransport *transport,
+		unsigned int queue_index, size_t queue_size,
+		spec::PackedDescriptor *ring, spec::EventSuppression *driver_event,
+		spec::EventSuppression *device_event, bool event_index, bool in_order,
 		arch::scalar_register<uint16_t> notify_register)
-: Queue{queue_index, queue_size, table, available, used},
+: Queue{queue_index, queue_size, ring, driver_event, device_event, event_index, in_order},
 		_transport{transport}, _notifyRegister{notify_register} { }
 
 void StandardPciQueue::notifyTransport() {
@@ -642,12 +757,15 @@ discover(protocols::hw::Device hw_device, DiscoverMode mode) {
 			common_space.store(PCI_DEVICE_STATUS, 0);
 			assert(!common_space.load(PCI_DEVICE_STATUS));
 
-			helix::UniqueDescriptor queueMsi;
+			std::vector<helix::UniqueDescriptor> queue_msis;
 
-			// Enable MSI-X.
+			// Enable MSI-X. The number of queues is not known yet, hence we
+			// allocate as many vectors as the device supports (up to a limit).
 			if (info.numMsis) {
+				constexpr unsigned int maxQueueMsis = 32;
 				co_await hw_device.enableMsi();
-				queueMsi = co_await hw_device.installMsi(0);
+				for(unsigned int i = 0; i < std::min(info.numMsis, maxQueueMsis); i++)
+					queue_msis.push_back(co_await hw_device.installMsi(i));
 			}
 
 			// Set the ACKNOWLEDGE and DRIVER bits.
@@ -659,10 +777,9 @@ discover(protocols::hw::Device hw_device, DiscoverMode mode) {
 
 			std::cout << "virtio: Using standard PCI transport" << std::endl;
 			co_return std::make_unique<StandardPciTransport>(std::move(hw_device),
-					info.numMsis,
 					std::move(*common_mapping), std::move(*notify_mapping),
 					std::move(*isr_mapping), std::move(*device_mapping),
-					notify_multiplier, std::move(irq), std::move(queueMsi));
+					notify_multiplier, std::move(irq), std::move(queue_msis));
 		}
 	}
 
@@ -706,8 +823,7 @@ Handle::Handle(Queue *queue, size_t table_index)
 void Handle::setupBuffer(HostToDeviceType, arch::dma_buffer_view view) {
 	assert(view.size());
 
-	uintptr_t physical;
-	HEL_CHECK(helPointerPhysical(view.data(), &physical));
+	auto physical = dma_core::physicalOf(view.data());
 
 	auto descriptor = _queue->_table + _tableIndex;
 	descriptor->address.store(physical);
@@ -717,8 +833,7 @@ void Handle::setupBuffer(HostToDeviceType, arch::dma_buffer_view view) {
 void Handle::setupBuffer(DeviceToHostType, arch::dma_buffer_view view) {
 	assert(view.size());
 
-	uintptr_t physical;
-	HEL_CHECK(helPointerPhysical(view.data(), &physical));
+	auto physical = dma_core::physicalOf(view.data());
 
 	auto descriptor = _queue->_table + _tableIndex;
 	descriptor->address.store(physical);
@@ -732,6 +847,62 @@ void Handle::setupLink(Handle other) {
 	descriptor->flags.store(descriptor->flags.load() | VIRTQ_DESC_F_NEXT);
 }
 
+void Handle::setupIndirect(IndirectChain &chain) {
+	assert(chain.size());
+
+	auto physical = dma_core::physicalOf(chain.table());
+
+	// Packed virtqs expect indirect tables in the packed format. The entries are
+	// consumed in table order, hence only the WRITE flag needs to be preserved.
+	if(_queue->_packed) {
+		for(size_t i = 0; i < chain.size(); i++) {
+			auto entry = reinterpret_cast<spec::PackedDescriptor *>(chain.table() + i);
+			auto flags = chain.table()[i].flags.load() & VIRTQ_DESC_F_WRITE;
+			entry->id.store(0);
+			entry->flags.store(flags);
+		}
+	}
+
+	auto descriptor = _queue->_table + _tableIndex;
+	descriptor->address.store(physical);
+	descriptor->length.store(chain.size() * sizeof(spec::Descriptor));
+	descriptor->flags.store(VIRTQ_DESC_F_INDIRECT);
+}
+
+// --------------------------------------------------------
+// IndirectChain
+// --------------------------------------------------------
+
+spec::Descriptor *IndirectChain::_append(arch::dma_buffer_view view) {
+	assert(view.size());
+	assert(_numEntries < _maxEntries);
+
+	auto physical = dma_core::physicalOf(view.data());
+
+	// Link the previous entry to the new one.
+	if(_numEntries) {
+		auto previous = _table + (_numEntries - 1);
+		previous->next.store(_numEntries);
+		previous->flags.store(previous->flags.load() | VIRTQ_DESC_F_NEXT);
+	}
+
+	auto descriptor = _table + _numEntries++;
+	descriptor->address.store(physical);
+	descriptor->length.store(view.size());
+	descriptor->flags.store(0);
+	descriptor->next.store(0);
+	return descriptor;
+}
+
+void IndirectChain::setupBuffer(HostToDeviceType, arch::dma_buffer_view view) {
+	_append(view);
+}
+
+void IndirectChain::setupBuffer(DeviceToHostType, arch::dma_buffer_view view) {
+	auto descriptor = _append(view);
+	descriptor->flags.store(VIRTQ_DESC_F_WRITE);
+}
+
 async::result<void> scatterGather(HostToDeviceType, Chain &chain, Queue *queue,
 		arch::dma_buffer_view view) {
 	constexpr size_t page_size = 0x1000;
@@ -758,13 +929,36 @@ async::result<void> scatterGather(DeviceToHostType, Chain &chain, Queue *queue,
 	}
 }
 
+void scatterGather(HostToDeviceType, IndirectChain &chain, arch::dma_buffer_view view) {
+	constexpr size_t page_size = 0x1000;
+	size_t offset = 0;
+	while(offset < view.size()) {
+		auto address = reinterpret_cast<uintptr_t>(view.data()) + offset;
+		auto chunk = std::min(view.size() - offset, page_size - (address & (page_size - 1)));
+		chain.setupBuffer(hostToDevice, view.subview(offset, chunk));
+		offset += chunk;
+	}
+}
+
+void scatterGather(DeviceToHostType, IndirectChain &chain, arch::dma_buffer_view view) {
+	constexpr size_t page_size = 0x1000;
+	size_t offset = 0;
+	while(offset < view.size()) {
+		auto address = reinterpret_cast<uintptr_t>(view.data()) + offset;
+		auto chunk = std::min(view.size() - offset, page_size - (address & (page_size - 1)));
+		chain.setupBuffer(deviceToHost, view.subview(offset, chunk));
+		offset += chunk;
+	}
+}
+
 // --------------------------------------------------------
 // Queue
 // --------------------------------------------------------
 
 Queue::Queue(unsigned int queue_index, size_t queue_size, spec::Descriptor *table,
-		spec::AvailableRing *available, spec::UsedRing *used)
-: _queueIndex{queue_index}, _queueSize{queue_size}, _progressHead{0} {
+		spec::AvailableRing *available, spec::UsedRing *used, bool event_index)
+: _queueIndex{queue_index}, _queueSize{queue_size}, _packed{false}, _progressHead{0},
+		_useEventIndex{event_index}, _notifiedHead{0} {
 	// Construct the hardware state.
 	_table = new (table) spec::Descriptor[_queueSize];
 	_availableRing = new (available) spec::AvailableRing;
@@ -793,9 +987,43 @@ Queue::Queue(unsigned int queue_index, size_t queue_size, spec::Descriptor *tabl
 	_activeRequests.resize(_queueSize);
 }
 
+Queue::Queue(unsigned int queue_index, size_t queue_size, spec::PackedDescriptor *ring,
+		spec::EventSuppression *driver_event, spec::EventSuppression *device_event,
+		bool event_index, bool in_order)
+: _queueIndex{queue_index}, _queueSize{queue_size}, _packed{true},
+		_shadowTable(queue_size), _inOrder{in_order}, _progressHead{0},
+		_useEventIndex{event_index}, _notifiedHead{0} {
+	assert(queue_size <= 0x8000);
+
+	// Construct the hardware state. Descriptors with cleared AVAIL and USED bits
+	// are neither available nor used for the initial wrap counters.
+	_ring = new (ring) spec::PackedDescriptor[_queueSize];
+	_driverEvent = new (driver_event) spec::EventSuppression;
+	_deviceEvent = new (device_event) spec::EventSuppression;
+
+	for(size_t i = 0; i < _queueSize; i++) {
+		_ring[i].address.store(0);
+		_ring[i].length.store(0);
+		_ring[i].id.store(0);
+		_ring[i].flags.store(0);
+	}
+	_driverEvent->offWrap.store(0x8000);
+	_driverEvent->flags.store(_useEventIndex ? RING_EVENT_FLAGS_DESC : RING_EVENT_FLAGS_ENABLE);
+
+	// Construct the software state.
+	_table = _shadowTable.data();
+	for(size_t i = 0; i < _queueSize; i++)
+		_descriptorStack.push_back(i);
+	_activeRequests.resize(_queueSize);
+}
+
 async::result<Handle> Queue::obtainDescriptor() {
 	while(true) {
 		if(_descriptorStack.empty()) {
+			// Descriptors are only returned once the device sees them,
+			// hence we must not keep posted descriptors unnotified while we wait.
+			if(_packed ? _numAdded : _availableRing->headIndex.load() != _notifiedHead)
+				notify();
 			co_await _descriptorDoorbell.async_wait();
 			continue;
 		}
@@ -820,6 +1048,11 @@ void Queue::postDescriptor(Handle handle, Request *request,
 	assert(!_activeRequests[handle.tableIndex()]);
 	_activeRequests[handle.tableIndex()] = request;
 
+	if(_packed) {
+		_postPacked(handle);
+		return;
+	}
+
 	auto enqueue_head = _availableRing->headIndex.load();
 	auto ring_index = enqueue_head & (_queueSize - 1);
 	_availableRing->elements[ring_index].tableIndex.store(handle.tableIndex());
@@ -829,17 +1062,49 @@ void Queue::postDescriptor(Handle handle, Request *request,
 }
 
 void Queue::notify() {
-	asm volatile ( "" : : : "memory" );
-	if(!(_usedRing->flags.load() & VIRTQ_USED_F_NO_NOTIFY))
+	if(_packed) {
+		_notifyPacked();
+		return;
+	}
+
+	auto new_head = _availableRing->headIndex.load();
+	auto old_head = std::exchange(_notifiedHead, new_head);
+
+	// The device must observe the new headIndex before we read its event index / flags.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if(_useEventIndex) {
+		// Notify iff the device's event index lies in [old_head, new_head),
+		// i.e., the device asked to be notified for one of the new descriptors.
+		uint16_t event = _usedExtra->eventIndex.load();
+		if(static_cast<uint16_t>(new_head - event - 1) < static_cast<uint16_t>(new_head - old_head))
+			notifyTransport();
+	}else if(!(_usedRing->flags.load() & VIRTQ_USED_F_NO_NOTIFY)) {
 		notifyTransport();
+	}
 }
 
 void Queue::processInterrupt() {
+	if(_packed) {
+		_processPacked();
+		return;
+	}
+
 	while(true) {
 		auto used_head = _usedRing->headIndex.load();
 
-		if((_progressHead & 0xFFFF) == used_head)
-			break;
+		if((_progressHead & 0xFFFF) == used_head) {
+			if(!_useEventIndex)
+				break;
+
+			// Ask for an interrupt on the next used entry. Re-check the used ring
+			// afterwards, as the device might have added entries in the meantime.
+			_availableExtra->eventIndex.store(_progressHead);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if((_progressHead & 0xFFFF) == _usedRing->headIndex.load())
+				break;
+			continue;
+		}
 
 		asm volatile ( "" : : : "memory" );
 
@@ -851,15 +1116,10 @@ void Queue::processInterrupt() {
 		auto request = _activeRequests[table_index];
 		assert(request);
 		_activeRequests[table_index] = nullptr;
+		request->bytesWritten = _usedRing->elements[ring_index].written.load();
 
 		// Free all descriptors in the descriptor chain.
-		auto chain_index = table_index;
-		while(_table[chain_index].flags.load() & VIRTQ_DESC_F_NEXT) {
-			auto successor = _table[chain_index].next.load();
-			_descriptorStack.push_back(chain_index);
-			chain_index = successor;
-		}
-		_descriptorStack.push_back(chain_index);
+		_freeChain(table_index);
 		_descriptorDoorbell.raise();
 
 		// Call the completion handler.
@@ -869,5 +1129,169 @@ void Queue::processInterrupt() {
 	}
 }
 
+size_t Queue::_freeChain(size_t table_index) {
+	size_t n = 1;
+	auto chain_index = table_index;
+	while(_table[chain_index].flags.load() & VIRTQ_DESC_F_NEXT) {
+		auto successor = _table[chain_index].next.load();
+		_descriptorStack.push_back(chain_index);
+		chain_index = successor;
+		n++;
+	}
+	_descriptorStack.push_back(chain_index);
+	return n;
+}
+
+void Queue::_postPacked(Handle handle) {
+	auto head = handle.tableIndex();
+	auto position = _availPosition;
+	auto wrap = _availWrap;
+
+	// Copy the chain to the ring. The head is made available last, such that
+	// the device never observes a partial chain.
+	uint16_t head_flags = 0;
+	size_t n = 0;
+	auto chain_index = head;
+	while(true) {
+		auto &source = _table[chain_index];
+		auto &descriptor = _ring[position];
+		auto source_flags = source.flags.load();
+
+		uint16_t flags = source_flags
+				& (VIRTQ_DESC_F_NEXT | VIRTQ_DESC_F_WRITE | VIRTQ_DESC_F_INDIRECT);
+		flags |= wrap ? VIRTQ_DESC_F_AVAIL : VIRTQ_DESC_F_USED;
+
+		descriptor.address.store(source.address.load());
+		descriptor.length.store(source.length.load());
+		descriptor.id.store(head);
+		if(n) {
+			descriptor.flags.store(flags);
+		}else{
+			head_flags = flags;
+		}
+		n++;
+
+		if(++position == _queueSize) {
+			position = 0;
+			wrap = !wrap;
+		}
+		if(!(source_flags & VIRTQ_DESC_F_NEXT))
+			break;
+		chain_index = source.next.load();
+	}
+
+	std::atomic_thread_fence(std::memory_order_release);
+	_ring[_availPosition].flags.store(head_flags);
+
+	_availPosition = position;
+	_availWrap = wrap;
+	_numAdded += n;
+	if(_inOrder)
+		_postedHeads.push_back(head);
+}
+
+void Queue::_notifyPacked() {
+	auto added = std::exchange(_numAdded, 0);
+
+	// The device must observe the new descriptors before we read its event suppression.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	auto flags = _deviceEvent->flags.load();
+	if(flags == RING_EVENT_FLAGS_DISABLE)
+		return;
+
+	if(flags == RING_EVENT_FLAGS_DESC && _useEventIndex) {
+		// Same check as for split virtqs; the event offset is relative to the wrap
+		// counter that the device specified.
+		auto off_wrap = _deviceEvent->offWrap.load();
+		uint16_t event = off_wrap & 0x7FFF;
+		bool event_wrap = off_wrap >> 15;
+		if(event_wrap != _availWrap)
+			event -= _queueSize;
+
+		uint16_t new_head = _availPosition;
+		uint16_t old_head = new_head - added;
+		if(static_cast<uint16_t>(new_head - event - 1) < static_cast<uint16_t>(new_head - old_head))
+			notifyTransport();
+		return;
+	}
+
+	notifyTransport();
+}
+
+void Queue::_processPacked() {
+	while(true) {
+		auto &descriptor = _ring[_usedPosition];
+		auto flags = descriptor.flags.load();
+
+		// Used descriptors have both bits equal to the used wrap counter.
+		bool avail = flags & VIRTQ_DESC_F_AVAIL;
+		bool used = flags & VIRTQ_DESC_F_USED;
+		if(avail != _usedWrap || used != _usedWrap) {
+			if(!_useEventIndex)
+				break;
+
+			// Ask for an interrupt on the next used descriptor. Re-check the ring
+			// afterwards, as the device might have used descriptors in the meantime.
+			_driverEvent->offWrap.store(_usedPosition | (uint16_t{_usedWrap} << 15));
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			flags = descriptor.flags.load();
+			if(bool(flags & VIRTQ_DESC_F_AVAIL) != _usedWrap
+					|| bool(flags & VIRTQ_DESC_F_USED) != _usedWrap)
+				break;
+			continue;
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		auto id = descriptor.id.load();
+		auto written = descriptor.length.load();
+		assert(id < _queueSize);
+
+		auto complete = [&] (uint16_t head, size_t bytes_written) {
+			auto request = _activeRequests[head];
+			assert(request);
+			_activeRequests[head] = nullptr;
+			request->bytesWritten = bytes_written;
+
+			// The device skips over all descriptors of the chain.
+			_usedPosition += _freeChain(head);
+			if(_usedPosition >= _queueSize) {
+				_usedPosition -= _queueSize;
+				_usedWrap = !_usedWrap;
+			}
+
+			request->complete(request);
+		};
+
+		if(_inOrder) {
+			// The device may only report the last buffer of a batch; all buffers that were
+			// posted before it are complete as well. Like Linux, we assume that the device
+			// filled their device-writable descriptors completely.
+			while(true) {
+				assert(!_postedHeads.empty());
+				auto head = _postedHeads.front();
+				_postedHeads.pop_front();
+				if(head == id)
+					break;
+
+				size_t capacity = 0;
+				auto chain_index = head;
+				while(true) {
+					auto chain_flags = _table[chain_index].flags.load();
+					if(chain_flags & VIRTQ_DESC_F_WRITE)
+						capacity += _table[chain_index].length.load();
+					if(!(chain_flags & VIRTQ_DESC_F_NEXT))
+						break;
+					chain_index = _table[chain_index].next.load();
+				}
+				complete(head, capacity);
+			}
+		}
+		complete(id, written);
+		_descriptorDoorbell.raise();
+	}
+}
+
 } // namespace virtio_core
 
@@ -33,7 +33,8 @@ void Command::notifyCompletion() {
 	event_.raise();
 }
 
-void Command::prepare(commandTable& table, commandHeader& header) {
+void Command::prepare(commandTable& table, commandHeader& header,
+		std::optional<uint8_t> queueTag) {
 	auto tablePhys = helix::ptrToPhysical(&table);
 	assert(tablePhys < std::numeric_limits<uint32_t>::max() &&
 			numSectors_ < std::numeric_limits<uint16_t>::max());
@@ -51,7 +52,9 @@ void Command::prepare(commandTable& table, commandHeader& header) {
 	table.commandFis.lba5 = (sector_ >> 40) & 0xFF;
 	table.commandFis.sectorCount = static_cast<uint16_t>(numSectors_);
 
-	auto numEntries = writeScatterGather_(table);
+	size_t numEntries = 0;
+	if (numBytes_)
+		numEntries = writeScatterGather_(table);
 
 	memset(&header, 0, sizeof(commandHeader));
 	header.configBytes[0] = sizeof(fisH2D) / 4; // Supply length in words
@@ -61,17 +64,49 @@ void Command::prepare(commandTable& table, commandHeader& header) {
 	header.ctBase = static_cast<uint32_t>(helix::ptrToPhysical(&table));
 	header.ctBaseUpper = 0;
 
+	if (queueTag) {
+		assert(isQueueable() && *queueTag < limits::maxCmdSlots);
+
+		// FPDMA QUEUED commands carry the sector count in the features registers
+		// and the tag in bits 7:3 of the count register.
+		table.commandFis.features = numSectors_ & 0xFF;
+		table.commandFis.featuresUpper = (numSectors_ >> 8) & 0xFF;
+		table.commandFis.sectorCount = *queueTag << 3;
+	}
+
 	switch (type_) {
 		case CommandType::read:
-			table.commandFis.command = 0x25; // READ DMA EXT
+			// READ FPDMA QUEUED or READ DMA EXT
+			table.commandFis.command = queueTag ? 0x60 : 0x25;
 			break;
 		case CommandType::write:
-			table.commandFis.command = 0x35; // WRITE DMA EXT
+			// WRITE FPDMA QUEUED or WRITE DMA EXT
+			table.commandFis.command = queueTag ? 0x61 : 0x35;
 			header.configBytes[0] |= 1 << 6; // Indicates we are writing
 			break;
+		case CommandType::writeFua:
+			// WRITE FPDMA QUEUED with the FUA bit or WRITE DMA FUA EXT
+			if (queueTag)
+				table.commandFis.devHead |= 1 << 7;
+			table.commandFis.command = queueTag ? 0x61 : 0x3D;
+			header.configBytes[0] |= 1 << 6;
+			break;
+		case CommandType::flush:
+			table.commandFis.command = 0xEA; // FLUSH CACHE EXT
+			break;
+		case CommandType::trim:
+			// DATA SET MANAGEMENT; the count register holds the number of 512 byte blocks
+			// of LBA range entries.
+			table.commandFis.command = 0x06;
+			table.commandFis.features = 1; // TRIM
+			header.configBytes[0] |= 1 << 6;
+			break;
 		case CommandType::identify:
 			table.commandFis.command = 0xEC; // IDENTIFY DEVICE
 			break;
+		case CommandType::readLogExt:
+			table.commandFis.command = 0x2F; // READ LOG EXT
+			break;
 		default:
 			assert(!"unknown command type");
 	}
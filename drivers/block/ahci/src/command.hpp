@@ -1,5 +1,7 @@
 #pragma once
 
+#include <optional>
+
 #include <async/oneshot-event.hpp>
 
 #include "spec.hpp"
@@ -7,7 +9,14 @@
 enum class CommandType {
 	read,
 	write,
-	identify
+	// Write that completes once the data is on stable storage.
+	writeFua,
+	flush,
+	// DATA SET MANAGEMENT with the TRIM bit; the buffer holds LBA range entries.
+	trim,
+	identify,
+	// READ LOG EXT of a single 512 byte page; the sector is the log address.
+	readLogExt
 };
 
 struct Command {
@@ -22,9 +31,22 @@ public:
 		assert(type == CommandType::identify);
 	}
 
-	void prepare(commandTable& table, commandHeader& header);
+	// Only reads and writes can be issued as NCQ commands.
+	bool isQueueable() const {
+		return type_ == CommandType::read || type_ == CommandType::write
+				|| type_ == CommandType::writeFua;
+	}
+
+	// If queueTag is set, the command is issued as an NCQ command using that tag.
+	void prepare(commandTable& table, commandHeader& header,
+			std::optional<uint8_t> queueTag = std::nullopt);
 	void notifyCompletion(); 
 
+	// Returns the number of times the command was reissued after an error.
+	unsigned int noteRetry() {
+		return ++numRetries_;
+	}
+
 	auto getFuture() {
 		return event_.wait();
 	}
@@ -38,6 +60,7 @@ private:
 	size_t numBytes_;
 	void *buffer_;
 	CommandType type_;
+	unsigned int numRetries_ = 0;
 	async::oneshot_event event_;
 };
 
@@ -47,8 +70,16 @@ constexpr const char *cmdTypeToString(CommandType type) {
 			return "read";
 		case CommandType::write:
 			return "write";
+		case CommandType::writeFua:
+			return "FUA write";
+		case CommandType::flush:
+			return "flush";
+		case CommandType::trim:
+			return "trim";
 		case CommandType::identify:
 			return "identify";
+		case CommandType::readLogExt:
+			return "read log";
 		default:
 			assert(!"unknown command type");
 	}
@@ -31,6 +31,7 @@ namespace flags {
 
 	namespace cap {
 		constexpr int supports64Bit   = 1 << 31;
+		constexpr int supportsNcq     = 1 << 30;
 		constexpr int staggeredSpinup = 1 << 27;
 	}
 
@@ -101,13 +102,14 @@ async::detached Controller::run() {
 	auto iss = (cap >> 20) & 0xF;
 	bool ss = cap & flags::cap::staggeredSpinup;
 	bool s64a = cap & flags::cap::supports64Bit;
+	bool sncq = cap & flags::cap::supportsNcq;
 	assert(s64a); // TODO: We aren't allowed to read some fields if no 64-bit support
 
 	printf("block/ahci: Initialised controller: version %x, %d active ports, "
-			"%d slots, Gen %d, SS %s, 64-bit %s\n", version, std::popcount(portsImpl_),
-			numCommandSlots, iss, ss ? "yes" : "no", s64a ? "yes" : "no");
+			"%d slots, Gen %d, SS %s, 64-bit %s, NCQ %s\n", version, std::popcount(portsImpl_),
+			numCommandSlots, iss, ss ? "yes" : "no", s64a ? "yes" : "no", sncq ? "yes" : "no");
 
-	if (!(co_await initPorts_(numCommandSlots, ss))) {
+	if (!(co_await initPorts_(numCommandSlots, ss, sncq))) {
 		std::cout << "\e[31mblock/ahci: No ports found, exiting\e[39m\n";
 		co_return;
 	}
@@ -145,7 +147,7 @@ async::detached Controller::handleIrqs_() {
 		auto intStatus = regs_.load(regs::interruptStatus) & portsImpl_;
 		if (intStatus) {
 			for (auto& port : activePorts_) {
-				if (intStatus & (1 << port->getIndex())) {
+				if (intStatus & (1u << port->getIndex())) {
 					port->handleIrq();
 				}
 			}
@@ -158,11 +160,12 @@ async::detached Controller::handleIrqs_() {
 	}
 }
 
-async::result<bool> Controller::initPorts_(size_t numCommandSlots, bool ss) {
+async::result<bool> Controller::initPorts_(size_t numCommandSlots, bool ss, bool ncq) {
 	for (int i = 0; i < maxPorts_; i++) {
 		if (portsImpl_ & (1 << i)) {
 			auto offset = 0x100 + i * 0x80;
-			auto port = std::make_unique<Port>(i, numCommandSlots, ss, regs_.subspace(offset));
+			auto port = std::make_unique<Port>(i, numCommandSlots, ss, ncq,
+					regs_.subspace(offset));
 
 			if (co_await port->init())
 				activePorts_.push_back(std::move(port));
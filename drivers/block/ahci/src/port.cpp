@@ -1,3 +1,5 @@
+#include <bit>
+#include <cstring>
 #include <inttypes.h>
 
 #include <helix/memory.hpp>
@@ -15,7 +17,9 @@ namespace regs {
 	constexpr arch::scalar_register<uint32_t> commandAndStatus{0x18}; 
 	constexpr arch::scalar_register<uint32_t> tfd{0x20}; 
 	constexpr arch::scalar_register<uint32_t> status{0x28}; 
+	constexpr arch::scalar_register<uint32_t> sControl{0x2C};
 	constexpr arch::scalar_register<uint32_t> sErr{0x30};
+	constexpr arch::scalar_register<uint32_t> sActive{0x34};
 	constexpr arch::scalar_register<uint32_t> commandIssue{0x38}; 
 }
 
@@ -35,24 +39,44 @@ namespace flags {
 		constexpr int hostDataError   = 1 << 28;
 		constexpr int ifFatalError    = 1 << 27;
 		constexpr int ifNonFatalError = 1 << 26;
+		constexpr int setDeviceBits   = 1 << 3;
 		constexpr int d2hFis          = 1;
 	}
 
 	namespace tfd {
 		constexpr int bsy = 1 << 7;
 		constexpr int drq = 1 << 3;
+		constexpr int err = 1;
+	}
+
+	namespace ncqErrorLog {
+		// Set if the error was caused by a non-queued command.
+		constexpr uint8_t nonQueued = 1 << 7;
+		constexpr uint8_t tagMask   = 0x1F;
 	}
 }
 
 namespace {
 	constexpr size_t sectorSize = 512;
 	constexpr bool logCommands  = false;
+
+	// Upper bound on the size of the LBA range list of a TRIM (in 512 byte blocks).
+	constexpr size_t maxTrimBlocks = 8;
+	// Each LBA range entry covers up to this many sectors.
+	constexpr size_t maxSectorsPerTrimRange = 0xFFFF;
+
+	// Number of times a failing command is reissued before giving up.
+	constexpr unsigned int maxRetries = 3;
+	// Log address of the NCQ Command Error log (SATA 3.2 spec: 13.7.4).
+	constexpr uint64_t ncqErrorLogAddress = 0x10;
 }
 
 // TODO: We can use a more appropriate block size, but this breaks other parts of the OS.
-Port::Port(int portIndex, size_t numCommandSlots, bool staggeredSpinUp, arch::mem_space regs)
-	: BlockDevice{::sectorSize},  regs_{regs}, numCommandSlots_{numCommandSlots},
-	commandsInFlight_{0}, portIndex_{portIndex}, staggeredSpinUp_{staggeredSpinUp} {
+Port::Port(int portIndex, size_t numCommandSlots, bool staggeredSpinUp, bool hbaSupportsNcq,
+		arch::mem_space regs)
+	: BlockDevice{::sectorSize},  regs_{regs}, submittedMask_{0}, numCommandSlots_{numCommandSlots},
+	commandsInFlight_{0}, portIndex_{portIndex}, staggeredSpinUp_{staggeredSpinUp},
+	hbaSupportsNcq_{hbaSupportsNcq}, useNcq_{false} {
 
 }
 
@@ -142,8 +166,7 @@ async::detached Port::run() {
 
 	// Start port (10.3.1)
 	assert(!(regs_.load(regs::commandAndStatus) & flags::cmd::cmdListRunning));
-	cas = regs_.load(regs::commandAndStatus);
-	regs_.store(regs::commandAndStatus, cas | flags::cmd::start);
+	start_();
 
 	size_t slot = co_await findFreeSlot_();
 
@@ -151,11 +174,11 @@ async::detached Port::run() {
 	Command cmd = Command(identify.data(), CommandType::identify);
 	cmd.prepare(commandTables_[slot], commandList_->slots[slot]);
 
-	regs_.store(regs::commandIssue, 1 << slot);
+	regs_.store(regs::commandIssue, 1u << slot);
 
 	// Just poll for completion for simplicity
 	auto success = co_await helix::kindaBusyWait(500'000'000,
-			[&](){ return !(regs_.load(regs::commandIssue) & (1 << slot)); });
+			[&](){ return !(regs_.load(regs::commandIssue) & (1u << slot)); });
 	assert(success);
 
 	assert(identify->supportsLba48());
@@ -163,9 +186,23 @@ async::detached Port::run() {
 	auto sectorCount = identify->maxLBA48;
 	auto model = identify->getModel();
 
+	// Use NCQ if both the HBA and the device support it. The device may accept
+	// fewer outstanding commands than the HBA has slots.
+	useNcq_ = hbaSupportsNcq_ && identify->supportsNcq();
+	if (useNcq_)
+		numCommandSlots_ = std::min(numCommandSlots_, identify->getQueueDepth());
+
+	supportsFlush_ = identify->supportsWriteCache() && identify->supportsFlushExt();
+	supportsFua_ = useNcq_ || identify->supportsFuaExt();
+	supportsTrim_ = identify->supportsTrim();
+	maxTrimBlocks_ = std::min(identify->getMaxDsmBlocks(), maxTrimBlocks);
+
 	printf("block/ahci: Started port %d, model %s, logical sector size %zu, "
-			"physical sector size %zu, sector count %" PRIu64 "\n",
-			portIndex_, model.c_str(), logicalSize, physicalSize, sectorCount);
+			"physical sector size %zu, sector count %" PRIu64 ", NCQ %s, %zu slots, "
+			"flush %s, TRIM %s\n",
+			portIndex_, model.c_str(), logicalSize, physicalSize, sectorCount,
+			useNcq_ ? "yes" : "no", numCommandSlots_,
+			supportsFlush_ ? "yes" : "no", supportsTrim_ ? "yes" : "no");
 	assert(logicalSize == 512 && "block/ahci: logical sector size > 512 is not supported");
 
 	// Clear errors
@@ -177,6 +214,7 @@ async::detached Port::run() {
 	auto ie = regs_.load(regs::interruptEnable);
 	regs_.store(regs::interruptEnable, ie
 			| flags::is::d2hFis
+			| flags::is::setDeviceBits
 			| flags::is::taskFileError
 			| flags::is::hostDataError
 			| flags::is::hostFatalError
@@ -200,43 +238,60 @@ async::result<size_t> Port::findFreeSlot_() {
 
 	// We can't look at CI here, as the HBA might clear it before we have
 	// a chance to notify completion, so the array slot will still be occupied.
-	// TODO: We could use a bitmask and CLZ for this.
-	for (size_t i = 0; i < numCommandSlots_; i++) {
-		if (!submittedCmds_[i]) {
-			co_return i;
-		}
-	}
-
-	assert(!"commandsInFlight < numCommandSlots, but submission queue was full");
-	co_return 0;
+	auto slot = std::countr_one(submittedMask_);
+	assert(static_cast<size_t>(slot) < numCommandSlots_
+			&& "commandsInFlight < numCommandSlots, but submission queue was full");
+	co_return slot;
 }
 
 void Port::handleIrq() {
 	auto is = regs_.load(regs::interruptStatus);
 
 	// Check errors
-	// TODO: Make this more robust (log non-fatal errors, try to recover, print more state etc.)
-	if (is & (flags::is::hostFatalError | flags::is::ifFatalError)) {
+	if (is & flags::is::hostFatalError) {
 		printf("\e[31mblock/ahci: Port %d encountered fatal error, PxIS = %u, PxSERR = %u\e[39m\n",
 				portIndex_, is, regs_.load(regs::sErr));
 		abort();
 	}
 
+	// The HBA stops processing commands on task file and interface fatal errors.
+	// recover_() restarts the port and notifies the commands afterwards.
+	if (recovering_) {
+		regs_.store(regs::interruptStatus, is);
+		return;
+	}
+	if (is & (flags::is::taskFileError | flags::is::ifFatalError)) {
+		recovering_ = true;
+		recover_(is);
+		return;
+	}
+
 	if (logCommands) {
 		printf("block/ahci: Port %d handling IRQ: PxIS %x, PxIE %x, TFD %x, CI %x, CAS %x\n",
 				portIndex_, is, regs_.load(regs::interruptEnable), regs_.load(regs::tfd),
 				regs_.load(regs::commandIssue), regs_.load(regs::commandAndStatus));
 	}
 
-	// Notify all completed commands
-	auto numCompleted = 0;
-	auto cmdActiveMask = regs_.load(regs::commandIssue);
-	for (size_t i = 0; i < numCommandSlots_; i++) {
-		if (submittedCmds_[i] && !(cmdActiveMask & (1 << i))) {
-			Command *cmd = std::exchange(submittedCmds_[i], nullptr);
-			cmd->notifyCompletion();
-			numCompleted++;
-		}
+	// Notify all completed commands. NCQ commands are outstanding until the device
+	// clears their bit in SActive (via a Set Device Bits FIS), while the HBA
+	// clears CI once a command was transferred. Non-queued commands only use CI.
+	completeCommands_(regs_.load(regs::sActive) | regs_.load(regs::commandIssue));
+
+	// Acknowledge the interrupt
+	regs_.store(regs::interruptStatus, is);
+}
+
+void Port::completeCommands_(uint32_t activeMask) {
+	auto completedMask = submittedMask_ & ~activeMask;
+	auto numCompleted = std::popcount(completedMask);
+	submittedMask_ &= ~completedMask;
+	while (completedMask) {
+		auto i = std::countr_zero(completedMask);
+		completedMask &= completedMask - 1;
+
+		Command *cmd = std::exchange(submittedCmds_[i], nullptr);
+		assert(cmd);
+		cmd->notifyCompletion();
 	}
 
 	// If the buffer has gone from full to not full, wake the tasks waiting for a free slot.
@@ -247,9 +302,136 @@ void Port::handleIrq() {
 	}
 
 	commandsInFlight_ -= numCompleted;
+	if (!commandsInFlight_ && numCompleted > 0)
+		idleDoorbell_.raise();
+}
 
-	// Acknowledge the interrupt
-	regs_.store(regs::interruptStatus, is);
+// Software error recovery (AHCI spec: 6.2.2).
+async::detached Port::recover_(uint32_t is) {
+	auto tfd = regs_.load(regs::tfd);
+	auto activeMask = regs_.load(regs::sActive) | regs_.load(regs::commandIssue);
+	auto ncqMask = regs_.load(regs::sActive) & submittedMask_;
+	// PxCMD.CCS holds the slot of the failing non-queued command.
+	auto currentSlot = (regs_.load(regs::commandAndStatus) >> 8) & 0x1F;
+	printf("\e[31mblock/ahci: Port %d encountered error, PxIS = %x, PxTFD = %x, PxSERR = %x, "
+			"PxCI = %x, PxSACT = %x\e[39m\n", portIndex_, is, tfd, regs_.load(regs::sErr),
+			regs_.load(regs::commandIssue), regs_.load(regs::sActive));
+
+	// Commands that are no longer active completed before the error.
+	completeCommands_(activeMask);
+
+	// Clearing PxCMD.ST also clears PxCI and PxSACT.
+	if (!(co_await stop_())) {
+		printf("\e[31mblock/ahci: Port %d failed to stop\e[39m\n", portIndex_);
+		abort();
+	}
+	regs_.store(regs::sErr, ~0u);
+	regs_.store(regs::interruptStatus, ~0u);
+
+	bool didReset = false;
+	if ((tfd & flags::tfd::bsy) || (tfd & flags::tfd::drq)) {
+		if (!(co_await reset_())) {
+			printf("\e[31mblock/ahci: Port %d failed to reset\e[39m\n", portIndex_);
+			abort();
+		}
+		didReset = true;
+	}
+	start_();
+
+	// After an NCQ error, the device aborts all outstanding commands and rejects new
+	// ones until the NCQ Command Error log is read, which also reports the failing tag.
+	// A COMRESET clears that state, but the log is no longer valid afterwards.
+	std::optional<uint32_t> failedSlot;
+	if (!ncqMask) {
+		failedSlot = currentSlot;
+	} else if (!didReset) {
+		auto log = arch::dma_array<uint8_t>{nullptr, sectorSize};
+		Command cmd{ncqErrorLogAddress, 1, sectorSize, log.data(), CommandType::readLogExt};
+		// All commands are reissued below, so slot 0 can be reused here.
+		cmd.prepare(commandTables_[0], commandList_->slots[0]);
+		regs_.store(regs::commandIssue, 1);
+		auto success = co_await helix::kindaBusyWait(500'000'000,
+				[&](){ return !(regs_.load(regs::commandIssue) & 1); });
+		if (success && !(regs_.load(regs::tfd) & flags::tfd::err)) {
+			if (!(log[0] & flags::ncqErrorLog::nonQueued))
+				failedSlot = log[0] & flags::ncqErrorLog::tagMask;
+		} else {
+			printf("\e[31mblock/ahci: Port %d failed to read the NCQ error log\e[39m\n",
+					portIndex_);
+			co_await stop_();
+			regs_.store(regs::sErr, ~0u);
+			regs_.store(regs::interruptStatus, ~0u);
+			if (!(co_await reset_())) {
+				printf("\e[31mblock/ahci: Port %d failed to reset\e[39m\n", portIndex_);
+				abort();
+			}
+			start_();
+		}
+	}
+
+	// Reissue the commands that did not complete. Only the failing command counts
+	// as retried; if it is unknown, all of them do.
+	uint32_t sactMask = 0;
+	uint32_t ciMask = 0;
+	for (auto mask = submittedMask_; mask; mask &= mask - 1) {
+		auto slot = std::countr_zero(mask);
+		auto cmd = submittedCmds_[slot];
+		assert(cmd);
+
+		if (!failedSlot || *failedSlot == static_cast<uint32_t>(slot)) {
+			if (cmd->noteRetry() > maxRetries) {
+				printf("\e[31mblock/ahci: Port %d giving up on slot %d\e[39m\n",
+						portIndex_, slot);
+				abort();
+			}
+		}
+
+		std::optional<uint8_t> queueTag;
+		if (useNcq_ && cmd->isQueueable()) {
+			queueTag = slot;
+			sactMask |= 1u << slot;
+		}
+		cmd->prepare(commandTables_[slot], commandList_->slots[slot], queueTag);
+		ciMask |= 1u << slot;
+	}
+	if (sactMask)
+		regs_.store(regs::sActive, sactMask);
+	if (ciMask)
+		regs_.store(regs::commandIssue, ciMask);
+
+	recovering_ = false;
+	recoveredDoorbell_.raise();
+}
+
+void Port::start_() {
+	auto cas = regs_.load(regs::commandAndStatus);
+	regs_.store(regs::commandAndStatus, cas | flags::cmd::start);
+}
+
+async::result<bool> Port::stop_() {
+	auto cas = regs_.load(regs::commandAndStatus);
+	regs_.store(regs::commandAndStatus, cas & ~flags::cmd::start);
+
+	co_return co_await helix::kindaBusyWait(500'000'000, [&](){
+		return !(regs_.load(regs::commandAndStatus) & flags::cmd::cmdListRunning); });
+}
+
+// Issues a COMRESET (AHCI spec: 10.4.2). The port must be stopped.
+async::result<bool> Port::reset_() {
+	auto sctl = regs_.load(regs::sControl);
+	regs_.store(regs::sControl, (sctl & ~0xFu) | 1);
+	co_await helix::sleepFor(1'000'000);
+	regs_.store(regs::sControl, sctl & ~0xFu);
+
+	auto success = co_await helix::kindaBusyWait(1'000'000'000, [&](){
+		return (regs_.load(regs::status) & 0xF) == 3; });
+	if (!success)
+		co_return false;
+	regs_.store(regs::sErr, ~0u);
+
+	co_return co_await helix::kindaBusyWait(1'000'000'000, [&](){
+		auto tfd = regs_.load(regs::tfd);
+		return !(tfd & flags::tfd::bsy) && !(tfd & flags::tfd::drq); });
 }
 
 async::detached Port::submitPendingLoop_() {
@@ -261,19 +443,39 @@ async::detached Port::submitPendingLoop_() {
 }
 
 async::result<void> Port::submitCommand_(Command *cmd) {
+	// Queued and non-queued commands must not be outstanding at the same time.
+	// Hence, non-queued commands wait for the NCQ commands to drain and block
+	// the submission of further commands until they complete.
+	bool exclusive = useNcq_ && !cmd->isQueueable();
+	if (exclusive) {
+		while (commandsInFlight_)
+			co_await idleDoorbell_.async_wait();
+	}
+
 	auto slot = co_await findFreeSlot_();
-	assert(!(regs_.load(regs::commandIssue) & (1 << slot)));
+	while (recovering_)
+		co_await recoveredDoorbell_.async_wait();
+	assert(!(regs_.load(regs::commandIssue) & (1u << slot)));
 	assert(!submittedCmds_[slot]);
 
-	// Setup command table and FIS
-	cmd->prepare(commandTables_[slot], commandList_->slots[slot]);
+	// Setup command table and FIS. For NCQ, the tag is simply the slot number.
+	std::optional<uint8_t> queueTag;
+	if (useNcq_ && cmd->isQueueable())
+		queueTag = slot;
+	cmd->prepare(commandTables_[slot], commandList_->slots[slot], queueTag);
 
-	// Issue command
+	// Issue command. For NCQ, PxSACT must be set before PxCI (AHCI spec: 5.3.2.2).
 	submittedCmds_[slot] = cmd;
+	submittedMask_ |= 1u << slot;
 	commandsInFlight_++;
-	regs_.store(regs::commandIssue, 1 << slot);
+	if (queueTag)
+		regs_.store(regs::sActive, 1u << slot);
+	regs_.store(regs::commandIssue, 1u << slot);
 
-	co_return;
+	if (exclusive) {
+		while (commandsInFlight_)
+			co_await idleDoorbell_.async_wait();
+	}
 }
 
 async::result<void> Port::readSectors(uint64_t sector, void *buffer, size_t numSectors) {
@@ -289,3 +491,50 @@ async::result<void> Port::writeSectors(uint64_t sector, const void *buffer, size
 	pendingCmdQueue_.put(&cmd);
 	co_await cmd.getFuture();
 }
+
+async::result<void> Port::flush() {
+	if (!supportsFlush_)
+		co_return;
+
+	Command cmd{0, 0, 0, nullptr, CommandType::flush};
+	pendingCmdQueue_.put(&cmd);
+	co_await cmd.getFuture();
+}
+
+async::result<void> Port::writeSectorsFua(uint64_t sector, const void *buffer, size_t numSectors) {
+	if (!supportsFua_) {
+		co_await writeSectors(sector, buffer, numSectors);
+		co_await flush();
+		co_return;
+	}
+
+	Command cmd{sector, numSectors, numSectors * sectorSize,
+			const_cast<void *>(buffer), CommandType::writeFua};
+	pendingCmdQueue_.put(&cmd);
+	co_await cmd.getFuture();
+}
+
+async::result<void> Port::discardSectors(uint64_t sector, size_t numSectors) {
+	if (!supportsTrim_)
+		co_return;
+
+	// Each entry holds the LBA in bits 47:0 and the number of sectors in bits 63:48.
+	constexpr size_t entriesPerBlock = 512 / sizeof(uint64_t);
+	auto ranges = arch::dma_array<uint64_t>{nullptr, maxTrimBlocks_ * entriesPerBlock};
+	while (numSectors) {
+		memset(ranges.data(), 0, maxTrimBlocks_ * 512);
+
+		size_t n = 0;
+		while (numSectors && n < maxTrimBlocks_ * entriesPerBlock) {
+			auto chunk = std::min(numSectors, maxSectorsPerTrimRange);
+			ranges[n++] = (static_cast<uint64_t>(chunk) << 48) | sector;
+			sector += chunk;
+			numSectors -= chunk;
+		}
+
+		auto numBlocks = (n + entriesPerBlock - 1) / entriesPerBlock;
+		Command cmd{0, numBlocks, numBlocks * 512, ranges.data(), CommandType::trim};
+		pendingCmdQueue_.put(&cmd);
+		co_await cmd.getFuture();
+	}
+}
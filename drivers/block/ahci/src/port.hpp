@@ -15,7 +15,8 @@
 
 class Port : public blockfs::BlockDevice {
 public:
-	Port(int index, size_t numCommandSlots, bool staggeredSpinUp, arch::mem_space regs);
+	Port(int index, size_t numCommandSlots, bool staggeredSpinUp, bool hbaSupportsNcq,
+			arch::mem_space regs);
 
 public:
 	async::result<bool> init();
@@ -24,6 +25,9 @@ public:
 
 	async::result<void> readSectors(uint64_t sector, void *buf, size_t numSectors) override;
 	async::result<void> writeSectors(uint64_t sector, const void *buf, size_t numSectors) override;
+	async::result<void> flush() override;
+	async::result<void> writeSectorsFua(uint64_t sector, const void *buf, size_t numSectors) override;
+	async::result<void> discardSectors(uint64_t sector, size_t numSectors) override;
 
 	int getIndex() const { return portIndex_; }
 
@@ -31,8 +35,12 @@ private:
 	async::result<size_t> findFreeSlot_();
 	async::detached submitPendingLoop_();
 	async::result<void> submitCommand_(Command *cmd);
+	// Notifies the submitted commands whose slots are not set in activeMask.
+	void completeCommands_(uint32_t activeMask);
+	async::detached recover_(uint32_t is);
 	void start_();
-	void stop_();
+	async::result<bool> stop_();
+	async::result<bool> reset_();
 
 private:
 	// Mapping is owned by Controller
@@ -55,10 +63,25 @@ private:
 	async::queue<Command *, stl_allocator> pendingCmdQueue_;
 
 	std::array<Command *, limits::maxCmdSlots> submittedCmds_{};
+	// Bitmask of slots in submittedCmds_ that are occupied.
+	uint32_t submittedMask_;
 	async::recurring_event freeSlotDoorbell_;
+	// Raised when the last outstanding command completes.
+	async::recurring_event idleDoorbell_;
+	// Set while the port is restarted after an error; no commands are issued meanwhile.
+	bool recovering_ = false;
+	async::recurring_event recoveredDoorbell_;
 
 	size_t numCommandSlots_;
 	size_t commandsInFlight_;
 	int portIndex_;
 	bool staggeredSpinUp_;
+	bool hbaSupportsNcq_;
+	bool useNcq_;
+
+	// Features of the device, as reported by IDENTIFY DEVICE.
+	bool supportsFlush_ = false;
+	bool supportsFua_ = false;
+	bool supportsTrim_ = false;
+	size_t maxTrimBlocks_ = 1;
 };
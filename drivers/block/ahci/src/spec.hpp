@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <utility>
@@ -86,15 +87,23 @@ static_assert(sizeof(commandTable) == 128 + 16 * commandTable::prdtEntries);
 struct identifyDevice {
 	uint16_t _junkA[27];
 	uint16_t model[20];
-	uint16_t _junkB[36];
+	uint16_t _junkB[28];
+	uint16_t queueDepth;
+	uint16_t sataCapabilities;
+	uint16_t _junkG[5];
+	uint16_t commandSets;
 	uint16_t capabilities;
-	uint16_t _junkC[16];
+	uint16_t commandSetsExt;
+	uint16_t _junkC[14];
 	uint64_t maxLBA48;
-	uint16_t _junkD[2];
+	uint16_t _junkD;
+	uint16_t maxDsmBlocks;
 	uint16_t sectorSizeInfo;
 	uint16_t _junkE[9];
 	uint16_t logicalSectorSize;
-	uint16_t _junkF[139];
+	uint16_t _junkF[52];
+	uint16_t dsmSupport;
+	uint16_t _junkH[86];
 
 	std::string getModel() const {
 		char modelNative[41];
@@ -139,5 +148,36 @@ struct identifyDevice {
 	bool supportsLba48() const {
 		return capabilities & (1 << 10);
 	}
+
+	bool supportsNcq() const {
+		return sataCapabilities & (1 << 8);
+	}
+
+	bool supportsFlushExt() const {
+		return capabilities & (1 << 13);
+	}
+
+	bool supportsWriteCache() const {
+		return commandSets & (1 << 5);
+	}
+
+	// WRITE DMA FUA EXT; FPDMA QUEUED commands always accept the FUA bit.
+	bool supportsFuaExt() const {
+		return commandSetsExt & (1 << 6);
+	}
+
+	bool supportsTrim() const {
+		return dsmSupport & 1;
+	}
+
+	// Returns the maximum number of 512 byte blocks of LBA ranges per DATA SET MANAGEMENT.
+	size_t getMaxDsmBlocks() const {
+		return std::max<size_t>(maxDsmBlocks, 1);
+	}
+
+	// Returns the maximum number of outstanding NCQ commands
+	size_t getQueueDepth() const {
+		return (queueDepth & 0x1F) + 1;
+	}
 };
 static_assert(sizeof(identifyDevice) == 512);
@@ -1,15 +1,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <algorithm>
 #include <iostream>
+#include <optional>
 #include <queue>
 
 #include <async/result.hpp>
 #include <async/recurring-event.hpp>
 #include <async/oneshot-event.hpp>
+#include <arch/dma_structs.hpp>
 #include <arch/io_space.hpp>
 #include <arch/register.hpp>
 #include <helix/ipc.hpp>
+#include <helix/memory.hpp>
 #include <helix/timer.hpp>
 #include <protocols/hw/client.hpp>
 #include <protocols/mbus/client.hpp>
@@ -41,13 +46,30 @@ namespace alt_regs {
 	inline constexpr arch::scalar_register<uint8_t> inStatus{0};
 }
 
+// Bus master registers of the primary channel of a PCI IDE controller.
+namespace bm_regs {
+	inline constexpr arch::scalar_register<uint8_t> command{0};
+	inline constexpr arch::scalar_register<uint8_t> status{2};
+	inline constexpr arch::scalar_register<uint32_t> prdtAddress{4};
+}
+
+// Physical region descriptor. The regions must not cross a 64 KiB boundary.
+struct PrdEntry {
+	uint32_t address;
+	// Zero encodes 64 KiB.
+	uint16_t byteCount;
+	uint16_t flags;
+};
+static_assert(sizeof(PrdEntry) == 8, "Bad PrdEntry struct size");
+
 class Controller : public blockfs::BlockDevice {
 	enum class IoResult {
 		none,
 		timeout,
 		notReady,
 		noData,
-		withData
+		withData,
+		error
 	};
 
 public:
@@ -58,10 +80,14 @@ public:
 public:
 	async::detached run();
 
+	// Enables bus master DMA through the I/O ports of a PCI IDE controller.
+	void attachBusMaster(uint16_t offset, HelHandle bar);
+
 private:
 	async::detached _doRequestLoop();
 	async::result<IoResult> _pollForBsy();
 	async::result<IoResult> _waitForBsyIrq();
+	async::result<IoResult> _waitForDmaIrq();
 
 public:
 	async::result<void> readSectors(uint64_t sector, void *buffer,
@@ -74,8 +100,17 @@ private:
 	enum Commands {
 		kCommandReadSectors = 0x20,
 		kCommandReadSectorsExt = 0x24,
+		kCommandReadDmaExt = 0x25,
+		kCommandReadMultipleExt = 0x29,
 		kCommandWriteSectors = 0x30,
 		kCommandWriteSectorsExt = 0x34,
+		kCommandWriteDmaExt = 0x35,
+		kCommandWriteMultipleExt = 0x39,
+		kCommandReadMultiple = 0xC4,
+		kCommandWriteMultiple = 0xC5,
+		kCommandSetMultipleMode = 0xC6,
+		kCommandReadDma = 0xC8,
+		kCommandWriteDma = 0xCA,
 		kCommandIdentify = 0xEC,
 	};
 
@@ -87,9 +122,22 @@ private:
 		kStatusBsy = 0x80,
 
 		kDeviceSlave = 0x10,
-		kDeviceLba = 0x40
+		kDeviceLba = 0x40,
+
+		kBmCommandStart = 0x01,
+		// Direction of the transfer: set if the controller writes to memory.
+		kBmCommandRead = 0x08,
+
+		kBmStatusActive = 0x01,
+		kBmStatusError = 0x02,
+		kBmStatusIrq = 0x04,
+
+		kPrdEndOfTable = 0x8000
 	};
 
+	// PRD tables must not cross a 64 KiB boundary; a single page never does.
+	static constexpr size_t maxPrdEntries = 4096 / sizeof(PrdEntry);
+
 	struct Request {
 		bool isWrite;
 		uint64_t sector;
@@ -100,6 +148,17 @@ private:
 
 	async::result<void> _performRequest(Request *request);
 
+	// Programs the task file and issues a command.
+	void _issueCommand(uint8_t command, uint64_t sector, size_t numSectors);
+
+	async::result<void> _transferPio(bool isWrite, uint64_t sector,
+			size_t numSectors, void *buffer);
+	async::result<void> _transferDma(bool isWrite, uint64_t sector, size_t numSectors);
+
+	// Fills the PRD table for (a prefix of) the buffer. Returns the number of sectors
+	// that are covered by the table, or zero if the buffer cannot be used for DMA.
+	size_t _buildPrdt(void *buffer, size_t numSectors);
+
 	async::result<bool> _detectDevice();
 
 	std::queue<Request *> _requestQueue;
@@ -110,6 +169,12 @@ private:
 	arch::io_space _altSpace;
 
 	bool _supportsLBA48;
+	bool _supportsDma;
+	// Number of sectors per DRQ block of READ/WRITE MULTIPLE (or 1 if unsupported).
+	unsigned int _multipleCount;
+
+	std::optional<arch::io_space> _busMasterSpace;
+	arch::dma_array<PrdEntry> _prdt;
 
 	uint64_t _irqSequence;
 };
@@ -118,11 +183,25 @@ Controller::Controller(uint16_t mainOffset, uint16_t altOffset,
 		helix::UniqueDescriptor mainBar, helix::UniqueDescriptor altBar,
 		helix::UniqueDescriptor irq)
 : BlockDevice{512}, _irq{std::move(irq)},
-		_ioSpace{mainOffset}, _altSpace{altOffset}, _supportsLBA48{false} {
+		_ioSpace{mainOffset}, _altSpace{altOffset}, _supportsLBA48{false},
+		_supportsDma{false}, _multipleCount{1} {
 	HEL_CHECK(helEnableIo(mainBar.getHandle()));
 	HEL_CHECK(helEnableIo(altBar.getHandle()));
 }
 
+void Controller::attachBusMaster(uint16_t offset, HelHandle bar) {
+	HEL_CHECK(helEnableIo(bar));
+	_busMasterSpace = arch::io_space{offset};
+	_prdt = arch::dma_array<PrdEntry>{nullptr, maxPrdEntries};
+
+	// Requests are only issued by _doRequestLoop(), hence no request is in flight
+	// while the bus master is stopped here.
+	_busMasterSpace->store(bm_regs::command, 0);
+	_busMasterSpace->store(bm_regs::status,
+			_busMasterSpace->load(bm_regs::status) | kBmStatusError | kBmStatusIrq);
+	std::cout << "block/ata: Using bus master DMA" << std::endl;
+}
+
 async::detached Controller::run() {
 	// Initialize the _irqSequence. For now, assume that this is 0.
 	// TODO: if the driver restarts, we would need to get the current IRQ sequence from the kernel.
@@ -202,12 +281,41 @@ auto Controller::_waitForBsyIrq() -> async::result<IoResult> {
 		// TODO: Report those errors to the caller.
 		if(!(status & kStatusRdy)) // Device was disconnected?
 			co_return IoResult::notReady;
-		assert(!(status & kStatusErr));
-		assert(!(status & kStatusDf));
+		if(status & (kStatusErr | kStatusDf))
+			co_return IoResult::error;
 		co_return ((status & kStatusDrq) ? IoResult::withData : IoResult::noData);
 	}
 }
 
+auto Controller::_waitForDmaIrq() -> async::result<IoResult> {
+	while(true) {
+		auto await = co_await helix_ng::awaitEvent(_irq, _irqSequence);
+		HEL_CHECK(await.error());
+		_irqSequence = await.sequence();
+
+		// Unlike the task file, the bus master tells us whether the IRQ was ours.
+		auto bmStatus = _busMasterSpace->load(bm_regs::status);
+		if(!(bmStatus & kBmStatusIrq)) {
+			HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckNack, _irqSequence));
+			continue;
+		}
+		if(logIrqs)
+			std::cout << "block/ata: DMA IRQ fired." << std::endl;
+
+		_busMasterSpace->store(bm_regs::command, 0);
+		_busMasterSpace->store(bm_regs::status, bmStatus | kBmStatusError | kBmStatusIrq);
+
+		// Reading the status register clears the device's IRQ.
+		auto status = _ioSpace.load(regs::inStatus);
+		HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, _irqSequence));
+		if(status & kStatusBsy)
+			co_return IoResult::timeout;
+		if((bmStatus & kBmStatusError) || (status & (kStatusErr | kStatusDf)))
+			co_return IoResult::error;
+		co_return IoResult::noData;
+	}
+}
+
 async::result<void> Controller::readSectors(uint64_t sector,
 		void *buffer, size_t numSectors) {
 	Request request{};
@@ -292,6 +400,22 @@ async::result<bool> Controller::_detectDevice() {
 
 	printf("block/ata: detected device, model: '%s', %s 48-bit LBA\n", model, _supportsLBA48 ? "supports" : "doesn't support");
 
+	auto ident_words = reinterpret_cast<uint16_t *>(ident_data);
+	_supportsDma = ident_words[49] & (1 << 8);
+
+	// Word 47 contains the maximal number of sectors per DRQ block.
+	auto maxMultiple = ident_words[47] & 0xFF;
+	if(maxMultiple > 1) {
+		_ioSpace.store(regs::outDevice, kDeviceLba);
+		_ioSpace.store(regs::outSectorCount, maxMultiple);
+		_ioSpace.store(regs::outCommand, kCommandSetMultipleMode);
+		if ((co_await _waitForBsyIrq()) == IoResult::noData)
+			_multipleCount = maxMultiple;
+	}
+
+	printf("block/ata: %s DMA, %u sectors per PIO block\n",
+			_supportsDma ? "supports" : "doesn't support", _multipleCount);
+
 	co_return true;
 }
 
@@ -300,78 +424,210 @@ async::result<void> Controller::_performRequest(Request *request) {
 		std::cout << "block/ata: Reading/writing " << request->numSectors
 				<< " sectors from " << request->sector << std::endl;
 
-	assert(!(request->sector & ~((size_t(1) << 48) - 1)));
-	assert(request->numSectors <= 255);
+	// LBA48 commands transfer up to 65536 sectors, LBA28 commands up to 256.
+	size_t maxSectors = _supportsLBA48 ? 65536 : 256;
 
-	_ioSpace.store(regs::outDevice, kDeviceLba);
-	// TODO: There should be a 400ns delay after drive selection.
+	size_t progress = 0;
+	while(progress < request->numSectors) {
+		auto sector = request->sector + progress;
+		auto buffer = reinterpret_cast<uint8_t *>(request->buffer) + progress * 512;
+		auto chunk = std::min(request->numSectors - progress, maxSectors);
+
+		size_t n = 0;
+		if(_busMasterSpace && _supportsDma)
+			n = _buildPrdt(buffer, chunk);
+
+		if(n) {
+			co_await _transferDma(request->isWrite, sector, n);
+		}else{
+			n = chunk;
+			co_await _transferPio(request->isWrite, sector, n, buffer);
+		}
+		progress += n;
+	}
+
+	if(logRequests)
+		std::cout << "block/ata: Reading/writing from " << request->sector
+				<< " complete" << std::endl;
+}
 
+void Controller::_issueCommand(uint8_t command, uint64_t sector, size_t numSectors) {
+	// A sector count of zero encodes the maximal count (256 or 65536).
 	if (_supportsLBA48) {
-		_ioSpace.store(regs::outSectorCount, (request->numSectors >> 8) & 0xFF);
-		_ioSpace.store(regs::outLba1, (request->sector >> 24) & 0xFF);
-		_ioSpace.store(regs::outLba2, (request->sector >> 32) & 0xFF);
-		_ioSpace.store(regs::outLba3, (request->sector >> 40) & 0xFF);
+		assert(!(sector & ~((uint64_t(1) << 48) - 1)));
+		assert(numSectors && numSectors <= 65536);
+		_ioSpace.store(regs::outDevice, kDeviceLba);
+		// TODO: There should be a 400ns delay after drive selection.
+
+		_ioSpace.store(regs::outSectorCount, (numSectors >> 8) & 0xFF);
+		_ioSpace.store(regs::outLba1, (sector >> 24) & 0xFF);
+		_ioSpace.store(regs::outLba2, (sector >> 32) & 0xFF);
+		_ioSpace.store(regs::outLba3, (sector >> 40) & 0xFF);
+	}else{
+		assert(!(sector & ~((uint64_t(1) << 28) - 1)));
+		assert(numSectors && numSectors <= 256);
+		// LBA28 commands take the upper bits of the sector from the device register.
+		_ioSpace.store(regs::outDevice, kDeviceLba | ((sector >> 24) & 0x0F));
 	}
 
-	_ioSpace.store(regs::outSectorCount, request->numSectors & 0xFF);
-	_ioSpace.store(regs::outLba1, request->sector & 0xFF);
-	_ioSpace.store(regs::outLba2, (request->sector >> 8) & 0xFF);
-	_ioSpace.store(regs::outLba3, (request->sector >> 16) & 0xFF);
+	_ioSpace.store(regs::outSectorCount, numSectors & 0xFF);
+	_ioSpace.store(regs::outLba1, sector & 0xFF);
+	_ioSpace.store(regs::outLba2, (sector >> 8) & 0xFF);
+	_ioSpace.store(regs::outLba3, (sector >> 16) & 0xFF);
+	_ioSpace.store(regs::outCommand, command);
+}
+
+async::result<void> Controller::_transferPio(bool isWrite, uint64_t sector,
+		size_t numSectors, void *buffer) {
+	// With READ/WRITE MULTIPLE, the device raises one IRQ per block of sectors.
+	bool multiple = _multipleCount > 1;
+	size_t perBlock = _multipleCount;
 
-	if(!request->isWrite) {
+	if(!isWrite) {
 		if (_supportsLBA48)
-			_ioSpace.store(regs::outCommand, kCommandReadSectorsExt);
+			_issueCommand(multiple ? kCommandReadMultipleExt : kCommandReadSectorsExt,
+					sector, numSectors);
 		else
-			_ioSpace.store(regs::outCommand, kCommandReadSectors);
+			_issueCommand(multiple ? kCommandReadMultiple : kCommandReadSectors,
+					sector, numSectors);
 
-		// Receive the result for each sector.
-		for(size_t k = 0; k < request->numSectors; k++) {
+		// Receive the result for each block.
+		for(size_t k = 0; k < numSectors; k += perBlock) {
 			auto ioRes = co_await _waitForBsyIrq();
 			assert(ioRes == IoResult::withData);
 
 			// Read the data.
 			// TODO: Do we have to be careful with endianess here?
-			auto chunk = reinterpret_cast<uint8_t *>(request->buffer) + k * 512;
+			auto chunk = reinterpret_cast<uint8_t *>(buffer) + k * 512;
+			auto n = std::min(perBlock, numSectors - k);
 			// TODO: The following is a hack. Lock the page into memory instead!
-			*static_cast<volatile uint8_t *>(chunk); // Fault in the page.
-			_ioSpace.load_iterative(regs::ioData, reinterpret_cast<uint16_t *>(chunk), 256);
+			for(size_t i = 0; i < n; i++)
+				*static_cast<volatile uint8_t *>(chunk + i * 512); // Fault in the page.
+			_ioSpace.load_iterative(regs::ioData, reinterpret_cast<uint16_t *>(chunk), n * 256);
 		}
 	}else{
 		if (_supportsLBA48)
-			_ioSpace.store(regs::outCommand, kCommandWriteSectorsExt);
+			_issueCommand(multiple ? kCommandWriteMultipleExt : kCommandWriteSectorsExt,
+					sector, numSectors);
 		else
-			_ioSpace.store(regs::outCommand, kCommandWriteSectors);
+			_issueCommand(multiple ? kCommandWriteMultiple : kCommandWriteSectors,
+					sector, numSectors);
 
-		// Write requests do not generate an IRQ for the first sector.
+		// Write requests do not generate an IRQ for the first block.
 		auto ioRes = co_await _pollForBsy();
 		assert(ioRes == IoResult::withData);
 
-		// Receive the result for each sector.
-		for(size_t k = 0; k < request->numSectors; k++) {
-			// Read the data.
+		// Send the data of each block.
+		for(size_t k = 0; k < numSectors; k += perBlock) {
 			// TODO: Do we have to be careful with endianess here?
-			auto chunk = reinterpret_cast<uint8_t *>(request->buffer) + k * 512;
+			auto chunk = reinterpret_cast<uint8_t *>(buffer) + k * 512;
+			auto n = std::min(perBlock, numSectors - k);
 			// TODO: The following is a hack. Lock the page into memory instead!
-			*static_cast<volatile uint8_t *>(chunk); // Fault in the page.
-			_ioSpace.store_iterative(regs::ioData, reinterpret_cast<uint16_t *>(chunk), 256);
+			for(size_t i = 0; i < n; i++)
+				*static_cast<volatile uint8_t *>(chunk + i * 512); // Fault in the page.
+			_ioSpace.store_iterative(regs::ioData, reinterpret_cast<uint16_t *>(chunk), n * 256);
 
-			// Wait for the device to process the sector.
+			// Wait for the device to process the block.
 			auto ioRes = co_await _waitForBsyIrq();
-			if(k + 1 < request->numSectors) {
+			if(k + n < numSectors) {
 				assert(ioRes == IoResult::withData);
 			}else{
 				assert(ioRes == IoResult::noData);
 			}
 		}
 	}
+}
 
-	if(logRequests)
-		std::cout << "block/ata: Reading/writing from " << request->sector
-				<< " complete" << std::endl;
+async::result<void> Controller::_transferDma(bool isWrite, uint64_t sector,
+		size_t numSectors) {
+	_busMasterSpace->store(bm_regs::command, 0);
+	_busMasterSpace->store(bm_regs::status,
+			_busMasterSpace->load(bm_regs::status) | kBmStatusError | kBmStatusIrq);
+	_busMasterSpace->store(bm_regs::prdtAddress,
+			static_cast<uint32_t>(helix::ptrToPhysical(_prdt.data())));
+	uint8_t direction = isWrite ? 0 : kBmCommandRead;
+	_busMasterSpace->store(bm_regs::command, direction);
+
+	if (_supportsLBA48)
+		_issueCommand(isWrite ? kCommandWriteDmaExt : kCommandReadDmaExt, sector, numSectors);
+	else
+		_issueCommand(isWrite ? kCommandWriteDma : kCommandReadDma, sector, numSectors);
+	_busMasterSpace->store(bm_regs::command, direction | kBmCommandStart);
+
+	auto ioRes = co_await _waitForDmaIrq();
+	// TODO: Report those errors to the caller.
+	assert(ioRes == IoResult::noData);
+}
+
+/* Note on buffer: libblockfs guarantees us that the buffer is locked into memory,
+ * hence its physical pages do not change during the DMA.
+ */
+size_t Controller::_buildPrdt(void *buffer, size_t numSectors) {
+	size_t pageSize = getpagesize();
+
+	// The controller only transfers words to 32-bit physical addresses.
+	auto virt = reinterpret_cast<uintptr_t>(buffer);
+	if(virt & 1)
+		return 0;
+
+	size_t numBytes = numSectors * 512;
+	size_t progress = 0;
+	size_t n = 0;
+	std::vector<uint32_t> lengths; // Byte counts before encoding.
+	while(progress < numBytes) {
+		auto address = virt + progress;
+		auto phys = helix::addressToPhysical(address);
+		auto chunk = std::min(pageSize - (address & (pageSize - 1)), numBytes - progress);
+		if(phys + chunk > (uintptr_t(1) << 32))
+			break;
+
+		// Merge physically contiguous pages as long as we stay in the same 64 KiB region.
+		if(n && uintptr_t{_prdt[n - 1].address} + lengths[n - 1] == phys
+				&& (_prdt[n - 1].address >> 16) == ((phys + chunk - 1) >> 16)) {
+			lengths[n - 1] += chunk;
+		}else{
+			if(n == maxPrdEntries)
+				break;
+			_prdt[n].address = phys;
+			lengths.push_back(chunk);
+			n++;
+		}
+		progress += chunk;
+	}
+
+	// Only transfer whole sectors.
+	size_t excess = progress & 511;
+	while(excess) {
+		auto cut = std::min<size_t>(excess, lengths[n - 1]);
+		lengths[n - 1] -= cut;
+		if(!lengths[n - 1]) {
+			lengths.pop_back();
+			n--;
+		}
+		excess -= cut;
+		progress -= cut;
+	}
+	if(!progress)
+		return 0;
+
+	for(size_t i = 0; i < n; i++) {
+		_prdt[i].byteCount = lengths[i] & 0xFFFF;
+		_prdt[i].flags = (i + 1 == n) ? kPrdEndOfTable : 0;
+	}
+	return progress / 512;
 }
 
 std::vector<std::shared_ptr<Controller>> globalControllers;
 
+// Bus master of the PCI IDE controller that owns the legacy ports (if any).
+struct BusMaster {
+	protocols::hw::Device device;
+	uint16_t offset;
+	helix::UniqueDescriptor bar;
+};
+
+std::optional<BusMaster> globalBusMaster;
+
 // ------------------------------------------------------------------------
 // Freestanding discovery functions.
 // ------------------------------------------------------------------------
@@ -389,10 +645,35 @@ async::detached bindController(mbus::Entity entity) {
 			info.barInfo[0].address, info.barInfo[1].address,
 			std::move(mainBar), std::move(altBar),
 			std::move(irq));
+	// The PCI IDE controller can be discovered before or after the legacy ports.
+	if(globalBusMaster)
+		controller->attachBusMaster(globalBusMaster->offset, globalBusMaster->bar.getHandle());
 	controller->run();
 	globalControllers.push_back(std::move(controller));
 }
 
+async::detached bindIdeController(mbus::Entity entity) {
+	protocols::hw::Device device(co_await entity.bind());
+	auto info = co_await device.getPciInfo();
+
+	// We only drive the primary channel in compatibility mode (i.e., at the legacy ports).
+	auto progIf = co_await device.loadPciSpace(0x09, 1);
+	if((progIf & 0x01) || !(progIf & 0x80)
+			|| info.barInfo[4].ioType != protocols::hw::IoType::kIoTypePort) {
+		std::cout << "block/ata: IDE controller does not support bus mastering"
+				" on the compatibility channel" << std::endl;
+		co_return;
+	}
+
+	auto bar = co_await device.accessBar(4);
+	co_await device.enableBusmaster();
+
+	globalBusMaster = BusMaster{std::move(device),
+			static_cast<uint16_t>(info.barInfo[4].address), std::move(bar)};
+	for(auto &controller : globalControllers)
+		controller->attachBusMaster(globalBusMaster->offset, globalBusMaster->bar.getHandle());
+}
+
 async::detached observeControllers() {
 	auto root = co_await mbus::Instance::global().getRoot();
 
@@ -409,6 +690,23 @@ async::detached observeControllers() {
 	co_await root.linkObserver(std::move(filter), std::move(handler));
 }
 
+async::detached observeIdeControllers() {
+	auto root = co_await mbus::Instance::global().getRoot();
+
+	auto filter = mbus::Conjunction({
+		mbus::EqualsFilter("pci-class", "01"),
+		mbus::EqualsFilter("pci-subclass", "01")
+	});
+
+	auto handler = mbus::ObserverHandler{}
+	.withAttach([] (mbus::Entity entity, mbus::Properties) {
+		printf("block/ata: detected PCI IDE controller\n");
+		bindIdeController(std::move(entity));
+	});
+
+	co_await root.linkObserver(std::move(filter), std::move(handler));
+}
+
 // --------------------------------------------------------
 // main() function
 // --------------------------------------------------------
@@ -417,5 +715,6 @@ int main() {
 	printf("block/ata: Starting driver\n");
 
 	observeControllers();
+	observeIdeControllers();
 	async::run_forever(helix::currentDispatcher);
 }
@@ -1,18 +1,63 @@
+#include <algorithm>
+
 #include <arch/bit.hpp>
 #include <helix/memory.hpp>
+#include <string.h>
 #include <unistd.h>
 
 #include "command.hpp"
 
-void Command::setupBuffer(arch::dma_buffer_view view) {
+arch::dma_array<uint64_t> ListPagePool::allocate() {
+	static size_t pageSize = getpagesize();
+
+	if (freePages_.empty())
+		return arch::dma_array<uint64_t>{nullptr, pageSize >> 3};
+
+	auto page = std::move(freePages_.back());
+	freePages_.pop_back();
+	return page;
+}
+
+void ListPagePool::free(arch::dma_array<uint64_t> page) {
+	if (freePages_.size() >= MAX_FREE_PAGES)
+		return;
+	freePages_.push_back(std::move(page));
+}
+
+void Command::buildDataPointer(ListPagePool &pool, bool useSgl) {
+	static size_t pageSize = getpagesize();
+
+	if (!view_.size())
+		return;
+
+	// Buffers that fit into prp1 and prp2 do not need a list page, so PRPs are
+	// at least as cheap as SGLs in this case.
+	auto offset = reinterpret_cast<uintptr_t>(view_.data()) % pageSize;
+	if (useSgl && offset + view_.size() > pageSize * 2) {
+		buildSgl(pool);
+	} else {
+		buildPrps(pool);
+	}
+}
+
+void Command::releaseListPages(ListPagePool &pool) {
+	for (auto &page : listPages_)
+		pool.free(std::move(page));
+	listPages_.clear();
+}
+
+void Command::buildPrps(ListPagePool &pool) {
 	using arch::convert_endian;
 	using arch::endian;
 
 	static size_t pageSize = getpagesize();
 
+	auto view = view_;
 	uintptr_t virtStart = reinterpret_cast<uintptr_t>(view.data());
 	auto offset = virtStart % pageSize;
 
+	command_.common.flags = (command_.common.flags & ~spec::kPsdtMask) | spec::kPsdtPrp;
+
 	if (offset + view.size() <= pageSize * 2) {
 		// Inline
 		command_.common.dataPtr.prp1 = convert_endian<endian::little, endian::native>(
@@ -31,35 +76,23 @@ void Command::setupBuffer(arch::dma_buffer_view view) {
 	auto size = view.size();
 
 	prp1 = helix::addressToPhysical(virtStart);
-
-	if (offset + view.size() <= pageSize) {
-		command_.readWrite.dataPtr.prp1 = convert_endian<endian::little, endian::native>(prp1);
-		command_.readWrite.dataPtr.prp2 = 0;
-		return;
-	}
 	size -= pageSize - offset;
 	virtStart += pageSize - offset;
 
-	if (size <= pageSize) {
-		command_.readWrite.dataPtr.prp1 = convert_endian<endian::little, endian::native>(prp1);
-		command_.readWrite.dataPtr.prp2 = convert_endian<endian::little, endian::native>(
-			helix::addressToPhysical(virtStart));
-		return;
-	}
-
-	auto prpObj = arch::dma_array<uint64_t>{nullptr, pageSize >> 3};
+	auto prpObj = pool.allocate();
 	auto *prpList = prpObj.data();
 
 	prp2 = helix::ptrToPhysical(prpList);
-	prpLists.push_back(std::move(prpObj));
+	listPages_.push_back(std::move(prpObj));
 
-	int i = 0;
+	size_t i = 0;
 	for (;;) {
 		if (i == pageSize >> 3) {
+			// The last entry of a full list points to the next list.
 			auto *oldPrpList = prpList;
-			prpObj = arch::dma_array<uint64_t>{nullptr, pageSize >> 3};
+			prpObj = pool.allocate();
 			prpList = prpObj.data();
-			prpLists.push_back(std::move(prpObj));
+			listPages_.push_back(std::move(prpObj));
 
 			prpList[0] = oldPrpList[i - 1];
 			oldPrpList[i - 1] = convert_endian<endian::little, endian::native>(
@@ -75,6 +108,77 @@ void Command::setupBuffer(arch::dma_buffer_view view) {
 		size -= pageSize;
 	}
 
-	command_.readWrite.dataPtr.prp1 = convert_endian<endian::little, endian::native>(prp1);
-	command_.readWrite.dataPtr.prp2 = convert_endian<endian::little, endian::native>(prp2);
+	command_.common.dataPtr.prp1 = convert_endian<endian::little, endian::native>(prp1);
+	command_.common.dataPtr.prp2 = convert_endian<endian::little, endian::native>(prp2);
+}
+
+void Command::buildSgl(ListPagePool &pool) {
+	using arch::convert_endian;
+	using arch::endian;
+
+	static size_t pageSize = getpagesize();
+
+	auto makeDescriptor = [] (uint64_t address, uint32_t length, uint8_t type) {
+		spec::SglDescriptor desc{};
+		desc.address = convert_endian<endian::little, endian::native>(address);
+		desc.length = convert_endian<endian::little, endian::native>(length);
+		desc.identifier = type;
+		return desc;
+	};
+
+	// Merge physically contiguous pages into a single data block.
+	std::vector<std::pair<uint64_t, uint32_t>> blocks;
+	uintptr_t virt = reinterpret_cast<uintptr_t>(view_.data());
+	size_t remaining = view_.size();
+	while (remaining) {
+		auto chunk = std::min(pageSize - virt % pageSize, remaining);
+		auto phys = helix::addressToPhysical(virt);
+		if (!blocks.empty() && blocks.back().first + blocks.back().second == phys) {
+			blocks.back().second += chunk;
+		} else {
+			blocks.push_back({phys, chunk});
+		}
+		virt += chunk;
+		remaining -= chunk;
+	}
+
+	command_.common.flags = (command_.common.flags & ~spec::kPsdtMask) | spec::kPsdtSgl;
+
+	spec::SglDescriptor head;
+	if (blocks.size() == 1) {
+		head = makeDescriptor(blocks[0].first, blocks[0].second, spec::kSglDataBlock);
+		memcpy(&command_.common.dataPtr, &head, sizeof(spec::SglDescriptor));
+		return;
+	}
+
+	// Each segment fills one page. Unless it is the last segment, its final
+	// descriptor points to the next segment.
+	auto perSegment = pageSize / sizeof(spec::SglDescriptor);
+	spec::SglDescriptor *link = &head;
+	size_t i = 0;
+	for (;;) {
+		auto page = pool.allocate();
+		auto *segment = reinterpret_cast<spec::SglDescriptor *>(page.data());
+
+		auto n = blocks.size() - i;
+		bool last = n <= perSegment;
+		if (!last)
+			n = perSegment - 1;
+		for (size_t k = 0; k < n; k++)
+			segment[k] = makeDescriptor(blocks[i + k].first, blocks[i + k].second,
+					spec::kSglDataBlock);
+		i += n;
+
+		auto entries = last ? n : n + 1;
+		*link = makeDescriptor(helix::ptrToPhysical(segment),
+				entries * sizeof(spec::SglDescriptor),
+				last ? spec::kSglLastSegment : spec::kSglSegment);
+		listPages_.push_back(std::move(page));
+
+		if (last)
+			break;
+		link = &segment[n];
+	}
+
+	memcpy(&command_.common.dataPtr, &head, sizeof(spec::SglDescriptor));
 }
@@ -7,6 +7,19 @@
 
 #include "spec.hpp"
 
+// Recycles the page-sized buffers that hold PRP lists and SGL segments.
+// Each queue owns one pool, hence no locking is required.
+struct ListPagePool {
+	arch::dma_array<uint64_t> allocate();
+	void free(arch::dma_array<uint64_t> page);
+
+private:
+	// Upper bound on the number of idle pages that the pool retains.
+	static constexpr size_t MAX_FREE_PAGES = 64;
+
+	std::vector<arch::dma_array<uint64_t>> freePages_;
+};
+
 struct Command {
 	using Result = std::pair<uint16_t, spec::CompletionEntry::Result>;
 
@@ -14,7 +27,18 @@ struct Command {
 		return command_;
 	}
 
-	void setupBuffer(arch::dma_buffer_view view);
+	// Attaches a data buffer to the command. The data pointer is only filled in
+	// by buildDataPointer() once the command is submitted to a queue.
+	void setupBuffer(arch::dma_buffer_view view) {
+		view_ = view;
+	}
+
+	// Describes the buffer by PRPs or, if useSgl is set, by SGL descriptors.
+	// Pages for PRP lists and SGL segments are taken from the given pool.
+	void buildDataPointer(ListPagePool &pool, bool useSgl);
+
+	// Returns the list pages to the pool after the command completed.
+	void releaseListPages(ListPagePool &pool);
 
 	async::future<Result, frg::stl_allocator> getFuture() {
 		return promise_.get_future();
@@ -25,7 +49,11 @@ struct Command {
 	}
 
 private:
+	void buildPrps(ListPagePool &pool);
+	void buildSgl(ListPagePool &pool);
+
 	spec::Command command_;
 	async::promise<Result, frg::stl_allocator> promise_;
-	std::vector<arch::dma_array<uint64_t>> prpLists;
+	arch::dma_buffer_view view_;
+	std::vector<arch::dma_array<uint64_t>> listPages_;
 };
@@ -1,8 +1,16 @@
+#include <algorithm>
+#include <thread>
+
 #include <arch/bit.hpp>
 #include <helix/timer.hpp>
 
 #include "controller.hpp"
 
+namespace {
+	// Trades CPU time for latency; see Controller::handleIrqs().
+	constexpr bool busyPollIoQueues = false;
+} // namespace
+
 namespace regs {
 	constexpr arch::bit_register<uint64_t> cap{0x0};
 	constexpr arch::scalar_register<uint32_t> vs{0x4};
@@ -17,6 +25,7 @@ namespace flags {
 	namespace cap {
 		constexpr arch::field<uint64_t, uint16_t> mqes{0, 16};
 		constexpr arch::field<uint64_t, uint8_t> dstrd{32, 4};
+		constexpr arch::field<uint64_t, uint8_t> mpsmin{48, 4};
 	} // namespace cap
 
 	namespace vs {
@@ -37,15 +46,25 @@ namespace flags {
 } // namespace flags
 
 Controller::Controller(protocols::hw::Device hwDevice, helix::Mapping hbaRegs,
-					   helix::UniqueDescriptor, helix::UniqueDescriptor irq)
+					   helix::UniqueDescriptor, helix::UniqueDescriptor irq,
+					   unsigned int numMsis)
 	: hwDevice_{std::move(hwDevice)}, regsMapping_{std::move(hbaRegs)},
-	  regs_{regsMapping_.get()}, irq_{std::move(irq)} {
+	  regs_{regsMapping_.get()}, irq_{std::move(irq)}, numMsis_{numMsis} {
 }
 
 async::detached Controller::run() {
-	co_await hwDevice_.enableBusIrq();
+	if (numMsis_) {
+		// Vector 0 serves the admin queue, the remaining ones serve IO queues.
+		co_await hwDevice_.enableMsi();
+		for (unsigned int i = 0; i < std::min(numMsis_, MAX_IO_QUEUES + 1); i++)
+			irqs_.push_back(co_await hwDevice_.installMsi(i));
+	} else {
+		co_await hwDevice_.enableBusIrq();
+		irqs_.push_back(std::move(irq_));
+	}
 
-	handleIrqs();
+	for (unsigned int i = 0; i < irqs_.size(); i++)
+		handleIrqs(i);
 
 	co_await reset();
 	co_await scanNamespaces();
@@ -54,24 +73,60 @@ async::detached Controller::run() {
 		ns->run();
 }
 
-async::detached Controller::handleIrqs() {
-	irqSequence_ = 0;
+int Controller::reapCompletions(unsigned int vector) {
+	int found = 0;
+	for (auto &q : activeQueues_) {
+		if (q->getIrqVector() == vector)
+			found += q->handleIrq();
+	}
+	return found;
+}
+
+bool Controller::isBusyPolled(unsigned int vector) {
+	for (auto &q : activeQueues_) {
+		if (q->getIrqVector() == vector && q->isBusyPolled())
+			return true;
+	}
+	return false;
+}
+
+async::detached Controller::handleIrqs(unsigned int vector) {
+	auto &irq = irqs_[vector];
+	uint64_t sequence = 0;
 
 	while (true) {
-		auto await = co_await helix_ng::awaitEvent(irq_, irqSequence_);
+		auto await = co_await helix_ng::awaitEvent(irq, sequence);
 		HEL_CHECK(await.error());
-		irqSequence_ = await.sequence();
+		sequence = await.sequence();
 
-		int found = 0;
-		for (auto &q : activeQueues_) {
-			found |= q->handleIrq();
+		if (!reapCompletions(vector)) {
+			HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckNack, sequence));
+			continue;
 		}
 
-		if (found) {
-			HEL_CHECK(helAcknowledgeIrq(irq_.getHandle(), kHelAckAcknowledge, irqSequence_));
-		} else {
-			HEL_CHECK(helAcknowledgeIrq(irq_.getHandle(), kHelAckNack, irqSequence_));
+		// Under load, poll the completion queues instead of taking one IRQ per completion.
+		// The kernel masks the IRQ until we acknowledge it, so completions that
+		// arrive while we poll do not cause further wakeups.
+		bool busyPoll = isBusyPolled(vector);
+		uint64_t start;
+		HEL_CHECK(helGetClock(&start));
+		uint64_t lastCompletion = start;
+		for (int round = 1; round < IRQ_POLL_ROUNDS || busyPoll; round++) {
+			// Let the submission paths run before polling again.
+			co_await helix::sleepFor(0);
+
+			uint64_t now;
+			HEL_CHECK(helGetClock(&now));
+			if (reapCompletions(vector)) {
+				lastCompletion = now;
+			} else if (!busyPoll || now - lastCompletion > BUSY_POLL_WINDOW) {
+				break;
+			}
+			if (now - start > MAX_POLL_TIME)
+				break;
 		}
+
+		HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckAcknowledge, sequence));
 	}
 }
 
@@ -104,6 +159,7 @@ async::result<void> Controller::reset() {
 
 	queueDepth_ = std::min((cap & flags::cap::mqes) + 1, IO_QUEUE_DEPTH);
 	dbStride_ = 1 << (cap & flags::cap::dstrd);
+	minPageShift_ = 12 + (cap & flags::cap::mpsmin);
 
 	version_ = regs_.load(regs::vs);
 
@@ -122,10 +178,23 @@ async::result<void> Controller::reset() {
 
 	co_await enable();
 
-	auto ioQ = std::make_unique<Queue>(1, queueDepth_, regs_.subspace(doorbellsOffset + 1 * 8 * dbStride_));
-	ioQ->init();
+	// Create one IO queue pair per CPU, as far as the controller and our vectors allow.
+	auto wantedQueues = std::clamp(std::thread::hardware_concurrency(), 1u, MAX_IO_QUEUES);
+	auto numQueues = co_await setNumQueues(wantedQueues);
+
+	for (unsigned int qid = 1; qid <= numQueues; qid++) {
+		// With a single vector, all queues share it.
+		unsigned int vector = 0;
+		if (irqs_.size() > 1)
+			vector = 1 + (qid - 1) % (irqs_.size() - 1);
+
+		auto ioQ = std::make_unique<Queue>(qid, queueDepth_,
+				regs_.subspace(doorbellsOffset + qid * 8 * dbStride_), vector);
+		ioQ->init();
+		ioQ->setBusyPoll(busyPollIoQueues);
 
-	if (co_await setupIoQueue(ioQ.get())) {
+		if (!(co_await setupIoQueue(ioQ.get())))
+			break;
 		ioQ->run();
 		activeQueues_.push_back(std::move(ioQ));
 	}
@@ -133,6 +202,32 @@ async::result<void> Controller::reset() {
 	assert(activeQueues_.size() >= 2 && "At least need one IO queue");
 }
 
+async::result<unsigned int> Controller::setNumQueues(unsigned int count) {
+	using arch::convert_endian;
+	using arch::endian;
+
+	auto &adminQ = activeQueues_.front();
+	auto cmd = std::make_unique<Command>();
+	auto &cmdBuf = cmd->getCommandBuffer().common;
+
+	// Both counts are zero-based.
+	cmdBuf.opcode = spec::kSetFeatures;
+	cmdBuf.cdw10 = convert_endian<endian::little, endian::native>(
+			(uint32_t)spec::kFeatureNumQueues);
+	cmdBuf.cdw11 = convert_endian<endian::little, endian::native>(
+			((count - 1) << 16) | (count - 1));
+
+	auto res = co_await adminQ->submitCommand(std::move(cmd));
+	if (res.first != 0)
+		co_return 1;
+
+	// The controller may allocate more or less queues than we asked for.
+	auto allocated = convert_endian<endian::little>(res.second.u32);
+	auto numSq = (allocated & 0xFFFF) + 1;
+	auto numCq = (allocated >> 16) + 1;
+	co_return std::min({count, numSq, numCq});
+}
+
 async::result<bool> Controller::setupIoQueue(Queue *q) {
 	auto cqRes = co_await createCQ(q);
 	if (cqRes.first != 0)
@@ -160,7 +255,7 @@ async::result<Command::Result> Controller::createCQ(Queue *q) {
 	cmdBuf.cqid = convert_endian<endian::little, endian::native>((uint16_t)q->getQueueId());
 	cmdBuf.qSize = convert_endian<endian::little, endian::native>((uint16_t)q->getQueueDepth() - 1);
 	cmdBuf.cqFlags = convert_endian<endian::little, endian::native>((uint16_t)flags);
-	cmdBuf.irqVector = 0; // TODO: set to MSI vector
+	cmdBuf.irqVector = convert_endian<endian::little, endian::native>((uint16_t)q->getIrqVector());
 
 	return adminQ->submitCommand(std::move(cmd));
 }
@@ -241,6 +336,19 @@ async::result<void> Controller::scanNamespaces() {
 
 	nn = convert_endian<endian::little>(idCtrl.nn);
 
+	// MDTS is a power of two in units of the minimal page size; zero means no limit.
+	if (idCtrl.mdts)
+		maxTransferSize_ = size_t{1} << (idCtrl.mdts + minPageShift_);
+
+	oncs_ = convert_endian<endian::little>(idCtrl.oncs);
+	volatileWriteCache_ = idCtrl.vwc & 1;
+
+	auto sglSupport = convert_endian<endian::little>(idCtrl.sgls) & 3;
+	if (sglSupport == spec::kSglSupported || sglSupport == spec::kSglDwordAligned) {
+		for (size_t i = 1; i < activeQueues_.size(); i++)
+			activeQueues_[i]->setUseSgl(true);
+	}
+
 	if (version_ >= flags::vs::version(1, 1, 0)) {
 		auto nsList = arch::dma_array<uint32_t>{nullptr, 1024};
 		int numLists = (nn + 1023) >> 10;
@@ -289,7 +397,13 @@ async::result<void> Controller::createNamespace(unsigned int nsid) {
 }
 
 async::result<Command::Result> Controller::submitIoCommand(std::unique_ptr<Command> cmd) {
-	auto &ioQ = activeQueues_.back();
+	// Spread the IO over all queues by picking the least loaded one.
+	// activeQueues_[0] is the admin queue.
+	auto ioQ = activeQueues_[1].get();
+	for (size_t i = 2; i < activeQueues_.size(); i++) {
+		if (activeQueues_[i]->getOutstanding() < ioQ->getOutstanding())
+			ioQ = activeQueues_[i].get();
+	}
 
 	return ioQ->submitCommand(std::move(cmd));
 }
@@ -10,19 +10,48 @@
 
 struct Controller {
 	Controller(protocols::hw::Device hwDevice, helix::Mapping hbaRegs,
-			   helix::UniqueDescriptor ahciBar, helix::UniqueDescriptor irq);
+			   helix::UniqueDescriptor ahciBar, helix::UniqueDescriptor irq,
+			   unsigned int numMsis);
 
 	async::detached run();
 
 	async::result<Command::Result> submitIoCommand(std::unique_ptr<Command> cmd);
 
+	// Maximal size of a single data transfer in bytes, or zero if there is no limit.
+	size_t getMaxTransferSize() const {
+		return maxTransferSize_;
+	}
+
+	// Whether the controller has a volatile write cache that needs to be flushed.
+	bool hasVolatileWriteCache() const {
+		return volatileWriteCache_;
+	}
+	bool supportsDatasetManagement() const {
+		return oncs_ & spec::kOncsDatasetManagement;
+	}
+	bool supportsWriteZeroes() const {
+		return oncs_ & spec::kOncsWriteZeroes;
+	}
+
 private:
 	static constexpr int IO_QUEUE_DEPTH = 1024;
+	// Upper bound on the number of IO queues that we create.
+	static constexpr unsigned int MAX_IO_QUEUES = 64;
+	// Maximal number of polling rounds after an IRQ before it is acknowledged again.
+	static constexpr int IRQ_POLL_ROUNDS = 16;
+	// Busy-polled queues keep polling for this long after the last completion (in ns).
+	static constexpr uint64_t BUSY_POLL_WINDOW = 50'000;
+	// Upper bound on the time that an IRQ stays unacknowledged while polling (in ns).
+	static constexpr uint64_t MAX_POLL_TIME = 10'000'000;
 
 	protocols::hw::Device hwDevice_;
 	helix::Mapping regsMapping_;
 	arch::mem_space regs_;
 	helix::UniqueDescriptor irq_;
+	unsigned int numMsis_;
+
+	// Interrupt vectors; either a single legacy IRQ or one per MSI-X vector.
+	std::vector<helix::UniqueDescriptor> irqs_;
 
 	std::vector<std::unique_ptr<Queue>> activeQueues_;
 	std::vector<std::unique_ptr<Namespace>> activeNamespaces_;
@@ -30,8 +59,10 @@ private:
 	unsigned int queueDepth_;
 	uint32_t dbStride_;
 	uint32_t version_;
-
-	uint64_t irqSequence_;
+	int minPageShift_;
+	size_t maxTransferSize_ = 0;
+	uint16_t oncs_ = 0;
+	bool volatileWriteCache_ = false;
 
 	async::result<void> reset();
 	async::result<void> scanNamespaces();
@@ -40,6 +71,7 @@ private:
 	async::result<void> enable();
 	async::result<void> disable();
 
+	async::result<unsigned int> setNumQueues(unsigned int count);
 	async::result<bool> setupIoQueue(Queue *q);
 	async::result<Command::Result> createCQ(Queue *q);
 	async::result<Command::Result> createSQ(Queue *q);
@@ -50,5 +82,7 @@ private:
 
 	async::result<void> createNamespace(unsigned int nsid);
 
-	async::detached handleIrqs();
+	int reapCompletions(unsigned int vector);
+	bool isBusyPolled(unsigned int vector);
+	async::detached handleIrqs(unsigned int vector);
 };
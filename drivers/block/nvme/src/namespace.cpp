@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <arch/bit.hpp>
 
 #include "namespace.hpp"
@@ -15,33 +17,124 @@ async::detached Namespace::run() {
 }
 
 async::result<void> Namespace::readSectors(uint64_t sector, void *buffer, size_t numSectors) {
+	return transfer(spec::kRead, sector, static_cast<char *>(buffer), numSectors);
+}
+
+async::result<void> Namespace::writeSectors(uint64_t sector, const void *buffer, size_t numSectors) {
+	return transfer(spec::kWrite, sector, const_cast<char *>(static_cast<const char *>(buffer)),
+			numSectors);
+}
+
+async::result<void> Namespace::flush() {
 	using arch::convert_endian;
 	using arch::endian;
 
+	if (!controller_->hasVolatileWriteCache())
+		co_return;
+
 	auto cmd = std::make_unique<Command>();
-	auto &cmdBuf = cmd->getCommandBuffer().readWrite;
+	auto &cmdBuf = cmd->getCommandBuffer().common;
 
-	cmdBuf.opcode = spec::kRead;
-	cmdBuf.nsid = convert_endian<endian::little, endian::native>(nsid_);
-	cmdBuf.startLba = convert_endian<endian::little, endian::native>(sector);
-	cmdBuf.length = convert_endian<endian::little, endian::native>((uint16_t)numSectors - 1);
-	cmd->setupBuffer(arch::dma_buffer_view{nullptr, buffer, numSectors << lbaShift_});
+	cmdBuf.opcode = spec::kFlush;
+	cmdBuf.namespaceId = convert_endian<endian::little, endian::native>(nsid_);
 
 	co_await controller_->submitIoCommand(std::move(cmd));
 }
 
-async::result<void> Namespace::writeSectors(uint64_t sector, const void *buffer, size_t numSectors) {
+async::result<void> Namespace::writeSectorsFua(uint64_t sector, const void *buffer,
+		size_t numSectors) {
+	return transfer(spec::kWrite, sector, const_cast<char *>(static_cast<const char *>(buffer)),
+			numSectors, spec::kControlFua);
+}
+
+async::result<void> Namespace::discardSectors(uint64_t sector, size_t numSectors) {
 	using arch::convert_endian;
 	using arch::endian;
 
-	auto cmd = std::make_unique<Command>();
-	auto &cmdBuf = cmd->getCommandBuffer().readWrite;
+	if (!controller_->supportsDatasetManagement())
+		co_return;
 
-	cmdBuf.opcode = spec::kWrite;
-	cmdBuf.nsid = convert_endian<endian::little, endian::native>(nsid_);
-	cmdBuf.startLba = convert_endian<endian::little, endian::native>(sector);
-	cmdBuf.length = convert_endian<endian::little, endian::native>((uint16_t)numSectors - 1);
-	cmd->setupBuffer(arch::dma_buffer_view{nullptr, (char *)buffer, numSectors << lbaShift_});
+	auto ranges = arch::dma_array<spec::DsmRange>{nullptr, MAX_DSM_RANGES};
+	while (numSectors) {
+		size_t n = 0;
+		while (numSectors && n < MAX_DSM_RANGES) {
+			auto chunk = std::min(numSectors, MAX_SECTORS_PER_DSM_RANGE);
+			ranges[n].attributes = 0;
+			ranges[n].numBlocks = convert_endian<endian::little, endian::native>((uint32_t)chunk);
+			ranges[n].startLba = convert_endian<endian::little, endian::native>(sector);
+			sector += chunk;
+			numSectors -= chunk;
+			n++;
+		}
 
-	co_await controller_->submitIoCommand(std::move(cmd));
+		auto cmd = std::make_unique<Command>();
+		auto &cmdBuf = cmd->getCommandBuffer().common;
+
+		cmdBuf.opcode = spec::kDatasetManagement;
+		cmdBuf.namespaceId = convert_endian<endian::little, endian::native>(nsid_);
+		cmdBuf.cdw10 = convert_endian<endian::little, endian::native>((uint32_t)(n - 1));
+		cmdBuf.cdw11 = convert_endian<endian::little, endian::native>(
+				(uint32_t)spec::kDsmDeallocate);
+		cmd->setupBuffer(arch::dma_buffer_view{nullptr, ranges.data(),
+				n * sizeof(spec::DsmRange)});
+
+		co_await controller_->submitIoCommand(std::move(cmd));
+	}
+}
+
+async::result<void> Namespace::writeZeroes(uint64_t sector, size_t numSectors) {
+	using arch::convert_endian;
+	using arch::endian;
+
+	if (!controller_->supportsWriteZeroes()) {
+		co_await BlockDevice::writeZeroes(sector, numSectors);
+		co_return;
+	}
+
+	while (numSectors) {
+		auto chunk = std::min(numSectors, MAX_SECTORS_PER_COMMAND);
+
+		auto cmd = std::make_unique<Command>();
+		auto &cmdBuf = cmd->getCommandBuffer().readWrite;
+
+		cmdBuf.opcode = spec::kWriteZeroes;
+		cmdBuf.nsid = convert_endian<endian::little, endian::native>(nsid_);
+		cmdBuf.startLba = convert_endian<endian::little, endian::native>(sector);
+		cmdBuf.length = convert_endian<endian::little, endian::native>((uint16_t)(chunk - 1));
+
+		co_await controller_->submitIoCommand(std::move(cmd));
+
+		sector += chunk;
+		numSectors -= chunk;
+	}
+}
+
+async::result<void> Namespace::transfer(uint8_t opcode, uint64_t sector, char *buffer,
+		size_t numSectors, uint16_t control) {
+	using arch::convert_endian;
+	using arch::endian;
+
+	size_t maxSectors = MAX_SECTORS_PER_COMMAND;
+	if (auto maxTransfer = controller_->getMaxTransferSize(); maxTransfer)
+		maxSectors = std::min(maxSectors, std::max(maxTransfer >> lbaShift_, size_t{1}));
+
+	while (numSectors) {
+		auto chunk = std::min(numSectors, maxSectors);
+
+		auto cmd = std::make_unique<Command>();
+		auto &cmdBuf = cmd->getCommandBuffer().readWrite;
+
+		cmdBuf.opcode = opcode;
+		cmdBuf.nsid = convert_endian<endian::little, endian::native>(nsid_);
+		cmdBuf.startLba = convert_endian<endian::little, endian::native>(sector);
+		cmdBuf.length = convert_endian<endian::little, endian::native>((uint16_t)(chunk - 1));
+		cmdBuf.control = convert_endian<endian::little, endian::native>(control);
+		cmd->setupBuffer(arch::dma_buffer_view{nullptr, buffer, chunk << lbaShift_});
+
+		co_await controller_->submitIoCommand(std::move(cmd));
+
+		sector += chunk;
+		buffer += chunk << lbaShift_;
+		numSectors -= chunk;
+	}
 }
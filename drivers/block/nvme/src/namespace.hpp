@@ -13,7 +13,22 @@ struct Namespace : blockfs::BlockDevice {
 	async::result<void> readSectors(uint64_t sector, void *buf, size_t numSectors) override;
 	async::result<void> writeSectors(uint64_t sector, const void *buf, size_t numSectors) override;
 
+	async::result<void> flush() override;
+	async::result<void> writeSectorsFua(uint64_t sector, const void *buf, size_t numSectors) override;
+	async::result<void> discardSectors(uint64_t sector, size_t numSectors) override;
+	async::result<void> writeZeroes(uint64_t sector, size_t numSectors) override;
+
 private:
+	// The NLB field of read and write commands is 16 bits wide.
+	static constexpr size_t MAX_SECTORS_PER_COMMAND = 65536;
+	// Limits of a Dataset Management command.
+	static constexpr size_t MAX_DSM_RANGES = 256;
+	static constexpr size_t MAX_SECTORS_PER_DSM_RANGE = 0xFFFFFFFF;
+
+	// Issues one command per chunk of at most MDTS bytes.
+	async::result<void> transfer(uint8_t opcode, uint64_t sector, char *buffer, size_t numSectors,
+			uint16_t control = 0);
+
 	Controller *controller_;
 	unsigned int nsid_;
 	int lbaShift_;
@@ -5,8 +5,10 @@
 #include "queue.hpp"
 #include "spec.hpp"
 
-Queue::Queue(unsigned int qid, unsigned int depth, arch::mem_space doorbells)
-	: qid_(qid), depth_(depth), doorbells_(doorbells), sqTail_(0), cqHead_(0), cqPhase_(1) {
+Queue::Queue(unsigned int qid, unsigned int depth, arch::mem_space doorbells,
+			 unsigned int irqVector)
+	: qid_(qid), depth_(depth), irqVector_(irqVector), doorbells_(doorbells), sqTail_(0),
+	  cqHead_(0), cqPhase_(1), commandsInFlight_(0), outstanding_(0) {
 	queuedCmds_.resize(depth);
 }
 
@@ -58,6 +60,7 @@ int Queue::handleIrq() {
 		assert(queuedCmds_[slot]);
 
 		std::unique_ptr<Command> cmd = std::move(queuedCmds_[slot]);
+		cmd->releaseListPages(listPagePool_);
 		cmd->complete(status, cqe->result);
 
 		if (++cqHead_ == depth_) {
@@ -104,6 +107,8 @@ async::detached Queue::submitPendingLoop() {
 async::result<void> Queue::submitCommandToDevice(std::unique_ptr<Command> cmd) {
 	auto slot = co_await findFreeSlot();
 
+	cmd->buildDataPointer(listPagePool_, useSgl_);
+
 	auto &cmdBuf = cmd->getCommandBuffer();
 	cmdBuf.common.commandId = (uint16_t)slot;
 
@@ -119,6 +124,9 @@ async::result<void> Queue::submitCommandToDevice(std::unique_ptr<Command> cmd) {
 async::result<Command::Result> Queue::submitCommand(std::unique_ptr<Command> cmd) {
 	auto future = cmd->getFuture();
 
+	outstanding_++;
 	pendingCmdQueue_.put(std::move(cmd));
-	co_return *(co_await future.get());
+	auto result = *(co_await future.get());
+	outstanding_--;
+	co_return result;
 }
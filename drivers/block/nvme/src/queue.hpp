@@ -9,7 +9,8 @@
 #include "spec.hpp"
 
 struct Queue {
-	Queue(unsigned int index, unsigned int depth, arch::mem_space doorbells);
+	Queue(unsigned int index, unsigned int depth, arch::mem_space doorbells,
+			unsigned int irqVector = 0);
 
 	void init();
 	async::detached run();
@@ -27,6 +28,27 @@ struct Queue {
 	uintptr_t getSqPhysAddr() const {
 		return sqPhys_;
 	}
+	unsigned int getIrqVector() const {
+		return irqVector_;
+	}
+
+	// Number of commands that were submitted but did not complete yet.
+	size_t getOutstanding() const {
+		return outstanding_;
+	}
+
+	// Busy-polled queues are polled until they are idle instead of only after IRQs.
+	bool isBusyPolled() const {
+		return busyPoll_;
+	}
+	void setBusyPoll(bool busyPoll) {
+		busyPoll_ = busyPoll;
+	}
+
+	// Only IO queues may use SGLs; admin commands always use PRPs.
+	void setUseSgl(bool useSgl) {
+		useSgl_ = useSgl;
+	}
 
 	async::result<Command::Result> submitCommand(std::unique_ptr<Command> cmd);
 
@@ -35,6 +57,7 @@ struct Queue {
 private:
 	unsigned int qid_;
 	unsigned int depth_;
+	unsigned int irqVector_;
 	arch::mem_space doorbells_;
 	spec::CompletionEntry *cqes_;
 	void *sqCmds_;
@@ -49,6 +72,11 @@ private:
 	std::vector<std::unique_ptr<Command>> queuedCmds_;
 	async::recurring_event freeSlotDoorbell_;
 	size_t commandsInFlight_;
+	size_t outstanding_;
+	bool busyPoll_ = false;
+	bool useSgl_ = false;
+
+	ListPagePool listPagePool_;
 
 	async::result<size_t> findFreeSlot();
 	async::detached submitPendingLoop();
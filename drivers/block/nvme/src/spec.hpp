@@ -3,8 +3,27 @@
 namespace spec {
 
 enum CommandOpcode {
+	kFlush = 0x00,
 	kWrite = 0x01,
 	kRead = 0x02,
+	kWriteZeroes = 0x08,
+	kDatasetManagement = 0x09,
+};
+
+// Bits of IdentifyController::oncs.
+enum OptionalCommands {
+	kOncsDatasetManagement = 1 << 2,
+	kOncsWriteZeroes = 1 << 3,
+};
+
+// Bits of ReadWriteCommand::control.
+enum ReadWriteControl {
+	kControlFua = 1 << 14,
+};
+
+// Attributes of Dataset Management commands (in CDW11).
+enum DatasetManagementAttributes {
+	kDsmDeallocate = 1 << 2,
 };
 
 enum AdminOpcode {
@@ -13,6 +32,11 @@ enum AdminOpcode {
 	kDeleteCQ = 0x4,
 	kCreateCQ = 0x5,
 	kIdentify = 0x6,
+	kSetFeatures = 0x9,
+};
+
+enum FeatureId {
+	kFeatureNumQueues = 0x07,
 };
 
 enum CommandFlags {
@@ -20,6 +44,27 @@ enum CommandFlags {
 	kCQIrqEnabled = 1 << 1,
 };
 
+// Bits 7:6 of the command flags select PRPs or SGLs for the data pointer.
+enum DataTransferFlags {
+	kPsdtPrp = 0 << 6,
+	kPsdtSgl = 1 << 6,
+	kPsdtMask = 3 << 6,
+};
+
+// Bits 1:0 of IdentifyController::sgls.
+enum SglSupport {
+	kSglUnsupported = 0,
+	kSglSupported = 1,
+	kSglDwordAligned = 2,
+};
+
+// Descriptor types (bits 7:4 of the identifier).
+enum SglDescriptorType {
+	kSglDataBlock = 0x0 << 4,
+	kSglSegment = 0x2 << 4,
+	kSglLastSegment = 0x3 << 4,
+};
+
 enum IdentifyCNS {
 	kIdentifyNamespace = 0x00,
 	kIdentifyController = 0x01,
@@ -183,6 +228,23 @@ struct DataPointer {
 };
 static_assert(sizeof(DataPointer) == 16);
 
+// SGL descriptors can replace the PRP entries of a DataPointer.
+struct SglDescriptor {
+	uint64_t address;
+	uint32_t length;
+	uint8_t __reserved[3];
+	uint8_t identifier;
+};
+static_assert(sizeof(SglDescriptor) == 16);
+
+// Dataset Management commands take a list of up to 256 such ranges.
+struct DsmRange {
+	uint32_t attributes;
+	uint32_t numBlocks;
+	uint64_t startLba;
+};
+static_assert(sizeof(DsmRange) == 16);
+
 struct CommonCommand {
 	uint8_t opcode;
 	uint8_t flags;
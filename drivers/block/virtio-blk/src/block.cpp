@@ -1,6 +1,9 @@
 
 #include <stdlib.h>
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <thread>
 
 #include "block.hpp"
 
@@ -13,8 +16,8 @@ static bool logInitiateRetire = false;
 // UserRequest
 // --------------------------------------------------------
 
-UserRequest::UserRequest(bool write_, uint64_t sector_, void *buffer_, size_t num_sectors_)
-: write{write_}, sector{sector_}, buffer{buffer_}, numSectors{num_sectors_} { }
+UserRequest::UserRequest(uint32_t type_, uint64_t sector_, void *buffer_, size_t length_)
+: type{type_}, sector{sector_}, buffer{buffer_}, length{length_} { }
 
 // --------------------------------------------------------
 // Device
@@ -22,12 +25,48 @@ UserRequest::UserRequest(bool write_, uint64_t sector_, void *buffer_, size_t nu
 
 Device::Device(std::unique_ptr<virtio_core::Transport> transport)
 : blockfs::BlockDevice{512}, _transport{std::move(transport)},
-		_requestQueue{nullptr} { }
+		_useIndirect{false}, _maxSegments{0}, _useFlush{false}, _useDiscard{false},
+		_useWriteZeroes{false}, _maxDiscardSectors{0}, _maxWriteZeroesSectors{0} { }
 
 void Device::runDevice() {
+	size_t seg_max = 0;
+	size_t num_queues = 1;
+
+	if(_transport->checkDeviceFeature(virtio_core::VIRTIO_F_INDIRECT_DESC)) {
+		_transport->acknowledgeDriverFeature(virtio_core::VIRTIO_F_INDIRECT_DESC);
+		_useIndirect = true;
+	}
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_SEG_MAX)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_SEG_MAX);
+		seg_max = _transport->space().load(spec::regs::segMax);
+	}
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_FLUSH)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_FLUSH);
+		_useFlush = true;
+	}
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_DISCARD)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_DISCARD);
+		_maxDiscardSectors = _transport->space().load(spec::regs::maxDiscardSectors);
+		_useDiscard = _maxDiscardSectors > 0;
+	}
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_WRITE_ZEROES)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_WRITE_ZEROES);
+		_maxWriteZeroesSectors = _transport->space().load(spec::regs::maxWriteZeroesSectors);
+		_useWriteZeroes = _maxWriteZeroesSectors > 0;
+	}
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_MQ)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_MQ);
+		// There is no point in using more queues than CPUs.
+		num_queues = std::clamp(static_cast<size_t>(_transport->space().load(spec::regs::numQueues)),
+				size_t{1}, static_cast<size_t>(std::max(std::thread::hardware_concurrency(), 1u)));
+	}
+
 	_transport->finalizeFeatures();
-	_transport->claimQueues(1);
-	_requestQueue = _transport->setupQueue(0);
+	_transport->claimQueues(num_queues);
+
+	for(size_t i = 0; i < num_queues; i++)
+		_requestQueues.push_back(RequestQueue{_transport->setupQueue(i),
+				nullptr, nullptr, nullptr});
 
 	auto size = static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[0]))
 			| (static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[1])) << 32);
@@ -36,119 +75,230 @@ void Device::runDevice() {
 	_transport->runDevice();
 
 	// perform device specific setup
-	virtRequestBuffer = new VirtRequest[_requestQueue->numDescriptors()];
-	statusBuffer = new uint8_t[_requestQueue->numDescriptors()];
+	for(auto &queue : _requestQueues) {
+		auto num_descriptors = queue.virtq->numDescriptors();
+		queue.virtRequestBuffer = new VirtRequest[num_descriptors];
+		queue.statusBuffer = new uint8_t[num_descriptors];
+
+		// natural alignment makes sure that request headers do not cross page boundaries
+		assert((uintptr_t)queue.virtRequestBuffer % sizeof(VirtRequest) == 0);
+
+		if(_useIndirect) {
+			// Align each table to its size so that it is physically contiguous.
+			constexpr size_t table_bytes = indirectTableSize * sizeof(virtio_core::spec::Descriptor);
+			queue.indirectBuffer = static_cast<virtio_core::spec::Descriptor *>(
+					aligned_alloc(table_bytes, num_descriptors * table_bytes));
+			assert(queue.indirectBuffer);
+		}
+	}
+
+	// One descriptor is needed for the header and one for the status byte.
+	// Without indirect tables, limit the chain length to ensure that we don't monopolize the device.
+	if(_useIndirect) {
+		_maxSegments = indirectTableSize - 2;
+	}else{
+		_maxSegments = _requestQueues.front().virtq->numDescriptors() / 4;
+	}
+	if(seg_max)
+		_maxSegments = std::min(_maxSegments, seg_max);
+	assert(_maxSegments >= 1);
+
+	std::cout << "virtio: Using " << num_queues << " queue(s), up to " << _maxSegments
+			<< " segments per request, indirect descriptors: "
+			<< (_useIndirect ? "yes" : "no") << ", flush: " << (_useFlush ? "yes" : "no")
+			<< ", discard: " << (_useDiscard ? "yes" : "no")
+			<< ", write zeroes: " << (_useWriteZeroes ? "yes" : "no") << std::endl;
 
-	// natural alignment makes sure that request headers do not cross page boundaries
-	assert((uintptr_t)virtRequestBuffer % sizeof(VirtRequest) == 0);
-	
 	// setup an interrupt for the device
-	_processRequests();
+	for(auto &queue : _requestQueues)
+		_processRequests(&queue);
 
 	blockfs::runDevice(this);
 }
 
 async::result<void> Device::readSectors(uint64_t sector,
 		void *buffer, size_t num_sectors) {
+	co_await _transfer(false, sector, buffer, num_sectors);
+}
+
+async::result<void> Device::writeSectors(uint64_t sector,
+		const void *buffer, size_t num_sectors) {
+	co_await _transfer(true, sector, const_cast<void *>(buffer), num_sectors);
+}
+
+async::result<void> Device::_transfer(bool write, uint64_t sector,
+		void *buffer, size_t num_sectors) {
 	// Natural alignment makes sure a sector does not cross a page boundary.
 	assert(!((uintptr_t)buffer % 512));
-//	printf("readSectors(%lu, %lu)\n", sector, num_sectors);
 
-	// Limit to ensure that we don't monopolize the device.
-	auto max_sectors = _requestQueue->numDescriptors() / 4;
-	assert(max_sectors >= 1);
+	// Each segment covers at most one page. As the buffer is only sector-aligned,
+	// the first and last page might be partial.
+	size_t max_sectors = 1;
+	if(_maxSegments > 1)
+		max_sectors = (_maxSegments - 1) * (0x1000 / 512);
 
+	// Split the transfer, but keep all parts in flight at the same time.
+	std::vector<std::unique_ptr<UserRequest>> requests;
 	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
-		auto request = new UserRequest(false, sector + progress,
-				(char *)buffer + 512 * progress,
-				std::min(num_sectors - progress, max_sectors));
-		_pendingQueue.push(request);
-		_pendingDoorbell.raise();
-		co_await request->event.wait();
-		delete request;
+		auto request = std::make_unique<UserRequest>(write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN,
+				sector + progress, (char *)buffer + 512 * progress,
+				512 * std::min(num_sectors - progress, max_sectors));
+		_pendingQueue.push(request.get());
+		requests.push_back(std::move(request));
 	}
+	_pendingDoorbell.raise();
+
+	for(auto &request : requests)
+		co_await request->event.wait();
 }
 
-async::result<void> Device::writeSectors(uint64_t sector,
-		const void *buffer, size_t num_sectors) {
-	// Natural alignment makes sure a sector does not cross a page boundary.
-	assert(!((uintptr_t)buffer % 512));
-//	printf("writeSectors(%lu, %lu)\n", sector, num_sectors);
+async::result<void> Device::flush() {
+	if(!_useFlush)
+		co_return;
+
+	UserRequest request{VIRTIO_BLK_T_FLUSH, 0, nullptr, 0};
+	co_await _submitSingle(&request);
+}
 
-	// Limit to ensure that we don't monopolize the device.
-	auto max_sectors = _requestQueue->numDescriptors() / 4;
-	assert(max_sectors >= 1);
+async::result<void> Device::discardSectors(uint64_t sector, size_t num_sectors) {
+	if(!_useDiscard)
+		co_return;
+	co_await _submitSegments(VIRTIO_BLK_T_DISCARD, sector, num_sectors, _maxDiscardSectors);
+}
 
+async::result<void> Device::writeZeroes(uint64_t sector, size_t num_sectors) {
+	if(!_useWriteZeroes) {
+		co_await BlockDevice::writeZeroes(sector, num_sectors);
+		co_return;
+	}
+	co_await _submitSegments(VIRTIO_BLK_T_WRITE_ZEROES, sector, num_sectors,
+			_maxWriteZeroesSectors);
+}
+
+async::result<void> Device::_submitSegments(uint32_t type, uint64_t sector,
+		size_t num_sectors, size_t max_sectors) {
+	// We only use a single segment per request; this avoids depending on
+	// max_discard_seg and max_write_zeroes_seg.
+	VirtDiscardSegment segment;
 	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
-		auto request = new UserRequest(true, sector + progress,
-				(char *)buffer + 512 * progress,
-				std::min(num_sectors - progress, max_sectors));
-		_pendingQueue.push(request);
-		_pendingDoorbell.raise();
-		co_await request->event.wait();
-		delete request;
+		segment.sector = sector + progress;
+		segment.numSectors = std::min(num_sectors - progress, max_sectors);
+		segment.flags = 0;
+
+		UserRequest request{type, 0, &segment, sizeof(VirtDiscardSegment)};
+		co_await _submitSingle(&request);
 	}
 }
 
-async::detached Device::_processRequests() {
+async::result<void> Device::_submitSingle(UserRequest *request) {
+	_pendingQueue.push(request);
+	_pendingDoorbell.raise();
+	co_await request->event.wait();
+}
+
+async::detached Device::_processRequests(RequestQueue *queue) {
 	while(true) {
 		if(_pendingQueue.empty()) {
 			co_await _pendingDoorbell.async_wait();
 			continue;
 		}
 
-		auto request = _pendingQueue.front();
-		_pendingQueue.pop();
-		assert(request->numSectors);
+		// Post all pending requests, then notify the device only once.
+		// Note that obtainDescriptor() notifies the device itself before it blocks.
+		while(!_pendingQueue.empty()) {
+			auto request = _pendingQueue.front();
+			_pendingQueue.pop();
 
-		// Setup the descriptor for the request header.
-		virtio_core::Chain chain;
-		chain.append(co_await _requestQueue->obtainDescriptor());
-
-		VirtRequest *header = &virtRequestBuffer[chain.front().tableIndex()];
-		if(request->write) {
-			header->type = VIRTIO_BLK_T_OUT;
-		}else{
-			header->type = VIRTIO_BLK_T_IN;
-		}
-		header->reserved = 0;
-		header->sector = request->sector;
-
-		chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
-				header, sizeof(VirtRequest)});
-		
-		// Setup descriptors for the transfered data.
-		for(size_t i = 0; i < request->numSectors; i++) {
-			chain.append(co_await _requestQueue->obtainDescriptor());
-			if(request->write) {
-				chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
-						(char *)request->buffer + 512 * i, 512});
+			if(_useIndirect) {
+				co_await _submitIndirect(queue, request);
 			}else{
-				chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
-						(char *)request->buffer + 512 * i, 512});
+				co_await _submitDirect(queue, request);
 			}
+
+			if(logInitiateRetire)
+				std::cout << "Submitting request of type " << request->type << " with "
+						<< request->length << " bytes on queue "
+						<< queue->virtq->queueIndex() << std::endl;
 		}
 
+		queue->virtq->notify();
+	}
+}
+
+namespace {
+	void completeRequest(virtio_core::Request *base_request) {
+		auto request = static_cast<UserRequest *>(base_request);
 		if(logInitiateRetire)
-			std::cout << "Submitting " << request->numSectors
-					<< " data descriptors" << std::endl;
-
-		// Setup a descriptor for the status byte.
-		chain.append(co_await _requestQueue->obtainDescriptor());
-		chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
-				&statusBuffer[chain.front().tableIndex()], 1});
-
-		// Submit the request to the device
-		_requestQueue->postDescriptor(chain.front(), request,
-				[] (virtio_core::Request *base_request) {
-			auto request = static_cast<UserRequest *>(base_request);
-			if(logInitiateRetire)
-				std::cout << "Retiring " << request->numSectors
-						<< " data descriptors" << std::endl;
-			request->event.raise();
-		});
-		_requestQueue->notify();
+			std::cout << "Retiring request of type " << request->type << " with "
+					<< request->length << " bytes" << std::endl;
+		request->event.raise();
+	}
+}
+
+async::result<void> Device::_submitIndirect(RequestQueue *queue, UserRequest *request) {
+	// The entire request only occupies a single descriptor of the virtq.
+	auto handle = co_await queue->virtq->obtainDescriptor();
+	auto index = handle.tableIndex();
+
+	VirtRequest *header = &queue->virtRequestBuffer[index];
+	header->type = request->type;
+	header->reserved = 0;
+	header->sector = request->sector;
+
+	virtio_core::IndirectChain chain{queue->indirectBuffer + index * indirectTableSize,
+			indirectTableSize};
+	chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
+			header, sizeof(VirtRequest)});
+
+	// Only reads transfer data to the host; flushes do not transfer data at all.
+	if(request->length) {
+		arch::dma_buffer_view data{nullptr, request->buffer, request->length};
+		if(request->type != VIRTIO_BLK_T_IN) {
+			virtio_core::scatterGather(virtio_core::hostToDevice, chain, data);
+		}else{
+			virtio_core::scatterGather(virtio_core::deviceToHost, chain, data);
+		}
 	}
+
+	chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
+			&queue->statusBuffer[index], 1});
+
+	handle.setupIndirect(chain);
+	queue->virtq->postDescriptor(handle, request, &completeRequest);
+}
+
+async::result<void> Device::_submitDirect(RequestQueue *queue, UserRequest *request) {
+	// Setup the descriptor for the request header.
+	virtio_core::Chain chain;
+	chain.append(co_await queue->virtq->obtainDescriptor());
+	auto index = chain.front().tableIndex();
+
+	VirtRequest *header = &queue->virtRequestBuffer[index];
+	header->type = request->type;
+	header->reserved = 0;
+	header->sector = request->sector;
+
+	chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
+			header, sizeof(VirtRequest)});
+
+	// Setup descriptors for the transfered data.
+	if(request->length) {
+		arch::dma_buffer_view data{nullptr, request->buffer, request->length};
+		if(request->type != VIRTIO_BLK_T_IN) {
+			co_await virtio_core::scatterGather(virtio_core::hostToDevice, chain,
+					queue->virtq, data);
+		}else{
+			co_await virtio_core::scatterGather(virtio_core::deviceToHost, chain,
+					queue->virtq, data);
+		}
+	}
+
+	// Setup a descriptor for the status byte.
+	chain.append(co_await queue->virtq->obtainDescriptor());
+	chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
+			&queue->statusBuffer[index], 1});
+
+	queue->virtq->postDescriptor(chain.front(), request, &completeRequest);
 }
 
 } } // namespace block::virtio
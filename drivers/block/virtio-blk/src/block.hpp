@@ -1,5 +1,6 @@
 
 #include <queue>
+#include <vector>
 
 #include <blockfs.hpp>
 #include <core/virtio/core.hpp>
@@ -21,13 +22,37 @@ static_assert(sizeof(VirtRequest) == 16, "Bad sizeof(VirtRequest)");
 
 enum {
 	VIRTIO_BLK_T_IN = 0,
-	VIRTIO_BLK_T_OUT = 1
+	VIRTIO_BLK_T_OUT = 1,
+	VIRTIO_BLK_T_FLUSH = 4,
+	VIRTIO_BLK_T_DISCARD = 11,
+	VIRTIO_BLK_T_WRITE_ZEROES = 13
+};
+
+// Payload of VIRTIO_BLK_T_DISCARD and VIRTIO_BLK_T_WRITE_ZEROES requests.
+struct VirtDiscardSegment {
+	uint64_t sector;
+	uint32_t numSectors;
+	uint32_t flags;
+};
+static_assert(sizeof(VirtDiscardSegment) == 16, "Bad sizeof(VirtDiscardSegment)");
+
+// Feature bits.
+enum {
+	VIRTIO_BLK_F_SEG_MAX = 2,
+	VIRTIO_BLK_F_FLUSH = 9,
+	VIRTIO_BLK_F_MQ = 12,
+	VIRTIO_BLK_F_DISCARD = 13,
+	VIRTIO_BLK_F_WRITE_ZEROES = 14
 };
 
 namespace spec::regs {
 	inline constexpr arch::scalar_register<uint32_t> capacity[] = {
 			arch::scalar_register<uint32_t>{0},
 			arch::scalar_register<uint32_t>{4}};
+	inline constexpr arch::scalar_register<uint32_t> segMax{12};
+	inline constexpr arch::scalar_register<uint16_t> numQueues{34};
+	inline constexpr arch::scalar_register<uint32_t> maxDiscardSectors{36};
+	inline constexpr arch::scalar_register<uint32_t> maxWriteZeroesSectors{48};
 }
 
 struct Device;
@@ -37,12 +62,14 @@ struct Device;
 // --------------------------------------------------------
 
 struct UserRequest : virtio_core::Request {
-	UserRequest(bool write, uint64_t sector, void *buffer, size_t num_sectors);
+	UserRequest(uint32_t type, uint64_t sector, void *buffer, size_t length);
 
-	bool write;
+	// One of the VIRTIO_BLK_T_ request types.
+	uint32_t type;
 	uint64_t sector;
+	// For discard and write zeroes requests, this points to a VirtDiscardSegment.
 	void *buffer;
-	size_t numSectors;
+	size_t length;
 
 	async::oneshot_event event;
 };
@@ -51,7 +78,22 @@ struct UserRequest : virtio_core::Request {
 // Device
 // --------------------------------------------------------
 
+// Per-virtq state of a Device.
+struct RequestQueue {
+	virtio_core::Queue *virtq;
+
+	// These buffers store virtio-block request headers, status bytes and indirect tables.
+	// They are indexed by the index of the request's first descriptor.
+	VirtRequest *virtRequestBuffer;
+	uint8_t *statusBuffer;
+	virtio_core::spec::Descriptor *indirectBuffer;
+};
+
 struct Device : blockfs::BlockDevice {
+	// Number of entries of each indirect descriptor table.
+	// Chosen such that a table (16 bytes per entry) does not cross a page boundary.
+	static constexpr size_t indirectTableSize = 128;
+
 	Device(std::unique_ptr<virtio_core::Transport> transport);
 
 	void runDevice();
@@ -62,23 +104,51 @@ struct Device : blockfs::BlockDevice {
 	async::result<void> writeSectors(uint64_t sector,
 			const void *buffer, size_t num_sectors) override;
 
+	async::result<void> flush() override;
+
+	async::result<void> discardSectors(uint64_t sector, size_t num_sectors) override;
+
+	async::result<void> writeZeroes(uint64_t sector, size_t num_sectors) override;
+
 private:
-	// Submits requests from _pendingQueue to the device.
-	async::detached _processRequests();
-	
+	async::result<void> _transfer(bool write, uint64_t sector, void *buffer, size_t num_sectors);
+
+	// Issues discard or write zeroes requests of at most max_sectors each.
+	async::result<void> _submitSegments(uint32_t type, uint64_t sector, size_t num_sectors,
+			size_t max_sectors);
+
+	// Submits a single request and waits for its completion.
+	async::result<void> _submitSingle(UserRequest *request);
+
+	// Submits requests from _pendingQueue to the given virtq.
+	// There is one such loop per virtq; they all compete for the same _pendingQueue.
+	async::detached _processRequests(RequestQueue *queue);
+
+	// Submits a single request, either via an indirect table or via a direct chain.
+	async::result<void> _submitIndirect(RequestQueue *queue, UserRequest *request);
+	async::result<void> _submitDirect(RequestQueue *queue, UserRequest *request);
+
 	std::unique_ptr<virtio_core::Transport> _transport;
 
-	// The single virtq of this device.
-	virtio_core::Queue *_requestQueue;
+	std::vector<RequestQueue> _requestQueues;
+
+	// Whether VIRTIO_F_INDIRECT_DESC was negotiated.
+	bool _useIndirect;
+
+	// Maximal number of data segments per request.
+	size_t _maxSegments;
+
+	// Whether VIRTIO_BLK_F_FLUSH, VIRTIO_BLK_F_DISCARD and VIRTIO_BLK_F_WRITE_ZEROES
+	// were negotiated, and the sector limits of the latter two.
+	bool _useFlush;
+	bool _useDiscard;
+	bool _useWriteZeroes;
+	size_t _maxDiscardSectors;
+	size_t _maxWriteZeroesSectors;
 
 	// Stores UserRequest objects that have not been submitted yet.
 	std::queue<UserRequest *> _pendingQueue;
 	async::recurring_event _pendingDoorbell;
-
-	// these two buffer store virtio-block request header and status bytes
-	// they are indexed by the index of the request's first descriptor
-	VirtRequest *virtRequestBuffer;
-	uint8_t *statusBuffer;
 };
 
 } } // namespace block::virtio
@@ -77,7 +77,7 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 
 		GfxDevice::BufferObject *getBufferObject();
 		uint32_t getPixelPitch();
-		void notifyDirty() override;
+		void notifyDirty(const std::vector<drm_core::DamageRect> &clips) override;
 
 	private:
 		std::shared_ptr<GfxDevice::BufferObject> _bo;
@@ -1,6 +1,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <algorithm>
 #include <deque>
 #include <experimental/optional>
 #include <functional>
@@ -210,22 +211,7 @@ async::detached GfxDevice::Configuration::_dispatch(std::unique_ptr<drm_core::At
 			auto bo = fb->getBufferObject();
 			assert(bo->getWidth() == _device->_screenWidth);
 			assert(bo->getHeight() == _device->_screenHeight);
-			auto dest = reinterpret_cast<char *>(_device->_fbMapping.get());
-			auto src = reinterpret_cast<char *>(bo->accessMapping());
-
-			if(fb->fastScanout()) {
-				for(unsigned int k = 0; k < bo->getHeight(); k++) {
-					drm_core::fastCopy16(dest, src, bo->getWidth() * 4);
-					dest += _device->_screenPitch;
-					src += fb->getPitch();
-				}
-			}else{
-				for(unsigned int k = 0; k < bo->getHeight(); k++) {
-					memcpy(dest, src, bo->getWidth() * 4);
-					dest += _device->_screenPitch;
-					src += fb->getPitch();
-				}
-			}
+			fb->scanout({0, 0, bo->getWidth(), bo->getHeight()});
 		}
 	} else {
 		std::cout << "gfx/plainfb: Disable scanout" << std::endl;
@@ -289,9 +275,50 @@ GfxDevice::BufferObject *GfxDevice::FrameBuffer::getBufferObject() {
 	return _bo.get();
 }
 
-void GfxDevice::FrameBuffer::notifyDirty() {
-	// TODO: Re-blit the FrameBuffer if it is currently displayed.
-	std::cout << "gfx/plainfb: notifyDirty() is not implemented correctly" << std::endl;
+void GfxDevice::FrameBuffer::notifyDirty(const std::vector<drm_core::DamageRect> &clips) {
+	// Only re-blit the FrameBuffer if it is currently displayed.
+	auto crtc_state = _device->_theCrtc->drmState();
+	if(!_device->_claimedDevice || !crtc_state || !crtc_state->mode)
+		return;
+	auto plane_state = _device->_plane->drmState();
+	if(!plane_state || plane_state->fb.get() != this)
+		return;
+
+	if(clips.empty()) {
+		scanout({0, 0, _bo->getWidth(), _bo->getHeight()});
+	}else{
+		for(auto &clip : clips)
+			scanout(clip);
+	}
+}
+
+void GfxDevice::FrameBuffer::scanout(drm_core::DamageRect rect) {
+	auto x2 = std::min(rect.x2, _bo->getWidth());
+	auto y2 = std::min(rect.y2, _bo->getHeight());
+	auto x1 = rect.x1;
+	if(x1 >= x2 || rect.y1 >= y2)
+		return;
+
+	// fastCopy16() moves 16 bytes (i.e., 4 pixels) at a time. Since the width is
+	// a multiple of 4 pixels on this path, rounding the columns stays within the row.
+	if(_fastScanout) {
+		x1 &= ~uint32_t{3};
+		x2 = (x2 + 3) & ~uint32_t{3};
+	}
+
+	auto dest = reinterpret_cast<char *>(_device->_fbMapping.get())
+			+ rect.y1 * _device->_screenPitch + x1 * 4;
+	auto src = reinterpret_cast<char *>(_bo->accessMapping())
+			+ rect.y1 * _pitch + x1 * 4;
+	for(auto k = rect.y1; k < y2; k++) {
+		if(_fastScanout) {
+			drm_core::fastCopy16(dest, src, (x2 - x1) * 4);
+		}else{
+			memcpy(dest, src, (x2 - x1) * 4);
+		}
+		dest += _device->_screenPitch;
+		src += _pitch;
+	}
 }
 
 // ----------------------------------------------------------------
@@ -354,7 +381,8 @@ async::detached bindController(mbus::Entity entity) {
 
 	auto gfx_device = std::make_shared<GfxDevice>(std::move(hw_device),
 			info.width, info.height, info.pitch,
-			helix::Mapping{fb_memory, 0, info.pitch * info.height});
+			helix::Mapping{fb_memory, 0, info.pitch * info.height,
+					kHelMapProtRead | kHelMapProtWrite | kHelMapCacheWriteCombine});
 	gfx_device->initialize();
 
 	// Create an mbus object for the device.
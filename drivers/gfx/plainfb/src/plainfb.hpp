@@ -78,7 +78,10 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 		bool fastScanout() { return _fastScanout; }
 
 		GfxDevice::BufferObject *getBufferObject();
-		void notifyDirty() override;
+		void notifyDirty(const std::vector<drm_core::DamageRect> &clips) override;
+
+		// Copies a region of the framebuffer to the hardware framebuffer.
+		void scanout(drm_core::DamageRect rect);
 
 	private:
 		GfxDevice *_device;
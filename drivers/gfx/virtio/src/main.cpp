@@ -1,6 +1,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <algorithm>
 #include <deque>
 #include <optional>
 #include <functional>
@@ -77,22 +78,27 @@ async::detached GfxDevice::initialize() {
 	auto num_scanouts = static_cast<uint32_t>(_transport->space().load(spec::cfg::numScanouts));
 	for(size_t i = 0; i < num_scanouts; i++) {
 		auto plane = std::make_shared<Plane>(this, i, Plane::PlaneType::PRIMARY);
-		auto crtc = std::make_shared<Crtc>(this, i, plane);
+		auto cursor_plane = std::make_shared<Plane>(this, i, Plane::PlaneType::CURSOR);
+		auto crtc = std::make_shared<Crtc>(this, i, plane, cursor_plane);
 		auto encoder = std::make_shared<Encoder>(this);
 
 		plane->setupWeakPtr(plane);
 		plane->setupState(plane);
+		cursor_plane->setupWeakPtr(cursor_plane);
+		cursor_plane->setupState(cursor_plane);
 		crtc->setupWeakPtr(crtc);
 		crtc->setupState(crtc);
 		encoder->setupWeakPtr(encoder);
 
 		plane->setupPossibleCrtcs({crtc.get()});
+		cursor_plane->setupPossibleCrtcs({crtc.get()});
 
 		encoder->setupPossibleCrtcs({crtc.get()});
 		encoder->setupPossibleClones({encoder.get()});
 		encoder->setCurrentCrtc(crtc.get());
 
 		registerObject(plane.get());
+		registerObject(cursor_plane.get());
 		registerObject(crtc.get());
 		registerObject(encoder.get());
 
@@ -110,6 +116,10 @@ async::detached GfxDevice::initialize() {
 		assignments.push_back(drm_core::Assignment::withInt(plane, crtcYProperty(), 0));
 		assignments.push_back(drm_core::Assignment::withModeObj(plane, fbIdProperty(), nullptr));
 
+		assignments.push_back(drm_core::Assignment::withInt(cursor_plane, planeTypeProperty(), 2));
+		assignments.push_back(drm_core::Assignment::withModeObj(cursor_plane, crtcIdProperty(), crtc));
+		assignments.push_back(drm_core::Assignment::withModeObj(cursor_plane, fbIdProperty(), nullptr));
+
 		setupCrtc(crtc.get());
 		setupEncoder(encoder.get());
 
@@ -260,6 +270,20 @@ async::detached GfxDevice::Configuration::_dispatch(std::unique_ptr<drm_core::At
 		_device->_claimedDevice = true;
 	}
 
+	// Cursor planes are handled by the cursor queue. If nothing else changed,
+	// we do not need to touch the scanouts at all.
+	bool cursor_only = state->cursorOnly();
+	for(auto &[id, ps] : state->plane_states()) {
+		if(ps->plane->type() != drm_core::Plane::PlaneType::CURSOR)
+			continue;
+		auto crtc = static_cast<GfxDevice::Crtc *>(ps->plane->getPossibleCrtcs().front());
+		co_await crtc->commitCursor(ps);
+	}
+	if(cursor_only) {
+		complete();
+		co_return;
+	}
+
 	auto crtc_states = state->crtc_states();
 
 	for(auto pair : crtc_states) {
@@ -378,21 +402,148 @@ GfxDevice::Encoder::Encoder(GfxDevice *device)
 // GfxDevice::Crtc.
 // ----------------------------------------------------------------
 
-GfxDevice::Crtc::Crtc(GfxDevice *device, int id, std::shared_ptr<Plane> plane)
+GfxDevice::Crtc::Crtc(GfxDevice *device, int id, std::shared_ptr<Plane> plane,
+		std::shared_ptr<Plane> cursor_plane)
 	:drm_core::Crtc { device->allocator.allocate() } {
 	_device = device;
 	_scanoutId = id;
 	_primaryPlane = plane;
+	_cursorPlane = cursor_plane;
 }
 
 drm_core::Plane *GfxDevice::Crtc::primaryPlane() {
 	return _primaryPlane.get();
 }
 
+drm_core::Plane *GfxDevice::Crtc::cursorPlane() {
+	return _cursorPlane.get();
+}
+
 int GfxDevice::Crtc::scanoutId() {
 	return _scanoutId;
 }
 
+async::result<void> GfxDevice::Crtc::commitCursor(std::shared_ptr<drm_core::PlaneState> state) {
+	auto previous = _cursorPlane->drmState();
+	_cursorPlane->setDrmState(state);
+
+	spec::UpdateCursor cursor;
+	memset(&cursor, 0, sizeof(spec::UpdateCursor));
+	cursor.pos.scanoutId = _scanoutId;
+	cursor.pos.x = state->crtc_x;
+	cursor.pos.y = state->crtc_y;
+
+	if(state->fb != previous->fb) {
+		// A resource ID of zero hides the cursor.
+		if(state->fb) {
+			auto fb = static_pointer_cast<GfxDevice::FrameBuffer>(state->fb);
+			co_await _uploadCursor(fb->getBufferObject());
+			cursor.resourceId = _cursorResource;
+		}
+		cursor.header.type = spec::cmd::updateCursor;
+	}else{
+		if(!state->fb)
+			co_return;
+		cursor.header.type = spec::cmd::moveCursor;
+		cursor.resourceId = _cursorResource;
+	}
+
+	// Commands on the cursor queue do not return a response.
+	virtio_core::Chain chain;
+	co_await virtio_core::scatterGather(virtio_core::hostToDevice, chain, _device->_cursorQ,
+			arch::dma_buffer_view{nullptr, &cursor, sizeof(spec::UpdateCursor)});
+	co_await AwaitableRequest{_device->_cursorQ, chain.front()};
+}
+
+async::result<void> GfxDevice::Crtc::_uploadCursor(GfxDevice::BufferObject *bo) {
+	constexpr uint32_t cursorSize = 64;
+	constexpr size_t imageSize = cursorSize * cursorSize * 4;
+
+	if(!_cursorResource) {
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(imageSize, 0, nullptr, &handle));
+		_cursorMemory = helix::UniqueDescriptor{handle};
+		_cursorMapping = helix::Mapping{_cursorMemory, 0, imageSize};
+		_cursorResource = _device->_hwAllocator.allocate();
+
+		spec::Create2d buffer;
+		memset(&buffer, 0, sizeof(spec::Create2d));
+		buffer.header.type = spec::cmd::create2d;
+		buffer.resourceId = _cursorResource;
+		buffer.format = spec::format::bgra;
+		buffer.width = cursorSize;
+		buffer.height = cursorSize;
+		spec::Header result;
+
+		virtio_core::Chain chain;
+		co_await virtio_core::scatterGather(virtio_core::hostToDevice, chain, _device->_controlQ,
+				arch::dma_buffer_view{nullptr, &buffer, sizeof(spec::Create2d)});
+		co_await virtio_core::scatterGather(virtio_core::deviceToHost, chain, _device->_controlQ,
+				arch::dma_buffer_view{nullptr, &result, sizeof(spec::Header)});
+		co_await AwaitableRequest{_device->_controlQ, chain.front()};
+		assert(result.type == spec::resp::noData);
+
+		// Fault in the pages before asking for their physical addresses.
+		memset(_cursorMapping.get(), 0, imageSize);
+		std::vector<spec::MemEntry> entries;
+		for(size_t page = 0; page < imageSize; page += 4096) {
+			spec::MemEntry entry;
+			memset(&entry, 0, sizeof(spec::MemEntry));
+			uintptr_t physical;
+			HEL_CHECK(helPointerPhysical(reinterpret_cast<char *>(_cursorMapping.get()) + page,
+					&physical));
+			entry.address = physical;
+			entry.length = 4096;
+			entries.push_back(entry);
+		}
+
+		spec::AttachBacking attachment;
+		memset(&attachment, 0, sizeof(spec::AttachBacking));
+		attachment.header.type = spec::cmd::attachBacking;
+		attachment.resourceId = _cursorResource;
+		attachment.numEntries = entries.size();
+
+		spec::Header attach_result;
+		virtio_core::Chain attach_chain;
+		co_await virtio_core::scatterGather(virtio_core::hostToDevice, attach_chain, _device->_controlQ,
+				arch::dma_buffer_view{nullptr, &attachment, sizeof(spec::AttachBacking)});
+		co_await virtio_core::scatterGather(virtio_core::hostToDevice, attach_chain, _device->_controlQ,
+				arch::dma_buffer_view{nullptr, entries.data(), entries.size() * sizeof(spec::MemEntry)});
+		co_await virtio_core::scatterGather(virtio_core::deviceToHost, attach_chain, _device->_controlQ,
+				arch::dma_buffer_view{nullptr, &attach_result, sizeof(spec::Header)});
+		co_await AwaitableRequest{_device->_controlQ, attach_chain.front()};
+		assert(attach_result.type == spec::resp::noData);
+	}
+
+	co_await bo->wait();
+
+	// Copy the image into the top left corner and clear the remaining pixels.
+	auto width = std::min(bo->getWidth(), cursorSize);
+	auto height = std::min(bo->getHeight(), cursorSize);
+	helix::Mapping image{bo->getMemory().first, 0, bo->getSize()};
+	auto dest = reinterpret_cast<char *>(_cursorMapping.get());
+	auto src = reinterpret_cast<char *>(image.get());
+	memset(dest, 0, imageSize);
+	for(uint32_t k = 0; k < height; k++)
+		memcpy(dest + k * cursorSize * 4, src + k * bo->getWidth() * 4, width * 4);
+
+	spec::XferToHost2d xfer;
+	memset(&xfer, 0, sizeof(spec::XferToHost2d));
+	xfer.header.type = spec::cmd::xferToHost2d;
+	xfer.rect.width = cursorSize;
+	xfer.rect.height = cursorSize;
+	xfer.resourceId = _cursorResource;
+
+	spec::Header xfer_result;
+	virtio_core::Chain xfer_chain;
+	co_await virtio_core::scatterGather(virtio_core::hostToDevice, xfer_chain, _device->_controlQ,
+			arch::dma_buffer_view{nullptr, &xfer, sizeof(spec::XferToHost2d)});
+	co_await virtio_core::scatterGather(virtio_core::deviceToHost, xfer_chain, _device->_controlQ,
+			arch::dma_buffer_view{nullptr, &xfer_result, sizeof(spec::Header)});
+	co_await AwaitableRequest{_device->_controlQ, xfer_chain.front()};
+	assert(xfer_result.type == spec::resp::noData);
+}
+
 // ----------------------------------------------------------------
 // GfxDevice::FrameBuffer.
 // ----------------------------------------------------------------
@@ -408,35 +559,58 @@ GfxDevice::BufferObject *GfxDevice::FrameBuffer::getBufferObject() {
 	return _bo.get();
 }
 
-void GfxDevice::FrameBuffer::notifyDirty() {
-	_xferAndFlush();
-}
-
-async::detached GfxDevice::FrameBuffer::_xferAndFlush() {
-	spec::XferToHost2d xfer;
-	memset(&xfer, 0, sizeof(spec::XferToHost2d));
-	xfer.header.type = spec::cmd::xferToHost2d;
-	xfer.rect.x = 0;
-	xfer.rect.y = 0;
-	xfer.rect.width = _bo->getWidth();
-	xfer.rect.height = _bo->getHeight();
-	xfer.resourceId = _bo->hardwareId();
-
-	spec::Header xfer_result;
-	virtio_core::Chain xfer_chain;
-	co_await virtio_core::scatterGather(virtio_core::hostToDevice, xfer_chain, _device->_controlQ,
-		arch::dma_buffer_view{nullptr, &xfer, sizeof(spec::XferToHost2d)});
-	co_await virtio_core::scatterGather(virtio_core::deviceToHost, xfer_chain, _device->_controlQ,
-		arch::dma_buffer_view{nullptr, &xfer_result, sizeof(spec::Header)});
-	co_await AwaitableRequest{_device->_controlQ, xfer_chain.front()};
+void GfxDevice::FrameBuffer::notifyDirty(const std::vector<drm_core::DamageRect> &clips) {
+	std::vector<spec::Rect> rects;
+	if(clips.empty()) {
+		rects.push_back({0, 0, _bo->getWidth(), _bo->getHeight()});
+	}else{
+		for(auto &clip : clips) {
+			auto x2 = std::min(clip.x2, _bo->getWidth());
+			auto y2 = std::min(clip.y2, _bo->getHeight());
+			if(clip.x1 >= x2 || clip.y1 >= y2)
+				continue;
+			rects.push_back({clip.x1, clip.y1, x2 - clip.x1, y2 - clip.y1});
+		}
+		if(rects.empty())
+			return;
+	}
+	_xferAndFlush(std::move(rects));
+}
+
+// Transfers each damaged rectangle to the host but flushes only their bounding box.
+async::detached GfxDevice::FrameBuffer::_xferAndFlush(std::vector<spec::Rect> rects) {
+	auto x1 = _bo->getWidth(), y1 = _bo->getHeight();
+	uint32_t x2 = 0, y2 = 0;
+	for(auto &rect : rects) {
+		spec::XferToHost2d xfer;
+		memset(&xfer, 0, sizeof(spec::XferToHost2d));
+		xfer.header.type = spec::cmd::xferToHost2d;
+		xfer.rect = rect;
+		// Dumb buffers are tightly packed, see createDumb().
+		xfer.offset = (rect.y * _bo->getWidth() + rect.x) * 4;
+		xfer.resourceId = _bo->hardwareId();
+
+		spec::Header xfer_result;
+		virtio_core::Chain xfer_chain;
+		co_await virtio_core::scatterGather(virtio_core::hostToDevice, xfer_chain, _device->_controlQ,
+			arch::dma_buffer_view{nullptr, &xfer, sizeof(spec::XferToHost2d)});
+		co_await virtio_core::scatterGather(virtio_core::deviceToHost, xfer_chain, _device->_controlQ,
+			arch::dma_buffer_view{nullptr, &xfer_result, sizeof(spec::Header)});
+		co_await AwaitableRequest{_device->_controlQ, xfer_chain.front()};
+
+		x1 = std::min(x1, rect.x);
+		y1 = std::min(y1, rect.y);
+		x2 = std::max(x2, rect.x + rect.width);
+		y2 = std::max(y2, rect.y + rect.height);
+	}
 
 	spec::ResourceFlush flush;
 	memset(&flush, 0, sizeof(spec::ResourceFlush));
 	flush.header.type = spec::cmd::resourceFlush;
-	flush.rect.x = 0;
-	flush.rect.y = 0;
-	flush.rect.width = _bo->getWidth();
-	flush.rect.height = _bo->getHeight();
+	flush.rect.x = x1;
+	flush.rect.y = y1;
+	flush.rect.width = x2 - x1;
+	flush.rect.height = y2 - y1;
 	flush.resourceId = _bo->hardwareId();
 
 	spec::Header flush_result;
@@ -6,6 +6,7 @@
 namespace spec {
 
 namespace format {
+	inline constexpr uint32_t bgra = 1;
 	inline constexpr uint32_t bgrx = 2;
 	inline constexpr uint32_t xrgb = 4;
 }
@@ -18,6 +19,9 @@ namespace cmd {
 	inline constexpr uint32_t xferToHost2d = 0x105;
 	inline constexpr uint32_t attachBacking = 0x106;
 
+	inline constexpr uint32_t updateCursor = 0x300;
+	inline constexpr uint32_t moveCursor = 0x301;
+
 } //namespace cmd
 
 namespace resp {
@@ -91,6 +95,22 @@ struct ResourceFlush {
 	uint32_t padding;
 };
 
+struct CursorPos {
+	uint32_t scanoutId;
+	uint32_t x;
+	uint32_t y;
+	uint32_t padding;
+};
+
+struct UpdateCursor {
+	Header header;
+	CursorPos pos;
+	uint32_t resourceId;
+	uint32_t hotX;
+	uint32_t hotY;
+	uint32_t padding;
+};
+
 namespace cfg {
 	inline constexpr arch::scalar_register<uint32_t> numScanouts(8);
 } //namespace cfg
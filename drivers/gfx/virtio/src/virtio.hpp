@@ -84,24 +84,38 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 	};
 
 	struct Crtc final : drm_core::Crtc {
-		Crtc(GfxDevice *device, int id, std::shared_ptr<Plane> plane);
+		Crtc(GfxDevice *device, int id, std::shared_ptr<Plane> plane,
+				std::shared_ptr<Plane> cursor_plane);
 
 		drm_core::Plane *primaryPlane() override;
+		drm_core::Plane *cursorPlane() override;
 		int scanoutId();
-		// cursorPlane
+
+		// Applies the state of the cursor plane. The cursor image is only uploaded
+		// if it changed; otherwise, the cursor is just moved.
+		async::result<void> commitCursor(std::shared_ptr<drm_core::PlaneState> state);
 
 	private:
+		async::result<void> _uploadCursor(GfxDevice::BufferObject *bo);
+
 		GfxDevice *_device;
 		int _scanoutId;
 		std::shared_ptr<Plane> _primaryPlane;
+		std::shared_ptr<Plane> _cursorPlane;
+
+		// The host expects 64x64 cursor images. Cursor framebuffers are copied into
+		// this resource, which is created on first use.
+		uint32_t _cursorResource = 0;
+		helix::UniqueDescriptor _cursorMemory;
+		helix::Mapping _cursorMapping;
 	};
 
 	struct FrameBuffer final : drm_core::FrameBuffer {
 		FrameBuffer(GfxDevice *device, std::shared_ptr<GfxDevice::BufferObject> bo);
 
 		GfxDevice::BufferObject *getBufferObject();
-		void notifyDirty() override;
-		async::detached _xferAndFlush();
+		void notifyDirty(const std::vector<drm_core::DamageRect> &clips) override;
+		async::detached _xferAndFlush(std::vector<spec::Rect> rects);
 
 	private:
 		std::shared_ptr<GfxDevice::BufferObject> _bo;
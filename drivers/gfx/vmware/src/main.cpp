@@ -493,6 +493,9 @@ bool GfxDevice::Configuration::capture(std::vector<drm_core::Assignment> assignm
 		assign.property->writeToState(assign, state);
 		using namespace drm_core;
 
+		if (assign.object != _device->_cursorPlane)
+			_cursorOnly = false;
+
 		switch(assign.property->id()) {
 			case srcW: {
 				if (assign.object == _device->_cursorPlane && _device->hasCapability(caps::cursor)) {
@@ -606,17 +609,13 @@ async::detached GfxDevice::Configuration::commitConfiguration(std::unique_ptr<dr
 	}
 
 	if (_cursorMove) {
-		_device->_fifo.moveCursor(cursor_plane_state->src_x, cursor_plane_state->src_y);
+		_device->_fifo.moveCursor(cursor_plane_state->crtc_x, cursor_plane_state->crtc_y);
 	}
 
-	if (primary_plane_state->fb != nullptr) {
+	// Cursor updates are handled entirely by the hardware cursor.
+	if (primary_plane_state->fb != nullptr && !_cursorOnly) {
 		auto fb = static_pointer_cast<GfxDevice::FrameBuffer>(primary_plane_state->fb);
-		helix::Mapping user_fb{fb->getBufferObject()->getMemory().first, 0, fb->getBufferObject()->getSize()};
-		drm_core::fastCopy16(_device->_fbMapping.get(), user_fb.get(), fb->getBufferObject()->getSize());
-		int w = _device->readRegister(register_index::width),
-			h = _device->readRegister(register_index::height);
-
-		co_await _device->_fifo.updateRectangle(0, 0, w, h);
+		co_await fb->scanout();
 	}
 
 	complete();
@@ -663,6 +662,7 @@ drm_core::Plane *GfxDevice::Crtc::Crtc::cursorPlane() {
 GfxDevice::FrameBuffer::FrameBuffer(GfxDevice *dev,
 		std::shared_ptr<GfxDevice::BufferObject> bo, uint32_t pixel_pitch)
 	: drm_core::FrameBuffer { dev->allocator.allocate() } {
+	_device = dev;
 	_bo = bo;
 	_pixelPitch = pixel_pitch;
 }
@@ -675,8 +675,23 @@ uint32_t GfxDevice::FrameBuffer::getPixelPitch() {
 	return _pixelPitch;
 }
 
-void GfxDevice::FrameBuffer::notifyDirty() {
+void GfxDevice::FrameBuffer::notifyDirty(const std::vector<drm_core::DamageRect> &) {
+	// Since commits that only move the cursor do not copy the framebuffer anymore,
+	// clients rely on this to update the screen.
+	if (_device->_primaryPlane->getFrameBuffer() != this)
+		return;
+	[] (FrameBuffer *self) -> async::detached {
+		co_await self->scanout();
+	}(this);
+}
+
+async::result<void> GfxDevice::FrameBuffer::scanout() {
+	helix::Mapping user_fb{_bo->getMemory().first, 0, _bo->getSize()};
+	drm_core::fastCopy16(_device->_fbMapping.get(), user_fb.get(), _bo->getSize());
+	int w = _device->readRegister(register_index::width),
+		h = _device->readRegister(register_index::height);
 
+	co_await _device->_fifo.updateRectangle(0, 0, w, h);
 }
 
 // ----------------------------------------------------------------
@@ -729,7 +744,8 @@ async::result<void> setupDevice(mbus::Entity entity) {
 	auto fifo_bar_info = info.barInfo[2];
 
 	auto gfx_device = std::make_shared<GfxDevice>(std::move(pci_device),
-			helix::Mapping{fb_bar, 0, fb_bar_info.length},
+			helix::Mapping{fb_bar, 0, fb_bar_info.length,
+					kHelMapProtRead | kHelMapProtWrite | kHelMapCacheWriteCombine},
 			helix::Mapping{fifo_bar, 0, fifo_bar_info.length},
 			std::move(io_bar), io_bar_info.address);
 
@@ -15,7 +15,7 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 
 	struct Configuration : drm_core::Configuration {
 		Configuration(GfxDevice *device)
-		: _device(device), _cursorUpdate(false), _cursorMove(false) { };
+		: _device(device), _cursorUpdate(false), _cursorMove(false), _cursorOnly(true) { };
 
 		bool capture(std::vector<drm_core::Assignment> assignment, std::unique_ptr<drm_core::AtomicState> & state) override;
 		void dispose() override;
@@ -28,6 +28,8 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 
 		bool _cursorUpdate;
 		bool _cursorMove;
+		// Set if all assignments target the cursor plane.
+		bool _cursorOnly;
 	};
 
 	struct Plane : drm_core::Plane {
@@ -72,9 +74,13 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 
 		GfxDevice::BufferObject *getBufferObject();
 		uint32_t getPixelPitch();
-		void notifyDirty() override;
+		void notifyDirty(const std::vector<drm_core::DamageRect> &clips) override;
+
+		// Copies the framebuffer to VRAM and updates the screen.
+		async::result<void> scanout();
 
 	private:
+		GfxDevice *_device;
 		std::shared_ptr<GfxDevice::BufferObject> _bo;
 		uint32_t _pixelPitch;
 	};
@@ -1,9 +1,17 @@
 #pragma once
 
+#include <span>
+
 #include <async/result.hpp>
 
 namespace blockfs {
 
+// One element of a vectored request. Elements cover consecutive sectors.
+struct SectorBuffer {
+	void *data;
+	size_t numSectors;
+};
+
 struct BlockDevice {
 	BlockDevice(size_t sector_size);
 
@@ -16,6 +24,31 @@ struct BlockDevice {
 		throw std::runtime_error("BlockDevice does not support writeSectors()");
 	}
 
+	// Vectored variants of readSectors() and writeSectors(). The default implementations
+	// issue a single request through a bounce buffer; devices that support
+	// scatter-gather natively should override them.
+	virtual async::result<void> readSectorsVectored(uint64_t sector,
+			std::span<const SectorBuffer> buffers);
+
+	virtual async::result<void> writeSectorsVectored(uint64_t sector,
+			std::span<const SectorBuffer> buffers);
+
+	// Writes back the device's volatile write cache. Devices that do not cache
+	// writes do not need to override this.
+	virtual async::result<void> flush();
+
+	// Like writeSectors() but only completes once the data is on stable storage.
+	// The default implementation writes the data and then flushes the device.
+	virtual async::result<void> writeSectorsFua(uint64_t sector, const void *buffer,
+			size_t num_sectors);
+
+	// Tells the device that the contents of the sectors are no longer needed.
+	// This is only a hint; the contents of discarded sectors are undefined.
+	virtual async::result<void> discardSectors(uint64_t sector, size_t num_sectors);
+
+	// Fills the sectors with zeros. The default implementation writes zero-filled buffers.
+	virtual async::result<void> writeZeroes(uint64_t sector, size_t num_sectors);
+
 	const size_t sectorSize;
 };
 
@@ -0,0 +1,110 @@
+#include <algorithm>
+
+#include "elevator.hpp"
+
+namespace blockfs {
+
+Elevator::Elevator(BlockDevice *device)
+: BlockDevice{device->sectorSize}, _device{device} {
+	_run();
+}
+
+async::result<void> Elevator::readSectors(uint64_t sector, void *buffer,
+		size_t num_sectors) {
+	Request request{sector, buffer, num_sectors, {}};
+	_pending.push_back(&request);
+	_pendingDoorbell.raise();
+
+	co_await request.done.wait();
+}
+
+async::result<void> Elevator::writeSectors(uint64_t sector, const void *buffer,
+		size_t num_sectors) {
+	// Writes are already fused by the file system; pass them through.
+	return _device->writeSectors(sector, buffer, num_sectors);
+}
+
+async::result<void> Elevator::readSectorsVectored(uint64_t sector,
+		std::span<const SectorBuffer> buffers) {
+	return _device->readSectorsVectored(sector, buffers);
+}
+
+async::result<void> Elevator::writeSectorsVectored(uint64_t sector,
+		std::span<const SectorBuffer> buffers) {
+	return _device->writeSectorsVectored(sector, buffers);
+}
+
+async::result<void> Elevator::flush() {
+	return _device->flush();
+}
+
+async::result<void> Elevator::writeSectorsFua(uint64_t sector, const void *buffer,
+		size_t num_sectors) {
+	return _device->writeSectorsFua(sector, buffer, num_sectors);
+}
+
+async::result<void> Elevator::discardSectors(uint64_t sector, size_t num_sectors) {
+	return _device->discardSectors(sector, num_sectors);
+}
+
+async::result<void> Elevator::writeZeroes(uint64_t sector, size_t num_sectors) {
+	return _device->writeZeroes(sector, num_sectors);
+}
+
+async::detached Elevator::_run() {
+	while(true) {
+		if(_pending.empty()) {
+			co_await _pendingDoorbell.async_wait();
+			continue;
+		}
+		if(_inFlight >= maxInFlight) {
+			co_await _completionDoorbell.async_wait();
+			continue;
+		}
+
+		std::sort(_pending.begin(), _pending.end(), [] (Request *a, Request *b) {
+			return a->sector < b->sector;
+		});
+
+		// Take the run of adjacent requests that starts at the lowest sector.
+		size_t n = 1;
+		size_t numSectors = _pending[0]->numSectors;
+		while(n < _pending.size()) {
+			auto prev = _pending[n - 1];
+			auto next = _pending[n];
+			if(next->sector != prev->sector + prev->numSectors)
+				break;
+			if((numSectors + next->numSectors) * sectorSize > maxMergedBytes)
+				break;
+			numSectors += next->numSectors;
+			n++;
+		}
+
+		std::vector<Request *> batch{_pending.begin(), _pending.begin() + n};
+		_pending.erase(_pending.begin(), _pending.begin() + n);
+		_issue(std::move(batch));
+	}
+}
+
+async::detached Elevator::_issue(std::vector<Request *> batch) {
+	_inFlight++;
+
+	if(batch.size() == 1) {
+		co_await _device->readSectors(batch[0]->sector, batch[0]->buffer, batch[0]->numSectors);
+	}else{
+		std::vector<SectorBuffer> buffers;
+		buffers.reserve(batch.size());
+		for(auto request : batch)
+			buffers.push_back({request->buffer, request->numSectors});
+		co_await _device->readSectorsVectored(batch[0]->sector, buffers);
+	}
+
+	_inFlight--;
+	_completionDoorbell.raise();
+
+	// This may destruct the requests.
+	for(auto request : batch)
+		request->done.raise();
+}
+
+} // namespace blockfs
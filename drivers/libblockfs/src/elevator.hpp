@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+
+#include <async/oneshot-event.hpp>
+#include <async/recurring-event.hpp>
+#include <blockfs.hpp>
+
+namespace blockfs {
+
+// Collects read requests that are issued concurrently (e.g., on behalf of different inodes)
+// and merges requests to adjacent sectors into a single vectored request.
+struct Elevator final : BlockDevice {
+	Elevator(BlockDevice *device);
+
+	async::result<void> readSectors(uint64_t sector, void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> writeSectors(uint64_t sector, const void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> readSectorsVectored(uint64_t sector,
+			std::span<const SectorBuffer> buffers) override;
+
+	async::result<void> writeSectorsVectored(uint64_t sector,
+			std::span<const SectorBuffer> buffers) override;
+
+	async::result<void> flush() override;
+
+	async::result<void> writeSectorsFua(uint64_t sector, const void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> discardSectors(uint64_t sector, size_t num_sectors) override;
+
+	async::result<void> writeZeroes(uint64_t sector, size_t num_sectors) override;
+
+private:
+	// Upper bound on the size of merged requests.
+	static constexpr size_t maxMergedBytes = 1 << 20;
+
+	// Number of merged requests that we keep in flight. New requests queue up
+	// while all of them are in flight, which gives them a chance to be merged.
+	static constexpr int maxInFlight = 4;
+
+	struct Request {
+		uint64_t sector;
+		void *buffer;
+		size_t numSectors;
+		async::oneshot_event done;
+	};
+
+	async::detached _run();
+
+	async::detached _issue(std::vector<Request *> batch);
+
+	BlockDevice *_device;
+
+	// Requests that were not issued to the device yet.
+	std::vector<Request *> _pending;
+	async::recurring_event _pendingDoorbell;
+
+	int _inFlight = 0;
+	async::recurring_event _completionDoorbell;
+};
+
+} // namespace blockfs
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <algorithm>
 #include <iostream>
+#include <map>
 #include <sys/stat.h>
 
 #include <async/result.hpp>
@@ -22,6 +23,10 @@ namespace {
 
 	constexpr int pageShift = 12;
 	constexpr size_t pageSize = size_t{1} << pageShift;
+
+	// Number of manage requests that we keep outstanding for each inode.
+	// This allows page cache misses on the same file to reach the device in parallel.
+	constexpr int numManageRequests = 4;
 }
 
 // --------------------------------------------------------
@@ -34,6 +39,11 @@ Inode::Inode(FileSystem &fs, uint32_t number)
 void Inode::setFileSize(size_t size) {
 	assert(!(size & ~uint64_t(0xFFFFFFFF)));
 	diskInode()->size = size;
+	attributesChanged();
+}
+
+void Inode::attributesChanged() {
+	fs.attributeGenerations.bump(number);
 }
 
 async::result<frg::expected<protocols::fs::Error, std::optional<DirEntry>>>
@@ -52,7 +62,41 @@ Inode::findEntry(std::string name) {
 	co_await submit.async_wait();
 	HEL_CHECK(lock_memory.error());
 
-	// Read the directory structure.
+	if(!dirIndex)
+		buildDirIndex();
+
+	auto it = dirIndex->find(name);
+	if(it == dirIndex->end())
+		co_return std::nullopt;
+
+	auto disk_entry = reinterpret_cast<DiskDirEntry *>(
+			reinterpret_cast<char *>(fileMapping.get()) + it->second);
+	assert(disk_entry->inode
+			&& name.length() == disk_entry->nameLength
+			&& !memcmp(disk_entry->name, name.data(), name.length()));
+
+	DirEntry entry;
+	entry.inode = disk_entry->inode;
+
+	switch(disk_entry->fileType) {
+	case EXT2_FT_REG_FILE:
+		entry.fileType = kTypeRegular; break;
+	case EXT2_FT_DIR:
+		entry.fileType = kTypeDirectory; break;
+	case EXT2_FT_SYMLINK:
+		entry.fileType = kTypeSymlink; break;
+	default:
+		entry.fileType = kTypeNone;
+	}
+
+	co_return entry;
+}
+
+void Inode::buildDirIndex() {
+	dirIndex.emplace();
+
+	// Directories with an htree index can also be read linearly: the index lives in
+	// space that is covered by the record of ".." or by empty records.
 	uintptr_t offset = 0;
 	while(offset < fileSize()) {
 		assert(!(offset & 3));
@@ -61,31 +105,12 @@ Inode::findEntry(std::string name) {
 				reinterpret_cast<char *>(fileMapping.get()) + offset);
 		assert(disk_entry->recordLength);
 
-		if(disk_entry->inode
-				&& name.length() == disk_entry->nameLength
-				&& !memcmp(disk_entry->name, name.data(), name.length())) {
-			DirEntry entry;
-			entry.inode = disk_entry->inode;
-
-			switch(disk_entry->fileType) {
-			case EXT2_FT_REG_FILE:
-				entry.fileType = kTypeRegular; break;
-			case EXT2_FT_DIR:
-				entry.fileType = kTypeDirectory; break;
-			case EXT2_FT_SYMLINK:
-				entry.fileType = kTypeSymlink; break;
-			default:
-				entry.fileType = kTypeNone;
-			}
-
-			co_return entry;
-		}
+		if(disk_entry->inode)
+			dirIndex->insert({std::string{disk_entry->name, disk_entry->nameLength}, offset});
 
 		offset += disk_entry->recordLength;
 	}
 	assert(offset == fileSize());
-
-	co_return std::nullopt;
 }
 
 async::result<std::optional<DirEntry>>
@@ -121,6 +146,18 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 				throw std::runtime_error("unexpected type");
 		}
 		memcpy(diskEntry->name, name.data(), name.length() + 1);
+		if(dirIndex)
+			dirIndex->insert({name, offset});
+
+		// We do not maintain the htree; clearing the flag turns the directory into
+		// a valid linear directory (this is what ext2 drivers without dir_index do).
+		if(diskInode()->flags & EXT2_INDEX_FL) {
+			diskInode()->flags &= ~EXT2_INDEX_FL;
+			auto syncDirInode = co_await helix_ng::synchronizeSpace(
+					helix::BorrowedDescriptor{kHelNullHandle},
+					diskMapping.get(), fs.inodeSize);
+			HEL_CHECK(syncDirInode.error());
+		}
 
 		// Flush the data to disk.
 		// TODO: It would be enough to flush only one or two pages here.
@@ -132,6 +169,7 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 		auto target = fs.accessInode(ino);
 		co_await target->readyJump.wait();
 		target->diskInode()->linksCount++;
+		target->attributesChanged();
 
 		// Flush the target inode to disk.
 		auto syncInode = co_await helix_ng::synchronizeSpace(
@@ -223,48 +261,56 @@ async::result<frg::expected<protocols::fs::Error>> Inode::unlink(std::string nam
 	co_await submit.async_wait();
 	HEL_CHECK(lock_memory.error());
 
-	// Read the directory structure.
+	if(!dirIndex)
+		buildDirIndex();
+
+	auto it = dirIndex->find(name);
+	if(it == dirIndex->end())
+		co_return protocols::fs::Error::fileNotFound;
+	auto entry_offset = it->second;
+
+	// Records never cross block boundaries, so the previous entry is in the same block.
 	DiskDirEntry *previous_entry = nullptr;
-	uintptr_t offset = 0;
-	while(offset < fileSize()) {
+	uintptr_t offset = entry_offset & ~uintptr_t(fs.blockSize - 1);
+	while(offset < entry_offset) {
 		assert(!(offset & 3));
-		assert(offset + sizeof(DiskDirEntry) <= fileSize());
-		auto disk_entry = reinterpret_cast<DiskDirEntry *>(
+		previous_entry = reinterpret_cast<DiskDirEntry *>(
 				reinterpret_cast<char *>(fileMapping.get()) + offset);
-		assert(disk_entry->recordLength);
-
-		if(disk_entry->inode
-				&& name.length() == disk_entry->nameLength
-				&& !memcmp(disk_entry->name, name.data(), name.length())) {
-			// The directory should start with "." and "..". As those entries are never deleted,
-			// we can assume that a previous entry exists.
-			assert(previous_entry);
-			previous_entry->recordLength += disk_entry->recordLength;
-
-			// Flush the data to disk.
-			// TODO: It would be enough to flush only one or two pages here.
-			auto syncDir = co_await helix_ng::synchronizeSpace(
-					helix::BorrowedDescriptor{kHelNullHandle}, fileMapping.get(), fileSize());
-			HEL_CHECK(syncDir.error());
-
-			// Decrement the inode's link count
-			auto target = fs.accessInode(disk_entry->inode);
-			co_await target->readyJump.wait();
-			target->diskInode()->linksCount--;
-			auto syncInode = co_await helix_ng::synchronizeSpace(
-					helix::BorrowedDescriptor{kHelNullHandle},
-					target->diskMapping.get(), fs.inodeSize);
-			HEL_CHECK(syncInode.error());
+		assert(previous_entry->recordLength);
+		offset += previous_entry->recordLength;
+	}
+	assert(offset == entry_offset);
 
-			co_return {};
-		}
+	auto disk_entry = reinterpret_cast<DiskDirEntry *>(
+			reinterpret_cast<char *>(fileMapping.get()) + entry_offset);
+	auto ino = disk_entry->inode;
+	assert(ino);
 
-		offset += disk_entry->recordLength;
-		previous_entry = disk_entry;
+	// The first record of a block cannot be merged into a previous one; mark it as unused.
+	if(previous_entry) {
+		previous_entry->recordLength += disk_entry->recordLength;
+	}else{
+		disk_entry->inode = 0;
 	}
-	assert(offset == fileSize());
+	dirIndex->erase(it);
+
+	// Flush the data to disk.
+	// TODO: It would be enough to flush only one or two pages here.
+	auto syncDir = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle}, fileMapping.get(), fileSize());
+	HEL_CHECK(syncDir.error());
+
+	// Decrement the inode's link count
+	auto target = fs.accessInode(ino);
+	co_await target->readyJump.wait();
+	target->diskInode()->linksCount--;
+	target->attributesChanged();
+	auto syncInode = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			target->diskMapping.get(), fs.inodeSize);
+	HEL_CHECK(syncInode.error());
 
-	co_return protocols::fs::Error::fileNotFound;
+	co_return {};
 }
 
 async::result<std::optional<DirEntry>> Inode::mkdir(std::string name) {
@@ -305,6 +351,7 @@ async::result<std::optional<DirEntry>> Inode::mkdir(std::string name) {
 	offset += (sizeof(DiskDirEntry) + 2 + 3) & ~size_t(3);
 
 	dirNode->diskInode()->linksCount++;
+	dirNode->attributesChanged();
 	dotEntry->inode = dirNode->number;
 	dotEntry->recordLength = offset;
 	dotEntry->nameLength = 1;
@@ -315,6 +362,7 @@ async::result<std::optional<DirEntry>> Inode::mkdir(std::string name) {
 			reinterpret_cast<char *>(dirNode->fileMapping.get()) + offset);
 
 	diskInode()->linksCount++;
+	attributesChanged();
 	dotDotEntry->inode = number;
 	dotDotEntry->recordLength = dirNode->fileSize() - offset;
 	dotDotEntry->nameLength = 2;
@@ -360,6 +408,7 @@ async::result<protocols::fs::Error> Inode::chmod(int mode) {
 	co_await readyJump.wait();
 
 	diskInode()->mode = (diskInode()->mode & 0xFFFFF000) | mode;
+	attributesChanged();
 
 	auto syncInode = co_await helix_ng::synchronizeSpace(
 			helix::BorrowedDescriptor{kHelNullHandle},
@@ -385,6 +434,7 @@ async::result<protocols::fs::Error> Inode::utimensat(uint64_t atime_sec, uint64_
 	clock_gettime(CLOCK_MONOTONIC, &time);
 	diskInode()->atime = time.tv_sec;
 	diskInode()->mtime = time.tv_sec;
+	attributesChanged();
 
 	auto syncInode = co_await helix_ng::synchronizeSpace(
 			helix::BorrowedDescriptor{kHelNullHandle},
@@ -436,13 +486,66 @@ async::result<void> FileSystem::init() {
 		std::cout << "ext2fs:     Inodes per group: " << inodesPerGroup << std::endl;
 	}
 
-	blockGroupDescriptorBuffer.resize((numBlockGroups * sizeof(DiskGroupDesc) + 511) & ~size_t(511));
-	bgdt = (DiskGroupDesc *)blockGroupDescriptorBuffer.data();
+	constexpr uint32_t supportedIncompat = EXT2_FEATURE_INCOMPAT_FILETYPE
+			| EXT3_FEATURE_INCOMPAT_RECOVER | EXT4_FEATURE_INCOMPAT_EXTENTS
+			| EXT4_FEATURE_INCOMPAT_64BIT | EXT4_FEATURE_INCOMPAT_FLEX_BG;
+	if(sb.featureIncompat & ~supportedIncompat)
+		std::cout << "\e[31m" "ext2fs: Unsupported r/w-required features: "
+				<< (sb.featureIncompat & ~supportedIncompat) << "\e[39m" << std::endl;
+	if(sb.featureRoCompat & (EXT4_FEATURE_RO_COMPAT_GDT_CSUM | EXT4_FEATURE_RO_COMPAT_METADATA_CSUM))
+		std::cout << "\e[31m" "ext2fs: Metadata checksums are not updated on writes"
+				"\e[39m" << std::endl;
+
+	// We only support block numbers that fit into 32 bits, even with the 64bit feature.
+	groupDescSize = sizeof(DiskGroupDesc);
+	if(sb.featureIncompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+		groupDescSize = sb.descSize;
+		assert(groupDescSize >= sizeof(DiskGroupDesc) + sizeof(DiskGroupDescHi));
+		if(sb.blocksCountHi) {
+			std::cout << "ext2fs: File systems with more than 2^32 blocks"
+					" are not supported" << std::endl;
+			abort();
+		}
+	}
+
+	// The journal logs whole blocks, hence we keep whole blocks of the BGDT.
+	blockGroupDescriptorBuffer.resize((numBlockGroups * groupDescSize + blockSize - 1)
+			& ~size_t(blockSize - 1));
 
 	auto bgdt_offset = (2048 + blockSize - 1) & ~size_t(blockSize - 1);
 	co_await device->readSectors((bgdt_offset >> blockShift) * sectorsPerBlock,
 			blockGroupDescriptorBuffer.data(), blockGroupDescriptorBuffer.size() / 512);
 
+	if((sb.featureCompat & EXT3_FEATURE_COMPAT_HAS_JOURNAL) && sb.journalInum) {
+		auto candidate = std::make_unique<Journal>(device, blockSize,
+				co_await mapJournal(sb.journalInum));
+		if(co_await candidate->load()) {
+			co_await candidate->recover();
+			journal = std::move(candidate);
+		}
+
+		// Recovery may have rewritten the BGDT.
+		if(journal && journal->didReplay())
+			co_await device->readSectors((bgdt_offset >> blockShift) * sectorsPerBlock,
+					blockGroupDescriptorBuffer.data(), blockGroupDescriptorBuffer.size() / 512);
+	}
+
+	if(journal) {
+		// Tell other implementations that the journal must be recovered while we are mounted.
+		co_await device->readSectors(2, buffer.data(), 2);
+		memcpy(&sb, buffer.data(), sizeof(DiskSuperblock));
+		sb.featureIncompat |= EXT3_FEATURE_INCOMPAT_RECOVER;
+		memcpy(buffer.data(), &sb, sizeof(DiskSuperblock));
+		co_await device->writeSectorsFua(2, buffer.data(), 2);
+	}
+
+	if(sb.featureIncompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+		for(uint32_t bg_idx = 0; bg_idx < numBlockGroups; bg_idx++) {
+			auto hi = reinterpret_cast<DiskGroupDescHi *>(&groupDesc(bg_idx) + 1);
+			assert(!hi->blockBitmapHi && !hi->inodeBitmapHi && !hi->inodeTableHi);
+		}
+	}
+
 	// Create memory bundles to manage the block and inode bitmaps.
 	HelHandle block_bitmap_frontal, inode_bitmap_frontal;
 	HelHandle block_bitmap_backing, inode_bitmap_backing;
@@ -478,7 +581,7 @@ async::detached FileSystem::manageBlockBitmap(helix::UniqueDescriptor memory) {
 		HEL_CHECK(manage.error());
 
 		auto bg_idx = manage.offset() >> blockPagesShift;
-		auto block = bgdt[bg_idx].blockBitmap;
+		auto block = groupDesc(bg_idx).blockBitmap;
 		assert(block);
 
 		assert(!(manage.offset() & ((1 << blockPagesShift) - 1))
@@ -498,8 +601,7 @@ async::detached FileSystem::manageBlockBitmap(helix::UniqueDescriptor memory) {
 
 			helix::Mapping bitmap_map{memory,
 					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->writeSectors(block * sectorsPerBlock,
-					bitmap_map.get(), sectorsPerBlock);
+			co_await writeMetadata(block, bitmap_map.get(), 1);
 			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageWriteback,
 					manage.offset(), manage.length()));
 		}
@@ -515,7 +617,7 @@ async::detached FileSystem::manageInodeBitmap(helix::UniqueDescriptor memory) {
 		HEL_CHECK(manage.error());
 
 		auto bg_idx = manage.offset() >> blockPagesShift;
-		auto block = bgdt[bg_idx].inodeBitmap;
+		auto block = groupDesc(bg_idx).inodeBitmap;
 		assert(block);
 
 		assert(!(manage.offset() & ((1 << blockPagesShift) - 1))
@@ -535,8 +637,7 @@ async::detached FileSystem::manageInodeBitmap(helix::UniqueDescriptor memory) {
 
 			helix::Mapping bitmap_map{memory,
 					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->writeSectors(block * sectorsPerBlock,
-					bitmap_map.get(), sectorsPerBlock);
+			co_await writeMetadata(block, bitmap_map.get(), 1);
 			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageWriteback,
 					manage.offset(), manage.length()));
 		}
@@ -557,7 +658,7 @@ async::detached FileSystem::manageInodeTable(helix::UniqueDescriptor memory) {
 		// TODO: Use shifts instead of division.
 		auto bg_idx = manage.offset() / (inodesPerGroup * inodeSize);
 		auto bg_offset = manage.offset() % (inodesPerGroup * inodeSize);
-		auto block = bgdt[bg_idx].inodeTable;
+		auto block = groupDesc(bg_idx).inodeTable;
 		assert(block);
 
 		if(manage.type() == kHelManageInitialize) {
@@ -572,8 +673,9 @@ async::detached FileSystem::manageInodeTable(helix::UniqueDescriptor memory) {
 
 			helix::Mapping table_map{memory,
 					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->writeSectors(block * sectorsPerBlock + bg_offset / 512,
-					table_map.get(), manage.length() / 512);
+			assert(!(bg_offset & (blockSize - 1)));
+			co_await writeMetadata(block + (bg_offset >> blockShift),
+					table_map.get(), manage.length() >> blockShift);
 			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageWriteback,
 					manage.offset(), manage.length()));
 		}
@@ -628,6 +730,8 @@ async::result<std::shared_ptr<Inode>> FileSystem::createRegular() {
 	disk_inode->atime = time.tv_sec;
 	disk_inode->ctime = time.tv_sec;
 	disk_inode->mtime = time.tv_sec;
+	// The inode number may have been used by a deleted inode before.
+	attributeGenerations.bump(ino);
 
 	co_return accessInode(ino);
 }
@@ -662,10 +766,12 @@ async::result<std::shared_ptr<Inode>> FileSystem::createDirectory() {
 	disk_inode->atime = time.tv_sec;
 	disk_inode->ctime = time.tv_sec;
 	disk_inode->mtime = time.tv_sec;
+	// The inode number may have been used by a deleted inode before.
+	attributeGenerations.bump(ino);
 
 	// update usedDirsCount in the respective bgdt for this inode
 	auto bg_idx = (ino - 1) / inodesPerGroup;
-	bgdt[bg_idx].usedDirsCount++;
+	groupDesc(bg_idx).usedDirsCount++;
 	co_await writebackBgdt();
 
 	co_return accessInode(ino);
@@ -701,6 +807,8 @@ async::result<std::shared_ptr<Inode>> FileSystem::createSymlink() {
 	disk_inode->atime = time.tv_sec;
 	disk_inode->ctime = time.tv_sec;
 	disk_inode->mtime = time.tv_sec;
+	// The inode number may have been used by a deleted inode before.
+	attributeGenerations.bump(ino);
 
 	co_return accessInode(ino);
 }
@@ -709,10 +817,8 @@ async::result<void> FileSystem::write(Inode *inode, uint64_t offset,
 		const void *buffer, size_t length) {
 	co_await inode->readyJump.wait();
 
-	// Make sure that data blocks are allocated.
-	auto blockOffset = (offset & ~(blockSize - 1)) >> blockShift;
-	auto blockCount = ((offset & (blockSize - 1)) + length + (blockSize - 1)) >> blockShift;
-	co_await assignDataBlocks(inode, blockOffset, blockCount);
+	// Data blocks are only allocated on writeback (see manageFileData()).
+	// Until then, the new data only lives in the page cache.
 
 	// Resize the file if necessary.
 	if(offset + length > inode->fileSize()) {
@@ -809,7 +915,8 @@ async::detached FileSystem::initiateInode(std::shared_ptr<Inode> inode) {
 
 	manageIndirect(inode, 1, helix::UniqueDescriptor{backingOrder1});
 	manageIndirect(inode, 2, helix::UniqueDescriptor{backingOrder2});
-	manageFileData(inode);
+	for(int i = 0; i < numManageRequests; i++)
+		manageFileData(inode);
 
 	inode->isReady = true;
 	inode->readyJump.raise();
@@ -849,8 +956,16 @@ async::detached FileSystem::manageFileData(std::shared_ptr<Inode> inode) {
 			size_t num_blocks = (backed_size + (inode->fs.blockSize - 1)) / inode->fs.blockSize;
 
 			assert(num_blocks * inode->fs.blockSize <= manage.length());
+			// Block allocation modifies the inode's block map, hence we do not
+			// run it concurrently with other writebacks of the same inode.
+			co_await inode->writebackMutex.async_lock();
+			// Allocate blocks for the whole range at once; this yields contiguous runs
+			// for data that was appended by many small writes.
+			co_await inode->fs.assignDataBlocks(inode.get(),
+					manage.offset() / inode->fs.blockSize, num_blocks);
 			co_await inode->fs.writeDataBlocks(inode, manage.offset() / inode->fs.blockSize,
 					num_blocks, file_map.get());
+			inode->writebackMutex.unlock();
 
 			HEL_CHECK(helUpdateMemory(inode->backingMemory, kHelManageWriteback,
 					manage.offset(), manage.length()));
@@ -909,17 +1024,22 @@ async::detached FileSystem::manageIndirect(std::shared_ptr<Inode> inode,
 		if (manage.type() == kHelManageInitialize) {
 			helix::Mapping out_map{memory,
 					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->readSectors(block * sectorsPerBlock,
-					out_map.get(), sectorsPerBlock);
+			// Due to delayed allocation, the indirect block may not exist yet.
+			if(block) {
+				co_await device->readSectors(block * sectorsPerBlock,
+						out_map.get(), sectorsPerBlock);
+			}else{
+				memset(out_map.get(), 0, manage.length());
+			}
 			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageInitialize,
 					manage.offset(), manage.length()));
 		} else {
 			assert(manage.type() == kHelManageWriteback);
+			assert(block);
 
 			helix::Mapping out_map{memory,
 					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->writeSectors(block * sectorsPerBlock,
-					out_map.get(), sectorsPerBlock);
+			co_await writeMetadata(block, out_map.get(), 1);
 			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageWriteback,
 					manage.offset(), manage.length()));
 
@@ -927,8 +1047,21 @@ async::detached FileSystem::manageIndirect(std::shared_ptr<Inode> inode,
 	}
 }
 
-async::result<uint32_t> FileSystem::allocateBlock() {
-	for(uint32_t bg_idx = 0; bg_idx < numBlockGroups; bg_idx++) {
+async::result<std::pair<uint32_t, size_t>>
+FileSystem::allocateBlocks(uint32_t goal, size_t count) {
+	assert(count);
+	if(goal >= blocksCount)
+		goal = 0;
+
+	// Start at the goal's block group, continue with the following groups.
+	auto goal_bg = goal / blocksPerGroup;
+	for(uint32_t k = 0; k < numBlockGroups; k++) {
+		auto bg_idx = (goal_bg + k) % numBlockGroups;
+
+		// Skip full groups without touching their bitmaps.
+		if(!groupDesc(bg_idx).freeBlocksCount)
+			continue;
+
 		helix::LockMemoryView lock_bitmap;
 		auto &&submit_bitmap = helix::submitLockMemoryView(blockBitmap,
 				&lock_bitmap,
@@ -942,36 +1075,110 @@ async::result<uint32_t> FileSystem::allocateBlock() {
 				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
 
 		auto words = reinterpret_cast<uint32_t *>(bitmap_map.get());
-		for(unsigned int i = 0; i < (blocksPerGroup + 31) / 32; i++) {
-			if(words[i] == 0xFFFFFFFF)
-				continue;
-			for(int j = 0; j < 32; j++) {
-				if(i * 32 + j >= blocksPerGroup)
-					break;
-				if(words[i] & (static_cast<uint32_t>(1) << j))
-					continue;
-				// TODO: Make sure we never return reserved blocks.
-				// TODO: Make sure we never return blocks higher than the max. block in the SB.
-				auto block = bg_idx * blocksPerGroup + i * 32 + j;
-				assert(block);
-				assert(block < blocksCount);
-				words[i] |= static_cast<uint32_t>(1) << j;
+		auto isFree = [&] (uint32_t bit) {
+			return !(words[bit / 32] & (static_cast<uint32_t>(1) << (bit % 32)));
+		};
+		// Scans a word at a time; this matters for large groups that are mostly full
+		// (the scan runs on the thread that serves all other requests).
+		auto findFree = [&] (uint32_t from, uint32_t to) -> std::optional<uint32_t> {
+			uint32_t bit = from;
+			while(bit < to) {
+				// Treat bits below the starting bit as allocated.
+				auto used = words[bit / 32] | ((static_cast<uint32_t>(1) << (bit % 32)) - 1);
+				if(used != 0xFFFFFFFF) {
+					auto candidate = (bit & ~uint32_t{31}) + __builtin_ctz(~used);
+					if(candidate < to)
+						return candidate;
+					return std::nullopt;
+				}
+				bit = (bit & ~uint32_t{31}) + 32;
+			}
+			return std::nullopt;
+		};
+
+		// The last group can be shorter than blocksPerGroup.
+		uint32_t group_blocks = std::min(blocksPerGroup, blocksCount - bg_idx * blocksPerGroup);
+
+		// Search forward from the goal, then wrap around to the start of the group.
+		uint32_t start = (bg_idx == goal_bg) ? std::min(goal % blocksPerGroup, group_blocks) : 0;
+		auto first = findFree(start, group_blocks);
+		if(!first)
+			first = findFree(0, start);
+		if(!first)
+			continue;
+
+		// TODO: Make sure we never return reserved blocks.
+		size_t n = 0;
+		while(n < count && *first + n < group_blocks && isFree(*first + n)) {
+			words[(*first + n) / 32] |= static_cast<uint32_t>(1) << ((*first + n) % 32);
+			n++;
+		}
 
-				bgdt[bg_idx].freeBlocksCount--;
-				co_await writebackBgdt();
+		auto block = bg_idx * blocksPerGroup + *first;
+		assert(block);
+		assert(block + n <= blocksCount);
 
-				co_return block;
-			}
-			assert(!"Failed to find zero-bit");
+		groupDesc(bg_idx).freeBlocksCount -= n;
+		co_await writebackBgdt();
+
+		co_return std::pair<uint32_t, size_t>{block, n};
+	}
+
+	co_return std::pair<uint32_t, size_t>{0, 0};
+}
+
+async::result<uint32_t> FileSystem::allocateBlock(uint32_t goal) {
+	auto [block, n] = co_await allocateBlocks(goal, 1);
+	co_return block;
+}
+
+async::result<void> FileSystem::freeBlocks(uint32_t block, size_t count) {
+	assert(block && block + count <= blocksCount);
+
+	size_t progress = 0;
+	while(progress < count) {
+		auto bg_idx = (block + progress) / blocksPerGroup;
+		uint32_t first = (block + progress) % blocksPerGroup;
+		auto n = std::min(count - progress, size_t{blocksPerGroup - first});
+
+		helix::LockMemoryView lock_bitmap;
+		auto &&submit_bitmap = helix::submitLockMemoryView(blockBitmap,
+				&lock_bitmap,
+				bg_idx << blockPagesShift, 1 << blockPagesShift,
+				helix::Dispatcher::global());
+		co_await submit_bitmap.async_wait();
+		HEL_CHECK(lock_bitmap.error());
+
+		helix::Mapping bitmap_map{blockBitmap,
+				bg_idx << blockPagesShift, size_t{1} << blockPagesShift,
+				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+
+		auto words = reinterpret_cast<uint32_t *>(bitmap_map.get());
+		for(size_t k = 0; k < n; k++) {
+			auto bit = first + k;
+			assert(words[bit / 32] & (static_cast<uint32_t>(1) << (bit % 32)));
+			words[bit / 32] &= ~(static_cast<uint32_t>(1) << (bit % 32));
 		}
+
+		groupDesc(bg_idx).freeBlocksCount += n;
+		progress += n;
 	}
 
-	co_return 0;
+	// Freed indirect or directory blocks may still have copies in the journal.
+	if(journal)
+		journal->revokeBlocks(block, count);
+	co_await writebackBgdt();
+
+	co_await device->discardSectors(uint64_t{block} * sectorsPerBlock, count * sectorsPerBlock);
 }
 
 async::result<uint32_t> FileSystem::allocateInode() {
 	// TODO: Do not start at block group zero.
 	for(uint32_t bg_idx = 0; bg_idx < numBlockGroups; bg_idx++) {
+		// Skip full groups without touching their bitmaps.
+		if(!groupDesc(bg_idx).freeInodesCount)
+			continue;
+
 		helix::LockMemoryView lock_bitmap;
 		auto &&submit_bitmap = helix::submitLockMemoryView(inodeBitmap,
 				&lock_bitmap,
@@ -1000,7 +1207,7 @@ async::result<uint32_t> FileSystem::allocateInode() {
 				assert(ino < inodesCount);
 				words[i] |= static_cast<uint32_t>(1) << j;
 
-				bgdt[bg_idx].freeInodesCount--;
+				groupDesc(bg_idx).freeInodesCount--;
 				co_await writebackBgdt();
 
 				co_return ino;
@@ -1025,31 +1232,57 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 
 	auto disk_inode = inode->diskInode();
 
+	if(disk_inode->flags & EXT4_EXTENTS_FL) {
+		co_await appendExtents(inode, block_offset, num_blocks);
+		co_return;
+	}
+
+	// Place new blocks right behind the previous block of the file if possible;
+	// otherwise, start in the inode's block group.
+	uint32_t goal = ((inode->number - 1) / inodesPerGroup) * blocksPerGroup;
+	if(block_offset && block_offset <= i_range
+			&& disk_inode->data.blocks.direct[block_offset - 1])
+		goal = disk_inode->data.blocks.direct[block_offset - 1] + 1;
+
+	// Allocates a run of blocks for the holes in list[0, n).
+	auto fillHoles = [&] (uint32_t *list, size_t n) -> async::result<void> {
+		size_t i = 0;
+		while(i < n) {
+			if(list[i]) {
+				goal = list[i] + 1;
+				i++;
+				continue;
+			}
+			size_t holes = 1;
+			while(i + holes < n && !list[i + holes])
+				holes++;
+
+			auto [block, count] = co_await allocateBlocks(goal, holes);
+			assert(block && "Out of disk space"); // TODO: Fix this.
+			for(size_t j = 0; j < count; j++)
+				list[i + j] = block + j;
+			disk_inode->blocks += count * (blockSize / 512);
+			goal = block + count;
+			i += count;
+		}
+	};
+
 	size_t prg = 0;
 	while(prg < num_blocks) {
 		if(block_offset + prg < i_range) {
-			while(prg < num_blocks
-					&& block_offset + prg < i_range) {
-				auto idx = block_offset + prg;
-				if(disk_inode->data.blocks.direct[idx]) {
-					prg++;
-					continue;
-				}
-				auto block = co_await allocateBlock();
-				assert(block && "Out of disk space"); // TODO: Fix this.
-				disk_inode->blocks += (blockSize / 512);
-				disk_inode->data.blocks.direct[idx] = block;
-				prg++;
-			}
+			auto n = std::min(num_blocks - prg, i_range - (block_offset + prg));
+			co_await fillHoles(&disk_inode->data.blocks.direct[block_offset + prg], n);
+			prg += n;
 		}else if(block_offset + prg < s_range) {
 			bool needsReset = false;
 
 			// Allocate the single-indirect block itself.
 			if(!disk_inode->data.blocks.singleIndirect) {
-				auto block = co_await allocateBlock();
+				auto block = co_await allocateBlock(goal);
 				assert(block && "Out of disk space"); // TODO: Fix this.
 				disk_inode->blocks += (blockSize / 512);
 				disk_inode->data.blocks.singleIndirect = block;
+				goal = block + 1;
 				needsReset = true;
 			}
 
@@ -1068,19 +1301,9 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 			if(needsReset)
 				memset(window, 0, size_t{1} << blockPagesShift);
 
-			while(prg < num_blocks
-					&& block_offset + prg < s_range) {
-				auto idx = block_offset + prg - i_range;
-				if(window[idx]) {
-					prg++;
-					continue;
-				}
-				auto block = co_await allocateBlock();
-				assert(block && "Out of disk space"); // TODO: Fix this.
-				disk_inode->blocks += (blockSize / 512);
-				window[idx] = block;
-				prg++;
-			}
+			auto n = std::min(num_blocks - prg, s_range - (block_offset + prg));
+			co_await fillHoles(&window[block_offset + prg - i_range], n);
+			prg += n;
 		}else if(block_offset + prg < d_range) {
 			assert(!"TODO: Implement allocation in double indirect blocks");
 		}else{
@@ -1094,6 +1317,128 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 	HEL_CHECK(syncInode.error());
 }
 
+async::result<std::pair<uint64_t, size_t>>
+FileSystem::mapExtent(Inode *inode, uint64_t block, size_t limit) {
+	auto node = reinterpret_cast<const char *>(inode->diskInode()->data.embedded);
+	std::vector<char> nodeBuffer;
+
+	// Start of the next subtree; the current subtree does not map blocks beyond it.
+	uint64_t bound = UINT64_MAX;
+	auto until = [&] (uint64_t end) {
+		return static_cast<size_t>(std::min<uint64_t>(limit, end - block));
+	};
+
+	while(true) {
+		auto header = reinterpret_cast<const DiskExtentHeader *>(node);
+		assert(header->magic == extentMagic);
+
+		if(!header->depth) {
+			auto extents = reinterpret_cast<const DiskExtent *>(header + 1);
+			for(uint16_t i = 0; i < header->entries; i++) {
+				auto &extent = extents[i];
+				if(block < extent.block)
+					co_return std::pair<uint64_t, size_t>{0, until(extent.block)};
+
+				bool initialized = extent.length <= maxInitializedExtent;
+				uint64_t length = initialized ? extent.length
+						: extent.length - maxInitializedExtent;
+				if(block < extent.block + length) {
+					if(!initialized)
+						co_return std::pair<uint64_t, size_t>{0, until(extent.block + length)};
+					uint64_t start = (uint64_t{extent.startHi} << 32) | extent.startLo;
+					co_return std::pair<uint64_t, size_t>{start + (block - extent.block),
+							until(extent.block + length)};
+				}
+			}
+			co_return std::pair<uint64_t, size_t>{0, until(bound)};
+		}
+
+		// Descend into the last subtree that starts at or before the block.
+		auto indices = reinterpret_cast<const DiskExtentIndex *>(header + 1);
+		int k = -1;
+		for(uint16_t i = 0; i < header->entries; i++) {
+			if(indices[i].block > block)
+				break;
+			k = i;
+		}
+		if(k < 0) {
+			auto end = header->entries ? uint64_t{indices[0].block} : bound;
+			co_return std::pair<uint64_t, size_t>{0, until(end)};
+		}
+		if(k + 1 < header->entries)
+			bound = std::min<uint64_t>(bound, indices[k + 1].block);
+
+		uint64_t leaf = (uint64_t{indices[k].leafHi} << 32) | indices[k].leafLo;
+		nodeBuffer.resize(blockSize);
+		co_await device->readSectors(leaf * sectorsPerBlock,
+				nodeBuffer.data(), sectorsPerBlock);
+		node = nodeBuffer.data();
+	}
+}
+
+async::result<void> FileSystem::appendExtents(Inode *inode,
+		uint64_t block_offset, size_t num_blocks) {
+	auto disk_inode = inode->diskInode();
+
+	size_t prg = 0;
+	while(prg < num_blocks) {
+		auto [physical, n] = co_await mapExtent(inode, block_offset + prg, num_blocks - prg);
+		if(physical) {
+			prg += n;
+			continue;
+		}
+
+		// We only support appending to an extent tree that fits into the inode.
+		auto header = reinterpret_cast<DiskExtentHeader *>(disk_inode->data.embedded);
+		auto extents = reinterpret_cast<DiskExtent *>(header + 1);
+		assert(header->magic == extentMagic);
+		if(header->depth) {
+			std::cout << "\e[31m" "ext2fs: Allocation in extent trees of depth > 0"
+					" is not supported" "\e[39m" << std::endl;
+			abort();
+		}
+
+		DiskExtent *last = header->entries ? &extents[header->entries - 1] : nullptr;
+		uint64_t lastEnd = last ? last->block + last->length : 0;
+		if(last && (last->length > maxInitializedExtent || block_offset + prg < lastEnd)) {
+			std::cout << "\e[31m" "ext2fs: Filling holes in extent-mapped files"
+					" is not supported" "\e[39m" << std::endl;
+			abort();
+		}
+
+		uint64_t lastStart = last ? ((uint64_t{last->startHi} << 32) | last->startLo) : 0;
+		uint32_t goal = last ? lastStart + last->length
+				: ((inode->number - 1) / inodesPerGroup) * blocksPerGroup;
+		auto [block, count] = co_await allocateBlocks(goal,
+				std::min(n, size_t{maxInitializedExtent}));
+		assert(block && "Out of disk space"); // TODO: Fix this.
+		disk_inode->blocks += count * (blockSize / 512);
+
+		// Extend the last extent if the new blocks are adjacent to it (logically and physically).
+		if(last && lastEnd == block_offset + prg && lastStart + last->length == block
+				&& last->length + count <= maxInitializedExtent) {
+			last->length += count;
+		}else{
+			if(header->entries == header->max) {
+				std::cout << "\e[31m" "ext2fs: Growing extent trees"
+						" is not supported" "\e[39m" << std::endl;
+				abort();
+			}
+			auto &extent = extents[header->entries++];
+			extent.block = block_offset + prg;
+			extent.length = count;
+			extent.startHi = 0;
+			extent.startLo = block;
+		}
+		prg += count;
+	}
+
+	auto syncInode = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			inode->diskMapping.get(), inodeSize);
+	HEL_CHECK(syncInode.error());
+}
+
 async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
 		uint64_t offset, size_t num_blocks, void *buffer) {
 	// We perform "block-fusion" here i.e. we try to read/write multiple
@@ -1120,6 +1465,22 @@ async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
 	co_await inode->readyJump.wait();
 	// TODO: Assert that we do not read past the EOF.
 
+	if(inode->diskInode()->flags & EXT4_EXTENTS_FL) {
+		size_t progress = 0;
+		while(progress < num_blocks) {
+			auto [block, n] = co_await mapExtent(inode.get(), offset + progress,
+					num_blocks - progress);
+			if(block) {
+				co_await device->readSectors(block * sectorsPerBlock,
+						(uint8_t *)buffer + progress * blockSize, n * sectorsPerBlock);
+			}else{
+				memset((uint8_t *)buffer + progress * blockSize, 0, n * blockSize);
+			}
+			progress += n;
+		}
+		co_return;
+	}
+
 	constexpr size_t indirectBufferSize = 8;
 
 	std::array<uint32_t, indirectBufferSize> indirectBuffer;
@@ -1241,6 +1602,27 @@ async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
 	co_await inode->readyJump.wait();
 	// TODO: Assert that we do not write past the EOF.
 
+	// Directory contents are metadata; regular file data bypasses the journal.
+	bool journaled = journal && inode->fileType == kTypeDirectory;
+
+	if(inode->diskInode()->flags & EXT4_EXTENTS_FL) {
+		size_t progress = 0;
+		while(progress < num_blocks) {
+			auto [block, n] = co_await mapExtent(inode.get(), offset + progress,
+					num_blocks - progress);
+			assert(block); // assignDataBlocks() must be called before.
+			if(journaled) {
+				co_await writeMetadata(block,
+						(const uint8_t *)buffer + progress * blockSize, n);
+			}else{
+				co_await device->writeSectors(block * sectorsPerBlock,
+						(const uint8_t *)buffer + progress * blockSize, n * sectorsPerBlock);
+			}
+			progress += n;
+		}
+		co_return;
+	}
+
 	size_t progress = 0;
 	while(progress < num_blocks) {
 		// Block number and block count of the writeSectors() command that we will issue here.
@@ -1295,18 +1677,26 @@ async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
 //				<< " blocks, starting at " << issue.first << std::endl;
 
 		assert(issue.first);
-		co_await device->writeSectors(issue.first * sectorsPerBlock,
-				(const uint8_t *)buffer + progress * blockSize,
-				issue.second * sectorsPerBlock);
+		if(journaled) {
+			co_await writeMetadata(issue.first,
+					(const uint8_t *)buffer + progress * blockSize, issue.second);
+		}else{
+			co_await device->writeSectors(issue.first * sectorsPerBlock,
+					(const uint8_t *)buffer + progress * blockSize,
+					issue.second * sectorsPerBlock);
+		}
 		progress += issue.second;
 	}
 }
 
 
 async::result<void> FileSystem::truncate(Inode *inode, size_t size) {
+	auto oldSize = inode->fileSize();
 	HEL_CHECK(helResizeMemory(inode->backingMemory,
 			(size + 0xFFF) & ~size_t(0xFFF)));
 	inode->setFileSize(size);
+	if(size < oldSize)
+		co_await releaseDataBlocks(inode, (size + blockSize - 1) >> blockShift);
 	auto syncInode = co_await helix_ng::synchronizeSpace(
 			helix::BorrowedDescriptor{kHelNullHandle},
 			inode->diskMapping.get(), inodeSize);
@@ -1314,10 +1704,243 @@ async::result<void> FileSystem::truncate(Inode *inode, size_t size) {
 	co_return;
 }
 
+async::result<void> FileSystem::releaseDataBlocks(Inode *inode, uint64_t block_offset) {
+	auto disk_inode = inode->diskInode();
+
+	// TODO: Free blocks of extent-mapped files.
+	if(disk_inode->flags & EXT4_EXTENTS_FL)
+		co_return;
+
+	size_t per_indirect = blockSize / 4;
+	size_t i_range = 12;
+	size_t s_range = i_range + per_indirect;
+
+	// Adjacent blocks are freed (and discarded) together.
+	uint32_t runStart = 0;
+	size_t runLength = 0;
+	auto release = [&] (uint32_t block) -> async::result<void> {
+		disk_inode->blocks -= blockSize / 512;
+		if(runLength && runStart + runLength == block) {
+			runLength++;
+			co_return;
+		}
+		if(runLength)
+			co_await freeBlocks(runStart, runLength);
+		runStart = block;
+		runLength = 1;
+	};
+
+	for(size_t i = block_offset; i < i_range; i++) {
+		if(!disk_inode->data.blocks.direct[i])
+			continue;
+		co_await release(disk_inode->data.blocks.direct[i]);
+		disk_inode->data.blocks.direct[i] = 0;
+	}
+
+	if(disk_inode->data.blocks.singleIndirect && block_offset < s_range) {
+		helix::LockMemoryView lock_indirect;
+		auto &&submit = helix::submitLockMemoryView(inode->indirectOrder1,
+				&lock_indirect, 0, 1 << blockPagesShift,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(lock_indirect.error());
+
+		helix::Mapping indirect_map{inode->indirectOrder1,
+				0, size_t{1} << blockPagesShift,
+				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+		auto window = reinterpret_cast<uint32_t *>(indirect_map.get());
+
+		for(size_t i = std::max(block_offset, i_range) - i_range; i < per_indirect; i++) {
+			if(!window[i])
+				continue;
+			co_await release(window[i]);
+			window[i] = 0;
+		}
+
+		if(block_offset <= i_range) {
+			// Write back the cached indirect block before it is freed;
+			// otherwise, a later writeback would not find its block.
+			auto syncIndirect = co_await helix_ng::synchronizeSpace(
+					helix::BorrowedDescriptor{kHelNullHandle},
+					indirect_map.get(), size_t{1} << blockPagesShift);
+			HEL_CHECK(syncIndirect.error());
+
+			co_await release(disk_inode->data.blocks.singleIndirect);
+			disk_inode->data.blocks.singleIndirect = 0;
+		}
+	}
+
+	// TODO: Free blocks that are reachable from double and triple indirect blocks.
+
+	if(runLength)
+		co_await freeBlocks(runStart, runLength);
+}
+
+async::result<void> FileSystem::sync(Inode *inode) {
+	co_await inode->readyJump.wait();
+
+	// Regular files do not keep a mapping of their page cache, so map it temporarily.
+	auto mapSize = (inode->fileSize() + 0xFFF) & ~size_t(0xFFF);
+	if(mapSize) {
+		helix::Mapping fileMap{helix::BorrowedDescriptor{inode->frontalMemory},
+				0, mapSize, kHelMapProtRead | kHelMapDontRequireBacking};
+		auto syncData = co_await helix_ng::synchronizeSpace(
+				helix::BorrowedDescriptor{kHelNullHandle}, fileMap.get(), mapSize);
+		HEL_CHECK(syncData.error());
+	}
+
+	// Writeback of the data can allocate blocks, so the block map is written afterwards.
+	if(!(inode->diskInode()->flags & EXT4_EXTENTS_FL)
+			&& inode->diskInode()->data.blocks.singleIndirect) {
+		helix::Mapping indirectMap{inode->indirectOrder1,
+				0, size_t{1} << blockPagesShift,
+				kHelMapProtRead | kHelMapDontRequireBacking};
+		auto syncIndirect = co_await helix_ng::synchronizeSpace(
+				helix::BorrowedDescriptor{kHelNullHandle},
+				indirectMap.get(), size_t{1} << blockPagesShift);
+		HEL_CHECK(syncIndirect.error());
+	}
+
+	auto syncInode = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			inode->diskMapping.get(), inodeSize);
+	HEL_CHECK(syncInode.error());
+
+	co_await device->flush();
+}
+
 async::result<void> FileSystem::writebackBgdt() {
 	auto bgdt_offset = (2048 + blockSize - 1) & ~size_t(blockSize - 1);
-	co_await device->writeSectors((bgdt_offset >> blockShift) * sectorsPerBlock,
-			blockGroupDescriptorBuffer.data(), blockGroupDescriptorBuffer.size() / 512);
+	co_await writeMetadata(bgdt_offset >> blockShift,
+			blockGroupDescriptorBuffer.data(), blockGroupDescriptorBuffer.size() >> blockShift);
+}
+
+async::result<void> FileSystem::writeMetadata(uint64_t block, const void *buffer,
+		size_t num_blocks) {
+	if(journal) {
+		co_await journal->writeBlocks(block, buffer, num_blocks);
+	}else{
+		co_await device->writeSectors(block * sectorsPerBlock, buffer,
+				num_blocks * sectorsPerBlock);
+	}
+}
+
+async::result<std::vector<uint64_t>> FileSystem::mapJournal(uint32_t number) {
+	auto bg_idx = (number - 1) / inodesPerGroup;
+	auto offset = size_t{(number - 1) % inodesPerGroup} * inodeSize;
+	std::vector<char> buffer(blockSize);
+	co_await device->readSectors((groupDesc(bg_idx).inodeTable + (offset >> blockShift))
+			* sectorsPerBlock, buffer.data(), sectorsPerBlock);
+
+	DiskInode disk_inode;
+	memcpy(&disk_inode, buffer.data() + (offset & (blockSize - 1)), sizeof(DiskInode));
+
+	std::vector<uint64_t> blocks;
+	if(disk_inode.flags & EXT4_EXTENTS_FL) {
+		co_await mapJournalExtents(reinterpret_cast<const char *>(disk_inode.data.embedded),
+				blocks);
+		co_return blocks;
+	}
+
+	size_t num_blocks = disk_inode.size >> blockShift;
+	size_t per_indirect = blockSize / 4;
+	std::vector<uint32_t> indirect(per_indirect);
+	std::vector<uint32_t> order2(per_indirect);
+
+	for(size_t i = 0; i < 12 && blocks.size() < num_blocks; i++)
+		blocks.push_back(disk_inode.data.blocks.direct[i]);
+
+	if(blocks.size() < num_blocks) {
+		co_await device->readSectors(uint64_t{disk_inode.data.blocks.singleIndirect}
+				* sectorsPerBlock, indirect.data(), sectorsPerBlock);
+		for(size_t i = 0; i < per_indirect && blocks.size() < num_blocks; i++)
+			blocks.push_back(indirect[i]);
+	}
+
+	if(blocks.size() < num_blocks) {
+		co_await device->readSectors(uint64_t{disk_inode.data.blocks.doubleIndirect}
+				* sectorsPerBlock, order2.data(), sectorsPerBlock);
+		for(size_t j = 0; j < per_indirect && blocks.size() < num_blocks; j++) {
+			co_await device->readSectors(uint64_t{order2[j]} * sectorsPerBlock,
+					indirect.data(), sectorsPerBlock);
+			for(size_t i = 0; i < per_indirect && blocks.size() < num_blocks; i++)
+				blocks.push_back(indirect[i]);
+		}
+	}
+
+	// Journals are never large enough to need triple indirect blocks.
+	assert(blocks.size() == num_blocks);
+	co_return blocks;
+}
+
+async::result<void> FileSystem::mapJournalExtents(const char *node,
+		std::vector<uint64_t> &blocks) {
+	auto header = reinterpret_cast<const DiskExtentHeader *>(node);
+	assert(header->magic == extentMagic);
+
+	if(!header->depth) {
+		auto extents = reinterpret_cast<const DiskExtent *>(header + 1);
+		for(uint16_t i = 0; i < header->entries; i++) {
+			auto &extent = extents[i];
+			assert(extent.length <= maxInitializedExtent);
+			uint64_t start = (uint64_t{extent.startHi} << 32) | extent.startLo;
+			if(blocks.size() < extent.block + extent.length)
+				blocks.resize(extent.block + extent.length);
+			for(uint16_t k = 0; k < extent.length; k++)
+				blocks[extent.block + k] = start + k;
+		}
+		co_return;
+	}
+
+	auto indices = reinterpret_cast<const DiskExtentIndex *>(header + 1);
+	std::vector<char> buffer(blockSize);
+	for(uint16_t i = 0; i < header->entries; i++) {
+		uint64_t leaf = (uint64_t{indices[i].leafHi} << 32) | indices[i].leafLo;
+		co_await device->readSectors(leaf * sectorsPerBlock, buffer.data(), sectorsPerBlock);
+		co_await mapJournalExtents(buffer.data(), blocks);
+	}
+}
+
+async::result<void>
+FileSystem::readEntryStats(std::vector<protocols::fs::DirectoryEntry> &entries) {
+	// Entries of the same directory are usually allocated in the same block group,
+	// hence many of them share a page of the inode table.
+	std::map<uint64_t, std::vector<protocols::fs::DirectoryEntry *>> pages;
+	for(auto &entry : entries) {
+		assert(entry.inode);
+		auto inode_address = (entry.inode - 1) * inodeSize;
+		pages[inode_address & ~(pageSize - 1)].push_back(&entry);
+	}
+
+	for(auto &[page_address, page_entries] : pages) {
+		helix::LockMemoryView lock_inodes;
+		auto &&submit = helix::submitLockMemoryView(inodeTable,
+				&lock_inodes, page_address, pageSize,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(lock_inodes.error());
+
+		helix::Mapping page_map{inodeTable,
+				static_cast<ptrdiff_t>(page_address), pageSize,
+				kHelMapProtRead | kHelMapDontRequireBacking};
+
+		for(auto entry : page_entries) {
+			auto inode_address = (entry->inode - 1) * inodeSize;
+			auto disk_inode = reinterpret_cast<DiskInode *>(
+					reinterpret_cast<char *>(page_map.get()) + (inode_address - page_address));
+
+			protocols::fs::FileStats stats{};
+			stats.linkCount = disk_inode->linksCount;
+			stats.fileSize = disk_inode->size;
+			stats.mode = disk_inode->mode & 0xFFF;
+			stats.uid = disk_inode->uid;
+			stats.gid = disk_inode->gid;
+			stats.accessTime.tv_sec = disk_inode->atime;
+			stats.dataModifyTime.tv_sec = disk_inode->mtime;
+			stats.anyChangeTime.tv_sec = disk_inode->ctime;
+			entry->stats = stats;
+		}
+	}
 }
 
 // --------------------------------------------------------
@@ -1371,5 +1994,68 @@ OpenFile::readEntries() {
 	co_return std::nullopt;
 }
 
+async::result<protocols::fs::ReadEntryBatchResult>
+OpenFile::readEntryBatch(size_t maxSize, bool withStats) {
+	co_await inode->readyJump.wait();
+
+	if (inode->fileType != kTypeDirectory)
+		co_return protocols::fs::Error::notDirectory;
+
+	auto map_size = (inode->fileSize() + 0xFFF) & ~size_t(0xFFF);
+
+	helix::LockMemoryView lock_memory;
+	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(inode->frontalMemory),
+			&lock_memory, 0, map_size, helix::Dispatcher::global());
+	co_await submit.async_wait();
+	HEL_CHECK(lock_memory.error());
+
+	helix::Mapping file_map{helix::BorrowedDescriptor{inode->frontalMemory},
+			0, map_size,
+			kHelMapProtRead | kHelMapDontRequireBacking};
+
+	std::vector<protocols::fs::DirectoryEntry> entries;
+	size_t size = 0;
+	assert(offset <= inode->fileSize());
+	while(offset < inode->fileSize()) {
+		assert(!(offset & 3));
+		assert(offset + sizeof(DiskDirEntry) <= inode->fileSize());
+		auto disk_entry = reinterpret_cast<DiskDirEntry *>(
+				reinterpret_cast<char *>(file_map.get()) + offset);
+		assert(offset + disk_entry->recordLength <= inode->fileSize());
+
+		if(disk_entry->inode) {
+			// Leave the entry for the next call if it does not fit.
+			auto recordSize = protocols::fs::direntRecordSize(disk_entry->nameLength);
+			if(size + recordSize > maxSize) {
+				if(entries.empty())
+					co_return protocols::fs::Error::illegalArguments;
+				break;
+			}
+			size += recordSize;
+
+			protocols::fs::DirectoryEntry entry;
+			entry.name = std::string(disk_entry->name, disk_entry->nameLength);
+			entry.inode = disk_entry->inode;
+			switch(disk_entry->fileType) {
+			case EXT2_FT_REG_FILE:
+				entry.type = protocols::fs::FileType::regular; break;
+			case EXT2_FT_DIR:
+				entry.type = protocols::fs::FileType::directory; break;
+			case EXT2_FT_SYMLINK:
+				entry.type = protocols::fs::FileType::symlink; break;
+			default:
+				entry.type = protocols::fs::FileType::unknown;
+			}
+			entries.push_back(std::move(entry));
+		}
+
+		offset += disk_entry->recordLength;
+	}
+
+	if(withStats)
+		co_await inode->fs.readEntryStats(entries);
+	co_return std::move(entries);
+}
+
 } } // namespace blockfs::ext2fs
 
@@ -9,6 +9,7 @@
 #include <vector>
 #include <protocols/fs/file-locks.hpp>
 
+#include <async/mutex.hpp>
 #include <async/oneshot-event.hpp>
 #include <async/recurring-event.hpp>
 #include <hel.h>
@@ -16,6 +17,7 @@
 #include <blockfs.hpp>
 #include "common.hpp"
 #include "fs.bragi.hpp"
+#include "journal.hpp"
 
 namespace blockfs {
 namespace ext2fs {
@@ -89,11 +91,16 @@ struct DiskSuperblock {
 	//-- Directory Indexing Support --
 	uint32_t hashSeed[4];
 	uint8_t defHashVersion;
-	uint8_t padding[3];
+	uint8_t jnlBackupType;
+	uint16_t descSize;
 	//-- Other options --
 	uint32_t defaultMountOptions;
 	uint32_t firstMetaBg;
-	uint8_t unused[760];
+	uint32_t mkfsTime;
+	uint32_t jnlBlocks[17];
+	//-- 64bit Support --
+	uint32_t blocksCountHi;
+	uint8_t unused[684];
 };
 static_assert(sizeof(DiskSuperblock) == 1024, "Bad DiskSuperblock struct size");
 
@@ -109,6 +116,36 @@ struct DiskGroupDesc {
 };
 static_assert(sizeof(DiskGroupDesc) == 32, "Bad DiskGroupDesc struct size");
 
+// With the 64bit feature, group descriptors are (at least) 64 bytes long.
+struct DiskGroupDescHi {
+	uint32_t blockBitmapHi;
+	uint32_t inodeBitmapHi;
+	uint32_t inodeTableHi;
+	uint16_t freeBlocksCountHi;
+	uint16_t freeInodesCountHi;
+	uint16_t usedDirsCountHi;
+	uint16_t pad;
+	uint8_t reserved[12];
+};
+static_assert(sizeof(DiskGroupDescHi) == 32, "Bad DiskGroupDescHi struct size");
+
+enum {
+	EXT3_FEATURE_COMPAT_HAS_JOURNAL = 0x4
+};
+
+enum {
+	EXT2_FEATURE_INCOMPAT_FILETYPE = 0x2,
+	EXT3_FEATURE_INCOMPAT_RECOVER = 0x4,
+	EXT4_FEATURE_INCOMPAT_EXTENTS = 0x40,
+	EXT4_FEATURE_INCOMPAT_64BIT = 0x80,
+	EXT4_FEATURE_INCOMPAT_FLEX_BG = 0x200
+};
+
+enum {
+	EXT4_FEATURE_RO_COMPAT_GDT_CSUM = 0x10,
+	EXT4_FEATURE_RO_COMPAT_METADATA_CSUM = 0x400
+};
+
 struct DiskInode {
 	uint16_t mode;
 	uint16_t uid;
@@ -135,6 +172,45 @@ enum {
 	EXT2_ROOT_INO = 2
 };
 
+enum {
+	// The directory has an htree (dir_index) index.
+	EXT2_INDEX_FL = 0x1000,
+	// The file data is mapped by an extent tree in FileData::embedded.
+	EXT4_EXTENTS_FL = 0x80000
+};
+
+struct DiskExtentHeader {
+	uint16_t magic;
+	uint16_t entries;
+	uint16_t max;
+	uint16_t depth;
+	uint32_t generation;
+};
+static_assert(sizeof(DiskExtentHeader) == 12, "Bad DiskExtentHeader struct size");
+
+// Entry of an inner node of the extent tree.
+struct DiskExtentIndex {
+	uint32_t block;
+	uint32_t leafLo;
+	uint16_t leafHi;
+	uint16_t unused;
+};
+static_assert(sizeof(DiskExtentIndex) == 12, "Bad DiskExtentIndex struct size");
+
+// Entry of a leaf of the extent tree.
+struct DiskExtent {
+	uint32_t block;
+	uint16_t length;
+	uint16_t startHi;
+	uint32_t startLo;
+};
+static_assert(sizeof(DiskExtent) == 12, "Bad DiskExtent struct size");
+
+constexpr uint16_t extentMagic = 0xF30A;
+
+// Extents longer than this are uninitialized (i.e., they read as zeros).
+constexpr uint16_t maxInitializedExtent = 32768;
+
 enum {
 	EXT2_S_IFMT = 0xF000,
 	EXT2_S_IFLNK = 0xA000,
@@ -185,6 +261,9 @@ struct Inode : std::enable_shared_from_this<Inode> {
 
 	void setFileSize(uint64_t size);
 
+	// Must be called whenever the attributes returned by getStats() change.
+	void attributesChanged();
+
 	async::result<frg::expected<protocols::fs::Error, std::optional<DirEntry>>>
 	findEntry(std::string name);
 
@@ -195,6 +274,9 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	async::result<protocols::fs::Error> chmod(int mode);
 	async::result<protocols::fs::Error> utimensat(uint64_t atime_sec, uint64_t atime_nsec, uint64_t mtime_sec, uint64_t mtime_nsec);
 
+	// Builds dirIndex. The directory's mapping must be locked.
+	void buildDirIndex();
+
 	FileSystem &fs;
 
 	// ext2fs on-disk inode number
@@ -214,6 +296,9 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	HelHandle frontalMemory;
 	helix::Mapping fileMapping;
 
+	// Serializes writeback of the page cache (see FileSystem::manageFileData()).
+	async::mutex writebackMutex;
+
 	// Caches indirection blocks reachable from the inode.
 	// - Indirection level 1/1 for single indirect blocks.
 	// - Indirection level 1/2 for double indirect blocks.
@@ -235,6 +320,10 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	FlockManager flockManager;
 
 	std::unordered_set<std::string> obstructedLinks;
+
+	// For directories: maps names to the offsets of their DiskDirEntry.
+	// Built on the first lookup and kept up-to-date by link() and unlink().
+	std::optional<std::unordered_map<std::string, uint32_t>> dirIndex;
 };
 
 // --------------------------------------------------------
@@ -264,21 +353,54 @@ struct FileSystem {
 	async::detached manageIndirect(std::shared_ptr<Inode> inode, int order,
 			helix::UniqueDescriptor memory);
 
-	async::result<uint32_t> allocateBlock();
+	// Allocates up to count contiguous blocks, preferably at or after goal.
+	// Returns the first block and the number of blocks (or 0 if the FS is full).
+	async::result<std::pair<uint32_t, size_t>> allocateBlocks(uint32_t goal, size_t count);
+	async::result<uint32_t> allocateBlock(uint32_t goal = 0);
+	// Marks count contiguous blocks as free and discards them on the device.
+	async::result<void> freeBlocks(uint32_t block, size_t count);
 	async::result<uint32_t> allocateInode();
 
 	async::result<void> assignDataBlocks(Inode *inode,
 			uint64_t block_offset, size_t num_blocks);
 
+	// For inodes with EXT4_EXTENTS_FL: returns the physical block that backs the given
+	// block of the file (or 0 for holes and uninitialized extents) and the number of
+	// blocks (at most limit) up to which this mapping is contiguous.
+	async::result<std::pair<uint64_t, size_t>> mapExtent(Inode *inode,
+			uint64_t block, size_t limit);
+
+	// Allocates blocks at the end of an extent-mapped file.
+	async::result<void> appendExtents(Inode *inode,
+			uint64_t block_offset, size_t num_blocks);
+
 	async::result<void> readDataBlocks(std::shared_ptr<Inode> inode, uint64_t block_offset,
 			size_t num_blocks, void *buffer);
 	async::result<void> writeDataBlocks(std::shared_ptr<Inode> inode, uint64_t block_offset,
 			size_t num_blocks, const void *buffer);
 
 	async::result<void> truncate(Inode *inode, size_t size);
+	// Frees all data blocks of the file starting at the given block of the file.
+	async::result<void> releaseDataBlocks(Inode *inode, uint64_t block_offset);
+
+	// Writes the file's data, its block map and its inode back to stable storage.
+	async::result<void> sync(Inode *inode);
 
 	async::result<void> writebackBgdt();
 
+	// Writes metadata blocks (bitmaps, inodes, indirect blocks, directories)
+	// through the journal if there is one.
+	async::result<void> writeMetadata(uint64_t block, const void *buffer, size_t num_blocks);
+
+	// Returns the physical blocks of the journal inode. Reads the inode directly from
+	// the device as the inode table must not be cached before the journal is recovered.
+	async::result<std::vector<uint64_t>> mapJournal(uint32_t number);
+	async::result<void> mapJournalExtents(const char *node, std::vector<uint64_t> &blocks);
+
+	// Fills in the stats of the given entries. Reads the inode table directly,
+	// i.e., without instantiating Inodes, and maps each page of it only once.
+	async::result<void> readEntryStats(std::vector<protocols::fs::DirectoryEntry> &entries);
+
 	BlockDevice *device;
 	uint16_t inodeSize;
 	uint32_t blockShift;
@@ -290,14 +412,24 @@ struct FileSystem {
 	uint32_t inodesPerGroup;
 	uint32_t blocksCount;
 	uint32_t inodesCount;
+	uint32_t groupDescSize;
 	std::vector<std::byte> blockGroupDescriptorBuffer;
-	DiskGroupDesc *bgdt;
+
+	// Only present for ext3/ext4 file systems with a journal inode.
+	std::unique_ptr<Journal> journal;
+
+	DiskGroupDesc &groupDesc(uint32_t bg_idx) {
+		return *reinterpret_cast<DiskGroupDesc *>(blockGroupDescriptorBuffer.data()
+				+ bg_idx * groupDescSize);
+	}
 
 	helix::UniqueDescriptor blockBitmap;
 	helix::UniqueDescriptor inodeBitmap;
 	helix::UniqueDescriptor inodeTable;
 
 	std::unordered_map<uint32_t, std::weak_ptr<Inode>> activeInodes;
+
+	protocols::fs::AttributeGenerationProvider attributeGenerations;
 };
 
 // --------------------------------------------------------
@@ -308,6 +440,8 @@ struct OpenFile {
 	OpenFile(std::shared_ptr<Inode> inode);
 
 	async::result<std::optional<std::string>> readEntries();
+	async::result<protocols::fs::ReadEntryBatchResult> readEntryBatch(size_t maxSize,
+			bool withStats);
 
 	std::shared_ptr<Inode> inode;
 	uint64_t offset;
@@ -84,5 +84,35 @@ async::result<void> Partition::writeSectors(uint64_t sector, const void *buffer,
 			buffer, count);
 }
 
+async::result<void> Partition::readSectorsVectored(uint64_t sector,
+		std::span<const SectorBuffer> buffers) {
+	return _table.getDevice()->readSectorsVectored(_startLba + sector, buffers);
+}
+
+async::result<void> Partition::writeSectorsVectored(uint64_t sector,
+		std::span<const SectorBuffer> buffers) {
+	return _table.getDevice()->writeSectorsVectored(_startLba + sector, buffers);
+}
+
+async::result<void> Partition::flush() {
+	return _table.getDevice()->flush();
+}
+
+async::result<void> Partition::writeSectorsFua(uint64_t sector, const void *buffer,
+		size_t count) {
+	assert(sector + count <= _numSectors);
+	return _table.getDevice()->writeSectorsFua(_startLba + sector, buffer, count);
+}
+
+async::result<void> Partition::discardSectors(uint64_t sector, size_t count) {
+	assert(sector + count <= _numSectors);
+	return _table.getDevice()->discardSectors(_startLba + sector, count);
+}
+
+async::result<void> Partition::writeZeroes(uint64_t sector, size_t count) {
+	assert(sector + count <= _numSectors);
+	return _table.getDevice()->writeZeroes(_startLba + sector, count);
+}
+
 } } // namespace blockfs::gpt
 
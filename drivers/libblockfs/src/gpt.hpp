@@ -102,6 +102,21 @@ struct Partition : public BlockDevice {
 	async::result<void> writeSectors(uint64_t sector, const void *buffer,
 			size_t num_sectors) override;
 
+	async::result<void> readSectorsVectored(uint64_t sector,
+			std::span<const SectorBuffer> buffers) override;
+
+	async::result<void> writeSectorsVectored(uint64_t sector,
+			std::span<const SectorBuffer> buffers) override;
+
+	async::result<void> flush() override;
+
+	async::result<void> writeSectorsFua(uint64_t sector, const void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> discardSectors(uint64_t sector, size_t num_sectors) override;
+
+	async::result<void> writeZeroes(uint64_t sector, size_t num_sectors) override;
+
 	Guid id();
 
 	Guid type();
@@ -0,0 +1,466 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <iostream>
+
+#include "journal.hpp"
+
+namespace blockfs {
+namespace ext2fs {
+
+namespace {
+	constexpr bool logJournal = true;
+
+	uint32_t load32(const std::byte *p) {
+		auto b = reinterpret_cast<const uint8_t *>(p);
+		return (uint32_t{b[0]} << 24) | (uint32_t{b[1]} << 16)
+				| (uint32_t{b[2]} << 8) | uint32_t{b[3]};
+	}
+
+	uint16_t load16(const std::byte *p) {
+		auto b = reinterpret_cast<const uint8_t *>(p);
+		return (uint16_t{b[0]} << 8) | uint16_t{b[1]};
+	}
+
+	void store32(std::byte *p, uint32_t v) {
+		p[0] = std::byte(v >> 24);
+		p[1] = std::byte(v >> 16);
+		p[2] = std::byte(v >> 8);
+		p[3] = std::byte(v);
+	}
+
+	void store16(std::byte *p, uint16_t v) {
+		p[0] = std::byte(v >> 8);
+		p[1] = std::byte(v);
+	}
+
+	void store64(std::byte *p, uint64_t v) {
+		store32(p, v >> 32);
+		store32(p + 4, v);
+	}
+
+	void storeHeader(std::byte *p, uint32_t type, uint32_t sequence) {
+		store32(p + offsetof(JournalHeader, magic), journalMagic);
+		store32(p + offsetof(JournalHeader, blockType), type);
+		store32(p + offsetof(JournalHeader, sequence), sequence);
+	}
+
+	// Compares sequence numbers modulo 2^32.
+	bool sequenceBefore(uint32_t a, uint32_t b) {
+		return static_cast<int32_t>(a - b) < 0;
+	}
+
+	// Offsets of the commit time within commit blocks.
+	constexpr size_t commitSecOffset = 0x30;
+	constexpr size_t commitNsecOffset = 0x38;
+
+	constexpr size_t uuidSize = 16;
+}
+
+Journal::Journal(BlockDevice *device, uint32_t blockSize, std::vector<uint64_t> blocks)
+: _device{device}, _blockSize{blockSize}, _sectorsPerBlock{blockSize / 512},
+		_blocks{std::move(blocks)} { }
+
+async::result<bool> Journal::load() {
+	assert(!_blocks.empty());
+	_superblock.resize(_blockSize);
+	co_await _readLogBlock(0, _superblock.data());
+
+	auto sb = _superblock.data();
+	auto magic = load32(sb + offsetof(JournalSuperblock, header.magic));
+	auto type = load32(sb + offsetof(JournalSuperblock, header.blockType));
+	if(magic != journalMagic
+			|| (type != JBD2_SUPERBLOCK_V1 && type != JBD2_SUPERBLOCK_V2)) {
+		std::cout << "ext2fs: Journal superblock is invalid" << std::endl;
+		co_return false;
+	}
+
+	_maxLen = load32(sb + offsetof(JournalSuperblock, maxLen));
+	_first = load32(sb + offsetof(JournalSuperblock, first));
+	if(load32(sb + offsetof(JournalSuperblock, blockSize)) != _blockSize
+			|| _maxLen > _blocks.size() || !_first || _first >= _maxLen) {
+		std::cout << "ext2fs: Journal geometry does not match the journal inode" << std::endl;
+		co_return false;
+	}
+
+	_sequence = load32(sb + offsetof(JournalSuperblock, sequence));
+	_tail = load32(sb + offsetof(JournalSuperblock, start));
+	_tailSequence = _sequence;
+
+	// v1 superblocks do not have feature fields.
+	uint32_t compat = 0, incompat = 0;
+	if(type == JBD2_SUPERBLOCK_V2) {
+		compat = load32(sb + offsetof(JournalSuperblock, featureCompat));
+		incompat = load32(sb + offsetof(JournalSuperblock, featureIncompat));
+	}
+	_has64bit = incompat & JBD2_FEATURE_INCOMPAT_64BIT;
+
+	constexpr uint32_t supportedIncompat = JBD2_FEATURE_INCOMPAT_REVOKE
+			| JBD2_FEATURE_INCOMPAT_64BIT;
+	if(type != JBD2_SUPERBLOCK_V2 || (compat & JBD2_FEATURE_COMPAT_CHECKSUM)
+			|| (incompat & ~supportedIncompat)) {
+		std::cout << "\e[31m" "ext2fs: Journal features are not supported"
+				" (compat: " << compat << ", incompat: " << incompat << ")"
+				"\e[39m" << std::endl;
+		if(_tail) {
+			std::cout << "ext2fs: Journal needs recovery, refusing to mount" << std::endl;
+			abort();
+		}
+		co_return false;
+	}
+
+	// Leave room for the transaction that is being written while the next one fills up.
+	_maxTransaction = (_maxLen - _first) / 4;
+	co_return true;
+}
+
+async::result<void> Journal::recover() {
+	if(_tail) {
+		struct Tag {
+			uint64_t block;
+			uint32_t index;
+			bool escaped;
+		};
+
+		struct Scanned {
+			uint32_t sequence;
+			std::vector<Tag> tags;
+			std::vector<uint64_t> revoked;
+		};
+
+		std::vector<Scanned> committed;
+		Scanned current{_tailSequence, {}, {}};
+
+		auto tagSize = _has64bit ? 12 : 8;
+		std::vector<std::byte> buffer(_blockSize);
+		uint32_t index = _tail;
+		size_t visited = 0;
+		while(visited < _maxLen - _first) {
+			co_await _readLogBlock(index, buffer.data());
+			auto p = buffer.data();
+			if(load32(p + offsetof(JournalHeader, magic)) != journalMagic
+					|| load32(p + offsetof(JournalHeader, sequence)) != current.sequence)
+				break;
+
+			auto type = load32(p + offsetof(JournalHeader, blockType));
+			if(type == JBD2_DESCRIPTOR_BLOCK) {
+				size_t offset = sizeof(JournalHeader);
+				while(offset + tagSize <= _blockSize) {
+					uint64_t block = load32(p + offset);
+					auto flags = load16(p + offset + 6);
+					if(_has64bit)
+						block |= uint64_t{load32(p + offset + 8)} << 32;
+					offset += tagSize;
+					if(!(flags & JBD2_FLAG_SAME_UUID))
+						offset += uuidSize;
+
+					index = _nextIndex(index);
+					visited++;
+					current.tags.push_back({block, index, bool(flags & JBD2_FLAG_ESCAPE)});
+					if(flags & JBD2_FLAG_LAST_TAG)
+						break;
+				}
+			}else if(type == JBD2_REVOKE_BLOCK) {
+				auto count = load32(p + offsetof(JournalRevokeHeader, count));
+				size_t recordSize = _has64bit ? 8 : 4;
+				for(size_t offset = sizeof(JournalRevokeHeader);
+						offset + recordSize <= std::min<size_t>(count, _blockSize);
+						offset += recordSize) {
+					uint64_t block = load32(p + offset);
+					if(_has64bit)
+						block = (block << 32) | load32(p + offset + 4);
+					current.revoked.push_back(block);
+				}
+			}else if(type == JBD2_COMMIT_BLOCK) {
+				auto sequence = current.sequence;
+				committed.push_back(std::move(current));
+				current = Scanned{sequence + 1, {}, {}};
+			}else{
+				break;
+			}
+
+			index = _nextIndex(index);
+			visited++;
+		}
+
+		// A revoke record prevents replay of the block from the same and earlier transactions.
+		std::unordered_map<uint64_t, uint32_t> revokedUntil;
+		for(auto &transaction : committed) {
+			for(auto block : transaction.revoked)
+				revokedUntil[block] = transaction.sequence;
+		}
+
+		size_t numReplayed = 0;
+		for(auto &transaction : committed) {
+			for(auto &tag : transaction.tags) {
+				auto it = revokedUntil.find(tag.block);
+				if(it != revokedUntil.end() && !sequenceBefore(it->second, transaction.sequence))
+					continue;
+
+				co_await _readLogBlock(tag.index, buffer.data());
+				if(tag.escaped)
+					store32(buffer.data(), journalMagic);
+				co_await _device->writeSectors(tag.block * _sectorsPerBlock,
+						buffer.data(), _sectorsPerBlock);
+				numReplayed++;
+			}
+		}
+		co_await _device->flush();
+
+		if(logJournal)
+			std::cout << "ext2fs: Replayed " << committed.size() << " transactions ("
+					<< numReplayed << " blocks) from the journal" << std::endl;
+		_didReplay = numReplayed;
+		_sequence = current.sequence;
+	}
+
+	// Start a new log. Recovery of the old one is complete, hence it can be overwritten.
+	_head = _first;
+	co_await _updateSuperblock(_first, _sequence);
+
+	_running = std::make_shared<Transaction>();
+	_run();
+}
+
+async::result<void> Journal::writeBlocks(uint64_t block, const void *buffer,
+		size_t num_blocks) {
+	// Collect the transactions that we join; large writes can span more than one.
+	std::vector<std::shared_ptr<Transaction>> transactions;
+	for(size_t i = 0; i < num_blocks; i++) {
+		while(!_running->blocks.count(block + i)
+				&& _logSize(_running->blocks.size() + 1, _running->revoked.size())
+					> _maxTransaction) {
+			auto full = _running;
+			_runningDoorbell.raise();
+			co_await full->done.wait();
+		}
+
+		auto data = static_cast<const std::byte *>(buffer) + i * _blockSize;
+		_running->blocks[block + i].assign(data, data + _blockSize);
+		_running->revoked.erase(block + i);
+		if(transactions.empty() || transactions.back() != _running)
+			transactions.push_back(_running);
+	}
+	_runningDoorbell.raise();
+
+	for(auto &transaction : transactions)
+		co_await transaction->done.wait();
+}
+
+void Journal::revokeBlocks(uint64_t block, size_t num_blocks) {
+	for(size_t i = 0; i < num_blocks; i++) {
+		_running->blocks.erase(block + i);
+		if(_logged.count(block + i))
+			_running->revoked.insert(block + i);
+	}
+	_runningDoorbell.raise();
+}
+
+async::result<void> Journal::_readLogBlock(uint32_t index, void *buffer) {
+	assert(index < _blocks.size());
+	co_await _device->readSectors(_blocks[index] * _sectorsPerBlock, buffer, _sectorsPerBlock);
+}
+
+async::result<void> Journal::_writeLog(uint32_t index, const std::byte *buffer,
+		size_t num_blocks) {
+	size_t progress = 0;
+	while(progress < num_blocks) {
+		// Fuse log blocks that are also physically contiguous.
+		size_t n = 1;
+		while(progress + n < num_blocks && index + n < _maxLen
+				&& _blocks[index + n] == _blocks[index] + n)
+			n++;
+
+		co_await _device->writeSectors(_blocks[index] * _sectorsPerBlock,
+				buffer + progress * _blockSize, n * _sectorsPerBlock);
+		progress += n;
+		index += n;
+		if(index == _maxLen)
+			index = _first;
+	}
+}
+
+uint32_t Journal::_nextIndex(uint32_t index) {
+	index++;
+	if(index == _maxLen)
+		return _first;
+	return index;
+}
+
+size_t Journal::_tagsPerDescriptor() {
+	// Only the first tag is followed by a UUID.
+	size_t tagSize = _has64bit ? 12 : 8;
+	return (_blockSize - sizeof(JournalHeader) - uuidSize) / tagSize;
+}
+
+size_t Journal::_revokesPerBlock() {
+	size_t recordSize = _has64bit ? 8 : 4;
+	return (_blockSize - sizeof(JournalRevokeHeader)) / recordSize;
+}
+
+size_t Journal::_logSize(size_t num_blocks, size_t num_revoked) {
+	auto perDescriptor = _tagsPerDescriptor();
+	auto perRevoke = _revokesPerBlock();
+	return (num_revoked + perRevoke - 1) / perRevoke
+			+ (num_blocks + perDescriptor - 1) / perDescriptor
+			+ num_blocks + 1;
+}
+
+async::result<void> Journal::_updateSuperblock(uint32_t start, uint32_t sequence) {
+	// All transactions before start must be durable at their final location.
+	co_await _device->flush();
+
+	auto sb = _superblock.data();
+	store32(sb + offsetof(JournalSuperblock, start), start);
+	store32(sb + offsetof(JournalSuperblock, sequence), sequence);
+	// Readers of the log must honor our revoke records.
+	auto incompat = load32(sb + offsetof(JournalSuperblock, featureIncompat));
+	store32(sb + offsetof(JournalSuperblock, featureIncompat),
+			incompat | JBD2_FEATURE_INCOMPAT_REVOKE);
+	co_await _device->writeSectorsFua(_blocks[0] * _sectorsPerBlock, sb, _sectorsPerBlock);
+
+	_tail = start;
+	_tailSequence = sequence;
+	_logged.clear();
+}
+
+async::detached Journal::_run() {
+	while(true) {
+		if(_running->blocks.empty() && _running->revoked.empty()) {
+			co_await _runningDoorbell.async_wait();
+			continue;
+		}
+
+		// Writers that arrive while we commit join the next transaction.
+		auto transaction = std::move(_running);
+		_running = std::make_shared<Transaction>();
+
+		co_await _commit(transaction.get());
+		transaction->done.raise();
+	}
+}
+
+async::result<void> Journal::_commit(Transaction *transaction) {
+	auto numBlocks = transaction->blocks.size();
+	auto numRevoked = transaction->revoked.size();
+	auto logSize = _logSize(numBlocks, numRevoked);
+
+	// Reclaim the log lazily: all transactions before _head are checkpointed already,
+	// but we only move the tail forward once we would otherwise overwrite it.
+	size_t capacity = _maxLen - _first;
+	size_t used = (_head + capacity - _tail) % capacity;
+	if(logSize >= capacity - used)
+		co_await _updateSuperblock(_head, _sequence);
+	assert(logSize < capacity);
+
+	std::vector<std::byte> log((logSize - 1) * _blockSize);
+	size_t position = 0;
+
+	// Revoke records go first; their position within the transaction does not matter.
+	auto recordSize = _has64bit ? 8 : 4;
+	auto revokeIt = transaction->revoked.begin();
+	while(revokeIt != transaction->revoked.end()) {
+		auto p = log.data() + position * _blockSize;
+		storeHeader(p, JBD2_REVOKE_BLOCK, _sequence);
+		size_t offset = sizeof(JournalRevokeHeader);
+		while(revokeIt != transaction->revoked.end() && offset + recordSize <= _blockSize) {
+			if(_has64bit) {
+				store64(p + offset, *revokeIt);
+			}else{
+				store32(p + offset, *revokeIt);
+			}
+			offset += recordSize;
+			++revokeIt;
+		}
+		store32(p + offsetof(JournalRevokeHeader, count), offset);
+		position++;
+	}
+
+	auto tagSize = _has64bit ? 12 : 8;
+	auto uuid = _superblock.data() + offsetof(JournalSuperblock, uuid);
+	auto blockIt = transaction->blocks.begin();
+	while(blockIt != transaction->blocks.end()) {
+		auto descriptor = log.data() + position * _blockSize;
+		storeHeader(descriptor, JBD2_DESCRIPTOR_BLOCK, _sequence);
+		position++;
+
+		size_t offset = sizeof(JournalHeader);
+		size_t n = 0;
+		while(blockIt != transaction->blocks.end() && n < _tagsPerDescriptor()) {
+			auto &[block, data] = *blockIt;
+			auto p = log.data() + position * _blockSize;
+			memcpy(p, data.data(), _blockSize);
+
+			uint16_t flags = 0;
+			if(load32(p) == journalMagic) {
+				store32(p, 0);
+				flags |= JBD2_FLAG_ESCAPE;
+			}
+			if(n)
+				flags |= JBD2_FLAG_SAME_UUID;
+			if(std::next(blockIt) == transaction->blocks.end() || n + 1 == _tagsPerDescriptor())
+				flags |= JBD2_FLAG_LAST_TAG;
+
+			store32(descriptor + offset, block);
+			store16(descriptor + offset + 4, 0);
+			store16(descriptor + offset + 6, flags);
+			if(_has64bit)
+				store32(descriptor + offset + 8, block >> 32);
+			offset += tagSize;
+			if(!n) {
+				memcpy(descriptor + offset, uuid, uuidSize);
+				offset += uuidSize;
+			}
+
+			position++;
+			n++;
+			++blockIt;
+		}
+	}
+	assert(position == logSize - 1);
+
+	co_await _writeLog(_head, log.data(), position);
+
+	// The commit block must not become durable before the rest of the transaction.
+	co_await _device->flush();
+
+	std::vector<std::byte> commit(_blockSize);
+	storeHeader(commit.data(), JBD2_COMMIT_BLOCK, _sequence);
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	store64(commit.data() + commitSecOffset, now.tv_sec);
+	store32(commit.data() + commitNsecOffset, now.tv_nsec);
+
+	auto commitIndex = _head;
+	for(size_t i = 0; i < position; i++)
+		commitIndex = _nextIndex(commitIndex);
+	co_await _device->writeSectorsFua(_blocks[commitIndex] * _sectorsPerBlock,
+			commit.data(), _sectorsPerBlock);
+
+	for(auto &entry : transaction->blocks)
+		_logged.insert(entry.first);
+	_head = _nextIndex(commitIndex);
+	_sequence++;
+
+	// Checkpoint the transaction. The blocks are sorted, hence adjacent blocks
+	// can be written by a single request.
+	blockIt = transaction->blocks.begin();
+	std::vector<std::byte> run;
+	while(blockIt != transaction->blocks.end()) {
+		auto first = blockIt->first;
+		run.clear();
+		size_t n = 0;
+		while(blockIt != transaction->blocks.end() && blockIt->first == first + n) {
+			run.insert(run.end(), blockIt->second.begin(), blockIt->second.end());
+			n++;
+			++blockIt;
+		}
+		co_await _device->writeSectors(first * _sectorsPerBlock,
+				run.data(), n * _sectorsPerBlock);
+	}
+}
+
+} } // namespace blockfs::ext2fs
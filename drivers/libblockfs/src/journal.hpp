@@ -0,0 +1,177 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <async/oneshot-event.hpp>
+#include <async/recurring-event.hpp>
+#include <async/result.hpp>
+#include <blockfs.hpp>
+
+namespace blockfs {
+namespace ext2fs {
+
+// --------------------------------------------------------
+// On-disk structures (JBD2). All fields are big-endian.
+// --------------------------------------------------------
+
+constexpr uint32_t journalMagic = 0xC03B3998;
+
+enum {
+	JBD2_DESCRIPTOR_BLOCK = 1,
+	JBD2_COMMIT_BLOCK = 2,
+	JBD2_SUPERBLOCK_V1 = 3,
+	JBD2_SUPERBLOCK_V2 = 4,
+	JBD2_REVOKE_BLOCK = 5
+};
+
+enum {
+	JBD2_FEATURE_COMPAT_CHECKSUM = 0x1
+};
+
+enum {
+	JBD2_FEATURE_INCOMPAT_REVOKE = 0x1,
+	JBD2_FEATURE_INCOMPAT_64BIT = 0x2,
+	JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT = 0x4,
+	JBD2_FEATURE_INCOMPAT_CSUM_V2 = 0x8,
+	JBD2_FEATURE_INCOMPAT_CSUM_V3 = 0x10,
+	JBD2_FEATURE_INCOMPAT_FAST_COMMIT = 0x20
+};
+
+enum {
+	// The first word of the block matched journalMagic and was zeroed in the log.
+	JBD2_FLAG_ESCAPE = 0x1,
+	// The tag is not followed by a UUID.
+	JBD2_FLAG_SAME_UUID = 0x2,
+	JBD2_FLAG_LAST_TAG = 0x8
+};
+
+struct JournalHeader {
+	uint32_t magic;
+	uint32_t blockType;
+	uint32_t sequence;
+};
+static_assert(sizeof(JournalHeader) == 12, "Bad JournalHeader struct size");
+
+struct JournalSuperblock {
+	JournalHeader header;
+	uint32_t blockSize;
+	uint32_t maxLen;
+	uint32_t first;
+	uint32_t sequence;
+	uint32_t start;
+	uint32_t errno_;
+	uint32_t featureCompat;
+	uint32_t featureIncompat;
+	uint32_t featureRoCompat;
+	uint8_t uuid[16];
+	uint32_t nrUsers;
+	uint32_t dynSuper;
+	uint32_t maxTransaction;
+	uint32_t maxTransData;
+};
+static_assert(sizeof(JournalSuperblock) == 0x50, "Bad JournalSuperblock struct size");
+
+// Descriptor blocks contain tags of the form {be32 blockNr; be16 checksum; be16 flags;}
+// followed by be32 blockNrHi if JBD2_FEATURE_INCOMPAT_64BIT is set.
+// Tags without JBD2_FLAG_SAME_UUID are followed by the 16 byte UUID of the journal.
+
+struct JournalRevokeHeader {
+	JournalHeader header;
+	// Number of bytes of the block that are used (including this header).
+	uint32_t count;
+};
+static_assert(sizeof(JournalRevokeHeader) == 16, "Bad JournalRevokeHeader struct size");
+
+// --------------------------------------------------------
+// Journal
+// --------------------------------------------------------
+
+// Write-ahead log for metadata blocks in the format of ext3/ext4's JBD2.
+// Metadata writes join the running transaction; a single commit loop writes
+// all blocks of the transaction to the log at once (i.e., concurrent writers
+// share one sequential log write and one cache flush) and then checkpoints
+// them to their final location.
+struct Journal {
+	// blocks contains the physical block of each block of the journal inode.
+	Journal(BlockDevice *device, uint32_t blockSize, std::vector<uint64_t> blocks);
+
+	// Reads the journal superblock. Returns false if the journal cannot be used.
+	async::result<bool> load();
+
+	// Replays all committed transactions and starts a new log.
+	// Must be called before metadata is read from the device.
+	async::result<void> recover();
+
+	// True if recover() wrote blocks to their final location.
+	bool didReplay() {
+		return _didReplay;
+	}
+
+	// Writes full file system blocks through the journal. Completes once the blocks
+	// are committed and written to their final location.
+	async::result<void> writeBlocks(uint64_t block, const void *buffer, size_t num_blocks);
+
+	// Must be called when metadata blocks are freed. Ensures that older copies
+	// of the blocks in the log are not replayed over the blocks' new contents.
+	void revokeBlocks(uint64_t block, size_t num_blocks);
+
+private:
+	struct Transaction {
+		// Maps file system blocks to their contents.
+		std::map<uint64_t, std::vector<std::byte>> blocks;
+		std::unordered_set<uint64_t> revoked;
+		async::oneshot_event done;
+	};
+
+	async::result<void> _readLogBlock(uint32_t index, void *buffer);
+
+	// Writes consecutive log blocks, starting at the given block.
+	async::result<void> _writeLog(uint32_t index, const std::byte *buffer, size_t num_blocks);
+
+	uint32_t _nextIndex(uint32_t index);
+
+	size_t _tagsPerDescriptor();
+	size_t _revokesPerBlock();
+
+	// Number of log blocks (including the commit block) that a transaction takes.
+	size_t _logSize(size_t num_blocks, size_t num_revoked);
+
+	async::result<void> _updateSuperblock(uint32_t start, uint32_t sequence);
+
+	async::detached _run();
+
+	async::result<void> _commit(Transaction *transaction);
+
+	BlockDevice *_device;
+	uint32_t _blockSize;
+	uint32_t _sectorsPerBlock;
+	std::vector<uint64_t> _blocks;
+
+	std::vector<std::byte> _superblock;
+	uint32_t _first = 0;
+	uint32_t _maxLen = 0;
+	bool _has64bit = false;
+	bool _didReplay = false;
+
+	// Start of the log and its first sequence number as recorded in the superblock.
+	uint32_t _tail = 0;
+	uint32_t _tailSequence = 0;
+	// Position and sequence number of the next transaction.
+	uint32_t _head = 0;
+	uint32_t _sequence = 0;
+
+	// Blocks that have copies between _tail and _head.
+	std::unordered_set<uint64_t> _logged;
+
+	// Upper bound on the number of log blocks of a single transaction.
+	size_t _maxTransaction = 0;
+
+	std::shared_ptr<Transaction> _running;
+	async::recurring_event _runningDoorbell;
+};
+
+} } // namespace blockfs::ext2fs
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <iostream>
 #include <algorithm>
@@ -11,6 +12,7 @@
 #include <protocols/ostrace/ostrace.hpp>
 
 #include <blockfs.hpp>
+#include "elevator.hpp"
 #include "gpt.hpp"
 #include "ext2fs.hpp"
 #include "fs.bragi.hpp"
@@ -27,6 +29,7 @@ protocols::ostrace::EventId ostReadEvent;
 protocols::ostrace::EventId ostReaddirEvent;
 protocols::ostrace::ItemId ostByteCounter;
 protocols::ostrace::ItemId ostTimeCounter;
+protocols::ostrace::ItemId ostEntryCounter;
 
 namespace {
 
@@ -181,6 +184,20 @@ readEntries(void *object) {
 	co_return co_await self->readEntries();
 }
 
+async::result<protocols::fs::ReadEntryBatchResult>
+readEntryBatch(void *object, size_t maxSize, bool withStats) {
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+
+	auto result = co_await self->readEntryBatch(maxSize, withStats);
+
+	protocols::ostrace::Event oste{&ostContext, ostReaddirEvent};
+	if(result)
+		oste.withCounter(ostEntryCounter, static_cast<int64_t>(result.value().size()));
+	co_await oste.emit();
+
+	co_return std::move(result);
+}
+
 async::result<frg::expected<protocols::fs::Error>>
 truncate(void *object, size_t size) {
 	auto self = static_cast<ext2fs::OpenFile *>(object);
@@ -188,6 +205,12 @@ truncate(void *object, size_t size) {
 	co_return {};
 }
 
+async::result<frg::expected<protocols::fs::Error>> sync(void *object) {
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	co_await self->inode->fs.sync(self->inode.get());
+	co_return {};
+}
+
 async::result<int> getFileFlags(void *) {
 	std::cout << "libblockfs: getFileFlags is stubbed" << std::endl;
     co_return 0;
@@ -206,8 +229,10 @@ constexpr protocols::fs::FileOperations fileOperations {
 	.pread        = &pread,
 	.write        = &write,
 	.readEntries  = &readEntries,
+	.readEntryBatch = &readEntryBatch,
 	.accessMemory = &accessMemory,
 	.truncate     = &truncate,
+	.sync         = &sync,
 	.flock        = &flock,
 	.getFileFlags = &getFileFlags,
 	.setFileFlags = &setFileFlags,
@@ -326,6 +351,7 @@ open(std::shared_ptr<void> object) {
 	// Use CLOCK_REALTIME when available
 	clock_gettime(CLOCK_MONOTONIC, &time);
 	self->diskInode()->atime = time.tv_sec;
+	self->attributesChanged();
 
 	auto syncInode = co_await helix_ng::synchronizeSpace(
 			helix::BorrowedDescriptor{kHelNullHandle},
@@ -402,66 +428,76 @@ async::result<protocols::fs::TraverseLinksResult> traverseLinks(std::shared_ptr<
 		std::deque<std::string> components) {
 	auto self = std::static_pointer_cast<ext2fs::Inode>(object);
 
-	std::optional<ext2fs::DirEntry> entry;
 	std::shared_ptr<ext2fs::Inode> parent = self;
 	size_t processedComponents = 0;
+	// File type of the last node (or of self if no node is left).
+	protocols::fs::FileType type = protocols::fs::FileType::directory;
 
+	// Nodes on the path from self to the last node; ".." pops the last one.
 	std::vector<std::pair<std::shared_ptr<void>, int64_t>> nodes;
 
 	while (!components.empty()) {
 		auto component = components.front();
-		components.pop_front();
-		processedComponents++;
 
 		if (component == "..") {
-			if (parent == self)
-				co_return std::make_tuple(nodes, protocols::fs::FileType::unknown, 0);
+			// Above self, the client has to check for a mount point; stop here.
+			if (nodes.empty())
+				break;
 
-			parent = self->fs.accessInode(FRG_CO_TRY(co_await parent->findEntry(".."))->inode);
+			components.pop_front();
+			processedComponents++;
 			nodes.pop_back();
-		} else {
-			entry = FRG_CO_TRY(co_await parent->findEntry(component));
-
-			if (!entry) {
-				co_return protocols::fs::Error::fileNotFound;
-			}
+			if (nodes.empty())
+				parent = self;
+			else
+				parent = std::static_pointer_cast<ext2fs::Inode>(nodes.back().first);
+			type = protocols::fs::FileType::directory;
+			continue;
+		}
 
-			assert(entry->inode);
-			nodes.push_back({self->fs.accessInode(entry->inode), entry->inode});
+		components.pop_front();
+		processedComponents++;
 
-			if (!components.empty()) {
-				if (parent->obstructedLinks.find(component) != parent->obstructedLinks.end()) {
-					break;
-				}
+		if (component == ".")
+			continue;
 
-				auto ino = self->fs.accessInode(entry->inode);
-				if (entry->fileType == kTypeSymlink)
-					break;
+		auto entry = FRG_CO_TRY(co_await parent->findEntry(component));
 
-				if (entry->fileType != kTypeDirectory)
-					co_return protocols::fs::Error::notDirectory;
+		if (!entry) {
+			co_return protocols::fs::Error::fileNotFound;
+		}
 
-				parent = ino;
-			}
+		assert(entry->inode);
+		auto ino = self->fs.accessInode(entry->inode);
+		nodes.push_back({ino, entry->inode});
+
+		switch(entry->fileType) {
+		case kTypeDirectory:
+			type = protocols::fs::FileType::directory;
+			break;
+		case kTypeRegular:
+			type = protocols::fs::FileType::regular;
+			break;
+		case kTypeSymlink:
+			type = protocols::fs::FileType::symlink;
+			break;
+		default:
+			throw std::runtime_error("Unexpected file type");
 		}
-	}
 
-	if(!entry)
-		co_return protocols::fs::Error::fileNotFound;
+		if (components.empty())
+			break;
 
-	protocols::fs::FileType type;
-	switch(entry->fileType) {
-	case kTypeDirectory:
-		type = protocols::fs::FileType::directory;
-		break;
-	case kTypeRegular:
-		type = protocols::fs::FileType::regular;
-		break;
-	case kTypeSymlink:
-		type = protocols::fs::FileType::symlink;
-		break;
-	default:
-		throw std::runtime_error("Unexpected file type");
+		if (parent->obstructedLinks.find(component) != parent->obstructedLinks.end())
+			break;
+
+		if (entry->fileType == kTypeSymlink)
+			break;
+
+		if (entry->fileType != kTypeDirectory)
+			co_return protocols::fs::Error::notDirectory;
+
+		parent = ino;
 	}
 
 	co_return std::make_tuple(nodes, type, processedComponents);
@@ -487,6 +523,94 @@ constexpr protocols::fs::NodeOperations nodeOperations{
 BlockDevice::BlockDevice(size_t sector_size)
 : sectorSize(sector_size) { }
 
+namespace {
+	struct BounceBuffer {
+		BounceBuffer(size_t size)
+		: data{aligned_alloc(0x1000, (size + 0xFFF) & ~size_t(0xFFF))} {
+			if(!data)
+				throw std::bad_alloc{};
+		}
+
+		BounceBuffer(const BounceBuffer &) = delete;
+
+		~BounceBuffer() {
+			free(data);
+		}
+
+		BounceBuffer &operator= (const BounceBuffer &) = delete;
+
+		void *data;
+	};
+}
+
+async::result<void> BlockDevice::readSectorsVectored(uint64_t sector,
+		std::span<const SectorBuffer> buffers) {
+	if(buffers.size() == 1) {
+		co_await readSectors(sector, buffers[0].data, buffers[0].numSectors);
+		co_return;
+	}
+
+	size_t numSectors = 0;
+	for(auto &b : buffers)
+		numSectors += b.numSectors;
+
+	BounceBuffer bounce{numSectors * sectorSize};
+	co_await readSectors(sector, bounce.data, numSectors);
+
+	size_t offset = 0;
+	for(auto &b : buffers) {
+		memcpy(b.data, reinterpret_cast<char *>(bounce.data) + offset, b.numSectors * sectorSize);
+		offset += b.numSectors * sectorSize;
+	}
+}
+
+async::result<void> BlockDevice::writeSectorsVectored(uint64_t sector,
+		std::span<const SectorBuffer> buffers) {
+	if(buffers.size() == 1) {
+		co_await writeSectors(sector, buffers[0].data, buffers[0].numSectors);
+		co_return;
+	}
+
+	size_t numSectors = 0;
+	for(auto &b : buffers)
+		numSectors += b.numSectors;
+
+	BounceBuffer bounce{numSectors * sectorSize};
+	size_t offset = 0;
+	for(auto &b : buffers) {
+		memcpy(reinterpret_cast<char *>(bounce.data) + offset, b.data, b.numSectors * sectorSize);
+		offset += b.numSectors * sectorSize;
+	}
+
+	co_await writeSectors(sector, bounce.data, numSectors);
+}
+
+async::result<void> BlockDevice::flush() {
+	co_return;
+}
+
+async::result<void> BlockDevice::writeSectorsFua(uint64_t sector, const void *buffer,
+		size_t numSectors) {
+	co_await writeSectors(sector, buffer, numSectors);
+	co_await flush();
+}
+
+async::result<void> BlockDevice::discardSectors(uint64_t, size_t) {
+	co_return;
+}
+
+async::result<void> BlockDevice::writeZeroes(uint64_t sector, size_t numSectors) {
+	// Bound the size of the zero buffer; larger requests are written in chunks.
+	constexpr size_t maxChunkBytes = 1 << 20;
+	auto chunkSectors = std::max(maxChunkBytes / sectorSize, size_t{1});
+
+	BounceBuffer zeros{std::min(numSectors, chunkSectors) * sectorSize};
+	memset(zeros.data, 0, std::min(numSectors, chunkSectors) * sectorSize);
+	for(size_t progress = 0; progress < numSectors; progress += chunkSectors)
+		co_await writeSectors(sector + progress, zeros.data,
+				std::min(numSectors - progress, chunkSectors));
+}
+
 async::detached servePartition(helix::UniqueLane lane) {
 	std::cout << "unix device: Connection" << std::endl;
 
@@ -552,6 +676,18 @@ async::detached servePartition(helix::UniqueLane lane) {
 			);
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(push_node.error());
+		}else if(req.req_type() == managarm::fs::CntReqType::SB_GET_ATTRIBUTE_GENERATIONS) {
+			managarm::fs::SvrResponse resp;
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+
+			auto ser = resp.SerializeAsString();
+			auto [send_resp, push_memory] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::pushDescriptor(fs->attributeGenerations.getMemory())
+			);
+			HEL_CHECK(send_resp.error());
+			HEL_CHECK(push_memory.error());
 		}else if(preamble.id() == managarm::fs::RenameRequest::message_id) {
 			std::vector<std::byte> tail(preamble.tail_size());
 			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
@@ -628,10 +764,13 @@ async::detached servePartition(helix::UniqueLane lane) {
 
 async::detached runDevice(BlockDevice *device) {
 	ostContext = co_await protocols::ostrace::createContext();
+	// Lets libfs_protocol record spans for traced requests.
+	protocols::ostrace::setDefaultContext(&ostContext);
 	ostReadEvent = co_await ostContext.announceEvent("libblockfs.read");
 	ostReaddirEvent = co_await ostContext.announceEvent("libblockfs.readdir");
 	ostByteCounter = co_await ostContext.announceItem("numBytes");
 	ostTimeCounter = co_await ostContext.announceItem("time");
+	ostEntryCounter = co_await ostContext.announceItem("numEntries");
 
 	table = new gpt::Table(device);
 	co_await table->parse();
@@ -666,7 +805,7 @@ async::detached runDevice(BlockDevice *device) {
 			continue;
 		printf("It's a Windows data partition!\n");
 
-		fs = new ext2fs::FileSystem(&table->getPartition(i));
+		fs = new ext2fs::FileSystem(new Elevator(&table->getPartition(i)));
 		co_await fs->init();
 		printf("ext2fs is ready!\n");
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <queue>
+#include <span>
 #include <vector>
 
 #include <async/result.hpp>
@@ -105,6 +106,9 @@ public:
 
 	void emitEvent(int type, int code, int value);
 
+	// Same as calling emitEvent() for each event, but reserves space for all of them at once.
+	void emitEvents(std::span<const StagedEvent> events);
+
 	void notify();
 
 private:
@@ -117,6 +117,7 @@ File::read(void *object, const char *, void *buffer, size_t max_size) {
 		// Reset the overflow flag.
 		self->_pending.clear();
 		self->_overflow = false;
+		self->_statusPage.update(self->_currentSeq, 0);
 
 		co_return sizeof(input_event);
 	}else{
@@ -422,17 +423,37 @@ void EventDevice::emitEvent(int type, int code, int value) {
 	_staged.push_back(StagedEvent{type, code, value});
 }
 
+void EventDevice::emitEvents(std::span<const StagedEvent> events) {
+	_staged.reserve(_staged.size() + events.size());
+	for(auto &evt : events)
+		emitEvent(evt.type, evt.code, evt.value);
+}
+
 void EventDevice::notify() {
 	if(_staged.empty())
 		return;
 
+	// All files that use the same clock see the same timestamp for this packet.
+	// Files usually share one of very few clocks, so only query each clock once.
+	std::pair<int, timespec> clocks[2];
+	int numClocks = 0;
+	auto timestampFor = [&] (int clockId) -> timespec {
+		for(int i = 0; i < numClocks; i++)
+			if(clocks[i].first == clockId)
+				return clocks[i].second;
+		struct timespec now;
+		if(clock_gettime(clockId, &now))
+			throw std::runtime_error("clock_gettime() failed");
+		if(numClocks < 2)
+			clocks[numClocks++] = {clockId, now};
+		return now;
+	};
+
 	for(auto &file : _files) {
 		if(file._overflow)
 			continue;
 
-		struct timespec now;
-		if(clock_gettime(file._clockId, &now))
-			throw std::runtime_error("clock_gettime() failed");
+		auto now = timestampFor(file._clockId);
 
 		if(file._pending.size() > 1024) {
 			file._overflow = true;
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <netserver/nic.hpp>
+#include <protocols/hw/client.hpp>
+
+namespace nic::intel {
+// Whether the driver supports the Intel (vendor 8086) PCI device with the given ID.
+bool supportsDevice(uint16_t deviceId);
+
+// Uses up to wantedQueues RX/TX queues if the device supports MSI-X.
+async::result<std::shared_ptr<nic::Link>> makeShared(protocols::hw::Device device,
+	uint16_t deviceId, size_t wantedQueues = 1);
+} // namespace nic::intel
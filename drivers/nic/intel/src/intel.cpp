@@ -0,0 +1,643 @@
+#include <nic/intel/intel.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <arch/dma_pool.hpp>
+#include <async/recurring-event.hpp>
+#include <core/dma/slab-pool.hpp>
+#include <helix/ipc.hpp>
+#include <helix/memory.hpp>
+#include <helix/timer.hpp>
+#include <protocols/logging/logging.hpp>
+
+#include "spec.hpp"
+
+namespace {
+
+// Enable with MANAGARM_LOG=intel-nic.frames=debug.
+protocols::logging::Subsystem frameLog{"intel-nic.frames"};
+
+constexpr size_t numRxDescriptors = 256;
+constexpr size_t numTxDescriptors = 256;
+// Size of each receive and transmit buffer.
+constexpr size_t bufferSize = 2048;
+constexpr size_t maxFrameSize = 1514;
+// Re-armed receive descriptors are handed back to the device in batches,
+// since each tail update is an uncached MMIO write.
+constexpr size_t rxRefillBatch = 16;
+// Upper bound on the number of interrupts per second of each vector.
+constexpr unsigned int interruptRate = 20'000;
+
+// The default key of Microsoft's RSS specification.
+constexpr uint8_t rssKey[40] = {
+	0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+	0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+	0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+	0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+	0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
+enum class Family {
+	e82574,
+	igb82576,
+	// The 82580 and its successors (I350, I210, I211) share the IVAR layout.
+	igb82580
+};
+
+struct Model {
+	uint16_t deviceId;
+	Family family;
+	const char *name;
+	// Number of receive queues that RSS can distribute frames to.
+	unsigned int maxRxQueues;
+	// Transmitted frames are not steered by the device; the 82574 only uses one queue.
+	unsigned int maxTxQueues;
+};
+
+constexpr Model models[] = {
+	{0x10D3, Family::e82574, "82574L", 2, 1},
+	{0x10C9, Family::igb82576, "82576", 16, 16},
+	{0x10E6, Family::igb82576, "82576", 16, 16},
+	{0x10E7, Family::igb82576, "82576", 16, 16},
+	{0x1521, Family::igb82580, "I350", 8, 8},
+	{0x1522, Family::igb82580, "I350", 8, 8},
+	{0x1523, Family::igb82580, "I350", 8, 8},
+	{0x1524, Family::igb82580, "I350", 8, 8},
+	{0x1533, Family::igb82580, "I210", 4, 4},
+	{0x1536, Family::igb82580, "I210", 4, 4},
+	{0x1537, Family::igb82580, "I210", 4, 4},
+	{0x1538, Family::igb82580, "I210", 4, 4},
+	{0x157B, Family::igb82580, "I210", 4, 4},
+	{0x157C, Family::igb82580, "I210", 4, 4},
+	{0x1539, Family::igb82580, "I211", 2, 2},
+};
+
+const Model *findModel(uint16_t deviceId) {
+	for(auto &model : models) {
+		if(model.deviceId == deviceId)
+			return &model;
+	}
+	return nullptr;
+}
+
+struct RxRing {
+	arch::mem_space regs;
+	arch::dma_array<spec::RxDescriptor> descriptors;
+	std::vector<arch::dma_buffer> buffers;
+	std::vector<uintptr_t> physical;
+	// Next descriptor that the device completes.
+	size_t next = 0;
+	// Number of descriptors that were re-armed but not handed to the device yet.
+	size_t pendingRefill = 0;
+	async::recurring_event doorbell;
+};
+
+// Frames are copied into per-descriptor buffers so that send() does not need
+// to wait until the device is done with the frame.
+struct TxRing {
+	arch::mem_space regs;
+	arch::dma_array<spec::TxDescriptor> descriptors;
+	std::vector<arch::dma_buffer> buffers;
+	std::vector<uintptr_t> physical;
+	// Next descriptor that we fill.
+	size_t tail = 0;
+	// Oldest descriptor that the device did not complete yet.
+	size_t clean = 0;
+	size_t inFlight = 0;
+	async::recurring_event doorbell;
+};
+
+struct IntelNic : nic::Link {
+	IntelNic(protocols::hw::Device hwDevice, const Model *model,
+			helix::UniqueDescriptor bar, helix::Mapping regsMapping);
+
+	async::result<void> initialize(size_t wantedQueues, unsigned int numMsis);
+
+	virtual size_t numQueues() override;
+	virtual async::result<nic::RxInfo> receive(arch::dma_buffer_view, size_t queue) override;
+	virtual async::result<void> send(const arch::dma_buffer_view, size_t queue) override;
+	virtual async::result<void> sendOffloaded(const arch::dma_buffer_view,
+			nic::TxOffload, size_t queue) override;
+
+	virtual ~IntelNic() override = default;
+private:
+	bool isIgb() const {
+		return model_->family != Family::e82574;
+	}
+
+	void disableIrqs_();
+	async::result<void> reset_();
+	void readMac_();
+	async::result<void> setupRxRing_(unsigned int index);
+	async::result<void> setupTxRing_(unsigned int index);
+	void setupRss_();
+	void setupMsix_();
+	void setInterruptRate_(unsigned int vector);
+	void reportLink_();
+
+	void refillRx_(RxRing *ring);
+	void reclaimTx_(TxRing *ring);
+	void wakeQueue_(unsigned int queue);
+	async::detached handleIrqs_(unsigned int vector);
+
+	protocols::hw::Device hwDevice_;
+	const Model *model_;
+	helix::UniqueDescriptor bar_;
+	helix::Mapping regsMapping_;
+	arch::mem_space regs_;
+	dma_core::SlabPool dmaPool_;
+
+	// With MSI-X, vector i serves queue i and the last vector serves all other causes.
+	// Otherwise, there is a single (legacy) IRQ and a single queue.
+	bool msix_ = false;
+	std::vector<helix::UniqueDescriptor> irqs_;
+
+	std::vector<std::unique_ptr<RxRing>> rxRings_;
+	std::vector<std::unique_ptr<TxRing>> txRings_;
+};
+
+IntelNic::IntelNic(protocols::hw::Device hwDevice, const Model *model,
+		helix::UniqueDescriptor bar, helix::Mapping regsMapping)
+	: nic::Link(1500, &dmaPool_), hwDevice_{std::move(hwDevice)}, model_{model},
+	bar_{std::move(bar)}, regsMapping_{std::move(regsMapping)}, regs_{regsMapping_.get()} { }
+
+async::result<void> IntelNic::initialize(size_t wantedQueues, unsigned int numMsis) {
+	std::cout << "intel-nic: Initializing " << model_->name << std::endl;
+
+	co_await reset_();
+	readMac_();
+
+	// RSS needs one MSI-X vector per queue, plus one vector for other causes.
+	size_t numQueues = 1;
+	if(numMsis >= 2) {
+		msix_ = true;
+		numQueues = std::min({std::max(wantedQueues, size_t{1}),
+				size_t{model_->maxRxQueues}, size_t{numMsis - 1}});
+	}
+
+	if(msix_) {
+		co_await hwDevice_.enableMsi();
+		for(unsigned int i = 0; i <= numQueues; i++)
+			irqs_.push_back(co_await hwDevice_.installMsi(i));
+	}else{
+		co_await hwDevice_.enableBusIrq();
+		irqs_.push_back(co_await hwDevice_.accessIrq());
+	}
+
+	// We do not join any multicast groups.
+	for(unsigned int i = 0; i < 128; i++)
+		regs_.store(spec::regs::at(spec::regs::mta, i), 0);
+
+	if(!isIgb())
+		regs_.store(spec::regs::rfctl, regs_.load(spec::regs::rfctl)
+				| spec::rfctl::extendedStatus);
+	for(unsigned int i = 0; i < numQueues; i++)
+		co_await setupRxRing_(i);
+	for(unsigned int i = 0; i < std::min(numQueues, size_t{model_->maxTxQueues}); i++)
+		co_await setupTxRing_(i);
+
+	// The packet checksum is never used; RSS needs the field for the hash.
+	regs_.store(spec::regs::rxcsum, spec::rxcsum::ipOffload | spec::rxcsum::tcpUdpOffload
+			| spec::rxcsum::disablePacketChecksum);
+	features |= nic::features::txChecksum | nic::features::rxChecksum;
+	if(numQueues > 1)
+		setupRss_();
+
+	regs_.store(spec::regs::rctl, spec::rctl::enable | spec::rctl::broadcastAccept
+			| spec::rctl::stripCrc);
+	if(!isIgb())
+		regs_.store(spec::regs::tipg, spec::tipgCopper);
+	regs_.store(spec::regs::tctl, spec::tctl::enable | spec::tctl::padShortPackets
+			| spec::tctl::collisionThreshold | spec::tctl::collisionDistance
+			| spec::tctl::retransmitOnLateCollision);
+
+	// Rings must be enabled before the device owns any receive descriptors.
+	// One descriptor stays unused so that a full ring can be told apart from an empty one.
+	for(auto &ring : rxRings_)
+		ring->regs.store(spec::ring::tail, numRxDescriptors - 1);
+
+	for(unsigned int i = 0; i < irqs_.size(); i++)
+		handleIrqs_(i);
+	if(msix_) {
+		setupMsix_();
+	}else{
+		setInterruptRate_(0);
+		regs_.store(spec::regs::ims, spec::irq::txDescWritten | spec::irq::linkStatusChange
+				| spec::irq::rxDescMinThreshold | spec::irq::rxOverrun | spec::irq::rxTimer);
+	}
+
+	auto ctrl = regs_.load(spec::regs::ctrl);
+	ctrl |= spec::ctrl::setLinkUp;
+	ctrl &= ~(spec::ctrl::linkReset | spec::ctrl::phyReset);
+	if(!isIgb())
+		ctrl |= spec::ctrl::autoSpeedDetect;
+	regs_.store(spec::regs::ctrl, ctrl);
+
+	std::cout << "intel-nic: Using " << rxRings_.size() << " RX and " << txRings_.size()
+			<< " TX queues" << (msix_ ? " with MSI-X" : "") << std::endl;
+}
+
+void IntelNic::disableIrqs_() {
+	regs_.store(spec::regs::imc, 0xFFFFFFFF);
+	if(isIgb())
+		regs_.store(spec::regs::eimc, 0xFFFFFFFF);
+	regs_.load(spec::regs::icr);
+}
+
+async::result<void> IntelNic::reset_() {
+	disableIrqs_();
+	regs_.store(spec::regs::rctl, 0);
+	regs_.store(spec::regs::tctl, spec::tctl::padShortPackets);
+
+	// Stop DMA before the reset; otherwise, the device can hang.
+	regs_.store(spec::regs::ctrl, regs_.load(spec::regs::ctrl) | spec::ctrl::gioMasterDisable);
+	co_await helix::kindaBusyWait(10'000'000, [&] {
+		return !(regs_.load(spec::regs::status) & spec::status::gioMasterEnable);
+	});
+
+	regs_.store(spec::regs::ctrl, regs_.load(spec::regs::ctrl) | spec::ctrl::reset);
+	// Register accesses shortly after the reset can stall the device.
+	co_await helix::sleepFor(10'000'000);
+	if(!co_await helix::kindaBusyWait(100'000'000, [&] {
+		return !(regs_.load(spec::regs::ctrl) & spec::ctrl::reset);
+	}))
+		std::cout << "\e[31m" "intel-nic: Device reset timed out" "\e[39m" << std::endl;
+
+	// The receive address (among others) is loaded from the NVM.
+	if(!co_await helix::kindaBusyWait(100'000'000, [&] {
+		return regs_.load(spec::regs::eecd) & spec::eecd::autoReadDone;
+	}))
+		std::cout << "\e[31m" "intel-nic: NVM auto-read timed out" "\e[39m" << std::endl;
+
+	disableIrqs_();
+}
+
+void IntelNic::readMac_() {
+	auto low = regs_.load(spec::regs::ral0);
+	auto high = regs_.load(spec::regs::rah0);
+	for(int i = 0; i < 4; i++)
+		mac_[i] = low >> (8 * i);
+	mac_[4] = high;
+	mac_[5] = high >> 8;
+
+	char ms[3 * 6 + 1];
+	sprintf(ms, "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",
+			mac_[0], mac_[1], mac_[2],
+			mac_[3], mac_[4], mac_[5]);
+	std::cout << "intel-nic: Device has a hardware MAC: " << ms << std::endl;
+
+	// Bit 31 of RAH marks the address as valid.
+	if(!(high & (uint32_t{1} << 31)))
+		std::cout << "\e[33m" "intel-nic: Receive address is not marked valid" "\e[39m"
+				<< std::endl;
+}
+
+async::result<void> IntelNic::setupRxRing_(unsigned int index) {
+	auto ring = std::make_unique<RxRing>();
+	ring->regs = regs_.subspace(spec::rxRingOffset(isIgb(), index));
+	ring->descriptors = arch::dma_array<spec::RxDescriptor>{&dmaPool_, numRxDescriptors};
+	for(size_t i = 0; i < numRxDescriptors; i++) {
+		ring->buffers.push_back(arch::dma_buffer{&dmaPool_, bufferSize});
+		ring->physical.push_back(dma_core::physicalOf(ring->buffers.back().data()));
+		ring->descriptors[i].read.bufferAddress = ring->physical.back();
+		ring->descriptors[i].read.headerAddress = 0;
+	}
+
+	auto physical = dma_core::physicalOf(ring->descriptors.data());
+	ring->regs.store(spec::ring::baseLow, physical & 0xFFFFFFFF);
+	ring->regs.store(spec::ring::baseHigh, physical >> 32);
+	ring->regs.store(spec::ring::length, numRxDescriptors * sizeof(spec::RxDescriptor));
+	ring->regs.store(spec::ring::head, 0);
+	ring->regs.store(spec::ring::tail, 0);
+
+	if(isIgb()) {
+		ring->regs.store(spec::ring::srrctl, spec::srrctl::bufferSize2k
+				| spec::srrctl::advancedOneBuffer | spec::srrctl::dropEnable);
+		ring->regs.store(spec::ring::control, ring->regs.load(spec::ring::control)
+				| spec::ringControl::enable);
+		if(!co_await helix::kindaBusyWait(10'000'000, [&] {
+			return ring->regs.load(spec::ring::control) & spec::ringControl::enable;
+		}))
+			std::cout << "\e[31m" "intel-nic: Failed to enable RX queue " << index
+					<< "\e[39m" << std::endl;
+	}
+
+	rxRings_.push_back(std::move(ring));
+}
+
+async::result<void> IntelNic::setupTxRing_(unsigned int index) {
+	auto ring = std::make_unique<TxRing>();
+	ring->regs = regs_.subspace(spec::txRingOffset(isIgb(), index));
+	ring->descriptors = arch::dma_array<spec::TxDescriptor>{&dmaPool_, numTxDescriptors};
+	for(size_t i = 0; i < numTxDescriptors; i++) {
+		ring->buffers.push_back(arch::dma_buffer{&dmaPool_, bufferSize});
+		ring->physical.push_back(dma_core::physicalOf(ring->buffers.back().data()));
+		memset(&ring->descriptors[i], 0, sizeof(spec::TxDescriptor));
+	}
+
+	auto physical = dma_core::physicalOf(ring->descriptors.data());
+	ring->regs.store(spec::ring::baseLow, physical & 0xFFFFFFFF);
+	ring->regs.store(spec::ring::baseHigh, physical >> 32);
+	ring->regs.store(spec::ring::length, numTxDescriptors * sizeof(spec::TxDescriptor));
+	ring->regs.store(spec::ring::head, 0);
+	ring->regs.store(spec::ring::tail, 0);
+
+	if(isIgb()) {
+		ring->regs.store(spec::ring::control, ring->regs.load(spec::ring::control)
+				| spec::ringControl::enable);
+		if(!co_await helix::kindaBusyWait(10'000'000, [&] {
+			return ring->regs.load(spec::ring::control) & spec::ringControl::enable;
+		}))
+			std::cout << "\e[31m" "intel-nic: Failed to enable TX queue " << index
+					<< "\e[39m" << std::endl;
+	}
+
+	txRings_.push_back(std::move(ring));
+}
+
+// Distributes IPv4 and TCP/IPv4 flows over all receive queues. netserver steers TCP flows
+// to their shards in software, hence the hash only needs to spread the load evenly.
+void IntelNic::setupRss_() {
+	for(unsigned int i = 0; i < 10; i++)
+		regs_.store(spec::regs::at(spec::regs::rssrk, i),
+				rssKey[4 * i] | (rssKey[4 * i + 1] << 8)
+				| (rssKey[4 * i + 2] << 16) | (uint32_t{rssKey[4 * i + 3]} << 24));
+
+	// The redirection table has 128 one-byte entries. On the 82574, bit 7 selects the queue.
+	unsigned int shift = isIgb() ? 0 : 7;
+	for(unsigned int i = 0; i < 32; i++) {
+		uint32_t word = 0;
+		for(unsigned int j = 0; j < 4; j++)
+			word |= ((4 * i + j) % rxRings_.size()) << shift << (8 * j);
+		regs_.store(spec::regs::at(spec::regs::reta, i), word);
+	}
+
+	regs_.store(spec::regs::mrqc, (isIgb() ? spec::mrqc::enableRssIgb : spec::mrqc::enableRss82574)
+			| spec::mrqc::hashIpv4 | spec::mrqc::hashTcpIpv4);
+}
+
+void IntelNic::setupMsix_() {
+	unsigned int otherVector = rxRings_.size();
+
+	if(isIgb()) {
+		regs_.store(spec::regs::gpie, spec::gpie::nonSelectiveClear | spec::gpie::msixMode
+				| spec::gpie::pbaSupport);
+
+		// Each IVAR register holds the vectors of four causes (one byte each).
+		std::vector<uint32_t> ivars(8, 0);
+		auto assign = [&] (unsigned int queue, bool tx, unsigned int vector) {
+			unsigned int index, offset;
+			if(model_->family == Family::igb82576) {
+				index = queue & 7;
+				offset = (queue & 8) << 1;
+			}else{
+				index = queue >> 1;
+				offset = (queue & 1) << 4;
+			}
+			if(tx)
+				offset += 8;
+			ivars[index] |= (vector | spec::ivarValidIgb) << offset;
+		};
+		for(unsigned int i = 0; i < rxRings_.size(); i++)
+			assign(i, false, i);
+		for(unsigned int i = 0; i < txRings_.size(); i++)
+			assign(i, true, i);
+		for(unsigned int i = 0; i < ivars.size(); i++)
+			regs_.store(spec::regs::at(spec::regs::ivar, i), ivars[i]);
+		regs_.store(spec::regs::ivarMisc, (otherVector | spec::ivarValidIgb) << 8);
+
+		// Causes are cleared automatically; masking is done by the kernel until we
+		// acknowledge the MSI.
+		uint32_t vectors = (uint32_t{1} << (otherVector + 1)) - 1;
+		regs_.store(spec::regs::eiac, vectors);
+		regs_.store(spec::regs::eims, vectors);
+		regs_.store(spec::regs::ims, spec::irq::linkStatusChange);
+	}else{
+		// The 82574 has fixed causes for each queue: RxQ0, RxQ1, TxQ0, TxQ1, Other.
+		// Each one is assigned a vector in a four-bit field of IVAR.
+		uint32_t ivar = 0;
+		uint32_t causes = spec::irq::other;
+		for(unsigned int i = 0; i < rxRings_.size(); i++) {
+			ivar |= (i | spec::ivarValid82574) << (4 * i);
+			causes |= spec::irq::rxQueue0 << i;
+		}
+		for(unsigned int i = 0; i < txRings_.size(); i++) {
+			ivar |= (i | spec::ivarValid82574) << (8 + 4 * i);
+			causes |= spec::irq::txQueue0 << i;
+		}
+		ivar |= (otherVector | spec::ivarValid82574) << 16;
+		regs_.store(spec::regs::ivar82574, ivar);
+		regs_.store(spec::regs::ctrlExt, regs_.load(spec::regs::ctrlExt)
+				| spec::ctrlExt::pbaSupport);
+
+		regs_.store(spec::regs::eiac82574, causes);
+		regs_.store(spec::regs::ims, causes | spec::irq::linkStatusChange);
+	}
+
+	for(unsigned int i = 0; i < rxRings_.size(); i++)
+		setInterruptRate_(i);
+}
+
+// Interrupt moderation: the device delays interrupts such that each vector
+// fires at most interruptRate times per second.
+void IntelNic::setInterruptRate_(unsigned int vector) {
+	if(isIgb()) {
+		// The interval is in bits 14:2, in units of 0.25 us.
+		uint32_t interval = (4 * 1'000'000 / interruptRate) & 0x7FFC;
+		regs_.store(spec::regs::at(spec::regs::eitr, vector),
+				interval | spec::eitrCounterIgnore);
+	}else{
+		// The interval is in units of 256 ns.
+		uint32_t interval = 1'000'000'000 / (interruptRate * 256);
+		regs_.store(spec::regs::itr, interval);
+		if(msix_)
+			regs_.store(spec::regs::at(spec::regs::eitr82574, vector), interval);
+	}
+}
+
+void IntelNic::reportLink_() {
+	bool up = regs_.load(spec::regs::status) & spec::status::linkUp;
+	std::cout << "intel-nic: Link is " << (up ? "up" : "down") << std::endl;
+}
+
+size_t IntelNic::numQueues() {
+	return rxRings_.size();
+}
+
+void IntelNic::wakeQueue_(unsigned int queue) {
+	rxRings_[queue]->doorbell.raise();
+	if(queue < txRings_.size())
+		txRings_[queue]->doorbell.raise();
+}
+
+async::detached IntelNic::handleIrqs_(unsigned int vector) {
+	auto &irq = irqs_[vector];
+	uint64_t sequence = 0;
+
+	while(true) {
+		auto await = co_await helix_ng::awaitEvent(irq, sequence);
+		HEL_CHECK(await.error());
+		sequence = await.sequence();
+
+		if(!msix_) {
+			// ICR is cleared on read. The IRQ line may be shared with other devices.
+			auto causes = regs_.load(spec::regs::icr);
+			if(!causes) {
+				HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckNack, sequence));
+				continue;
+			}
+			if(causes & spec::irq::linkStatusChange)
+				reportLink_();
+			wakeQueue_(0);
+		}else if(vector == rxRings_.size()) {
+			auto causes = regs_.load(spec::regs::icr);
+			if(causes & spec::irq::linkStatusChange)
+				reportLink_();
+		}else{
+			// The receive and transmit paths check the descriptors themselves.
+			wakeQueue_(vector);
+		}
+
+		HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckAcknowledge, sequence));
+	}
+}
+
+void IntelNic::refillRx_(RxRing *ring) {
+	auto index = ring->next;
+	auto descriptor = &ring->descriptors[index];
+	descriptor->read.bufferAddress = ring->physical[index];
+	descriptor->read.headerAddress = 0;
+	ring->next = (index + 1) % numRxDescriptors;
+
+	// The device may use all descriptors up to (but excluding) the tail.
+	if(++ring->pendingRefill == rxRefillBatch) {
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		ring->regs.store(spec::ring::tail, index);
+		ring->pendingRefill = 0;
+	}
+}
+
+async::result<nic::RxInfo> IntelNic::receive(arch::dma_buffer_view frame, size_t queue) {
+	auto ring = rxRings_[queue].get();
+
+	while(true) {
+		auto descriptor = &ring->descriptors[ring->next];
+		uint32_t statusError;
+		while(!((statusError = __atomic_load_n(&descriptor->writeback.statusError,
+				__ATOMIC_ACQUIRE)) & spec::rxStatus::done))
+			co_await ring->doorbell.async_wait();
+
+		// Since jumbo frames are not enabled, frames always fit into a single buffer.
+		if(!(statusError & spec::rxStatus::endOfPacket)
+				|| (statusError & spec::rxStatus::frameErrors)) {
+			MLOG_DEBUG(frameLog, "Dropping erroneous frame on queue {}", queue);
+			refillRx_(ring);
+			continue;
+		}
+
+		nic::RxInfo info;
+		info.length = std::min(size_t{descriptor->writeback.length}, frame.size());
+		memcpy(frame.data(), ring->buffers[ring->next].data(), info.length);
+		info.checksumValid = !(statusError & spec::rxStatus::ignoreChecksum)
+				&& (statusError & (spec::rxStatus::tcpChecksum | spec::rxStatus::udpChecksum))
+				&& !(statusError & spec::rxStatus::tcpUdpChecksumError);
+		refillRx_(ring);
+
+		MLOG_DEBUG(frameLog, "Received {} byte frame on queue {}", info.length, queue);
+		co_return info;
+	}
+}
+
+void IntelNic::reclaimTx_(TxRing *ring) {
+	while(ring->inFlight) {
+		auto descriptor = &ring->descriptors[ring->clean];
+		if(!(__atomic_load_n(&descriptor->status, __ATOMIC_ACQUIRE) & spec::txStatus::done))
+			break;
+		ring->clean = (ring->clean + 1) % numTxDescriptors;
+		ring->inFlight--;
+	}
+}
+
+async::result<void> IntelNic::send(const arch::dma_buffer_view payload, size_t queue) {
+	co_await sendOffloaded(payload, {}, queue);
+}
+
+async::result<void> IntelNic::sendOffloaded(const arch::dma_buffer_view payload,
+		nic::TxOffload offload, size_t queue) {
+	assert(!offload.gsoSize && "link does not support segmentation offload");
+	if(payload.size() > maxFrameSize)
+		throw std::runtime_error("data exceeds mtu");
+
+	// Legacy descriptors can only insert checksums within the first 256 bytes.
+	if(offload.needsChecksum && offload.csumStart + offload.csumOffset > 0xFF) {
+		co_await nic::Link::sendOffloaded(payload, offload, queue);
+		co_return;
+	}
+
+	// The 82574 has fewer transmit queues than receive queues.
+	auto ring = txRings_[queue % txRings_.size()].get();
+	reclaimTx_(ring);
+	while(ring->inFlight == numTxDescriptors - 1) {
+		co_await ring->doorbell.async_wait();
+		reclaimTx_(ring);
+	}
+
+	auto index = ring->tail;
+	memcpy(ring->buffers[index].data(), payload.data(), payload.size());
+
+	auto descriptor = &ring->descriptors[index];
+	memset(descriptor, 0, sizeof(spec::TxDescriptor));
+	descriptor->bufferAddress = ring->physical[index];
+	descriptor->length = payload.size();
+	descriptor->command = spec::txCommand::endOfPacket | spec::txCommand::insertFcs
+			| spec::txCommand::reportStatus;
+	if(offload.needsChecksum) {
+		// The device sums up everything from checksumStart to the end of the frame,
+		// including the pseudo header sum in the checksum field.
+		descriptor->command |= spec::txCommand::insertChecksum;
+		descriptor->checksumStart = offload.csumStart;
+		descriptor->checksumOffset = offload.csumStart + offload.csumOffset;
+	}
+
+	ring->tail = (index + 1) % numTxDescriptors;
+	ring->inFlight++;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	ring->regs.store(spec::ring::tail, ring->tail);
+
+	MLOG_DEBUG(frameLog, "Sending {} byte frame on queue {}", payload.size(), queue);
+}
+
+} // namespace
+
+namespace nic::intel {
+
+bool supportsDevice(uint16_t deviceId) {
+	return findModel(deviceId);
+}
+
+async::result<std::shared_ptr<nic::Link>> makeShared(protocols::hw::Device device,
+		uint16_t deviceId, size_t wantedQueues) {
+	auto model = findModel(deviceId);
+	assert(model);
+
+	auto info = co_await device.getPciInfo();
+	auto &barInfo = info.barInfo[0];
+	assert(barInfo.ioType == protocols::hw::IoType::kIoTypeMemory);
+	auto bar = co_await device.accessBar(0);
+	helix::Mapping mapping{bar, barInfo.offset, barInfo.length};
+	co_await device.enableBusmaster();
+
+	auto nic = std::make_shared<IntelNic>(std::move(device), model,
+			std::move(bar), std::move(mapping));
+	co_await nic->initialize(wantedQueues, info.numMsis);
+	co_return nic;
+}
+
+} // namespace nic::intel
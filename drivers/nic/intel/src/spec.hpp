@@ -0,0 +1,224 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <arch/mem_space.hpp>
+
+// Registers and descriptors of the Intel 82574 (e1000e) and of the igb family
+// (82576, I350, I210, I211). Unless noted otherwise, definitions apply to both.
+namespace spec {
+
+namespace regs {
+	constexpr arch::scalar_register<uint32_t> ctrl{0x0000};
+	constexpr arch::scalar_register<uint32_t> status{0x0008};
+	constexpr arch::scalar_register<uint32_t> eecd{0x0010};
+	constexpr arch::scalar_register<uint32_t> ctrlExt{0x0018};
+	constexpr arch::scalar_register<uint32_t> icr{0x00C0};
+	constexpr arch::scalar_register<uint32_t> itr{0x00C4};
+	constexpr arch::scalar_register<uint32_t> ims{0x00D0};
+	constexpr arch::scalar_register<uint32_t> imc{0x00D8};
+	constexpr arch::scalar_register<uint32_t> rctl{0x0100};
+	constexpr arch::scalar_register<uint32_t> tctl{0x0400};
+	constexpr arch::scalar_register<uint32_t> tipg{0x0410};
+	constexpr arch::scalar_register<uint32_t> rxcsum{0x5000};
+	constexpr arch::scalar_register<uint32_t> rfctl{0x5008};
+	constexpr arch::scalar_register<uint32_t> ral0{0x5400};
+	constexpr arch::scalar_register<uint32_t> rah0{0x5404};
+	constexpr arch::scalar_register<uint32_t> mrqc{0x5818};
+
+	// Arrays of 32-bit registers.
+	constexpr ptrdiff_t mta = 0x5200; // 128 entries.
+	constexpr ptrdiff_t reta = 0x5C00; // 32 entries.
+	constexpr ptrdiff_t rssrk = 0x5C80; // 10 entries.
+
+	// 82574 only.
+	constexpr arch::scalar_register<uint32_t> eiac82574{0x00DC};
+	constexpr arch::scalar_register<uint32_t> ivar82574{0x00E4};
+	constexpr ptrdiff_t eitr82574 = 0x00E8; // One entry per MSI-X vector.
+
+	// igb only.
+	constexpr arch::scalar_register<uint32_t> gpie{0x1514};
+	constexpr arch::scalar_register<uint32_t> eims{0x1524};
+	constexpr arch::scalar_register<uint32_t> eimc{0x1528};
+	constexpr arch::scalar_register<uint32_t> eiac{0x152C};
+	constexpr ptrdiff_t eitr = 0x1680; // One entry per MSI-X vector.
+	constexpr ptrdiff_t ivar = 0x1700;
+	constexpr arch::scalar_register<uint32_t> ivarMisc{0x1740};
+
+	inline arch::scalar_register<uint32_t> at(ptrdiff_t array, unsigned int index) {
+		return arch::scalar_register<uint32_t>{array + 4 * static_cast<ptrdiff_t>(index)};
+	}
+} // namespace regs
+
+// Both families use the same layout for the registers of each descriptor ring;
+// only the location of the rings differs, see rxRingOffset() and txRingOffset().
+namespace ring {
+	constexpr arch::scalar_register<uint32_t> baseLow{0x00};
+	constexpr arch::scalar_register<uint32_t> baseHigh{0x04};
+	constexpr arch::scalar_register<uint32_t> length{0x08};
+	constexpr arch::scalar_register<uint32_t> srrctl{0x0C}; // igb receive rings only.
+	constexpr arch::scalar_register<uint32_t> head{0x10};
+	constexpr arch::scalar_register<uint32_t> tail{0x18};
+	constexpr arch::scalar_register<uint32_t> control{0x28};
+} // namespace ring
+
+inline ptrdiff_t rxRingOffset(bool igb, unsigned int index) {
+	return igb ? 0xC000 + 0x40 * index : 0x2800 + 0x100 * index;
+}
+
+inline ptrdiff_t txRingOffset(bool igb, unsigned int index) {
+	return igb ? 0xE000 + 0x40 * index : 0x3800 + 0x100 * index;
+}
+
+namespace ctrl {
+	constexpr uint32_t gioMasterDisable = 1 << 2;
+	constexpr uint32_t linkReset = 1 << 3;
+	constexpr uint32_t autoSpeedDetect = 1 << 5;
+	constexpr uint32_t setLinkUp = 1 << 6;
+	constexpr uint32_t reset = 1 << 26;
+	constexpr uint32_t phyReset = uint32_t{1} << 31;
+} // namespace ctrl
+
+namespace status {
+	constexpr uint32_t linkUp = 1 << 1;
+	constexpr uint32_t gioMasterEnable = 1 << 19;
+} // namespace status
+
+namespace eecd {
+	constexpr uint32_t autoReadDone = 1 << 9;
+} // namespace eecd
+
+namespace ctrlExt {
+	// 82574: required in MSI-X mode.
+	constexpr uint32_t pbaSupport = uint32_t{1} << 31;
+} // namespace ctrlExt
+
+// Causes in ICR, IMS and IMC.
+namespace irq {
+	constexpr uint32_t txDescWritten = 1 << 0;
+	constexpr uint32_t linkStatusChange = 1 << 2;
+	constexpr uint32_t rxDescMinThreshold = 1 << 4;
+	constexpr uint32_t rxOverrun = 1 << 6;
+	constexpr uint32_t rxTimer = 1 << 7;
+
+	// 82574 in MSI-X mode.
+	constexpr uint32_t rxQueue0 = 1 << 20;
+	constexpr uint32_t txQueue0 = 1 << 22;
+	constexpr uint32_t other = 1 << 24;
+} // namespace irq
+
+namespace rctl {
+	constexpr uint32_t enable = 1 << 1;
+	constexpr uint32_t broadcastAccept = 1 << 15;
+	// Buffer size of 2048 bytes is encoded as zero.
+	constexpr uint32_t stripCrc = 1 << 26;
+} // namespace rctl
+
+namespace tctl {
+	constexpr uint32_t enable = 1 << 1;
+	constexpr uint32_t padShortPackets = 1 << 3;
+	constexpr uint32_t collisionThreshold = 0xF << 4;
+	constexpr uint32_t collisionDistance = 0x3F << 12;
+	constexpr uint32_t retransmitOnLateCollision = 1 << 24;
+} // namespace tctl
+
+// Default inter-packet gap for copper links (82574 only).
+constexpr uint32_t tipgCopper = 8 | (8 << 10) | (6 << 20);
+
+namespace rxcsum {
+	constexpr uint32_t ipOffload = 1 << 8;
+	constexpr uint32_t tcpUdpOffload = 1 << 9;
+	// Report the RSS hash instead of the fragment checksum; required for RSS.
+	constexpr uint32_t disablePacketChecksum = 1 << 13;
+} // namespace rxcsum
+
+namespace rfctl {
+	// 82574: use extended receive descriptors.
+	constexpr uint32_t extendedStatus = 1 << 15;
+} // namespace rfctl
+
+namespace mrqc {
+	constexpr uint32_t enableRss82574 = 1;
+	constexpr uint32_t enableRssIgb = 2;
+	constexpr uint32_t hashTcpIpv4 = 1 << 16;
+	constexpr uint32_t hashIpv4 = 1 << 17;
+} // namespace mrqc
+
+namespace srrctl {
+	constexpr uint32_t bufferSize2k = 2; // In units of 1 KiB.
+	constexpr uint32_t advancedOneBuffer = 1 << 25;
+	// Drop frames if the ring is full instead of stalling the other rings.
+	constexpr uint32_t dropEnable = uint32_t{1} << 31;
+} // namespace srrctl
+
+namespace ringControl {
+	// igb: enables a ring. Rings of the 82574 are always enabled.
+	constexpr uint32_t enable = 1 << 25;
+} // namespace ringControl
+
+namespace gpie {
+	constexpr uint32_t nonSelectiveClear = 1 << 0;
+	constexpr uint32_t msixMode = 1 << 4;
+	constexpr uint32_t pbaSupport = uint32_t{1} << 31;
+} // namespace gpie
+
+// igb: EITR ignores the rate counter on writes (all models except the 82575).
+constexpr uint32_t eitrCounterIgnore = uint32_t{1} << 31;
+
+constexpr uint32_t ivarValidIgb = 0x80;
+constexpr uint32_t ivarValid82574 = 0x8;
+
+// The extended receive descriptor of the 82574 and the advanced one-buffer receive
+// descriptor of igb have the same layout. The device overwrites the read format
+// with the write-back format once it has stored the frame.
+union RxDescriptor {
+	struct {
+		uint64_t bufferAddress;
+		uint64_t headerAddress; // Clears the DD bit; no header split.
+	} read;
+	struct {
+		uint32_t info;
+		uint32_t rssHash;
+		uint32_t statusError;
+		uint16_t length;
+		uint16_t vlan;
+	} writeback;
+};
+static_assert(sizeof(RxDescriptor) == 16);
+
+namespace rxStatus {
+	constexpr uint32_t done = 1 << 0;
+	constexpr uint32_t endOfPacket = 1 << 1;
+	constexpr uint32_t ignoreChecksum = 1 << 2;
+	constexpr uint32_t udpChecksum = 1 << 4;
+	constexpr uint32_t tcpChecksum = 1 << 5;
+
+	constexpr uint32_t tcpUdpChecksumError = 1 << 29;
+	// CRC, symbol, sequence, carrier extension and RX data errors.
+	constexpr uint32_t frameErrors = 0x97000000;
+} // namespace rxStatus
+
+// Both families support legacy transmit descriptors, including checksum insertion.
+struct TxDescriptor {
+	uint64_t bufferAddress;
+	uint16_t length;
+	uint8_t checksumOffset;
+	uint8_t command;
+	uint8_t status;
+	uint8_t checksumStart;
+	uint16_t special;
+};
+static_assert(sizeof(TxDescriptor) == 16);
+
+namespace txCommand {
+	constexpr uint8_t endOfPacket = 1 << 0;
+	constexpr uint8_t insertFcs = 1 << 1;
+	constexpr uint8_t insertChecksum = 1 << 2;
+	constexpr uint8_t reportStatus = 1 << 3;
+} // namespace txCommand
+
+namespace txStatus {
+	constexpr uint8_t done = 1 << 0;
+} // namespace txStatus
+
+} // namespace spec
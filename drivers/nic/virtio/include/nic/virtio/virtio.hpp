@@ -4,5 +4,7 @@
 #include <core/virtio/core.hpp>
 
 namespace nic::virtio {
-std::shared_ptr<nic::Link> makeShared(std::unique_ptr<virtio_core::Transport>);
+// Uses up to wantedQueuePairs RX/TX queue pairs if the device supports VIRTIO_NET_F_MQ.
+std::shared_ptr<nic::Link> makeShared(std::unique_ptr<virtio_core::Transport>,
+	size_t wantedQueuePairs = 1);
 } // namespace nic::virtio
@@ -1,18 +1,55 @@
 #include <nic/virtio/virtio.hpp>
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <vector>
+
 #include <arch/dma_pool.hpp>
+#include <async/oneshot-event.hpp>
+#include <async/recurring-event.hpp>
+#include <core/dma/slab-pool.hpp>
 #include <core/virtio/core.hpp>
+#include <protocols/logging/logging.hpp>
 
 namespace {
+
+// Enable with MANAGARM_LOG=virtio-driver.frames=debug.
+protocols::logging::Subsystem frameLog{"virtio-driver.frames"};
+
 // Device feature bits.
 constexpr size_t legacyHeaderSize = 10;
 enum {
-	VIRTIO_NET_F_MAC = 5
+	VIRTIO_NET_F_CSUM = 0,
+	VIRTIO_NET_F_GUEST_CSUM = 1,
+	VIRTIO_NET_F_MAC = 5,
+	VIRTIO_NET_F_HOST_TSO4 = 11,
+	VIRTIO_NET_F_MRG_RXBUF = 15,
+	VIRTIO_NET_F_CTRL_VQ = 17,
+	VIRTIO_NET_F_MQ = 22
 };
 
+// Offsets into the device configuration space.
+constexpr size_t configMaxVirtqueuePairs = 8;
+
+// Classes and commands on the control virtq.
+enum {
+	VIRTIO_NET_CTRL_MQ = 4
+};
+
+enum {
+	VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET = 0
+};
+
+constexpr uint8_t VIRTIO_NET_OK = 0;
+
 // Bits for VirtHeader::flags.
 enum {
-	VIRTIO_NET_HDR_F_NEEDS_CSUM = 1
+	VIRTIO_NET_HDR_F_NEEDS_CSUM = 1,
+	VIRTIO_NET_HDR_F_DATA_VALID = 2
 };
 
 // Values for VirtHeader::gsoType.
@@ -34,21 +71,92 @@ struct VirtHeader {
 	uint16_t numBuffers;
 };
 
+struct ControlHeader {
+	uint8_t cls;
+	uint8_t command;
+};
+
+// Size of each receive and transmit buffer, including the VirtHeader.
+constexpr size_t bufferSize = 2048;
+constexpr size_t maxFrameSize = 1514;
+
+struct VirtioNic;
+struct QueuePair;
+
+// A receive buffer that is (usually) posted to the receive virtq.
+struct RxBuffer : virtio_core::Request {
+	QueuePair *pair;
+	arch::dma_buffer buffer;
+};
+
+// A transmit buffer; frames are copied into it so that send() does not need
+// to wait until the device is done with the frame.
+struct TxBuffer : virtio_core::Request {
+	QueuePair *pair;
+	arch::dma_buffer buffer;
+	// Set if the frame does not fit into the buffer and is transmitted in-place.
+	async::oneshot_event *done = nullptr;
+};
+
+// A receive virtq and a transmit virtq, together with their buffers.
+// With VIRTIO_NET_F_MQ, the device has multiple pairs; it steers received frames
+// to the pair that the flow was last transmitted on.
+struct QueuePair {
+	async::result<void> postRxBuffer(RxBuffer *rx);
+	void kickTx();
+
+	VirtioNic *nic;
+	virtio_core::Queue *receiveVq;
+	virtio_core::Queue *transmitVq;
+
+	std::vector<std::unique_ptr<RxBuffer>> rxBuffers;
+	// Buffers that were filled by the device but not consumed by receive() yet.
+	std::deque<RxBuffer *> rxReady;
+	async::recurring_event rxDoorbell;
+
+	std::vector<std::unique_ptr<TxBuffer>> txBuffers;
+	std::vector<TxBuffer *> txFree;
+	async::recurring_event txDoorbell;
+	// Number of frames that the device was notified about but did not complete yet.
+	size_t txKicked = 0;
+	// Number of frames that were posted but not kicked yet.
+	size_t txPosted = 0;
+};
+
 struct VirtioNic : nic::Link {
-	VirtioNic(std::unique_ptr<virtio_core::Transport> transport);
+	VirtioNic(std::unique_ptr<virtio_core::Transport> transport, size_t wantedQueuePairs);
 
-	virtual async::result<void> receive(arch::dma_buffer_view) override;
-	virtual async::result<void> send(const arch::dma_buffer_view) override;
+	virtual size_t numQueues() override;
+	virtual async::result<nic::RxInfo> receive(arch::dma_buffer_view, size_t queue) override;
+	virtual async::result<void> send(const arch::dma_buffer_view, size_t queue) override;
+	virtual async::result<void> sendOffloaded(const arch::dma_buffer_view,
+			nic::TxOffload, size_t queue) override;
 
 	virtual ~VirtioNic() override = default;
 private:
+	friend struct QueuePair;
+
+	async::detached postInitialRxBuffers_();
+	async::detached enableQueuePairs_();
+	async::result<bool> sendControl_(uint8_t cls, uint8_t command,
+			const void *data, size_t size);
+
 	std::unique_ptr<virtio_core::Transport> transport_;
-	arch::contiguous_pool dmaPool_;
-	virtio_core::Queue *receiveVq_;
-	virtio_core::Queue *transmitVq_;
+	dma_core::SlabPool dmaPool_;
+	virtio_core::Queue *controlVq_ = nullptr;
+
+	// Whether VIRTIO_NET_F_MRG_RXBUF was negotiated.
+	bool mergeRxBuffers_ = false;
+	size_t headerSize_ = legacyHeaderSize;
+
+	std::vector<std::unique_ptr<QueuePair>> pairs_;
+	// Number of pairs that the device currently uses; it starts with one pair.
+	// Frames for inactive transmit virtqs are sent on the first pair instead.
+	size_t activePairs_ = 1;
 };
 
-VirtioNic::VirtioNic(std::unique_ptr<virtio_core::Transport> transport)
+VirtioNic::VirtioNic(std::unique_ptr<virtio_core::Transport> transport,
+		size_t wantedQueuePairs)
 	: nic::Link(1500, &dmaPool_), transport_ { std::move(transport) }
 {
 	if(transport_->checkDeviceFeature(VIRTIO_NET_F_MAC)) {
@@ -64,55 +172,315 @@ VirtioNic::VirtioNic(std::unique_ptr<virtio_core::Transport> transport)
 		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_MAC);
 	}
 
+	if(transport_->checkDeviceFeature(VIRTIO_NET_F_CSUM)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_CSUM);
+		features |= nic::features::txChecksum;
+
+		// TSO requires checksum offload.
+		if(transport_->checkDeviceFeature(VIRTIO_NET_F_HOST_TSO4)) {
+			transport_->acknowledgeDriverFeature(VIRTIO_NET_F_HOST_TSO4);
+			features |= nic::features::tso4;
+		}
+	}
+
+	if(transport_->checkDeviceFeature(VIRTIO_NET_F_GUEST_CSUM)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_GUEST_CSUM);
+		features |= nic::features::rxChecksum;
+	}
+
+	if(transport_->checkDeviceFeature(VIRTIO_NET_F_MRG_RXBUF)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_MRG_RXBUF);
+		mergeRxBuffers_ = true;
+		headerSize_ = sizeof(VirtHeader);
+	}
+
+	// Multiple queue pairs are enabled through the control virtq.
+	size_t numPairs = 1;
+	size_t maxPairs = 1;
+	if(wantedQueuePairs > 1
+			&& transport_->checkDeviceFeature(VIRTIO_NET_F_CTRL_VQ)
+			&& transport_->checkDeviceFeature(VIRTIO_NET_F_MQ)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_CTRL_VQ);
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_MQ);
+		maxPairs = std::max(transport_->loadConfig16(configMaxVirtqueuePairs), uint16_t{1});
+		numPairs = std::min(maxPairs, wantedQueuePairs);
+		std::cout << "virtio-driver: Using " << numPairs << " of " << maxPairs
+				<< " queue pairs" << std::endl;
+	}
+
 	transport_->finalizeFeatures();
-	transport_->claimQueues(2);
-	receiveVq_ = transport_->setupQueue(0);
-	transmitVq_ = transport_->setupQueue(1);
+
+	// The control virtq follows the last possible queue pair.
+	if(numPairs > 1) {
+		transport_->claimQueues(2 * maxPairs + 1);
+	}else{
+		transport_->claimQueues(2);
+	}
+	for(size_t i = 0; i < numPairs; i++) {
+		auto pair = std::make_unique<QueuePair>();
+		pair->nic = this;
+		pair->receiveVq = transport_->setupQueue(2 * i);
+		pair->transmitVq = transport_->setupQueue(2 * i + 1);
+		pairs_.push_back(std::move(pair));
+	}
+	if(numPairs > 1)
+		controlVq_ = transport_->setupQueue(2 * maxPairs);
+
+	for(auto &pair : pairs_) {
+		// With mergeable buffers, each receive buffer is a single descriptor;
+		// otherwise, the header and the frame use separate descriptors.
+		auto numRx = pair->receiveVq->numDescriptors();
+		if(!mergeRxBuffers_)
+			numRx /= 2;
+		for(size_t i = 0; i < numRx; i++) {
+			auto rx = std::make_unique<RxBuffer>();
+			rx->pair = pair.get();
+			rx->buffer = arch::dma_buffer{&dmaPool_, bufferSize};
+			pair->rxBuffers.push_back(std::move(rx));
+		}
+
+		// Each frame uses two descriptors (header and frame).
+		auto numTx = pair->transmitVq->numDescriptors() / 2;
+		for(size_t i = 0; i < numTx; i++) {
+			auto tx = std::make_unique<TxBuffer>();
+			tx->pair = pair.get();
+			tx->buffer = arch::dma_buffer{&dmaPool_, bufferSize};
+			pair->txFree.push_back(tx.get());
+			pair->txBuffers.push_back(std::move(tx));
+		}
+	}
 
 	transport_->runDevice();
+
+	postInitialRxBuffers_();
+	if(numPairs > 1)
+		enableQueuePairs_();
+}
+
+size_t VirtioNic::numQueues() {
+	return pairs_.size();
+}
+
+async::result<void> QueuePair::postRxBuffer(RxBuffer *rx) {
+	virtio_core::Chain chain;
+	if(nic->mergeRxBuffers_) {
+		chain.append(co_await receiveVq->obtainDescriptor());
+		chain.setupBuffer(virtio_core::deviceToHost, rx->buffer);
+	}else{
+		chain.append(co_await receiveVq->obtainDescriptor());
+		chain.setupBuffer(virtio_core::deviceToHost,
+				rx->buffer.subview(0, nic->headerSize_));
+		chain.append(co_await receiveVq->obtainDescriptor());
+		chain.setupBuffer(virtio_core::deviceToHost,
+				rx->buffer.subview(nic->headerSize_, maxFrameSize));
+	}
+
+	receiveVq->postDescriptor(chain.front(), rx,
+			[] (virtio_core::Request *base_request) {
+		auto rx = static_cast<RxBuffer *>(base_request);
+		rx->pair->rxReady.push_back(rx);
+		rx->pair->rxDoorbell.raise();
+	});
+}
+
+async::detached VirtioNic::postInitialRxBuffers_() {
+	for(auto &pair : pairs_) {
+		for(auto &rx : pair->rxBuffers)
+			co_await pair->postRxBuffer(rx.get());
+		pair->receiveVq->notify();
+	}
 }
 
-async::result<void> VirtioNic::receive(arch::dma_buffer_view frame) {
-	arch::dma_object<VirtHeader> header { &dmaPool_ };
+async::result<bool> VirtioNic::sendControl_(uint8_t cls, uint8_t command,
+		const void *data, size_t size) {
+	struct ControlRequest : virtio_core::Request {
+		async::oneshot_event done;
+	};
+
+	// The header, the command-specific data and the ack are separate descriptors.
+	arch::dma_buffer buffer{&dmaPool_, sizeof(ControlHeader) + size + 1};
+	auto p = reinterpret_cast<uint8_t *>(buffer.data());
+	ControlHeader header{cls, command};
+	memcpy(p, &header, sizeof(ControlHeader));
+	memcpy(p + sizeof(ControlHeader), data, size);
+	p[sizeof(ControlHeader) + size] = 0xFF;
 
 	virtio_core::Chain chain;
-	chain.append(co_await receiveVq_->obtainDescriptor());
-	chain.setupBuffer(virtio_core::deviceToHost,
-			header.view_buffer().subview(0, legacyHeaderSize));
-	chain.append(co_await receiveVq_->obtainDescriptor());
-	chain.setupBuffer(virtio_core::deviceToHost, frame);
+	chain.append(co_await controlVq_->obtainDescriptor());
+	chain.setupBuffer(virtio_core::hostToDevice, buffer.subview(0, sizeof(ControlHeader)));
+	chain.append(co_await controlVq_->obtainDescriptor());
+	chain.setupBuffer(virtio_core::hostToDevice, buffer.subview(sizeof(ControlHeader), size));
+	chain.append(co_await controlVq_->obtainDescriptor());
+	chain.setupBuffer(virtio_core::deviceToHost, buffer.subview(sizeof(ControlHeader) + size, 1));
 
-	co_await receiveVq_->submitDescriptor(chain.front());
+	ControlRequest request;
+	controlVq_->postDescriptor(chain.front(), &request,
+			[] (virtio_core::Request *base_request) {
+		static_cast<ControlRequest *>(base_request)->done.raise();
+	});
+	controlVq_->notify();
+	co_await request.done.wait();
 
-	co_return;
+	co_return p[sizeof(ControlHeader) + size] == VIRTIO_NET_OK;
+}
+
+async::detached VirtioNic::enableQueuePairs_() {
+	uint16_t numPairs = pairs_.size();
+	if(!co_await sendControl_(VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET,
+			&numPairs, sizeof(numPairs))) {
+		std::cout << "\e[31m" "virtio-driver: Failed to enable multiple queue pairs"
+				"\e[39m" << std::endl;
+		co_return;
+	}
+	activePairs_ = numPairs;
 }
 
-async::result<void> VirtioNic::send(const arch::dma_buffer_view payload) {
-	if (payload.size() > 1514) {
+async::result<nic::RxInfo> VirtioNic::receive(arch::dma_buffer_view frame, size_t queue) {
+	auto pair = pairs_[queue].get();
+	while(pair->rxReady.empty())
+		co_await pair->rxDoorbell.async_wait();
+
+	auto rx = pair->rxReady.front();
+	pair->rxReady.pop_front();
+
+	auto header = reinterpret_cast<VirtHeader *>(rx->buffer.data());
+	size_t numBuffers = 1;
+	if(mergeRxBuffers_) {
+		numBuffers = header->numBuffers;
+		assert(numBuffers >= 1);
+	}
+
+	// With GUEST_CSUM, the device either validated the checksum or the frame
+	// originated on the host and was never checksummed in the first place.
+	nic::RxInfo info;
+	if(features & nic::features::rxChecksum)
+		info.checksumValid = header->flags
+				& (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM);
+
+	// Copy the frame out of the (possibly multiple) receive buffers.
+	// The first buffer contains the header; the following ones only contain data.
+	size_t progress = 0;
+	for(size_t i = 0; i < numBuffers; i++) {
+		if(i) {
+			while(pair->rxReady.empty())
+				co_await pair->rxDoorbell.async_wait();
+			rx = pair->rxReady.front();
+			pair->rxReady.pop_front();
+		}
+
+		size_t offset = i ? 0 : headerSize_;
+		size_t length = rx->bytesWritten > offset ? rx->bytesWritten - offset : 0;
+		auto chunk = std::min(length, frame.size() - progress);
+		memcpy(reinterpret_cast<char *>(frame.data()) + progress,
+				reinterpret_cast<char *>(rx->buffer.data()) + offset, chunk);
+		progress += chunk;
+
+		co_await pair->postRxBuffer(rx);
+	}
+	pair->receiveVq->notify();
+	info.length = progress;
+
+	MLOG_DEBUG(frameLog, "Received {} byte frame on queue {}", progress, queue);
+	co_return info;
+}
+
+// Frames that are posted while the device still processes earlier frames
+// are only kicked once these complete; this batches multiple frames per notification.
+void QueuePair::kickTx() {
+	assert(!txKicked);
+	txKicked = std::exchange(txPosted, 0);
+	if(txKicked)
+		transmitVq->notify();
+}
+
+async::result<void> VirtioNic::send(const arch::dma_buffer_view payload, size_t queue) {
+	co_await sendOffloaded(payload, {}, queue);
+}
+
+async::result<void> VirtioNic::sendOffloaded(const arch::dma_buffer_view payload,
+		nic::TxOffload offload, size_t queue) {
+	if (offload.gsoSize) {
+		assert(features & nic::features::tso4);
+		if (payload.size() > 0xFFFF + 14)
+			throw std::runtime_error("super-segment exceeds maximum IP packet size");
+	} else if (payload.size() > maxFrameSize) {
 		throw std::runtime_error("data exceeds mtu");
 	}
 
-	arch::dma_object<VirtHeader> header { &dmaPool_ };
-	memset(header.data(), 0, sizeof(VirtHeader));
+	auto pair = pairs_[queue < activePairs_ ? queue : 0].get();
+	while(pair->txFree.empty())
+		co_await pair->txDoorbell.async_wait();
+	auto tx = pair->txFree.back();
+	pair->txFree.pop_back();
 
+	auto header = reinterpret_cast<VirtHeader *>(tx->buffer.data());
+	memset(header, 0, headerSize_);
+	if(offload.needsChecksum) {
+		assert(features & nic::features::txChecksum);
+		header->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+		header->csumStart = offload.csumStart;
+		header->csumOffset = offload.csumOffset;
+	}
+	if(offload.gsoSize) {
+		header->gsoType = VIRTIO_NET_HDR_GSO_TCPV4;
+		header->gsoSize = offload.gsoSize;
+		header->hdrLen = offload.headerLength;
+	}
+
+	// Small frames are copied so that we do not need to wait for the device.
+	// Larger frames (i.e., super-segments) are transmitted in-place.
+	bool inPlace = payload.size() > bufferSize - headerSize_;
+
+	auto transmitVq = pair->transmitVq;
 	virtio_core::Chain chain;
-	chain.append(co_await transmitVq_->obtainDescriptor());
+	chain.append(co_await transmitVq->obtainDescriptor());
 	chain.setupBuffer(virtio_core::hostToDevice,
-			header.view_buffer().subview(0, legacyHeaderSize));
-	chain.append(co_await transmitVq_->obtainDescriptor());
-	chain.setupBuffer(virtio_core::hostToDevice, payload);
+			tx->buffer.subview(0, headerSize_));
+	if(inPlace) {
+		co_await virtio_core::scatterGather(virtio_core::hostToDevice, chain,
+				transmitVq, payload);
+	}else{
+		memcpy(reinterpret_cast<char *>(tx->buffer.data()) + headerSize_,
+				payload.data(), payload.size());
+		chain.append(co_await transmitVq->obtainDescriptor());
+		chain.setupBuffer(virtio_core::hostToDevice,
+				tx->buffer.subview(headerSize_, payload.size()));
+	}
 
-	std::cout << "virtio-driver: sending frame" << std::endl;
-	co_await transmitVq_->submitDescriptor(chain.front());
-	std::cout << "virtio-driver: sent frame" << std::endl;
+	MLOG_DEBUG(frameLog, "Sending {} byte frame", payload.size());
+
+	async::oneshot_event done;
+	if(inPlace)
+		tx->done = &done;
+
+	transmitVq->postDescriptor(chain.front(), tx,
+			[] (virtio_core::Request *base_request) {
+		auto tx = static_cast<TxBuffer *>(base_request);
+		auto pair = tx->pair;
+		if(tx->done)
+			std::exchange(tx->done, nullptr)->raise();
+		pair->txFree.push_back(tx);
+		pair->txDoorbell.raise();
+
+		assert(pair->txKicked);
+		if(!--pair->txKicked)
+			pair->kickTx();
+	});
+	pair->txPosted++;
+	if(!pair->txKicked)
+		pair->kickTx();
+
+	if(inPlace)
+		co_await done.wait();
 }
+
 } // namespace
 
 namespace nic::virtio {
 
 std::shared_ptr<nic::Link> makeShared(
-		std::unique_ptr<virtio_core::Transport> transport) {
-	return std::make_shared<VirtioNic>(std::move(transport));
+		std::unique_ptr<virtio_core::Transport> transport, size_t wantedQueuePairs) {
+	return std::make_shared<VirtioNic>(std::move(transport), wantedQueuePairs);
 }
 
 } // namespace nic::virtio
@@ -4,23 +4,32 @@
 #include <libevbackend.hpp>
 
 // -----------------------------------------------------
-// Fields.
+// Extractors.
 // -----------------------------------------------------
 
-enum class FieldType {
+enum class ExtractorType {
 	null,
-	padding,
 	variable,
 	array
 };
 
-struct Field {
-	FieldType type;
-	int bitSize;
-	int dataMin;
-	int dataMax;
+// Extracts a single field of an input report. Extractors are compiled from the
+// report descriptor once, so that reports can be decoded without re-interpreting
+// the descriptor. Padding does not produce extractors.
+struct Extractor {
+	ExtractorType type;
+	// Position of the (first) value in the report.
+	unsigned int bitOffset;
+	unsigned int bitSize;
+	// Number of consecutive values; only arrays have more than one.
+	unsigned int count;
 	bool isSigned;
-	int arraySize;
+	int32_t dataMin;
+	int32_t dataMax;
+	// For variables, index of the element that receives the value.
+	// For arrays, index of the element that corresponds to dataMin
+	// (the array covers dataMax - dataMin + 1 elements).
+	size_t element;
 };
 
 // -----------------------------------------------------
@@ -53,8 +62,10 @@ struct HidDevice {
 	void parseReportDescriptor(Device device, uint8_t* p, uint8_t* limit);
 	async::detached run(Device device, int intf_num, int config_num);
 
-	std::vector<Field> fields;
+	std::vector<Extractor> extractors;
 	std::vector<Element> elements;
+	// Total size of all input fields in bits.
+	unsigned int reportBits = 0;
 
 private:
 	std::shared_ptr<libevbackend::EventDevice> _eventDev;
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <deque>
 #include <experimental/optional>
 #include <iostream>
@@ -192,70 +193,68 @@ int32_t signExtend(uint32_t x, int bits) {
 	return (x ^ m) - m;
 }
 
-void interpret(const std::vector<Field> &fields, uint8_t *report, size_t size,
-		std::vector<std::pair<bool, int32_t>> &values) {
-	int k = 0; // Offset of the value that we're generating.
-
-	unsigned int bit_offset = 0;
-	auto fetch = [&] (unsigned int bit_size, bool is_signed) -> int32_t {
-		assert(bit_offset + bit_size <= size * 8);
-
-		unsigned int b = bit_offset / 8;
-		assert(b < size);
-		uint32_t word = uint32_t(report[b]);
-		if(b + 1 < size)
-			word |= uint32_t(report[b + 1]) << 8;
-		if(b + 2 < size)
-			word |= uint32_t(report[b + 2]) << 16;
-		if(b + 3 < size)
-			word |= uint32_t(report[b + 3]) << 24;
-
-		uint32_t mask = (uint32_t(1) << bit_size) - 1;
-		uint32_t raw = (word >> (bit_offset % 8)) & mask;
-//			std::cout << "bit_offset: " << bit_offset << ", raw: " << raw << std::endl;
-		bit_offset += bit_size;
-
-		if(is_signed) {
-			return signExtend(raw, bit_size);
-		}else{
-			auto data = static_cast<int32_t>(raw);
-			assert(data >= 0);
-			return data;
-		}
+// Returns bit_size bits at bit_offset; the caller ensures that they are part of the report.
+uint32_t extractBits(const uint8_t *report, size_t size,
+		unsigned int bit_offset, unsigned int bit_size) {
+	// Fields of up to 32 bits can span 5 bytes.
+	unsigned int b = bit_offset / 8;
+	uint64_t word = 0;
+	for(unsigned int i = 0; i < 5 && b + i < size; i++)
+		word |= uint64_t(report[b + i]) << (i * 8);
+	return (word >> (bit_offset % 8)) & ((uint64_t(1) << bit_size) - 1);
+}
+
+// Decodes an input report in a single pass over the extractors and appends
+// the resulting events. pressed is scratch space that covers the largest array.
+void decodeReport(const std::vector<Extractor> &extractors,
+		const std::vector<Element> &elements, const uint8_t *report, size_t size,
+		std::vector<uint8_t> &pressed, std::vector<libevbackend::StagedEvent> &events) {
+	auto emit = [&] (size_t index, int32_t value) {
+		auto &element = elements[index];
+		if(logFieldValues)
+			std::cout << "usagePage: " << element.usagePage
+					<< ", usageId: 0x" << std::hex << element.usageId << std::dec
+					<< ", value: " << value << std::endl;
+		if(element.inputType < 0 || element.disabled)
+			return;
+		if(logInputCodes)
+			std::cout << "    inputType: " << element.inputType
+					<< ", inputCode: " << element.inputCode
+					<< ", value: " << value << std::endl;
+		events.push_back({element.inputType, element.inputCode, value});
 	};
 
-	for(const Field &f : fields) {
-		if(f.type == FieldType::padding) {
-			for(int i = 0; i < f.arraySize; i++)
-				fetch(f.bitSize, false);
+	for(const Extractor &e : extractors) {
+		// Some devices send short reports that omit trailing fields.
+		if(e.bitOffset + e.count * e.bitSize > size * 8)
 			continue;
-		}
 
-		assert(f.bitSize <= 31);
-
-		if(f.type == FieldType::array) {
-			assert(!f.isSigned);
-			for(int i = 0; i < f.dataMax - f.dataMin + 1; i++)
-				values[k + i] = {true, 0};
-			
-			for(int i = 0; i < f.arraySize; i++) {
-				auto data = fetch(f.bitSize, false);
-				if(!(data >= f.dataMin && data <= f.dataMax))
-					continue;
+		if(e.type == ExtractorType::array) {
+			for(unsigned int i = 0; i < e.count; i++) {
+				auto data = static_cast<int32_t>(extractBits(report, size,
+						e.bitOffset + i * e.bitSize, e.bitSize));
+				if(data >= e.dataMin && data <= e.dataMax)
+					pressed[data - e.dataMin] = 1;
+			}
 
-				values[k + data - f.dataMin] = {true, 1};
+			// Elements that do not appear in the array are released.
+			for(int32_t i = 0; i < e.dataMax - e.dataMin + 1; i++) {
+				emit(e.element + i, pressed[i]);
+				pressed[i] = 0;
 			}
-			k += f.dataMax - f.dataMin + 1;
 		}else{
-			assert(f.type == FieldType::variable);
-			auto data = fetch(f.bitSize, f.isSigned);
-			if(data >= f.dataMin && data <= f.dataMax)
-				values[k] = {true, data};
-			k++;
+			assert(e.type == ExtractorType::variable);
+			auto raw = extractBits(report, size, e.bitOffset, e.bitSize);
+			int32_t data;
+			if(e.isSigned) {
+				data = signExtend(raw, e.bitSize);
+			}else{
+				data = static_cast<int32_t>(raw);
+			}
+			if(data >= e.dataMin && data <= e.dataMax)
+				emit(e.element, data);
 		}
 	}
-
-	assert(bit_offset == size * 8);
 }
 
 struct LocalState {
@@ -294,12 +293,13 @@ void HidDevice::parseReportDescriptor(Device, uint8_t *p, uint8_t* limit) {
 		if(!local.usage.empty() && (local.usageMin || local.usageMax))
 			throw std::runtime_error("Usage and Usage Mnimum/Maximum specified");
 			
+		auto bit_size = global.reportSize.value();
+		if(bit_size > 31)
+			throw std::runtime_error("Report Size exceeds 31 bits");
+
 		if(local.usage.empty() && !local.usageMin && !local.usageMax) {
-			Field field;
-			field.type = FieldType::padding;
-			field.bitSize = global.reportSize.value();
-			field.arraySize = global.reportCount.value();
-			fields.push_back(field);
+			// Padding only advances the bit offset.
+			reportBits += bit_size * global.reportCount.value();
 		}else if(!array) {
 			for(unsigned int i = 0; i < global.reportCount.value(); i++) {
 				uint16_t actual_id;
@@ -313,25 +313,29 @@ void HidDevice::parseReportDescriptor(Device, uint8_t *p, uint8_t* limit) {
 				if(!global.logicalMin || !global.logicalMax)
 					throw std::runtime_error("logicalMin or logicalMax not set");
 				
-				Field field;
-				field.type = FieldType::variable;
-				field.bitSize = global.reportSize.value();
+				Extractor extractor;
+				extractor.type = ExtractorType::variable;
+				extractor.bitOffset = reportBits;
+				extractor.bitSize = bit_size;
+				extractor.count = 1;
 				if(global.logicalMin.value().first < 0) {
-					field.isSigned = true;
-					field.dataMin = global.logicalMin.value().first;
-					field.dataMax = global.logicalMax.value().first;
+					extractor.isSigned = true;
+					extractor.dataMin = global.logicalMin.value().first;
+					extractor.dataMax = global.logicalMax.value().first;
 				}else {
-					field.isSigned = false;
-					field.dataMin = global.logicalMin.value().second;
-					field.dataMax = global.logicalMax.value().second;
+					extractor.isSigned = false;
+					extractor.dataMin = global.logicalMin.value().second;
+					extractor.dataMax = global.logicalMax.value().second;
 				}
-				fields.push_back(field);
+				extractor.element = elements.size();
+				extractors.push_back(extractor);
+				reportBits += bit_size;
 
 				Element element;
 				element.usageId = actual_id;
 				element.usagePage = global.usagePage.value();
-				element.logicalMin = field.dataMin;
-				element.logicalMax = field.dataMax;
+				element.logicalMin = extractor.dataMin;
+				element.logicalMax = extractor.dataMax;
 				element.isAbsolute = !relative;
 				element.disabled = foundElements.count((element.usagePage << 16) |  element.usageId);
 				foundElements.insert((element.usagePage << 16) |  element.usageId);
@@ -353,23 +357,25 @@ void HidDevice::parseReportDescriptor(Device, uint8_t *p, uint8_t* limit) {
 
 			if(!local.usageMin)
 				throw std::runtime_error("usageMin not set");
-
-			Field field;
-			field.type = FieldType::array;
-			field.bitSize = global.reportSize.value();
-			if(global.logicalMin.value().first < 0) {
-				field.isSigned = true;
-				field.dataMin = global.logicalMin.value().first;
-				field.dataMax = global.logicalMax.value().first;
-			}else {
-				field.isSigned = false;
-				field.dataMin = global.logicalMin.value().second;
-				field.dataMax = global.logicalMax.value().second;
-			}
-			field.arraySize = global.reportCount.value();
-			fields.push_back(field);
-
-			for(uint32_t i = 0; i < local.usageMax.value() - local.usageMin.value() + 1; i++) {
+			if(global.logicalMin.value().first < 0)
+				throw std::runtime_error("Arrays with negative Logical Minimum are not supported");
+
+			// Values beyond the usage range do not correspond to any element.
+			uint32_t num_usages = local.usageMax.value() - local.usageMin.value() + 1;
+			Extractor extractor;
+			extractor.type = ExtractorType::array;
+			extractor.bitOffset = reportBits;
+			extractor.bitSize = bit_size;
+			extractor.count = global.reportCount.value();
+			extractor.isSigned = false;
+			extractor.dataMin = global.logicalMin.value().second;
+			extractor.dataMax = std::min(static_cast<int64_t>(global.logicalMax.value().second),
+					static_cast<int64_t>(extractor.dataMin) + num_usages - 1);
+			extractor.element = elements.size();
+			extractors.push_back(extractor);
+			reportBits += bit_size * extractor.count;
+
+			for(uint32_t i = 0; i < num_usages; i++) {
 				Element element;
 				element.usageId = local.usageMin.value() + i;
 				element.usagePage = global.usagePage.value();
@@ -583,12 +589,15 @@ async::detached HidDevice::run(Device device, int config_num, int intf_num) {
 		_eventDev->enableEvent(element->inputType, element->inputCode);
 	}
 
-	if(logFields)
-		for(size_t i = 0; i < fields.size(); i++) {
-			std::cout << "Field " << i << ": [" << fields[i].arraySize
-					<< "]. Bit size: " << fields[i].bitSize
-					<< ", signed: " << fields[i].isSigned << std::endl;
+	if(logFields) {
+		std::cout << "usb-hid: Input reports have " << reportBits << " bits" << std::endl;
+		for(size_t i = 0; i < extractors.size(); i++) {
+			std::cout << "Extractor " << i << ": [" << extractors[i].count
+					<< "] at bit " << extractors[i].bitOffset
+					<< ". Bit size: " << extractors[i].bitSize
+					<< ", signed: " << extractors[i].isSigned << std::endl;
 		}
+	}
 
 	// Create an mbus object for the device.
 	auto root = co_await mbus::Instance::global().getRoot();
@@ -615,8 +624,14 @@ async::detached HidDevice::run(Device device, int config_num, int intf_num) {
 	// Read reports from the USB device.
 	std::cout << "usb-hid: Entering report loop" << std::endl;
 
-	std::vector<std::pair<bool, int32_t>> values;
-	values.resize(elements.size());
+	size_t max_array = 0;
+	for(auto &extractor : extractors)
+		if(extractor.type == ExtractorType::array)
+			max_array = std::max(max_array,
+					static_cast<size_t>(extractor.dataMax - extractor.dataMin + 1));
+	std::vector<uint8_t> pressed(max_array);
+	std::vector<libevbackend::StagedEvent> events;
+	events.reserve(elements.size() + 1);
 	while(true) {
 //		std::cout << "usb-hid: Requesting new report" << std::endl;
 		arch::dma_buffer report{device.bufferPool(), in_endp_pktsize};
@@ -638,37 +653,13 @@ async::detached HidDevice::run(Device device, int config_num, int intf_num) {
 			std::cout << std::dec << std::endl;
 		}
 
-		std::fill(values.begin(), values.end(), std::pair<bool, int32_t>{false, 0});
-		interpret(fields, reinterpret_cast<uint8_t *>(report.data()),
-				length, values);
-	
-		if(logFieldValues) {
-			for(size_t i = 0; i < values.size(); i++)
-				if(values[i].first)
-					std::cout << "usagePage: " << elements[i].usagePage
-							<< ", usageId: 0x" << std::hex << elements[i].usageId << std::dec
-							<< ", value: " << values[i].second << std::endl;
-			std::cout << std::endl;
-		}
-
 		if(logInputCodes)
 			std::cout << "Reporting input event" << std::endl;
-		for(size_t i = 0; i < values.size(); i++) {
-			auto element = &elements[i];
-			if(element->inputType < 0)
-				continue;
-			if(!values[i].first)
-				continue;
-			if(element->disabled)
-				continue;
-			if(logInputCodes)
-				std::cout << "    inputType: " << element->inputType
-						<< ", inputCode: " << element->inputCode
-						<< ", value: " << values[i].second << std::endl;
-
-			_eventDev->emitEvent(element->inputType, element->inputCode, values[i].second);
-		}
-		_eventDev->emitEvent(EV_SYN, SYN_REPORT, 0);
+		events.clear();
+		decodeReport(extractors, elements, reinterpret_cast<uint8_t *>(report.data()),
+				length, pressed, events);
+		events.push_back({EV_SYN, SYN_REPORT, 0});
+		_eventDev->emitEvents(events);
 		_eventDev->notify();
 	}
 }
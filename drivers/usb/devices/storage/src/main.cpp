@@ -7,6 +7,7 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include <async/algorithm.hpp>
 #include <async/result.hpp>
 #include <protocols/mbus/client.hpp>
 #include <protocols/usb/usb.hpp>
@@ -22,6 +23,48 @@ namespace {
 
 	// I own a USB key that does not support the READ6 command. ~AvdG
 	constexpr bool enableRead6 = false;
+
+	void putBigEndian(uint8_t *p, uint64_t value, int n) {
+		for(int i = 0; i < n; i++)
+			p[i] = value >> (8 * (n - 1 - i));
+	}
+
+	// Fills in the SCSI command of a CBW. We prefer the 10-byte commands since not all
+	// devices implement the 16-byte ones; the latter are only used if the LBA or the
+	// transfer length do not fit.
+	void encodeCommand(CommandBlockWrapper &cbw, bool isWrite, uint64_t sector,
+			size_t numSectors) {
+		if(!isWrite && enableRead6 && sector <= 0x1FFFFF && numSectors <= 0xFF) {
+			scsi::Read6 command;
+			memset(&command, 0, sizeof(scsi::Read6));
+			command.opCode = 0x08;
+			putBigEndian(command.lba, sector, 3);
+			command.transferLength = numSectors;
+
+			cbw.cmdLength = sizeof(scsi::Read6);
+			memcpy(cbw.cmdData, &command, sizeof(scsi::Read6));
+		}else if(sector <= 0xFFFFFFFF && numSectors <= 0xFFFF) {
+			// Read10 and Write10 share their layout.
+			scsi::Read10 command;
+			memset(&command, 0, sizeof(scsi::Read10));
+			command.opCode = isWrite ? 0x2A : 0x28;
+			putBigEndian(command.lba, sector, 4);
+			putBigEndian(command.transferLength, numSectors, 2);
+
+			cbw.cmdLength = sizeof(scsi::Read10);
+			memcpy(cbw.cmdData, &command, sizeof(scsi::Read10));
+		}else{
+			static_assert(sizeof(scsi::Read16) == sizeof(scsi::Write16));
+			scsi::Read16 command;
+			memset(&command, 0, sizeof(scsi::Read16));
+			command.opCode = isWrite ? 0x8A : 0x88;
+			putBigEndian(command.lba, sector, 8);
+			putBigEndian(command.transferLength, numSectors, 4);
+
+			cbw.cmdLength = sizeof(scsi::Read16);
+			memcpy(cbw.cmdData, &command, sizeof(scsi::Read16));
+		}
+	}
 }
 
 async::detached StorageDevice::run(int config_num, int intf_num) {
@@ -62,14 +105,15 @@ async::detached StorageDevice::run(int config_num, int intf_num) {
 			_queue.pop_front();
 			
 			if(logRequests)
-				std::cout << "block-usb: Reading " << req->numSectors << " sectors" << std::endl;
+				std::cout << "block-usb: " << (req->isWrite ? "Writing " : "Reading ")
+						<< req->numSectors << " sectors" << std::endl;
 			assert(req->numSectors);
-			assert(req->numSectors <= 0xFFFF);
+			assert(req->numSectors <= 0xFFFFFFFF / 512);
 
 			CommandBlockWrapper cbw;
 			memset(&cbw, 0, sizeof(CommandBlockWrapper));
 			cbw.signature = Signatures::kSignCbw;
-			cbw.tag = 1;
+			cbw.tag = ++_tag;
 			cbw.transferLength = req->numSectors * 512;
 			if(!req->isWrite) {
 				cbw.flags = 0x80; // Direction: Device-to-Host.
@@ -77,89 +121,57 @@ async::detached StorageDevice::run(int config_num, int intf_num) {
 				cbw.flags = 0; // Direction: Host-to-Device.
 			}
 			cbw.lun = 0;
-
-			if(!req->isWrite) {
-				if(enableRead6 && req->sector <= 0x1FFFFF && req->numSectors <= 0xFF) {
-					scsi::Read6 command;
-					memset(&command, 0, sizeof(scsi::Read6));
-					command.opCode = 0x08;
-					command.lba[0] = req->sector >> 16;
-					command.lba[1] = (req->sector >> 8) & 0xFF;
-					command.lba[2] = req->sector & 0xFF;
-					command.transferLength = req->numSectors;
-
-					cbw.cmdLength = sizeof(scsi::Read6);
-					memcpy(cbw.cmdData, &command, sizeof(scsi::Read6));
-				}else if(req->sector <= 0xFFFFFFFF) {
-					scsi::Read10 command;
-					memset(&command, 0, sizeof(scsi::Read10));
-					command.opCode = 0x28;
-					command.lba[0] = req->sector >> 24;
-					command.lba[1] = (req->sector >> 16) & 0xFF;
-					command.lba[2] = (req->sector >> 8) & 0xFF;
-					command.lba[3] = req->sector & 0xFF;
-					command.transferLength[0] = req->numSectors >> 8;
-					command.transferLength[1] = req->numSectors & 0xFF;
-
-					cbw.cmdLength = sizeof(scsi::Read10);
-					memcpy(cbw.cmdData, &command, sizeof(scsi::Read10));
-				}else{
-					throw std::logic_error("USB storage does not currently support high LBAs!");
-				}
-			}else{
-				if(req->sector <= 0xFFFFFFFF) {
-					scsi::Write10 command;
-					memset(&command, 0, sizeof(scsi::Write10));
-					command.opCode = 0x2A;
-					command.lba[0] = req->sector >> 24;
-					command.lba[1] = (req->sector >> 16) & 0xFF;
-					command.lba[2] = (req->sector >> 8) & 0xFF;
-					command.lba[3] = req->sector & 0xFF;
-					command.transferLength[0] = req->numSectors >> 8;
-					command.transferLength[1] = req->numSectors & 0xFF;
-
-					cbw.cmdLength = sizeof(scsi::Write10);
-					memcpy(cbw.cmdData, &command, sizeof(scsi::Write10));
-				}else{
-					throw std::logic_error("USB storage does not currently support high LBAs!");
-				}
-			}
+			encodeCommand(cbw, req->isWrite, req->sector, req->numSectors);
 
 			// TODO: Respect USB device DMA requirements.
-
-			// TODO: Ideally, we want to post the IN-transfer first.
-			// We do this to try to avoid unnecessary IRQs
-			// and round-trips to the device and host-controller driver.
+			arch::dma_buffer_view data{nullptr, req->buffer, req->numSectors * 512};
 			CommandStatusWrapper csw;
 
-			if(logSteps)
-				std::cout << "block-usb: Sending CBW" << std::endl;
-			(co_await endp_out.transfer(BulkTransfer{XferFlags::kXferToDevice,
-					arch::dma_buffer_view{nullptr, &cbw, sizeof(CommandBlockWrapper)}})).unwrap();
-			
-			if(logSteps)
-				std::cout << "block-usb: Waiting for data" << std::endl;
+			auto sendCbw = [&] () -> async::result<void> {
+				if(logSteps)
+					std::cout << "block-usb: Sending CBW" << std::endl;
+				(co_await endp_out.transfer(BulkTransfer{XferFlags::kXferToDevice,
+						arch::dma_buffer_view{nullptr, &cbw, sizeof(CommandBlockWrapper)}})).unwrap();
+			};
+
+			auto receiveCsw = [&] () -> async::result<void> {
+				if(logSteps)
+					std::cout << "block-usb: Waiting for CSW" << std::endl;
+				(co_await endp_in.transfer(BulkTransfer{XferFlags::kXferToHost,
+						arch::dma_buffer_view{nullptr, &csw, sizeof(CommandStatusWrapper)}})).unwrap();
+			};
+
+			// The device processes the CBW, the data stage and the CSW strictly in order.
+			// We queue the transfers of both pipes up front (in order on each pipe), such
+			// that the host controller can start the next stage without a round-trip to us.
 			if(!req->isWrite) {
-				BulkTransfer data_info{XferFlags::kXferToHost,
-						arch::dma_buffer_view{nullptr, req->buffer, req->numSectors * 512}};
-				// TODO: We want this to be lazy but that only works if can ensure that
-				// the next transaction is also posted to the queue.
-	//			data_info.lazyNotification = true;
-				(co_await endp_in.transfer(data_info)).unwrap();
+				co_await async::when_all(
+					sendCbw(),
+					[&] () -> async::result<void> {
+						if(logSteps)
+							std::cout << "block-usb: Waiting for data" << std::endl;
+						(co_await endp_in.transfer(BulkTransfer{XferFlags::kXferToHost,
+								data})).unwrap();
+						co_await receiveCsw();
+					}()
+				);
 			}else{
-				(co_await endp_out.transfer(BulkTransfer{XferFlags::kXferToDevice,
-						arch::dma_buffer_view{nullptr, req->buffer, req->numSectors * 512}})).unwrap();
+				co_await async::when_all(
+					[&] () -> async::result<void> {
+						co_await sendCbw();
+						if(logSteps)
+							std::cout << "block-usb: Sending data" << std::endl;
+						(co_await endp_out.transfer(BulkTransfer{XferFlags::kXferToDevice,
+								data})).unwrap();
+					}(),
+					receiveCsw()
+				);
 			}
 
-			if(logSteps)
-				std::cout << "block-usb: Waiting for CSW" << std::endl;
-			(co_await endp_in.transfer(BulkTransfer{XferFlags::kXferToHost,
-					arch::dma_buffer_view{nullptr, &csw, sizeof(CommandStatusWrapper)}})).unwrap();
-
 			if(logSteps)
 				std::cout << "block-usb: Request complete" << std::endl;
 			assert(csw.signature == Signatures::kSignCsw);
-			assert(csw.tag == 1);
+			assert(csw.tag == cbw.tag);
 			assert(!csw.dataResidue);
 			if(csw.status) {
 				std::cout << "block-usb: Error status 0x"
@@ -77,6 +77,15 @@ struct Read16 {
 	uint8_t control;
 };
 
+struct Write16 {
+	uint8_t opCode;
+	uint8_t options;
+	uint8_t lba[8];
+	uint8_t transferLength[4];
+	uint8_t grpNumber;
+	uint8_t control;
+};
+
 struct Read32 {
 	uint8_t opCode;
 	uint8_t control;
@@ -122,6 +131,8 @@ private:
 
 	Device _usbDevice;
 	async::recurring_event _doorbell;
+	// Tag of the last CBW; the device echoes it in the CSW.
+	uint32_t _tag = 0;
 
 	boost::intrusive::list<
 		Request,
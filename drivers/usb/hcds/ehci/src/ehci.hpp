@@ -84,6 +84,13 @@ struct Controller : std::enable_shared_from_this<Controller> {
 		void setAddress(int address);
 		arch::dma_object<QueueHead> head;
 		boost::intrusive::list<Transaction> transactions;
+
+		// Links the entity into _activeQueues while it has pending transactions.
+		boost::intrusive::list_member_hook<> activeHook;
+
+		// The most recently completed transaction. The QH overlay may still point
+		// to its last qTD, so it is only freed once the next transaction completes.
+		Transaction *retired = nullptr;
 	};
 
 
@@ -149,8 +156,19 @@ private:
 	
 	void _progressSchedule();
 	void _progressQueue(QueueEntity *entity);
+	void _retire(QueueEntity *entity, Transaction *transaction);
 	
 	boost::intrusive::list<QueueEntity> _asyncSchedule;
+
+	// Queues with pending transactions; only these are scanned on completion IRQs.
+	boost::intrusive::list<
+		QueueEntity,
+		boost::intrusive::member_hook<
+			QueueEntity,
+			boost::intrusive::list_member_hook<>,
+			&QueueEntity::activeHook
+		>
+	> _activeQueues;
 	arch::dma_object<QueueHead> _asyncQh;
 	
 	// ----------------------------------------------------------------------------
@@ -1,6 +1,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <deque>
 #include <optional>
@@ -70,6 +71,27 @@ async::detached Enumerator::_probe() {
 
 namespace {
 	arch::contiguous_pool schedulePool;
+
+	// Recycled qTD arrays, indexed by their size. Transfers usually need only a few
+	// qTDs, so this avoids going through schedulePool for each transaction.
+	constexpr size_t maxCachedTds = 16;
+	std::vector<arch::dma_array<TransferDescriptor>> tdCache[maxCachedTds + 1];
+
+	arch::dma_array<TransferDescriptor> allocateTds(size_t n) {
+		if(n > maxCachedTds || tdCache[n].empty())
+			return arch::dma_array<TransferDescriptor>{&schedulePool, n};
+		auto tds = std::move(tdCache[n].back());
+		tdCache[n].pop_back();
+		// The builders do not write all buffer pointers.
+		memset(&tds[0], 0, n * sizeof(TransferDescriptor));
+		return tds;
+	}
+
+	void freeTds(arch::dma_array<TransferDescriptor> tds) {
+		auto n = tds.size();
+		if(n <= maxCachedTds)
+			tdCache[n].push_back(std::move(tds));
+	}
 }
 
 // ----------------------------------------------------------------------------
@@ -691,7 +713,7 @@ auto Controller::_buildControl(XferFlags dir,
 
 	size_t num_data = (buffer.size() + 0x3FFF) / 0x4000;
 	assert(num_data <= 1);
-	arch::dma_array<TransferDescriptor> transfers{&schedulePool, num_data + 2};
+	auto transfers = allocateTds(num_data + 2);
 
 	// TODO: This code is horribly broken if the setup packet or
 	// one of the data packets crosses a page boundary.
@@ -761,7 +783,7 @@ auto Controller::_buildInterruptOrBulk(XferFlags dir,
 		std::cout << "ehci: Building transfer using " << num_data << " TDs" << std::endl;
 
 	// Finally construct each qTD.
-	arch::dma_array<TransferDescriptor> transfers{&schedulePool, num_data};
+	auto transfers = allocateTds(num_data);
 
 	size_t progress = 0;
 	for(size_t i = 0; i < num_data; i++) {
@@ -848,6 +870,7 @@ void Controller::_linkAsync(QueueEntity *entity) {
 
 void Controller::_linkTransaction(QueueEntity *queue, Transaction *transaction) {
 	assert(transaction->transfers.size());
+	auto pointer = schedulePointer(&transaction->transfers[0]);
 
 	if(queue->transactions.empty()) {
 		if(logSubmits)
@@ -858,7 +881,6 @@ void Controller::_linkTransaction(QueueEntity *queue, Transaction *transaction)
 		assert(!(status & qh_status::halted));
 		assert(!(status & qh_status::totalBytes));
 		auto current = (queue->head->curTd.load() & qh_curTd::curTd);
-		auto pointer = schedulePointer(&transaction->transfers[0]);
 		queue->head->nextTd.store(qh_nextTd::nextTd(pointer));
 
 		if(debugLinking) {
@@ -872,76 +894,110 @@ void Controller::_linkTransaction(QueueEntity *queue, Transaction *transaction)
 			// TODO: We could ensure that the new TD pointer is part of the transaction.
 			std::cout << "ehci: AdvanceQueue to new transaction" << std::endl;
 		}
+
+		_activeQueues.push_back(*queue);
+	}else{
+		// Chain the transaction to the last qTD of the queue while the schedule keeps running.
+		// If the controller has already retired that qTD, it does not see the update;
+		// _progressQueue() links the transaction into the QH in this case.
+		if(logSubmits)
+			std::cout << "ehci: Appending in _linkTransaction" << std::endl;
+		auto tail = &queue->transactions.back();
+		tail->transfers[tail->transfers.size() - 1].nextTd.store(td_ptr::ptr(pointer));
 	}
 
 	queue->transactions.push_back(*transaction);
 }
 
 void Controller::_progressSchedule() {
-	auto it = _asyncSchedule.begin();
-	while(it != _asyncSchedule.end()) {
-		_progressQueue(&(*it));
+	auto it = _activeQueues.begin();
+	while(it != _activeQueues.end()) {
+		// _progressQueue() removes idle queues from the list.
+		auto entity = &(*it);
 		++it;
+		_progressQueue(entity);
 	}
 }
 
 void Controller::_progressQueue(QueueEntity *entity) {
-	if(entity->transactions.empty())
-		return;
-
-	auto active = &entity->transactions.front();
-	while(active->numComplete < active->transfers.size()) {
-		auto transfer = &active->transfers[active->numComplete];
-		if((transfer->status.load() & td_status::active)
-				|| (transfer->status.load() & td_status::halted)
-				|| (transfer->status.load() & td_status::transactionError)
-				|| (transfer->status.load() & td_status::babbleDetected)
-				|| (transfer->status.load() & td_status::dataBufferError))
-			break;
-
-		auto lost = (transfer->status.load() & td_status::totalBytes);
-		assert(!lost); // TODO: Support short packets.
-
-		active->numComplete++;
-		active->lostSize += lost;
-	}
+	// A single IRQ can retire multiple transactions of the same queue.
+	while(!entity->transactions.empty()) {
+		auto active = &entity->transactions.front();
+		while(active->numComplete < active->transfers.size()) {
+			auto transfer = &active->transfers[active->numComplete];
+			if((transfer->status.load() & td_status::active)
+					|| (transfer->status.load() & td_status::halted)
+					|| (transfer->status.load() & td_status::transactionError)
+					|| (transfer->status.load() & td_status::babbleDetected)
+					|| (transfer->status.load() & td_status::dataBufferError))
+				break;
+
+			auto lost = (transfer->status.load() & td_status::totalBytes);
+			assert(!lost); // TODO: Support short packets.
+
+			active->numComplete++;
+			active->lostSize += lost;
+		}
 
-	auto current = active->numComplete;
-	if(current == active->transfers.size()) {
-		if(logSubmits)
-			std::cout << "ehci: Transfer complete!" << std::endl;
-		assert(active->fullSize >= active->lostSize);
-		active->promise.set_value(active->fullSize - active->lostSize);
-		active->voidPromise.set_value(UsbError{});
-
-		// Clean up the Queue.
-		entity->transactions.pop_front();
-		//delete active;
-		// TODO: _reclaim(active);
-
-		// Schedule the next transaction.
-		assert(entity->head->nextTd.load() & td_ptr::terminate);
-		if(!entity->transactions.empty()) {
+		auto current = active->numComplete;
+		if(current == active->transfers.size()) {
 			if(logSubmits)
-				std::cout << "ehci: Linking in _progressQueue" << std::endl;
-			auto front = &entity->transactions.front();
-			entity->head->nextTd.store(qh_nextTd::nextTd(schedulePointer(&front->transfers[0])));
+				std::cout << "ehci: Transfer complete!" << std::endl;
+			assert(active->fullSize >= active->lostSize);
+
+			// Clean up the Queue.
+			entity->transactions.pop_front();
+			_retire(entity, active);
+
+			if(entity->transactions.empty()) {
+				_activeQueues.erase(_activeQueues.iterator_to(*entity));
+			}else{
+				// Schedule the next transaction if the controller stopped before it was appended.
+				auto front = &entity->transactions.front();
+				auto status = entity->head->status.load();
+				if(!(status & qh_status::active)
+						&& (entity->head->nextTd.load() & td_ptr::terminate)
+						&& (front->transfers[0].status.load() & td_status::active)) {
+					if(logSubmits)
+						std::cout << "ehci: Linking in _progressQueue" << std::endl;
+					entity->head->nextTd.store(qh_nextTd::nextTd(
+							schedulePointer(&front->transfers[0])));
+				}
+			}
+
+			// Completion can submit new transactions to this queue; we are done touching it.
+			active->promise.set_value(active->fullSize - active->lostSize);
+			active->voidPromise.set_value(UsbError{});
+		}else if((active->transfers[current].status.load() & td_status::halted)
+				|| (active->transfers[current].status.load() & td_status::transactionError)
+				|| (active->transfers[current].status.load() & td_status::babbleDetected)
+				|| (active->transfers[current].status.load() & td_status::dataBufferError)) {
+			printf("Transfer error!\n");
+
+			_dump(entity);
+
+			// Clean up the Queue.
+			entity->transactions.pop_front();
+			//delete active;
+			// TODO: _reclaim(active);
+			if(entity->transactions.empty())
+				_activeQueues.erase(_activeQueues.iterator_to(*entity));
+			return;
+		}else{
+			return;
 		}
-	}else if((active->transfers[current].status.load() & td_status::halted)
-			|| (active->transfers[current].status.load() & td_status::transactionError)
-			|| (active->transfers[current].status.load() & td_status::babbleDetected)
-			|| (active->transfers[current].status.load() & td_status::dataBufferError)) {
-		printf("Transfer error!\n");
-
-		_dump(entity);
-
-		// Clean up the Queue.
-		entity->transactions.pop_front();
-		//delete active;
-		// TODO: _reclaim(active);
 	}
 }
 
+void Controller::_retire(QueueEntity *entity, Transaction *transaction) {
+	// Once a newer transaction completed, the controller no longer references the old one.
+	if(entity->retired) {
+		freeTds(std::move(entity->retired->transfers));
+		delete entity->retired;
+	}
+	entity->retired = transaction;
+}
+
 // ----------------------------------------------------------------------------
 // Port management.
 // ----------------------------------------------------------------------------
@@ -2,6 +2,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <algorithm>
 #include <deque>
 #include <optional>
 #include <functional>
@@ -70,12 +71,12 @@ constexpr const char *completionCodeNames[256] = {
 std::vector<std::shared_ptr<Controller>> globalControllers;
 
 Controller::Controller(protocols::hw::Device hw_device, helix::Mapping mapping,
-		helix::UniqueDescriptor mmio, helix::UniqueIrq irq, bool useMsis)
+		helix::UniqueDescriptor mmio, helix::UniqueIrq irq, unsigned int numMsis)
 : _hw_device{std::move(hw_device)}, _mapping{std::move(mapping)},
 		_mmio{std::move(mmio)}, _irq{std::move(irq)},
 		_space{_mapping.get()}, _memoryPool{},
 		_dcbaa{&_memoryPool, 256}, _cmdRing{this},
-		_eventRing{this}, _useMsis{useMsis} {
+		_numMsis{numMsis}, _useMsis{numMsis > 0} {
 	auto op_offset = _space.load(cap_regs::caplength);
 	auto runtime_offset = _space.load(cap_regs::rtsoff);
 	auto doorbell_offset = _space.load(cap_regs::dboff);
@@ -304,11 +305,25 @@ async::detached Controller::initialize() {
 	for (int i = 1; i < max_intrs; i++)
 		_interrupters.push_back(std::make_unique<Interrupter>(i, this));
 
-	_interrupters[0]->setEventRing(&_eventRing);
-	_interrupters[0]->setEnable(true);
+	// With multiple MSIs, we use one interrupter per MSI and spread the
+	// transfer events of the devices over them.
+	constexpr unsigned int maxEventRings = 8;
+	unsigned int numEventRings = 1;
+	if (_useMsis)
+		numEventRings = std::min({_numMsis, static_cast<unsigned int>(max_intrs), maxEventRings});
+	printf("xhci: using %u interrupters\n", numEventRings);
+
+	for (unsigned int i = 0; i < numEventRings; i++) {
+		_eventRings.push_back(std::make_unique<EventRing>(this, i));
+		_interrupters[i]->setEventRing(_eventRings[i].get());
+		_interrupters[i]->setEnable(true);
+	}
 
 	if (_useMsis) {
-		handleMsis();
+		for (unsigned int i = 1; i < numEventRings; i++)
+			_extraMsis.push_back(co_await _hw_device.installMsi(i));
+		for (unsigned int i = 0; i < numEventRings; i++)
+			handleMsis(i);
 	} else {
 		co_await _hw_device.enableBusIrq();
 		handleIrqs();
@@ -346,17 +361,18 @@ async::detached Controller::handleIrqs() {
 		_interrupters[0]->clearPending();
 		HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, sequence));
 
-		_eventRing.processRing();
+		_eventRings[0]->processRing();
 	}
 
 	printf("xhci: interrupt coroutine should not exit...\n");
 }
 
-async::detached Controller::handleMsis() {
+async::detached Controller::handleMsis(size_t index) {
+	auto &irq = index ? _extraMsis[index - 1] : _irq;
 	uint64_t sequence = 0;
 
 	while(1) {
-		auto await = co_await helix_ng::awaitEvent(_irq, sequence);
+		auto await = co_await helix_ng::awaitEvent(irq, sequence);
 		HEL_CHECK(await.error());
 		sequence = await.sequence();
 
@@ -364,9 +380,9 @@ async::detached Controller::handleMsis() {
 		// but if we check it, and nack if it's unset, the driver nacks
 		// an IRQ from the device and essentially stalls the driver.
 
-		HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, sequence));
+		HEL_CHECK(helAcknowledgeIrq(irq.getHandle(), kHelAckAcknowledge, sequence));
 
-		_eventRing.processRing();
+		_eventRings[index]->processRing();
 	}
 
 	printf("xhci: interrupt coroutine should not exit...\n");
@@ -432,9 +448,9 @@ void Controller::CommandRing::submit() {
 // Controller::EventRing
 // ------------------------------------------------------------------------
 
-Controller::EventRing::EventRing(Controller *controller)
+Controller::EventRing::EventRing(Controller *controller, int interrupter)
 :_eventRing{&controller->_memoryPool}, _erst{&controller->_memoryPool, 1},
-	_dequeuePtr{0}, _controller{controller}, _ccs{1} {
+	_dequeuePtr{0}, _controller{controller}, _interrupter{interrupter}, _ccs{1} {
 
 	for (size_t i = 0; i < eventRingSize; i++) {
 		_eventRing->ent[i] = {{0, 0, 0, 0}};
@@ -477,13 +493,10 @@ void Controller::EventRing::processRing() {
 		if ((raw_ev.val[3] & 1) != old_ccs)
 			break; // not the proper cycle state
 
-		Controller::Event ev = Controller::Event::fromRawTrb(raw_ev);
-
-		_dequeuedEvents.push_back(ev);
-		processEvent(ev);
+		processEvent(Controller::Event::fromRawTrb(raw_ev));
 	}
 
-	_controller->_interrupters[0]->setEventRing(this, true);
+	_controller->_interrupters[_interrupter]->setEventRing(this, true);
 	_doorbell.raise();
 }
 
@@ -504,8 +517,20 @@ void Controller::EventRing::processEvent(Controller::Event ev) {
 			_controller->_ports[ev.portId - 1]->_doorbell.raise();
 	} else if (ev.type == TrbType::transferEvent) {
 		auto transferRing = _controller->_devices[ev.slotId]->_transferRings[ev.endpointId - 1].get();
+
+		// After a missed service error, the controller skips TDs without generating events
+		// for them; the next event that refers to a TRB tells us how far it skipped.
+		// Ring underrun/overrun and missed service events do not necessarily refer to a TRB.
+		if (ev.completionCode == 23)
+			transferRing->_missedService = true;
+		if (!ev.trbPointer)
+			return;
+
 		size_t commandIndex = (ev.trbPointer - transferRing->getPtr()) / sizeof(RawTrb);
 		assert(commandIndex < Controller::TransferRing::transferRingSize);
+		if (transferRing->_missedService)
+			transferRing->retireMissed(commandIndex);
+
 		auto transferEv = transferRing->_transferEvents[commandIndex];
 		transferRing->_transferEvents[commandIndex] = nullptr;
 		if (transferEv) {
@@ -807,6 +832,7 @@ async::detached Controller::Port::initPort() {
 	assert(targetPacketSize != -1);
 
 	_device = std::make_shared<Device>(_id, _controller);
+	_device->_isFullSpeed = isFullSpeed;
 	co_await _device->allocSlot(_proto->protocolSlotType, targetPacketSize);
 	_controller->_devices[_device->_slotId] = _device;
 
@@ -892,23 +918,53 @@ void Controller::TransferRing::pushRawTransfer(RawTrb cmd,
 	_enqueuePtr++;
 
 	if (_enqueuePtr >= Controller::TransferRing::transferRingSize - 1) {
-		updateLink();
+		updateLink(cmd.val[3] & (1 << 4));
 		_pcs = !_pcs;
 		_enqueuePtr = 0;
 	}
 }
 
-void Controller::TransferRing::updateLink() {
+void Controller::TransferRing::updateLink(bool chain) {
 	_transferRing->ent[transferRingSize - 1] = {{
 		static_cast<uint32_t>(getPtr() & 0xFFFFFFFF),
 		static_cast<uint32_t>(getPtr() >> 32),
 		0,
-		static_cast<uint32_t>(_pcs | (1 << 1) | (1 << 5) | (6 << 10))
+		static_cast<uint32_t>(_pcs | (1 << 1) | (chain << 4) | (1 << 5) | (6 << 10))
 	}};
 }
 
+size_t Controller::TransferRing::freeTrbs() {
+	// The link TRB is not usable. One TRB is kept free to distinguish a full ring
+	// from an empty one.
+	constexpr size_t usable = transferRingSize - 1;
+	return (_dequeuePtr + usable - _enqueuePtr - 1) % usable;
+}
+
+async::result<void> Controller::TransferRing::awaitFreeTrbs(size_t count) {
+	assert(count <= transferRingSize - 2);
+	while (freeTrbs() < count)
+		co_await _retireDoorbell.async_wait();
+}
+
 void Controller::TransferRing::updateDequeue(int current) {
-	_dequeuePtr = current;
+	_dequeuePtr = current + 1;
+	if (_dequeuePtr >= transferRingSize - 1)
+		_dequeuePtr = 0;
+	_retireDoorbell.raise();
+}
+
+void Controller::TransferRing::retireMissed(int current) {
+	for (size_t i = _dequeuePtr; i != static_cast<size_t>(current);
+			i = (i + 1) % (transferRingSize - 1)) {
+		auto transferEv = _transferEvents[i];
+		if (!transferEv)
+			continue;
+		_transferEvents[i] = nullptr;
+		transferEv->event.completionCode = 23;
+		transferEv->event.transferLen = 0;
+		transferEv->completion.raise();
+	}
+	_missedService = false;
 }
 
 // ------------------------------------------------------------------------
@@ -946,6 +1002,7 @@ Controller::Device::useConfiguration(int number) {
 		PipeType dir;
 		int packet_size;
 		EndpointType type;
+		int interval;
 	};
 
 	std::vector<EndpointInfo> _eps = {};
@@ -963,16 +1020,16 @@ Controller::Device::useConfiguration(int number) {
 
 		int pipe = info.endpointNumber.value();
 		if (info.endpointIn.value()) {
-			_eps.push_back({pipe, PipeType::in, packet_size, ep_type});
+			_eps.push_back({pipe, PipeType::in, packet_size, ep_type, desc->interval});
 		} else {
-			_eps.push_back({pipe, PipeType::out, packet_size, ep_type});
+			_eps.push_back({pipe, PipeType::out, packet_size, ep_type, desc->interval});
 		}
 	});
 
 	for (auto &ep : _eps) {
 		printf("xhci: setting up %s endpoint %d (max packet size: %d)\n", 
 			ep.dir == PipeType::in ? "in" : "out", ep.pipe, ep.packet_size);
-		co_await setupEndpoint(ep.pipe, ep.dir, ep.packet_size, ep.type);
+		co_await setupEndpoint(ep.pipe, ep.dir, ep.packet_size, ep.type, ep.interval);
 	}
 
 	RawTrb setup_stage = {{
@@ -1130,9 +1187,92 @@ async::result<void> Controller::Device::allocSlot(int slotType, int packetSize)
 }
 
 void Controller::Device::pushRawTransfer(int endpoint, RawTrb cmd, Controller::TransferRing::TransferEvent *ev) {
+	// Interrupter target.
+	cmd.val[2] |= _controller->interrupterOf(_slotId) << 22;
 	_transferRings[endpoint]->pushRawTransfer(cmd, ev);
 }
 
+// Splits the buffer into physically contiguous chunks that can be described by a single TRB.
+// Calls fn(physical, size, is_last) for each chunk; empty buffers yield a single empty chunk.
+template<typename F>
+static void forEachTrbChunk(arch::dma_buffer_view buffer, F fn) {
+	if (!buffer.size()) {
+		fn(0, 0, true);
+		return;
+	}
+
+	size_t progress = 0;
+	while(progress < buffer.size()) {
+		uintptr_t pptr, ptr = (uintptr_t)buffer.data() + progress;
+		HEL_CHECK(helPointerPhysical((void *)ptr, &pptr));
+
+		// TRB buffers must not cross 64 KiB boundaries.
+		auto limit = std::min(buffer.size() - progress, 0x10000 - (pptr & 0xFFFF));
+		auto chunk = std::min(limit, 0x1000 - (ptr & 0xFFF));
+		while(chunk < limit) {
+			uintptr_t next;
+			HEL_CHECK(helPointerPhysical((void *)(ptr + chunk), &next));
+			if(next != pptr + chunk)
+				break;
+			chunk = std::min(limit, chunk + 0x1000);
+		}
+
+		fn(pptr, chunk, (progress + chunk) >= buffer.size());
+		progress += chunk;
+	}
+}
+
+static size_t countTrbs(arch::dma_buffer_view buffer) {
+	size_t n = 0;
+	forEachTrbChunk(buffer, [&] (uintptr_t, size_t, bool) { n++; });
+	return n;
+}
+
+void Controller::Device::pushNormalTransfers(int endpoint, arch::dma_buffer_view buffer,
+		uint32_t flags, Controller::TransferRing::TransferEvent *ev) {
+	forEachTrbChunk(buffer, [&] (uintptr_t pptr, size_t chunk, bool is_last) {
+		RawTrb transfer = {{
+			static_cast<uint32_t>(pptr & 0xFFFFFFFF),
+			static_cast<uint32_t>(pptr >> 32),
+			static_cast<uint32_t>(chunk),
+			flags | (!is_last << 4) | (is_last << 5)
+				| (static_cast<uint32_t>(TrbType::normal) << 10)}};
+
+		pushRawTransfer(endpoint, transfer, is_last ? ev : nullptr);
+	});
+}
+
+void Controller::Device::pushIsochTransfer(int endpoint, arch::dma_buffer_view buffer,
+		uint32_t flags, Controller::TransferRing::TransferEvent *ev) {
+	// The TD consists of an Isoch TRB followed by Normal TRBs. We always set SIA
+	// (i.e., the packet is scheduled in the next free service interval).
+	bool is_first = true;
+	forEachTrbChunk(buffer, [&] (uintptr_t pptr, size_t chunk, bool is_last) {
+		auto type = is_first ? TrbType::isoch : TrbType::normal;
+
+		RawTrb transfer = {{
+			static_cast<uint32_t>(pptr & 0xFFFFFFFF),
+			static_cast<uint32_t>(pptr >> 32),
+			static_cast<uint32_t>(chunk),
+			flags | (!is_last << 4) | (is_last << 5)
+				| (static_cast<uint32_t>(type) << 10)
+				| (static_cast<uint32_t>(is_first) << 31)}};
+
+		pushRawTransfer(endpoint, transfer, is_last ? ev : nullptr);
+		is_first = false;
+	});
+}
+
+async::result<void> Controller::Device::reserveTrbs(int endpoint, size_t count) {
+	auto ring = _transferRings[endpoint].get();
+	if (ring->freeTrbs() >= count)
+		co_return;
+
+	// Make sure that the controller processes the TRBs that we already pushed.
+	submit(endpoint + 1);
+	co_await ring->awaitFreeTrbs(count);
+}
+
 async::result<void> Controller::Device::readDescriptor(arch::dma_buffer_view dest, uint16_t desc) {
 	RawTrb setup_stage = {{
 			static_cast<uint32_t>((desc << 16) | (6 << 8) | 0x80), // GET_DESCRIPTOR, dev to host
@@ -1180,7 +1320,8 @@ static inline uint32_t getHcdEndpointType(PipeType dir, EndpointType type) {
 	return 0;
 }
 
-async::result<void> Controller::Device::setupEndpoint(int endpoint, PipeType dir, size_t maxPacketSize, EndpointType type, bool drop) {
+async::result<void> Controller::Device::setupEndpoint(int endpoint, PipeType dir, size_t maxPacketSize,
+		EndpointType type, int interval, bool drop) {
 	printf("xhci: doing endpoint stuff to %d\n", endpoint);
 	auto inputCtx = arch::dma_object<InputContext>{&_controller->_memoryPool};
 	memset(inputCtx.data(), 0, sizeof(InputContext));
@@ -1195,22 +1336,37 @@ async::result<void> Controller::Device::setupEndpoint(int endpoint, PipeType dir
 	inputCtx->slotContext.val[0] |= (31 << 27);
 
 	_transferRings[endpointId - 1] = std::make_unique<TransferRing>(_controller);
+	_maxPacketSizes[endpointId - 1] = maxPacketSize;
 
 	// max burst size = 0
 	// tr dequeue = tr ring ptr
 	// dcs = 1
-	// interval = 0
+	// interval = 0 (except for isochronous endpoints)
 	// max p streams = 0
 	// mult = 0
-	// error count = 3
+	// error count = 3 (0 for isochronous endpoints, which are never retried)
 	// average trb length = packet size * 2
+	// max esit payload = packet size (for isochronous endpoints)
 	auto tr_ptr = _transferRings[endpointId - 1]->getPtr();
 	printf("xhci: tr ptr = %016lx\n", tr_ptr);
 	assert(!(tr_ptr & 0xF));
-	inputCtx->endpointContext[endpointId - 1].val[1] = (3 << 1) | (getHcdEndpointType(dir, type) << 3) | (maxPacketSize << 16);
+
+	uint32_t errorCount = 3;
+	uint32_t intervalExp = 0;
+	uint32_t maxEsitPayload = 0;
+	if (type == EndpointType::isochronous) {
+		// bInterval is 2^(bInterval - 1) (micro)frames, xHCI uses 2^Interval microframes.
+		intervalExp = std::clamp(interval, 1, 16) - 1 + (_isFullSpeed ? 3 : 0);
+		intervalExp = std::min(intervalExp, uint32_t{15});
+		errorCount = 0;
+		maxEsitPayload = maxPacketSize;
+	}
+
+	inputCtx->endpointContext[endpointId - 1].val[0] = (intervalExp << 16);
+	inputCtx->endpointContext[endpointId - 1].val[1] = (errorCount << 1) | (getHcdEndpointType(dir, type) << 3) | (maxPacketSize << 16);
 	inputCtx->endpointContext[endpointId - 1].val[2] = (1 << 0) | (tr_ptr & 0xFFFFFFF0);
 	inputCtx->endpointContext[endpointId - 1].val[3] = (tr_ptr >> 32);
-	inputCtx->endpointContext[endpointId - 1].val[4] = maxPacketSize * 2;
+	inputCtx->endpointContext[endpointId - 1].val[4] = (maxEsitPayload << 16) | (maxPacketSize * 2);
 
 	uintptr_t in_ctx_ptr;
 	HEL_CHECK(helPointerPhysical(inputCtx.data(), &in_ctx_ptr));
@@ -1285,27 +1441,9 @@ Controller::EndpointState::transfer(InterruptTransfer info) {
 
 	Controller::TransferRing::TransferEvent ev;
 
-	size_t progress = 0;
-	while(progress < info.buffer.size()) {
-		uintptr_t pptr, ptr = (uintptr_t)info.buffer.data() + progress;
-		HEL_CHECK(helPointerPhysical((void *)ptr, &pptr));
-
-		auto chunk = std::min(info.buffer.size() - progress, 0x1000 - (ptr & 0xFFF));
-
-		bool is_last = (progress + chunk) >= info.buffer.size();
-
-		RawTrb transfer = {{
-			static_cast<uint32_t>(pptr & 0xFFFFFFFF),
-			static_cast<uint32_t>(pptr >> 32),
-			static_cast<uint32_t>(chunk),
-			(!is_last << 4) | (1 << 2) | (is_last << 5)
-				| (static_cast<uint32_t>(TrbType::normal) << 10)}};
-
-		_device->pushRawTransfer(endpointId - 1, transfer, is_last ? &ev : nullptr);
-
-		progress += chunk;
-	}
-
+	// Interrupt on short packet.
+	co_await _device->reserveTrbs(endpointId - 1, countTrbs(info.buffer));
+	_device->pushNormalTransfers(endpointId - 1, info.buffer, 1 << 2, &ev);
 	_device->submit(endpointId);
 
 	co_await ev.completion.wait();
@@ -1321,27 +1459,9 @@ Controller::EndpointState::transfer(BulkTransfer info) {
 
 	Controller::TransferRing::TransferEvent ev;
 
-	size_t progress = 0;
-	while(progress < info.buffer.size()) {
-		uintptr_t pptr, ptr = (uintptr_t)info.buffer.data() + progress;
-		HEL_CHECK(helPointerPhysical((void *)ptr, &pptr));
-
-		auto chunk = std::min(info.buffer.size() - progress, 0x1000 - (ptr & 0xFFF));
-
-		bool is_last = (progress + chunk) >= info.buffer.size();
-
-		RawTrb transfer = {{
-			static_cast<uint32_t>(pptr & 0xFFFFFFFF),
-			static_cast<uint32_t>(pptr >> 32),
-			static_cast<uint32_t>(chunk),
-			(!is_last << 4) | (1 << 2) | (is_last << 5)
-				| (static_cast<uint32_t>(TrbType::normal) << 10)}};
-
-		_device->pushRawTransfer(endpointId - 1, transfer, is_last ? &ev : nullptr);
-
-		progress += chunk;
-	}
-
+	// Interrupt on short packet.
+	co_await _device->reserveTrbs(endpointId - 1, countTrbs(info.buffer));
+	_device->pushNormalTransfers(endpointId - 1, info.buffer, 1 << 2, &ev);
 	_device->submit(endpointId);
 
 	co_await ev.completion.wait();
@@ -1355,6 +1475,71 @@ Controller::EndpointState::transfer(BulkTransfer info) {
 	co_return info.buffer.size() - ev.event.transferLen;
 }
 
+async::result<frg::expected<UsbError, std::vector<IsochronousPacket>>>
+Controller::EndpointState::transfer(IsochronousTransfer info) {
+	int endpointId = _endpoint * 2 + (_type == PipeType::in ? 1 : 0);
+
+	// We do not program bursts; each packet must fit into a single USB packet.
+	assert(info.packetSize);
+	assert(info.packetSize <= _device->_maxPacketSizes[endpointId - 1]);
+
+	auto numPackets = info.numPackets();
+	auto events = std::make_unique<Controller::TransferRing::TransferEvent[]>(numPackets);
+
+	// Each packet is a separate TD, such that we get a completion code per packet.
+	// If the ring fills up, reserveTrbs() starts the TDs that were pushed before.
+	for (size_t i = 0; i < numPackets; i++) {
+		auto offset = i * info.packetSize;
+		auto packet = info.buffer.subview(offset,
+				std::min(info.packetSize, info.buffer.size() - offset));
+
+		co_await _device->reserveTrbs(endpointId - 1, countTrbs(packet));
+		// Interrupt on short packet.
+		_device->pushIsochTransfer(endpointId - 1, packet, 1 << 2, &events[i]);
+	}
+	_device->submit(endpointId);
+
+	std::vector<IsochronousPacket> packets;
+	packets.reserve(numPackets);
+	for (size_t i = 0; i < numPackets; i++) {
+		auto &ev = events[i];
+		co_await ev.completion.wait();
+
+		auto offset = i * info.packetSize;
+		auto size = std::min(info.packetSize, info.buffer.size() - offset);
+
+		// The residual is exact as long as the TD consists of a single TRB, which is
+		// the case unless the packet crosses a 64 KiB or page boundary.
+		size_t length = 0;
+		if (ev.event.completionCode == 1 || ev.event.completionCode == 13)
+			length = size - std::min(size, ev.event.transferLen);
+
+		UsbError status;
+		switch (ev.event.completionCode) {
+			case 1: // Success.
+			case 13: // Short packet.
+				status = UsbError::none;
+				break;
+			case 3:
+				status = UsbError::babble;
+				break;
+			case 6:
+				status = UsbError::stall;
+				break;
+			case 23:
+				status = UsbError::missedService;
+				break;
+			default:
+				printf("xhci: isochronous packet completed with %s\n",
+						completionCodeNames[ev.event.completionCode]);
+				status = UsbError::transactionError;
+		}
+		packets.push_back({status, length});
+	}
+
+	co_return packets;
+}
+
 // ------------------------------------------------------------------------
 // Freestanding PCI discovery functions.
 // ------------------------------------------------------------------------
@@ -1379,7 +1564,7 @@ async::detached bindController(mbus::Entity entity) {
 	helix::Mapping mapping{bar, info.barInfo[0].offset, info.barInfo[0].length};
 
 	auto controller = std::make_shared<Controller>(std::move(device), std::move(mapping),
-			std::move(bar), std::move(irq), info.numMsis > 0);
+			std::move(bar), std::move(irq), info.numMsis);
 	controller->initialize();
 	globalControllers.push_back(std::move(controller));
 }
@@ -19,11 +19,11 @@ struct Controller : std::enable_shared_from_this<Controller> {
 	Controller(protocols::hw::Device hw_device,
 			helix::Mapping mapping,
 			helix::UniqueDescriptor mmio,
-			helix::UniqueIrq irq, bool useMsis);
+			helix::UniqueIrq irq, unsigned int numMsis);
 
 	async::detached initialize();
 	async::detached handleIrqs();
-	async::detached handleMsis();
+	async::detached handleMsis(size_t index);
 
 private:
 	struct Event {
@@ -104,14 +104,15 @@ private:
 
 		static_assert(sizeof(ErstEntry) == 64, "invalid ErstEntry size");
 
-		EventRing(Controller *controller);
+		EventRing(Controller *controller, int interrupter);
 		uintptr_t getErstPtr();
 		uintptr_t getEventRingPtr();
 		size_t getErstSize();
 
+		// Processes all events up to the first one that the controller did not
+		// write yet; ERDP is only updated once at the end.
 		void processRing();
 
-		std::deque<Event> _dequeuedEvents;
 		async::recurring_event _doorbell;
 	private:
 		arch::dma_object<EventRingEntries> _eventRing;
@@ -121,6 +122,7 @@ private:
 
 		size_t _dequeuePtr;
 		Controller *_controller;
+		int _interrupter;
 
 		int _ccs;
 	};
@@ -142,11 +144,23 @@ private:
 
 		void pushRawTransfer(RawTrb cmd, TransferEvent *ev = nullptr);
 
+		// Number of TRBs that can be pushed without overwriting TRBs that
+		// the controller did not retire yet.
+		size_t freeTrbs();
+		async::result<void> awaitFreeTrbs(size_t count);
+
+		// Called for each transfer event; current is the TRB that the event refers to.
 		void updateDequeue(int current);
-		void updateLink();
+		// Completes the TDs that the controller skipped after a missed service
+		// error on an isochronous endpoint (i.e., all TDs before current).
+		void retireMissed(int current);
+		// The chain bit must be set if the link TRB is in the middle of a TD.
+		void updateLink(bool chain);
 
 		std::array<TransferEvent *, transferRingSize> _transferEvents;
+		bool _missedService = false;
 	private:
+		async::recurring_event _retireDoorbell;
 		arch::dma_object<TransferRingEntries> _transferRing;
 		size_t _dequeuePtr;
 		size_t _enqueuePtr;
@@ -216,15 +230,29 @@ private:
 
 		void submit(int endpoint);
 		void pushRawTransfer(int endpoint, RawTrb cmd, TransferRing::TransferEvent *ev = nullptr);
+		// Pushes a TD of Normal TRBs for the buffer. Physically contiguous pages
+		// are merged into a single TRB (up to the next 64 KiB boundary).
+		void pushNormalTransfers(int endpoint, arch::dma_buffer_view buffer,
+				uint32_t flags, TransferRing::TransferEvent *ev);
+		// Pushes a TD that transfers the buffer as a single isochronous packet.
+		void pushIsochTransfer(int endpoint, arch::dma_buffer_view buffer,
+				uint32_t flags, TransferRing::TransferEvent *ev);
+		// Waits until the transfer ring of the endpoint has room for the given number
+		// of TRBs. Rings the doorbell first if it has to wait.
+		async::result<void> reserveTrbs(int endpoint, size_t count);
 		async::result<void> allocSlot(int slotType, int packetSize);
 
 		async::result<void> readDescriptor(arch::dma_buffer_view dest, uint16_t desc);
 
 		std::array<std::unique_ptr<TransferRing>, 31> _transferRings;
+		std::array<size_t, 31> _maxPacketSizes{};
 
 		int _slotId;
+		bool _isFullSpeed = false;
 
-		async::result<void> setupEndpoint(int endpoint, PipeType dir, size_t maxPacketSize, EndpointType type, bool drop = false);
+		// interval is the bInterval field of the endpoint descriptor.
+		async::result<void> setupEndpoint(int endpoint, PipeType dir, size_t maxPacketSize,
+				EndpointType type, int interval = 0, bool drop = false);
 
 	private:
 		int _portId;
@@ -288,6 +316,8 @@ private:
 		async::result<frg::expected<UsbError>> transfer(ControlTransfer info) override;
 		async::result<frg::expected<UsbError, size_t>> transfer(InterruptTransfer info) override;
 		async::result<frg::expected<UsbError, size_t>> transfer(BulkTransfer info) override;
+		async::result<frg::expected<UsbError, std::vector<IsochronousPacket>>>
+		transfer(IsochronousTransfer info) override;
 
 	private:
 		std::shared_ptr<Device> _device;
@@ -321,11 +351,21 @@ private:
 	std::array<std::shared_ptr<Device>, 256> _devices;
 
 	CommandRing _cmdRing;
-	EventRing _eventRing;
+	// One event ring per interrupter that we use. Command completion and port
+	// status change events always go to the first one.
+	std::vector<std::unique_ptr<EventRing>> _eventRings;
+	// IRQs of the interrupters other than the first one.
+	std::vector<helix::UniqueIrq> _extraMsis;
+
+	// Interrupter that receives the transfer events of a device.
+	int interrupterOf(int slotId) {
+		return slotId % _eventRings.size();
+	}
 
 	int _numPorts;
 	int _maxDeviceSlots;
 
+	unsigned int _numMsis;
 	bool _useMsis;
 };
 
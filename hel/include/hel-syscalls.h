@@ -206,6 +206,35 @@ extern inline __attribute__ (( always_inline )) HelError helUnmapMemory(HelHandl
 	return helSyscall3(kHelCallUnmapMemory, (HelWord)space, (HelWord)pointer, (HelWord)size);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helRemapMemory(HelHandle handle,
+		HelHandle space, void *pointer, size_t size, size_t new_size, uint32_t flags,
+		void **new_pointer) {
+	HelWord out_ptr;
+	HelError error = helSyscall6_1(kHelCallRemapMemory, (HelWord)handle, (HelWord)space,
+			(HelWord)pointer, (HelWord)size, (HelWord)new_size, (HelWord)flags, &out_ptr);
+	*new_pointer = (void *)out_ptr;
+	return error;
+};
+
+extern inline __attribute__ (( always_inline )) HelError helQuerySpaceStats(HelHandle space,
+		struct HelSpaceStats *stats) {
+	return helSyscall2(kHelCallQuerySpaceStats, (HelWord)space, (HelWord)stats);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helMapDmaSpace(HelHandle space,
+		HelHandle memory, uintptr_t offset, size_t size, uint32_t flags, uint64_t *iova) {
+	HelWord out_iova;
+	HelError error = helSyscall5_1(kHelCallMapDmaSpace, (HelWord)space, (HelWord)memory,
+			(HelWord)offset, (HelWord)size, (HelWord)flags, &out_iova);
+	*iova = out_iova;
+	return error;
+};
+
+extern inline __attribute__ (( always_inline )) HelError helUnmapDmaSpace(HelHandle space,
+		uint64_t iova, size_t size) {
+	return helSyscall3(kHelCallUnmapDmaSpace, (HelWord)space, (HelWord)iova, (HelWord)size);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSubmitSynchronizeSpace(
 		HelHandle space, void *pointer, size_t size,
 		HelHandle queue, uintptr_t context) {
@@ -268,6 +297,51 @@ extern inline __attribute__ (( always_inline )) HelError helLoadahead(HelHandle
 	return helSyscall3(kHelCallLoadahead, (HelWord)handle, (HelWord)offset, (HelWord)length);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helAdviseMemory(HelHandle handle,
+		uintptr_t offset, size_t length, int advice) {
+	return helSyscall4(kHelCallAdviseMemory, (HelWord)handle, (HelWord)offset,
+			(HelWord)length, (HelWord)advice);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helDiscardMemory(HelHandle handle,
+		uintptr_t offset, size_t length, uint32_t flags) {
+	return helSyscall4(kHelCallDiscardMemory, (HelWord)handle, (HelWord)offset,
+			(HelWord)length, (HelWord)flags);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helCreateMemoryAccount(size_t softLimit,
+		size_t hardLimit, HelHandle *handle) {
+	HelWord handle_word;
+	HelError error = helSyscall2_1(kHelCallCreateMemoryAccount, (HelWord)softLimit,
+			(HelWord)hardLimit, &handle_word);
+	*handle = (HelHandle)handle_word;
+	return error;
+};
+
+extern inline __attribute__ (( always_inline )) HelError helSetMemoryAccount(HelHandle universe,
+		HelHandle account) {
+	return helSyscall2(kHelCallSetMemoryAccount, (HelWord)universe, (HelWord)account);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helQueryMemoryAccount(HelHandle handle,
+		struct HelMemoryAccountInfo *info) {
+	return helSyscall2(kHelCallQueryMemoryAccount, (HelWord)handle, (HelWord)info);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helAccessMemoryPressure(HelHandle *handle) {
+	HelWord handle_word;
+	HelError error = helSyscall0_1(kHelCallAccessMemoryPressure, &handle_word);
+	*handle = (HelHandle)handle_word;
+	return error;
+};
+
+extern inline __attribute__ (( always_inline )) HelError helQueryMemoryPressure(int *level) {
+	HelWord level_word;
+	HelError error = helSyscall0_1(kHelCallQueryMemoryPressure, &level_word);
+	*level = (int)level_word;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helCreateThread(HelHandle universe,
 		HelHandle address_space, HelAbi abi, void *ip, void *sp, uint32_t flags,
 		HelHandle *handle) {
@@ -292,6 +366,12 @@ extern inline __attribute__ (( always_inline )) HelError helSetPriority(HelHandl
 	return helSyscall2(kHelCallSetPriority, (HelWord)handle, (HelWord)priority);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSetSchedulingPolicy(HelHandle handle,
+		int policy, int rtPriority) {
+	return helSyscall3(kHelCallSetSchedulingPolicy, (HelWord)handle, (HelWord)policy,
+			(HelWord)rtPriority);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSubmitObserve(HelHandle handle,
 		uint64_t in_seq, HelHandle queue, uintptr_t context) {
 	return helSyscall4(kHelCallSubmitObserve, (HelWord)handle, (HelWord)in_seq,
@@ -340,6 +420,11 @@ extern inline __attribute__ (( always_inline )) HelError helSubmitAwaitClock(uin
 	return error;
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSetTimerSlack(HelHandle handle,
+		uint64_t slack) {
+	return helSyscall2(kHelCallSetTimerSlack, (HelWord)handle, (HelWord)slack);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helCreateStream(HelHandle *lane1,
 		HelHandle *lane2) {
 	HelWord out_lane1;
@@ -357,6 +442,15 @@ extern inline __attribute__ (( always_inline )) HelError helSubmitAsync(HelHandl
 			(HelWord)queue, (HelWord)context, (HelWord)flags);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSubmitBatch(
+		const struct HelSubmission *submissions, size_t count, size_t *numSubmitted) {
+	HelWord outNumSubmitted;
+	HelError error = helSyscall2_1(kHelCallSubmitBatch,
+			(HelWord)submissions, (HelWord)count, &outNumSubmitted);
+	*numSubmitted = (size_t)outNumSubmitted;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helShutdownLane(HelHandle handle) {
 	return helSyscall1(kHelCallShutdownLane, (HelWord)handle);
 };
@@ -371,6 +465,28 @@ extern inline __attribute__ (( always_inline )) HelError helFutexWake(int *point
 	return helSyscall1(kHelCallFutexWake, (HelWord)pointer);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helFutexRequeue(int *pointer,
+		int expected, int *target, unsigned int wakeCount, unsigned int requeueCount) {
+	return helSyscall5(kHelCallFutexRequeue, (HelWord)pointer, (HelWord)expected,
+			(HelWord)target, (HelWord)wakeCount, (HelWord)requeueCount);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helGetFutexOwnerId(unsigned int *id) {
+	HelWord id_word;
+	HelError error = helSyscall0_1(kHelCallGetFutexOwnerId, &id_word);
+	*id = (unsigned int)id_word;
+	return error;
+};
+
+extern inline __attribute__ (( always_inline )) HelError helFutexLockPi(int *pointer,
+		int64_t deadline) {
+	return helSyscall2(kHelCallFutexLockPi, (HelWord)pointer, (HelWord)deadline);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helFutexUnlockPi(int *pointer) {
+	return helSyscall1(kHelCallFutexUnlockPi, (HelWord)pointer);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helCreateOneshotEvent(HelHandle *handle) {
 	HelWord handle_word;
 	HelError error = helSyscall0_1(kHelCallCreateOneshotEvent, &handle_word);
@@ -403,6 +519,11 @@ extern inline __attribute__ (( always_inline )) HelError helAcknowledgeIrq(HelHa
 			(HelWord)sequence);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSetIrqAffinity(HelHandle handle,
+		int cpu) {
+	return helSyscall2(kHelCallSetIrqAffinity, (HelWord)handle, (HelWord)cpu);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSubmitAwaitEvent(HelHandle handle,
 		uint64_t sequence, HelHandle queue, uintptr_t context) {
 	return helSyscall4(kHelCallSubmitAwaitEvent, (HelWord)handle, (HelWord)sequence,
@@ -16,7 +16,7 @@
 
 enum {
 	// largest system call number plus 1
-	kHelNumCalls = 103,
+	kHelNumCalls = 122,
 
 	kHelCallLog = 1,
 	kHelCallPanic = 10,
@@ -47,6 +47,10 @@ enum {
 	kHelCallSubmitProtectMemory = 99,
 	kHelCallSubmitSynchronizeSpace = 53,
 	kHelCallUnmapMemory = 36,
+	kHelCallRemapMemory = 121,
+	kHelCallQuerySpaceStats = 113,
+	kHelCallMapDmaSpace = 114,
+	kHelCallUnmapDmaSpace = 115,
 	kHelCallPointerPhysical = 43,
 	kHelCallSubmitReadMemory = 77,
 	kHelCallSubmitWriteMemory = 78,
@@ -55,11 +59,21 @@ enum {
 	kHelCallUpdateMemory = 47,
 	kHelCallSubmitLockMemoryView = 48,
 	kHelCallLoadahead = 49,
+	kHelCallAdviseMemory = 104,
+	kHelCallDiscardMemory = 120,
+	kHelCallCreateMemoryAccount = 105,
+	kHelCallSetMemoryAccount = 106,
+	kHelCallQueryMemoryAccount = 107,
+	kHelCallAccessMemoryPressure = 108,
+	kHelCallQueryMemoryPressure = 109,
+	kHelCallSetTimerSlack = 110,
+	kHelCallSetIrqAffinity = 111,
 	kHelCallCreateVirtualizedSpace = 50,
 
 	kHelCallCreateThread = 67,
 	kHelCallQueryThreadStats = 95,
 	kHelCallSetPriority = 85,
+	kHelCallSetSchedulingPolicy = 119,
 	kHelCallYield = 34,
 	kHelCallSubmitObserve = 74,
 	kHelCallKillThread = 87,
@@ -77,10 +91,15 @@ enum {
 
 	kHelCallCreateStream = 68,
 	kHelCallSubmitAsync = 79,
+	kHelCallSubmitBatch = 112,
 	kHelCallShutdownLane = 91,
 
 	kHelCallFutexWait = 73,
 	kHelCallFutexWake = 71,
+	kHelCallFutexRequeue = 103,
+	kHelCallGetFutexOwnerId = 116,
+	kHelCallFutexLockPi = 117,
+	kHelCallFutexUnlockPi = 118,
 
 	kHelCallCreateOneshotEvent = 96,
 	kHelCallCreateBitsetEvent = 97,
@@ -192,6 +211,20 @@ enum {
 	kHelAbiSystemV = 1
 };
 
+//! Scheduling policies for ::helSetSchedulingPolicy.
+enum {
+	//! Fair share scheduling according to the thread's priority (the default).
+	kHelSchedFair = 0,
+	//! Real-time scheduling; runs until the thread blocks or is preempted by a
+	//! real-time thread of higher priority.
+	kHelSchedFifo = 1,
+	//! Like ::kHelSchedFifo but yields to threads of equal priority after each time slice.
+	kHelSchedRoundRobin = 2
+};
+
+//! Maximal real-time priority for ::helSetSchedulingPolicy.
+static const int kHelMaxRealtimePriority = 99;
+
 enum {
 	kHelActionDismiss = 11,
 	kHelActionOffer = 5,
@@ -203,13 +236,22 @@ enum {
 	kHelActionRecvInline = 7,
 	kHelActionRecvToBuffer = 3,
 	kHelActionPushDescriptor = 2,
-	kHelActionPullDescriptor = 4
+	kHelActionPullDescriptor = 4,
+	//! Pushes HelAction::length handles from the array at HelAction::buffer.
+	//! Must be matched by ::kHelActionPullDescriptors.
+	kHelActionPushDescriptors = 12,
+	//! Pulls up to HelAction::length handles; the result is a HelHandlesResult.
+	kHelActionPullDescriptors = 13
 };
 
+//! Maximal number of handles of ::kHelActionPushDescriptors and ::kHelActionPullDescriptors.
+static const size_t kHelMaxDescriptorsPerAction = 1024;
+
 enum {
 	kHelItemChain = 1,
 	kHelItemAncillary = 2,
 	kHelItemWantLane = (1 << 16),
+	kHelItemDirect = (1 << 17),
 };
 
 struct HelSgItem {
@@ -226,6 +268,17 @@ struct HelAction {
 	HelHandle handle;
 };
 
+//! One element of helSubmitBatch().
+//! The fields correspond to the arguments of helSubmitAsync().
+struct HelSubmission {
+	HelHandle handle;
+	const struct HelAction *actions;
+	size_t count;
+	HelHandle queue;
+	uintptr_t context;
+	uint32_t flags;
+};
+
 enum {
 	kHelDescMemory = 1,
 	kHelDescAddressSpace = 2,
@@ -242,16 +295,75 @@ struct HelDescriptorInfo {
 enum HelAllocFlags {
 	kHelAllocContinuous = 4,
 	kHelAllocOnDemand = 1,
+	//! Only allocate physical memory from the NUMA node given in HelAllocRestrictions::numaNode.
+	kHelAllocNodeBound = 8,
+	//! Back the memory by naturally aligned 2 MiB chunks so that it can be mapped using huge pages.
+	//! Ignored if the size is not a multiple of 2 MiB.
+	kHelAllocHuge = 16,
 };
 
 struct HelAllocRestrictions {
 	int addressBits;
+	int numaNode;
 };
 
 enum HelManagedFlags {
 	kHelManagedReadahead = 1
 };
 
+enum HelMemoryAdvice {
+	kHelAdviseNormal = 0,
+	kHelAdviseRandom = 1,
+	kHelAdviseSequential = 2,
+	kHelAdviseWillNeed = 3,
+	kHelAdviseMergeable = 4,
+	kHelAdviseUnmergeable = 5
+};
+
+enum HelDiscardFlags {
+	kHelDiscardLazy = 1
+};
+
+//! System-wide memory pressure levels.
+//! Bit (1 << level) of the memory pressure event is raised when the pressure changes to level.
+enum HelMemoryPressure {
+	kHelMemoryPressureNone = 0,
+	kHelMemoryPressureLow = 1,
+	kHelMemoryPressureMedium = 2,
+	kHelMemoryPressureCritical = 3
+};
+
+//! Bits of the event of a memory account.
+enum HelMemoryAccountEvents {
+	//! The usage of the account exceeded its soft limit.
+	kHelMemoryAccountSoftLimit = 1,
+	//! An allocation failed since it would exceed the hard limit.
+	kHelMemoryAccountHardLimit = 2
+};
+
+struct HelMemoryAccountInfo {
+	size_t usage;
+	size_t softLimit;
+	size_t hardLimit;
+};
+
+//! Memory statistics of an address space.
+//! All sizes are in bytes.
+//! The kernel updates these values whenever it changes page tables;
+//! hence, querying them is cheap.
+struct HelSpaceStats {
+	//! Total length of all mappings.
+	uint64_t mappedSize;
+	//! Resident memory of copy-on-write mappings (e.g., private anonymous memory).
+	uint64_t anonymousRss;
+	//! Resident memory of managed memory objects (e.g., the page cache of files).
+	uint64_t fileRss;
+	//! Resident memory of memory objects that were created by ::helAllocateMemory.
+	uint64_t sharedRss;
+	//! Memory that is used for page tables.
+	uint64_t pageTableSize;
+};
+
 enum HelManageRequests {
 	kHelManageInitialize = 1,
 	kHelManageWriteback = 2
@@ -262,7 +374,23 @@ enum HelMapFlags {
 	kHelMapProtRead = 256,
 	kHelMapProtWrite = 512,
 	kHelMapProtExecute = 1024,
-	kHelMapDontRequireBacking = 128
+	kHelMapDontRequireBacking = 128,
+	//! Fetch and map all pages of the mapping before returning.
+	kHelMapPopulate = 2048,
+
+	// Caching attributes; at most one of them may be set.
+	// Without any of them, the caching attributes of the memory object are used
+	// (i.e., write-back for RAM).
+	kHelMapCacheWriteBack = 4096,
+	kHelMapCacheWriteCombine = 8192,
+	kHelMapCacheWriteThrough = 12288,
+	kHelMapCacheUncached = 16384,
+	kHelMapCacheMask = 28672
+};
+
+enum HelRemapFlags {
+	//! Allow the kernel to move the mapping if it cannot be grown in place.
+	kHelRemapMayMove = 1
 };
 
 enum HelThreadFlags {
@@ -408,6 +536,13 @@ struct HelQueueParameters {
 	size_t chunkSize;
 };
 
+//! Mask to extract the owner's ID from the word of a priority inheritance futex.
+static const int kHelFutexPiOwnerMask = 0x3FFFFFFF;
+
+//! Set by the kernel if a priority inheritance futex has waiters.
+//! The owner must call ::helFutexUnlockPi to release such a futex.
+static const int kHelFutexPiWaiters = (1 << 30);
+
 //! Mask to extract the current queue head.
 static const int kHelHeadMask = 0xFFFFFF;
 
@@ -492,6 +627,19 @@ struct HelInlineResultNoFlex {
 	size_t length;
 };
 
+struct HelHandlesResult {
+	HelError error;
+	int reserved;
+	size_t count;
+	HelHandle handles[];
+};
+
+struct HelHandlesResultNoFlex {
+	HelError error;
+	int reserved;
+	size_t count;
+};
+
 struct HelLengthResult {
 	HelError error;
 	int reserved;
@@ -527,7 +675,25 @@ union HelKernletData {
 };
 
 struct HelThreadStats {
+	//! Time (in nanoseconds) that the thread ran in user mode.
 	uint64_t userTime;
+	//! Time (in nanoseconds) that the thread ran in syscalls and page fault handlers.
+	uint64_t kernelTime;
+	//! Time (in nanoseconds) that the thread was runnable but waited for a CPU.
+	uint64_t waitTime;
+	//! Number of times that the thread blocked.
+	uint64_t voluntarySwitches;
+	//! Number of times that the thread was preempted.
+	uint64_t involuntarySwitches;
+	//! Page faults that were resolved without blocking.
+	uint64_t minorFaults;
+	//! Page faults that had to block (e.g., on a managed memory object).
+	uint64_t majorFaults;
+	//! Number of helSubmitAsync() calls.
+	uint64_t ipcSubmissions;
+	//! CPU that the thread was last scheduled on, or -1.
+	int32_t lastCpu;
+	uint32_t reserved;
 };
 
 enum {
@@ -634,6 +800,8 @@ HEL_C_LINKAGE HelError helCancelAsync(HelHandle queueHandle, uint64_t asyncId);
 //! @param[in] restrictions
 //!    	Specifies restrictions for the kernel's memory allocator.
 //!    	May be @p NULL if there are no restrictions.
+//!    	By default, memory is taken from the NUMA node of the faulting CPU
+//!    	(with fallback to other nodes); pass ::kHelAllocNodeBound to bind it to a node.
 //! @param[out] handle
 //!    	Handle to the new memory object.
 HEL_C_LINKAGE HelError helAllocateMemory(size_t size, uint32_t flags,
@@ -703,6 +871,20 @@ HEL_C_LINKAGE HelError helCreateIndirectMemory(size_t numSlots, HelHandle *handl
 HEL_C_LINKAGE HelError helAlterMemoryIndirection(HelHandle indirectHandle, size_t slotIndex,
 		HelHandle memoryHandle, uintptr_t offset, size_t size);
 
+//! Creates a view of a part of a memory object.
+//! @param[in] bundle
+//!    	Handle to the memory object.
+//! @param[in] offset
+//!    	Offset in bytes, relative to @p bundle.
+//!    	Must be aligned to the system's page size.
+//! @param[in] size
+//!    	Size of the view in bytes.
+//!    	Must be aligned to the system's page size.
+//! @param[in] flags
+//!    	One of the caching attributes (e.g., ::kHelMapCacheWriteCombine) or zero.
+//!    	If set, mappings of the view use these attributes unless they specify their own.
+//! @param[out] handle
+//!    	Handle to the new view.
 HEL_C_LINKAGE HelError helCreateSliceView(HelHandle bundle, uintptr_t offset, size_t size,
 		uint32_t flags, HelHandle *handle);
 
@@ -734,6 +916,10 @@ HEL_C_LINKAGE HelError helCreateSpace(HelHandle *handle);
 //! @param[in] size
 //!    	Size of the mappping in bytes.
 //!    	Must be aligned to the system's page size.
+//! @param[in] flags
+//!    	Protection flags (e.g., ::kHelMapProtRead), ::kHelMapDontRequireBacking,
+//!    	::kHelMapPopulate and at most one of the caching attributes
+//!    	(e.g., ::kHelMapCacheWriteCombine for framebuffers).
 //! @param[out] actualPointer
 //!    	Pointer to which the memory is mapped.
 //!     Differs from @p pointer only if @p pointer was specified as @p NULL.
@@ -786,6 +972,78 @@ HEL_C_LINKAGE HelError helSubmitSynchronizeSpace(HelHandle spaceHandle,
 //!    	Must be aligned to the system's page size.
 HEL_C_LINKAGE HelError helUnmapMemory(HelHandle spaceHandle, void *pointer, size_t size);
 
+//! Changes the size of a mapping and/or moves it within its address space.
+//!
+//! The mapping keeps referring to the same memory object; its pages are not copied.
+//! If the mapping is moved, the page table entries are transferred to the new
+//! address and the old range is unmapped.
+//! Shrinking a mapping unmaps the tail of the mapping.
+//! @param[in] memoryHandle
+//!     Handle to the memory object of the mapping, or ::kHelNullHandle.
+//!     If a handle is given, the mapping can grow up to the current size of
+//!     the memory object (e.g., after helResizeMemory()). Otherwise, it can only
+//!     grow within the range of the memory object that was visible to helMapMemory().
+//! @param[in] spaceHandle
+//!     Handle to the address space containing @p pointer.
+//! @param[in] pointer
+//!     Pointer to the mapping. Must be aligned to the system's page size.
+//!     The range given by @p pointer and @p size must be covered by
+//!     exactly one mapping (i.e., it cannot span the results of multiple
+//!     helMapMemory() calls).
+//! @param[in] size
+//!     Current size of the mapping. Must be aligned to the system's page size.
+//! @param[in] newSize
+//!     Requested size of the mapping. Must be aligned to the system's page size.
+//! @param[in] flags
+//!     Combination of ::HelRemapFlags. Without ::kHelRemapMayMove,
+//!     this fails with ::kHelErrNoMemory if the mapping cannot be grown in place.
+//! @param[out] newPointer
+//!     Address of the mapping after the call.
+HEL_C_LINKAGE HelError helRemapMemory(HelHandle memoryHandle, HelHandle spaceHandle,
+		void *pointer, size_t size, size_t newSize, uint32_t flags, void **newPointer);
+
+//! Queries memory statistics of an address space.
+//!
+//! @param[in] spaceHandle
+//!     Handle to the address space.
+//!     If this is ::kHelNullHandle, the current address space is queried.
+//! @param[out] stats
+//!     Statistics of the address space.
+HEL_C_LINKAGE HelError helQuerySpaceStats(HelHandle spaceHandle, struct HelSpaceStats *stats);
+
+//! Maps memory into the IO address space of a device.
+//!
+//! DMA spaces are obtained from the hardware protocol of a device that is
+//! behind an IOMMU. The device can only access memory that is mapped into its DMA space.
+//! Mapped memory stays locked (i.e., it is not evicted) until it is unmapped again.
+//! @param[in] spaceHandle
+//!     Handle to the DMA space.
+//! @param[in] memoryHandle
+//!     Handle to the memory object that is mapped.
+//! @param[in] offset
+//!     Offset of the range inside the memory object.
+//!    	Must be aligned to the system's page size.
+//! @param[in] size
+//!     Size of the range.
+//!    	Must be aligned to the system's page size.
+//! @param[in] flags
+//!     Combination of ::kHelMapProtRead and ::kHelMapProtWrite.
+//!     Without ::kHelMapProtWrite, the device can only read the memory.
+//! @param[out] iova
+//!     IO virtual address that the device uses to access the range.
+HEL_C_LINKAGE HelError helMapDmaSpace(HelHandle spaceHandle, HelHandle memoryHandle,
+		uintptr_t offset, size_t size, uint32_t flags, uint64_t *iova);
+
+//! Unmaps memory from the IO address space of a device.
+//!
+//! @param[in] spaceHandle
+//!     Handle to the DMA space.
+//! @param[in] iova
+//!     IO virtual address that was returned by ::helMapDmaSpace.
+//! @param[in] size
+//!     Size that was passed to ::helMapDmaSpace.
+HEL_C_LINKAGE HelError helUnmapDmaSpace(HelHandle spaceHandle, uint64_t iova, size_t size);
+
 HEL_C_LINKAGE HelError helPointerPhysical(const void *pointer, uintptr_t *physical);
 
 //! Load memory (i.e., bytes) from a descriptor.
@@ -841,6 +1099,89 @@ HEL_C_LINKAGE HelError helSubmitLockMemoryView(HelHandle handle, uintptr_t offse
 //!     Length of the memory range that is preloaded.
 HEL_C_LINKAGE HelError helLoadahead(HelHandle handle, uintptr_t offset, size_t length);
 
+//! Notifies the kernel about the expected access pattern of a memory object.
+//!
+//! Like helLoadahead(), this is purely a performance hint. For managed memory,
+//! it controls readahead: ::kHelAdviseRandom disables it, ::kHelAdviseSequential
+//! uses large readahead windows and ::kHelAdviseWillNeed preloads the range.
+//! For copy-on-write memory, ::kHelAdviseMergeable allows the kernel to merge
+//! pages with identical contents (and ::kHelAdviseUnmergeable disallows it again);
+//! this applies to the entire memory object.
+//! @param[in] handle
+//!     Handle to the memory object.
+//! @param[in] offset
+//!     Offset in bytes, relative to @p handle.
+//! @param[in] length
+//!     Length of the memory range that the advice applies to.
+//! @param[in] advice
+//!     One of the values of ::HelMemoryAdvice.
+HEL_C_LINKAGE HelError helAdviseMemory(HelHandle handle, uintptr_t offset, size_t length,
+		int advice);
+
+//! Drops the pages of a range of a copy-on-write memory object.
+//!
+//! Afterwards, the range reads as the memory that the object was created from
+//! (i.e., as zeros for copies of ::kHelZeroMemory). The range is unmapped from all
+//! address spaces with a single TLB shootdown per mapping. Pages that are locked
+//! (e.g., by helSubmitLockMemoryView()) keep their contents.
+//! With ::kHelDiscardLazy, pages are only dropped once the kernel needs to reclaim
+//! memory; pages that are accessed again before that keep their contents.
+//! This corresponds to MADV_FREE while the default corresponds to MADV_DONTNEED.
+//! @param[in] handle
+//!     Handle to the memory object.
+//! @param[in] offset
+//!     Offset in bytes, relative to @p handle. Must be page-aligned.
+//! @param[in] length
+//!     Length of the range in bytes. Must be page-aligned.
+//! @param[in] flags
+//!     Combination of ::HelDiscardFlags.
+HEL_C_LINKAGE HelError helDiscardMemory(HelHandle handle, uintptr_t offset, size_t length,
+		uint32_t flags);
+
+//! Creates a memory account.
+//!
+//! Memory objects created by helAllocateMemory() and helCopyOnWrite() are charged
+//! to the account of the creating universe. Once the hard limit is reached,
+//! page faults on such objects fail with ::kHelErrNoMemory.
+//! The handle can be awaited by helSubmitAwaitEvent(); see ::HelMemoryAccountEvents.
+//! @param[in] softLimit
+//!     Usage in bytes above which ::kHelMemoryAccountSoftLimit is raised. Zero disables it.
+//! @param[in] hardLimit
+//!     Maximal usage in bytes. Zero disables the limit.
+//! @param[out] handle
+//!     Handle to the new account.
+HEL_C_LINKAGE HelError helCreateMemoryAccount(size_t softLimit, size_t hardLimit,
+		HelHandle *handle);
+
+//! Sets the memory account of a universe.
+//!
+//! Only affects memory objects that are created afterwards.
+//! Universes created by helCreateUniverse() inherit the account of their creator.
+//! @param[in] universe
+//!     Handle to the universe.
+//! @param[in] account
+//!     Handle to the account or ::kHelNullHandle to detach the current account.
+HEL_C_LINKAGE HelError helSetMemoryAccount(HelHandle universe, HelHandle account);
+
+//! Queries the usage and the limits of a memory account.
+//! @param[in] handle
+//!     Handle to the account.
+//! @param[out] info
+//!     Information about the account.
+HEL_C_LINKAGE HelError helQueryMemoryAccount(HelHandle handle,
+		struct HelMemoryAccountInfo *info);
+
+//! Returns an event that can be awaited by helSubmitAwaitEvent() to observe
+//! changes of the system-wide memory pressure (see ::HelMemoryPressure).
+//! @param[out] handle
+//!     Handle to the event.
+HEL_C_LINKAGE HelError helAccessMemoryPressure(HelHandle *handle);
+
+//! Queries the current system-wide memory pressure.
+//! @param[out] level
+//!     One of the values of ::HelMemoryPressure.
+HEL_C_LINKAGE HelError helQueryMemoryPressure(int *level);
+
 HEL_C_LINKAGE HelError helCreateVirtualizedSpace(HelHandle *handle);
 
 //! @}
@@ -880,6 +1221,20 @@ HEL_C_LINKAGE HelError helQueryThreadStats(HelHandle handle, struct HelThreadSta
 //!     New priority value of the thread.
 HEL_C_LINKAGE HelError helSetPriority(HelHandle handle, int priority);
 
+//! Set the scheduling policy of a thread.
+//!
+//! Runnable threads with a real-time policy always run before threads
+//! that use ::kHelSchedFair. Among real-time threads, higher real-time priorities
+//! take precedence; threads of equal real-time priority run in FIFO order.
+//! @param[in] handle
+//!     Handle to the thread.
+//! @param[in] policy
+//!     New scheduling policy (one of the kHelSched* constants).
+//! @param[in] rtPriority
+//!     Real-time priority between 1 and ::kHelMaxRealtimePriority.
+//!     Must be zero for ::kHelSchedFair.
+HEL_C_LINKAGE HelError helSetSchedulingPolicy(HelHandle handle, int policy, int rtPriority);
+
 //! Yields the current thread.
 HEL_C_LINKAGE HelError helYield();
 
@@ -957,6 +1312,18 @@ HEL_C_LINKAGE HelError helGetClock(uint64_t *counter);
 HEL_C_LINKAGE HelError helSubmitAwaitClock(uint64_t counter,
 		HelHandle queue, uintptr_t context, uint64_t *asyncId);
 
+//! Set the timer slack of a thread.
+//!
+//! Timers that the thread submits via ::helSubmitAwaitClock and ::helFutexWait
+//! may complete up to @p slack nanoseconds after their deadline.
+//! This lets the kernel serve timers with nearby deadlines by a single interrupt.
+//! The default slack of a thread is zero.
+//! @param[in] handle
+//!     Handle to the thread.
+//! @param[in] slack
+//!     New slack value in nanoseconds.
+HEL_C_LINKAGE HelError helSetTimerSlack(HelHandle handle, uint64_t slack);
+
 HEL_C_LINKAGE HelError helCreateVirtualizedCpu(HelHandle handle, HelHandle *out_handle);
 
 HEL_C_LINKAGE HelError helRunVirtualizedCpu(HelHandle handle, struct HelVmexitReason *reason);
@@ -994,6 +1361,19 @@ HEL_C_LINKAGE HelError helCreateStream(HelHandle *lane1, HelHandle *lane2);
 HEL_C_LINKAGE HelError helSubmitAsync(HelHandle handle, const struct HelAction *actions,
 		size_t count, HelHandle queue, uintptr_t context, uint32_t flags);
 
+//! Performs multiple helSubmitAsync() calls in a single syscall.
+//!
+//! Submissions are processed in order. Processing stops at the first
+//! submission that fails; the error of that submission is returned.
+//! @param[in] submissions
+//!     Pointer to array of submissions.
+//! @param[in] count
+//!     Number of elements in @p submissions.
+//! @param[out] numSubmitted
+//!     Number of submissions that were successfully submitted.
+HEL_C_LINKAGE HelError helSubmitBatch(const struct HelSubmission *submissions,
+		size_t count, size_t *numSubmitted);
+
 HEL_C_LINKAGE HelError helShutdownLane(HelHandle handle);
 
 //! @}
@@ -1005,7 +1385,7 @@ HEL_C_LINKAGE HelError helShutdownLane(HelHandle handle);
 //!     Pointer that identifies the futex.
 //! @param[in] expected
 //!     Expected value of the futex. This function does nothing unless
-//!     the futex pointed to by @pointer matches this value.
+//!     the futex pointed to by @p pointer matches this value.
 //! @param[in] deadline
 //!     Timeout (in absolute monotone time, see ::helGetClock).
 HEL_C_LINKAGE HelError helFutexWait(int *pointer, int expected, int64_t deadline);
@@ -1015,6 +1395,55 @@ HEL_C_LINKAGE HelError helFutexWait(int *pointer, int expected, int64_t deadline
 //!     Pointer that identifies the futex.
 HEL_C_LINKAGE HelError helFutexWake(int *pointer);
 
+//! Wakes up waiters of a futex and moves remaining waiters to another futex.
+//!
+//! This function does nothing and fails with ::kHelErrIllegalState unless
+//! the futex pointed to by @p pointer matches @p expected.
+//! @param[in] pointer
+//!     Pointer that identifies the futex.
+//! @param[in] expected
+//!     Expected value of the futex.
+//! @param[in] target
+//!     Pointer that identifies the futex that waiters are moved to.
+//! @param[in] wakeCount
+//!     Maximal number of waiters to wake up.
+//! @param[in] requeueCount
+//!     Maximal number of waiters to move to @p target.
+HEL_C_LINKAGE HelError helFutexRequeue(int *pointer, int expected, int *target,
+		unsigned int wakeCount, unsigned int requeueCount);
+
+//! Returns the ID that identifies the current thread as owner of
+//! priority inheritance futexes.
+//!
+//! The ID is non-zero and fits into ::kHelFutexPiOwnerMask.
+//! @param[out] id
+//!     ID of the current thread.
+HEL_C_LINKAGE HelError helGetFutexOwnerId(unsigned int *id);
+
+//! Acquires a priority inheritance futex.
+//!
+//! The futex is unlocked if its word is zero and owned by the thread whose ID
+//! (see ::helGetFutexOwnerId) is stored in the word otherwise.
+//! Userspace acquires unlocked futexes by a compare-and-swap from zero to its ID and
+//! only calls this function if the futex is locked.
+//! While the current thread waits, the owner runs with (at least) its priority.
+//! Fails with ::kHelErrIllegalState if the current thread already owns the futex
+//! and with ::kHelErrCancelled if the deadline expires.
+//! @param[in] pointer
+//!     Pointer that identifies the futex.
+//! @param[in] deadline
+//!     Timeout (in absolute monotone time, see ::helGetClock) or -1.
+HEL_C_LINKAGE HelError helFutexLockPi(int *pointer, int64_t deadline);
+
+//! Releases a priority inheritance futex that is owned by the current thread.
+//!
+//! Userspace only needs to call this function if ::kHelFutexPiWaiters is set.
+//! The futex is handed over to the waiter of highest priority.
+//! Fails with ::kHelErrIllegalState if the current thread does not own the futex.
+//! @param[in] pointer
+//!     Pointer that identifies the futex.
+HEL_C_LINKAGE HelError helFutexUnlockPi(int *pointer);
+
 //! @}
 //! @name Event Handling
 //! @{
@@ -1036,8 +1465,31 @@ HEL_C_LINKAGE HelError helRaiseEvent(HelHandle handle);
 
 HEL_C_LINKAGE HelError helAccessIrq(int number, HelHandle *handle);
 
+//! Acknowledge, NACK or kick an IRQ.
+//!
+//! Until the IRQ is acknowledged, it is not raised again; if the hardware signals
+//! it anyway, the kernel masks it (for MSI-X, at the device).
+//! Drivers can use this to poll their completion queues before acknowledging.
+//! @param[in] handle
+//!     Handle to the IRQ.
+//! @param[in] flags
+//!     One of ::kHelAckAcknowledge, ::kHelAckNack or ::kHelAckKick,
+//!     optionally combined with ::kHelAckClear.
+//! @param[in] sequence
+//!     Sequence number of the IRQ (as returned by ::helSubmitAwaitEvent).
 HEL_C_LINKAGE HelError helAcknowledgeIrq(HelHandle handle, uint32_t flags, uint64_t sequence);
 
+//! Steer an IRQ to a CPU.
+//!
+//! Future IRQs are delivered to the given CPU.
+//! Fails with ::kHelErrNoHardwareSupport if the interrupt controller
+//! cannot route the IRQ to that CPU.
+//! @param[in] handle
+//!     Handle to the IRQ.
+//! @param[in] cpu
+//!     Index of the CPU that should receive the IRQ.
+HEL_C_LINKAGE HelError helSetIrqAffinity(HelHandle handle, int cpu);
+
 //! Wait for an event.
 //!
 //! This is an asynchronous operation.
@@ -379,6 +379,107 @@ private:
 	UniqueDescriptor _descriptor;
 };
 
+struct PushDescriptorsResult {
+	PushDescriptorsResult() :_valid{false} {}
+
+	HelError error() {
+		FRG_ASSERT(_valid);
+		return _error;
+	}
+
+	void parse(void *&ptr, ElementHandle) {
+		auto result = reinterpret_cast<HelSimpleResult *>(ptr);
+		_error = result->error;
+		ptr = (char *)ptr + sizeof(HelSimpleResult);
+		_valid = true;
+	}
+
+private:
+	bool _valid;
+	HelError _error;
+};
+
+// The handles live in the queue element; handles that are not claimed
+// through descriptor() are closed when the result is destructed.
+struct PullDescriptorsResult {
+	friend void swap(PullDescriptorsResult &a, PullDescriptorsResult &b) {
+		using std::swap;
+		swap(a._valid, b._valid);
+		swap(a._error, b._error);
+		swap(a._element, b._element);
+		swap(a._handles, b._handles);
+		swap(a._count, b._count);
+	}
+
+	PullDescriptorsResult() :_valid{false} {}
+
+	PullDescriptorsResult(const PullDescriptorsResult &) = delete;
+
+	PullDescriptorsResult(PullDescriptorsResult &&other)
+	: PullDescriptorsResult() {
+		swap(*this, other);
+	}
+
+	~PullDescriptorsResult() {
+		reset();
+	}
+
+	PullDescriptorsResult &operator= (PullDescriptorsResult other) {
+		swap(*this, other);
+		return *this;
+	}
+
+	HelError error() {
+		FRG_ASSERT(_valid);
+		return _error;
+	}
+
+	size_t count() {
+		FRG_ASSERT(_valid);
+		HEL_CHECK(error());
+		return _count;
+	}
+
+	// Takes ownership of the i-th descriptor.
+	UniqueDescriptor descriptor(size_t i) {
+		FRG_ASSERT(_valid);
+		HEL_CHECK(error());
+		FRG_ASSERT(i < _count);
+		UniqueDescriptor descriptor{_handles[i]};
+		_handles[i] = kHelNullHandle;
+		return descriptor;
+	}
+
+	void parse(void *&ptr, ElementHandle element) {
+		auto result = reinterpret_cast<HelHandlesResult *>(ptr);
+		_error = result->error;
+		_count = result->count;
+		_handles = result->handles;
+
+		_element = element;
+
+		ptr = (char *)ptr + sizeof(HelHandlesResult)
+			+ ((_count * sizeof(HelHandle) + 7) & ~size_t(7));
+		_valid = true;
+	}
+
+	// Closes all unclaimed descriptors and releases the queue element.
+	void reset() {
+		for(size_t i = 0; i < _count; i++)
+			if(_handles[i] != kHelNullHandle)
+				HEL_CHECK(helCloseDescriptor(kHelThisUniverse, _handles[i]));
+		_count = 0;
+		_element = {};
+	}
+
+private:
+	bool _valid;
+	HelError _error;
+	ElementHandle _element;
+	HelHandle *_handles = nullptr;
+	size_t _count = 0;
+};
+
 
 // --------------------------------------------------------------------
 // Items
@@ -403,6 +504,7 @@ struct ExtractCredentials { };
 struct SendBuffer {
 	const void *buf;
 	size_t size;
+	bool direct = false;
 };
 
 struct RecvBuffer {
@@ -418,6 +520,15 @@ struct PushDescriptor {
 
 struct PullDescriptor { };
 
+struct PushDescriptors {
+	const HelHandle *handles;
+	size_t count;
+};
+
+struct PullDescriptors {
+	size_t maxCount;
+};
+
 template <typename Allocator>
 struct SendBragiHeadTail {
 	SendBragiHeadTail(Allocator allocator)
@@ -447,6 +558,13 @@ struct SendBragiHeadOnly {
 	frg::vector<uint8_t, Allocator> head;
 };
 
+// Like SendBragiHeadOnly but stores the head inside the item itself,
+// i.e., in the operation state of exchangeMsgs(). Does not allocate.
+template <size_t N>
+struct SendBragiHeadInline {
+	frg::array<uint8_t, N> head;
+};
+
 // --------------------------------------------------------------------
 // Construction functions
 // --------------------------------------------------------------------
@@ -485,6 +603,11 @@ inline auto sendBuffer(const void *data, size_t length) {
 	return SendBuffer{data, length};
 }
 
+// Lets the kernel copy large buffers directly into the receiver's address space.
+inline auto sendBufferDirect(const void *data, size_t length) {
+	return SendBuffer{data, length, true};
+}
+
 inline auto recvBuffer(void *data, size_t length) {
 	return RecvBuffer{data, length};
 }
@@ -501,6 +624,16 @@ inline auto pullDescriptor() {
 	return PullDescriptor{};
 }
 
+// Transfers all handles under a single acquisition of the universe lock (on both sides).
+// At most kHelMaxDescriptorsPerAction handles can be transferred at once.
+inline auto pushDescriptors(const HelHandle *handles, size_t count) {
+	return PushDescriptors{handles, count};
+}
+
+inline auto pullDescriptors(size_t maxCount) {
+	return PullDescriptors{maxCount};
+}
+
 template <typename Message, typename Allocator>
 inline auto sendBragiHeadTail(Message &msg, Allocator allocator = Allocator()) {
 	SendBragiHeadTail<Allocator> item{allocator};
@@ -523,6 +656,16 @@ inline auto sendBragiHeadOnly(Message &msg, Allocator allocator = Allocator()) {
 	return item;
 }
 
+template <typename Message>
+inline auto sendBragiHeadInline(Message &msg) {
+	SendBragiHeadInline<Message::head_size> item;
+	FRG_ASSERT(!msg.size_of_tail());
+
+	bragi::write_head_only(msg, item.head);
+
+	return item;
+}
+
 // --------------------------------------------------------------------
 // Item -> HelAction transformation
 // --------------------------------------------------------------------
@@ -600,7 +743,8 @@ inline auto createActionsArrayFor(bool chain, const ExtractCredentials &) {
 inline auto createActionsArrayFor(bool chain, const SendBuffer &item) {
 	HelAction action{};
 	action.type = kHelActionSendFromBuffer;
-	action.flags = chain ? kHelItemChain : 0;
+	action.flags = (chain ? kHelItemChain : 0)
+			| (item.direct ? kHelItemDirect : 0);
 	action.buffer = const_cast<void *>(item.buf);
 	action.length = item.size;
 
@@ -642,6 +786,25 @@ inline auto createActionsArrayFor(bool chain, const PullDescriptor &) {
 	return frg::array<HelAction, 1>{action};
 }
 
+inline auto createActionsArrayFor(bool chain, const PushDescriptors &item) {
+	HelAction action{};
+	action.type = kHelActionPushDescriptors;
+	action.flags = chain ? kHelItemChain : 0;
+	action.buffer = const_cast<HelHandle *>(item.handles);
+	action.length = item.count;
+
+	return frg::array<HelAction, 1>{action};
+}
+
+inline auto createActionsArrayFor(bool chain, const PullDescriptors &item) {
+	HelAction action{};
+	action.type = kHelActionPullDescriptors;
+	action.flags = chain ? kHelItemChain : 0;
+	action.length = item.maxCount;
+
+	return frg::array<HelAction, 1>{action};
+}
+
 template <typename Allocator>
 inline auto createActionsArrayFor(bool chain, const SendBragiHeadTail<Allocator> &item) {
 	HelAction headAction{}, tailAction{};
@@ -670,6 +833,18 @@ inline auto createActionsArrayFor(bool chain, const SendBragiHeadOnly<Allocator>
 	return frg::array<HelAction, 1>{action};
 }
 
+template <size_t N>
+inline auto createActionsArrayFor(bool chain, const SendBragiHeadInline<N> &item) {
+	HelAction action{};
+
+	action.type = kHelActionSendFromBuffer;
+	action.flags = chain ? kHelItemChain : 0;
+	action.buffer = const_cast<uint8_t *>(item.head.data());
+	action.length = N;
+
+	return frg::array<HelAction, 1>{action};
+}
+
 // --------------------------------------------------------------------
 // Item -> Result type transformation
 // --------------------------------------------------------------------
@@ -720,6 +895,14 @@ inline auto resultTypeTuple(const PullDescriptor &) {
 	return frg::tuple<PullDescriptorResult>{};
 }
 
+inline auto resultTypeTuple(const PushDescriptors &) {
+	return frg::tuple<PushDescriptorsResult>{};
+}
+
+inline auto resultTypeTuple(const PullDescriptors &) {
+	return frg::tuple<PullDescriptorsResult>{};
+}
+
 template <typename Allocator>
 inline auto resultTypeTuple(const SendBragiHeadTail<Allocator> &) {
 	return frg::tuple<SendBufferResult, SendBufferResult>{};
@@ -730,6 +913,11 @@ inline auto resultTypeTuple(const SendBragiHeadOnly<Allocator> &) {
 	return frg::tuple<SendBufferResult>{};
 }
 
+template <size_t N>
+inline auto resultTypeTuple(const SendBragiHeadInline<N> &) {
+	return frg::tuple<SendBufferResult>{};
+}
+
 template <typename ...T>
 inline auto createResultsTuple(T &&...args) {
 	return frg::tuple_cat(resultTypeTuple(std::forward<T>(args))...);
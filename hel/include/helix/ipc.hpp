@@ -5,6 +5,7 @@
 #include <initializer_list>
 #include <list>
 #include <tuple>
+#include <vector>
 #include <array>
 #include <stdexcept>
 
@@ -174,11 +175,30 @@ private:
 public:
 	static constexpr int sizeShift = 9;
 
+	// The kernel fills one chunk at a time. Once all chunks are in use (i.e., the
+	// elements of all chunks are still referenced), completions stall until
+	// an ElementHandle is released.
+	static constexpr int defaultNumChunks = 16;
+	static constexpr size_t defaultChunkSize = 4096;
+
+	// Per-thread dispatcher.
 	static Dispatcher &global();
 
-	Dispatcher()
-	: _handle{kHelNullHandle}, _queue{nullptr},
-			_activeChunks{0}, _retrieveIndex{0}, _nextIndex{0}, _lastProgress{0} { }
+	// Sets the queue parameters of global() dispatchers that are created afterwards
+	// by the calling thread or by any other thread. Must be called before global()
+	// is used by the thread that should observe the new parameters.
+	static void configureGlobal(int numChunks, size_t chunkSize);
+
+	explicit Dispatcher(int numChunks = defaultNumChunks, size_t chunkSize = defaultChunkSize)
+	: _numChunks{numChunks}, _chunkSize{chunkSize},
+			_handle{kHelNullHandle}, _queue{nullptr},
+			_activeChunks{0}, _hadWaiters{false},
+			_retrieveIndex{0}, _nextIndex{0}, _lastProgress{0},
+			_chunks(numChunks), _refCounts(numChunks) {
+		// Each chunk needs a slot in the index queue.
+		assert(numChunks > 0 && numChunks <= (1 << sizeShift));
+		assert(chunkSize >= sizeof(HelElement));
+	}
 
 	Dispatcher(const Dispatcher &) = delete;
 
@@ -188,8 +208,8 @@ public:
 		if(!_handle) {
 			HelQueueParameters params {
 				.ringShift = sizeShift,
-				.numChunks = 16,
-				.chunkSize = 4096
+				.numChunks = static_cast<unsigned int>(_numChunks),
+				.chunkSize = _chunkSize
 			};
 			HEL_CHECK(helCreateQueue(&params, &_handle));
 
@@ -204,18 +224,57 @@ public:
 
 			_queue = reinterpret_cast<HelQueue *>(mapping);
 			auto chunksPtr = reinterpret_cast<std::byte *>(mapping) + chunksOffset;
-			for(unsigned int i = 0; i < 16; ++i)
+			for(int i = 0; i < _numChunks; ++i)
 				_chunks[i] = reinterpret_cast<HelChunk *>(chunksPtr + i * reservedPerChunk);
 		}
 
 		return _handle;
 	}
 
+	// If enabled, submit() stages submissions and passes them to the kernel in a single
+	// helSubmitBatch() call, at the latest before wait() blocks. Note that error checking
+	// is deferred as well; descriptors must stay alive until the batch is flushed.
+	void enableSubmitBatching() {
+		_batchSubmissions = true;
+	}
+
+	// Submits (or stages) a helSubmitAsync() on this dispatcher's queue.
+	// The actions array must stay valid until the operation completes.
+	void submit(HelHandle handle, const HelAction *actions, size_t count, Context *context) {
+		if(!_batchSubmissions) {
+			HEL_CHECK(helSubmitAsync(handle, actions, count, acquire(),
+					reinterpret_cast<uintptr_t>(context), 0));
+			return;
+		}
+
+		_staged.push_back(HelSubmission{
+			.handle = handle,
+			.actions = actions,
+			.count = count,
+			.queue = acquire(),
+			.context = reinterpret_cast<uintptr_t>(context),
+			.flags = 0
+		});
+		if(_staged.size() >= maxStaged)
+			flushSubmissions();
+	}
+
+	void flushSubmissions() {
+		if(_staged.empty())
+			return;
+		size_t numSubmitted;
+		HEL_CHECK(helSubmitBatch(_staged.data(), _staged.size(), &numSubmitted));
+		assert(numSubmitted == _staged.size());
+		_staged.clear();
+	}
+
 	void wait() {
+		flushSubmissions();
+
 		while(true) {
 			// TODO: Initialize all chunks when setting up the queue.
 			if(_retrieveIndex == _nextIndex) {
-				assert(_activeChunks < 16);
+				assert(_activeChunks < _numChunks);
 
 				// Reset and enqueue the new chunk.
 				_chunks[_activeChunks]->progressFutex = 0;
@@ -227,8 +286,7 @@ public:
 				_refCounts[_activeChunks] = 1;
 				_activeChunks++;
 				continue;
-			}else if (_hadWaiters && _activeChunks < (1 << sizeShift)) {
-				assert(_activeChunks < 16);
+			}else if (_hadWaiters && _activeChunks < _numChunks) {
 
 				// Reset and enqueue the new chunk.
 				_chunks[_activeChunks]->progressFutex = 0;
@@ -252,20 +310,55 @@ public:
 				continue;
 			}
 
-			// Dequeue the next element.
-			auto ptr = (char *)_retrieveChunk() + sizeof(HelChunk) + _lastProgress;
-			auto element = reinterpret_cast<HelElement *>(ptr);
-			_lastProgress += sizeof(HelElement) + element->length;
+			_dispatchElement();
 
-			auto context = reinterpret_cast<Context *>(element->context);
-			_refCounts[_numberOf(_retrieveIndex)]++;
-			context->complete(ElementHandle{this, _numberOf(_retrieveIndex),
-					ptr + sizeof(HelElement)});
+			// The kernel publishes elements in batches. Drain all elements that are
+			// already available such that we only block once per batch.
+			for(int i = 1; i < maxDrain; i++) {
+				if(!_tryDispatch())
+					break;
+			}
 			return;
 		}
 	}
 
 private:
+	// Maximal number of elements that wait() completes per call.
+	static constexpr int maxDrain = 64;
+
+	// Maximal number of submissions that are staged before they are flushed.
+	static constexpr size_t maxStaged = 64;
+
+	void _dispatchElement() {
+		auto ptr = (char *)_retrieveChunk() + sizeof(HelChunk) + _lastProgress;
+		auto element = reinterpret_cast<HelElement *>(ptr);
+		_lastProgress += sizeof(HelElement) + element->length;
+
+		auto context = reinterpret_cast<Context *>(element->context);
+		_refCounts[_numberOf(_retrieveIndex)]++;
+		context->complete(ElementHandle{this, _numberOf(_retrieveIndex),
+				ptr + sizeof(HelElement)});
+	}
+
+	// Like wait() but never blocks. Returns true if an element was dispatched.
+	bool _tryDispatch() {
+		while(_retrieveIndex != _nextIndex) {
+			auto futex = __atomic_load_n(&_retrieveChunk()->progressFutex, __ATOMIC_ACQUIRE);
+			if(_lastProgress != (futex & kHelProgressMask)) {
+				_dispatchElement();
+				return true;
+			}else if(!(futex & kHelProgressDone)) {
+				return false;
+			}
+
+			_surrender(_numberOf(_retrieveIndex));
+
+			_lastProgress = 0;
+			_retrieveIndex = ((_retrieveIndex + 1) & kHelHeadMask);
+		}
+		return false;
+	}
+
 	void _surrender(int cn) {
 		assert(_refCounts[cn] > 0);
 		if(_refCounts[cn]-- > 1)
@@ -328,9 +421,11 @@ private:
 	}
 
 private:
+	int _numChunks;
+	size_t _chunkSize;
+
 	HelHandle _handle;
 	HelQueue *_queue;
-	HelChunk *_chunks[16];
 
 	int _activeChunks;
 	bool _hadWaiters;
@@ -342,8 +437,13 @@ private:
 	// Progress into the current chunk.
 	int _lastProgress;
 
+	std::vector<HelChunk *> _chunks;
+
 	// Per-chunk reference counts.
-	int _refCounts[16];
+	std::vector<int> _refCounts;
+
+	bool _batchSubmissions = false;
+	std::vector<HelSubmission> _staged;
 };
 
 inline void CurrentDispatcherToken::wait() {
@@ -906,12 +1006,11 @@ struct ExchangeMsgsOperation : private Context {
 	: lane_{std::move(lane)}, actions_{std::move(actions)}, receiver_{std::move(receiver)} { }
 
 	void start() {
-		auto helActions = frg::apply(chainActionArrays, actions_);
+		// Kept in the operation since the dispatcher may defer the submission.
+		helActions_ = frg::apply(chainActionArrays, actions_);
 
-		auto context = static_cast<Context *>(this);
-		HEL_CHECK(helSubmitAsync(lane_.getHandle(),
-				helActions.data(), helActions.size(), Dispatcher::global().acquire(),
-				reinterpret_cast<uintptr_t>(context), 0));
+		Dispatcher::global().submit(lane_.getHandle(),
+				helActions_.data(), helActions_.size(), this);
 	}
 
 private:
@@ -928,6 +1027,7 @@ private:
 
 	BorrowedDescriptor lane_;
 	Actions actions_;
+	decltype(frg::apply(chainActionArrays, std::declval<Actions &>())) helActions_;
 	Receiver receiver_;
 };
 
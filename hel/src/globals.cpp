@@ -7,10 +7,22 @@
 
 namespace helix {
 
+namespace {
+	std::atomic<int> globalNumChunks{Dispatcher::defaultNumChunks};
+	std::atomic<size_t> globalChunkSize{Dispatcher::defaultChunkSize};
+}
+
 Dispatcher &Dispatcher::global() {
-	thread_local static Dispatcher dispatcher;
+	thread_local static Dispatcher dispatcher{globalNumChunks.load(std::memory_order_relaxed),
+			globalChunkSize.load(std::memory_order_relaxed)};
 	return dispatcher;
 }
 
+void Dispatcher::configureGlobal(int numChunks, size_t chunkSize) {
+	assert(numChunks > 0 && numChunks <= (1 << sizeShift));
+	globalNumChunks.store(numChunks, std::memory_order_relaxed);
+	globalChunkSize.store(chunkSize, std::memory_order_relaxed);
+}
+
 } // namespace helix
 
@@ -116,6 +116,72 @@ void mapSingle4kPage(address_t address, address_t physical, uint32_t flags,
 	((uint64_t *)l3_ptr)[l3] = new_entry;
 }
 
+void mapSingle2MiBPage(address_t address, address_t physical, uint32_t flags,
+		CachingMode caching_mode) {
+	assert(address % largePageSize == 0);
+	assert(physical % largePageSize == 0);
+
+	auto ttbr = (address >> 63) & 1;
+	auto l0 = (address >> 39) & 0x1FF;
+	auto l1 = (address >> 30) & 0x1FF;
+	auto l2 = (address >> 21) & 0x1FF;
+
+	auto l0_ent = ((uint64_t *)eirTTBR[ttbr])[l0];
+	auto l1_ptr = l0_ent & 0xFFFFFFFFF000;
+	if (!(l0_ent & kPageValid)) {
+		uint64_t addr = allocPage();
+
+		for(int i = 0; i < 512; i++)
+			((uint64_t *)addr)[i] = 0;
+
+		((uint64_t *)eirTTBR[ttbr])[l0] =
+			addr | kPageValid | kPageTable;
+
+		l1_ptr = addr;
+	}
+
+	auto l1_ent = ((uint64_t *)l1_ptr)[l1];
+	auto l2_ptr = l1_ent & 0xFFFFFFFFF000;
+	if (!(l1_ent & kPageValid)) {
+		uint64_t addr = allocPage();
+
+		for(int i = 0; i < 512; i++)
+			((uint64_t *)addr)[i] = 0;
+
+		((uint64_t *)l1_ptr)[l1] =
+			addr | kPageValid | kPageTable;
+
+		l2_ptr = addr;
+	}
+
+	auto l2_ent = ((uint64_t *)l2_ptr)[l2];
+
+	if (l2_ent & kPageValid)
+		eir::panicLogger() << "eir: Trying to map 0x" << frg::hex_fmt{address}
+				<< " twice!" << frg::endlog;
+
+	// Block descriptors are valid entries without the table bit.
+	uint64_t new_entry = physical | kPageValid | kPageAccess;
+
+	if (!(flags & PageFlags::write))
+		new_entry |= kPageRO;
+	if (!(flags & PageFlags::execute))
+		new_entry |= kPageXN | kPagePXN;
+	if (!(flags & PageFlags::global))
+		new_entry |= kPageNotGlobal;
+
+	if (caching_mode == CachingMode::writeCombine) {
+		new_entry |= kPageGRE | kPageOuterSh;
+	} else if (caching_mode == CachingMode::mmio) {
+		new_entry |= kPagenGnRnE | kPageOuterSh;
+	} else {
+		assert(caching_mode == CachingMode::null);
+		new_entry |= kPageWb | kPageInnerSh;
+	}
+
+	((uint64_t *)l2_ptr)[l2] = new_entry;
+}
+
 address_t getSingle4kPage(address_t address) {
 	auto ttbr = (address >> 63) & 1;
 	auto l0 = (address >> 39) & 0x1FF;
@@ -146,6 +212,12 @@ address_t getSingle4kPage(address_t address) {
 	return page_ptr;
 }
 
+uint64_t readTimestampCounter() {
+	uint64_t cntpct;
+	asm volatile ("mrs %0, cntpct_el0" : "=r"(cntpct));
+	return cntpct;
+}
+
 void initProcessorEarly() {
 	eir::infoLogger() << "Starting Eir" << frg::endlog;
 
@@ -166,7 +238,8 @@ void initProcessorEarly() {
 		(0b00001100 << 8) | // Device, GRE
 		(0b00000000 << 16)| // Device, nGnRnE
 		(0b00000100 << 24)| // Device, nGnRE
-		(0b01000100UL << 32); // Normal Non-cacheable
+		(0b01000100UL << 32) | // Normal Non-cacheable
+		(0b10111011UL << 40); // Normal Write-through RW-Allocate non-transient
 
 	asm volatile ("msr mair_el1, %0" :: "r" (mair));
 
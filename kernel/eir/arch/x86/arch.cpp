@@ -20,6 +20,8 @@ enum X86PageFlags {
 	kPageUser = 4,
 	kPagePwt = 0x8,
 	kPagePat = 0x80,
+	kPageHuge = 0x80, // Only in PDs; the PAT bit of huge pages is kPageHugePat.
+	kPageHugePat = 0x1000,
 	kPageGlobal = 0x100,
 	kPageXd = 0x8000000000000000
 };
@@ -106,6 +108,59 @@ void mapSingle4kPage(address_t address, address_t physical, uint32_t flags,
 	((uint64_t*)pt)[pt_index] = new_entry;
 }
 
+void mapSingle2MiBPage(address_t address, address_t physical, uint32_t flags,
+		CachingMode caching_mode) {
+	assert(address % largePageSize == 0);
+	assert(physical % largePageSize == 0);
+
+	int pml4_index = (int)((address >> 39) & 0x1FF);
+	int pdpt_index = (int)((address >> 30) & 0x1FF);
+	int pd_index = (int)((address >> 21) & 0x1FF);
+
+	// find the pml4_entry. the pml4 is always present
+	uintptr_t pml4 = eirPml4Pointer;
+	uint64_t pml4_entry = ((uint64_t *)pml4)[pml4_index];
+
+	// find the pdpt entry; create pdpt if necessary
+	uintptr_t pdpt = (uintptr_t)(pml4_entry & 0xFFFFF000);
+	if(!(pml4_entry & kPagePresent)) {
+		pdpt = allocPage();
+		for(int i = 0; i < 512; i++)
+			((uint64_t *)pdpt)[i] = 0;
+		((uint64_t *)pml4)[pml4_index] = pdpt | kPagePresent | kPageWrite;
+	}
+	uint64_t pdpt_entry = ((uint64_t *)pdpt)[pdpt_index];
+
+	// find the pd entry; create pd if necessary
+	uintptr_t pd = (uintptr_t)(pdpt_entry & 0xFFFFF000);
+	if(!(pdpt_entry & kPagePresent)) {
+		pd = allocPage();
+		for(int i = 0; i < 512; i++)
+			((uint64_t *)pd)[i] = 0;
+		((uint64_t *)pdpt)[pdpt_index] = pd | kPagePresent | kPageWrite;
+	}
+	uint64_t pd_entry = ((uint64_t *)pd)[pd_index];
+
+	// setup the new pd entry
+	if(pd_entry & kPagePresent)
+		eir::panicLogger() << "eir: Trying to map 0x" << frg::hex_fmt{address}
+				<< " twice!" << frg::endlog;
+
+	uint64_t new_entry = physical | kPagePresent | kPageHuge;
+	if (flags & PageFlags::write)
+		new_entry |= kPageWrite;
+	if (!(flags & PageFlags::execute))
+		new_entry |= kPageXd;
+	if (flags & PageFlags::global)
+		new_entry |= kPageGlobal;
+	if (caching_mode == CachingMode::writeCombine)
+		new_entry |= kPageHugePat | kPagePwt;
+	else
+		assert(caching_mode == CachingMode::null);
+
+	((uint64_t *)pd)[pd_index] = new_entry;
+}
+
 address_t getSingle4kPage(address_t address) {
 	assert(address % pageSize == 0);
 
@@ -142,6 +197,13 @@ address_t getSingle4kPage(address_t address) {
 	return pt_entry & 0xF'FFFF'FFFF'F000;
 }
 
+uint64_t readTimestampCounter() {
+	uint32_t lsw, msw;
+	asm volatile ("rdtsc" : "=a"(lsw), "=d"(msw));
+	return (static_cast<uint64_t>(msw) << 32)
+			| static_cast<uint64_t>(lsw);
+}
+
 void initArchCpu();
 
 void initProcessorEarly() {
@@ -23,12 +23,19 @@ enum class CachingMode {
 
 static constexpr int pageShift = 12;
 static constexpr size_t pageSize = size_t(1) << pageShift;
+static constexpr size_t largePageSize = size_t(1) << 21;
 
 void setupPaging();
 void mapSingle4kPage(address_t address, address_t physical, uint32_t flags,
 		CachingMode caching_mode = CachingMode::null);
+// Maps a 2 MiB page. Note that getSingle4kPage() does not understand such mappings.
+void mapSingle2MiBPage(address_t address, address_t physical, uint32_t flags,
+		CachingMode caching_mode = CachingMode::null);
 address_t getSingle4kPage(address_t address);
 
+// Returns the raw timestamp counter. thor converts it to nanoseconds.
+uint64_t readTimestampCounter();
+
 void initProcessorEarly();
 void initProcessorPaging(void *kernel_start, uint64_t &kernel_entry);
 
@@ -52,6 +52,10 @@ void mapRegionsAndStructs();
 
 address_t loadKernelImage(void *image);
 
+// Records a phase of eir (timestamps from readTimestampCounter()).
+// generateInfo() passes all phases to thor.
+void recordBootPhase(const char *name, uint64_t begin, uint64_t end);
+
 EirInfo *generateInfo(const char *cmdline);
 
 void setFbInfo(void *ptr, int width, int height, size_t pitch);
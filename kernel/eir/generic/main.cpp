@@ -112,6 +112,8 @@ address_t cutFromRegion(size_t size) {
 }
 
 void setupRegionStructs() {
+	auto phaseBegin = readTimestampCounter();
+
 	for(size_t i = 0; i < numRegions; ++i) {
 		if(regions[i].regionType != RegionType::allocatable)
 			continue;
@@ -136,6 +138,8 @@ void setupRegionStructs() {
 		auto table_ptr = reinterpret_cast<int8_t *>(table_paddr);
 		BuddyAccessor::initialize(table_ptr, num_roots, order);
 	}
+
+	recordBootPhase("setup-regions", phaseBegin, readTimestampCounter());
 }
 
 // ----------------------------------------------------------------------------
@@ -275,6 +279,8 @@ void unpoisonKasanShadow(address_t base, size_t size) {
 // ----------------------------------------------------------------------------
 
 void mapRegionsAndStructs() {
+	auto phaseBegin = readTimestampCounter();
+
 	// This region should be available RAM on every PC.
 	for(size_t page = 0x8000; page < 0x80000; page += pageSize)
 			mapSingle4kPage(0xFFFF'8000'0000'0000 + page,
@@ -287,10 +293,22 @@ void mapRegionsAndStructs() {
 		if(regions[i].regionType != RegionType::allocatable)
 			continue;
 
-		// Map the region itself.
-		for(address_t page = 0; page < regions[i].size; page += pageSize)
-			mapSingle4kPage(0xFFFF'8000'0000'0000 + regions[i].address + page,
-					regions[i].address + page, PageFlags::write | PageFlags::global);
+		// Map the region itself. Use 2 MiB pages where the region allows it; on large
+		// machines, 4 KiB pages would take up a lot of memory (and time) for page tables.
+		// The KASAN shadow below still uses 4 KiB pages.
+		address_t page = 0;
+		while(page < regions[i].size) {
+			auto physical = regions[i].address + page;
+			if(!(physical & (largePageSize - 1)) && regions[i].size - page >= largePageSize) {
+				mapSingle2MiBPage(0xFFFF'8000'0000'0000 + physical,
+						physical, PageFlags::write | PageFlags::global);
+				page += largePageSize;
+			}else{
+				mapSingle4kPage(0xFFFF'8000'0000'0000 + physical,
+						physical, PageFlags::write | PageFlags::global);
+				page += pageSize;
+			}
+		}
 		mapKasanShadow(0xFFFF'8000'0000'0000 + regions[i].address, regions[i].size);
 		unpoisonKasanShadow(0xFFFF'8000'0000'0000 + regions[i].address, regions[i].size);
 
@@ -306,6 +324,8 @@ void mapRegionsAndStructs() {
 		unpoisonKasanShadow(buddyMapping, regions[i].buddyOverhead);
 		regions[i].buddyMap = buddyMapping;
 	}
+
+	recordBootPhase("map-regions", phaseBegin, readTimestampCounter());
 }
 
 void allocLogRingBuffer() {
@@ -335,6 +355,8 @@ address_t mapBootstrapData(void *p) {
 // ----------------------------------------------------------------------------
 
 address_t loadKernelImage(void *image) {
+	auto phaseBegin = readTimestampCounter();
+
 	Elf64_Ehdr ehdr;
 	memcpy(&ehdr, image, sizeof(Elf64_Ehdr));
 	if(ehdr.e_ident[0] != '\x7F'
@@ -386,9 +408,31 @@ address_t loadKernelImage(void *image) {
 		unpoisonKasanShadow(phdr.p_paddr, phdr.p_memsz);
 	}
 
+	recordBootPhase("load-kernel", phaseBegin, readTimestampCounter());
 	return ehdr.e_entry;
 }
 
+// ----------------------------------------------------------------------------
+
+namespace {
+	// All phases need to fit into a single page of bootstrap data.
+	constexpr size_t maxBootPhases = pageSize / sizeof(EirBootPhase);
+
+	EirBootPhase bootPhases[maxBootPhases];
+	size_t numBootPhases = 0;
+}
+
+void recordBootPhase(const char *name, uint64_t begin, uint64_t end) {
+	if(numBootPhases == maxBootPhases)
+		return;
+	auto phase = &bootPhases[numBootPhases++];
+	auto length = frg::min(strlen(name), sizeof(phase->name) - 1);
+	memcpy(phase->name, name, length);
+	phase->name[length] = 0;
+	phase->begin = begin;
+	phase->end = end;
+}
+
 EirInfo *generateInfo(const char *cmdline){
 	// Setup the eir interface struct.
 	auto info_ptr = bootAlloc<EirInfo>();
@@ -449,6 +493,12 @@ EirInfo *generateInfo(const char *cmdline){
 	memcpy(cmd_buffer, cmdline, cmd_length + 1);
 	info_ptr->commandLine = mapBootstrapData(cmd_buffer);
 
+	// Pass the boot phases to thor. They are reported with thor's own boot profile.
+	auto phaseBuffer = reinterpret_cast<EirBootPhase *>(allocPage());
+	memcpy(phaseBuffer, bootPhases, numBootPhases * sizeof(EirBootPhase));
+	info_ptr->numBootPhases = numBootPhases;
+	info_ptr->bootPhases = mapBootstrapData(phaseBuffer);
+
 	return info_ptr;
 }
 
@@ -36,6 +36,14 @@ struct EirFramebuffer {
 	EirSize fbType;
 };
 
+// Time spent in a phase of eir, in units of the raw timestamp counter
+// (i.e., the TSC on x86 and the physical counter on ARM).
+struct EirBootPhase {
+	char name[32];
+	uint64_t begin;
+	uint64_t end;
+};
+
 struct EirInfo {
 	uint64_t signature;
 	EirPtr commandLine;
@@ -54,4 +62,7 @@ struct EirInfo {
 
 	uint64_t acpiRsdt;
 	uint64_t acpiRevision;
+
+	EirSize numBootPhases;
+	EirPtr bootPhases;
 };
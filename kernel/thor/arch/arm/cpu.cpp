@@ -43,7 +43,7 @@ Executor::Executor()
 : _pointer{nullptr}, _exceptionStack{nullptr} {  }
 
 Executor::Executor(UserContext *context, AbiParameters abi) {
-	_pointer = static_cast<char *>(kernelAlloc->allocate(getStateSize()));
+	_pointer = static_cast<char *>(allocateExecutorState(getStateSize()));
 	memset(_pointer, 0, getStateSize());
 
 	general()->elr = abi.ip;
@@ -56,7 +56,7 @@ Executor::Executor(UserContext *context, AbiParameters abi) {
 
 Executor::Executor(FiberContext *context, AbiParameters abi)
 : _exceptionStack{nullptr} {
-	_pointer = static_cast<char *>(kernelAlloc->allocate(getStateSize()));
+	_pointer = static_cast<char *>(allocateExecutorState(getStateSize()));
 	memset(_pointer, 0, getStateSize());
 
 	general()->elr = abi.ip;
@@ -67,7 +67,8 @@ Executor::Executor(FiberContext *context, AbiParameters abi)
 }
 
 Executor::~Executor() {
-	kernelAlloc->free(_pointer);
+	if(_pointer)
+		freeExecutorState(_pointer, getStateSize());
 }
 
 void saveExecutor(Executor *executor, FaultImageAccessor accessor) {
@@ -280,6 +281,20 @@ void initializeThisProcessor() {
 	cpu_data->cpuIndex = allCpuContexts->size();
 	allCpuContexts->push(cpu_data);
 
+	// Derive the topology from the affinity levels of MPIDR. If the MT bit is set,
+	// Aff0 numbers the threads of a core; otherwise, it numbers the cores of a cluster.
+	// We assume that the CPUs of a cluster share their last level cache.
+	uint64_t mpidr;
+	asm volatile ("mrs %0, mpidr_el1" : "=r"(mpidr));
+	uint64_t affinity = (mpidr & 0xFF'FFFF) | ((mpidr >> 8) & 0xFF00'0000);
+	if(mpidr & (uint64_t(1) << 24)) {
+		cpu_data->coreId = affinity >> 8;
+		cpu_data->llcId = affinity >> 16;
+	}else{
+		cpu_data->coreId = affinity;
+		cpu_data->llcId = affinity >> 8;
+	}
+
 	cpu_data->irqStack = UniqueKernelStack::make();
 	cpu_data->detachedStack = UniqueKernelStack::make();
 	cpu_data->idleStack = UniqueKernelStack::make();
@@ -34,6 +34,9 @@ namespace dist_reg {
 	static constexpr uintptr_t sgiSetPendingBase = 0xF10;
 	static constexpr uintptr_t sgiClearPendingBase = 0xF20;
 
+	// GICv3 only.
+	static constexpr uintptr_t irqRouterBase = 0x6000;
+
 	static constexpr arch::bit_register<uint32_t> control{0x00};
 	static constexpr arch::bit_register<uint32_t> type{0x04};
 	static constexpr arch::bit_register<uint32_t> sgi{0xF00};
@@ -41,6 +44,10 @@ namespace dist_reg {
 
 namespace dist_control {
 	arch::field<uint32_t, bool> enable{0, 1};
+	// GICv3 (non-secure view, or single security state).
+	arch::field<uint32_t, bool> enableGrp1{1, 1};
+	arch::field<uint32_t, bool> affinityRouting{4, 1};
+	arch::field<uint32_t, bool> registerWritePending{31, 1};
 } // namespace dist_control
 
 namespace dist_type {
@@ -55,12 +62,41 @@ namespace dist_sgi {
 	arch::field<uint32_t, uint8_t> targetListFilter{24, 2};
 } // namespace dist_sgi
 
-GicDistributor::GicDistributor(uintptr_t addr)
-: base_{addr}, space_{}, irqPins_{*kernelAlloc} {
-	auto register_ptr = KernelVirtualMemory::global().allocate(0x1000);
-	KernelPageSpace::global().mapSingle4k(VirtualAddr(register_ptr), addr,
-			page_access::write, CachingMode::mmio);
-	space_ = arch::mem_space{register_ptr};
+namespace {
+	// Maps a range of MMIO registers.
+	void *mapRegisters(uintptr_t addr, size_t size) {
+		size = (size + kPageSize - 1) & ~(kPageSize - 1);
+		auto ptr = KernelVirtualMemory::global().allocate(size);
+		for (size_t i = 0; i < size; i += kPageSize) {
+			KernelPageSpace::global().mapSingle4k(VirtualAddr(ptr) + i, addr + i,
+					page_access::write, CachingMode::mmio);
+		}
+		return ptr;
+	}
+
+	// Affinity of the current CPU in the format of GICD_IROUTER.
+	uint64_t currentAffinity() {
+		uint64_t mpidr;
+		asm volatile ("mrs %0, mpidr_el1" : "=r"(mpidr));
+		return mpidr & 0xFF'00FF'FFFF;
+	}
+} // namespace anonymous
+
+GicDistributor::GicDistributor(uintptr_t addr, size_t size, bool v3)
+: base_{addr}, v3_{v3}, space_{}, irqPins_{*kernelAlloc} {
+	// The GICv2 distributor fits into a single page; GICv3 uses a 64 KiB frame.
+	space_ = arch::mem_space{mapRegisters(addr, v3 ? frg::max(size, size_t{0x10000}) : 0x1000)};
+}
+
+void GicDistributor::setRedistributorRegion(uintptr_t addr, size_t size) {
+	assert(v3_);
+	redistPtr_ = mapRegisters(addr, size);
+	redistSize_ = size;
+}
+
+void GicDistributor::waitForRwp_() {
+	while (space_.load_relaxed(dist_reg::control) & dist_control::registerWritePending)
+		;
 }
 
 void GicDistributor::init() {
@@ -75,7 +111,18 @@ void GicDistributor::init() {
 
 	space_.store_relaxed(dist_reg::control, dist_control::enable(false));
 
-	auto iface = getCurrentCpuIfaceNo_();
+	if (v3_) {
+		// IROUTER is only writable once affinity routing is enabled.
+		waitForRwp_();
+		space_.store_relaxed(dist_reg::control, dist_control::affinityRouting(true));
+		waitForRwp_();
+
+		// The system register interface only acknowledges group 1 interrupts.
+		for (int i = 32; i < noLines; i += 32)
+			arch::scalar_store_relaxed<uint32_t>(space_, dist_reg::irqGroupBase + i / 8, 0xFFFF'FFFF);
+	}
+
+	auto target = getCurrentTarget_();
 
 	irqPins_.resize(noLines, nullptr);
 	for (int i = 0; i < noLines; i++) {
@@ -85,14 +132,24 @@ void GicDistributor::init() {
 		if (i >= 32) {
 			pin->mask();
 			pin->setPriority_(defaultPrio);
-			pin->setAffinity_(iface);
+			pin->setAffinity_(target);
 		}
 	}
 
-	space_.store_relaxed(dist_reg::control, dist_control::enable(true));
+	if (v3_) {
+		space_.store_relaxed(dist_reg::control, dist_control::affinityRouting(true)
+				| dist_control::enableGrp1(true));
+		waitForRwp_();
+	} else {
+		space_.store_relaxed(dist_reg::control, dist_control::enable(true));
+	}
 }
 
 void GicDistributor::initOnThisCpu() {
+	if (v3_)
+		arch::scalar_store_relaxed<uint32_t>(getCpuData()->gicCpuInterface->ppiSpace(),
+				dist_reg::irqGroupBase, 0xFFFF'FFFF);
+
 	for (int i = 0; i < 32; i++) {
 		auto pin = irqPins_[i];
 		pin->mask();
@@ -101,12 +158,38 @@ void GicDistributor::initOnThisCpu() {
 	}
 }
 
-void GicDistributor::sendIpi(uint8_t ifaceNo, uint8_t id) {
-	space_.store_relaxed(dist_reg::sgi, dist_sgi::sgiNo(id) | dist_sgi::cpuTargetList(1 << ifaceNo) | dist_sgi::targetListFilter(0));
+namespace {
+	// SGIs are generated by writing ICC_SGI1R_EL1.
+	void writeSgi1r(uint64_t v) {
+		// Make prior memory accesses visible to the target before the SGI arrives.
+		asm volatile ("dsb ishst" ::: "memory");
+		asm volatile ("msr S3_0_C12_C11_5, %0" :: "r"(v));
+		asm volatile ("isb" ::: "memory");
+	}
+} // namespace anonymous
+
+void GicDistributor::sendIpi(GicCpuInterface *target, uint8_t id) {
+	auto t = target->routingTarget();
+	if (v3_) {
+		// Aff0 selects a bit in the target list; RS selects the range of 16 Aff0 values.
+		uint64_t aff0 = t & 0xFF;
+		uint64_t aff1 = (t >> 8) & 0xFF;
+		uint64_t aff2 = (t >> 16) & 0xFF;
+		uint64_t aff3 = (t >> 32) & 0xFF;
+		writeSgi1r((aff3 << 48) | ((aff0 >> 4) << 44) | (aff2 << 32)
+				| (uint64_t(id & 0xF) << 24) | (aff1 << 16) | (uint64_t(1) << (aff0 & 0xF)));
+	} else {
+		space_.store_relaxed(dist_reg::sgi, dist_sgi::sgiNo(id) | dist_sgi::cpuTargetList(1 << t) | dist_sgi::targetListFilter(0));
+	}
 }
 
 void GicDistributor::sendIpiToOthers(uint8_t id) {
-	space_.store_relaxed(dist_reg::sgi, dist_sgi::sgiNo(id) | dist_sgi::targetListFilter(1));
+	if (v3_) {
+		// IRM = 1 routes the SGI to all PEs except the current one.
+		writeSgi1r((uint64_t(1) << 40) | (uint64_t(id & 0xF) << 24));
+	} else {
+		space_.store_relaxed(dist_reg::sgi, dist_sgi::sgiNo(id) | dist_sgi::targetListFilter(1));
+	}
 }
 
 frg::string<KernelAlloc> GicDistributor::buildPinName(uint32_t irq) {
@@ -136,7 +219,7 @@ IrqStrategy GicDistributor::Pin::program(TriggerMode mode, Polarity polarity) {
 	assert(success);
 
 	if (irq_ >= 32)
-		setAffinity_(getCpuData()->gicCpuInterface->interfaceNumber());
+		setAffinity_(getCpuData()->gicCpuInterface->routingTarget());
 
 	assert(globalIrqSlots[irq_]->isAvailable());
 	globalIrqSlots[irq_]->link(this);
@@ -151,25 +234,51 @@ IrqStrategy GicDistributor::Pin::program(TriggerMode mode, Polarity polarity) {
 	}
 }
 
+arch::mem_space GicDistributor::Pin::space_() {
+	if (irq_ < 32)
+		return getCpuData()->gicCpuInterface->ppiSpace();
+	return parent_->space_;
+}
+
 void GicDistributor::Pin::mask() {
 	size_t regOff = (irq_ / 32) * 4;
 	size_t bitOff = irq_ & 31;
 
-	arch::scalar_store_relaxed<uint32_t>(parent_->space_, dist_reg::irqClearEnableBase + regOff, (1 << bitOff));
+	arch::scalar_store_relaxed<uint32_t>(space_(), dist_reg::irqClearEnableBase + regOff, (1 << bitOff));
 }
 
 void GicDistributor::Pin::unmask() {
 	size_t regOff = (irq_ / 32) * 4;
 	size_t bitOff = irq_ & 31;
 
-	arch::scalar_store_relaxed<uint32_t>(parent_->space_, dist_reg::irqSetEnableBase + regOff, (1 << bitOff));
+	arch::scalar_store_relaxed<uint32_t>(space_(), dist_reg::irqSetEnableBase + regOff, (1 << bitOff));
 }
 
 void GicDistributor::Pin::sendEoi() {
 	getCpuData()->gicCpuInterface->eoi(0, irq_);
 }
 
-void GicDistributor::Pin::setAffinity_(uint8_t ifaceNo) {
+Error GicDistributor::Pin::retarget(int cpu) {
+	// SGIs and PPIs are always delivered to the CPU that they belong to.
+	if (irq_ < 32)
+		return Error::noHardwareSupport;
+
+	auto iface = getCpuData(cpu)->gicCpuInterface;
+	if (!iface)
+		return Error::illegalArgs;
+	setAffinity_(iface->routingTarget());
+	return Error::success;
+}
+
+void GicDistributor::Pin::setAffinity_(uint64_t target) {
+	assert(irq_ >= 32);
+
+	if (parent_->v3_) {
+		arch::scalar_store_relaxed<uint64_t>(parent_->space_,
+				dist_reg::irqRouterBase + irq_ * 8, target);
+		return;
+	}
+
 	size_t regOff = (irq_ / 4) * 4;
 	size_t bitOff = (irq_ & 3) * 8;
 
@@ -177,7 +286,7 @@ void GicDistributor::Pin::setAffinity_(uint8_t ifaceNo) {
 			dist_reg::irqTargetBase + regOff);
 
 	v &= ~(0xFF << bitOff);
-	v |= (1 << ifaceNo) << bitOff;
+	v |= (1 << target) << bitOff;
 
 	arch::scalar_store_relaxed<uint32_t>(parent_->space_,
 			dist_reg::irqTargetBase + regOff, v);
@@ -187,13 +296,13 @@ void GicDistributor::Pin::setPriority_(uint8_t prio) {
 	size_t regOff = (irq_ / 4) * 4;
 	size_t bitOff = (irq_ & 3) * 8;
 
-	auto v = arch::scalar_load_relaxed<uint32_t>(parent_->space_,
+	auto v = arch::scalar_load_relaxed<uint32_t>(space_(),
 			dist_reg::irqPriorityBase + regOff);
 
 	v &= ~(0xFF << bitOff);
 	v |= uint32_t(prio) << bitOff;
 
-	arch::scalar_store_relaxed<uint32_t>(parent_->space_,
+	arch::scalar_store_relaxed<uint32_t>(space_(),
 			dist_reg::irqPriorityBase + regOff, v);
 }
 
@@ -207,19 +316,30 @@ bool GicDistributor::Pin::setMode(TriggerMode trigger, Polarity polarity) {
 	if (polarity == Polarity::low)
 		return false;
 
-	auto v = arch::scalar_load_relaxed<uint32_t>(parent_->space_,
+	auto v = arch::scalar_load_relaxed<uint32_t>(space_(),
 			dist_reg::irqConfigBase + i * 4);
 
 	v &= ~(3 << j);
 	v |= (trigger == TriggerMode::edge ? 2 : 0) << j;
 
-	arch::scalar_store_relaxed<uint32_t>(parent_->space_,
+	arch::scalar_store_relaxed<uint32_t>(space_(),
 			dist_reg::irqConfigBase + i * 4, v);
 
 	return true;
 }
 
 void GicDistributor::dumpPendingSgis() {
+	// GICv3 does not track the source CPU of pending SGIs.
+	if (v3_) {
+		auto pending = arch::scalar_load_relaxed<uint32_t>(getCpuData()->gicCpuInterface->ppiSpace(),
+				dist_reg::irqSetPendingBase);
+		for (int i = 0; i < 16; i++) {
+			if (pending & (1 << i))
+				infoLogger() << "thor: on CPU " << getCpuData()->cpuIndex << ", SGI " << i << " pending" << frg::endlog;
+		}
+		return;
+	}
+
 	for (int i = 0; i < 16; i++) {
 		int off = (i % 4) * 8;
 		int reg = (i / 4);
@@ -236,6 +356,12 @@ void GicDistributor::dumpPendingSgis() {
 	}
 }
 
+uint64_t GicDistributor::getCurrentTarget_() {
+	if (v3_)
+		return currentAffinity();
+	return getCurrentCpuIfaceNo_();
+}
+
 uint8_t GicDistributor::getCurrentCpuIfaceNo_() {
 	for (size_t i = 0; i < 8; i++) {
 		auto v = arch::scalar_load_relaxed<uint32_t>(space_, dist_reg::irqTargetBase + i * 4);
@@ -284,23 +410,19 @@ namespace cpu_ack_eoi {
 	arch::field<uint32_t, uint8_t> cpuId{10, 3};
 } // namespace cpu_control
 
-GicCpuInterface::GicCpuInterface(GicDistributor *dist, uintptr_t addr, size_t size)
-: dist_{dist}, space_{}, useSplitEoiDeact_{}, ifaceNo_{} {
+GicCpuInterfaceV2::GicCpuInterfaceV2(GicDistributor *dist, uintptr_t addr, size_t size)
+: GicCpuInterface{dist}, space_{}, useSplitEoiDeact_{} {
 	if (size > 0x1000) {
 		useSplitEoiDeact_ = true;
 		infoLogger() << "thor: Using split EOI/Deactivate mode" << frg::endlog;
 	}
 
-	auto ptr = KernelVirtualMemory::global().allocate(size);
-
-	for (size_t i = 0; i < size; i += kPageSize) {
-		KernelPageSpace::global().mapSingle4k(VirtualAddr(ptr) + i, addr + i,
-				page_access::write, CachingMode::mmio);
-	}
-	space_ = arch::mem_space{ptr};
+	space_ = arch::mem_space{mapRegisters(addr, size)};
+	// SGIs and PPIs are banked in the distributor.
+	ppiSpace_ = dist->space_;
 }
 
-void GicCpuInterface::init() {
+void GicCpuInterfaceV2::init() {
 	dist_->initOnThisCpu();
 
 	space_.store_relaxed(cpu_reg::priorityMask, 0xF0);
@@ -308,7 +430,7 @@ void GicCpuInterface::init() {
 	for (int i = 0; i < 4; i++)
 		arch::scalar_store_relaxed<uint32_t>(space_, cpu_reg::activePriorityBase + i * 4, 0);
 
-	ifaceNo_ = dist_->getCurrentCpuIfaceNo_();
+	target_ = dist_->getCurrentCpuIfaceNo_();
 
 	auto bypass = space_.load_relaxed(cpu_reg::control) & cpu_control::bypass;
 
@@ -318,7 +440,7 @@ void GicCpuInterface::init() {
 			| cpu_control::eoiModeNs(useSplitEoiDeact_));
 }
 
-frg::tuple<uint8_t, uint32_t> GicCpuInterface::get() {
+frg::tuple<uint8_t, uint32_t> GicCpuInterfaceV2::get() {
 	auto v = space_.load_relaxed(cpu_reg::ack);
 
 	if (useSplitEoiDeact_ && (v & cpu_ack_eoi::irqId) < 1020)
@@ -327,7 +449,7 @@ frg::tuple<uint8_t, uint32_t> GicCpuInterface::get() {
 	return {v & cpu_ack_eoi::cpuId, v & cpu_ack_eoi::irqId};
 }
 
-void GicCpuInterface::eoi(uint8_t cpuId, uint32_t irqId) {
+void GicCpuInterfaceV2::eoi(uint8_t cpuId, uint32_t irqId) {
 	if (useSplitEoiDeact_) {
 		space_.store_relaxed(cpu_reg::deact, cpu_ack_eoi::cpuId(cpuId) | cpu_ack_eoi::irqId(irqId));
 	} else {
@@ -335,10 +457,126 @@ void GicCpuInterface::eoi(uint8_t cpuId, uint32_t irqId) {
 	}
 }
 
-uint8_t GicCpuInterface::getCurrentPriority() {
+uint8_t GicCpuInterfaceV2::getCurrentPriority() {
 	return space_.load_relaxed(cpu_reg::runningPriority);
 }
 
+// ---------------------------------------------------------------------
+// CpuInterface (GICv3 system registers)
+// ---------------------------------------------------------------------
+
+namespace redist_reg {
+	static constexpr arch::bit_register<uint32_t> waker{0x14};
+	static constexpr uintptr_t type = 0x08;
+
+	// Offset of the SGI frame that follows the RD frame.
+	static constexpr uintptr_t sgiFrame = 0x10000;
+} // namespace redist_reg
+
+namespace redist_waker {
+	arch::field<uint32_t, bool> processorSleep{1, 1};
+	arch::field<uint32_t, bool> childrenAsleep{2, 1};
+} // namespace redist_waker
+
+namespace redist_type {
+	static constexpr uint64_t virtualLpis = uint64_t(1) << 1;
+	static constexpr uint64_t last = uint64_t(1) << 4;
+} // namespace redist_type
+
+// The assembler does not necessarily know the ICC_* names, hence we use the encodings.
+#define ICC_IAR1_EL1 "S3_0_C12_C12_0"
+#define ICC_EOIR1_EL1 "S3_0_C12_C12_1"
+#define ICC_BPR1_EL1 "S3_0_C12_C12_3"
+#define ICC_CTLR_EL1 "S3_0_C12_C12_4"
+#define ICC_SRE_EL1 "S3_0_C12_C12_5"
+#define ICC_IGRPEN1_EL1 "S3_0_C12_C12_7"
+#define ICC_AP1R0_EL1 "S3_0_C12_C9_0"
+#define ICC_DIR_EL1 "S3_0_C12_C11_1"
+#define ICC_RPR_EL1 "S3_0_C12_C11_3"
+#define ICC_PMR_EL1 "S3_0_C4_C6_0"
+
+GicCpuInterfaceV3::GicCpuInterfaceV3(GicDistributor *dist)
+: GicCpuInterface{dist} {
+	target_ = currentAffinity();
+}
+
+void GicCpuInterfaceV3::setupRedistributor_() {
+	assert(dist_->redistPtr_);
+
+	// GICR_TYPER stores the affinity as Aff3.Aff2.Aff1.Aff0.
+	uint64_t affinity = ((target_ >> 8) & 0xFF00'0000) | (target_ & 0xFF'FFFF);
+
+	for (size_t off = 0; off < dist_->redistSize_; ) {
+		arch::mem_space rd{reinterpret_cast<char *>(dist_->redistPtr_) + off};
+		auto type = arch::scalar_load_relaxed<uint64_t>(rd, redist_reg::type);
+
+		if ((type >> 32) == affinity) {
+			// Wake up the redistributor.
+			rd.store_relaxed(redist_reg::waker, redist_waker::processorSleep(false));
+			while (rd.load_relaxed(redist_reg::waker) & redist_waker::childrenAsleep)
+				;
+
+			ppiSpace_ = arch::mem_space{reinterpret_cast<char *>(dist_->redistPtr_)
+					+ off + redist_reg::sgiFrame};
+			return;
+		}
+
+		if (type & redist_type::last)
+			break;
+		// GICv4 redistributors have two additional frames for virtual LPIs.
+		off += (type & redist_type::virtualLpis) ? 0x40000 : 0x20000;
+	}
+
+	panicLogger() << "thor: Unable to find the GIC redistributor of CPU "
+			<< getCpuData()->cpuIndex << frg::endlog;
+}
+
+void GicCpuInterfaceV3::init() {
+	setupRedistributor_();
+
+	// Enable the system register interface.
+	uint64_t sre;
+	asm volatile ("mrs %0, " ICC_SRE_EL1 : "=r"(sre));
+	asm volatile ("msr " ICC_SRE_EL1 ", %0" :: "r"(sre | 1));
+	asm volatile ("isb" ::: "memory");
+
+	dist_->initOnThisCpu();
+
+	asm volatile ("msr " ICC_PMR_EL1 ", %0" :: "r"(uint64_t{0xF0}));
+	asm volatile ("msr " ICC_BPR1_EL1 ", %0" :: "r"(uint64_t{0}));
+	asm volatile ("msr " ICC_AP1R0_EL1 ", %0" :: "r"(uint64_t{0}));
+
+	// Like on GICv2, we split priority drop (in get()) and deactivation (in eoi()).
+	uint64_t ctlr;
+	asm volatile ("mrs %0, " ICC_CTLR_EL1 : "=r"(ctlr));
+	asm volatile ("msr " ICC_CTLR_EL1 ", %0" :: "r"(ctlr | (1 << 1)));
+
+	asm volatile ("msr " ICC_IGRPEN1_EL1 ", %0" :: "r"(uint64_t{1}));
+	asm volatile ("isb" ::: "memory");
+}
+
+frg::tuple<uint8_t, uint32_t> GicCpuInterfaceV3::get() {
+	uint64_t v;
+	asm volatile ("mrs %0, " ICC_IAR1_EL1 : "=r"(v) :: "memory");
+	uint32_t irq = v & 0xFF'FFFF;
+
+	if (irq < 1020)
+		asm volatile ("msr " ICC_EOIR1_EL1 ", %0" :: "r"(v));
+
+	// The source CPU of SGIs is not reported.
+	return {0, irq};
+}
+
+void GicCpuInterfaceV3::eoi(uint8_t, uint32_t irqId) {
+	asm volatile ("msr " ICC_DIR_EL1 ", %0" :: "r"(uint64_t{irqId}) : "memory");
+}
+
+uint8_t GicCpuInterfaceV3::getCurrentPriority() {
+	uint64_t v;
+	asm volatile ("mrs %0, " ICC_RPR_EL1 : "=r"(v));
+	return v & 0xFF;
+}
+
 // --------------------------------------------------------------------
 // Initialization
 // --------------------------------------------------------------------
@@ -367,12 +605,20 @@ static initgraph::Task initGic{&globalInitEngine, "arm.init-gic",
 		infoLogger() << "thor: found the GIC at node \"" << gicNode->path() << "\"" << frg::endlog;
 		assert(gicNode->reg().size() >= 2);
 
-		dist.initialize(gicNode->reg()[0].addr);
+		// For GICv3, reg[1] is the redistributor region. We do not support
+		// multiple redistributor regions (i.e., #redistributor-regions > 1).
+		bool v3 = gicNode->isCompatible(dtGicV3Compatible);
+		infoLogger() << "thor: Using GICv" << (v3 ? 3 : 2) << frg::endlog;
+
+		dist.initialize(gicNode->reg()[0].addr, gicNode->reg()[0].size, v3);
+		if (v3) {
+			dist->setRedistributorRegion(gicNode->reg()[1].addr, gicNode->reg()[1].size);
+		}else{
+			cpuInterfaceAddr = gicNode->reg()[1].addr;
+			cpuInterfaceSize = gicNode->reg()[1].size;
+		}
 		dist->init();
 
-		cpuInterfaceAddr = gicNode->reg()[1].addr;
-		cpuInterfaceSize = gicNode->reg()[1].size;
-
 		initGicOnThisCpu();
 	}
 };
@@ -385,9 +631,14 @@ initgraph::Stage *getIrqControllerReadyStage() {
 void initGicOnThisCpu() {
 	auto cpuData = getCpuData();
 
-	cpuData->gicCpuInterface = frg::construct<GicCpuInterface>(*kernelAlloc,
-			dist.get(),
-			cpuInterfaceAddr, cpuInterfaceSize);
+	if (dist->isV3()) {
+		cpuData->gicCpuInterface = frg::construct<GicCpuInterfaceV3>(*kernelAlloc,
+				dist.get());
+	} else {
+		cpuData->gicCpuInterface = frg::construct<GicCpuInterfaceV2>(*kernelAlloc,
+				dist.get(),
+				cpuInterfaceAddr, cpuInterfaceSize);
+	}
 	cpuData->gicCpuInterface->init();
 }
 
@@ -2,6 +2,7 @@
 #include <thor-internal/arch/ints.hpp>
 #include <thor-internal/arch/gic.hpp>
 #include <thor-internal/debug.hpp>
+#include <thor-internal/profile.hpp>
 #include <thor-internal/thread.hpp>
 #include <assert.h>
 
@@ -24,10 +25,11 @@ void suspendSelf() {
 extern frg::manual_box<GicDistributor> dist;
 
 void sendPingIpi(int id) {
-	dist->sendIpi(getCpuData(id)->gicCpuInterface->interfaceNumber(), 0);
+	dist->sendIpi(getCpuData(id)->gicCpuInterface, 0);
 }
 
 void sendShootdownIpi() {
+	numShootdownIpis.increment();
 	dist->sendIpiToOthers(1);
 }
 
@@ -67,11 +67,8 @@ void PageBinding::rebind() {
 	assert(_boundSpace);
 	auto context = &getCpuData()->pageContext;
 
-	// Invalidate old TLB contents for this TTBR0's ASID
-	uint64_t old_ttbr0;
-	asm volatile ("mrs %0, ttbr0_el1" : "=r" (old_ttbr0) :: "memory");
-	invalidateAsid((old_ttbr0 >> 48) & 0xFFFF);
-
+	// Shootdowns also invalidate the ASIDs of non-primary bindings,
+	// hence the TLB entries of this ASID are still valid.
 	auto ttbr0 = (uint64_t(_asid) << 48) | _boundSpace->rootTable();
 	asm volatile ("dsb st; msr ttbr0_el1, %0; dsb sy; isb" :: "r" (ttbr0) : "memory");
 
@@ -99,14 +96,13 @@ void PageBinding::rebind(smarter::shared_ptr<PageSpace> space) {
 	_boundSpace = space;
 	_alreadyShotSequence = target_seq;
 
-	// Invalidate old TLB contents for this TTBR0's ASID
-	uint64_t old_ttbr0;
-	asm volatile ("mrs %0, ttbr0_el1" : "=r" (old_ttbr0) :: "memory");
-	invalidateAsid((old_ttbr0 >> 48) & 0xFFFF);
-
 	auto ttbr0 = (uint64_t(_asid) << 48) | _boundSpace->rootTable();
 	asm volatile ("msr ttbr0_el1, %0; isb; dsb sy; isb" :: "r" (ttbr0) : "memory");
 
+	// Drop the entries of the space that was previously tagged with this ASID.
+	// This is done after the switch so that no stale entries can be refilled.
+	invalidateAsid(_asid);
+
 	_primaryStamp = context->_nextStamp++;
 	context->_primaryBinding = this;
 
@@ -163,10 +159,8 @@ void PageBinding::unbind() {
 		return;
 
 	// Perform shootdown.
-	if (!isPrimary()) {
-		// If there was only a single binding, it would have been primary.
-		invalidateAsid(_asid);
-	}
+	// rebind() does not flush the ASID anymore, so this is also required for primary bindings.
+	invalidateAsid(_asid);
 
 	frg::intrusive_list<
 		ShootNode,
@@ -492,6 +486,7 @@ static inline constexpr uint64_t kPageGRE = (1 << 2);
 static inline constexpr uint64_t kPagenGnRnE = (2 << 2);
 static inline constexpr uint64_t kPagenGnRE = (3 << 2);
 static inline constexpr uint64_t kPageUc = (4 << 2);
+static inline constexpr uint64_t kPageWt = (5 << 2);
 static inline constexpr uint64_t kPageAddress = 0xFFFFFFFFF000;
 
 void KernelPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
@@ -584,6 +579,8 @@ void KernelPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
 		new_entry |= kPagenGnRE | kPageOuterSh;
 	else if (caching_mode == CachingMode::mmioNonPosted)
 		new_entry |= kPagenGnRnE | kPageOuterSh;
+	else if (caching_mode == CachingMode::writeThrough)
+		new_entry |= kPageWt | kPageInnerSh;
 	else {
 		assert(caching_mode == CachingMode::null || caching_mode == CachingMode::writeBack);
 		new_entry |= kPageWb | kPageInnerSh;
@@ -711,10 +708,10 @@ void ClientPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical, bo
 	if (tbl0[index0].load() & kPageValid) {
 		accessor1 = PageAccessor{tbl0[index0].load() & kPageAddress};
 	} else {
-		auto tbl_address = physicalAllocator->allocate(kPageSize);
+		auto tbl_address = physicalAllocator->allocateZeroedPage();
 		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		_numTablePages.fetch_add(1, std::memory_order_relaxed);
 		accessor1 = PageAccessor{tbl_address};
-		memset(accessor1.get(), 0, kPageSize);
 
 		uint64_t new_entry = tbl_address | kPageValid | kPageTable;
 		tbl0[index0].store(new_entry);
@@ -724,10 +721,10 @@ void ClientPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical, bo
 	if (tbl1[index1].load() & kPageValid) {
 		accessor2 = PageAccessor{tbl1[index1].load() & kPageAddress};
 	} else {
-		auto tbl_address = physicalAllocator->allocate(kPageSize);
+		auto tbl_address = physicalAllocator->allocateZeroedPage();
 		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		_numTablePages.fetch_add(1, std::memory_order_relaxed);
 		accessor2 = PageAccessor{tbl_address};
-		memset(accessor2.get(), 0, kPageSize);
 
 		uint64_t new_entry = tbl_address | kPageValid | kPageTable;
 		tbl1[index1].store(new_entry);
@@ -737,10 +734,10 @@ void ClientPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical, bo
 	if (tbl2[index2].load() & kPageValid) {
 		accessor3 = PageAccessor{tbl2[index2].load() & kPageAddress};
 	} else {
-		auto tbl_address = physicalAllocator->allocate(kPageSize);
+		auto tbl_address = physicalAllocator->allocateZeroedPage();
 		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		_numTablePages.fetch_add(1, std::memory_order_relaxed);
 		accessor3 = PageAccessor{tbl_address};
-		memset(accessor3.get(), 0, kPageSize);
 
 		uint64_t new_entry = tbl_address | kPageValid | kPageTable;
 		tbl2[index2].store(new_entry);
@@ -763,6 +760,8 @@ void ClientPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical, bo
 		new_entry |= kPagenGnRE | kPageOuterSh;
 	else if (caching_mode == CachingMode::mmioNonPosted)
 		new_entry |= kPagenGnRnE | kPageOuterSh;
+	else if (caching_mode == CachingMode::writeThrough)
+		new_entry |= kPageWt | kPageInnerSh;
 	else {
 		assert(caching_mode == CachingMode::null || caching_mode == CachingMode::writeBack);
 		new_entry |= kPageWb | kPageInnerSh;
@@ -996,4 +995,63 @@ bool ClientPageSpace::updatePageAccess(VirtualAddr pointer) {
 	return true;
 }
 
+void ClientPageSpace::detachEmptyTables(VirtualAddr va, size_t size, DetachedPageList &list) {
+	constexpr uintptr_t l2Span = uintptr_t(1) << 30;
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	// Invalid entries are always zero since unmapSingle4k() clears the entire descriptor.
+	auto isEmpty = [] (arch::scalar_variable<uint64_t> *tbl) {
+		for (int i = 0; i < 512; i++) {
+			if (tbl[i].load())
+				return false;
+		}
+		return true;
+	};
+
+	// Level 0 is always present. We do not reclaim level 1 tables.
+	PageAccessor accessor0{rootTable()};
+	auto tbl0 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor0.get());
+
+	auto end = va + size;
+	for (auto l2Base = va & ~(l2Span - 1); l2Base < end; l2Base += l2Span) {
+		auto index0 = (int)((l2Base >> 39) & 0x1FF);
+		auto index1 = (int)((l2Base >> 30) & 0x1FF);
+
+		if (!(tbl0[index0].load() & kPageValid))
+			continue;
+		PageAccessor accessor1{tbl0[index0].load() & kPageAddress};
+		auto tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
+
+		if (!(tbl1[index1].load() & kPageValid))
+			continue;
+		PageAccessor accessor2{tbl1[index1].load() & kPageAddress};
+		auto tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor2.get());
+
+		auto l3Begin = frg::max(va, l2Base) & ~(kHugePageSize - 1);
+		auto l3End = frg::min(end, l2Base + l2Span);
+		for (auto l3Base = l3Begin; l3Base < l3End; l3Base += kHugePageSize) {
+			auto index2 = (int)((l3Base >> 21) & 0x1FF);
+			auto entry = tbl2[index2].load();
+			if (!(entry & kPageValid))
+				continue;
+
+			PageAccessor accessor3{entry & kPageAddress};
+			if (!isEmpty(reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor3.get())))
+				continue;
+			tbl2[index2].store(0);
+			list.push(entry & kPageAddress);
+			_numTablePages.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		if (!isEmpty(tbl2))
+			continue;
+		auto entry = tbl1[index1].load();
+		tbl1[index1].store(0);
+		list.push(entry & kPageAddress);
+		_numTablePages.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
 }
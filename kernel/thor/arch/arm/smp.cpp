@@ -241,6 +241,8 @@ static initgraph::Task initAPs{&globalInitEngine, "arm.init-aps",
 
 			return false;
 		});
+
+		Scheduler::enableLoadBalancing();
 	}
 };
 }
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string.h>
+
+namespace thor {
+
+// Copies large buffers in kernel memory (e.g., pages in the physical window).
+// The kernel is built with -mgeneral-regs-only, so NEON is not available;
+// memcpy() already compiles to ldp/stp pairs.
+inline void bulkCopy(void *dest, const void *src, size_t size) {
+	memcpy(dest, src, size);
+}
+
+} // namespace thor
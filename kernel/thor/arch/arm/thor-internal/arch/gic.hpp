@@ -9,14 +9,25 @@ namespace thor {
 
 struct GicCpuInterface;
 
+// Supports GICv2 (memory-mapped CPU interface) and GICv3/v4 (affinity routing,
+// per-CPU redistributors and the ICC_* system register CPU interface).
 struct GicDistributor {
 	friend struct GicCpuInterface;
+	friend struct GicCpuInterfaceV2;
+	friend struct GicCpuInterfaceV3;
 
-	GicDistributor(uintptr_t addr);
+	GicDistributor(uintptr_t addr, size_t size, bool v3);
+
+	bool isV3() const {
+		return v3_;
+	}
+
+	// GICv3 only: registers the GICR frames of all CPUs.
+	void setRedistributorRegion(uintptr_t addr, size_t size);
 
 	void init();
 	void initOnThisCpu();
-	void sendIpi(uint8_t ifaceNo, uint8_t id);
+	void sendIpi(GicCpuInterface *target, uint8_t id);
 	void sendIpiToOthers(uint8_t id);
 	void dumpPendingSgis();
 
@@ -40,8 +51,14 @@ struct GicDistributor {
 
 		bool setMode(TriggerMode trigger, Polarity polarity);
 
+	protected:
+		Error retarget(int cpu) override;
+
 	private:
-		void setAffinity_(uint8_t ifaceNo);
+		// Registers of SGIs and PPIs are banked per CPU.
+		arch::mem_space space_();
+
+		void setAffinity_(uint64_t target);
 		void setPriority_(uint8_t prio);
 
 		GicDistributor *parent_;
@@ -58,37 +75,83 @@ struct GicDistributor {
 
 private:
 	uint8_t getCurrentCpuIfaceNo_();
+	// Routing target of the current CPU, see GicCpuInterface::routingTarget().
+	uint64_t getCurrentTarget_();
+	void waitForRwp_();
 
 	uintptr_t base_;
+	bool v3_;
 	arch::mem_space space_;
 	frg::vector<Pin *, KernelAlloc> irqPins_;
+
+	void *redistPtr_ = nullptr;
+	size_t redistSize_ = 0;
 };
 
 struct GicCpuInterface {
-	GicCpuInterface(GicDistributor *dist, uintptr_t addr, size_t size);
+	GicCpuInterface(GicDistributor *dist)
+	: dist_{dist} { }
 
-	void init();
+	virtual ~GicCpuInterface() = default;
+
+	virtual void init() = 0;
 
 	// returns {cpuId, irqId}
-	frg::tuple<uint8_t, uint32_t> get();
-	void eoi(uint8_t cpuId, uint32_t irqId);
+	virtual frg::tuple<uint8_t, uint32_t> get() = 0;
+	virtual void eoi(uint8_t cpuId, uint32_t irqId) = 0;
 
-	uint8_t getCurrentPriority();
+	virtual uint8_t getCurrentPriority() = 0;
 
 	GicDistributor *getDistributor() const {
 		return dist_;
 	}
 
-	uint8_t interfaceNumber() const {
-		return ifaceNo_;
+	// GICv2: number of the CPU interface.
+	// GICv3: affinity of the CPU in the format of GICD_IROUTER (i.e., MPIDR without the flag bits).
+	uint64_t routingTarget() const {
+		return target_;
 	}
 
-private:
+	// Registers that configure the SGIs and PPIs of this CPU.
+	// GICv2: the (banked) distributor. GICv3: the SGI frame of the redistributor.
+	arch::mem_space ppiSpace() const {
+		return ppiSpace_;
+	}
+
+protected:
 	GicDistributor *dist_;
+	uint64_t target_ = 0;
+	arch::mem_space ppiSpace_;
+};
+
+struct GicCpuInterfaceV2 final : GicCpuInterface {
+	GicCpuInterfaceV2(GicDistributor *dist, uintptr_t addr, size_t size);
+
+	void init() override;
+
+	frg::tuple<uint8_t, uint32_t> get() override;
+	void eoi(uint8_t cpuId, uint32_t irqId) override;
+
+	uint8_t getCurrentPriority() override;
+
+private:
 	arch::mem_space space_;
 	bool useSplitEoiDeact_;
+};
+
+struct GicCpuInterfaceV3 final : GicCpuInterface {
+	GicCpuInterfaceV3(GicDistributor *dist);
+
+	void init() override;
 
-	uint8_t ifaceNo_;
+	frg::tuple<uint8_t, uint32_t> get() override;
+	void eoi(uint8_t cpuId, uint32_t irqId) override;
+
+	uint8_t getCurrentPriority() override;
+
+private:
+	// Finds and wakes up the redistributor of this CPU.
+	void setupRedistributor_();
 };
 
 initgraph::Stage *getIrqControllerReadyStage();
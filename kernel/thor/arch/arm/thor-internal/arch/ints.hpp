@@ -27,6 +27,9 @@ inline void halt() {
 
 void suspendSelf();
 
+// The idle loop only uses WFI, hence there is no state to reset.
+inline void resetIdleWakeState() { }
+
 void sendPingIpi(int id);
 void sendShootdownIpi();
 
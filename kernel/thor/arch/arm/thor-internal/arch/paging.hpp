@@ -11,9 +11,13 @@
 
 namespace thor {
 
+struct DetachedPageList;
+
 enum {
 	kPageSize = 0x1000,
-	kPageShift = 12
+	kPageShift = 12,
+	kHugePageSize = 0x200000,
+	kHugePageShift = 21
 };
 
 constexpr Word kPfAccess = 1;
@@ -105,6 +109,8 @@ private:
 };
 
 // Functions for debugging kernel page access:
+// Note that eir maps most of the physical mapping using 2 MiB pages; these functions
+// only work for pages that are mapped individually.
 // Deny all access to the physical mapping.
 void poisonPhysicalAccess(PhysicalAddr physical);
 // Deny write access to the physical mapping.
@@ -410,13 +416,29 @@ public:
 
 	void mapSingle4k(VirtualAddr pointer, PhysicalAddr physical, bool user_access,
 			uint32_t flags, CachingMode caching_mode);
+	// TODO: Support 2 MiB block mappings.
+	bool mapSingle2m(VirtualAddr, PhysicalAddr, bool, uint32_t, CachingMode) {
+		return false;
+	}
 	PageStatus unmapSingle4k(VirtualAddr pointer);
 	PageStatus cleanSingle4k(VirtualAddr pointer);
 	bool isMapped(VirtualAddr pointer);
 	bool updatePageAccess(VirtualAddr pointer);
 
+	// Detaches level 2 and level 3 tables that overlap [va, va + size) and are empty.
+	// The caller frees them after the range was shot down.
+	void detachEmptyTables(VirtualAddr va, size_t size, DetachedPageList &list);
+
+	// Number of pages that are used for page tables (including the root table).
+	size_t numTablePages() {
+		return _numTablePages.load(std::memory_order_relaxed);
+	}
+
 private:
 	frg::ticket_spinlock _mutex;
+
+	// Decreases when detachEmptyTables() reclaims tables.
+	std::atomic<size_t> _numTablePages{1};
 };
 
 } // namespace thor
@@ -1,5 +1,6 @@
 #include <thor-internal/arch/timer.hpp>
 #include <thor-internal/arch/cpu.hpp>
+#include <thor-internal/boot-profile.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/timer.hpp>
 #include <thor-internal/schedule.hpp>
@@ -19,6 +20,10 @@ uint64_t getRawTimestampCounter() {
 	return cntpct;
 }
 
+uint64_t rawTimestampCounterToNanos(uint64_t ticks) {
+	return ticks * 1000000 / ticksPerMilli;
+}
+
 uint64_t getVirtualTimestampCounter() {
 	uint64_t cntvct;
 	asm volatile ("mrs %0, cntvct_el0" : "=r"(cntvct));
@@ -37,7 +42,7 @@ struct PhysicalGenericTimer : IrqSink, ClockSource {
 	}
 
 	uint64_t currentNanos() override {
-		return getRawTimestampCounter() * 1000000 / ticksPerMilli;
+		return rawTimestampCounterToNanos(getRawTimestampCounter());
 	}
 };
 
@@ -5,6 +5,7 @@
 #include <thor-internal/kasan.hpp>
 #include <thor-internal/main.hpp>
 #include <thor-internal/physical.hpp>
+#include <thor-internal/acpi/acpi.hpp>
 
 namespace thor {
 
@@ -65,7 +66,7 @@ Executor::Executor()
 : _pointer{nullptr}, _syscallStack{nullptr}, _tss{nullptr} { }
 
 Executor::Executor(UserContext *context, AbiParameters abi) {
-	_pointer = (char *)kernelAlloc->allocate(determineSize());
+	_pointer = static_cast<char *>(allocateExecutorState(determineSize()));
 	memset(_pointer, 0, determineSize());
 
 	// Assert assumptions about xsave
@@ -87,7 +88,7 @@ Executor::Executor(UserContext *context, AbiParameters abi) {
 
 Executor::Executor(FiberContext *context, AbiParameters abi)
 : _syscallStack{nullptr}, _tss{nullptr} {
-	_pointer = (char *)kernelAlloc->allocate(determineSize());
+	_pointer = static_cast<char *>(allocateExecutorState(determineSize()));
 	memset(_pointer, 0, determineSize());
 
 	// Assert assumptions about xsave
@@ -106,7 +107,8 @@ Executor::Executor(FiberContext *context, AbiParameters abi)
 }
 
 Executor::~Executor() {
-	kernelAlloc->free(_pointer);
+	if(_pointer)
+		freeExecutorState(_pointer, determineSize());
 }
 
 void saveExecutor(Executor *executor, FaultImageAccessor accessor) {
@@ -135,11 +137,7 @@ void saveExecutor(Executor *executor, FaultImageAccessor accessor) {
 	executor->general()->clientFs = common::x86::rdmsr(common::x86::kMsrIndexFsBase);
 	executor->general()->clientGs = common::x86::rdmsr(common::x86::kMsrIndexKernelGsBase);
 
-	if(getGlobalCpuFeatures()->haveXsave){
-		common::x86::xsave((uint8_t*)executor->_fxState(), ~0);
-	} else {
-		asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
-	}
+	saveSimdState(executor);
 }
 
 void saveExecutor(Executor *executor, IrqImageAccessor accessor) {
@@ -168,12 +166,7 @@ void saveExecutor(Executor *executor, IrqImageAccessor accessor) {
 	executor->general()->clientFs = common::x86::rdmsr(common::x86::kMsrIndexFsBase);
 	executor->general()->clientGs = common::x86::rdmsr(common::x86::kMsrIndexKernelGsBase);
 
-
-	if(getGlobalCpuFeatures()->haveXsave){
-		common::x86::xsave((uint8_t*)executor->_fxState(), ~0);
-	}else{
-		asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
-	}
+	saveSimdState(executor);
 }
 
 void saveExecutor(Executor *executor, SyscallImageAccessor accessor) {
@@ -202,11 +195,7 @@ void saveExecutor(Executor *executor, SyscallImageAccessor accessor) {
 	executor->general()->clientFs = common::x86::rdmsr(common::x86::kMsrIndexFsBase);
 	executor->general()->clientGs = common::x86::rdmsr(common::x86::kMsrIndexKernelGsBase);
 
-	if(getGlobalCpuFeatures()->haveXsave){
-		common::x86::xsave((uint8_t*)executor->_fxState(), ~0);
-	}else{
-		asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
-	}
+	saveSimdState(executor);
 }
 
 void switchExecutor(smarter::borrowed_ptr<Thread> thread) {
@@ -412,8 +401,10 @@ static initgraph::Task enumerateCpuFeaturesTask{&globalInitEngine, "x86.enumerat
 			infoLogger() << "\e[37mthor: CPUs support XSAVE\e[39m" << frg::endlog;
 			globalCpuFeatures.haveXsave = true;
 
-			auto xsaveCpuid = common::x86::cpuid(0xD);
-			globalCpuFeatures.xsaveRegionSize = xsaveCpuid[2];
+			if(common::x86::cpuid(0xD, 1)[0] & 1) {
+				infoLogger() << "\e[37mthor: CPUs support XSAVEOPT\e[39m" << frg::endlog;
+				globalCpuFeatures.haveXsaveopt = true;
+			}
 		}else{
 			infoLogger() << "\e[37mthor: CPUs do not support XSAVE!\e[39m" << frg::endlog;
 		}
@@ -434,6 +425,35 @@ static initgraph::Task enumerateCpuFeaturesTask{&globalInitEngine, "x86.enumerat
 			}
 		}
 
+		if(globalCpuFeatures.haveXsave) {
+			uint64_t mask = 0;
+			mask |= (uint64_t(1) << 0); // x87 feature set
+			mask |= (uint64_t(1) << 1); // SSE feature set
+
+			if(globalCpuFeatures.haveAvx)
+				mask |= (uint64_t(1) << 2); // AVX feature set
+
+			if(globalCpuFeatures.haveZmm) {
+				mask |= (uint64_t(1) << 5); // AVX-512 opmask registers
+				mask |= (uint64_t(1) << 6); // ZMM{0 -> 15}
+				mask |= (uint64_t(1) << 7); // ZMM{16 -> 31}
+			}
+			globalCpuFeatures.xsaveMask = mask;
+
+			// CPUID.(EAX=0xD,ECX=0).ECX covers all supported components (including
+			// ones that we never enable, such as AMX tiles); only reserve space
+			// for the components in XCR0. Legacy region and header take 576 bytes.
+			size_t size = 576;
+			for(int i = 2; i < 64; i++) {
+				if(!(mask & (uint64_t(1) << i)))
+					continue;
+				auto componentCpuid = common::x86::cpuid(0xD, i);
+				size = frg::max(size, size_t(componentCpuid[1]) + componentCpuid[0]);
+			}
+			globalCpuFeatures.xsaveRegionSize = size;
+			infoLogger() << "thor: XSAVE area is " << size << " bytes" << frg::endlog;
+		}
+
 		if(common::x86::cpuid(0x80000007)[3] & (1 << 8)) {
 			infoLogger() << "\e[37mthor: CPUs support invariant TSC\e[39m"
 					<< frg::endlog;
@@ -451,6 +471,27 @@ static initgraph::Task enumerateCpuFeaturesTask{&globalInitEngine, "x86.enumerat
 					<< frg::endlog;
 		}
 
+		if(common::x86::cpuid(0x07)[1] & (1 << 9)) {
+			infoLogger() << "\e[37mthor: CPUs support enhanced rep movsb\e[39m" << frg::endlog;
+			globalCpuFeatures.haveErms = true;
+		}
+		if(common::x86::cpuid(0x07)[3] & (1 << 4)) {
+			infoLogger() << "\e[37mthor: CPUs support fast short rep movsb\e[39m" << frg::endlog;
+			globalCpuFeatures.haveFsrm = true;
+		}
+
+		if(common::x86::cpuid(0x01)[2] & (1 << 3)) {
+			infoLogger() << "\e[37mthor: CPUs support MONITOR/MWAIT\e[39m" << frg::endlog;
+			globalCpuFeatures.haveMwait = true;
+			if(common::x86::cpuid(0)[0] >= 5)
+				globalCpuFeatures.mwaitSubstates = common::x86::cpuid(0x05)[3];
+		}
+		if(common::x86::cpuid(0)[0] >= 6 && (common::x86::cpuid(0x06)[0] & (1 << 2))) {
+			infoLogger() << "\e[37mthor: CPUs support always running APIC timer\e[39m"
+					<< frg::endlog;
+			globalCpuFeatures.haveArat = true;
+		}
+
 		auto intelPmLeaf = common::x86::cpuid(0xA)[0];
 		if(intelPmLeaf & 0xFF) {
 			infoLogger() << "\e[37mthor: CPUs support Intel performance counters\e[39m"
@@ -560,6 +601,76 @@ static initgraph::Task initBootProcessorTask{&globalInitEngine, "x86.init-boot-p
 	}
 };
 
+namespace {
+	// Number of bits that are needed to represent n distinct IDs.
+	unsigned int idShiftFor(uint32_t n) {
+		unsigned int shift = 0;
+		while((uint32_t(1) << shift) < n)
+			shift++;
+		return shift;
+	}
+
+	// Derives the SMT and LLC domains of this CPU from its x2APIC ID.
+	void detectTopology(CpuData *cpuData) {
+		auto maxLeaf = common::x86::cpuid(0)[0];
+		auto maxExtendedLeaf = common::x86::cpuid(0x8000'0000)[0];
+
+		uint32_t apicId = cpuData->localApicId;
+		unsigned int smtShift = 0;
+		// Prefer the V2 extended topology leaf (0x1F) over leaf 0xB.
+		uint32_t topologyLeaves[] = {0x1F, 0xB};
+		for(auto leaf : topologyLeaves) {
+			if(maxLeaf < leaf)
+				continue;
+			// Leaf 0x1F is only valid if it reports at least one level.
+			if(!((common::x86::cpuid(leaf, 0)[2] >> 8) & 0xFF))
+				continue;
+			for(uint32_t level = 0; ; level++) {
+				auto regs = common::x86::cpuid(leaf, level);
+				auto type = (regs[2] >> 8) & 0xFF;
+				if(!type)
+					break;
+				if(type == 1) // SMT level.
+					smtShift = regs[0] & 0x1F;
+				apicId = regs[3];
+			}
+			break;
+		}
+
+		// Find the number of logical CPUs that share the highest level cache,
+		// using the deterministic cache parameters of Intel (leaf 4) or AMD (0x8000'001D).
+		auto sharingOfLastLevel = [] (uint32_t leaf) -> uint32_t {
+			uint32_t bestLevel = 0;
+			uint32_t sharing = 0;
+			for(uint32_t i = 0; i < 16; i++) {
+				auto regs = common::x86::cpuid(leaf, i);
+				if(!(regs[0] & 0x1F))
+					break;
+				auto level = (regs[0] >> 5) & 7;
+				if(level >= bestLevel) {
+					bestLevel = level;
+					sharing = ((regs[0] >> 14) & 0xFFF) + 1;
+				}
+			}
+			return sharing;
+		};
+		uint32_t llcSharing = 0;
+		if(maxLeaf >= 4)
+			llcSharing = sharingOfLastLevel(4);
+		if(!llcSharing && maxExtendedLeaf >= 0x8000'001D
+				&& (common::x86::cpuid(0x8000'0001)[2] & (uint32_t(1) << 22)))
+			llcSharing = sharingOfLastLevel(0x8000'001D);
+
+		cpuData->coreId = apicId >> smtShift;
+		// Without cache information, assume that all CPUs share a cache.
+		cpuData->llcId = llcSharing ? (apicId >> idShiftFor(llcSharing)) : 0;
+
+		infoLogger() << "thor: CPU " << cpuData->cpuIndex << " has APIC ID " << apicId
+				<< ", core " << cpuData->coreId << ", LLC " << cpuData->llcId
+				<< frg::endlog;
+	}
+}
+
 void initializeThisProcessor() {
 	auto cpuData = getCpuData();
 
@@ -567,6 +678,8 @@ void initializeThisProcessor() {
 	cpuData->cpuIndex = allCpuContexts->size();
 	allCpuContexts->push(cpuData);
 
+	detectTopology(cpuData);
+
 	// Allocate per-CPU areas.
 	cpuData->irqStack = UniqueKernelStack::make();
 	cpuData->dfStack = UniqueKernelStack::make();
@@ -638,20 +751,7 @@ void initializeThisProcessor() {
 		cr4 |= uint32_t(1) << 18; // Enable XSAVE and x{get, set}bv
 		asm volatile ("mov %0, %%cr4" : : "r" (cr4));
 
-		uint64_t xcr0 = 0;
-		xcr0 |= (uint64_t(1) << 0); // Enable saving of x87 feature set
-		xcr0 |= (uint64_t(1) << 1); // Enable saving of SSE feature set
-
-		if(getGlobalCpuFeatures()->haveAvx)
-			xcr0 |= (uint64_t(1) << 2); // Enable saving of AVX feature set and enable it
-
-		if(getGlobalCpuFeatures()->haveZmm) {
-			xcr0 |= (uint64_t(1) << 5); // Enable AVX-512
-			xcr0 |= (uint64_t(1) << 6); // Enable management of ZMM{0 -> 15}
-			xcr0 |= (uint64_t(1) << 7); // Enable management of ZMM{16 -> 31}
-		}
-
-		common::x86::wrxcr(0, xcr0);
+		common::x86::wrxcr(0, getGlobalCpuFeatures()->xsaveMask);
 	}
 
 	// Enable the SMAP extension.
@@ -695,9 +795,9 @@ void initializeThisProcessor() {
 	}
 
 	// Enable the PCID extension.
+	// All invalidations target the current PCID or use CR3 writes, hence INVPCID is not needed.
 	bool pcidBit = common::x86::cpuid(0x01)[2] & (uint32_t(1) << 17);
-	bool invpcidBit = common::x86::cpuid(0x07)[1] & (uint32_t(1) << 10);
-	if(pcidBit && invpcidBit) {
+	if(pcidBit) {
 		infoLogger() << "\e[37mthor: CPU supports PCIDs\e[39m" << frg::endlog;
 
 		uint64_t cr4;
@@ -706,9 +806,6 @@ void initializeThisProcessor() {
 		asm volatile ("mov %0, %%cr4" : : "r" (cr4));
 
 		cpuData->havePcids = true;
-	}else if(pcidBit) {
-		infoLogger() << "\e[37mthor: CPU supports PCIDs but no INVPCID;"
-				" will not use PCIDs!\e[39m" << frg::endlog;
 	}else{
 		infoLogger() << "\e[37mthor: CPU does not support PCIDs!\e[39m" << frg::endlog;
 	}
@@ -777,6 +874,22 @@ void secondaryMain(StatusBlock *statusBlock) {
 	scheduler->commitReschedule();
 }
 
+void resetSecondary(unsigned int apic_id) {
+	if(disableSmp)
+		return;
+
+	// On modern processors INIT lets the processor enter the wait-for-SIPI state.
+	// The BIOS is not involved in this process at all.
+	infoLogger() << "thor: Resetting AP " << apic_id << "." << frg::endlog;
+	raiseInitAssertIpi(apic_id);
+}
+
+void waitForSecondaryReset() {
+	if(disableSmp)
+		return;
+	KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(10'000'000)); // Wait for 10ms.
+}
+
 void bootSecondary(unsigned int apic_id) {
 	if(disableSmp)
 		return;
@@ -797,6 +910,7 @@ void bootSecondary(unsigned int apic_id) {
 
 	auto context = frg::construct<CpuData>(*kernelAlloc);
 	context->localApicId = apic_id;
+	context->numaNode = acpi::getNumaNodeOfApic(apic_id);
 
 	// Participate in global TLB invalidation *before* paging is used by the target CPU.
 	{
@@ -819,11 +933,8 @@ void bootSecondary(unsigned int apic_id) {
 	statusBlock->cpuContext = context;
 
 	// Send the IPI sequence that starts up the AP.
-	// On modern processors INIT lets the processor enter the wait-for-SIPI state.
-	// The BIOS is not involved in this process at all.
+	// The AP is already in the wait-for-SIPI state, see resetSecondary().
 	infoLogger() << "thor: Booting AP " << apic_id << "." << frg::endlog;
-	raiseInitAssertIpi(apic_id);
-	KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(10'000'000)); // Wait for 10ms.
 
 	// SIPI causes the processor to resume execution and resets CS:IP.
 	// Intel suggets to send two SIPIs (probably for redundancy reasons).
@@ -3,6 +3,7 @@
 #include <thor-internal/profile.hpp>
 #include <thor-internal/thread.hpp>
 #include <thor-internal/arch/cpu.hpp>
+#include <thor-internal/arch/paging.hpp>
 #include <thor-internal/arch/pmc-amd.hpp>
 #include <thor-internal/arch/pmc-intel.hpp>
 
@@ -497,6 +498,85 @@ extern "C" void onPlatformWork() {
 	disableInts();
 }
 
+namespace {
+	// Reads a word of user memory from NMI context. The page fault handler cannot run
+	// in NMI context; thus, we walk the page tables instead of going through a UAR.
+	// Returns false if the word is not mapped by regular (write-back) user memory.
+	bool peekUserWordFromNmi(uintptr_t address, uint64_t &word) {
+		if((address & 7) || address >= 0x8000'0000'0000)
+			return false;
+
+		uint64_t cr3;
+		asm volatile ("mov %%cr3, %0" : "=r"(cr3));
+		PhysicalAddr table = cr3 & 0x000F'FFFF'FFFF'F000;
+
+		for(int level = 3; level >= 0; level--) {
+			PageAccessor accessor{table};
+			auto entries = reinterpret_cast<uint64_t *>(accessor.get());
+			auto entry = __atomic_load_n(&entries[(address >> (12 + 9 * level)) & 0x1FF],
+					__ATOMIC_RELAXED);
+			if(!(entry & 0x1) || !(entry & 0x4)) // Present and user bits.
+				return false;
+
+			auto physical = entry & 0x000F'FFFF'FFFF'F000;
+			bool huge = (level == 1 || level == 2) && (entry & 0x80);
+			if(level && !huge) {
+				table = physical;
+				continue;
+			}
+
+			// Do not touch anything that might be MMIO (i.e., PWT, PCD or PAT are set).
+			if((entry & 0x18) || (entry & (huge ? 0x1000 : 0x80)))
+				return false;
+
+			uintptr_t pageSize = uintptr_t{1} << (12 + 9 * level);
+			physical = (physical & ~(pageSize - 1)) + (address & (pageSize - 1));
+			PageAccessor dataAccessor{physical & ~PhysicalAddr(kPageSize - 1)};
+			word = *reinterpret_cast<uint64_t *>(
+					reinterpret_cast<char *>(dataAccessor.get()) + (physical & (kPageSize - 1)));
+			return true;
+		}
+		__builtin_unreachable();
+	}
+
+	void recordProfileSample(NmiImageAccessor image) {
+		ProfileSample sample;
+		sample.ip = *image.ip();
+		sample.thread = 0;
+		sample.universe = 0;
+		sample.event = static_cast<uint32_t>(kernelProfileEvent);
+		sample.numFrames = 0;
+
+		bool inUser = *image.cs() == kSelClientUserCode;
+		if(inUser || *image.cs() == kSelExecutorFaultCode
+				|| *image.cs() == kSelExecutorSyscallCode) {
+			auto thread = getCpuData()->activeExecutor.get();
+			if(thread) {
+				sample.thread = reinterpret_cast<uintptr_t>(thread);
+				sample.universe = reinterpret_cast<uintptr_t>(thread->getUniverse().get());
+			}
+		}
+
+		// Walk the user-space stack via frame pointers.
+		if(inUser) {
+			uintptr_t fp = *image.rbp();
+			while(sample.numFrames < maxProfileFrames) {
+				uint64_t nextFp, returnIp;
+				if(!peekUserWordFromNmi(fp, nextFp) || !peekUserWordFromNmi(fp + 8, returnIp))
+					break;
+				sample.frames[sample.numFrames++] = returnIp;
+				// Stacks grow down, so this also guarantees termination on corrupted stacks.
+				if(nextFp <= fp)
+					break;
+				fp = nextFp;
+			}
+		}
+
+		getCpuData()->localProfileRing->enqueue(&sample,
+				offsetof(ProfileSample, frames) + sample.numFrames * sizeof(uint64_t));
+	}
+}
+
 extern "C" void onPlatformNmi(NmiImageAccessor image) {
 	// If we interrupted user space or a kernel stub, we might need to update GS.
 	auto gs = common::x86::rdmsr(common::x86::kMsrIndexGsBase);
@@ -508,13 +588,11 @@ extern "C" void onPlatformNmi(NmiImageAccessor image) {
 	bool explained = false;
 	auto pmcMechanism = cpuData->profileMechanism.load(std::memory_order_acquire);
 	if(pmcMechanism == ProfileMechanism::intelPmc && checkIntelPmcOverflow()) {
-		uintptr_t ip = *image.ip();
-		cpuData->localProfileRing->enqueue(&ip, sizeof(uintptr_t));
+		recordProfileSample(image);
 		setIntelPmc();
 		explained = true;
 	}else if(pmcMechanism == ProfileMechanism::amdPmc && checkAmdPmcOverflow()) {
-		uintptr_t ip = *image.ip();
-		cpuData->localProfileRing->enqueue(&ip, sizeof(uintptr_t));
+		recordProfileSample(image);
 		setAmdPmc();
 		explained = true;
 	}
@@ -539,11 +617,86 @@ extern "C" void onPlatformNmi(NmiImageAccessor image) {
 }
 
 extern "C" void enableIntsAndHaltForever();
+extern "C" [[noreturn]] void runInIdleDomain(void (*function)());
+
+namespace {
+	// Predicted idle times beyond which deeper C-states pay off. Without _CST
+	// latencies, we use conservative values that cover the C-states of common CPUs.
+	constexpr uint64_t mwaitC2Residency = 200'000;
+	constexpr uint64_t mwaitDeepResidency = 2'000'000;
+
+	// Returns the MWAIT hint for the deepest C-state that the predicted idle time justifies.
+	uint32_t chooseMwaitHint() {
+		auto features = getGlobalCpuFeatures();
+		// Without ARAT, the APIC timer (and thus our next deadline) stops in C-states deeper than C1.
+		if(!features->haveArat)
+			return 0;
+
+		uint64_t idleNanos = UINT64_MAX;
+		if(auto deadline = LocalApicContext::nextDeadline(); deadline) {
+			auto now = systemClockSource()->currentNanos();
+			idleNanos = deadline > now ? deadline - now : 0;
+		}
+
+		// Hints use (C-state - 1) in bits 4-7 and the sub-state in bits 0-3.
+		auto hasCState = [&] (int n) {
+			return (features->mwaitSubstates >> (4 * n)) & 0xF;
+		};
+		int cstate = 1;
+		if(idleNanos >= mwaitDeepResidency) {
+			for(int n = 7; n > 2; n--) {
+				if(hasCState(n)) {
+					cstate = n;
+					break;
+				}
+			}
+		}
+		if(cstate == 1 && idleNanos >= mwaitC2Residency && hasCState(2))
+			cstate = 2;
+		return (cstate - 1) << 4;
+	}
+
+	void mwaitIdleLoop() {
+		auto wake = &getCpuData()->idleWake.state;
+		while(true) {
+			assert(!intsAreEnabled());
+			auto hint = chooseMwaitHint();
+
+			wake->store(idleWaiting, std::memory_order_relaxed);
+			asm volatile ("monitor" : : "a"(wake), "c"(0), "d"(0) : "memory");
+			// Pings that arrive before MONITOR is armed are not tracked by MWAIT.
+			// STI delays IRQs until MWAIT is executed; pending IRQs end MWAIT immediately.
+			if(wake->load(std::memory_order_seq_cst) == idleWaiting)
+				asm volatile ("sti\n\tmwait" : : "a"(hint), "c"(0) : "memory");
+			disableInts();
+
+			// Either an IRQ has been handled (without rescheduling) or the wakeup is spurious.
+			if(wake->exchange(idleRunning, std::memory_order_acq_rel) != idleWoken)
+				continue;
+
+			// Do the same as IdleTask::handlePreemption() but without an IRQ frame.
+			localScheduler()->update();
+			if(localScheduler()->maybeReschedule()) {
+				runOnStack([] (Continuation) {
+					localScheduler()->commitReschedule();
+				}, getCpuData()->detachedStack.base());
+			}else{
+				localScheduler()->renewSchedule();
+			}
+		}
+	}
+}
 
 void suspendSelf() {
 	assert(!intsAreEnabled());
+	if(getGlobalCpuFeatures()->haveMwait)
+		runInIdleDomain(&mwaitIdleLoop);
 	enableIntsAndHaltForever();
 }
 
+void resetIdleWakeState() {
+	getCpuData()->idleWake.state.store(idleRunning, std::memory_order_relaxed);
+}
+
 } // namespace thor
 
@@ -16,32 +16,6 @@ void invalidatePage(const void *address) {
 	asm volatile ("invlpg %0" : : "m"(*p) : "memory");
 }
 
-void invalidatePcid(int pcid) {
-	struct {
-		uint64_t pcid;
-		const void *address;
-	} descriptor;
-
-	descriptor.pcid = pcid;
-	descriptor.address = nullptr;
-
-	uint64_t type = 1;
-	asm volatile ("invpcid %1, %0" : : "r"(type), "m"(descriptor) : "memory");
-}
-
-void invalidatePage(int pcid, const void *address) {
-	struct {
-		uint64_t pcid;
-		const void *address;
-	} descriptor;
-
-	descriptor.pcid = pcid;
-	descriptor.address = address;
-
-	uint64_t type = 0;
-	asm volatile ("invpcid %1, %0" : : "r"(type), "m"(descriptor) : "memory");
-}
-
 void invalidateFullTlb() {
 	uint64_t pml4;
 	asm volatile ("mov %%cr3, %0" : "=r"(pml4));
@@ -76,18 +50,27 @@ enum {
 	kPagePat = 0x80,
 	kPageGlobal = 0x100,
 	kPageXd = 0x8000000000000000,
-	kPageAddress = 0x000FFFFFFFFFF000
+	kPageAddress = 0x000FFFFFFFFFF000,
+	// Bits that only apply to 2 MiB entries in the PD.
+	kPageHuge = 0x80,
+	kPageHugePat = 0x1000,
+	kPageHugeAddress = 0x000FFFFFFFE00000
 };
 
 namespace thor {
 
+namespace {
+	// Shootdowns of larger ranges flush the entire PCID instead of single pages.
+	constexpr size_t fullFlushThreshold = 32 * kPageSize;
+}
+
 // --------------------------------------------------------
 
 PageContext::PageContext()
 : _nextStamp{1}, _primaryBinding{nullptr} { }
 
 PageBinding::PageBinding()
-: _pcid{0}, _boundSpace{nullptr},
+: _pcid{0}, _staleTlb{false}, _boundSpace{nullptr},
 		_primaryStamp{0}, _alreadyShotSequence{0} { }
 
 bool PageBinding::isPrimary() {
@@ -105,9 +88,10 @@ void PageBinding::rebind() {
 	auto context = &getCpuData()->pageContext;
 
 	auto cr3 = _boundSpace->rootTable() | _pcid;
-	if(getCpuData()->havePcids)
+	if(getCpuData()->havePcids && !_staleTlb)
 		cr3 |= PhysicalAddr(1) << 63; // Do not invalidate the PCID.
 	asm volatile ("mov %0, %%cr3" : : "r"(cr3) : "memory");
+	_staleTlb = false;
 
 	_primaryStamp = context->_nextStamp++;
 	context->_primaryBinding = this;
@@ -129,6 +113,7 @@ void PageBinding::rebind(smarter::shared_ptr<PageSpace> space) {
 
 		target_seq = space->_shootSequence;
 		space->_numBindings++;
+		space->_bindingEpoch++;
 	}
 
 	_boundSpace = space;
@@ -137,6 +122,7 @@ void PageBinding::rebind(smarter::shared_ptr<PageSpace> space) {
 	// Switch CR3 and invalidate the PCID.
 	auto cr3 = space->rootTable() | _pcid;
 	asm volatile ("mov %0, %%cr3" : : "r"(cr3) : "memory");
+	_staleTlb = false;
 
 	_primaryStamp = context->_nextStamp++;
 	context->_primaryBinding = this;
@@ -175,6 +161,7 @@ void PageBinding::rebind(smarter::shared_ptr<PageSpace> space) {
 		}
 
 		unbound_space->_numBindings--;
+		unbound_space->_bindingEpoch++;
 		if(!unbound_space->_numBindings && unbound_space->_retireNode) {
 			unbound_space->_retireNode->complete();
 			unbound_space->_retireNode = nullptr;
@@ -200,9 +187,10 @@ void PageBinding::unbind() {
 		asm volatile ("mov %0, %%cr3" : : "r"(cr3) : "memory");
 	}else{
 		// If there was only a single binding, it would have been primary.
+		// The CPU does not translate through this PCID; rebind() flushes it before reuse.
 		assert(getCpuData()->havePcids);
-		invalidatePcid(_pcid);
 	}
+	_staleTlb = false;
 
 	frg::intrusive_list<
 		ShootNode,
@@ -238,6 +226,7 @@ void PageBinding::unbind() {
 		}
 
 		_boundSpace->_numBindings--;
+		_boundSpace->_bindingEpoch++;
 		if(!_boundSpace->_numBindings && _boundSpace->_retireNode) {
 			_boundSpace->_retireNode->complete();
 			_boundSpace->_retireNode = nullptr;
@@ -285,16 +274,10 @@ void PageBinding::shootdown() {
 
 				if(current->_initiatorCpu != getCpuData()) {
 					// Perform the actual shootdown.
-					if(!getCpuData()->havePcids) {
-						assert(!_pcid);
-						for(size_t pg = 0; pg < current->size; pg += kPageSize)
-							invalidatePage(reinterpret_cast<void *>(current->address + pg));
-					}else{
-						for(size_t pg = 0; pg < current->size; pg += kPageSize)
-							invalidatePage(_pcid, reinterpret_cast<void *>(current->address + pg));
-					}
+					invalidateRange(current->address, current->size);
 
 					// Signal completion of the shootdown.
+					_boundSpace->_bindingEpoch++;
 					if(current->_bindingsToShoot.fetch_sub(1, std::memory_order_acq_rel) == 1) {
 						auto it = _boundSpace->_shootQueue.iterator_to(current);
 						_boundSpace->_shootQueue.erase(it);
@@ -318,6 +301,37 @@ void PageBinding::shootdown() {
 	}
 }
 
+void PageBinding::invalidateRange(VirtualAddr address, size_t size) {
+	assert(!intsAreEnabled());
+	assert(getCpuData()->havePcids || !_pcid);
+
+	if(!getCpuData()->havePcids) {
+		if(size > fullFlushThreshold) {
+			invalidateFullTlb();
+		}else{
+			for(size_t pg = 0; pg < size; pg += kPageSize)
+				invalidatePage(reinterpret_cast<void *>(address + pg));
+		}
+		return;
+	}
+
+	// The CPU does not translate through non-primary PCIDs,
+	// hence we can defer the flush until rebind() makes this binding primary again.
+	if(!isPrimary()) {
+		_staleTlb = true;
+		return;
+	}
+
+	// INVLPG and CR3 writes act on the current PCID, so we do not need INVPCID here.
+	if(size > fullFlushThreshold) {
+		auto cr3 = _boundSpace->rootTable() | _pcid;
+		asm volatile ("mov %0, %%cr3" : : "r"(cr3) : "memory");
+	}else{
+		for(size_t pg = 0; pg < size; pg += kPageSize)
+			invalidatePage(reinterpret_cast<void *>(address + pg));
+	}
+}
+
 // --------------------------------------------------------
 
 GlobalPageBinding::GlobalPageBinding()
@@ -422,7 +436,7 @@ void PageSpace::activate(smarter::shared_ptr<PageSpace> space) {
 
 
 PageSpace::PageSpace(PhysicalAddr root_table)
-: _rootTable{root_table}, _numBindings{0}, _shootSequence{0} { }
+: _rootTable{root_table}, _numBindings{0}, _shootSequence{0}, _bindingEpoch{0} { }
 
 PageSpace::~PageSpace() {
 	assert(!_numBindings);
@@ -451,8 +465,10 @@ bool PageSpace::submitShootdown(ShootNode *node) {
 	assert(!(node->address & (kPageSize - 1)));
 	assert(!(node->size & (kPageSize - 1)));
 
+	auto irq_lock = frg::guard(&irqMutex());
+
+	bool coalesce;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&_mutex);
 
 		auto unshot_bindings = _numBindings;
@@ -462,9 +478,7 @@ bool PageSpace::submitShootdown(ShootNode *node) {
 		if(!getCpuData()->havePcids) {
 			if(bindings[0].boundSpace().get() == this) {
 				assert(unshot_bindings);
-
-				for(size_t pg = 0; pg < node->size; pg += kPageSize)
-					invalidatePage(reinterpret_cast<void *>(node->address + pg));
+				bindings[0].invalidateRange(node->address, node->size);
 				unshot_bindings--;
 			}
 		}else{
@@ -472,10 +486,7 @@ bool PageSpace::submitShootdown(ShootNode *node) {
 				if(bindings[i].boundSpace().get() != this)
 					continue;
 				assert(unshot_bindings);
-
-				for(size_t pg = 0; pg < node->size; pg += kPageSize)
-					invalidatePage(bindings[i].getPcid(),
-							reinterpret_cast<void *>(node->address + pg));
+				bindings[i].invalidateRange(node->address, node->size);
 				unshot_bindings--;
 			}
 		}
@@ -483,13 +494,24 @@ bool PageSpace::submitShootdown(ShootNode *node) {
 		if(!unshot_bindings)
 			return true;
 
+		// If the previous request was also queued by this CPU and no binding changed
+		// or acknowledged anything since then, the IPI that we sent for it
+		// is still pending on all CPUs that need to handle this request.
+		coalesce = !_shootQueue.empty()
+				&& _shootQueue.back()->_initiatorCpu == getCpuData()
+				&& _shootQueue.back()->_epoch == _bindingEpoch;
+
 		node->_initiatorCpu = getCpuData();
 		node->_sequence = ++_shootSequence;
+		node->_epoch = _bindingEpoch;
 		node->_bindingsToShoot = unshot_bindings;
 		_shootQueue.push_back(node);
 	}
 
-	sendShootdownIpi();
+	// Send the IPI before enabling IRQs, such that coalesced requests
+	// cannot overtake the IPI of the request that they rely on.
+	if(!coalesce)
+		sendShootdownIpi();
 	return false;
 }
 
@@ -701,7 +723,8 @@ ClientPageSpace::~ClientPageSpace() {
 		PageAccessor accessor{ps};
 		auto tbl = reinterpret_cast<uint64_t *>(accessor.get());
 		for(int i = 0; i < 512; i++) {
-			if(tbl[i] & kPagePresent)
+			// 2 MiB pages do not own a page table.
+			if((tbl[i] & kPagePresent) && !(tbl[i] & kPageHuge))
 				physicalAllocator->free(tbl[i] & kPageAddress, kPageSize);
 		}
 	};
@@ -761,10 +784,10 @@ void ClientPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
 	if(tbl4[index4].load() & kPagePresent) {
 		accessor3 = PageAccessor{tbl4[index4].load() & 0x000FFFFFFFFFF000};
 	}else{
-		auto tbl_address = physicalAllocator->allocate(kPageSize);
+		auto tbl_address = physicalAllocator->allocateZeroedPage();
 		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		_numTablePages.fetch_add(1, std::memory_order_relaxed);
 		accessor3 = PageAccessor{tbl_address};
-		memset(accessor3.get(), 0, kPageSize);
 
 		uint64_t new_entry = tbl_address | kPagePresent | kPageWrite;
 		if(user_page)
@@ -779,10 +802,10 @@ void ClientPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
 	if(tbl3[index3].load() & kPagePresent) {
 		accessor2 = PageAccessor{tbl3[index3].load() & 0x000FFFFFFFFFF000};
 	}else{
-		auto tbl_address = physicalAllocator->allocate(kPageSize);
+		auto tbl_address = physicalAllocator->allocateZeroedPage();
 		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		_numTablePages.fetch_add(1, std::memory_order_relaxed);
 		accessor2 = PageAccessor{tbl_address};
-		memset(accessor2.get(), 0, kPageSize);
 
 		uint64_t new_entry = tbl_address | kPagePresent | kPageWrite;
 		if(user_page)
@@ -795,12 +818,13 @@ void ClientPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
 	// Make sure there is a PT.
 	tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor2.get());
 	if(tbl2[index2].load() & kPagePresent) {
+		assert(!(tbl2[index2].load() & kPageHuge));
 		accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 	}else{
-		auto tbl_address = physicalAllocator->allocate(kPageSize);
+		auto tbl_address = physicalAllocator->allocateZeroedPage();
 		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		_numTablePages.fetch_add(1, std::memory_order_relaxed);
 		accessor1 = PageAccessor{tbl_address};
-		memset(accessor1.get(), 0, kPageSize);
 
 		uint64_t new_entry = tbl_address | kPagePresent | kPageWrite;
 		if(user_page)
@@ -832,6 +856,108 @@ void ClientPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
 	tbl1[index1].store(new_entry);
 }
 
+bool ClientPageSpace::mapSingle2m(VirtualAddr pointer, PhysicalAddr physical,
+		bool user_page, uint32_t flags, CachingMode caching_mode) {
+	assert(!(pointer & (kHugePageSize - 1)));
+	assert(!(physical & (kHugePageSize - 1)));
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	PageAccessor accessor4;
+	PageAccessor accessor3;
+	PageAccessor accessor2;
+
+	auto index4 = (int)((pointer >> 39) & 0x1FF);
+	auto index3 = (int)((pointer >> 30) & 0x1FF);
+	auto index2 = (int)((pointer >> 21) & 0x1FF);
+
+	// The PML4 does always exist.
+	accessor4 = PageAccessor{rootTable()};
+
+	// Make sure there is a PDPT.
+	auto tbl4 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor4.get());
+	if(tbl4[index4].load() & kPagePresent) {
+		accessor3 = PageAccessor{tbl4[index4].load() & kPageAddress};
+	}else{
+		auto tbl_address = physicalAllocator->allocateZeroedPage();
+		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		_numTablePages.fetch_add(1, std::memory_order_relaxed);
+		accessor3 = PageAccessor{tbl_address};
+
+		uint64_t new_entry = tbl_address | kPagePresent | kPageWrite;
+		if(user_page)
+			new_entry |= kPageUser;
+		tbl4[index4].store(new_entry);
+	}
+
+	// Make sure there is a PD.
+	auto tbl3 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor3.get());
+	if(tbl3[index3].load() & kPagePresent) {
+		accessor2 = PageAccessor{tbl3[index3].load() & kPageAddress};
+	}else{
+		auto tbl_address = physicalAllocator->allocateZeroedPage();
+		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		_numTablePages.fetch_add(1, std::memory_order_relaxed);
+		accessor2 = PageAccessor{tbl_address};
+
+		uint64_t new_entry = tbl_address | kPagePresent | kPageWrite;
+		if(user_page)
+			new_entry |= kPageUser;
+		tbl3[index3].store(new_entry);
+	}
+
+	// We never free page tables here, since the paging-structure caches of
+	// other CPUs may still refer to them. Fall back to 4k pages instead.
+	auto tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor2.get());
+	if(tbl2[index2].load() & kPagePresent)
+		return false;
+
+	uint64_t new_entry = physical | kPagePresent | kPageHuge;
+	if(user_page)
+		new_entry |= kPageUser;
+	if(flags & page_access::write)
+		new_entry |= kPageWrite;
+	if(!(flags & page_access::execute))
+		new_entry |= kPageXd;
+	if(caching_mode == CachingMode::writeThrough) {
+		new_entry |= kPagePwt;
+	}else if(caching_mode == CachingMode::writeCombine) {
+		new_entry |= kPageHugePat | kPagePwt;
+	}else if(caching_mode == CachingMode::uncached) {
+		new_entry |= kPagePwt | kPagePcd | kPageHugePat;
+	}else{
+		assert(caching_mode == CachingMode::null || caching_mode == CachingMode::writeBack);
+	}
+	tbl2[index2].store(new_entry);
+	return true;
+}
+
+void ClientPageSpace::_splitHugePage(arch::scalar_variable<uint64_t> *tbl2, int index2) {
+	auto entry = tbl2[index2].load();
+	assert((entry & kPagePresent) && (entry & kPageHuge));
+
+	auto tbl_address = physicalAllocator->allocate(kPageSize);
+	assert(tbl_address != PhysicalAddr(-1) && "OOM");
+	_numTablePages.fetch_add(1, std::memory_order_relaxed);
+	PageAccessor accessor{tbl_address};
+	auto tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor.get());
+
+	// All bits except for the PAT bit have the same position in 4k entries.
+	uint64_t bits = entry & ~uint64_t(kPageHugeAddress | kPageHuge | kPageHugePat);
+	if(entry & kPageHugePat)
+		bits |= kPagePat;
+	auto physical = entry & kPageHugeAddress;
+	for(int i = 0; i < 512; i++)
+		tbl1[i].store((physical + i * kPageSize) | bits);
+
+	// The new PT maps the same translations, so no shootdown is required here.
+	uint64_t new_entry = tbl_address | kPagePresent | kPageWrite;
+	if(entry & kPageUser)
+		new_entry |= kPageUser;
+	tbl2[index2].store(new_entry);
+}
+
 PageStatus ClientPageSpace::unmapSingle4k(VirtualAddr pointer) {
 	assert(!(pointer & (kPageSize - 1)));
 
@@ -870,6 +996,8 @@ PageStatus ClientPageSpace::unmapSingle4k(VirtualAddr pointer) {
 	if(!(tbl2[index2].load() & kPagePresent))
 		return 0;
 	assert(tbl2[index2].load() & kPagePresent);
+	if(tbl2[index2].load() & kPageHuge)
+		_splitHugePage(tbl2, index2);
 	accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 	auto tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
 
@@ -922,6 +1050,8 @@ PageStatus ClientPageSpace::cleanSingle4k(VirtualAddr pointer) {
 	if(!(tbl2[index2].load() & kPagePresent))
 		return 0;
 	assert(tbl2[index2].load() & kPagePresent);
+	if(tbl2[index2].load() & kPageHuge)
+		_splitHugePage(tbl2, index2);
 	accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 	auto tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
 
@@ -976,6 +1106,8 @@ bool ClientPageSpace::isMapped(VirtualAddr pointer) {
 	// Find the PT.
 	if(!(tbl2[index2].load() & kPagePresent))
 		return false;
+	if(tbl2[index2].load() & kPageHuge)
+		return true;
 	accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 	tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
 
@@ -986,6 +1118,65 @@ bool ClientPageSpace::updatePageAccess(VirtualAddr) {
 	return false;
 }
 
+void ClientPageSpace::detachEmptyTables(VirtualAddr va, size_t size, DetachedPageList &list) {
+	constexpr uintptr_t pdSpan = uintptr_t(1) << 30;
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	// Non-present entries are always zero since unmapSingle4k() clears the entire PTE.
+	auto isEmpty = [] (arch::scalar_variable<uint64_t> *tbl) {
+		for(int i = 0; i < 512; i++) {
+			if(tbl[i].load())
+				return false;
+		}
+		return true;
+	};
+
+	// The PML4 is always present. We do not reclaim PDPTs.
+	PageAccessor accessor4{rootTable()};
+	auto tbl4 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor4.get());
+
+	auto end = va + size;
+	for(auto pdBase = va & ~(pdSpan - 1); pdBase < end; pdBase += pdSpan) {
+		auto index4 = (int)((pdBase >> 39) & 0x1FF);
+		auto index3 = (int)((pdBase >> 30) & 0x1FF);
+
+		if(!(tbl4[index4].load() & kPagePresent))
+			continue;
+		PageAccessor accessor3{tbl4[index4].load() & kPageAddress};
+		auto tbl3 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor3.get());
+
+		if(!(tbl3[index3].load() & kPagePresent))
+			continue;
+		PageAccessor accessor2{tbl3[index3].load() & kPageAddress};
+		auto tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor2.get());
+
+		auto ptBegin = frg::max(va, pdBase) & ~(kHugePageSize - 1);
+		auto ptEnd = frg::min(end, pdBase + pdSpan);
+		for(auto ptBase = ptBegin; ptBase < ptEnd; ptBase += kHugePageSize) {
+			auto index2 = (int)((ptBase >> 21) & 0x1FF);
+			auto entry = tbl2[index2].load();
+			if(!(entry & kPagePresent) || (entry & kPageHuge))
+				continue;
+
+			PageAccessor accessor1{entry & kPageAddress};
+			if(!isEmpty(reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get())))
+				continue;
+			tbl2[index2].store(0);
+			list.push(entry & kPageAddress);
+			_numTablePages.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		if(!isEmpty(tbl2))
+			continue;
+		auto entry = tbl3[index3].load();
+		tbl3[index3].store(0);
+		list.push(entry & kPageAddress);
+		_numTablePages.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
 ClientPageSpace::Walk::Walk(ClientPageSpace *space)
 : _space{space} {
 	irqMutex().lock();
@@ -1005,14 +1196,21 @@ void ClientPageSpace::Walk::walkTo(uintptr_t address) {
 	_accessor3 = PageAccessor{};
 	_accessor2 = PageAccessor{};
 	_accessor1 = PageAccessor{};
+	_huge = false;
 }
 
 PageFlags ClientPageSpace::Walk::peekFlags() {
 	_update();
-	assert(_accessor1);
 
-	auto tbl = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor1.get());
-	auto ent = tbl[(_address >> 12) & 0x1FF].load();
+	uint64_t ent;
+	if(_huge) {
+		auto tbl = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor2.get());
+		ent = tbl[(_address >> 21) & 0x1FF].load();
+	}else{
+		assert(_accessor1);
+		auto tbl = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor1.get());
+		ent = tbl[(_address >> 12) & 0x1FF].load();
+	}
 	assert(ent & kPagePresent);
 
 	PageFlags flags = 0;
@@ -1025,6 +1223,14 @@ PageFlags ClientPageSpace::Walk::peekFlags() {
 
 PhysicalAddr ClientPageSpace::Walk::peekPhysical() {
 	_update();
+
+	if(_huge) {
+		auto tbl = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor2.get());
+		auto ent = tbl[(_address >> 21) & 0x1FF].load();
+		assert(ent & kPagePresent);
+		return (ent & kPageHugeAddress) + (_address & (kHugePageSize - 1) & ~(kPageSize - 1));
+	}
+
 	assert(_accessor1);
 
 	auto tbl = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor1.get());
@@ -1057,6 +1263,10 @@ void ClientPageSpace::Walk::_update() {
 	auto tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor2.get());
 	if(!(tbl2[index2].load() & kPagePresent))
 		return;
+	if(tbl2[index2].load() & kPageHuge) {
+		_huge = true;
+		return;
+	}
 	_accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 }
 
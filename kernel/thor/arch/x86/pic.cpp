@@ -3,11 +3,13 @@
 #include <arch/mem_space.hpp>
 #include <arch/register.hpp>
 #include <thor-internal/arch/hpet.hpp>
+#include <thor-internal/boot-profile.hpp>
 #include <thor-internal/debug.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/initgraph.hpp>
 #include <thor-internal/irq.hpp>
 #include <thor-internal/main.hpp>
+#include <thor-internal/profile.hpp>
 
 namespace thor {
 
@@ -122,6 +124,7 @@ void GlobalApicContext::GlobalAlarmSlot::arm(uint64_t nanos) {
 		auto irq_lock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&globalApicContext()->_mutex);
 		globalApicContext()->_globalDeadline = nanos;
+		globalApicContext()->_deadlineCpu = getCpuData()->cpuIndex;
 	}
 	LocalApicContext::_updateLocalTimer();
 }
@@ -140,6 +143,15 @@ bool LocalApicContext::checkPreemption() {
 	return localApicContext()->_preemptionDeadline != 0;
 }
 
+uint64_t LocalApicContext::nextDeadline() {
+	auto self = localApicContext();
+	if(!self->_preemptionDeadline)
+		return self->_globalDeadline;
+	if(!self->_globalDeadline)
+		return self->_preemptionDeadline;
+	return frg::min(self->_preemptionDeadline, self->_globalDeadline);
+}
+
 void LocalApicContext::handleTimerIrq() {
 	assert(localApicContext()->timersAreCalibrated);
 
@@ -148,6 +160,7 @@ void LocalApicContext::handleTimerIrq() {
 				<< frg::endlog;
 	auto self = localApicContext();
 	auto now = systemClockSource()->currentNanos();
+	self->_programmedTscDeadline = 0;
 
 	if(self->_preemptionDeadline && now > self->_preemptionDeadline)
 		self->_preemptionDeadline = 0;
@@ -157,16 +170,25 @@ void LocalApicContext::handleTimerIrq() {
 		globalApicContext()->_globalAlarmInstance.fireAlarm();
 
 		// Update the global deadline to avoid calling fireAlarm() on the next IRQ.
-		{
-			auto irq_lock = frg::guard(&irqMutex());
-			auto lock = frg::guard(&globalApicContext()->_mutex);
-			localApicContext()->_globalDeadline = globalApicContext()->_globalDeadline;
-		}
+		LocalApicContext::_fetchGlobalDeadline();
 	}
 
 	localApicContext()->_updateLocalTimer();
 }
 
+// Copy the global deadline so we can access it without locking.
+// Only the CPU that armed the global alarm is woken up for it; this keeps
+// CPUs without local work from being interrupted by unrelated timers.
+void LocalApicContext::_fetchGlobalDeadline() {
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&globalApicContext()->_mutex);
+	if(globalApicContext()->_deadlineCpu == getCpuData()->cpuIndex) {
+		localApicContext()->_globalDeadline = globalApicContext()->_globalDeadline;
+	}else{
+		localApicContext()->_globalDeadline = 0;
+	}
+}
+
 void LocalApicContext::_updateLocalTimer() {
 	uint64_t deadline = 0;
 	auto consider = [&] (uint64_t dc) {
@@ -176,27 +198,27 @@ void LocalApicContext::_updateLocalTimer() {
 			deadline = dc;
 	};
 
-	// Copy the global deadline so we can access it without locking.
-	{
-		auto irq_lock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&globalApicContext()->_mutex);
-		localApicContext()->_globalDeadline = globalApicContext()->_globalDeadline;
-	}
+	LocalApicContext::_fetchGlobalDeadline();
 
 	consider(localApicContext()->_preemptionDeadline);
 	consider(localApicContext()->_globalDeadline);
 
 	if(localApicContext()->useTscMode) {
-		if(!deadline) {
-			common::x86::wrmsr(0x6E0, 0);
-			return;
+		// This runs on every scheduling decision; avoid the MSR write
+		// if the deadline did not change.
+		uint64_t ticks = 0;
+		if(deadline) {
+			auto product = static_cast<unsigned __int128>(deadline)
+					* localApicContext()->tscTicksMult;
+			ticks = static_cast<uint64_t>(product >> LocalApicContext::tscTicksShift);
+			// Zero disarms the timer.
+			if(!ticks)
+				ticks = 1;
 		}
-
-		uint64_t ticks;
-		auto of = __builtin_mul_overflow(deadline, localApicContext()->tscTicksPerMilli, &ticks);
-		assert(!of);
-		ticks /= 1'000'000;
+		if(ticks == localApicContext()->_programmedTscDeadline)
+			return;
 		common::x86::wrmsr(0x6E0, ticks);
+		localApicContext()->_programmedTscDeadline = ticks;
 		if(debugTimer)
 			infoLogger() << "thor [CPU " << getLocalApicId() << "]: Setting TSC deadline to "
 					<< ticks << frg::endlog;
@@ -337,12 +359,16 @@ uint64_t localTicks() {
 	return picBase.load(lApicCurCount);
 }
 
+uint64_t rawTimestampCounterToNanos(uint64_t ticks) {
+	// Multiplying the raw TSC by 10^6 directly would overflow after a few hours.
+	auto product = static_cast<unsigned __int128>(ticks) * localApicContext()->tscNanosMult;
+	return static_cast<uint64_t>(product >> LocalApicContext::tscNanosShift);
+}
+
 namespace {
 	struct TscClockSource final : ClockSource {
 		uint64_t currentNanos() override {
-			auto r = getRawTimestampCounter() * 1'000'000 / localApicContext()->tscTicksPerMilli;
-	//		infoLogger() << r << frg::endlog;
-			return r;
+			return rawTimestampCounterToNanos(getRawTimestampCounter());
 		}
 	};
 
@@ -377,6 +403,13 @@ void calibrateApicTimer() {
 	auto tsc_elapsed = getRawTimestampCounter() - tsc_start;
 
 	localApicContext()->tscTicksPerMilli = tsc_elapsed / millis;
+	localApicContext()->tscNanosMult = (uint64_t{1'000'000} << LocalApicContext::tscNanosShift)
+			/ localApicContext()->tscTicksPerMilli;
+	// Derive the inverse from tscNanosMult such that TSC deadlines agree with the TSC clock source.
+	localApicContext()->tscTicksMult = static_cast<uint64_t>(
+			(static_cast<unsigned __int128>(1) << (LocalApicContext::tscNanosShift
+					+ LocalApicContext::tscTicksShift))
+			/ localApicContext()->tscNanosMult);
 	infoLogger() << "thor: TSC ticks/ms: " << localApicContext()->tscTicksPerMilli
 				<< " on CPU #" << getCpuData()->cpuIndex << frg::endlog;
 
@@ -454,49 +487,55 @@ void raiseStartupIpi(uint32_t dest_apic_id, uint32_t page) {
 	}
 }
 
-void sendShootdownIpi() {
-	if(picBase.isUsingX2apic()) {
-		picBase.store(lX2ApicIcr, x2apicIcrLowVector(0xF0) | x2apicIcrLowDelivMode(0)
-				| x2apicIcrLowLevel(true) | x2apicIcrLowShorthand(2) | x2apicIcrHighDestField(0));
-	} else {
-		picBase.store(lApicIcrHigh, apicIcrHighDestField(0));
-		picBase.store(lApicIcrLow, apicIcrLowVector(0xF0) | apicIcrLowDelivMode(0)
-				| apicIcrLowLevel(true) | apicIcrLowShorthand(2));
-		while(picBase.load(lApicIcrLow) & apicIcrLowDelivStatus) {
-			// Wait for IPI delivery.
-		}	
+namespace {
+	// Sends a fixed or NMI IPI. In x2APIC mode, this is a single MSR write
+	// and the ICR has no delivery status. In xAPIC mode, we wait for the previous
+	// IPI to be accepted before reusing the ICR instead of spinning after each IPI.
+	void sendIpi(uint8_t vector, uint8_t mode, uint8_t shorthand, uint32_t dest_apic_id) {
+		if(picBase.isUsingX2apic()) {
+			// Writes to x2APIC MSRs are not serializing; make sure that the target
+			// observes all prior stores (e.g., shootdown requests) when it receives the IPI.
+			asm volatile ("mfence; lfence" : : : "memory");
+			picBase.store(lX2ApicIcr, x2apicIcrLowVector(vector) | x2apicIcrLowDelivMode(mode)
+					| x2apicIcrLowLevel(true) | x2apicIcrLowShorthand(shorthand)
+					| x2apicIcrHighDestField(dest_apic_id));
+		} else {
+			while(picBase.load(lApicIcrLow) & apicIcrLowDelivStatus) {
+				// Wait for delivery of the previous IPI.
+			}
+			picBase.store(lApicIcrHigh, apicIcrHighDestField(dest_apic_id));
+			picBase.store(lApicIcrLow, apicIcrLowVector(vector) | apicIcrLowDelivMode(mode)
+					| apicIcrLowLevel(true) | apicIcrLowShorthand(shorthand));
+		}
 	}
 }
 
+void sendShootdownIpi() {
+	numShootdownIpis.increment();
+	// Broadcast to all CPUs (including the current one) via the shorthand.
+	sendIpi(0xF0, 0, 2, 0);
+}
+
 void sendPingIpi(int id) {
-	auto apic = getCpuData(id)->localApicId;
-//	infoLogger() << "thor [CPU" << getLocalApicId() << "]: Sending ping" << frg::endlog;
-	if(picBase.isUsingX2apic()) {
-		picBase.store(lX2ApicIcr, x2apicIcrLowVector(0xF1) | x2apicIcrLowDelivMode(0)
-				| x2apicIcrLowLevel(true) | x2apicIcrLowShorthand(0) | x2apicIcrHighDestField(apic));
-	} else {
-		picBase.store(lApicIcrHigh, apicIcrHighDestField(apic));
-		picBase.store(lApicIcrLow, apicIcrLowVector(0xF1) | apicIcrLowDelivMode(0)
-				| apicIcrLowLevel(true) | apicIcrLowShorthand(0));
-		while(picBase.load(lApicIcrLow) & apicIcrLowDelivStatus) {
-			// Wait for IPI delivery.
-		}
+	auto cpuData = getCpuData(id);
+
+	// If the CPU is in MWAIT, writing to its monitored line is enough to wake it up.
+	// If a wakeup is already in flight, the target will notice our work anyway.
+	uint32_t state = idleWaiting;
+	if(cpuData->idleWake.state.compare_exchange_strong(state, idleWoken,
+			std::memory_order_acq_rel) || state == idleWoken) {
+		numIdleWakesWithoutIpi.increment();
+		return;
 	}
+
+	numPingIpis.increment();
+//	infoLogger() << "thor [CPU" << getLocalApicId() << "]: Sending ping" << frg::endlog;
+	sendIpi(0xF1, 0, 0, cpuData->localApicId);
 }
 
 void sendGlobalNmi() {
 	// Send the NMI to all /other/ CPUs but not to the current one.
-	if(picBase.isUsingX2apic()) {
-		picBase.store(lX2ApicIcr, x2apicIcrLowVector(0) | x2apicIcrLowDelivMode(4)
-				| x2apicIcrLowLevel(true) | x2apicIcrLowShorthand(3) | x2apicIcrHighDestField(0));
-	} else {
-		picBase.store(lApicIcrHigh, apicIcrHighDestField(0));
-		picBase.store(lApicIcrLow, apicIcrLowVector(0) | apicIcrLowDelivMode(4)
-				| apicIcrLowLevel(true) | apicIcrLowShorthand(3));
-		while(picBase.load(lApicIcrLow) & apicIcrLowDelivStatus) {
-			// Wait for IPI delivery.
-		}
-	}
+	sendIpi(0, 4, 3, 0);
 }
 
 // --------------------------------------------------------
@@ -526,14 +565,13 @@ namespace {
 			return IrqStrategy::justEoi;
 		}
 
+		// The local APIC cannot mask MSIs, so we mask them at the device.
 		void mask() override {
-			// TODO: Support this.
-			infoLogger() << "\e[31m" "thor: Masking of APIC-MSIs is not implemented" "\e[39m"
-					<< frg::endlog;
+			maskAtDevice(true);
 		}
 
 		void unmask() override {
-			// TODO: Implement this when mask() is implemented.
+			maskAtDevice(false);
 		}
 
 		void sendEoi() override {
@@ -541,15 +579,27 @@ namespace {
 		}
 
 		uint64_t getMessageAddress() override {
-			return 0xFEE00000;
+			return 0xFEE00000 | (destination_ << 12);
 		}
 
 		uint32_t getMessageData() override {
 			return vector_;
 		}
 
+	protected:
+		Error retargetMessage(int cpu) override {
+			// Without interrupt remapping, MSIs can only target 8-bit APIC IDs.
+			auto apicId = getCpuData(cpu)->localApicId;
+			if(apicId > 0xFF)
+				return Error::noHardwareSupport;
+			destination_ = apicId;
+			return Error::success;
+		}
+
 	private:
 		unsigned int vector_;
+		// APIC ID of the CPU that receives the MSI.
+		uint32_t destination_ = 0;
 	};
 }
 
@@ -621,10 +671,15 @@ namespace {
 			void unmask() override;
 			void sendEoi() override;
 
+		protected:
+			Error retarget(int cpu) override;
+
 		private:
 			IoApic *_chip;
 			unsigned int _index;
 			int _vector = -1;
+			// APIC ID of the CPU that receives the IRQ.
+			uint32_t _destination = 0;
 
 			// The following variables store the current pin configuration.
 			bool _levelTriggered;
@@ -728,7 +783,7 @@ namespace {
 					<< name() << frg::endlog;
 
 		_chip->_storeRegister(kIoApicInts + _index * 2 + 1,
-				static_cast<uint32_t>(pin_word2::destination(0)));
+				static_cast<uint32_t>(pin_word2::destination(_destination)));
 		_chip->_storeRegister(kIoApicInts + _index * 2,
 				static_cast<uint32_t>(pin_word1::vector(_vector)
 				| pin_word1::deliveryMode(0) | pin_word1::levelTriggered(_levelTriggered)
@@ -736,6 +791,19 @@ namespace {
 		return strategy;
 	}
 
+	Error IoApic::Pin::retarget(int cpu) {
+		auto apicId = getCpuData(cpu)->localApicId;
+		if(apicId > 0xFF)
+			return Error::noHardwareSupport;
+		_destination = apicId;
+
+		// Only the destination is changed; the pin stays masked or unmasked.
+		if(_vector != -1)
+			_chip->_storeRegister(kIoApicInts + _index * 2 + 1,
+					static_cast<uint32_t>(pin_word2::destination(_destination)));
+		return Error::success;
+	}
+
 	void IoApic::Pin::mask() {
 //		infoLogger() << "thor: Masking pin " << _index << frg::endlog;
 		_chip->_storeRegister(kIoApicInts + _index * 2,
@@ -1,33 +1,51 @@
 #include <x86/machine.hpp>
 #include <thor-internal/arch/pmc-amd.hpp>
+#include <thor-internal/profile.hpp>
 
 namespace thor {
 
 namespace counters {
 	inline constexpr unsigned int clockCycles = 0x76;
 	inline constexpr unsigned int instructionsRetired = 0xC0;
+	inline constexpr unsigned int branchesMispredicted = 0xC3;
+	// With unit mask 0x09: L2 misses caused by data and instruction cache misses.
+	// The L3 can only be monitored through a separate (non-core) PMU.
+	inline constexpr unsigned int l2CacheRequests = 0x64;
 }
 
 void setAmdPmc() {
 	// TODO: Support counters with IDs > 0xFF.
-	unsigned int whichCounter = counters::clockCycles;
+	unsigned int whichCounter;
+	switch(kernelProfileEvent) {
+	case ProfileEvent::cycles:
+		whichCounter = counters::clockCycles;
+		break;
+	case ProfileEvent::instructions:
+		whichCounter = counters::instructionsRetired;
+		break;
+	case ProfileEvent::llcMisses:
+		whichCounter = counters::l2CacheRequests | (0x09 << 8);
+		break;
+	case ProfileEvent::branchMisses:
+		whichCounter = counters::branchesMispredicted;
+		break;
+	}
 
 	// First, disable the performance counter.
 	// The manual recommends this to avoid races during the inital value update.
 	// Furthermore, KVM (but not real hardware) requires this to work!
 	common::x86::wrmsr(0xC001'0200,
-			static_cast<uint64_t>(whichCounter & 0xFF)
+			static_cast<uint64_t>(whichCounter & 0xFFFF)
 			| (UINT64_C(3) << 16) // Count all events
 			| (UINT64_C(1) << 20) // Enable LAPIC interrupt
 	);
 
 	// Program the initial value.
-	// This is hardcoded to yield a fixed number of events per second on a 1 GHz machine for now.
-	common::x86::wrmsr(0xC001'0201, -static_cast<uint64_t>(1'000'000'000/5000));
+	common::x86::wrmsr(0xC001'0201, -profileSamplePeriod(kernelProfileEvent));
 
 	// Re-enable the performance counter.
 	common::x86::wrmsr(0xC001'0200,
-			static_cast<uint64_t>(whichCounter & 0xFF)
+			static_cast<uint64_t>(whichCounter & 0xFFFF)
 			| (UINT64_C(3) << 16) // Count all events
 			| (UINT64_C(1) << 20) // Enable LAPIC interrupt
 			| (UINT64_C(1) << 22) // Enable performance counter
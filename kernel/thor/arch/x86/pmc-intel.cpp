@@ -1,44 +1,94 @@
 #include <x86/machine.hpp>
 #include <thor-internal/arch/pmc-intel.hpp>
+#include <thor-internal/profile.hpp>
 
 namespace thor {
 
 enum class IntelCounter {
 	none,
 	fixed0, // Instructions retired.
-	fixed1 // Clock cycles.
+	fixed1, // Clock cycles.
+	pmc0 // General purpose counter, programmed via PERFEVTSEL0.
 };
 
 static IntelCounter whichCounter = IntelCounter::fixed1;
 
+// Event select and unit mask of architectural events (for PERFEVTSEL0).
+static uint64_t pmc0EventSelect = 0;
+
 void initializeIntelPmc() {
-	// Disable all fixed performance counters.
+	switch(kernelProfileEvent) {
+	case ProfileEvent::cycles:
+		whichCounter = IntelCounter::fixed1;
+		break;
+	case ProfileEvent::instructions:
+		whichCounter = IntelCounter::fixed0;
+		break;
+	case ProfileEvent::llcMisses:
+		whichCounter = IntelCounter::pmc0;
+		pmc0EventSelect = 0x2E | (0x41 << 8);
+		break;
+	case ProfileEvent::branchMisses:
+		whichCounter = IntelCounter::pmc0;
+		pmc0EventSelect = 0xC5;
+		break;
+	}
+
+	// Disable all performance counters that we use.
 	common::x86::wrmsr(0x38D, // PERF_FIXED_CTR_CTRL
 		0
 	);
+	common::x86::wrmsr(0x186, // PERFEVTSEL0
+		0
+	);
 
 	// Counters first need to be enabled in the "global control" MSR.
 	common::x86::wrmsr(0x38F, // PERF_GLOBAL_CTRL
 			common::x86::rdmsr(0x38F)
+			| (UINT64_C(1) << 0)
 			| (UINT64_C(1) << 32)
 			| (UINT64_C(1) << 33));
 }
 
 void setIntelPmc() {
+	auto period = profileSamplePeriod(kernelProfileEvent);
+
+	if(whichCounter == IntelCounter::pmc0) {
+		// Disable the performance counter.
+		common::x86::wrmsr(0x186, // PERFEVTSEL0
+			0
+		);
+
+		common::x86::wrmsr(0xC1, // PMC0
+				((UINT64_C(1) << 48) - period) & ((UINT64_C(1) << 48) - 1));
+
+		// Clear the overflow bit; otherwise, no further PMIs are generated.
+		common::x86::wrmsr(0x390, // PERF_GLOBAL_OVF_CTRL
+				UINT64_C(1) << 0);
+
+		// Re-enable the performance counter.
+		common::x86::wrmsr(0x186, // PERFEVTSEL0
+				pmc0EventSelect
+				| (UINT64_C(3) << 16) // User + supervisor mode
+				| (UINT64_C(1) << 20) // Enable PMI
+				| (UINT64_C(1) << 22) // Enable the counter
+		);
+		return;
+	}
+
 	// Disable the performance counter.
 	common::x86::wrmsr(0x38D, // PERF_FIXED_CTR_CTRL
 		0
 	);
 
 	// Program the initial value.
-	// This is hardcoded to yield a fixed number of events per second on a 1 GHz machine for now.
 	if(whichCounter == IntelCounter::fixed0) {
 		common::x86::wrmsr(0x309, // PERF_FIXED_CTR0
-				(UINT64_C(1) << 48) - 1'000'000'000/5000);
+				(UINT64_C(1) << 48) - period);
 	}else{
 		assert(whichCounter == IntelCounter::fixed1);
 		common::x86::wrmsr(0x30A, // PERF_FIXED_CTR1
-				(UINT64_C(1) << 48) - 1'000'000'000/5000);
+				(UINT64_C(1) << 48) - period);
 	}
 
 	// TODO: Clear overflow. This is required for real hardware.
@@ -66,9 +116,12 @@ void setIntelPmc() {
 bool checkIntelPmcOverflow() {
 	if(whichCounter == IntelCounter::fixed0) {
 		common::x86::wrmsr(0x309, // PERF_FIXED_CTR0
-				(UINT64_C(1) << 48) - 1'000'000'000/5000);
+				(UINT64_C(1) << 48) - profileSamplePeriod(kernelProfileEvent));
 		return common::x86::rdmsr(0x38E) // PERF_GLOBAL_STATUS
 				& (UINT64_C(1) << 32); // Overflow of PERF_FIXED_CTR0
+	}else if(whichCounter == IntelCounter::pmc0) {
+		return common::x86::rdmsr(0x38E) // PERF_GLOBAL_STATUS
+				& (UINT64_C(1) << 0); // Overflow of PMC0
 	}else{
 		assert(whichCounter == IntelCounter::fixed1);
 		return common::x86::rdmsr(0x38E) // PERF_GLOBAL_STATUS
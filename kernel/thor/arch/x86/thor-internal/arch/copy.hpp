@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string.h>
+#include <thor-internal/arch/cpu.hpp>
+
+namespace thor {
+
+// Copies of at least this size use rep movsb on CPUs with ERMS (but without FSRM).
+inline constexpr size_t ermsThreshold = 256;
+
+// Copies large buffers in kernel memory (e.g., pages in the physical window).
+// With ERMS, rep movsb moves whole cache lines and beats our unrolled memcpy() for large
+// copies; with FSRM, it is also fast for short copies.
+inline void bulkCopy(void *dest, const void *src, size_t size) {
+	auto features = getGlobalCpuFeatures();
+	if(features->haveFsrm || (features->haveErms && size >= ermsThreshold)) {
+		// DF = 0 due to the calling convention.
+		asm volatile ("rep movsb" : "+D"(dest), "+S"(src), "+c"(size) : : "memory");
+		return;
+	}
+	memcpy(dest, src, size);
+}
+
+} // namespace thor
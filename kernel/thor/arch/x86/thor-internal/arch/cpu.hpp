@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <stddef.h>
 #include <stdint.h>
 #include <utility>
@@ -283,6 +284,7 @@ struct NmiImageAccessor {
 	Word *ip() { return &_frame()->rip; }
 	Word *cs() { return &_frame()->cs; }
 	Word *rflags() { return &_frame()->rflags; }
+	Word *rbp() { return &_frame()->rbp; }
 
 private:
 	// note: this struct is accessed from assembly.
@@ -518,12 +520,24 @@ struct CpuFeatures {
 	static constexpr uint32_t profileAmdSupported = 2;
 
 	bool haveXsave;
+	bool haveXsaveopt;
 	bool haveAvx;
 	bool haveZmm;
 	bool haveInvariantTsc;
 	bool haveTscDeadline;
 	bool haveVmx;
+	// Enhanced rep movsb and fast short rep movsb.
+	bool haveErms;
+	bool haveFsrm;
+	bool haveMwait;
+	// The APIC timer keeps running in deep C-states.
+	bool haveArat;
+	// CPUID.05H:EDX, i.e., the number of MWAIT sub-states per C-state (4 bits each).
+	uint32_t mwaitSubstates;
 	uint32_t profileFlags;
+	// State components that are enabled in XCR0.
+	uint64_t xsaveMask;
+	// Size of the (standard format) XSAVE area for the components in xsaveMask.
 	size_t xsaveRegionSize;
 };
 
@@ -590,6 +604,13 @@ struct PlatformCpuData : public AssemblyCpuData {
 
 	LocalApicContext apicContext;
 
+	// MONITORed by the idle loop. Other CPUs wake this CPU by writing to it
+	// instead of sending an IPI. Occupies its own cache line since MONITOR
+	// triggers on any write to the line.
+	struct alignas(64) IdleWake {
+		std::atomic<uint32_t> state{0};
+	} idleWake;
+
 	// TODO: This is not really arch-specific!
 	smarter::borrowed_ptr<Thread> activeExecutor;
 };
@@ -632,8 +653,28 @@ void doRunOnStack(void (*function) (void *, void *), void *sp, void *argument);
 void setupBootCpuContext();
 void initializeThisProcessor();
 
+// Booting an AP takes two steps: resetSecondary() sends INIT to put the AP into the
+// wait-for-SIPI state. After all APs have been reset, waitForSecondaryReset() waits
+// for them to settle and bootSecondary() starts them one at a time.
+// This way, the 10ms INIT delay is only paid once and not once per AP.
+void resetSecondary(unsigned int apic_id);
+void waitForSecondaryReset();
 void bootSecondary(unsigned int apic_id);
 
+// Saves the SIMD state of the current CPU to the executor.
+// With XSAVEOPT, components that the thread did not touch since they were last
+// restored (e.g., AVX-512 state of threads that only use SSE) are not written.
+inline void saveSimdState(Executor *executor) {
+	auto features = getGlobalCpuFeatures();
+	if(features->haveXsaveopt) {
+		common::x86::xsaveopt((uint8_t*)executor->_fxState(), ~0);
+	}else if(features->haveXsave) {
+		common::x86::xsave((uint8_t*)executor->_fxState(), ~0);
+	}else{
+		asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
+	}
+}
+
 template<typename F>
 void forkExecutor(F functor, Executor *executor) {
 	auto delegate = [] (void *p) {
@@ -641,11 +682,7 @@ void forkExecutor(F functor, Executor *executor) {
 		(*fp)();
 	};
 
-	if(getGlobalCpuFeatures()->haveXsave) {
-		common::x86::xsave((uint8_t*)executor->_fxState(), ~0);
-	} else {
-		asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
-	}
+	saveSimdState(executor);
 
 	doForkExecutor(executor, delegate, &functor);
 }
@@ -32,8 +32,21 @@ inline void halt() {
 	asm volatile ("hlt");
 }
 
+// States of PlatformCpuData::idleWake.
+enum : uint32_t {
+	idleRunning = 0,
+	// The CPU is (about to be) in MWAIT.
+	idleWaiting = 1,
+	// Another CPU requested a reschedule by writing the monitored line.
+	idleWoken = 2
+};
+
 void suspendSelf();
 
+// Must be called when an IRQ interrupts the idle loop. Afterwards, pings are
+// delivered as IPIs again until the CPU re-enters MWAIT.
+void resetIdleWakeState();
+
 void sendPingIpi(int id);
 
 } // namespace thor
@@ -2,6 +2,7 @@
 
 #include <atomic>
 
+#include <arch/variable.hpp>
 #include <frg/list.hpp>
 #include <assert.h>
 #include <smarter.hpp>
@@ -11,9 +12,13 @@
 
 namespace thor {
 
+struct DetachedPageList;
+
 enum {
 	kPageSize = 0x1000,
-	kPageShift = 12
+	kPageShift = 12,
+	kHugePageSize = 0x200000,
+	kHugePageShift = 21
 };
 
 constexpr Word kPfAccess = 1;
@@ -95,12 +100,17 @@ private:
 
 	uint64_t _sequence;
 
+	// Value of PageSpace::_bindingEpoch when this node was queued.
+	uint64_t _epoch;
+
 	std::atomic<unsigned int> _bindingsToShoot;
 
 	frg::default_list_hook<ShootNode> _queueNode;
 };
 
 // Functions for debugging kernel page access:
+// Note that eir maps most of the physical mapping using 2 MiB pages; these functions
+// only work for pages that are mapped individually.
 // Deny all access to the physical mapping.
 void poisonPhysicalAccess(PhysicalAddr physical);
 // Deny write access to the physical mapping.
@@ -109,7 +119,9 @@ void poisonPhysicalWriteAccess(PhysicalAddr physical);
 struct PageSpace;
 struct PageBinding;
 
-static constexpr int maxPcidCount = 8;
+// Number of address spaces that stay tagged in the TLB of each CPU.
+// Servers and their clients constantly switch spaces via IPC, so this should not be too small.
+static constexpr int maxPcidCount = 32;
 
 // Per-CPU context for paging.
 struct PageContext {
@@ -163,9 +175,16 @@ struct PageBinding {
 
 	void shootdown();
 
+	// Invalidates a range of this binding's TLB entries on the current CPU.
+	void invalidateRange(VirtualAddr address, size_t size);
+
 private:
 	int _pcid;
 
+	// Set if TLB entries of this (non-primary) PCID were not invalidated yet.
+	// The PCID is flushed when the binding becomes primary again.
+	bool _staleTlb;
+
 	// TODO: Once we can use libsmarter in the kernel, we should make this a shared_ptr
 	//       to the PageSpace that does *not* prevent the PageSpace from becoming
 	//       "activatable".
@@ -221,6 +240,10 @@ private:
 
 	uint64_t _shootSequence;
 
+	// Incremented whenever a binding is added, removed or processes the shootdown queue.
+	// Used to decide whether a previously sent shootdown IPI also covers a new request.
+	uint64_t _bindingEpoch;
+
 	frg::intrusive_list<
 		ShootNode,
 		frg::locate_member<
@@ -339,6 +362,9 @@ public:
 		PageAccessor _accessor3;
 		PageAccessor _accessor2;
 		PageAccessor _accessor1; // Finest level (page table).
+
+		// Set if the address is mapped by a 2 MiB page (in _accessor2).
+		bool _huge = false;
 	};
 
 	ClientPageSpace();
@@ -351,13 +377,32 @@ public:
 
 	void mapSingle4k(VirtualAddr pointer, PhysicalAddr physical, bool user_access,
 			uint32_t flags, CachingMode caching_mode);
+	// Maps a 2 MiB page. Fails if any page table already exists for the range.
+	// The 4k functions below transparently split 2 MiB pages if necessary.
+	bool mapSingle2m(VirtualAddr pointer, PhysicalAddr physical, bool user_access,
+			uint32_t flags, CachingMode caching_mode);
 	PageStatus unmapSingle4k(VirtualAddr pointer);
 	PageStatus cleanSingle4k(VirtualAddr pointer);
 	bool isMapped(VirtualAddr pointer);
 	bool updatePageAccess(VirtualAddr pointer);
 
+	// Detaches PTs and PDs that overlap [va, va + size) and are empty.
+	// The caller frees them after the range was shot down.
+	void detachEmptyTables(VirtualAddr va, size_t size, DetachedPageList &list);
+
+	// Number of pages that are used for page tables (including the root table).
+	size_t numTablePages() {
+		return _numTablePages.load(std::memory_order_relaxed);
+	}
+
 private:
+	// Replaces the 2 MiB page in tbl2[index2] by a page table with equivalent 4k entries.
+	void _splitHugePage(arch::scalar_variable<uint64_t> *tbl2, int index2);
+
 	frg::ticket_spinlock _mutex;
+
+	// Decreases when detachEmptyTables() reclaims tables.
+	std::atomic<size_t> _numTablePages{1};
 };
 
 void invalidatePage(const void *address);
@@ -74,6 +74,8 @@ private:
 	frg::ticket_spinlock _mutex;
 
 	uint64_t _globalDeadline;
+	// CPU that is responsible for firing the global alarm.
+	int _deadlineCpu = -1;
 };
 
 struct LocalApicContext {
@@ -84,19 +86,33 @@ struct LocalApicContext {
 	static void setPreemption(uint64_t nanos);
 	static bool checkPreemption();
 
+	// Earliest deadline that the local timer is armed for (or zero if it is not armed).
+	// Used to predict the length of idle periods.
+	static uint64_t nextDeadline();
+
 	static void handleTimerIrq();
 
 	bool useTscMode = false;
 	bool timersAreCalibrated = false;
 	uint32_t localTicksPerMilli = 0;
 	uint64_t tscTicksPerMilli = 0;
+	// Nanoseconds = (TSC * tscNanosMult) >> tscNanosShift.
+	uint64_t tscNanosMult = 0;
+	static constexpr int tscNanosShift = 32;
+	// Inverse of the above: TSC = (nanoseconds * tscTicksMult) >> tscTicksShift.
+	uint64_t tscTicksMult = 0;
+	static constexpr int tscTicksShift = 32;
 
 private:
+	static void _fetchGlobalDeadline();
 	static void _updateLocalTimer();
 
 private:
 	uint64_t _preemptionDeadline;
 	uint64_t _globalDeadline;
+	// Value of IA32_TSC_DEADLINE as last written by _updateLocalTimer().
+	// The CPU clears the MSR when the timer fires.
+	uint64_t _programmedTscDeadline = 0;
 };
 
 GlobalApicContext *globalApicContext();
@@ -61,6 +61,7 @@ namespace thor::vmx {
 	constexpr uint64_t GUEST_CR3 = 0x00006802;
 	constexpr uint64_t GUEST_CR4 = 0x00006804;
 	constexpr uint64_t CTLS_EPTP = 0x0000201A;
+	constexpr uint64_t VIRTUAL_PROCESSOR_ID = 0x00000000;
 
 	constexpr uint64_t GUEST_ES_SELECTOR                = 0x00000800;
 	constexpr uint64_t GUEST_CS_SELECTOR                = 0x00000802;
@@ -122,6 +123,7 @@ namespace thor::vmx {
 	constexpr uint64_t GUEST_INTR_STATUS                 = 0x00000810;
 	constexpr uint64_t GUEST_PML_INDEX                   = 0x00000812;
 	constexpr uint64_t VM_EXIT_REASON                    = 0x00004402;
+	constexpr uint64_t VM_EXIT_INSTRUCTION_LENGTH        = 0x0000440c;
 	constexpr uint64_t VM_INSTRUCTION_ERROR              = 0x00004400;
 	constexpr uint64_t EPT_VIOLATION_ADDRESS             = 0x00002400;
 	constexpr uint64_t EPT_VIOLATION_FLAGS               = 0x00006400;
@@ -132,6 +134,7 @@ namespace thor::vmx {
 	constexpr uint64_t TR_ACCESS_RIGHT   = (0x3 | 1 << 7);
 
 	constexpr uint64_t VMEXIT_EXTERNAL_INTERRUPT           = 1;
+	constexpr uint64_t VMEXIT_CPUID                        = 10;
 	constexpr uint64_t VMEXIT_HLT                          = 12;
 	constexpr uint64_t VMEXIT_EPT_VIOLATION                = 48;
 
@@ -143,6 +146,11 @@ namespace thor::vmx {
 	constexpr uint64_t EPT_ENABLE                     = 1 << 1;
 	constexpr uint64_t UNRESTRICTED_GUEST             = 1 << 7;
 	constexpr uint64_t VMEXIT_ON_DESCRIPTOR           = 1 << 2;
+	constexpr uint64_t VPID_ENABLE                    = 1 << 5;
+
+	// Bits of IA32_VMX_EPT_VPID_CAP.
+	constexpr uint64_t CAP_INVVPID                    = uint64_t(1) << 32;
+	constexpr uint64_t CAP_INVVPID_SINGLE_CONTEXT     = uint64_t(1) << 41;
 
 
 	bool vmxon();
@@ -152,6 +160,8 @@ namespace thor::vmx {
 		Vmcs(const Vmcs& vmcs) = delete;
 		Vmcs& operator=(const Vmcs& vmcs) = delete;
 		HelVmexitReason run();
+		// Emulates a CPUID instruction that caused a VM exit.
+		void handleCpuid();
 		void storeRegs(const HelX86VirtualizationRegs *regs);
 		void loadRegs(HelX86VirtualizationRegs *res);
 		~Vmcs();
@@ -162,6 +172,12 @@ namespace thor::vmx {
 		smarter::shared_ptr<EptSpace> space;
 		bool launched = false;
 
+		// Tags the guest's TLB entries such that they survive VM entries and exits.
+		// Zero if VPIDs are not used.
+		uint16_t vpid = 0;
+		// CPU that this VMCS last ran on. TLB entries on other CPUs may be stale.
+		int lastCpu = -1;
+
 		GuestState state;
 	};
 }
@@ -110,6 +110,24 @@ namespace thor::vmx {
 		return tmp;
 	}
 
+	namespace {
+		// VPIDs are never reused, hence no VMCS can see the TLB entries of another one.
+		// Once they run out, new VMCSs run without a VPID.
+		std::atomic<uint32_t> nextVpid{1};
+
+		void invvpidSingleContext(uint16_t vpid) {
+			struct {
+				uint64_t vpid;
+				uint64_t linearAddress;
+			} descriptor{vpid, 0};
+			asm volatile (
+				"invvpid (%0), %1;"
+				: : "r"(&descriptor), "r"((uint64_t)1)
+				: "memory"
+			);
+		}
+	}
+
 	Vmcs::Vmcs(smarter::shared_ptr<EptSpace> ept) : space(ept) {
 		infoLogger() << "vmx: Creating VMCS" << frg::endlog;
 		region = (void*)physicalAllocator->allocate(kPageSize);
@@ -132,10 +150,22 @@ namespace thor::vmx {
 				VMEXIT_ON_HLT |
 				VMEXIT_ON_PIO |
 				SECONDARY_CONTROLS_ON);
-		vmwrite(PROC_BASED_VM_EXEC_CONTROLS2,
-				EPT_ENABLE |
-				UNRESTRICTED_GUEST |
-				VMEXIT_ON_DESCRIPTOR);
+		uint32_t allowedSecondary = common::x86::rdmsr(IA32_VMX_SEC_PROCBASED_CTLS_MSR) >> 32;
+		uint64_t eptVpidCaps = common::x86::rdmsr(IA32_VMX_EPT_VPID_CAP_MSR);
+		if((allowedSecondary & VPID_ENABLE)
+				&& (eptVpidCaps & CAP_INVVPID)
+				&& (eptVpidCaps & CAP_INVVPID_SINGLE_CONTEXT)) {
+			auto id = nextVpid.fetch_add(1, std::memory_order_relaxed);
+			if(id <= 0xFFFF)
+				vpid = id;
+		}
+
+		uint64_t secondary = EPT_ENABLE | UNRESTRICTED_GUEST | VMEXIT_ON_DESCRIPTOR;
+		if(vpid)
+			secondary |= VPID_ENABLE;
+		vmwrite(PROC_BASED_VM_EXEC_CONTROLS2, secondary);
+		if(vpid)
+			vmwrite(VIRTUAL_PROCESSOR_ID, vpid);
 		vmwrite(EXCEPTION_BITMAP, 0);
 
 		uint64_t vmExitCtrls = common::x86::rdmsr(0x483);
@@ -310,6 +340,11 @@ namespace thor::vmx {
 			asm volatile("cli");
 			vmclear((PhysicalAddr)region);
 			vmptrld((PhysicalAddr)region);
+			// The guest's INVLPGs and CR3 writes only affect the current CPU.
+			if(vpid && getCpuData()->cpuIndex != lastCpu) {
+				invvpidSingleContext(vpid);
+				lastCpu = getCpuData()->cpuIndex;
+			}
 			if(getGlobalCpuFeatures()->haveXsave){
 				common::x86::xsave((uint8_t*)hostFstate, ~0);
 				common::x86::xrstor((uint8_t*)guestFstate, ~0);
@@ -369,12 +404,32 @@ namespace thor::vmx {
 					exitInfo.flags = exitFlags;
 					return exitInfo;
 				}
+			}else if(reason == VMEXIT_CPUID) {
+				// CPUID always exits. Answer it here instead of bouncing to the VMM:
+				// guests execute it often (e.g., in their TSC and feature detection paths).
+				handleCpuid();
 			}else if(reason == VMEXIT_EXTERNAL_INTERRUPT) {
 				infoLogger() << "vmx: external-interrupt exit" << frg::endlog;
 			}
 		}
 	}
 
+	void Vmcs::handleCpuid() {
+		auto leaf = static_cast<uint32_t>(state.rax);
+		auto subleaf = static_cast<uint32_t>(state.rcx);
+		auto res = common::x86::cpuid(leaf, subleaf);
+		if(leaf == 1) {
+			res[2] &= ~(uint32_t(1) << 5); // Hide VMX, we do not support nested virtualization.
+			res[2] |= uint32_t(1) << 31; // Indicate that we are running under a hypervisor.
+		}
+		state.rax = res[0];
+		state.rbx = res[1];
+		state.rcx = res[2];
+		state.rdx = res[3];
+
+		vmwrite(GUEST_RIP, vmread(GUEST_RIP) + vmread(VM_EXIT_INSTRUCTION_LENGTH));
+	}
+
 	void Vmcs::storeRegs(const HelX86VirtualizationRegs *regs) {
 		memcpy(&state, regs, sizeof(GuestState));
 
@@ -1,9 +1,13 @@
 #include <cstddef>
 #include <type_traits>
 #include <thor-internal/address-space.hpp>
+#include <thor-internal/arch/copy.hpp>
 #include <thor-internal/coroutine.hpp>
+#include <thor-internal/cpu-data.hpp>
 #include <thor-internal/physical.hpp>
 #include <thor-internal/fiber.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/metrics.hpp>
 #include <frg/container_of.hpp>
 #include <thor-internal/types.hpp>
 
@@ -15,6 +19,31 @@ namespace {
 	constexpr bool logCleanup = false;
 	constexpr bool logUsage = false;
 
+	// Keeps VirtualSpace::_mappingSequence odd while mappings are modified.
+	struct MappingSequenceGuard {
+		MappingSequenceGuard(std::atomic<uint64_t> *sequence)
+		: _sequence{sequence} {
+			if(_sequence)
+				_sequence->fetch_add(1, std::memory_order_acq_rel);
+		}
+
+		MappingSequenceGuard(const MappingSequenceGuard &) = delete;
+
+		~MappingSequenceGuard() {
+			if(_sequence)
+				_sequence->fetch_add(1, std::memory_order_release);
+		}
+
+		MappingSequenceGuard &operator= (const MappingSequenceGuard &) = delete;
+
+	private:
+		std::atomic<uint64_t> *_sequence;
+	};
+
+	// Bounds of the per-mapping fault-around window, in pages.
+	constexpr size_t initialFaultAroundPages = 16;
+	constexpr size_t maxFaultAroundPages = 256;
+
 	[[maybe_unused]]
 	void logRss(VirtualSpace *space) {
 		if(!logUsage)
@@ -39,8 +68,12 @@ namespace {
 // Generic VirtualOperation implementation.
 // --------------------------------------------------------
 
+bool VirtualOperations::mapSingle2m(VirtualAddr, PhysicalAddr, uint32_t, CachingMode) {
+	return false;
+}
+
 frg::expected<Error> VirtualOperations::mapPresentPages(VirtualAddr va, MemoryView *view,
-		uintptr_t offset, size_t size, PageFlags flags) {
+		uintptr_t offset, size_t size, PageFlags flags, CachingMode cachingMode) {
 	assert(!(va & (kPageSize - 1)));
 	assert(!(offset & (kPageSize - 1)));
 	assert(!(size & (kPageSize - 1)));
@@ -48,22 +81,36 @@ frg::expected<Error> VirtualOperations::mapPresentPages(VirtualAddr va, MemoryVi
 	if (!flags)
 		return {};
 
-	for(size_t progress = 0; progress < size; progress += kPageSize) {
+	size_t progress = 0;
+	while(progress < size) {
+		// Prefer huge pages if the view is backed by suitable contiguous memory.
+		if(!((va + progress) & (kHugePageSize - 1)) && size - progress >= kHugePageSize) {
+			auto hugeRange = view->peekHugeRange(offset + progress);
+			if(hugeRange.get<0>() != PhysicalAddr(-1)
+					&& mapSingle2m(va + progress, hugeRange.get<0>(),
+							flags, effectiveCachingMode(cachingMode, hugeRange.get<1>()))) {
+				accountPages_(view, kHugePageSize >> kPageShift);
+				progress += kHugePageSize;
+				continue;
+			}
+		}
+
 		auto physicalRange = view->peekRange(offset + progress);
 
 		assert(!isMapped(va + progress));
-		if(physicalRange.get<0>() == PhysicalAddr(-1))
-			continue;
-		assert(!(physicalRange.get<0>() & (kPageSize - 1)));
-
-		mapSingle4k(va + progress, physicalRange.get<0>(),
-				flags, physicalRange.get<1>());
+		if(physicalRange.get<0>() != PhysicalAddr(-1)) {
+			assert(!(physicalRange.get<0>() & (kPageSize - 1)));
+			mapSingle4k(va + progress, physicalRange.get<0>(),
+					flags, effectiveCachingMode(cachingMode, physicalRange.get<1>()));
+			accountPages_(view, 1);
+		}
+		progress += kPageSize;
 	}
 	return {};
 }
 
 frg::expected<Error> VirtualOperations::remapPresentPages(VirtualAddr va, MemoryView *view,
-		uintptr_t offset, size_t size, PageFlags flags) {
+		uintptr_t offset, size_t size, PageFlags flags, CachingMode cachingMode) {
 	assert(!(va & (kPageSize - 1)));
 	assert(!(offset & (kPageSize - 1)));
 	assert(!(size & (kPageSize - 1)));
@@ -78,10 +125,12 @@ frg::expected<Error> VirtualOperations::remapPresentPages(VirtualAddr va, Memory
 		if(physicalRange.get<0>() != PhysicalAddr(-1)) {
 			assert(!(physicalRange.get<0>() & (kPageSize - 1)));
 			mapSingle4k(va + progress, physicalRange.get<0>(),
-					flags, physicalRange.get<1>());
+					flags, effectiveCachingMode(cachingMode, physicalRange.get<1>()));
+			accountPages_(view, 1);
 		}
 
 		if(status & page_status::present) {
+			accountPages_(view, -1);
 			if(status & page_status::dirty)
 				view->markDirty(offset + progress, kPageSize);
 		}
@@ -89,8 +138,33 @@ frg::expected<Error> VirtualOperations::remapPresentPages(VirtualAddr va, Memory
 	return {};
 }
 
+frg::expected<Error> VirtualOperations::mapResidentPages(VirtualAddr va, MemoryView *view,
+		uintptr_t offset, size_t size, PageFlags flags, CachingMode cachingMode) {
+	assert(!(va & (kPageSize - 1)));
+	assert(!(offset & (kPageSize - 1)));
+	assert(!(size & (kPageSize - 1)));
+
+	if (!flags)
+		return {};
+
+	for(size_t progress = 0; progress < size; progress += kPageSize) {
+		if(isMapped(va + progress))
+			continue;
+
+		auto physicalRange = view->peekRange(offset + progress);
+		if(physicalRange.get<0>() == PhysicalAddr(-1))
+			continue;
+		assert(!(physicalRange.get<0>() & (kPageSize - 1)));
+
+		mapSingle4k(va + progress, physicalRange.get<0>(),
+				flags, effectiveCachingMode(cachingMode, physicalRange.get<1>()));
+		accountPages_(view, 1);
+	}
+	return {};
+}
+
 frg::expected<Error> VirtualOperations::faultPage(VirtualAddr va,
-		MemoryView *view, uintptr_t offset, PageFlags flags) {
+		MemoryView *view, uintptr_t offset, PageFlags flags, CachingMode cachingMode) {
 	auto physicalRange = view->peekRange(offset & ~(kPageSize - 1));
 	if(physicalRange.get<0>() == PhysicalAddr(-1))
 		return Error::fault;
@@ -98,12 +172,35 @@ frg::expected<Error> VirtualOperations::faultPage(VirtualAddr va,
 	// TODO: detect spurious page faults.
 	PageStatus status = unmapSingle4k(va & ~(kPageSize - 1));
 	mapSingle4k(va & ~(kPageSize - 1), physicalRange.get<0>() & ~(kPageSize - 1),
-			flags, physicalRange.get<1>());
+			flags, effectiveCachingMode(cachingMode, physicalRange.get<1>()));
 
 	if(status & page_status::present) {
 		if(status & page_status::dirty)
 			view->markDirty(offset & ~(kPageSize - 1), kPageSize);
+	}else{
+		accountPages_(view, 1);
+	}
+	return {};
+}
+
+frg::expected<Error> VirtualOperations::faultHugePage(VirtualAddr va,
+		MemoryView *view, uintptr_t offset, PageFlags flags, CachingMode cachingMode) {
+	assert(!(va & (kHugePageSize - 1)));
+	auto hugeRange = view->peekHugeRange(offset);
+	if(hugeRange.get<0>() == PhysicalAddr(-1))
+		return Error::fault;
+
+	// Only map a huge page if that does not replace existing 4k mappings;
+	// otherwise, we would have to propagate their dirty bits.
+	for(size_t progress = 0; progress < kHugePageSize; progress += kPageSize) {
+		if(isMapped(va + progress))
+			return Error::fault;
 	}
+
+	if(!mapSingle2m(va, hugeRange.get<0>(), flags,
+			effectiveCachingMode(cachingMode, hugeRange.get<1>())))
+		return Error::fault;
+	accountPages_(view, kHugePageSize >> kPageShift);
 	return {};
 }
 
@@ -134,6 +231,7 @@ frg::expected<Error> VirtualOperations::unmapPages(VirtualAddr va,
 		auto status = unmapSingle4k(va + progress);
 		if(!(status & page_status::present))
 			continue;
+		accountPages_(view, -1);
 
 		if(status & page_status::dirty)
 			view->markDirty(offset + progress, kPageSize);
@@ -141,17 +239,18 @@ frg::expected<Error> VirtualOperations::unmapPages(VirtualAddr va,
 	return {};
 }
 
-size_t VirtualOperations::getRss() {
-	// Derived classes should track RSS; the generic implementaton does not.
-	// TODO: As soon as all derived classes implement this, we should make it pure virtual.
+size_t VirtualOperations::getPageTablePages() {
 	return 0;
 }
 
+void VirtualOperations::detachEmptyTables(VirtualAddr, size_t, DetachedPageList &) { }
+
 // --------------------------------------------------------
 
 MemorySlice::MemorySlice(smarter::shared_ptr<MemoryView> view,
-		ptrdiff_t view_offset, size_t view_size)
-: _view{std::move(view)}, _viewOffset{view_offset}, _viewSize{view_size} {
+		ptrdiff_t view_offset, size_t view_size, CachingMode caching_mode)
+: _view{std::move(view)}, _viewOffset{view_offset}, _viewSize{view_size},
+		_cachingMode{caching_mode} {
 	assert(!(_viewOffset & (kPageSize - 1)));
 	assert(!(_viewSize & (kPageSize - 1)));
 }
@@ -210,7 +309,8 @@ bool HoleAggregator::check_invariant(HoleTree &tree, Hole *hole) {
 Mapping::Mapping(size_t length, MappingFlags flags,
 		smarter::shared_ptr<MemorySlice> slice_, uintptr_t viewOffset)
 : length{length}, flags{flags},
-		slice{std::move(slice_)}, viewOffset{viewOffset} {
+		slice{std::move(slice_)}, viewOffset{viewOffset},
+		faultAroundPages{initialFaultAroundPages} {
 	assert(viewOffset >= slice->offset());
 	assert(viewOffset + length <= slice->offset() + slice->length());
 	view = slice->getView();
@@ -273,7 +373,20 @@ Mapping::resolveRange(ptrdiff_t offset) {
 	// TODO: This function should be rewritten.
 	assert((size_t)offset + kPageSize <= length);
 	auto bundle_range = view->peekRange(viewOffset + offset);
-	return frg::tuple<PhysicalAddr, CachingMode>{bundle_range.get<0>(), bundle_range.get<1>()};
+	return frg::tuple<PhysicalAddr, CachingMode>{bundle_range.get<0>(),
+			effectiveCachingMode(cachingMode(), bundle_range.get<1>())};
+}
+
+CachingMode Mapping::cachingMode() {
+	switch(flags & MappingFlags::cachingMask) {
+	case MappingFlags::cacheWriteBack: return CachingMode::writeBack;
+	case MappingFlags::cacheWriteCombine: return CachingMode::writeCombine;
+	case MappingFlags::cacheWriteThrough: return CachingMode::writeThrough;
+	case MappingFlags::cacheUncached: return CachingMode::uncached;
+	default:
+		assert(!(flags & MappingFlags::cachingMask));
+		return CachingMode::null;
+	}
 }
 
 coroutine<void> Mapping::runEvictionLoop() {
@@ -322,19 +435,68 @@ coroutine<void> Mapping::runEvictionLoop() {
 
 CowChain::CowChain(smarter::shared_ptr<CowChain> chain)
 : _superChain{std::move(chain)}, _pages{*kernelAlloc} {
+	if(_superChain)
+		_superChain->_numSubChains.fetch_add(1, std::memory_order_relaxed);
 }
 
 CowChain::~CowChain() {
 	if(logCleanup)
 		infoLogger() << "thor: Releasing CowChain" << frg::endlog;
 
+	if(_superChain)
+		_superChain->_numSubChains.fetch_sub(1, std::memory_order_relaxed);
+
 	for(auto it = _pages.begin(); it != _pages.end(); ++it) {
-		auto physical = it->load(std::memory_order_relaxed);
-		assert(physical != PhysicalAddr(-1));
+		auto physical = it->physical.load(std::memory_order_relaxed);
+		if(physical == PhysicalAddr(-1))
+			continue;
 		physicalAllocator->free(physical, kPageSize);
 	}
 }
 
+// --------------------------------------------------------
+// RangeLock
+// --------------------------------------------------------
+
+coroutine<void> RangeLock::_acquire(Holder *holder) {
+	assert(!holder->_acquired);
+
+	while(true) {
+		// The condition is evaluated with the event's lock held, hence a concurrent
+		// _release() cannot slip between the check and the wait.
+		auto waited = co_await _releaseEvent.async_wait_if([&] () -> bool {
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			for(auto other : _holders) {
+				if(holder->_conflictsWith(other))
+					return true;
+			}
+			_holders.push_back(holder);
+			holder->_acquired = true;
+			return false;
+		});
+		if(holder->_acquired)
+			break;
+
+		// Do not continue on the stack of _release().
+		if(waited)
+			co_await WorkQueue::generalQueue()->schedule();
+	}
+}
+
+void RangeLock::_release(Holder *holder) {
+	assert(holder->_acquired);
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		_holders.erase(_holders.iterator_to(holder));
+		holder->_acquired = false;
+	}
+	_releaseEvent.raise();
+}
+
 // --------------------------------------------------------
 // VirtualSpace
 // --------------------------------------------------------
@@ -358,43 +520,47 @@ VirtualSpace::~VirtualSpace() {
 	}
 }
 
-void VirtualSpace::retire() {
+coroutine<void> VirtualSpace::retire() {
 	if(logCleanup)
 		infoLogger() << "\e[31mthor: VirtualSpace is cleared\e[39m" << frg::endlog;
 
 	// TODO: Set some flag to make sure that no mappings are added/deleted.
-	auto mapping = _mappings.first();
-	while(mapping) {
-		assert(mapping->state == MappingState::active);
-		mapping->state = MappingState::zombie;
+	{
+		MappingSequenceGuard sequenceGuard{&_mappingSequence};
+		auto mapping = _mappings.first();
+		while(mapping) {
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto pagingLock = frg::guard(&mapping->pagingMutex);
 
-		auto unmapOutcome = _ops->unmapPages(mapping->address, mapping->view.get(),
-				mapping->viewOffset, mapping->length);
-		assert(unmapOutcome);
+				assert(mapping->state == MappingState::active);
+				mapping->state = MappingState::zombie;
+			}
 
-		mapping = MappingTree::successor(mapping);
+			auto unmapOutcome = _ops->unmapPages(mapping->address, mapping->view.get(),
+					mapping->viewOffset, mapping->length);
+			assert(unmapOutcome);
+
+			mapping = MappingTree::successor(mapping);
+		}
 	}
 
-	// TODO: It would be less ugly to run this in a non-detached way.
-	async::detach_with_allocator(*kernelAlloc, [] (smarter::shared_ptr<VirtualSpace> self)
-			-> coroutine<void> {
-		co_await self->_ops->retire();
+	co_await _ops->retire();
 
-		while(self->_mappings.get_root()) {
-			auto mapping = self->_mappings.get_root();
-			self->_mappings.remove(mapping);
+	while(_mappings.get_root()) {
+		auto mapping = _mappings.get_root();
+		_mappings.remove(mapping);
 
-			assert(mapping->state == MappingState::zombie);
-			mapping->state = MappingState::retired;
+		assert(mapping->state == MappingState::zombie);
+		mapping->state = MappingState::retired;
 
-			if(mapping->view->canEvictMemory()) {
-				mapping->cancelEviction.cancel();
-				co_await mapping->evictionDoneEvent.wait();
-			}
-			mapping->view->removeObserver(&mapping->observer);
-			mapping->selfPtr.ctr()->decrement();
+		if(mapping->view->canEvictMemory()) {
+			mapping->cancelEviction.cancel();
+			co_await mapping->evictionDoneEvent.wait();
 		}
-	}(selfPtr.lock()));
+		mapping->view->removeObserver(&mapping->observer);
+		mapping->selfPtr.ctr()->decrement();
+	}
 }
 
 coroutine<frg::expected<Error, VirtualAddr>>
@@ -410,7 +576,15 @@ VirtualSpace::map(smarter::borrowed_ptr<MemorySlice> slice,
 	frg::unique_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
 	bool needsShootdown = false;
 
+	// Non-fixed mappings are allocated from holes; since the allocation and the
+	// installation of the mapping happen atomically, nobody can observe the range before.
+	auto [lockAddress, lockLength] = _affectedRange(address, length);
+	RangeLock::Holder rangeHolder{&_rangeLock, lockAddress, lockLength, true};
+	MappingSequenceGuard sequenceGuard{(flags & kMapFixed) ? &_mappingSequence : nullptr};
+
 	if (flags & kMapFixed) {
+		co_await rangeHolder.acquire();
+
 		auto [start, end] = co_await _splitMappings(address, length);
 		assert(start || (!start && !end));
 		needsShootdown = co_await _unmapMappings(address, length, start, end);
@@ -464,6 +638,29 @@ VirtualSpace::map(smarter::borrowed_ptr<MemorySlice> slice,
 		if(flags & kMapDontRequireBacking)
 			mappingFlags |= MappingFlags::dontRequireBacking;
 
+		// Without an explicit caching mode, the default of the slice applies.
+		auto caching = flags & kMapCachingMask;
+		if(!caching) {
+			switch(slice->cachingMode()) {
+			case CachingMode::writeBack: caching = kMapCacheWriteBack; break;
+			case CachingMode::writeCombine: caching = kMapCacheWriteCombine; break;
+			case CachingMode::writeThrough: caching = kMapCacheWriteThrough; break;
+			case CachingMode::uncached: caching = kMapCacheUncached; break;
+			default: break;
+			}
+		}
+		if(caching == kMapCacheWriteBack) {
+			mappingFlags |= MappingFlags::cacheWriteBack;
+		}else if(caching == kMapCacheWriteCombine) {
+			mappingFlags |= MappingFlags::cacheWriteCombine;
+		}else if(caching == kMapCacheWriteThrough) {
+			mappingFlags |= MappingFlags::cacheWriteThrough;
+		}else if(caching == kMapCacheUncached) {
+			mappingFlags |= MappingFlags::cacheUncached;
+		}else{
+			assert(!caching);
+		}
+
 		mapping = smarter::allocate_shared<Mapping>(Allocator{},
 				length, static_cast<MappingFlags>(mappingFlags),
 				slice.lock(), slice->offset() + offset);
@@ -474,6 +671,7 @@ VirtualSpace::map(smarter::borrowed_ptr<MemorySlice> slice,
 		// Install the new mapping object.
 		mapping->tie(selfPtr.lock(), actualAddress);
 		_mappings.insert(mapping.get());
+		_mappedSize.fetch_add(length, std::memory_order_relaxed);
 
 		assert(mapping->state == MappingState::null);
 		mapping->state = MappingState::active;
@@ -491,7 +689,7 @@ VirtualSpace::map(smarter::borrowed_ptr<MemorySlice> slice,
 			pageFlags |= page_access::read;
 
 		auto mapOutcome = _ops->mapPresentPages(mapping->address, mapping->view.get(),
-				mapping->viewOffset, mapping->length, pageFlags);
+				mapping->viewOffset, mapping->length, pageFlags, mapping->cachingMode());
 		assert(mapOutcome);
 	}
 
@@ -536,6 +734,11 @@ VirtualSpace::protect(VirtualAddr address, size_t length, uint32_t flags) {
 	co_await _consistencyMutex.async_lock();
 	frg::unique_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
 
+	auto [lockAddress, lockLength] = _affectedRange(address, length);
+	RangeLock::Holder rangeHolder{&_rangeLock, lockAddress, lockLength, true};
+	co_await rangeHolder.acquire();
+	MappingSequenceGuard sequenceGuard{&_mappingSequence};
+
 	auto [start, end] = co_await _splitMappings(address, length);
 	assert(start || (!start && !end));
 	for (auto it = start; it != end;) {
@@ -543,7 +746,12 @@ VirtualSpace::protect(VirtualAddr address, size_t length, uint32_t flags) {
 		it = MappingTree::successor(it);
 
 		if (address >= mapping->address && (address + length) <= (mapping->address + mapping->length)) {
-			mapping->protect(static_cast<MappingFlags>(mappingFlags));
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto pagingLock = frg::guard(&mapping->pagingMutex);
+
+				mapping->protect(static_cast<MappingFlags>(mappingFlags));
+			}
 
 			assert(mapping->state == MappingState::active);
 
@@ -559,7 +767,7 @@ VirtualSpace::protect(VirtualAddr address, size_t length, uint32_t flags) {
 			frg::unique_lock evictionLock{frg::adopt_lock, mapping->evictionMutex};
 
 			auto remapOutcome = _ops->remapPresentPages(mapping->address, mapping->view.get(),
-					mapping->viewOffset, mapping->length, pageFlags);
+					mapping->viewOffset, mapping->length, pageFlags, mapping->cachingMode());
 			assert(remapOutcome);
 		}
 	}
@@ -572,25 +780,166 @@ coroutine<frg::expected<Error>> VirtualSpace::unmap(VirtualAddr address, size_t
 	co_await _consistencyMutex.async_lock();
 	frg::unique_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
 
+	auto [lockAddress, lockLength] = _affectedRange(address, length);
+	RangeLock::Holder rangeHolder{&_rangeLock, lockAddress, lockLength, true};
+	co_await rangeHolder.acquire();
+	MappingSequenceGuard sequenceGuard{&_mappingSequence};
+
 	auto [start, end] = co_await _splitMappings(address, length);
 	assert(start || (!start && !end));
 	auto needsShootdown = co_await _unmapMappings(address, length, start, end);
 
-	if (needsShootdown)
+	if (needsShootdown) {
+		// Reclaim page tables that became empty; this is batched with the shootdown.
+		DetachedPageList tables;
+		_ops->detachEmptyTables(address, length, tables);
 		co_await _ops->shootdown(address, length);
+		tables.free();
+	}
 
 	co_return {};
 }
 
+coroutine<frg::expected<Error, VirtualAddr>>
+VirtualSpace::remap(smarter::shared_ptr<MemorySlice> slice, VirtualAddr address,
+		size_t length, size_t newLength, RemapFlags flags) {
+	assert(length && newLength);
+	assert(!(length % kPageSize) && !(newLength % kPageSize));
+
+	co_await _consistencyMutex.async_lock();
+	frg::unique_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
+
+	// If the mapping grows (or moves), the new range is allocated from holes.
+	// As in map(), nobody can observe that range before the mapping is installed,
+	// hence it is sufficient to lock the current range.
+	auto [lockAddress, lockLength] = _affectedRange(address, length);
+	RangeLock::Holder rangeHolder{&_rangeLock, lockAddress, lockLength, true};
+	co_await rangeHolder.acquire();
+	MappingSequenceGuard sequenceGuard{&_mappingSequence};
+
+	auto [start, end] = co_await _splitMappings(address, length);
+	if(!start || start->address != address || start->length != length)
+		co_return Error::illegalArgs;
+	auto mapping = start->selfPtr.lock();
+	assert(mapping->state == MappingState::active);
+
+	if(newLength == length)
+		co_return address;
+
+	if(newLength < length) {
+		// Shrinking is the same as unmapping the tail of the mapping.
+		auto tailAddress = address + newLength;
+		auto tailLength = length - newLength;
+		auto [tailStart, tailEnd] = co_await _splitMappings(tailAddress, tailLength);
+		auto needsShootdown = co_await _unmapMappings(tailAddress, tailLength,
+				tailStart, tailEnd);
+		if(needsShootdown)
+			co_await _ops->shootdown(tailAddress, tailLength);
+		co_return address;
+	}
+
+	if(!slice)
+		slice = mapping->slice;
+	if(slice->getView().get() != mapping->view.get() || mapping->viewOffset < slice->offset())
+		co_return Error::illegalArgs;
+	if(mapping->viewOffset + newLength > slice->offset() + slice->length())
+		co_return Error::bufferTooSmall;
+
+	// Prefer to grow the mapping in place; otherwise, allocate a new range.
+	bool inPlace = false;
+	VirtualAddr newAddress = 0;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto spaceLock = frg::guard(&_snapshotMutex);
+
+		if(_isFree(address + length, newLength - length)) {
+			_allocateAt(address + length, newLength - length);
+			inPlace = true;
+			newAddress = address;
+		}else if(flags & kRemapMayMove) {
+			newAddress = _allocate(newLength, kMapPreferTop);
+		}
+	}
+	if(!newAddress)
+		co_return Error::noMemory;
+
+	// The grown mapping replaces the current one, similar to _splitMappings().
+	smarter::shared_ptr<Mapping> newMapping;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto spaceLock = frg::guard(&_snapshotMutex);
+
+		{
+			auto pagingLock = frg::guard(&mapping->pagingMutex);
+
+			mapping->state = MappingState::zombie;
+		}
+
+		newMapping = smarter::allocate_shared<Mapping>(Allocator{},
+				newLength, mapping->flags, std::move(slice), mapping->viewOffset);
+		newMapping->selfPtr = newMapping;
+		newMapping->tie(selfPtr.lock(), newAddress);
+
+		_mappings.remove(mapping.get());
+		_mappings.insert(newMapping.get());
+		_mappedSize.fetch_add(newLength - length, std::memory_order_relaxed);
+
+		assert(newMapping->state == MappingState::null);
+		newMapping->state = MappingState::active;
+
+		// We keep one reference until the detach the observer.
+		newMapping.ctr()->increment();
+		newMapping->view->addObserver(&newMapping->observer);
+
+		auto pageFlags = newMapping->compilePageFlags();
+		if(inPlace) {
+			// The existing page table entries stay valid; only the new tail needs to be mapped.
+			auto mapOutcome = _ops->mapPresentPages(address + length, newMapping->view.get(),
+					newMapping->viewOffset + length, newLength - length,
+					pageFlags, newMapping->cachingMode());
+			assert(mapOutcome);
+		}else{
+			// Move the page table entries of the present pages to the new range.
+			auto unmapOutcome = _ops->unmapPages(address, mapping->view.get(),
+					mapping->viewOffset, length);
+			assert(unmapOutcome);
+			auto mapOutcome = _ops->mapPresentPages(newAddress, newMapping->view.get(),
+					newMapping->viewOffset, newLength, pageFlags, newMapping->cachingMode());
+			assert(mapOutcome);
+
+			_freeHole(address, length);
+		}
+	}
+
+	if(!inPlace)
+		co_await _ops->shootdown(address, length);
+
+	if(newMapping->view->canEvictMemory())
+		async::detach_with_allocator(*kernelAlloc, newMapping->runEvictionLoop());
+
+	// Retire the old mapping.
+	assert(mapping->state == MappingState::zombie);
+	mapping->state = MappingState::retired;
+
+	if(mapping->view->canEvictMemory()) {
+		mapping->cancelEviction.cancel();
+		co_await mapping->evictionDoneEvent.wait();
+	}
+	mapping->view->removeObserver(&mapping->observer);
+	mapping->selfPtr.ctr()->decrement();
+
+	co_return newAddress;
+}
+
 coroutine<frg::expected<Error>>
 VirtualSpace::synchronize(VirtualAddr address, size_t size) {
-	co_await _consistencyMutex.async_lock_shared();
-	frg::shared_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
-
 	auto misalign = address & (kPageSize - 1);
 	auto alignedAddress = address & ~(kPageSize - 1);
 	auto alignedSize = (size + misalign + kPageSize - 1) & ~(kPageSize - 1);
 
+	RangeLock::Holder rangeHolder{&_rangeLock, alignedAddress, alignedSize, false};
+	co_await rangeHolder.acquire();
+
 	size_t overallProgress = 0;
 	while(overallProgress < alignedSize) {
 		smarter::shared_ptr<Mapping> mapping;
@@ -622,9 +971,29 @@ VirtualSpace::synchronize(VirtualAddr address, size_t size) {
 coroutine<frg::expected<Error>>
 VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 		smarter::shared_ptr<WorkQueue> wq) {
-	co_await _consistencyMutex.async_lock_shared();
-	frg::shared_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
+	// Speculatively handle the fault without the range lock.
+	// This fails if a writer is active or becomes active concurrently.
+	auto sequence = _mappingSequence.load(std::memory_order_acquire);
+	if(!(sequence & 1)) {
+		bool retry = false;
+		auto outcome = co_await _resolveFault(address, faultFlags, wq, &sequence, &retry);
+		// Errors can also be caused by concurrent writers (e.g., if the mapping is replaced).
+		if(!retry && (outcome
+				|| _mappingSequence.load(std::memory_order_acquire) == sequence))
+			co_return outcome;
+	}
+
+	// Lock the surrounding huge page; this covers the huge page path and fault-around.
+	RangeLock::Holder rangeHolder{&_rangeLock, address & ~(kHugePageSize - 1),
+			kHugePageSize, false};
+	co_await rangeHolder.acquire();
 
+	co_return co_await _resolveFault(address, faultFlags, std::move(wq), nullptr, nullptr);
+}
+
+coroutine<frg::expected<Error>>
+VirtualSpace::_resolveFault(VirtualAddr address, uint32_t faultFlags,
+		smarter::shared_ptr<WorkQueue> wq, const uint64_t *speculativeSequence, bool *retry) {
 	smarter::shared_ptr<Mapping> mapping;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
@@ -657,9 +1026,33 @@ VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 		co_await mapping->evictionMutex.async_lock();
 		frg::unique_lock evictionLock{frg::adopt_lock, mapping->evictionMutex};
 
+		auto irqLock = frg::guard(&irqMutex());
+		auto pagingLock = frg::guard(&mapping->pagingMutex);
+
+		// Writers only modify the mapping (and thus zap its pages) after incrementing the
+		// sequence and taking pagingMutex. If the sequence did not change yet,
+		// the page table entries that we install below are thus seen by the writer.
+		if(speculativeSequence
+				&& (_mappingSequence.load(std::memory_order_acquire) != *speculativeSequence
+					|| mapping->state != MappingState::active)) {
+			*retry = true;
+			co_return Error::spuriousOperation;
+		}
+
+		// Try to map the entire huge page around the faulting address first.
+		auto hugeAddress = address & ~(kHugePageSize - 1);
+		if(hugeAddress >= mapping->address
+				&& hugeAddress + kHugePageSize <= mapping->address + mapping->length) {
+			auto hugeOutcome = _ops->faultHugePage(hugeAddress, mapping->view.get(),
+					mapping->viewOffset + (hugeAddress - mapping->address),
+					mapping->compilePageFlags(), mapping->cachingMode());
+			if(hugeOutcome)
+				co_return {};
+		}
+
 		auto remapOutcome = _ops->faultPage(address & ~(kPageSize - 1),
 				mapping->view.get(), mapping->viewOffset + offset,
-				mapping->compilePageFlags());
+				mapping->compilePageFlags(), mapping->cachingMode());
 		if(!remapOutcome) {
 			if(remapOutcome.error() == Error::spuriousOperation) {
 				// Spurious page faults are the result of race conditions.
@@ -673,10 +1066,79 @@ VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 			}
 		}
 
+		// Fault-around: also map resident pages in an aligned window around the fault.
+		// The window grows while faults hit the window behind the previous one
+		// (i.e., for sequential access) and shrinks otherwise.
+		auto page = offset >> kPageShift;
+		auto lastPage = mapping->lastFaultPage.exchange(page, std::memory_order_relaxed);
+		auto window = mapping->faultAroundPages.load(std::memory_order_relaxed);
+		if(page > lastPage && page - lastPage <= window) {
+			window = frg::min(window * 2, maxFaultAroundPages);
+		}else{
+			window = frg::max(window / 2, size_t{1});
+		}
+		mapping->faultAroundPages.store(window, std::memory_order_relaxed);
+
+		if(window > 1) {
+			auto windowStart = (page & ~(window - 1)) << kPageShift;
+			auto windowEnd = frg::min(windowStart + (window << kPageShift), mapping->length);
+			auto aroundOutcome = _ops->mapResidentPages(mapping->address + windowStart,
+					mapping->view.get(), mapping->viewOffset + windowStart,
+					windowEnd - windowStart, mapping->compilePageFlags(),
+					mapping->cachingMode());
+			assert(aroundOutcome);
+		}
+
 		co_return {};
 	}
 }
 
+coroutine<frg::expected<Error>>
+VirtualSpace::populate(VirtualAddr address, size_t length, smarter::shared_ptr<WorkQueue> wq) {
+	assert(!(address & (kPageSize - 1)));
+	assert(!(length & (kPageSize - 1)));
+
+	RangeLock::Holder rangeHolder{&_rangeLock, address, length, false};
+	co_await rangeHolder.acquire();
+
+	smarter::shared_ptr<Mapping> mapping;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		auto space_guard = frg::guard(&_snapshotMutex);
+
+		mapping = _findMapping(address);
+	}
+	if(!mapping)
+		co_return Error::fault;
+
+	auto offset = address - mapping->address;
+	auto size = frg::min(length, mapping->length - offset);
+
+	FetchFlags fetchFlags = 0;
+	if(mapping->flags & MappingFlags::dontRequireBacking)
+		fetchFlags |= fetchDisallowBacking;
+
+	// Fetch all pages first; fetchRange() often returns more than a single page.
+	size_t progress = 0;
+	while(progress < size) {
+		auto range = FRG_CO_TRY(co_await mapping->view->fetchRange(
+				mapping->viewOffset + offset + progress, fetchFlags, wq));
+		auto chunk = (range.get<1>() + (kPageSize - 1)) & ~(kPageSize - 1);
+		progress += frg::max(chunk, static_cast<size_t>(kPageSize));
+	}
+
+	// Afterwards, install all of them in a single pass over the range.
+	// Pages that were evicted in the meantime are simply faulted in later.
+	co_await mapping->evictionMutex.async_lock();
+	frg::unique_lock evictionLock{frg::adopt_lock, mapping->evictionMutex};
+
+	auto mapOutcome = _ops->mapResidentPages(mapping->address + offset, mapping->view.get(),
+			mapping->viewOffset + offset, size, mapping->compilePageFlags(),
+			mapping->cachingMode());
+	assert(mapOutcome);
+	co_return {};
+}
+
 coroutine<frg::expected<Error, PhysicalAddr>>
 VirtualSpace::retrievePhysical(VirtualAddr address, smarter::shared_ptr<WorkQueue> wq) {
 	// We do not take _consistencyMutex here since we are only interested in a snapshot.
@@ -730,13 +1192,45 @@ smarter::shared_ptr<Mapping> VirtualSpace::_findMapping(VirtualAddr address) {
 	return nullptr;
 }
 
+frg::tuple<VirtualAddr, size_t> VirtualSpace::_affectedRange(VirtualAddr address,
+		size_t length) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_snapshotMutex);
+
+	// Only the first and the last mapping can extend beyond the range.
+	auto start = address;
+	auto end = address + length;
+	if(auto first = _findMapping(address); first)
+		start = first->address;
+	if(auto last = _findMapping(address + length - 1); last)
+		end = last->address + last->length;
+	return frg::tuple<VirtualAddr, size_t>{start, end - start};
+}
+
 VirtualAddr VirtualSpace::_allocate(size_t length, MapFlags flags) {
 	assert(length > 0);
 	assert((length % kPageSize) == 0);
 //	infoLogger() << "Allocate virtual memory area"
 //			<< ", size: 0x" << frg::hex_fmt(length) << frg::endlog;
 
-	if(_holes.get_root()->largestHole < length)
+	// Align large mappings such that they can be backed by huge pages.
+	if(length >= kHugePageSize) {
+		auto address = _allocateAligned(length, kHugePageSize, flags);
+		if(address)
+			return address;
+	}
+	return _allocateAligned(length, kPageSize, flags);
+}
+
+VirtualAddr VirtualSpace::_allocateAligned(size_t length, size_t alignment, MapFlags flags) {
+	assert(!(alignment & (alignment - 1)));
+	assert(alignment >= kPageSize);
+
+	// Holes of this size are guaranteed to contain a suitably aligned range.
+	// For page alignment, this is exactly the length.
+	auto needed = length + alignment - kPageSize;
+
+	if(_holes.get_root()->largestHole < needed)
 		return 0; // TODO: Return something else here?
 
 	auto current = _holes.get_root();
@@ -744,41 +1238,45 @@ VirtualAddr VirtualSpace::_allocate(size_t length, MapFlags flags) {
 		if(flags & kMapPreferBottom) {
 			// Try to allocate memory at the bottom of the range.
 			if(HoleTree::get_left(current)
-					&& HoleTree::get_left(current)->largestHole >= length) {
+					&& HoleTree::get_left(current)->largestHole >= needed) {
 				current = HoleTree::get_left(current);
 				continue;
 			}
 
-			if(current->length() >= length) {
+			auto address = (current->address() + alignment - 1) & ~(alignment - 1);
+			if(address + length <= current->address() + current->length()) {
 				// Note that _splitHole can deallocate the hole!
-				auto address = current->address();
-				_splitHole(current, 0, length);
+				_splitHole(current, address - current->address(), length);
 				return address;
 			}
 
-			assert(HoleTree::get_right(current));
-			assert(HoleTree::get_right(current)->largestHole >= length);
+			if(!HoleTree::get_right(current)
+					|| HoleTree::get_right(current)->largestHole < needed)
+				return 0;
 			current = HoleTree::get_right(current);
 		}else{
 			// Try to allocate memory at the top of the range.
 			assert(flags & kMapPreferTop);
 
 			if(HoleTree::get_right(current)
-					&& HoleTree::get_right(current)->largestHole >= length) {
+					&& HoleTree::get_right(current)->largestHole >= needed) {
 				current = HoleTree::get_right(current);
 				continue;
 			}
 
 			if(current->length() >= length) {
-				// Note that _splitHole can deallocate the hole!
-				auto offset = current->length() - length;
-				auto address = current->address() + offset;
-				_splitHole(current, offset, length);
-				return address;
+				auto address = (current->address() + current->length() - length)
+						& ~(alignment - 1);
+				if(address >= current->address()) {
+					// Note that _splitHole can deallocate the hole!
+					_splitHole(current, address - current->address(), length);
+					return address;
+				}
 			}
 
-			assert(HoleTree::get_left(current));
-			assert(HoleTree::get_left(current)->largestHole >= length);
+			if(!HoleTree::get_left(current)
+					|| HoleTree::get_left(current)->largestHole < needed)
+				return 0;
 			current = HoleTree::get_left(current);
 		}
 	}
@@ -828,15 +1326,93 @@ void VirtualSpace::_splitHole(Hole *hole, VirtualAddr offset, size_t length) {
 	frg::destruct(*kernelAlloc, hole);
 }
 
+void VirtualSpace::_freeHole(VirtualAddr address, size_t length) {
+	// Find the holes that preceede/succeede the range.
+	Hole *pre = nullptr;
+	Hole *succ = nullptr;
+
+	auto current = _holes.get_root();
+	while(current) {
+		if(address < current->address()) {
+			if(HoleTree::get_left(current)) {
+				current = HoleTree::get_left(current);
+			}else{
+				pre = HoleTree::predecessor(current);
+				succ = current;
+				break;
+			}
+		}else{
+			assert(address >= current->address() + current->length());
+			if(HoleTree::get_right(current)) {
+				current = HoleTree::get_right(current);
+			}else{
+				pre = current;
+				succ = HoleTree::successor(current);
+				break;
+			}
+		}
+	}
+
+	// Try to merge the new hole and the existing ones.
+	if(pre && pre->address() + pre->length() == address
+			&& succ && address + length == succ->address()) {
+		auto hole = frg::construct<Hole>(*kernelAlloc, pre->address(),
+				pre->length() + length + succ->length());
+
+		_holes.remove(pre);
+		_holes.remove(succ);
+		_holes.insert(hole);
+		frg::destruct(*kernelAlloc, pre);
+		frg::destruct(*kernelAlloc, succ);
+	}else if(pre && pre->address() + pre->length() == address) {
+		auto hole = frg::construct<Hole>(*kernelAlloc,
+				pre->address(), pre->length() + length);
+
+		_holes.remove(pre);
+		_holes.insert(hole);
+		frg::destruct(*kernelAlloc, pre);
+	}else if(succ && address + length == succ->address()) {
+		auto hole = frg::construct<Hole>(*kernelAlloc,
+				address, length + succ->length());
+
+		_holes.remove(succ);
+		_holes.insert(hole);
+		frg::destruct(*kernelAlloc, succ);
+	}else{
+		auto hole = frg::construct<Hole>(*kernelAlloc, address, length);
+
+		_holes.insert(hole);
+	}
+}
+
+bool VirtualSpace::_isFree(VirtualAddr address, size_t length) {
+	auto current = _holes.get_root();
+	while(current) {
+		if(address < current->address()) {
+			current = HoleTree::get_left(current);
+		}else if(address >= current->address() + current->length()) {
+			current = HoleTree::get_right(current);
+		}else{
+			return address + length <= current->address() + current->length();
+		}
+	}
+	return false;
+}
+
 coroutine<frg::tuple<Mapping *, Mapping *>> VirtualSpace::_splitMappings(uintptr_t address, size_t size) {
-	// _consistencyMutex is held here by the caller
+	// _consistencyMutex and an exclusive range lock on _affectedRange() are held here by the caller
 
-	auto left = _mappings.get_root();
-	while (left) {
-		if (auto next = MappingTree::get_left(left))
-			left = next;
-		else
-			break;
+	// Mappings do not overlap, hence their ends are ordered like their addresses.
+	// Find the first mapping that ends after address; all earlier ones are unaffected.
+	Mapping *left = nullptr;
+	auto current = _mappings.get_root();
+	while (current) {
+		if ((current->address + current->length) > address) {
+			left = current;
+			current = MappingTree::get_left(current);
+		} else {
+			current = MappingTree::get_right(current);
+		}
 	}
 
 	Mapping *start = nullptr, *end = nullptr;
@@ -870,8 +1446,13 @@ coroutine<frg::tuple<Mapping *, Mapping *>> VirtualSpace::_splitMappings(uintptr
 			smarter::shared_ptr<Mapping> leftMapping = nullptr;
 			smarter::shared_ptr<Mapping> rightMapping = nullptr;
 
-			assert(mapping->state == MappingState::active);
-			mapping->state = MappingState::zombie;
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto pagingLock = frg::guard(&mapping->pagingMutex);
+
+				assert(mapping->state == MappingState::active);
+				mapping->state = MappingState::zombie;
+			}
 
 			{
 				auto leftSize = at - mapping->address;
@@ -958,15 +1539,27 @@ coroutine<bool> VirtualSpace::_unmapMappings(VirtualAddr address, size_t length,
 		if (mapping->address >= address && (mapping->address + mapping->length) <= (address + length)) {
 			needsShootdown = true;
 
-			assert(mapping->state == MappingState::active);
-			mapping->state = MappingState::zombie;
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto pagingLock = frg::guard(&mapping->pagingMutex);
+
+				assert(mapping->state == MappingState::active);
+				mapping->state = MappingState::zombie;
+			}
 
 			// Mark pages as dirty and unmap without holding a lock.
 			auto unmapOutcome = _ops->unmapPages(mapping->address, mapping->view.get(),
 						mapping->viewOffset, mapping->length);
 			assert(unmapOutcome);
 
-			_mappings.remove(mapping.get());
+			// Page faults in other ranges can look up _mappings concurrently.
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&_snapshotMutex);
+
+				_mappings.remove(mapping.get());
+				_mappedSize.fetch_sub(mapping->length, std::memory_order_relaxed);
+			}
 
 			assert(mapping->state == MappingState::zombie);
 			mapping->state = MappingState::retired;
@@ -979,64 +1572,11 @@ coroutine<bool> VirtualSpace::_unmapMappings(VirtualAddr address, size_t length,
 			mapping->selfPtr.ctr()->decrement();
 
 			// Finally, coalesce the hole in the hole tree.
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&_snapshotMutex);
 
-			// Find the holes that preceede/succeede mapping.
-			Hole *pre;
-			Hole *succ;
-
-			auto current = _holes.get_root();
-			while(true) {
-				assert(current);
-				if(mapping->address < current->address()) {
-					if(HoleTree::get_left(current)) {
-						current = HoleTree::get_left(current);
-					}else{
-						pre = HoleTree::predecessor(current);
-						succ = current;
-						break;
-					}
-				}else{
-					assert(mapping->address >= current->address() + current->length());
-					if(HoleTree::get_right(current)) {
-						current = HoleTree::get_right(current);
-					}else{
-						pre = current;
-						succ = HoleTree::successor(current);
-						break;
-					}
-				}
-			}
-
-			// Try to merge the new hole and the existing ones.
-			if(pre && pre->address() + pre->length() == mapping->address
-					&& succ && mapping->address + mapping->length == succ->address()) {
-				auto hole = frg::construct<Hole>(*kernelAlloc, pre->address(),
-						pre->length() + mapping->length + succ->length());
-
-				_holes.remove(pre);
-				_holes.remove(succ);
-				_holes.insert(hole);
-				frg::destruct(*kernelAlloc, pre);
-				frg::destruct(*kernelAlloc, succ);
-			}else if(pre && pre->address() + pre->length() == mapping->address) {
-				auto hole = frg::construct<Hole>(*kernelAlloc,
-						pre->address(), pre->length() + mapping->length);
-
-				_holes.remove(pre);
-				_holes.insert(hole);
-				frg::destruct(*kernelAlloc, pre);
-			}else if(succ && mapping->address + mapping->length == succ->address()) {
-				auto hole = frg::construct<Hole>(*kernelAlloc,
-						mapping->address, mapping->length + succ->length());
-
-				_holes.remove(succ);
-				_holes.insert(hole);
-				frg::destruct(*kernelAlloc, succ);
-			}else{
-				auto hole = frg::construct<Hole>(*kernelAlloc,
-						mapping->address, mapping->length);
-
-				_holes.insert(hole);
+				_freeHole(mapping->address, mapping->length);
 			}
 		}
 	}
@@ -1044,6 +1584,31 @@ coroutine<bool> VirtualSpace::_unmapMappings(VirtualAddr address, size_t length,
 	co_return needsShootdown;
 }
 
+namespace {
+	// Returns the size of the chunk at offsetInMapping that can be copied through a single
+	// PageAccessor, up to limit bytes. physical is the (present) page at offsetInMapping.
+	// The chunk extends over following pages as long as they are present and physically
+	// contiguous (the physical window maps them contiguously as well); this saves
+	// a fetchRange() and a reschedule per page for large contiguous mappings.
+	// The caller must have locked the range.
+	size_t contiguousChunk(Mapping *mapping, uintptr_t offsetInMapping,
+			PhysicalAddr physical, size_t limit) {
+		auto misalign = offsetInMapping & (kPageSize - 1);
+		auto chunk = frg::min(limit, kPageSize - misalign);
+		while(chunk < limit) {
+			auto nextOffset = offsetInMapping + chunk;
+			assert(!(nextOffset & (kPageSize - 1)));
+			if(nextOffset >= mapping->length)
+				break;
+			auto [nextPhysical, nextMode] = mapping->resolveRange(nextOffset);
+			if(nextPhysical != physical + misalign + chunk)
+				break;
+			chunk += frg::min(limit - chunk, kPageSize);
+		}
+		return chunk;
+	}
+}
+
 coroutine<size_t> VirtualSpace::readPartialSpace(uintptr_t address,
 		void *buffer, size_t size, smarter::shared_ptr<WorkQueue> wq) {
 	// We do not take _consistencyMutex here since we are only interested in a snapshot.
@@ -1055,7 +1620,7 @@ coroutine<size_t> VirtualSpace::readPartialSpace(uintptr_t address,
 			auto irqLock = frg::guard(&irqMutex());
 			auto spaceGuard = frg::guard(&_snapshotMutex);
 
-			mapping = _findMapping(address);
+			mapping = _findMapping(address + progress);
 		}
 		if(!mapping)
 			co_return progress;
@@ -1101,9 +1666,9 @@ coroutine<size_t> VirtualSpace::readPartialSpace(uintptr_t address,
 
 			PageAccessor accessor{physical};
 			auto misalign = offsetInMapping & (kPageSize - 1);
-			auto chunk = frg::min(size - progress, kPageSize - misalign);
+			auto chunk = contiguousChunk(mapping.get(), offsetInMapping, physical, size - progress);
 			assert(chunk); // Otherwise, we would have finished already.
-			memcpy(reinterpret_cast<std::byte *>(buffer) + progress,
+			bulkCopy(reinterpret_cast<std::byte *>(buffer) + progress,
 					reinterpret_cast<const std::byte *>(accessor.get()) + misalign,
 					chunk);
 			progress += chunk;
@@ -1129,7 +1694,7 @@ coroutine<size_t> VirtualSpace::writePartialSpace(uintptr_t address,
 			auto irqLock = frg::guard(&irqMutex());
 			auto spaceGuard = frg::guard(&_snapshotMutex);
 
-			mapping = _findMapping(address);
+			mapping = _findMapping(address + progress);
 		}
 		if(!mapping)
 			co_return progress;
@@ -1175,9 +1740,9 @@ coroutine<size_t> VirtualSpace::writePartialSpace(uintptr_t address,
 
 			PageAccessor accessor{physical};
 			auto misalign = offsetInMapping & (kPageSize - 1);
-			auto chunk = frg::min(size - progress, kPageSize - misalign);
+			auto chunk = contiguousChunk(mapping.get(), offsetInMapping, physical, size - progress);
 			assert(chunk); // Otherwise, we would have finished already.
-			memcpy(reinterpret_cast<std::byte *>(accessor.get()) + misalign,
+			bulkCopy(reinterpret_cast<std::byte *>(accessor.get()) + misalign,
 					reinterpret_cast<const std::byte *>(buffer) + progress,
 					chunk);
 			progress += chunk;
@@ -1192,6 +1757,83 @@ coroutine<size_t> VirtualSpace::writePartialSpace(uintptr_t address,
 	co_return progress;
 }
 
+coroutine<VirtualSpace::PartialTransfer> VirtualSpace::transferPartialSpace(uintptr_t address,
+		VirtualSpace *destSpace, uintptr_t destAddress, size_t size,
+		smarter::shared_ptr<WorkQueue> wq) {
+	// We do not take _consistencyMutex here since we are only interested in a snapshot.
+
+	size_t progress = 0;
+	while(progress < size) {
+		smarter::shared_ptr<Mapping> mapping;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto spaceGuard = frg::guard(&_snapshotMutex);
+
+			mapping = _findMapping(address + progress);
+		}
+		if(!mapping)
+			co_return PartialTransfer{progress, true};
+
+		auto startInMapping = address + progress - mapping->address;
+		auto limitInMapping = frg::min(size - progress, mapping->length - startInMapping);
+		// Otherwise, _findMapping() would have returned garbage.
+		assert(limitInMapping);
+
+		auto lockOutcome = co_await mapping->lockVirtualRange(startInMapping, limitInMapping, wq);
+		if(!lockOutcome)
+			co_return PartialTransfer{progress, true};
+
+		FetchFlags fetchFlags = 0;
+		if(mapping->flags & MappingFlags::dontRequireBacking)
+			fetchFlags |= fetchDisallowBacking;
+
+		// This loop iterates until we hit the end of the mapping.
+		bool success = true;
+		bool sourceFault = false;
+		while(progress < size) {
+			auto offsetInMapping = address + progress - mapping->address;
+			if(offsetInMapping == mapping->length)
+				break;
+			assert(offsetInMapping < mapping->length);
+
+			auto touchOutcome = co_await mapping->view->fetchRange(
+					(mapping->viewOffset + offsetInMapping) & ~(kPageSize - 1), fetchFlags, wq);
+			if(!touchOutcome) {
+				success = false;
+				sourceFault = true;
+				break;
+			}
+
+			auto [physical, cacheMode] = mapping->resolveRange(
+					offsetInMapping & ~(kPageSize - 1));
+			// Since we have locked the MemoryView, the physical address remains valid here.
+			assert(physical != PhysicalAddr(-1));
+
+			// Write the source page directly into the destination space.
+			// The destination space pins its own pages while copying.
+			PageAccessor accessor{physical};
+			auto misalign = offsetInMapping & (kPageSize - 1);
+			auto chunk = contiguousChunk(mapping.get(), offsetInMapping, physical, size - progress);
+			assert(chunk); // Otherwise, we would have finished already.
+			auto written = co_await destSpace->writePartialSpace(destAddress + progress,
+					reinterpret_cast<const std::byte *>(accessor.get()) + misalign,
+					chunk, wq);
+			progress += written;
+			if(written != chunk) {
+				success = false;
+				break;
+			}
+		}
+
+		mapping->unlockVirtualRange(startInMapping, limitInMapping);
+
+		if(!success)
+			co_return PartialTransfer{progress, sourceFault};
+	}
+
+	co_return PartialTransfer{progress, false};
+}
+
 // --------------------------------------------------------
 // AddressSpace
 // --------------------------------------------------------
@@ -1206,8 +1848,93 @@ AddressSpace::AddressSpace()
 
 AddressSpace::~AddressSpace() { }
 
+// --------------------------------------------------------
+// AddressSpaceReaper
+// --------------------------------------------------------
+
+namespace {
+	THOR_DEFINE_GAUGE_METRIC(numPendingTeardowns, "thor.address-space.pending-teardowns",
+			"Address spaces without handles that are not torn down yet");
+}
+
+// The last handle to an address space is usually dropped by the server that
+// handles the exit of the owning process (e.g., POSIX). Unmapping a large space
+// takes a long time, hence dispose() only queues the space; a fiber unmaps the
+// spaces (one at a time) and frees their page tables once they are unreferenced.
+struct AddressSpaceReaper {
+	void post(AddressSpace *space) {
+		FiberBlocker *blocker;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&mutex_);
+
+			space->reaperSelf_ = space->selfPtr.lock();
+			queue_.push_back(space);
+			blocker = std::exchange(blocker_, nullptr);
+		}
+		numPendingTeardowns.add(1);
+		if(blocker)
+			KernelFiber::unblockOther(blocker);
+	}
+
+	void run() {
+		while(true) {
+			FiberBlocker blocker;
+			blocker.setup();
+
+			AddressSpace *space = nullptr;
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&mutex_);
+
+				if(queue_.empty()) {
+					blocker_ = &blocker;
+				}else{
+					space = queue_.pop_front();
+				}
+			}
+			if(!space) {
+				KernelFiber::blockCurrent(&blocker);
+				continue;
+			}
+
+			auto self = std::move(space->reaperSelf_);
+			KernelFiber::asyncBlockCurrent(self->retire());
+			numPendingTeardowns.sub(1);
+		}
+	}
+
+private:
+	frg::ticket_spinlock mutex_;
+	frg::intrusive_list<
+		AddressSpace,
+		frg::locate_member<
+			AddressSpace,
+			frg::default_list_hook<AddressSpace>,
+			&AddressSpace::reaperHook_
+		>
+	> queue_;
+	// Non-null while the fiber waits for new spaces.
+	FiberBlocker *blocker_ = nullptr;
+};
+
+namespace {
+	constinit frg::manual_box<AddressSpaceReaper> globalReaper;
+}
+
+// Address spaces are only created (and disposed) once fibers are available.
+static initgraph::Task startAddressSpaceReaper{&globalInitEngine, "generic.start-address-space-reaper",
+	initgraph::Requires{getFibersAvailableStage()},
+	[] {
+		globalReaper.initialize();
+		KernelFiber::run([] {
+			globalReaper->run();
+		});
+	}
+};
+
 void AddressSpace::dispose(BindableHandle) {
-	retire();
+	globalReaper->post(this);
 }
 
 // --------------------------------------------------------
@@ -0,0 +1,105 @@
+#include <eir/interface.hpp>
+#include <thor-internal/boot-profile.hpp>
+#include <thor-internal/cpu-data.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/ostrace.hpp>
+
+namespace thor {
+
+extern "C" EirInfo *thorBootInfoPtr;
+
+namespace {
+	constexpr int maxNameLength = 48;
+
+	struct BootPhase {
+		BootPhaseKind kind;
+		char name[maxNameLength];
+		uint64_t begin;
+		uint64_t end;
+	};
+
+	// Protects the data structures below.
+	constinit frg::ticket_spinlock profileMutex;
+
+	constinit BootPhase bootPhases[512]{};
+	constinit size_t numBootPhases = 0;
+	constinit size_t numDroppedPhases = 0;
+	// Set by emitBootProfile(); afterwards, bootPhases does not change anymore.
+	constinit bool profileEmitted = false;
+
+	const char *kindPrefix(BootPhaseKind kind) {
+		switch(kind) {
+		case BootPhaseKind::eir: return "boot.eir:";
+		case BootPhaseKind::initgraphTask: return "boot.task:";
+		case BootPhaseKind::initgraphStage: return "boot.stage:";
+		case BootPhaseKind::server: return "boot.server:";
+		}
+		__builtin_unreachable();
+	}
+
+	void emitPhase(BootPhaseKind kind, frg::string_view name, uint64_t begin, uint64_t end) {
+		if(!osTraceInUse.load(std::memory_order_relaxed))
+			return;
+
+		static OsTraceItemId beginItem = announceOsTraceItem("boot.begin");
+		static OsTraceItemId endItem = announceOsTraceItem("boot.end");
+
+		frg::string<KernelAlloc> eventName{*kernelAlloc, kindPrefix(kind)};
+		eventName += name;
+		OsTraceEvent event{announceOsTraceEvent(eventName)};
+		event.withCounter(beginItem, rawTimestampCounterToNanos(begin));
+		event.withCounter(endItem, rawTimestampCounterToNanos(end));
+		event.emit();
+	}
+}
+
+void recordBootPhase(BootPhaseKind kind, frg::string_view name, uint64_t begin, uint64_t end) {
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&profileMutex);
+
+		if(!profileEmitted) {
+			if(numBootPhases == sizeof(bootPhases) / sizeof(*bootPhases)) {
+				numDroppedPhases++;
+				return;
+			}
+
+			auto phase = &bootPhases[numBootPhases++];
+			auto length = frg::min(name.size(), size_t{maxNameLength - 1});
+			phase->kind = kind;
+			memcpy(phase->name, name.data(), length);
+			phase->name[length] = 0;
+			phase->begin = begin;
+			phase->end = end;
+			return;
+		}
+	}
+
+	emitPhase(kind, name, begin, end);
+}
+
+void emitBootProfile() {
+	size_t n;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&profileMutex);
+
+		assert(!profileEmitted);
+		profileEmitted = true;
+		n = numBootPhases;
+	}
+
+	if(numDroppedPhases)
+		infoLogger() << "thor: Boot profile dropped "
+				<< numDroppedPhases << " phases" << frg::endlog;
+
+	// eir uses the same timestamp counter, hence its phases can be emitted as-is.
+	auto eirPhases = reinterpret_cast<EirBootPhase *>(thorBootInfoPtr->bootPhases);
+	for(size_t i = 0; i < thorBootInfoPtr->numBootPhases; i++)
+		emitPhase(BootPhaseKind::eir, eirPhases[i].name, eirPhases[i].begin, eirPhases[i].end);
+
+	for(size_t i = 0; i < n; i++)
+		emitPhase(bootPhases[i].kind, bootPhases[i].name, bootPhases[i].begin, bootPhases[i].end);
+}
+
+} // namespace thor
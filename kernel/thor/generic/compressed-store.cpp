@@ -0,0 +1,262 @@
+#include <assert.h>
+#include <string.h>
+#include <atomic>
+
+#include <thor-internal/compressed-store.hpp>
+#include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/physical.hpp>
+
+namespace thor {
+
+namespace {
+	// Pages are only stored if compression saves at least a quarter of the page.
+	constexpr size_t maxCompressedSize = kPageSize * 3 / 4;
+
+	// The pool may take up this fraction (1 / n) of physical memory.
+	constexpr size_t poolFraction = 4;
+
+	// Parameters of the LZ4 block format.
+	constexpr size_t minMatch = 4;
+	// The last match must start at least this many bytes before the end of the input.
+	constexpr size_t matchLimit = 12;
+	// The last bytes of the input are always emitted as literals.
+	constexpr size_t lastLiterals = 5;
+	constexpr size_t maxOffset = 0xFFFF;
+
+	constexpr int hashBits = 12;
+
+	struct Workspace {
+		// Maps hashes of 4-byte sequences to their last position in the input.
+		uint16_t table[1 << hashBits];
+		uint8_t buffer[maxCompressedSize];
+	};
+
+	std::atomic<size_t> numStoredPages{0};
+	std::atomic<size_t> numZeroPages{0};
+	std::atomic<size_t> numCompressedBytes{0};
+	std::atomic<uint64_t> numCompressions{0};
+	std::atomic<uint64_t> numDecompressions{0};
+	std::atomic<uint64_t> numRejections{0};
+
+	size_t poolLimit() {
+		return physicalAllocator->numTotalPages() * kPageSize / poolFraction;
+	}
+
+	uint32_t read32(const uint8_t *p) {
+		uint32_t v;
+		memcpy(&v, p, sizeof(uint32_t));
+		return v;
+	}
+
+	uint32_t hashOf(uint32_t sequence) {
+		return (sequence * 2654435761U) >> (32 - hashBits);
+	}
+
+	bool isZeroFilled(const void *page) {
+		auto words = reinterpret_cast<const uint64_t *>(page);
+		for(size_t i = 0; i < kPageSize / sizeof(uint64_t); i++)
+			if(words[i])
+				return false;
+		return true;
+	}
+
+	// Writes the LZ4 encoding of a length that does not fit into the token.
+	bool emitLength(uint8_t *&op, uint8_t *end, size_t length) {
+		while(length >= 255) {
+			if(op == end)
+				return false;
+			*op++ = 255;
+			length -= 255;
+		}
+		if(op == end)
+			return false;
+		*op++ = length;
+		return true;
+	}
+
+	// Emits a sequence of literals that is followed by a match (unless matchLength is zero).
+	bool emitSequence(uint8_t *&op, uint8_t *end, const uint8_t *literals, size_t numLiterals,
+			size_t offset, size_t matchLength) {
+		if(op == end)
+			return false;
+		auto token = op++;
+		*token = (numLiterals < 15 ? numLiterals : 15) << 4;
+		if(numLiterals >= 15 && !emitLength(op, end, numLiterals - 15))
+			return false;
+
+		if(static_cast<size_t>(end - op) < numLiterals)
+			return false;
+		memcpy(op, literals, numLiterals);
+		op += numLiterals;
+
+		if(!matchLength)
+			return true;
+
+		if(end - op < 2)
+			return false;
+		*op++ = offset & 0xFF;
+		*op++ = offset >> 8;
+
+		auto extra = matchLength - minMatch;
+		*token |= extra < 15 ? extra : 15;
+		if(extra >= 15 && !emitLength(op, end, extra - 15))
+			return false;
+		return true;
+	}
+
+	// Greedy LZ4 compressor for a single page. Returns zero if the output does not fit.
+	size_t compressLz4(const uint8_t *src, uint8_t *dst, size_t capacity, uint16_t *table) {
+		memset(table, 0, sizeof(uint16_t) << hashBits);
+
+		uint8_t *op = dst;
+		uint8_t *end = dst + capacity;
+		size_t anchor = 0;
+		size_t ip = 0;
+		while(ip + matchLimit < kPageSize) {
+			auto sequence = read32(src + ip);
+			auto h = hashOf(sequence);
+			size_t candidate = table[h];
+			table[h] = ip;
+
+			if(candidate >= ip || ip - candidate > maxOffset
+					|| read32(src + candidate) != sequence) {
+				ip++;
+				continue;
+			}
+
+			size_t length = minMatch;
+			while(ip + length < kPageSize - lastLiterals
+					&& src[candidate + length] == src[ip + length])
+				length++;
+
+			if(!emitSequence(op, end, src + anchor, ip - anchor, ip - candidate, length))
+				return 0;
+			ip += length;
+			anchor = ip;
+		}
+
+		if(!emitSequence(op, end, src + anchor, kPageSize - anchor, 0, 0))
+			return 0;
+		return op - dst;
+	}
+
+	size_t decodeLength(const uint8_t *&ip) {
+		size_t length = 0;
+		uint8_t b;
+		do {
+			b = *ip++;
+			length += b;
+		} while(b == 255);
+		return length;
+	}
+
+	// Our own compressor produced the input, hence it is trusted; we only assert
+	// that the output matches the page size.
+	void decompressLz4(const uint8_t *src, size_t size, uint8_t *dst) {
+		const uint8_t *ip = src;
+		const uint8_t *end = src + size;
+		uint8_t *op = dst;
+		while(true) {
+			auto token = *ip++;
+
+			size_t numLiterals = token >> 4;
+			if(numLiterals == 15)
+				numLiterals += decodeLength(ip);
+			assert(op + numLiterals <= dst + kPageSize);
+			memcpy(op, ip, numLiterals);
+			ip += numLiterals;
+			op += numLiterals;
+
+			if(ip == end)
+				break;
+
+			size_t offset = ip[0] | (size_t(ip[1]) << 8);
+			ip += 2;
+			size_t length = token & 15;
+			if(length == 15)
+				length += decodeLength(ip);
+			length += minMatch;
+
+			// Matches can overlap the output that they produce; copy byte-wise.
+			assert(offset && op - dst >= static_cast<ptrdiff_t>(offset));
+			assert(op + length <= dst + kPageSize);
+			auto match = op - offset;
+			for(size_t i = 0; i < length; i++)
+				op[i] = match[i];
+			op += length;
+		}
+		assert(op == dst + kPageSize);
+	}
+}
+
+CompressedPage *compressPage(const void *page) {
+	if(isZeroFilled(page)) {
+		auto compressed = static_cast<CompressedPage *>(
+				kernelAlloc->allocate(sizeof(CompressedPage)));
+		compressed->size = 0;
+		numStoredPages.fetch_add(1, std::memory_order_relaxed);
+		numZeroPages.fetch_add(1, std::memory_order_relaxed);
+		numCompressions.fetch_add(1, std::memory_order_relaxed);
+		return compressed;
+	}
+
+	if(numCompressedBytes.load(std::memory_order_relaxed) + maxCompressedSize > poolLimit()) {
+		numRejections.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	auto workspace = static_cast<Workspace *>(kernelAlloc->allocate(sizeof(Workspace)));
+	auto size = compressLz4(static_cast<const uint8_t *>(page), workspace->buffer,
+			maxCompressedSize, workspace->table);
+	if(!size) {
+		kernelAlloc->deallocate(workspace, sizeof(Workspace));
+		numRejections.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	auto compressed = static_cast<CompressedPage *>(
+			kernelAlloc->allocate(sizeof(CompressedPage) + size));
+	compressed->size = size;
+	memcpy(compressed->data, workspace->buffer, size);
+	kernelAlloc->deallocate(workspace, sizeof(Workspace));
+
+	numStoredPages.fetch_add(1, std::memory_order_relaxed);
+	numCompressedBytes.fetch_add(size, std::memory_order_relaxed);
+	numCompressions.fetch_add(1, std::memory_order_relaxed);
+	return compressed;
+}
+
+void decompressPage(CompressedPage *compressed, void *page) {
+	if(!compressed->size) {
+		memset(page, 0, kPageSize);
+	}else{
+		decompressLz4(compressed->data, compressed->size, static_cast<uint8_t *>(page));
+	}
+	numDecompressions.fetch_add(1, std::memory_order_relaxed);
+	discardCompressedPage(compressed);
+}
+
+void discardCompressedPage(CompressedPage *compressed) {
+	size_t size = compressed->size;
+	numStoredPages.fetch_sub(1, std::memory_order_relaxed);
+	if(!size) {
+		numZeroPages.fetch_sub(1, std::memory_order_relaxed);
+	}else{
+		numCompressedBytes.fetch_sub(size, std::memory_order_relaxed);
+	}
+	kernelAlloc->deallocate(compressed, sizeof(CompressedPage) + size);
+}
+
+CompressedStoreStats getCompressedStoreStats() {
+	return {
+		.storedPages = numStoredPages.load(std::memory_order_relaxed),
+		.zeroPages = numZeroPages.load(std::memory_order_relaxed),
+		.compressedBytes = numCompressedBytes.load(std::memory_order_relaxed),
+		.poolLimit = poolLimit(),
+		.compressions = numCompressions.load(std::memory_order_relaxed),
+		.decompressions = numDecompressions.load(std::memory_order_relaxed),
+		.rejections = numRejections.load(std::memory_order_relaxed)
+	};
+}
+
+} // namespace thor
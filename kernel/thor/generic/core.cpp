@@ -226,21 +226,182 @@ constinit frg::manual_box<PhysicalChunkAllocator> physicalAllocator = {};
 
 constinit frg::manual_box<KernelVirtualAlloc> kernelVirtualAlloc = {};
 
-constinit frg::manual_box<
-	frg::slab_pool<
-		KernelVirtualAlloc,
-		IrqSpinlock
-	>
-> kernelHeap = {};
+constinit frg::manual_box<KernelSlabPool> kernelHeap = {};
 
 constinit frg::manual_box<KernelAlloc> kernelAlloc = {};
 
+// --------------------------------------------------------
+// Per-CPU heap magazines
+// --------------------------------------------------------
+
+namespace {
+
+// KASAN needs to see every free to poison the object; allocation tracing wants
+// to see the real lifetime of objects. Bypass the magazine layer in both cases.
+#if defined(THOR_KASAN) || defined(KERNEL_LOG_ALLOCATIONS)
+constexpr bool useHeapMagazines = false;
+#else
+constexpr bool useHeapMagazines = true;
+#endif
+
+struct HeapDepot {
+	IrqSpinlock mutex;
+	HeapMagazine *full[HeapCache::numClasses] = {};
+	HeapMagazine *empty[HeapCache::numClasses] = {};
+};
+
+constinit HeapDepot heapDepot;
+
+// Returns the size class index or -1 if the size is not cached.
+int heapSizeClass(size_t size) {
+	if(!size || size > (size_t{1} << HeapCache::maxShift))
+		return -1;
+	int shift = HeapCache::minShift;
+	while(size > (size_t{1} << shift))
+		++shift;
+	return shift - HeapCache::minShift;
+}
+
+HeapMagazine *popMagazine(HeapMagazine *&list) {
+	auto magazine = list;
+	if(magazine)
+		list = magazine->next;
+	return magazine;
+}
+
+void pushMagazine(HeapMagazine *&list, HeapMagazine *magazine) {
+	magazine->next = list;
+	list = magazine;
+}
+
+} // anonymous namespace
+
+void *KernelAlloc::allocate(size_t size) {
+	if(heapGuardSampleRate) {
+		if(auto pointer = sampleGuardedAllocation(size); pointer)
+			return pointer;
+	}
+
+	int idx = heapSizeClass(size);
+	if(!useHeapMagazines || idx < 0)
+		return pool_->allocate(size);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto cache = &getCpuData()->heapCache;
+	auto sc = &cache->classes[idx];
+
+	if(!sc->loaded || !sc->loaded->rounds) {
+		if(sc->previous && sc->previous->rounds) {
+			std::swap(sc->loaded, sc->previous);
+		}else{
+			// Trade an empty magazine for a full one from the depot.
+			HeapMagazine *full;
+			{
+				auto lock = frg::guard(&heapDepot.mutex);
+				full = popMagazine(heapDepot.full[idx]);
+				if(full && sc->previous)
+					pushMagazine(heapDepot.empty[idx], sc->previous);
+			}
+			if(!full) {
+				cache->stats.allocMisses++;
+				// Always allocate the full class size such that the object
+				// can be recycled for any request of this class.
+				return pool_->allocate(size_t{1} << (idx + HeapCache::minShift));
+			}
+			sc->previous = sc->loaded;
+			sc->loaded = full;
+		}
+	}
+
+	cache->stats.allocHits++;
+	return sc->loaded->objects[--sc->loaded->rounds];
+}
+
+void KernelAlloc::deallocate(void *pointer, size_t size) {
+	if(isGuardedHeapPointer(pointer)) {
+		freeGuardedObject(pointer);
+		return;
+	}
+
+	int idx = heapSizeClass(size);
+	if(!useHeapMagazines || idx < 0 || !pointer) {
+		pool_->free(pointer);
+		return;
+	}
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto cache = &getCpuData()->heapCache;
+	auto sc = &cache->classes[idx];
+
+	if(!sc->loaded || sc->loaded->rounds == HeapMagazine::capacity) {
+		if(sc->previous && sc->previous->rounds < HeapMagazine::capacity) {
+			std::swap(sc->loaded, sc->previous);
+		}else{
+			// Trade a full magazine for an empty one from the depot.
+			HeapMagazine *empty;
+			{
+				auto lock = frg::guard(&heapDepot.mutex);
+				empty = popMagazine(heapDepot.empty[idx]);
+			}
+			if(!empty) {
+				auto memory = pool_->allocate(sizeof(HeapMagazine));
+				if(!memory) {
+					cache->stats.freeMisses++;
+					pool_->free(pointer);
+					return;
+				}
+				empty = new (memory) HeapMagazine{};
+			}
+			if(sc->previous) {
+				auto lock = frg::guard(&heapDepot.mutex);
+				pushMagazine(heapDepot.full[idx], sc->previous);
+			}
+			sc->previous = sc->loaded;
+			sc->loaded = empty;
+		}
+	}
+
+	cache->stats.freeHits++;
+	sc->loaded->objects[sc->loaded->rounds++] = pointer;
+}
+
+HeapCacheStats getHeapCacheStats(int cpu) {
+	// The counters are only written by their own CPU; a torn snapshot is acceptable here.
+	return getCpuData(cpu)->heapCache.stats;
+}
+
 // --------------------------------------------------------
 // CpuData
 // --------------------------------------------------------
 
 ExecutorContext::ExecutorContext() { }
 
+void *allocateExecutorState(size_t size) {
+	{
+		auto irqLock = frg::guard(&irqMutex());
+
+		auto cache = &getCpuData()->executorStateCache;
+		if(cache->numStates && cache->size == size)
+			return cache->states[--cache->numStates];
+	}
+	return kernelAlloc->allocate(size);
+}
+
+void freeExecutorState(void *pointer, size_t size) {
+	{
+		auto irqLock = frg::guard(&irqMutex());
+
+		auto cache = &getCpuData()->executorStateCache;
+		if(!cache->numStates)
+			cache->size = size;
+		if(cache->size == size && cache->numStates < ExecutorStateCache::maxStates) {
+			cache->states[cache->numStates++] = pointer;
+			return;
+		}
+	}
+	kernelAlloc->deallocate(pointer, size);
+}
+
 CpuData::CpuData()
 : scheduler{this}, activeFiber{nullptr}, heartbeat{0} { }
 
@@ -1,5 +1,9 @@
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/debug.hpp>
+#include <thor-internal/fiber.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/metrics.hpp>
+#include <thor-internal/timer.hpp>
 #include <thor-internal/arch/stack.hpp>
 
 namespace thor {
@@ -142,6 +146,112 @@ namespace {
 	};
 
 	constinit LogProcessor logProcessor;
+
+	THOR_DEFINE_COUNTER_METRIC(droppedLogMessages, "thor.log.dropped",
+			"Log messages that were dropped because the log drain fell behind");
+
+	// Set while the log drain fiber runs. Otherwise, logging is synchronous.
+	constinit std::atomic<bool> asyncLogging{false};
+	constinit std::atomic<uint64_t> globalLogSequence{0};
+
+	// The drain polls the rings; it cannot be woken up by the producers as
+	// messages can be emitted from any context (e.g., with scheduler locks held).
+	constexpr uint64_t minDrainInterval = 1'000'000;
+	constexpr uint64_t maxDrainInterval = 64'000'000;
+
+	// Must be called with IRQs disabled. Does not block if the ring is full.
+	void postToRing(LogRing &ring, const char *msg) {
+		auto head = ring.head.load(std::memory_order_relaxed);
+		auto tail = ring.tail.load(std::memory_order_acquire);
+		if(head - tail == LogRing::numRecords) {
+			droppedLogMessages.increment();
+			return;
+		}
+
+		auto &record = ring.records[head % LogRing::numRecords];
+		record.sequence = globalLogSequence.fetch_add(1, std::memory_order_relaxed);
+		uint32_t length = 0;
+		while(length < LogRing::maxLength && msg[length])
+			length++;
+		record.length = length;
+		memcpy(record.text, msg, length);
+		ring.head.store(head + 1, std::memory_order_release);
+	}
+
+	// Passes the oldest message of all rings to the LogHandlers.
+	// Returns false if all rings are empty. Must be called with logMutex held.
+	// Messages that are concurrently posted can be reordered slightly.
+	bool drainOneRecord() {
+		LogRing *oldestRing = nullptr;
+		LogRing::Record *oldest = nullptr;
+		for(int i = 0; i < getCpuCount(); i++) {
+			auto ring = &getCpuData(i)->logRing;
+			auto tail = ring->tail.load(std::memory_order_relaxed);
+			if(ring->head.load(std::memory_order_acquire) == tail)
+				continue;
+			auto record = &ring->records[tail % LogRing::numRecords];
+			if(!oldest || record->sequence < oldest->sequence) {
+				oldestRing = ring;
+				oldest = record;
+			}
+		}
+		if(!oldest)
+			return false;
+
+		for(uint32_t i = 0; i < oldest->length; i++)
+			logProcessor.print(oldest->text[i]);
+		logProcessor.print('\n');
+
+		oldestRing->tail.store(oldestRing->tail.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+		return true;
+	}
+
+	// Flushes messages that were posted before the caller's message.
+	// Must be called with logMutex held.
+	void drainAllRecords() {
+		auto limit = static_cast<size_t>(getCpuCount()) * LogRing::numRecords;
+		for(size_t i = 0; i < limit; i++) {
+			if(!drainOneRecord())
+				break;
+		}
+	}
+
+	initgraph::Task startLogDrain{&globalInitEngine, "generic.start-log-drain",
+		initgraph::Requires{getFibersAvailableStage()},
+		[] {
+			KernelFiber::run([] {
+				asyncLogging.store(true, std::memory_order_release);
+
+				uint64_t reportedDrops = 0;
+				uint64_t interval = minDrainInterval;
+				while(true) {
+					bool drained = false;
+					while(true) {
+						auto irqLock = frg::guard(&irqMutex());
+						auto lock = frg::guard(&logMutex);
+						if(!drainOneRecord())
+							break;
+						drained = true;
+					}
+
+					if(auto drops = droppedLogMessages.read(); drops != reportedDrops) {
+						infoLogger() << "thor: " << (drops - reportedDrops)
+								<< " log messages were dropped" << frg::endlog;
+						reportedDrops = drops;
+						continue;
+					}
+
+					if(drained) {
+						interval = minDrainInterval;
+					}else{
+						interval = frg::min(interval * 2, maxDrainInterval);
+					}
+					KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(interval));
+				}
+			});
+		}
+	};
 } // anonymous namespace
 
 void panic() {
@@ -156,8 +266,12 @@ constinit frg::stack_buffer_logger<PanicSink> panicLogger;
 
 void InfoSink::operator() (const char *msg) {
 	auto irqLock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&logMutex);
+	if(asyncLogging.load(std::memory_order_acquire)) {
+		postToRing(getCpuData()->logRing, msg);
+		return;
+	}
 
+	auto lock = frg::guard(&logMutex);
 	logProcessor.print(msg);
 	logProcessor.print('\n');
 }
@@ -166,6 +280,7 @@ void UrgentSink::operator() (const char *msg) {
 	StatelessIrqLock irqLock;
 	auto lock = frg::guard(&logMutex);
 
+	drainAllRecords();
 	logProcessor.print(msg);
 	logProcessor.print('\n');
 }
@@ -173,9 +288,13 @@ void UrgentSink::operator() (const char *msg) {
 void PanicSink::operator() (const char *msg) {
 	StatelessIrqLock irqLock;
 
+	// Make sure that all further output reaches the LogHandlers.
+	asyncLogging.store(false, std::memory_order_relaxed);
+
 	{
 		auto lock = frg::guard(&logMutex);
 
+		drainAllRecords();
 		logProcessor.print(msg);
 		logProcessor.print('\n');
 	}
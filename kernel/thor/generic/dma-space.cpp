@@ -0,0 +1,180 @@
+#include <utility>
+
+#include <thor-internal/debug.hpp>
+#include <thor-internal/dma-space.hpp>
+
+namespace thor {
+
+namespace {
+	constexpr int maxIommus = 16;
+
+	Iommu *iommus[maxIommus];
+	int numIommus = 0;
+}
+
+void registerIommu(Iommu *iommu) {
+	if(numIommus == maxIommus) {
+		infoLogger() << "thor: Too many IOMMUs, ignoring IOMMU" << frg::endlog;
+		return;
+	}
+	iommus[numIommus++] = iommu;
+}
+
+smarter::shared_ptr<IommuDomain> createIommuDomain(uint16_t segment, uint16_t requesterId) {
+	for(int i = 0; i < numIommus; i++) {
+		auto domain = iommus[i]->createDomain(segment, requesterId);
+		if(domain)
+			return domain;
+	}
+	return nullptr;
+}
+
+DmaSpace::DmaSpace(smarter::shared_ptr<IommuDomain> domain)
+: _domain{std::move(domain)} { }
+
+DmaSpace::~DmaSpace() {
+	// No map() can be in progress since it keeps the space alive.
+	for(size_t i = 0; i < _mappings.size(); i++) {
+		auto &mapping = _mappings[i];
+		assert(mapping.ready);
+		_unmapPages(mapping.iova, mapping.size);
+		mapping.view->unlockRange(mapping.offset, mapping.size);
+	}
+}
+
+coroutine<frg::expected<Error, uint64_t>> DmaSpace::map(smarter::shared_ptr<MemoryView> view,
+		uintptr_t offset, size_t size, bool writable, smarter::shared_ptr<WorkQueue> wq) {
+	if(!size || (offset & (kPageSize - 1)) || (size & (kPageSize - 1)))
+		co_return Error::illegalArgs;
+	if(offset + size < offset || offset + size > view->getLength())
+		co_return Error::outOfBounds;
+
+	frg::optional<uint64_t> iova;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		iova = _allocate(size);
+	}
+	if(!iova)
+		co_return Error::noMemory;
+
+	auto lockError = co_await view->asyncLockRange(offset, size, wq);
+	if(lockError != Error::success) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		_release(*iova);
+		co_return lockError;
+	}
+
+	// Fetch and map the pages one by one; the lock keeps them from being evicted.
+	size_t progress = 0;
+	while(progress < size) {
+		auto fetchOutcome = co_await view->fetchRange(offset + progress, 0, wq);
+		if(!fetchOutcome) {
+			_unmapPages(*iova, progress);
+			view->unlockRange(offset, size);
+
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			_release(*iova);
+			co_return fetchOutcome.error();
+		}
+
+		auto physical = view->peekRange(offset + progress).get<0>();
+		assert(physical != PhysicalAddr(-1));
+		_domain->mapPage(*iova + progress, physical, writable);
+		progress += kPageSize;
+	}
+	_domain->flush();
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		for(size_t i = 0; i < _mappings.size(); i++) {
+			auto &mapping = _mappings[i];
+			if(mapping.iova != *iova)
+				continue;
+			mapping.view = std::move(view);
+			mapping.offset = offset;
+			mapping.ready = true;
+			break;
+		}
+	}
+
+	co_return *iova;
+}
+
+Error DmaSpace::unmap(uint64_t iova, size_t size) {
+	smarter::shared_ptr<MemoryView> view;
+	uintptr_t offset;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		size_t i = 0;
+		while(i < _mappings.size() && _mappings[i].iova != iova)
+			i++;
+		if(i == _mappings.size() || !_mappings[i].ready || _mappings[i].size != size)
+			return Error::illegalArgs;
+
+		// Keep the IO virtual addresses reserved until the pages are unmapped.
+		_mappings[i].ready = false;
+		view = std::move(_mappings[i].view);
+		offset = _mappings[i].offset;
+	}
+
+	_unmapPages(iova, size);
+	view->unlockRange(offset, size);
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		_release(iova);
+	}
+	return Error::success;
+}
+
+// First-fit allocation; the number of persistent mappings per device is small.
+frg::optional<uint64_t> DmaSpace::_allocate(size_t size) {
+	// Keep IO virtual address zero unmapped to catch null pointers in descriptors.
+	uint64_t candidate = kPageSize;
+	size_t position = 0;
+	while(position < _mappings.size()) {
+		auto &mapping = _mappings[position];
+		if(candidate + size <= mapping.iova)
+			break;
+		candidate = mapping.iova + mapping.size;
+		position++;
+	}
+	if(candidate + size > _domain->addressLimit())
+		return frg::null_opt;
+
+	_mappings.push_back(Mapping{candidate, size, nullptr, 0, false});
+	for(size_t i = _mappings.size() - 1; i > position; i--)
+		std::swap(_mappings[i], _mappings[i - 1]);
+	return candidate;
+}
+
+void DmaSpace::_release(uint64_t iova) {
+	size_t i = 0;
+	while(_mappings[i].iova != iova)
+		i++;
+	for(; i + 1 < _mappings.size(); i++)
+		std::swap(_mappings[i], _mappings[i + 1]);
+	_mappings.pop_back();
+}
+
+void DmaSpace::_unmapPages(uint64_t iova, size_t size) {
+	if(!size)
+		return;
+	for(size_t progress = 0; progress < size; progress += kPageSize)
+		_domain->unmapPage(iova + progress);
+	_domain->flush();
+}
+
+} // namespace thor
@@ -0,0 +1,314 @@
+#include <string.h>
+#include <frg/string.hpp>
+#include <thor-internal/arch/paging.hpp>
+#include <thor-internal/cpu-data.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/heap-guard.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/metrics.hpp>
+#include <thor-internal/physical.hpp>
+
+namespace thor {
+
+extern frg::manual_box<frg::string<KernelAlloc>> kernelCommandLine;
+
+constinit uint64_t heapGuardSampleRate = 0;
+constinit uintptr_t heapGuardBase = 0;
+constinit size_t heapGuardSize = 0;
+
+THOR_DEFINE_COUNTER_METRIC(numGuardedAllocations, "thor.heap-guard.allocations",
+		"Heap allocations that were sampled by the heap guard");
+THOR_DEFINE_COUNTER_METRIC(numGuardPoolExhausted, "thor.heap-guard.exhausted",
+		"Sampled heap allocations that did not find a free heap guard slot");
+
+namespace {
+	// Each slot consists of one page for the object, preceded by a guard page.
+	// One more guard page follows the last slot.
+	constexpr size_t numSlots = 255;
+	constexpr int numTraceFrames = 4;
+
+	constexpr uint8_t freedPattern = 0x6B;
+
+	// Canary bytes also depend on the address, so that shifted copies are detected.
+	uint8_t canaryAt(uintptr_t address) {
+		return 0xAA ^ (address & 7);
+	}
+
+	enum class SlotState {
+		unused,
+		allocated,
+		freed
+	};
+
+	struct Slot {
+		SlotState state = SlotState::unused;
+		uintptr_t object = 0;
+		size_t size = 0;
+		uintptr_t allocTrace[numTraceFrames] = {};
+		uintptr_t freeTrace[numTraceFrames] = {};
+	};
+
+	// Protects the data structures below.
+	constinit frg::ticket_spinlock guardMutex;
+
+	constinit Slot slots[numSlots];
+	// FIFO of free slots. Reusing the least recently freed slot keeps
+	// freed objects around for as long as possible.
+	constinit size_t freeSlots[numSlots];
+	constinit size_t freeHead = 0;
+	constinit size_t numFreeSlots = 0;
+	constinit uint64_t numSampled = 0;
+
+	uintptr_t slotPage(size_t index) {
+		return heapGuardBase + (2 * index + 1) * kPageSize;
+	}
+
+	void recordTrace(uintptr_t (&trace)[numTraceFrames]) {
+		int n = 0;
+		walkThisStack([&] (uintptr_t ip) {
+			if(n < numTraceFrames)
+				trace[n++] = ip;
+		});
+		while(n < numTraceFrames)
+			trace[n++] = 0;
+	}
+
+	void logTrace(const char *what, const uintptr_t (&trace)[numTraceFrames]) {
+		auto msg = infoLogger();
+		msg << "thor: " << what << ":";
+		for(int i = 0; i < numTraceFrames && trace[i]; i++)
+			msg << " " << reinterpret_cast<void *>(trace[i]);
+		msg << frg::endlog;
+	}
+
+	[[noreturn]] void reportSlot(const char *problem, uintptr_t address, Slot *slot) {
+		infoLogger() << "\e[31m" "thor: Heap guard detected " << problem
+				<< " at " << reinterpret_cast<void *>(address) << "\e[39m" << frg::endlog;
+		if(slot) {
+			infoLogger() << "thor: Object " << reinterpret_cast<void *>(slot->object)
+					<< " of size " << slot->size
+					<< (slot->state == SlotState::freed ? " (freed)" : "") << frg::endlog;
+			logTrace("Allocated at", slot->allocTrace);
+			if(slot->state == SlotState::freed)
+				logTrace("Freed at", slot->freeTrace);
+		}
+		panicLogger() << "thor: Heap corruption detected" << frg::endlog;
+		__builtin_unreachable();
+	}
+
+	// Returns the address of the first byte of the slot's page that was overwritten (or zero).
+	// Bytes in [slot->object, objectEnd) are expected to contain the freed pattern,
+	// all other bytes are expected to contain canaries.
+	uintptr_t findCorruption(Slot *slot, uintptr_t objectEnd) {
+		auto page = slotPage(slot - slots);
+		for(uintptr_t p = page; p < page + kPageSize; p++) {
+			auto v = *reinterpret_cast<uint8_t *>(p);
+			if(p >= slot->object && p < objectEnd) {
+				if(v != freedPattern)
+					return p;
+			}else if(v != canaryAt(p)) {
+				return p;
+			}
+		}
+		return 0;
+	}
+
+	Slot *slotOf(void *pointer) {
+		auto index = (reinterpret_cast<uintptr_t>(pointer) - heapGuardBase) / kPageSize;
+		if(!(index & 1))
+			return nullptr; // Guard page.
+		return &slots[index / 2];
+	}
+
+	uint64_t parseSampleRate() {
+		frg::string_view cmdline{kernelCommandLine->data(), kernelCommandLine->size()};
+		frg::string_view prefix{"kernel-heap.sample-rate="};
+
+		uint64_t rate = 0;
+		size_t i = 0;
+		while(i < cmdline.size()) {
+			while(i < cmdline.size() && cmdline[i] == ' ')
+				i++;
+			size_t j = i;
+			while(j < cmdline.size() && cmdline[j] != ' ')
+				j++;
+
+			auto token = cmdline.sub_string(i, j - i);
+			if(token.size() >= prefix.size() && token.sub_string(0, prefix.size()) == prefix) {
+				rate = 0;
+				for(size_t k = prefix.size(); k < token.size(); k++) {
+					if(token[k] < '0' || token[k] > '9') {
+						infoLogger() << "\e[31m" "thor: Invalid heap sample rate " << token
+								<< "\e[39m" << frg::endlog;
+						return 0;
+					}
+					rate = rate * 10 + (token[k] - '0');
+				}
+			}
+			i = j;
+		}
+		return rate;
+	}
+
+	initgraph::Task initHeapGuard{&globalInitEngine, "generic.init-heap-guard",
+		initgraph::Entails{getTaskingAvailableStage()},
+		[] {
+			auto rate = parseSampleRate();
+			if(!rate)
+				return;
+
+			size_t size = (2 * numSlots + 1) * kPageSize;
+			auto base = reinterpret_cast<uintptr_t>(KernelVirtualMemory::global().allocate(size));
+			for(size_t i = 0; i < numSlots; i++) {
+				auto page = base + (2 * i + 1) * kPageSize;
+				PhysicalAddr physical = physicalAllocator->allocate(kPageSize);
+				assert(physical != static_cast<PhysicalAddr>(-1) && "OOM");
+				KernelPageSpace::global().mapSingle4k(page, physical,
+						page_access::write, CachingMode::null);
+
+				// Unused slots look like freed slots with empty objects.
+				for(uintptr_t p = page; p < page + kPageSize; p++)
+					*reinterpret_cast<uint8_t *>(p) = canaryAt(p);
+				freeSlots[i] = i;
+			}
+			numFreeSlots = numSlots;
+
+			heapGuardBase = base;
+			heapGuardSize = size;
+			heapGuardSampleRate = rate;
+			infoLogger() << "thor: Heap guard samples one in " << rate
+					<< " allocations" << frg::endlog;
+		}
+	};
+}
+
+void *sampleGuardedAllocation(size_t size) {
+	if(!size || size > kPageSize)
+		return nullptr;
+
+	Slot *slot;
+	bool rightAligned;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+
+		// Only sampled allocations take the global lock.
+		auto cache = &getCpuData()->heapCache;
+		if(cache->guardCountdown > 1) {
+			cache->guardCountdown--;
+			return nullptr;
+		}
+		cache->guardCountdown = heapGuardSampleRate;
+
+		auto lock = frg::guard(&guardMutex);
+		if(!numFreeSlots) {
+			numGuardPoolExhausted.increment();
+			return nullptr;
+		}
+		slot = &slots[freeSlots[freeHead]];
+		freeHead = (freeHead + 1) % numSlots;
+		numFreeSlots--;
+
+		// Alternate between detecting overflows and underflows.
+		rightAligned = !(numSampled++ & 1);
+	}
+
+	// Detect writes to the object after it was freed.
+	if(slot->state == SlotState::freed) {
+		if(auto p = findCorruption(slot, slot->object + slot->size); p)
+			reportSlot("use-after-free write", p, slot);
+	}
+
+	// Align like the slab allocator does, i.e., to the size rounded up to a power of two.
+	size_t align = 16;
+	while(align < size)
+		align <<= 1;
+
+	auto page = slotPage(slot - slots);
+	uintptr_t object = page;
+	if(rightAligned)
+		object = page + ((kPageSize - size) & ~(align - 1));
+
+	// The object itself is not initialized (as for other allocations);
+	// set the bytes that previously belonged to the freed object to canaries.
+	for(uintptr_t p = slot->object; p < slot->object + slot->size; p++)
+		*reinterpret_cast<uint8_t *>(p) = canaryAt(p);
+
+	slot->state = SlotState::allocated;
+	slot->object = object;
+	slot->size = size;
+	recordTrace(slot->allocTrace);
+	numGuardedAllocations.increment();
+	return reinterpret_cast<void *>(object);
+}
+
+void freeGuardedObject(void *pointer) {
+	auto slot = slotOf(pointer);
+	if(!slot)
+		reportSlot("invalid free", reinterpret_cast<uintptr_t>(pointer), nullptr);
+	if(slot->state != SlotState::allocated)
+		reportSlot("double free", reinterpret_cast<uintptr_t>(pointer), slot);
+	if(reinterpret_cast<uintptr_t>(pointer) != slot->object)
+		reportSlot("invalid free", reinterpret_cast<uintptr_t>(pointer), slot);
+
+	// Check the canaries around the object. While the object is live, its bytes are arbitrary;
+	// to reuse findCorruption(), fill the object with the freed pattern first.
+	memset(pointer, freedPattern, slot->size);
+	if(auto p = findCorruption(slot, slot->object + slot->size); p)
+		reportSlot("out-of-bounds write", p, slot);
+
+	slot->state = SlotState::freed;
+	recordTrace(slot->freeTrace);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&guardMutex);
+	freeSlots[(freeHead + numFreeSlots) % numSlots] = slot - slots;
+	numFreeSlots++;
+}
+
+void *reallocateGuardedObject(void *pointer, size_t size) {
+	auto slot = slotOf(pointer);
+	if(!slot || slot->state != SlotState::allocated)
+		reportSlot("invalid reallocation", reinterpret_cast<uintptr_t>(pointer), slot);
+
+	void *newPointer = nullptr;
+	if(size) {
+		newPointer = kernelAlloc->allocate(size);
+		if(!newPointer)
+			return nullptr;
+		memcpy(newPointer, pointer, frg::min(size, slot->size));
+	}
+	freeGuardedObject(pointer);
+	return newPointer;
+}
+
+void checkHeapGuardFault(uintptr_t address, uintptr_t ip, bool write) {
+	if(!isGuardedHeapPointer(reinterpret_cast<void *>(address)))
+		return;
+
+	infoLogger() << "thor: Heap guard fault on " << (write ? "write to " : "read from ")
+			<< reinterpret_cast<void *>(address)
+			<< ", faulting ip: " << reinterpret_cast<void *>(ip) << frg::endlog;
+
+	// Attribute the access to the nearest object.
+	auto index = (address - heapGuardBase) / kPageSize;
+	Slot *slot = nullptr;
+	if(!(index & 1)) {
+		Slot *before = index ? &slots[index / 2 - 1] : nullptr;
+		Slot *after = index / 2 < numSlots ? &slots[index / 2] : nullptr;
+		if(before && before->state == SlotState::unused)
+			before = nullptr;
+		if(after && after->state == SlotState::unused)
+			after = nullptr;
+		if(before && after) {
+			slot = (address - (before->object + before->size) < after->object - address)
+					? before : after;
+		}else{
+			slot = before ? before : after;
+		}
+	}else{
+		slot = &slots[index / 2];
+	}
+	reportSlot("out-of-bounds access", address, slot);
+}
+
+} // namespace thor
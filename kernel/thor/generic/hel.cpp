@@ -8,10 +8,12 @@
 #include <frg/small_vector.hpp>
 #include <thor-internal/event.hpp>
 #include <thor-internal/coroutine.hpp>
+#include <thor-internal/dma-space.hpp>
 #include <thor-internal/io.hpp>
 #include <thor-internal/ipc-queue.hpp>
 #include <thor-internal/irq.hpp>
 #include <thor-internal/kernlet.hpp>
+#include <thor-internal/memory-account.hpp>
 #include <thor-internal/physical.hpp>
 #include <thor-internal/random.hpp>
 #include <thor-internal/stream.hpp>
@@ -27,6 +29,10 @@
 using namespace thor;
 
 namespace {
+	// kHelItemDirect is ignored for transfers below this size; for those,
+	// bounce buffers are cheaper than pinning the pages of both address spaces.
+	constexpr size_t directTransferThreshold = 4 * kPageSize;
+
 	// TODO: Replace this by a function that returns the type of special descriptor.
 	bool isSpecialMemoryView(HelHandle handle) {
 		return handle == kHelZeroMemory;
@@ -108,6 +114,7 @@ HelError translateError(Error error) {
 	case Error::bufferTooSmall: return kHelErrBufferTooSmall;
 	case Error::fault: return kHelErrFault;
 	case Error::remoteFault: return kHelErrRemoteFault;
+	case Error::noMemory: return kHelErrNoMemory;
 	default:
 		assert(!"Unexpected error");
 		__builtin_unreachable();
@@ -155,6 +162,9 @@ HelError helSubmitAsyncNop(HelHandle queueHandle, uintptr_t context) {
 		queue = queueWrapper->get<QueueDescriptor>().queue;
 	}
 
+	if(!queue->validSize(ipcSourceSize(sizeof(HelSimpleResult))))
+		return kHelErrQueueTooSmall;
+
 	[] (smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
 			enable_detached_coroutine = {}) -> void {
 		HelSimpleResult helResult{.error = kHelErrNone};
@@ -175,6 +185,9 @@ HelError helCreateUniverse(HelHandle *handle) {
 		auto irq_lock = frg::guard(&irqMutex());
 		Universe::Guard universe_guard(this_universe->lock);
 
+		// New universes are charged to the same account as their creator.
+		new_universe->memoryAccount = this_universe->memoryAccount;
+
 		*handle = this_universe->attachDescriptor(universe_guard,
 				UniverseDescriptor(std::move(new_universe)));
 	}
@@ -363,16 +376,24 @@ HelError helAllocateMemory(size_t size, uint32_t flags,
 //			<< ", sum of allocated memory: " << (void *)pressure << frg::endlog;
 
 	HelAllocRestrictions effective{
-		.addressBits = 64
+		.addressBits = 64,
+		.numaNode = 0
 	};
 	if(restrictions)
 		if(!readUserMemory(&effective, restrictions, sizeof(HelAllocRestrictions)))
 			return kHelErrFault;
+	if(flags & kHelAllocNodeBound) {
+		if(effective.numaNode < 0 || effective.numaNode >= physicalAllocator->numNodes())
+			return kHelErrIllegalArgs;
+	}
 
 	smarter::shared_ptr<AllocatedMemory> memory;
 	if(flags & kHelAllocContinuous) {
 		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
 				size, kPageSize);
+	}else if((flags & kHelAllocHuge) && !(size & (kHugePageSize - 1))) {
+		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
+				kHugePageSize, kHugePageSize);
 	}else if(flags & kHelAllocOnDemand) {
 		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits);
 	}else{
@@ -380,11 +401,14 @@ HelError helAllocateMemory(size_t size, uint32_t flags,
 		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits);
 	}
 	memory->selfPtr = memory;
+	if(flags & kHelAllocNodeBound)
+		memory->bindToNode(effective.numaNode);
 
 	{
 		auto irqLock = frg::guard(&irqMutex());
 		Universe::Guard universeGuard(thisUniverse->lock);
 
+		memory->setAccount(thisUniverse->memoryAccount);
 		*handle = thisUniverse->attachDescriptor(universeGuard,
 				MemoryViewDescriptor(std::move(memory)));
 	}
@@ -481,6 +505,7 @@ HelError helCopyOnWrite(HelHandle memoryHandle,
 		auto irq_lock = frg::guard(&irqMutex());
 		Universe::Guard universe_guard(this_universe->lock);
 
+		slice->setAccount(this_universe->memoryAccount);
 		*outHandle = this_universe->attachDescriptor(universe_guard,
 				MemoryViewDescriptor(std::move(slice)));
 	}
@@ -562,9 +587,27 @@ HelError helAlterMemoryIndirection(HelHandle indirectHandle, size_t slot,
 	return kHelErrNone;
 }
 
+namespace {
+	// Translates the kHelMapCache* flags. Returns false if they are invalid.
+	bool decodeCachingFlags(uint32_t flags, CachingMode *mode) {
+		switch(flags & kHelMapCacheMask) {
+		case 0: *mode = CachingMode::null; return true;
+		case kHelMapCacheWriteBack: *mode = CachingMode::writeBack; return true;
+		case kHelMapCacheWriteCombine: *mode = CachingMode::writeCombine; return true;
+		case kHelMapCacheWriteThrough: *mode = CachingMode::writeThrough; return true;
+		case kHelMapCacheUncached: *mode = CachingMode::uncached; return true;
+		default: return false;
+		}
+	}
+}
+
 HelError helCreateSliceView(HelHandle memoryHandle,
 		uintptr_t offset, size_t size, uint32_t flags, HelHandle *handle) {
-	assert(!flags);
+	CachingMode cachingMode;
+	if(flags & ~kHelMapCacheMask)
+		return kHelErrIllegalArgs;
+	if(!decodeCachingFlags(flags, &cachingMode))
+		return kHelErrIllegalArgs;
 	assert((offset % kPageSize) == 0);
 	assert((size % kPageSize) == 0);
 
@@ -585,7 +628,7 @@ HelError helCreateSliceView(HelHandle memoryHandle,
 	}
 
 	auto slice = smarter::allocate_shared<MemorySlice>(*kernelAlloc,
-			std::move(view), offset, size);
+			std::move(view), offset, size, cachingMode);
 	{
 		auto irq_lock = frg::guard(&irqMutex());
 		Universe::Guard universe_guard(this_universe->lock);
@@ -720,14 +763,24 @@ HelError helRunVirtualizedCpu(HelHandle handle, HelVmexitReason *exitInfo) {
 }
 
 HelError helGetRandomBytes(void *buffer, size_t wantedSize, size_t *actualSize) {
+	// Generating is cheap compared to the syscall itself; hence, return up to 4 KiB per call.
+	// The bytes are staged through a small buffer that is written out with IRQs enabled.
 	char bounceBuffer[128];
-	size_t generatedSize = generateRandomBytes(bounceBuffer,
-			frg::min(wantedSize, size_t{128}));
-
-	if(!writeUserMemory(buffer, bounceBuffer, generatedSize))
-		return kHelErrFault;
+	size_t totalSize = frg::min(wantedSize, size_t{0x1000});
+	size_t progress = 0;
+	while(progress < totalSize) {
+		size_t generatedSize = generateRandomBytes(bounceBuffer,
+				frg::min(totalSize - progress, sizeof(bounceBuffer)));
+
+		bool success = writeUserMemory(reinterpret_cast<char *>(buffer) + progress,
+				bounceBuffer, generatedSize);
+		memset(bounceBuffer, 0, generatedSize);
+		if(!success)
+			return kHelErrFault;
+		progress += generatedSize;
+	}
 
-	*actualSize = generatedSize;
+	*actualSize = progress;
 	return kHelErrNone;
 }
 
@@ -741,6 +794,9 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 		return kHelErrIllegalArgs;
 	if(length % kPageSize != 0)
 		return kHelErrIllegalArgs;
+	CachingMode cachingMode;
+	if(!decodeCachingFlags(flags, &cachingMode))
+		return kHelErrIllegalArgs;
 
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
@@ -762,6 +818,14 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 	if(flags & kHelMapDontRequireBacking)
 		map_flags |= AddressSpace::kMapDontRequireBacking;
 
+	switch(cachingMode) {
+	case CachingMode::writeBack: map_flags |= AddressSpace::kMapCacheWriteBack; break;
+	case CachingMode::writeCombine: map_flags |= AddressSpace::kMapCacheWriteCombine; break;
+	case CachingMode::writeThrough: map_flags |= AddressSpace::kMapCacheWriteThrough; break;
+	case CachingMode::uncached: map_flags |= AddressSpace::kMapCacheUncached; break;
+	default: break;
+	}
+
 	smarter::shared_ptr<MemorySlice> slice;
 	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 	smarter::shared_ptr<VirtualSpace> vspace;
@@ -822,6 +886,22 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 		return kHelErrBufferTooSmall;
 	}
 
+	// Like MAP_POPULATE, failure to prefault pages does not fail the mapping itself.
+	if(flags & kHelMapPopulate) {
+		auto wq = this_thread->pagingWorkQueue();
+		frg::expected<Error> populateOutcome;
+		if(!isVspace) {
+			populateOutcome = Thread::asyncBlockCurrent(space->populate(mapResult.value(), length,
+					wq->take()), wq);
+		}else{
+			populateOutcome = Thread::asyncBlockCurrent(vspace->populate(mapResult.value(), length,
+					wq->take()), wq);
+		}
+		if(!populateOutcome)
+			infoLogger() << "thor: Failed to populate mapping at "
+					<< (void *)mapResult.value() << frg::endlog;
+	}
+
 	*actualPointer = (void *)mapResult.value();
 	return kHelErrNone;
 }
@@ -916,6 +996,176 @@ HelError helUnmapMemory(HelHandle space_handle, void *pointer, size_t length) {
 	return kHelErrNone;
 }
 
+HelError helRemapMemory(HelHandle memoryHandle, HelHandle spaceHandle,
+		void *pointer, size_t size, size_t newSize, uint32_t flags, void **newPointer) {
+	if(!size || !newSize)
+		return kHelErrIllegalArgs;
+	if((uintptr_t)pointer % kPageSize != 0)
+		return kHelErrIllegalArgs;
+	if(size % kPageSize != 0 || newSize % kPageSize != 0)
+		return kHelErrIllegalArgs;
+	if(flags & ~uint32_t{kHelRemapMayMove})
+		return kHelErrIllegalArgs;
+
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<MemorySlice> slice;
+	smarter::shared_ptr<AddressSpace, BindableHandle> space;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		if(memoryHandle != kHelNullHandle) {
+			auto memoryWrapper = thisUniverse->getDescriptor(universeGuard, memoryHandle);
+			if(!memoryWrapper)
+				return kHelErrNoDescriptor;
+			if(memoryWrapper->is<MemorySliceDescriptor>()) {
+				slice = memoryWrapper->get<MemorySliceDescriptor>().slice;
+			}else if(memoryWrapper->is<MemoryViewDescriptor>()) {
+				auto memory = memoryWrapper->get<MemoryViewDescriptor>().memory;
+				auto sliceLength = memory->getLength();
+				slice = smarter::allocate_shared<MemorySlice>(*kernelAlloc,
+						std::move(memory), 0, sliceLength);
+			}else{
+				return kHelErrBadDescriptor;
+			}
+		}
+
+		if(spaceHandle == kHelNullHandle) {
+			space = thisThread->getAddressSpace().lock();
+		}else{
+			auto spaceWrapper = thisUniverse->getDescriptor(universeGuard, spaceHandle);
+			if(!spaceWrapper)
+				return kHelErrNoDescriptor;
+			if(!spaceWrapper->is<AddressSpaceDescriptor>())
+				return kHelErrBadDescriptor;
+			space = spaceWrapper->get<AddressSpaceDescriptor>().space;
+		}
+	}
+
+	uint32_t remapFlags = 0;
+	if(flags & kHelRemapMayMove)
+		remapFlags |= AddressSpace::kRemapMayMove;
+
+	auto outcome = Thread::asyncBlockCurrent(space->remap(std::move(slice),
+			(VirtualAddr)pointer, size, newSize, remapFlags));
+	if(!outcome) {
+		if(outcome.error() == Error::illegalArgs)
+			return kHelErrIllegalArgs;
+		return translateError(outcome.error());
+	}
+
+	*newPointer = reinterpret_cast<void *>(outcome.value());
+	return kHelErrNone;
+}
+
+HelError helQuerySpaceStats(HelHandle spaceHandle, HelSpaceStats *userStats) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<AddressSpace, BindableHandle> space;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		if(spaceHandle == kHelNullHandle) {
+			space = thisThread->getAddressSpace().lock();
+		}else{
+			auto spaceWrapper = thisUniverse->getDescriptor(universeGuard, spaceHandle);
+			if(!spaceWrapper)
+				return kHelErrNoDescriptor;
+			if(!spaceWrapper->is<AddressSpaceDescriptor>())
+				return kHelErrBadDescriptor;
+			space = spaceWrapper->get<AddressSpaceDescriptor>().space;
+		}
+	}
+
+	HelSpaceStats stats;
+	memset(&stats, 0, sizeof(HelSpaceStats));
+	stats.mappedSize = space->mappedSize();
+	stats.anonymousRss = space->rss(RssKind::anonymous);
+	stats.fileRss = space->rss(RssKind::file);
+	stats.sharedRss = space->rss(RssKind::shared);
+	stats.pageTableSize = space->pageTableSize();
+
+	if(!writeUserObject(userStats, stats))
+		return kHelErrFault;
+
+	return kHelErrNone;
+}
+
+HelError helMapDmaSpace(HelHandle spaceHandle, HelHandle memoryHandle,
+		uintptr_t offset, size_t size, uint32_t flags, uint64_t *iova) {
+	if(flags & ~(kHelMapProtRead | kHelMapProtWrite))
+		return kHelErrIllegalArgs;
+
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<DmaSpace> space;
+	smarter::shared_ptr<MemoryView> memory;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		auto spaceWrapper = thisUniverse->getDescriptor(universeGuard, spaceHandle);
+		if(!spaceWrapper)
+			return kHelErrNoDescriptor;
+		if(!spaceWrapper->is<DmaSpaceDescriptor>())
+			return kHelErrBadDescriptor;
+		space = spaceWrapper->get<DmaSpaceDescriptor>().space;
+
+		auto memoryWrapper = thisUniverse->getDescriptor(universeGuard, memoryHandle);
+		if(!memoryWrapper)
+			return kHelErrNoDescriptor;
+		if(!memoryWrapper->is<MemoryViewDescriptor>())
+			return kHelErrBadDescriptor;
+		memory = memoryWrapper->get<MemoryViewDescriptor>().memory;
+	}
+	if(!space)
+		return kHelErrBadDescriptor;
+
+	auto outcome = Thread::asyncBlockCurrent(space->map(std::move(memory), offset, size,
+			flags & kHelMapProtWrite, thisThread->mainWorkQueue()->take()));
+	if(!outcome) {
+		if(outcome.error() == Error::illegalArgs)
+			return kHelErrIllegalArgs;
+		if(outcome.error() == Error::outOfBounds)
+			return kHelErrOutOfBounds;
+		return translateError(outcome.error());
+	}
+
+	*iova = outcome.value();
+	return kHelErrNone;
+}
+
+HelError helUnmapDmaSpace(HelHandle spaceHandle, uint64_t iova, size_t size) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<DmaSpace> space;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		auto spaceWrapper = thisUniverse->getDescriptor(universeGuard, spaceHandle);
+		if(!spaceWrapper)
+			return kHelErrNoDescriptor;
+		if(!spaceWrapper->is<DmaSpaceDescriptor>())
+			return kHelErrBadDescriptor;
+		space = spaceWrapper->get<DmaSpaceDescriptor>().space;
+	}
+	if(!space)
+		return kHelErrBadDescriptor;
+
+	if(auto error = space->unmap(iova, size); error != Error::success) {
+		assert(error == Error::illegalArgs);
+		return kHelErrIllegalArgs;
+	}
+	return kHelErrNone;
+}
+
 HelError helSubmitSynchronizeSpace(HelHandle spaceHandle, void *pointer, size_t length,
 		HelHandle queueHandle, uintptr_t context) {
 	auto thisThread = getCurrentThread();
@@ -946,6 +1196,9 @@ HelError helSubmitSynchronizeSpace(HelHandle spaceHandle, void *pointer, size_t
 		queue = queueWrapper->get<QueueDescriptor>().queue;
 	}
 
+	if(!queue->validSize(ipcSourceSize(sizeof(HelSimpleResult))))
+		return kHelErrQueueTooSmall;
+
 	[] (smarter::shared_ptr<AddressSpace, BindableHandle> space,
 			void *pointer, size_t length,
 			smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
@@ -1006,6 +1259,9 @@ HelError helSubmitReadMemory(HelHandle handle, uintptr_t address,
 		queue = queueWrapper->get<QueueDescriptor>().queue;
 	}
 
+	if(!queue->validSize(ipcSourceSize(sizeof(HelSimpleResult))))
+		return kHelErrQueueTooSmall;
+
 	auto readMemoryView = [] (smarter::shared_ptr<Thread> submitThread,
 			smarter::shared_ptr<MemoryView> view,
 			uintptr_t address, size_t length, void *buffer,
@@ -1163,6 +1419,9 @@ HelError helSubmitWriteMemory(HelHandle handle, uintptr_t address,
 		queue = queueWrapper->get<QueueDescriptor>().queue;
 	}
 
+	if(!queue->validSize(ipcSourceSize(sizeof(HelSimpleResult))))
+		return kHelErrQueueTooSmall;
+
 	auto writeMemoryView = [] (smarter::shared_ptr<Thread> submitThread,
 			smarter::shared_ptr<MemoryView> view,
 			uintptr_t address, size_t length, const void *buffer,
@@ -1503,13 +1762,201 @@ HelError helLoadahead(HelHandle handle, uintptr_t offset, size_t length) {
 		memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
 	}
 
-/*	auto handle_load = smarter::allocate_shared<AsyncInitiateLoad>(*kernelAlloc,
-			NullCompleter(), offset, length);
+	// This is only a hint; ignore memory objects that do not support it.
+	memory->adviseAccess(AccessAdvice::willNeed, offset, length);
+
+	return kHelErrNone;
+}
+
+HelError helAdviseMemory(HelHandle handle, uintptr_t offset, size_t length, int advice) {
+	if(offset % kPageSize || length % kPageSize)
+		return kHelErrIllegalArgs;
+
+	AccessAdvice accessAdvice;
+	switch(advice) {
+	case kHelAdviseNormal: accessAdvice = AccessAdvice::normal; break;
+	case kHelAdviseRandom: accessAdvice = AccessAdvice::random; break;
+	case kHelAdviseSequential: accessAdvice = AccessAdvice::sequential; break;
+	case kHelAdviseWillNeed: accessAdvice = AccessAdvice::willNeed; break;
+	case kHelAdviseMergeable: accessAdvice = AccessAdvice::mergeable; break;
+	case kHelAdviseUnmergeable: accessAdvice = AccessAdvice::unmergeable; break;
+	default:
+		return kHelErrIllegalArgs;
+	}
+
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	smarter::shared_ptr<MemoryView> memory;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		if(!memory_wrapper)
+			return kHelErrNoDescriptor;
+		if(!memory_wrapper->is<MemoryViewDescriptor>())
+			return kHelErrBadDescriptor;
+		memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
+	}
+
+	auto error = memory->adviseAccess(accessAdvice, offset, length);
+	if(error == Error::illegalObject)
+		return kHelErrUnsupportedOperation;
+	if(error == Error::outOfBounds)
+		return kHelErrOutOfBounds;
+	assert(error == Error::success);
+	return kHelErrNone;
+}
+
+HelError helDiscardMemory(HelHandle handle, uintptr_t offset, size_t length, uint32_t flags) {
+	if(offset % kPageSize || length % kPageSize)
+		return kHelErrIllegalArgs;
+	if(flags & ~uint32_t(kHelDiscardLazy))
+		return kHelErrIllegalArgs;
+
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	smarter::shared_ptr<MemoryView> memory;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		if(!memory_wrapper)
+			return kHelErrNoDescriptor;
+		if(!memory_wrapper->is<MemoryViewDescriptor>())
+			return kHelErrBadDescriptor;
+		memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
+	}
+
+	auto outcome = Thread::asyncBlockCurrent(memory->discardRange(offset, length,
+			flags & kHelDiscardLazy));
+	if(!outcome) {
+		if(outcome.error() == Error::illegalObject)
+			return kHelErrUnsupportedOperation;
+		if(outcome.error() == Error::outOfBounds)
+			return kHelErrOutOfBounds;
+		return translateError(outcome.error());
+	}
+	return kHelErrNone;
+}
+
+HelError helCreateMemoryAccount(size_t softLimit, size_t hardLimit, HelHandle *handle) {
+	if(softLimit % kPageSize || hardLimit % kPageSize)
+		return kHelErrIllegalArgs;
+	if(softLimit && hardLimit && softLimit > hardLimit)
+		return kHelErrIllegalArgs;
+
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	auto account = smarter::allocate_shared<MemoryAccount>(*kernelAlloc, softLimit, hardLimit);
+
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		*handle = this_universe->attachDescriptor(universe_guard,
+				MemoryAccountDescriptor(std::move(account)));
+	}
+
+	return kHelErrNone;
+}
+
+HelError helSetMemoryAccount(HelHandle universeHandle, HelHandle accountHandle) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	smarter::shared_ptr<Universe> universe;
+	smarter::shared_ptr<MemoryAccount> account;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		if(universeHandle == kHelThisUniverse) {
+			universe = this_universe.lock();
+		}else{
+			auto universe_wrapper = this_universe->getDescriptor(universe_guard, universeHandle);
+			if(!universe_wrapper)
+				return kHelErrNoDescriptor;
+			if(!universe_wrapper->is<UniverseDescriptor>())
+				return kHelErrBadDescriptor;
+			universe = universe_wrapper->get<UniverseDescriptor>().universe;
+		}
+
+		if(accountHandle != kHelNullHandle) {
+			auto account_wrapper = this_universe->getDescriptor(universe_guard, accountHandle);
+			if(!account_wrapper)
+				return kHelErrNoDescriptor;
+			if(!account_wrapper->is<MemoryAccountDescriptor>())
+				return kHelErrBadDescriptor;
+			account = account_wrapper->get<MemoryAccountDescriptor>().account;
+		}
+	}
+
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(universe->lock);
+
+		universe->memoryAccount = std::move(account);
+	}
+
+	return kHelErrNone;
+}
+
+HelError helQueryMemoryAccount(HelHandle handle, HelMemoryAccountInfo *userInfo) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	smarter::shared_ptr<MemoryAccount> account;
 	{
-		// TODO: protect memory object with a guard
-		memory->submitInitiateLoad(std::move(handle_load));
-	}*/
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		if(!wrapper)
+			return kHelErrNoDescriptor;
+		if(!wrapper->is<MemoryAccountDescriptor>())
+			return kHelErrBadDescriptor;
+		account = wrapper->get<MemoryAccountDescriptor>().account;
+	}
+
+	HelMemoryAccountInfo info;
+	memset(&info, 0, sizeof(HelMemoryAccountInfo));
+	info.usage = account->usage();
+	info.softLimit = account->softLimit();
+	info.hardLimit = account->hardLimit();
+
+	if(!writeUserObject(userInfo, info))
+		return kHelErrFault;
+
+	return kHelErrNone;
+}
+
+HelError helAccessMemoryPressure(HelHandle *handle) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		*handle = this_universe->attachDescriptor(universe_guard,
+				BitsetEventDescriptor(getMemoryPressureEvent()));
+	}
+
+	return kHelErrNone;
+}
 
+HelError helQueryMemoryPressure(int *level) {
+	switch(currentMemoryPressure()) {
+	case MemoryPressure::none: *level = kHelMemoryPressureNone; break;
+	case MemoryPressure::low: *level = kHelMemoryPressureLow; break;
+	case MemoryPressure::medium: *level = kHelMemoryPressureMedium; break;
+	case MemoryPressure::critical: *level = kHelMemoryPressureCritical; break;
+	}
 	return kHelErrNone;
 }
 
@@ -1600,7 +2047,19 @@ HelError helQueryThreadStats(HelHandle handle, HelThreadStats *user_stats) {
 
 	HelThreadStats stats;
 	memset(&stats, 0, sizeof(HelThreadStats));
-	stats.userTime = thread->runTime();
+	auto runTime = thread->runTime();
+	auto kernelTime = thread->kernelTime();
+	// runTime() is only updated on scheduling events while kernelTime() is updated on
+	// every syscall; hence, kernelTime() can be slightly larger.
+	stats.userTime = runTime > kernelTime ? runTime - kernelTime : 0;
+	stats.kernelTime = kernelTime;
+	stats.waitTime = thread->waitTime();
+	stats.voluntarySwitches = thread->numVoluntarySwitches();
+	stats.involuntarySwitches = thread->numInvoluntarySwitches();
+	stats.minorFaults = thread->numPageFaults() - thread->numMajorPageFaults();
+	stats.majorFaults = thread->numMajorPageFaults();
+	stats.ipcSubmissions = thread->numIpcSubmissions();
+	stats.lastCpu = thread->lastCpu();
 
 	if(!writeUserObject(user_stats, stats))
 		return kHelErrFault;
@@ -1632,6 +2091,71 @@ HelError helSetPriority(HelHandle handle, int priority) {
 	return kHelErrNone;
 }
 
+HelError helSetSchedulingPolicy(HelHandle handle, int policy, int rtPriority) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	SchedulePolicy schedulePolicy;
+	if(policy == kHelSchedFair) {
+		if(rtPriority)
+			return kHelErrIllegalArgs;
+		schedulePolicy = SchedulePolicy::fair;
+	}else{
+		if(policy == kHelSchedFifo) {
+			schedulePolicy = SchedulePolicy::fifo;
+		}else if(policy == kHelSchedRoundRobin) {
+			schedulePolicy = SchedulePolicy::roundRobin;
+		}else{
+			return kHelErrIllegalArgs;
+		}
+		if(rtPriority < 1 || rtPriority > kHelMaxRealtimePriority)
+			return kHelErrIllegalArgs;
+	}
+
+	smarter::shared_ptr<Thread> thread;
+	if(handle == kHelThisThread) {
+		thread = this_thread.lock();
+	}else{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		if(!thread_wrapper)
+			return kHelErrNoDescriptor;
+		if(!thread_wrapper->is<ThreadDescriptor>())
+			return kHelErrBadDescriptor;
+		thread = remove_tag_cast(thread_wrapper->get<ThreadDescriptor>().thread);
+	}
+
+	Scheduler::setPolicy(thread.get(), schedulePolicy, rtPriority);
+
+	return kHelErrNone;
+}
+
+HelError helSetTimerSlack(HelHandle handle, uint64_t slack) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	smarter::shared_ptr<Thread> thread;
+	if(handle == kHelThisThread) {
+		thread = this_thread.lock();
+	}else{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		if(!thread_wrapper)
+			return kHelErrNoDescriptor;
+		if(!thread_wrapper->is<ThreadDescriptor>())
+			return kHelErrBadDescriptor;
+		thread = remove_tag_cast(thread_wrapper->get<ThreadDescriptor>().thread);
+	}
+
+	thread->setTimerSlack(slack);
+
+	return kHelErrNone;
+}
+
 HelError helYield() {
 	Thread::deferCurrent();
 
@@ -2021,7 +2545,8 @@ HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t
 					std::move(queue), context);
 			closure->queue->registerNode(closure);
 			*async_id = closure->asyncId();
-			generalTimerEngine()->installTimer(closure);
+			closure->setSlack(getCurrentThread()->timerSlack());
+			generalTimerEngine()->installTimeout(closure);
 		}
 
 		static void elapsed(Worklet *worklet) {
@@ -2110,6 +2635,7 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 
 	auto thisThread = getCurrentThread();
 	auto thisUniverse = thisThread->getUniverse();
+	thisThread->accountIpcSubmission();
 
 	LaneHandle lane;
 	smarter::shared_ptr<IpcQueue> queue;
@@ -2146,6 +2672,7 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 			HelCredentialsResult helCredentialsResult;
 			HelInlineResultNoFlex helInlineResult;
 			HelLengthResult helLengthResult;
+			HelHandlesResultNoFlex helHandlesResult;
 		};
 	};
 
@@ -2265,6 +2792,43 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				node->_tag = kTagPullDescriptor;
 				ipcSize += ipcSourceSize(sizeof(HelHandleResult));
 				break;
+			case kHelActionPushDescriptors: {
+				if(recipe->length > kHelMaxDescriptorsPerAction)
+					return kHelErrIllegalArgs;
+
+				frg::dyn_array<HelHandle, KernelAlloc> handles{recipe->length, *kernelAlloc};
+				if(!readUserArray(reinterpret_cast<const HelHandle *>(recipe->buffer),
+						handles.data(), recipe->length))
+					return kHelErrFault;
+
+				// Resolve all handles under a single acquisition of the universe lock.
+				frg::vector<AnyDescriptor, KernelAlloc> operands{*kernelAlloc};
+				operands.resize(recipe->length);
+				{
+					auto irq_lock = frg::guard(&irqMutex());
+					Universe::Guard universe_guard(thisUniverse->lock);
+
+					for(size_t j = 0; j < recipe->length; j++) {
+						auto wrapper = thisUniverse->getDescriptor(universe_guard, handles[j]);
+						if(!wrapper)
+							return kHelErrNoDescriptor;
+						operands[j] = *wrapper;
+					}
+				}
+
+				node->_tag = kTagPushDescriptors;
+				node->_inDescriptors = std::move(operands);
+				ipcSize += ipcSourceSize(sizeof(HelSimpleResult));
+				break;
+			}
+			case kHelActionPullDescriptors:
+				if(recipe->length > kHelMaxDescriptorsPerAction)
+					return kHelErrIllegalArgs;
+				node->_tag = kTagPullDescriptors;
+				node->_maxLength = recipe->length;
+				ipcSize += ipcSourceSize(sizeof(HelHandlesResultNoFlex));
+				ipcSize += ipcSourceSize(recipe->length * sizeof(HelHandle));
+				break;
 			default:
 				return kHelErrIllegalArgs;
 		}
@@ -2393,6 +2957,36 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 					item->helHandleResult = {translateError(node->error()), 0, handle};
 					item->mainSource.setup(&item->helHandleResult, sizeof(HelHandleResult));
 					link(&item->mainSource);
+				}else if(recipe->type == kHelActionPushDescriptors) {
+					item->helSimpleResult = {translateError(node->error()), 0};
+					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionPullDescriptors) {
+					auto descriptors = node->descriptors();
+					size_t n = descriptors.size();
+
+					if(n) {
+						auto universe = closure->weakUniverse.lock();
+						assert(universe);
+
+						// Reuse the transmit buffer (which is unused by this tag) for the handles.
+						node->_transmitBuffer = frg::unique_memory<KernelAlloc>{*kernelAlloc,
+								n * sizeof(HelHandle)};
+						auto handles = reinterpret_cast<HelHandle *>(node->_transmitBuffer.data());
+
+						auto irq_lock = frg::guard(&irqMutex());
+						Universe::Guard lock(universe->lock);
+
+						for(size_t j = 0; j < n; j++)
+							handles[j] = universe->attachDescriptor(lock,
+									std::move(descriptors[j]));
+					}
+
+					item->helHandlesResult = {translateError(node->error()), 0, n};
+					item->mainSource.setup(&item->helHandlesResult, sizeof(HelHandlesResultNoFlex));
+					item->dataSource.setup(node->_transmitBuffer.data(), n * sizeof(HelHandle));
+					link(&item->mainSource);
+					link(&item->dataSource);
 				}else{
 					// This cannot happen since we validate recipes at submit time.
 					__builtin_trap();
@@ -2502,6 +3096,31 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				// Empty packets are handled by the generic stream code.
 				assert(recipe->length);
 
+				if((recipe->flags & kHelItemDirect)
+						&& recipe->length >= directTransferThreshold) {
+					// The receiver copies directly from our address space.
+					// Send the packet (may deallocate the peer!).
+					peer->flowQueue.put({
+						.size = recipe->length,
+						.space = thread->getAddressSpace().get(),
+						.address = reinterpret_cast<uintptr_t>(recipe->buffer),
+						.terminate = true
+					});
+
+					// Our address space must stay alive until the receiver acks.
+					auto ackPacket = co_await node->flowQueue.async_get();
+					assert(ackPacket);
+					if(ackPacket->sourceFault) {
+						node->_error = Error::fault;
+					}else if(ackPacket->fault) {
+						node->_error = Error::remoteFault;
+					}else{
+						node->_error = Error::success;
+					}
+					node->complete();
+					continue;
+				}
+
 				size_t progress = 0;
 				size_t numSent = 0;
 				size_t numAcked = 0;
@@ -2614,12 +3233,29 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 
 				size_t progress = 0;
 				bool didFault = false;
+				// Set if a direct transfer faulted on the sender's side.
+				bool didSourceFault = false;
 				// Each iteration of this loop sends one ack packet.
 				while(true) {
 					auto xferPacket = co_await node->flowQueue.async_get();
 					assert(xferPacket);
 
-					if(xferPacket->data && !didFault) {
+					if(xferPacket->space && !didFault) {
+						// Otherwise, there would have been a transmission error.
+						assert(progress + xferPacket->size <= recipe->length);
+
+						auto transfer = co_await xferPacket->space->transferPartialSpace(
+								xferPacket->address, thread->getAddressSpace().get(),
+								reinterpret_cast<uintptr_t>(recipe->buffer) + progress,
+								xferPacket->size, thread->mainWorkQueue()->take());
+						if(transfer.progress == xferPacket->size) {
+							progress += transfer.progress;
+						}else if(transfer.sourceFault) {
+							didSourceFault = true;
+						}else{
+							didFault = true;
+						}
+					}else if(xferPacket->data && !didFault) {
 						// Otherwise, there would have been a transmission error.
 						assert(progress + xferPacket->size <= recipe->length);
 
@@ -2639,6 +3275,10 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 							// Ack the packet (may deallocate the peer!).
 							peer->flowQueue.put({ .terminate = true, .fault = true, });
 							node->_error = Error::fault;
+						}else if(didSourceFault) {
+							// Ack the packet (may deallocate the peer!).
+							peer->flowQueue.put({ .terminate = true, .sourceFault = true });
+							node->_error = Error::remoteFault;
 						}else{
 							// Ack the packet (may deallocate the peer!).
 							peer->flowQueue.put({ .terminate = true });
@@ -2678,6 +3318,28 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 	return kHelErrNone;
 }
 
+HelError helSubmitBatch(const HelSubmission *submissions, size_t count,
+		size_t *numSubmitted) {
+	size_t n = 0;
+	for(; n < count; n++) {
+		HelSubmission submission;
+		if(!readUserObject(submissions + n, submission)) {
+			*numSubmitted = n;
+			return kHelErrFault;
+		}
+
+		auto error = helSubmitAsync(submission.handle, submission.actions, submission.count,
+				submission.queue, submission.context, submission.flags);
+		if(error) {
+			*numSubmitted = n;
+			return error;
+		}
+	}
+
+	*numSubmitted = n;
+	return kHelErrNone;
+}
+
 HelError helShutdownLane(HelHandle handle) {
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
@@ -2726,7 +3388,8 @@ HelError helFutexWait(int *pointer, int expected, int64_t deadline) {
 							cancellation);
 				},
 				[&] (async::cancellation_token cancellation) {
-					return generalTimerEngine()->sleep(deadline, cancellation);
+					return generalTimerEngine()->timeout(deadline, cancellation,
+							thisThread->timerSlack());
 				}
 			)
 		);
@@ -2747,6 +3410,119 @@ HelError helFutexWake(int *pointer) {
 	return kHelErrNone;
 }
 
+HelError helFutexRequeue(int *pointer, int expected, int *target,
+		unsigned int wakeCount, unsigned int requeueCount) {
+	auto thisThread = getCurrentThread();
+	auto space = thisThread->getAddressSpace();
+
+	auto targetOrError = space->resolveGlobalFutex(reinterpret_cast<uintptr_t>(target));
+	if(!targetOrError)
+		return kHelErrFault;
+
+	auto futexOrError = Thread::asyncBlockCurrent(
+			space->grabGlobalFutex(reinterpret_cast<uintptr_t>(pointer),
+					thisThread->mainWorkQueue()->take()));
+	if(!futexOrError)
+		return kHelErrFault;
+	GlobalFutex futex = std::move(futexOrError.value());
+
+	auto outcome = getGlobalFutexRealm()->requeue(std::move(futex), expected,
+			targetOrError.value(), wakeCount, requeueCount);
+	if(!outcome) {
+		assert(outcome.error() == Error::futexRace);
+		return kHelErrIllegalState;
+	}
+
+	return kHelErrNone;
+}
+
+static_assert(kHelFutexPiOwnerMask == FutexRealm::piOwnerMask);
+static_assert(kHelFutexPiWaiters == FutexRealm::piWaitersBit);
+
+HelError helGetFutexOwnerId(unsigned int *id) {
+	auto thisThread = getCurrentThread();
+	*id = thisThread->futexOwnerId();
+	return kHelErrNone;
+}
+
+HelError helFutexLockPi(int *pointer, int64_t deadline) {
+	auto thisThread = getCurrentThread();
+	auto space = thisThread->getAddressSpace();
+
+	if(deadline < 0 && deadline != -1)
+		return kHelErrIllegalArgs;
+
+	auto futexOrError = Thread::asyncBlockCurrent(
+			space->grabGlobalFutex(reinterpret_cast<uintptr_t>(pointer),
+					thisThread->mainWorkQueue()->take()));
+	if(!futexOrError)
+		return kHelErrFault;
+	GlobalFutex futex = std::move(futexOrError.value());
+
+	auto thread = thisThread.lock();
+	smarter::shared_ptr<ScheduleEntity> waiter{thread, thread.get()};
+	auto resolve = [] (uint32_t id) -> smarter::shared_ptr<ScheduleEntity> {
+		auto owner = Thread::findByFutexOwnerId(id);
+		if(!owner)
+			return nullptr;
+		return smarter::shared_ptr<ScheduleEntity>{owner, owner.get()};
+	};
+
+	Error error;
+	if(deadline < 0) {
+		error = Thread::asyncBlockCurrent(
+			getGlobalFutexRealm()->lockPi(std::move(futex), std::move(waiter),
+					thisThread->futexOwnerId(), resolve)
+		);
+	}else{
+		Thread::asyncBlockCurrent(
+			async::race_and_cancel(
+				[&] (async::cancellation_token cancellation) {
+					return async::transform(
+						getGlobalFutexRealm()->lockPi(std::move(futex), std::move(waiter),
+								thisThread->futexOwnerId(), resolve, cancellation),
+						[&] (Error outcome) {
+							error = outcome;
+						}
+					);
+				},
+				[&] (async::cancellation_token cancellation) {
+					return generalTimerEngine()->timeout(deadline, cancellation,
+							thisThread->timerSlack());
+				}
+			)
+		);
+	}
+
+	if(error == Error::illegalState)
+		return kHelErrIllegalState;
+	if(error == Error::cancelled)
+		return kHelErrCancelled;
+	assert(error == Error::success);
+	return kHelErrNone;
+}
+
+HelError helFutexUnlockPi(int *pointer) {
+	auto thisThread = getCurrentThread();
+	auto space = thisThread->getAddressSpace();
+
+	auto futexOrError = Thread::asyncBlockCurrent(
+			space->grabGlobalFutex(reinterpret_cast<uintptr_t>(pointer),
+					thisThread->mainWorkQueue()->take()));
+	if(!futexOrError)
+		return kHelErrFault;
+	GlobalFutex futex = std::move(futexOrError.value());
+
+	auto outcome = getGlobalFutexRealm()->unlockPi(std::move(futex),
+			thisThread->futexOwnerId());
+	if(!outcome) {
+		assert(outcome.error() == Error::illegalState);
+		return kHelErrIllegalState;
+	}
+
+	return kHelErrNone;
+}
+
 HelError helCreateOneshotEvent(HelHandle *handle) {
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
@@ -2871,6 +3647,36 @@ HelError helAcknowledgeIrq(HelHandle handle, uint32_t flags, uint64_t sequence)
 	}
 }
 
+HelError helSetIrqAffinity(HelHandle handle, int cpu) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	smarter::shared_ptr<IrqObject> irq;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		auto irq_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		if(!irq_wrapper)
+			return kHelErrNoDescriptor;
+		if(!irq_wrapper->is<IrqDescriptor>())
+			return kHelErrBadDescriptor;
+		irq = irq_wrapper->get<IrqDescriptor>().irq;
+	}
+
+	auto pin = irq->getPin();
+	if(!pin)
+		return kHelErrIllegalState;
+
+	auto error = pin->setAffinity(cpu);
+	if(error == Error::illegalArgs)
+		return kHelErrIllegalArgs;
+	if(error == Error::noHardwareSupport)
+		return kHelErrNoHardwareSupport;
+	assert(error == Error::success);
+	return kHelErrNone;
+}
+
 HelError helSubmitAwaitEvent(HelHandle handle, uint64_t sequence,
 		HelHandle queue_handle, uintptr_t context) {
 	struct IrqClosure final : IpcNode {
@@ -2995,6 +3801,10 @@ HelError helSubmitAwaitEvent(HelHandle handle, uint64_t sequence,
 		auto event = descriptor.get<BitsetEventDescriptor>().event;
 		EventClosure::issue(std::move(event), sequence,
 				std::move(queue), context);
+	}else if(descriptor.is<MemoryAccountDescriptor>()) {
+		auto event = descriptor.get<MemoryAccountDescriptor>().account->event();
+		EventClosure::issue(std::move(event), sequence,
+				std::move(queue), context);
 	}else{
 		return kHelErrBadDescriptor;
 	}
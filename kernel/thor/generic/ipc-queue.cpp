@@ -102,29 +102,38 @@ coroutine<void> IpcQueue::_runQueue() {
 			if(!_anyNodes.load(std::memory_order_relaxed))
 				continue;
 
-			// Check if there is enough space in the current chunk.
-			IpcNode *node;
-			uintptr_t progress;
-			{
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&_mutex);
+			// Write as many elements as possible to the chunk before updating the
+			// progress futex. This way, user-space is woken up (at most) once per batch.
+			NodeList batch;
+			size_t numBatched = 0;
+			bool retireChunk = false;
+			auto progress = _currentProgress;
+			while(numBatched < maxBatchSize) {
+				IpcNode *node;
+				{
+					auto irqLock = frg::guard(&irqMutex());
+					auto lock = frg::guard(&_mutex);
+
+					if(_nodeQueue.empty())
+						break;
+					node = _nodeQueue.front();
+				}
 
-				assert(!_nodeQueue.empty());
-				node = _nodeQueue.front();
-				progress = _currentProgress;
-			}
+				// Compute the overall length of the element.
+				size_t length = 0;
+				for(auto sgSource = node->_source; sgSource; sgSource = sgSource->link)
+					length += (sgSource->size + 7) & ~size_t(7);
+				// Submitters must reject elements that do not fit into a chunk (see validSize()).
+				assert(sizeof(ElementStruct) + length <= _chunkSize);
 
-			// Compute the overall length of the element.
-			size_t length = 0;
-			for(auto sgSource = _nodeQueue.front()->_source; sgSource; sgSource = sgSource->link)
-				length += (sgSource->size + 7) & ~size_t(7);
-			assert(length <= _chunkSize);
+				// Check if we need to retire the current chunk.
+				if(progress + sizeof(ElementStruct) + length > _chunkSize) {
+					retireChunk = true;
+					break;
+				}
 
-			// Check if we need to retire the current chunk.
-			bool emitElement = true;
-			if(progress + length <= _chunkSize) {
 				// Emit the next element to the current chunk.
-				auto elementOffset = offsetof(ChunkStruct, buffer) + _currentProgress;
+				auto elementOffset = offsetof(ChunkStruct, buffer) + progress;
 				assert(!(elementOffset & 0x7));
 
 				ElementStruct element;
@@ -140,18 +149,28 @@ coroutine<void> IpcQueue::_runQueue() {
 							sgSource->pointer, sgSource->size);
 					sgOffset += (sgSource->size + 7) & ~size_t(7);
 				}
-			}else{
-				emitElement = false;
-			}
+				progress += sizeof(ElementStruct) + length;
+
+				// Take the node out of the queue.
+				{
+					auto irqLock = frg::guard(&irqMutex());
+					auto lock = frg::guard(&_mutex);
 
-			// Update the progress futex.
-			unsigned int newProgressWord;
-			if(emitElement) {
-				newProgressWord = progress + sizeof(ElementStruct) + length;
-			}else{
-				newProgressWord = progress | kProgressDone;
+					_nodeQueue.pop_front();
+
+					assert(_anyNodes.load(std::memory_order_relaxed));
+					if(_nodeQueue.empty())
+						_anyNodes.store(false, std::memory_order_relaxed);
+				}
+				batch.push_back(node);
+				numBatched++;
 			}
 
+			// Update the progress futex (once for the entire batch).
+			unsigned int newProgressWord = progress;
+			if(retireChunk)
+				newProgressWord |= kProgressDone;
+
 			auto progressFutexWord = __atomic_exchange_n(&chunkHead->progressFutex,
 					newProgressWord, __ATOMIC_RELEASE);
 			// If user-space modifies any non-flags field, that's a contract violation.
@@ -162,29 +181,23 @@ coroutine<void> IpcQueue::_runQueue() {
 			}
 
 			// Update our internal state and retire the chunk.
-			if(!emitElement) {
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&_mutex);
-
-				_currentIndex = ((_currentIndex + 1) & kHeadMask);
-				_currentProgress = 0;
-				break;
-			}
-
-			// Update our internal state and retire the node.
 			{
 				auto irqLock = frg::guard(&irqMutex());
 				auto lock = frg::guard(&_mutex);
 
-				_currentProgress += sizeof(ElementStruct) + length;
-				_nodeQueue.pop_front();
-
-				assert(_anyNodes.load(std::memory_order_relaxed));
-				if(_nodeQueue.empty())
-					_anyNodes.store(false, std::memory_order_relaxed);
+				if(retireChunk) {
+					_currentIndex = ((_currentIndex + 1) & kHeadMask);
+					_currentProgress = 0;
+				}else{
+					_currentProgress = progress;
+				}
 			}
 
-			node->complete();
+			while(!batch.empty())
+				batch.pop_front()->complete();
+
+			if(retireChunk)
+				break;
 		}
 	}
 }
@@ -8,6 +8,40 @@ namespace thor {
 
 namespace {
 	constexpr bool logService = false;
+
+	using IrqPinList = frg::intrusive_list<
+		IrqPin,
+		frg::locate_member<
+			IrqPin,
+			frg::default_list_hook<IrqPin>,
+			&IrqPin::globalHook
+		>
+	>;
+
+	// Protected by globalPinListLock; initialized on first use.
+	constinit frg::manual_box<IrqPinList> globalPinList = {};
+	constinit bool globalPinListInitialized = false;
+	IrqSpinlock globalPinListLock;
+}
+
+frg::vector<IrqPinStats, KernelAlloc> getIrqPinStats() {
+	frg::vector<IrqPinStats, KernelAlloc> stats{*kernelAlloc};
+
+	auto guard = frg::guard(&globalPinListLock);
+	if(!globalPinListInitialized)
+		return stats;
+	for(auto pin : *globalPinList) {
+		auto lock = frg::guard(&pin->_mutex);
+		frg::vector<uint64_t, KernelAlloc> raises{*kernelAlloc};
+		for(auto count : pin->_raiseCounts)
+			raises.push_back(count);
+		stats.push_back(IrqPinStats{
+			.name = pin->name(),
+			.affinity = pin->_affinity,
+			.raises = std::move(raises)
+		});
+	}
+	return stats;
 }
 
 // --------------------------------------------------------
@@ -123,6 +157,15 @@ IrqPin::IrqPin(frg::string<KernelAlloc> name)
 : _name{std::move(name)}, _strategy{IrqStrategy::null},
 		_inService{false}, _dueSinks{0},
 		_maskState{0} {
+	{
+		auto guard = frg::guard(&globalPinListLock);
+		if(!globalPinListInitialized) {
+			globalPinList.initialize();
+			globalPinListInitialized = true;
+		}
+		globalPinList->push_back(this);
+	}
+
 	[] (IrqPin *self, enable_detached_coroutine = {}) -> void {
 		while(true) {
 			co_await self->_unstallEvent.async_wait_if([&] () -> bool {
@@ -164,6 +207,24 @@ IrqPin::IrqPin(frg::string<KernelAlloc> name)
 	}(this);
 }
 
+Error IrqPin::setAffinity(int cpu) {
+	if(cpu < 0 || cpu >= getCpuCount())
+		return Error::illegalArgs;
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	if(auto error = retarget(cpu); error != Error::success)
+		return error;
+	infoLogger() << "thor: Steering IRQ " << _name << " to CPU " << cpu << frg::endlog;
+	_affinity = cpu;
+	return Error::success;
+}
+
+Error IrqPin::retarget(int) {
+	return Error::noHardwareSupport;
+}
+
 void IrqPin::configure(IrqConfiguration desired) {
 	assert(desired.specified());
 
@@ -189,6 +250,11 @@ void IrqPin::raise() {
 	assert(!intsAreEnabled());
 	auto lock = frg::guard(&_mutex);
 
+	size_t cpu = getCpuData()->cpuIndex;
+	if(cpu >= _raiseCounts.size())
+		_raiseCounts.resize(cpu + 1, 0);
+	_raiseCounts[cpu]++;
+
 	if(_strategy == IrqStrategy::null) {
 		infoLogger() << "\e[35mthor: Unconfigured IRQ was raised\e[39m" << frg::endlog;
 		dumpHardwareState();
@@ -444,6 +510,34 @@ void IrqPin::_updateMask() {
 	}
 }
 
+// --------------------------------------------------------
+// MsiPin
+// --------------------------------------------------------
+
+void MsiPin::setProgrammer(MsiProgrammer *programmer, size_t index) {
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(pinMutex());
+
+	_programmer = programmer;
+	_programmerIndex = index;
+}
+
+void MsiPin::maskAtDevice(bool masked) {
+	// IrqPin unmasks after every IRQ; avoid the MMIO access if nothing changes.
+	if(!_programmer || masked == _maskedAtDevice)
+		return;
+	_programmer->maskMsi(_programmerIndex, masked);
+	_maskedAtDevice = masked;
+}
+
+Error MsiPin::retarget(int cpu) {
+	if(auto error = retargetMessage(cpu); error != Error::success)
+		return error;
+	if(_programmer)
+		_programmer->programMsi(this, _programmerIndex);
+	return Error::success;
+}
+
 // --------------------------------------------------------
 // IrqObject
 // --------------------------------------------------------
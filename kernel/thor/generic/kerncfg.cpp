@@ -1,9 +1,15 @@
 #include <frg/string.hpp>
 
 #include <thor-internal/universe.hpp>
+#include <thor-internal/compressed-store.hpp>
 #include <thor-internal/coroutine.hpp>
+#include <thor-internal/cpu-data.hpp>
 #include <thor-internal/fiber.hpp>
+#include <thor-internal/irq.hpp>
 #include <thor-internal/kerncfg.hpp>
+#include <thor-internal/lock-stats.hpp>
+#include <thor-internal/memory-view.hpp>
+#include <thor-internal/metrics.hpp>
 #include <thor-internal/ostrace.hpp>
 #include <thor-internal/profile.hpp>
 #include <thor-internal/stream.hpp>
@@ -47,6 +53,184 @@ coroutine<Error> handleReq(LaneHandle boundLane) {
 		memcpy(cmdlineBuffer.data(), kernelCommandLine->data(), kernelCommandLine->size());
 		auto cmdlineError = co_await SendBufferSender{lane, std::move(cmdlineBuffer)};
 		assert(cmdlineError == Error::success && "Unexpected mbus transaction");
+	}else if(req.req_type() == managarm::kerncfg::CntReqType::GET_CPU_STATS) {
+		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+		resp.set_error(managarm::kerncfg::Error::SUCCESS);
+
+		for(int i = 0; i < getCpuCount(); i++) {
+			managarm::kerncfg::CpuStats<KernelAlloc> stats(*kernelAlloc);
+			stats.set_cpu_index(i);
+
+			auto heapStats = getHeapCacheStats(i);
+			stats.set_heap_alloc_hits(heapStats.allocHits);
+			stats.set_heap_alloc_misses(heapStats.allocMisses);
+			stats.set_heap_free_hits(heapStats.freeHits);
+			stats.set_heap_free_misses(heapStats.freeMisses);
+
+			auto scheduler = &getCpuData(i)->scheduler;
+			stats.set_idle_nanos(scheduler->idleNanos());
+			stats.set_idle_wakeups(scheduler->idleWakeups());
+
+			resp.add_cpu_stats(std::move(stats));
+		}
+
+		frg::string<KernelAlloc> ser(*kernelAlloc);
+		resp.SerializeToString(&ser);
+		frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, ser.size()};
+		memcpy(respBuffer.data(), ser.data(), ser.size());
+		auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+		assert(respError == Error::success && "Unexpected mbus transaction");
+	}else if(req.req_type() == managarm::kerncfg::CntReqType::GET_MEMORY_STATS) {
+		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+		resp.set_error(managarm::kerncfg::Error::SUCCESS);
+		resp.set_size(physicalAllocator->numTotalPages());
+
+		for(int i = 0; i < physicalAllocator->numNodes(); i++) {
+			managarm::kerncfg::NodeMemoryStats<KernelAlloc> stats(*kernelAlloc);
+			stats.set_node(i);
+			stats.set_total_pages(physicalAllocator->numTotalPagesOfNode(i));
+			stats.set_used_pages(physicalAllocator->numUsedPagesOfNode(i));
+			resp.add_node_stats(std::move(stats));
+		}
+
+		frg::string<KernelAlloc> ser(*kernelAlloc);
+		resp.SerializeToString(&ser);
+		frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, ser.size()};
+		memcpy(respBuffer.data(), ser.data(), ser.size());
+		auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+		assert(respError == Error::success && "Unexpected mbus transaction");
+	}else if(req.req_type() == managarm::kerncfg::CntReqType::GET_CACHE_STATS) {
+		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+		resp.set_error(managarm::kerncfg::Error::SUCCESS);
+
+		auto cacheStats = getCacheStats();
+		resp.set_active_pages(cacheStats.activePages);
+		resp.set_inactive_pages(cacheStats.inactivePages);
+		for(auto &bundle : cacheStats.bundles) {
+			managarm::kerncfg::CacheBundleStats<KernelAlloc> stats(*kernelAlloc);
+			stats.set_bundle_id(bundle.id);
+			stats.set_active_pages(bundle.activePages);
+			stats.set_inactive_pages(bundle.inactivePages);
+			stats.set_activations(bundle.activations);
+			stats.set_evictions(bundle.evictions);
+			resp.add_cache_stats(std::move(stats));
+		}
+
+		auto storeStats = getCompressedStoreStats();
+		managarm::kerncfg::SwapStats<KernelAlloc> swapStats(*kernelAlloc);
+		swapStats.set_stored_pages(storeStats.storedPages);
+		swapStats.set_zero_pages(storeStats.zeroPages);
+		swapStats.set_compressed_bytes(storeStats.compressedBytes);
+		swapStats.set_pool_limit(storeStats.poolLimit);
+		swapStats.set_compressions(storeStats.compressions);
+		swapStats.set_decompressions(storeStats.decompressions);
+		swapStats.set_rejections(storeStats.rejections);
+		resp.set_swap_stats(std::move(swapStats));
+
+		frg::string<KernelAlloc> ser(*kernelAlloc);
+		resp.SerializeToString(&ser);
+		frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, ser.size()};
+		memcpy(respBuffer.data(), ser.data(), ser.size());
+		auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+		assert(respError == Error::success && "Unexpected mbus transaction");
+	}else if(req.req_type() == managarm::kerncfg::CntReqType::GET_IRQ_STATS) {
+		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+		resp.set_error(managarm::kerncfg::Error::SUCCESS);
+
+		for(auto &pin : getIrqPinStats()) {
+			managarm::kerncfg::IrqStats<KernelAlloc> stats(*kernelAlloc);
+			stats.set_name(std::move(pin.name));
+			stats.set_affinity(pin.affinity);
+			for(size_t i = 0; i < pin.raises.size(); i++) {
+				if(!pin.raises[i])
+					continue;
+				managarm::kerncfg::IrqCpuStats<KernelAlloc> cpuStats(*kernelAlloc);
+				cpuStats.set_cpu_index(i);
+				cpuStats.set_raises(pin.raises[i]);
+				stats.add_cpu_stats(std::move(cpuStats));
+			}
+			resp.add_irq_stats(std::move(stats));
+		}
+
+		frg::string<KernelAlloc> ser(*kernelAlloc);
+		resp.SerializeToString(&ser);
+		frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, ser.size()};
+		memcpy(respBuffer.data(), ser.data(), ser.size());
+		auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+		assert(respError == Error::success && "Unexpected mbus transaction");
+	}else if(req.req_type() == managarm::kerncfg::CntReqType::GET_LOCK_STATS) {
+		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+		resp.set_error(managarm::kerncfg::Error::SUCCESS);
+
+#ifdef THOR_LOCK_STATS
+		for(auto cls : allLockClasses()) {
+			managarm::kerncfg::LockStats<KernelAlloc> stats(*kernelAlloc);
+			stats.set_name(frg::string<KernelAlloc>{*kernelAlloc, cls->name});
+			stats.set_acquisitions(cls->acquisitions.load(std::memory_order_relaxed));
+			stats.set_contended_acquisitions(
+					cls->contendedAcquisitions.load(std::memory_order_relaxed));
+			stats.set_total_spin_ticks(cls->totalSpinTicks.load(std::memory_order_relaxed));
+			stats.set_max_hold_ticks(cls->maxHoldTicks.load(std::memory_order_relaxed));
+			for(auto &bucket : cls->spinHistogram)
+				stats.add_spin_histogram(bucket.load(std::memory_order_relaxed));
+			resp.add_lock_stats(std::move(stats));
+		}
+#endif
+
+		frg::string<KernelAlloc> ser(*kernelAlloc);
+		resp.SerializeToString(&ser);
+		frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, ser.size()};
+		memcpy(respBuffer.data(), ser.data(), ser.size());
+		auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+		assert(respError == Error::success && "Unexpected mbus transaction");
+	}else if(req.req_type() == managarm::kerncfg::CntReqType::GET_METRICS) {
+		managarm::kerncfg::MetricsSnapshot<KernelAlloc> snapshot(*kernelAlloc);
+		for(auto metric = firstMetric(); metric; metric = metric->next()) {
+			managarm::kerncfg::Metric<KernelAlloc> msg(*kernelAlloc);
+			msg.set_name(frg::string<KernelAlloc>{*kernelAlloc, metric->name()});
+			msg.set_description(frg::string<KernelAlloc>{*kernelAlloc, metric->description()});
+			switch(metric->type()) {
+			case MetricType::counter:
+				msg.set_type(managarm::kerncfg::MetricType::COUNTER);
+				msg.set_counter_value(static_cast<CounterMetric *>(metric)->read());
+				break;
+			case MetricType::gauge:
+				msg.set_type(managarm::kerncfg::MetricType::GAUGE);
+				msg.set_gauge_value(static_cast<GaugeMetric *>(metric)->read());
+				break;
+			case MetricType::histogram: {
+				auto histogram = static_cast<HistogramMetric *>(metric);
+				msg.set_type(managarm::kerncfg::MetricType::HISTOGRAM);
+				for(int i = 0; i < HistogramMetric::numBuckets; i++)
+					msg.add_buckets(histogram->readBucket(i));
+				msg.set_sum(histogram->readSum());
+				break;
+			}
+			}
+			snapshot.add_metrics(std::move(msg));
+		}
+
+		frg::string<KernelAlloc> snapshotSer(*kernelAlloc);
+		snapshot.SerializeToString(&snapshotSer);
+
+		// The snapshot is only sent if it fits; otherwise, userspace retries with
+		// a buffer of the returned size.
+		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+		resp.set_error(managarm::kerncfg::Error::SUCCESS);
+		resp.set_size(snapshotSer.size());
+
+		frg::string<KernelAlloc> ser(*kernelAlloc);
+		resp.SerializeToString(&ser);
+		frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, ser.size()};
+		memcpy(respBuffer.data(), ser.data(), ser.size());
+		auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+		assert(respError == Error::success && "Unexpected mbus transaction");
+
+		size_t sendSize = (snapshotSer.size() <= req.size()) ? snapshotSer.size() : 0;
+		frg::unique_memory<KernelAlloc> snapshotBuffer{*kernelAlloc, sendSize};
+		memcpy(snapshotBuffer.data(), snapshotSer.data(), sendSize);
+		auto snapshotError = co_await SendBufferSender{lane, std::move(snapshotBuffer)};
+		assert(snapshotError == Error::success && "Unexpected mbus transaction");
 	}else{
 		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
 		resp.set_error(managarm::kerncfg::Error::ILLEGAL_REQUEST);
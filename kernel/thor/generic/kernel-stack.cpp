@@ -1,5 +1,7 @@
 #include <thor-internal/arch/paging.hpp>
+#include <thor-internal/cpu-data.hpp>
 #include <thor-internal/debug.hpp>
+#include <thor-internal/kasan.hpp>
 #include <thor-internal/kernel_heap.hpp>
 #include <thor-internal/kernel-stack.hpp>
 #include <thor-internal/physical.hpp>
@@ -7,6 +9,18 @@
 namespace thor {
 
 UniqueKernelStack UniqueKernelStack::make() {
+	{
+		auto irqLock = frg::guard(&irqMutex());
+
+		auto cache = &getCpuData()->kernelStackCache;
+		if(cache->numStacks) {
+			auto top = cache->stacks[--cache->numStacks];
+			// The previous owner may have left poisoned stack frames behind.
+			cleanKasanShadow(top - kSize, kSize);
+			return UniqueKernelStack(top);
+		}
+	}
+
 	size_t guardedSize = kSize + kPageSize;
 	auto pointer = KernelVirtualMemory::global().allocate(guardedSize);
 
@@ -25,8 +39,22 @@ UniqueKernelStack::~UniqueKernelStack() {
 	if(!_base)
 		return;
 
+	// Objects may have been embedded below the (page-aligned) top of the stack.
+	auto top = reinterpret_cast<char *>(
+			(reinterpret_cast<uintptr_t>(_base) + kPageSize - 1) & ~(kPageSize - 1));
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+
+		auto cache = &getCpuData()->kernelStackCache;
+		if(cache->numStacks < KernelStackCache::maxStacks) {
+			cache->stacks[cache->numStacks++] = top;
+			return;
+		}
+	}
+
 	size_t guardedSize = kSize + kPageSize;
-	auto address = reinterpret_cast<uintptr_t>(_base - guardedSize);
+	auto address = reinterpret_cast<uintptr_t>(top - guardedSize);
 	for(size_t offset = 0; offset < kSize; offset += kPageSize) {
 		PhysicalAddr physical = KernelPageSpace::global().unmapSingle4k(
 				address + guardedSize - kSize + offset);
@@ -0,0 +1,21 @@
+#include <thor-internal/lock-stats.hpp>
+
+namespace thor {
+
+constinit LockClass slabLockClass{"slab"};
+constinit LockClass physicalLockClass{"physical"};
+constinit LockClass futexLockClass{"futex"};
+
+namespace {
+	LockClass *const lockClasses[] = {
+		&slabLockClass,
+		&physicalLockClass,
+		&futexLockClass
+	};
+}
+
+frg::span<LockClass *const> allLockClasses() {
+	return {lockClasses, sizeof(lockClasses) / sizeof(*lockClasses)};
+}
+
+} // namespace thor
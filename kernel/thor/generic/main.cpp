@@ -1,16 +1,20 @@
 #include <algorithm>
 #include <eir/interface.hpp>
+#include <frg/optional.hpp>
 #include <frg/string.hpp>
 #include <elf.h>
 #include <thor-internal/arch/system.hpp>
+#include <thor-internal/boot-profile.hpp>
 #include <thor-internal/debug.hpp>
 #include <thor-internal/fiber.hpp>
+#include <thor-internal/heap-guard.hpp>
 #include <thor-internal/framebuffer/fb.hpp>
 #include <thor-internal/initgraph.hpp>
 #include <thor-internal/irq.hpp>
 #include <thor-internal/kerncfg.hpp>
 #include <thor-internal/kernlet.hpp>
 #include <thor-internal/main.hpp>
+#include <thor-internal/metrics.hpp>
 #include <thor-internal/module.hpp>
 #include <thor-internal/pci/pci.hpp>
 #include <thor-internal/physical.hpp>
@@ -280,6 +284,9 @@ extern "C" void thorMain() {
 		KernelFiber::asyncBlockCurrent(runServer("sbin/clocktracker"));
 		KernelFiber::asyncBlockCurrent(runServer("sbin/posix-subsystem"));
 		KernelFiber::asyncBlockCurrent(runServer("sbin/virtio-console"));
+
+		// The kernel's part of the boot process is done.
+		emitBootProfile();
 	});
 
 	Scheduler::resume(getCpuData()->wqFiber);
@@ -330,12 +337,47 @@ extern "C" void handleProtectionFault(FaultImageAccessor image) {
 			<< "    Faulting segment: " << (void *)*image.code() << frg::endlog;
 }
 
+// Adds the run time that elapses during the lifetime of this object to the thread's kernel time.
+struct KernelTimeScope {
+	KernelTimeScope(Thread *thread)
+	: _thread{thread} {
+		auto irqLock = frg::guard(&irqMutex());
+		_startRunTime = localScheduler()->liveRunTimeOfCurrent();
+	}
+
+	KernelTimeScope(const KernelTimeScope &) = delete;
+
+	KernelTimeScope &operator= (const KernelTimeScope &) = delete;
+
+	~KernelTimeScope() {
+		auto irqLock = frg::guard(&irqMutex());
+		// The thread might have migrated, but the run time still increases monotonically.
+		auto runTime = localScheduler()->liveRunTimeOfCurrent();
+		if(runTime > _startRunTime)
+			_thread->accountKernelTime(runTime - _startRunTime);
+	}
+
+private:
+	Thread *_thread;
+	uint64_t _startRunTime;
+};
+
+namespace {
+	THOR_DEFINE_COUNTER_METRIC(pageFaultMetric, "thor.page-faults",
+			"Page faults, including faults on user access from the kernel");
+	THOR_DEFINE_COUNTER_METRIC(blockingPageFaultMetric, "thor.page-faults.blocking",
+			"Page faults that had to block (e.g., to wait for I/O)");
+}
+
 void handlePageFault(FaultImageAccessor image, uintptr_t address, Word errorCode) {
+	const Word kPfWrite = 2;
+	if(image.inKernelDomain())
+		checkHeapGuardFault(address, *image.ip(), errorCode & kPfWrite);
+
 	smarter::borrowed_ptr<Thread> this_thread = getCurrentThread();
 	auto address_space = this_thread->getAddressSpace();
 
 	const Word kPfAccess = 1;
-	const Word kPfWrite = 2;
 	const Word kPfUser = 4;
 	const Word kPfBadTable = 8;
 	const Word kPfInstruction = 16;
@@ -389,9 +431,21 @@ void handlePageFault(FaultImageAccessor image, uintptr_t address, Word errorCode
 	if(errorCode & kPfInstruction)
 		flags |= AddressSpace::kFaultExecute;
 
+	// Faults in the kernel domain (i.e., on user access) are already accounted as syscalls.
+	frg::optional<KernelTimeScope> kernelTime;
+	if(!image.inKernelDomain())
+		kernelTime.emplace(this_thread.get());
+
 	auto wq = this_thread->pagingWorkQueue();
-	if(Thread::asyncBlockCurrent(
-			address_space->handleFault(address, flags, wq->take()), wq))
+	auto switchesBefore = this_thread->numVoluntarySwitches();
+	bool handled = Thread::asyncBlockCurrent(
+			address_space->handleFault(address, flags, wq->take()), wq);
+	bool blocked = this_thread->numVoluntarySwitches() != switchesBefore;
+	this_thread->accountPageFault(blocked);
+	pageFaultMetric.increment();
+	if(blocked)
+		blockingPageFaultMetric.increment();
+	if(handled)
 		return;
 
 	// If we get here, the page fault could not be handled.
@@ -487,6 +541,53 @@ extern "C" void thorImplementNoThreadIrqs() {
 	assert(!"Implement no-thread IRQ stubs");
 }
 
+namespace {
+	// Handles frequent syscalls that never block and return quickly. These calls only
+	// run worklets if some are pending. Unless worklets run, helNop and helGetClock
+	// skip kernel time accounting (i.e., they are accounted as user time).
+	// Returns false for all other syscalls.
+	bool handleFastSyscall(Thread *thisThread, SyscallImageAccessor image) {
+		Word arg0 = *image.in0();
+		Word arg1 = *image.in1();
+		Word arg2 = *image.in2();
+		Word arg3 = *image.in3();
+		Word arg4 = *image.in4();
+		Word arg5 = *image.in5();
+
+		frg::optional<KernelTimeScope> kernelTime;
+		switch(*image.number()) {
+		case kHelCallNop: {
+			*image.error() = helNop();
+		} break;
+		case kHelCallGetClock: {
+			uint64_t counter;
+			*image.error() = helGetClock(&counter);
+			*image.out0() = counter;
+		} break;
+		case kHelCallFutexWake: {
+			kernelTime.emplace(thisThread);
+			*image.error() = helFutexWake((int *)arg0);
+		} break;
+		case kHelCallSubmitAsync: {
+			kernelTime.emplace(thisThread);
+			*image.error() = helSubmitAsync((HelHandle)arg0, (HelAction *)arg1,
+					(size_t)arg2, (HelHandle)arg3, (uintptr_t)arg4, (uint32_t)arg5);
+		} break;
+		default:
+			return false;
+		}
+
+		if(thisThread->mainWorkQueue()->check()) {
+			if(!kernelTime)
+				kernelTime.emplace(thisThread);
+			thisThread->mainWorkQueue()->run();
+		}
+
+		Thread::raiseSignals(image);
+		return true;
+	}
+}
+
 void handleSyscall(SyscallImageAccessor image) {
 	smarter::borrowed_ptr<Thread> this_thread = getCurrentThread();
 	auto cpuData = getCpuData();
@@ -494,9 +595,15 @@ void handleSyscall(SyscallImageAccessor image) {
 		infoLogger() << this_thread.get() << " on CPU " << cpuData->cpuIndex
 				<< " syscall #" << *image.number() << frg::endlog;
 
+	if(handleFastSyscall(this_thread.get(), image))
+		return;
+
+	KernelTimeScope kernelTime{this_thread.get()};
+
 	// Run worklets before we run the syscall.
 	// This avoids useless FutexWait calls on IPC queues.
-	this_thread->mainWorkQueue()->run();
+	if(this_thread->mainWorkQueue()->check())
+		this_thread->mainWorkQueue()->run();
 
 	// TODO: The return in this code path prevents us from checking for signals!
 	if(*image.number() >= kHelCallSuper) {
@@ -520,9 +627,6 @@ void handleSyscall(SyscallImageAccessor image) {
 		Thread::interruptCurrent(kIntrPanic, image);
 	} break;
 
-	case kHelCallNop: {
-		*image.error() = helNop();
-	} break;
 	case kHelCallSubmitAsyncNop: {
 		*image.error() = helSubmitAsyncNop((HelHandle)arg0, (uintptr_t)arg1);
 	} break;
@@ -621,6 +725,24 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallUnmapMemory: {
 		*image.error() = helUnmapMemory((HelHandle)arg0, (void *)arg1, (size_t)arg2);
 	} break;
+	case kHelCallRemapMemory: {
+		void *newPointer;
+		*image.error() = helRemapMemory((HelHandle)arg0, (HelHandle)arg1,
+				(void *)arg2, (size_t)arg3, (size_t)arg4, (uint32_t)arg5, &newPointer);
+		*image.out0() = (Word)newPointer;
+	} break;
+	case kHelCallQuerySpaceStats: {
+		*image.error() = helQuerySpaceStats((HelHandle)arg0, (HelSpaceStats *)arg1);
+	} break;
+	case kHelCallMapDmaSpace: {
+		uint64_t iova;
+		*image.error() = helMapDmaSpace((HelHandle)arg0, (HelHandle)arg1,
+				(uintptr_t)arg2, (size_t)arg3, (uint32_t)arg4, &iova);
+		*image.out0() = iova;
+	} break;
+	case kHelCallUnmapDmaSpace: {
+		*image.error() = helUnmapDmaSpace((HelHandle)arg0, (uint64_t)arg1, (size_t)arg2);
+	} break;
 	case kHelCallSubmitSynchronizeSpace: {
 		*image.error() = helSubmitSynchronizeSpace((HelHandle)arg0, (void *)arg1, (size_t)arg2,
 				(HelHandle)arg3, (uintptr_t)arg4);
@@ -660,6 +782,35 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallLoadahead: {
 		*image.error() = helLoadahead((HelHandle)arg0, (uintptr_t)arg1, (size_t)arg2);
 	} break;
+	case kHelCallAdviseMemory: {
+		*image.error() = helAdviseMemory((HelHandle)arg0, (uintptr_t)arg1, (size_t)arg2,
+				(int)arg3);
+	} break;
+	case kHelCallDiscardMemory: {
+		*image.error() = helDiscardMemory((HelHandle)arg0, (uintptr_t)arg1, (size_t)arg2,
+				(uint32_t)arg3);
+	} break;
+	case kHelCallCreateMemoryAccount: {
+		HelHandle handle;
+		*image.error() = helCreateMemoryAccount((size_t)arg0, (size_t)arg1, &handle);
+		*image.out0() = handle;
+	} break;
+	case kHelCallSetMemoryAccount: {
+		*image.error() = helSetMemoryAccount((HelHandle)arg0, (HelHandle)arg1);
+	} break;
+	case kHelCallQueryMemoryAccount: {
+		*image.error() = helQueryMemoryAccount((HelHandle)arg0, (HelMemoryAccountInfo *)arg1);
+	} break;
+	case kHelCallAccessMemoryPressure: {
+		HelHandle handle;
+		*image.error() = helAccessMemoryPressure(&handle);
+		*image.out0() = handle;
+	} break;
+	case kHelCallQueryMemoryPressure: {
+		int level;
+		*image.error() = helQueryMemoryPressure(&level);
+		*image.out0() = level;
+	} break;
 	case kHelCallCreateVirtualizedSpace: {
 		HelHandle handle;
 		*image.error() = helCreateVirtualizedSpace(&handle);
@@ -695,6 +846,9 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallSetPriority: {
 		*image.error() = helSetPriority((HelHandle)arg0, (int)arg1);
 	} break;
+	case kHelCallSetSchedulingPolicy: {
+		*image.error() = helSetSchedulingPolicy((HelHandle)arg0, (int)arg1, (int)arg2);
+	} break;
 	case kHelCallYield: {
 		*image.error() = helYield();
 	} break;
@@ -720,17 +874,15 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallWriteFsBase: {
 		*image.error() = helWriteFsBase((void *)arg0);
 	} break;
-	case kHelCallGetClock: {
-		uint64_t counter;
-		*image.error() = helGetClock(&counter);
-		*image.out0() = counter;
-	} break;
 	case kHelCallSubmitAwaitClock: {
 		uint64_t async_id;
 		*image.error() = helSubmitAwaitClock((uint64_t)arg0,
 				(HelHandle)arg1, (uintptr_t)arg2, &async_id);
 		*image.out0() = async_id;
 	} break;
+	case kHelCallSetTimerSlack: {
+		*image.error() = helSetTimerSlack((HelHandle)arg0, (uint64_t)arg1);
+	} break;
 
 	case kHelCallCreateStream: {
 		HelHandle lane1;
@@ -739,9 +891,10 @@ void handleSyscall(SyscallImageAccessor image) {
 		*image.out0() = lane1;
 		*image.out1() = lane2;
 	} break;
-	case kHelCallSubmitAsync: {
-		*image.error() = helSubmitAsync((HelHandle)arg0, (HelAction *)arg1,
-				(size_t)arg2, (HelHandle)arg3, (uintptr_t)arg4, (uint32_t)arg5);
+	case kHelCallSubmitBatch: {
+		size_t numSubmitted;
+		*image.error() = helSubmitBatch((HelSubmission *)arg0, (size_t)arg1, &numSubmitted);
+		*image.out0() = numSubmitted;
 	} break;
 	case kHelCallShutdownLane: {
 		*image.error() = helShutdownLane((HelHandle)arg0);
@@ -750,8 +903,20 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallFutexWait: {
 		*image.error() = helFutexWait((int *)arg0, (int)arg1, (int64_t)arg2);
 	} break;
-	case kHelCallFutexWake: {
-		*image.error() = helFutexWake((int *)arg0);
+	case kHelCallFutexRequeue: {
+		*image.error() = helFutexRequeue((int *)arg0, (int)arg1, (int *)arg2,
+				(unsigned int)arg3, (unsigned int)arg4);
+	} break;
+	case kHelCallGetFutexOwnerId: {
+		unsigned int id;
+		*image.error() = helGetFutexOwnerId(&id);
+		*image.out0() = id;
+	} break;
+	case kHelCallFutexLockPi: {
+		*image.error() = helFutexLockPi((int *)arg0, (int64_t)arg1);
+	} break;
+	case kHelCallFutexUnlockPi: {
+		*image.error() = helFutexUnlockPi((int *)arg0);
 	} break;
 
 	case kHelCallCreateOneshotEvent: {
@@ -775,6 +940,9 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallAcknowledgeIrq: {
 		*image.error() = helAcknowledgeIrq((HelHandle)arg0, (uint32_t)arg1, (uint64_t)arg2);
 	} break;
+	case kHelCallSetIrqAffinity: {
+		*image.error() = helSetIrqAffinity((HelHandle)arg0, (int)arg1);
+	} break;
 	case kHelCallSubmitAwaitEvent: {
 		*image.error() = helSubmitAwaitEvent((HelHandle)arg0, (uint64_t)arg1,
 				(HelHandle)arg2, (uintptr_t)arg3);
@@ -815,7 +983,8 @@ void handleSyscall(SyscallImageAccessor image) {
 	}
 
 	// Run more worklets that were posted by the syscall.
-	this_thread->mainWorkQueue()->run();
+	if(this_thread->mainWorkQueue()->check())
+		this_thread->mainWorkQueue()->run();
 
 	Thread::raiseSignals(image);
 
@@ -0,0 +1,101 @@
+#include <thor-internal/fiber.hpp>
+#include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/memory-account.hpp>
+#include <thor-internal/physical.hpp>
+#include <thor-internal/timer.hpp>
+
+namespace thor {
+
+namespace {
+	constexpr bool logPressure = false;
+
+	// Interval at which the pressure is re-evaluated, in nanoseconds.
+	constexpr uint64_t pressureInterval = 100'000'000;
+
+	frg::manual_box<smarter::shared_ptr<BitsetEvent>> pressureEvent;
+	std::atomic<int> pressureLevel{static_cast<int>(MemoryPressure::none)};
+
+	// Watermarks, in percent of the total number of pages that are still free.
+	MemoryPressure computePressure() {
+		auto totalPages = physicalAllocator->numTotalPages();
+		auto freePages = physicalAllocator->numFreePages();
+		if(freePages * 100 < totalPages * 4)
+			return MemoryPressure::critical;
+		if(freePages * 100 < totalPages * 10)
+			return MemoryPressure::medium;
+		if(freePages * 100 < totalPages * 25)
+			return MemoryPressure::low;
+		return MemoryPressure::none;
+	}
+}
+
+MemoryPressure currentMemoryPressure() {
+	return static_cast<MemoryPressure>(pressureLevel.load(std::memory_order_relaxed));
+}
+
+smarter::shared_ptr<BitsetEvent> getMemoryPressureEvent() {
+	return *pressureEvent;
+}
+
+static initgraph::Task initPressureMonitor{&globalInitEngine, "generic.init-memory-pressure",
+	initgraph::Requires{getFibersAvailableStage()},
+	[] {
+		pressureEvent.initialize(smarter::allocate_shared<BitsetEvent>(*kernelAlloc));
+
+		KernelFiber::run([=] {
+			while(true) {
+				auto level = static_cast<int>(computePressure());
+				if(level != pressureLevel.load(std::memory_order_relaxed)) {
+					if(logPressure)
+						infoLogger() << "thor: Memory pressure changes to level " << level
+								<< " (" << physicalAllocator->numFreePages()
+								<< " free pages)" << frg::endlog;
+					pressureLevel.store(level, std::memory_order_relaxed);
+					(*pressureEvent)->trigger(uint32_t(1) << level);
+				}
+
+				KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(pressureInterval));
+			}
+		});
+	}
+};
+
+// --------------------------------------------------------
+// MemoryAccount.
+// --------------------------------------------------------
+
+MemoryAccount::MemoryAccount(size_t softLimit, size_t hardLimit)
+: _softLimit{softLimit}, _hardLimit{hardLimit},
+		_event{smarter::allocate_shared<BitsetEvent>(*kernelAlloc)} { }
+
+bool MemoryAccount::charge(size_t size) {
+	auto usage = _usage.load(std::memory_order_relaxed);
+	do {
+		if(_hardLimit && usage + size > _hardLimit) {
+			_event->trigger(hardLimitBit);
+			return false;
+		}
+	} while(!_usage.compare_exchange_weak(usage, usage + size, std::memory_order_relaxed));
+
+	_checkSoftLimit(usage, usage + size);
+	return true;
+}
+
+void MemoryAccount::forceCharge(size_t size) {
+	auto usage = _usage.fetch_add(size, std::memory_order_relaxed);
+	_checkSoftLimit(usage, usage + size);
+}
+
+void MemoryAccount::uncharge(size_t size) {
+	auto usage = _usage.fetch_sub(size, std::memory_order_relaxed);
+	assert(usage >= size);
+}
+
+void MemoryAccount::_checkSoftLimit(size_t oldUsage, size_t newUsage) {
+	// Only notify when the soft limit is crossed, not on every charge above it.
+	if(_softLimit && oldUsage <= _softLimit && newUsage > _softLimit)
+		_event->trigger(softLimitBit);
+}
+
+} // namespace thor
@@ -1,3 +1,4 @@
+#include <thor-internal/compressed-store.hpp>
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/main.hpp>
@@ -20,16 +21,28 @@ namespace {
 // Reclaim implementation.
 // --------------------------------------------------------
 
+// Pages are kept on two LRU lists. New pages enter the inactive list; they are only
+// promoted to the active list when they are accessed for the second time (see bumpPage()).
+// Pages are evicted from the head of the inactive list. The active list is only allowed
+// to grow as large as the inactive list; beyond that, its oldest pages are demoted.
+// This ensures that a single pass over a large file cannot flush the working set.
 struct MemoryReclaimer {
+	void addBundle(CacheBundle *bundle) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		bundle->_bundleId = _nextBundleId++;
+		_bundleList.push_back(bundle);
+	}
+
 	void addPage(CachePage *page) {
 		auto irqLock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&_mutex);
 
 		assert(!(page->flags & CachePage::reclaimRegistered));
 
-		_lruList.push_back(page);
 		page->flags |= CachePage::reclaimRegistered;
-		_cachedSize += kPageSize;
+		_pushInactive(page);
 	}
 
 	void removePage(CachePage *page) {
@@ -39,16 +52,9 @@ struct MemoryReclaimer {
 		assert(page->flags & CachePage::reclaimRegistered);
 
 		if(page->flags & CachePage::reclaimPosted) {
-			if(!(page->flags & CachePage::reclaimInflight)) {
-				auto it = page->bundle->_reclaimList.iterator_to(page);
-				page->bundle->_reclaimList.erase(it);
-			}
-
-			page->flags &= ~(CachePage::reclaimPosted | CachePage::reclaimInflight);
+			_unpost(page);
 		}else{
-			auto it = _lruList.iterator_to(page);
-			_lruList.erase(it);
-			_cachedSize -= kPageSize;
+			_unlink(page);
 		}
 		page->flags &= ~CachePage::reclaimRegistered;
 	}
@@ -60,19 +66,38 @@ struct MemoryReclaimer {
 		assert(page->flags & CachePage::reclaimRegistered);
 
 		if(page->flags & CachePage::reclaimPosted) {
-			if(!(page->flags & CachePage::reclaimInflight)) {
-				auto it = page->bundle->_reclaimList.iterator_to(page);
-				page->bundle->_reclaimList.erase(it);
-			}
-
-			page->flags &= ~(CachePage::reclaimPosted | CachePage::reclaimInflight);
-			_cachedSize += kPageSize;
+			// The page was accessed again before it could be evicted.
+			_unpost(page);
+			_pushInactive(page);
+			page->flags |= CachePage::reclaimReferenced;
+		}else if(page->flags & CachePage::reclaimActive) {
+			_unlink(page);
+			_pushActive(page);
+		}else if(page->flags & CachePage::reclaimReferenced) {
+			_unlink(page);
+			_pushActive(page);
+			page->bundle->_numActivations++;
 		}else{
-			auto it = _lruList.iterator_to(page);
-			_lruList.erase(it);
+			// Keep the position in the inactive list; otherwise, streaming accesses
+			// that touch each page twice would still push out older pages.
+			page->flags |= CachePage::reclaimReferenced;
 		}
+	}
+
+	// Moves the page to the head of the inactive list such that it is reclaimed first.
+	void demotePage(CachePage *page) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		assert(page->flags & CachePage::reclaimRegistered);
 
-		_lruList.push_back(page);
+		if(page->flags & CachePage::reclaimPosted)
+			return;
+		_unlink(page);
+		page->flags &= ~(CachePage::reclaimActive | CachePage::reclaimReferenced);
+		_inactiveList.push_front(page);
+		_inactiveSize += kPageSize;
+		page->bundle->_numInactive++;
 	}
 
 	auto awaitReclaim(CacheBundle *bundle, async::cancellation_token ct = {}) {
@@ -104,6 +129,64 @@ struct MemoryReclaimer {
 		return page;
 	}
 
+	// Waits until pages of anonymous bundles are posted.
+	auto awaitCompression() {
+		return async::sequence(
+			async::transform(
+				_compressEvent.async_wait_if([this] () -> bool {
+					auto irqLock = frg::guard(&irqMutex());
+					auto lock = frg::guard(&_mutex);
+
+					return _compressList.empty();
+				}),
+				[] (auto) { }
+			),
+			WorkQueue::generalQueue()->schedule()
+		);
+	}
+
+	// Takes a posted page of an anonymous bundle. Returns false if there is no such page.
+	// Otherwise, memory is set to the CopyOnWriteMemory that owns the page
+	// (or to a null pointer if the memory is being destructed).
+	bool takeCompressionPage(smarter::shared_ptr<CopyOnWriteMemory> &memory, uint64_t &index) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		if(_compressList.empty())
+			return false;
+
+		auto page = _compressList.pop_front();
+
+		assert(page->flags & CachePage::reclaimRegistered);
+		assert(page->flags & CachePage::reclaimPosted);
+		assert(!(page->flags & CachePage::reclaimInflight));
+
+		page->flags |= CachePage::reclaimInflight;
+
+		// The memory cannot be freed before it removes the page (which needs our lock).
+		// If it is already being destructed, lock() fails and the destructor cleans up the page.
+		index = page->identity;
+		memory = static_cast<CopyOnWriteMemory *>(page->bundle)->selfPtr.lock();
+		return true;
+	}
+
+	CacheStats getStats() {
+		CacheStats stats{0, 0, frg::vector<CacheBundleStats, KernelAlloc>{*kernelAlloc}};
+
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		stats.activePages = _activeSize / kPageSize;
+		stats.inactivePages = _inactiveSize / kPageSize;
+		for(auto bundle : _bundleList) {
+			if(!bundle->_numActive && !bundle->_numInactive && !bundle->_numEvictions)
+				continue;
+			stats.bundles.push_back({bundle->_bundleId, bundle->_numActive,
+					bundle->_numInactive, bundle->_numActivations, bundle->_numEvictions});
+		}
+		return stats;
+	}
+
 	void runReclaimFiber() {
 		auto checkReclaim = [this] () -> bool {
 			if(disableUncaching)
@@ -112,7 +195,7 @@ struct MemoryReclaimer {
 			auto irqLock = frg::guard(&irqMutex());
 			auto lock = frg::guard(&_mutex);
 
-			if(_lruList.empty())
+			if(_inactiveList.empty() && _activeList.empty())
 				return false;
 
 			if(!tortureUncaching) {
@@ -128,17 +211,33 @@ struct MemoryReclaimer {
 				}
 			}
 
-			auto page = _lruList.pop_front();
+			// Demote pages until the active list is no larger than the inactive list.
+			while(!_activeList.empty()
+					&& (_activeSize > _inactiveSize || _inactiveList.empty())) {
+				auto page = _activeList.front();
+				_unlink(page);
+				_pushInactive(page);
+			}
+
+			auto page = _inactiveList.front();
+			_unlink(page);
 
 			assert(page->flags & CachePage::reclaimRegistered);
 			assert(!(page->flags & CachePage::reclaimPosted));
 			assert(!(page->flags & CachePage::reclaimInflight));
 
 			page->flags |= CachePage::reclaimPosted;
-			_cachedSize -= kPageSize;
 
-			page->bundle->_reclaimList.push_back(page);
-			page->bundle->_reclaimEvent.raise();
+			page->bundle->_numEvictions++;
+			if(page->bundle->_anonymous) {
+				_compressList.push_back(page);
+				// awaitCompression() takes _mutex while the event's lock is held.
+				lock.unlock();
+				_compressEvent.raise();
+			}else{
+				page->bundle->_reclaimList.push_back(page);
+				page->bundle->_reclaimEvent.raise();
+			}
 
 			return true;
 		};
@@ -148,8 +247,9 @@ struct MemoryReclaimer {
 				if(logUncaching) {
 					auto irqLock = frg::guard(&irqMutex());
 					auto lock = frg::guard(&_mutex);
-					infoLogger() << "thor: " << (_cachedSize / 1024)
-							<< " KiB of cached pages" << frg::endlog;
+					infoLogger() << "thor: " << (_activeSize / 1024) << " KiB of active and "
+							<< (_inactiveSize / 1024) << " KiB of inactive cached pages"
+							<< frg::endlog;
 				}
 
 				while(checkReclaim())
@@ -161,9 +261,62 @@ struct MemoryReclaimer {
 				}
 			}
 		});
+
+		[] (MemoryReclaimer *self, enable_detached_coroutine = {}) -> void {
+			while(true) {
+				co_await self->awaitCompression();
+
+				smarter::shared_ptr<CopyOnWriteMemory> memory;
+				uint64_t index;
+				while(self->takeCompressionPage(memory, index)) {
+					if(memory)
+						co_await memory->_compressPage(index);
+					memory = nullptr;
+				}
+			}
+		}(this);
 	}
 
 private:
+	// Removes a posted page from the list that it was posted to.
+	void _unpost(CachePage *page) {
+		if(!(page->flags & CachePage::reclaimInflight)) {
+			auto &list = page->bundle->_anonymous ? _compressList : page->bundle->_reclaimList;
+			list.erase(list.iterator_to(page));
+		}
+
+		page->flags &= ~(CachePage::reclaimPosted | CachePage::reclaimInflight);
+	}
+
+	void _pushInactive(CachePage *page) {
+		page->flags &= ~(CachePage::reclaimActive | CachePage::reclaimReferenced);
+		_inactiveList.push_back(page);
+		_inactiveSize += kPageSize;
+		page->bundle->_numInactive++;
+	}
+
+	void _pushActive(CachePage *page) {
+		page->flags &= ~CachePage::reclaimReferenced;
+		page->flags |= CachePage::reclaimActive;
+		_activeList.push_back(page);
+		_activeSize += kPageSize;
+		page->bundle->_numActive++;
+	}
+
+	// Removes the page from the active or the inactive list.
+	void _unlink(CachePage *page) {
+		if(page->flags & CachePage::reclaimActive) {
+			_activeList.erase(_activeList.iterator_to(page));
+			_activeSize -= kPageSize;
+			page->bundle->_numActive--;
+		}else{
+			_inactiveList.erase(_inactiveList.iterator_to(page));
+			_inactiveSize -= kPageSize;
+			page->bundle->_numInactive--;
+		}
+		page->flags &= ~(CachePage::reclaimActive | CachePage::reclaimReferenced);
+	}
+
 	frg::ticket_spinlock _mutex;
 
 	frg::intrusive_list<
@@ -173,9 +326,41 @@ private:
 			frg::default_list_hook<CachePage>,
 			&CachePage::listHook
 		>
-	> _lruList;
+	> _activeList;
+
+	frg::intrusive_list<
+		CachePage,
+		frg::locate_member<
+			CachePage,
+			frg::default_list_hook<CachePage>,
+			&CachePage::listHook
+		>
+	> _inactiveList;
+
+	frg::intrusive_list<
+		CacheBundle,
+		frg::locate_member<
+			CacheBundle,
+			frg::default_list_hook<CacheBundle>,
+			&CacheBundle::_bundleHook
+		>
+	> _bundleList;
+
+	// Posted pages of anonymous bundles.
+	frg::intrusive_list<
+		CachePage,
+		frg::locate_member<
+			CachePage,
+			frg::default_list_hook<CachePage>,
+			&CachePage::listHook
+		>
+	> _compressList;
 
-	size_t _cachedSize = 0;
+	async::recurring_event _compressEvent;
+
+	size_t _activeSize = 0;
+	size_t _inactiveSize = 0;
+	uint64_t _nextBundleId = 1;
 };
 
 static frg::manual_box<MemoryReclaimer> globalReclaimer;
@@ -188,6 +373,385 @@ static initgraph::Task initReclaim{&globalInitEngine, "generic.init-reclaim",
 	}
 };
 
+CacheStats getCacheStats() {
+	return globalReclaimer->getStats();
+}
+
+// --------------------------------------------------------
+// Page merging.
+// --------------------------------------------------------
+
+// A read-only frame that is shared by all merged pages with identical contents.
+struct MergedFrame {
+	PhysicalAddr physical;
+	uint64_t hash;
+	// Number of merged pages that refer to this frame plus temporary references of the merger.
+	size_t refCount;
+	// Next frame with the same hash (in case of hash collisions).
+	MergedFrame *next = nullptr;
+};
+
+namespace {
+	uint64_t hashPage(PhysicalAddr physical) {
+		PageAccessor accessor{physical};
+		auto words = reinterpret_cast<const uint64_t *>(accessor.get());
+		uint64_t hash = 0xCBF29CE484222325;
+		for(size_t i = 0; i < kPageSize / sizeof(uint64_t); i++)
+			hash = (hash ^ words[i]) * 0x100000001B3;
+		return hash ^ (hash >> 29);
+	}
+
+	bool comparePages(PhysicalAddr a, PhysicalAddr b) {
+		PageAccessor accessorA{a};
+		PageAccessor accessorB{b};
+		return !memcmp(accessorA.get(), accessorB.get(), kPageSize);
+	}
+}
+
+// Similar to Linux' KSM, the merger periodically scans the pages of all mergeable
+// CopyOnWriteMemory objects. Pages whose hash did not change since the last scan are
+// merged with a page of identical contents, either one that is already merged (the
+// frame table) or one that was seen during the current round (the candidate table).
+// Merged pages are unmapped; any subsequent fetch copies the frame again, just like
+// fetches of pages in a CowChain.
+// Locking: the merger's mutex may be taken while the mutex of a memory is held.
+struct PageMerger {
+	// Number of present pages that are hashed between two pauses of the scanner.
+	static constexpr size_t pagesPerBatch = 100;
+	static constexpr uint64_t batchInterval = 20'000'000;
+
+	PageMerger()
+	: _frames{frg::hash<uint64_t>{}, *kernelAlloc} {
+		_candidates.initialize(frg::hash<uint64_t>{}, *kernelAlloc);
+	}
+
+	void addMemory(CopyOnWriteMemory *memory) {
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			if(memory->_mergeable)
+				return;
+			memory->_mergeable = true;
+			_memories.push_back(memory);
+		}
+		_memoriesEvent.raise();
+	}
+
+	void inheritMergeable(CopyOnWriteMemory *memory, CopyOnWriteMemory *forked) {
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			if(!memory->_mergeable)
+				return;
+			assert(!forked->_mergeable);
+			forked->_mergeable = true;
+			_memories.push_back(forked);
+		}
+		_memoriesEvent.raise();
+	}
+
+	void removeMemory(CopyOnWriteMemory *memory) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		if(!memory->_mergeable)
+			return;
+		memory->_mergeable = false;
+		_memories.erase(_memories.iterator_to(memory));
+	}
+
+	void addRef(MergedFrame *frame) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		assert(frame->refCount);
+		frame->refCount++;
+	}
+
+	// Drops a reference and frees the frame once the last reference is gone.
+	void releaseFrame(MergedFrame *frame) {
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			assert(frame->refCount);
+			if(--frame->refCount)
+				return;
+			_unlinkFrame(frame);
+		}
+
+		physicalAllocator->free(frame->physical, kPageSize);
+		frg::destruct(*kernelAlloc, frame);
+	}
+
+	// Returns a private copy of the frame and drops a reference to it.
+	// If the reference is the last one, the frame's page itself is returned.
+	PhysicalAddr unmerge(MergedFrame *frame) {
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			assert(frame->refCount);
+			if(frame->refCount == 1) {
+				_unlinkFrame(frame);
+				auto physical = frame->physical;
+				frg::destruct(*kernelAlloc, frame);
+				return physical;
+			}
+		}
+
+		auto physical = physicalAllocator->allocate(kPageSize);
+		assert(physical != PhysicalAddr(-1) && "OOM");
+		PageAccessor copyAccessor{physical};
+		PageAccessor frameAccessor{frame->physical};
+		memcpy(copyAccessor.get(), frameAccessor.get(), kPageSize);
+
+		releaseFrame(frame);
+		return physical;
+	}
+
+	void runScanner() {
+		[] (PageMerger *self, enable_detached_coroutine = {}) -> void {
+			while(true) {
+				co_await self->_memoriesEvent.async_wait_if([self] () -> bool {
+					auto irqLock = frg::guard(&irqMutex());
+					auto lock = frg::guard(&self->_mutex);
+
+					return self->_memories.empty();
+				});
+				co_await WorkQueue::generalQueue()->schedule();
+
+				// Take a snapshot of all mergeable memories. Weak pointers ensure that
+				// we do not keep memories of exited processes alive until the end of the round.
+				frg::vector<smarter::weak_ptr<CopyOnWriteMemory>, KernelAlloc> round{*kernelAlloc};
+				{
+					auto irqLock = frg::guard(&irqMutex());
+					auto lock = frg::guard(&self->_mutex);
+
+					for(auto memory : self->_memories)
+						round.push_back(memory->selfPtr);
+				}
+
+				for(auto &weakMemory : round) {
+					auto memory = weakMemory.lock();
+					if(!memory)
+						continue;
+					co_await self->_scanMemory(memory.get());
+				}
+
+				// Candidates are only valid within a single round.
+				{
+					auto irqLock = frg::guard(&irqMutex());
+					auto lock = frg::guard(&self->_mutex);
+
+					self->_candidates.destruct();
+					self->_candidates.initialize(frg::hash<uint64_t>{}, *kernelAlloc);
+				}
+			}
+		}(this);
+	}
+
+private:
+	struct Candidate {
+		smarter::weak_ptr<CopyOnWriteMemory> memory;
+		uint64_t index;
+	};
+
+	coroutine<void> _scanMemory(CopyOnWriteMemory *memory) {
+		for(uint64_t index = 0; index < (memory->_length >> kPageShift); index++) {
+			uint64_t hash;
+			bool stable;
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&memory->_mutex);
+
+				auto page = memory->_ownedPages.find(index);
+				if(!page || page->state != CopyOnWriteMemory::CowState::hasCopy || page->lockCount)
+					continue;
+
+				// Only merge pages that did not change since the last round.
+				hash = hashPage(page->physical);
+				stable = page->mergeHashed && page->mergeHash == hash;
+				page->mergeHash = hash;
+				page->mergeHashed = true;
+			}
+
+			if(stable)
+				co_await _tryMerge(memory, index, hash);
+
+			if(++_batchSize == pagesPerBatch) {
+				_batchSize = 0;
+				co_await generalTimerEngine()->sleepFor(batchInterval);
+				co_await WorkQueue::generalQueue()->schedule();
+			}
+		}
+	}
+
+	coroutine<void> _tryMerge(CopyOnWriteMemory *memory, uint64_t index, uint64_t hash) {
+		MergedFrame *frame = nullptr;
+		frg::optional<Candidate> candidate;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			if(auto it = _frames.get(hash); it) {
+				frame = *it;
+				frame->refCount++;
+			}else if(auto it = _candidates->get(hash); it) {
+				candidate = std::move(*it);
+				_candidates->remove(hash);
+			}else{
+				_candidates->insert(hash, Candidate{memory->selfPtr, index});
+			}
+		}
+
+		// Turn the candidate into a new frame.
+		if(candidate) {
+			auto other = candidate->memory.lock();
+			if(!other || (other.get() == memory && candidate->index == index))
+				co_return;
+			frame = co_await _mergePage(other.get(), candidate->index, hash, nullptr);
+			if(!frame)
+				co_return;
+		}
+
+		// Merging can fail due to hash collisions; this is harmless.
+		if(frame) {
+			co_await _mergePage(memory, index, hash, frame);
+			releaseFrame(frame);
+		}
+	}
+
+	// Merges the page into the given frame (or into a new frame if frame is null).
+	// On success, returns the frame with a reference that is owned by the caller.
+	coroutine<MergedFrame *> _mergePage(CopyOnWriteMemory *memory, uint64_t index,
+			uint64_t hash, MergedFrame *frame) {
+		using CowState = CopyOnWriteMemory::CowState;
+
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&memory->_mutex);
+
+			auto page = memory->_ownedPages.find(index);
+			if(!page || page->state != CowState::hasCopy || page->lockCount)
+				co_return nullptr;
+			memory->_removeFromReclaim(page);
+			page->state = CowState::merging;
+		}
+
+		co_await memory->_evictQueue.evictRange(index << kPageShift, kPageSize);
+
+		PhysicalAddr freePhysical = PhysicalAddr(-1);
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&memory->_mutex);
+
+			// Fetches and locks cancel the merge.
+			auto page = memory->_ownedPages.find(index);
+			if(!page || page->state != CowState::merging)
+				co_return nullptr;
+
+			// The page is not mapped anymore but it might have changed after it was hashed.
+			bool identical = frame ? comparePages(page->physical, frame->physical)
+					: hashPage(page->physical) == hash;
+			if(!identical) {
+				page->state = CowState::hasCopy;
+				memory->_addToReclaim(page, index);
+				co_return nullptr;
+			}
+
+			if(frame) {
+				addRef(frame);
+				freePhysical = page->physical;
+			}else{
+				// One reference for the page and one for the caller.
+				frame = frg::construct<MergedFrame>(*kernelAlloc);
+				frame->physical = page->physical;
+				frame->hash = hash;
+				frame->refCount = 2;
+				_linkFrame(frame);
+			}
+
+			// Merged pages stay charged, like compressed pages.
+			page->state = CowState::merged;
+			page->merged = frame;
+			page->physical = PhysicalAddr(-1);
+		}
+
+		if(freePhysical != PhysicalAddr(-1))
+			physicalAllocator->free(freePhysical, kPageSize);
+		co_return frame;
+	}
+
+	void _linkFrame(MergedFrame *frame) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		if(auto it = _frames.get(frame->hash); it) {
+			frame->next = *it;
+			*it = frame;
+		}else{
+			_frames.insert(frame->hash, frame);
+		}
+	}
+
+	// Expects _mutex to be held.
+	void _unlinkFrame(MergedFrame *frame) {
+		auto it = _frames.get(frame->hash);
+		assert(it);
+		if(*it == frame) {
+			if(frame->next) {
+				*it = frame->next;
+			}else{
+				_frames.remove(frame->hash);
+			}
+			return;
+		}
+
+		auto prev = *it;
+		while(prev->next != frame) {
+			assert(prev->next);
+			prev = prev->next;
+		}
+		prev->next = frame->next;
+	}
+
+	frg::ticket_spinlock _mutex;
+
+	frg::intrusive_list<
+		CopyOnWriteMemory,
+		frg::locate_member<
+			CopyOnWriteMemory,
+			frg::default_list_hook<CopyOnWriteMemory>,
+			&CopyOnWriteMemory::_mergeHook
+		>
+	> _memories;
+
+	async::recurring_event _memoriesEvent;
+
+	// Maps hashes to frames (chained via MergedFrame::next).
+	frg::hash_map<uint64_t, MergedFrame *, frg::hash<uint64_t>, KernelAlloc> _frames;
+	// Maps hashes to pages that were seen during the current round.
+	frg::manual_box<
+		frg::hash_map<uint64_t, Candidate, frg::hash<uint64_t>, KernelAlloc>
+	> _candidates;
+
+	// Only accessed by the scanner.
+	size_t _batchSize = 0;
+};
+
+static frg::manual_box<PageMerger> globalMerger;
+
+static initgraph::Task initMerger{&globalInitEngine, "generic.init-page-merger",
+	initgraph::Requires{getFibersAvailableStage()},
+	[] {
+		globalMerger.initialize();
+		globalMerger->runScanner();
+	}
+};
+
 // --------------------------------------------------------
 // MemoryView.
 // --------------------------------------------------------
@@ -345,6 +909,18 @@ Error MemoryView::updateRange(ManageRequest, size_t, size_t) {
 	return Error::illegalObject;
 }
 
+frg::tuple<PhysicalAddr, CachingMode> MemoryView::peekHugeRange(uintptr_t) {
+	return frg::tuple<PhysicalAddr, CachingMode>{PhysicalAddr(-1), CachingMode::null};
+}
+
+Error MemoryView::adviseAccess(AccessAdvice, uintptr_t, size_t) {
+	return Error::illegalObject;
+}
+
+coroutine<frg::expected<Error>> MemoryView::discardRange(uintptr_t, size_t, bool) {
+	co_return Error::illegalObject;
+}
+
 void MemoryView::submitManage(ManageNode *) {
 	panicLogger() << "MemoryView does not support management!" << frg::endlog;
 }
@@ -445,12 +1021,9 @@ ImmediateMemory::ImmediateMemory(size_t length)
 	auto numPages = (length + kPageSize - 1) >> kPageShift;
 	_physicalPages.resize(numPages);
 	for(size_t i = 0; i < numPages; ++i) {
-		auto physical = physicalAllocator->allocate(kPageSize, 64);
+		auto physical = physicalAllocator->allocateZeroedPage();
 		assert(physical != PhysicalAddr(-1) && "OOM when allocating ImmediateMemory");
 
-		PageAccessor accessor{physical};
-		memset(accessor.get(), 0, kPageSize);
-
 		_physicalPages[i] = physical;
 	}
 }
@@ -470,12 +1043,9 @@ void ImmediateMemory::resize(size_t newSize, async::any_receiver<void> receiver)
 		assert(newNumPages >= currentNumPages);
 		_physicalPages.resize(newNumPages);
 		for(size_t i = currentNumPages; i < newNumPages; ++i) {
-			auto physical = physicalAllocator->allocate(kPageSize, 64);
+			auto physical = physicalAllocator->allocateZeroedPage();
 			assert(physical != PhysicalAddr(-1) && "OOM when allocating ImmediateMemory");
 
-			PageAccessor accessor{physical};
-			memset(accessor.get(), 0, kPageSize);
-
 			_physicalPages[i] = physical;
 		}
 	}
@@ -575,6 +1145,13 @@ frg::tuple<PhysicalAddr, CachingMode> HardwareMemory::peekRange(uintptr_t offset
 	return frg::tuple<PhysicalAddr, CachingMode>{_base + offset, _cacheMode};
 }
 
+frg::tuple<PhysicalAddr, CachingMode> HardwareMemory::peekHugeRange(uintptr_t offset) {
+	assert(offset % kPageSize == 0);
+	if(((_base + offset) & (kHugePageSize - 1)) || offset + kHugePageSize > _length)
+		return frg::tuple<PhysicalAddr, CachingMode>{PhysicalAddr(-1), CachingMode::null};
+	return frg::tuple<PhysicalAddr, CachingMode>{_base + offset, _cacheMode};
+}
+
 coroutine<frg::expected<Error, PhysicalRange>>
 HardwareMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<WorkQueue>) {
 	assert(offset % kPageSize == 0);
@@ -623,8 +1200,11 @@ AllocatedMemory::~AllocatedMemory() {
 		infoLogger() << "thor: Releasing AllocatedMemory ("
 				<< (physicalAllocator->numUsedPages() * 4) << " KiB in use)" << frg::endlog;
 	for(size_t i = 0; i < _physicalChunks.size(); ++i) {
-		if(_physicalChunks[i] != PhysicalAddr(-1))
+		if(_physicalChunks[i] != PhysicalAddr(-1)) {
 			physicalAllocator->free(_physicalChunks[i], _chunkSize);
+			if(_account)
+				_account->uncharge(_chunkSize);
+		}
 	}
 	if(logUsage)
 		infoLogger() << "thor:     ("
@@ -675,6 +1255,27 @@ frg::tuple<PhysicalAddr, CachingMode> AllocatedMemory::peekRange(uintptr_t offse
 			CachingMode::null};
 }
 
+frg::tuple<PhysicalAddr, CachingMode> AllocatedMemory::peekHugeRange(uintptr_t offset) {
+	assert(offset % kPageSize == 0);
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	// Chunks are naturally aligned, so huge pages need chunks of at least that size.
+	if(_chunkSize < kHugePageSize || _chunkAlign < kHugePageSize
+			|| (offset & (kHugePageSize - 1)))
+		return frg::tuple<PhysicalAddr, CachingMode>{PhysicalAddr(-1), CachingMode::null};
+
+	auto index = offset / _chunkSize;
+	auto disp = offset & (_chunkSize - 1);
+	assert(index < _physicalChunks.size());
+
+	if(_physicalChunks[index] == PhysicalAddr(-1))
+		return frg::tuple<PhysicalAddr, CachingMode>{PhysicalAddr(-1), CachingMode::null};
+	return frg::tuple<PhysicalAddr, CachingMode>{_physicalChunks[index] + disp,
+			CachingMode::null};
+}
+
 coroutine<frg::expected<Error, PhysicalRange>>
 AllocatedMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<WorkQueue>) {
 	auto irq_lock = frg::guard(&irqMutex());
@@ -685,13 +1286,29 @@ AllocatedMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<Wo
 	assert(index < _physicalChunks.size());
 
 	if(_physicalChunks[index] == PhysicalAddr(-1)) {
-		auto physical = physicalAllocator->allocate(_chunkSize, _addressBits);
-		assert(physical != PhysicalAddr(-1) && "OOM");
-		assert(!(physical & (_chunkAlign - 1)));
+		if(_account && !_account->charge(_chunkSize))
+			co_return Error::noMemory;
+
+		PhysicalAddr physical;
+		if(_chunkSize == kPageSize && _addressBits >= 64
+				&& _numaNode == PhysicalChunkAllocator::anyNode) {
+			physical = physicalAllocator->allocateZeroedPage();
+			assert(physical != PhysicalAddr(-1) && "OOM");
+		}else{
+			physical = physicalAllocator->allocate(_chunkSize, _addressBits, _numaNode);
+			if(physical == PhysicalAddr(-1)) {
+				// Node-bound memory can run out of pages while other nodes still have some.
+				assert(_numaNode != PhysicalChunkAllocator::anyNode && "OOM");
+				if(_account)
+					_account->uncharge(_chunkSize);
+				co_return Error::noMemory;
+			}
+			assert(!(physical & (_chunkAlign - 1)));
 
-		for(size_t pg_progress = 0; pg_progress < _chunkSize; pg_progress += kPageSize) {
-			PageAccessor accessor{physical + pg_progress};
-			memset(accessor.get(), 0, kPageSize);
+			for(size_t pg_progress = 0; pg_progress < _chunkSize; pg_progress += kPageSize) {
+				PageAccessor accessor{physical + pg_progress};
+				memset(accessor.get(), 0, kPageSize);
+			}
 		}
 		_physicalChunks[index] = physical;
 	}
@@ -730,6 +1347,8 @@ ManagedSpace::ManagedSpace(size_t length, bool readahead)
 : pages{*kernelAlloc}, numPages{length >> kPageShift}, readahead{readahead} {
 	assert(!(length & (kPageSize - 1)));
 
+	globalReclaimer->addBundle(this);
+
 	[] (ManagedSpace *self, enable_detached_coroutine = {}) -> void {
 		while(true) {
 			// TODO: Cancel awaitReclaim() when the ManagedSpace is destructed.
@@ -781,6 +1400,7 @@ ManagedSpace::ManagedSpace(size_t length, bool readahead)
 ManagedSpace::~ManagedSpace() {
 	// TODO: Free all physical memory.
 	// TODO: We also have to remove all Loaded/Evicting pages from the reclaimer.
+	//       The bundle also needs to be removed from the reclaimer's list.
 	assert(!"Implement this");
 }
 
@@ -899,22 +1519,33 @@ void ManagedSpace::_progressManagement(ManageList &pending) {
 		pending.push_back(node);
 	}
 
+	// Limit the size of initialization requests (to the maximal readahead window)
+	// such that multiple outstanding requests of the driver can proceed in parallel.
+	constexpr ptrdiff_t maxInitializationPages = 64;
+
 	while(!_initializationList.empty() && !_managementQueue.empty()) {
 		auto page = _initializationList.front();
 		auto index = page->identity;
 
-		// Fuse the request with adjacent pages in the list.
-		ptrdiff_t count = 0;
-		while(!_initializationList.empty()) {
-			auto fuse_cache_page = _initializationList.front();
-			auto fuse_index = fuse_cache_page->identity;
-			auto fuse_managed_page = frg::container_of(fuse_cache_page, &ManagedPage::cachePage);
-			if(fuse_index != index + count)
-				break;
-			assert(fuse_managed_page->loadState == kStateWantInitialization);
+		// Fuse the request with adjacent pages, even if they are not adjacent in the list
+		// (e.g., since the misses happened in a different order).
+		auto takePage = [&] (size_t fuse_index) -> bool {
+			if(fuse_index >= numPages)
+				return false;
+			auto fuse_managed_page = pages.find(fuse_index);
+			if(!fuse_managed_page || fuse_managed_page->loadState != kStateWantInitialization)
+				return false;
+			_initializationList.erase(_initializationList.iterator_to(&fuse_managed_page->cachePage));
 			fuse_managed_page->loadState = kStateInitialization;
+			return true;
+		};
+
+		ptrdiff_t count = 0;
+		while(count < maxInitializationPages && takePage(index + count))
+			count++;
+		while(count < maxInitializationPages && index > 0 && takePage(index - 1)) {
+			index--;
 			count++;
-			_initializationList.pop_front();
 		}
 		assert(count);
 
@@ -959,6 +1590,41 @@ void ManagedSpace::_progressMonitors(MonitorList &pending) {
 	}
 }
 
+void ManagedSpace::_requestPages(size_t index, size_t count) {
+	for(size_t i = 0; i < count; ++i) {
+		if(!(index + i < numPages))
+			break;
+		auto [pit, wasInserted] = pages.find_or_insert(index + i, this, index + i);
+		assert(pit);
+		if(pit->loadState == kStateMissing) {
+			pit->loadState = kStateWantInitialization;
+			_initializationList.push_back(&pit->cachePage);
+		}
+	}
+}
+
+size_t ManagedSpace::_readaheadOnMiss(size_t index) {
+	// Window sizes in pages.
+	constexpr size_t initialWindow = 4;
+	constexpr size_t maxWindow = 64;
+
+	if(!readahead || advice == AccessAdvice::random)
+		return 0;
+
+	if(advice == AccessAdvice::sequential) {
+		_readaheadWindow = maxWindow;
+	}else if(index == _streamEnd) {
+		// The previous window was consumed; double the window.
+		_readaheadWindow = frg::min(frg::max(_readaheadWindow * 2, initialWindow), maxWindow);
+	}else{
+		// Random access backs off to no readahead at all.
+		_readaheadWindow /= 2;
+	}
+
+	_streamEnd = index + 1 + _readaheadWindow;
+	return _readaheadWindow;
+}
+
 // --------------------------------------------------------
 // BackingMemory
 // --------------------------------------------------------
@@ -1030,11 +1696,8 @@ BackingMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<Work
 	assert(pit);
 
 	if(pit->physical == PhysicalAddr(-1)) {
-		PhysicalAddr physical = physicalAllocator->allocate(kPageSize);
+		PhysicalAddr physical = physicalAllocator->allocateZeroedPage();
 		assert(physical != PhysicalAddr(-1) && "OOM");
-
-		PageAccessor accessor{physical};
-		memset(accessor.get(), 0, kPageSize);
 		pit->physical = physical;
 	}
 
@@ -1215,24 +1878,14 @@ FrontalMemory::fetchRange(uintptr_t offset, FetchFlags flags, smarter::shared_pt
 		}
 
 		// We have to take the slow-path, i.e., perform the fetch asynchronously.
+		// Pages that are already being initialized (e.g., due to readahead)
+		// do not count as misses for the purpose of readahead.
 		if(pit->loadState == ManagedSpace::kStateMissing) {
 			pit->loadState = ManagedSpace::kStateWantInitialization;
 			_managed->_initializationList.push_back(&pit->cachePage);
-		}
 
-		// Perform readahead.
-		if(_managed->readahead)
-			for(size_t i = 1; i < 4; ++i) {
-				if(!(index + i < _managed->numPages))
-					break;
-				auto [pit, wasInserted] = _managed->pages.find_or_insert(
-						index + i, _managed.get(), index + i);
-				assert(pit);
-				if(pit->loadState == ManagedSpace::kStateMissing) {
-					pit->loadState = ManagedSpace::kStateWantInitialization;
-					_managed->_initializationList.push_back(&pit->cachePage);
-				}
-			}
+			_managed->_requestPages(index + 1, _managed->_readaheadOnMiss(index));
+		}
 
 		_managed->_progressManagement(pendingManagement);
 
@@ -1310,6 +1963,34 @@ size_t FrontalMemory::getLength() {
 	return _managed->numPages << kPageShift;
 }
 
+Error FrontalMemory::adviseAccess(AccessAdvice advice, uintptr_t offset, size_t size) {
+	assert(!(offset % kPageSize));
+	assert(!(size % kPageSize));
+
+	if(advice == AccessAdvice::mergeable || advice == AccessAdvice::unmergeable)
+		return Error::illegalObject;
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_managed->mutex);
+
+		if(offset + size > (_managed->numPages << kPageShift))
+			return Error::outOfBounds;
+
+		if(advice == AccessAdvice::willNeed) {
+			_managed->_requestPages(offset >> kPageShift, size >> kPageShift);
+		}else{
+			// Readahead state is tracked per object, not per range.
+			_managed->advice = advice;
+			_managed->_readaheadWindow = 0;
+		}
+	}
+
+	if(advice == AccessAdvice::willNeed)
+		_managed->_deferredManagement.invoke();
+	return Error::success;
+}
+
 coroutine<frg::expected<Error, PhysicalAddr>> FrontalMemory::takeGlobalFutex(uintptr_t offset,
 		smarter::shared_ptr<WorkQueue> wq) {
 	// For now, we pick the trival implementation here.
@@ -1445,19 +2126,255 @@ Error IndirectMemory::setIndirection(size_t slot, smarter::shared_ptr<MemoryView
 CopyOnWriteMemory::CopyOnWriteMemory(smarter::shared_ptr<MemoryView> view,
 		uintptr_t offset, size_t length,
 		smarter::shared_ptr<CowChain> chain)
-: MemoryView{&_evictQueue}, _view{std::move(view)},
+: MemoryView{&_evictQueue}, CacheBundle{true}, _view{std::move(view)},
 		_viewOffset{offset}, _length{length}, _copyChain{std::move(chain)},
 		_ownedPages{*kernelAlloc} {
 	assert(length);
 	assert(!(offset & (kPageSize - 1)));
 	assert(!(length & (kPageSize - 1)));
+
+	if(_copyChain)
+		_copyChain->_numMemories.fetch_add(1, std::memory_order_relaxed);
 }
 
 CopyOnWriteMemory::~CopyOnWriteMemory() {
+	if(_copyChain)
+		_copyChain->_numMemories.fetch_sub(1, std::memory_order_relaxed);
+
+	globalMerger->removeMemory(this);
+
 	for(auto it = _ownedPages.begin(); it != _ownedPages.end(); ++it) {
-		assert(it->state == CowState::hasCopy);
-		assert(it->physical != PhysicalAddr(-1));
-		physicalAllocator->free(it->physical, kPageSize);
+		if(it->cachePage.flags & CachePage::reclaimRegistered)
+			globalReclaimer->removePage(&it->cachePage);
+
+		if(it->state == CowState::compressed) {
+			discardCompressedPage(it->compressed);
+		}else if(it->state == CowState::merged) {
+			globalMerger->releaseFrame(it->merged);
+		}else{
+			assert(it->state == CowState::hasCopy || it->state == CowState::evicting
+					|| it->state == CowState::merging || it->state == CowState::discarding);
+			assert(it->physical != PhysicalAddr(-1));
+			physicalAllocator->free(it->physical, kPageSize);
+		}
+		_unchargePage();
+	}
+}
+
+bool CopyOnWriteMemory::_chargePage() {
+	if(!_account)
+		return true;
+	return _account->charge(kPageSize);
+}
+
+void CopyOnWriteMemory::_unchargePage() {
+	if(_account)
+		_account->uncharge(kPageSize);
+}
+
+void CopyOnWriteMemory::_addToReclaim(CowPage *page, uint64_t index) {
+	assert(page->state == CowState::hasCopy);
+	assert(!page->lockCount);
+	page->cachePage.bundle = this;
+	page->cachePage.identity = index;
+	globalReclaimer->addPage(&page->cachePage);
+}
+
+void CopyOnWriteMemory::_removeFromReclaim(CowPage *page) {
+	if(page->cachePage.flags & CachePage::reclaimRegistered)
+		globalReclaimer->removePage(&page->cachePage);
+}
+
+void CopyOnWriteMemory::_makePresent(CowPage *page) {
+	if(page->state == CowState::compressed) {
+		// The page stays charged while it is compressed, hence we do not charge it again.
+		auto physical = physicalAllocator->allocate(kPageSize);
+		assert(physical != PhysicalAddr(-1) && "OOM");
+		PageAccessor accessor{physical};
+		decompressPage(page->compressed, accessor.get());
+		page->compressed = nullptr;
+		page->physical = physical;
+	}else if(page->state == CowState::merged) {
+		page->physical = globalMerger->unmerge(page->merged);
+		page->merged = nullptr;
+	}else{
+		// Cancel the eviction; _compressPage(), the merger and discardRange()
+		// notice the state change.
+		assert(page->state == CowState::evicting || page->state == CowState::merging
+				|| page->state == CowState::discarding);
+	}
+	page->state = CowState::hasCopy;
+}
+
+void CopyOnWriteMemory::_dropPage(CowPage *page, uint64_t index) {
+	assert(!(page->cachePage.flags & CachePage::reclaimRegistered));
+	assert(!page->lockCount);
+
+	if(page->state == CowState::compressed) {
+		discardCompressedPage(page->compressed);
+	}else if(page->state == CowState::merged) {
+		globalMerger->releaseFrame(page->merged);
+	}else{
+		assert(page->state == CowState::evicting || page->state == CowState::discarding);
+		physicalAllocator->free(page->physical, kPageSize);
+	}
+	_ownedPages.erase(index);
+	_unchargePage();
+}
+
+coroutine<void> CopyOnWriteMemory::_compressPage(uint64_t index) {
+	CowPage *cowIt;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		// The page might have been bumped, locked or removed in the meantime.
+		cowIt = _ownedPages.find(index);
+		if(!cowIt || !(cowIt->cachePage.flags & CachePage::reclaimInflight))
+			co_return;
+		assert(cowIt->state == CowState::hasCopy);
+		assert(!cowIt->lockCount);
+		cowIt->state = CowState::evicting;
+		globalReclaimer->removePage(&cowIt->cachePage);
+	}
+
+	co_await _evictQueue.evictRange(index << kPageShift, kPageSize);
+
+	// The page is not mapped anymore, so it cannot change unless the eviction is cancelled.
+	PhysicalAddr physical;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		cowIt = _ownedPages.find(index);
+		if(!cowIt || cowIt->state != CowState::evicting)
+			co_return;
+
+		// Lazily freed pages that were not accessed again do not need to be preserved.
+		if(cowIt->lazyFree) {
+			_dropPage(cowIt, index);
+			co_return;
+		}
+		physical = cowIt->physical;
+	}
+
+	CompressedPage *compressed;
+	{
+		PageAccessor accessor{physical};
+		compressed = compressPage(accessor.get());
+	}
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		cowIt = _ownedPages.find(index);
+		if(!cowIt || cowIt->state != CowState::evicting) {
+			if(compressed)
+				discardCompressedPage(compressed);
+			co_return;
+		}
+
+		// Pages that do not compress well stay resident; they are not registered
+		// with the reclaimer again until they are locked and unlocked.
+		if(!compressed) {
+			cowIt->state = CowState::hasCopy;
+			co_return;
+		}
+
+		cowIt->state = CowState::compressed;
+		cowIt->compressed = compressed;
+		cowIt->physical = PhysicalAddr(-1);
+	}
+
+	physicalAllocator->free(physical, kPageSize);
+}
+
+namespace {
+	// Moves all pages of superChain that are not shadowed by chain into chain and
+	// unlinks superChain. Expects that both chains are locked and that chain is
+	// the only user of superChain.
+	void collapseChain(CowChain *chain, CowChain *superChain) {
+		assert(!superChain->_numMemories.load(std::memory_order_relaxed));
+		assert(superChain->_numSubChains.load(std::memory_order_relaxed) == 1);
+
+		for(auto it = superChain->_pages.begin(); it != superChain->_pages.end(); ++it) {
+			auto physical = it->physical.load(std::memory_order_relaxed);
+			if(physical == PhysicalAddr(-1))
+				continue;
+
+			if(chain->_pages.find(it->index)) {
+				physicalAllocator->free(physical, kPageSize);
+			}else{
+				chain->_pages.insert(it->index, it->index, physical);
+			}
+			it->physical.store(PhysicalAddr(-1), std::memory_order_relaxed);
+		}
+
+		// chain takes over superChain's reference to its own super-chain.
+		chain->_superChain = std::move(superChain->_superChain);
+		superChain->_numSubChains.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+PhysicalAddr CopyOnWriteMemory::_fetchFromChain(smarter::shared_ptr<CowChain> chain,
+		uintptr_t pageOffset) {
+	auto index = pageOffset >> kPageShift;
+
+	auto irqLock = frg::guard(&irqMutex());
+
+	// Chains are locked hand-over-hand (always a chain before its super-chain).
+	// Hence, collapsing a chain (which moves its pages to its sub-chain)
+	// cannot slip between our lookups in the two chains.
+	chain->_mutex.lock();
+
+	// If no one else uses the chain, no one else can observe its pages
+	// and we can take the page instead of copying it.
+	bool exclusive = chain->_numMemories.load(std::memory_order_relaxed) == 1
+			&& !chain->_numSubChains.load(std::memory_order_relaxed);
+	while(true) {
+		auto it = chain->_pages.find(index);
+		if(it && it->physical.load(std::memory_order_relaxed) != PhysicalAddr(-1)) {
+			auto srcPhysical = it->physical.load(std::memory_order_relaxed);
+
+			PhysicalAddr physical;
+			if(exclusive) {
+				physical = srcPhysical;
+				chain->_pages.erase(index);
+			}else{
+				// We can just copy synchronously here -- the descendant is not evicted.
+				physical = physicalAllocator->allocate(kPageSize);
+				assert(physical != PhysicalAddr(-1) && "OOM");
+				PageAccessor accessor{physical};
+				PageAccessor srcAccessor{srcPhysical};
+				memcpy(accessor.get(), srcAccessor.get(), kPageSize);
+			}
+			chain->_mutex.unlock();
+			return physical;
+		}
+
+		auto superChain = chain->_superChain;
+		if(!superChain) {
+			chain->_mutex.unlock();
+			return PhysicalAddr(-1);
+		}
+		superChain->_mutex.lock();
+
+		// If the super-chain is only reachable through this chain (e.g., because the
+		// process that forked it exited), fold it into this chain. This keeps walks
+		// short even after many generations of fork().
+		// Note that the counters cannot increase here: sub-chains and memories are only
+		// added to chains that are still used by some memory.
+		if(!superChain->_numMemories.load(std::memory_order_relaxed)
+				&& superChain->_numSubChains.load(std::memory_order_relaxed) == 1) {
+			collapseChain(chain.get(), superChain.get());
+			superChain->_mutex.unlock();
+			continue;
+		}
+
+		chain->_mutex.unlock();
+		chain = std::move(superChain);
+		exclusive = false;
 	}
 }
 
@@ -1465,6 +2382,24 @@ size_t CopyOnWriteMemory::getLength() {
 	return _length;
 }
 
+void CopyOnWriteMemory::resize(size_t newLength, async::any_receiver<void> receiver) {
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		// Pages beyond the old length have never been copied, hence they are
+		// fetched from _view (e.g., they are zero for copies of the zero memory).
+		if((newLength & (kPageSize - 1)) || newLength < _length
+				|| _viewOffset + newLength > _view->getLength()) {
+			infoLogger() << "thor: CopyOnWriteMemory can only grow within its view"
+					<< frg::endlog;
+		}else{
+			_length = newLength;
+		}
+	}
+	receiver.set_value();
+}
+
 frg::expected<Error, frg::tuple<smarter::shared_ptr<GlobalFutexSpace>, uintptr_t>>
 CopyOnWriteMemory::resolveGlobalFutex(uintptr_t offset) {
 	smarter::shared_ptr<GlobalFutexSpace> futexSpace{selfPtr.lock()};
@@ -1486,12 +2421,16 @@ void CopyOnWriteMemory::fork(async::any_receiver<frg::tuple<Error, smarter::shar
 		auto newChain = smarter::allocate_shared<CowChain>(*kernelAlloc, _copyChain);
 
 		// Update the original mapping
+		if(_copyChain)
+			_copyChain->_numMemories.fetch_sub(1, std::memory_order_relaxed);
 		_copyChain = newChain;
+		_copyChain->_numMemories.fetch_add(1, std::memory_order_relaxed);
 
 		// Create a new mapping in the forked space.
 		forked = smarter::allocate_shared<CopyOnWriteMemory>(*kernelAlloc,
 				_view, _viewOffset, _length, newChain);
 		forked->selfPtr = forked;
+		forked->_account = _account;
 
 		// Finally, inspect all copied pages owned by the original mapping.
 		for(size_t pg = 0; pg < _length; pg += kPageSize) {
@@ -1499,6 +2438,21 @@ void CopyOnWriteMemory::fork(async::any_receiver<frg::tuple<Error, smarter::shar
 
 			if(!osIt)
 				continue;
+
+			// Merged pages stay merged; the forked memory shares the frame.
+			if(osIt->state == CowState::merged) {
+				globalMerger->addRef(osIt->merged);
+				if(_account)
+					_account->forceCharge(kPageSize);
+
+				auto fsIt = forked->_ownedPages.insert(pg >> kPageShift);
+				fsIt->state = CowState::merged;
+				fsIt->merged = osIt->merged;
+				continue;
+			}
+
+			if(osIt->state != CowState::hasCopy)
+				_makePresent(osIt);
 			assert(osIt->state == CowState::hasCopy);
 
 			// The page is locked. We *need* to keep it in the old address space.
@@ -1512,24 +2466,34 @@ void CopyOnWriteMemory::fork(async::any_receiver<frg::tuple<Error, smarter::shar
 				PageAccessor copyAccessor{copyPhysical};
 				memcpy(copyAccessor.get(), lockedAccessor.get(), kPageSize);
 
+				// fork() cannot fail at this point; ignore the hard limit.
+				if(_account)
+					_account->forceCharge(kPageSize);
+
 				// Update the chains.
 				auto fsIt = forked->_ownedPages.insert(pg >> kPageShift);
 				fsIt->state = CowState::hasCopy;
 				fsIt->physical = copyPhysical;
+				forked->_addToReclaim(fsIt, pg >> kPageShift);
 			}else{
 				auto physical = osIt->physical;
 				assert(physical != PhysicalAddr(-1));
 
 				// Update the chains.
-				auto pageOffset = _viewOffset + pg;
-				auto newIt = newChain->_pages.insert(pageOffset >> kPageShift,
-						PhysicalAddr(-1));
+				auto pageIndex = (_viewOffset + pg) >> kPageShift;
+				newChain->_pages.insert(pageIndex, pageIndex, physical);
+				_removeFromReclaim(osIt);
 				_ownedPages.erase(pg >> kPageShift);
-				newIt->store(physical, std::memory_order_relaxed);
+
+				// Pages in a CowChain are shared; they are not charged to any account.
+				_unchargePage();
 			}
 		}
 	}
 
+	// Like on Linux, forks of mergeable memory are mergeable as well.
+	globalMerger->inheritMergeable(this, forked.get());
+
 	async::detach_with_allocator(*kernelAlloc,
 			[] (CopyOnWriteMemory *self, smarter::shared_ptr<CopyOnWriteMemory> forked,
 			async::any_receiver<frg::tuple<Error, smarter::shared_ptr<MemoryView>>> receiver)
@@ -1560,6 +2524,7 @@ bool CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 			uintptr_t viewOffset;
 			CowPage *cowIt;
 			bool waitForCopy = false;
+			bool outOfMemory = false;
 			{
 				// If the page is present in our private chain, we just return it.
 				auto irqLock = frg::guard(&irqMutex());
@@ -1567,9 +2532,16 @@ bool CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 
 				cowIt = self->_ownedPages.find(offset >> kPageShift);
 				if(cowIt) {
+					cowIt->lazyFree = false;
+					if(cowIt->state != CowState::hasCopy && cowIt->state != CowState::inProgress)
+						self->_makePresent(cowIt);
+
 					if(cowIt->state == CowState::hasCopy) {
 						assert(cowIt->physical != PhysicalAddr(-1));
 
+						// Locked pages must not be evicted.
+						if(!cowIt->lockCount)
+							self->_removeFromReclaim(cowIt);
 						cowIt->lockCount++;
 						progress += kPageSize;
 						continue;
@@ -1577,6 +2549,8 @@ bool CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 						assert(cowIt->state == CowState::inProgress);
 						waitForCopy = true;
 					}
+				}else if(!self->_chargePage()) {
+					outOfMemory = true;
 				}else{
 					chain = self->_copyChain;
 					view = self->_view;
@@ -1588,6 +2562,15 @@ bool CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 				}
 			}
 
+			if(outOfMemory) {
+				// Drop the locks that we already took.
+				if(progress)
+					self->unlockRange(overallOffset, progress);
+				node->result = Error::noMemory;
+				node->resume();
+				co_return;
+			}
+
 			if(waitForCopy) {
 				bool stillWaiting;
 				do {
@@ -1596,10 +2579,7 @@ bool CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 						auto irqLock = frg::guard(&irqMutex());
 						auto lock = frg::guard(&self->_mutex);
 
-						if(cowIt->state == CowState::inProgress)
-							return true;
-						assert(cowIt->state == CowState::hasCopy);
-						return false;
+						return cowIt->state == CowState::inProgress;
 					});
 					co_await wq->schedule();
 				} while(stillWaiting);
@@ -1608,37 +2588,29 @@ bool CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 					auto irqLock = frg::guard(&irqMutex());
 					auto lock = frg::guard(&self->_mutex);
 
-					assert(cowIt->state == CowState::hasCopy);
+					// The reclaimer might have picked up the page in the meantime.
+					if(cowIt->state != CowState::hasCopy)
+						self->_makePresent(cowIt);
+					if(!cowIt->lockCount)
+						self->_removeFromReclaim(cowIt);
 					cowIt->lockCount++;
 				}
 				progress += kPageSize;
 				continue;
 			}
 
-			PhysicalAddr physical = physicalAllocator->allocate(kPageSize);
-			assert(physical != PhysicalAddr(-1) && "OOM");
-			PageAccessor accessor{physical};
-
-			// Try to copy from a descendant CoW chain.
+			// Try to take the page from a descendant CoW chain.
 			auto pageOffset = viewOffset + offset;
-			while(chain) {
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&chain->_mutex);
-
-				if(auto it = chain->_pages.find(pageOffset >> kPageShift); it) {
-					// We can just copy synchronously here -- the descendant is not evicted.
-					auto srcPhysical = it->load(std::memory_order_relaxed);
-					assert(srcPhysical != PhysicalAddr(-1));
-					auto srcAccessor = PageAccessor{srcPhysical};
-					memcpy(accessor.get(), srcAccessor.get(), kPageSize);
-					break;
-				}
-
-				chain = chain->_superChain;
-			}
+			PhysicalAddr physical = PhysicalAddr(-1);
+			if(chain)
+				physical = self->_fetchFromChain(std::move(chain), pageOffset);
 
 			// Copy from the root view.
-			if(!chain) {
+			if(physical == PhysicalAddr(-1)) {
+				physical = physicalAllocator->allocate(kPageSize);
+				assert(physical != PhysicalAddr(-1) && "OOM");
+				PageAccessor accessor{physical};
+
 				// TODO: Handle errors here -- we need to drop the lock again.
 				auto copyOutcome = co_await view->copyFrom(pageOffset & ~(kPageSize - 1),
 						accessor.get(), kPageSize, wq);
@@ -1673,11 +2645,13 @@ void CopyOnWriteMemory::unlockRange(uintptr_t offset, size_t size) {
 	auto lock = frg::guard(&_mutex);
 
 	for(size_t pg = 0; pg < size; pg += kPageSize) {
-		auto it = _ownedPages.find((offset + pg) >> kPageShift);
+		auto index = (offset + pg) >> kPageShift;
+		auto it = _ownedPages.find(index);
 		assert(it);
 		assert(it->state == CowState::hasCopy);
 		assert(it->lockCount > 0);
-		it->lockCount--;
+		if(!--it->lockCount)
+			_addToReclaim(it, index);
 	}
 }
 
@@ -1685,10 +2659,9 @@ frg::tuple<PhysicalAddr, CachingMode> CopyOnWriteMemory::peekRange(uintptr_t off
 	auto irq_lock = frg::guard(&irqMutex());
 	auto lock = frg::guard(&_mutex);
 
-	if(auto it = _ownedPages.find(offset >> kPageShift); it) {
-		assert(it->state == CowState::hasCopy);
+	// Pages that are being evicted need to go through fetchRange() to cancel the eviction.
+	if(auto it = _ownedPages.find(offset >> kPageShift); it && it->state == CowState::hasCopy)
 		return frg::tuple<PhysicalAddr, CachingMode>{it->physical, CachingMode::null};
-	}
 
 	return frg::tuple<PhysicalAddr, CachingMode>{PhysicalAddr(-1), CachingMode::null};
 }
@@ -1707,6 +2680,16 @@ CopyOnWriteMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<
 
 		cowIt = _ownedPages.find(offset >> kPageShift);
 		if(cowIt) {
+			cowIt->lazyFree = false;
+			if(cowIt->state != CowState::hasCopy && cowIt->state != CowState::inProgress) {
+				_makePresent(cowIt);
+				if(!cowIt->lockCount)
+					_addToReclaim(cowIt, offset >> kPageShift);
+			}else if(cowIt->state == CowState::hasCopy) {
+				if(cowIt->cachePage.flags & CachePage::reclaimRegistered)
+					globalReclaimer->bumpPage(&cowIt->cachePage);
+			}
+
 			if(cowIt->state == CowState::hasCopy) {
 				assert(cowIt->physical != PhysicalAddr(-1));
 
@@ -1716,6 +2699,9 @@ CopyOnWriteMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<
 				waitForCopy = true;
 			}
 		}else{
+			if(!_chargePage())
+				co_return Error::noMemory;
+
 			chain = _copyChain;
 			view = _view;
 			viewOffset = _viewOffset;
@@ -1734,41 +2720,35 @@ CopyOnWriteMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<
 				auto irqLock = frg::guard(&irqMutex());
 				auto lock = frg::guard(&_mutex);
 
-				if(cowIt->state == CowState::inProgress)
-					return true;
-				assert(cowIt->state == CowState::hasCopy);
-				return false;
+				return cowIt->state == CowState::inProgress;
 			});
 			co_await wq->schedule();
 		} while(stillWaiting);
 
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		// The reclaimer might have picked up the page in the meantime.
+		if(cowIt->state != CowState::hasCopy) {
+			_makePresent(cowIt);
+			if(!cowIt->lockCount)
+				_addToReclaim(cowIt, offset >> kPageShift);
+		}
 		co_return PhysicalRange{cowIt->physical, kPageSize, CachingMode::null};
 	}
 
-	PhysicalAddr physical = physicalAllocator->allocate(kPageSize);
-	assert(physical != PhysicalAddr(-1) && "OOM");
-	PageAccessor accessor{physical};
-
-	// Try to copy from a descendant CoW chain.
+	// Try to take the page from a descendant CoW chain.
 	auto pageOffset = viewOffset + offset;
-	while(chain) {
-		auto irqLock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&chain->_mutex);
-
-		if(auto it = chain->_pages.find(pageOffset >> kPageShift); it) {
-			// We can just copy synchronously here -- the descendant is not evicted.
-			auto srcPhysical = it->load(std::memory_order_relaxed);
-			assert(srcPhysical != PhysicalAddr(-1));
-			auto srcAccessor = PageAccessor{srcPhysical};
-			memcpy(accessor.get(), srcAccessor.get(), kPageSize);
-			break;
-		}
-
-		chain = chain->_superChain;
-	}
+	PhysicalAddr physical = PhysicalAddr(-1);
+	if(chain)
+		physical = _fetchFromChain(std::move(chain), pageOffset);
 
 	// Copy from the root view.
-	if(!chain) {
+	if(physical == PhysicalAddr(-1)) {
+		physical = physicalAllocator->allocate(kPageSize);
+		assert(physical != PhysicalAddr(-1) && "OOM");
+		PageAccessor accessor{physical};
+
 		FRG_CO_TRY(co_await view->copyFrom(pageOffset & ~(kPageSize - 1),
 				accessor.get(), kPageSize, wq));
 	}
@@ -1784,15 +2764,88 @@ CopyOnWriteMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<
 		assert(cowIt->state == CowState::inProgress);
 		cowIt->state = CowState::hasCopy;
 		cowIt->physical = physical;
+		if(!cowIt->lockCount)
+			_addToReclaim(cowIt, offset >> kPageShift);
 	}
 	_copyEvent.raise();
-	co_return PhysicalRange{cowIt->physical, kPageSize, CachingMode::null};
+	co_return PhysicalRange{physical, kPageSize, CachingMode::null};
 }
 
 void CopyOnWriteMemory::markDirty(uintptr_t, size_t) {
 	// We do not need to track dirty pages.
 }
 
+// Mergeability is tracked per object, not per range. Advising unmergeable only stops
+// the scanner; pages that are already merged are copied on their next fetch.
+Error CopyOnWriteMemory::adviseAccess(AccessAdvice advice, uintptr_t offset, size_t size) {
+	if(offset + size > _length)
+		return Error::outOfBounds;
+
+	if(advice == AccessAdvice::mergeable) {
+		globalMerger->addMemory(this);
+	}else if(advice == AccessAdvice::unmergeable) {
+		globalMerger->removeMemory(this);
+	}
+	return Error::success;
+}
+
+// Compressed and merged pages are not mapped, hence they are dropped immediately.
+// Other pages are marked (either as discarding or as lazily freed) and evicted from all
+// mappings at once, which takes a single shootdown per mapping. Concurrent fetches
+// cancel the discard (and keep the page's contents) as for compression and merging.
+coroutine<frg::expected<Error>> CopyOnWriteMemory::discardRange(uintptr_t offset, size_t size,
+		bool lazy) {
+	if(offset + size > _length)
+		co_return Error::outOfBounds;
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		for(size_t pg = 0; pg < size; pg += kPageSize) {
+			auto index = (offset + pg) >> kPageShift;
+			auto page = _ownedPages.find(index);
+			// Locked pages are in use (e.g., for DMA); they keep their contents.
+			if(!page || page->lockCount || page->state == CowState::inProgress)
+				continue;
+
+			if(page->state == CowState::compressed || page->state == CowState::merged) {
+				_dropPage(page, index);
+			}else if(lazy) {
+				page->lazyFree = true;
+				if(page->state != CowState::hasCopy)
+					continue;
+				if(!(page->cachePage.flags & CachePage::reclaimRegistered))
+					_addToReclaim(page, index);
+				globalReclaimer->demotePage(&page->cachePage);
+			}else{
+				_removeFromReclaim(page);
+				page->state = CowState::discarding;
+			}
+		}
+	}
+
+	// Lazily freed pages are evicted as well such that accesses fault and clear lazyFree.
+	co_await _evictQueue.evictRange(offset, size);
+
+	if(lazy)
+		co_return {};
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		for(size_t pg = 0; pg < size; pg += kPageSize) {
+			auto index = (offset + pg) >> kPageShift;
+			auto page = _ownedPages.find(index);
+			if(!page || page->state != CowState::discarding)
+				continue;
+			_dropPage(page, index);
+		}
+	}
+	co_return {};
+}
+
 coroutine<frg::expected<Error, PhysicalAddr>> CopyOnWriteMemory::takeGlobalFutex(uintptr_t offset,
 		smarter::shared_ptr<WorkQueue> wq) {
 	// For now, we pick the trival implementation here.
@@ -0,0 +1,29 @@
+#include <thor-internal/metrics.hpp>
+
+namespace thor {
+
+namespace {
+	// Metrics are registered by static constructors, i.e., before other CPUs run.
+	constinit Metric *metricList = nullptr;
+	constinit size_t numUsedSlots = 0;
+}
+
+Metric::Metric(const char *name, const char *description, MetricType type, size_t numSlots)
+: _name{name}, _description{description}, _type{type}, _slot{numUsedSlots}, _next{metricList} {
+	assert(numUsedSlots + numSlots <= maxMetricSlots && "Increase maxMetricSlots");
+	numUsedSlots += numSlots;
+	metricList = this;
+}
+
+uint64_t Metric::aggregate(size_t i) const {
+	uint64_t sum = 0;
+	for(int k = 0; k < getCpuCount(); k++)
+		sum += getCpuData(k)->metricSlots[_slot + i].load(std::memory_order_relaxed);
+	return sum;
+}
+
+Metric *firstMetric() {
+	return metricList;
+}
+
+} // namespace thor
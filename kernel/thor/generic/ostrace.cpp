@@ -2,9 +2,11 @@
 #include <bragi/helpers-frigg.hpp>
 #include <frg/small_vector.hpp>
 #include <frg/span.hpp>
+#include <frg/vector.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/kernel-io.hpp>
 #include <thor-internal/main.hpp>
+#include <thor-internal/memory-view.hpp>
 #include <thor-internal/ostrace.hpp>
 #include <thor-internal/stream.hpp>
 #include <thor-internal/timer.hpp>
@@ -32,6 +34,22 @@ namespace {
 std::atomic<uint64_t> nextId{1};
 frg::manual_box<LogRingBuffer> globalOsTraceRing;
 
+using managarm::ostrace::RingLayout;
+
+// Ring that a userspace thread writes EventRecords into (see SetupRingReq).
+struct UserOsTraceRing {
+	smarter::shared_ptr<AllocatedMemory> memory;
+	PhysicalAddr physical;
+	// Set once the lane that the ring was set up on is closed.
+	// The drain fiber frees the ring after draining it one last time.
+	std::atomic<bool> closed{false};
+	// Only accessed by the drain fiber.
+	uint64_t tail = 0;
+};
+
+frg::ticket_spinlock userRingsMutex;
+frg::manual_box<frg::vector<UserOsTraceRing *, KernelAlloc>> userRings;
+
 initgraph::Task initOsTraceCore{&globalInitEngine, "generic.init-ostrace-core",
 	initgraph::Entails{getOsTraceAvailableStage()},
 	[] {
@@ -41,10 +59,16 @@ initgraph::Task initOsTraceCore{&globalInitEngine, "generic.init-ostrace-core",
 		void *osTraceMemory = kernelAlloc->allocate(1 << 20);
 		globalOsTraceRing.initialize(reinterpret_cast<uintptr_t>(osTraceMemory), 1 << 20);
 
+		userRings.initialize(*kernelAlloc);
+
 		osTraceInUse.store(true);
 	}
 };
 
+// Maximal size of a serialized record. Records are serialized on the stack.
+constexpr size_t maxRecordSize = 256;
+static_assert(maxRecordSize >= managarm::ostrace::RingLayout::RING_MAX_RECORD);
+
 template<typename R>
 void commitOsTrace(R record) {
 	if(!osTraceInUse.load(std::memory_order_relaxed))
@@ -63,6 +87,27 @@ void commitOsTrace(R record) {
 	globalOsTraceRing->enqueue(ser.data(), ser.size(), !intsAreEnabled());
 }
 
+// Events are written to a per-CPU ring without taking any locks; a fiber moves them
+// to the global ring. Events from different CPUs are thus not ordered by their timestamps.
+void commitOsTraceEvent(const managarm::ostrace::EventRecord<KernelAlloc> &record) {
+	char ser[maxRecordSize];
+	auto ts = record.size_of_tail();
+	bool encodeSuccess = bragi::write_head_tail(record,
+			frg::span<char>(ser, 8),
+			frg::span<char>(ser + 8, ts));
+	assert(encodeSuccess);
+
+	// Disabling IRQs guarantees that only a single context writes to the ring.
+	auto irqLock = frg::guard(&irqMutex());
+
+	auto ring = getCpuData()->localOsTraceRing.load(std::memory_order_relaxed);
+	if(!ring) {
+		ring = frg::construct<SingleContextRecordRing>(*kernelAlloc);
+		getCpuData()->localOsTraceRing.store(ring, std::memory_order_release);
+	}
+	ring->enqueue(ser, 8 + ts);
+}
+
 } // anonymous namespace
 
 OsTraceEventId announceOsTraceEvent(frg::string_view name) {
@@ -76,16 +121,127 @@ OsTraceEventId announceOsTraceEvent(frg::string_view name) {
 	return static_cast<OsTraceEventId>(id);
 }
 
+OsTraceItemId announceOsTraceItem(frg::string_view name) {
+	auto id = nextId.fetch_add(1, std::memory_order_relaxed);
+
+	managarm::ostrace::AnnounceItemRecord<KernelAlloc> record{*kernelAlloc};
+	record.set_id(id);
+	record.set_name(frg::string<KernelAlloc>{*kernelAlloc, name});
+	commitOsTrace(std::move(record));
+
+	return static_cast<OsTraceItemId>(id);
+}
+
 void emitOsTrace(managarm::ostrace::EventRecord<KernelAlloc> record) {
+	if(!osTraceInUse.load(std::memory_order_relaxed))
+		return;
+
 	record.set_ts(systemClockSource()->currentNanos());
 
-	commitOsTrace(std::move(record));
+	// Records with many counters (which can only be emitted by userspace) are rare.
+	// They bypass the per-CPU rings.
+	if(8 + record.size_of_tail() > maxRecordSize) {
+		commitOsTrace(std::move(record));
+		return;
+	}
+	commitOsTraceEvent(record);
 }
 
 LogRingBuffer *getGlobalOsTraceRing() {
 	return globalOsTraceRing.get();
 }
 
+namespace {
+
+constexpr size_t userRingCapacity = RingLayout::RING_SIZE - RingLayout::RING_DATA;
+
+// Copies data out of the ring, taking care of wrap-around.
+// Note that the ring is physically contiguous but we only access it page by page.
+void copyFromUserRing(UserOsTraceRing *ring, uint64_t pos, char *buffer, size_t size) {
+	size_t progress = 0;
+	while(progress < size) {
+		auto offset = RingLayout::RING_DATA + (pos + progress) % userRingCapacity;
+		auto misalign = offset & (kPageSize - 1);
+		auto chunk = frg::min(size - progress, kPageSize - misalign);
+		chunk = frg::min(chunk, static_cast<size_t>(RingLayout::RING_SIZE - offset));
+
+		PageAccessor accessor{ring->physical + (offset - misalign)};
+		memcpy(buffer + progress, reinterpret_cast<char *>(accessor.get()) + misalign, chunk);
+		progress += chunk;
+	}
+}
+
+uint64_t *userRingWord(PageAccessor &accessor, uintptr_t offset) {
+	return reinterpret_cast<uint64_t *>(reinterpret_cast<char *>(accessor.get()) + offset);
+}
+
+// Moves all complete records of the ring to the global ring.
+void drainUserRing(UserOsTraceRing *ring) {
+	// The RING_HEAD and RING_TAIL words are both on the first page.
+	PageAccessor accessor{ring->physical};
+	auto head = __atomic_load_n(userRingWord(accessor, RingLayout::RING_HEAD), __ATOMIC_ACQUIRE);
+	auto tail = ring->tail;
+
+	// Userspace controls the ring, hence we need to validate everything.
+	// If the ring is corrupted, we discard its contents.
+	if(head - tail > userRingCapacity)
+		tail = head;
+
+	while(head - tail >= 8) {
+		char buffer[maxRecordSize];
+		copyFromUserRing(ring, tail, buffer, 8);
+
+		auto preamble = bragi::read_preamble(frg::span<const char>{buffer, 8});
+		size_t size = 8 + preamble.tail_size();
+		if(preamble.error()
+				|| preamble.id() != bragi::message_id<managarm::ostrace::EventRecord>
+				|| size > maxRecordSize || size > head - tail) {
+			tail = head;
+			break;
+		}
+
+		copyFromUserRing(ring, tail + 8, buffer + 8, size - 8);
+		globalOsTraceRing->enqueue(buffer, size);
+		tail += size;
+	}
+
+	ring->tail = tail;
+	__atomic_store_n(userRingWord(accessor, RingLayout::RING_TAIL), tail, __ATOMIC_RELEASE);
+}
+
+void drainUserRings() {
+	frg::vector<UserOsTraceRing *, KernelAlloc> rings{*kernelAlloc};
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&userRingsMutex);
+		for(auto ring : *userRings)
+			rings.push(ring);
+	}
+
+	for(auto ring : rings) {
+		// Check before draining such that we do not miss records written before closing.
+		bool closed = ring->closed.load(std::memory_order_acquire);
+		drainUserRing(ring);
+		if(!closed)
+			continue;
+
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&userRingsMutex);
+			for(size_t i = 0; i < userRings->size(); ++i) {
+				if((*userRings)[i] != ring)
+					continue;
+				(*userRings)[i] = userRings->back();
+				userRings->pop();
+				break;
+			}
+		}
+		frg::destruct(*kernelAlloc, ring);
+	}
+}
+
+} // anonymous namespace
+
 // --------------------------------------------------------------------------------------
 // mbus object handling.
 // --------------------------------------------------------------------------------------
@@ -93,7 +249,8 @@ LogRingBuffer *getGlobalOsTraceRing() {
 namespace {
 
 coroutine<void> handleBind(LaneHandle objectLane);
-coroutine<Error> handleReq(LaneHandle boundLane);
+coroutine<Error> handleReq(LaneHandle boundLane,
+		frg::vector<UserOsTraceRing *, KernelAlloc> &rings);
 
 coroutine<void> createObject(LaneHandle mbusLane) {
 	auto [offerError, lane] = co_await OfferSender{mbusLane};
@@ -156,8 +313,11 @@ coroutine<void> handleBind(LaneHandle objectLane) {
 	auto boundLane = stream.get<0>();
 
 	async::detach_with_allocator(*kernelAlloc, ([] (LaneHandle boundLane) -> coroutine<void> {
+		// Rings that were set up on this lane.
+		frg::vector<UserOsTraceRing *, KernelAlloc> rings{*kernelAlloc};
+
 		while(true) {
-			auto error = co_await handleReq(boundLane);
+			auto error = co_await handleReq(boundLane, rings);
 			if(error == Error::endOfLane)
 				break;
 			if(error == Error::protocolViolation) {
@@ -167,10 +327,14 @@ coroutine<void> handleBind(LaneHandle objectLane) {
 				assert(error == Error::success);
 			}
 		}
+
+		for(auto ring : rings)
+			ring->closed.store(true, std::memory_order_release);
 	})(boundLane));
 }
 
-coroutine<Error> handleReq(LaneHandle boundLane) {
+coroutine<Error> handleReq(LaneHandle boundLane,
+		frg::vector<UserOsTraceRing *, KernelAlloc> &rings) {
 	auto [acceptError, lane] = co_await AcceptSender{boundLane};
 	if(acceptError == Error::endOfLane)
 		co_return Error::endOfLane;
@@ -245,6 +409,59 @@ coroutine<Error> handleReq(LaneHandle boundLane) {
 			co_return Error::protocolViolation;
 		}
 	} break;
+	case bragi::message_id<managarm::ostrace::SetupRingReq>: {
+		auto maybeReq = bragi::parse_head_tail<managarm::ostrace::SetupRingReq>(
+				headSpan, tailSpan, *kernelAlloc);
+		if(!maybeReq)
+			co_return Error::protocolViolation;
+
+		managarm::ostrace::Response<KernelAlloc> resp(*kernelAlloc);
+		smarter::shared_ptr<AllocatedMemory> memory;
+		if(wantOsTrace) {
+			// Allocate the ring as a single chunk such that it is physically contiguous.
+			memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc,
+					RingLayout::RING_SIZE, 64, RingLayout::RING_SIZE);
+			memory->selfPtr = memory;
+			resp.set_error(managarm::ostrace::Error::SUCCESS);
+		}else{
+			resp.set_error(managarm::ostrace::Error::OSTRACE_GLOBALLY_DISABLED);
+		}
+
+		frg::string<KernelAlloc> ser(*kernelAlloc);
+		resp.SerializeToString(&ser);
+		frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, ser.size()};
+		memcpy(respBuffer.data(), ser.data(), ser.size());
+		auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+		if(respError != Error::success) {
+			assert(isRemoteIpcError(respError));
+			co_return Error::protocolViolation;
+		}
+
+		if(!memory)
+			break;
+
+		// AllocatedMemory::fetchRange() does not use the work queue.
+		auto physicalOrError = co_await memory->fetchRange(0, 0, nullptr);
+		assert(physicalOrError);
+		auto physical = physicalOrError.value().get<0>();
+
+		auto ring = frg::construct<UserOsTraceRing>(*kernelAlloc);
+		ring->memory = memory;
+		ring->physical = physical;
+		rings.push(ring);
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&userRingsMutex);
+			userRings->push(ring);
+		}
+
+		auto memoryError = co_await PushDescriptorSender{lane,
+				MemoryViewDescriptor{std::move(memory)}};
+		if(memoryError != Error::success) {
+			assert(isRemoteIpcError(memoryError));
+			co_return Error::protocolViolation;
+		}
+	} break;
 	case bragi::message_id<managarm::ostrace::AnnounceEventReq>: {
 		auto maybeReq = bragi::parse_head_tail<managarm::ostrace::AnnounceEventReq>(
 				headSpan, tailSpan, *kernelAlloc);
@@ -324,6 +541,40 @@ initgraph::Task initOsTraceMbus{&globalInitEngine, "generic.init-ostrace-sinks",
 		getFibersAvailableStage(),
 		getIoChannelsDiscoveredStage()},
 	[] {
+		// Create a fiber that moves events from the per-CPU rings (and from the
+		// rings of userspace threads) to the global ring.
+		if(wantOsTrace) {
+			KernelFiber::run([=] {
+				frg::vector<uint64_t, KernelAlloc> deqPtrs{*kernelAlloc};
+
+				while(true) {
+					// CPUs can come up after this fiber starts.
+					if(deqPtrs.size() < static_cast<size_t>(getCpuCount()))
+						deqPtrs.resize(getCpuCount(), 0);
+
+					for(int i = 0; i < getCpuCount(); i++) {
+						auto ring = getCpuData(i)->localOsTraceRing.load(std::memory_order_acquire);
+						if(!ring)
+							continue;
+
+						while(true) {
+							char buffer[maxRecordSize];
+							auto [success, recordPtr, newPtr, size] = ring->dequeueAt(
+									deqPtrs[i], buffer, maxRecordSize);
+							deqPtrs[i] = newPtr;
+							if(!success)
+								break;
+							globalOsTraceRing->enqueue(buffer, size);
+						}
+					}
+
+					drainUserRings();
+
+					KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(1'000'000));
+				}
+			});
+		}
+
 		// Create a fiber to manage requests to the ostrace mbus object.
 		KernelFiber::run([=] {
 			// We unconditionally create the mbus object since userspace might use it.
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <thor-internal/arch/ints.hpp>
 #include <thor-internal/arch/paging.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/debug.hpp>
@@ -54,16 +55,66 @@ void PhysicalChunkAllocator::bootstrapRegion(PhysicalAddr address,
 	_freePages.store(currentFree + (numRoots << order), std::memory_order_relaxed);
 }
 
-PhysicalAddr PhysicalChunkAllocator::allocate(size_t size, int addressBits) {
+void PhysicalChunkAllocator::assignNode(PhysicalAddr address, size_t size, int node) {
+	assert(node >= 0 && node < maxNumaNodes);
+
 	auto irq_lock = frg::guard(&irqMutex());
 	auto lock = frg::guard(&_mutex);
 
-	auto currentFree = _freePages.load(std::memory_order_relaxed);
-	auto currentUsed = _usedPages.load(std::memory_order_relaxed);
-	assert(currentFree > size / kPageSize);
-	_freePages.store(currentFree - size / kPageSize, std::memory_order_relaxed);
-	_usedPages.store(currentUsed + size / kPageSize, std::memory_order_relaxed);
+	for(int i = 0; i < _numRegions; i++) {
+		if(_allRegions[i].physicalBase < address
+				|| _allRegions[i].physicalBase - address >= size)
+			continue;
+		_allRegions[i].node = node;
+	}
+	if(node >= _numNodes)
+		_numNodes = node + 1;
+}
+
+size_t PhysicalChunkAllocator::numTotalPagesOfNode(int node) {
+	size_t n = 0;
+	for(int i = 0; i < _numRegions; i++)
+		if(_allRegions[i].node == node)
+			n += _allRegions[i].regionSize >> kPageShift;
+	return n;
+}
+
+size_t PhysicalChunkAllocator::numUsedPagesOfNode(int node) {
+	size_t n = 0;
+	for(int i = 0; i < _numRegions; i++)
+		if(_allRegions[i].node == node)
+			n += _allRegions[i].usedPages.load(std::memory_order_relaxed);
+	return n;
+}
+
+namespace {
+	int cacheLevelOf(int order) {
+		for(int k = 0; k < PhysicalPageCache::numLevels; k++)
+			if(PhysicalPageCache::levels[k].order == order)
+				return k;
+		return -1;
+	}
+
+	// Pages that are zeroed ahead of time are usually not touched again soon;
+	// avoid evicting useful cache lines for them.
+	void zeroPageNonTemporal(void *page) {
+#ifdef __x86_64__
+		auto p = reinterpret_cast<uint64_t *>(page);
+		for(size_t i = 0; i < kPageSize / sizeof(uint64_t); i += 4)
+			asm volatile ("movnti %1, 0(%0)\n"
+					"\tmovnti %1, 8(%0)\n"
+					"\tmovnti %1, 16(%0)\n"
+					"\tmovnti %1, 24(%0)"
+					: : "r"(p + i), "r"(uint64_t{0}) : "memory");
+		// Non-temporal stores are weakly ordered; complete them before the page is handed out.
+		asm volatile ("sfence" : : : "memory");
+#else
+		memset(page, 0, kPageSize);
+#endif
+	}
+}
 
+PhysicalAddr PhysicalChunkAllocator::allocate(size_t size, int addressBits, int node) {
 	// TODO: This could be solved better.
 	int target = 0;
 	while(size > (size_t(kPageSize) << target))
@@ -73,45 +124,267 @@ PhysicalAddr PhysicalChunkAllocator::allocate(size_t size, int addressBits) {
 	if(logPhysicalAllocs)
 		infoLogger() << "thor: Allocating physical memory of order "
 					<< (target + kPageShift) << frg::endlog;
-	for(int i = 0; i < _numRegions; i++) {
-		if(target > _allRegions[i].buddyAccessor.tableOrder())
-			continue;
 
-		auto physical = _allRegions[i].buddyAccessor.allocate(target, addressBits);
-		if(physical == BuddyAccessor::illegalAddress)
-			continue;
-	//	infoLogger() << "Allocate " << (void *)physical << frg::endlog;
-		assert(!(physical % (size_t(kPageSize) << target)));
-		return physical;
+	auto irq_lock = frg::guard(&irqMutex());
+
+	bool strict = node != anyNode;
+	if(!strict)
+		node = getCpuData()->numaNode;
+
+	// Cached pages can be located anywhere; only use them for unrestricted allocations.
+	int level = cacheLevelOf(target);
+	if(level >= 0 && addressBits >= 64 && !strict) {
+		auto cache = &getCpuData()->pageCache;
+		auto &info = PhysicalPageCache::levels[level];
+		auto cacheLock = frg::guard(&cache->mutex);
+
+		if(!cache->count[level]) {
+			auto lock = frg::guard(&_mutex);
+			while(cache->count[level] < info.batch) {
+				auto physical = _allocateFromBuddy(target, addressBits, node, false);
+				if(physical == static_cast<PhysicalAddr>(-1))
+					break;
+				cache->pages[level][cache->count[level]++] = physical;
+			}
+		}
+
+		if(cache->count[level]) {
+			auto physical = cache->pages[level][--cache->count[level]];
+			_markUsed(physical, size);
+			return physical;
+		}
 	}
 
-	return static_cast<PhysicalAddr>(-1);
+	PhysicalAddr physical;
+	{
+		auto lock = frg::guard(&_mutex);
+		physical = _allocateFromBuddy(target, addressBits, node, strict);
+	}
+	if(physical == static_cast<PhysicalAddr>(-1)) {
+		// The hot lists of other CPUs may still hold free pages.
+		_drainCaches();
+
+		auto lock = frg::guard(&_mutex);
+		physical = _allocateFromBuddy(target, addressBits, node, strict);
+		if(physical == static_cast<PhysicalAddr>(-1))
+			return physical;
+	}
+
+	_markUsed(physical, size);
+	return physical;
 }
 
 void PhysicalChunkAllocator::free(PhysicalAddr address, size_t size) {
-	auto irq_lock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&_mutex);
-	
 	int target = 0;
 	while(size > (size_t(kPageSize) << target))
 		target++;
 
+	auto irq_lock = frg::guard(&irqMutex());
+
+	_markFree(address, size);
+
+	int level = cacheLevelOf(target);
+	if(level >= 0) {
+		auto cache = &getCpuData()->pageCache;
+		auto &info = PhysicalPageCache::levels[level];
+		auto cacheLock = frg::guard(&cache->mutex);
+
+		if(cache->count[level] == info.high) {
+			auto lock = frg::guard(&_mutex);
+			for(size_t j = 0; j < info.batch; j++)
+				_freeToBuddy(cache->pages[level][--cache->count[level]], target);
+		}
+
+		cache->pages[level][cache->count[level]++] = address;
+		return;
+	}
+
+	auto lock = frg::guard(&_mutex);
+	_freeToBuddy(address, target);
+}
+
+PhysicalAddr PhysicalChunkAllocator::allocateZeroedPage() {
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+
+		auto cache = &getCpuData()->pageCache;
+		auto cacheLock = frg::guard(&cache->mutex);
+		if(cache->numZeroed) {
+			auto physical = cache->zeroed[--cache->numZeroed];
+			_markUsed(physical, kPageSize);
+			return physical;
+		}
+	}
+
+	auto physical = allocate(kPageSize);
+	if(physical == static_cast<PhysicalAddr>(-1))
+		return physical;
+
+	PageAccessor accessor{physical};
+	memset(accessor.get(), 0, kPageSize);
+	return physical;
+}
+
+void PhysicalChunkAllocator::freeZeroedPage(PhysicalAddr physical) {
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+
+		// Keep a slot for the page that the idle loop is zeroing (see zeroPagesWhileIdle()).
+		auto cache = &getCpuData()->pageCache;
+		auto cacheLock = frg::guard(&cache->mutex);
+		auto limit = PhysicalPageCache::maxZeroedPages;
+		if(cache->zeroing != static_cast<PhysicalAddr>(-1))
+			limit--;
+		if(cache->numZeroed < limit) {
+			_markFree(physical, kPageSize);
+			cache->zeroed[cache->numZeroed++] = physical;
+			return;
+		}
+	}
+
+	free(physical, kPageSize);
+}
+
+void PhysicalChunkAllocator::zeroPagesWhileIdle() {
+	assert(!intsAreEnabled());
+
+	auto cache = &getCpuData()->pageCache;
+	while(true) {
+		if(cache->zeroing == static_cast<PhysicalAddr>(-1)) {
+			auto cacheLock = frg::guard(&cache->mutex);
+			if(cache->numZeroed == PhysicalPageCache::maxZeroedPages)
+				return;
+
+			// Prefer pages from the hot list; they are freed soonest and hence
+			// least likely to still be cached.
+			if(cache->count[0]) {
+				cache->zeroing = cache->pages[0][--cache->count[0]];
+			}else{
+				auto lock = frg::guard(&_mutex);
+				cache->zeroing = _allocateFromBuddy(0, 64, getCpuData()->numaNode, false);
+				if(cache->zeroing == static_cast<PhysicalAddr>(-1))
+					return;
+			}
+		}
+
+		// If an IRQ preempts the idle task here, we restart this page on the next call.
+		enableInts();
+		PageAccessor accessor{cache->zeroing};
+		zeroPageNonTemporal(accessor.get());
+		disableInts();
+
+		// IRQ handlers and _drainCaches() can only take pages from zeroed,
+		// hence there is still room.
+		auto cacheLock = frg::guard(&cache->mutex);
+		assert(cache->numZeroed < PhysicalPageCache::maxZeroedPages);
+		cache->zeroed[cache->numZeroed++] = cache->zeroing;
+		cache->zeroing = static_cast<PhysicalAddr>(-1);
+	}
+}
+
+void PhysicalChunkAllocator::_markFree(PhysicalAddr address, size_t size) {
+	auto previousUsed = _usedPages.fetch_sub(size / kPageSize, std::memory_order_relaxed);
+	assert(previousUsed > size / kPageSize);
+	_freePages.fetch_add(size / kPageSize, std::memory_order_relaxed);
+	_regionOf(address, size)->usedPages.fetch_sub(size / kPageSize,
+			std::memory_order_relaxed);
+}
+
+void PhysicalChunkAllocator::_markUsed(PhysicalAddr address, size_t size) {
+	auto previousFree = _freePages.fetch_sub(size / kPageSize, std::memory_order_relaxed);
+	assert(previousFree > size / kPageSize);
+	_usedPages.fetch_add(size / kPageSize, std::memory_order_relaxed);
+	_regionOf(address, size)->usedPages.fetch_add(size / kPageSize,
+			std::memory_order_relaxed);
+}
+
+auto PhysicalChunkAllocator::_regionOf(PhysicalAddr address, size_t size) -> Region * {
 	for(int i = 0; i < _numRegions; i++) {
 		if(address < _allRegions[i].physicalBase)
 			continue;
 		if(address + size - _allRegions[i].physicalBase > _allRegions[i].regionSize)
 			continue;
+		return &_allRegions[i];
+	}
 
-		_allRegions[i].buddyAccessor.free(address, target);
-		auto currentFree = _freePages.load(std::memory_order_relaxed);
-		auto currentUsed = _usedPages.load(std::memory_order_relaxed);
-		assert(currentUsed > size / kPageSize);
-		_freePages.store(currentFree + size / kPageSize, std::memory_order_relaxed);
-		_usedPages.store(currentUsed - size / kPageSize, std::memory_order_relaxed);
-		return;
+	panicLogger() << "thor: Physical page " << (void *)address
+			<< " is not part of any region" << frg::endlog;
+	__builtin_unreachable();
+}
+
+PhysicalAddr PhysicalChunkAllocator::_allocateFromBuddy(int order, int addressBits,
+		int node, bool strict) {
+	// First try regions of the preferred node, then (unless strict) all other regions.
+	for(int pass = 0; pass < 2; pass++) {
+		if(pass && strict)
+			break;
+
+		for(int i = 0; i < _numRegions; i++) {
+			if((_allRegions[i].node == node) != !pass)
+				continue;
+			if(order > _allRegions[i].buddyAccessor.tableOrder())
+				continue;
+
+			auto physical = _allRegions[i].buddyAccessor.allocate(order, addressBits);
+			if(physical == BuddyAccessor::illegalAddress)
+				continue;
+		//	infoLogger() << "Allocate " << (void *)physical << frg::endlog;
+			assert(!(physical % (size_t(kPageSize) << order)));
+			return physical;
+		}
 	}
 
-	assert(!"Physical page is not part of any region");
+	return static_cast<PhysicalAddr>(-1);
+}
+
+void PhysicalChunkAllocator::_freeToBuddy(PhysicalAddr address, int order) {
+	auto size = size_t(kPageSize) << order;
+	_regionOf(address, size)->buddyAccessor.free(address, order);
+}
+
+void PhysicalChunkAllocator::_drainCaches() {
+	assert(!intsAreEnabled());
+
+	for(int i = 0; i < getCpuCount(); i++) {
+		auto cache = &getCpuData(i)->pageCache;
+		auto cacheLock = frg::guard(&cache->mutex);
+		auto lock = frg::guard(&_mutex);
+
+		for(int k = 0; k < PhysicalPageCache::numLevels; k++) {
+			while(cache->count[k])
+				_freeToBuddy(cache->pages[k][--cache->count[k]],
+						PhysicalPageCache::levels[k].order);
+		}
+		while(cache->numZeroed)
+			_freeToBuddy(cache->zeroed[--cache->numZeroed], 0);
+	}
+}
+
+// --------------------------------------------------------
+// DetachedPageList
+// --------------------------------------------------------
+
+void DetachedPageList::push(PhysicalAddr physical) {
+	PageAccessor accessor{physical};
+	auto link = reinterpret_cast<PhysicalAddr *>(accessor.get());
+	assert(!*link);
+	// The last page keeps a zero link; the list is terminated by _count instead.
+	if(_count)
+		__atomic_store_n(link, _head, __ATOMIC_RELAXED);
+	_head = physical;
+	_count++;
+}
+
+void DetachedPageList::free() {
+	while(_count) {
+		auto physical = _head;
+		PageAccessor accessor{physical};
+		auto link = reinterpret_cast<PhysicalAddr *>(accessor.get());
+		_head = *link;
+		*link = 0;
+		_count--;
+		physicalAllocator->freeZeroedPage(physical);
+	}
 }
 
 } // namespace thor
@@ -10,11 +10,61 @@
 
 namespace thor {
 
+extern frg::manual_box<frg::string<KernelAlloc>> kernelCommandLine;
+
 bool wantKernelProfile = false;
+ProfileEvent kernelProfileEvent = ProfileEvent::cycles;
+
+THOR_DEFINE_COUNTER_METRIC(numShootdownIpis, "thor.ipi.shootdown",
+		"TLB shootdown IPIs that were sent");
+THOR_DEFINE_COUNTER_METRIC(numPingIpis, "thor.ipi.ping",
+		"Wakeup/preemption pings that required an IPI");
+THOR_DEFINE_COUNTER_METRIC(numIdleWakesWithoutIpi, "thor.ipi.avoided",
+		"Pings that were delivered through the MWAIT monitor of an idle CPU");
 
 namespace {
 	frg::manual_box<LogRingBuffer> globalProfileRing;
 
+	struct {
+		frg::string_view name;
+		ProfileEvent event;
+	} profileEventNames[] = {
+		{"cycles", ProfileEvent::cycles},
+		{"instructions", ProfileEvent::instructions},
+		{"llc-misses", ProfileEvent::llcMisses},
+		{"branch-misses", ProfileEvent::branchMisses}
+	};
+
+	void parseProfileEvent() {
+		frg::string_view cmdline{kernelCommandLine->data(), kernelCommandLine->size()};
+		frg::string_view prefix{"kernel-profile.event="};
+
+		size_t i = 0;
+		while(i < cmdline.size()) {
+			while(i < cmdline.size() && cmdline[i] == ' ')
+				i++;
+			size_t j = i;
+			while(j < cmdline.size() && cmdline[j] != ' ')
+				j++;
+
+			auto token = cmdline.sub_string(i, j - i);
+			if(token.size() >= prefix.size() && token.sub_string(0, prefix.size()) == prefix) {
+				auto name = token.sub_string(prefix.size(), token.size() - prefix.size());
+				bool found = false;
+				for(auto &entry : profileEventNames) {
+					if(entry.name != name)
+						continue;
+					kernelProfileEvent = entry.event;
+					found = true;
+				}
+				if(!found)
+					infoLogger() << "\e[31m" "thor: Unknown profiling event " << name
+							<< ", falling back to cycles" "\e[39m" << frg::endlog;
+			}
+			i = j;
+		}
+	}
+
 	initgraph::Task initProfilingSinks{&globalInitEngine, "generic.init-profiling-sinks",
 		initgraph::Requires{getFibersAvailableStage(),
 			getIoChannelsDiscoveredStage()},
@@ -28,15 +78,55 @@ namespace {
 				async::detach_with_allocator(*kernelAlloc,
 						dumpRingToChannel(globalProfileRing.get(), std::move(channel), 2048));
 			}
+
+			// The profile ring only contains IP samples, so IPI rates go to the log.
+			KernelFiber::run([=] {
+				uint64_t lastCount = 0;
+				uint64_t lastPings = 0;
+				uint64_t lastIdleWakes = 0;
+				while(true) {
+					KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(1'000'000'000));
+
+					auto count = numShootdownIpis.read();
+					if(count != lastCount)
+						infoLogger() << "thor: " << (count - lastCount)
+								<< " shootdown IPIs per second" << frg::endlog;
+					lastCount = count;
+
+					auto pings = numPingIpis.read();
+					auto idleWakes = numIdleWakesWithoutIpi.read();
+					if(pings != lastPings || idleWakes != lastIdleWakes)
+						infoLogger() << "thor: " << (pings - lastPings)
+								<< " ping IPIs and " << (idleWakes - lastIdleWakes)
+								<< " IPI-less idle wakeups per second" << frg::endlog;
+					lastPings = pings;
+					lastIdleWakes = idleWakes;
+				}
+			});
 		}
 	};
 }
 
+uint64_t profileSamplePeriod(ProfileEvent event) {
+	// The periods of cycles and instructions yield 5000 samples per second on a 1 GHz machine.
+	switch(event) {
+	case ProfileEvent::cycles:
+	case ProfileEvent::instructions:
+		return 1'000'000'000 / 5000;
+	case ProfileEvent::llcMisses:
+	case ProfileEvent::branchMisses:
+		return 1'000;
+	}
+	__builtin_unreachable();
+}
+
 void initializeProfile() {
 #ifdef __x86_64__
 	if(!wantKernelProfile)
 		return;
 
+	parseProfileEvent();
+
 	if(!(getGlobalCpuFeatures()->profileFlags & CpuFeatures::profileIntelSupported)
 			&& !(getGlobalCpuFeatures()->profileFlags & CpuFeatures::profileAmdSupported)) {
 		infoLogger() << "\e[31m" "thor: Kernel profiling was requested but"
@@ -66,16 +156,16 @@ void initializeProfile() {
 
 		uint64_t deqPtr = 0;
 		while(true) {
-			char buffer[128];
+			char buffer[sizeof(ProfileSample)];
 			auto [success, recordPtr, newPtr, size] = getCpuData()->localProfileRing->dequeueAt(
-					deqPtr, buffer, 128);
+					deqPtr, buffer, sizeof(ProfileSample));
 			deqPtr = newPtr;
 			if(!success) {
 				KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(1'000'000));
 				continue;
 			}
 			assert(size);
-			assert(size < 128);
+			assert(size <= sizeof(ProfileSample));
 
 			globalProfileRing->enqueue(buffer, size);
 		}
@@ -4,6 +4,7 @@
 #include <cralgo/aes.hpp>
 #include <cralgo/sha2_32.hpp>
 #include <thor-internal/arch/cpu.hpp>
+#include <thor-internal/cpu-data.hpp>
 #include <thor-internal/kernel_heap.hpp>
 #include <thor-internal/random.hpp>
 #include <thor-internal/debug.hpp>
@@ -75,6 +76,12 @@ struct Fortuna {
 		cralgo::sha256_clear(&keyHash);
 		cralgo::sha256_update(&keyHash, tempDigest, keySize);
 		cralgo::sha256_finalize(&keyHash, keyBytes_);
+		generation_.fetch_add(1, std::memory_order_release);
+	}
+
+	// Incremented whenever new entropy is mixed into the generator key.
+	uint32_t generation() {
+		return generation_.load(std::memory_order_acquire);
 	}
 
 	size_t generate(void *buffer, size_t size) {
@@ -128,6 +135,7 @@ struct Fortuna {
 			//       the true amount of entropy in the pool.
 			++reseedNumber_;
 			injectedIntoPoolZero_.store(0, std::memory_order_relaxed);
+			generation_.fetch_add(1, std::memory_order_release);
 		}
 
 		cralgo::aes_secret_key ek, dk;
@@ -182,6 +190,8 @@ private:
 	// This is protected by generatorMutex_;
 	uint32_t reseedNumber_ = 1;
 
+	std::atomic<uint32_t> generation_{1};
+
 	// The remaining fields form the entropy accumulator.
 	Pool pools_[numPools];
 	std::atomic<size_t> injectedIntoPoolZero_{0};
@@ -191,6 +201,77 @@ frg::manual_box<Fortuna> csprng;
 
 } // anonymous namespace
 
+// Serves generateRandomBytes() on a single CPU such that callers do not contend on
+// (and re-run the key schedule of) the global generator. This is an AES-CTR generator
+// keyed from the global one; after each refill of its output buffer, it replaces its key
+// by fresh output. Bytes are erased from the buffer once they are handed out.
+struct LocalCsprng {
+	static constexpr size_t bufferSize = 512;
+
+	// Draw a fresh key from the global generator after this many bytes of output.
+	static constexpr size_t reseedInterval = size_t{1} << 20;
+
+	size_t generate(void *buffer, size_t size) {
+		auto p = reinterpret_cast<char *>(buffer);
+		size_t progress = 0;
+		while(progress < size) {
+			if(!available_)
+				refill_();
+			auto chunk = frg::min(size - progress, available_);
+			auto src = buffer_ + bufferSize - available_;
+			memcpy(p + progress, src, chunk);
+			memset(src, 0, chunk);
+			available_ -= chunk;
+			progress += chunk;
+		}
+		return progress;
+	}
+
+private:
+	void rekey_(const uint8_t *key) {
+		cralgo::aes_secret_key dk;
+		cralgo::aes256_key_schedule(key, &ek_, &dk);
+		memset(ctrBlock_, 0, Fortuna::blockSize);
+	}
+
+	void encrypt_(uint8_t *out, size_t size) {
+		for(size_t n = 0; n < size; n += Fortuna::blockSize) {
+			cralgo::aes256_encrypt(ctrBlock_, out + n, 1, &ek_);
+			for(int i = 0; i < Fortuna::blockSize; ++i) {
+				if(++ctrBlock_[i])
+					break;
+			}
+		}
+	}
+
+	void refill_() {
+		uint8_t key[Fortuna::keySize];
+		if(generation_ != csprng->generation() || sinceReseed_ >= reseedInterval) {
+			csprng->generate(key, Fortuna::keySize);
+			generation_ = csprng->generation();
+			sinceReseed_ = 0;
+			rekey_(key);
+		}
+
+		encrypt_(key, Fortuna::keySize);
+		encrypt_(buffer_, bufferSize);
+		rekey_(key);
+		memset(key, 0, Fortuna::keySize);
+		available_ = bufferSize;
+		sinceReseed_ += bufferSize;
+	}
+
+	cralgo::aes_secret_key ek_;
+	uint8_t ctrBlock_[Fortuna::blockSize];
+	// Zero (i.e., never seeded) or the Fortuna::generation() that we were last keyed from.
+	uint32_t generation_ = 0;
+	size_t sinceReseed_ = 0;
+
+	uint8_t buffer_[bufferSize];
+	// Unused bytes at the end of buffer_.
+	size_t available_ = 0;
+};
+
 void initializeRandom() {
 	csprng.initialize();
 
@@ -220,7 +301,15 @@ void injectEntropy(unsigned int entropySource, unsigned int seqNum, void *buffer
 }
 
 size_t generateRandomBytes(void *buffer, size_t size) {
-	return csprng->generate(buffer, size);
+	// Disabling IRQs guarantees that only a single context uses the local generator.
+	auto irqLock = frg::guard(&irqMutex());
+
+	auto local = getCpuData()->localCsprng;
+	if(!local) {
+		local = frg::construct<LocalCsprng>(*kernelAlloc);
+		getCpuData()->localCsprng = local;
+	}
+	return local->generate(buffer, size);
 }
 
 } // namespace thor
@@ -3,6 +3,7 @@
 #include <thor-internal/arch/ints.hpp>
 #include <thor-internal/arch/cpu.hpp>
 #include <thor-internal/cpu-data.hpp>
+#include <thor-internal/physical.hpp>
 #include <thor-internal/schedule.hpp>
 #include <thor-internal/timer.hpp>
 
@@ -13,12 +14,28 @@ namespace {
 	constexpr bool logNextBest = false;
 	constexpr bool logUpdates = false;
 	constexpr bool logIdle = false;
+	constexpr bool logBalancing = false;
 
 	constexpr bool disablePreemption = false;
 
+	// Switch directly to an entity that was resumed by an entity that blocks afterwards,
+	// e.g., from a client that blocks on the reply to the server that serves its request.
+	constexpr bool enableDirectHandoff = true;
+
 	// Minimum length of a preemption time slice in ns.
 	constexpr int64_t sliceGranularity = 10'000'000;
 
+	// Time slice of round robin entities in ns.
+	constexpr uint64_t roundRobinSlice = 10'000'000;
+
+	// Interval of periodic load balancing in ns.
+	constexpr uint64_t balanceInterval = 50'000'000;
+
+	// Maximal number of waiting entities that we inspect to find a migratable one.
+	constexpr int maxMigrationCandidates = 4;
+
+	std::atomic<bool> loadBalancingEnabled{false};
+
 	struct IdleTask final : ScheduleEntity {
 		IdleTask()
 		: ScheduleEntity{ScheduleType::idle} { }
@@ -27,6 +44,7 @@ namespace {
 			runOnStack([] (Continuation) {
 				if(logIdle)
 					infoLogger() << "System is idle" << frg::endlog;
+				physicalAllocator->zeroPagesWhileIdle();
 				suspendSelf();
 				__builtin_trap();
 			}, getCpuData()->idleStack.base());
@@ -34,6 +52,7 @@ namespace {
 		}
 
 		void handlePreemption(IrqImageAccessor image) override {
+			resetIdleWakeState();
 			localScheduler()->update();
 			if(localScheduler()->maybeReschedule()) {
 				runOnStack([] (Continuation cont, IrqImageAccessor image) {
@@ -52,12 +71,20 @@ namespace {
 int ScheduleEntity::orderPriority(const ScheduleEntity *a, const ScheduleEntity *b) {
 	assert(a->type() == ScheduleType::regular);
 	assert(b->type() == ScheduleType::regular);
+	if(a->isRealtime() || b->isRealtime()) {
+		auto rank = [] (const ScheduleEntity *entity) {
+			return entity->isRealtime() ? 1 + entity->rtPriority : 0;
+		};
+		return rank(b) - rank(a);
+	}
 	return b->priority - a->priority; // Prefer larger priority.
 }
 
 bool ScheduleEntity::scheduleBefore(const ScheduleEntity *a, const ScheduleEntity *b) {
 	assert(a->type() == ScheduleType::regular);
 	assert(b->type() == ScheduleType::regular);
+	if(a->isRealtime() && b->isRealtime())
+		return a->_rtSequence < b->_rtSequence; // FIFO order.
 	return a->baseUnfairness - a->refProgress
 			> b->baseUnfairness - b->refProgress; // Prefer greater unfairness.
 }
@@ -90,22 +117,152 @@ void Scheduler::unassociate(ScheduleEntity *entity) {
 
 	assert(entity->state == ScheduleState::attached);
 	assert(entity != self->_current);
-	entity->_scheduler = nullptr;
+	{
+		auto lock = frg::guard(&self->_mutex);
+
+		// The entity might have blocked before its priority change was applied.
+		if(entity->_priorityChangePending) {
+			self->_priorityList.erase(self->_priorityList.iterator_to(entity));
+			entity->_priorityChangePending = false;
+			_commitPriority(entity);
+		}
+		__atomic_store_n(&entity->_scheduler, nullptr, __ATOMIC_RELAXED);
+	}
 	entity->state = ScheduleState::null;
 }
 
 void Scheduler::setPriority(ScheduleEntity *entity, int priority) {
 	assert(entity->type() == ScheduleType::regular);
 
-	auto scheduleLock = frg::guard(&irqMutex());
+	auto irqLock = frg::guard(&irqMutex());
+	{
+		auto lock = frg::guard(&entity->_donationMutex);
+		entity->_basePriority = priority;
+	}
+	_updatePriority(entity);
+}
 
-	auto self = entity->_scheduler;
-	assert(self);
+void Scheduler::setPolicy(ScheduleEntity *entity, SchedulePolicy policy, int rtPriority) {
+	assert(entity->type() == ScheduleType::regular);
+
+	auto irqLock = frg::guard(&irqMutex());
+	{
+		auto lock = frg::guard(&entity->_donationMutex);
+		entity->_basePolicy = policy;
+		entity->_baseRtPriority = rtPriority;
+	}
+	_updatePriority(entity);
+}
+
+void Scheduler::donatePriority(ScheduleEntity *entity, PriorityDonation *donation,
+		int priority) {
+	assert(entity->type() == ScheduleType::regular);
+
+	auto irqLock = frg::guard(&irqMutex());
+	{
+		auto lock = frg::guard(&entity->_donationMutex);
+		donation->_priority = priority;
+		if(!donation->_donated) {
+			entity->_donations.push_back(donation);
+			donation->_donated = true;
+		}
+	}
+	_updatePriority(entity);
+}
+
+void Scheduler::revokePriority(ScheduleEntity *entity, PriorityDonation *donation) {
+	assert(entity->type() == ScheduleType::regular);
+
+	auto irqLock = frg::guard(&irqMutex());
+	{
+		auto lock = frg::guard(&entity->_donationMutex);
+		if(!donation->_donated)
+			return;
+		entity->_donations.erase(entity->_donations.iterator_to(donation));
+		donation->_donated = false;
+	}
+	_updatePriority(entity);
+}
+
+// Recomputes the effective priority of an entity. Entities in a _waitQueue can only be
+// re-inserted by the owning CPU, hence we defer the change to its next update().
+void Scheduler::_updatePriority(ScheduleEntity *entity) {
+	assert(!intsAreEnabled());
+
+	int priority;
+	SchedulePolicy policy;
+	int rtPriority;
+	{
+		auto lock = frg::guard(&entity->_donationMutex);
+		priority = entity->_basePriority;
+		for(auto donation : entity->_donations)
+			priority = frg::max(priority, donation->_priority);
+		policy = entity->_basePolicy;
+		rtPriority = entity->_baseRtPriority;
+	}
 
-	// Otherwise, we would have to remove-reinsert into the queue.
-	assert(entity == self->_current);
+	// _scheduler only changes while holding the _mutex of the old scheduler.
+	Scheduler *self;
+	while(true) {
+		self = __atomic_load_n(&entity->_scheduler, __ATOMIC_ACQUIRE);
+		if(!self) {
+			__atomic_store_n(&entity->priority, priority, __ATOMIC_RELAXED);
+			entity->policy = policy;
+			entity->rtPriority = rtPriority;
+			return;
+		}
+		self->_mutex.lock();
+		if(__atomic_load_n(&entity->_scheduler, __ATOMIC_RELAXED) == self)
+			break;
+		self->_mutex.unlock();
+	}
+	frg::unique_lock lock{frg::adopt_lock, self->_mutex};
 
-	entity->priority = priority;
+	entity->_wantedPriority = priority;
+	entity->_wantedPolicy = policy;
+	entity->_wantedRtPriority = rtPriority;
+
+	// The current entity of this CPU can only change on this CPU.
+	if(entity->state == ScheduleState::attached || entity->state == ScheduleState::pending
+			|| (self == localScheduler() && entity == self->_current)) {
+		_commitPriority(entity);
+		return;
+	}
+
+	if(entity->_priorityChangePending)
+		return;
+	entity->_priorityChangePending = true;
+	self->_priorityList.push_back(entity);
+	lock.unlock();
+
+	if(self != localScheduler())
+		sendPingIpi(self->_cpuContext->cpuIndex);
+}
+
+void Scheduler::_commitPriority(ScheduleEntity *entity) {
+	__atomic_store_n(&entity->priority, entity->_wantedPriority, __ATOMIC_RELAXED);
+	entity->policy = entity->_wantedPolicy;
+	entity->rtPriority = entity->_wantedRtPriority;
+}
+
+void Scheduler::_applyPriorityChanges() {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	while(!_priorityList.empty()) {
+		auto entity = _priorityList.pop_front();
+		assert(entity->_priorityChangePending);
+		entity->_priorityChangePending = false;
+
+		if(entity->state == ScheduleState::active && entity != _current
+				&& entity != _scheduled) {
+			_waitQueue.remove(entity);
+			_commitPriority(entity);
+			_waitQueue.push(entity);
+		}else{
+			_commitPriority(entity);
+		}
+	}
 }
 
 void Scheduler::resume(ScheduleEntity *entity) {
@@ -126,6 +283,12 @@ void Scheduler::resume(ScheduleEntity *entity) {
 
 		wasEmpty = self->_pendingList.empty();
 		self->_pendingList.push_back(entity);
+
+		// Remember the entity in case that the current entity blocks before the next reschedule.
+		// This does not apply if we are not called on behalf of a regular entity (e.g., while idle).
+		if(self == localScheduler() && self->_current
+				&& self->_current->type() == ScheduleType::regular)
+			self->_handoff = entity;
 	}
 
 	if(wasEmpty) {
@@ -149,10 +312,15 @@ void Scheduler::suspendCurrent() {
 	// Update the unfairness on suspend.
 	self->_updateEntityStats(entity);
 	entity->state = ScheduleState::attached;
+	entity->_numVoluntarySwitches++;
 
 	self->_current = nullptr;
 }
 
+void Scheduler::enableLoadBalancing() {
+	loadBalancingEnabled.store(true, std::memory_order_release);
+}
+
 Scheduler::Scheduler(CpuData *cpuContext)
 : _cpuContext{cpuContext}, _current{&globalIdleTask.get()} { }
 
@@ -200,6 +368,12 @@ void Scheduler::update() {
 	if(n)
 		_systemProgress += deltaTime * fixedInverse(n);
 
+	// While idle, update() is only called when the CPU is woken up (e.g., by a timer or IPI).
+	if(_current->type() == ScheduleType::idle) {
+		_idleNanos += deltaTime;
+		_idleWakeups++;
+	}
+
 	_updateCurrentEntity();
 
 	// Finally, process all pending entities.
@@ -224,11 +398,28 @@ void Scheduler::update() {
 		// Update the unfairness reference.
 		entity->refProgress = _systemProgress;
 		entity->_refClock = _refClock;
+		entity->_rtSequence = _nextRtSequence++;
 		entity->state = ScheduleState::active;
 
 		_waitQueue.push(entity);
 		_numWaiting++;
 	}
+
+	_applyPriorityChanges();
+
+	if(loadBalancingEnabled.load(std::memory_order_acquire)) {
+		// Serve requests of idle CPUs first.
+		auto requester = _stealRequest.exchange(nullptr, std::memory_order_acq_rel);
+		if(requester && !requester->_loadHint.load(std::memory_order_relaxed))
+			_migrateOne(requester);
+
+		if(_refClock - _balanceClock >= balanceInterval) {
+			_balanceClock = _refClock;
+			_balance();
+		}
+	}
+
+	_publishLoad();
 }
 
 bool Scheduler::maybeReschedule() {
@@ -253,6 +444,16 @@ bool Scheduler::maybeReschedule() {
 			return false;
 		}
 
+		// Real-time entities of equal priority are not subject to fair share scheduling.
+		if(_current->isRealtime()) {
+			if(_current->policy != SchedulePolicy::roundRobin
+					|| _refClock - _sliceClock < roundRobinSlice)
+				return false;
+			// Go to the end of the FIFO order.
+			_current->_rtSequence = _nextRtSequence++;
+			return true;
+		}
+
 		// Switch based on unfairness.
 		auto diff = _liveUnfairness(_current) + sliceGranularity * 256
 				- _liveUnfairness(_waitQueue.top());
@@ -270,6 +471,8 @@ bool Scheduler::maybeReschedule() {
 void Scheduler::forceReschedule() {
 	assert(!intsAreEnabled());
 
+	// If there is no current entity, it blocked (see suspendCurrent())
+	// and _schedule() may hand off to the entity that it resumed last.
 	if(_current)
 		_unschedule();
 	_schedule();
@@ -282,16 +485,15 @@ void Scheduler::forceReschedule() {
 	_current = _scheduled;
 	_scheduled = nullptr;
 	_sliceClock = _refClock;
+	_handoff = nullptr;
 
-	if(!preemptionIsArmed())
-		_updatePreemption();
+	_updatePreemption();
 
 	currentRunnable()->invoke();
 }
 
 void Scheduler::renewSchedule() {
-	if(!preemptionIsArmed())
-		_updatePreemption();
+	_updatePreemption();
 }
 
 ScheduleEntity *Scheduler::currentRunnable() {
@@ -299,14 +501,28 @@ ScheduleEntity *Scheduler::currentRunnable() {
 	return _current;
 }
 
+uint64_t Scheduler::liveRunTimeOfCurrent() {
+	assert(!intsAreEnabled());
+	assert(_current);
+	if(_current->type() == ScheduleType::idle)
+		return 0;
+	auto now = systemClockSource()->currentNanos();
+	return _current->_runTime + (now - _current->_refClock);
+}
+
 void Scheduler::_unschedule() {
 	assert(_current);
 
+	// The current entity is preempted, hence it does not wait for the entity that it resumed.
+	_handoff = nullptr;
+
 	// Decrease the unfairness at the end of the time slice.
 	_updateEntityStats(_current);
 
 	if(_current->type() == ScheduleType::regular
 			|| _current->state == ScheduleState::active) {
+		if(_current->type() == ScheduleType::regular)
+			_current->_numInvoluntarySwitches++;
 		_waitQueue.push(_current);
 		_numWaiting++;
 	}
@@ -322,17 +538,23 @@ void Scheduler::_schedule() {
 		if(logScheduling)
 			infoLogger() << "No entities to schedule" << frg::endlog;
 		_scheduled = &globalIdleTask.get();
+		_publishLoad();
+		_requestWork();
 		return;
 	}
 
-	auto entity = _waitQueue.top();
-	_waitQueue.pop();
+	auto entity = _takeHandoff();
+	if(!entity) {
+		entity = _waitQueue.top();
+		_waitQueue.pop();
+	}
 	_numWaiting--;
 
 	// Increase the unfairness at the start of the time slice.
 	assert(entity->state == ScheduleState::active);
 	_updateWaitingEntity(entity);
 	_updateEntityStats(entity);
+	entity->_lastCpu = _cpuContext->cpuIndex;
 
 	if(logScheduling) {
 //		infoLogger() << "System progress: " << (_systemProgress / 256) / (1000 * 1000)
@@ -351,14 +573,207 @@ void Scheduler::_schedule() {
 	_scheduled = entity;
 }
 
-// Returns true if preemption should be done immediately.
+// Returns the entity that the current (now blocked) entity resumed and removes it
+// from the wait queue, or returns nullptr if we should pick the next entity as usual.
+// The entity runs in the remaining time slice (we do not restart the preemption timer),
+// hence the blocked entity effectively donates its time slice.
+ScheduleEntity *Scheduler::_takeHandoff() {
+	auto entity = _handoff;
+	_handoff = nullptr;
+	if(!enableDirectHandoff || !entity)
+		return nullptr;
+
+	// The entity might have been migrated or might still be pending.
+	// Since entities only leave the wait queue on their own CPU (in _schedule() and
+	// _migrateOne()), an active entity of this scheduler is in our wait queue.
+	if(entity->_scheduler != this || entity->state != ScheduleState::active)
+		return nullptr;
+
+	// Never bypass entities of higher priority.
+	if(ScheduleEntity::orderPriority(entity, _waitQueue.top()) > 0)
+		return nullptr;
+
+	_waitQueue.remove(entity);
+	_directHandoffs++;
+	return entity;
+}
+
+// Migrating to another LLC loses cache contents and separates entities
+// that communicate with each other, hence we require a larger imbalance.
+size_t Scheduler::_migrationThreshold(Scheduler *other) {
+	return other->_cpuContext->llcId == _cpuContext->llcId ? 1 : 2;
+}
+
+// Returns true if an SMT sibling of this CPU runs or waits for entities.
+bool Scheduler::_haveBusySibling() {
+	for(int i = 0; i < getCpuCount(); i++) {
+		auto other = &getCpuData(i)->scheduler;
+		if(other == this || other->_cpuContext->coreId != _cpuContext->coreId)
+			continue;
+		if(other->_loadHint.load(std::memory_order_relaxed))
+			return true;
+	}
+	return false;
+}
+
+void Scheduler::_balance() {
+	if(!_numWaiting)
+		return;
+	size_t ownLoad = _numWaiting;
+	if(_current->type() == ScheduleType::regular)
+		ownLoad++;
+
+	// Among CPUs of equal load, prefer idle cores over idle SMT siblings of busy cores,
+	// and CPUs that share our LLC over remote ones.
+	auto rank = [this] (Scheduler *other) -> int {
+		int r = 0;
+		if(other->_haveBusySibling())
+			r += 2;
+		if(other->_cpuContext->llcId != _cpuContext->llcId)
+			r += 1;
+		return r;
+	};
+
+	Scheduler *idlest = nullptr;
+	size_t idlestLoad = ownLoad;
+	int idlestRank = 0;
+	for(int i = 0; i < getCpuCount(); i++) {
+		auto other = &getCpuData(i)->scheduler;
+		if(other == this)
+			continue;
+		auto load = other->_loadHint.load(std::memory_order_relaxed);
+		if(load > idlestLoad)
+			continue;
+		auto r = rank(other);
+		if(load < idlestLoad || (idlest && r < idlestRank)) {
+			idlest = other;
+			idlestLoad = load;
+			idlestRank = r;
+		}
+	}
+
+	// Only migrate if that actually reduces the imbalance.
+	if(idlest && idlestLoad + _migrationThreshold(idlest) < ownLoad)
+		_migrateOne(idlest);
+}
+
+void Scheduler::_requestWork() {
+	if(!loadBalancingEnabled.load(std::memory_order_acquire))
+		return;
+
+	// Look for a CPU that has at least one waiting entity in addition to the running one.
+	// CPUs on other LLCs need to have more waiting entities, see _migrationThreshold().
+	Scheduler *busiest = nullptr;
+	size_t busiestExcess = 0;
+	for(int i = 0; i < getCpuCount(); i++) {
+		auto other = &getCpuData(i)->scheduler;
+		if(other == this)
+			continue;
+		auto load = other->_loadHint.load(std::memory_order_relaxed);
+		auto threshold = _migrationThreshold(other);
+		if(load <= threshold)
+			continue;
+		if(load - threshold > busiestExcess) {
+			busiest = other;
+			busiestExcess = load - threshold;
+		}
+	}
+	if(!busiest)
+		return;
+
+	Scheduler *expected = nullptr;
+	if(busiest->_stealRequest.compare_exchange_strong(expected, this,
+			std::memory_order_acq_rel))
+		sendPingIpi(busiest->_cpuContext->cpuIndex);
+}
+
+bool Scheduler::_migrateOne(Scheduler *target) {
+	assert(!intsAreEnabled());
+	assert(target != this);
+
+	// Prefer the entity that would run next on this CPU.
+	ScheduleEntity *rejected[maxMigrationCandidates];
+	int numRejected = 0;
+	ScheduleEntity *entity = nullptr;
+	while(!_waitQueue.empty() && numRejected < maxMigrationCandidates) {
+		auto candidate = _waitQueue.top();
+		_waitQueue.pop();
+		if(candidate->isMigratableTo(target->_cpuContext)) {
+			entity = candidate;
+			break;
+		}
+		rejected[numRejected++] = candidate;
+	}
+	for(int i = 0; i < numRejected; i++)
+		_waitQueue.push(rejected[i]);
+	if(!entity)
+		return false;
+	_numWaiting--;
+
+	// The entity can run (and exit) on the target CPU; do not keep a reference to it.
+	if(entity == _handoff)
+		_handoff = nullptr;
+
+	// baseUnfairness does not depend on this scheduler's progress and carries over;
+	// refProgress is reset by the target when it takes the entity from its pending list.
+	_updateWaitingEntity(entity);
+	_updateEntityStats(entity);
+
+	if(logBalancing)
+		infoLogger() << "thor: Migrating entity from CPU " << _cpuContext->cpuIndex
+				<< " to CPU " << target->_cpuContext->cpuIndex << frg::endlog;
+
+	{
+		auto lock = frg::guard(&_mutex);
+
+		// The target would not find the entity in its _priorityList.
+		if(entity->_priorityChangePending) {
+			_priorityList.erase(_priorityList.iterator_to(entity));
+			entity->_priorityChangePending = false;
+			_commitPriority(entity);
+		}
+		entity->state = ScheduleState::pending;
+		__atomic_store_n(&entity->_scheduler, target, __ATOMIC_RELEASE);
+	}
+
+	bool wasEmpty;
+	{
+		auto lock = frg::guard(&target->_mutex);
+
+		wasEmpty = target->_pendingList.empty();
+		target->_pendingList.push_back(entity);
+	}
+	// Prevent other CPUs from migrating to the target before it has seen the entity.
+	target->_loadHint.fetch_add(1, std::memory_order_relaxed);
+
+	if(wasEmpty)
+		sendPingIpi(target->_cpuContext->cpuIndex);
+
+	_publishLoad();
+	return true;
+}
+
+void Scheduler::_publishLoad() {
+	size_t n = _numWaiting;
+	if(_current && _current->type() == ScheduleType::regular)
+		n++;
+	if(_scheduled && _scheduled->type() == ScheduleType::regular)
+		n++;
+	_loadHint.store(n, std::memory_order_relaxed);
+}
+
+// Arms the preemption timer if (and only if) another entity competes for this CPU.
+// Otherwise, the timer is stopped such that the CPU is only woken up by real alarms.
 void Scheduler::_updatePreemption() {
 	if(disablePreemption)
 		return;
 
 	// Disable preemption if there are no other threads.
-	if(_waitQueue.empty())
+	if(_waitQueue.empty()) {
+		if(preemptionIsArmed())
+			disarmPreemption();
 		return;
+	}
 
 	// If there was no current entity, we would have rescheduled.
 	assert(_current);
@@ -367,13 +782,24 @@ void Scheduler::_updatePreemption() {
 
 	if(auto po = ScheduleEntity::orderPriority(_current, _waitQueue.top()); po < 0) {
 		// Disable preemption if we have higher priority.
+		if(preemptionIsArmed())
+			disarmPreemption();
 		return;
 	}else{
 		// If there was an entity with higher priority, we would have rescheduled.
 		assert(!po);
 	}
 
-	armPreemption(sliceGranularity);
+	// FIFO entities are never preempted by entities of equal priority.
+	if(_current->policy == SchedulePolicy::fifo) {
+		if(preemptionIsArmed())
+			disarmPreemption();
+		return;
+	}
+
+	// Do not restart a running time slice.
+	if(!preemptionIsArmed())
+		armPreemption(sliceGranularity);
 }
 
 void Scheduler::_updateCurrentEntity() {
@@ -411,8 +837,11 @@ void Scheduler::_updateEntityStats(ScheduleEntity *entity) {
 	assert(entity->state == ScheduleState::active
 			|| entity == _current);
 
-	if(entity == _current)
+	if(entity == _current) {
 		entity->_runTime += _refClock - entity->_refClock;
+	}else{
+		entity->_waitTime += _refClock - entity->_refClock;
+	}
 	entity->_refClock = _refClock;
 }
 
@@ -2,13 +2,16 @@
 #include <frg/hash_map.hpp>
 #include <frg/string.hpp>
 #include <elf.h>
+#include <thor-internal/boot-profile.hpp>
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/debug.hpp>
 #include <thor-internal/universe.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/module.hpp>
+#include <thor-internal/ostrace.hpp>
 #include <thor-internal/stream.hpp>
 #include <thor-internal/thread.hpp>
+#include <thor-internal/timer.hpp>
 #include "mbus.frigg_pb.hpp"
 #include "svrctl.frigg_pb.hpp"
 
@@ -196,14 +199,34 @@ coroutine<ImageInfo> loadModuleImage(smarter::shared_ptr<AddressSpace, BindableH
 			if((virt_length % kPageSize) != 0)
 				virt_length += kPageSize - virt_length % kPageSize;
 			
-			auto memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, virt_length);
-			memory->selfPtr = memory;
-			co_await copyBetweenViews(memory.get(), phdr.p_vaddr - virt_address,
-					image.get(), phdr.p_offset, phdr.p_filesz,
-					WorkQueue::generalQueue()->take());
-
-			auto view = smarter::allocate_shared<MemorySlice>(*kernelAlloc,
-					std::move(memory), 0, virt_length);
+			// If the segment's pages coincide with pages of the image and there is
+			// no zero-filled part, back the segment by the image itself instead of copying it.
+			// Writable segments get a CoW layer on top such that the image stays intact.
+			auto misalign = phdr.p_vaddr - virt_address;
+			bool canShare = phdr.p_offset % kPageSize == misalign
+					&& phdr.p_memsz == phdr.p_filesz
+					&& phdr.p_offset - misalign + virt_length <= image->getLength();
+
+			smarter::shared_ptr<MemorySlice> view;
+			if(canShare && (phdr.p_flags & PF_W)) {
+				auto memory = smarter::allocate_shared<CopyOnWriteMemory>(*kernelAlloc,
+						image, phdr.p_offset - misalign, virt_length);
+				memory->selfPtr = memory;
+				view = smarter::allocate_shared<MemorySlice>(*kernelAlloc,
+						std::move(memory), 0, virt_length);
+			}else if(canShare) {
+				view = smarter::allocate_shared<MemorySlice>(*kernelAlloc,
+						image, phdr.p_offset - misalign, virt_length);
+			}else{
+				auto memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, virt_length);
+				memory->selfPtr = memory;
+				co_await copyBetweenViews(memory.get(), misalign,
+						image.get(), phdr.p_offset, phdr.p_filesz,
+						WorkQueue::generalQueue()->take());
+
+				view = smarter::allocate_shared<MemorySlice>(*kernelAlloc,
+						std::move(memory), 0, virt_length);
+			}
 
 			if((phdr.p_flags & (PF_R | PF_W | PF_X)) == (PF_R | PF_W)) {
 				auto mapResult = co_await space->map(std::move(view),
@@ -383,9 +406,27 @@ coroutine<void> runMbus() {
 
 	auto module = resolveModule("/sbin/mbus");
 	assert(module && module->type == MfsType::regular);
+	auto launchBegin = getRawTimestampCounter();
 	co_await executeModule("/sbin/mbus", static_cast<MfsRegular *>(module),
 			controlStream.get<0>(),
 			std::move(*futureMbusServer), localScheduler());
+	recordBootPhase(BootPhaseKind::server, "/sbin/mbus", launchBegin, getRawTimestampCounter());
+}
+
+// Each server is launched at most once, hence every launch gets its own event.
+// The event is emitted once the server's image is loaded and its thread is running;
+// the counter records how long that took (in nanoseconds).
+static void traceLaunch(frg::string_view name, uint64_t nanos) {
+	if(!osTraceInUse.load(std::memory_order_relaxed))
+		return;
+
+	static OsTraceItemId durationItem = announceOsTraceItem("thor.launch-duration");
+
+	frg::string<KernelAlloc> eventName{*kernelAlloc, "thor.launch:"};
+	eventName += name;
+	OsTraceEvent event{announceOsTraceEvent(eventName)};
+	event.withCounter(durationItem, nanos);
+	event.emit();
 }
 
 coroutine<LaneHandle> runServer(frg::string_view name) {
@@ -408,9 +449,13 @@ coroutine<LaneHandle> runServer(frg::string_view name) {
 	auto controlStream = createStream();
 	allServers->insert(nameStr, controlStream.get<1>());
 
+	auto launchStart = systemClockSource()->currentNanos();
+	auto launchBegin = getRawTimestampCounter();
 	co_await executeModule(name, static_cast<MfsRegular *>(module),
 			controlStream.get<0>(),
 			LaneHandle{}, localScheduler());
+	traceLaunch(name, systemClockSource()->currentNanos() - launchStart);
+	recordBootPhase(BootPhaseKind::server, name, launchBegin, getRawTimestampCounter());
 
 	co_return controlStream.get<1>();
 }
@@ -720,6 +720,7 @@ namespace posix {
 					mbusHandle,
 					nullptr,
 					reinterpret_cast<HelHandle *>(clientFileTable),
+					nullptr,
 					nullptr
 				};
 
@@ -22,6 +22,7 @@ struct ImbueExtract { };
 struct SendRecvInline { };
 struct SendRecvBuffer { };
 struct PushPull { };
+struct PushPullMany { };
 
 static void transfer(OfferAccept, StreamNode *offer, StreamNode *accept) {
 	offer->_error = Error::success;
@@ -73,6 +74,26 @@ static void transfer(PushPull, StreamNode *push, StreamNode *pull) {
 	pull->complete();
 }
 
+static void transfer(PushPullMany, StreamNode *push, StreamNode *pull) {
+	if(push->_inDescriptors.size() > pull->_maxLength) {
+		push->_error = Error::bufferTooSmall;
+		push->complete();
+
+		pull->_error = Error::bufferTooSmall;
+		pull->complete();
+		return;
+	}
+
+	auto descriptors = std::move(push->_inDescriptors);
+
+	push->_error = Error::success;
+	push->complete();
+
+	pull->_error = Error::success;
+	pull->_descriptors = std::move(descriptors);
+	pull->complete();
+}
+
 void Stream::Submitter::enqueue(const LaneHandle &lane, StreamList &chain) {
 	while(!chain.empty()) {
 		auto node = chain.pop_front();
@@ -223,6 +244,8 @@ void Stream::Submitter::run() {
 			v->issueFlow.raise();
 		}else if(u->tag() == kTagPushDescriptor && v->tag() == kTagPullDescriptor) {
 			transfer(PushPull{}, u, v);
+		}else if(u->tag() == kTagPushDescriptors && v->tag() == kTagPullDescriptors) {
+			transfer(PushPullMany{}, u, v);
 		}else{
 			u->_error = Error::transmissionMismatch;
 			if(usesFlowProtocol(u->tag())) {
@@ -1,10 +1,14 @@
 #pragma once
 
+#include <atomic>
+
 #include <async/basic.hpp>
 #include <async/mutex.hpp>
 #include <async/oneshot-event.hpp>
+#include <async/recurring-event.hpp>
 #include <frg/container_of.hpp>
 #include <frg/expected.hpp>
+#include <frg/list.hpp>
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/memory-view.hpp>
 
@@ -12,6 +16,11 @@ namespace thor {
 
 struct VirtualSpace;
 
+// Mappings can override the caching mode of the memory that they map.
+inline CachingMode effectiveCachingMode(CachingMode mapping, CachingMode memory) {
+	return mapping != CachingMode::null ? mapping : memory;
+}
+
 struct VirtualOperations {
 	virtual void retire(RetireNode *node) = 0;
 
@@ -23,19 +32,34 @@ struct VirtualOperations {
 	virtual PageStatus cleanSingle4k(VirtualAddr pointer) = 0;
 	virtual bool isMapped(VirtualAddr pointer) = 0;
 
+	// Maps a 2 MiB page. Returns false if this is not possible (e.g., if the
+	// architecture does not support it); the caller then falls back to 4k pages.
+	virtual bool mapSingle2m(VirtualAddr pointer, PhysicalAddr physical,
+			uint32_t flags, CachingMode cachingMode);
+
 	// ----------------------------------------------------------------------------------
 
 	// The following API is based on MemoryView and will replace the legacy API above.
 	// The advantage of this approach is that we do not need on virtual call per page anymore.
+	// Unless cachingMode is CachingMode::null, it overrides the caching mode of the view.
 
 	virtual frg::expected<Error> mapPresentPages(VirtualAddr va, MemoryView *view,
-			uintptr_t offset, size_t size, PageFlags flags);
+			uintptr_t offset, size_t size, PageFlags flags, CachingMode cachingMode);
 
 	virtual frg::expected<Error> remapPresentPages(VirtualAddr va, MemoryView *view,
-			uintptr_t offset, size_t size, PageFlags flags);
+			uintptr_t offset, size_t size, PageFlags flags, CachingMode cachingMode);
+
+	// Like mapPresentPages() but skips pages that are already mapped.
+	virtual frg::expected<Error> mapResidentPages(VirtualAddr va, MemoryView *view,
+			uintptr_t offset, size_t size, PageFlags flags, CachingMode cachingMode);
 
 	virtual frg::expected<Error> faultPage(VirtualAddr va, MemoryView *view, uintptr_t offset,
-			PageFlags flags);
+			PageFlags flags, CachingMode cachingMode);
+
+	// Like faultPage() but maps the 2 MiB page around va.
+	// Fails if the view cannot provide a huge page at offset.
+	virtual frg::expected<Error> faultHugePage(VirtualAddr va, MemoryView *view,
+			uintptr_t offset, PageFlags flags, CachingMode cachingMode);
 
 	virtual frg::expected<Error> cleanPages(VirtualAddr va, MemoryView *view,
 			uintptr_t offset, size_t size);
@@ -43,7 +67,24 @@ struct VirtualOperations {
 	virtual frg::expected<Error> unmapPages(VirtualAddr va, MemoryView *view,
 			uintptr_t offset, size_t size);
 
-	virtual size_t getRss();
+	// Resident memory (in bytes) of the given kind, i.e., the amount of memory that
+	// is mapped by present PTEs. This is updated by the functions above.
+	size_t getRss(RssKind kind) {
+		return residentPages_[static_cast<int>(kind)].load(std::memory_order_relaxed)
+				<< kPageShift;
+	}
+
+	size_t getRss() {
+		return getRss(RssKind::anonymous) + getRss(RssKind::file) + getRss(RssKind::shared);
+	}
+
+	// Number of pages that are used for page tables.
+	virtual size_t getPageTablePages();
+
+	// Detaches the page tables that overlap [va, va + size) and do not contain any
+	// entries anymore. Other CPUs may still walk these tables until the range is shot down;
+	// hence, the caller must only free the list after the shootdown completed.
+	virtual void detachEmptyTables(VirtualAddr va, size_t size, DetachedPageList &list);
 
 	// ----------------------------------------------------------------------------------
 	// Sender boilerplate for retire()
@@ -146,6 +187,14 @@ protected:
 	~VirtualOperations() = default;
 
 	// ----------------------------------------------------------------------------------
+
+private:
+	void accountPages_(MemoryView *view, ptrdiff_t numPages) {
+		residentPages_[static_cast<int>(view->rssKind())].fetch_add(numPages,
+				std::memory_order_relaxed);
+	}
+
+	std::atomic<size_t> residentPages_[static_cast<int>(RssKind::count)]{};
 };
 
 struct Hole {
@@ -179,7 +228,14 @@ enum MappingFlags : uint32_t {
 	protWrite = 0x20,
 	protExecute = 0x40,
 
-	dontRequireBacking = 0x100
+	dontRequireBacking = 0x100,
+
+	// Caching mode of the mapping; if none is set, the caching mode of the view is used.
+	cachingMask = 0x7000,
+	cacheWriteBack = 0x1000,
+	cacheWriteCombine = 0x2000,
+	cacheWriteThrough = 0x3000,
+	cacheUncached = 0x4000
 };
 
 struct TouchVirtualResult {
@@ -213,6 +269,9 @@ struct Mapping {
 	frg::tuple<PhysicalAddr, CachingMode>
 	resolveRange(ptrdiff_t offset);
 
+	// Caching mode requested by the flags of the mapping (or CachingMode::null).
+	CachingMode cachingMode();
+
 	// ----------------------------------------------------------------------------------
 	// Sender boilerplate for lockVirtualRange()
 	// ----------------------------------------------------------------------------------
@@ -310,9 +369,15 @@ public:
 	smarter::shared_ptr<MemoryView> view;
 	size_t viewOffset;
 
+	// State of the fault-around heuristic (see VirtualSpace::handleFault()).
+	// faultAroundPages is always a power of two.
+	std::atomic<size_t> faultAroundPages;
+	std::atomic<size_t> lastFaultPage{0};
+
 	// This mutex is held whenever we modify parts of the page space that belong
 	// to this mapping (using VirtualOperation::mapSingle4k and similar). This is
 	// necessary since we sometimes need to read pages before writing them.
+	// Changes to state and flags are also done with this mutex held.
 	frg::ticket_spinlock pagingMutex;
 };
 
@@ -348,6 +413,60 @@ using MappingTree = frg::rbtree<
 	MappingLess
 >;
 
+// Locks ranges of virtual addresses. Shared holders of overlapping ranges can run
+// concurrently, while exclusive holders exclude all holders of overlapping ranges.
+struct RangeLock {
+	struct Holder {
+		friend struct RangeLock;
+
+		Holder(RangeLock *lock, VirtualAddr address, size_t length, bool exclusive)
+		: _lock{lock}, _address{address}, _length{length}, _exclusive{exclusive} { }
+
+		Holder(const Holder &) = delete;
+
+		~Holder() {
+			if(_acquired)
+				_lock->_release(this);
+		}
+
+		Holder &operator= (const Holder &) = delete;
+
+		coroutine<void> acquire() {
+			return _lock->_acquire(this);
+		}
+
+	private:
+		bool _conflictsWith(Holder *other) {
+			return (_exclusive || other->_exclusive)
+					&& _address < other->_address + other->_length
+					&& other->_address < _address + _length;
+		}
+
+		RangeLock *_lock;
+		VirtualAddr _address;
+		size_t _length;
+		bool _exclusive;
+		bool _acquired = false;
+		frg::default_list_hook<Holder> _hook;
+	};
+
+private:
+	coroutine<void> _acquire(Holder *holder);
+	void _release(Holder *holder);
+
+	frg::ticket_spinlock _mutex;
+	async::recurring_event _releaseEvent;
+
+	frg::intrusive_list<
+		Holder,
+		frg::locate_member<
+			Holder,
+			frg::default_list_hook<Holder>,
+			&Holder::_hook
+		>
+	> _holders;
+};
+
 struct VirtualSpace {
 	friend struct Mapping;
 
@@ -362,6 +481,17 @@ public:
 		kMapProtExecute = 0x20,
 		kMapPopulate = 0x200,
 		kMapDontRequireBacking = 0x400,
+		// Caching modes; at most one of them can be set.
+		kMapCachingMask = 0x7000,
+		kMapCacheWriteBack = 0x1000,
+		kMapCacheWriteCombine = 0x2000,
+		kMapCacheWriteThrough = 0x3000,
+		kMapCacheUncached = 0x4000,
+	};
+
+	typedef uint32_t RemapFlags;
+	enum : RemapFlags {
+		kRemapMayMove = 0x01
 	};
 
 	enum FaultFlags : uint32_t {
@@ -373,7 +503,8 @@ public:
 
 	~VirtualSpace();
 
-	void retire();
+	// Unmaps all mappings. Completes once the mappings are no longer accessible on any CPU.
+	coroutine<void> retire();
 
 	void setupInitialHole(VirtualAddr address, size_t size);
 
@@ -390,9 +521,25 @@ public:
 	coroutine<frg::expected<Error>>
 	unmap(VirtualAddr address, size_t length);
 
+	// Resizes the mapping at [address, address + length) to newLength bytes.
+	// The range must be covered by a single mapping. If the mapping cannot grow in place
+	// and kRemapMayMove is set, its page table entries are moved to a new range.
+	// In either case, the pages of the underlying view are not touched.
+	// If slice is non-null, it replaces the slice of the mapping (and must refer to the
+	// same view); this allows the mapping to grow if the view was resized.
+	// Returns the new address of the mapping.
+	coroutine<frg::expected<Error, VirtualAddr>>
+	remap(smarter::shared_ptr<MemorySlice> slice, VirtualAddr address,
+			size_t length, size_t newLength, RemapFlags flags);
+
 	coroutine<frg::expected<Error>>
 	handleFault(VirtualAddr address, uint32_t flags, smarter::shared_ptr<WorkQueue> wq);
 
+	// Fetches and maps all pages of the mapping at address (up to length bytes),
+	// such that subsequent accesses do not fault.
+	coroutine<frg::expected<Error>>
+	populate(VirtualAddr address, size_t length, smarter::shared_ptr<WorkQueue> wq);
+
 	coroutine<frg::expected<Error, PhysicalAddr>>
 	retrievePhysical(VirtualAddr address, smarter::shared_ptr<WorkQueue> wq);
 
@@ -400,6 +547,19 @@ public:
 		return _ops->getRss();
 	}
 
+	size_t rss(RssKind kind) {
+		return _ops->getRss(kind);
+	}
+
+	size_t pageTableSize() {
+		return _ops->getPageTablePages() << kPageShift;
+	}
+
+	// Total length of all mappings.
+	size_t mappedSize() {
+		return _mappedSize.load(std::memory_order_relaxed);
+	}
+
 	// ----------------------------------------------------------------------------------
 	// Read/write support.
 	// ----------------------------------------------------------------------------------
@@ -435,6 +595,18 @@ public:
 		);
 	}
 
+	struct PartialTransfer {
+		// Number of bytes that were copied.
+		size_t progress;
+		// If the transfer is incomplete: whether the source (or else, the destination) faulted.
+		bool sourceFault;
+	};
+
+	// Copies data from this space directly into destSpace, without going through
+	// an intermediate kernel buffer.
+	coroutine<PartialTransfer> transferPartialSpace(uintptr_t address, VirtualSpace *destSpace,
+			uintptr_t destAddress, size_t size, smarter::shared_ptr<WorkQueue> wq);
+
 	// ----------------------------------------------------------------------------------
 	// GlobalFutex support.
 	// ----------------------------------------------------------------------------------
@@ -487,6 +659,7 @@ public:
 private:
 	// Allocates a new mapping of the given length somewhere in the address space.
 	VirtualAddr _allocate(size_t length, MapFlags flags);
+	VirtualAddr _allocateAligned(size_t length, size_t alignment, MapFlags flags);
 
 	VirtualAddr _allocateAt(VirtualAddr address, size_t length);
 
@@ -495,6 +668,13 @@ private:
 	// Splits some memory range from a hole mapping.
 	void _splitHole(Hole *hole, VirtualAddr offset, VirtualAddr length);
 
+	// Returns the range [address, address + length) to the hole tree.
+	// Coalesces it with adjacent holes.
+	void _freeHole(VirtualAddr address, size_t length);
+
+	// Returns true if [address, address + length) is entirely within a single hole.
+	bool _isFree(VirtualAddr address, size_t length);
+
 	// Potentially splits mappings into two parts at (address) and (address + size).
 	// Returns the start and end mappings that are within the specified range.
 	coroutine<frg::tuple<Mapping *, Mapping *>> _splitMappings(uintptr_t address, size_t size);
@@ -504,11 +684,33 @@ private:
 	// Returns whether shootdown needs to be performed (any of the mappings got unmapped).
 	coroutine<bool> _unmapMappings(VirtualAddr address, size_t length, Mapping *start, Mapping *end);
 
+	// Returns the range that is covered by all mappings that overlap the given range
+	// (or the range itself if it is larger). Splitting a mapping affects the whole
+	// original mapping, so that is the range that operations need to lock.
+	frg::tuple<VirtualAddr, size_t> _affectedRange(VirtualAddr address, size_t length);
+
+	// Implementation of handleFault(). If speculativeSequence is non-null, the caller
+	// does not hold a range lock; in that case, retry is set if the fault has to be
+	// handled again with the range lock held.
+	coroutine<frg::expected<Error>> _resolveFault(VirtualAddr address, uint32_t faultFlags,
+			smarter::shared_ptr<WorkQueue> wq, const uint64_t *speculativeSequence, bool *retry);
+
 	VirtualOperations *_ops;
 
 	// Since changing memory mappings requires TLB shootdown, most mapping-related operations
-	// of VirtualSpace are async. Thus, we use an async mutex to serialize these operations.
-	async::shared_mutex _consistencyMutex;
+	// of VirtualSpace are async. Thus, we use an async mutex to serialize operations that
+	// change _mappings and _holes (i.e., map(), unmap() and protect()).
+	async::mutex _consistencyMutex;
+
+	// Operations that need the mappings of a range to stay unchanged (e.g., page faults)
+	// only lock that range in shared mode. Writers additionally lock the range that they
+	// change in exclusive mode. Hence, faults only wait for writers that touch the same range.
+	RangeLock _rangeLock;
+
+	// Odd while map(), unmap() or protect() modifies existing mappings. Page faults first
+	// try to proceed without _rangeLock and fall back to it if this changes in the meantime.
+	// Writers increment this before they modify a Mapping under its pagingMutex.
+	std::atomic<uint64_t> _mappingSequence{0};
 
 	// To avoid taking _consistencyMutex for operations that only need to look at the current
 	// state of the VirtualSpace (and that can run concurrently with mapping-related that
@@ -519,10 +721,14 @@ private:
 
 	HoleTree _holes;
 	MappingTree _mappings;
+
+	// Updated when mappings are added to or removed from _mappings (but not on splits).
+	std::atomic<size_t> _mappedSize{0};
 };
 
 struct AddressSpace final : VirtualSpace, smarter::crtp_counter<AddressSpace, BindableHandle> {
 	friend struct Mapping;
+	friend struct AddressSpaceReaper;
 
 	// Silence Clang warning about hidden overloads.
 	using smarter::crtp_counter<AddressSpace, BindableHandle>::dispose;
@@ -556,6 +762,19 @@ struct AddressSpace final : VirtualSpace, smarter::crtp_counter<AddressSpace, Bi
 			return space_->pageSpace_.isMapped(pointer);
 		}
 
+		bool mapSingle2m(VirtualAddr pointer, PhysicalAddr physical,
+				uint32_t flags, CachingMode cachingMode) override {
+			return space_->pageSpace_.mapSingle2m(pointer, physical, true, flags, cachingMode);
+		}
+
+		size_t getPageTablePages() override {
+			return space_->pageSpace_.numTablePages();
+		}
+
+		void detachEmptyTables(VirtualAddr va, size_t size, DetachedPageList &list) override {
+			space_->pageSpace_.detachEmptyTables(va, size, list);
+		}
+
 	private:
 		AddressSpace *space_;
 	};
@@ -593,6 +812,10 @@ public:
 private:
 	Operations ops_;
 	ClientPageSpace pageSpace_;
+
+	// Keeps the space alive while it waits for its teardown.
+	smarter::shared_ptr<VirtualSpace> reaperSelf_;
+	frg::default_list_hook<AddressSpace> reaperHook_;
 };
 
 struct MemoryViewLockHandle {
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <frg/string.hpp>
+
+namespace thor {
+
+// Defined by the architecture code. Not included from arch/cpu.hpp since this header
+// is needed by initgraph.hpp.
+uint64_t getRawTimestampCounter();
+// Converts ticks of getRawTimestampCounter() to nanoseconds.
+// Only valid after the timers are calibrated.
+uint64_t rawTimestampCounterToNanos(uint64_t ticks);
+
+enum class BootPhaseKind {
+	eir,
+	initgraphTask,
+	initgraphStage,
+	server
+};
+
+// Records a phase of the boot process. begin and end are ticks of getRawTimestampCounter();
+// instants (such as initgraph stages) have begin == end. This works before the kernel heap
+// is available. The name is copied.
+void recordBootPhase(BootPhaseKind kind, frg::string_view name, uint64_t begin, uint64_t end);
+
+// Emits all boot phases (including the phases that eir passed to us) as ostrace events.
+// Phases that are recorded afterwards are emitted immediately.
+void emitBootProfile();
+
+} // namespace thor
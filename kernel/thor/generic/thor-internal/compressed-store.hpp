@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace thor {
+
+// Compressed copy of a page that was evicted from anonymous memory.
+// The data is an LZ4 block that decompresses to exactly one page.
+struct CompressedPage {
+	// Size of data in bytes. Zero for pages that only contain zeros.
+	uint16_t size;
+	uint8_t data[];
+};
+
+struct CompressedStoreStats {
+	// Number of pages that are currently stored (including zero-filled pages).
+	size_t storedPages;
+	size_t zeroPages;
+	// Total size of the compressed data.
+	size_t compressedBytes;
+	// Maximal value of compressedBytes.
+	size_t poolLimit;
+	uint64_t compressions;
+	uint64_t decompressions;
+	// Pages that were not stored since they did not compress well or the pool was full.
+	uint64_t rejections;
+};
+
+// Compresses the given page. Returns nullptr if the page does not compress
+// well enough to be worth storing or if the pool is full.
+CompressedPage *compressPage(const void *page);
+
+// Decompresses into the given page and releases the compressed copy.
+void decompressPage(CompressedPage *compressed, void *page);
+
+// Releases the compressed copy without decompressing it.
+void discardCompressedPage(CompressedPage *compressed);
+
+CompressedStoreStats getCompressedStoreStats();
+
+} // namespace thor
@@ -1,17 +1,25 @@
 #pragma once
 
 #include <thor-internal/arch/cpu.hpp>
+#include <thor-internal/debug.hpp>
 #include <thor-internal/executor-context.hpp>
+#include <thor-internal/kernel_heap.hpp>
 #include <thor-internal/kernel-locks.hpp>
+#include <thor-internal/physical.hpp>
 #include <thor-internal/schedule.hpp>
+#include <thor-internal/timer.hpp>
 
 namespace thor {
 
 // Forward defined for pointers that are part of CpuData.
 struct KernelFiber;
+struct LocalCsprng;
 struct SingleContextRecordRing;
 struct WorkQueue;
 
+// Number of per-CPU slots that are available to metrics (see metrics.hpp).
+constexpr size_t maxMetricSlots = 256;
+
 enum class ProfileMechanism {
 	none,
 	intelPmc,
@@ -29,9 +37,20 @@ struct CpuData : public PlatformCpuData {
 	UniqueKernelStack detachedStack;
 	UniqueKernelStack idleStack;
 	Scheduler scheduler;
+	HeapCache heapCache;
+	PhysicalPageCache pageCache;
+	KernelStackCache kernelStackCache;
+	ExecutorStateCache executorStateCache;
+	TimerWheel timerWheel;
 	bool haveVirtualization;
 
 	int cpuIndex;
+	// NUMA node (as used by PhysicalChunkAllocator) that this CPU belongs to.
+	int numaNode = 0;
+	// CPUs with the same coreId are SMT siblings; CPUs with the same llcId share
+	// their last level cache. Filled in by the architecture's initializeThisProcessor().
+	int coreId = 0;
+	int llcId = 0;
 
 	ExecutorContext *executorContext = nullptr;
 	KernelFiber *activeFiber;
@@ -40,9 +59,17 @@ struct CpuData : public PlatformCpuData {
 	std::atomic<uint64_t> heartbeat;
 
 	unsigned int irqEntropySeq = 0;
+	// Allocated on the first call to generateRandomBytes() on this CPU.
+	LocalCsprng *localCsprng = nullptr;
 	std::atomic<ProfileMechanism> profileMechanism{};
 	// TODO: This should be a unique_ptr instead.
 	SingleContextRecordRing *localProfileRing = nullptr;
+	// Allocated on the first ostrace event that is emitted on this CPU.
+	std::atomic<SingleContextRecordRing *> localOsTraceRing{nullptr};
+
+	std::atomic<uint64_t> metricSlots[maxMetricSlots]{};
+
+	LogRing logRing;
 };
 
 CpuData *getCpuData(size_t k);
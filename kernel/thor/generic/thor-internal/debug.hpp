@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+#include <atomic>
 #include <frg/list.hpp>
 #include <frg/logging.hpp>
 
@@ -26,6 +28,29 @@ void disableLogHandler(LogHandler *sink);
 size_t currentLogSequence();
 void copyLogMessage(size_t sequence, char *text);
 
+// Once the log drain fiber runs, infoLogger() only appends messages to the ring of the
+// current CPU; the fiber passes them on to the LogHandlers. If the ring is full,
+// messages are dropped (and counted) instead of waiting for the LogHandlers.
+// Single producer (the owning CPU, with IRQs disabled), single consumer (the drain).
+struct LogRing {
+	static constexpr size_t numRecords = 32;
+	static constexpr size_t maxLength = 244;
+
+	struct Record {
+		// Global sequence number; used to restore the order of messages across CPUs.
+		uint64_t sequence;
+		uint32_t length;
+		char text[maxLength];
+	};
+	static_assert(sizeof(Record) == 256);
+
+	Record records[numRecords];
+	// Only written by the producer.
+	std::atomic<uint64_t> head{0};
+	// Only written by the consumer.
+	std::atomic<uint64_t> tail{0};
+};
+
 // --------------------------------------------------------
 // Loggers.
 // --------------------------------------------------------
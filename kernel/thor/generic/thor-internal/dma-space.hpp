@@ -0,0 +1,82 @@
+#pragma once
+
+#include <frg/optional.hpp>
+#include <frg/vector.hpp>
+#include <thor-internal/coroutine.hpp>
+#include <thor-internal/error.hpp>
+#include <thor-internal/memory-view.hpp>
+
+namespace thor {
+
+// IO virtual address space of a device behind an IOMMU.
+struct IommuDomain {
+	virtual ~IommuDomain() = default;
+
+	// Exclusive upper bound of the IO virtual addresses that the domain can translate.
+	virtual uint64_t addressLimit() = 0;
+
+	// All addresses must be page-aligned. Changes only become visible
+	// to the device after flush() returns.
+	virtual void mapPage(uint64_t iova, PhysicalAddr physical, bool writable) = 0;
+	virtual void unmapPage(uint64_t iova) = 0;
+	virtual void flush() = 0;
+};
+
+struct Iommu {
+	// Returns nullptr if this IOMMU does not translate requests of the given device.
+	// requesterId is the PCI bus/device/function triple (i.e., bus << 8 | devfn).
+	virtual smarter::shared_ptr<IommuDomain> createDomain(uint16_t segment,
+			uint16_t requesterId) = 0;
+
+protected:
+	~Iommu() = default;
+};
+
+void registerIommu(Iommu *iommu);
+
+// Creates a domain on the IOMMU that is responsible for the given device.
+// Returns nullptr if no IOMMU translates requests of the device.
+smarter::shared_ptr<IommuDomain> createIommuDomain(uint16_t segment, uint16_t requesterId);
+
+// Persistent mappings of memory views into the IO address space of a device.
+// Mapped ranges stay locked (and thus pinned) until they are unmapped again.
+struct DmaSpace {
+	DmaSpace(smarter::shared_ptr<IommuDomain> domain);
+
+	DmaSpace(const DmaSpace &) = delete;
+
+	~DmaSpace();
+
+	DmaSpace &operator= (const DmaSpace &) = delete;
+
+	coroutine<frg::expected<Error, uint64_t>> map(smarter::shared_ptr<MemoryView> view,
+			uintptr_t offset, size_t size, bool writable, smarter::shared_ptr<WorkQueue> wq);
+
+	// iova and size must match a previous call to map().
+	Error unmap(uint64_t iova, size_t size);
+
+private:
+	struct Mapping {
+		uint64_t iova;
+		size_t size;
+		smarter::shared_ptr<MemoryView> view;
+		uintptr_t offset;
+		// False while map() is still in progress.
+		bool ready;
+	};
+
+	// Reserves a range of IO virtual addresses.
+	frg::optional<uint64_t> _allocate(size_t size);
+	void _release(uint64_t iova);
+
+	void _unmapPages(uint64_t iova, size_t size);
+
+	smarter::shared_ptr<IommuDomain> _domain;
+
+	frg::ticket_spinlock _mutex;
+
+	// Sorted by IO virtual address.
+	frg::vector<Mapping, KernelAlloc> _mappings{*kernelAlloc};
+};
+
+} // namespace thor
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 namespace thor {
 
 // This class uniquely identifies a thread or fiber.
@@ -11,6 +14,22 @@ struct ExecutorContext {
 	ExecutorContext &operator= (const ExecutorContext &) = delete;
 };
 
+// Per-CPU cache of the blocks that store the register (including FPU/SIMD) state
+// of Executors. All blocks have the same size since it only depends on CPU features.
+// The blocks exceed the size classes of the per-CPU heap cache.
+struct ExecutorStateCache {
+	static constexpr size_t maxStates = 8;
+
+	void *states[maxStates];
+	size_t numStates = 0;
+	size_t size = 0;
+};
+
+// Allocate and free Executor state blocks through the current CPU's cache.
+// Blocks returned by allocateExecutorState() are *not* zeroed.
+void *allocateExecutorState(size_t size);
+void freeExecutorState(void *pointer, size_t size);
+
 inline ExecutorContext *illegalExecutorContext() {
 	return reinterpret_cast<ExecutorContext *>(static_cast<uintptr_t>(-1));
 }
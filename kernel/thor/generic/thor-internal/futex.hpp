@@ -11,6 +11,8 @@
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/error.hpp>
 #include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/lock-stats.hpp>
+#include <thor-internal/schedule.hpp>
 #include <thor-internal/work-queue.hpp>
 
 namespace thor {
@@ -52,14 +54,33 @@ concept Futex = requires(F f) {
 	f.retire();
 };
 
+// Priority inheritance futexes additionally need to update the futex word.
+template<typename F>
+concept PiFutex = Futex<F> && requires(F f, unsigned int &expected, unsigned int desired) {
+	f.compareExchange(expected, desired);
+};
+
 struct FutexRealm {
+	// Number of independently locked buckets. Must be a power of two.
+	static constexpr size_t numBuckets = 64;
+
+	// Layout of the words of priority inheritance (PI) futexes. The word contains the
+	// owner's ID (or zero if the futex is unlocked) and a bit that forces the owner
+	// to enter the kernel on unlock.
+	static constexpr unsigned int piOwnerMask = 0x3FFF'FFFF;
+	static constexpr unsigned int piWaitersBit = 0x4000'0000;
+
 private:
+	using Mutex = TrackedLock<frg::ticket_spinlock, futexLockClass>;
+
+	struct Bucket;
+
 	// Represents a single waiter.
 	struct Node {
 		friend struct FutexRealm;
 
 		Node(FutexRealm *realm, FutexIdentity id)
-		: realm_{realm}, id_{id}, cobs_{this} { }
+		: realm_{realm}, id_{id}, bucket_{&realm->_bucketOf(id)}, cobs_{this} { }
 
 	protected:
 		virtual void complete() = 0;
@@ -70,10 +91,21 @@ private:
 		void cancel_() {
 			{
 				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&realm_->_mutex);
+
+				// requeue() can move the node to another bucket while we are not holding
+				// the lock. Retry until we hold the lock of the node's current bucket.
+				Bucket *bucket;
+				while(true) {
+					bucket = __atomic_load_n(&bucket_, __ATOMIC_ACQUIRE);
+					bucket->mutex.lock();
+					if(__atomic_load_n(&bucket_, __ATOMIC_RELAXED) == bucket)
+						break;
+					bucket->mutex.unlock();
+				}
+				frg::unique_lock lock{frg::adopt_lock, bucket->mutex};
 
 				if(!result_) {
-					auto sit = realm_->_slots.get(id_);
+					auto sit = bucket->slots.get(id_);
 					// Invariant: If the slot exists then its queue is not empty.
 					assert(!sit->queue.empty());
 
@@ -82,7 +114,7 @@ private:
 					result_ = Error::cancelled;
 
 					if(sit->queue.empty())
-						realm_->_slots.remove(id_);
+						bucket->slots.remove(id_);
 				}else{
 					assert(!queueHook_.in_list);
 				}
@@ -92,29 +124,193 @@ private:
 		}
 
 		FutexRealm *realm_;
+		// id_ and bucket_ are protected by the lock of bucket_.
 		FutexIdentity id_;
+		Bucket *bucket_;
 		frg::optional<Error> result_; // Set after completion.
 		async::cancellation_observer<frg::bound_mem_fn<&Node::cancel_>> cobs_;
 		frg::default_list_hook<Node> queueHook_;
 	};
 
-	struct Slot {
-		frg::intrusive_list<
+	using NodeList = frg::intrusive_list<
+		Node,
+		frg::locate_member<
 			Node,
-			frg::locate_member<
-				Node,
-				frg::default_list_hook<Node>,
-				&Node::queueHook_
-			>
-		> queue;
+			frg::default_list_hook<Node>,
+			&Node::queueHook_
+		>
+	>;
+
+	struct Slot {
+		NodeList queue;
+	};
+
+	struct PiState;
+
+	// Represents a single waiter of a PI futex.
+	struct PiNode {
+		friend struct FutexRealm;
+
+		PiNode(FutexRealm *realm, FutexIdentity id,
+				smarter::shared_ptr<ScheduleEntity> waiter, uint32_t waiterId)
+		: realm_{realm}, id_{id}, bucket_{&realm->_bucketOf(id)},
+				waiter_{std::move(waiter)}, waiterId_{waiterId},
+				priority_{waiter_->effectivePriority()}, cobs_{this} { }
+
+	protected:
+		virtual void complete() = 0;
+
+		~PiNode() = default;
+
+	private:
+		void cancel_() {
+			{
+				// PI waiters are never requeued, hence bucket_ is stable.
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&bucket_->mutex);
+
+				if(!result_) {
+					auto sit = bucket_->piStates.get(id_);
+					assert(sit);
+					auto state = *sit;
+					state->waiters.erase(state->waiters.iterator_to(this));
+					result_ = Error::cancelled;
+
+					// We leave piWaitersBit set; the owner's unlock clears it.
+					realm_->_updatePiState(*bucket_, id_, state);
+				}else{
+					assert(!queueHook_.in_list);
+				}
+			}
+
+			complete();
+		}
+
+		FutexRealm *realm_;
+		FutexIdentity id_;
+		Bucket *bucket_;
+		smarter::shared_ptr<ScheduleEntity> waiter_;
+		uint32_t waiterId_;
+		int priority_;
+		frg::optional<Error> result_; // Set after completion.
+		async::cancellation_observer<frg::bound_mem_fn<&PiNode::cancel_>> cobs_;
+		frg::default_list_hook<PiNode> queueHook_;
+	};
+
+	using PiNodeList = frg::intrusive_list<
+		PiNode,
+		frg::locate_member<
+			PiNode,
+			frg::default_list_hook<PiNode>,
+			&PiNode::queueHook_
+		>
+	>;
+
+	// Exists while a PI futex has waiters. The waiters lend their priority to the owner.
+	struct PiState {
+		// May be null if the owner's ID does not belong to a running thread.
+		smarter::shared_ptr<ScheduleEntity> owner;
+		PiNodeList waiters;
+		PriorityDonation donation;
+	};
+
+	// Buckets are cache line aligned such that unrelated futexes do not contend.
+	struct alignas(64) Bucket {
+		Bucket()
+		: slots{FutexIdentity::Hash{}, *kernelAlloc},
+				piStates{FutexIdentity::Hash{}, *kernelAlloc} { }
+
+		Mutex mutex;
+
+		frg::hash_map<
+			FutexIdentity,
+			Slot,
+			FutexIdentity::Hash,
+			KernelAlloc
+		> slots;
+
+		frg::hash_map<
+			FutexIdentity,
+			PiState *,
+			FutexIdentity::Hash,
+			KernelAlloc
+		> piStates;
 	};
 
+	static_assert(!(numBuckets & (numBuckets - 1)), "numBuckets must be a power of two");
+
+	Bucket &_bucketOf(FutexIdentity id) {
+		return _buckets[FutexIdentity::Hash{}(id) & (numBuckets - 1)];
+	}
+
+	// Removes up to count waiters of id from the bucket and appends them to pending.
+	// Returns the number of removed waiters. The caller must hold the bucket lock.
+	size_t _dequeueWaiters(Bucket &bucket, FutexIdentity id, size_t count, NodeList &pending) {
+		auto sit = bucket.slots.get(id);
+		if(!sit)
+			return 0;
+		// Invariant: If the slot exists then its queue is not empty.
+		assert(!sit->queue.empty());
+
+		size_t n = 0;
+		while(n < count && !sit->queue.empty()) {
+			auto node = sit->queue.front();
+			assert(!node->result_);
+			sit->queue.pop_front();
+
+			if(node->cobs_.try_reset()) {
+				node->result_ = Error::success;
+				pending.push_back(node);
+				++n;
+			}else{
+				// cancel_() is about to run; it completes the node.
+				node->result_ = Error::cancelled;
+			}
+		}
+
+		if(sit->queue.empty())
+			bucket.slots.remove(id);
+		return n;
+	}
+
+	// Returns the waiter of highest priority (the longest waiting one on ties).
+	static PiNode *_topPiWaiter(PiState *state) {
+		PiNode *top = nullptr;
+		for(auto node : state->waiters) {
+			if(!top || node->priority_ > top->priority_)
+				top = node;
+		}
+		return top;
+	}
+
+	// Updates the donation to the owner after the waiters changed, or releases the
+	// PiState if there are no waiters anymore. The caller must hold the bucket lock.
+	void _updatePiState(Bucket &bucket, FutexIdentity id, PiState *state) {
+		if(state->waiters.empty()) {
+			if(state->owner)
+				Scheduler::revokePriority(state->owner.get(), &state->donation);
+			bucket.piStates.remove(id);
+			frg::destruct(*kernelAlloc, state);
+			return;
+		}
+
+		if(state->owner)
+			Scheduler::donatePriority(state->owner.get(), &state->donation,
+					_topPiWaiter(state)->priority_);
+	}
+
 public:
-	FutexRealm()
-	: _slots{FutexIdentity::Hash{}, *kernelAlloc} { }
+	FutexRealm() = default;
 
 	bool empty() {
-		return _slots.empty();
+		for(auto &bucket : _buckets) {
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&bucket.mutex);
+
+			if(!bucket.slots.empty() || !bucket.piStates.empty())
+				return false;
+		}
+		return true;
 	}
 
 	// ----------------------------------------------------------------------------------
@@ -140,7 +336,8 @@ public:
 
 			auto fastPath = [&] {
 				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&realm_->_mutex);
+				// The node is not visible to requeue() yet, hence bucket_ is stable.
+				auto lock = frg::guard(&bucket_->mutex);
 
 				if(f.read() != expected_) {
 					result_ = Error::futexRace;
@@ -152,10 +349,10 @@ public:
 					return true;
 				}
 
-				auto sit = realm_->_slots.get(id_);
+				auto sit = bucket_->slots.get(id_);
 				if(!sit) {
-					realm_->_slots.insert(id_, Slot());
-					sit = realm_->_slots.get(id_);
+					bucket_->slots.insert(id_, Slot());
+					sit = bucket_->slots.get(id_);
 				}
 
 				assert(!queueHook_.in_list);
@@ -210,60 +407,296 @@ public:
 
 	// ----------------------------------------------------------------------------------
 
-	void wake(FutexIdentity id) {
-		frg::intrusive_list<
-			Node,
-			frg::locate_member<
-				Node,
-				frg::default_list_hook<Node>,
-				&Node::queueHook_
-			>
-		> pending;
+	// Wakes up to count waiters of the futex. Returns the number of woken waiters.
+	size_t wake(FutexIdentity id, size_t count = static_cast<size_t>(-1)) {
+		NodeList pending;
+		size_t n;
+		{
+			auto &bucket = _bucketOf(id);
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&bucket.mutex);
+
+			n = _dequeueWaiters(bucket, id, count, pending);
+		}
+
+		while(!pending.empty()) {
+			auto node = pending.pop_front();
+			node->complete();
+		}
+		return n;
+	}
+
+	// Wakes up to wakeCount waiters of from and moves up to requeueCount of the remaining
+	// waiters to the futex identified by to. Fails with Error::futexRace if
+	// the value of from does not match expected (like FUTEX_CMP_REQUEUE).
+	template<Futex F>
+	frg::expected<Error> requeue(F from, unsigned int expected, FutexIdentity to,
+			size_t wakeCount, size_t requeueCount) {
+		auto fromId = from.getIdentity();
+		if(fromId == to) {
+			// Requeueing onto the same futex is a no-op; only wake waiters.
+			if(from.read() != expected) {
+				from.retire();
+				return Error::futexRace;
+			}
+			from.retire();
+			wake(fromId, wakeCount);
+			return {};
+		}
+
+		NodeList pending;
+		bool race = false;
 		{
+			auto fromBucket = &_bucketOf(fromId);
+			auto toBucket = &_bucketOf(to);
+
 			auto irqLock = frg::guard(&irqMutex());
-			auto lock = frg::guard(&_mutex);
-
-			auto sit = _slots.get(id);
-			if(!sit)
-				return;
-			// Invariant: If the slot exists then its queue is not empty.
-			assert(!sit->queue.empty());
-
-			// TODO: Enable users to only wake a certain number of waiters.
-			while(!sit->queue.empty()) {
-				auto node = sit->queue.front();
-				assert(!node->result_);
-				sit->queue.pop_front();
-
-				if(node->cobs_.try_reset()) {
-					node->result_ = Error::success;
-					pending.push_back(node);
+			// Lock the buckets in address order to avoid deadlocks.
+			auto lowBucket = frg::min(fromBucket, toBucket);
+			auto highBucket = frg::max(fromBucket, toBucket);
+			lowBucket->mutex.lock();
+			if(highBucket != lowBucket)
+				highBucket->mutex.lock();
+
+			if(from.read() != expected) {
+				race = true;
+			}else{
+				_dequeueWaiters(*fromBucket, fromId, wakeCount, pending);
+
+				auto sit = fromBucket->slots.get(fromId);
+				if(sit && requeueCount) {
+					auto dit = toBucket->slots.get(to);
+					if(!dit) {
+						toBucket->slots.insert(to, Slot());
+						dit = toBucket->slots.get(to);
+						// The insertion may have invalidated sit if both are in the same bucket.
+						sit = fromBucket->slots.get(fromId);
+					}
+
+					size_t n = 0;
+					while(n < requeueCount && !sit->queue.empty()) {
+						auto node = sit->queue.pop_front();
+						node->id_ = to;
+						__atomic_store_n(&node->bucket_, toBucket, __ATOMIC_RELEASE);
+						dit->queue.push_back(node);
+						++n;
+					}
+
+					if(sit->queue.empty())
+						fromBucket->slots.remove(fromId);
 				}
 			}
 
-			if(sit->queue.empty())
-				_slots.remove(id);
+			if(highBucket != lowBucket)
+				highBucket->mutex.unlock();
+			lowBucket->mutex.unlock();
 		}
 
+		// Retire the Futex only after we are done with it.
+		from.retire();
+
 		while(!pending.empty()) {
 			auto node = pending.pop_front();
 			node->complete();
 		}
+
+		if(race)
+			return Error::futexRace;
+		return {};
+	}
+
+	// ----------------------------------------------------------------------------------
+	// lockPi().
+	// ----------------------------------------------------------------------------------
+
+	// Acquires a PI futex on behalf of the waiter (identified by waiterId in the futex word).
+	// While the futex is contended, the owner inherits the priority of its waiters.
+	// Resolve maps owner IDs to smarter::shared_ptr<ScheduleEntity>; it is called while
+	// holding the bucket lock. Completes with Error::illegalState if the waiter already
+	// owns the futex and with Error::cancelled on cancellation.
+	template<PiFutex F, typename Resolve, typename R>
+	struct LockPiOperation final : private PiNode {
+		LockPiOperation(FutexRealm *self, F f, smarter::shared_ptr<ScheduleEntity> waiter,
+				uint32_t waiterId, Resolve resolve, async::cancellation_token ct, R receiver)
+		: PiNode{self, f.getIdentity(), std::move(waiter), waiterId}, f_{std::move(f)},
+				resolve_{std::move(resolve)}, ct_{ct}, receiver_{std::move(receiver)} { }
+
+		LockPiOperation(const LockPiOperation &) = delete;
+
+		LockPiOperation &operator= (const LockPiOperation &) = delete;
+
+		bool start_inline() {
+			// See WaitOperation::start_inline().
+			F f = std::move(f_);
+
+			auto fastPath = [&] {
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&bucket_->mutex);
+
+				uint32_t ownerId;
+				auto word = f.read();
+				while(true) {
+					ownerId = word & piOwnerMask;
+					if(!ownerId) {
+						// Keep piWaitersBit such that the next unlock wakes other waiters.
+						if(f.compareExchange(word, waiterId_ | (word & piWaitersBit))) {
+							result_ = Error::success;
+							return true;
+						}
+						continue;
+					}
+					if(ownerId == waiterId_) {
+						result_ = Error::illegalState;
+						return true;
+					}
+					if(word & piWaitersBit || f.compareExchange(word, word | piWaitersBit))
+						break;
+				}
+
+				if(!cobs_.try_set(ct_)) {
+					result_ = Error::cancelled;
+					return true;
+				}
+
+				PiState *state;
+				if(auto sit = bucket_->piStates.get(id_); sit) {
+					state = *sit;
+				}else{
+					state = frg::construct<PiState>(*kernelAlloc);
+					state->owner = resolve_(ownerId);
+					bucket_->piStates.insert(id_, state);
+				}
+
+				assert(!queueHook_.in_list);
+				state->waiters.push_back(this);
+				realm_->_updatePiState(*bucket_, id_, state);
+				return false;
+			}(); // Immediately invoked.
+
+			f.retire();
+
+			if(fastPath) {
+				async::execution::set_value_inline(receiver_, *result_);
+				return true;
+			}
+			return false;
+		}
+
+	private:
+		void complete() override {
+			async::execution::set_value_noinline(receiver_, *result_);
+		}
+
+		F f_;
+		Resolve resolve_;
+		async::cancellation_token ct_;
+		R receiver_;
+	};
+
+	template<PiFutex F, typename Resolve>
+	struct [[nodiscard]] LockPiSender {
+		using value_type = Error;
+
+		template<typename R>
+		LockPiOperation<F, Resolve, R> connect(R receiver) {
+			return {self, std::move(f), std::move(waiter), waiterId, std::move(resolve),
+					ct, std::move(receiver)};
+		}
+
+		async::sender_awaiter<LockPiSender, Error> operator co_await() {
+			return {std::move(*this)};
+		}
+
+		FutexRealm *self;
+		F f;
+		smarter::shared_ptr<ScheduleEntity> waiter;
+		uint32_t waiterId;
+		Resolve resolve;
+		async::cancellation_token ct;
+	};
+
+	template<PiFutex F, typename Resolve>
+	LockPiSender<F, Resolve> lockPi(F f, smarter::shared_ptr<ScheduleEntity> waiter,
+			uint32_t waiterId, Resolve resolve, async::cancellation_token ct = {}) {
+		return {this, std::move(f), std::move(waiter), waiterId, std::move(resolve), ct};
+	}
+
+	// ----------------------------------------------------------------------------------
+
+	// Releases a PI futex that is owned by ownerId. Ownership is handed to the waiter of
+	// highest priority (if any). Fails with Error::illegalState if ownerId does not own
+	// the futex.
+	template<PiFutex F>
+	frg::expected<Error> unlockPi(F f, uint32_t ownerId) {
+		auto id = f.getIdentity();
+		auto &bucket = _bucketOf(id);
+
+		PiNode *next = nullptr;
+		bool notOwner = false;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&bucket.mutex);
+
+			PiState *state = nullptr;
+			if(auto sit = bucket.piStates.get(id); sit)
+				state = *sit;
+
+			auto word = f.read();
+			auto expectedOwner = ownerId;
+			while(true) {
+				if((word & piOwnerMask) != expectedOwner) {
+					// Only fail if we did not hand off the futex yet.
+					notOwner = (expectedOwner == ownerId);
+					break;
+				}
+
+				PiNode *candidate = nullptr;
+				unsigned int desired = 0;
+				if(state && !state->waiters.empty()) {
+					candidate = _topPiWaiter(state);
+					desired = candidate->waiterId_;
+					if(state->waiters.front() != candidate || state->waiters.back() != candidate)
+						desired |= piWaitersBit;
+				}
+				if(!f.compareExchange(word, desired))
+					continue;
+				if(!candidate)
+					break;
+
+				state->waiters.erase(state->waiters.iterator_to(candidate));
+				if(candidate->cobs_.try_reset()) {
+					candidate->result_ = Error::success;
+					next = candidate;
+					break;
+				}
+
+				// cancel_() is about to run; it completes the node. The futex word
+				// already names the candidate, hence we pass the futex on.
+				candidate->result_ = Error::cancelled;
+				expectedOwner = candidate->waiterId_;
+				word = desired;
+			}
+
+			if(state && !notOwner) {
+				if(state->owner)
+					Scheduler::revokePriority(state->owner.get(), &state->donation);
+				state->owner = next ? next->waiter_ : nullptr;
+				_updatePiState(bucket, id, state);
+			}
+		}
+
+		f.retire();
+
+		if(next)
+			next->complete();
+
+		if(notOwner)
+			return Error::illegalState;
+		return {};
 	}
 
 private:
-	using Mutex = frg::ticket_spinlock;
-
-	// TODO: use a scalable hash table with fine-grained locks to
-	// improve the scalability of the futex algorithm.
-	Mutex _mutex;
-
-	frg::hash_map<
-		FutexIdentity,
-		Slot,
-		FutexIdentity::Hash,
-		KernelAlloc
-	> _slots;
+	Bucket _buckets[numBuckets];
 };
 
 } // namespace thor
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace thor {
+
+// Sampling memory-safety checker for the kernel heap (similar to Linux' KFENCE).
+// If enabled by kernel-heap.sample-rate=N on the kernel command line, one out of N
+// allocations (per CPU) is served from a pool of pages that are separated by unmapped
+// guard pages. Sampled objects are placed against one of the guard pages;
+// the remainder of the object's page is filled with a canary that is checked on free.
+// Freed objects are filled with a pattern that is checked when the page is reused.
+// Since this only costs a branch on unsampled allocations, it can be enabled in production.
+
+extern uint64_t heapGuardSampleRate; // Zero if sampling is disabled.
+extern uintptr_t heapGuardBase;
+extern size_t heapGuardSize;
+
+inline bool isGuardedHeapPointer(void *pointer) {
+	// If the pool does not exist, heapGuardSize is zero and this is always false.
+	return reinterpret_cast<uintptr_t>(pointer) - heapGuardBase < heapGuardSize;
+}
+
+// Returns nullptr if the allocation is not sampled (or if the pool is exhausted).
+void *sampleGuardedAllocation(size_t size);
+void freeGuardedObject(void *pointer);
+void *reallocateGuardedObject(void *pointer, size_t size);
+
+// Called on kernel page faults. Reports the fault and panics if the address
+// is inside the pool, otherwise it returns.
+void checkHeapGuardFault(uintptr_t address, uintptr_t ip, bool write);
+
+} // namespace thor
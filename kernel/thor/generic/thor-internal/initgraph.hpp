@@ -2,6 +2,7 @@
 
 #include <frg/array.hpp>
 #include <frg/list.hpp>
+#include <thor-internal/boot-profile.hpp>
 #include <thor-internal/debug.hpp>
 #include <assert.h>
 
@@ -154,13 +155,20 @@ struct Engine {
 				infoLogger() << "thor: Running task " << current->displayName_
 						<< frg::endlog;
 
+			auto activateBegin = getRawTimestampCounter();
 			current->activate();
+			auto activateEnd = getRawTimestampCounter();
 			current->done_ = true;
 
 			if(current->type_ == NodeType::stage)
 				infoLogger() << "thor: Reached stage " << current->displayName_
 						<< frg::endlog;
 
+			if(current->displayName_)
+				recordBootPhase(current->type_ == NodeType::task
+							? BootPhaseKind::initgraphTask : BootPhaseKind::initgraphStage,
+						current->displayName_, activateBegin, activateEnd);
+
 			for(auto edge : current->outList_) {
 				auto successor = edge->target_;
 
@@ -164,6 +164,9 @@ public:
 	// ----------------------------------------------------------------------------------
 
 private:
+	// Maximal number of elements that are written before the progress futex is updated.
+	static constexpr size_t maxBatchSize = 64;
+
 	coroutine<void> _runQueue();
 
 private:
@@ -4,6 +4,7 @@
 #include <frg/expected.hpp>
 #include <frg/list.hpp>
 #include <frg/string.hpp>
+#include <frg/vector.hpp>
 #include <thor-internal/error.hpp>
 #include <thor-internal/kernel_heap.hpp>
 #include <thor-internal/kernlet.hpp>
@@ -146,6 +147,17 @@ enum class IrqStrategy {
 	maskThenEoi
 };
 
+struct IrqPinStats {
+	frg::string<KernelAlloc> name;
+	// CPU that the IRQ is steered to, or -1 if it was never steered.
+	int affinity;
+	// Number of times that the IRQ was raised on each CPU.
+	frg::vector<uint64_t, KernelAlloc> raises;
+};
+
+// Returns statistics about all IRQ pins.
+frg::vector<IrqPinStats, KernelAlloc> getIrqPinStats();
+
 // Represents a (not necessarily physical) "pin" of an interrupt controller.
 // This class handles the IRQ configuration and acknowledgement.
 struct IrqPin {
@@ -154,6 +166,8 @@ private:
 	static constexpr int maskedWhileBuffered = 2;
 	static constexpr int maskedForNack = 4;
 
+	friend frg::vector<IrqPinStats, KernelAlloc> getIrqPinStats();
+
 public:
 	static void attachSink(IrqPin *pin, IrqSink *sink);
 	static Error ackSink(IrqSink *sink, uint64_t sequence);
@@ -173,6 +187,11 @@ public:
 
 	void configure(IrqConfiguration cfg);
 
+	// Delivers future IRQs to the given CPU.
+	// Returns Error::illegalArgs for invalid CPUs and Error::noHardwareSupport
+	// if the interrupt controller cannot route the IRQ to the CPU.
+	Error setAffinity(int cpu);
+
 	// This function is called from IrqSlot::raise().
 	void raise();
 
@@ -196,6 +215,14 @@ protected:
 	// Sends an end-of-interrupt signal to the interrupt controller.
 	virtual void sendEoi() = 0;
 
+	frg::ticket_spinlock *pinMutex() {
+		return &_mutex;
+	}
+
+	// Reprograms the interrupt controller to deliver the IRQ to the given CPU.
+	// Called with the pin's mutex held. The default implementation does not support this.
+	virtual Error retarget(int cpu);
+
 	~IrqPin() = default;
 
 private:
@@ -232,6 +259,10 @@ private:
 	int _unstallExponent = 0;
 	async::recurring_event _unstallEvent;
 
+	int _affinity = -1;
+	// Indexed by CPU; grown on demand in raise().
+	frg::vector<uint64_t, KernelAlloc> _raiseCounts{*kernelAlloc};
+
 	// TODO: This list should change rarely. Use a RCU list.
 	frg::intrusive_list<
 		IrqSink,
@@ -241,6 +272,25 @@ private:
 			&IrqSink::hook
 		>
 	> _sinkList;
+
+public:
+	// Links all IRQ pins for getIrqPinStats(). Pins are never destructed.
+	frg::default_list_hook<IrqPin> globalHook;
+};
+
+struct MsiPin;
+
+// Implemented by devices that store the message of an MsiPin (e.g., in an MSI-X table).
+struct MsiProgrammer {
+	// Writes the current message of the pin to the device.
+	virtual void programMsi(MsiPin *pin, size_t index) = 0;
+
+	// Masks or unmasks the MSI at the device. Called in IRQ context.
+	// Devices without per-vector masking may ignore this.
+	virtual void maskMsi(size_t index, bool masked) = 0;
+
+protected:
+	~MsiProgrammer() = default;
 };
 
 struct MsiPin : IrqPin {
@@ -250,8 +300,27 @@ struct MsiPin : IrqPin {
 	virtual uint64_t getMessageAddress() = 0;
 	virtual uint32_t getMessageData() = 0;
 
+	// Called by the device once it stores the message; retarget() then
+	// rewrites the device's copy of the message.
+	void setProgrammer(MsiProgrammer *programmer, size_t index);
+
 protected:
+	// Changes the message returned by getMessageAddress() and getMessageData()
+	// such that the MSI is delivered to the given CPU.
+	virtual Error retargetMessage(int cpu) = 0;
+
+	Error retarget(int cpu) override;
+
+	// Implementations of mask() and unmask() can use this if the interrupt
+	// controller itself cannot mask MSIs.
+	void maskAtDevice(bool masked);
+
 	~MsiPin() = default;
+
+private:
+	MsiProgrammer *_programmer = nullptr;
+	size_t _programmerIndex = 0;
+	bool _maskedAtDevice = false;
 };
 
 // ----------------------------------------------------------------------------
@@ -10,6 +10,17 @@ struct StackBase {
 	void *sp;
 };
 
+// Per-CPU cache of kernel stacks. Cached stacks stay mapped, such that creating
+// and destroying threads neither touches the page allocator nor kernel virtual memory
+// (and, in particular, does not need TLB shootdowns).
+struct KernelStackCache {
+	static constexpr size_t maxStacks = 8;
+
+	// Tops of the cached stacks.
+	char *stacks[maxStacks];
+	size_t numStacks = 0;
+};
+
 struct UniqueKernelStack {
 	static constexpr size_t kSize = 0xF000;
 
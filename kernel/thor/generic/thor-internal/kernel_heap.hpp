@@ -6,6 +6,8 @@
 #include <frg/manual_box.hpp>
 #include <physical-buddy.hpp>
 #include <thor-internal/arch/stack.hpp>
+#include <thor-internal/heap-guard.hpp>
+#include <thor-internal/lock-stats.hpp>
 
 namespace thor {
 
@@ -66,16 +68,81 @@ public:
 	void output_trace(void *buffer, size_t size);
 };
 
-using KernelAlloc = frg::slab_allocator<KernelVirtualAlloc, IrqSpinlock>;
+using KernelSlabPool = frg::slab_pool<KernelVirtualAlloc, TrackedLock<IrqSpinlock, slabLockClass>>;
+
+// Per-CPU magazine layer in front of the global slab pool (see Bonwick & Adams,
+// "Magazines and Vmem"). Each CPU owns a loaded and a previous magazine per size class;
+// full and empty magazines are exchanged with a global depot.
+// The global slab pool is only consulted if neither magazine nor the depot can serve a request.
+struct HeapMagazine {
+	static constexpr size_t capacity = 30;
+
+	HeapMagazine *next = nullptr;
+	size_t rounds = 0;
+	void *objects[capacity];
+};
+
+struct HeapCacheStats {
+	uint64_t allocHits = 0;
+	uint64_t allocMisses = 0;
+	uint64_t freeHits = 0;
+	uint64_t freeMisses = 0;
+};
+
+struct HeapCache {
+	// Size classes are powers of two from 2^minShift to 2^maxShift bytes.
+	static constexpr int minShift = 4;
+	static constexpr int maxShift = 10;
+	static constexpr int numClasses = maxShift - minShift + 1;
+
+	struct SizeClass {
+		HeapMagazine *loaded = nullptr;
+		HeapMagazine *previous = nullptr;
+	};
+
+	SizeClass classes[numClasses];
+	HeapCacheStats stats;
+	// Allocations until the heap guard samples the next one (see heap-guard.hpp).
+	uint64_t guardCountdown = 0;
+};
+
+struct KernelAlloc {
+	constexpr KernelAlloc(KernelSlabPool *pool)
+	: pool_{pool} { }
+
+	void *allocate(size_t size);
+	void deallocate(void *pointer, size_t size);
+
+	// free() and reallocate() do not know the object's size class.
+	// They always go to the global pool, which is fine since cached objects
+	// are ordinary slab objects.
+	void free(void *pointer) {
+		if(isGuardedHeapPointer(pointer)) {
+			freeGuardedObject(pointer);
+			return;
+		}
+		pool_->free(pointer);
+	}
+
+	void *reallocate(void *pointer, size_t size) {
+		if(isGuardedHeapPointer(pointer))
+			return reallocateGuardedObject(pointer, size);
+		return pool_->realloc(pointer, size);
+	}
+
+	KernelSlabPool *get_pool() {
+		return pool_;
+	}
+
+private:
+	KernelSlabPool *pool_;
+};
+
+HeapCacheStats getHeapCacheStats(int cpu);
 
 extern constinit frg::manual_box<KernelVirtualAlloc> kernelVirtualAlloc;
 
-extern constinit frg::manual_box<
-	frg::slab_pool<
-		KernelVirtualAlloc,
-		IrqSpinlock
-	>
-> kernelHeap;
+extern constinit frg::manual_box<KernelSlabPool> kernelHeap;
 
 extern constinit frg::manual_box<KernelAlloc> kernelAlloc;
 
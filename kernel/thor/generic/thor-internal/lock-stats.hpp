@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <frg/span.hpp>
+
+namespace thor {
+
+// Defined by the architecture code. Not included from arch/cpu.hpp since this header
+// is needed by kernel_heap.hpp.
+uint64_t getRawTimestampCounter();
+
+// Statistics that are shared by all locks of the same class (e.g., all futex buckets).
+// All times are in ticks of getRawTimestampCounter().
+// Only updated if thor is built with the kernel_lock_stats option.
+struct LockClass {
+	static constexpr int numSpinBuckets = 16;
+
+	// Acquisitions that spin for at least this long are considered to be contended.
+	static constexpr uint64_t contentionThreshold = 256;
+
+	constexpr LockClass(const char *name_)
+	: name{name_} { }
+
+	LockClass(const LockClass &) = delete;
+
+	LockClass &operator= (const LockClass &) = delete;
+
+	void noteAcquire(uint64_t spinTicks) {
+		acquisitions.fetch_add(1, std::memory_order_relaxed);
+		if(spinTicks >= contentionThreshold)
+			contendedAcquisitions.fetch_add(1, std::memory_order_relaxed);
+		totalSpinTicks.fetch_add(spinTicks, std::memory_order_relaxed);
+		spinHistogram[spinBucket(spinTicks)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void noteRelease(uint64_t holdTicks) {
+		auto max = maxHoldTicks.load(std::memory_order_relaxed);
+		while(holdTicks > max) {
+			if(maxHoldTicks.compare_exchange_weak(max, holdTicks, std::memory_order_relaxed))
+				break;
+		}
+	}
+
+	// Bucket i counts acquisitions that spun for [2^i, 2^(i + 1)) ticks;
+	// the first and the last bucket also include shorter and longer spins.
+	static int spinBucket(uint64_t spinTicks) {
+		int bucket = 0;
+		while(spinTicks > 1 && bucket < numSpinBuckets - 1) {
+			spinTicks >>= 1;
+			bucket++;
+		}
+		return bucket;
+	}
+
+	const char *name;
+	std::atomic<uint64_t> acquisitions{0};
+	std::atomic<uint64_t> contendedAcquisitions{0};
+	std::atomic<uint64_t> totalSpinTicks{0};
+	std::atomic<uint64_t> maxHoldTicks{0};
+	std::atomic<uint64_t> spinHistogram[numSpinBuckets]{};
+};
+
+extern LockClass slabLockClass;
+extern LockClass physicalLockClass;
+extern LockClass futexLockClass;
+
+// Returns all lock classes (even if lock statistics are disabled).
+frg::span<LockClass *const> allLockClasses();
+
+#ifdef THOR_LOCK_STATS
+
+// Wraps a lock and accounts its acquisitions in Class.
+// Lock must be held with IRQs disabled such that the hold time is measured on a single CPU.
+template<typename Lock, LockClass &Class>
+struct TrackedLock {
+	constexpr TrackedLock() = default;
+
+	TrackedLock(const TrackedLock &) = delete;
+
+	TrackedLock &operator= (const TrackedLock &) = delete;
+
+	void lock() {
+		auto start = getRawTimestampCounter();
+		_lock.lock();
+		_acquiredAt = getRawTimestampCounter();
+		Class.noteAcquire(_acquiredAt - start);
+	}
+
+	void unlock() {
+		auto hold = getRawTimestampCounter() - _acquiredAt;
+		_lock.unlock();
+		Class.noteRelease(hold);
+	}
+
+private:
+	Lock _lock;
+	uint64_t _acquiredAt = 0;
+};
+
+#else // THOR_LOCK_STATS
+
+template<typename Lock, LockClass &Class>
+using TrackedLock = Lock;
+
+#endif // THOR_LOCK_STATS
+
+} // namespace thor
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+
+#include <smarter.hpp>
+#include <thor-internal/event.hpp>
+
+namespace thor {
+
+// System-wide memory pressure, derived from the number of free physical pages.
+enum class MemoryPressure {
+	none,
+	low,
+	medium,
+	critical
+};
+
+MemoryPressure currentMemoryPressure();
+
+// Raises bit (1 << level) whenever the pressure changes to the given level.
+smarter::shared_ptr<BitsetEvent> getMemoryPressureEvent();
+
+// Accounts physical memory that is allocated by AllocatedMemory and CopyOnWriteMemory.
+// Memory objects are charged to the account of the universe that created them.
+struct MemoryAccount {
+	// Bits of event().
+	static constexpr uint32_t softLimitBit = 1;
+	static constexpr uint32_t hardLimitBit = 2;
+
+	// A limit of zero means that there is no limit.
+	MemoryAccount(size_t softLimit, size_t hardLimit);
+
+	MemoryAccount(const MemoryAccount &) = delete;
+
+	MemoryAccount &operator= (const MemoryAccount &) = delete;
+
+	// Returns false (and does not charge anything) if the hard limit would be exceeded.
+	bool charge(size_t size);
+
+	// Charges memory even if that exceeds the hard limit.
+	// Used on paths that cannot fail, such as eager copies during fork().
+	void forceCharge(size_t size);
+
+	void uncharge(size_t size);
+
+	size_t usage() {
+		return _usage.load(std::memory_order_relaxed);
+	}
+
+	size_t softLimit() {
+		return _softLimit;
+	}
+
+	size_t hardLimit() {
+		return _hardLimit;
+	}
+
+	// Raised when the usage exceeds the soft limit and when a charge fails.
+	smarter::shared_ptr<BitsetEvent> event() {
+		return _event;
+	}
+
+private:
+	void _checkSoftLimit(size_t oldUsage, size_t newUsage);
+
+	size_t _softLimit;
+	size_t _hardLimit;
+	std::atomic<size_t> _usage{0};
+	smarter::shared_ptr<BitsetEvent> _event;
+};
+
+} // namespace thor
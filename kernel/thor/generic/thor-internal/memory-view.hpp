@@ -12,6 +12,8 @@
 #include <thor-internal/arch/paging.hpp>
 #include <thor-internal/error.hpp>
 #include <thor-internal/futex.hpp>
+#include <thor-internal/memory-account.hpp>
+#include <thor-internal/physical.hpp>
 #include <thor-internal/types.hpp>
 #include <thor-internal/kernel-locks.hpp>
 
@@ -23,6 +25,16 @@ enum class ManageRequest {
 	writeback
 };
 
+enum class AccessAdvice {
+	normal,
+	random,
+	sequential,
+	willNeed,
+	// Only supported by CopyOnWriteMemory.
+	mergeable,
+	unmergeable
+};
+
 struct Mapping;
 struct AddressSpace;
 struct AddressSpaceLockHandle;
@@ -38,6 +50,10 @@ struct CachePage {
 	static constexpr uint32_t reclaimPosted = 0x02;
 	// Page has been evicted (neither in the LRU, nor in the bundle list).
 	static constexpr uint32_t reclaimInflight = 0x04;
+	// Page is on the active list (otherwise, it is on the inactive list).
+	static constexpr uint32_t reclaimActive = 0x08;
+	// Page was accessed while on the inactive list; the next access activates it.
+	static constexpr uint32_t reclaimReferenced = 0x10;
 
 	// CacheBundle that owns this page.
 	CacheBundle *bundle = nullptr;
@@ -52,11 +68,50 @@ struct CachePage {
 	uint32_t flags = 0;
 };
 
+// Per-bundle statistics of the reclaim mechanism.
+struct CacheBundleStats {
+	uint64_t id;
+	size_t activePages;
+	size_t inactivePages;
+	// Number of pages that were moved from the inactive to the active list.
+	uint64_t activations;
+	// Number of pages that were posted for eviction.
+	uint64_t evictions;
+};
+
+struct CacheStats {
+	size_t activePages;
+	size_t inactivePages;
+	frg::vector<CacheBundleStats, KernelAlloc> bundles;
+};
+
+// Returns statistics about all bundles that have pages in the cache or that had pages evicted.
+CacheStats getCacheStats();
+
 // This is the "backend" part of a memory object.
 struct CacheBundle {
 	friend struct MemoryReclaimer;
 
+	CacheBundle() = default;
+
+protected:
+	// Pages of anonymous bundles are not handed to the bundle's own reclaim loop;
+	// instead, the reclaimer compresses them (see CopyOnWriteMemory).
+	explicit CacheBundle(bool anonymous)
+	: _anonymous{anonymous} { }
+
 private:
+	frg::default_list_hook<CacheBundle> _bundleHook;
+
+	bool _anonymous = false;
+
+	// The following fields are protected by the reclaimer's lock.
+	uint64_t _bundleId = 0;
+	size_t _numActive = 0;
+	size_t _numInactive = 0;
+	uint64_t _numActivations = 0;
+	uint64_t _numEvictions = 0;
+
 	frg::intrusive_list<
 		CachePage,
 		frg::locate_member<
@@ -171,6 +226,16 @@ public:
 using FetchFlags = uint32_t;
 inline constexpr FetchFlags fetchDisallowBacking = 1;
 
+// Determines how pages of a MemoryView are accounted in the RSS of address spaces.
+enum class RssKind {
+	// Pages are not accounted (e.g., device memory).
+	none,
+	anonymous,
+	file,
+	shared,
+	count
+};
+
 struct RangeToEvict {
 	uintptr_t offset;
 	size_t size;
@@ -303,6 +368,11 @@ public:
 	// Result stays valid until the range is evicted.
 	virtual frg::tuple<PhysicalAddr, CachingMode> peekRange(uintptr_t offset) = 0;
 
+	// Like peekRange() but only succeeds if [offset, offset + kHugePageSize) is backed
+	// by physically contiguous memory that is aligned to kHugePageSize.
+	// The default implementation always fails.
+	virtual frg::tuple<PhysicalAddr, CachingMode> peekHugeRange(uintptr_t offset);
+
 	// Makes a range of memory available for peekRange().
 	virtual coroutine<frg::expected<Error>>
 	touchRange(uintptr_t offset, size_t size, FetchFlags flags, smarter::shared_ptr<WorkQueue> wq);
@@ -321,9 +391,26 @@ public:
 	// Called (e.g. by user space) to update a range after loading or writeback.
 	virtual Error updateRange(ManageRequest type, size_t offset, size_t length);
 
+	// Hint about the expected access pattern. Returns Error::illegalObject
+	// if the view does not make use of such hints.
+	virtual Error adviseAccess(AccessAdvice advice, uintptr_t offset, size_t size);
+
+	// Drops the pages of the range; they read as the contents of the view's source again.
+	// If lazy is set, pages are only dropped under memory pressure and accessing them
+	// before that keeps their contents. Returns Error::illegalObject if the view
+	// cannot drop pages.
+	virtual coroutine<frg::expected<Error>> discardRange(uintptr_t offset, size_t size,
+			bool lazy);
+
 	virtual Error setIndirection(size_t slot, smarter::shared_ptr<MemoryView> view,
 			uintptr_t offset, size_t size);
 
+	// Note that copy-on-write views account all pages as anonymous, even pages
+	// that are still shared with the view that they copy.
+	virtual RssKind rssKind() {
+		return RssKind::anonymous;
+	}
+
 	// ----------------------------------------------------------------------------------
 	// Memory eviction.
 	// ----------------------------------------------------------------------------------
@@ -552,7 +639,8 @@ struct SliceRange {
 
 struct MemorySlice {
 	MemorySlice(smarter::shared_ptr<MemoryView> view,
-			ptrdiff_t view_offset, size_t view_size);
+			ptrdiff_t view_offset, size_t view_size,
+			CachingMode caching_mode = CachingMode::null);
 
 	smarter::shared_ptr<MemoryView> getView() {
 		return _view;
@@ -561,10 +649,15 @@ struct MemorySlice {
 	uintptr_t offset() { return _viewOffset; }
 	size_t length() { return _viewSize; }
 
+	// Caching mode of mappings that do not request a specific one.
+	// CachingMode::null if the caching mode of the view is used.
+	CachingMode cachingMode() { return _cachingMode; }
+
 private:
 	smarter::shared_ptr<MemoryView> _view;
 	ptrdiff_t _viewOffset;
 	size_t _viewSize;
+	CachingMode _cachingMode;
 };
 
 // ----------------------------------------------------------------------------------
@@ -779,10 +872,14 @@ struct HardwareMemory final : MemoryView {
 	Error lockRange(uintptr_t offset, size_t size) override;
 	void unlockRange(uintptr_t offset, size_t size) override;
 	frg::tuple<PhysicalAddr, CachingMode> peekRange(uintptr_t offset) override;
+	frg::tuple<PhysicalAddr, CachingMode> peekHugeRange(uintptr_t offset) override;
 	coroutine<frg::expected<Error, PhysicalRange>>
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	RssKind rssKind() override {
+		return RssKind::none;
+	}
 
 private:
 	PhysicalAddr _base;
@@ -805,23 +902,42 @@ struct AllocatedMemory final : MemoryView, GlobalFutexSpace {
 	Error lockRange(uintptr_t offset, size_t size) override;
 	void unlockRange(uintptr_t offset, size_t size) override;
 	frg::tuple<PhysicalAddr, CachingMode> peekRange(uintptr_t offset) override;
+	frg::tuple<PhysicalAddr, CachingMode> peekHugeRange(uintptr_t offset) override;
 	coroutine<frg::expected<Error, PhysicalRange>>
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	RssKind rssKind() override {
+		return RssKind::shared;
+	}
 
 	coroutine<frg::expected<Error, PhysicalAddr>> takeGlobalFutex(uintptr_t offset,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void retireGlobalFutex(uintptr_t offset) override;
 
+	// Restricts future physical allocations to the given NUMA node.
+	// Must be called before the memory is accessed.
+	void bindToNode(int node) {
+		_numaNode = node;
+	}
+
+	// Charges future physical allocations to the given account.
+	// Must be called before the memory is accessed.
+	void setAccount(smarter::shared_ptr<MemoryAccount> account) {
+		_account = std::move(account);
+	}
+
 public:
 	// Contract: set by the code that constructs this object.
 	smarter::borrowed_ptr<AllocatedMemory> selfPtr;
 private:
 	frg::ticket_spinlock _mutex;
 
+	smarter::shared_ptr<MemoryAccount> _account;
+
 	frg::vector<PhysicalAddr, KernelAlloc> _physicalChunks;
 	int _addressBits;
+	int _numaNode = PhysicalChunkAllocator::anyNode;
 	size_t _chunkSize, _chunkAlign;
 };
 
@@ -890,6 +1006,13 @@ struct ManagedSpace : CacheBundle {
 	void _progressManagement(ManageList &pending);
 	void _progressMonitors(MonitorList &pending);
 
+	// Moves missing pages in [index, index + count) to the initialization list.
+	void _requestPages(size_t index, size_t count);
+
+	// Called when the page at index has to be initialized due to a fetch.
+	// Updates the stream detection and returns the number of pages to read ahead.
+	size_t _readaheadOnMiss(size_t index);
+
 	smarter::borrowed_ptr<ManagedSpace> selfPtr;
 
 	frg::ticket_spinlock mutex;
@@ -898,6 +1021,12 @@ struct ManagedSpace : CacheBundle {
 
 	size_t numPages;
 	bool readahead;
+	AccessAdvice advice = AccessAdvice::normal;
+
+	// Sequential stream detection: a miss at _streamEnd continues the stream and
+	// grows the readahead window, other misses shrink it.
+	size_t _streamEnd = 0;
+	size_t _readaheadWindow = 0;
 
 	EvictionQueue _evictQueue;
 
@@ -945,6 +1074,9 @@ public:
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	RssKind rssKind() override {
+		return RssKind::file;
+	}
 	void submitManage(ManageNode *handle) override;
 	Error updateRange(ManageRequest type, size_t offset, size_t length) override;
 
@@ -971,6 +1103,10 @@ public:
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	RssKind rssKind() override {
+		return RssKind::file;
+	}
+	Error adviseAccess(AccessAdvice advice, uintptr_t offset, size_t size) override;
 
 	coroutine<frg::expected<Error, PhysicalAddr>> takeGlobalFutex(uintptr_t offset,
 			smarter::shared_ptr<WorkQueue> wq) override;
@@ -1025,6 +1161,15 @@ private:
 };
 
 struct CowChain {
+	struct Page {
+		Page(uint64_t index, PhysicalAddr physical)
+		: index{index}, physical{physical} { }
+
+		uint64_t index;
+		// Set to -1 once the page has been moved to another chain.
+		std::atomic<PhysicalAddr> physical;
+	};
+
 	CowChain(smarter::shared_ptr<CowChain> chain);
 
 	~CowChain();
@@ -1033,10 +1178,25 @@ struct CowChain {
 	frg::ticket_spinlock _mutex;
 
 	smarter::shared_ptr<CowChain> _superChain;
-	frg::rcu_radixtree<std::atomic<PhysicalAddr>, KernelAlloc> _pages;
+	frg::rcu_radixtree<Page, KernelAlloc> _pages;
+
+	// Number of CopyOnWriteMemory objects that use this chain as their _copyChain.
+	std::atomic<unsigned int> _numMemories{0};
+	// Number of chains that use this chain as their _superChain.
+	std::atomic<unsigned int> _numSubChains{0};
 };
 
-struct CopyOnWriteMemory final : MemoryView, GlobalFutexSpace /*, MemoryObserver */ {
+struct CompressedPage;
+struct MergedFrame;
+
+// Copied pages that are not locked are registered with the reclaimer. Under memory pressure,
+// they are compressed into the compressed store and decompressed again on the next fetch.
+// If the memory is advised to be mergeable, pages with identical contents are merged into
+// a single shared frame; the next fetch copies the frame again.
+struct CopyOnWriteMemory final : MemoryView, GlobalFutexSpace, CacheBundle /*, MemoryObserver */ {
+	friend struct MemoryReclaimer;
+	friend struct PageMerger;
+
 public:
 	CopyOnWriteMemory(smarter::shared_ptr<MemoryView> view,
 			uintptr_t offset, size_t length,
@@ -1048,6 +1208,8 @@ public:
 	CopyOnWriteMemory &operator= (const CopyOnWriteMemory &) = delete;
 
 	size_t getLength() override;
+	// Only growing is supported; the new range is backed by the original view.
+	void resize(size_t newLength, async::any_receiver<void> receiver) override;
 	void fork(async::any_receiver<frg::tuple<Error, smarter::shared_ptr<MemoryView>>> receiver) override;
 	frg::expected<Error, frg::tuple<smarter::shared_ptr<GlobalFutexSpace>, uintptr_t>>
 			resolveGlobalFutex(uintptr_t offset) override;
@@ -1060,36 +1222,95 @@ public:
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	Error adviseAccess(AccessAdvice advice, uintptr_t offset, size_t size) override;
+	coroutine<frg::expected<Error>> discardRange(uintptr_t offset, size_t size,
+			bool lazy) override;
 
 	coroutine<frg::expected<Error, PhysicalAddr>> takeGlobalFutex(uintptr_t offset,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void retireGlobalFutex(uintptr_t offset) override;
 
+	// Charges copied pages to the given account; forks inherit the account.
+	// Must be called before the memory is accessed.
+	void setAccount(smarter::shared_ptr<MemoryAccount> account) {
+		_account = std::move(account);
+	}
+
 public:
 	// Contract: set by the code that constructs this object.
-	smarter::borrowed_ptr<CopyOnWriteMemory> selfPtr;
+	// This is a weak pointer such that the reclaimer can get a reference from a CachePage.
+	smarter::weak_ptr<CopyOnWriteMemory> selfPtr;
 private:
+	// Charges a single copied page. Returns false if the account's hard limit is hit.
+	bool _chargePage();
+	void _unchargePage();
+
+	// Looks up the page at the given offset of _view in the chain and its super-chains.
+	// Returns a page that this memory can own, or -1 if no chain contains the page.
+	PhysicalAddr _fetchFromChain(smarter::shared_ptr<CowChain> chain, uintptr_t pageOffset);
+
 	enum class CowState {
 		null,
 		inProgress,
-		hasCopy
+		hasCopy,
+		// Like hasCopy, but the page is being evicted to the compressed store.
+		evicting,
+		// The page is only present in the compressed store.
+		compressed,
+		// Like hasCopy, but the page is being evicted to be merged.
+		merging,
+		// Like hasCopy, but the page is being evicted to be dropped by discardRange().
+		discarding,
+		// The page is shared with other pages of identical contents.
+		merged
 	};
 
 	struct CowPage {
 		PhysicalAddr physical = -1;
 		CowState state = CowState::null;
 		unsigned int lockCount = 0;
+		// Only valid in state compressed.
+		CompressedPage *compressed = nullptr;
+		// Only valid in state merged.
+		MergedFrame *merged = nullptr;
+		// Hash of the contents at the time of the last merge scan.
+		uint64_t mergeHash = 0;
+		bool mergeHashed = false;
+		// Set by lazy discardRange(); the reclaimer drops such pages instead of
+		// compressing them. Cleared when the page is fetched again.
+		bool lazyFree = false;
+		CachePage cachePage;
 	};
 
+	// The following functions expect _mutex to be held.
+	// Registers a page that just became unlocked (or was copied) with the reclaimer.
+	void _addToReclaim(CowPage *page, uint64_t index);
+	void _removeFromReclaim(CowPage *page);
+	// Turns a page in state evicting, compressed, merging, merged or discarding back into
+	// a page in state hasCopy.
+	void _makePresent(CowPage *page);
+
+	// Called by the reclaimer to move a page to the compressed store
+	// (or to drop it if it is lazily freed).
+	coroutine<void> _compressPage(uint64_t index);
+
+	// Frees the page and removes it from _ownedPages.
+	void _dropPage(CowPage *page, uint64_t index);
+
 	frg::ticket_spinlock _mutex;
 
 	smarter::shared_ptr<MemoryView> _view;
 	uintptr_t _viewOffset;
 	size_t _length;
 	smarter::shared_ptr<CowChain> _copyChain;
+	smarter::shared_ptr<MemoryAccount> _account;
 	frg::rcu_radixtree<CowPage, KernelAlloc> _ownedPages;
 	async::recurring_event _copyEvent;
 	EvictionQueue _evictQueue;
+
+	// Protected by the mutex of the page merger.
+	bool _mergeable = false;
+	frg::default_list_hook<CopyOnWriteMemory> _mergeHook;
 };
 
 // --------------------------------------------------------------------------------------
@@ -1140,6 +1361,16 @@ struct GlobalFutex {
 		return __atomic_load_n(accessPtr, __ATOMIC_RELAXED);
 	}
 
+	// On failure, expected is updated to the current value of the word.
+	bool compareExchange(unsigned int &expected, unsigned int desired) {
+		PageAccessor accessor{physical_};
+		auto offsetOfWord = offset_ & (kPageSize - 1);
+		auto accessPtr = reinterpret_cast<unsigned int *>(
+				reinterpret_cast<std::byte *>(accessor.get()) + offsetOfWord);
+		return __atomic_compare_exchange_n(accessPtr, &expected, desired, false,
+				__ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+	}
+
 	void retire() {
 		space_->retireGlobalFutex(offset_);
 		space_ = nullptr;
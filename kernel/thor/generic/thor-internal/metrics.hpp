@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#include <thor-internal/cpu-data.hpp>
+
+namespace thor {
+
+enum class MetricType {
+	counter,
+	gauge,
+	histogram
+};
+
+// Base class of all metrics. Metrics register themselves on construction and must have
+// static storage duration; use the THOR_DEFINE_*_METRIC() macros below to declare them.
+//
+// Values are stored in per-CPU slots (see CpuData::metricSlots), i.e., updates only touch
+// cache lines of the current CPU. Readers sum up the slots of all CPUs.
+// Updates are atomic, so they remain correct if the thread migrates during the update.
+struct Metric {
+	Metric(const char *name, const char *description, MetricType type, size_t numSlots);
+
+	Metric(const Metric &) = delete;
+
+	Metric &operator= (const Metric &) = delete;
+
+	const char *name() const {
+		return _name;
+	}
+
+	const char *description() const {
+		return _description;
+	}
+
+	MetricType type() const {
+		return _type;
+	}
+
+	Metric *next() const {
+		return _next;
+	}
+
+protected:
+	void addLocal(size_t i, uint64_t value) {
+		getCpuData()->metricSlots[_slot + i].fetch_add(value, std::memory_order_relaxed);
+	}
+
+	// Sums up the given slot over all CPUs.
+	uint64_t aggregate(size_t i) const;
+
+private:
+	const char *_name;
+	const char *_description;
+	MetricType _type;
+	size_t _slot;
+	Metric *_next;
+};
+
+// Monotonically increasing value, e.g., number of page faults.
+struct CounterMetric : Metric {
+	CounterMetric(const char *name, const char *description)
+	: Metric{name, description, MetricType::counter, 1} { }
+
+	void increment(uint64_t n = 1) {
+		addLocal(0, n);
+	}
+
+	uint64_t read() const {
+		return aggregate(0);
+	}
+};
+
+// Value that can go up and down, e.g., number of allocated objects.
+// Individual CPUs can observe negative values; only the sum is meaningful.
+struct GaugeMetric : Metric {
+	GaugeMetric(const char *name, const char *description)
+	: Metric{name, description, MetricType::gauge, 1} { }
+
+	void add(int64_t n) {
+		addLocal(0, static_cast<uint64_t>(n));
+	}
+
+	void sub(int64_t n) {
+		addLocal(0, -static_cast<uint64_t>(n));
+	}
+
+	int64_t read() const {
+		return static_cast<int64_t>(aggregate(0));
+	}
+};
+
+// Distribution of values, e.g., latencies in ticks.
+struct HistogramMetric : Metric {
+	static constexpr int numBuckets = 32;
+
+	HistogramMetric(const char *name, const char *description)
+	: Metric{name, description, MetricType::histogram, numBuckets + 1} { }
+
+	void record(uint64_t value) {
+		addLocal(bucketOf(value), 1);
+		addLocal(numBuckets, value);
+	}
+
+	// Bucket i counts values in [2^i, 2^(i + 1)); the first and the last bucket
+	// also include smaller and larger values.
+	static int bucketOf(uint64_t value) {
+		int bucket = 0;
+		while(value > 1 && bucket < numBuckets - 1) {
+			value >>= 1;
+			bucket++;
+		}
+		return bucket;
+	}
+
+	uint64_t readBucket(int i) const {
+		return aggregate(i);
+	}
+
+	uint64_t readSum() const {
+		return aggregate(numBuckets);
+	}
+};
+
+// Returns the most recently registered metric; iterate using Metric::next().
+Metric *firstMetric();
+
+#define THOR_DEFINE_COUNTER_METRIC(ident, name, description) \
+	::thor::CounterMetric ident{name, description}
+#define THOR_DEFINE_GAUGE_METRIC(ident, name, description) \
+	::thor::GaugeMetric ident{name, description}
+#define THOR_DEFINE_HISTOGRAM_METRIC(ident, name, description) \
+	::thor::HistogramMetric ident{name, description}
+
+} // namespace thor
@@ -12,10 +12,12 @@ extern bool wantOsTrace;
 extern std::atomic<bool> osTraceInUse;
 
 enum class OsTraceEventId : uint64_t { };
+enum class OsTraceItemId : uint64_t { };
 
 LogRingBuffer *getGlobalOsTraceRing();
 
 OsTraceEventId announceOsTraceEvent(frg::string_view name);
+OsTraceItemId announceOsTraceItem(frg::string_view name);
 void emitOsTrace(managarm::ostrace::EventRecord<KernelAlloc> record);
 
 initgraph::Stage *getOsTraceAvailableStage();
@@ -27,6 +29,15 @@ struct OsTraceEvent {
 			rec_.set_id(static_cast<uint64_t>(id));
 	}
 
+	void withCounter(OsTraceItemId id, int64_t value) {
+		if(!live_)
+			return;
+		managarm::ostrace::CounterItem item;
+		item.set_id(static_cast<uint64_t>(id));
+		item.set_value(value);
+		rec_.add_ctrs(std::move(item));
+	}
+
 	void emit() {
 		if(!live_)
 			return;
@@ -5,6 +5,7 @@
 #include <frg/spinlock.hpp>
 #include <frg/manual_box.hpp>
 #include <physical-buddy.hpp>
+#include <thor-internal/lock-stats.hpp>
 #include <thor-internal/types.hpp>
 
 namespace thor {
@@ -25,17 +26,81 @@ public:
 	void *access(PhysicalAddr physical);
 };
 
+// Per-CPU hot lists of free pages. Pages are moved between these lists and the
+// buddy allocator in batches to amortize the cost of taking the global lock.
+// Pages in these lists are still accounted as free.
+struct PhysicalPageCache {
+	struct Level {
+		int order;
+		size_t batch;
+		size_t high;
+	};
+
+	static constexpr int numLevels = 2;
+	static constexpr size_t maxPages = 64;
+	static constexpr Level levels[numLevels] = {
+		{0, 16, 64},
+		{9, 2, 4}
+	};
+
+	// Protects all lists. Other CPUs only take it to drain the lists when the buddy
+	// allocator runs out of memory, so it is hardly ever contended.
+	// Must be taken before the allocator's mutex.
+	frg::ticket_spinlock mutex;
+
+	PhysicalAddr pages[numLevels][maxPages];
+	size_t count[numLevels] = {};
+
+	// Single pages that were zeroed while the CPU was idle. Like the hot lists,
+	// these pages are still accounted as free.
+	static constexpr size_t maxZeroedPages = 32;
+
+	PhysicalAddr zeroed[maxZeroedPages];
+	size_t numZeroed = 0;
+	// Page that the idle loop is currently zeroing (or -1). Since the idle loop can be
+	// preempted at any point, the page is only moved to zeroed once it is complete.
+	PhysicalAddr zeroing = static_cast<PhysicalAddr>(-1);
+};
+
 class PhysicalChunkAllocator {
-	typedef frg::ticket_spinlock Mutex;
+	typedef TrackedLock<frg::ticket_spinlock, physicalLockClass> Mutex;
 public:
+	static constexpr int maxNumaNodes = 8;
+
+	// Allocate from the current CPU's node first, then fall back to other nodes.
+	static constexpr int anyNode = -1;
+
 	PhysicalChunkAllocator();
 	
 	void bootstrapRegion(PhysicalAddr address,
 			int order, size_t numRoots, int8_t *buddyTree);
 
-	PhysicalAddr allocate(size_t size, int addressBits = 64);
+	// Tags all regions that start within [address, address + size) with the given node.
+	void assignNode(PhysicalAddr address, size_t size, int node);
+
+	// If node is not anyNode, memory is only taken from that node.
+	PhysicalAddr allocate(size_t size, int addressBits = 64, int node = anyNode);
 	void free(PhysicalAddr address, size_t size);
 
+	// Allocates a single zero-filled page. Takes pages that were zeroed ahead of time
+	// if possible; otherwise, the page is zeroed on the spot.
+	PhysicalAddr allocateZeroedPage();
+
+	// Frees a single page that is known to be zero-filled (e.g., an empty page table).
+	// The page is kept in the current CPU's pool of zeroed pages if there is room.
+	void freeZeroedPage(PhysicalAddr physical);
+
+	// Fills the current CPU's pool of zeroed pages. Called by the idle task with IRQs
+	// disabled; IRQs are enabled while pages are being zeroed.
+	void zeroPagesWhileIdle();
+
+	int numNodes() {
+		return _numNodes;
+	}
+
+	size_t numTotalPagesOfNode(int node);
+	size_t numUsedPagesOfNode(int node);
+
 	size_t numTotalPages() {
 		return _totalPages.load(std::memory_order_relaxed);
 	}
@@ -47,16 +112,33 @@ public:
 	}
 
 private:
-	Mutex _mutex;
-
 	struct Region {
 		PhysicalAddr physicalBase;
 		PhysicalAddr regionSize;
 		BuddyAccessor buddyAccessor;
+		int node = 0;
+		// Pages of this region that are handed out (i.e., not in the buddy or in a hot list).
+		std::atomic<size_t> usedPages{0};
 	};
 
+	Region *_regionOf(PhysicalAddr address, size_t size);
+
+	// Updates the page counters when memory (that was accounted as free) is handed out.
+	void _markUsed(PhysicalAddr address, size_t size);
+	// Updates the page counters when memory is returned (and accounted as free again).
+	void _markFree(PhysicalAddr address, size_t size);
+
+	// The following functions expect _mutex to be held.
+	PhysicalAddr _allocateFromBuddy(int order, int addressBits, int node, bool strict);
+	void _freeToBuddy(PhysicalAddr address, int order);
+	// Returns the pages in the lists of all CPUs to the buddy allocator.
+	void _drainCaches();
+
+	Mutex _mutex;
+
 	Region _allRegions[8];
 	int _numRegions = 0;
+	int _numNodes = 1;
 
 	std::atomic<size_t> _totalPages{0};
 	std::atomic<size_t> _usedPages{0};
@@ -65,4 +147,29 @@ private:
 
 extern constinit frg::manual_box<PhysicalChunkAllocator> physicalAllocator;
 
+// List of zero-filled pages that are freed together, e.g., page tables that were
+// detached from a page space but can only be freed once the TLB shootdown completes.
+// The list is threaded through the first word of each page. Since the links are
+// page-aligned, they never have the present (or valid) bit of a page table entry set.
+struct DetachedPageList {
+	DetachedPageList() = default;
+
+	DetachedPageList(const DetachedPageList &) = delete;
+
+	DetachedPageList &operator= (const DetachedPageList &) = delete;
+
+	bool empty() {
+		return !_count;
+	}
+
+	void push(PhysicalAddr physical);
+
+	// Clears the links and frees all pages through freeZeroedPage().
+	void free();
+
+private:
+	PhysicalAddr _head = 0;
+	size_t _count = 0;
+};
+
 } // namespace thor
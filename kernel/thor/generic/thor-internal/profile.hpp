@@ -1,11 +1,50 @@
 #pragma once
 
+#include <atomic>
+
+#include <thor-internal/metrics.hpp>
 #include <thor-internal/ring-buffer.hpp>
 
 namespace thor {
 
 extern bool wantKernelProfile;
 
+// Hardware event that triggers profiling samples.
+// Selected by kernel-profile.event=<name> on the kernel command line.
+enum class ProfileEvent : uint32_t {
+	cycles,
+	instructions,
+	llcMisses,
+	branchMisses
+};
+
+extern ProfileEvent kernelProfileEvent;
+
+// Number of events between two samples.
+uint64_t profileSamplePeriod(ProfileEvent event);
+
+inline constexpr size_t maxProfileFrames = 16;
+
+// Record format of the profile ring. Only the first numFrames entries of frames are
+// part of the record. frames contains the return addresses of the interrupted user-space
+// stack (walked via frame pointers); it is empty if the sample was taken in the kernel.
+struct ProfileSample {
+	uint64_t ip;
+	uint64_t thread; // Address of the interrupted Thread, or zero.
+	uint64_t universe; // Address of the interrupted thread's Universe, or zero.
+	uint32_t event; // ProfileEvent.
+	uint32_t numFrames;
+	uint64_t frames[maxProfileFrames];
+};
+
+// Total number of TLB shootdown IPIs that were sent.
+// While profiling, the rate is logged once per second.
+extern CounterMetric numShootdownIpis;
+// Number of wakeup/preemption pings that required an IPI, and pings that
+// were delivered by writing to the MWAIT monitor of an idle CPU instead.
+extern CounterMetric numPingIpis;
+extern CounterMetric numIdleWakesWithoutIpi;
+
 void initializeProfile();
 LogRingBuffer *getGlobalProfileRing();
 
@@ -6,6 +6,7 @@
 #include <frg/list.hpp>
 #include <frg/pairing_heap.hpp>
 #include <frg/spinlock.hpp>
+#include <atomic>
 
 namespace thor {
 
@@ -25,6 +26,29 @@ enum class ScheduleState {
 	active
 };
 
+enum class SchedulePolicy {
+	// Fair share scheduling based on priority and unfairness.
+	fair,
+	// Real-time policies. Real-time entities always run before fair entities.
+	// FIFO entities run until they block or until a real-time entity of higher priority
+	// becomes runnable. Round robin entities also yield to entities of the same
+	// real-time priority at the end of their time slice.
+	fifo,
+	roundRobin
+};
+
+// A priority that is lent to an entity, e.g., by the waiters of a lock that the entity holds.
+// The entity runs with the maximum of its own priority and all priorities that it receives.
+struct PriorityDonation {
+	friend struct ScheduleEntity;
+	friend struct Scheduler;
+
+private:
+	int _priority = 0;
+	frg::default_list_hook<PriorityDonation> _hook;
+	bool _donated = false;
+};
+
 // This needs to store a large timeframe.
 // For now, store it as 55.8 0 signed integer nanoseconds.
 using Progress = int64_t;
@@ -53,10 +77,45 @@ public:
 
 	virtual void handlePreemption(IrqImageAccessor image) = 0;
 
+	// Returns true if the load balancer may move this entity to the given CPU.
+	// Entities that are bound to a specific CPU (e.g., kernel fibers) keep the default.
+	virtual bool isMigratableTo(CpuData *) {
+		return false;
+	}
+
+	// Priority that the entity is scheduled with, including donated priorities.
+	int effectivePriority() {
+		return __atomic_load_n(&priority, __ATOMIC_RELAXED);
+	}
+
+	bool isRealtime() const {
+		return policy != SchedulePolicy::fair;
+	}
+
 	uint64_t runTime() {
 		return _runTime;
 	}
 
+	// Time that the entity was runnable but waited for a CPU.
+	uint64_t waitTime() {
+		return _waitTime;
+	}
+
+	// Number of times the entity gave up its CPU by blocking.
+	uint64_t numVoluntarySwitches() {
+		return _numVoluntarySwitches;
+	}
+
+	// Number of times the entity was preempted.
+	uint64_t numInvoluntarySwitches() {
+		return _numInvoluntarySwitches;
+	}
+
+	// Index of the CPU that the entity was last scheduled on (or -1).
+	int lastCpu() {
+		return _lastCpu;
+	}
+
 private:
 	const ScheduleType type_;
 
@@ -64,13 +123,49 @@ private:
 	Scheduler *_scheduler;
 
 	ScheduleState state;
+	// Effective priority, i.e., the maximum of _basePriority and all donations.
 	int priority;
+	int _basePriority = 0;
+
+	SchedulePolicy policy = SchedulePolicy::fair;
+	// Only meaningful for real-time policies. Larger values are preferred.
+	int rtPriority = 0;
+	// Protected by _donationMutex.
+	SchedulePolicy _basePolicy = SchedulePolicy::fair;
+	int _baseRtPriority = 0;
+
+	// Orders real-time entities of equal priority. Assigned when the entity
+	// becomes runnable and when a round robin entity exhausts its time slice.
+	uint64_t _rtSequence = 0;
+
+	// Protects _donations.
+	frg::ticket_spinlock _donationMutex;
+	frg::intrusive_list<
+		PriorityDonation,
+		frg::locate_member<
+			PriorityDonation,
+			frg::default_list_hook<PriorityDonation>,
+			&PriorityDonation::_hook
+		>
+	> _donations;
+
+	// Priority changes of active entities are applied by the owning CPU.
+	// Protected by the _mutex of _scheduler.
+	int _wantedPriority = 0;
+	SchedulePolicy _wantedPolicy = SchedulePolicy::fair;
+	int _wantedRtPriority = 0;
+	bool _priorityChangePending = false;
+	frg::default_list_hook<ScheduleEntity> _priorityHook;
 
 	frg::default_list_hook<ScheduleEntity> listHook;
 	frg::pairing_heap_hook<ScheduleEntity> heapHook;
 
 	uint64_t _refClock;
 	uint64_t _runTime;
+	uint64_t _waitTime = 0;
+	uint64_t _numVoluntarySwitches = 0;
+	uint64_t _numInvoluntarySwitches = 0;
+	int _lastCpu = -1;
 
 	// Scheduler::_systemProgress value at some slice T.
 	// Invariant: This entity's state did not change since T.
@@ -97,10 +192,20 @@ struct Scheduler {
 	static void unassociate(ScheduleEntity *entity);
 
 	static void setPriority(ScheduleEntity *entity, int priority);
+	static void setPolicy(ScheduleEntity *entity, SchedulePolicy policy, int rtPriority);
+
+	// Lends a priority to the entity until the donation is revoked.
+	// Calling this again on a donated PriorityDonation updates its priority.
+	static void donatePriority(ScheduleEntity *entity, PriorityDonation *donation,
+			int priority);
+	static void revokePriority(ScheduleEntity *entity, PriorityDonation *donation);
 
 	static void resume(ScheduleEntity *entity);
 	static void suspendCurrent();
 
+	// Called once all CPUs are online; before that, entities are never migrated.
+	static void enableLoadBalancing();
+
 	Scheduler(CpuData *cpu_context);
 
 	Scheduler(const Scheduler &) = delete;
@@ -122,11 +227,43 @@ public:
 
 	ScheduleEntity *currentRunnable();
 
+	// Run time of the current entity, including the running time slice.
+	// Must be called with IRQs disabled.
+	uint64_t liveRunTimeOfCurrent();
+
+	// Statistics. These are only written by the owning CPU;
+	// other CPUs may observe slightly outdated values.
+	uint64_t idleNanos() {
+		return _idleNanos;
+	}
+	uint64_t idleWakeups() {
+		return _idleWakeups;
+	}
+	uint64_t directHandoffs() {
+		return _directHandoffs;
+	}
+
 private:
+	static void _updatePriority(ScheduleEntity *entity);
+	static void _commitPriority(ScheduleEntity *entity);
+	void _applyPriorityChanges();
+
 	void _unschedule();
 	void _schedule();
 
+	ScheduleEntity *_takeHandoff();
+
 private:
+	// Load balancing. Entities in _waitQueue are only ever touched by the owning CPU,
+	// hence migration is always performed by the source CPU: idle CPUs post a
+	// request to a busy CPU (_stealRequest) which then pushes an entity to them.
+	void _balance();
+	void _requestWork();
+	size_t _migrationThreshold(Scheduler *other);
+	bool _haveBusySibling();
+	bool _migrateOne(Scheduler *target);
+	void _publishLoad();
+
 	void _updatePreemption();
 
 	void _updateCurrentEntity();
@@ -151,6 +288,8 @@ private:
 
 	size_t _numWaiting = 0;
 
+	uint64_t _nextRtSequence = 0;
+
 	// The last tick at which the scheduler's state (i.e. progress) was updated.
 	// In our model this is the time point at which slice T started.
 	uint64_t _refClock = 0;
@@ -162,11 +301,30 @@ private:
 	// This allows us to easily track u_p(T) for all waiting processes.
 	Progress _systemProgress = 0;
 
+	// Number of regular entities (waiting + running) as seen by other CPUs.
+	std::atomic<size_t> _loadHint{0};
+
+	// Set by an idle CPU that wants to receive work from this scheduler.
+	std::atomic<Scheduler *> _stealRequest{nullptr};
+
+	// Last time at which periodic balancing was performed.
+	uint64_t _balanceClock = 0;
+
+	uint64_t _idleNanos = 0;
+	uint64_t _idleWakeups = 0;
+	uint64_t _directHandoffs = 0;
+
+	// Entity that the current entity resumed last (on this CPU). If the current entity
+	// blocks before it is switched out otherwise, we switch to this entity directly.
+	// Only accessed by the owning CPU with IRQs disabled.
+	ScheduleEntity *_handoff = nullptr;
+
 	// ----------------------------------------------------------------------------------
 	// Management of pending entities.
 	// ----------------------------------------------------------------------------------
 
-	// Note that _mutex *only* protects _pendingList and nothing more!
+	// Note that _mutex *only* protects _pendingList and _priorityList (and the state
+	// transitions into pending) and nothing more!
 	frg::ticket_spinlock _mutex;
 
 	frg::intrusive_list<
@@ -177,6 +335,16 @@ private:
 			&ScheduleEntity::listHook
 		>
 	> _pendingList;
+
+	// Active entities whose _wantedPriority needs to be applied to _waitQueue.
+	frg::intrusive_list<
+		ScheduleEntity,
+		frg::locate_member<
+			ScheduleEntity,
+			frg::default_list_hook<ScheduleEntity>,
+			&ScheduleEntity::_priorityHook
+		>
+	> _priorityList;
 };
 
 Scheduler *localScheduler();
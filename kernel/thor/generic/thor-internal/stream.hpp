@@ -47,7 +47,9 @@ enum {
 	kTagRecvKernelBuffer,
 	kTagRecvFlow,
 	kTagPushDescriptor,
-	kTagPullDescriptor
+	kTagPullDescriptor,
+	kTagPushDescriptors,
+	kTagPullDescriptors
 };
 
 inline int getStreamOrientation(int tag) {
@@ -57,12 +59,14 @@ inline int getStreamOrientation(int tag) {
 	case kTagRecvKernelBuffer:
 	case kTagRecvFlow:
 	case kTagPullDescriptor:
+	case kTagPullDescriptors:
 		return -1;
 	case kTagOffer:
 	case kTagImbueCredentials:
 	case kTagSendKernelBuffer:
 	case kTagSendFlow:
 	case kTagPushDescriptor:
+	case kTagPushDescriptors:
 		return 1;
 	}
 	return 0;
@@ -75,8 +79,14 @@ inline bool usesFlowProtocol(int tag) {
 struct FlowPacket {
 	void *data = nullptr;
 	size_t size = 0;
+	// For direct transfers, the data is read from space at address instead of data.
+	// space stays valid until the packet is acked.
+	VirtualSpace *space = nullptr;
+	uintptr_t address = 0;
 	bool terminate = false;
 	bool fault = false;
+	// Set in acks of direct transfers if the sender's memory faulted.
+	bool sourceFault = false;
 };
 
 struct StreamNode {
@@ -120,6 +130,8 @@ public:
 	size_t _maxLength;
 	frg::unique_memory<KernelAlloc> _inBuffer;
 	AnyDescriptor _inDescriptor;
+	// Used by kTagPushDescriptors; kTagPullDescriptors accepts up to _maxLength descriptors.
+	frg::vector<AnyDescriptor, KernelAlloc> _inDescriptors{*kernelAlloc};
 
 	StreamNode *peerNode = nullptr;
 
@@ -170,6 +182,10 @@ public:
 		return std::move(_descriptor);
 	}
 
+	frg::vector<AnyDescriptor, KernelAlloc> descriptors() {
+		return std::move(_descriptors);
+	}
+
 public:
 	Error _error{};
 	frg::array<char, 16> _transmitCredentials;
@@ -177,6 +193,7 @@ public:
 	frg::unique_memory<KernelAlloc> _transmitBuffer;
 	LaneHandle _lane;
 	AnyDescriptor _descriptor;
+	frg::vector<AnyDescriptor, KernelAlloc> _descriptors{*kernelAlloc};
 };
 
 using StreamList = frg::intrusive_list<
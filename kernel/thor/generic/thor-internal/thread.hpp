@@ -67,6 +67,7 @@ public:
 				smarter::shared_ptr<WorkQueue, ActiveHandle>{sptr, &ptr->_mainWorkQueue});
 		ptr->_pagingWorkQueue.selfPtr = remove_tag_cast(
 				smarter::shared_ptr<WorkQueue, ActiveHandle>{sptr, &ptr->_pagingWorkQueue});
+		ptr->_assignFutexOwnerId(remove_tag_cast(sptr));
 		return sptr;
 	}
 
@@ -205,6 +206,15 @@ public:
 		return _credentials;
 	}
 
+	// Identifies the thread in the words of priority inheritance futexes.
+	// IDs are reused after the thread terminates.
+	uint32_t futexOwnerId() {
+		return _futexOwnerId;
+	}
+
+	// Returns the thread with the given futexOwnerId() unless it terminated.
+	static smarter::shared_ptr<Thread> findByFutexOwnerId(uint32_t id);
+
 	WorkQueue *mainWorkQueue() {
 		return &_mainWorkQueue;
 	}
@@ -273,6 +283,8 @@ public:
 
 	void handlePreemption(IrqImageAccessor accessor) override;
 
+	bool isMigratableTo(CpuData *cpu) override;
+
 private:
 	void _uninvoke();
 	void _kill();
@@ -283,6 +295,50 @@ public:
 		_affinityMask = std::move(mask);
 	}
 
+	// Slack (in nanoseconds) of timers that this thread submits.
+	uint64_t timerSlack() {
+		return _timerSlack.load(std::memory_order_relaxed);
+	}
+
+	void setTimerSlack(uint64_t slack) {
+		_timerSlack.store(slack, std::memory_order_relaxed);
+	}
+
+	// Statistics, reported by helQueryThreadStats().
+	// These are only updated by the thread itself.
+
+	// Run time (i.e., excluding time spent blocked) in syscalls and page faults.
+	uint64_t kernelTime() {
+		return _kernelTime.load(std::memory_order_relaxed);
+	}
+
+	uint64_t numPageFaults() {
+		return _numPageFaults.load(std::memory_order_relaxed);
+	}
+
+	// Page faults that had to block (e.g., to wait for a managed memory object).
+	uint64_t numMajorPageFaults() {
+		return _numMajorPageFaults.load(std::memory_order_relaxed);
+	}
+
+	uint64_t numIpcSubmissions() {
+		return _numIpcSubmissions.load(std::memory_order_relaxed);
+	}
+
+	void accountKernelTime(uint64_t delta) {
+		_kernelTime.fetch_add(delta, std::memory_order_relaxed);
+	}
+
+	void accountPageFault(bool major) {
+		_numPageFaults.fetch_add(1, std::memory_order_relaxed);
+		if(major)
+			_numMajorPageFaults.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void accountIpcSubmission() {
+		_numIpcSubmissions.fetch_add(1, std::memory_order_relaxed);
+	}
+
 	// TODO: Tidy this up.
 	smarter::borrowed_ptr<Thread> self;
 
@@ -316,7 +372,11 @@ private:
 		kRunTerminated
 	};
 
+	void _assignFutexOwnerId(smarter::weak_ptr<Thread> self);
+	void _releaseFutexOwnerId();
+
 	char _credentials[16];
+	uint32_t _futexOwnerId = 0;
 
 	AssociatedWorkQueue _mainWorkQueue;
 	AssociatedWorkQueue _pagingWorkQueue;
@@ -343,6 +403,13 @@ private:
 	// The thread is killed when this counter reaches zero.
 	std::atomic<int> _runCount;
 
+	std::atomic<uint64_t> _timerSlack{0};
+
+	std::atomic<uint64_t> _kernelTime{0};
+	std::atomic<uint64_t> _numPageFaults{0};
+	std::atomic<uint64_t> _numMajorPageFaults{0};
+	std::atomic<uint64_t> _numIpcSubmissions{0};
+
 	UserContext _userContext;
 	ExecutorContext _executorContext;
 public:
@@ -6,6 +6,7 @@
 #include <async/cancellation.hpp>
 #include <frg/container_of.hpp>
 #include <frg/intrusive.hpp>
+#include <frg/list.hpp>
 #include <frg/pairing_heap.hpp>
 #include <frg/spinlock.hpp>
 #include <thor-internal/cancel.hpp>
@@ -14,6 +15,7 @@
 namespace thor {
 
 struct PrecisionTimerEngine;
+struct TimerWheel;
 
 struct ClockSource {
 	virtual uint64_t currentNanos() = 0;
@@ -57,6 +59,8 @@ private:
 
 enum class TimerState {
 	none,
+	// The timer is in a TimerWheel.
+	wheeled,
 	queued,
 	elapsed,
 	retired
@@ -75,9 +79,10 @@ struct PrecisionTimerNode {
 
 	friend struct CompareTimer;
 	friend struct PrecisionTimerEngine;
+	friend struct TimerWheel;
 
 	PrecisionTimerNode()
-	: _engine{nullptr}, _cancelCb{this} { }
+	: _engine{nullptr}, _wheel{nullptr}, _cancelCb{this} { }
 
 	void setup(uint64_t deadline, Worklet *elapsed) {
 		_deadline = deadline;
@@ -90,33 +95,55 @@ struct PrecisionTimerNode {
 		_elapsed = elapsed;
 	}
 
+	// Allows the timer to fire up to slack nanoseconds after its deadline.
+	// The engine uses this to serve timers with nearby deadlines by the same alarm.
+	void setSlack(uint64_t slack) {
+		_slack = slack;
+	}
+
 	bool wasCancelled() {
 		return _wasCancelled;
 	}
 
 	frg::pairing_heap_hook<PrecisionTimerNode> hook;
+	frg::default_list_hook<PrecisionTimerNode> wheelHook;
 
 private:
+	uint64_t _latest() const {
+		uint64_t latest;
+		if(__builtin_add_overflow(_deadline, _slack, &latest))
+			return UINT64_MAX;
+		return latest;
+	}
+
 	uint64_t _deadline;
+	uint64_t _slack = 0;
 	async::cancellation_token _cancelToken;
 	Worklet *_elapsed;
 
 	// TODO: If we allow timer engines to be destructed, this needs to be refcounted.
 	PrecisionTimerEngine *_engine;
+	// Non-null if the timer was installed by installTimeout().
+	TimerWheel *_wheel;
+	// Position in the wheel; only valid in TimerState::wheeled.
+	uint8_t _wheelLevel = 0;
+	uint8_t _wheelSlot = 0;
 
 	TimerState _state = TimerState::none;
 	bool _wasCancelled = false;
 	async::cancellation_observer<CancelFunctor> _cancelCb;
 };
 
+// Orders timers by the latest time at which they have to fire.
 struct CompareTimer {
 	bool operator() (const PrecisionTimerNode *a, const PrecisionTimerNode *b) const {
-		return a->_deadline > b->_deadline;
+		return a->_latest() > b->_latest();
 	}
 };
 
 struct PrecisionTimerEngine final : private AlarmSink {
 	friend struct PrecisionTimerNode;
+	friend struct TimerWheel;
 
 private:
 	using Mutex = frg::ticket_spinlock;
@@ -126,6 +153,12 @@ public:
 	
 	void installTimer(PrecisionTimerNode *timer);
 
+	// Like installTimer() but intended for timeouts, i.e., timers that are usually
+	// cancelled before they elapse. Such timers are kept in the TimerWheel of the
+	// current CPU and only enter the engine's queue shortly before their deadline.
+	// They still fire at their exact deadline.
+	void installTimeout(PrecisionTimerNode *timer);
+
 	// ----------------------------------------------------------------------------------
 	// Sender boilerplate for sleep()
 	// ----------------------------------------------------------------------------------
@@ -145,12 +178,20 @@ public:
 		PrecisionTimerEngine *self;
 		uint64_t deadline;
 		async::cancellation_token cancellation;
+		bool isTimeout = false;
+		uint64_t slack = 0;
 	};
 
 	SleepSender sleep(uint64_t deadline, async::cancellation_token cancellation = {}) {
 		return {this, deadline, cancellation};
 	}
 
+	// Same as sleep() but uses installTimeout().
+	SleepSender timeout(uint64_t deadline, async::cancellation_token cancellation,
+			uint64_t slack = 0) {
+		return {this, deadline, cancellation, true, slack};
+	}
+
 	SleepSender sleepFor(uint64_t nanos, async::cancellation_token cancellation = {}) {
 		return {this, systemClockSource()->currentNanos() + nanos, cancellation};
 	}
@@ -169,8 +210,12 @@ public:
 				auto op = frg::container_of(base, &SleepOperation::worklet_);
 				async::execution::set_value(op->receiver_);
 			}, WorkQueue::generalQueue());
-			node_.setup(s_.deadline, &worklet_);
-			s_.self->installTimer(&node_);
+			node_.setup(s_.deadline, s_.cancellation, &worklet_);
+			node_.setSlack(s_.slack);
+			if(s_.isTimeout)
+				s_.self->installTimeout(&node_);
+			else
+				s_.self->installTimer(&node_);
 		}
 
 	private:
@@ -192,6 +237,11 @@ private:
 
 	void firedAlarm();
 
+	// Used by TimerWheel. Unlike installTimer(), these do not touch the
+	// cancellation observer. The caller disables IRQs.
+	void _queueTimer(PrecisionTimerNode *timer);
+	bool _dequeueTimer(PrecisionTimerNode *timer);
+
 private:
 	void _progress();
 
@@ -213,8 +263,75 @@ private:
 	size_t _activeTimers;
 };
 
+// Hierarchical timer wheel that holds the timeouts of one CPU (see installTimeout()).
+// Each level has numSlots slots; a slot on level l covers numSlots^l ticks.
+// Timers are cascaded to lower levels as time advances and are moved to the
+// PrecisionTimerEngine once their deadline is at most one tick away.
+struct TimerWheel {
+	friend struct PrecisionTimerNode;
+	friend struct PrecisionTimerEngine;
+
+	static constexpr uint64_t tickNanos = 1'000'000;
+	static constexpr int slotShift = 6;
+	static constexpr int numSlots = 1 << slotShift;
+	static constexpr int numLevels = 4;
+
+	TimerWheel() = default;
+
+	TimerWheel(const TimerWheel &) = delete;
+
+	TimerWheel &operator= (const TimerWheel &) = delete;
+
+private:
+	using Mutex = frg::ticket_spinlock;
+
+	using SlotList = frg::intrusive_list<
+		PrecisionTimerNode,
+		frg::locate_member<
+			PrecisionTimerNode,
+			frg::default_list_hook<PrecisionTimerNode>,
+			&PrecisionTimerNode::wheelHook
+		>
+	>;
+
+	// Called with IRQs disabled.
+	void installTimer(PrecisionTimerEngine *engine, PrecisionTimerNode *timer);
+
+	void cancelTimer(PrecisionTimerNode *timer);
+
+	// The following functions are called with _mutex held.
+	void _insert(PrecisionTimerNode *timer);
+	void _cascade(int level, int slot);
+	void _advance(uint64_t tick);
+	uint64_t _nextTick();
+	void _updateDriver();
+
+	static void _driverElapsed(Worklet *worklet);
+
+	Mutex _mutex;
+
+	PrecisionTimerEngine *_engine = nullptr;
+
+	// All ticks up to (and including) this one have been processed.
+	uint64_t _currentTick = 0;
+
+	// Bit s of _occupied[l] is set iff _slots[l][s] is not empty.
+	uint64_t _occupied[numLevels] = {};
+	SlotList _slots[numLevels][numSlots];
+
+	// Timer in the PrecisionTimerEngine that advances the wheel.
+	PrecisionTimerNode _driver;
+	Worklet _driverWorklet;
+	// True while _driver is queued or its worklet is pending.
+	bool _driverArmed = false;
+};
+
 inline void PrecisionTimerNode::CancelFunctor::operator() () {
-	node_->_engine->cancelTimer(node_);
+	if(node_->_wheel) {
+		node_->_wheel->cancelTimer(node_);
+	}else{
+		node_->_engine->cancelTimer(node_);
+	}
 }
 
 PrecisionTimerEngine *generalTimerEngine();
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <frg/variant.hpp>
+#include <frg/vector.hpp>
 #include <assert.h>
 #include <smarter.hpp>
 #include <thor-internal/mm-rc.hpp>
@@ -13,6 +14,7 @@ typedef int64_t Handle;
 struct MemoryView;
 struct AddressSpace;
 struct IoSpace;
+struct DmaSpace;
 struct Thread;
 struct Universe;
 struct IpcQueue;
@@ -61,6 +63,15 @@ struct AddressSpaceDescriptor {
 	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 };
 
+struct MemoryAccount;
+
+struct MemoryAccountDescriptor {
+	MemoryAccountDescriptor(smarter::shared_ptr<MemoryAccount> account)
+	: account{std::move(account)} { }
+
+	smarter::shared_ptr<MemoryAccount> account;
+};
+
 struct MemoryViewLockDescriptor {
 	MemoryViewLockDescriptor(smarter::shared_ptr<NamedMemoryViewLock> lock)
 	: lock(std::move(lock)) { }
@@ -199,6 +210,13 @@ struct IoDescriptor {
 	smarter::shared_ptr<IoSpace> ioSpace;
 };
 
+struct DmaSpaceDescriptor {
+	DmaSpaceDescriptor(smarter::shared_ptr<DmaSpace> space)
+	: space{std::move(space)} { }
+
+	smarter::shared_ptr<DmaSpace> space;
+};
+
 // --------------------------------------------------------
 // AnyDescriptor
 // --------------------------------------------------------
@@ -226,12 +244,14 @@ typedef frg::variant<
 	VirtualizedSpaceDescriptor,
 	VirtualizedCpuDescriptor,
 	MemoryViewLockDescriptor,
+	MemoryAccountDescriptor,
 	ThreadDescriptor,
 	LaneDescriptor,
 	IrqDescriptor,
 	OneshotEventDescriptor,
 	BitsetEventDescriptor,
 	IoDescriptor,
+	DmaSpaceDescriptor,
 	KernletObjectDescriptor,
 	BoundKernletDescriptor
 > AnyDescriptor;
@@ -240,6 +260,9 @@ typedef frg::variant<
 // Universe.
 // --------------------------------------------------------
 
+// Handles index into a two-level table: the low bits select a slot, the high bits store
+// the generation of the slot at the time the handle was attached. Slots of detached handles
+// are reused but their generation is bumped, such that stale handles do not resolve.
 struct Universe {
 public:
 	typedef frg::ticket_spinlock Lock;
@@ -248,6 +271,10 @@ public:
 	Universe();
 	~Universe();
 
+	Universe(const Universe &) = delete;
+
+	Universe &operator= (const Universe &) = delete;
+
 	Handle attachDescriptor(Guard &guard, AnyDescriptor descriptor);
 
 	AnyDescriptor *getDescriptor(Guard &guard, Handle handle);
@@ -256,15 +283,33 @@ public:
 
 	Lock lock;
 
+	// Account that is charged for memory allocated by this universe (may be null).
+	// Protected by lock.
+	smarter::shared_ptr<MemoryAccount> memoryAccount;
+
 private:
-	frg::hash_map<
-		Handle,
-		AnyDescriptor,
-		frg::hash<Handle>,
-		KernelAlloc
-	> _descriptorMap;
-
-	Handle _nextHandle;
+	static constexpr int indexBits = 32;
+	static constexpr uint32_t generationMask = (uint32_t{1} << 31) - 1;
+	static constexpr size_t slotsPerChunk = 64;
+
+	struct Slot {
+		uint32_t generation = 0;
+		uint32_t nextFree = 0;
+		frg::optional<AnyDescriptor> descriptor;
+	};
+
+	struct Chunk {
+		Slot slots[slotsPerChunk];
+	};
+
+	Slot *_slotOf(Handle handle);
+
+	frg::vector<Chunk *, KernelAlloc> _chunks;
+
+	// Head of the list of free slots (linked through Slot::nextFree); zero if empty.
+	// Index zero is never handed out since handle zero is kHelNullHandle.
+	uint32_t _freeHead = 0;
+	uint32_t _numSlots = 1;
 };
 
 } // namespace thor
@@ -2,8 +2,11 @@
 #include <string.h>
 
 #include <frg/container_of.hpp>
+#include <frg/hash_map.hpp>
+#include <frg/manual_box.hpp>
 
 #include <thor-internal/cpu-data.hpp>
+#include <thor-internal/futex.hpp>
 #include <thor-internal/stream.hpp>
 #include <thor-internal/thread.hpp>
 
@@ -11,6 +14,19 @@ namespace thor {
 
 static std::atomic<uint64_t> globalThreadId;
 
+namespace {
+	// Maps futex owner IDs to threads. Protected by futexOwnerMutex.
+	frg::ticket_spinlock futexOwnerMutex;
+	frg::manual_box<frg::hash_map<
+		uint32_t,
+		smarter::weak_ptr<Thread>,
+		frg::hash<uint32_t>,
+		KernelAlloc
+	>> futexOwners;
+	bool futexOwnersInitialized = false;
+	uint32_t nextFutexOwnerId = 1;
+}
+
 namespace {
 	constexpr bool logTransitions = false;
 	constexpr bool logRunStates = false;
@@ -244,6 +260,13 @@ void Thread::interruptCurrent(Interrupt interrupt, SyscallImageAccessor image) {
 
 void Thread::raiseSignals(SyscallImageAccessor image) {
 	auto this_thread = getCurrentThread();
+
+	// This runs at the end of every syscall; avoid taking the locks if nothing is pending.
+	// Signals that are raised concurrently are seen on the next syscall or preemption.
+	if(!__atomic_load_n(&this_thread->_pendingKill, __ATOMIC_RELAXED)
+			&& __atomic_load_n(&this_thread->_pendingSignal, __ATOMIC_RELAXED) == kSigNone)
+		return;
+
 	StatelessIrqLock irq_lock;
 	auto lock = frg::guard(&this_thread->_mutex);
 
@@ -259,6 +282,7 @@ void Thread::raiseSignals(SyscallImageAccessor image) {
 
 		this_thread->_runState = kRunTerminated;
 		++this_thread->_stateSeq;
+		this_thread->_releaseFutexOwnerId();
 		saveExecutor(&this_thread->_executor, image); // FIXME: Why do we save the state here?
 		getCpuData()->scheduler.update();
 		Scheduler::suspendCurrent();
@@ -352,7 +376,7 @@ void Thread::interruptOther(smarter::borrowed_ptr<Thread> thread) {
 	// TODO: Perform the interrupt immediately if possible.
 
 //	assert(thread->_pendingSignal == kSigNone);
-	thread->_pendingSignal = kSigInterrupt;
+	__atomic_store_n(&thread->_pendingSignal, kSigInterrupt, __ATOMIC_RELAXED);
 }
 
 Error Thread::resumeOther(smarter::borrowed_ptr<Thread> thread) {
@@ -387,6 +411,50 @@ Thread::Thread(smarter::shared_ptr<Universe> universe,
 	memcpy(_credentials + 8, &id, sizeof(uint64_t));
 }
 
+smarter::shared_ptr<Thread> Thread::findByFutexOwnerId(uint32_t id) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&futexOwnerMutex);
+
+	if(!futexOwnersInitialized)
+		return nullptr;
+	auto it = futexOwners->get(id);
+	if(!it)
+		return nullptr;
+	return it->lock();
+}
+
+void Thread::_assignFutexOwnerId(smarter::weak_ptr<Thread> self) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&futexOwnerMutex);
+
+	if(!futexOwnersInitialized) {
+		futexOwners.initialize(frg::hash<uint32_t>{}, *kernelAlloc);
+		futexOwnersInitialized = true;
+	}
+
+	// IDs wrap around; skip IDs that are still in use.
+	uint32_t id;
+	do {
+		id = nextFutexOwnerId;
+		nextFutexOwnerId = (nextFutexOwnerId + 1) & FutexRealm::piOwnerMask;
+		if(!nextFutexOwnerId)
+			nextFutexOwnerId = 1;
+	} while(futexOwners->get(id));
+
+	futexOwners->insert(id, std::move(self));
+	_futexOwnerId = id;
+}
+
+void Thread::_releaseFutexOwnerId() {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&futexOwnerMutex);
+
+	if(!_futexOwnerId)
+		return;
+	futexOwners->remove(_futexOwnerId);
+	_futexOwnerId = 0;
+}
+
 Thread::~Thread() {
 	assert(_runState == kRunTerminated);
 	assert(_observeQueue.empty());
@@ -508,6 +576,17 @@ void Thread::handlePreemption(IrqImageAccessor image) {
 	}
 }
 
+bool Thread::isMigratableTo(CpuData *cpu) {
+	// The affinity mask is only changed by the thread itself (via helSetAffinity()),
+	// hence it cannot change while the scheduler considers migrating the thread.
+	if(_affinityMask.empty())
+		return true;
+	size_t i = cpu->cpuIndex;
+	if(i / 8 >= _affinityMask.size())
+		return false;
+	return _affinityMask[i / 8] & (1 << (i % 8));
+}
+
 void Thread::_uninvoke() {
 	UserContext::deactivate();
 }
@@ -522,6 +601,7 @@ void Thread::_kill() {
 	if(_runState == kRunSuspended || _runState == kRunInterrupted) {
 		_runState = kRunTerminated;
 		++_stateSeq;
+		_releaseFutexOwnerId();
 		Scheduler::unassociate(this);
 
 		ObserveQueue queue;
@@ -536,7 +616,7 @@ void Thread::_kill() {
 		}
 	}else{
 		// TODO: Wake up blocked threads.
-		_pendingKill = true;
+		__atomic_store_n(&_pendingKill, true, __ATOMIC_RELAXED);
 	}
 }
 
@@ -45,6 +45,11 @@ void PrecisionTimerEngine::installTimer(PrecisionTimerNode *timer) {
 	_progress();
 }
 
+void PrecisionTimerEngine::installTimeout(PrecisionTimerNode *timer) {
+	auto irq_lock = frg::guard(&irqMutex());
+	getCpuData()->timerWheel.installTimer(this, timer);
+}
+
 void PrecisionTimerEngine::cancelTimer(PrecisionTimerNode *timer) {
 	auto irq_lock = frg::guard(&irqMutex());
 	auto lock = frg::guard(&_mutex);
@@ -61,6 +66,27 @@ void PrecisionTimerEngine::cancelTimer(PrecisionTimerNode *timer) {
 	WorkQueue::post(timer->_elapsed);
 }
 
+void PrecisionTimerEngine::_queueTimer(PrecisionTimerNode *timer) {
+	auto lock = frg::guard(&_mutex);
+
+	_timerQueue.push(timer);
+	_activeTimers++;
+	timer->_state = TimerState::queued;
+
+	_progress();
+}
+
+bool PrecisionTimerEngine::_dequeueTimer(PrecisionTimerNode *timer) {
+	auto lock = frg::guard(&_mutex);
+
+	if(timer->_state != TimerState::queued)
+		return false;
+	_timerQueue.remove(timer);
+	_activeTimers--;
+	timer->_state = TimerState::none;
+	return true;
+}
+
 void PrecisionTimerEngine::firedAlarm() {
 	auto irq_lock = frg::guard(&irqMutex());
 	auto lock = frg::guard(&_mutex);
@@ -73,7 +99,9 @@ void PrecisionTimerEngine::firedAlarm() {
 void PrecisionTimerEngine::_progress() {
 	auto current = _clock->currentNanos();
 	do {
-		// Process all timers that elapsed in the past.
+		// Process all timers that elapsed in the past. The queue is ordered by
+		// deadline plus slack, so this also picks up timers whose slack allows
+		// them to fire together with the one that triggered the alarm.
 		if(logProgress)
 			infoLogger() << "thor: Processing timers until " << current << frg::endlog;
 		while(true) {
@@ -102,9 +130,171 @@ void PrecisionTimerEngine::_progress() {
 
 		// Setup the comparator and iterate if there was a race.
 		assert(!_timerQueue.empty());
-		_alarm->arm(_timerQueue.top()->_deadline);
+		_alarm->arm(_timerQueue.top()->_latest());
 		current = _clock->currentNanos();
-	} while(_timerQueue.top()->_deadline <= current);
+	} while(_timerQueue.top()->_latest() <= current);
+}
+
+// --------------------------------------------------------
+// TimerWheel
+// --------------------------------------------------------
+
+void TimerWheel::installTimer(PrecisionTimerEngine *engine, PrecisionTimerNode *timer) {
+	assert(!timer->_engine);
+	timer->_engine = engine;
+	timer->_wheel = this;
+
+	auto lock = frg::guard(&_mutex);
+	assert(!_engine || _engine == engine);
+	_engine = engine;
+	assert(timer->_state == TimerState::none);
+
+	if(!timer->_cancelCb.try_set(timer->_cancelToken)) {
+		timer->_wasCancelled = true;
+		timer->_state = TimerState::retired;
+		WorkQueue::post(timer->_elapsed);
+		return;
+	}
+
+	// Bring _currentTick up to date such that _insert() picks the right level.
+	_advance(systemClockSource()->currentNanos() / tickNanos + 1);
+	_insert(timer);
+	_updateDriver();
+}
+
+void TimerWheel::cancelTimer(PrecisionTimerNode *timer) {
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		if(timer->_state == TimerState::wheeled) {
+			auto &list = _slots[timer->_wheelLevel][timer->_wheelSlot];
+			list.erase(list.iterator_to(timer));
+			if(list.empty())
+				_occupied[timer->_wheelLevel] &= ~(uint64_t{1} << timer->_wheelSlot);
+
+			timer->_wasCancelled = true;
+			timer->_state = TimerState::retired;
+			WorkQueue::post(timer->_elapsed);
+			return;
+		}
+	}
+
+	// The timer was already moved to the engine.
+	timer->_engine->cancelTimer(timer);
+}
+
+void TimerWheel::_insert(PrecisionTimerNode *timer) {
+	auto tick = timer->_deadline / tickNanos;
+	if(tick <= _currentTick + 1) {
+		if(logTimers)
+			infoLogger() << "thor: Moving timer at " << timer->_deadline
+					<< " from wheel to engine" << frg::endlog;
+		_engine->_queueTimer(timer);
+		return;
+	}
+
+	// Timers beyond the range of the top level are cascaded from its last slot.
+	constexpr uint64_t range = uint64_t{1} << (slotShift * numLevels);
+	auto delta = tick - _currentTick;
+	if(delta >= range)
+		tick = _currentTick + range - 1;
+
+	int level = 0;
+	while(level < numLevels - 1 && delta >= (uint64_t{1} << (slotShift * (level + 1))))
+		level++;
+	int slot = (tick >> (slotShift * level)) & (numSlots - 1);
+
+	timer->_wheelLevel = level;
+	timer->_wheelSlot = slot;
+	timer->_state = TimerState::wheeled;
+	_slots[level][slot].push_back(timer);
+	_occupied[level] |= uint64_t{1} << slot;
+}
+
+void TimerWheel::_cascade(int level, int slot) {
+	if(!(_occupied[level] & (uint64_t{1} << slot)))
+		return;
+
+	// _insert() never puts a timer back into the slot that is being cascaded.
+	auto &list = _slots[level][slot];
+	while(!list.empty())
+		_insert(list.pop_front());
+	_occupied[level] &= ~(uint64_t{1} << slot);
+}
+
+void TimerWheel::_advance(uint64_t tick) {
+	while(true) {
+		auto next = _nextTick();
+		if(!next || next > tick)
+			break;
+
+		// Cascade all slots whose period starts at this tick.
+		_currentTick = next;
+		for(int l = numLevels - 1; l >= 0; l--) {
+			if(next & ((uint64_t{1} << (slotShift * l)) - 1))
+				continue;
+			_cascade(l, (next >> (slotShift * l)) & (numSlots - 1));
+		}
+	}
+
+	if(tick > _currentTick)
+		_currentTick = tick;
+}
+
+// Returns the next tick at which a slot needs to be cascaded, or zero if the wheel is empty.
+uint64_t TimerWheel::_nextTick() {
+	uint64_t next = 0;
+	for(int l = 0; l < numLevels; l++) {
+		if(!_occupied[l])
+			continue;
+
+		// Find the first occupied slot after the current one, wrapping around.
+		auto base = (_currentTick >> (slotShift * l)) + 1;
+		auto shift = base & (numSlots - 1);
+		auto rotated = shift
+				? (_occupied[l] >> shift) | (_occupied[l] << (numSlots - shift))
+				: _occupied[l];
+		auto candidate = (base + __builtin_ctzll(rotated)) << (slotShift * l);
+		if(!next || candidate < next)
+			next = candidate;
+	}
+	return next;
+}
+
+void TimerWheel::_updateDriver() {
+	auto next = _nextTick();
+	if(!next)
+		return;
+
+	// Fire one tick early; _driverElapsed() processes ticks up to now + 1.
+	// This gives the driver's worklet one tick to move timers to the engine.
+	auto deadline = (next - 1) * tickNanos;
+	if(_driverArmed) {
+		if(_driver._deadline <= deadline)
+			return;
+		// If this fails, the driver's worklet is pending and calls us again.
+		if(!_engine->_dequeueTimer(&_driver))
+			return;
+	}
+
+	_driver._engine = _engine;
+	_driver._state = TimerState::none;
+	_driver.setup(deadline, &_driverWorklet);
+	_driverWorklet.setup(&TimerWheel::_driverElapsed, WorkQueue::generalQueue());
+	_driverArmed = true;
+	_engine->_queueTimer(&_driver);
+}
+
+void TimerWheel::_driverElapsed(Worklet *worklet) {
+	auto self = frg::container_of(worklet, &TimerWheel::_driverWorklet);
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&self->_mutex);
+
+	self->_driverArmed = false;
+	self->_advance(systemClockSource()->currentNanos() / tickNanos + 1);
+	self->_updateDriver();
 }
 
 ClockSource *systemClockSource() {
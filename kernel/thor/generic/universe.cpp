@@ -1,3 +1,4 @@
+#include <thor-internal/memory-account.hpp>
 #include <thor-internal/universe.hpp>
 
 namespace thor {
@@ -7,31 +8,70 @@ namespace {
 }
 
 Universe::Universe()
-: _descriptorMap{frg::hash<Handle>{}, *kernelAlloc}, _nextHandle{1} { }
+: _chunks{*kernelAlloc} { }
 
 Universe::~Universe() {
 	if(logCleanup)
 		infoLogger() << "\e[31mthor: Universe is deallocated\e[39m" << frg::endlog;
+
+	for(auto chunk : _chunks)
+		frg::destruct(*kernelAlloc, chunk);
 }
 
 Handle Universe::attachDescriptor(Guard &guard, AnyDescriptor descriptor) {
 	assert(guard.protects(&lock));
 
-	Handle handle = _nextHandle++;
-	_descriptorMap.insert(handle, std::move(descriptor));
-	return handle;
+	uint32_t index;
+	if(_freeHead) {
+		index = _freeHead;
+		_freeHead = _chunks[index / slotsPerChunk]->slots[index % slotsPerChunk].nextFree;
+	}else{
+		index = _numSlots++;
+		if(index / slotsPerChunk == _chunks.size())
+			_chunks.push(frg::construct<Chunk>(*kernelAlloc));
+	}
+
+	auto slot = &_chunks[index / slotsPerChunk]->slots[index % slotsPerChunk];
+	assert(!slot->descriptor);
+	slot->descriptor.emplace(std::move(descriptor));
+	return (static_cast<Handle>(slot->generation) << indexBits) | index;
+}
+
+auto Universe::_slotOf(Handle handle) -> Slot * {
+	if(handle <= 0)
+		return nullptr;
+	auto index = static_cast<uint32_t>(handle);
+	auto generation = static_cast<uint64_t>(handle) >> indexBits;
+	if(index >= _numSlots)
+		return nullptr;
+	auto slot = &_chunks[index / slotsPerChunk]->slots[index % slotsPerChunk];
+	if(!slot->descriptor || slot->generation != generation)
+		return nullptr;
+	return slot;
 }
 
 AnyDescriptor *Universe::getDescriptor(Guard &guard, Handle handle) {
 	assert(guard.protects(&lock));
 
-	return _descriptorMap.get(handle);
+	auto slot = _slotOf(handle);
+	if(!slot)
+		return nullptr;
+	return &(*slot->descriptor);
 }
 
 frg::optional<AnyDescriptor> Universe::detachDescriptor(Guard &guard, Handle handle) {
 	assert(guard.protects(&lock));
 
-	return _descriptorMap.remove(handle);
+	auto slot = _slotOf(handle);
+	if(!slot)
+		return frg::null_opt;
+
+	frg::optional<AnyDescriptor> descriptor{std::move(*slot->descriptor)};
+	slot->descriptor = frg::null_opt;
+	slot->generation = (slot->generation + 1) & generationMask;
+	slot->nextFree = _freeHead;
+	_freeHead = static_cast<uint32_t>(handle);
+	return descriptor;
 }
 
 } // namespace thor
@@ -20,12 +20,7 @@ void WorkQueue::post(Worklet *worklet) {
 		wq->_localQueue.push_back(worklet);
 		wq->_localPosted.store(true, std::memory_order_relaxed);
 	}else{
-		auto irqLock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&wq->_mutex);
-
-		invokeWakeup = wq->_lockedQueue.empty();
-		wq->_lockedQueue.push_back(worklet);
-		wq->_lockedPosted.store(true, std::memory_order_relaxed);
+		invokeWakeup = wq->_pushRemote(worklet);
 	}
 
 	if(invokeWakeup)
@@ -51,12 +46,7 @@ bool WorkQueue::enter(Worklet *worklet) {
 		wq->_localPosted.store(true, std::memory_order_relaxed);
 	}else{
 		// Same logic as in post().
-		auto irqLock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&wq->_mutex);
-
-		invokeWakeup = wq->_lockedQueue.empty();
-		wq->_lockedQueue.push_back(worklet);
-		wq->_lockedPosted.store(true, std::memory_order_relaxed);
+		invokeWakeup = wq->_pushRemote(worklet);
 	}
 
 	if(invokeWakeup)
@@ -64,11 +54,21 @@ bool WorkQueue::enter(Worklet *worklet) {
 	return false;
 }
 
+// Returns true if the stack was empty, i.e., if wakeup() needs to be called.
+bool WorkQueue::_pushRemote(Worklet *worklet) {
+	auto head = _remoteHead.load(std::memory_order_relaxed);
+	do {
+		worklet->_remoteNext = head;
+	} while(!_remoteHead.compare_exchange_weak(head, worklet,
+			std::memory_order_release, std::memory_order_relaxed));
+	return !head;
+}
+
 bool WorkQueue::check() {
 	// _localPosted is only accessed from the thread/fiber that runs the WQ.
-	// For _lockedPosted, see the comment in the header file.
+	// For _remoteHead, see the comment in the header file.
 	return _localPosted.load(std::memory_order_relaxed)
-			|| _lockedPosted.load(std::memory_order_relaxed);
+			|| _remoteHead.load(std::memory_order_relaxed);
 }
 
 void WorkQueue::run() {
@@ -91,12 +91,24 @@ void WorkQueue::run() {
 
 		pending.splice(pending.end(), _localQueue);
 		_localPosted.store(false, std::memory_order_relaxed);
+	}
 
-		if(_lockedPosted.load(std::memory_order_relaxed)) {
-			auto lock = frg::guard(&_mutex);
-
-			pending.splice(pending.end(), _lockedQueue);
-			_lockedPosted.store(false, std::memory_order_relaxed);
+	// Synchronizes with the release CAS in _pushRemote().
+	if(_remoteHead.load(std::memory_order_relaxed)) {
+		auto head = _remoteHead.exchange(nullptr, std::memory_order_acquire);
+
+		// Reverse the stack such that worklets run in the order in which they were posted.
+		Worklet *reversed = nullptr;
+		while(head) {
+			auto next = head->_remoteNext;
+			head->_remoteNext = reversed;
+			reversed = head;
+			head = next;
+		}
+		while(reversed) {
+			auto next = reversed->_remoteNext;
+			pending.push_back(reversed);
+			reversed = next;
 		}
 	}
 
@@ -0,0 +1,536 @@
+#include <string.h>
+
+#include <arch/mem_space.hpp>
+#include <arch/register.hpp>
+#include <thor-internal/arch/cpu.hpp>
+#include <thor-internal/arch/paging.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/dma-space.hpp>
+#include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/physical.hpp>
+#include <thor-internal/acpi/acpi.hpp>
+#include <thor-internal/pci/pci.hpp>
+
+#include <lai/core.h>
+
+// Intel VT-d DMA remapping. Devices stay in pass-through mode until a driver
+// requests a DMA space; only then do their requests go through page tables.
+
+namespace thor {
+namespace acpi {
+
+struct [[gnu::packed]] DmarHeader {
+	uint8_t hostAddressWidth;
+	uint8_t flags;
+	uint8_t reserved[10];
+};
+
+struct [[gnu::packed]] DmarGenericEntry {
+	uint16_t type;
+	uint16_t length;
+};
+
+// DMA remapping hardware unit definition.
+struct [[gnu::packed]] DmarDrhdEntry {
+	DmarGenericEntry generic;
+	uint8_t flags;
+	uint8_t reserved;
+	uint16_t segment;
+	uint64_t registerBase;
+};
+
+struct [[gnu::packed]] DmarDeviceScope {
+	uint8_t type;
+	uint8_t length;
+	uint16_t reserved;
+	uint8_t enumerationId;
+	uint8_t startBus;
+	// Followed by (device, function) pairs.
+	uint8_t path[];
+};
+
+namespace drhd_flags {
+	static constexpr uint8_t includePciAll = 1;
+};
+
+namespace {
+
+inline constexpr arch::scalar_register<uint64_t> capabilityReg(0x08);
+inline constexpr arch::scalar_register<uint64_t> extendedCapabilityReg(0x10);
+inline constexpr arch::scalar_register<uint32_t> globalCommandReg(0x18);
+inline constexpr arch::scalar_register<uint32_t> globalStatusReg(0x1C);
+inline constexpr arch::scalar_register<uint64_t> rootTableReg(0x20);
+inline constexpr arch::scalar_register<uint64_t> contextCommandReg(0x28);
+
+namespace cap {
+	constexpr uint64_t requiresWriteBufferFlush = uint64_t{1} << 4;
+	constexpr int sagawShift = 8;
+	constexpr uint64_t numDomainsMask = 7;
+}
+
+namespace ecap {
+	constexpr uint64_t coherent = 1;
+	constexpr uint64_t passThrough = uint64_t{1} << 6;
+	constexpr int iotlbOffsetShift = 8;
+	constexpr uint64_t iotlbOffsetMask = 0x3FF;
+}
+
+// Bits of the global command and global status registers.
+namespace global {
+	constexpr uint32_t translationEnable = uint32_t{1} << 31;
+	constexpr uint32_t setRootTable = uint32_t{1} << 30;
+	constexpr uint32_t writeBufferFlush = uint32_t{1} << 27;
+	// Status bits that must be preserved when writing the command register.
+	constexpr uint32_t persistentMask = 0x96FF'FFFF;
+}
+
+namespace invalidate {
+	constexpr uint64_t contextCacheGlobal = (uint64_t{1} << 63) | (uint64_t{1} << 61);
+	constexpr uint64_t iotlbGlobal = (uint64_t{1} << 63) | (uint64_t{1} << 60);
+	constexpr uint64_t iotlbDomain = (uint64_t{1} << 63) | (uint64_t{2} << 60);
+	constexpr uint64_t busy = uint64_t{1} << 63;
+}
+
+namespace entry {
+	constexpr uint64_t present = 1;
+	constexpr uint64_t read = 1;
+	constexpr uint64_t write = 2;
+	constexpr uint64_t translatePassThrough = 2 << 2;
+	constexpr uint64_t addressMask = 0x000F'FFFF'FFFF'F000;
+}
+
+// Domain ID of all devices that are in pass-through mode.
+constexpr uint16_t passThroughDomain = 1;
+
+PhysicalAddr allocateTable() {
+	auto physical = physicalAllocator->allocate(kPageSize);
+	assert(physical != PhysicalAddr(-1) && "OOM while allocating VT-d tables");
+	PageAccessor accessor{physical};
+	memset(accessor.get(), 0, kPageSize);
+	return physical;
+}
+
+volatile uint64_t *tableEntries(PhysicalAddr table) {
+	PageAccessor accessor{table};
+	return reinterpret_cast<volatile uint64_t *>(accessor.get());
+}
+
+struct VtdUnit;
+
+struct VtdDomain final : IommuDomain {
+	VtdDomain(VtdUnit *unit, uint16_t domainId, uint16_t requesterId);
+
+	~VtdDomain() override;
+
+	uint16_t domainId() {
+		return _domainId;
+	}
+
+	PhysicalAddr rootTable() {
+		return _root;
+	}
+
+	uint64_t addressLimit() override;
+
+	void mapPage(uint64_t iova, PhysicalAddr physical, bool writable) override;
+	void unmapPage(uint64_t iova) override;
+	void flush() override;
+
+private:
+	// Returns the last-level entry of iova (or nullptr if allocate is false
+	// and no last-level table exists).
+	volatile uint64_t *_walk(uint64_t iova, bool allocate);
+
+	void _freeTables(PhysicalAddr table, int level);
+
+	VtdUnit *_unit;
+	uint16_t _domainId;
+	uint16_t _requesterId;
+	PhysicalAddr _root;
+
+	frg::ticket_spinlock _mutex;
+};
+
+struct VtdUnit final : Iommu {
+	VtdUnit(PhysicalAddr base, uint16_t segment, bool includeAll);
+
+	void addEndpoint(uint16_t requesterId);
+
+	bool usable() {
+		return _levels;
+	}
+
+	int levels() {
+		return _levels;
+	}
+
+	smarter::shared_ptr<IommuDomain> createDomain(uint16_t segment,
+			uint16_t requesterId) override;
+
+	// Called by VtdDomain.
+	void flushCache(const volatile void *pointer);
+	void invalidateDomain(uint16_t domainId);
+	void attachDomain(VtdDomain *domain, uint16_t requesterId);
+	void detachDomain(uint16_t requesterId);
+
+private:
+	bool _covers(uint16_t requesterId);
+
+	void _enableTranslation();
+	PhysicalAddr _contextTable(uint8_t bus);
+	void _setContext(uint16_t requesterId, uint64_t low, uint64_t high);
+
+	void _writeCommand(uint32_t bit);
+	void _flushWriteBuffer();
+	void _invalidateContextCache();
+	void _invalidateIotlb(uint64_t command);
+
+	arch::mem_space _space;
+	uint64_t _capability;
+	uint64_t _extendedCapability;
+	uint16_t _segment;
+	bool _includeAll;
+	bool _coherent;
+	// Number of page table levels; zero if the unit cannot be used.
+	int _levels = 0;
+	// Value of the AW field of context entries.
+	uint64_t _addressWidth = 0;
+	unsigned int _numDomains;
+	uintptr_t _iotlbOffset;
+
+	frg::vector<uint16_t, KernelAlloc> _endpoints{*kernelAlloc};
+
+	frg::ticket_spinlock _mutex;
+	bool _translating = false;
+	unsigned int _nextDomainId = passThroughDomain + 1;
+	PhysicalAddr _rootTable = PhysicalAddr(-1);
+};
+
+VtdDomain::VtdDomain(VtdUnit *unit, uint16_t domainId, uint16_t requesterId)
+: _unit{unit}, _domainId{domainId}, _requesterId{requesterId} {
+	_root = allocateTable();
+	_unit->flushCache(tableEntries(_root));
+}
+
+VtdDomain::~VtdDomain() {
+	_unit->detachDomain(_requesterId);
+	_freeTables(_root, _unit->levels() - 1);
+}
+
+uint64_t VtdDomain::addressLimit() {
+	return uint64_t{1} << (12 + 9 * _unit->levels());
+}
+
+void VtdDomain::mapPage(uint64_t iova, PhysicalAddr physical, bool writable) {
+	assert(!(iova & (kPageSize - 1)));
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	auto pte = _walk(iova, true);
+	*pte = physical | entry::read | (writable ? entry::write : 0);
+	_unit->flushCache(pte);
+}
+
+void VtdDomain::unmapPage(uint64_t iova) {
+	assert(!(iova & (kPageSize - 1)));
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	auto pte = _walk(iova, false);
+	if(!pte)
+		return;
+	*pte = 0;
+	_unit->flushCache(pte);
+}
+
+void VtdDomain::flush() {
+	// Also required after mapping pages if the unit caches non-present entries.
+	_unit->invalidateDomain(_domainId);
+}
+
+volatile uint64_t *VtdDomain::_walk(uint64_t iova, bool allocate) {
+	auto table = _root;
+	for(int level = _unit->levels() - 1; level > 0; level--) {
+		auto entries = tableEntries(table);
+		auto pde = &entries[(iova >> (12 + 9 * level)) & 0x1FF];
+		if(!(*pde & (entry::read | entry::write))) {
+			if(!allocate)
+				return nullptr;
+			auto next = allocateTable();
+			_unit->flushCache(tableEntries(next));
+			*pde = next | entry::read | entry::write;
+			_unit->flushCache(pde);
+		}
+		table = *pde & entry::addressMask;
+	}
+	return &tableEntries(table)[(iova >> 12) & 0x1FF];
+}
+
+void VtdDomain::_freeTables(PhysicalAddr table, int level) {
+	if(level) {
+		auto entries = tableEntries(table);
+		for(int i = 0; i < 512; i++) {
+			if(entries[i] & (entry::read | entry::write))
+				_freeTables(entries[i] & entry::addressMask, level - 1);
+		}
+	}
+	physicalAllocator->free(table, kPageSize);
+}
+
+VtdUnit::VtdUnit(PhysicalAddr base, uint16_t segment, bool includeAll)
+: _segment{segment}, _includeAll{includeAll} {
+	auto pointer = KernelVirtualMemory::global().allocate(kPageSize);
+	KernelPageSpace::global().mapSingle4k(VirtualAddr(pointer), base,
+			page_access::write, CachingMode::null);
+	_space = arch::mem_space(pointer);
+
+	_capability = _space.load(capabilityReg);
+	_extendedCapability = _space.load(extendedCapabilityReg);
+	_coherent = _extendedCapability & ecap::coherent;
+	_numDomains = 1 << (4 + 2 * (_capability & cap::numDomainsMask));
+	_iotlbOffset = ((_extendedCapability >> ecap::iotlbOffsetShift) & ecap::iotlbOffsetMask) * 16;
+
+	// The IOTLB registers are not necessarily on the first page of the register set.
+	if(_iotlbOffset + 16 > kPageSize) {
+		auto size = (_iotlbOffset + 16 + kPageSize - 1) & ~(kPageSize - 1);
+		pointer = KernelVirtualMemory::global().allocate(size);
+		for(size_t progress = 0; progress < size; progress += kPageSize)
+			KernelPageSpace::global().mapSingle4k(VirtualAddr(pointer) + progress,
+					base + progress, page_access::write, CachingMode::null);
+		_space = arch::mem_space(pointer);
+	}
+
+	auto sagaw = (_capability >> cap::sagawShift) & 0x1F;
+	if(sagaw & 4) {
+		_levels = 4;
+		_addressWidth = 2;
+	}else if(sagaw & 2) {
+		_levels = 3;
+		_addressWidth = 1;
+	}
+
+	if(!(_extendedCapability & ecap::passThrough)) {
+		// Enabling translation would stop DMA of all devices that do not use a DMA space.
+		infoLogger() << "thor: VT-d unit at 0x" << frg::hex_fmt(base)
+				<< " does not support pass-through, ignoring it" << frg::endlog;
+		_levels = 0;
+	}else if(!_levels) {
+		infoLogger() << "thor: VT-d unit at 0x" << frg::hex_fmt(base)
+				<< " supports no usable address width, ignoring it" << frg::endlog;
+	}
+}
+
+void VtdUnit::addEndpoint(uint16_t requesterId) {
+	_endpoints.push_back(requesterId);
+}
+
+bool VtdUnit::_covers(uint16_t requesterId) {
+	if(_includeAll)
+		return true;
+	for(auto endpoint : _endpoints)
+		if(endpoint == requesterId)
+			return true;
+	return false;
+}
+
+smarter::shared_ptr<IommuDomain> VtdUnit::createDomain(uint16_t segment,
+		uint16_t requesterId) {
+	if(segment != _segment || !_covers(requesterId))
+		return nullptr;
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	if(_nextDomainId == _numDomains) {
+		infoLogger() << "thor: VT-d unit ran out of domain IDs" << frg::endlog;
+		return nullptr;
+	}
+
+	if(!_translating)
+		_enableTranslation();
+
+	auto domain = smarter::allocate_shared<VtdDomain>(*kernelAlloc,
+			this, _nextDomainId++, requesterId);
+	attachDomain(domain.get(), requesterId);
+	return domain;
+}
+
+void VtdUnit::flushCache(const volatile void *pointer) {
+	if(_coherent)
+		return;
+	asm volatile ("clflush (%0)" : : "r"(pointer) : "memory");
+}
+
+void VtdUnit::invalidateDomain(uint16_t domainId) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	_flushWriteBuffer();
+	_invalidateIotlb(invalidate::iotlbDomain | (uint64_t{domainId} << 32));
+}
+
+// Expects _mutex to be held.
+void VtdUnit::attachDomain(VtdDomain *domain, uint16_t requesterId) {
+	_setContext(requesterId, domain->rootTable() | entry::present,
+			_addressWidth | (uint64_t{domain->domainId()} << 8));
+}
+
+void VtdUnit::detachDomain(uint16_t requesterId) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	_setContext(requesterId, entry::translatePassThrough | entry::present,
+			_addressWidth | (uint64_t{passThroughDomain} << 8));
+}
+
+// Puts all enumerated devices of this unit into pass-through mode, then turns on translation.
+void VtdUnit::_enableTranslation() {
+	_rootTable = allocateTable();
+	flushCache(tableEntries(_rootTable));
+
+	for(auto &device : *pci::allDevices) {
+		if(device->seg != _segment)
+			continue;
+		uint16_t requesterId = (device->bus << 8) | (device->slot << 3) | device->function;
+		if(!_covers(requesterId))
+			continue;
+		// Fill the whole bus; this also covers functions that were not enumerated.
+		auto bus = static_cast<uint8_t>(device->bus);
+		auto rootEntries = tableEntries(_rootTable);
+		if(rootEntries[bus * 2] & entry::present)
+			continue;
+		auto context = _contextTable(bus);
+		auto entries = tableEntries(context);
+		for(int devfn = 0; devfn < 256; devfn++) {
+			entries[devfn * 2 + 1] = _addressWidth | (uint64_t{passThroughDomain} << 8);
+			entries[devfn * 2] = entry::translatePassThrough | entry::present;
+		}
+		for(size_t offset = 0; offset < kPageSize; offset += 64)
+			flushCache(reinterpret_cast<volatile char *>(entries) + offset);
+	}
+
+	_space.store(rootTableReg, _rootTable);
+	_writeCommand(global::setRootTable);
+	_invalidateContextCache();
+	_invalidateIotlb(invalidate::iotlbGlobal);
+	_writeCommand(global::translationEnable);
+	_translating = true;
+
+	infoLogger() << "thor: Enabled VT-d translation on segment " << _segment
+			<< " (" << _levels << "-level page tables)" << frg::endlog;
+}
+
+PhysicalAddr VtdUnit::_contextTable(uint8_t bus) {
+	auto rootEntries = tableEntries(_rootTable);
+	auto rootEntry = &rootEntries[bus * 2];
+	if(!(*rootEntry & entry::present)) {
+		auto context = allocateTable();
+		flushCache(tableEntries(context));
+		*rootEntry = context | entry::present;
+		flushCache(rootEntry);
+	}
+	return *rootEntry & entry::addressMask;
+}
+
+void VtdUnit::_setContext(uint16_t requesterId, uint64_t low, uint64_t high) {
+	auto entries = tableEntries(_contextTable(requesterId >> 8));
+	auto contextEntry = &entries[(requesterId & 0xFF) * 2];
+
+	// Entries must not be modified while they are present.
+	contextEntry[0] = 0;
+	flushCache(contextEntry);
+	_flushWriteBuffer();
+	_invalidateContextCache();
+
+	contextEntry[1] = high;
+	contextEntry[0] = low;
+	flushCache(contextEntry);
+	_flushWriteBuffer();
+	_invalidateContextCache();
+	_invalidateIotlb(invalidate::iotlbGlobal);
+}
+
+void VtdUnit::_writeCommand(uint32_t bit) {
+	auto status = _space.load(globalStatusReg) & global::persistentMask;
+	_space.store(globalCommandReg, status | bit);
+	// Both commands are acknowledged by setting the respective status bit.
+	while(!(_space.load(globalStatusReg) & bit))
+		pause();
+}
+
+void VtdUnit::_flushWriteBuffer() {
+	if(!(_capability & cap::requiresWriteBufferFlush))
+		return;
+	auto status = _space.load(globalStatusReg) & global::persistentMask;
+	_space.store(globalCommandReg, status | global::writeBufferFlush);
+	while(_space.load(globalStatusReg) & global::writeBufferFlush)
+		pause();
+}
+
+void VtdUnit::_invalidateContextCache() {
+	_space.store(contextCommandReg, invalidate::contextCacheGlobal);
+	while(_space.load(contextCommandReg) & invalidate::busy)
+		pause();
+}
+
+void VtdUnit::_invalidateIotlb(uint64_t command) {
+	arch::scalar_register<uint64_t> iotlbReg(_iotlbOffset + 8);
+	_space.store(iotlbReg, command);
+	while(_space.load(iotlbReg) & invalidate::busy)
+		pause();
+}
+
+frg::manual_box<frg::vector<VtdUnit *, KernelAlloc>> units;
+
+} // anonymous namespace
+
+static initgraph::Task parseDmarTask{&globalInitEngine, "acpi.parse-dmar",
+	initgraph::Requires{getTablesDiscoveredStage()},
+	initgraph::Entails{getTaskingAvailableStage()},
+	[] {
+		void *dmarWindow = laihost_scan("DMAR", 0);
+		if(!dmarWindow) {
+			infoLogger() << "thor: No DMAR, DMA is not remapped" << frg::endlog;
+			return;
+		}
+		auto dmar = reinterpret_cast<acpi_header_t *>(dmarWindow);
+
+		units.initialize(*kernelAlloc);
+
+		size_t offset = sizeof(acpi_header_t) + sizeof(DmarHeader);
+		while(offset < dmar->length) {
+			auto generic = (DmarGenericEntry *)((uint8_t *)dmar + offset);
+			if(generic->type == 0) { // DMA remapping hardware unit
+				auto drhd = (DmarDrhdEntry *)generic;
+				auto unit = frg::construct<VtdUnit>(*kernelAlloc, drhd->registerBase,
+						drhd->segment, drhd->flags & drhd_flags::includePciAll);
+
+				size_t scopeOffset = sizeof(DmarDrhdEntry);
+				while(scopeOffset < generic->length) {
+					auto scope = (DmarDeviceScope *)((uint8_t *)generic + scopeOffset);
+					size_t pathLength = (scope->length - sizeof(DmarDeviceScope)) / 2;
+					if(scope->type == 1 && pathLength == 1) { // PCI endpoint
+						unit->addEndpoint((scope->startBus << 8)
+								| (scope->path[0] << 3) | scope->path[1]);
+					}else if(scope->type == 1 || scope->type == 2) {
+						infoLogger() << "thor: Ignoring DMAR scope behind PCI bridges"
+								<< frg::endlog;
+					}
+					scopeOffset += scope->length;
+				}
+
+				if(unit->usable()) {
+					units->push_back(unit);
+					registerIommu(unit);
+				}
+			}
+			offset += generic->length;
+		}
+
+		infoLogger() << "thor: DMAR describes " << units->size()
+				<< " usable VT-d unit(s)" << frg::endlog;
+	}
+};
+
+} } // namespace thor::acpi
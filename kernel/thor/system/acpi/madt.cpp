@@ -147,18 +147,25 @@ void bootOtherProcessors() {
 
 	infoLogger() << "thor: Booting APs." << frg::endlog;
 
-	size_t offset = sizeof(acpi_header_t) + sizeof(MadtHeader);
-	while(offset < madt->length) {
-		auto generic = (MadtGenericEntry *)((uint8_t *)madt + offset);
-		if(generic->type == 0) { // local APIC
-			auto entry = (MadtLocalEntry *)generic;
-			// TODO: Support BSPs with APIC ID != 0.
-			if((entry->flags & local_flags::enabled)
-					&& entry->localApicId) // We ignore the BSP here.
-				bootSecondary(entry->localApicId);
+	auto forEachAp = [&] (auto fn) {
+		size_t offset = sizeof(acpi_header_t) + sizeof(MadtHeader);
+		while(offset < madt->length) {
+			auto generic = (MadtGenericEntry *)((uint8_t *)madt + offset);
+			if(generic->type == 0) { // local APIC
+				auto entry = (MadtLocalEntry *)generic;
+				// TODO: Support BSPs with APIC ID != 0.
+				if((entry->flags & local_flags::enabled)
+						&& entry->localApicId) // We ignore the BSP here.
+					fn(entry->localApicId);
+			}
+			offset += generic->length;
 		}
-		offset += generic->length;
-	}
+	};
+
+	// All APs share the trampoline page, hence only the INIT phase overlaps.
+	forEachAp([] (unsigned int apicId) { resetSecondary(apicId); });
+	waitForSecondaryReset();
+	forEachAp([] (unsigned int apicId) { bootSecondary(apicId); });
 }
 
 // --------------------------------------------------------
@@ -403,6 +410,7 @@ static initgraph::Task bootApsTask{&globalInitEngine, "acpi.boot-aps",
 	initgraph::Requires{&enterAcpiModeTask},
 	[] {
 		bootOtherProcessors();
+		Scheduler::enableLoadBalancing();
 	}
 };
 
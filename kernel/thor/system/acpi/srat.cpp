@@ -0,0 +1,152 @@
+#include <thor-internal/arch/cpu.hpp>
+#include <thor-internal/cpu-data.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/physical.hpp>
+#include <thor-internal/acpi/acpi.hpp>
+
+#include <lai/core.h>
+
+namespace thor {
+namespace acpi {
+
+struct [[gnu::packed]] SratHeader {
+	uint32_t reserved1;
+	uint64_t reserved2;
+};
+
+struct [[gnu::packed]] SratGenericEntry {
+	uint8_t type;
+	uint8_t length;
+};
+
+struct [[gnu::packed]] SratLocalApicEntry {
+	SratGenericEntry generic;
+	uint8_t proximityDomainLow;
+	uint8_t localApicId;
+	uint32_t flags;
+	uint8_t localSapicEid;
+	uint8_t proximityDomainHigh[3];
+	uint32_t clockDomain;
+};
+
+struct [[gnu::packed]] SratMemoryEntry {
+	SratGenericEntry generic;
+	uint32_t proximityDomain;
+	uint16_t reserved1;
+	uint64_t baseAddress;
+	uint64_t length;
+	uint32_t reserved2;
+	uint32_t flags;
+	uint64_t reserved3;
+};
+
+struct [[gnu::packed]] SratLocalX2ApicEntry {
+	SratGenericEntry generic;
+	uint16_t reserved1;
+	uint32_t proximityDomain;
+	uint32_t x2ApicId;
+	uint32_t flags;
+	uint32_t clockDomain;
+	uint32_t reserved2;
+};
+
+namespace srat_flags {
+	static constexpr uint32_t enabled = 1;
+};
+
+namespace {
+
+// Maps ACPI proximity domains to dense node numbers.
+uint32_t nodeDomains[PhysicalChunkAllocator::maxNumaNodes];
+int numNodes = 0;
+
+struct ApicNode {
+	uint32_t apicId;
+	int node;
+};
+
+constexpr int maxApicNodes = 256;
+ApicNode apicNodes[maxApicNodes];
+int numApicNodes = 0;
+
+int nodeOfDomain(uint32_t domain) {
+	for(int i = 0; i < numNodes; i++)
+		if(nodeDomains[i] == domain)
+			return i;
+	if(numNodes == PhysicalChunkAllocator::maxNumaNodes) {
+		infoLogger() << "thor: Too many NUMA nodes, merging domain " << domain
+				<< " into node 0" << frg::endlog;
+		return 0;
+	}
+	nodeDomains[numNodes] = domain;
+	return numNodes++;
+}
+
+void addApicNode(uint32_t apicId, int node) {
+	if(numApicNodes == maxApicNodes) {
+		infoLogger() << "thor: Ignoring SRAT affinity of APIC " << apicId << frg::endlog;
+		return;
+	}
+	apicNodes[numApicNodes++] = ApicNode{apicId, node};
+}
+
+} // anonymous namespace
+
+int getNumaNodeOfApic(uint32_t apicId) {
+	for(int i = 0; i < numApicNodes; i++)
+		if(apicNodes[i].apicId == apicId)
+			return apicNodes[i].node;
+	return 0;
+}
+
+static initgraph::Task parseSratTask{&globalInitEngine, "acpi.parse-srat",
+	initgraph::Requires{getTablesDiscoveredStage()},
+	initgraph::Entails{getTaskingAvailableStage()},
+	[] {
+		void *sratWindow = laihost_scan("SRAT", 0);
+		if(!sratWindow) {
+			infoLogger() << "thor: No SRAT, assuming a single NUMA node" << frg::endlog;
+			return;
+		}
+		auto srat = reinterpret_cast<acpi_header_t *>(sratWindow);
+
+		size_t offset = sizeof(acpi_header_t) + sizeof(SratHeader);
+		while(offset < srat->length) {
+			auto generic = (SratGenericEntry *)((uint8_t *)srat + offset);
+			if(generic->type == 0) { // Local APIC affinity
+				auto entry = (SratLocalApicEntry *)generic;
+				if(entry->flags & srat_flags::enabled) {
+					uint32_t domain = entry->proximityDomainLow
+							| (uint32_t(entry->proximityDomainHigh[0]) << 8)
+							| (uint32_t(entry->proximityDomainHigh[1]) << 16)
+							| (uint32_t(entry->proximityDomainHigh[2]) << 24);
+					addApicNode(entry->localApicId, nodeOfDomain(domain));
+				}
+			}else if(generic->type == 1) { // Memory affinity
+				auto entry = (SratMemoryEntry *)generic;
+				if(entry->flags & srat_flags::enabled) {
+					int node = nodeOfDomain(entry->proximityDomain);
+					infoLogger() << "thor: Memory at 0x" << frg::hex_fmt(entry->baseAddress)
+							<< ", size 0x" << frg::hex_fmt(entry->length)
+							<< " belongs to NUMA node " << node << frg::endlog;
+					physicalAllocator->assignNode(entry->baseAddress, entry->length, node);
+				}
+			}else if(generic->type == 2) { // Local x2APIC affinity
+				auto entry = (SratLocalX2ApicEntry *)generic;
+				if(entry->flags & srat_flags::enabled)
+					addApicNode(entry->x2ApicId, nodeOfDomain(entry->proximityDomain));
+			}
+			offset += generic->length;
+		}
+
+		infoLogger() << "thor: SRAT describes " << numNodes << " NUMA node(s)" << frg::endlog;
+
+#ifdef __x86_64__
+		// APs look up their node when they are booted; fix up the BSP here.
+		getCpuData()->numaNode = getNumaNodeOfApic(getCpuData()->localApicId);
+#endif
+	}
+};
+
+} } // namespace thor::acpi
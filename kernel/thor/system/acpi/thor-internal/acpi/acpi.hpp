@@ -24,4 +24,7 @@ namespace acpi {
 initgraph::Stage *getTablesDiscoveredStage();
 initgraph::Stage *getNsAvailableStage();
 
+// Returns the NUMA node of a (x2)APIC according to the SRAT, or zero if the SRAT is absent.
+int getNumaNodeOfApic(uint32_t apicId);
+
 } } // namespace thor::acpi
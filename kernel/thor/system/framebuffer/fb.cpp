@@ -25,6 +25,7 @@ struct FbDisplay final : TextDisplay {
 	FbDisplay(void *ptr, unsigned int width, unsigned int height, size_t pitch)
 	: _width{width}, _height{height}, _pitch{pitch / sizeof(uint32_t)} {
 		assert(!(pitch % sizeof(uint32_t)));
+		_trackCells = getWidth() <= maxColumns && getHeight() <= maxRows;
 		setWindow(ptr);
 		_clearScreen(defaultBg);
 	}
@@ -41,12 +42,39 @@ struct FbDisplay final : TextDisplay {
 	void setBlanks(unsigned int x, unsigned int y, int count, int bg) override;
 
 private:
+	// Enough for 3840x2160 with the 8x16 font.
+	static constexpr int maxColumns = 480;
+	static constexpr int maxRows = 135;
+
+	// What is currently shown in a character cell. Blanks are stored as spaces with fg = 0
+	// since the foreground color does not affect them.
+	struct Cell {
+		char c;
+		int8_t fg;
+		int8_t bg;
+
+		bool operator== (const Cell &other) const {
+			return c == other.c && fg == other.fg && bg == other.bg;
+		}
+	};
+
+	// Updates the shadow copy of the cells and calls render(start, n) for each run of
+	// n cells (starting at offset start) that actually changed.
+	template<typename F, typename F2>
+	void _updateCells(unsigned int x, unsigned int y, int count, F cellAt, F2 render);
+
+	void _renderBlanks(unsigned int x, unsigned int y, int count, int bg);
 	void _clearScreen(uint32_t rgb_color);
 
 	volatile uint32_t *_window;
 	unsigned int _width;
 	unsigned int _height;
 	size_t _pitch;
+
+	// The BootScreen redraws its entire text on every message; by keeping track of the
+	// cells on screen we avoid writing (slow, write-combined) pixels that do not change.
+	bool _trackCells;
+	Cell _cells[maxRows * maxColumns];
 };
 
 int FbDisplay::getWidth() {
@@ -57,14 +85,53 @@ int FbDisplay::getHeight() {
 	return _height / fontHeight;
 }
 
+template<typename F, typename F2>
+void FbDisplay::_updateCells(unsigned int x, unsigned int y, int count, F cellAt, F2 render) {
+	if(!_trackCells) {
+		render(0, count);
+		return;
+	}
+
+	auto cells = &_cells[y * maxColumns + x];
+	int k = 0;
+	while(k < count) {
+		if(cells[k] == cellAt(k)) {
+			k++;
+			continue;
+		}
+		int start = k;
+		while(k < count && !(cells[k] == cellAt(k))) {
+			cells[k] = cellAt(k);
+			k++;
+		}
+		render(start, k - start);
+	}
+}
+
 void FbDisplay::setChars(unsigned int x, unsigned int y,
 		const char *c, int count, int fg, int bg) {
-	renderChars((void *)_window, _pitch, x, y, c, count, fg, bg,
-			std::integral_constant<int, fontWidth>{},
-			std::integral_constant<int, fontHeight>{});
+	auto cellAt = [&] (int k) -> Cell {
+		if(c[k] == ' ')
+			return {' ', 0, static_cast<int8_t>(bg)};
+		return {c[k], static_cast<int8_t>(fg), static_cast<int8_t>(bg)};
+	};
+	_updateCells(x, y, count, cellAt, [&] (int start, int n) {
+		renderChars((void *)_window, _pitch, x + start, y, c + start, n, fg, bg,
+				std::integral_constant<int, fontWidth>{},
+				std::integral_constant<int, fontHeight>{});
+	});
 }
 
 void FbDisplay::setBlanks(unsigned int x, unsigned int y, int count, int bg) {
+	auto cellAt = [&] (int) -> Cell {
+		return {' ', 0, static_cast<int8_t>(bg)};
+	};
+	_updateCells(x, y, count, cellAt, [&] (int start, int n) {
+		_renderBlanks(x + start, y, n, bg);
+	});
+}
+
+void FbDisplay::_renderBlanks(unsigned int x, unsigned int y, int count, int bg) {
 	auto bg_rgb = (bg < 0) ? defaultBg : rgbColor[bg]; 
 
 	auto dest_line = _window + y * fontHeight * _pitch + x * fontWidth;
@@ -79,6 +146,11 @@ void FbDisplay::setBlanks(unsigned int x, unsigned int y, int count, int bg) {
 }
 
 void FbDisplay::_clearScreen(uint32_t rgb_color) {
+	if(_trackCells) {
+		for(int i = 0; i < maxRows * maxColumns; i++)
+			_cells[i] = {' ', 0, -1};
+	}
+
 	auto dest_line = _window;
 	for(size_t i = 0; i < _height; i++) {
 		auto dest = dest_line;
@@ -2,6 +2,7 @@
 #include <frg/algorithm.hpp>
 #include <hw.frigg_bragi.hpp>
 #include <mbus.frigg_pb.hpp>
+#include <thor-internal/dma-space.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/io.hpp>
 #include <thor-internal/kernel_heap.hpp>
@@ -22,6 +23,12 @@ extern frg::manual_box<LaneHandle> mbusClient;
 
 namespace pci {
 
+// Per-BAR and per-capability lines make up most of the enumeration log; on machines
+// with many functions, printing them to the serial port and boot screen dominates
+// the time spent in enumeration.
+constexpr bool logBars = false;
+constexpr bool logCapabilities = false;
+
 frg::manual_box<
 	frg::vector<
 		smarter::shared_ptr<PciDevice>,
@@ -558,6 +565,67 @@ namespace {
 			assert(headError == Error::success);
 			assert(tailError == Error::success);
 
+			auto descError = co_await PushDescriptorSender{conversation, std::move(descriptor)};
+			// TODO: improve error handling here.
+			assert(descError == Error::success);
+		}else if(preamble.id() == bragi::message_id<managarm::hw::AccessDmaSpaceRequest>) {
+			auto req = bragi::parse_head_only<managarm::hw::AccessDmaSpaceRequest>(reqBuffer, *kernelAlloc);
+
+			if (!req) {
+				infoLogger() << "thor: Closing lane due to illegal HW request." << frg::endlog;
+				co_return true;
+			}
+
+			auto space = device->obtainDmaSpace();
+
+			managarm::hw::SvrResponse<KernelAlloc> resp{*kernelAlloc};
+
+			if (!space) {
+				resp.set_error(managarm::hw::Errors::NO_HARDWARE_SUPPORT);
+			} else {
+				resp.set_error(managarm::hw::Errors::SUCCESS);
+			}
+
+			auto [headError, tailError] = co_await sendResponse(conversation, std::move(resp));
+
+			// TODO: improve error handling here.
+			assert(headError == Error::success);
+			assert(tailError == Error::success);
+
+			auto descError = co_await PushDescriptorSender{conversation,
+					DmaSpaceDescriptor{std::move(space)}};
+			// TODO: improve error handling here.
+			assert(descError == Error::success);
+		}else if(preamble.id() == bragi::message_id<managarm::hw::AccessPciSpaceRequest>) {
+			auto req = bragi::parse_head_only<managarm::hw::AccessPciSpaceRequest>(reqBuffer, *kernelAlloc);
+
+			if (!req) {
+				infoLogger() << "thor: Closing lane due to illegal HW request." << frg::endlog;
+				co_return true;
+			}
+
+			// Drivers only map the configuration space for reading;
+			// stores still go through StorePciSpaceRequest.
+			auto address = device->parentBus->io->configSpaceAddress(device->parentBus->segId,
+					device->parentBus->busId, device->slot, device->function);
+			MemoryViewDescriptor descriptor{nullptr};
+
+			managarm::hw::SvrResponse<KernelAlloc> resp{*kernelAlloc};
+
+			if (!address) {
+				resp.set_error(managarm::hw::Errors::NO_HARDWARE_SUPPORT);
+			} else {
+				descriptor = MemoryViewDescriptor{smarter::allocate_shared<HardwareMemory>(
+						*kernelAlloc, *address, kPageSize, CachingMode::mmio)};
+				resp.set_error(managarm::hw::Errors::SUCCESS);
+			}
+
+			auto [headError, tailError] = co_await sendResponse(conversation, std::move(resp));
+
+			// TODO: improve error handling here.
+			assert(headError == Error::success);
+			assert(tailError == Error::success);
+
 			auto descError = co_await PushDescriptorSender{conversation, std::move(descriptor)};
 			// TODO: improve error handling here.
 			assert(descError == Error::success);
@@ -724,6 +792,19 @@ IrqPin *PciDevice::getIrqPin() {
 	return interrupt;
 }
 
+smarter::shared_ptr<DmaSpace> PciDevice::obtainDmaSpace() {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&dmaSpaceMutex);
+
+	if(!dmaSpace) {
+		auto domain = createIommuDomain(seg, (bus << 8) | (slot << 3) | function);
+		if(!domain)
+			return nullptr;
+		dmaSpace = smarter::allocate_shared<DmaSpace>(*kernelAlloc, std::move(domain));
+	}
+	return dmaSpace;
+}
+
 void PciDevice::enableIrq() {
 	auto io = parentBus->io;
 
@@ -737,9 +818,8 @@ void PciDevice::setupMsi(MsiPin *msi, size_t index) {
 
 	if (msixIndex >= 0) {
 		// Setup the MSI-X table.
+		programMsi(msi, index);
 		auto space = arch::mem_space{msixMapping}.subspace(index * 16);
-		space.store(msixMessageAddress, msi->getMessageAddress());
-		space.store(msixMessageData, msi->getMessageData());
 		space.store(msixVectorControl,
 				space.load(msixVectorControl) & ~uint32_t{1});
 	} else {
@@ -752,13 +832,39 @@ void PciDevice::setupMsi(MsiPin *msi, size_t index) {
 		auto msgControl = io->readConfigHalf(parentBus,
 				slot, function, offset + 2);
 
-		bool is64Capable = msgControl & (1 << 7);
-
 		msgControl &= ~0x0071; // Disable MSI by default, enable only 1 message
 
 		io->writeConfigHalf(parentBus,
 				slot, function, offset + 2, msgControl);
 
+		programMsi(msi, index);
+	}
+
+	msi->setProgrammer(this, index);
+}
+
+// Also used to update the message when the MSI is steered to another CPU.
+void PciDevice::programMsi(MsiPin *msi, size_t index) {
+	auto io = parentBus->io;
+
+	if (msixIndex >= 0) {
+		// Mask the vector while the message is inconsistent.
+		auto space = arch::mem_space{msixMapping}.subspace(index * 16);
+		auto vectorControl = space.load(msixVectorControl);
+		space.store(msixVectorControl, vectorControl | 1);
+		space.store(msixMessageAddress, msi->getMessageAddress());
+		space.store(msixMessageData, msi->getMessageData());
+		space.store(msixVectorControl, vectorControl);
+	} else {
+		assert(msiIndex >= 0);
+		assert(!index);
+		auto offset = caps[msiIndex].offset;
+
+		auto msgControl = io->readConfigHalf(parentBus,
+				slot, function, offset + 2);
+
+		bool is64Capable = msgControl & (1 << 7);
+
 		io->writeConfigWord(parentBus,
 				slot, function, offset + 4, msi->getMessageAddress() & 0xFFFFFFFF);
 
@@ -777,6 +883,21 @@ void PciDevice::setupMsi(MsiPin *msi, size_t index) {
 	}
 }
 
+void PciDevice::maskMsi(size_t index, bool masked) {
+	// Only MSI-X is supported here: the per-vector mask of plain MSI lives in
+	// configuration space, which we do not want to access in IRQ context.
+	if (msixIndex < 0)
+		return;
+
+	auto space = arch::mem_space{msixMapping}.subspace(index * 16);
+	auto vectorControl = space.load(msixVectorControl);
+	if (masked) {
+		space.store(msixVectorControl, vectorControl | 1);
+	} else {
+		space.store(msixVectorControl, vectorControl & ~uint32_t{1});
+	}
+}
+
 void PciDevice::enableMsi() {
 	auto io = parentBus->io;
 
@@ -860,8 +981,9 @@ void readEntityBars(PciEntity *entity, int nBars) {
 			bars[i].length = length;
 
 			if (!address) {
-				infoLogger() << "            unallocated I/O space BAR #" << i
-						<< ", length: " << length << " ports" << frg::endlog;
+				if(logBars)
+					infoLogger() << "            unallocated I/O space BAR #" << i
+							<< ", length: " << length << " ports" << frg::endlog;
 			} else {
 				// Check all parent resources to see if this BAR is actually memory mapped
 				bool isMemoryMapped = false;
@@ -899,9 +1021,10 @@ void readEntityBars(PciEntity *entity, int nBars) {
 					bars[i].offset = 0;
 				}
 
-				infoLogger() << "            I/O space BAR #" << i
-						<< " at 0x" << frg::hex_fmt(address)
-						<< ", length: " << length << " ports" << frg::endlog;
+				if(logBars)
+					infoLogger() << "            I/O space BAR #" << i
+							<< " at 0x" << frg::hex_fmt(address)
+							<< ", length: " << length << " ports" << frg::endlog;
 
 			}
 		}else if(((bar >> 1) & 3) == 0) {
@@ -924,10 +1047,11 @@ void readEntityBars(PciEntity *entity, int nBars) {
 			bars[i].prefetchable = bar & (1 << 3);
 
 			if (!address) {
-				infoLogger() << "            unallocated 32-bit memory BAR #" << i
-						<< ", length: " << length << " bytes"
-						<< (bar & (1 << 3) ? " (prefetchable)" : "")
-						<< frg::endlog;
+				if(logBars)
+					infoLogger() << "            unallocated 32-bit memory BAR #" << i
+							<< ", length: " << length << " bytes"
+							<< (bar & (1 << 3) ? " (prefetchable)" : "")
+							<< frg::endlog;
 			} else {
 				bars[i].hostType = PciBar::kBarMemory;
 				bars[i].allocated = true;
@@ -938,11 +1062,12 @@ void readEntityBars(PciEntity *entity, int nBars) {
 						CachingMode::mmio);
 				bars[i].offset = offset;
 
-				infoLogger() << "            32-bit memory BAR #" << i
-						<< " at 0x" << frg::hex_fmt(address)
-						<< ", length: " << length << " bytes"
-						<< (bar & (1 << 3) ? " (prefetchable)" : "")
-						<< frg::endlog;
+				if(logBars)
+					infoLogger() << "            32-bit memory BAR #" << i
+							<< " at 0x" << frg::hex_fmt(address)
+							<< ", length: " << length << " bytes"
+							<< (bar & (1 << 3) ? " (prefetchable)" : "")
+							<< frg::endlog;
 			}
 		}else if(((bar >> 1) & 3) == 2) {
 			assert(i < (nBars - 1)); // Otherwise there is no next bar.
@@ -971,10 +1096,11 @@ void readEntityBars(PciEntity *entity, int nBars) {
 			bars[i].prefetchable = bar & (1 << 3);
 
 			if (!address) {
-				infoLogger() << "            unallocated 64-bit memory BAR #" << i
-						<< ", length: " << length << " bytes"
-						<< (bar & (1 << 3) ? " (prefetchable)" : "")
-						<< frg::endlog;
+				if(logBars)
+					infoLogger() << "            unallocated 64-bit memory BAR #" << i
+							<< ", length: " << length << " bytes"
+							<< (bar & (1 << 3) ? " (prefetchable)" : "")
+							<< frg::endlog;
 			} else {
 				bars[i].hostType = PciBar::kBarMemory;
 				bars[i].allocated = true;
@@ -985,11 +1111,12 @@ void readEntityBars(PciEntity *entity, int nBars) {
 						CachingMode::mmio);
 				bars[i].offset = offset;
 
-				infoLogger() << "            64-bit memory BAR #" << i
-						<< " at 0x" << frg::hex_fmt(address)
-						<< ", length: " << length << " bytes"
-						<< (bar & (1 << 3) ? " (prefetchable)" : "")
-						<< frg::endlog;
+				if(logBars)
+					infoLogger() << "            64-bit memory BAR #" << i
+							<< " at 0x" << frg::hex_fmt(address)
+							<< ", length: " << length << " bytes"
+							<< (bar & (1 << 3) ? " (prefetchable)" : "")
+							<< frg::endlog;
 			}
 
 			i++;
@@ -1015,11 +1142,13 @@ void findPciCaps(PciEntity *entity) {
 
 			auto name = nameOfCapability(type);
 			if(name) {
-				infoLogger() << "            " << name << " capability"
-						<< frg::endlog;
+				if(logCapabilities)
+					infoLogger() << "            " << name << " capability"
+							<< frg::endlog;
 			}else{
-				infoLogger() << "            Capability of type 0x"
-						<< frg::hex_fmt((int)type) << frg::endlog;
+				if(logCapabilities)
+					infoLogger() << "            Capability of type 0x"
+							<< frg::hex_fmt((int)type) << frg::endlog;
 			}
 
 			if(type == 0x10) {
@@ -80,4 +80,11 @@ void EcamPcieConfigIo::writeConfigWord(uint32_t seg, uint32_t bus, uint32_t slot
 	arch::scalar_store<uint32_t>(space, spaceOffset, value);
 }
 
+frg::optional<PhysicalAddr> EcamPcieConfigIo::configSpaceAddress(uint32_t seg, uint32_t bus,
+		uint32_t slot, uint32_t function) {
+	assert(seg == seg_);
+	assert(bus >= busStart_ && bus <= busEnd_);
+	return mmioBase_ + (uintptr_t(bus - busStart_) << 20) + calculateOffset_(slot, function, 0);
+}
+
 } // namespace thor::pci
@@ -14,6 +14,7 @@ namespace thor {
 
 struct MemoryView;
 struct IoSpace;
+struct DmaSpace;
 
 struct BootScreen;
 
@@ -274,7 +275,7 @@ struct PciBridge final : PciEntity {
 	uint32_t subordinateId;
 };
 
-struct PciDevice final : PciEntity {
+struct PciDevice final : PciEntity, MsiProgrammer {
 
 	PciDevice(PciBus *parentBus_, uint32_t seg, uint32_t bus, uint32_t slot, uint32_t function,
 			uint16_t vendor, uint16_t device_id, uint8_t revision,
@@ -288,11 +289,17 @@ struct PciDevice final : PciEntity {
 	smarter::shared_ptr<IrqObject> obtainIrqObject();
 	IrqPin *getIrqPin();
 
+	// Returns nullptr if the device is not behind an IOMMU.
+	smarter::shared_ptr<DmaSpace> obtainDmaSpace();
+
 	void enableIrq();
 
 	void setupMsi(MsiPin *msi, size_t index);
 	void enableMsi();
 
+	void programMsi(MsiPin *msi, size_t index) override;
+	void maskMsi(size_t index, bool masked) override;
+
 	// mbus object ID of the device
 	int64_t mbusId;
 
@@ -327,6 +334,10 @@ struct PciDevice final : PciEntity {
 	// Device attachments.
 	FbInfo *associatedFrameBuffer;
 	BootScreen *associatedScreen;
+
+	// IOMMU domain of the device; created on first use.
+	frg::ticket_spinlock dmaSpaceMutex;
+	smarter::shared_ptr<DmaSpace> dmaSpace;
 };
 
 enum {
@@ -430,6 +441,13 @@ struct PciConfigIo {
 	virtual void writeConfigWord(uint32_t seg, uint32_t bus, uint32_t slot,
 			uint32_t function, uint16_t offset, uint32_t value) = 0;
 
+	// Returns the physical address of the 4 KiB configuration space of a function
+	// if the configuration space is memory-mapped (i.e., for ECAM).
+	virtual frg::optional<PhysicalAddr> configSpaceAddress(uint32_t, uint32_t,
+			uint32_t, uint32_t) {
+		return frg::null_opt;
+	}
+
 protected:
 	~PciConfigIo() = default;
 };
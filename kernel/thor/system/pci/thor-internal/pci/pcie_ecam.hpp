@@ -23,6 +23,9 @@ struct EcamPcieConfigIo final : PciConfigIo {
 	void writeConfigWord(uint32_t seg, uint32_t bus, uint32_t slot,
 			uint32_t function, uint16_t offset, uint32_t value) override;
 
+	frg::optional<PhysicalAddr> configSpaceAddress(uint32_t seg, uint32_t bus,
+			uint32_t slot, uint32_t function) override;
+
 private:
 	arch::mem_space spaceForBus_(uint32_t bus);
 	uintptr_t calculateOffset_(uint32_t slot, uint32_t function,
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <sys/auxv.h>
 #include <algorithm>
+#include <deque>
 #include <iostream>
 #include <memory>
 #include <unordered_map>
@@ -13,10 +14,14 @@
 #include <variant>
 #include <vector>
 
+#include <async/recurring-event.hpp>
 #include <async/result.hpp>
+#include <bragi/helpers-std.hpp>
+#include <frg/std_compat.hpp>
 #include <helix/ipc.hpp>
 
 #include "mbus.pb.h"
+#include <ostrace.bragi.hpp>
 
 // --------------------------------------------------------
 // Entity
@@ -152,15 +157,73 @@ struct Observer {
 	explicit Observer(AnyFilter filter, helix::UniqueLane lane)
 	: _filter(std::move(filter)), _lane(std::move(lane)) { }
 
-	async::detached traverse(std::shared_ptr<Entity> root);
+	// Queues all existing matching entities below root.
+	void traverse(std::shared_ptr<Entity> root);
 
-	async::detached onAttach(std::shared_ptr<Entity> entity);
+	void onAttach(std::shared_ptr<Entity> entity);
 
 private:
+	void _kick();
+
+	// Drains _queue. Entities that are queued while a message is in flight are
+	// sent in the next batch; hence at most one message per observer is in flight.
+	async::detached _deliver();
+
 	AnyFilter _filter;
 	helix::UniqueLane _lane;
+	std::deque<std::shared_ptr<Entity>> _queue;
+	bool _delivering = false;
 };
 
+// Upper bound on the size of ATTACH_BATCH messages (see the receive buffer size in the client).
+constexpr size_t maxBatchBytes = 4096;
+
+// Inverted index: property name -> property value -> all entities with that property
+// (in order of creation). Entities are never removed.
+using PostingList = std::vector<std::shared_ptr<Entity>>;
+std::unordered_map<std::string, std::unordered_map<std::string, PostingList>> propertyIndex;
+
+void indexEntity(const std::shared_ptr<Entity> &entity) {
+	for(auto &kv : entity->getProperties())
+		propertyIndex[kv.first][kv.second].push_back(entity);
+}
+
+// Returns a superset of the entities that match the filter
+// or nullptr if the filter cannot be answered from the index.
+static const PostingList *candidatesOf(const AnyFilter &filter) {
+	static const PostingList emptyList;
+
+	if(auto real = std::get_if<EqualsFilter>(&filter); real) {
+		auto pit = propertyIndex.find(real->getProperty());
+		if(pit == propertyIndex.end())
+			return &emptyList;
+		auto vit = pit->second.find(real->getValue());
+		if(vit == pit->second.end())
+			return &emptyList;
+		return &vit->second;
+	}else if(auto real = std::get_if<Conjunction>(&filter); real) {
+		// Any operand restricts the result; pick the most selective one.
+		const PostingList *best = nullptr;
+		for(auto &operand : real->getOperands()) {
+			auto list = candidatesOf(operand);
+			if(list && (!best || list->size() < best->size()))
+				best = list;
+		}
+		return best;
+	}else{
+		throw std::runtime_error("Unexpected filter");
+	}
+}
+
+static bool isDescendantOf(const Entity *entity, const Entity *root) {
+	if(entity == root)
+		return true;
+	for(auto current = entity->getParent(); current; current = current->getParent())
+		if(current.get() == root)
+			return true;
+	return false;
+}
+
 static bool matchesFilter(const Entity *entity, const AnyFilter &filter) {
 	if(auto real = std::get_if<EqualsFilter>(&filter); real) {
 		auto &properties = entity->getProperties();
@@ -183,60 +246,92 @@ void Group::processAttach(std::shared_ptr<Entity> entity) {
 		observer_ptr->onAttach(entity);
 }
 
-async::detached Observer::traverse(std::shared_ptr<Entity> root) {
-	std::queue<std::shared_ptr<Entity>> entities;
-	entities.push(root);
-	while(!entities.empty()) {
-		std::shared_ptr<Entity> entity = entities.front();
-		entities.pop();
-		if(const Entity &er = *entity; typeid(er) == typeid(Group)) {
-			auto group = std::static_pointer_cast<Group>(entity);
-			for(auto child : group->getChildren())
-				entities.push(std::move(child));
+void Observer::traverse(std::shared_ptr<Entity> root) {
+	if(auto candidates = candidatesOf(_filter); candidates) {
+		for(auto &entity : *candidates) {
+			if(!isDescendantOf(entity.get(), root.get())
+					|| !matchesFilter(entity.get(), _filter))
+				continue;
+			_queue.push_back(entity);
+		}
+	}else{
+		std::queue<std::shared_ptr<Entity>> entities;
+		entities.push(root);
+		while(!entities.empty()) {
+			std::shared_ptr<Entity> entity = entities.front();
+			entities.pop();
+			if(const Entity &er = *entity; typeid(er) == typeid(Group)) {
+				auto group = std::static_pointer_cast<Group>(entity);
+				for(auto child : group->getChildren())
+					entities.push(std::move(child));
+			}
+
+			if(!matchesFilter(entity.get(), _filter))
+				continue;
+			_queue.push_back(std::move(entity));
 		}
+	}
+	_kick();
+}
 
-		if(!matchesFilter(entity.get(), _filter)) 
-			continue;
-		
-		helix::SendBuffer send_req;
+void Observer::onAttach(std::shared_ptr<Entity> entity) {
+	if(!matchesFilter(entity.get(), _filter))
+		return;
+	_queue.push_back(std::move(entity));
+	_kick();
+}
+
+void Observer::_kick() {
+	if(_delivering || _queue.empty())
+		return;
+	_delivering = true;
+	_deliver();
+}
 
+async::detached Observer::_deliver() {
+	while(!_queue.empty()) {
 		managarm::mbus::SvrRequest req;
-		req.set_req_type(managarm::mbus::SvrReqType::ATTACH);
-		req.set_id(entity->getId());
-		for(auto kv : entity->getProperties()) {
-			auto entry = req.add_properties();
-			entry->set_name(kv.first);
-			entry->mutable_item()->mutable_string_item()->set_value(kv.second);
+		if(_queue.size() == 1) {
+			auto entity = std::move(_queue.front());
+			_queue.pop_front();
+
+			req.set_req_type(managarm::mbus::SvrReqType::ATTACH);
+			req.set_id(entity->getId());
+			for(auto kv : entity->getProperties()) {
+				auto entry = req.add_properties();
+				entry->set_name(kv.first);
+				entry->mutable_item()->mutable_string_item()->set_value(kv.second);
+			}
+		}else{
+			req.set_req_type(managarm::mbus::SvrReqType::ATTACH_BATCH);
+			while(!_queue.empty()) {
+				auto &entity = _queue.front();
+				auto attachment = req.add_attachments();
+				attachment->set_id(entity->getId());
+				for(auto kv : entity->getProperties()) {
+					auto entry = attachment->add_properties();
+					entry->set_name(kv.first);
+					entry->mutable_item()->mutable_string_item()->set_value(kv.second);
+				}
+
+				// Always send at least one entity, even if it exceeds the limit on its own.
+				if(req.attachments_size() > 1 && req.ByteSizeLong() > maxBatchBytes) {
+					req.mutable_attachments()->RemoveLast();
+					break;
+				}
+				_queue.pop_front();
+			}
 		}
 
+		helix::SendBuffer send_req;
+
 		auto ser = req.SerializeAsString();
 		auto &&transmit = helix::submitAsync(_lane, helix::Dispatcher::global(),
 				helix::action(&send_req, ser.data(), ser.size()));
 		co_await transmit.async_wait();
 		HEL_CHECK(send_req.error());
 	}
-}
-
-async::detached Observer::onAttach(std::shared_ptr<Entity> entity) {
-	if(!matchesFilter(entity.get(), _filter)) 
-		co_return;
-	
-	helix::SendBuffer send_req;
-
-	managarm::mbus::SvrRequest req;
-	req.set_req_type(managarm::mbus::SvrReqType::ATTACH);
-	req.set_id(entity->getId());
-	for(auto kv : entity->getProperties()) {
-		auto entry = req.add_properties();
-		entry->set_name(kv.first);
-		entry->mutable_item()->mutable_string_item()->set_value(kv.second);
-	}
-
-	auto ser = req.SerializeAsString();
-	auto &&transmit = helix::submitAsync(_lane, helix::Dispatcher::global(),
-			helix::action(&send_req, ser.data(), ser.size()));
-	co_await transmit.async_wait();
-	HEL_CHECK(send_req.error());
+	_delivering = false;
 }
 
 std::unordered_map<int64_t, std::shared_ptr<Entity>> allEntities;
@@ -263,6 +358,107 @@ static AnyFilter decodeFilter(const managarm::mbus::AnyFilter &proto_filter) {
 	}
 }
 
+// --------------------------------------------------------
+// Boot profiling
+// --------------------------------------------------------
+
+// To find out when drivers come up during boot, we report the time of each object's
+// attach to ostrace (as "boot.mbus:<class>" events, see extract-ostrace's boot-chart mode).
+// ostrace itself is an mbus object; attaches that happen before it shows up are buffered.
+
+constexpr size_t maxPendingAttaches = 1024;
+
+std::deque<std::pair<std::string, uint64_t>> pendingAttaches;
+async::recurring_event attachesPending;
+bool traceAttaches = true; // Cleared if ostrace turns out to be disabled.
+
+void noteAttach(const std::unordered_map<std::string, std::string> &properties) {
+	if(!traceAttaches || pendingAttaches.size() == maxPendingAttaches)
+		return;
+
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+
+	// Announcements only have a fixed-size head.
+	std::string name{"boot.mbus:"};
+	auto it = properties.find("class");
+	name += (it != properties.end()) ? it->second.substr(0, 64) : "unknown";
+
+	pendingAttaches.push_back({std::move(name), now});
+	attachesPending.raise();
+}
+
+template<typename Req>
+async::result<managarm::ostrace::Response> ostraceRequest(helix::BorrowedLane lane,
+		Req &req) {
+	auto [offer, sendReq, recvResp] =
+		co_await helix_ng::exchangeMsgs(
+			lane,
+			helix_ng::offer(
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline()
+			)
+		);
+	HEL_CHECK(offer.error());
+	HEL_CHECK(sendReq.error());
+	HEL_CHECK(recvResp.error());
+
+	auto maybeResp = bragi::parse_head_only<managarm::ostrace::Response>(recvResp);
+	assert(maybeResp);
+	co_return std::move(maybeResp.value());
+}
+
+async::detached emitAttaches(std::shared_ptr<Object> ostrace) {
+	helix::UniqueLane lane{co_await ostrace->bind()};
+
+	managarm::ostrace::NegotiateReq negotiateReq;
+	auto negotiateResp = co_await ostraceRequest(lane, negotiateReq);
+	if(negotiateResp.error() != managarm::ostrace::Error::SUCCESS) {
+		traceAttaches = false;
+		pendingAttaches.clear();
+		co_return;
+	}
+
+	auto announceItem = [&] (std::string name) -> async::result<uint64_t> {
+		managarm::ostrace::AnnounceItemReq req;
+		req.set_name(std::move(name));
+		auto resp = co_await ostraceRequest(lane, req);
+		co_return resp.id();
+	};
+	auto beginItem = co_await announceItem("boot.begin");
+	auto endItem = co_await announceItem("boot.end");
+
+	std::unordered_map<std::string, uint64_t> eventIds;
+	while(true) {
+		while(pendingAttaches.empty())
+			co_await attachesPending.async_wait();
+		auto [name, ts] = std::move(pendingAttaches.front());
+		pendingAttaches.pop_front();
+
+		auto it = eventIds.find(name);
+		if(it == eventIds.end()) {
+			managarm::ostrace::AnnounceEventReq req;
+			req.set_name(name);
+			auto resp = co_await ostraceRequest(lane, req);
+			it = eventIds.insert({name, resp.id()}).first;
+		}
+
+		// Attaches are instants; the kernel's boot phases use the same pair of items.
+		managarm::ostrace::CounterItem beginCtr;
+		beginCtr.set_id(beginItem);
+		beginCtr.set_value(ts);
+		managarm::ostrace::CounterItem endCtr;
+		endCtr.set_id(endItem);
+		endCtr.set_value(ts);
+
+		managarm::ostrace::EmitEventReq req;
+		req.set_id(it->second);
+		req.add_ctrs(std::move(beginCtr));
+		req.add_ctrs(std::move(endCtr));
+		co_await ostraceRequest(lane, req);
+	}
+}
+
 async::detached serve(helix::UniqueLane lane) {
 	while(true) {
 		helix::Accept accept;
@@ -347,12 +543,16 @@ async::detached serve(helix::UniqueLane lane) {
 				assert(kv.has_item() && kv.item().has_string_item());
 				properties.insert({ kv.name(), kv.item().string_item().value() });
 			}
+			noteAttach(properties);
+			auto isOstrace = properties.count("class")
+					&& properties.at("class") == "ostrace";
 
 			helix::UniqueLane local_lane, remote_lane;
 			std::tie(local_lane, remote_lane) = helix::createStream();
 			auto child = std::make_shared<Object>(nextEntityId++,
 					group, std::move(properties), std::move(local_lane));
 			allEntities.insert({ child->getId(), child });
+			indexEntity(child);
 
 			group->addChild(child);
 
@@ -374,6 +574,10 @@ async::detached serve(helix::UniqueLane lane) {
 			co_await transmit.async_wait();
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(send_lane.error());
+
+			// The object only handles binds once it receives the response.
+			if(isOstrace)
+				emitAttaches(child);
 		}else if(req.req_type() == managarm::mbus::CntReqType::LINK_OBSERVER) {
 			helix::SendBuffer send_resp;
 			helix::PushDescriptor send_lane;
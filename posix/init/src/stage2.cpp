@@ -58,6 +58,13 @@ int main() {
 		abort();
 	}
 
+	// Start the log collector early; until it runs, servers print their logs synchronously.
+	auto logd = fork();
+	if(!logd) {
+		execl("/usr/bin/runsvr", "/usr/bin/runsvr", "run",
+				"/usr/lib/managarm/server/logd.bin", nullptr);
+	}else assert(logd != -1);
+
 	// Start some drivers that are not integrated into udev rules yet.
 #if defined (__x86_64__)
 	auto input_ps2 = fork();
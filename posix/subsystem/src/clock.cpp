@@ -73,17 +73,22 @@ async::result<void> enumerateTracker() {
 struct timespec getRealtime() {
 	auto page = reinterpret_cast<TrackerPage *>(trackerPageMapping.get());
 
-	// Start the seqlock read.
-	auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
-	assert(!(seqlock & 1));
-
-	// Perform the actual loads.
-	auto ref = __atomic_load_n(&page->refClock, __ATOMIC_RELAXED);
-	auto base = __atomic_load_n(&page->baseRealtime, __ATOMIC_RELAXED);
-
-	// Finish the seqlock read.
-	__atomic_thread_fence(__ATOMIC_ACQUIRE);
-	assert(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) == seqlock);
+	int64_t ref, base;
+	while(true) {
+		// Start the seqlock read.
+		auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
+		if(seqlock & 1)
+			continue; // An update is in progress.
+
+		// Perform the actual loads.
+		ref = __atomic_load_n(&page->refClock, __ATOMIC_RELAXED);
+		base = __atomic_load_n(&page->baseRealtime, __ATOMIC_RELAXED);
+
+		// Finish the seqlock read; retry if the page was updated concurrently.
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) == seqlock)
+			break;
+	}
 
 	// Calculate the current time.
 	uint64_t now;
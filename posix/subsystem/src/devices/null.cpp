@@ -27,14 +27,12 @@ private:
 	}
 
 	helix::UniqueLane _passthrough;
-	async::cancellation_event _cancelServe;
 
 public:
 	static void serve(smarter::shared_ptr<NullFile> file) {
 		helix::UniqueLane lane;
 		std::tie(lane, file->_passthrough) = helix::createStream();
-		async::detach(protocols::fs::servePassthrough(std::move(lane),
-				file, &fileOperations, file->_cancelServe));
+		serveStateless(std::move(file), std::move(lane));
 	}
 
 	NullFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link)
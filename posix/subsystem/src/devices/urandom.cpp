@@ -8,19 +8,53 @@
 
 namespace {
 
+void getKernelRandom(char *p, size_t length) {
+	size_t n = 0;
+	while(n < length) {
+		size_t chunk;
+		HEL_CHECK(helGetRandomBytes(p + n, length - n, &chunk));
+		n += chunk;
+	}
+}
+
+// Most reads are small (e.g., seeds and nonces); these are served from a buffer
+// that is refilled by a single syscall. Bytes are erased once they are handed out.
+struct RandomPool {
+	static constexpr size_t poolSize = 4096;
+	// Larger reads bypass the pool.
+	static constexpr size_t maxPooledRead = 256;
+
+	void read(char *p, size_t length) {
+		if(length > maxPooledRead) {
+			getKernelRandom(p, length);
+			return;
+		}
+
+		if(available_ < length) {
+			getKernelRandom(buffer_, poolSize);
+			available_ = poolSize;
+		}
+		auto src = buffer_ + poolSize - available_;
+		memcpy(p, src, length);
+		memset(src, 0, length);
+		available_ -= length;
+	}
+
+private:
+	char buffer_[poolSize];
+	// Unused bytes at the end of buffer_.
+	size_t available_ = 0;
+};
+
+// Each worker thread has its own pool (see File::serveStateless()).
+thread_local RandomPool threadPool;
+
 struct UrandomFile final : File {
 private:
 	async::result<frg::expected<Error, size_t>>
 	readSome(Process *, void *data, size_t length) override {
-		auto p = reinterpret_cast<char *>(data);
-		size_t n = 0;
-		while(n < length) {
-			size_t chunk;
-			HEL_CHECK(helGetRandomBytes(p + n, length - n, &chunk));
-			n+= chunk;
-		}
-
-		co_return n;
+		threadPool.read(reinterpret_cast<char *>(data), length);
+		co_return length;
 	}
 
 	async::result<frg::expected<Error, size_t>> writeAll(Process *, const void *, size_t length) override {
@@ -36,14 +70,12 @@ private:
 	}
 
 	helix::UniqueLane _passthrough;
-	async::cancellation_event _cancelServe;
 
 public:
 	static void serve(smarter::shared_ptr<UrandomFile> file) {
 		helix::UniqueLane lane;
 		std::tie(lane, file->_passthrough) = helix::createStream();
-		async::detach(protocols::fs::servePassthrough(std::move(lane),
-				file, &fileOperations, file->_cancelServe));
+		serveStateless(std::move(file), std::move(lane));
 	}
 
 	UrandomFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link)
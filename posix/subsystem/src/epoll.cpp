@@ -1,17 +1,23 @@
 
 #include <string.h>
+#include <algorithm>
 #include <iostream>
+#include <optional>
+#include <unordered_map>
+#include <vector>
 
 #include <async/recurring-event.hpp>
 #include <boost/intrusive/list.hpp>
 #include <frg/manual_box.hpp>
 #include <helix/ipc.hpp>
+#include <protocols/logging/logging.hpp>
 #include "common.hpp"
 #include "epoll.hpp"
 
 namespace {
 
-bool logEpoll = false;
+// Enable with MANAGARM_LOG=posix.epoll=debug.
+protocols::logging::Subsystem epollLog{"posix.epoll"};
 
 struct OpenFile : File {
 	// ------------------------------------------------------------------------
@@ -42,11 +48,27 @@ private:
 		smarter::shared_ptr<Item> item;
 	};
 
+	// Flags that are passed in the event mask but that are not poll events.
+	static constexpr int flagMask = EPOLLET | EPOLLONESHOT;
+
 	struct Item : boost::intrusive::list_base_hook<> {
 		Item(smarter::shared_ptr<OpenFile> epoll, Process *process,
 				smarter::shared_ptr<File> file, int mask, uint64_t cookie)
 		: epoll{epoll}, state{stateActive}, process{process},
-				file{std::move(file)}, eventMask{mask}, cookie{cookie} { }
+				file{std::move(file)}, cookie{cookie} {
+			setMask(mask);
+		}
+
+		void setMask(int mask) {
+			eventMask = mask & ~flagMask;
+			edgeTriggered = mask & EPOLLET;
+			oneShot = mask & EPOLLONESHOT;
+		}
+
+		// Events that we report; EPOLLERR and EPOLLHUP are always reported.
+		int watchedEvents() {
+			return eventMask | EPOLLERR | EPOLLHUP;
+		}
 
 		smarter::shared_ptr<OpenFile> epoll;
 		State state;
@@ -55,8 +77,23 @@ private:
 		Process *process;
 		smarter::shared_ptr<File> file;
 		int eventMask;
+		bool edgeTriggered;
+		bool oneShot;
 		uint64_t cookie;
 
+		// Set once a EPOLLONESHOT item reported an event; cleared by modifyItem().
+		bool disarmed = false;
+
+		// Edges that pollWait() returned but that were not reported yet, together with
+		// the sequence number of the last edge. Edge-triggered items report these
+		// directly, i.e., without calling pollStatus() again.
+		int pendingEdges = 0;
+		uint64_t edgeSeq = 0;
+
+		// Status that _fetchBatchedStatus() obtained for this item; it is consumed by
+		// waitForEvents() instead of calling pollStatus().
+		std::optional<frg::expected<Error, PollStatusResult>> batchedStatus;
+
 		async::cancellation_event cancelPoll;
 
 		frg::manual_box<
@@ -71,72 +108,124 @@ private:
 		smarter::borrowed_ptr<Item> self;
 	};
 
+	// Starts a pollWait() for edges after the given sequence number.
+	// Returns true if the operation completed inline; the caller then needs to call _awaitPoll().
+	static bool _startPolling(Item *item, uint64_t seq) {
+		assert(item->state & statePolling);
+		item->cancelPoll.reset();
+		item->pollOperation.construct_with([&] {
+			return async::execution::connect(
+				item->file->pollWait(item->process, seq,
+						item->watchedEvents(), item->cancelPoll),
+				Receiver{item->self.lock()}
+			);
+		});
+		return async::execution::start_inline(*item->pollOperation);
+	}
+
 	static void _awaitPoll(Item *item) {
-	reRunImmediately:
-		// First, destruct the operation so that we can re-use it later.
-		item->pollOperation.destruct();
+		while(true) {
+			// First, destruct the operation so that we can re-use it later.
+			item->pollOperation.destruct();
 
-		assert(item->state & statePolling);
-		auto self = item->epoll.get();
-
-		// Discard non-active and closed items.
-		if(!(item->state & stateActive)) {
-			item->state &= ~statePolling;
-			// TODO: We might have polling + pending items in the future.
-			assert(!item->state);
-			return;
-		}
+			assert(item->state & statePolling);
+			auto self = item->epoll.get();
 
-		auto resultOrError = std::move(*item->pollOutcome);
+			// Discard non-active and closed items.
+			if(!(item->state & stateActive)) {
+				item->state &= ~statePolling;
+				return;
+			}
 
-		if(!resultOrError) {
-			assert(resultOrError.error() == Error::fileClosed);
-			item->state &= ~statePolling;
-			return;
-		}
+			auto resultOrError = std::move(*item->pollOutcome);
+
+			if(!resultOrError) {
+				assert(resultOrError.error() == Error::fileClosed);
+				item->state &= ~statePolling;
+				return;
+			}
+
+			// Pending items are checked by waitForEvents() anyway; this happens if the
+			// item was modified while we were waiting. Disarmed items are not watched.
+			if((item->state & statePending) || item->disarmed) {
+				item->state &= ~statePolling;
+				return;
+			}
+
+			// Note that items only become pending if there is an edge.
+			// This is the correct behavior for edge-triggered items.
+			// Level-triggered items stay pending until the event disappears.
+			auto [seq, edges] = resultOrError.value();
+			if(edges & item->watchedEvents()) {
+				MLOG_DEBUG(epollLog, "{}: Item {} becomes pending",
+						item->epoll->structName(), item->file->structName());
 
-		// Note that items only become pending if there is an edge.
-		// This is the correct behavior for edge-triggered items.
-		// Level-triggered items stay pending until the event disappears.
-		auto result = resultOrError.value();
-		if(std::get<1>(result) & (item->eventMask | EPOLLERR | EPOLLHUP)) {
-			if(logEpoll)
-				std::cout << "posix.epoll \e[1;34m" << item->epoll->structName() << "\e[0m"
-						<< ": Item \e[1;34m" << item->file->structName()
-						<< "\e[0m becomes pending" << std::endl;
-
-			// Note that we stop watching once an item becomes pending.
-			// We do this as we have to pollStatus() again anyway before we report the item.
-			item->state &= ~statePolling;
-			if(!(item->state & statePending)) {
+				// Note that we stop watching once an item becomes pending.
+				item->state &= ~statePolling;
 				item->state |= statePending;
+				item->pendingEdges |= edges & item->watchedEvents();
+				item->edgeSeq = seq;
 
 				item->self.lock().ctr()->increment();
 				self->_pendingQueue.push_back(*item);
 				self->_currentSeq++;
 				self->_statusBell.raise();
+				return;
 			}
-		}else{
-			// Here, we assume that the lambda does not execute on the current stack.
-			// TODO: Use some callback queueing mechanism to ensure this.
-			if(logEpoll)
-				std::cout << "posix.epoll \e[1;34m" << item->epoll->structName() << "\e[0m"
-						<< ": Item \e[1;34m" << item->file->structName()
-						<< "\e[0m still not pending after pollWait()."
-						<< " Mask is " << item->eventMask << ", while edges are "
-						<< std::get<1>(result) << std::endl;
-			item->cancelPoll.reset();
-			item->pollOperation.construct_with([&] {
-				return async::execution::connect(
-					item->file->pollWait(item->process, std::get<0>(result),
-							item->eventMask | EPOLLERR | EPOLLHUP, item->cancelPoll),
-					Receiver{item->self.lock()}
-				);
-			});
-			// Poll should not return immediately; we use an ugly goto here in favor of wrapping
-			// the entire function in a loop.
-			if(async::execution::start_inline(*item->pollOperation))
-				goto reRunImmediately;
+
+			MLOG_DEBUG(epollLog, "{}: Item {} still not pending after pollWait()."
+					" Mask is {}, while edges are {}",
+					item->epoll->structName(), item->file->structName(),
+					item->eventMask, edges);
+			// Poll should not return immediately; if it does, we simply loop.
+			if(!_startPolling(item, seq))
+				return;
+		}
+	}
+
+	// Maximal number of files that we query with a single FILE_POLL_STATUS_BATCH.
+	static constexpr size_t maxBatchedStatus = 64;
+
+	// Queries the status of pending items whose files are served by the same external
+	// server (e.g., sockets of the netserver) with one request per server, instead of
+	// one pollStatus() request per item. Items are appended to fetched.
+	async::result<void> _fetchBatchedStatus(std::vector<smarter::shared_ptr<Item>> &fetched) {
+		std::unordered_map<uint64_t, std::vector<smarter::shared_ptr<Item>>> groups;
+		for(auto &item : _pendingQueue) {
+			if(!(item.state & stateActive) || item.batchedStatus)
+				continue;
+			if(item.edgeTriggered && item.pendingEdges)
+				continue;
+			auto client = item.file->pollStatusClient();
+			if(!client || !client->pollServer())
+				continue;
+			groups[client->pollServer()].push_back(item.self.lock());
+		}
+
+		for(auto &[server, items] : groups) {
+			// Single items are handled by pollStatus() as usual.
+			if(items.size() < 2)
+				continue;
+
+			for(size_t i = 0; i < items.size(); i += maxBatchedStatus) {
+				size_t n = std::min(items.size() - i, maxBatchedStatus);
+				std::vector<protocols::fs::File *> clients;
+				for(size_t j = 0; j < n; j++)
+					clients.push_back(items[i + j]->file->pollStatusClient());
+
+				auto results = co_await protocols::fs::pollStatusBatch(clients);
+				for(size_t j = 0; j < n; j++) {
+					auto &item = items[i + j];
+					// On errors, we fall back to pollStatus() that reports them properly.
+					if(!results[j] || !(item->state & statePending))
+						continue;
+					item->batchedStatus = results[j].value();
+					fetched.push_back(item);
+				}
+			}
+
+			MLOG_DEBUG(epollLog, "{}: Queried {} items of the same server in batch",
+					structName(), items.size());
 		}
 	}
 
@@ -147,9 +236,8 @@ public:
 
 	Error addItem(Process *process, smarter::shared_ptr<File> file, int fd,
 			int mask, uint64_t cookie) {
-		if(logEpoll)
-			std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Adding item \e[1;34m"
-					<< file->structName() << "\e[0m. Mask is " << mask << std::endl;
+		MLOG_DEBUG(epollLog, "{}: Adding item {}. Mask is {}",
+				structName(), file->structName(), mask);
 		// TODO: Fix the memory-leak.
 		if(_fileMap.find({file.get(), fd}) != _fileMap.end()) {
 			return Error::alreadyExists;
@@ -171,9 +259,8 @@ public:
 	}
 
 	Error modifyItem(File *file, int fd, int mask, uint64_t cookie) {
-		if(logEpoll)
-			std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Modifying item \e[1;34m"
-					<< file->structName() << "\e[0m. New mask is " << mask << std::endl;
+		MLOG_DEBUG(epollLog, "{}: Modifying item {}. New mask is {}",
+				structName(), file->structName(), mask);
 		auto it = _fileMap.find({file, fd});
 		if(it == _fileMap.end()) {
 			return Error::noSuchFile;
@@ -181,8 +268,10 @@ public:
 		auto item = it->second;
 		assert(item->state & stateActive);
 
-		item->eventMask = mask;
+		item->setMask(mask);
 		item->cookie = cookie;
+		item->disarmed = false;
+		item->pendingEdges = 0;
 		item->cancelPoll.cancel();
 
 		// Mark the item as pending.
@@ -198,9 +287,7 @@ public:
 	}
 
 	Error deleteItem(File *file, int fd) {
-		if(logEpoll)
-			std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Deleting item \e[1;34m"
-					<< file->structName() << "\e[0m" << std::endl;
+		MLOG_DEBUG(epollLog, "{}: Deleting item {}", structName(), file->structName());
 		auto it = _fileMap.find({file, fd});
 		if(it == _fileMap.end()) {
 			return Error::noSuchFile;
@@ -219,19 +306,22 @@ public:
 	waitForEvents(struct epoll_event *events, size_t max_events,
 			async::cancellation_token cancellation) {
 		assert(max_events);
-		if(logEpoll) {
-			std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Entering wait."
-					" There are " << _pendingQueue.size() << " pending items; cancellation is "
-					<< (cancellation.is_cancellation_requested() ? "active" : "inactive")
-					<< std::endl;
-		}
+		MLOG_DEBUG(epollLog, "{}: Entering wait. There are {} pending items;"
+				" cancellation is {}", structName(), _pendingQueue.size(),
+				cancellation.is_cancellation_requested() ? "active" : "inactive");
 
 		size_t k = 0;
 		boost::intrusive::list<Item> repoll_queue;
+		// Edge-triggered items that we report are watched again once we are done;
+		// otherwise, an inline pollWait() could report them twice in the same call.
+		std::vector<std::pair<smarter::shared_ptr<Item>, uint64_t>> rearmQueue;
+		std::vector<smarter::shared_ptr<Item>> batchedItems;
 		while(true) {
 			// TODO: Stop waiting in this case.
 			assert(isOpen());
 
+			co_await _fetchBatchedStatus(batchedItems);
+
 			while(!_pendingQueue.empty()) {
 				auto item = _pendingQueue.front().self.lock();
 				_pendingQueue.pop_front();
@@ -240,64 +330,64 @@ public:
 
 				// Discard non-alive items without returning them.
 				if(!(item->state & stateActive)) {
-					if(logEpoll)
-						std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Discarding"
-								" inactive item \e[1;34m" << item->file->structName() << "\e[0m"
-								<< std::endl;
+					MLOG_DEBUG(epollLog, "{}: Discarding inactive item {}",
+							structName(), item->file->structName());
 					item->state &= ~statePending;
 					continue;
 				}
 
-				if(logEpoll)
-					std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Checking item "
-							<< "\e[1;34m" << item->file->structName() << "\e[0m" << std::endl;
-				auto result_or_error = co_await item->file->pollStatus(item->process);
-
-				// Discard closed items.
-				if(!result_or_error) {
-					assert(result_or_error.error() == Error::fileClosed);
-					if(logEpoll)
-						std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Discarding"
-								" closed item \e[1;34m" << item->file->structName() << "\e[0m"
-								<< std::endl;
-					item->state &= ~statePending;
-					continue;
-				}
+				uint64_t seq;
+				int status;
+				if(item->edgeTriggered && item->pendingEdges) {
+					seq = item->edgeSeq;
+					status = item->pendingEdges;
+				}else{
+					auto result_or_error = item->batchedStatus
+							? std::move(*item->batchedStatus)
+							: co_await item->file->pollStatus(item->process);
+					item->batchedStatus.reset();
+
+					// Discard closed items.
+					if(!result_or_error) {
+						assert(result_or_error.error() == Error::fileClosed);
+						MLOG_DEBUG(epollLog, "{}: Discarding closed item {}",
+								structName(), item->file->structName());
+						item->state &= ~statePending;
+						continue;
+					}
 
-				auto result = result_or_error.value();
-				if(logEpoll)
-					std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m:"
-							" Item \e[1;34m" << item->file->structName() << "\e[0m"
-							" mask is " << item->eventMask << ", while " << std::get<1>(result)
-							<< " is active" << std::endl;
+					std::tie(seq, status) = result_or_error.value();
+					MLOG_DEBUG(epollLog, "{}: Item {} mask is {}, while {} is active",
+							structName(), item->file->structName(), item->eventMask, status);
+					status &= item->watchedEvents();
+				}
+				item->pendingEdges = 0;
 
 				// Abort early (i.e before requeuing) if the item is not pending.
-				auto status = std::get<1>(result) & (item->eventMask | EPOLLERR | EPOLLHUP);
 				if(!status) {
 					item->state &= ~statePending;
 					if(!(item->state & statePolling)) {
 						item->state |= statePolling;
 
 						// Once an item is not pending anymore, we continue watching it.
-						item->cancelPoll.reset();
-						item->pollOperation.construct_with([&] {
-							return async::execution::connect(
-								item->file->pollWait(item->process, std::get<0>(result),
-										item->eventMask | EPOLLERR | EPOLLHUP, item->cancelPoll),
-								Receiver{item}
-							);
-						});
-						if(async::execution::start_inline(*item->pollOperation))
+						if(_startPolling(item.get(), seq))
 							_awaitPoll(item.get());
 					}
 					continue;
 				}
 
-				// We have to increment the sequence again as concurrent waiters
-				// might have seen an empty _pendingQueue.
-				// TODO: Edge-triggered watches should not be requeued here.
-				item.ctr()->increment();
-				repoll_queue.push_back(*item);
+				if(item->oneShot) {
+					item->state &= ~statePending;
+					item->disarmed = true;
+				}else if(item->edgeTriggered) {
+					item->state &= ~statePending;
+					rearmQueue.push_back({item, seq});
+				}else{
+					// We have to increment the sequence again as concurrent waiters
+					// might have seen an empty _pendingQueue.
+					item.ctr()->increment();
+					repoll_queue.push_back(*item);
+				}
 
 				assert(k < max_events);
 				memset(events + k, 0, sizeof(struct epoll_event));
@@ -318,6 +408,10 @@ public:
 			co_await _statusBell.async_wait(cancellation);
 		}
 
+		// Do not keep batched results of items that we did not report; they become stale.
+		for(auto &item : batchedItems)
+			item->batchedStatus.reset();
+
 		// Before returning, we have to reinsert the level-triggered events that we report.
 		if(!repoll_queue.empty()) {
 			_pendingQueue.splice(_pendingQueue.end(), repoll_queue);
@@ -325,9 +419,15 @@ public:
 			_statusBell.raise();
 		}
 
-		if(logEpoll)
-			std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Return from wait"
-					" with " << k << " items" << std::endl;
+		for(auto &[item, seq] : rearmQueue) {
+			if(!(item->state & stateActive) || (item->state & (statePending | statePolling)))
+				continue;
+			item->state |= statePolling;
+			if(_startPolling(item.get(), seq))
+				_awaitPoll(item.get());
+		}
+
+		MLOG_DEBUG(epollLog, "{}: Return from wait with {} items", structName(), k);
 
 		co_return k;
 	}
@@ -8,12 +8,15 @@
 #include "fs.hpp"
 #include "eventfd.hpp"
 #include "process.hpp"
+#include "shared-counter.hpp"
 #include "vfs.hpp"
 
 namespace eventfd {
 
 namespace {
 
+// The counter lives in shared memory (see posix::CounterPage); clients can access it
+// directly. Hence, the server re-reads it whenever it handles a request.
 struct OpenFile : File {
 	OpenFile(unsigned int initval, bool nonBlock)
 	: File{StructName::get("eventfd")}, _currentSeq{1}, _readableSeq{0},
@@ -35,9 +38,12 @@ struct OpenFile : File {
 			co_return Error::illegalArguments;
 
 		while (1) {
-			if (_counter) {
-				memcpy(data, &_counter, 8);
-				_counter = 0;
+			_synchronize();
+			auto value = _counter.load();
+			if (value) {
+				if (!_counter.compareExchange(value, 0))
+					continue;
+				memcpy(data, &value, 8);
 				_writeableSeq = ++_currentSeq;
 				_doorbell.raise();
 				co_return 8;
@@ -45,32 +51,41 @@ struct OpenFile : File {
 
 			if (_nonBlock)
 				co_return Error::wouldBlock;
-			else
-				co_await _doorbell.async_wait();
+			co_await _waitForChange();
 		}
 	}
 
 	async::result<frg::expected<Error, size_t>>
-	writeAll(Process *process, const void *data, size_t length) override {
-		assert(length >= 8); // TODO: return Error::illegalArguments to user instead
+	writeAll(Process *, const void *data, size_t length) override {
+		if (length < 8)
+			co_return Error::illegalArguments;
 
 		uint64_t num;
 		memcpy(&num, data, 8);
 
-		assert(num != 0xFFFFFFFFFFFFFFFF); // TODO: return Error::wouldBlock to user instead
+		if (num == 0xFFFFFFFFFFFFFFFF)
+			co_return Error::illegalArguments;
 
-		if (num && num + _counter <= _counter) {
-			if (_nonBlock)
-				assert(!"return Error::wouldBlock from eventfd::OpenFile::writeAll");
-			else
-				co_await _doorbell.async_wait(); // wait for read
-		}
+		while (1) {
+			_synchronize();
 
-		_counter += num;
+			// Clients write zero to notify us about changes of the shared counter.
+			if (!num)
+				co_return length;
 
-		_readableSeq = ++_currentSeq;
-		_doorbell.raise();
-		co_return length;
+			auto value = _counter.load();
+			if (value < 0xFFFFFFFFFFFFFFFF && num < 0xFFFFFFFFFFFFFFFF - value) {
+				if (!_counter.compareExchange(value, value + num))
+					continue;
+				_readableSeq = ++_currentSeq;
+				_doorbell.raise();
+				co_return length;
+			}
+
+			if (_nonBlock)
+				co_return Error::wouldBlock;
+			co_await _waitForChange();
+		}
 	}
 
 	async::result<frg::expected<Error, PollWaitResult>>
@@ -79,9 +94,14 @@ struct OpenFile : File {
 		(void)mask; // TODO: utilize mask.
 
 		assert(sequence <= _currentSeq);
-		while (_currentSeq == sequence &&
-				!cancellation.is_cancellation_requested())
-			co_await _doorbell.async_wait(cancellation);
+		{
+			SharedCounter::WaitGuard guard{&_counter};
+			// Clients only notify us once they see the guard; catch earlier changes.
+			_synchronize();
+			while (_currentSeq == sequence &&
+					!cancellation.is_cancellation_requested())
+				co_await _doorbell.async_wait(cancellation);
+		}
 
 		int edges = 0;
 		if (_readableSeq > sequence)
@@ -94,20 +114,49 @@ struct OpenFile : File {
 
 	async::result<frg::expected<Error, PollStatusResult>>
 	pollStatus(Process *) override {
+		_synchronize();
+		auto value = _counter.load();
+
 		int events = 0;
-		if (_counter > 0)
+		if (value > 0)
 			events |= EPOLLIN;
-		if (_counter < 0xFFFFFFFFFFFFFFFF)
+		if (value < 0xFFFFFFFFFFFFFFFE)
 			events |= EPOLLOUT;
 
 		co_return PollStatusResult(_currentSeq, events);
 	}
 
+	FutureMaybe<helix::UniqueDescriptor> accessMemory() override {
+		co_return _counter.dupMemory();
+	}
+
 	helix::BorrowedDescriptor getPassthroughLane() override {
 		return _passthrough;
 	}
 
 private:
+	// Turns changes that clients made to the shared counter into poll() edges.
+	void _synchronize() {
+		auto change = _counter.synchronize();
+		if (change > 0) {
+			_readableSeq = ++_currentSeq;
+		} else if (change < 0) {
+			_writeableSeq = ++_currentSeq;
+		} else {
+			return;
+		}
+		_doorbell.raise();
+	}
+
+	// Waits until the counter is changed, either by the server or by a client.
+	async::result<void> _waitForChange() {
+		auto sequence = _currentSeq;
+		SharedCounter::WaitGuard guard{&_counter};
+		_synchronize();
+		while (_currentSeq == sequence)
+			co_await _doorbell.async_wait();
+	}
+
 	helix::UniqueLane _passthrough;
 	async::recurring_event _doorbell;
 
@@ -115,7 +164,7 @@ private:
 	uint64_t _readableSeq;
 	uint64_t _writeableSeq;
 
-	uint64_t _counter;
+	SharedCounter _counter;
 	bool _nonBlock;
 };
 
@@ -3,7 +3,10 @@
 #include <stdint.h>
 #include <string.h>
 #include <sys/auxv.h>
+#include <algorithm>
 #include <iostream>
+#include <list>
+#include <map>
 
 #include "common.hpp"
 #include "vfs.hpp"
@@ -12,10 +15,52 @@
 
 constexpr size_t kPageSize = 0x1000;
 
-// This struct is parsed before knowing the type of executable (PIE vs. non-PIE)
-// and also before knowing the ELF's base address.
-struct ImagePreamble {
+constexpr bool logExec = false;
+
+namespace {
+
+ExecStats globalExecStats;
+
+} // anonymous namespace
+
+const ExecStats &execStats() {
+	return globalExecStats;
+}
+
+// A parsed ELF image. Segments are described relative to the base address,
+// such that the same image can be mapped into multiple processes.
+struct ElfImage {
+	struct Mapping {
+		enum class Source {
+			// Mapped copy-on-write from the file's memory.
+			file,
+			// Mapped copy-on-write from memory that was filled when the image was loaded.
+			memory,
+			// Mapped copy-on-write from the zero memory.
+			zero
+		};
+
+		Source source;
+		uintptr_t address;
+		size_t length;
+		uint64_t fileOffset = 0;
+		helix::UniqueDescriptor memory;
+		uint32_t protection;
+	};
+
+	// We treat every ET_DYN object as PIE.
 	bool isPie = false;
+
+	uintptr_t entry;
+	uintptr_t phdrAddress = 0;
+	size_t phdrEntrySize;
+	size_t phdrCount;
+
+	helix::UniqueDescriptor fileMemory;
+	std::vector<Mapping> mappings;
+
+	// Number of bytes that were read from the file (as opposed to demand paged).
+	size_t bytesRead = 0;
 };
 
 // This struct contains the image meta data with correct base address applied.
@@ -29,46 +74,63 @@ struct ImageInfo {
 	size_t phdrCount;
 };
 
-async::result<frg::expected<Error, ImagePreamble>>
-parseElfPreamble(SharedFilePtr file) {
-	ImagePreamble preamble;
-
-	// Read the elf file header and verify the signature.
-	Elf64_Ehdr ehdr;
-	FRG_CO_TRY(co_await file->seek(0, VfsSeek::absolute));
-	FRG_CO_TRY(co_await file->readExactly(nullptr, &ehdr, sizeof(Elf64_Ehdr)));
+// Reads the parts of an ELF file that are copied (instead of mapped) into the image.
+// For FSes that support image caching, this copies from a mapping of the file's memory
+// (i.e., from the FS server's page cache) instead of sending a seek() and a read()
+// request for each part; only non-resident pages need to be fetched by the FS server.
+struct ElfReader {
+	ElfReader(SharedFilePtr file)
+	: _file{std::move(file)} { }
+
+	async::result<frg::expected<Error>> init(helix::BorrowedDescriptor memory) {
+		auto link = _file->associatedLink();
+		auto node = link ? link->getTarget() : nullptr;
+		if(memory.getHandle() == kHelNullHandle || !node || !node->cachesImages())
+			co_return {};
+
+		auto stats = FRG_CO_TRY(co_await node->getStats());
+		_fileSize = stats.fileSize;
+		if(_fileSize)
+			_window = helix::Mapping{memory, 0, _fileSize, kHelMapProtRead};
+		_useWindow = true;
+		co_return {};
+	}
 
-	if(!(ehdr.e_ident[0] == 0x7F
-			&& ehdr.e_ident[1] == 'E'
-			&& ehdr.e_ident[2] == 'L'
-			&& ehdr.e_ident[3] == 'F'))
-		co_return Error::badExecutable;
-	if(ehdr.e_type != ET_EXEC && ehdr.e_type != ET_DYN)
-		co_return Error::badExecutable;
+	async::result<frg::expected<Error>> readAt(uint64_t offset, void *data, size_t length) {
+		if(!_useWindow) {
+			FRG_CO_TRY(co_await _file->seek(offset, VfsSeek::absolute));
+			FRG_CO_TRY(co_await _file->readExactly(nullptr, data, length));
+			co_return {};
+		}
 
-	// Right now we treat every ET_DYN object as PIE and unconditionally apply
-	// a non-zero base address.
-	if(ehdr.e_type == ET_DYN)
-		preamble.isPie = true;
+		if(offset > _fileSize || length > _fileSize - offset)
+			co_return Error::badExecutable;
+		memcpy(data, reinterpret_cast<char *>(_window.get()) + offset, length);
+		co_return {};
+	}
 
-	co_return preamble;
-}
+private:
+	SharedFilePtr _file;
+	bool _useWindow = false;
+	uint64_t _fileSize = 0;
+	helix::Mapping _window;
+};
 
-async::result<frg::expected<Error, ImageInfo>>
-loadElfImage(SharedFilePtr file, VmContext *vmContext, uintptr_t base) {
-	assert(!(base & (kPageSize - 1))); // Callers need to ensure this.
-	ImageInfo info;
+async::result<frg::expected<Error, std::shared_ptr<ElfImage>>>
+parseElfImage(SharedFilePtr file) {
+	auto image = std::make_shared<ElfImage>();
 
 	// Get a handle to the file's memory.
-	auto fileMemory = co_await file->accessMemory();
+	image->fileMemory = co_await file->accessMemory();
+
+	ElfReader reader{file};
+	FRG_CO_TRY(co_await reader.init(image->fileMemory));
 
 	// Read the elf file header and verify the signature.
 	Elf64_Ehdr ehdr;
-	FRG_CO_TRY(co_await file->seek(0, VfsSeek::absolute));
-	FRG_CO_TRY(co_await file->readExactly(nullptr, &ehdr, sizeof(Elf64_Ehdr)));
+	FRG_CO_TRY(co_await reader.readAt(0, &ehdr, sizeof(Elf64_Ehdr)));
+	image->bytesRead += sizeof(Elf64_Ehdr);
 
-	// Verify the ELF file again, since loadElfPreamble() is not necessarily called
-	// on every object that we load.
 	if(!(ehdr.e_ident[0] == 0x7F
 			&& ehdr.e_ident[1] == 'E'
 			&& ehdr.e_ident[2] == 'L'
@@ -77,16 +139,19 @@ loadElfImage(SharedFilePtr file, VmContext *vmContext, uintptr_t base) {
 	if(ehdr.e_type != ET_EXEC && ehdr.e_type != ET_DYN)
 		co_return Error::badExecutable;
 
-	info.entryIp = (char *)base + ehdr.e_entry;
-	info.phdrEntrySize = ehdr.e_phentsize;
-	info.phdrCount = ehdr.e_phnum;
+	image->isPie = ehdr.e_type == ET_DYN;
+	image->entry = ehdr.e_entry;
+	image->phdrEntrySize = ehdr.e_phentsize;
+	image->phdrCount = ehdr.e_phnum;
 
-	// Read the elf program headers and load them into the address space.
+	// Read the elf program headers.
 	std::vector<char> phdrBuffer;
 	phdrBuffer.resize(ehdr.e_phnum * ehdr.e_phentsize);
-	FRG_CO_TRY(co_await file->seek(ehdr.e_phoff, VfsSeek::absolute));
-	FRG_CO_TRY(co_await file->readExactly(nullptr,
+	FRG_CO_TRY(co_await reader.readAt(ehdr.e_phoff,
 			phdrBuffer.data(), ehdr.e_phnum * size_t(ehdr.e_phentsize)));
+	image->bytesRead += phdrBuffer.size();
+
+	using Source = ElfImage::Mapping::Source;
 
 	for(int i = 0; i < ehdr.e_phnum; i++) {
 		auto phdr = (Elf64_Phdr *)(phdrBuffer.data() + i * ehdr.e_phentsize);
@@ -96,7 +161,7 @@ loadElfImage(SharedFilePtr file, VmContext *vmContext, uintptr_t base) {
 				continue;
 
 			size_t misalign = phdr->p_vaddr & (kPageSize - 1);
-			uintptr_t mapAddress = base + phdr->p_vaddr - misalign;
+			uintptr_t mapAddress = phdr->p_vaddr - misalign;
 			size_t mapLength = (phdr->p_memsz + misalign + kPageSize - 1) & ~(kPageSize - 1);
 
 			// Check if we can share the segment.
@@ -114,47 +179,81 @@ loadElfImage(SharedFilePtr file, VmContext *vmContext, uintptr_t base) {
 					co_return Error::badExecutable;
 				}
 
-				// Map the segment with correct permissions into the process.
+				// Pages are faulted in from the page cache on demand.
 				if((phdr->p_flags & (PF_R | PF_W | PF_X)) == (PF_R | PF_X)) {
-					HEL_CHECK(helLoadahead(fileMemory.getHandle(), phdr->p_offset, mapLength));
-
-					co_await vmContext->mapFile(mapAddress,
-							fileMemory.dup(), file,
-							phdr->p_offset, mapLength, true,
-							kHelMapProtRead | kHelMapProtExecute);
+					image->mappings.push_back({Source::file, mapAddress, mapLength,
+							phdr->p_offset, {}, kHelMapProtRead | kHelMapProtExecute});
 				}else{
 					std::cout << "posix: Illegal combination of segment permissions" << std::endl;
 					co_return Error::badExecutable;
 				}
-			}else{
-				// Map the segment with write permission into this address space.
-				HelHandle segmentHandle;
-				HEL_CHECK(helAllocateMemory(mapLength, 0, nullptr, &segmentHandle));
-
-				void *window;
-				HEL_CHECK(helMapMemory(segmentHandle, kHelNullHandle, nullptr,
-						0, mapLength, kHelMapProtRead | kHelMapProtWrite, &window));
+			}else if((phdr->p_offset & (kPageSize - 1)) == misalign) {
+				if((phdr->p_flags & (PF_R | PF_W | PF_X)) != (PF_R | PF_W)) {
+					std::cout << "posix: Illegal combination of segment permissions" << std::endl;
+					co_return Error::badExecutable;
+				}
+				constexpr uint32_t protection = kHelMapProtRead | kHelMapProtWrite;
+
+				// The segment consists of (i) pages that are entirely backed by the file,
+				// (ii) a page that contains the end of the file data and (iii) pages that are
+				// entirely bss. (i) is mapped from the file and (iii) from the zero memory;
+				// only (ii) has to be read.
+				uintptr_t fileEnd = phdr->p_vaddr + phdr->p_filesz;
+				uintptr_t cowEnd = fileEnd & ~(kPageSize - 1);
+				uintptr_t zeroBegin = (fileEnd + kPageSize - 1) & ~(kPageSize - 1);
+				uintptr_t mapEnd = mapAddress + mapLength;
+				auto fileOffset = [&] (uintptr_t address) {
+					return phdr->p_offset + (address - phdr->p_vaddr);
+				};
+
+				if(cowEnd > mapAddress)
+					image->mappings.push_back({Source::file, mapAddress, cowEnd - mapAddress,
+							fileOffset(mapAddress), {}, protection});
+
+				if(zeroBegin != cowEnd) {
+					HelHandle pageHandle;
+					HEL_CHECK(helAllocateMemory(kPageSize, 0, nullptr, &pageHandle));
+					helix::UniqueDescriptor page{pageHandle};
+					helix::Mapping window{page, 0, kPageSize};
+
+					// If the segment starts in this page, the bytes in front of it stay zero.
+					uintptr_t readBegin = std::max(cowEnd, uintptr_t(phdr->p_vaddr));
+					memset(window.get(), 0, kPageSize);
+					FRG_CO_TRY(co_await reader.readAt(fileOffset(readBegin),
+							(char *)window.get() + (readBegin - cowEnd), fileEnd - readBegin));
+					image->bytesRead += fileEnd - readBegin;
+
+					image->mappings.push_back({Source::memory, cowEnd, kPageSize,
+							0, std::move(page), protection});
+				}
 
-				// Map the segment with correct permissions into the process.
-				if((phdr->p_flags & (PF_R | PF_W | PF_X)) == (PF_R | PF_W)) {
-					co_await vmContext->mapFile(mapAddress,
-							helix::UniqueDescriptor{segmentHandle}, file,
-							0, mapLength, true,
-							kHelMapProtRead | kHelMapProtWrite);
-				}else{
+				if(mapEnd > zeroBegin)
+					image->mappings.push_back({Source::zero, zeroBegin, mapEnd - zeroBegin,
+							0, {}, protection});
+			}else{
+				// p_offset and p_vaddr are not congruent modulo the page size,
+				// so we cannot map the file. Copy the segment instead.
+				if((phdr->p_flags & (PF_R | PF_W | PF_X)) != (PF_R | PF_W)) {
 					std::cout << "posix: Illegal combination of segment permissions" << std::endl;
 					co_return Error::badExecutable;
 				}
 
+				HelHandle segmentHandle;
+				HEL_CHECK(helAllocateMemory(mapLength, 0, nullptr, &segmentHandle));
+				helix::UniqueDescriptor segment{segmentHandle};
+				helix::Mapping window{segment, 0, mapLength};
+
 				// Read the segment contents from the file.
-				memset(window, 0, mapLength);
-				FRG_CO_TRY(co_await file->seek(phdr->p_offset, VfsSeek::absolute));
-				FRG_CO_TRY(co_await file->readExactly(nullptr,
-						(char *)window + misalign, phdr->p_filesz));
-				HEL_CHECK(helUnmapMemory(kHelNullHandle, window, mapLength));
+				memset(window.get(), 0, mapLength);
+				FRG_CO_TRY(co_await reader.readAt(phdr->p_offset,
+						(char *)window.get() + misalign, phdr->p_filesz));
+				image->bytesRead += phdr->p_filesz;
+
+				image->mappings.push_back({Source::memory, mapAddress, mapLength,
+						0, std::move(segment), kHelMapProtRead | kHelMapProtWrite});
 			}
 		}else if(phdr->p_type == PT_PHDR) {
-			info.phdrPtr = (char *)base + phdr->p_vaddr;
+			image->phdrAddress = phdr->p_vaddr;
 		}else if(phdr->p_type == PT_DYNAMIC || phdr->p_type == PT_INTERP
 				|| phdr->p_type == PT_TLS
 				|| phdr->p_type == PT_GNU_EH_FRAME || phdr->p_type == PT_GNU_STACK
@@ -166,6 +265,101 @@ loadElfImage(SharedFilePtr file, VmContext *vmContext, uintptr_t base) {
 		}
 	}
 
+	co_return image;
+}
+
+// Caches parsed images of files whose FS supports it (see FsNode::cachesImages()).
+// Mapping a cached image does not read from the file; the pages of the file and the
+// pre-filled pages of the image are shared (copy-on-write) by all processes.
+struct ImageCache {
+	static ImageCache &global() {
+		static ImageCache cache;
+		return cache;
+	}
+
+	// Adds the number of bytes that had to be read from the file to bytesRead.
+	async::result<frg::expected<Error, std::shared_ptr<ElfImage>>>
+	lookupOrParse(SharedFilePtr file, size_t &bytesRead) {
+		auto link = file->associatedLink();
+		auto node = link ? link->getTarget() : nullptr;
+		if(!node || !node->cachesImages()) {
+			auto image = FRG_CO_TRY(co_await parseElfImage(file));
+			bytesRead += image->bytesRead;
+			co_return image;
+		}
+
+		auto stats = FRG_CO_TRY(co_await node->getStats());
+		Key key{node->superblock(), stats.inodeNumber,
+				stats.mtimeSecs, stats.mtimeNanos, stats.fileSize};
+
+		if(auto it = _map.find(key); it != _map.end()) {
+			globalExecStats.imageCacheHits++;
+			_lru.splice(_lru.begin(), _lru, it->second);
+			co_return it->second->second;
+		}
+
+		globalExecStats.imageCacheMisses++;
+		auto image = FRG_CO_TRY(co_await parseElfImage(file));
+		bytesRead += image->bytesRead;
+		// Another exec() may have inserted the same image while we were parsing.
+		if(_map.find(key) == _map.end()) {
+			_lru.push_front({key, image});
+			_map.insert({key, _lru.begin()});
+			if(_lru.size() > maxImages) {
+				_map.erase(_lru.back().first);
+				_lru.pop_back();
+			}
+		}
+		co_return image;
+	}
+
+private:
+	static constexpr size_t maxImages = 32;
+
+	struct Key {
+		FsSuperblock *superblock;
+		uint64_t inode;
+		uint64_t mtimeSecs;
+		uint64_t mtimeNanos;
+		uint64_t size;
+
+		auto operator<=> (const Key &) const = default;
+	};
+
+	std::list<std::pair<Key, std::shared_ptr<ElfImage>>> _lru;
+	std::map<Key, decltype(_lru)::iterator> _map;
+};
+
+async::result<ImageInfo>
+mapElfImage(const ElfImage &image, SharedFilePtr file, VmContext *vmContext, uintptr_t base) {
+	assert(!(base & (kPageSize - 1))); // Callers need to ensure this.
+	using Source = ElfImage::Mapping::Source;
+
+	for(auto &mapping : image.mappings) {
+		switch(mapping.source) {
+		case Source::file:
+			co_await vmContext->mapFile(base + mapping.address,
+					image.fileMemory.dup(), file,
+					mapping.fileOffset, mapping.length, true, mapping.protection);
+			break;
+		case Source::memory:
+			co_await vmContext->mapFile(base + mapping.address,
+					mapping.memory.dup(), file,
+					0, mapping.length, true, mapping.protection);
+			break;
+		case Source::zero:
+			co_await vmContext->mapFile(base + mapping.address,
+					helix::UniqueDescriptor{}, nullptr,
+					0, mapping.length, true, mapping.protection);
+			break;
+		}
+	}
+
+	ImageInfo info;
+	info.entryIp = (char *)base + image.entry;
+	info.phdrPtr = (char *)base + image.phdrAddress;
+	info.phdrEntrySize = image.phdrEntrySize;
+	info.phdrCount = image.phdrCount;
 	co_return info;
 }
 
@@ -250,19 +444,24 @@ execute(ViewPath root, ViewPath workdir,
 		nRecursions++;
 	}
 
-	auto execPreamble = FRG_CO_TRY(co_await parseElfPreamble(execFile));
-	ImageInfo execInfo;
-	if(execPreamble.isPie) {
-		// Unconditionally apply a non-zero base address to PIE objects.
-		execInfo = FRG_CO_TRY(co_await loadElfImage(execFile, vmContext.get(), 0x200000));
-	}else{
-		execInfo = FRG_CO_TRY(co_await loadElfImage(execFile, vmContext.get(), 0));
-	}
+	auto &imageCache = ImageCache::global();
+	size_t bytesRead = 0;
+	auto execImage = FRG_CO_TRY(co_await imageCache.lookupOrParse(execFile, bytesRead));
+	// Unconditionally apply a non-zero base address to PIE objects.
+	auto execInfo = co_await mapElfImage(*execImage, execFile, vmContext.get(),
+			execImage->isPie ? 0x200000 : 0);
 
 	// TODO: Should we really look up the dynamic linker in the current working dir?
 	auto ldsoFile = FRG_CO_TRY(co_await open(root, workdir, "/lib/ld-init.so", self));
 	assert(ldsoFile); // If open() succeeds, it must return a non-null file.
-	auto ldsoInfo = FRG_CO_TRY(co_await loadElfImage(ldsoFile, vmContext.get(), 0x40000000));
+	auto ldsoImage = FRG_CO_TRY(co_await imageCache.lookupOrParse(ldsoFile, bytesRead));
+	auto ldsoInfo = co_await mapElfImage(*ldsoImage, ldsoFile, vmContext.get(), 0x40000000);
+
+	globalExecStats.numExecs++;
+	globalExecStats.bytesRead += bytesRead;
+	if(logExec)
+		std::cout << "posix: exec() of " << path << " read "
+				<< bytesRead << " bytes" << std::endl;
 
 	constexpr size_t stackSize = 0x200000;
 
@@ -8,6 +8,18 @@ struct ExecuteResult {
 	void *auxEnd = nullptr;
 };
 
+struct ExecStats {
+	uint64_t numExecs = 0;
+	// Bytes that were read from executables and the dynamic linker. Most of the image
+	// is demand paged and does not count towards this.
+	uint64_t bytesRead = 0;
+	// Lookups of the executable and the dynamic linker in the image cache.
+	uint64_t imageCacheHits = 0;
+	uint64_t imageCacheMisses = 0;
+};
+
+const ExecStats &execStats();
+
 async::result<frg::expected<Error, ExecuteResult>>
 execute(ViewPath root, ViewPath workdir,
 		std::string path,
@@ -1,8 +1,10 @@
 #include <sys/epoll.h>
 #include <map>
 
+#include <async/oneshot-event.hpp>
 #include <frg/std_compat.hpp>
 #include <protocols/fs/client.hpp>
+#include <protocols/fs/defs.hpp>
 #include "common.hpp"
 #include "extern_fs.hpp"
 #include "fs.bragi.hpp"
@@ -30,8 +32,16 @@ struct Superblock final : FsSuperblock {
 	std::shared_ptr<FsLink> internalizePeripheralLink(Node *parent, std::string name,
 			std::shared_ptr<Node> target);
 
+	// Returns the server's attribute generations (see protocols::fs::AttributeGenerationProvider)
+	// or nullptr if the server does not provide them. They are requested on first use.
+	async::result<const uint64_t *> attributeGenerations();
+
 private:
 	helix::UniqueLane _lane;
+
+	bool _generationsRequested = false;
+	async::oneshot_event _generationsReceived;
+	helix::Mapping _generationsMapping;
 	std::map<uint64_t, std::weak_ptr<DirectoryNode>> _activeStructural;
 	std::map<uint64_t, std::weak_ptr<Node>> _activePeripheralNodes;
 	std::map<std::tuple<uint64_t, std::string, uint64_t>, std::weak_ptr<FsLink>> _activePeripheralLinks;
@@ -39,6 +49,22 @@ private:
 
 struct Node : FsNode {
 	async::result<frg::expected<Error, FileStats>> getStats() override {
+		const uint64_t *generations = nullptr;
+		if(auto sb = static_cast<Superblock *>(superblock()); sb)
+			generations = co_await sb->attributeGenerations();
+
+		// The server changes the attributes before it increments the generation.
+		// Hence, if we race with a change, we cache stats that are already
+		// outdated but we also observe a new generation on the next call.
+		uint64_t generation = 0;
+		if(generations) {
+			generation = __atomic_load_n(
+					&generations[protocols::fs::attributeGenerationSlot(getInode())],
+					__ATOMIC_ACQUIRE);
+			if(_cachedStats && _cachedGeneration == generation)
+				co_return *_cachedStats;
+		}
+
 		helix::Offer offer;
 		helix::SendBuffer send_req;
 		helix::RecvInline recv_resp;
@@ -74,6 +100,10 @@ struct Node : FsNode {
 		stats.ctimeSecs = resp.ctime_secs();
 		stats.ctimeNanos = resp.ctime_nanos();
 
+		if(generations) {
+			_cachedStats = stats;
+			_cachedGeneration = generation;
+		}
 		co_return stats;
 	}
 
@@ -157,11 +187,27 @@ private:
 	std::weak_ptr<Node> _self;
 	uint64_t _inode;
 	helix::UniqueLane _lane;
+
+	// Result of the last NODE_GET_STATS and the attribute generation that it belongs to.
+	std::optional<FileStats> _cachedStats;
+	uint64_t _cachedGeneration = 0;
 };
 
 struct OpenFile final : File {
 private:
+	// We usually seek and read these files more than once (e.g., to load executables),
+	// hence we send requests over a pipeline instead of creating a conversation per request.
+	async::result<void> _usePipeline() {
+		if(_pipelineRequested)
+			co_return;
+		_pipelineRequested = true;
+		co_await _file.openPipeline();
+	}
+
 	async::result<frg::expected<Error, off_t>> seek(off_t offset, VfsSeek whence) override {
+		co_await _usePipeline();
+		if(whence == VfsSeek::relative)
+			co_return co_await _file.seekRelative(offset);
 		assert(whence == VfsSeek::absolute);
 		co_await _file.seekAbsolute(offset);
 		co_return offset;
@@ -170,6 +216,7 @@ private:
 	// TODO: Ensure that the process is null? Pass credentials of the thread in the request?
 	async::result<frg::expected<Error, size_t>>
 	readSome(Process *, void *data, size_t max_length) override {
+		co_await _usePipeline();
 		size_t length = co_await _file.readSome(data, max_length);
 		co_return length;
 	}
@@ -242,6 +289,7 @@ public:
 private:
 	helix::UniqueLane _control;
 	protocols::fs::File _file;
+	bool _pipelineRequested = false;
 };
 
 struct RegularNode final : Node {
@@ -250,6 +298,11 @@ private:
 		return VfsType::regular;
 	}
 
+	// Executables are usually replaced (not modified in place), which yields a new inode.
+	bool cachesImages() override {
+		return true;
+	}
+
 	async::result<frg::expected<Error, smarter::shared_ptr<File, FileHandle>>>
 	open(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
 			SemanticFlags semantic_flags) override {
@@ -330,8 +383,8 @@ private:
 	}
 
 public:
-	SymlinkNode(uint64_t inode, helix::UniqueLane lane)
-	: Node{inode, std::move(lane)} { }
+	SymlinkNode(Superblock *sb, uint64_t inode, helix::UniqueLane lane)
+	: Node{inode, std::move(lane), sb} { }
 };
 
 struct Link : FsLink {
@@ -360,6 +413,8 @@ public:
 		HEL_CHECK(send_req.error());
 		HEL_CHECK(recv_resp.error());
 
+		DentryCache::global().invalidate(_owner.get(), _name);
+
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
@@ -440,7 +495,13 @@ private:
 		return true;
 	}
 
-	async::result<frg::expected<Error, std::pair<std::shared_ptr<FsLink>, size_t>>>
+	// Lookups require a round trip to the FS server, so they are worth caching.
+	// All modifications go through this server, which invalidates the cache.
+	bool cachesLinks() override {
+		return true;
+	}
+
+	async::result<frg::expected<Error, std::pair<std::vector<std::shared_ptr<FsLink>>, size_t>>>
 	traverseLinks(std::deque<std::string> path) override {
 		managarm::fs::CntRequest req;
 		req.set_req_type(managarm::fs::CntReqType::NODE_TRAVERSE_LINKS);
@@ -461,8 +522,6 @@ private:
 		HEL_CHECK(send_req.error());
 		HEL_CHECK(recv_resp.error());
 
-		std::shared_ptr<FsLink> link = nullptr;
-
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 
@@ -480,6 +539,22 @@ private:
 		assert(resp.links_traversed());
 		assert(resp.links_traversed() <= path.size());
 
+		// The server returns the nodes on the path from this directory to the last one,
+		// i.e., "." is skipped and ".." drops the previous node. Recover their names.
+		std::vector<std::string> names;
+		for (size_t i = 0; i < resp.links_traversed(); i++) {
+			if (path[i] == ".")
+				continue;
+			if (path[i] == "..") {
+				assert(!names.empty());
+				names.pop_back();
+			} else {
+				names.push_back(path[i]);
+			}
+		}
+		assert(names.size() == resp.ids().size());
+
+		std::vector<std::shared_ptr<FsLink>> links;
 		std::shared_ptr<Node> parentNode{weakNode()};
 		for (size_t i = 0; i < resp.ids().size(); i++) {
 			auto [pull_node] = co_await helix_ng::exchangeMsgs(
@@ -491,20 +566,19 @@ private:
 
 			if (i != resp.ids().size() - 1
 					|| resp.file_type() == managarm::fs::FileType::DIRECTORY) {
-				auto child = _sb->internalizeStructural(parentNode.get(), path[i],
+				auto child = _sb->internalizeStructural(parentNode.get(), names[i],
 						resp.ids()[i], pull_node.descriptor());
-				if (i != resp.ids().size() - 1)
-					parentNode = child;
-				else
-					link = child->treeLink();
+				links.push_back(child->treeLink());
+				parentNode = child;
 			}else{
 				auto child = _sb->internalizePeripheralNode(resp.file_type(), resp.ids()[i],
 						pull_node.descriptor());
-				link = _sb->internalizePeripheralLink(parentNode.get(), path[i], std::move(child));
+				links.push_back(_sb->internalizePeripheralLink(parentNode.get(), names[i],
+						std::move(child)));
 			}
 		}
 
-		co_return std::make_pair(link, resp.links_traversed());
+		co_return std::make_pair(std::move(links), resp.links_traversed());
 	}
 
 	async::result<std::variant<Error, std::shared_ptr<FsLink>>>
@@ -526,6 +600,9 @@ private:
 		HEL_CHECK(sendReq.error());
 		HEL_CHECK(recvResp.error());
 
+		// The link changed on the server; drop it from the cache.
+		DentryCache::global().invalidate(this, name);
+
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recvResp.data(), recvResp.length());
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
@@ -563,6 +640,8 @@ private:
 		HEL_CHECK(sendTarget.error());
 		HEL_CHECK(recvResp.error());
 
+		DentryCache::global().invalidate(this, name);
+
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recvResp.data(), recvResp.length());
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
@@ -651,6 +730,8 @@ private:
 		HEL_CHECK(send_req.error());
 		HEL_CHECK(recv_resp.error());
 
+		DentryCache::global().invalidate(this, name);
+
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
@@ -689,6 +770,8 @@ private:
 		HEL_CHECK(send_req.error());
 		HEL_CHECK(recv_resp.error());
 
+		DentryCache::global().invalidate(this, name);
+
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		if(resp.error() == managarm::fs::Errors::FILE_NOT_FOUND)
@@ -714,6 +797,8 @@ private:
 		HEL_CHECK(send_req.error());
 		HEL_CHECK(recv_resp.error());
 
+		DentryCache::global().invalidate(this, name);
+
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
@@ -815,6 +900,42 @@ FutureMaybe<std::shared_ptr<FsNode>> Superblock::createRegular() {
 	}
 }
 
+async::result<const uint64_t *> Superblock::attributeGenerations() {
+	if(_generationsRequested) {
+		co_await _generationsReceived.wait();
+		co_return reinterpret_cast<const uint64_t *>(_generationsMapping.get());
+	}
+	_generationsRequested = true;
+
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::SB_GET_ATTRIBUTE_GENERATIONS);
+
+	auto ser = req.SerializeAsString();
+	auto [offer, send_req, recv_resp, pull_memory] = co_await helix_ng::exchangeMsgs(
+		_lane,
+		helix_ng::offer(
+			helix_ng::sendBuffer(ser.data(), ser.size()),
+			helix_ng::recvInline(),
+			helix_ng::pullDescriptor()
+		)
+	);
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	if(resp.error() == managarm::fs::Errors::SUCCESS) {
+		HEL_CHECK(pull_memory.error());
+		_generationsMapping = helix::Mapping{pull_memory.descriptor(), 0,
+				(protocols::fs::numAttributeGenerations * sizeof(uint64_t) + 0xFFF)
+					& ~size_t(0xFFF),
+				kHelMapProtRead};
+	}
+	_generationsReceived.raise();
+	co_return reinterpret_cast<const uint64_t *>(_generationsMapping.get());
+}
+
 FutureMaybe<std::shared_ptr<FsNode>> Superblock::createSocket() {
 	throw std::runtime_error("extern_fs: createSocket() is not supported");
 }
@@ -845,6 +966,10 @@ async::result<frg::expected<Error, std::shared_ptr<FsLink>>>
 	HEL_CHECK(send_tail.error());
 	HEL_CHECK(recv_resp.error());
 
+	auto &cache = DentryCache::global();
+	cache.invalidate(source_node, req.old_name());
+	cache.invalidate(target_node, name);
+
 	managarm::fs::SvrResponse resp;
 	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 	if(resp.error() == managarm::fs::Errors::SUCCESS) {
@@ -893,7 +1018,7 @@ std::shared_ptr<Node> Superblock::internalizePeripheralNode(int64_t type,
 		node = std::make_shared<RegularNode>(this, id, std::move(lane));
 		break;
 	case managarm::fs::FileType::SYMLINK:
-		node = std::make_shared<SymlinkNode>(id, std::move(lane));
+		node = std::make_shared<SymlinkNode>(this, id, std::move(lane));
 		break;
 	default:
 		throw std::runtime_error("extern_fs: Unexpected file type");
@@ -24,10 +24,44 @@ struct Socket : File {
 		co_return resultOrError.value();
 	}
 
+	protocols::fs::File *pollStatusClient() override {
+		return &_file;
+	}
+
 	helix::BorrowedDescriptor getPassthroughLane() override {
 		return _file.getLane();
 	}
 
+	async::result<frg::expected<Error, AcceptResult>> accept(Process *) override {
+		managarm::fs::CntRequest req;
+		req.set_req_type(managarm::fs::CntReqType::PT_ACCEPT);
+
+		auto ser = req.SerializeAsString();
+		auto [offer, send_req, recv_resp, pull_lane] = co_await helix_ng::exchangeMsgs(
+			_file.getLane(),
+			helix_ng::offer(
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::recvInline(),
+				helix_ng::pullDescriptor()
+			)
+		);
+		HEL_CHECK(offer.error());
+		HEL_CHECK(send_req.error());
+		HEL_CHECK(recv_resp.error());
+
+		managarm::fs::SvrResponse resp;
+		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+		if(resp.error() == managarm::fs::Errors::WOULD_BLOCK)
+			co_return Error::wouldBlock;
+		if(resp.error() != managarm::fs::Errors::SUCCESS)
+			co_return Error::illegalArguments;
+		HEL_CHECK(pull_lane.error());
+
+		auto file = smarter::make_shared<Socket>(pull_lane.descriptor());
+		file->setupWeakFile(file);
+		co_return File::constructHandle(file);
+	}
+
 private:
 	protocols::fs::File _file;
 };
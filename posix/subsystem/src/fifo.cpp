@@ -1,12 +1,14 @@
 
+#include <limits.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <algorithm>
 #include <iostream>
-#include <deque>
 #include <map>
 
 #include <async/recurring-event.hpp>
 #include <helix/ipc.hpp>
+#include <protocols/posix/data.hpp>
 #include "fifo.hpp"
 
 #include <experimental/coroutine>
@@ -17,32 +19,115 @@ namespace {
 
 constexpr bool logFifos = false;
 
-struct Packet {
-	// The actual octet data that the packet consists of.
-	std::vector<char> buffer;
+// Same as the default capacity of pipes on Linux.
+constexpr size_t pipeCapacity = 16 * 4096;
+
+// Ring buffer in shared memory (see posix::PipeRing), such that clients can map it.
+struct SharedRing {
+	SharedRing(size_t capacity)
+	: _capacity{capacity} {
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(posix::pipeRingDataOffset + capacity, 0, nullptr, &handle));
+		_memory = helix::UniqueDescriptor{handle};
+		_mapping = helix::Mapping{_memory, 0, posix::pipeRingDataOffset + capacity};
+		_header()->capacity = capacity;
+	}
+
+	helix::UniqueDescriptor dupMemory() {
+		return _memory.dup();
+	}
+
+	size_t size() {
+		auto header = _header();
+		return __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE)
+				- __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+	}
+
+	size_t space() {
+		return _capacity - std::min(size(), _capacity);
+	}
+
+	bool empty() {
+		return !size();
+	}
+
+	// Appends up to length bytes. Returns the number of bytes that were appended.
+	size_t write(const void *data, size_t length) {
+		auto header = _header();
+		auto n = std::min(length, space());
+		if(!n)
+			return 0;
+
+		auto tail = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+		auto ring = _data();
+		auto offset = tail % _capacity;
+		auto first = std::min(n, _capacity - offset);
+		memcpy(ring + offset, data, first);
+		memcpy(ring, static_cast<const char *>(data) + first, n - first);
+		__atomic_store_n(&header->tail, tail + n, __ATOMIC_RELEASE);
+		_bump(&header->dataFutex);
+		return n;
+	}
+
+	// Removes up to length bytes. Returns the number of bytes that were removed.
+	size_t read(void *data, size_t length) {
+		auto header = _header();
+		auto n = std::min({length, size(), _capacity});
+		if(!n)
+			return 0;
+
+		auto head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+		auto ring = _data();
+		auto offset = head % _capacity;
+		auto first = std::min(n, _capacity - offset);
+		memcpy(data, ring + offset, first);
+		memcpy(static_cast<char *>(data) + first, ring, n - first);
+		__atomic_store_n(&header->head, head + n, __ATOMIC_RELEASE);
+		_bump(&header->spaceFutex);
+		return n;
+	}
 
-	size_t offset = 0;
+private:
+	posix::PipeRing *_header() {
+		return reinterpret_cast<posix::PipeRing *>(_mapping.get());
+	}
+
+	char *_data() {
+		return reinterpret_cast<char *>(_mapping.get()) + posix::pipeRingDataOffset;
+	}
+
+	void _bump(int *futex) {
+		__atomic_fetch_add(futex, 1, __ATOMIC_RELEASE);
+		if(__atomic_load_n(&_header()->waiters, __ATOMIC_ACQUIRE))
+			HEL_CHECK(helFutexWake(futex));
+	}
+
+	// Clients can modify the header, so we do not rely on its capacity field.
+	size_t _capacity;
+	helix::UniqueDescriptor _memory;
+	helix::Mapping _mapping;
 };
 
 struct Channel {
 	Channel()
-	: writerCount{0}, readerCount{0} { }
+	: writerCount{0}, readerCount{0}, buffer{pipeCapacity} { }
 
 	// Status management for poll().
 	async::recurring_event statusBell;
-	// Start at currentSeq = 1 since the pipe is always writable.
+	// Start at currentSeq = 1 since the pipe is initially writable.
 	uint64_t currentSeq = 1;
 	uint64_t noWriterSeq = 0;
 	uint64_t noReaderSeq = 0;
 	uint64_t inSeq = 0;
+	uint64_t outSeq = 1;
 	int writerCount;
 	int readerCount;
 
 	async::recurring_event readerPresent;
 	async::recurring_event writerPresent;
 
-	// The actual queue of this pipe.
-	std::deque<Packet> packetQueue;
+	// The data of this pipe. Writers block while it is full.
+	SharedRing buffer;
 };
 
 struct ReaderFile : File {
@@ -80,7 +165,7 @@ public:
 		if(!maxLength)
 			co_return 0;
 
-		while(_channel->packetQueue.empty() && _channel->writerCount) {
+		while(_channel->buffer.empty() && _channel->writerCount) {
 			if(nonBlock_) {
 				if(logFifos)
 					std::cout << "posix: FIFO pipe would block" << std::endl;
@@ -89,19 +174,17 @@ public:
 			co_await _channel->statusBell.async_wait();
 		}
 
-		if(_channel->packetQueue.empty()) {
+		if(_channel->buffer.empty()) {
 			assert(!_channel->writerCount);
 			co_return 0;
 		}
 
-		// TODO: Truncate packets (for SOCK_DGRAM) here.
-		auto packet = &_channel->packetQueue.front();
-		size_t chunk = std::min(packet->buffer.size() - packet->offset, maxLength);
+		auto chunk = _channel->buffer.read(data, maxLength);
 		assert(chunk); // Otherwise we return above since !maxLength.
-		memcpy(data, packet->buffer.data() + packet->offset, chunk);
-		packet->offset += chunk;
-		if(packet->offset == packet->buffer.size())
-			_channel->packetQueue.pop_front();
+
+		// Wake up writers that wait for space.
+		_channel->outSeq = ++_channel->currentSeq;
+		_channel->statusBell.raise();
 		co_return chunk;
 	}
 
@@ -132,12 +215,16 @@ public:
 		int events = 0;
 		if(!_channel->writerCount)
 			events |= EPOLLHUP;
-		if(!_channel->packetQueue.empty())
+		if(!_channel->buffer.empty())
 			events |= EPOLLIN;
 
 		co_return PollStatusResult(_channel->currentSeq, events);
 	}
 
+	FutureMaybe<helix::UniqueDescriptor> accessMemory() override {
+		co_return _channel->buffer.dupMemory();
+	}
+
 	helix::BorrowedDescriptor getPassthroughLane() override {
 		return _passthrough;
 	}
@@ -180,8 +267,8 @@ public:
 				smarter::shared_ptr<File>{file}, &File::fileOperations));
 	}
 
-	WriterFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link)
-	: File{StructName::get("fifo.write"), mount, link, File::defaultPipeLikeSeek} { }
+	WriterFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link, bool nonBlock = false)
+	: File{StructName::get("fifo.write"), mount, link, File::defaultPipeLikeSeek}, nonBlock_{nonBlock} { }
 
 	void connectChannel(std::shared_ptr<Channel> channel) {
 		assert(!_channel);
@@ -201,15 +288,34 @@ public:
 
 	async::result<frg::expected<Error, size_t>>
 	writeAll(Process *process, const void *data, size_t maxLength) override {
-		Packet packet;
-		packet.buffer.resize(maxLength);
-		memcpy(packet.buffer.data(), data, maxLength);
-		packet.offset = 0;
+		size_t written = 0;
+		while(written < maxLength) {
+			if(!_channel->readerCount) {
+				if(written)
+					break;
+				co_return Error::brokenPipe;
+			}
 
-		_channel->packetQueue.push_back(std::move(packet));
-		_channel->inSeq = ++_channel->currentSeq;
-		_channel->statusBell.raise();
-		co_return maxLength;
+			// Writes of up to PIPE_BUF bytes must not be interleaved with other writes.
+			size_t needed = maxLength <= PIPE_BUF ? maxLength : 1;
+			if(_channel->buffer.space() < needed) {
+				if(nonBlock_) {
+					if(written)
+						break;
+					if(logFifos)
+						std::cout << "posix: FIFO pipe would block" << std::endl;
+					co_return Error::wouldBlock;
+				}
+				co_await _channel->statusBell.async_wait();
+				continue;
+			}
+
+			written += _channel->buffer.write(static_cast<const char *>(data) + written,
+					maxLength - written);
+			_channel->inSeq = ++_channel->currentSeq;
+			_channel->statusBell.raise();
+		}
+		co_return written;
 	}
 
 	async::result<frg::expected<Error, PollWaitResult>>
@@ -224,7 +330,9 @@ public:
 		if(cancellation.is_cancellation_requested())
 			std::cout << "\e[33mposix: fifo::poll() cancellation is untested\e[39m" << std::endl;
 
-		int edges = EPOLLOUT;
+		int edges = 0;
+		if(_channel->outSeq > pastSeq)
+			edges |= EPOLLOUT;
 		if(_channel->noReaderSeq > pastSeq)
 			edges |= EPOLLERR;
 
@@ -233,21 +341,44 @@ public:
 
 	async::result<frg::expected<Error, PollStatusResult>>
 	pollStatus(Process *) override {
-		int events = EPOLLOUT;
+		int events = 0;
+		if(_channel->buffer.space() >= PIPE_BUF)
+			events |= EPOLLOUT;
 		if(!_channel->readerCount)
 			events |= EPOLLERR;
 
 		co_return PollStatusResult(_channel->currentSeq, events);
 	}
 
+	FutureMaybe<helix::UniqueDescriptor> accessMemory() override {
+		co_return _channel->buffer.dupMemory();
+	}
+
 	helix::BorrowedDescriptor getPassthroughLane() override {
 		return _passthrough;
 	}
 
+	async::result<void> setFileFlags(int flags) override {
+		if(flags & ~O_NONBLOCK) {
+			std::cout << "posix: setFileFlags on fifo \e[1;34m" << structName() << "\e[0m called with unknown flags" << std::endl;
+			co_return;
+		}
+		nonBlock_ = flags & O_NONBLOCK;
+		co_return;
+	}
+
+	async::result<int> getFileFlags() override {
+		if(nonBlock_)
+			co_return O_NONBLOCK;
+		co_return 0;
+	}
+
 private:
 	helix::UniqueLane _passthrough;
 
 	std::shared_ptr<Channel> _channel;
+
+	bool nonBlock_;
 };
 
 } // anonymous namespace
@@ -275,7 +406,7 @@ openNamedChannel(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
 	if (flags & semanticRead) {
 		assert(!(flags & semanticWrite));
 
-		auto r_file = smarter::make_shared<ReaderFile>(mount, link);
+		auto r_file = smarter::make_shared<ReaderFile>(mount, link, flags & semanticNonBlock);
 		r_file->setupWeakFile(r_file);
 		r_file->connectChannel(channel);
 
@@ -290,7 +421,7 @@ openNamedChannel(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
 		assert(flags & semanticWrite);
 		assert(!(flags & semanticRead));
 
-		auto w_file = smarter::make_shared<WriterFile>(mount, link);
+		auto w_file = smarter::make_shared<WriterFile>(mount, link, flags & semanticNonBlock);
 		w_file->setupWeakFile(w_file);
 		w_file->connectChannel(channel);
 
@@ -308,7 +439,7 @@ std::array<smarter::shared_ptr<File, FileHandle>, 2> createPair(bool nonBlock) {
 	auto link = SpecialLink::makeSpecialLink(VfsType::fifo, 0777);
 	auto channel = std::make_shared<Channel>();
 	auto r_file = smarter::make_shared<ReaderFile>(nullptr, link, nonBlock);
-	auto w_file = smarter::make_shared<WriterFile>(nullptr, link);
+	auto w_file = smarter::make_shared<WriterFile>(nullptr, link, nonBlock);
 	r_file->setupWeakFile(r_file);
 	w_file->setupWeakFile(w_file);
 	r_file->connectChannel(channel);
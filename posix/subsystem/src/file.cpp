@@ -6,6 +6,7 @@
 #include <helix/ipc.hpp>
 #include "file.hpp"
 #include "process.hpp"
+#include "workers.hpp"
 #include "fs.bragi.hpp"
 
 namespace {
@@ -84,6 +85,10 @@ async::result<frg::expected<protocols::fs::Error, size_t>> File::ptWrite(void *o
 		switch(result.error()) {
 		case Error::noSpaceLeft:
 			co_return protocols::fs::Error::noSpaceLeft;
+		case Error::wouldBlock:
+			co_return protocols::fs::Error::wouldBlock;
+		case Error::brokenPipe:
+			co_return protocols::fs::Error::brokenPipe;
 		default:
 			assert(!"Unexpected error from writeAll()");
 			__builtin_unreachable();
@@ -92,6 +97,41 @@ async::result<frg::expected<protocols::fs::Error, size_t>> File::ptWrite(void *o
 	co_return result.value();
 }
 
+async::result<frg::expected<protocols::fs::Error, size_t>>
+File::ptStatelessRead(void *object, const char *, void *buffer, size_t length) {
+	auto self = static_cast<File *>(object);
+	auto result = co_await self->readSome(nullptr, buffer, length);
+	if(!result) {
+		assert(result.error() == Error::illegalOperationTarget);
+		co_return protocols::fs::Error::illegalArguments;
+	}
+	co_return result.value();
+}
+
+async::result<frg::expected<protocols::fs::Error, size_t>>
+File::ptStatelessWrite(void *object, const char *, const void *buffer, size_t length) {
+	auto self = static_cast<File *>(object);
+	auto result = co_await self->writeAll(nullptr, buffer, length);
+	if(!result) {
+		assert(result.error() == Error::noSpaceLeft);
+		co_return protocols::fs::Error::noSpaceLeft;
+	}
+	co_return result.value();
+}
+
+void File::serveStateless(smarter::shared_ptr<File> file, helix::UniqueLane lane) {
+	pickStatelessWorker().post([file = std::move(file), lane = std::move(lane)] () mutable {
+		async::detach([] (smarter::shared_ptr<File> file,
+				helix::UniqueLane lane) -> async::result<void> {
+			co_await protocols::fs::servePassthrough(std::move(lane), file,
+					&statelessFileOperations);
+
+			// ~File() touches global state; drop our reference on the main thread.
+			mainWorker().post([file = std::move(file)] { });
+		}(std::move(file), std::move(lane)));
+	});
+}
+
 async::result<ReadEntriesResult> File::ptReadEntries(void *object) {
 	auto self = static_cast<File *>(object);
 	return self->readEntries();
@@ -108,6 +148,11 @@ async::result<void> File::ptAllocate(void *object,
 	return self->allocate(offset, size);
 }
 
+async::result<frg::expected<protocols::fs::Error>> File::ptSync(void *object) {
+	auto self = static_cast<File *>(object);
+	return self->sync();
+}
+
 async::result<int> File::ptGetOption(void *object, int option) {
 	auto self = static_cast<File *>(object);
 	return self->getOption(option);
@@ -159,6 +204,16 @@ async::result<void> File::ptSetFileFlags(void *object, int flags) {
 	return self->setFileFlags(flags);
 }
 
+async::result<frg::expected<protocols::fs::Error>> File::ptAddSeals(void *object, int seals) {
+	auto self = static_cast<File *>(object);
+	return self->addSeals(seals);
+}
+
+async::result<frg::expected<protocols::fs::Error, int>> File::ptGetSeals(void *object) {
+	auto self = static_cast<File *>(object);
+	return self->getSeals();
+}
+
 async::result<frg::expected<protocols::fs::Error, size_t>> File::ptPeername(void *object, void *addr_ptr, size_t max_addr_length) {
 	auto self = static_cast<File *>(object);
 	return self->peername(addr_ptr, max_addr_length);
@@ -284,6 +339,10 @@ async::result<void> File::allocate(int64_t, size_t) {
 	throw std::runtime_error("posix: Object has no File::allocate()");
 }
 
+async::result<frg::expected<protocols::fs::Error>> File::sync() {
+	co_return {};
+}
+
 async::result<frg::expected<Error, off_t>> File::seek(off_t, VfsSeek) {
 	if(_defaultOps & defaultPipeLikeSeek) {
 		co_return Error::seekOnPipe;
@@ -328,6 +387,10 @@ async::result<frg::expected<Error, PollStatusResult>> File::pollStatus(Process *
 	co_return PollStatusResult{std::get<0>(result), std::get<2>(result)};
 }
 
+protocols::fs::File *File::pollStatusClient() {
+	return nullptr;
+}
+
 async::result<int> File::getOption(int) {
 	std::cout << "posix \e[1;34m" << structName()
 			<< "\e[0m: Object does not implement getOption()" << std::endl;
@@ -398,6 +461,14 @@ async::result<void> File::setFileFlags(int flags) {
 	co_return;
 }
 
+async::result<frg::expected<protocols::fs::Error>> File::addSeals(int) {
+	co_return protocols::fs::Error::illegalOperationTarget;
+}
+
+async::result<frg::expected<protocols::fs::Error, int>> File::getSeals() {
+	co_return protocols::fs::Error::illegalOperationTarget;
+}
+
 async::result<frg::expected<protocols::fs::Error, size_t>> File::peername(void *addr_ptr, size_t max_addr_length) {
 	std::cout << "posix \e[1;34m" << structName()
 			<< "\e[0m: Object does not implement getPeerName()" << std::endl;
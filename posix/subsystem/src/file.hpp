@@ -8,6 +8,7 @@
 #include <boost/intrusive/rbtree.hpp>
 #include <frg/expected.hpp>
 #include <hel.h>
+#include <protocols/fs/client.hpp>
 #include <protocols/fs/server.hpp>
 #include "common.hpp"
 
@@ -124,6 +125,9 @@ public:
 	static async::result<void>
 	ptAllocate(void *object, int64_t offset, size_t size);
 
+	static async::result<frg::expected<protocols::fs::Error>>
+	ptSync(void *object);
+
 	static async::result<int>
 	ptGetOption(void *object, int option);
 
@@ -151,6 +155,12 @@ public:
 	static async::result<void>
 	ptSetFileFlags(void *object, int flags);
 
+	static async::result<frg::expected<protocols::fs::Error>>
+	ptAddSeals(void *object, int seals);
+
+	static async::result<frg::expected<protocols::fs::Error, int>>
+	ptGetSeals(void *object);
+
 	static async::result<protocols::fs::RecvResult>
 	ptRecvMsg(void *object, const char *creds, uint32_t flags,
 			void *data, size_t len,
@@ -179,6 +189,7 @@ public:
 		.readEntries = &ptReadEntries,
 		.truncate = &ptTruncate,
 		.fallocate = &ptAllocate,
+		.sync = &ptSync,
 		.ioctl = &ptIoctl,
 		.getOption = &ptGetOption,
 		.setOption = &ptSetOption,
@@ -188,11 +199,34 @@ public:
 		.sockname = &ptSockname,
 		.getFileFlags = &ptGetFileFlags,
 		.setFileFlags = &ptSetFileFlags,
+		.addSeals = &ptAddSeals,
+		.getSeals = &ptGetSeals,
 		.recvMsg = &ptRecvMsg,
 		.sendMsg = &ptSendMsg,
 		.peername = &ptPeername,
 	};
 
+	static async::result<frg::expected<protocols::fs::Error, size_t>>
+	ptStatelessRead(void *object, const char *credentials, void *buffer, size_t length);
+
+	static async::result<frg::expected<protocols::fs::Error, size_t>>
+	ptStatelessWrite(void *object, const char *credentials, const void *buffer, size_t length);
+
+	// Operations for files whose readSome(), writeAll() and seek() neither access global
+	// state nor the calling Process (which is passed as nullptr). Such files can be
+	// served on any worker thread (see serveStateless()).
+	static constexpr auto statelessFileOperations = protocols::fs::FileOperations{
+		.seekAbs = &ptSeekAbs,
+		.seekRel = &ptSeekRel,
+		.seekEof = &ptSeekEof,
+		.read = &ptStatelessRead,
+		.write = &ptStatelessWrite,
+	};
+
+	// Serves the passthrough lane of a file with statelessFileOperations
+	// on a worker thread other than the main one.
+	static void serveStateless(smarter::shared_ptr<File> file, helix::UniqueLane lane);
+
 	// ------------------------------------------------------------------------
 	// Public File API.
 	// ------------------------------------------------------------------------
@@ -286,6 +320,10 @@ public:
 
 	virtual async::result<void> allocate(int64_t offset, size_t size);
 
+	// Writes the file back to stable storage. Files that are served by the posix
+	// subsystem itself live in memory, hence the default does nothing.
+	virtual async::result<frg::expected<protocols::fs::Error>> sync();
+
 	// poll() uses a sequence number mechansim for synchronization.
 	// Before returning, it waits until current-sequence > in-sequence.
 	// Returns (current-sequence, edges since in-sequence, current events).
@@ -304,6 +342,10 @@ public:
 	// Returns (current-sequence, active events).
 	virtual async::result<frg::expected<Error, PollStatusResult>> pollStatus(Process *);
 
+	// Returns the client-side file if pollStatus() is forwarded to an external server.
+	// epoll uses this to query files of the same server with a single request.
+	virtual protocols::fs::File *pollStatusClient();
+
 	virtual async::result<int> getOption(int option);
 	virtual async::result<void> setOption(int option, int value);
 
@@ -327,6 +369,11 @@ public:
 	virtual async::result<int> getFileFlags();
 	virtual async::result<void> setFileFlags(int flags);
 
+	// Seals are managarm::fs::FileSeals flags. Files that do not support sealing
+	// fail with illegalOperationTarget (i.e., EINVAL).
+	virtual async::result<frg::expected<protocols::fs::Error>> addSeals(int seals);
+	virtual async::result<frg::expected<protocols::fs::Error, int>> getSeals();
+
 	virtual async::result<frg::expected<protocols::fs::Error, size_t>> peername(void *addr_ptr, size_t max_addr_length);
 
 	virtual helix::BorrowedDescriptor getPassthroughLane() = 0;
@@ -105,10 +105,18 @@ bool FsNode::hasTraverseLinks() {
 	return false;
 }
 
-async::result<frg::expected<Error, std::pair<std::shared_ptr<FsLink>, size_t>>> FsNode::traverseLinks(std::deque<std::string>) {
+async::result<frg::expected<Error, std::pair<std::vector<std::shared_ptr<FsLink>>, size_t>>> FsNode::traverseLinks(std::deque<std::string>) {
 	throw std::runtime_error("traverseLinks() is not implemented for this FsNode");
 }
 
+bool FsNode::cachesLinks() {
+	return false;
+}
+
+bool FsNode::cachesImages() {
+	return false;
+}
+
 async::result<Error> FsNode::chmod(int mode) {
 	std::cout << "\e[31m" "posix: chmod() is not implemented for this FsNode" "\e[39m" << std::endl;
 	co_return Error::accessDenied;
@@ -132,3 +140,81 @@ void FsNode::notifyObservers(uint32_t events, const std::string &name, uint32_t
 	}
 }
 
+
+// --------------------------------------------------------
+// DentryCache implementation.
+// --------------------------------------------------------
+
+namespace {
+
+constexpr bool logDentryCache = false;
+
+// Maximal number of entries in the global DentryCache.
+constexpr size_t dentryCacheBudget = 4096;
+
+} // anonymous namespace
+
+DentryCache &DentryCache::global() {
+	static DentryCache cache{dentryCacheBudget};
+	return cache;
+}
+
+std::optional<std::shared_ptr<FsLink>> DentryCache::lookup(FsNode *directory,
+		const std::string &name) {
+	auto it = _map.find(Key{directory, name});
+	if(it == _map.end()) {
+		_stats.misses++;
+		return std::nullopt;
+	}
+
+	_lru.splice(_lru.begin(), _lru, it->second);
+	if(it->second->link) {
+		_stats.hits++;
+	}else{
+		_stats.negativeHits++;
+	}
+
+	if(logDentryCache) {
+		auto lookups = _stats.hits + _stats.negativeHits + _stats.misses;
+		if(!(lookups % 1024))
+			std::cout << "posix: Dentry cache: " << _stats.hits << " hits, "
+					<< _stats.negativeHits << " negative hits, "
+					<< _stats.misses << " misses, " << _stats.evictions << " evictions, "
+					<< _stats.invalidations << " invalidations" << std::endl;
+	}
+	return it->second->link;
+}
+
+void DentryCache::insert(std::shared_ptr<FsNode> directory, std::string name,
+		std::shared_ptr<FsLink> link, uint64_t generation) {
+	if(generation != _generation)
+		return;
+
+	Key key{directory.get(), std::move(name)};
+	if(auto it = _map.find(key); it != _map.end()) {
+		it->second->link = std::move(link);
+		_lru.splice(_lru.begin(), _lru, it->second);
+		return;
+	}
+
+	if(_map.size() >= _budget) {
+		_map.erase(_lru.back().key);
+		_lru.pop_back();
+		_stats.evictions++;
+	}
+
+	_lru.push_front(Entry{key, std::move(directory), std::move(link)});
+	_map.emplace(std::move(key), _lru.begin());
+}
+
+void DentryCache::invalidate(FsNode *directory, const std::string &name) {
+	// Also bump the generation if there is no entry, as a lookup may be in flight.
+	_generation++;
+	auto it = _map.find(Key{directory, name});
+	if(it == _map.end())
+		return;
+
+	_lru.erase(it->second);
+	_map.erase(it);
+	_stats.invalidations++;
+}
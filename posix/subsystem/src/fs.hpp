@@ -1,9 +1,12 @@
 #pragma once
 
 #include <iostream>
+#include <list>
+#include <optional>
 #include <set>
 #include <deque>
 #include <unordered_map>
+#include <vector>
 
 #include <async/result.hpp>
 #include <boost/intrusive/rbtree.hpp>
@@ -170,9 +173,19 @@ public:
 	// Creates an socket
 	virtual async::result<frg::expected<Error, std::shared_ptr<FsLink>>> mksocket(std::string name);
 
-	// Recursive path traversal
+	// Recursive path traversal. Returns the links from this node to the last node that was
+	// reached (empty if ".." led back to this node) and the number of consumed components.
+	// Traversal stops early at symlinks and mount points.
 	virtual bool hasTraverseLinks();
-	virtual async::result<frg::expected<Error, std::pair<std::shared_ptr<FsLink>, size_t>>> traverseLinks(std::deque<std::string> path);
+	virtual async::result<frg::expected<Error, std::pair<std::vector<std::shared_ptr<FsLink>>, size_t>>> traverseLinks(std::deque<std::string> path);
+
+	// If true, path resolution caches the links of this directory in the DentryCache.
+	// The FS must then invalidate the cache whenever a link of this directory changes.
+	virtual bool cachesLinks();
+
+	// If true, exec() may cache the parsed ELF image of this file, keyed by its inode
+	// number, mtime and size. The FS must change one of them if the file is modified.
+	virtual bool cachesImages();
 
 protected:
 	void notifyObservers(uint32_t inotifyEvents, const std::string &name, uint32_t cookie);
@@ -185,6 +198,73 @@ private:
 	std::unordered_map<FsObserver *, std::shared_ptr<FsObserver>> _observers;
 };
 
+// ----------------------------------------------------------------------------
+// DentryCache class.
+// ----------------------------------------------------------------------------
+
+// Caches the results of directory lookups, keyed by (directory, name).
+// This includes negative entries for names that do not exist.
+// The least recently used entries are evicted once the cache is full.
+struct DentryCache {
+	struct Stats {
+		uint64_t hits = 0;
+		uint64_t negativeHits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		uint64_t invalidations = 0;
+	};
+
+	static DentryCache &global();
+
+	DentryCache(size_t budget)
+	: _budget{budget} { }
+
+	// Returns std::nullopt on a miss. On a hit, returns the cached link;
+	// nullptr represents a negative entry.
+	std::optional<std::shared_ptr<FsLink>> lookup(FsNode *directory, const std::string &name);
+
+	// Lookups should obtain the generation before they start; if the cache was
+	// invalidated in the meantime, the result of the lookup is not inserted.
+	uint64_t generation() {
+		return _generation;
+	}
+
+	// Inserts a positive (link != nullptr) or negative entry.
+	void insert(std::shared_ptr<FsNode> directory, std::string name,
+			std::shared_ptr<FsLink> link, uint64_t generation);
+
+	// Must be called whenever (directory, name) is created, removed or replaced.
+	void invalidate(FsNode *directory, const std::string &name);
+
+	const Stats &stats() {
+		return _stats;
+	}
+
+private:
+	using Key = std::pair<FsNode *, std::string>;
+
+	struct KeyHash {
+		size_t operator() (const Key &key) const {
+			return std::hash<FsNode *>{}(key.first) ^ std::hash<std::string>{}(key.second);
+		}
+	};
+
+	struct Entry {
+		Key key;
+		// Keeps the directory alive so that its address is not reused.
+		std::shared_ptr<FsNode> directory;
+		std::shared_ptr<FsLink> link;
+	};
+
+	size_t _budget;
+	uint64_t _generation = 0;
+	Stats _stats;
+
+	// Ordered from most recently used to least recently used.
+	std::list<Entry> _lru;
+	std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> _map;
+};
+
 // ----------------------------------------------------------------------------
 // SpecialLink class.
 // ----------------------------------------------------------------------------
@@ -2,6 +2,7 @@
 #include <sys/epoll.h>
 #include <sys/inotify.h>
 #include <iostream>
+#include <unordered_map>
 
 #include <async/recurring-event.hpp>
 #include <helix/ipc.hpp>
@@ -14,6 +15,9 @@ namespace inotify {
 
 namespace {
 
+// Linux' default for /proc/sys/fs/inotify/max_queued_events.
+constexpr size_t maxQueuedEvents = 16384;
+
 struct OpenFile : File {
 public:
 	struct Packet {
@@ -21,6 +25,12 @@ public:
 		uint32_t events;
 		std::string name;
 		uint32_t cookie;
+
+		size_t size() const {
+			return sizeof(inotify_event) + name.size() + 1;
+		}
+
+		bool operator== (const Packet &other) const = default;
 	};
 
 	struct Watch final : FsObserver {
@@ -34,9 +44,7 @@ public:
 				inotifyEvents |= IN_DELETE;
 			if(!(inotifyEvents & mask))
 				return;
-			file->_queue.push_back(Packet{descriptor, inotifyEvents & mask, name, cookie});
-			file->_inSeq = ++file->_currentSeq;
-			file->_statusBell.raise();
+			file->_postEvent(Packet{descriptor, inotifyEvents & mask, name, cookie});
 		}
 
 		OpenFile *file;
@@ -55,30 +63,40 @@ public:
 	: File{StructName::get("inotify")} { }
 
 	~OpenFile() {
-		// TODO: Properly keep track of watches.
-		std::cout << "\e[31m" "posix: Destruction of inotify leaks watches" "\e[39m" << std::endl;
+		// Watches point back to this file, hence they must not outlive it.
+		for(auto &[node, entry] : _watches) {
+			if(auto target = entry.node.lock(); target)
+				target->removeObserver(entry.watch.get());
+		}
 	}
 
 	async::result<frg::expected<Error, size_t>>
 	readSome(Process *, void *data, size_t maxLength) override {
-		// TODO: As an optimization, we could return multiple events at the same time.
-		Packet packet = std::move(_queue.front());
-		_queue.pop_front();
+		while(_queue.empty())
+			co_await _statusBell.async_wait();
 
-		if(maxLength < sizeof(inotify_event) + packet.name.size() + 1)
+		if(maxLength < _queue.front().size())
 			co_return Error::illegalArguments;
 
-		inotify_event e;
-		memset(&e, 0, sizeof(inotify_event));
-		e.wd = packet.descriptor;
-		e.mask = packet.events;
-		e.cookie = packet.cookie;
-		e.len = packet.name.size();
-
-		memcpy(data, &e, sizeof(inotify_event));
-		memcpy(reinterpret_cast<char *>(data) + sizeof(inotify_event),
-				packet.name.c_str(), packet.name.size() + 1);
-		co_return sizeof(inotify_event) + packet.name.size() + 1;
+		// Return as many events as fit into the buffer.
+		size_t progress = 0;
+		while(!_queue.empty() && progress + _queue.front().size() <= maxLength) {
+			Packet packet = std::move(_queue.front());
+			_queue.pop_front();
+
+			inotify_event e;
+			memset(&e, 0, sizeof(inotify_event));
+			e.wd = packet.descriptor;
+			e.mask = packet.events;
+			e.cookie = packet.cookie;
+			e.len = packet.name.size() + 1;
+
+			auto p = reinterpret_cast<char *>(data) + progress;
+			memcpy(p, &e, sizeof(inotify_event));
+			memcpy(p + sizeof(inotify_event), packet.name.c_str(), packet.name.size() + 1);
+			progress += packet.size();
+		}
+		co_return progress;
 	}
 
 	async::result<frg::expected<Error, PollWaitResult>>
@@ -113,21 +131,55 @@ public:
 	}
 
 	int addWatch(std::shared_ptr<FsNode> node, uint32_t mask) {
-		// TODO: Coalesce watch descriptors for the same inode.
 		if(mask & ~(IN_DELETE))
 			std::cout << "posix: inotify mask " << mask << " is partially ignored" << std::endl;
+
+		// As on Linux, watching the same node again updates the existing watch.
+		if(auto it = _watches.find(node.get()); it != _watches.end()) {
+			if(it->second.node.lock() == node) {
+				it->second.watch->mask = mask;
+				return it->second.watch->descriptor;
+			}
+			// The node was destroyed and its address was reused.
+			_watches.erase(it);
+		}
+
 		auto descriptor = _nextDescriptor++;
 		auto watch = std::make_shared<Watch>(this, descriptor, mask);
 		node->addObserver(watch);
+		_watches.insert({node.get(), WatchEntry{node, std::move(watch)}});
 		return descriptor;
 	}
 
 private:
+	struct WatchEntry {
+		std::weak_ptr<FsNode> node;
+		std::shared_ptr<Watch> watch;
+	};
+
+	void _postEvent(Packet packet) {
+		// Like Linux, merge an event with the last queued event if they are identical.
+		if(!_queue.empty() && _queue.back() == packet)
+			return;
+
+		if(_queue.size() >= maxQueuedEvents) {
+			// The overflow event itself is allowed to exceed the limit.
+			if(_queue.back().events == IN_Q_OVERFLOW)
+				return;
+			packet = Packet{-1, IN_Q_OVERFLOW, {}, 0};
+		}
+
+		_queue.push_back(std::move(packet));
+		_inSeq = ++_currentSeq;
+		_statusBell.raise();
+	}
+
 	helix::UniqueLane _passthrough;
 	std::deque<Packet> _queue;
 
 	// TODO: Use a proper ID allocator to allocate watch descriptor IDs.
 	int _nextDescriptor = 1;
+	std::unordered_map<FsNode *, WatchEntry> _watches;
 
 	async::recurring_event _statusBell;
 	uint64_t _currentSeq = 1;
@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/auxv.h>
 #include <sys/mman.h>
 #include <sys/poll.h>
@@ -11,12 +12,20 @@
 #include <sys/timerfd.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <algorithm>
+#include <array>
 #include <iomanip>
 #include <iostream>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
 
 #include <async/algorithm.hpp>
 #include <async/oneshot-event.hpp>
+#include <async/recurring-event.hpp>
 #include <protocols/mbus/client.hpp>
+#include <protocols/ostrace/ostrace.hpp>
 #include <helix/timer.hpp>
 
 #include "net.hpp"
@@ -25,6 +34,7 @@
 #include "device.hpp"
 #include "drvcore.hpp"
 #include "nl-socket.hpp"
+#include "nl-stats.hpp"
 #include "vfs.hpp"
 #include "process.hpp"
 #include "epoll.hpp"
@@ -40,8 +50,11 @@
 #include "fifo.hpp"
 #include "gdbserver.hpp"
 #include "inotify.hpp"
+#include "memfd.hpp"
 #include "procfs.hpp"
 #include "pts.hpp"
+#include "workers.hpp"
+#include "request-stats.hpp"
 #include "signalfd.hpp"
 #include "subsystem/block.hpp"
 #include "subsystem/drm.hpp"
@@ -66,8 +79,15 @@ namespace {
 	constexpr bool logCleanup = false;
 
 	constexpr bool debugFaults = false;
+
+	// Only stateless files are served on additional workers; there is little
+	// point in having many of them.
+	constexpr unsigned int maxWorkers = 4;
 }
 
+// Protects globalCredentialsMap. Lookups can happen on any worker thread.
+std::shared_mutex globalCredentialsMutex;
+
 std::map<
 	std::array<char, 16>,
 	std::shared_ptr<Process>
@@ -76,6 +96,7 @@ std::map<
 std::shared_ptr<Process> findProcessWithCredentials(const char *credentials) {
 	std::array<char, 16> creds;
 	memcpy(creds.data(), credentials, 16);
+	std::shared_lock lock{globalCredentialsMutex};
 	return globalCredentialsMap.at(creds);
 }
 
@@ -166,6 +187,27 @@ void dumpRegisters(std::shared_ptr<Process> proc) {
 	}
 }
 
+// Names of the supercalls for the latency statistics.
+const char *superCallName(unsigned int observation) {
+	switch(observation) {
+	case kHelObserveSuperCall + 1: return "GET_PROCESS_DATA";
+	case kHelObserveSuperCall + 2: return "FORK";
+	case kHelObserveSuperCall + 3: return "EXECVE";
+	case kHelObserveSuperCall + 4: return "EXIT";
+	case kHelObserveSuperCall + 5: return "SIG_KILL";
+	case kHelObserveSuperCall + 6: return "SIG_RESTORE";
+	case kHelObserveSuperCall + 7: return "SIG_MASK";
+	case kHelObserveSuperCall + 8: return "SIG_RAISE";
+	case kHelObserveSuperCall + 9: return "CLONE";
+	case kHelObserveSuperCall + 10: return "ANON_ALLOCATE";
+	case kHelObserveSuperCall + 11: return "ANON_FREE";
+	case kHelObserveSuperCall + 12: return "SIGALTSTACK";
+	case kHelObserveSuperCall + 13: return "SIGSUSPEND";
+	case kHelObserveSuperCall + 14: return "VFORK";
+	default: return nullptr;
+	}
+}
+
 async::result<void> observeThread(std::shared_ptr<Process> self,
 		std::shared_ptr<Generation> generation) {
 	auto thread = self->threadDescriptor();
@@ -189,6 +231,10 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 		HEL_CHECK(observe.error());
 		sequence = observe.sequence();
 
+		std::optional<RequestTimer> timer;
+		if(auto name = superCallName(observe.observation()); name)
+			timer.emplace(requestHistogram("supercall", name));
+
 		if(observe.observation() == kHelObserveSuperCall + 10) {
 			uintptr_t gprs[kHelNumGprs];
 			HEL_CHECK(helLoadRegisters(thread.getHandle(), kHelRegsGeneral, &gprs));
@@ -218,7 +264,8 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 				self->fileContext()->clientMbusLane(),
 				self->clientThreadPage(),
 				static_cast<HelHandle *>(self->clientFileTable()),
-				self->clientClkTrackerPage()
+				self->clientClkTrackerPage(),
+				self->clientIdentityPage()
 			};
 
 			if(logRequests)
@@ -376,11 +423,12 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 			HEL_CHECK(helStoreRegisters(thread.getHandle(), kHelRegsGeneral, &gprs));
 
 			bool killed = false;
-			if(self->checkOrRequestSignalRaise()) {
+			if(self->signalContext()->hasPendingSignal(~self->signalMask())
+					&& self->checkOrRequestSignalRaise()) {
 				auto active = co_await self->signalContext()->fetchSignal(
 						~self->signalMask(), true);
 				if(active) {
-					co_await self->signalContext()->raiseContext(active, self.get(), killed);
+					co_await self->signalContext()->raiseContext(*active, self.get(), killed);
 				}
 			}
 			if(killed)
@@ -403,7 +451,7 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 			bool killed = false;
 			auto active = co_await self->signalContext()->fetchSignal(~self->signalMask(), true);
 			if(active)
-				co_await self->signalContext()->raiseContext(active, self.get(), killed);
+				co_await self->signalContext()->raiseContext(*active, self.get(), killed);
 			if(killed)
 				break;
 			HEL_CHECK(helResume(thread.getHandle()));
@@ -448,11 +496,12 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 
 			// If the process signalled itself, we should process the signal before resuming.
 			bool killed = false;
-			if(self->checkOrRequestSignalRaise()) {
+			if(self->signalContext()->hasPendingSignal(~self->signalMask())
+					&& self->checkOrRequestSignalRaise()) {
 				auto active = co_await self->signalContext()->fetchSignal(
 						~self->signalMask(), true);
 				if(active)
-					co_await self->signalContext()->raiseContext(active, self.get(), killed);
+					co_await self->signalContext()->raiseContext(*active, self.get(), killed);
 			}
 			if(killed)
 				break;
@@ -526,14 +575,41 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 			gprs[kHelRegError] = 0;
 			HEL_CHECK(helStoreRegisters(thread.getHandle(), kHelRegsGeneral, &gprs));
 			HEL_CHECK(helResume(thread.getHandle()));
+		}else if(observe.observation() == kHelObserveSuperCall + 14) {
+			if(logRequests)
+				std::cout << "posix: vfork supercall" << std::endl;
+			auto child = Process::vfork(self);
+
+			// The child runs on the parent's stack, so copy all registers.
+			auto new_thread = child->threadDescriptor().getHandle();
+			uintptr_t pcrs[2], gprs[kHelNumGprs], thrs[2];
+			HEL_CHECK(helLoadRegisters(thread.getHandle(), kHelRegsProgram, &pcrs));
+			HEL_CHECK(helLoadRegisters(thread.getHandle(), kHelRegsGeneral, &gprs));
+			HEL_CHECK(helLoadRegisters(thread.getHandle(), kHelRegsThread, &thrs));
+
+			HEL_CHECK(helStoreRegisters(new_thread, kHelRegsProgram, &pcrs));
+			HEL_CHECK(helStoreRegisters(new_thread, kHelRegsThread, &thrs));
+
+			gprs[kHelRegError] = kHelErrNone;
+			gprs[kHelRegOut0] = 0;
+			HEL_CHECK(helStoreRegisters(new_thread, kHelRegsGeneral, &gprs));
+			HEL_CHECK(helResume(new_thread));
+
+			// The parent stays suspended while the child uses its address space.
+			co_await child->vforkDone();
+
+			gprs[kHelRegOut0] = child->pid();
+			HEL_CHECK(helStoreRegisters(thread.getHandle(), kHelRegsGeneral, &gprs));
+			HEL_CHECK(helResume(thread.getHandle()));
 		}else if(observe.observation() == kHelObserveInterrupt) {
 			//printf("posix: Process %s was interrupted\n", self->path().c_str());
 			bool killed = false;
-			if(self->checkOrRequestSignalRaise()) {
+			if(self->signalContext()->hasPendingSignal(~self->signalMask())
+					&& self->checkOrRequestSignalRaise()) {
 				auto active = co_await self->signalContext()->fetchSignal(
 						~self->signalMask(), true);
 				if(active)
-					co_await self->signalContext()->raiseContext(active, self.get(), killed);
+					co_await self->signalContext()->raiseContext(*active, self.get(), killed);
 			}
 			if(killed)
 				break;
@@ -549,8 +625,8 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 				co_await async::suspend_indefinitely({});
 			}
 
-			auto item = new SignalItem;
-			item->signalNumber = SIGABRT;
+			SignalItem item;
+			item.signalNumber = SIGABRT;
 			if(!self->checkSignalRaise())
 				std::cout << "\e[33m" "posix: Ignoring global signal flag "
 						"during synchronous user space panic" "\e[39m" << std::endl;
@@ -580,8 +656,8 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 				co_await async::suspend_indefinitely({});
 			}
 
-			auto item = new SignalItem;
-			item->signalNumber = SIGSEGV;
+			SignalItem item;
+			item.signalNumber = SIGSEGV;
 			if(!self->checkSignalRaise())
 				std::cout << "\e[33m" "posix: Ignoring global signal flag "
 						"during synchronous SIGSEGV" "\e[39m" << std::endl;
@@ -601,8 +677,8 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 				co_await async::suspend_indefinitely({});
 			}
 
-			auto item = new SignalItem;
-			item->signalNumber = SIGSEGV;
+			SignalItem item;
+			item.signalNumber = SIGSEGV;
 			if(!self->checkSignalRaise())
 				std::cout << "\e[33m" "posix: Ignoring global signal flag "
 						"during synchronous SIGSEGV" "\e[39m" << std::endl;
@@ -622,8 +698,8 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 				co_await async::suspend_indefinitely({});
 			}
 
-			auto item = new SignalItem;
-			item->signalNumber = SIGILL;
+			SignalItem item;
+			item.signalNumber = SIGILL;
 			if(!self->checkSignalRaise())
 				std::cout << "\e[33m" "posix: Ignoring global signal flag "
 						"during synchronous SIGILL" "\e[39m" << std::endl;
@@ -638,8 +714,8 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 			printf("\e[39m");
 			fflush(stdout);
 
-			auto item = new SignalItem;
-			item->signalNumber = SIGILL;
+			SignalItem item;
+			item.signalNumber = SIGILL;
 			if(!self->checkSignalRaise())
 				std::cout << "\e[33m" "posix: Ignoring global signal flag "
 						"during synchronous SIGILL" "\e[39m" << std::endl;
@@ -674,3026 +750,4079 @@ async::result<void> serveSignals(std::shared_ptr<Process> self,
 	generation->signalsDone.raise();
 }
 
-async::result<void> serveRequests(std::shared_ptr<Process> self,
-		std::shared_ptr<Generation> generation) {
-	async::cancellation_token cancellation = generation->cancelServe;
+namespace {
 
-	async::cancellation_callback cancel_callback{cancellation, [&] {
-		HEL_CHECK(helShutdownLane(self->posixLane().getHandle()));
-	}};
+// Owning buffer that can be passed to bragi's parse functions.
+struct RequestHead {
+	void *data() {
+		return buffer.data();
+	}
 
-	while(true) {
-		auto [accept, recv_head] = co_await helix_ng::exchangeMsgs(
-				self->posixLane(),
-				helix_ng::accept(
-					helix_ng::recvInline()
-				)
-			);
+	const void *data() const {
+		return buffer.data();
+	}
 
-		if(accept.error() == kHelErrLaneShutdown)
-			break;
-		HEL_CHECK(accept.error());
+	size_t size() const {
+		return buffer.size();
+	}
 
-		if(recv_head.error() == kHelErrBufferTooSmall) {
-			std::cout << "posix: Rejecting request due to RecvInline overflow" << std::endl;
-			continue;
-		}
-		HEL_CHECK(recv_head.error());
+	std::vector<char> buffer;
+};
 
-		auto conversation = accept.descriptor();
+// State of a single request on the POSIX lane of a process.
+// Each request is handled by its own coroutine that owns this struct.
+struct RequestContext {
+	template<typename Message = managarm::posix::SvrResponse>
+	async::result<void> sendErrorResponse(managarm::posix::Errors err) {
+		Message resp;
+		resp.set_error(err);
 
-		auto sendErrorResponse = [&conversation]<typename Message = managarm::posix::SvrResponse>(managarm::posix::Errors err) -> async::result<void> {
-			Message resp;
-			resp.set_error(err);
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+		HEL_CHECK(send_resp.error());
+	}
 
-			HEL_CHECK(send_resp.error());
-		};
+	std::shared_ptr<Process> self;
+	helix::UniqueDescriptor conversation;
+	bragi::preamble preamble;
+	// Copy of the head; the dispatcher's receive buffer must not be held
+	// while the request is in flight.
+	RequestHead head;
+	// Only valid for CntRequest-based requests.
+	managarm::posix::CntRequest req;
+};
 
-		auto preamble = bragi::read_preamble(recv_head);
-		assert(!preamble.error());
-		recv_head.reset();
+// Handlers return false if the lane should be shut down (e.g., on decoding failures).
+async::result<bool> handleGetTid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-		managarm::posix::CntRequest req;
-		if (preamble.id() == managarm::posix::CntRequest::message_id) {
-			auto o = bragi::parse_head_only<managarm::posix::CntRequest>(recv_head);
-			if (!o) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	auto req = bragi::parse_head_only<managarm::posix::GetTidRequest>(recv_head);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
+	if(logRequests)
+		std::cout << "posix: GET_TID" << std::endl;
 
-			req = *o;
-		}
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_pid(self->tid());
 
-		if(preamble.id() == bragi::message_id<managarm::posix::GetTidRequest>) {
-			auto req = bragi::parse_head_only<managarm::posix::GetTidRequest>(recv_head);
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
-			if(logRequests)
-				std::cout << "posix: GET_TID" << std::endl;
+	auto [sendResp] = co_await helix_ng::exchangeMsgs(
+		conversation,
+		helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+	);
+	HEL_CHECK(sendResp.error());
+	co_return true;
+}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_pid(self->tid());
+async::result<bool> handleGetPid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
 
-			auto [sendResp] = co_await helix_ng::exchangeMsgs(
-				conversation,
-				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-			);
-			HEL_CHECK(sendResp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::GET_PID) {
-			if(logRequests)
-				std::cout << "posix: GET_PID" << std::endl;
+	if(logRequests)
+		std::cout << "posix: GET_PID" << std::endl;
 
-			helix::SendBuffer send_resp;
+	helix::SendBuffer send_resp;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_pid(self->pid());
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_pid(self->pid());
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::GetPpidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::GetPpidRequest>(recv_head);
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+async::result<bool> handleGetPpid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			if(logRequests)
-				std::cout << "posix: GET_PPID" << std::endl;
+	auto req = bragi::parse_head_only<managarm::posix::GetPpidRequest>(recv_head);
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_pid(self->getParent()->pid());
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+	if(logRequests)
+		std::cout << "posix: GET_PPID" << std::endl;
 
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::GetUidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::GetUidRequest>(recv_head);
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_pid(self->getParent()->pid());
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			if(logRequests)
-				std::cout << "posix: GET_UID" << std::endl;
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_uid(self->uid());
+async::result<bool> handleGetUid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+	auto req = bragi::parse_head_only<managarm::posix::GetUidRequest>(recv_head);
 
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::SetUidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::SetUidRequest>(recv_head);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	if(logRequests)
+		std::cout << "posix: GET_UID" << std::endl;
 
-			if(logRequests)
-				std::cout << "posix: SET_UID" << std::endl;
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_uid(self->uid());
 
-			Error err = self->setUid(req->uid());
-			if(err == Error::accessDenied) {
-				co_await sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
-			} else if(err == Error::illegalArguments) {
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-			} else {
-				co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
-			}
-		}else if(preamble.id() == managarm::posix::GetEuidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::GetEuidRequest>(recv_head);
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			if(logRequests)
-				std::cout << "posix: GET_EUID" << std::endl;
+async::result<bool> handleSetUid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &recv_head = ctx.head;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_uid(self->euid());
+	auto req = bragi::parse_head_only<managarm::posix::SetUidRequest>(recv_head);
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::SetEuidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::SetEuidRequest>(recv_head);
+	if(logRequests)
+		std::cout << "posix: SET_UID" << std::endl;
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	Error err = self->setUid(req->uid());
+	if(err == Error::accessDenied) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
+	} else if(err == Error::illegalArguments) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+	} else {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+	}
+	co_return true;
+}
 
-			if(logRequests)
-				std::cout << "posix: SET_EUID" << std::endl;
+async::result<bool> handleGetEuid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			Error err = self->setEuid(req->uid());
-			if(err == Error::accessDenied) {
-				co_await sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
-			} else if(err == Error::illegalArguments) {
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-			} else {
-				co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
-			}
-		}else if(preamble.id() == managarm::posix::GetGidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::GetGidRequest>(recv_head);
+	auto req = bragi::parse_head_only<managarm::posix::GetEuidRequest>(recv_head);
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			if(logRequests)
-				std::cout << "posix: GET_GID" << std::endl;
+	if(logRequests)
+		std::cout << "posix: GET_EUID" << std::endl;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_uid(self->gid());
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_uid(self->euid());
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::GetEgidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::GetEgidRequest>(recv_head);
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+async::result<bool> handleSetEuid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &recv_head = ctx.head;
 
-			if(logRequests)
-				std::cout << "posix: GET_EGID" << std::endl;
+	auto req = bragi::parse_head_only<managarm::posix::SetEuidRequest>(recv_head);
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_uid(self->egid());
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+	if(logRequests)
+		std::cout << "posix: SET_EUID" << std::endl;
 
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::SetGidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::SetGidRequest>(recv_head);
+	Error err = self->setEuid(req->uid());
+	if(err == Error::accessDenied) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
+	} else if(err == Error::illegalArguments) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+	} else {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+	}
+	co_return true;
+}
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+async::result<bool> handleGetGid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			if(logRequests)
-				std::cout << "posix: SET_GID" << std::endl;
+	auto req = bragi::parse_head_only<managarm::posix::GetGidRequest>(recv_head);
 
-			Error err = self->setGid(req->uid());
-			if(err == Error::accessDenied) {
-				co_await sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
-			} else if(err == Error::illegalArguments) {
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-			} else {
-				co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
-			}
-		}else if(preamble.id() == managarm::posix::SetEgidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::SetEgidRequest>(recv_head);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	if(logRequests)
+		std::cout << "posix: GET_GID" << std::endl;
 
-			if(logRequests)
-				std::cout << "posix: SET_EGID" << std::endl;
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_uid(self->gid());
 
-			Error err = self->setEgid(req->uid());
-			if(err == Error::accessDenied) {
-				co_await sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
-			} else if(err == Error::illegalArguments) {
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-			} else {
-				co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
-			}
-		}else if(req.request_type() == managarm::posix::CntReqType::WAIT) {
-			if(logRequests)
-				std::cout << "posix: WAIT" << std::endl;
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			if(req.flags() & ~(WNOHANG | WUNTRACED | WCONTINUED)) {
-				std::cout << "posix: WAIT invalid flags: " << req.flags() << std::endl;
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
-			}
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			if(req.flags() & WUNTRACED)
-				std::cout << "\e[31mposix: WAIT flag WUNTRACED is silently ignored\e[39m" << std::endl;
+async::result<bool> handleGetEgid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			if(req.flags() & WCONTINUED)
-				std::cout << "\e[31mposix: WAIT flag WCONTINUED is silently ignored\e[39m" << std::endl;
+	auto req = bragi::parse_head_only<managarm::posix::GetEgidRequest>(recv_head);
 
-			TerminationState state;
-			auto pid = co_await self->wait(req.pid(), req.flags() & WNOHANG, &state);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			helix::SendBuffer send_resp;
+	if(logRequests)
+		std::cout << "posix: GET_EGID" << std::endl;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_pid(pid);
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_uid(self->egid());
 
-			uint32_t mode = 0;
-			if(auto byExit = std::get_if<TerminationByExit>(&state); byExit) {
-				mode |= 0x200 | byExit->code; // 0x200 = normal exit().
-			}else if(auto bySignal = std::get_if<TerminationBySignal>(&state); bySignal) {
-				mode |= 0x400 | (bySignal->signo << 24); // 0x400 = killed by signal.
-			}else{
-				assert(std::holds_alternative<std::monostate>(state));
-			}
-			resp.set_mode(mode);
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::GET_RESOURCE_USAGE) {
-			if(logRequests)
-				std::cout << "posix: GET_RESOURCE_USAGE" << std::endl;
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			HelThreadStats stats;
-			HEL_CHECK(helQueryThreadStats(self->threadDescriptor().getHandle(), &stats));
+async::result<bool> handleSetGid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &recv_head = ctx.head;
 
-			uint64_t user_time;
-			if(req.mode() == RUSAGE_SELF) {
-				user_time = stats.userTime;
-			}else if(req.mode() == RUSAGE_CHILDREN) {
-				user_time = self->accumulatedUsage().userTime;
-			}else{
-				std::cout << "\e[31mposix: GET_RESOURCE_USAGE mode is not supported\e[39m"
-						<< std::endl;
-				// TODO: Return an error response.
-			}
+	auto req = bragi::parse_head_only<managarm::posix::SetGidRequest>(recv_head);
 
-			helix::SendBuffer send_resp;
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_ru_user_time(stats.userTime);
+	if(logRequests)
+		std::cout << "posix: SET_GID" << std::endl;
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == bragi::message_id<managarm::posix::VmMapRequest>) {
-			auto req = bragi::parse_head_only<managarm::posix::VmMapRequest>(recv_head);
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
-			if(logRequests)
-				std::cout << "posix: VM_MAP size: " << (void *)(size_t)req->size() << std::endl;
+	Error err = self->setGid(req->uid());
+	if(err == Error::accessDenied) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
+	} else if(err == Error::illegalArguments) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+	} else {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+	}
+	co_return true;
+}
 
-			// TODO: Validate req->flags().
+async::result<bool> handleSetEgid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &recv_head = ctx.head;
 
-			if(req->mode() & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) {
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
-			}
+	auto req = bragi::parse_head_only<managarm::posix::SetEgidRequest>(recv_head);
 
-			uint32_t nativeFlags = 0;
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			if(req->mode() & PROT_READ)
-				nativeFlags |= kHelMapProtRead;
-			if(req->mode() & PROT_WRITE)
-				nativeFlags |= kHelMapProtWrite;
-			if(req->mode() & PROT_EXEC)
-				nativeFlags |= kHelMapProtExecute;
+	if(logRequests)
+		std::cout << "posix: SET_EGID" << std::endl;
 
-			bool copyOnWrite;
-			if((req->flags() & (MAP_PRIVATE | MAP_SHARED)) == MAP_PRIVATE) {
-				copyOnWrite = true;
-			}else if((req->flags() & (MAP_PRIVATE | MAP_SHARED)) == MAP_SHARED) {
-				copyOnWrite = false;
-			}else{
-				throw std::runtime_error("posix: Handle illegal flags in VM_MAP");
-			}
+	Error err = self->setEgid(req->uid());
+	if(err == Error::accessDenied) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
+	} else if(err == Error::illegalArguments) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+	} else {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+	}
+	co_return true;
+}
 
-			uintptr_t hint = 0;
-			if(req->flags() & MAP_FIXED)
-				hint = req->address_hint();
+async::result<bool> handleWait(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-			void *address;
-			if(req->flags() & MAP_ANONYMOUS) {
-				assert(req->fd() == -1);
-				assert(!req->rel_offset());
+	if(logRequests)
+		std::cout << "posix: WAIT" << std::endl;
 
-				if(copyOnWrite) {
-					address = co_await self->vmContext()->mapFile(hint,
-							{}, nullptr,
-							0, req->size(), true, nativeFlags);
-				}else{
-					HelHandle handle;
-					HEL_CHECK(helAllocateMemory(req->size(), 0, nullptr, &handle));
+	if(req.flags() & ~(WNOHANG | WUNTRACED | WCONTINUED)) {
+		std::cout << "posix: WAIT invalid flags: " << req.flags() << std::endl;
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		co_return true;
+	}
 
-					address = co_await self->vmContext()->mapFile(hint,
-							helix::UniqueDescriptor{handle}, nullptr,
-							0, req->size(), false, nativeFlags);
-				}
-			}else{
-				auto file = self->fileContext()->getFile(req->fd());
-				assert(file && "Illegal FD for VM_MAP");
-				auto memory = co_await file->accessMemory();
-				assert(memory);
-				address = co_await self->vmContext()->mapFile(hint,
-						std::move(memory), std::move(file),
-						req->rel_offset(), req->size(), copyOnWrite, nativeFlags);
-			}
+	if(req.flags() & WUNTRACED)
+		std::cout << "\e[31mposix: WAIT flag WUNTRACED is silently ignored\e[39m" << std::endl;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_offset(reinterpret_cast<uintptr_t>(address));
+	if(req.flags() & WCONTINUED)
+		std::cout << "\e[31mposix: WAIT flag WCONTINUED is silently ignored\e[39m" << std::endl;
 
-			auto [sendResp] = co_await helix_ng::exchangeMsgs(
-				conversation,
-				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-			);
-			HEL_CHECK(sendResp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::VM_REMAP) {
-			if(logRequests)
-				std::cout << "posix: VM_REMAP" << std::endl;
+	TerminationState state;
+	auto pid = co_await self->wait(req.pid(), req.flags() & WNOHANG, &state);
 
-			helix::SendBuffer send_resp;
+	helix::SendBuffer send_resp;
 
-			auto address = co_await self->vmContext()->remapFile(
-					reinterpret_cast<void *>(req.address()), req.size(), req.new_size());
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_pid(pid);
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_offset(reinterpret_cast<uintptr_t>(address));
+	uint32_t mode = 0;
+	if(auto byExit = std::get_if<TerminationByExit>(&state); byExit) {
+		mode |= 0x200 | byExit->code; // 0x200 = normal exit().
+	}else if(auto bySignal = std::get_if<TerminationBySignal>(&state); bySignal) {
+		mode |= 0x400 | (bySignal->signo << 24); // 0x400 = killed by signal.
+	}else{
+		assert(std::holds_alternative<std::monostate>(state));
+	}
+	resp.set_mode(mode);
+
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::VM_PROTECT) {
-			if(logRequests)
-				std::cout << "posix: VM_PROTECT" << std::endl;
-			helix::SendBuffer send_resp;
-			managarm::posix::SvrResponse resp;
+async::result<bool> handleGetResourceUsage(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
+
+	if(logRequests)
+		std::cout << "posix: GET_RESOURCE_USAGE" << std::endl;
+
+	HelThreadStats stats;
+	HEL_CHECK(helQueryThreadStats(self->threadDescriptor().getHandle(), &stats));
+
+	ResourceUsage usage{};
+	if(req.mode() == RUSAGE_SELF) {
+		usage.accumulate(stats);
+	}else if(req.mode() == RUSAGE_CHILDREN) {
+		usage = self->accumulatedUsage();
+	}else{
+		std::cout << "\e[31mposix: GET_RESOURCE_USAGE mode is not supported\e[39m"
+				<< std::endl;
+		// TODO: Return an error response.
+	}
 
-			if(req.mode() & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) {
-				resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				auto ser = resp.SerializeAsString();
-				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-						helix::action(&send_resp, ser.data(), ser.size()));
-				co_await transmit.async_wait();
-				HEL_CHECK(send_resp.error());
-				continue;
-			}
+	helix::SendBuffer send_resp;
+
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_ru_user_time(usage.userTime);
+	resp.set_ru_system_time(usage.systemTime);
+	resp.set_ru_minor_faults(usage.minorFaults);
+	resp.set_ru_major_faults(usage.majorFaults);
+	resp.set_ru_voluntary_switches(usage.voluntarySwitches);
+	resp.set_ru_involuntary_switches(usage.involuntarySwitches);
+
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			uint32_t native_flags = 0;
-			if(req.mode() & PROT_READ)
-				native_flags |= kHelMapProtRead;
-			if(req.mode() & PROT_WRITE)
-				native_flags |= kHelMapProtWrite;
-			if(req.mode() & PROT_EXEC)
-				native_flags |= kHelMapProtExecute;
+async::result<bool> handleVmMap(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			co_await self->vmContext()->protectFile(
-					reinterpret_cast<void *>(req.address()), req.size(), native_flags);
+	auto req = bragi::parse_head_only<managarm::posix::VmMapRequest>(recv_head);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
+	if(logRequests)
+		std::cout << "posix: VM_MAP size: " << (void *)(size_t)req->size() << std::endl;
 
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::VM_UNMAP) {
-			if(logRequests)
-				std::cout << "posix: VM_UNMAP address: " << (void *)req.address()
-						<< ", size: " << (void *)(size_t)req.size() << std::endl;
+	// TODO: Validate req->flags().
 
-			helix::SendBuffer send_resp;
+	if(req->mode() & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		co_return true;
+	}
 
-			self->vmContext()->unmapFile(reinterpret_cast<void *>(req.address()), req.size());
+	uint32_t nativeFlags = 0;
+
+	if(req->mode() & PROT_READ)
+		nativeFlags |= kHelMapProtRead;
+	if(req->mode() & PROT_WRITE)
+		nativeFlags |= kHelMapProtWrite;
+	if(req->mode() & PROT_EXEC)
+		nativeFlags |= kHelMapProtExecute;
+
+	bool copyOnWrite;
+	if((req->flags() & (MAP_PRIVATE | MAP_SHARED)) == MAP_PRIVATE) {
+		copyOnWrite = true;
+	}else if((req->flags() & (MAP_PRIVATE | MAP_SHARED)) == MAP_SHARED) {
+		copyOnWrite = false;
+	}else{
+		throw std::runtime_error("posix: Handle illegal flags in VM_MAP");
+	}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	uintptr_t hint = 0;
+	if(req->flags() & MAP_FIXED)
+		hint = req->address_hint();
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::MountRequest::message_id) {
-			std::vector<std::byte> tail(preamble.tail_size());
-			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(tail.data(), tail.size())
-				);
-			HEL_CHECK(recv_tail.error());
+	void *address;
+	if(req->flags() & MAP_ANONYMOUS) {
+		assert(req->fd() == -1);
+		assert(!req->rel_offset());
 
-			auto req = bragi::parse_head_tail<managarm::posix::MountRequest>(recv_head, tail);
+		if(copyOnWrite) {
+			address = co_await self->vmContext()->mapFile(hint,
+					{}, nullptr,
+					0, req->size(), true, nativeFlags);
+		}else{
+			HelHandle handle;
+			HEL_CHECK(helAllocateMemory(req->size(), 0, nullptr, &handle));
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+			address = co_await self->vmContext()->mapFile(hint,
+					helix::UniqueDescriptor{handle}, nullptr,
+					0, req->size(), false, nativeFlags);
+		}
+	}else{
+		auto file = self->fileContext()->getFile(req->fd());
+		assert(file && "Illegal FD for VM_MAP");
+		if(!copyOnWrite && (nativeFlags & kHelMapProtWrite)) {
+			auto seals = co_await file->getSeals();
+			if(seals && (seals.value() & managarm::fs::FileSeals::SEAL_WRITE)) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::INSUFFICIENT_PERMISSION);
+				co_return true;
 			}
+		}
+		auto memory = co_await file->accessMemory();
+		assert(memory);
+		address = co_await self->vmContext()->mapFile(hint,
+				std::move(memory), std::move(file),
+				req->rel_offset(), req->size(), copyOnWrite, nativeFlags);
+	}
 
-			if(logRequests)
-				std::cout << "posix: MOUNT " << req->fs_type() << " on " << req->path()
-						<< " to " << req->target_path() << std::endl;
-
-			auto resolveResult = co_await resolve(self->fsContext()->getRoot(),
-					self->fsContext()->getWorkingDirectory(), req->target_path(), self.get());
-			if(!resolveResult) {
-				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
-			auto target = resolveResult.value();
-
-			if(req->fs_type() == "procfs") {
-				co_await target.first->mount(target.second, getProcfs());
-			}else if(req->fs_type() == "sysfs") {
-				co_await target.first->mount(target.second, getSysfs());
-			}else if(req->fs_type() == "devtmpfs") {
-				co_await target.first->mount(target.second, getDevtmpfs());
-			}else if(req->fs_type() == "tmpfs") {
-				co_await target.first->mount(target.second, tmp_fs::createRoot());
-			}else if(req->fs_type() == "devpts") {
-				co_await target.first->mount(target.second, pts::getFsRoot());
-			}else{
-				assert(req->fs_type() == "ext2");
-				auto sourceResult = co_await resolve(self->fsContext()->getRoot(),
-						self->fsContext()->getWorkingDirectory(), req->path(), self.get());
-				if(!sourceResult) {
-					if(sourceResult.error() == protocols::fs::Error::fileNotFound) {
-						co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-						continue;
-					} else if(sourceResult.error() == protocols::fs::Error::notDirectory) {
-						co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-						continue;
-					} else {
-						std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-						co_return;
-					}
-				}
-				auto source = sourceResult.value();
-				assert(source.second);
-				assert(source.second->getTarget()->getType() == VfsType::blockDevice);
-				auto device = blockRegistry.get(source.second->getTarget()->readDevice());
-				auto link = co_await device->mount();
-				co_await target.first->mount(target.second, std::move(link));
-			}
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_offset(reinterpret_cast<uintptr_t>(address));
 
-			if(logRequests)
-				std::cout << "posix:     MOUNT succeeds" << std::endl;
+	auto [sendResp] = co_await helix_ng::exchangeMsgs(
+		conversation,
+		helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+	);
+	HEL_CHECK(sendResp.error());
+	co_return true;
+}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+async::result<bool> handleVmRemap(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-						conversation,
-						helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-					);
+	if(logRequests)
+		std::cout << "posix: VM_REMAP" << std::endl;
 
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::CHROOT) {
-			if(logRequests)
-				std::cout << "posix: CHROOT" << std::endl;
-
-			helix::SendBuffer send_resp;
-
-			auto pathResult = co_await resolve(self->fsContext()->getRoot(),
-					self->fsContext()->getWorkingDirectory(), req.path(), self.get());
-			if(!pathResult) {
-				if(pathResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(pathResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
-			auto path = pathResult.value();
-			self->fsContext()->changeRoot(path);
+	helix::SendBuffer send_resp;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	auto outcome = co_await self->vmContext()->remapFile(
+			reinterpret_cast<void *>(req.address()), req.size(), req.new_size());
+
+	managarm::posix::SvrResponse resp;
+	if(!outcome) {
+		assert(outcome.error() == Error::illegalArguments);
+		resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+	}else{
+		resp.set_error(managarm::posix::Errors::SUCCESS);
+		resp.set_offset(reinterpret_cast<uintptr_t>(outcome.value()));
+	}
+
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
+
+async::result<bool> handleVmProtect(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
+
+	if(logRequests)
+		std::cout << "posix: VM_PROTECT" << std::endl;
+	helix::SendBuffer send_resp;
+	managarm::posix::SvrResponse resp;
+
+	if(req.mode() & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) {
+		resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		auto ser = resp.SerializeAsString();
+		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&send_resp, ser.data(), ser.size()));
+		co_await transmit.async_wait();
+		HEL_CHECK(send_resp.error());
+		co_return true;
+	}
+
+	uint32_t native_flags = 0;
+	if(req.mode() & PROT_READ)
+		native_flags |= kHelMapProtRead;
+	if(req.mode() & PROT_WRITE)
+		native_flags |= kHelMapProtWrite;
+	if(req.mode() & PROT_EXEC)
+		native_flags |= kHelMapProtExecute;
+
+	co_await self->vmContext()->protectFile(
+			reinterpret_cast<void *>(req.address()), req.size(), native_flags);
+
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
+
+async::result<bool> handleVmUnmap(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
+
+	if(logRequests)
+		std::cout << "posix: VM_UNMAP address: " << (void *)req.address()
+				<< ", size: " << (void *)(size_t)req.size() << std::endl;
+
+	helix::SendBuffer send_resp;
+
+	self->vmContext()->unmapFile(reinterpret_cast<void *>(req.address()), req.size());
+
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
+
+async::result<bool> handleMount(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &preamble = ctx.preamble;
+	auto &recv_head = ctx.head;
+
+	std::vector<std::byte> tail(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+	HEL_CHECK(recv_tail.error());
+
+	auto req = bragi::parse_head_tail<managarm::posix::MountRequest>(recv_head, tail);
+
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
+
+	if(logRequests)
+		std::cout << "posix: MOUNT " << req->fs_type() << " on " << req->path()
+				<< " to " << req->target_path() << std::endl;
+
+	auto resolveResult = co_await resolve(self->fsContext()->getRoot(),
+			self->fsContext()->getWorkingDirectory(), req->target_path(), self.get());
+	if(!resolveResult) {
+		if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
+	auto target = resolveResult.value();
+
+	if(req->fs_type() == "procfs") {
+		co_await target.first->mount(target.second, getProcfs());
+	}else if(req->fs_type() == "sysfs") {
+		co_await target.first->mount(target.second, getSysfs());
+	}else if(req->fs_type() == "devtmpfs") {
+		co_await target.first->mount(target.second, getDevtmpfs());
+	}else if(req->fs_type() == "tmpfs") {
+		co_await target.first->mount(target.second, tmp_fs::createRoot());
+	}else if(req->fs_type() == "devpts") {
+		co_await target.first->mount(target.second, pts::getFsRoot());
+	}else{
+		assert(req->fs_type() == "ext2");
+		auto sourceResult = co_await resolve(self->fsContext()->getRoot(),
+				self->fsContext()->getWorkingDirectory(), req->path(), self.get());
+		if(!sourceResult) {
+			if(sourceResult.error() == protocols::fs::Error::fileNotFound) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+				co_return true;
+			} else if(sourceResult.error() == protocols::fs::Error::notDirectory) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+				co_return true;
+			} else {
+				std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+				co_return false;
+			}
+		}
+		auto source = sourceResult.value();
+		assert(source.second);
+		assert(source.second->getTarget()->getType() == VfsType::blockDevice);
+		auto device = blockRegistry.get(source.second->getTarget()->readDevice());
+		auto link = co_await device->mount();
+		co_await target.first->mount(target.second, std::move(link));
+	}
+
+	if(logRequests)
+		std::cout << "posix:     MOUNT succeeds" << std::endl;
+
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
+
+async::result<bool> handleChroot(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
+
+	if(logRequests)
+		std::cout << "posix: CHROOT" << std::endl;
+
+	helix::SendBuffer send_resp;
+
+	auto pathResult = co_await resolve(self->fsContext()->getRoot(),
+			self->fsContext()->getWorkingDirectory(), req.path(), self.get());
+	if(!pathResult) {
+		if(pathResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(pathResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
+	auto path = pathResult.value();
+	self->fsContext()->changeRoot(path);
+
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
+
+async::result<bool> handleChdir(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
+
+	if(logRequests)
+		std::cout << "posix: CHDIR" << std::endl;
+
+	helix::SendBuffer send_resp;
+
+	auto pathResult = co_await resolve(self->fsContext()->getRoot(),
+			self->fsContext()->getWorkingDirectory(), req.path(), self.get());
+	if(!pathResult) {
+		if(pathResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(pathResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
+	auto path = pathResult.value();
+	self->fsContext()->changeWorkingDirectory(path);
+
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
+
+async::result<bool> handleFchdir(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
+
+	if(logRequests)
+		std::cout << "posix: CHDIR" << std::endl;
+
+	managarm::posix::SvrResponse resp;
+	helix::SendBuffer send_resp;
+
+	auto file = self->fileContext()->getFile(req.fd());
+
+	if(!file) {
+		resp.set_error(managarm::posix::Errors::NO_SUCH_FD);
+
+		auto ser = resp.SerializeAsString();
+		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&send_resp, ser.data(), ser.size()));
+		co_await transmit.async_wait();
+		HEL_CHECK(send_resp.error());
+		co_return true;
+	}
+
+	self->fsContext()->changeWorkingDirectory({file->associatedMount(),
+			file->associatedLink()});
+
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
+
+async::result<bool> handleAccessat(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
+
+	if(logRequests || logPaths)
+		std::cout << "posix: ACCESSAT " << req.path() << std::endl;
+
+	ViewPath relative_to;
+	smarter::shared_ptr<File, FileHandle> file;
+
+	if(req.flags()) {
+		if(req.flags() & AT_SYMLINK_NOFOLLOW) {
+			std::cout << "posix: ACCESSAT flag handling AT_SYMLINK_NOFOLLOW is unimplemented" << std::endl;
+		} else if(req.flags() & AT_EACCESS) {
+			std::cout << "posix: ACCESSAT flag handling AT_EACCESS is unimplemented" << std::endl;
+		} else {
+			std::cout << "posix: ACCESSAT unknown flag is unimplemented: " << req.flags() << std::endl;
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+			co_return true;
+		}
+	}
+
+	if(req.fd() == AT_FDCWD) {
+		relative_to = self->fsContext()->getWorkingDirectory();
+	} else {
+		file = self->fileContext()->getFile(req.fd());
+
+		if(!file) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+			co_return true;
+		}
+
+		relative_to = {file->associatedMount(), file->associatedLink()};
+	}
+
+	auto pathResult = co_await resolve(self->fsContext()->getRoot(),
+			relative_to, req.path(), self.get());
+	if(!pathResult) {
+		if(pathResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(pathResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
+	auto path = pathResult.value();
+
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+
+	auto ser = resp.SerializeAsString();
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
+		helix_ng::sendBuffer(ser.data(), ser.size()));
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
+
+async::result<bool> handleMkdirat(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
+
+	if(logRequests || logPaths)
+		std::cout << "posix: MKDIRAT " << req.path() << std::endl;
+
+	helix::SendBuffer send_resp;
+	managarm::posix::SvrResponse resp;
+
+	ViewPath relative_to;
+	smarter::shared_ptr<File, FileHandle> file;
+
+	if (!req.path().size()) {
+		resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+
+		auto ser = resp.SerializeAsString();
+		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&send_resp, ser.data(), ser.size()));
+		co_await transmit.async_wait();
+		HEL_CHECK(send_resp.error());
+		co_return true;
+	}
+
+	if(req.fd() == AT_FDCWD) {
+		relative_to = self->fsContext()->getWorkingDirectory();
+	} else {
+		file = self->fileContext()->getFile(req.fd());
+
+		if (!file) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+			co_return true;
+		}
+
+		relative_to = {file->associatedMount(), file->associatedLink()};
+	}
+
+	PathResolver resolver;
+	resolver.setup(self->fsContext()->getRoot(),
+			relative_to, req.path(), self.get());
+	auto resolveResult = co_await resolver.resolve(resolvePrefix);
+	if(!resolveResult) {
+		if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
+
+	if(!resolver.hasComponent()) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
+		co_return true;
+	}
+
+	auto parent = resolver.currentLink()->getTarget();
+	auto existsResult = co_await parent->getLink(resolver.nextComponent());
+	assert(existsResult);
+	auto exists = existsResult.value();
+	if(exists) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
+		co_return true;
+	}
+
+	auto result = co_await parent->mkdir(resolver.nextComponent());
+	if(auto error = std::get_if<Error>(&result); error) {
+		assert(*error == Error::illegalOperationTarget);
+
+		resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+
+		auto ser = resp.SerializeAsString();
+		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&send_resp, ser.data(), ser.size()));
+		co_await transmit.async_wait();
+		HEL_CHECK(send_resp.error());
+	}else{
+		resp.set_error(managarm::posix::Errors::SUCCESS);
+
+		auto ser = resp.SerializeAsString();
+		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&send_resp, ser.data(), ser.size()));
+		co_await transmit.async_wait();
+		HEL_CHECK(send_resp.error());
+	}
+	co_return true;
+}
+
+async::result<bool> handleMkfifoAt(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &preamble = ctx.preamble;
+	auto &recv_head = ctx.head;
+
+	std::vector<std::byte> tail(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+	HEL_CHECK(recv_tail.error());
+
+	auto req = bragi::parse_head_tail<managarm::posix::MkfifoAtRequest>(recv_head, tail);
+
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
+
+	if(logRequests || logPaths)
+		std::cout << "posix: MKFIFOAT " << req->fd() << " " << req->path() << std::endl;
+
+	if (!req->path().size()) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		co_return true;
+	}
+
+	ViewPath relative_to;
+	smarter::shared_ptr<File, FileHandle> file;
+	std::shared_ptr<FsLink> target_link;
+
+	if (req->fd() == AT_FDCWD) {
+		relative_to = self->fsContext()->getWorkingDirectory();
+	} else {
+		file = self->fileContext()->getFile(req->fd());
+
+		if (!file) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+			co_return true;
+		}
+
+		relative_to = {file->associatedMount(), file->associatedLink()};
+	}
+
+	PathResolver resolver;
+	resolver.setup(self->fsContext()->getRoot(),
+			relative_to, req->path(), self.get());
+	auto resolveResult = co_await resolver.resolve(resolvePrefix | resolveNoTrailingSlash);
+	if(!resolveResult) {
+		if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
+
+	auto parent = resolver.currentLink()->getTarget();
+	if(co_await parent->getLink(resolver.nextComponent())) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
+		co_return true;
+	}
+
+	auto result = co_await parent->mkfifo(resolver.nextComponent(), req->mode());
+	if(!result) {
+		std::cout << "posix: Unexpected failure from mkfifo()" << std::endl;
+		co_return false;
+	}
+
+	co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+	co_return true;
+}
+
+async::result<bool> handleLinkAt(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &preamble = ctx.preamble;
+	auto &recv_head = ctx.head;
+
+	std::vector<std::byte> tail(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+	HEL_CHECK(recv_tail.error());
+
+	auto req = bragi::parse_head_tail<managarm::posix::LinkAtRequest>(recv_head, tail);
+
+	if(logRequests)
+		std::cout << "posix: LINKAT" << std::endl;
+
+	if(req->flags() & ~(AT_EMPTY_PATH | AT_SYMLINK_FOLLOW)) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		co_return true;
+	}
+
+	if(req->flags() & AT_EMPTY_PATH) {
+		std::cout << "posix: AT_EMPTY_PATH is unimplemented for linkat" << std::endl;
+	}
+
+	if(req->flags() & AT_SYMLINK_FOLLOW) {
+		std::cout << "posix: AT_SYMLINK_FOLLOW is unimplemented for linkat" << std::endl;
+	}
+
+	ViewPath relative_to;
+	smarter::shared_ptr<File, FileHandle> file;
+
+	if(req->fd() == AT_FDCWD) {
+		relative_to = self->fsContext()->getWorkingDirectory();
+	} else {
+		file = self->fileContext()->getFile(req->fd());
+
+		if(!file) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+			co_return true;
+		}
+
+		relative_to = {file->associatedMount(), file->associatedLink()};
+	}
+
+	PathResolver resolver;
+	resolver.setup(self->fsContext()->getRoot(),
+			relative_to, req->path(), self.get());
+	auto resolveResult = co_await resolver.resolve();
+	if(!resolveResult) {
+		if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
+
+	if (req->newfd() == AT_FDCWD) {
+		relative_to = self->fsContext()->getWorkingDirectory();
+	} else {
+		file = self->fileContext()->getFile(req->newfd());
+
+		if(!file) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+			co_return true;
+		}
+
+		relative_to = {file->associatedMount(), file->associatedLink()};
+	}
+
+	PathResolver new_resolver;
+	new_resolver.setup(self->fsContext()->getRoot(),
+			relative_to, req->target_path(), self.get());
+	auto new_resolveResult = co_await new_resolver.resolve(
+			resolvePrefix | resolveNoTrailingSlash);
+	if(!new_resolveResult) {
+		if(new_resolveResult.error() == protocols::fs::Error::illegalOperationTarget) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_OPERATION_TARGET);
+			co_return true;
+		} else if(new_resolveResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(new_resolveResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
+
+	auto target = resolver.currentLink()->getTarget();
+	auto directory = new_resolver.currentLink()->getTarget();
+	assert(target->superblock() == directory->superblock()); // Hard links across mount points are not allowed, return EXDEV
+	auto result = co_await directory->link(new_resolver.nextComponent(), target);
+	if(!result) {
+		std::cout << "posix: Unexpected failure from link()" << std::endl;
+		co_return false;
+	}
+
+	co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+	co_return true;
+}
+
+async::result<bool> handleSymlinkAt(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &preamble = ctx.preamble;
+	auto &recv_head = ctx.head;
+
+	std::vector<std::byte> tail(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+	HEL_CHECK(recv_tail.error());
+
+	auto req = bragi::parse_head_tail<managarm::posix::SymlinkAtRequest>(recv_head, tail);
+
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
+
+	if(logRequests || logPaths)
+		std::cout << "posix: SYMLINK " << req->path() << std::endl;
+
+	ViewPath relativeTo;
+	smarter::shared_ptr<File, FileHandle> file;
+
+	if (!req->path().size()) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		co_return true;
+	}
+
+	if(req->fd() == AT_FDCWD) {
+		relativeTo = self->fsContext()->getWorkingDirectory();
+	} else {
+		file = self->fileContext()->getFile(req->fd());
+		if (!file) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+			co_return true;
+		}
+
+		relativeTo = {file->associatedMount(), file->associatedLink()};
+	}
+
+	PathResolver resolver;
+	resolver.setup(self->fsContext()->getRoot(),
+			relativeTo, req->path(), self.get());
+	auto resolveResult = co_await resolver.resolve(
+			resolvePrefix | resolveNoTrailingSlash);
+	if(!resolveResult) {
+		if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
+
+	auto parent = resolver.currentLink()->getTarget();
+	auto result = co_await parent->symlink(resolver.nextComponent(), req->target_path());
+	if(auto error = std::get_if<Error>(&result); error) {
+		assert(*error == Error::illegalOperationTarget);
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		co_return true;
+	}
+
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+
+	auto [sendResp] = co_await helix_ng::exchangeMsgs(
+		conversation,
+		helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+	);
+	HEL_CHECK(sendResp.error());
+	co_return true;
+}
+
+async::result<bool> handleRenameAt(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &preamble = ctx.preamble;
+	auto &recv_head = ctx.head;
+
+	std::vector<std::byte> tail(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+	HEL_CHECK(recv_tail.error());
+
+	auto req = bragi::parse_head_tail<managarm::posix::RenameAtRequest>(recv_head, tail);
+
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
+
+	if(logRequests || logPaths)
+		std::cout << "posix: RENAMEAT " << req->path()
+				<< " to " << req->target_path() << std::endl;
+
+	ViewPath relative_to;
+	smarter::shared_ptr<File, FileHandle> file;
+
+	if (req->fd() == AT_FDCWD) {
+		relative_to = self->fsContext()->getWorkingDirectory();
+	} else {
+		file = self->fileContext()->getFile(req->fd());
+
+		if (!file) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+			co_return true;
+		}
+
+		relative_to = {file->associatedMount(), file->associatedLink()};
+	}
+
+	PathResolver resolver;
+	resolver.setup(self->fsContext()->getRoot(),
+			relative_to, req->path(), self.get());
+	auto resolveResult = co_await resolver.resolve();
+	if(!resolveResult) {
+		if(resolveResult.error() == protocols::fs::Error::isDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
+			co_return true;
+		} else if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
+
+	if (req->newfd() == AT_FDCWD) {
+		relative_to = self->fsContext()->getWorkingDirectory();
+	} else {
+		file = self->fileContext()->getFile(req->newfd());
+
+		if (!file) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+			co_return true;
+		}
+
+		relative_to = {file->associatedMount(), file->associatedLink()};
+	}
+
+	// TODO: Add resolveNoTrailingSlash if source is not a directory?
+	PathResolver new_resolver;
+	new_resolver.setup(self->fsContext()->getRoot(),
+			relative_to, req->target_path(), self.get());
+	auto new_resolveResult = co_await new_resolver.resolve(resolvePrefix);
+	if(!new_resolveResult) {
+		if(new_resolveResult.error() == protocols::fs::Error::isDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
+			co_return true;
+		} else if(new_resolveResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(new_resolveResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
+
+	auto superblock = resolver.currentLink()->getTarget()->superblock();
+	auto directory = new_resolver.currentLink()->getTarget();
+	assert(superblock == directory->superblock());
+	auto result = co_await superblock->rename(resolver.currentLink().get(),
+			directory.get(), new_resolver.nextComponent());
+	if(!result) {
+		assert(result.error() == Error::alreadyExists);
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
+		co_return true;
+	}
+
+	co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+	co_return true;
+}
+
+async::result<bool> handleFstatAt(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &preamble = ctx.preamble;
+	auto &recv_head = ctx.head;
+
+	std::vector<std::byte> tail(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+	HEL_CHECK(recv_tail.error());
+
+	auto req = bragi::parse_head_tail<managarm::posix::FstatAtRequest>(recv_head, tail);
+
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
+
+	if(logRequests)
+		std::cout << "posix: FSTATAT request" << std::endl;
+
+	ViewPath relative_to;
+	smarter::shared_ptr<File, FileHandle> file;
+	std::shared_ptr<FsLink> target_link;
+
+	if (req->fd() == AT_FDCWD) {
+		relative_to = self->fsContext()->getWorkingDirectory();
+	} else {
+		file = self->fileContext()->getFile(req->fd());
+
+		if (!file) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+			co_return true;
+		}
+
+		relative_to = {file->associatedMount(), file->associatedLink()};
+	}
+
+	if (req->flags() & AT_EMPTY_PATH) {
+		target_link = file->associatedLink();
+	} else {
+		PathResolver resolver;
+		resolver.setup(self->fsContext()->getRoot(),
+				relative_to, req->path(), self.get());
+
+		ResolveFlags resolveFlags = 0;
+		if (req->flags() & AT_SYMLINK_NOFOLLOW)
+		    resolveFlags |= resolveDontFollow;
+
+		auto resolveResult = co_await resolver.resolve(resolveFlags);
+		if(!resolveResult) {
+			if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+				co_return true;
+			} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+				co_return true;
+			} else {
+				std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+				co_return false;
+			}
+		}
+
+		target_link = resolver.currentLink();
+	}
+
+	auto statsResult = co_await target_link->getTarget()->getStats();
+	assert(statsResult);
+	auto stats = statsResult.value();
+
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+
+	DeviceId devnum;
+	switch(target_link->getTarget()->getType()) {
+	case VfsType::regular:
+		resp.set_file_type(managarm::posix::FileType::FT_REGULAR);
+		break;
+	case VfsType::directory:
+		resp.set_file_type(managarm::posix::FileType::FT_DIRECTORY);
+		break;
+	case VfsType::symlink:
+		resp.set_file_type(managarm::posix::FileType::FT_SYMLINK);
+		break;
+	case VfsType::charDevice:
+		resp.set_file_type(managarm::posix::FileType::FT_CHAR_DEVICE);
+		devnum = target_link->getTarget()->readDevice();
+		resp.set_ref_devnum(makedev(devnum.first, devnum.second));
+		break;
+	case VfsType::blockDevice:
+		resp.set_file_type(managarm::posix::FileType::FT_BLOCK_DEVICE);
+		devnum = target_link->getTarget()->readDevice();
+		resp.set_ref_devnum(makedev(devnum.first, devnum.second));
+		break;
+	case VfsType::socket:
+		resp.set_file_type(managarm::posix::FileType::FT_SOCKET);
+		break;
+	case VfsType::fifo:
+		resp.set_file_type(managarm::posix::FileType::FT_FIFO);
+		break;
+	default:
+		assert(target_link->getTarget()->getType() == VfsType::null);
+	}
+
+	if(stats.mode & ~0xFFFu)
+		std::cout << "\e[31m" "posix: FsNode::getStats() returned illegal mode of "
+				<< stats.mode << "\e[39m" << std::endl;
+
+	resp.set_fs_inode(stats.inodeNumber);
+	resp.set_mode(stats.mode);
+	resp.set_num_links(stats.numLinks);
+	resp.set_uid(stats.uid);
+	resp.set_gid(stats.gid);
+	resp.set_file_size(stats.fileSize);
+	resp.set_atime_secs(stats.atimeSecs);
+	resp.set_atime_nanos(stats.atimeNanos);
+	resp.set_mtime_secs(stats.mtimeSecs);
+	resp.set_mtime_nanos(stats.mtimeNanos);
+	resp.set_ctime_secs(stats.ctimeSecs);
+	resp.set_ctime_nanos(stats.ctimeNanos);
+
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
+
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
+
+async::result<bool> handleFchmodAt(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &preamble = ctx.preamble;
+	auto &recv_head = ctx.head;
+
+	std::vector<std::byte> tail(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+	HEL_CHECK(recv_tail.error());
+
+	auto req = bragi::parse_head_tail<managarm::posix::FchmodAtRequest>(recv_head, tail);
+
+	if(logRequests)
+		std::cout << "posix: FCHMODAT request" << std::endl;
+
+	ViewPath relative_to;
+	smarter::shared_ptr<File, FileHandle> file;
+	std::shared_ptr<FsLink> target_link;
+
+	if(req->fd() == AT_FDCWD) {
+		relative_to = self->fsContext()->getWorkingDirectory();
+	} else {
+		file = self->fileContext()->getFile(req->fd());
+
+		if (!file) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+			co_return true;
+		}
+
+		relative_to = {file->associatedMount(), file->associatedLink()};
+	}
+
+	if(req->flags()) {
+		if(req->flags() & AT_SYMLINK_NOFOLLOW) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_SUPPORTED);
+			co_return true;
+		} else if(req->flags() & AT_EMPTY_PATH) {
+			// Allowed, managarm extension
+		} else {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+			co_return true;
+		}
+	}
+
+	if(req->flags() & AT_EMPTY_PATH) {
+		target_link = file->associatedLink();
+	} else {
+		PathResolver resolver;
+		resolver.setup(self->fsContext()->getRoot(),
+			relative_to, req->path(), self.get());
+
+		auto resolveResult = co_await resolver.resolve();
+
+		if(!resolveResult) {
+			if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+				co_return true;
+			} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+				co_return true;
+			} else {
+				std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+				co_return false;
+			}
+		}
+
+		target_link = resolver.currentLink();
+	}
+
+	co_await target_link->getTarget()->chmod(req->mode());
+
+	co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+	co_return true;
+}
+
+async::result<bool> handleUtimensAt(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &preamble = ctx.preamble;
+	auto &recv_head = ctx.head;
+
+	std::vector<std::byte> tail(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+	HEL_CHECK(recv_tail.error());
+
+	auto req = bragi::parse_head_tail<managarm::posix::UtimensAtRequest>(recv_head, tail);
+
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
+
+	if(logRequests || logPaths)
+		std::cout << "posix: UTIMENSAT " << req->path() << std::endl;
+
+	ViewPath relativeTo;
+	smarter::shared_ptr<File, FileHandle> file;
+	std::shared_ptr<FsNode> target = nullptr;
+
+	if(!req->path().size()) {
+		target = self->fileContext()->getFile(req->fd())->associatedLink()->getTarget();
+	} else {
+		if(req->flags() & ~AT_SYMLINK_NOFOLLOW) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+			co_return true;
+		}
+
+		if(req->flags() & AT_SYMLINK_NOFOLLOW) {
+			std::cout << "posix: AT_SYMLINK_FOLLOW is unimplemented for utimensat" << std::endl;
+		}
+
+		if(req->fd() == AT_FDCWD) {
+			relativeTo = self->fsContext()->getWorkingDirectory();
+		} else {
+			file = self->fileContext()->getFile(req->fd());
+			if (!file) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+				co_return true;
+			}
+
+			relativeTo = {file->associatedMount(), file->associatedLink()};
+		}
+
+		PathResolver resolver;
+		resolver.setup(self->fsContext()->getRoot(),
+				relativeTo, req->path(), self.get());
+		auto resolveResult = co_await resolver.resolve();
+		if(!resolveResult) {
+			if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+				co_return true;
+			} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+				co_return true;
+			} else {
+				std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+				co_return false;
+			}
+		}
+
+		target = resolver.currentLink()->getTarget();
+	}
+
+	co_await target->utimensat(req->atimeSec(), req->atimeNsec(), req->mtimeSec(), req->mtimeNsec());
+
+	co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+	co_return true;
+}
+
+async::result<bool> handleReadlink(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
+
+	if(logRequests || logPaths)
+		std::cout << "posix: READLINK path: " << req.path() << std::endl;
+
+	helix::SendBuffer send_resp;
+	helix::SendBuffer send_data;
+
+	auto pathResult = co_await resolve(self->fsContext()->getRoot(),
+			self->fsContext()->getWorkingDirectory(), req.path(), self.get(), resolveDontFollow);
+	if(!pathResult) {
+		if(pathResult.error() == protocols::fs::Error::fileNotFound) {
+			managarm::posix::SvrResponse resp;
+			resp.set_error(managarm::posix::Errors::FILE_NOT_FOUND);
 
 			auto ser = resp.SerializeAsString();
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
+					helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
+					helix::action(&send_data, nullptr, 0));
 			co_await transmit.async_wait();
 			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::CHDIR) {
-			if(logRequests)
-				std::cout << "posix: CHDIR" << std::endl;
-
-			helix::SendBuffer send_resp;
-
-			auto pathResult = co_await resolve(self->fsContext()->getRoot(),
-					self->fsContext()->getWorkingDirectory(), req.path(), self.get());
-			if(!pathResult) {
-				if(pathResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(pathResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
-			auto path = pathResult.value();
-			self->fsContext()->changeWorkingDirectory(path);
-
+			co_return true;
+		} else if(pathResult.error() == protocols::fs::Error::notDirectory) {
 			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_error(managarm::posix::Errors::NOT_A_DIRECTORY);
 
 			auto ser = resp.SerializeAsString();
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
+					helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
+					helix::action(&send_data, nullptr, 0));
 			co_await transmit.async_wait();
 			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::FCHDIR) {
-			if(logRequests)
-				std::cout << "posix: CHDIR" << std::endl;
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
+	auto path = pathResult.value();
 
-			managarm::posix::SvrResponse resp;
-			helix::SendBuffer send_resp;
+	auto result = co_await path.second->getTarget()->readSymlink(path.second.get(), self.get());
+	if(auto error = std::get_if<Error>(&result); error) {
+		assert(*error == Error::illegalOperationTarget);
+
+		managarm::posix::SvrResponse resp;
+		resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
 
-			auto file = self->fileContext()->getFile(req.fd());
+		auto ser = resp.SerializeAsString();
+		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
+				helix::action(&send_data, nullptr, 0));
+		co_await transmit.async_wait();
+		HEL_CHECK(send_resp.error());
+	}else{
+		auto &target = std::get<std::string>(result);
+
+		managarm::posix::SvrResponse resp;
+		resp.set_error(managarm::posix::Errors::SUCCESS);
+
+		auto ser = resp.SerializeAsString();
+		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
+				helix::action(&send_data, target.data(), target.size()));
+		co_await transmit.async_wait();
+		HEL_CHECK(send_resp.error());
+	}
+	co_return true;
+}
+
+async::result<bool> handleOpenAt(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &preamble = ctx.preamble;
+	auto &recv_head = ctx.head;
+
+	std::vector<std::byte> tail(preamble.tail_size());
+	auto [recvTail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+	HEL_CHECK(recvTail.error());
+
+	auto req = bragi::parse_head_tail<managarm::posix::OpenAtRequest>(recv_head, tail);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
+	if(logRequests || logPaths)
+		std::cout << "posix: OPENAT path: " << req->path() << std::endl;
+
+	if((req->flags() & ~(managarm::posix::OpenFlags::OF_CREATE
+			| managarm::posix::OpenFlags::OF_EXCLUSIVE
+			| managarm::posix::OpenFlags::OF_NONBLOCK
+			| managarm::posix::OpenFlags::OF_CLOEXEC
+			| managarm::posix::OpenFlags::OF_TRUNC
+			| managarm::posix::OpenFlags::OF_RDONLY
+			| managarm::posix::OpenFlags::OF_WRONLY
+			| managarm::posix::OpenFlags::OF_RDWR
+			| managarm::posix::OpenFlags::OF_PATH))) {
+		std::cout << "posix: OPENAT flags not recognized: " << req->flags() << std::endl;
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		co_return true;
+	}
+
+	SemanticFlags semantic_flags = 0;
+	if(req->flags() & managarm::posix::OpenFlags::OF_NONBLOCK)
+		semantic_flags |= semanticNonBlock;
+
+	if (req->flags() & managarm::posix::OpenFlags::OF_RDONLY)
+		semantic_flags |= semanticRead;
+	else if (req->flags() & managarm::posix::OpenFlags::OF_WRONLY)
+		semantic_flags |= semanticWrite;
+	else if (req->flags() & managarm::posix::OpenFlags::OF_RDWR)
+		semantic_flags |= semanticRead | semanticWrite;
+
+	ViewPath relative_to;
+	smarter::shared_ptr<File, FileHandle> file;
+	std::shared_ptr<FsLink> target_link;
+
+	if(req->fd() == AT_FDCWD) {
+		relative_to = self->fsContext()->getWorkingDirectory();
+	} else {
+		file = self->fileContext()->getFile(req->fd());
+
+		if (!file) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+			co_return true;
+		}
+
+		relative_to = {file->associatedMount(), file->associatedLink()};
+	}
+
+	PathResolver resolver;
+	resolver.setup(self->fsContext()->getRoot(),
+			relative_to, req->path(), self.get());
+	if(req->flags() & managarm::posix::OpenFlags::OF_CREATE) {
+		auto resolveResult = co_await resolver.resolve(
+				resolvePrefix | resolveNoTrailingSlash);
+		if(!resolveResult) {
+			if(resolveResult.error() == protocols::fs::Error::isDirectory) {
+				// TODO: Verify additional constraints for sending EISDIR.
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
+				co_return true;
+			} else if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+				co_return true;
+			} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+				co_return true;
+			} else {
+				std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+				co_return false;
+			}
+		}
+
+		if(logRequests)
+			std::cout << "posix: Creating file " << req->path() << std::endl;
+
+		auto directory = resolver.currentLink()->getTarget();
+		auto tailResult = co_await directory->getLink(resolver.nextComponent());
+		assert(tailResult);
+		auto tail = tailResult.value();
+		if(tail) {
+			if(req->flags() & managarm::posix::OpenFlags::OF_EXCLUSIVE) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
+				co_return true;
+			}else{
+				auto fileResult = co_await tail->getTarget()->open(
+									resolver.currentView(), std::move(tail),
+									semantic_flags);
+				assert(fileResult);
+				file = fileResult.value();
+				assert(file);
+			}
+		}else{
+			assert(directory->superblock());
+			auto node = co_await directory->superblock()->createRegular();
+			if (!node) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+				co_return true;
+			}
+			// Due to races, link() can fail here.
+			// TODO: Implement a version of link() that eithers links the new node
+			// or returns the current node without failing.
+			auto linkResult = co_await directory->link(resolver.nextComponent(), node);
+			assert(linkResult);
+			auto link = linkResult.value();
+			auto fileResult = co_await node->open(resolver.currentView(), std::move(link),
+								semantic_flags);
+			assert(fileResult);
+			file = fileResult.value();
+			assert(file);
+		}
+	}else{
+		auto resolveResult = co_await resolver.resolve();
+		if(!resolveResult) {
+			if(resolveResult.error() == protocols::fs::Error::isDirectory) {
+				// TODO: Verify additional constraints for sending EISDIR.
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
+				co_return true;
+			} else if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+				co_return true;
+			} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+				co_return true;
+			} else {
+				std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+				co_return false;
+			}
+		}
 
-			if(!file) {
-				resp.set_error(managarm::posix::Errors::NO_SUCH_FD);
+		auto target = resolver.currentLink()->getTarget();
 
-				auto ser = resp.SerializeAsString();
-				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-						helix::action(&send_resp, ser.data(), ser.size()));
-				co_await transmit.async_wait();
-				HEL_CHECK(send_resp.error());
-				continue;
+		if(req->flags() & managarm::posix::OpenFlags::OF_PATH) {
+			auto dummyFile = smarter::make_shared<DummyFile>(resolver.currentView(), resolver.currentLink());
+			DummyFile::serve(dummyFile);
+			file = File::constructHandle(std::move(dummyFile));
+		} else {
+			auto fileResult = co_await target->open(resolver.currentView(), resolver.currentLink(), semantic_flags);
+			if(!fileResult) {
+				if(fileResult.error() == Error::noBackingDevice) {
+					co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_BACKING_DEVICE);
+					co_return true;
+				} else {
+					std::cout << "posix: Unexpected failure from open()" << std::endl;
+					co_return false;
+				}
 			}
+			assert(fileResult);
+			file = fileResult.value();
+		}
+	}
 
-			self->fsContext()->changeWorkingDirectory({file->associatedMount(),
-					file->associatedLink()});
+	if(!file) {
+		if(logRequests)
+			std::cout << "posix:     OPEN failed: file not found" << std::endl;
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+		co_return true;
+	}
 
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	if(req->flags() & managarm::posix::OpenFlags::OF_TRUNC) {
+		auto result = co_await file->truncate(0);
+		assert(result || result.error() == protocols::fs::Error::illegalOperationTarget);
+	}
+	int fd = self->fileContext()->attachFile(file,
+			req->flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
+	if(fd < 0) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_FILE_DESCRIPTORS);
+		co_return true;
+	}
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::ACCESSAT) {
-			if(logRequests || logPaths)
-				std::cout << "posix: ACCESSAT " << req.path() << std::endl;
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_fd(fd);
 
-			ViewPath relative_to;
-			smarter::shared_ptr<File, FileHandle> file;
+	auto [sendResp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
+	HEL_CHECK(sendResp.error());
+	co_return true;
+}
 
-			if(req.flags()) {
-				if(req.flags() & AT_SYMLINK_NOFOLLOW) {
-					std::cout << "posix: ACCESSAT flag handling AT_SYMLINK_NOFOLLOW is unimplemented" << std::endl;
-				} else if(req.flags() & AT_EACCESS) {
-					std::cout << "posix: ACCESSAT flag handling AT_EACCESS is unimplemented" << std::endl;
-				} else {
-					std::cout << "posix: ACCESSAT unknown flag is unimplemented: " << req.flags() << std::endl;
-					co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-					continue;
-				}
-			}
+async::result<bool> handleClose(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			if(req.fd() == AT_FDCWD) {
-				relative_to = self->fsContext()->getWorkingDirectory();
-			} else {
-				file = self->fileContext()->getFile(req.fd());
+	auto req = bragi::parse_head_only<managarm::posix::CloseRequest>(recv_head);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
+	if(logRequests)
+		std::cout << "posix: CLOSE file descriptor " << req->fd() << std::endl;
 
-				if(!file) {
-					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
-				}
+	self->fileContext()->closeFile(req->fd());
 
-				relative_to = {file->associatedMount(), file->associatedLink()};
-			}
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto pathResult = co_await resolve(self->fsContext()->getRoot(),
-					relative_to, req.path(), self.get());
-			if(!pathResult) {
-				if(pathResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(pathResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
-			auto path = pathResult.value();
+	auto [sendResp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
+	HEL_CHECK(sendResp.error());
+	co_return true;
+}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+async::result<bool> handleDup(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-			auto ser = resp.SerializeAsString();
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size()));
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::MKDIRAT) {
-			if(logRequests || logPaths)
-				std::cout << "posix: MKDIRAT " << req.path() << std::endl;
+	if(logRequests)
+		std::cout << "posix: DUP" << std::endl;
 
-			helix::SendBuffer send_resp;
-			managarm::posix::SvrResponse resp;
+	auto file = self->fileContext()->getFile(req.fd());
 
-			ViewPath relative_to;
-			smarter::shared_ptr<File, FileHandle> file;
+	if (!file) {
+		helix::SendBuffer send_resp;
 
-			if (!req.path().size()) {
-				resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		managarm::posix::SvrResponse resp;
+		resp.set_error(managarm::posix::Errors::BAD_FD);
 
-				auto ser = resp.SerializeAsString();
-				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-						helix::action(&send_resp, ser.data(), ser.size()));
-				co_await transmit.async_wait();
-				HEL_CHECK(send_resp.error());
-				continue;
-			}
+		auto ser = resp.SerializeAsString();
+		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&send_resp, ser.data(), ser.size()));
+		co_await transmit.async_wait();
+		HEL_CHECK(send_resp.error());
+		co_return true;
+	}
 
-			if(req.fd() == AT_FDCWD) {
-				relative_to = self->fsContext()->getWorkingDirectory();
-			} else {
-				file = self->fileContext()->getFile(req.fd());
+	if(req.flags() & ~(managarm::posix::OpenFlags::OF_CLOEXEC)) {
+		helix::SendBuffer send_resp;
 
-				if (!file) {
-					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
-				}
+		managarm::posix::SvrResponse resp;
+		resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
 
-				relative_to = {file->associatedMount(), file->associatedLink()};
-			}
+		auto ser = resp.SerializeAsString();
+		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&send_resp, ser.data(), ser.size()));
+		co_await transmit.async_wait();
+		HEL_CHECK(send_resp.error());
+		co_return true;
+	}
 
-			PathResolver resolver;
-			resolver.setup(self->fsContext()->getRoot(),
-					relative_to, req.path(), self.get());
-			auto resolveResult = co_await resolver.resolve(resolvePrefix);
-			if(!resolveResult) {
-				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
+	int newfd = self->fileContext()->attachFile(file,
+			req.flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
+	if(newfd < 0) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_FILE_DESCRIPTORS);
+		co_return true;
+	}
 
-			if(!resolver.hasComponent()) {
-				co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
-				continue;
-			}
+	helix::SendBuffer send_resp;
 
-			auto parent = resolver.currentLink()->getTarget();
-			auto existsResult = co_await parent->getLink(resolver.nextComponent());
-			assert(existsResult);
-			auto exists = existsResult.value();
-			if(exists) {
-				co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
-				continue;
-			}
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_fd(newfd);
 
-			auto result = co_await parent->mkdir(resolver.nextComponent());
-			if(auto error = std::get_if<Error>(&result); error) {
-				assert(*error == Error::illegalOperationTarget);
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-				resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+async::result<bool> handleDup2(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-				auto ser = resp.SerializeAsString();
-				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-						helix::action(&send_resp, ser.data(), ser.size()));
-				co_await transmit.async_wait();
-				HEL_CHECK(send_resp.error());
-			}else{
-				resp.set_error(managarm::posix::Errors::SUCCESS);
+	if(logRequests)
+		std::cout << "posix: DUP2" << std::endl;
 
-				auto ser = resp.SerializeAsString();
-				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-						helix::action(&send_resp, ser.data(), ser.size()));
-				co_await transmit.async_wait();
-				HEL_CHECK(send_resp.error());
-			}
-		}else if(preamble.id() == managarm::posix::MkfifoAtRequest::message_id) {
-			std::vector<std::byte> tail(preamble.tail_size());
-			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(tail.data(), tail.size())
-				);
-			HEL_CHECK(recv_tail.error());
+	auto file = self->fileContext()->getFile(req.fd());
 
-			auto req = bragi::parse_head_tail<managarm::posix::MkfifoAtRequest>(recv_head, tail);
+	if (!file || req.newfd() < 0 || req.newfd() >= FileContext::maxFileDescriptors) {
+		helix::SendBuffer send_resp;
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+		managarm::posix::SvrResponse resp;
+		resp.set_error(managarm::posix::Errors::BAD_FD);
 
-			if(logRequests || logPaths)
-				std::cout << "posix: MKFIFOAT " << req->fd() << " " << req->path() << std::endl;
+		auto ser = resp.SerializeAsString();
+		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&send_resp, ser.data(), ser.size()));
+		co_await transmit.async_wait();
+		HEL_CHECK(send_resp.error());
+		co_return true;
+	}
 
-			if (!req->path().size()) {
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
-			}
+	if(req.flags()) {
+		helix::SendBuffer send_resp;
 
-			ViewPath relative_to;
-			smarter::shared_ptr<File, FileHandle> file;
-			std::shared_ptr<FsLink> target_link;
+		managarm::posix::SvrResponse resp;
+		resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
 
-			if (req->fd() == AT_FDCWD) {
-				relative_to = self->fsContext()->getWorkingDirectory();
-			} else {
-				file = self->fileContext()->getFile(req->fd());
+		auto ser = resp.SerializeAsString();
+		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&send_resp, ser.data(), ser.size()));
+		co_await transmit.async_wait();
+		HEL_CHECK(send_resp.error());
+		co_return true;
+	}
 
-				if (!file) {
-					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
-				}
+	self->fileContext()->attachFile(req.newfd(), file);
 
-				relative_to = {file->associatedMount(), file->associatedLink()};
-			}
+	helix::SendBuffer send_resp;
 
-			PathResolver resolver;
-			resolver.setup(self->fsContext()->getRoot(),
-					relative_to, req->path(), self.get());
-			auto resolveResult = co_await resolver.resolve(resolvePrefix | resolveNoTrailingSlash);
-			if(!resolveResult) {
-				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto parent = resolver.currentLink()->getTarget();
-			if(co_await parent->getLink(resolver.nextComponent())) {
-				co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
-				continue;
-			}
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			auto result = co_await parent->mkfifo(resolver.nextComponent(), req->mode());
-			if(!result) {
-				std::cout << "posix: Unexpected failure from mkfifo()" << std::endl;
-				co_return;
-			}
+async::result<bool> handleIsTty(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
-		}else if(preamble.id() == managarm::posix::LinkAtRequest::message_id) {
-			std::vector<std::byte> tail(preamble.tail_size());
-			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(tail.data(), tail.size())
-				);
-			HEL_CHECK(recv_tail.error());
+	auto req = bragi::parse_head_only<managarm::posix::IsTtyRequest>(recv_head);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
+	if(logRequests)
+		std::cout << "posix: IS_TTY" << std::endl;
 
-			auto req = bragi::parse_head_tail<managarm::posix::LinkAtRequest>(recv_head, tail);
+	auto file = self->fileContext()->getFile(req->fd());
+	if(!file) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_SUCH_FD);
+		co_return true;
+	}
 
-			if(logRequests)
-				std::cout << "posix: LINKAT" << std::endl;
+	helix::SendBuffer send_resp;
 
-			if(req->flags() & ~(AT_EMPTY_PATH | AT_SYMLINK_FOLLOW)) {
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
-			}
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_mode(file->isTerminal());
 
-			if(req->flags() & AT_EMPTY_PATH) {
-				std::cout << "posix: AT_EMPTY_PATH is unimplemented for linkat" << std::endl;
-			}
+	auto [sendResp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
+	HEL_CHECK(sendResp.error());
+	co_return true;
+}
 
-			if(req->flags() & AT_SYMLINK_FOLLOW) {
-				std::cout << "posix: AT_SYMLINK_FOLLOW is unimplemented for linkat" << std::endl;
-			}
+async::result<bool> handleTtyName(RequestContext &ctx) {
+	auto &conversation = ctx.conversation;
 
-			ViewPath relative_to;
-			smarter::shared_ptr<File, FileHandle> file;
+	if(logRequests)
+		std::cout << "posix: TTY_NAME" << std::endl;
 
-			if(req->fd() == AT_FDCWD) {
-				relative_to = self->fsContext()->getWorkingDirectory();
-			} else {
-				file = self->fileContext()->getFile(req->fd());
+	helix::SendBuffer send_resp;
 
-				if(!file) {
-					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
-				}
+	std::cout << "\e[31mposix: Fix TTY_NAME\e[39m" << std::endl;
+	managarm::posix::SvrResponse resp;
+	resp.set_path("/dev/ttyS0");
+	resp.set_error(managarm::posix::Errors::SUCCESS);
 
-				relative_to = {file->associatedMount(), file->associatedLink()};
-			}
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			PathResolver resolver;
-			resolver.setup(self->fsContext()->getRoot(),
-					relative_to, req->path(), self.get());
-			auto resolveResult = co_await resolver.resolve();
-			if(!resolveResult) {
-				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
+async::result<bool> handleGetcwd(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
+
+	if(logRequests)
+		std::cout << "posix: GETCWD" << std::endl;
+
+	std::string path = self->fsContext()->getWorkingDirectory().getPath(
+			self->fsContext()->getRoot());
+
+	helix::SendBuffer send_resp;
+	helix::SendBuffer send_path;
+
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_size(path.size());
+
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
+			helix::action(&send_path, path.data(),
+					std::min(static_cast<size_t>(req.size()), path.size() + 1)));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	HEL_CHECK(send_path.error());
+	co_return true;
+}
 
-			if (req->newfd() == AT_FDCWD) {
-				relative_to = self->fsContext()->getWorkingDirectory();
-			} else {
-				file = self->fileContext()->getFile(req->newfd());
+async::result<bool> handleUnlinkAt(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &preamble = ctx.preamble;
+	auto &recv_head = ctx.head;
 
-				if(!file) {
-					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
-				}
+	std::vector<std::byte> tail(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+	HEL_CHECK(recv_tail.error());
 
-				relative_to = {file->associatedMount(), file->associatedLink()};
-			}
+	auto req = bragi::parse_head_tail<managarm::posix::UnlinkAtRequest>(recv_head, tail);
 
-			PathResolver new_resolver;
-			new_resolver.setup(self->fsContext()->getRoot(),
-					relative_to, req->target_path(), self.get());
-			auto new_resolveResult = co_await new_resolver.resolve(
-					resolvePrefix | resolveNoTrailingSlash);
-			if(!new_resolveResult) {
-				if(new_resolveResult.error() == protocols::fs::Error::illegalOperationTarget) {
-					co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_OPERATION_TARGET);
-					continue;
-				} else if(new_resolveResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(new_resolveResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			auto target = resolver.currentLink()->getTarget();
-			auto directory = new_resolver.currentLink()->getTarget();
-			assert(target->superblock() == directory->superblock()); // Hard links across mount points are not allowed, return EXDEV
-			auto result = co_await directory->link(new_resolver.nextComponent(), target);
-			if(!result) {
-				std::cout << "posix: Unexpected failure from link()" << std::endl;
-				co_return;
-			}
+	if(logRequests || logPaths)
+		std::cout << "posix: UNLINKAT path: " << req->path() << std::endl;
 
-			co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
-		}else if(preamble.id() == managarm::posix::SymlinkAtRequest::message_id) {
-			std::vector<std::byte> tail(preamble.tail_size());
-			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(tail.data(), tail.size())
-				);
-			HEL_CHECK(recv_tail.error());
+	ViewPath relative_to;
+	smarter::shared_ptr<File, FileHandle> file;
+	std::shared_ptr<FsLink> target_link;
 
-			auto req = bragi::parse_head_tail<managarm::posix::SymlinkAtRequest>(recv_head, tail);
+	if(req->flags()) {
+		if(req->flags() & AT_REMOVEDIR) {
+			std::cout << "posix: UNLINKAT flag AT_REMOVEDIR handling unimplemented" << std::endl;
+		} else {
+			std::cout << "posix: UNLINKAT flag handling unimplemented with unknown flag: " << req->flags() << std::endl;
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		}
+	}
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	if(req->fd() == AT_FDCWD) {
+		relative_to = self->fsContext()->getWorkingDirectory();
+	} else {
+		file = self->fileContext()->getFile(req->fd());
 
-			if(logRequests || logPaths)
-				std::cout << "posix: SYMLINK " << req->path() << std::endl;
+		if (!file) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+			co_return true;
+		}
 
-			ViewPath relativeTo;
-			smarter::shared_ptr<File, FileHandle> file;
+		relative_to = {file->associatedMount(), file->associatedLink()};
+	}
 
-			if (!req->path().size()) {
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
-			}
+	PathResolver resolver;
+	resolver.setup(self->fsContext()->getRoot(),
+			relative_to, req->path(), self.get());
+
+	auto resolveResult = co_await resolver.resolve();
+	if(!resolveResult) {
+		if(resolveResult.error() == protocols::fs::Error::isDirectory) {
+			// TODO: Only when AT_REMOVEDIR is not specified, fix this when flag handling is implemented.
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
+			co_return true;
+		} else if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
 
-			if(req->fd() == AT_FDCWD) {
-				relativeTo = self->fsContext()->getWorkingDirectory();
-			} else {
-				file = self->fileContext()->getFile(req->fd());
-				if (!file) {
-					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
-				}
+	target_link = resolver.currentLink();
 
-				relativeTo = {file->associatedMount(), file->associatedLink()};
-			}
+	auto owner = target_link->getOwner();
+	if(!owner) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::RESOURCE_IN_USE);
+		co_return true;
+	}
+	auto result = co_await owner->unlink(target_link->getName());
+	if(!result) {
+		if(result.error() == Error::noSuchFile) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		}else{
+			std::cout << "posix: Unexpected failure from unlink()" << std::endl;
+			co_return false;
+		}
+	}
 
-			PathResolver resolver;
-			resolver.setup(self->fsContext()->getRoot(),
-					relativeTo, req->path(), self.get());
-			auto resolveResult = co_await resolver.resolve(
-					resolvePrefix | resolveNoTrailingSlash);
-			if(!resolveResult) {
-				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
+	co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+	co_return true;
+}
 
-			auto parent = resolver.currentLink()->getTarget();
-			auto result = co_await parent->symlink(resolver.nextComponent(), req->target_path());
-			if(auto error = std::get_if<Error>(&result); error) {
-				assert(*error == Error::illegalOperationTarget);
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
-			}
+async::result<bool> handleRmdir(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &preamble = ctx.preamble;
+	auto &recv_head = ctx.head;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	std::vector<std::byte> tail(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+	HEL_CHECK(recv_tail.error());
 
-			auto [sendResp] = co_await helix_ng::exchangeMsgs(
-				conversation,
-				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-			);
-			HEL_CHECK(sendResp.error());
-		}else if(preamble.id() == managarm::posix::RenameAtRequest::message_id) {
-			std::vector<std::byte> tail(preamble.tail_size());
-			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(tail.data(), tail.size())
-				);
-			HEL_CHECK(recv_tail.error());
-
-			auto req = bragi::parse_head_tail<managarm::posix::RenameAtRequest>(recv_head, tail);
-
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	auto req = bragi::parse_head_tail<managarm::posix::RmdirRequest>(recv_head, tail);
 
-			if(logRequests || logPaths)
-				std::cout << "posix: RENAMEAT " << req->path()
-						<< " to " << req->target_path() << std::endl;
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			ViewPath relative_to;
-			smarter::shared_ptr<File, FileHandle> file;
+	if(logRequests || logPaths)
+		std::cout << "posix: RMDIR " << req->path() << std::endl;
 
-			if (req->fd() == AT_FDCWD) {
-				relative_to = self->fsContext()->getWorkingDirectory();
-			} else {
-				file = self->fileContext()->getFile(req->fd());
+	std::cout << "\e[31mposix: RMDIR: always removes the directory, even when not empty\e[39m" << std::endl;
+	std::shared_ptr<FsLink> target_link;
 
-				if (!file) {
-					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
-				}
+	PathResolver resolver;
+	resolver.setup(self->fsContext()->getRoot(), self->fsContext()->getWorkingDirectory(),
+			req->path(), self.get());
 
-				relative_to = {file->associatedMount(), file->associatedLink()};
-			}
+	auto resolveResult = co_await resolver.resolve();
+	if(!resolveResult) {
+		if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
 
-			PathResolver resolver;
-			resolver.setup(self->fsContext()->getRoot(),
-					relative_to, req->path(), self.get());
-			auto resolveResult = co_await resolver.resolve();
-			if(!resolveResult) {
-				if(resolveResult.error() == protocols::fs::Error::isDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
-					continue;
-				} else if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
+	target_link = resolver.currentLink();
 
-			if (req->newfd() == AT_FDCWD) {
-				relative_to = self->fsContext()->getWorkingDirectory();
-			} else {
-				file = self->fileContext()->getFile(req->newfd());
+	auto owner = target_link->getOwner();
+	auto result = co_await owner->rmdir(target_link->getName());
+	if(!result) {
+		std::cout << "posix: Unexpected failure from rmdir()" << std::endl;
+		co_return false;
+	}
 
-				if (!file) {
-					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
-				}
+	co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+	co_return true;
+}
 
-				relative_to = {file->associatedMount(), file->associatedLink()};
-			}
+async::result<bool> handleFdGetFlags(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-			// TODO: Add resolveNoTrailingSlash if source is not a directory?
-			PathResolver new_resolver;
-			new_resolver.setup(self->fsContext()->getRoot(),
-					relative_to, req->target_path(), self.get());
-			auto new_resolveResult = co_await new_resolver.resolve(resolvePrefix);
-			if(!new_resolveResult) {
-				if(new_resolveResult.error() == protocols::fs::Error::isDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
-					continue;
-				} else if(new_resolveResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(new_resolveResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
+	if(logRequests)
+		std::cout << "posix: FD_GET_FLAGS" << std::endl;
 
-			auto superblock = resolver.currentLink()->getTarget()->superblock();
-			auto directory = new_resolver.currentLink()->getTarget();
-			assert(superblock == directory->superblock());
-			auto result = co_await superblock->rename(resolver.currentLink().get(),
-					directory.get(), new_resolver.nextComponent());
-			if(!result) {
-				assert(result.error() == Error::alreadyExists);
-				co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
-				continue;
-			}
+	helix::SendBuffer send_resp;
 
-			co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
-		}else if(preamble.id() == managarm::posix::FstatAtRequest::message_id) {
-			std::vector<std::byte> tail(preamble.tail_size());
-			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(tail.data(), tail.size())
-				);
-			HEL_CHECK(recv_tail.error());
+	auto descriptor = self->fileContext()->getDescriptor(req.fd());
+	if(!descriptor) {
+		managarm::posix::SvrResponse resp;
+		resp.set_error(managarm::posix::Errors::NO_SUCH_FD);
 
-			auto req = bragi::parse_head_tail<managarm::posix::FstatAtRequest>(recv_head, tail);
+		auto ser = resp.SerializeAsString();
+		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&send_resp, ser.data(), ser.size()));
+		co_await transmit.async_wait();
+		HEL_CHECK(send_resp.error());
+		co_return true;
+	}
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	int flags = 0;
+	if(descriptor->closeOnExec)
+		flags |= FD_CLOEXEC;
 
-			if(logRequests)
-				std::cout << "posix: FSTATAT request" << std::endl;
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_flags(flags);
 
-			ViewPath relative_to;
-			smarter::shared_ptr<File, FileHandle> file;
-			std::shared_ptr<FsLink> target_link;
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			if (req->fd() == AT_FDCWD) {
-				relative_to = self->fsContext()->getWorkingDirectory();
-			} else {
-				file = self->fileContext()->getFile(req->fd());
+async::result<bool> handleFdSetFlags(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-				if (!file) {
-					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
-				}
+	if(logRequests)
+		std::cout << "posix: FD_SET_FLAGS" << std::endl;
 
-				relative_to = {file->associatedMount(), file->associatedLink()};
-			}
+	if(req.flags() & ~FD_CLOEXEC) {
+		std::cout << "posix: FD_SET_FLAGS unknown flags: " << req.flags() << std::endl;
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		co_return true;
+	}
+	int closeOnExec = req.flags() & FD_CLOEXEC;
+	if(self->fileContext()->setDescriptor(req.fd(), closeOnExec) != Error::success) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_SUCH_FD);
+		co_return true;
+	}
 
-			if (req->flags() & AT_EMPTY_PATH) {
-				target_link = file->associatedLink();
-			} else {
-				PathResolver resolver;
-				resolver.setup(self->fsContext()->getRoot(),
-						relative_to, req->path(), self.get());
-
-				ResolveFlags resolveFlags = 0;
-				if (req->flags() & AT_SYMLINK_NOFOLLOW)
-				    resolveFlags |= resolveDontFollow;
-
-				auto resolveResult = co_await resolver.resolve(resolveFlags);
-				if(!resolveResult) {
-					if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-						co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-						continue;
-					} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-						co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-						continue;
-					} else {
-						std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-						co_return;
-					}
-				}
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
 
-				target_link = resolver.currentLink();
-			}
+	auto ser = resp.SerializeAsString();
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
+			helix_ng::sendBuffer(ser.data(), ser.size()));
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			auto statsResult = co_await target_link->getTarget()->getStats();
-			assert(statsResult);
-			auto stats = statsResult.value();
+async::result<bool> handleIoctlFioclex(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	auto req = bragi::parse_head_only<managarm::posix::IoctlFioclexRequest>(recv_head);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			DeviceId devnum;
-			switch(target_link->getTarget()->getType()) {
-			case VfsType::regular:
-				resp.set_file_type(managarm::posix::FileType::FT_REGULAR);
-				break;
-			case VfsType::directory:
-				resp.set_file_type(managarm::posix::FileType::FT_DIRECTORY);
-				break;
-			case VfsType::symlink:
-				resp.set_file_type(managarm::posix::FileType::FT_SYMLINK);
-				break;
-			case VfsType::charDevice:
-				resp.set_file_type(managarm::posix::FileType::FT_CHAR_DEVICE);
-				devnum = target_link->getTarget()->readDevice();
-				resp.set_ref_devnum(makedev(devnum.first, devnum.second));
-				break;
-			case VfsType::blockDevice:
-				resp.set_file_type(managarm::posix::FileType::FT_BLOCK_DEVICE);
-				devnum = target_link->getTarget()->readDevice();
-				resp.set_ref_devnum(makedev(devnum.first, devnum.second));
-				break;
-			case VfsType::socket:
-				resp.set_file_type(managarm::posix::FileType::FT_SOCKET);
-				break;
-			case VfsType::fifo:
-				resp.set_file_type(managarm::posix::FileType::FT_FIFO);
-				break;
-			default:
-				assert(target_link->getTarget()->getType() == VfsType::null);
-			}
+	if(logRequests)
+		std::cout << "posix: FIOCLEX" << std::endl;
 
-			if(stats.mode & ~0xFFFu)
-				std::cout << "\e[31m" "posix: FsNode::getStats() returned illegal mode of "
-						<< stats.mode << "\e[39m" << std::endl;
-
-			resp.set_fs_inode(stats.inodeNumber);
-			resp.set_mode(stats.mode);
-			resp.set_num_links(stats.numLinks);
-			resp.set_uid(stats.uid);
-			resp.set_gid(stats.gid);
-			resp.set_file_size(stats.fileSize);
-			resp.set_atime_secs(stats.atimeSecs);
-			resp.set_atime_nanos(stats.atimeNanos);
-			resp.set_mtime_secs(stats.mtimeSecs);
-			resp.set_mtime_nanos(stats.mtimeNanos);
-			resp.set_ctime_secs(stats.ctimeSecs);
-			resp.set_ctime_nanos(stats.ctimeNanos);
-
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+	if(self->fileContext()->setDescriptor(req->fd(), true) != Error::success) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_SUCH_FD);
+		co_return true;
+	}
 
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::FchmodAtRequest::message_id) {
-			std::vector<std::byte> tail(preamble.tail_size());
-			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(tail.data(), tail.size())
-				);
-			HEL_CHECK(recv_tail.error());
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto req = bragi::parse_head_tail<managarm::posix::FchmodAtRequest>(recv_head, tail);
+	auto ser = resp.SerializeAsString();
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
+			helix_ng::sendBuffer(ser.data(), ser.size()));
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			if(logRequests)
-				std::cout << "posix: FCHMODAT request" << std::endl;
+// Translates POSIX_FADV_* and MADV_* (which agree on these values) to HelMemoryAdvice.
+std::optional<int> translateAdvice(int advice) {
+	switch(advice) {
+	case POSIX_MADV_NORMAL: return kHelAdviseNormal;
+	case POSIX_MADV_RANDOM: return kHelAdviseRandom;
+	case POSIX_MADV_SEQUENTIAL: return kHelAdviseSequential;
+	case POSIX_MADV_WILLNEED: return kHelAdviseWillNeed;
+	default: return std::nullopt;
+	}
+}
 
-			ViewPath relative_to;
-			smarter::shared_ptr<File, FileHandle> file;
-			std::shared_ptr<FsLink> target_link;
+async::result<bool> handleFadvise(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			if(req->fd() == AT_FDCWD) {
-				relative_to = self->fsContext()->getWorkingDirectory();
-			} else {
-				file = self->fileContext()->getFile(req->fd());
+	auto req = bragi::parse_head_only<managarm::posix::FadviseRequest>(recv_head);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-				if (!file) {
-					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
-				}
+	if(logRequests)
+		std::cout << "posix: FADVISE" << std::endl;
 
-				relative_to = {file->associatedMount(), file->associatedLink()};
-			}
+	auto file = self->fileContext()->getFile(req->fd());
+	if(!file) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_SUCH_FD);
+		co_return true;
+	}
+	if(req->offset() < 0 || req->length() < 0) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		co_return true;
+	}
 
-			if(req->flags()) {
-				if(req->flags() & AT_SYMLINK_NOFOLLOW) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_SUPPORTED);
-					continue;
-				} else if(req->flags() & AT_EMPTY_PATH) {
-					// Allowed, managarm extension
-				} else {
-					co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-					continue;
-				}
-			}
+	// DONTNEED and NOREUSE are accepted but ignored.
+	auto advice = translateAdvice(req->advice());
+	if(!advice && req->advice() != POSIX_FADV_DONTNEED && req->advice() != POSIX_FADV_NOREUSE) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		co_return true;
+	}
 
-			if(req->flags() & AT_EMPTY_PATH) {
-				target_link = file->associatedLink();
-			} else {
-				PathResolver resolver;
-				resolver.setup(self->fsContext()->getRoot(),
-					relative_to, req->path(), self.get());
-
-				auto resolveResult = co_await resolver.resolve();
-
-				if(!resolveResult) {
-					if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-						co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-						continue;
-					} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-						co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-						continue;
-					} else {
-						std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-						co_return;
-					}
-				}
+	auto link = file->associatedLink();
+	if(!link || link->getTarget()->getType() != VfsType::regular) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_OPERATION_TARGET);
+		co_return true;
+	}
 
-				target_link = resolver.currentLink();
-			}
+	if(advice) {
+		auto memory = co_await file->accessMemory();
+		size_t length;
+		HEL_CHECK(helMemoryInfo(memory.getHandle(), &length));
+
+		// A length of zero extends to the end of the file.
+		size_t begin = std::min(static_cast<size_t>(req->offset()) & ~size_t(0xFFF), length);
+		size_t end = length;
+		if(req->length())
+			end = std::min((static_cast<size_t>(req->offset() + req->length()) + 0xFFF)
+					& ~size_t(0xFFF), length);
+		if(end > begin)
+			helAdviseMemory(memory.getHandle(), begin, end - begin, *advice);
+	}
 
-			co_await target_link->getTarget()->chmod(req->mode());
+	co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+	co_return true;
+}
 
-			co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
-		}else if(preamble.id() == managarm::posix::UtimensAtRequest::message_id) {
-			std::vector<std::byte> tail(preamble.tail_size());
-			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(tail.data(), tail.size())
-				);
-			HEL_CHECK(recv_tail.error());
+async::result<bool> handleMadvise(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &recv_head = ctx.head;
 
-			auto req = bragi::parse_head_tail<managarm::posix::UtimensAtRequest>(recv_head, tail);
+	auto req = bragi::parse_head_only<managarm::posix::MadviseRequest>(recv_head);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	if(logRequests)
+		std::cout << "posix: MADVISE" << std::endl;
 
-			if(logRequests || logPaths)
-				std::cout << "posix: UTIMENSAT " << req->path() << std::endl;
+	if(req->advice() == MADV_MERGEABLE || req->advice() == MADV_UNMERGEABLE) {
+		if(req->address() & 0xFFF) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+			co_return true;
+		}
+		self->vmContext()->adviseMergeable(reinterpret_cast<void *>(req->address()),
+				req->size(), req->advice() == MADV_MERGEABLE);
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+		co_return true;
+	}
 
-			ViewPath relativeTo;
-			smarter::shared_ptr<File, FileHandle> file;
-			std::shared_ptr<FsNode> target = nullptr;
+	if(req->advice() == MADV_DONTNEED || req->advice() == MADV_FREE) {
+		if(req->address() & 0xFFF) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+			co_return true;
+		}
+		self->vmContext()->discardPages(reinterpret_cast<void *>(req->address()),
+				req->size(), req->advice() == MADV_FREE);
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+		co_return true;
+	}
 
-			if(!req->path().size()) {
-				target = self->fileContext()->getFile(req->fd())->associatedLink()->getTarget();
-			} else {
-				if(req->flags() & ~AT_SYMLINK_NOFOLLOW) {
-					co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-					continue;
-				}
+	// The remaining kinds of advice are only hints.
+	auto advice = translateAdvice(req->advice());
+	if(!advice || (req->address() & 0xFFF)) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		co_return true;
+	}
 
-				if(req->flags() & AT_SYMLINK_NOFOLLOW) {
-					std::cout << "posix: AT_SYMLINK_FOLLOW is unimplemented for utimensat" << std::endl;
-				}
+	self->vmContext()->adviseFile(reinterpret_cast<void *>(req->address()),
+			req->size(), *advice);
 
-				if(req->fd() == AT_FDCWD) {
-					relativeTo = self->fsContext()->getWorkingDirectory();
-				} else {
-					file = self->fileContext()->getFile(req->fd());
-					if (!file) {
-						co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-						continue;
-					}
+	co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+	co_return true;
+}
 
-					relativeTo = {file->associatedMount(), file->associatedLink()};
-				}
+async::result<bool> handleFsync(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &recv_head = ctx.head;
 
-				PathResolver resolver;
-				resolver.setup(self->fsContext()->getRoot(),
-						relativeTo, req->path(), self.get());
-				auto resolveResult = co_await resolver.resolve();
-				if(!resolveResult) {
-					if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-						co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-						continue;
-					} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-						co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-						continue;
-					} else {
-						std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-						co_return;
-					}
-				}
+	auto req = bragi::parse_head_only<managarm::posix::FsyncRequest>(recv_head);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-				target = resolver.currentLink()->getTarget();
-			}
+	if(logRequests)
+		std::cout << "posix: FSYNC " << req->fd() << std::endl;
 
-			co_await target->utimensat(req->atimeSec(), req->atimeNsec(), req->mtimeSec(), req->mtimeNsec());
+	auto file = self->fileContext()->getFile(req->fd());
+	if(!file) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_SUCH_FD);
+		co_return true;
+	}
 
-			co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
-		}else if(req.request_type() == managarm::posix::CntReqType::READLINK) {
-			if(logRequests || logPaths)
-				std::cout << "posix: READLINK path: " << req.path() << std::endl;
-
-			helix::SendBuffer send_resp;
-			helix::SendBuffer send_data;
-
-			auto pathResult = co_await resolve(self->fsContext()->getRoot(),
-					self->fsContext()->getWorkingDirectory(), req.path(), self.get(), resolveDontFollow);
-			if(!pathResult) {
-				if(pathResult.error() == protocols::fs::Error::fileNotFound) {
-					managarm::posix::SvrResponse resp;
-					resp.set_error(managarm::posix::Errors::FILE_NOT_FOUND);
-
-					auto ser = resp.SerializeAsString();
-					auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-							helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
-							helix::action(&send_data, nullptr, 0));
-					co_await transmit.async_wait();
-					HEL_CHECK(send_resp.error());
-					continue;
-				} else if(pathResult.error() == protocols::fs::Error::notDirectory) {
-					managarm::posix::SvrResponse resp;
-					resp.set_error(managarm::posix::Errors::NOT_A_DIRECTORY);
-
-					auto ser = resp.SerializeAsString();
-					auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-							helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
-							helix::action(&send_data, nullptr, 0));
-					co_await transmit.async_wait();
-					HEL_CHECK(send_resp.error());
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
-			auto path = pathResult.value();
+	// The request goes to the server of the file, which is the posix subsystem
+	// itself for files that do not live on an external file system.
+	auto result = co_await protocols::fs::sync(file->getPassthroughLane());
+	if(!result) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_OPERATION_TARGET);
+		co_return true;
+	}
 
-			auto result = co_await path.second->getTarget()->readSymlink(path.second.get(), self.get());
-			if(auto error = std::get_if<Error>(&result); error) {
-				assert(*error == Error::illegalOperationTarget);
+	co_await ctx.sendErrorResponse(managarm::posix::Errors::SUCCESS);
+	co_return true;
+}
 
-				managarm::posix::SvrResponse resp;
-				resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+// Data is copied by at most this many bytes per PT_WRITE_FROM_MEMORY.
+constexpr size_t copyFileRangeChunk = 1 << 20;
 
-				auto ser = resp.SerializeAsString();
-				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-						helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
-						helix::action(&send_data, nullptr, 0));
-				co_await transmit.async_wait();
-				HEL_CHECK(send_resp.error());
-			}else{
-				auto &target = std::get<std::string>(result);
+async::result<bool> handleCopyFileRange(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-				managarm::posix::SvrResponse resp;
-				resp.set_error(managarm::posix::Errors::SUCCESS);
+	auto req = bragi::parse_head_only<managarm::posix::CopyFileRangeRequest>(recv_head);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-				auto ser = resp.SerializeAsString();
-				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-						helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
-						helix::action(&send_data, target.data(), target.size()));
-				co_await transmit.async_wait();
-				HEL_CHECK(send_resp.error());
-			}
-		}else if(preamble.id() == bragi::message_id<managarm::posix::OpenAtRequest>) {
-			std::vector<std::byte> tail(preamble.tail_size());
-			auto [recvTail] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(tail.data(), tail.size())
-				);
-			HEL_CHECK(recvTail.error());
-
-			auto req = bragi::parse_head_tail<managarm::posix::OpenAtRequest>(recv_head, tail);
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
-			if(logRequests || logPaths)
-				std::cout << "posix: OPENAT path: " << req->path() << std::endl;
-
-			if((req->flags() & ~(managarm::posix::OpenFlags::OF_CREATE
-					| managarm::posix::OpenFlags::OF_EXCLUSIVE
-					| managarm::posix::OpenFlags::OF_NONBLOCK
-					| managarm::posix::OpenFlags::OF_CLOEXEC
-					| managarm::posix::OpenFlags::OF_TRUNC
-					| managarm::posix::OpenFlags::OF_RDONLY
-					| managarm::posix::OpenFlags::OF_WRONLY
-					| managarm::posix::OpenFlags::OF_RDWR
-					| managarm::posix::OpenFlags::OF_PATH))) {
-				std::cout << "posix: OPENAT flags not recognized: " << req->flags() << std::endl;
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
-			}
+	if(logRequests)
+		std::cout << "posix: COPY_FILE_RANGE from " << req->in_fd()
+				<< " to " << req->out_fd() << std::endl;
 
-			SemanticFlags semantic_flags = 0;
-			if(req->flags() & managarm::posix::OpenFlags::OF_NONBLOCK)
-				semantic_flags |= semanticNonBlock;
+	auto inFile = self->fileContext()->getFile(req->in_fd());
+	auto outFile = self->fileContext()->getFile(req->out_fd());
+	if(!inFile || !outFile) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_SUCH_FD);
+		co_return true;
+	}
 
-			if (req->flags() & managarm::posix::OpenFlags::OF_RDONLY)
-				semantic_flags |= semanticRead;
-			else if (req->flags() & managarm::posix::OpenFlags::OF_WRONLY)
-				semantic_flags |= semanticWrite;
-			else if (req->flags() & managarm::posix::OpenFlags::OF_RDWR)
-				semantic_flags |= semanticRead | semanticWrite;
+	// We hand the page cache of the input file to the server of the output file
+	// (e.g., netserver or a file system server), such that the data is never copied
+	// through the posix server or the client. Clients fall back to read() and write()
+	// for other kinds of input files.
+	auto link = inFile->associatedLink();
+	if(!link || link->getTarget()->getType() != VfsType::regular) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_OPERATION_TARGET);
+		co_return true;
+	}
 
-			ViewPath relative_to;
-			smarter::shared_ptr<File, FileHandle> file;
-			std::shared_ptr<FsLink> target_link;
+	auto statsResult = co_await link->getTarget()->getStats();
+	assert(statsResult);
+	uint64_t fileSize = statsResult.value().fileSize;
+
+	uint64_t offset;
+	if(req->in_offset() < 0) {
+		auto seekResult = co_await inFile->seek(0, VfsSeek::relative);
+		assert(seekResult);
+		offset = seekResult.value();
+	}else{
+		offset = req->in_offset();
+	}
 
-			if(req->fd() == AT_FDCWD) {
-				relative_to = self->fsContext()->getWorkingDirectory();
-			} else {
-				file = self->fileContext()->getFile(req->fd());
+	size_t length = 0;
+	if(offset < fileSize)
+		length = std::min<uint64_t>(req->size(), fileSize - offset);
+
+	auto memory = co_await inFile->accessMemory();
+	auto lane = outFile->getPassthroughLane();
+
+	size_t progress = 0;
+	managarm::posix::Errors error = managarm::posix::Errors::SUCCESS;
+	while(progress < length) {
+		auto chunk = std::min(length - progress, copyFileRangeChunk);
+		auto writeResult = co_await protocols::fs::writeFromMemory(lane, memory,
+				offset + progress, chunk);
+		if(!writeResult) {
+			switch(writeResult.error()) {
+			case protocols::fs::Error::wouldBlock:
+				error = managarm::posix::Errors::WOULD_BLOCK;
+				break;
+			case protocols::fs::Error::brokenPipe:
+				error = managarm::posix::Errors::BROKEN_PIPE;
+				break;
+			case protocols::fs::Error::illegalOperationTarget:
+				error = managarm::posix::Errors::ILLEGAL_OPERATION_TARGET;
+				break;
+			default:
+				error = managarm::posix::Errors::ILLEGAL_ARGUMENTS;
+			}
+			break;
+		}
+		progress += writeResult.value();
 
-				if (!file) {
-					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
-				}
+		// Short writes happen if e.g. a socket buffer is full; report what we have.
+		if(writeResult.value() < chunk)
+			break;
+	}
 
-				relative_to = {file->associatedMount(), file->associatedLink()};
-			}
+	// Errors are only reported if nothing was copied, as for write().
+	if(!progress && error != managarm::posix::Errors::SUCCESS) {
+		co_await ctx.sendErrorResponse(error);
+		co_return true;
+	}
 
-			PathResolver resolver;
-			resolver.setup(self->fsContext()->getRoot(),
-					relative_to, req->path(), self.get());
-			if(req->flags() & managarm::posix::OpenFlags::OF_CREATE) {
-				auto resolveResult = co_await resolver.resolve(
-						resolvePrefix | resolveNoTrailingSlash);
-				if(!resolveResult) {
-					if(resolveResult.error() == protocols::fs::Error::isDirectory) {
-						// TODO: Verify additional constraints for sending EISDIR.
-						co_await sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
-						continue;
-					} else if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-						co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-						continue;
-					} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-						co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-						continue;
-					} else {
-						std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-						co_return;
-					}
-				}
+	if(req->in_offset() < 0 && progress) {
+		auto seekResult = co_await inFile->seek(offset + progress, VfsSeek::absolute);
+		assert(seekResult);
+	}
 
-				if(logRequests)
-					std::cout << "posix: Creating file " << req->path() << std::endl;
-
-				auto directory = resolver.currentLink()->getTarget();
-				auto tailResult = co_await directory->getLink(resolver.nextComponent());
-				assert(tailResult);
-				auto tail = tailResult.value();
-				if(tail) {
-					if(req->flags() & managarm::posix::OpenFlags::OF_EXCLUSIVE) {
-						co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
-						continue;
-					}else{
-						auto fileResult = co_await tail->getTarget()->open(
-											resolver.currentView(), std::move(tail),
-											semantic_flags);
-						assert(fileResult);
-						file = fileResult.value();
-						assert(file);
-					}
-				}else{
-					assert(directory->superblock());
-					auto node = co_await directory->superblock()->createRegular();
-					if (!node) {
-						co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-						continue;
-					}
-					// Due to races, link() can fail here.
-					// TODO: Implement a version of link() that eithers links the new node
-					// or returns the current node without failing.
-					auto linkResult = co_await directory->link(resolver.nextComponent(), node);
-					assert(linkResult);
-					auto link = linkResult.value();
-					auto fileResult = co_await node->open(resolver.currentView(), std::move(link),
-										semantic_flags);
-					assert(fileResult);
-					file = fileResult.value();
-					assert(file);
-				}
-			}else{
-				auto resolveResult = co_await resolver.resolve();
-				if(!resolveResult) {
-					if(resolveResult.error() == protocols::fs::Error::isDirectory) {
-						// TODO: Verify additional constraints for sending EISDIR.
-						co_await sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
-						continue;
-					} else if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-						co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-						continue;
-					} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-						co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-						continue;
-					} else {
-						std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-						co_return;
-					}
-				}
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_size(progress);
+
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+		conversation,
+		helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+	);
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-				auto target = resolver.currentLink()->getTarget();
+async::result<bool> handleSigAction(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-				if(req->flags() & managarm::posix::OpenFlags::OF_PATH) {
-					auto dummyFile = smarter::make_shared<DummyFile>(resolver.currentView(), resolver.currentLink());
-					DummyFile::serve(dummyFile);
-					file = File::constructHandle(std::move(dummyFile));
-				} else {
-					auto fileResult = co_await target->open(resolver.currentView(), resolver.currentLink(), semantic_flags);
-					if(!fileResult) {
-						if(fileResult.error() == Error::noBackingDevice) {
-							co_await sendErrorResponse(managarm::posix::Errors::NO_BACKING_DEVICE);
-							continue;
-						} else {
-							std::cout << "posix: Unexpected failure from open()" << std::endl;
-							co_return;
-						}
-					}
-					assert(fileResult);
-					file = fileResult.value();
-				}
-			}
+	if(logRequests)
+		std::cout << "posix: SIG_ACTION" << std::endl;
 
-			if(!file) {
-				if(logRequests)
-					std::cout << "posix:     OPEN failed: file not found" << std::endl;
-				co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-				continue;
-			}
+	if(req.flags() & ~(SA_ONSTACK | SA_SIGINFO | SA_RESETHAND | SA_NODEFER | SA_RESTART | SA_NOCLDSTOP)) {
+		std::cout << "\e[31mposix: Unknown SIG_ACTION flags: 0x"
+				<< std::hex << req.flags()
+				<< std::dec << "\e[39m" << std::endl;
+		assert(!"Flags not implemented");
+	}
 
-			if(req->flags() & managarm::posix::OpenFlags::OF_TRUNC) {
-				auto result = co_await file->truncate(0);
-				assert(result || result.error() == protocols::fs::Error::illegalOperationTarget);
-			}
-			int fd = self->fileContext()->attachFile(file,
-					req->flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
+	helix::SendBuffer send_resp;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_fd(fd);
+	managarm::posix::SvrResponse resp;
 
-			auto [sendResp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
-			HEL_CHECK(sendResp.error());
-		}else if(preamble.id() == bragi::message_id<managarm::posix::CloseRequest>) {
-			auto req = bragi::parse_head_only<managarm::posix::CloseRequest>(recv_head);
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
-			if(logRequests)
-				std::cout << "posix: CLOSE file descriptor " << req->fd() << std::endl;
+	if(req.sig_number() <= 0 || req.sig_number() > 64) {
+		resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		auto ser = resp.SerializeAsString();
+		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&send_resp, ser.data(), ser.size()));
+		co_await transmit.async_wait();
+		HEL_CHECK(send_resp.error());
+		co_return true;
+	}
 
-			self->fileContext()->closeFile(req->fd());
+	SignalHandler saved_handler;
+	if(req.mode()) {
+		SignalHandler handler;
+		if(req.sig_handler() == uintptr_t(-2)) {
+			handler.disposition = SignalDisposition::none;
+		}else if(req.sig_handler() == uintptr_t(-3)) {
+			handler.disposition = SignalDisposition::ignore;
+		}else{
+			handler.disposition = SignalDisposition::handle;
+			handler.handlerIp = req.sig_handler();
+		}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+		handler.flags = 0;
+		handler.mask = req.sig_mask();
+		handler.restorerIp = req.sig_restorer();
+
+		if(req.flags() & SA_SIGINFO)
+			handler.flags |= signalInfo;
+		if(req.flags() & SA_RESETHAND)
+			handler.flags |= signalOnce;
+		if(req.flags() & SA_NODEFER)
+			handler.flags |= signalReentrant;
+		if(req.flags() & SA_ONSTACK)
+			handler.flags |= signalOnStack;
+		if(req.flags() & SA_RESTART)
+			std::cout << "\e[31mposix: Ignoring SA_RESTART\e[39m" << std::endl;
+		if(req.flags() & SA_NOCLDSTOP)
+			std::cout << "\e[31mposix: Ignoring SA_NOCLDSTOP\e[39m" << std::endl;
+
+		saved_handler = self->signalContext()->changeHandler(req.sig_number(), handler);
+	}else{
+		saved_handler = self->signalContext()->getHandler(req.sig_number());
+	}
 
-			auto [sendResp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
-			HEL_CHECK(sendResp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::DUP) {
-			if(logRequests)
-				std::cout << "posix: DUP" << std::endl;
+	int saved_flags = 0;
+	if(saved_handler.flags & signalInfo)
+		saved_flags |= SA_SIGINFO;
+	if(saved_handler.flags & signalOnce)
+		saved_flags |= SA_RESETHAND;
+	if(saved_handler.flags & signalReentrant)
+		saved_flags |= SA_NODEFER;
+	if(saved_handler.flags & signalOnStack)
+		saved_flags |= SA_ONSTACK;
+
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_flags(saved_flags);
+	resp.set_sig_mask(saved_handler.mask);
+	if(saved_handler.disposition == SignalDisposition::handle) {
+		resp.set_sig_handler(saved_handler.handlerIp);
+		resp.set_sig_restorer(saved_handler.restorerIp);
+	}else if(saved_handler.disposition == SignalDisposition::none) {
+		resp.set_sig_handler(-2);
+	}else{
+		assert(saved_handler.disposition == SignalDisposition::ignore);
+		resp.set_sig_handler(-3);
+	}
 
-			auto file = self->fileContext()->getFile(req.fd());
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			if (!file) {
-				helix::SendBuffer send_resp;
+async::result<bool> handlePipeCreate(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-				managarm::posix::SvrResponse resp;
-				resp.set_error(managarm::posix::Errors::BAD_FD);
+	if(logRequests)
+		std::cout << "posix: PIPE_CREATE" << std::endl;
 
-				auto ser = resp.SerializeAsString();
-				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-						helix::action(&send_resp, ser.data(), ser.size()));
-				co_await transmit.async_wait();
-				HEL_CHECK(send_resp.error());
-				continue;
-			}
+	assert(!(req.flags() & ~(O_CLOEXEC | O_NONBLOCK)));
 
-			if(req.flags() & ~(managarm::posix::OpenFlags::OF_CLOEXEC)) {
-				helix::SendBuffer send_resp;
+	bool nonBlock = false;
 
-				managarm::posix::SvrResponse resp;
-				resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+	if(req.flags() & O_NONBLOCK)
+		nonBlock = true;
 
-				auto ser = resp.SerializeAsString();
-				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-						helix::action(&send_resp, ser.data(), ser.size()));
-				co_await transmit.async_wait();
-				HEL_CHECK(send_resp.error());
-				continue;
-			}
+	helix::SendBuffer send_resp;
 
-			int newfd = self->fileContext()->attachFile(file,
-					req.flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
+	auto pair = fifo::createPair(nonBlock);
+	auto r_fd = self->fileContext()->attachFile(std::get<0>(pair),
+			req.flags() & O_CLOEXEC);
+	if(r_fd < 0) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_FILE_DESCRIPTORS);
+		co_return true;
+	}
+	auto w_fd = self->fileContext()->attachFile(std::get<1>(pair),
+			req.flags() & O_CLOEXEC);
+	if(w_fd < 0) {
+		self->fileContext()->closeFile(r_fd);
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_FILE_DESCRIPTORS);
+		co_return true;
+	}
 
-			helix::SendBuffer send_resp;
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.add_fds(r_fd);
+	resp.add_fds(w_fd);
+
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_fd(newfd);
+async::result<bool> handleSetsid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::DUP2) {
-			if(logRequests)
-				std::cout << "posix: DUP2" << std::endl;
+	if(logRequests)
+		std::cout << "posix: SETSID" << std::endl;
 
-			auto file = self->fileContext()->getFile(req.fd());
+	managarm::posix::SvrResponse resp;
 
-			if (!file || req.newfd() < 0) {
-				helix::SendBuffer send_resp;
+	if(self->pgPointer()->getSession()->getSessionId() == self->pid()) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
+		co_return true;
+	}
 
-				managarm::posix::SvrResponse resp;
-				resp.set_error(managarm::posix::Errors::BAD_FD);
+	auto session = TerminalSession::initializeNewSession(self.get());
 
-				auto ser = resp.SerializeAsString();
-				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-						helix::action(&send_resp, ser.data(), ser.size()));
-				co_await transmit.async_wait();
-				HEL_CHECK(send_resp.error());
-				continue;
-			}
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_sid(session->getSessionId());
 
-			if(req.flags()) {
-				helix::SendBuffer send_resp;
+	auto ser = resp.SerializeAsString();
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
+			helix_ng::sendBuffer(ser.data(), ser.size()));
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-				managarm::posix::SvrResponse resp;
-				resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+async::result<bool> handleSocket(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-				auto ser = resp.SerializeAsString();
-				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-						helix::action(&send_resp, ser.data(), ser.size()));
-				co_await transmit.async_wait();
-				HEL_CHECK(send_resp.error());
-				continue;
-			}
+	auto req = bragi::parse_head_only<managarm::posix::SocketRequest>(recv_head);
 
-			self->fileContext()->attachFile(req.newfd(), file);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			helix::SendBuffer send_resp;
+	if(logRequests)
+		std::cout << "posix: SOCKET" << std::endl;
+
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+
+	assert(!(req->flags() & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)));
+
+	smarter::shared_ptr<File, FileHandle> file;
+	if(req->domain() == AF_UNIX) {
+		assert(req->socktype() == SOCK_DGRAM || req->socktype() == SOCK_STREAM
+				|| req->socktype() == SOCK_SEQPACKET);
+		assert(!req->protocol());
+
+		file = un_socket::createSocketFile(req->flags() & SOCK_NONBLOCK);
+	}else if(req->domain() == AF_NETLINK) {
+		assert(req->socktype() == SOCK_RAW || req->socktype() == SOCK_DGRAM);
+		file = nl_socket::createSocketFile(req->protocol());
+	} else if (req->domain() == AF_INET) {
+		file = co_await extern_socket::createSocket(
+			co_await net::getNetLane(),
+			req->domain(),
+			req->socktype(), req->protocol(),
+			req->flags() & SOCK_NONBLOCK);
+	}else{
+		throw std::runtime_error("posix: Handle unknown protocol families");
+	}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	auto fd = self->fileContext()->attachFile(file,
+			req->flags() & SOCK_CLOEXEC);
+	if(fd < 0) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_FILE_DESCRIPTORS);
+		co_return true;
+	}
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == bragi::message_id<managarm::posix::IsTtyRequest>) {
-			auto req = bragi::parse_head_only<managarm::posix::IsTtyRequest>(recv_head);
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
-			if(logRequests)
-				std::cout << "posix: IS_TTY" << std::endl;
+	resp.set_fd(fd);
 
-			auto file = self->fileContext()->getFile(req->fd());
-			if(!file) {
-				co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_FD);
-				continue;
-			}
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			helix::SendBuffer send_resp;
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_mode(file->isTerminal());
-
-			auto [sendResp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
-			HEL_CHECK(sendResp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::TTY_NAME) {
-			if(logRequests)
-				std::cout << "posix: TTY_NAME" << std::endl;
+async::result<bool> handleSockpair(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			helix::SendBuffer send_resp;
+	auto req = bragi::parse_head_only<managarm::posix::SockpairRequest>(recv_head);
 
-			std::cout << "\e[31mposix: Fix TTY_NAME\e[39m" << std::endl;
-			managarm::posix::SvrResponse resp;
-			resp.set_path("/dev/ttyS0");
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::GETCWD) {
-			if(logRequests)
-				std::cout << "posix: GETCWD" << std::endl;
+	if(logRequests)
+		std::cout << "posix: SOCKPAIR" << std::endl;
 
-			std::string path = self->fsContext()->getWorkingDirectory().getPath(
-					self->fsContext()->getRoot());
+	assert(!(req->flags() & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)));
 
-			helix::SendBuffer send_resp;
-			helix::SendBuffer send_path;
+	if(req->flags() & SOCK_NONBLOCK)
+		std::cout << "\e[31mposix: socketpair(SOCK_NONBLOCK)"
+				" is not implemented correctly\e[39m" << std::endl;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_size(path.size());
+	assert(req->domain() == AF_UNIX);
+	assert(req->socktype() == SOCK_DGRAM || req->socktype() == SOCK_STREAM
+			|| req->socktype() == SOCK_SEQPACKET);
+	assert(!req->protocol());
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
-					helix::action(&send_path, path.data(),
-							std::min(static_cast<size_t>(req.size()), path.size() + 1)));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-			HEL_CHECK(send_path.error());
-		}else if(preamble.id() == managarm::posix::UnlinkAtRequest::message_id) {
-			std::vector<std::byte> tail(preamble.tail_size());
-			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(tail.data(), tail.size())
-				);
-			HEL_CHECK(recv_tail.error());
-
-			auto req = bragi::parse_head_tail<managarm::posix::UnlinkAtRequest>(recv_head, tail);
-
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	auto pair = un_socket::createSocketPair(self.get());
+	auto fd0 = self->fileContext()->attachFile(std::get<0>(pair),
+			req->flags() & SOCK_CLOEXEC);
+	if(fd0 < 0) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_FILE_DESCRIPTORS);
+		co_return true;
+	}
+	auto fd1 = self->fileContext()->attachFile(std::get<1>(pair),
+			req->flags() & SOCK_CLOEXEC);
+	if(fd1 < 0) {
+		self->fileContext()->closeFile(fd0);
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_FILE_DESCRIPTORS);
+		co_return true;
+	}
 
-			if(logRequests || logPaths)
-				std::cout << "posix: UNLINKAT path: " << req->path() << std::endl;
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.add_fds(fd0);
+	resp.add_fds(fd1);
 
-			ViewPath relative_to;
-			smarter::shared_ptr<File, FileHandle> file;
-			std::shared_ptr<FsLink> target_link;
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			if(req->flags()) {
-				if(req->flags() & AT_REMOVEDIR) {
-					std::cout << "posix: UNLINKAT flag AT_REMOVEDIR handling unimplemented" << std::endl;
-				} else {
-					std::cout << "posix: UNLINKAT flag handling unimplemented with unknown flag: " << req->flags() << std::endl;
-					co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				}
-			}
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			if(req->fd() == AT_FDCWD) {
-				relative_to = self->fsContext()->getWorkingDirectory();
-			} else {
-				file = self->fileContext()->getFile(req->fd());
+async::result<bool> handleAccept(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-				if (!file) {
-					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
-				}
+	auto req = bragi::parse_head_only<managarm::posix::AcceptRequest>(recv_head);
 
-				relative_to = {file->associatedMount(), file->associatedLink()};
-			}
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			PathResolver resolver;
-			resolver.setup(self->fsContext()->getRoot(),
-					relative_to, req->path(), self.get());
-
-			auto resolveResult = co_await resolver.resolve();
-			if(!resolveResult) {
-				if(resolveResult.error() == protocols::fs::Error::isDirectory) {
-					// TODO: Only when AT_REMOVEDIR is not specified, fix this when flag handling is implemented.
-					co_await sendErrorResponse(managarm::posix::Errors::IS_DIRECTORY);
-					continue;
-				} else if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
+	if(logRequests)
+		std::cout << "posix: ACCEPT" << std::endl;
 
-			target_link = resolver.currentLink();
+	auto sockfile = self->fileContext()->getFile(req->fd());
+	if(!sockfile) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+		co_return true;
+	}
 
-			auto owner = target_link->getOwner();
-			if(!owner) {
-				co_await sendErrorResponse(managarm::posix::Errors::RESOURCE_IN_USE);
-				continue;
-			}
-			auto result = co_await owner->unlink(target_link->getName());
-			if(!result) {
-				if(result.error() == Error::noSuchFile) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				}else{
-					std::cout << "posix: Unexpected failure from unlink()" << std::endl;
-					co_return;
-				}
-			}
+	auto newfileResult = co_await sockfile->accept(self.get());
+	if(!newfileResult) {
+		if(newfileResult.error() == Error::illegalArguments) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+			co_return true;
+		}
+		assert(newfileResult.error() == Error::wouldBlock);
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::WOULD_BLOCK);
+		co_return true;
+	}
+	auto newfile = newfileResult.value();
+	auto fd = self->fileContext()->attachFile(std::move(newfile));
+	if(fd < 0) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_FILE_DESCRIPTORS);
+		co_return true;
+	}
 
-			co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
-		}else if(preamble.id() == managarm::posix::RmdirRequest::message_id) {
-			std::vector<std::byte> tail(preamble.tail_size());
-			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(tail.data(), tail.size())
-				);
-			HEL_CHECK(recv_tail.error());
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_fd(fd);
 
-			auto req = bragi::parse_head_tail<managarm::posix::RmdirRequest>(recv_head, tail);
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			if(logRequests || logPaths)
-				std::cout << "posix: RMDIR " << req->path() << std::endl;
-
-			std::cout << "\e[31mposix: RMDIR: always removes the directory, even when not empty\e[39m" << std::endl;
-			std::shared_ptr<FsLink> target_link;
-
-			PathResolver resolver;
-			resolver.setup(self->fsContext()->getRoot(), self->fsContext()->getWorkingDirectory(),
-					req->path(), self.get());
-
-			auto resolveResult = co_await resolver.resolve();
-			if(!resolveResult) {
-				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
+async::result<bool> handleEpollCall(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-			target_link = resolver.currentLink();
+	if(logRequests)
+		std::cout << "posix: EPOLL_CALL" << std::endl;
 
-			auto owner = target_link->getOwner();
-			auto result = co_await owner->rmdir(target_link->getName());
-			if(!result) {
-				std::cout << "posix: Unexpected failure from rmdir()" << std::endl;
-				co_return;
-			}
+	helix::SendBuffer send_resp;
 
-			co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
-		}else if(req.request_type() == managarm::posix::CntReqType::FD_GET_FLAGS) {
-			if(logRequests)
-				std::cout << "posix: FD_GET_FLAGS" << std::endl;
+	// Since file descriptors may appear multiple times in a poll() call,
+	// we need to de-duplicate them here.
+	std::unordered_map<int, unsigned int> fdsToEvents;
 
-			helix::SendBuffer send_resp;
+	auto epfile = epoll::createFile();
+	assert(req.fds_size() == req.events_size());
 
-			auto descriptor = self->fileContext()->getDescriptor(req.fd());
-			if(!descriptor) {
-				managarm::posix::SvrResponse resp;
-				resp.set_error(managarm::posix::Errors::NO_SUCH_FD);
+	bool errorOut = false;
+	for(size_t i = 0; i < req.fds_size(); i++) {
+		auto [mapIt, inserted] = fdsToEvents.insert({req.fds(i), 0});
+		if(!inserted)
+			continue;
 
-				auto ser = resp.SerializeAsString();
-				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-						helix::action(&send_resp, ser.data(), ser.size()));
-				co_await transmit.async_wait();
-				HEL_CHECK(send_resp.error());
-				continue;
-			}
+		auto file = self->fileContext()->getFile(req.fds(i));
+		if(!file) {
+			// poll() is supposed to fail on a per-FD basis.
+			mapIt->second = POLLNVAL;
+			continue;
+		}
+		auto locked = file->weakFile().lock();
+		assert(locked);
+
+		// Translate POLL events to EPOLL events.
+		if(req.events(i) & ~(POLLIN | POLLPRI | POLLOUT | POLLRDHUP | POLLERR | POLLHUP
+				| POLLNVAL)) {
+			std::cout << "\e[31mposix: Unexpected events for poll()\e[39m" << std::endl;
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+			errorOut = true;
+			break;
+		}
 
-			int flags = 0;
-			if(descriptor->closeOnExec)
-				flags |= FD_CLOEXEC;
+		unsigned int mask = 0;
+		if(req.events(i) & POLLIN) mask |= EPOLLIN;
+		if(req.events(i) & POLLOUT) mask |= EPOLLOUT;
+		if(req.events(i) & POLLPRI) mask |= EPOLLPRI;
+		if(req.events(i) & POLLRDHUP) mask |= EPOLLRDHUP;
+		if(req.events(i) & POLLERR) mask |= EPOLLERR;
+		if(req.events(i) & POLLHUP) mask |= EPOLLHUP;
+
+		// addItem() can fail with EEXIST but we check for duplicate FDs above
+		// so that cannot happen here.
+		Error ret = epoll::addItem(epfile.get(), self.get(),
+				std::move(locked), req.fds(i), mask, req.fds(i));
+		assert(ret == Error::success);
+	}
+	if(errorOut)
+		co_return true;
+
+	// Collect the events of all FDs at once; otherwise, only a subset of the FDs
+	// would be reported as ready if many of them are.
+	std::vector<struct epoll_event> events(std::max(fdsToEvents.size(), size_t{1}));
+	size_t k;
+	if(req.timeout() < 0) {
+		k = co_await epoll::wait(epfile.get(), events.data(), events.size());
+	}else if(!req.timeout()) {
+		// Do not bother to set up a timer for zero timeouts.
+		async::cancellation_event cancel_wait;
+		cancel_wait.cancel();
+		k = co_await epoll::wait(epfile.get(), events.data(), events.size(), cancel_wait);
+	}else{
+		assert(req.timeout() > 0);
+		async::cancellation_event cancel_wait;
+		helix::TimeoutCancellation timer{static_cast<uint64_t>(req.timeout()), cancel_wait};
+		k = co_await epoll::wait(epfile.get(), events.data(), events.size(), cancel_wait);
+		co_await timer.retire();
+	}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_flags(flags);
+	// Assigned the returned events to each FD.
+	for(size_t j = 0; j < k; ++j) {
+		auto it = fdsToEvents.find(events[j].data.fd);
+		assert(it != fdsToEvents.end());
+
+		// Translate EPOLL events back to POLL events.
+		assert(!it->second);
+		if(events[j].events & EPOLLIN) it->second |= POLLIN;
+		if(events[j].events & EPOLLOUT) it->second |= POLLOUT;
+		if(events[j].events & EPOLLPRI) it->second |= POLLPRI;
+		if(events[j].events & EPOLLRDHUP) it->second |= POLLRDHUP;
+		if(events[j].events & EPOLLERR) it->second |= POLLERR;
+		if(events[j].events & EPOLLHUP) it->second |= POLLHUP;
+	}
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::FD_SET_FLAGS) {
-			if(logRequests)
-				std::cout << "posix: FD_SET_FLAGS" << std::endl;
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			if(req.flags() & ~FD_CLOEXEC) {
-				std::cout << "posix: FD_SET_FLAGS unknown flags: " << req.flags() << std::endl;
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
-			}
-			int closeOnExec = req.flags() & FD_CLOEXEC;
-			if(self->fileContext()->setDescriptor(req.fd(), closeOnExec) != Error::success) {
-				co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_FD);
-				continue;
-			}
+	for(size_t i = 0; i < req.fds_size(); ++i) {
+		auto it = fdsToEvents.find(req.fds(i));
+		assert(it != fdsToEvents.end());
+		resp.add_events(it->second);
+	}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			auto ser = resp.SerializeAsString();
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size()));
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == bragi::message_id<managarm::posix::IoctlFioclexRequest>) {
-			auto req = bragi::parse_head_only<managarm::posix::IoctlFioclexRequest>(recv_head);
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+async::result<bool> handleEpollCreate(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-			if(logRequests)
-				std::cout << "posix: FIOCLEX" << std::endl;
+	if(logRequests)
+		std::cout << "posix: EPOLL_CREATE" << std::endl;
 
-			if(self->fileContext()->setDescriptor(req->fd(), true) != Error::success) {
-				co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_FD);
-				continue;
-			}
+	helix::SendBuffer send_resp;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	assert(!(req.flags() & ~(managarm::posix::OpenFlags::OF_CLOEXEC)));
 
-			auto ser = resp.SerializeAsString();
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size()));
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::SIG_ACTION) {
-			if(logRequests)
-				std::cout << "posix: SIG_ACTION" << std::endl;
+	auto file = epoll::createFile();
+	auto fd = self->fileContext()->attachFile(file,
+			req.flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
+	if(fd < 0) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_FILE_DESCRIPTORS);
+		co_return true;
+	}
 
-			if(req.flags() & ~(SA_ONSTACK | SA_SIGINFO | SA_RESETHAND | SA_NODEFER | SA_RESTART | SA_NOCLDSTOP)) {
-				std::cout << "\e[31mposix: Unknown SIG_ACTION flags: 0x"
-						<< std::hex << req.flags()
-						<< std::dec << "\e[39m" << std::endl;
-				assert(!"Flags not implemented");
-			}
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_fd(fd);
 
-			helix::SendBuffer send_resp;
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			managarm::posix::SvrResponse resp;
+async::result<bool> handleEpollAdd(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-			if(req.sig_number() <= 0 || req.sig_number() > 64) {
-				resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				auto ser = resp.SerializeAsString();
-				auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-						helix::action(&send_resp, ser.data(), ser.size()));
-				co_await transmit.async_wait();
-				HEL_CHECK(send_resp.error());
-				continue;
-			}
+	if(logRequests)
+		std::cout << "posix: EPOLL_ADD" << std::endl;
 
-			SignalHandler saved_handler;
-			if(req.mode()) {
-				SignalHandler handler;
-				if(req.sig_handler() == uintptr_t(-2)) {
-					handler.disposition = SignalDisposition::none;
-				}else if(req.sig_handler() == uintptr_t(-3)) {
-					handler.disposition = SignalDisposition::ignore;
-				}else{
-					handler.disposition = SignalDisposition::handle;
-					handler.handlerIp = req.sig_handler();
-				}
+	helix::SendBuffer send_resp;
 
-				handler.flags = 0;
-				handler.mask = req.sig_mask();
-				handler.restorerIp = req.sig_restorer();
-
-				if(req.flags() & SA_SIGINFO)
-					handler.flags |= signalInfo;
-				if(req.flags() & SA_RESETHAND)
-					handler.flags |= signalOnce;
-				if(req.flags() & SA_NODEFER)
-					handler.flags |= signalReentrant;
-				if(req.flags() & SA_ONSTACK)
-					handler.flags |= signalOnStack;
-				if(req.flags() & SA_RESTART)
-					std::cout << "\e[31mposix: Ignoring SA_RESTART\e[39m" << std::endl;
-				if(req.flags() & SA_NOCLDSTOP)
-					std::cout << "\e[31mposix: Ignoring SA_NOCLDSTOP\e[39m" << std::endl;
-
-				saved_handler = self->signalContext()->changeHandler(req.sig_number(), handler);
-			}else{
-				saved_handler = self->signalContext()->getHandler(req.sig_number());
-			}
+	auto epfile = self->fileContext()->getFile(req.fd());
+	auto file = self->fileContext()->getFile(req.newfd());
+	if(!file || !epfile) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+		co_return true;
+	}
 
-			int saved_flags = 0;
-			if(saved_handler.flags & signalInfo)
-				saved_flags |= SA_SIGINFO;
-			if(saved_handler.flags & signalOnce)
-				saved_flags |= SA_RESETHAND;
-			if(saved_handler.flags & signalReentrant)
-				saved_flags |= SA_NODEFER;
-			if(saved_handler.flags & signalOnStack)
-				saved_flags |= SA_ONSTACK;
+	auto locked = file->weakFile().lock();
+	assert(locked);
+	Error ret = epoll::addItem(epfile.get(), self.get(),
+			std::move(locked), req.newfd(), req.flags(), req.cookie());
+	if(ret == Error::alreadyExists) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
+		co_return true;
+	}
+	assert(ret == Error::success);
 
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_flags(saved_flags);
-			resp.set_sig_mask(saved_handler.mask);
-			if(saved_handler.disposition == SignalDisposition::handle) {
-				resp.set_sig_handler(saved_handler.handlerIp);
-				resp.set_sig_restorer(saved_handler.restorerIp);
-			}else if(saved_handler.disposition == SignalDisposition::none) {
-				resp.set_sig_handler(-2);
-			}else{
-				assert(saved_handler.disposition == SignalDisposition::ignore);
-				resp.set_sig_handler(-3);
-			}
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::PIPE_CREATE) {
-			if(logRequests)
-				std::cout << "posix: PIPE_CREATE" << std::endl;
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			assert(!(req.flags() & ~(O_CLOEXEC | O_NONBLOCK)));
+async::result<bool> handleEpollModify(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-			bool nonBlock = false;
+	if(logRequests)
+		std::cout << "posix: EPOLL_MODIFY" << std::endl;
 
-			if(req.flags() & O_NONBLOCK)
-				nonBlock = true;
+	helix::SendBuffer send_resp;
 
-			helix::SendBuffer send_resp;
+	auto epfile = self->fileContext()->getFile(req.fd());
+	auto file = self->fileContext()->getFile(req.newfd());
+	assert(epfile && "Illegal FD for EPOLL_MODIFY");
+	assert(file && "Illegal FD for EPOLL_MODIFY item");
 
-			auto pair = fifo::createPair(nonBlock);
-			auto r_fd = self->fileContext()->attachFile(std::get<0>(pair),
-					req.flags() & O_CLOEXEC);
-			auto w_fd = self->fileContext()->attachFile(std::get<1>(pair),
-					req.flags() & O_CLOEXEC);
+	Error ret = epoll::modifyItem(epfile.get(), file.get(), req.newfd(),
+			req.flags(), req.cookie());
+	if(ret == Error::noSuchFile) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+		co_return true;
+	}
+	assert(ret == Error::success);
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.add_fds(r_fd);
-			resp.add_fds(w_fd);
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::SETSID) {
-			if(logRequests)
-				std::cout << "posix: SETSID" << std::endl;
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			managarm::posix::SvrResponse resp;
+async::result<bool> handleEpollDelete(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-			if(self->pgPointer()->getSession()->getSessionId() == self->pid()) {
-				co_await sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
-				continue;
-			}
+	if(logRequests)
+		std::cout << "posix: EPOLL_DELETE" << std::endl;
 
-			auto session = TerminalSession::initializeNewSession(self.get());
+	helix::SendBuffer send_resp;
 
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_sid(session->getSessionId());
+	auto epfile = self->fileContext()->getFile(req.fd());
+	auto file = self->fileContext()->getFile(req.newfd());
+	if(!epfile || !file) {
+		std::cout << "posix: Illegal FD for EPOLL_DELETE" << std::endl;
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+		co_return true;
+	}
 
-			auto ser = resp.SerializeAsString();
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size()));
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::SocketRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::SocketRequest>(recv_head);
+	Error ret = epoll::deleteItem(epfile.get(), file.get(), req.newfd(), req.flags());
+	if(ret == Error::noSuchFile) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+		co_return true;
+	}
+	assert(ret == Error::success);
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			if(logRequests)
-				std::cout << "posix: SOCKET" << std::endl;
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+async::result<bool> handleEpollWait(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-			assert(!(req->flags() & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)));
-
-			smarter::shared_ptr<File, FileHandle> file;
-			if(req->domain() == AF_UNIX) {
-				assert(req->socktype() == SOCK_DGRAM || req->socktype() == SOCK_STREAM
-						|| req->socktype() == SOCK_SEQPACKET);
-				assert(!req->protocol());
-
-				file = un_socket::createSocketFile(req->flags() & SOCK_NONBLOCK);
-			}else if(req->domain() == AF_NETLINK) {
-				assert(req->socktype() == SOCK_RAW || req->socktype() == SOCK_DGRAM);
-				file = nl_socket::createSocketFile(req->protocol());
-			} else if (req->domain() == AF_INET) {
-				file = co_await extern_socket::createSocket(
-					co_await net::getNetLane(),
-					req->domain(),
-					req->socktype(), req->protocol(),
-					req->flags() & SOCK_NONBLOCK);
-			}else{
-				throw std::runtime_error("posix: Handle unknown protocol families");
-			}
+	if(logRequests)
+		std::cout << "posix: EPOLL_WAIT request" << std::endl;
 
-			auto fd = self->fileContext()->attachFile(file,
-					req->flags() & SOCK_CLOEXEC);
+	helix::SendBuffer send_resp;
+	helix::SendBuffer send_data;
+	uint64_t former = self->signalMask();
 
-			resp.set_fd(fd);
+	auto epfile = self->fileContext()->getFile(req.fd());
+	if(!epfile) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+		co_return true;
+	}
+	if(req.sigmask_needed()) {
+		self->setSignalMask(req.sigmask());
+	}
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+	// Servers with many FDs benefit from large batches; bound the buffer nevertheless.
+	std::vector<struct epoll_event> events(std::min(req.size(), uint32_t(256)));
+	size_t k;
+	if(req.timeout() < 0) {
+		k = co_await epoll::wait(epfile.get(), events.data(), events.size());
+	}else if(!req.timeout()) {
+		// Do not bother to set up a timer for zero timeouts.
+		async::cancellation_event cancel_wait;
+		cancel_wait.cancel();
+		k = co_await epoll::wait(epfile.get(), events.data(), events.size(), cancel_wait);
+	}else{
+		assert(req.timeout() > 0);
+		async::cancellation_event cancel_wait;
+		helix::TimeoutCancellation timer{static_cast<uint64_t>(req.timeout()), cancel_wait};
+		k = co_await epoll::wait(epfile.get(), events.data(), events.size(), cancel_wait);
+		co_await timer.retire();
+	}
+	if(req.sigmask_needed()) {
+		self->setSignalMask(former);
+	}
 
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::SockpairRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::SockpairRequest>(recv_head);
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
+			helix::action(&send_data, events.data(), k * sizeof(struct epoll_event)));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			if(logRequests)
-				std::cout << "posix: SOCKPAIR" << std::endl;
+async::result<bool> handleTimerfdCreate(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-			assert(!(req->flags() & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)));
+	if(logRequests)
+		std::cout << "posix: TIMERFD_CREATE" << std::endl;
 
-			if(req->flags() & SOCK_NONBLOCK)
-				std::cout << "\e[31mposix: socketpair(SOCK_NONBLOCK)"
-						" is not implemented correctly\e[39m" << std::endl;
+	helix::SendBuffer send_resp;
 
-			assert(req->domain() == AF_UNIX);
-			assert(req->socktype() == SOCK_DGRAM || req->socktype() == SOCK_STREAM
-					|| req->socktype() == SOCK_SEQPACKET);
-			assert(!req->protocol());
+	assert(!(req.flags() & ~(TFD_CLOEXEC | TFD_NONBLOCK)));
 
-			auto pair = un_socket::createSocketPair(self.get());
-			auto fd0 = self->fileContext()->attachFile(std::get<0>(pair),
-					req->flags() & SOCK_CLOEXEC);
-			auto fd1 = self->fileContext()->attachFile(std::get<1>(pair),
-					req->flags() & SOCK_CLOEXEC);
+	auto file = timerfd::createFile(req.flags() & TFD_NONBLOCK);
+	auto fd = self->fileContext()->attachFile(file, req.flags() & TFD_CLOEXEC);
+	if(fd < 0) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_FILE_DESCRIPTORS);
+		co_return true;
+	}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.add_fds(fd0);
-			resp.add_fds(fd1);
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_fd(fd);
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::AcceptRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::AcceptRequest>(recv_head);
+async::result<bool> handleTimerfdSettime(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	if(logRequests)
+		std::cout << "posix: TIMERFD_SETTIME" << std::endl;
 
-			if(logRequests)
-				std::cout << "posix: ACCEPT" << std::endl;
+	helix::SendBuffer send_resp;
 
-			auto sockfile = self->fileContext()->getFile(req->fd());
-			if(!sockfile) {
-				co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-				continue;
-			}
+	auto file = self->fileContext()->getFile(req.fd());
+	assert(file && "Illegal FD for TIMERFD_SETTIME");
+	timerfd::setTime(file.get(),
+			{static_cast<time_t>(req.time_secs()), static_cast<long>(req.time_nanos())},
+			{static_cast<time_t>(req.interval_secs()), static_cast<long>(req.interval_nanos())});
 
-			auto newfileResult = co_await sockfile->accept(self.get());
-			if(!newfileResult) {
-				assert(newfileResult.error() == Error::wouldBlock);
-				co_await sendErrorResponse(managarm::posix::Errors::WOULD_BLOCK);
-				continue;
-			}
-			auto newfile = newfileResult.value();
-			auto fd = self->fileContext()->attachFile(std::move(newfile));
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_fd(fd);
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+async::result<bool> handleSignalfdCreate(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &req = ctx.req;
 
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::EPOLL_CALL) {
-			if(logRequests)
-				std::cout << "posix: EPOLL_CALL" << std::endl;
+	if(logRequests)
+		std::cout << "posix: SIGNALFD_CREATE" << std::endl;
 
-			helix::SendBuffer send_resp;
+	helix::SendBuffer send_resp;
 
-			// Since file descriptors may appear multiple times in a poll() call,
-			// we need to de-duplicate them here.
-			std::unordered_map<int, unsigned int> fdsToEvents;
+	if(req.flags() & ~(managarm::posix::OpenFlags::OF_CLOEXEC
+			| managarm::posix::OpenFlags::OF_NONBLOCK)) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		co_return true;
+	}
 
-			auto epfile = epoll::createFile();
-			assert(req.fds_size() == req.events_size());
+	auto file = createSignalFile(req.sigset(),
+			req.flags() & managarm::posix::OpenFlags::OF_NONBLOCK);
+	auto fd = self->fileContext()->attachFile(file,
+			req.flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
+	if(fd < 0) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_FILE_DESCRIPTORS);
+		co_return true;
+	}
 
-			bool errorOut = false;
-			for(size_t i = 0; i < req.fds_size(); i++) {
-				auto [mapIt, inserted] = fdsToEvents.insert({req.fds(i), 0});
-				if(!inserted)
-					continue;
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_fd(fd);
 
-				auto file = self->fileContext()->getFile(req.fds(i));
-				if(!file) {
-					// poll() is supposed to fail on a per-FD basis.
-					mapIt->second = POLLNVAL;
-					continue;
-				}
-				auto locked = file->weakFile().lock();
-				assert(locked);
-
-				// Translate POLL events to EPOLL events.
-				if(req.events(i) & ~(POLLIN | POLLPRI | POLLOUT | POLLRDHUP | POLLERR | POLLHUP
-						| POLLNVAL)) {
-					std::cout << "\e[31mposix: Unexpected events for poll()\e[39m" << std::endl;
-					co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-					errorOut = true;
-					break;
-				}
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-				unsigned int mask = 0;
-				if(req.events(i) & POLLIN) mask |= EPOLLIN;
-				if(req.events(i) & POLLOUT) mask |= EPOLLOUT;
-				if(req.events(i) & POLLPRI) mask |= EPOLLPRI;
-				if(req.events(i) & POLLRDHUP) mask |= EPOLLRDHUP;
-				if(req.events(i) & POLLERR) mask |= EPOLLERR;
-				if(req.events(i) & POLLHUP) mask |= EPOLLHUP;
-
-				// addItem() can fail with EEXIST but we check for duplicate FDs above
-				// so that cannot happen here.
-				Error ret = epoll::addItem(epfile.get(), self.get(),
-						std::move(locked), req.fds(i), mask, req.fds(i));
-				assert(ret == Error::success);
-			}
-			if(errorOut)
-				continue;
+async::result<bool> handleInotifyCreate(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			struct epoll_event events[16];
-			size_t k;
-			if(req.timeout() < 0) {
-				k = co_await epoll::wait(epfile.get(), events, 16);
-			}else if(!req.timeout()) {
-				// Do not bother to set up a timer for zero timeouts.
-				async::cancellation_event cancel_wait;
-				cancel_wait.cancel();
-				k = co_await epoll::wait(epfile.get(), events, 16, cancel_wait);
-			}else{
-				assert(req.timeout() > 0);
-				async::cancellation_event cancel_wait;
-				helix::TimeoutCancellation timer{static_cast<uint64_t>(req.timeout()), cancel_wait};
-				k = co_await epoll::wait(epfile.get(), events, 16, cancel_wait);
-				co_await timer.retire();
-			}
+	auto req = bragi::parse_head_only<managarm::posix::InotifyCreateRequest>(recv_head);
 
-			// Assigned the returned events to each FD.
-			for(size_t j = 0; j < k; ++j) {
-				auto it = fdsToEvents.find(events[j].data.fd);
-				assert(it != fdsToEvents.end());
-
-				// Translate EPOLL events back to POLL events.
-				assert(!it->second);
-				if(events[j].events & EPOLLIN) it->second |= POLLIN;
-				if(events[j].events & EPOLLOUT) it->second |= POLLOUT;
-				if(events[j].events & EPOLLPRI) it->second |= POLLPRI;
-				if(events[j].events & EPOLLRDHUP) it->second |= POLLRDHUP;
-				if(events[j].events & EPOLLERR) it->second |= POLLERR;
-				if(events[j].events & EPOLLHUP) it->second |= POLLHUP;
-			}
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	if(logRequests)
+		std::cout << "posix: INOTIFY_CREATE" << std::endl;
 
-			for(size_t i = 0; i < req.fds_size(); ++i) {
-				auto it = fdsToEvents.find(req.fds(i));
-				assert(it != fdsToEvents.end());
-				resp.add_events(it->second);
-			}
+	assert(!(req->flags() & ~(managarm::posix::OpenFlags::OF_CLOEXEC)));
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::EPOLL_CREATE) {
-			if(logRequests)
-				std::cout << "posix: EPOLL_CREATE" << std::endl;
+	auto file = inotify::createFile();
+	auto fd = self->fileContext()->attachFile(file,
+			req->flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
+	if(fd < 0) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_FILE_DESCRIPTORS);
+		co_return true;
+	}
 
-			helix::SendBuffer send_resp;
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_fd(fd);
 
-			assert(!(req.flags() & ~(managarm::posix::OpenFlags::OF_CLOEXEC)));
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			auto file = epoll::createFile();
-			auto fd = self->fileContext()->attachFile(file,
-					req.flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_fd(fd);
+async::result<bool> handleInotifyAdd(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &preamble = ctx.preamble;
+	auto &recv_head = ctx.head;
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::EPOLL_ADD) {
-			if(logRequests)
-				std::cout << "posix: EPOLL_ADD" << std::endl;
+	std::vector<std::byte> tail(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+	HEL_CHECK(recv_tail.error());
 
-			helix::SendBuffer send_resp;
+	auto req = bragi::parse_head_tail<managarm::posix::InotifyAddRequest>(recv_head, tail);
 
-			auto epfile = self->fileContext()->getFile(req.fd());
-			auto file = self->fileContext()->getFile(req.newfd());
-			if(!file || !epfile) {
-				co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-				continue;
-			}
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			auto locked = file->weakFile().lock();
-			assert(locked);
-			Error ret = epoll::addItem(epfile.get(), self.get(),
-					std::move(locked), req.newfd(), req.flags(), req.cookie());
-			if(ret == Error::alreadyExists) {
-				co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
-				continue;
-			}
-			assert(ret == Error::success);
+	managarm::posix::SvrResponse resp;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	if(logRequests || logPaths)
+		std::cout << "posix: INOTIFY_ADD" << req->path() << std::endl;
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::EPOLL_MODIFY) {
-			if(logRequests)
-				std::cout << "posix: EPOLL_MODIFY" << std::endl;
+	auto ifile = self->fileContext()->getFile(req->fd());
+	if(!ifile) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+		co_return true;
+	}
+
+	PathResolver resolver;
+	resolver.setup(self->fsContext()->getRoot(),
+			self->fsContext()->getWorkingDirectory(), req->path(), self.get());
+	auto resolveResult = co_await resolver.resolve();
+	if(!resolveResult) {
+		if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
 
-			helix::SendBuffer send_resp;
+	auto wd = inotify::addWatch(ifile.get(), resolver.currentLink()->getTarget(),
+			req->flags());
 
-			auto epfile = self->fileContext()->getFile(req.fd());
-			auto file = self->fileContext()->getFile(req.newfd());
-			assert(epfile && "Illegal FD for EPOLL_MODIFY");
-			assert(file && "Illegal FD for EPOLL_MODIFY item");
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_wd(wd);
 
-			Error ret = epoll::modifyItem(epfile.get(), file.get(), req.newfd(),
-					req.flags(), req.cookie());
-			if(ret == Error::noSuchFile) {
-				co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-				continue;
-			}
-			assert(ret == Error::success);
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::EPOLL_DELETE) {
-			if(logRequests)
-				std::cout << "posix: EPOLL_DELETE" << std::endl;
+async::result<bool> handleEventfdCreate(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			helix::SendBuffer send_resp;
+	auto req = bragi::parse_head_only<managarm::posix::EventfdCreateRequest>(recv_head);
 
-			auto epfile = self->fileContext()->getFile(req.fd());
-			auto file = self->fileContext()->getFile(req.newfd());
-			if(!epfile || !file) {
-				std::cout << "posix: Illegal FD for EPOLL_DELETE" << std::endl;
-				co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-				continue;
-			}
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			Error ret = epoll::deleteItem(epfile.get(), file.get(), req.newfd(), req.flags());
-			if(ret == Error::noSuchFile) {
-				co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-				continue;
-			}
-			assert(ret == Error::success);
+	if(logRequests)
+		std::cout << "posix: EVENTFD_CREATE" << std::endl;
 
-			managarm::posix::SvrResponse resp;
+	managarm::posix::SvrResponse resp;
+
+	if (req->flags() & ~(managarm::posix::OpenFlags::OF_CLOEXEC | managarm::posix::OpenFlags::OF_NONBLOCK)) {
+		std::cout << "posix: invalid flag specified (EFD_SEMAPHORE?)" << std::endl;
+		std::cout << "posix: flags specified: " << req->flags() << std::endl;
+		resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+	} else {
+
+		auto file = eventfd::createFile(req->initval(), req->flags() & managarm::posix::OpenFlags::OF_NONBLOCK);
+		auto fd = self->fileContext()->attachFile(file,
+				req->flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
+
+		if(fd < 0) {
+			resp.set_error(managarm::posix::Errors::NO_FILE_DESCRIPTORS);
+		}else{
 			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_fd(fd);
+		}
+	}
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::EPOLL_WAIT) {
-			if(logRequests)
-				std::cout << "posix: EPOLL_WAIT request" << std::endl;
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			helix::SendBuffer send_resp;
-			helix::SendBuffer send_data;
-			uint64_t former = self->signalMask();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			auto epfile = self->fileContext()->getFile(req.fd());
-			if(!epfile) {
-				co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-				continue;
-			}
-			if(req.sigmask_needed()) {
-				self->setSignalMask(req.sigmask());
-			}
+async::result<bool> handleMemfdCreate(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &preamble = ctx.preamble;
+	auto &recv_head = ctx.head;
 
-			struct epoll_event events[16];
-			size_t k;
-			if(req.timeout() < 0) {
-				k = co_await epoll::wait(epfile.get(), events,
-						std::min(req.size(), uint32_t(16)));
-			}else if(!req.timeout()) {
-				// Do not bother to set up a timer for zero timeouts.
-				async::cancellation_event cancel_wait;
-				cancel_wait.cancel();
-				k = co_await epoll::wait(epfile.get(), events,
-						std::min(req.size(), uint32_t(16)), cancel_wait);
-			}else{
-				assert(req.timeout() > 0);
-				async::cancellation_event cancel_wait;
-				helix::TimeoutCancellation timer{static_cast<uint64_t>(req.timeout()), cancel_wait};
-				k = co_await epoll::wait(epfile.get(), events, 16, cancel_wait);
-				co_await timer.retire();
-			}
-			if(req.sigmask_needed()) {
-				self->setSignalMask(former);
-			}
+	std::vector<std::byte> tail(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+	HEL_CHECK(recv_tail.error());
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	auto req = bragi::parse_head_tail<managarm::posix::MemfdCreateRequest>(recv_head, tail);
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
-					helix::action(&send_data, events, k * sizeof(struct epoll_event)));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::TIMERFD_CREATE) {
-			if(logRequests)
-				std::cout << "posix: TIMERFD_CREATE" << std::endl;
+	if(!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			helix::SendBuffer send_resp;
+	if(logRequests)
+		std::cout << "posix: MEMFD_CREATE " << req->name() << std::endl;
 
-			assert(!(req.flags() & ~(TFD_CLOEXEC | TFD_NONBLOCK)));
+	managarm::posix::SvrResponse resp;
 
-			auto file = timerfd::createFile(req.flags() & TFD_NONBLOCK);
-			auto fd = self->fileContext()->attachFile(file, req.flags() & TFD_CLOEXEC);
+	if(req->flags() & ~(managarm::posix::MemfdFlags::MFD_CLOEXEC
+			| managarm::posix::MemfdFlags::MFD_ALLOW_SEALING
+			| managarm::posix::MemfdFlags::MFD_HUGETLB)) {
+		resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+	}else{
+		auto file = memfd::createFile(req->name(),
+				req->flags() & managarm::posix::MemfdFlags::MFD_ALLOW_SEALING,
+				req->flags() & managarm::posix::MemfdFlags::MFD_HUGETLB);
+		auto fd = self->fileContext()->attachFile(file,
+				req->flags() & managarm::posix::MemfdFlags::MFD_CLOEXEC);
 
-			managarm::posix::SvrResponse resp;
+		if(fd < 0) {
+			resp.set_error(managarm::posix::Errors::NO_FILE_DESCRIPTORS);
+		}else{
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 			resp.set_fd(fd);
+		}
+	}
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::TIMERFD_SETTIME) {
-			if(logRequests)
-				std::cout << "posix: TIMERFD_SETTIME" << std::endl;
-
-			helix::SendBuffer send_resp;
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			auto file = self->fileContext()->getFile(req.fd());
-			assert(file && "Illegal FD for TIMERFD_SETTIME");
-			timerfd::setTime(file.get(),
-					{static_cast<time_t>(req.time_secs()), static_cast<long>(req.time_nanos())},
-					{static_cast<time_t>(req.interval_secs()), static_cast<long>(req.interval_nanos())});
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+async::result<bool> handleMknodAt(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &preamble = ctx.preamble;
+	auto &recv_head = ctx.head;
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(req.request_type() == managarm::posix::CntReqType::SIGNALFD_CREATE) {
-			if(logRequests)
-				std::cout << "posix: SIGNALFD_CREATE" << std::endl;
+	std::vector<std::byte> tail(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		);
+	HEL_CHECK(recv_tail.error());
 
-			helix::SendBuffer send_resp;
+	auto req = bragi::parse_head_tail<managarm::posix::MknodAtRequest>(recv_head, tail);
 
-			if(req.flags() & ~(managarm::posix::OpenFlags::OF_CLOEXEC
-					| managarm::posix::OpenFlags::OF_NONBLOCK)) {
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
-			}
+	if(!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			auto file = createSignalFile(req.sigset(),
-					req.flags() & managarm::posix::OpenFlags::OF_NONBLOCK);
-			auto fd = self->fileContext()->attachFile(file,
-					req.flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
+	if(logRequests || logPaths)
+		std::cout << "posix: MKNODAT for path " << req->path() << " with mode " << req->mode() << " and device " << req->device() << std::endl;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_fd(fd);
+	managarm::posix::SvrResponse resp;
 
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::InotifyCreateRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::InotifyCreateRequest>(recv_head);
+	ViewPath relative_to;
+	smarter::shared_ptr<File, FileHandle> file;
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	if(!req->path().size()) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		co_return true;
+	}
 
-			if(logRequests)
-				std::cout << "posix: INOTIFY_CREATE" << std::endl;
+	if(req->dirfd() == AT_FDCWD) {
+		relative_to = self->fsContext()->getWorkingDirectory();
+	} else {
+		file = self->fileContext()->getFile(req->dirfd());
 
-			assert(!(req->flags() & ~(managarm::posix::OpenFlags::OF_CLOEXEC)));
+		if(!file) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::BAD_FD);
+			co_return true;
+		}
 
-			auto file = inotify::createFile();
-			auto fd = self->fileContext()->attachFile(file,
-					req->flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
+		relative_to = {file->associatedMount(), file->associatedLink()};
+	}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_fd(fd);
+	// TODO: Add resolveNoTrailingSlash if not making a directory?
+	PathResolver resolver;
+	resolver.setup(self->fsContext()->getRoot(),
+			relative_to, req->path(), self.get());
+	auto resolveResult = co_await resolver.resolve(resolvePrefix);
+	if(!resolveResult) {
+		if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+			co_return true;
+		} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+			co_return true;
+		} else {
+			std::cout << "posix: Unexpected failure from resolve()" << std::endl;
+			co_return false;
+		}
+	}
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+	auto parent = resolver.currentLink()->getTarget();
+	auto existsResult = co_await parent->getLink(resolver.nextComponent());
+	assert(existsResult);
+	auto exists = existsResult.value();
+	if(exists) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
+		co_return true;
+	}
 
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::InotifyAddRequest::message_id) {
-			std::vector<std::byte> tail(preamble.tail_size());
-			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(tail.data(), tail.size())
-				);
-			HEL_CHECK(recv_tail.error());
+	VfsType type;
+	DeviceId dev;
+	if(S_ISDIR(req->mode())) {
+		type = VfsType::directory;
+	} else if(S_ISCHR(req->mode())) {
+		type = VfsType::charDevice;
+	} else if(S_ISBLK(req->mode())) {
+		type = VfsType::blockDevice;
+	} else if(S_ISREG(req->mode())) {
+		type = VfsType::regular;
+	} else if(S_ISFIFO(req->mode())) {
+		type = VfsType::fifo;
+	} else if(S_ISLNK(req->mode())) {
+		type = VfsType::symlink;
+	} else if(S_ISSOCK(req->mode())) {
+		type = VfsType::socket;
+	} else {
+		type = VfsType::null;
+	}
 
-			auto req = bragi::parse_head_tail<managarm::posix::InotifyAddRequest>(recv_head, tail);
+	// TODO: Verify the proper error return here.
+	if(type == VfsType::charDevice || type == VfsType::blockDevice) {
+		dev.first = major(req->device());
+		dev.second = minor(req->device());
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
+		auto result = co_await parent->mkdev(resolver.nextComponent(), type, dev);
+		if(!result) {
+			if(result.error() == Error::illegalOperationTarget) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				co_return true;
+			} else {
+				std::cout << "posix: Unexpected failure from mkdev()" << std::endl;
+				co_return false;
+			}
+		}
+	} else if(type == VfsType::fifo) {
+		auto result = co_await parent->mkfifo(resolver.nextComponent(), req->mode());
+		if(!result) {
+			if(result.error() == Error::illegalOperationTarget) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				co_return true;
+			} else {
+				std::cout << "posix: Unexpected failure from mkfifo()" << std::endl;
+				co_return false;
+			}
+		}
+	} else if(type == VfsType::socket) {
+		auto result = co_await parent->mksocket(resolver.nextComponent());
+		if(!result) {
+			if(result.error() == Error::illegalOperationTarget) {
+				co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				co_return true;
+			} else {
+				std::cout << "posix: Unexpected failure from mksocket()" << std::endl;
+				co_return false;
 			}
+		}
+	} else {
+		// TODO: Handle regular files.
+		std::cout << "\e[31mposix: Creating regular files with mknod is not supported.\e[39m" << std::endl;
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+		co_return true;
+	}
+	resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			managarm::posix::SvrResponse resp;
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			if(logRequests || logPaths)
-				std::cout << "posix: INOTIFY_ADD" << req->path() << std::endl;
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			auto ifile = self->fileContext()->getFile(req->fd());
-			if(!ifile) {
-				co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-				continue;
-			}
+async::result<bool> handleGetPgid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			PathResolver resolver;
-			resolver.setup(self->fsContext()->getRoot(),
-					self->fsContext()->getWorkingDirectory(), req->path(), self.get());
-			auto resolveResult = co_await resolver.resolve();
-			if(!resolveResult) {
-				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
+	auto req = bragi::parse_head_only<managarm::posix::GetPgidRequest>(recv_head);
 
-			auto wd = inotify::addWatch(ifile.get(), resolver.currentLink()->getTarget(),
-					req->flags());
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_wd(wd);
+	if(logRequests)
+		std::cout << "posix: GET_PGID" << std::endl;
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+	std::shared_ptr<Process> target;
+	if(req->pid()) {
+		target = Process::findProcess(req->pid());
+		if(!target) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_SUCH_RESOURCE);
+			co_return true;
+		}
+	} else {
+		target = self;
+	}
 
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::EventfdCreateRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::EventfdCreateRequest>(recv_head);
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_pid(target->pgPointer()->getHull()->getPid());
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			if(logRequests)
-				std::cout << "posix: EVENTFD_CREATE" << std::endl;
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			managarm::posix::SvrResponse resp;
+async::result<bool> handleSetPgid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-			if (req->flags() & ~(managarm::posix::OpenFlags::OF_CLOEXEC | managarm::posix::OpenFlags::OF_NONBLOCK)) {
-				std::cout << "posix: invalid flag specified (EFD_SEMAPHORE?)" << std::endl;
-				std::cout << "posix: flags specified: " << req->flags() << std::endl;
-				resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-			} else {
+	auto req = bragi::parse_head_only<managarm::posix::SetPgidRequest>(recv_head);
 
-				auto file = eventfd::createFile(req->initval(), req->flags() & managarm::posix::OpenFlags::OF_NONBLOCK);
-				auto fd = self->fileContext()->attachFile(file,
-						req->flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-				resp.set_error(managarm::posix::Errors::SUCCESS);
-				resp.set_fd(fd);
-			}
+	if(logRequests)
+		std::cout << "posix: SET_PGID" << std::endl;
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+	std::shared_ptr<Process> target;
+	if(req->pid()) {
+		target = Process::findProcess(req->pid());
+		if(!target) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_SUCH_RESOURCE);
+			co_return true;
+		}
+	} else {
+		target = self;
+	}
 
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::MknodAtRequest::message_id) {
-			std::vector<std::byte> tail(preamble.tail_size());
-			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::recvBuffer(tail.data(), tail.size())
-				);
-			HEL_CHECK(recv_tail.error());
+	if(target->pgPointer()->getSession() != self->pgPointer()->getSession()) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::INSUFFICIENT_PERMISSION);
+		co_return true;
+	}
 
-			auto req = bragi::parse_head_tail<managarm::posix::MknodAtRequest>(recv_head, tail);
+	// We can't change the process group ID of the session leader
+	if(target->pid() == target->pgPointer()->getSession()->getSessionId()) {
+		co_await ctx.sendErrorResponse(managarm::posix::Errors::INSUFFICIENT_PERMISSION);
+		co_return true;
+	}
 
-			if(!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	if(target->getParent()->pid() == self->pid()) {
+		if(target->didExecute()) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
+			co_return true;
+		}
+	}
 
-			if(logRequests || logPaths)
-				std::cout << "posix: MKNODAT for path " << req->path() << " with mode " << req->mode() << " and device " << req->device() << std::endl;
+	std::shared_ptr<ProcessGroup> group;
+	// If pgid is 0, we're going to set it to the calling process's pid, use the target group.
+	if(req->pgid()) {
+		group = target->pgPointer()->getSession()->getProcessGroupById(req->pgid());
+	} else {
+		group = target->pgPointer();
+	}
 
-			managarm::posix::SvrResponse resp;
+	if(group) {
+		// Found, do permission checking and join
+		group->reassociateProcess(target.get());
+	} else {
+		// Not found, making it if pgid and pid match, or if pgid is 0, indicating that we should make one
+		if(target->pid() == req->pgid() || !req->pgid()) {
+			target->pgPointer()->getSession()->spawnProcessGroup(target.get());
+		} else {
+			// Doesn't exists, and not requesting a make?
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_SUCH_RESOURCE);
+			co_return true;
+		}
+	}
 
-			ViewPath relative_to;
-			smarter::shared_ptr<File, FileHandle> file;
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
 
-			if(!req->path().size()) {
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
-			}
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			if(req->dirfd() == AT_FDCWD) {
-				relative_to = self->fsContext()->getWorkingDirectory();
-			} else {
-				file = self->fileContext()->getFile(req->dirfd());
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-				if(!file) {
-					co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
-					continue;
-				}
+async::result<bool> handleGetSid(RequestContext &ctx) {
+	auto &self = ctx.self;
+	auto &conversation = ctx.conversation;
+	auto &recv_head = ctx.head;
 
-				relative_to = {file->associatedMount(), file->associatedLink()};
-			}
+	auto req = bragi::parse_head_only<managarm::posix::GetSidRequest>(recv_head);
 
-			// TODO: Add resolveNoTrailingSlash if not making a directory?
-			PathResolver resolver;
-			resolver.setup(self->fsContext()->getRoot(),
-					relative_to, req->path(), self.get());
-			auto resolveResult = co_await resolver.resolve(resolvePrefix);
-			if(!resolveResult) {
-				if(resolveResult.error() == protocols::fs::Error::fileNotFound) {
-					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
-					continue;
-				} else if(resolveResult.error() == protocols::fs::Error::notDirectory) {
-					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
-					continue;
-				} else {
-					std::cout << "posix: Unexpected failure from resolve()" << std::endl;
-					co_return;
-				}
-			}
+	if (!req) {
+		std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+		co_return false;
+	}
 
-			auto parent = resolver.currentLink()->getTarget();
-			auto existsResult = co_await parent->getLink(resolver.nextComponent());
-			assert(existsResult);
-			auto exists = existsResult.value();
-			if(exists) {
-				co_await sendErrorResponse(managarm::posix::Errors::ALREADY_EXISTS);
-				continue;
-			}
+	if(logRequests)
+		std::cout << "posix: GET_SID on pid " << req->pid() << std::endl;
 
-			VfsType type;
-			DeviceId dev;
-			if(S_ISDIR(req->mode())) {
-				type = VfsType::directory;
-			} else if(S_ISCHR(req->mode())) {
-				type = VfsType::charDevice;
-			} else if(S_ISBLK(req->mode())) {
-				type = VfsType::blockDevice;
-			} else if(S_ISREG(req->mode())) {
-				type = VfsType::regular;
-			} else if(S_ISFIFO(req->mode())) {
-				type = VfsType::fifo;
-			} else if(S_ISLNK(req->mode())) {
-				type = VfsType::symlink;
-			} else if(S_ISSOCK(req->mode())) {
-				type = VfsType::socket;
-			} else {
-				type = VfsType::null;
-			}
+	std::shared_ptr<Process> target;
+	if(req->pid()) {
+		target = Process::findProcess(req->pid());
+		if(!target) {
+			co_await ctx.sendErrorResponse(managarm::posix::Errors::NO_SUCH_RESOURCE);
+			co_return true;
+		}
+	} else {
+		target = self;
+	}
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::SUCCESS);
+	resp.set_pid(target->pgPointer()->getSession()->getSessionId());
 
-			// TODO: Verify the proper error return here.
-			if(type == VfsType::charDevice || type == VfsType::blockDevice) {
-				dev.first = major(req->device());
-				dev.second = minor(req->device());
-
-				auto result = co_await parent->mkdev(resolver.nextComponent(), type, dev);
-				if(!result) {
-					if(result.error() == Error::illegalOperationTarget) {
-						co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-						continue;
-					} else {
-						std::cout << "posix: Unexpected failure from mkdev()" << std::endl;
-						co_return;
-					}
-				}
-			} else if(type == VfsType::fifo) {
-				auto result = co_await parent->mkfifo(resolver.nextComponent(), req->mode());
-				if(!result) {
-					if(result.error() == Error::illegalOperationTarget) {
-						co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-						continue;
-					} else {
-						std::cout << "posix: Unexpected failure from mkfifo()" << std::endl;
-						co_return;
-					}
-				}
-			} else if(type == VfsType::socket) {
-				auto result = co_await parent->mksocket(resolver.nextComponent());
-				if(!result) {
-					if(result.error() == Error::illegalOperationTarget) {
-						co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-						continue;
-					} else {
-						std::cout << "posix: Unexpected failure from mksocket()" << std::endl;
-						co_return;
-					}
-				}
-			} else {
-				// TODO: Handle regular files.
-				std::cout << "\e[31mposix: Creating regular files with mknod is not supported.\e[39m" << std::endl;
-				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
-				continue;
-			}
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+		);
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::GetPgidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::GetPgidRequest>(recv_head);
+async::result<bool> handleIllegalRequest(RequestContext &ctx) {
+	auto &conversation = ctx.conversation;
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+	std::cout << "posix: Illegal request" << std::endl;
+	helix::SendBuffer send_resp;
 
-			if(logRequests)
-				std::cout << "posix: GET_PGID" << std::endl;
+	managarm::posix::SvrResponse resp;
+	resp.set_error(managarm::posix::Errors::ILLEGAL_REQUEST);
 
-			std::shared_ptr<Process> target;
-			if(req->pid()) {
-				target = Process::findProcess(req->pid());
-				if(!target) {
-					co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_RESOURCE);
-					continue;
-				}
-			} else {
-				target = self;
-			}
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+	co_return true;
+}
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_pid(target->pgPointer()->getHull()->getPid());
+using RequestHandler = async::result<bool> (*)(RequestContext &ctx);
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+struct RequestHandlerEntry {
+	uint32_t key;
+	RequestHandler handler;
+	// Used for the latency statistics.
+	const char *name;
+};
 
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::SetPgidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::SetPgidRequest>(recv_head);
+template<size_t N>
+constexpr std::array<RequestHandlerEntry, N>
+sortHandlers(std::array<RequestHandlerEntry, N> entries) {
+	std::sort(entries.begin(), entries.end(), [] (const auto &a, const auto &b) {
+		return a.key < b.key;
+	});
+	return entries;
+}
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+template<size_t N>
+constexpr bool hasUniqueKeys(const std::array<RequestHandlerEntry, N> &entries) {
+	for(size_t i = 1; i < N; i++)
+		if(entries[i - 1].key == entries[i].key)
+			return false;
+	return true;
+}
 
-			if(logRequests)
-				std::cout << "posix: SET_PGID" << std::endl;
+// Handlers for bragi messages, keyed by message ID.
+constexpr auto messageHandlers = sortHandlers(std::to_array<RequestHandlerEntry>({
+	{bragi::message_id<managarm::posix::GetTidRequest>, &handleGetTid, "GetTid"},
+	{bragi::message_id<managarm::posix::GetPpidRequest>, &handleGetPpid, "GetPpid"},
+	{bragi::message_id<managarm::posix::GetUidRequest>, &handleGetUid, "GetUid"},
+	{bragi::message_id<managarm::posix::SetUidRequest>, &handleSetUid, "SetUid"},
+	{bragi::message_id<managarm::posix::GetEuidRequest>, &handleGetEuid, "GetEuid"},
+	{bragi::message_id<managarm::posix::SetEuidRequest>, &handleSetEuid, "SetEuid"},
+	{bragi::message_id<managarm::posix::GetGidRequest>, &handleGetGid, "GetGid"},
+	{bragi::message_id<managarm::posix::GetEgidRequest>, &handleGetEgid, "GetEgid"},
+	{bragi::message_id<managarm::posix::SetGidRequest>, &handleSetGid, "SetGid"},
+	{bragi::message_id<managarm::posix::SetEgidRequest>, &handleSetEgid, "SetEgid"},
+	{bragi::message_id<managarm::posix::VmMapRequest>, &handleVmMap, "VmMap"},
+	{bragi::message_id<managarm::posix::MountRequest>, &handleMount, "Mount"},
+	{bragi::message_id<managarm::posix::MkfifoAtRequest>, &handleMkfifoAt, "MkfifoAt"},
+	{bragi::message_id<managarm::posix::LinkAtRequest>, &handleLinkAt, "LinkAt"},
+	{bragi::message_id<managarm::posix::SymlinkAtRequest>, &handleSymlinkAt, "SymlinkAt"},
+	{bragi::message_id<managarm::posix::RenameAtRequest>, &handleRenameAt, "RenameAt"},
+	{bragi::message_id<managarm::posix::FstatAtRequest>, &handleFstatAt, "FstatAt"},
+	{bragi::message_id<managarm::posix::FchmodAtRequest>, &handleFchmodAt, "FchmodAt"},
+	{bragi::message_id<managarm::posix::UtimensAtRequest>, &handleUtimensAt, "UtimensAt"},
+	{bragi::message_id<managarm::posix::OpenAtRequest>, &handleOpenAt, "OpenAt"},
+	{bragi::message_id<managarm::posix::CloseRequest>, &handleClose, "Close"},
+	{bragi::message_id<managarm::posix::IsTtyRequest>, &handleIsTty, "IsTty"},
+	{bragi::message_id<managarm::posix::UnlinkAtRequest>, &handleUnlinkAt, "UnlinkAt"},
+	{bragi::message_id<managarm::posix::RmdirRequest>, &handleRmdir, "Rmdir"},
+	{bragi::message_id<managarm::posix::IoctlFioclexRequest>, &handleIoctlFioclex, "IoctlFioclex"},
+	{bragi::message_id<managarm::posix::FadviseRequest>, &handleFadvise, "Fadvise"},
+	{bragi::message_id<managarm::posix::MadviseRequest>, &handleMadvise, "Madvise"},
+	{bragi::message_id<managarm::posix::CopyFileRangeRequest>, &handleCopyFileRange, "CopyFileRange"},
+	{bragi::message_id<managarm::posix::FsyncRequest>, &handleFsync, "Fsync"},
+	{bragi::message_id<managarm::posix::SocketRequest>, &handleSocket, "Socket"},
+	{bragi::message_id<managarm::posix::SockpairRequest>, &handleSockpair, "Sockpair"},
+	{bragi::message_id<managarm::posix::AcceptRequest>, &handleAccept, "Accept"},
+	{bragi::message_id<managarm::posix::InotifyCreateRequest>, &handleInotifyCreate, "InotifyCreate"},
+	{bragi::message_id<managarm::posix::InotifyAddRequest>, &handleInotifyAdd, "InotifyAdd"},
+	{bragi::message_id<managarm::posix::EventfdCreateRequest>, &handleEventfdCreate, "EventfdCreate"},
+	{bragi::message_id<managarm::posix::MemfdCreateRequest>, &handleMemfdCreate, "MemfdCreate"},
+	{bragi::message_id<managarm::posix::MknodAtRequest>, &handleMknodAt, "MknodAt"},
+	{bragi::message_id<managarm::posix::GetPgidRequest>, &handleGetPgid, "GetPgid"},
+	{bragi::message_id<managarm::posix::SetPgidRequest>, &handleSetPgid, "SetPgid"},
+	{bragi::message_id<managarm::posix::GetSidRequest>, &handleGetSid, "GetSid"}
+}));
+static_assert(hasUniqueKeys(messageHandlers));
+
+// Handlers for CntRequest, keyed by CntReqType.
+constexpr auto cntHandlers = sortHandlers(std::to_array<RequestHandlerEntry>({
+	{static_cast<uint32_t>(managarm::posix::CntReqType::GET_PID), &handleGetPid, "GET_PID"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::WAIT), &handleWait, "WAIT"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::GET_RESOURCE_USAGE), &handleGetResourceUsage, "GET_RESOURCE_USAGE"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::VM_REMAP), &handleVmRemap, "VM_REMAP"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::VM_PROTECT), &handleVmProtect, "VM_PROTECT"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::VM_UNMAP), &handleVmUnmap, "VM_UNMAP"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::CHROOT), &handleChroot, "CHROOT"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::CHDIR), &handleChdir, "CHDIR"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::FCHDIR), &handleFchdir, "FCHDIR"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::ACCESSAT), &handleAccessat, "ACCESSAT"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::MKDIRAT), &handleMkdirat, "MKDIRAT"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::READLINK), &handleReadlink, "READLINK"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::DUP), &handleDup, "DUP"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::DUP2), &handleDup2, "DUP2"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::TTY_NAME), &handleTtyName, "TTY_NAME"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::GETCWD), &handleGetcwd, "GETCWD"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::FD_GET_FLAGS), &handleFdGetFlags, "FD_GET_FLAGS"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::FD_SET_FLAGS), &handleFdSetFlags, "FD_SET_FLAGS"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::SIG_ACTION), &handleSigAction, "SIG_ACTION"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::PIPE_CREATE), &handlePipeCreate, "PIPE_CREATE"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::SETSID), &handleSetsid, "SETSID"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::EPOLL_CALL), &handleEpollCall, "EPOLL_CALL"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::EPOLL_CREATE), &handleEpollCreate, "EPOLL_CREATE"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::EPOLL_ADD), &handleEpollAdd, "EPOLL_ADD"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::EPOLL_MODIFY), &handleEpollModify, "EPOLL_MODIFY"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::EPOLL_DELETE), &handleEpollDelete, "EPOLL_DELETE"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::EPOLL_WAIT), &handleEpollWait, "EPOLL_WAIT"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::TIMERFD_CREATE), &handleTimerfdCreate, "TIMERFD_CREATE"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::TIMERFD_SETTIME), &handleTimerfdSettime, "TIMERFD_SETTIME"},
+	{static_cast<uint32_t>(managarm::posix::CntReqType::SIGNALFD_CREATE), &handleSignalfdCreate, "SIGNALFD_CREATE"}
+}));
+static_assert(hasUniqueKeys(cntHandlers));
+
+constexpr RequestHandlerEntry illegalRequestEntry{0, &handleIllegalRequest, "illegal"};
+
+template<size_t N>
+const RequestHandlerEntry *findHandler(const std::array<RequestHandlerEntry, N> &entries,
+		uint32_t key) {
+	auto it = std::lower_bound(entries.begin(), entries.end(), key,
+			[] (const RequestHandlerEntry &entry, uint32_t key) {
+		return entry.key < key;
+	});
+	if(it == entries.end() || it->key != key)
+		return &illegalRequestEntry;
+	return &*it;
+}
 
-			std::shared_ptr<Process> target;
-			if(req->pid()) {
-				target = Process::findProcess(req->pid());
-				if(!target) {
-					co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_RESOURCE);
-					continue;
-				}
-			} else {
-				target = self;
-			}
+// Requests of a single generation that are still being handled.
+struct InFlightRequests {
+	size_t count = 0;
+	async::recurring_event doneEvent;
+};
 
-			if(target->pgPointer()->getSession() != self->pgPointer()->getSession()) {
-				co_await sendErrorResponse(managarm::posix::Errors::INSUFFICIENT_PERMISSION);
-				continue;
-			}
+async::detached runRequest(const RequestHandlerEntry *entry, std::unique_ptr<RequestContext> ctx,
+		InFlightRequests *inFlight) {
+	// Only CntRequest can carry the trace context of the client.
+	protocols::ostrace::TraceContext parent;
+	std::string_view spanName = "posix.request";
+	int64_t op = ctx->preamble.id();
+	if(ctx->preamble.id() == managarm::posix::CntRequest::message_id) {
+		parent = {ctx->req.trace_id(), ctx->req.trace_parent()};
+		spanName = "posix.cnt-request";
+		op = static_cast<int64_t>(ctx->req.request_type());
+	}
 
-			// We can't change the process group ID of the session leader
-			if(target->pid() == target->pgPointer()->getSession()->getSessionId()) {
-				co_await sendErrorResponse(managarm::posix::Errors::INSUFFICIENT_PERMISSION);
-				continue;
-			}
+	protocols::ostrace::Span span{protocols::ostrace::defaultContext(), spanName, parent, op};
+	co_await span.begin();
+	{
+		RequestTimer timer{requestHistogram("request", entry->name)};
+		if(!co_await entry->handler(*ctx))
+			HEL_CHECK(helShutdownLane(ctx->self->posixLane().getHandle()));
+	}
+	co_await span.end();
 
-			if(target->getParent()->pid() == self->pid()) {
-				if(target->didExecute()) {
-					co_await sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
-					continue;
-				}
-			}
+	assert(inFlight->count);
+	if(!--inFlight->count)
+		inFlight->doneEvent.raise();
+}
 
-			std::shared_ptr<ProcessGroup> group;
-			// If pgid is 0, we're going to set it to the calling process's pid, use the target group.
-			if(req->pgid()) {
-				group = target->pgPointer()->getSession()->getProcessGroupById(req->pgid());
-			} else {
-				group = target->pgPointer();
-			}
+} // anonymous namespace
 
-			if(group) {
-				// Found, do permission checking and join
-				group->reassociateProcess(target.get());
-			} else {
-				// Not found, making it if pgid and pid match, or if pgid is 0, indicating that we should make one
-				if(target->pid() == req->pgid() || !req->pgid()) {
-					target->pgPointer()->getSession()->spawnProcessGroup(target.get());
-				} else {
-					// Doesn't exists, and not requesting a make?
-					co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_RESOURCE);
-					continue;
-				}
-			}
+async::result<void> serveRequests(std::shared_ptr<Process> self,
+		std::shared_ptr<Generation> generation) {
+	async::cancellation_token cancellation = generation->cancelServe;
 
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
+	async::cancellation_callback cancel_callback{cancellation, [&] {
+		HEL_CHECK(helShutdownLane(self->posixLane().getHandle()));
+	}};
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+	// Each request runs in its own coroutine, such that a request that blocks
+	// (e.g., WAIT or EPOLL_WAIT) does not hold up later requests on the same lane.
+	// Handlers are started in the order in which the requests arrive; since each
+	// thread has its own lane and only issues one request at a time, this preserves
+	// the order of requests per thread.
+	InFlightRequests inFlight;
 
-			HEL_CHECK(send_resp.error());
-		}else if(preamble.id() == managarm::posix::GetSidRequest::message_id) {
-			auto req = bragi::parse_head_only<managarm::posix::GetSidRequest>(recv_head);
+	while(true) {
+		auto [accept, recv_head] = co_await helix_ng::exchangeMsgs(
+				self->posixLane(),
+				helix_ng::accept(
+					helix_ng::recvInline()
+				)
+			);
 
-			if (!req) {
-				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
-				break;
-			}
+		if(accept.error() == kHelErrLaneShutdown)
+			break;
+		HEL_CHECK(accept.error());
 
-			if(logRequests)
-				std::cout << "posix: GET_SID on pid " << req->pid() << std::endl;
+		if(recv_head.error() == kHelErrBufferTooSmall) {
+			std::cout << "posix: Rejecting request due to RecvInline overflow" << std::endl;
+			continue;
+		}
+		HEL_CHECK(recv_head.error());
 
-			std::shared_ptr<Process> target;
-			if(req->pid()) {
-				target = Process::findProcess(req->pid());
-				if(!target) {
-					co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_RESOURCE);
-					continue;
-				}
-			} else {
-				target = self;
-			}
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::SUCCESS);
-			resp.set_pid(target->pgPointer()->getSession()->getSessionId());
+		auto ctx = std::make_unique<RequestContext>();
+		ctx->self = self;
+		ctx->conversation = accept.descriptor();
+		ctx->preamble = bragi::read_preamble(recv_head);
+		assert(!ctx->preamble.error());
+		auto p = reinterpret_cast<const char *>(recv_head.data());
+		ctx->head.buffer.assign(p, p + recv_head.size());
+		recv_head.reset();
 
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-				);
+		const RequestHandlerEntry *entry;
+		if(ctx->preamble.id() == managarm::posix::CntRequest::message_id) {
+			auto o = bragi::parse_head_only<managarm::posix::CntRequest>(ctx->head);
+			if (!o) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
 
-			HEL_CHECK(send_resp.error());
+			ctx->req = *o;
+			entry = findHandler(cntHandlers, static_cast<uint32_t>(ctx->req.request_type()));
 		}else{
-			std::cout << "posix: Illegal request" << std::endl;
-			helix::SendBuffer send_resp;
-
-			managarm::posix::SvrResponse resp;
-			resp.set_error(managarm::posix::Errors::ILLEGAL_REQUEST);
-
-			auto ser = resp.SerializeAsString();
-			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
-					helix::action(&send_resp, ser.data(), ser.size()));
-			co_await transmit.async_wait();
-			HEL_CHECK(send_resp.error());
+			entry = findHandler(messageHandlers, ctx->preamble.id());
 		}
+
+		inFlight.count++;
+		runRequest(entry, std::move(ctx), &inFlight);
 	}
 
+	while(inFlight.count)
+		co_await inFlight.doneEvent.async_wait();
+
 	if(logCleanup)
 		std::cout << "\e[33mposix: Exiting serveRequests()\e[39m" << std::endl;
 	generation->requestsDone.raise();
@@ -3704,8 +4833,11 @@ async::result<void> serve(std::shared_ptr<Process> self, std::shared_ptr<Generat
 
 	std::array<char, 16> creds;
 	HEL_CHECK(helGetCredentials(thread.getHandle(), 0, creds.data()));
-	auto res = globalCredentialsMap.insert({creds, self});
-	assert(res.second);
+	{
+		std::unique_lock lock{globalCredentialsMutex};
+		auto res = globalCredentialsMap.insert({creds, self});
+		assert(res.second);
+	}
 
 	co_await async::when_all(
 		observeThread(self, generation),
@@ -3780,7 +4912,18 @@ async::result<void> enumerateKerncfg() {
 // main() function
 // --------------------------------------------------------
 
+namespace {
+	protocols::ostrace::Context ostContext;
+}
+
+// Requests are handled without tracing until ostrace is found.
+async::detached initTracing() {
+	ostContext = co_await protocols::ostrace::createContext();
+	protocols::ostrace::setDefaultContext(&ostContext);
+}
+
 async::detached runInit() {
+	initTracing();
 	co_await enumerateKerncfg();
 	co_await clk::enumerateTracker();
 	async::detach(net::enumerateNetserver());
@@ -3793,7 +4936,10 @@ int main() {
 
 //	HEL_CHECK(helSetPriority(kHelThisThread, 1));
 
+	initWorkers(std::clamp(std::thread::hardware_concurrency(), 1u, maxWorkers));
+
 	drvcore::initialize();
+	nl_stats::initialize();
 
 	charRegistry.install(createHeloutDevice());
 	charRegistry.install(pts::createMasterDevice());
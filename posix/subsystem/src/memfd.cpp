@@ -0,0 +1,228 @@
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+
+#include <helix/memory.hpp>
+#include <protocols/fs/server.hpp>
+#include <fs.bragi.hpp>
+#include "fs.hpp"
+#include "memfd.hpp"
+#include "vfs.hpp"
+
+namespace memfd {
+
+namespace {
+
+constexpr size_t pageSize = 0x1000;
+constexpr size_t hugePageSize = 0x200000;
+
+constexpr int allSeals = managarm::fs::FileSeals::SEAL_SEAL
+		| managarm::fs::FileSeals::SEAL_SHRINK
+		| managarm::fs::FileSeals::SEAL_GROW
+		| managarm::fs::FileSeals::SEAL_WRITE;
+
+// The size and the seals belong to the inode, not to the open file.
+// memfds can never be linked into a file system, hence each node has exactly one link.
+struct Link final : FsLink, std::enable_shared_from_this<Link> {
+	struct Node final : FsNode {
+		VfsType getType() override {
+			return VfsType::regular;
+		}
+
+		async::result<frg::expected<Error, FileStats>> getStats() override {
+			FileStats stats{};
+			// TODO: Allocate an inode number.
+			stats.inodeNumber = 1;
+			stats.fileSize = fileSize;
+			stats.numLinks = 1;
+			stats.mode = 0777;
+			co_return stats;
+		}
+
+		// Changes the file size. Memory objects cannot shrink, hence the memory
+		// past the new size is zeroed instead, like tmp_fs' MemoryNode.
+		void resizeFile(size_t newSize) {
+			if(newSize < fileSize)
+				memset(reinterpret_cast<char *>(mapping.get()) + newSize, 0,
+						std::min(fileSize, areaSize) - newSize);
+			fileSize = newSize;
+
+			size_t alignedSize = (newSize + chunkSize - 1) & ~(chunkSize - 1);
+			if(alignedSize <= areaSize)
+				return;
+			// Grow geometrically, otherwise appending to a file resizes and remaps the memory
+			// object for every page. Pages are only allocated once they are touched.
+			alignedSize = std::max(alignedSize, 2 * areaSize);
+
+			HEL_CHECK(helResizeMemory(memory.getHandle(), alignedSize));
+			mapping = helix::Mapping{memory, 0, alignedSize};
+			areaSize = alignedSize;
+		}
+
+		helix::UniqueDescriptor memory;
+		helix::Mapping mapping;
+		// Huge page memory is resized in units of huge pages.
+		size_t chunkSize = pageSize;
+		size_t areaSize = 0;
+		size_t fileSize = 0;
+		int seals = 0;
+	};
+
+	Link(std::string name)
+	: _name{std::move(name)} { }
+
+	std::shared_ptr<FsNode> getTarget() override {
+		return {shared_from_this(), &node};
+	}
+
+	std::shared_ptr<FsNode> getOwner() override {
+		return nullptr;
+	}
+
+	std::string getName() override {
+		return "memfd:" + _name;
+	}
+
+	Node node;
+
+private:
+	std::string _name;
+};
+
+struct OpenFile final : File {
+	static void serve(smarter::shared_ptr<OpenFile> file) {
+		helix::UniqueLane lane;
+		std::tie(lane, file->_passthrough) = helix::createStream();
+		async::detach(protocols::fs::servePassthrough(std::move(lane),
+				file, &fileOperations, file->_cancelServe));
+	}
+
+	OpenFile(std::shared_ptr<Link> link)
+	: File{StructName::get("memfd"), nullptr, link}, _node{&link->node} { }
+
+	void handleClose() override {
+		_cancelServe.cancel();
+	}
+
+	async::result<frg::expected<Error, off_t>>
+	seek(off_t delta, VfsSeek whence) override {
+		if(whence == VfsSeek::absolute) {
+			_offset = delta;
+		}else if(whence == VfsSeek::relative) {
+			_offset += delta;
+		}else{
+			assert(whence == VfsSeek::eof);
+			_offset = _node->fileSize + delta;
+		}
+		co_return _offset;
+	}
+
+	async::result<frg::expected<Error, size_t>>
+	readSome(Process *, void *buffer, size_t maxLength) override {
+		if(_offset >= _node->fileSize)
+			co_return 0;
+		auto chunk = std::min(_node->fileSize - _offset, maxLength);
+
+		memcpy(buffer, reinterpret_cast<char *>(_node->mapping.get()) + _offset, chunk);
+		_offset += chunk;
+		co_return chunk;
+	}
+
+	async::result<frg::expected<Error, size_t>>
+	writeAll(Process *, const void *buffer, size_t length) override {
+		if(_node->seals & managarm::fs::FileSeals::SEAL_WRITE)
+			co_return Error::insufficientPermissions;
+		if(_offset + length > _node->fileSize) {
+			if(_node->seals & managarm::fs::FileSeals::SEAL_GROW)
+				co_return Error::insufficientPermissions;
+			_node->resizeFile(_offset + length);
+		}
+
+		memcpy(reinterpret_cast<char *>(_node->mapping.get()) + _offset, buffer, length);
+		_offset += length;
+		co_return length;
+	}
+
+	async::result<frg::expected<protocols::fs::Error>> truncate(size_t size) override {
+		if(size < _node->fileSize && (_node->seals & managarm::fs::FileSeals::SEAL_SHRINK))
+			co_return protocols::fs::Error::insufficientPermissions;
+		if(size > _node->fileSize && (_node->seals & managarm::fs::FileSeals::SEAL_GROW))
+			co_return protocols::fs::Error::insufficientPermissions;
+		_node->resizeFile(size);
+		co_return {};
+	}
+
+	async::result<void> allocate(int64_t offset, size_t size) override {
+		// TODO: Careful about overflow.
+		if(offset + size <= _node->fileSize)
+			co_return;
+		// TODO: allocate() cannot fail; Linux returns EPERM here.
+		if(_node->seals & managarm::fs::FileSeals::SEAL_GROW) {
+			std::cout << "posix: fallocate() on memfd ignores F_SEAL_GROW" << std::endl;
+			co_return;
+		}
+		_node->resizeFile(offset + size);
+	}
+
+	FutureMaybe<helix::UniqueDescriptor> accessMemory() override {
+		co_return _node->memory.dup();
+	}
+
+	// Note that F_SEAL_WRITE does not revoke existing shared writable mappings
+	// (Linux fails with EBUSY in this case); VM_MAP refuses new ones.
+	async::result<frg::expected<protocols::fs::Error>> addSeals(int seals) override {
+		if(seals & ~allSeals)
+			co_return protocols::fs::Error::illegalArguments;
+		if(_node->seals & managarm::fs::FileSeals::SEAL_SEAL)
+			co_return protocols::fs::Error::insufficientPermissions;
+		_node->seals |= seals;
+		co_return {};
+	}
+
+	async::result<frg::expected<protocols::fs::Error, int>> getSeals() override {
+		co_return _node->seals;
+	}
+
+	helix::BorrowedDescriptor getPassthroughLane() override {
+		return _passthrough;
+	}
+
+private:
+	helix::UniqueLane _passthrough;
+	async::cancellation_event _cancelServe;
+
+	Link::Node *_node;
+	uint64_t _offset = 0;
+};
+
+} // anonymous namespace
+
+smarter::shared_ptr<File, FileHandle> createFile(std::string name,
+		bool allowSealing, bool hugePages) {
+	auto link = std::make_shared<Link>(std::move(name));
+	auto node = &link->node;
+
+	// Allocate the memory object upfront, such that accessMemory() never has to
+	// replace it. Huge pages are only a hint; the kernel uses them if the size allows.
+	uint32_t flags = kHelAllocOnDemand;
+	if(hugePages) {
+		flags |= kHelAllocHuge;
+		node->chunkSize = hugePageSize;
+	}
+	HelHandle handle;
+	HEL_CHECK(helAllocateMemory(node->chunkSize, flags, nullptr, &handle));
+	node->memory = helix::UniqueDescriptor{handle};
+	node->mapping = helix::Mapping{node->memory, 0, node->chunkSize};
+	node->areaSize = node->chunkSize;
+
+	// As on Linux, memfds that do not allow sealing are created with F_SEAL_SEAL.
+	if(!allowSealing)
+		node->seals = managarm::fs::FileSeals::SEAL_SEAL;
+
+	auto file = smarter::make_shared<OpenFile>(std::move(link));
+	file->setupWeakFile(file);
+	OpenFile::serve(file);
+	return File::constructHandle(std::move(file));
+}
+
+} // namespace memfd
@@ -0,0 +1,10 @@
+#include "file.hpp"
+
+namespace memfd {
+
+// Creates a file for memfd_create(). The file is backed by a single memory object
+// that accessMemory() returns, such that mmap() does not need to contact any server.
+smarter::shared_ptr<File, FileHandle> createFile(std::string name,
+		bool allowSealing, bool hugePages);
+
+}
@@ -24,6 +24,8 @@ std::map<std::pair<int, int>, std::unique_ptr<Group>> globalGroupMap;
 int nextPort = -1;
 std::map<int, OpenFile *> globalPortMap;
 
+std::map<int, Handler> globalHandlerMap;
+
 struct Packet {
 	// Sender netlink socket information.
 	int senderPort;
@@ -258,8 +260,9 @@ OpenFile::sendMsg(Process *process, uint32_t flags, const void *data, size_t max
 		assert(sa.nl_groups == (1 << (grp_idx - 1)));
 	}
 
-	// TODO: Associate port otherwise.
-	assert(_socketPort);
+	// Like Linux, bind the socket implicitly on the first send.
+	if(!_socketPort)
+		_associatePort();
 
 	Packet packet;
 	packet.senderPid = process->pid();
@@ -284,8 +287,17 @@ OpenFile::sendMsg(Process *process, uint32_t flags, const void *data, size_t max
 		assert(it != globalPortMap.end());
 
 		it->second->deliver(std::move(packet));
-	}else{
-		// TODO: Deliver the message a listener function.
+	}else if(auto it = globalHandlerMap.find(_protocol); it != globalHandlerMap.end()) {
+		auto replies = it->second(process, data, max_length);
+		for(auto &buffer : replies) {
+			Packet reply;
+			reply.senderPid = 0;
+			reply.senderPort = 0;
+			reply.group = 0;
+			reply.buffer.resize(buffer.size());
+			memcpy(reply.buffer.data(), buffer.data(), buffer.size());
+			deliver(std::move(reply));
+		}
 	}
 
 	co_return max_length;
@@ -344,12 +356,17 @@ void Group::carbonCopy(const Packet &packet) {
 // Free functions.
 // ----------------------------------------------------------------------------
 
-void configure(int protocol, int num_groups) {
+void configure(int protocol, int num_groups, Handler handler) {
 	for(int i = 0; i < num_groups; i++) {
 		std::pair<int, int> idx{protocol, i + 1};
 		auto res = globalGroupMap.insert(std::make_pair(idx, std::make_unique<Group>()));
 		assert(res.second);
 	}
+
+	if(handler) {
+		auto res = globalHandlerMap.insert({protocol, std::move(handler)});
+		assert(res.second);
+	}
 }
 
 void broadcast(int proto_idx, int grp_idx, std::string buffer) {
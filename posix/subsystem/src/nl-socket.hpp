@@ -1,11 +1,18 @@
 
+#include <functional>
+#include <string>
+#include <vector>
+
 #include "file.hpp"
 
 namespace nl_socket {
 
+// Handles messages that are sent to the kernel (i.e., to port 0).
+// Each of the returned buffers is delivered to the sender as a separate datagram.
+using Handler = std::function<std::vector<std::string>(Process *, const void *, size_t)>;
+
 // Configures the given netlink protocol.
-// TODO: Let this take a callback that is called on receive?
-void configure(int proto_idx, int num_groups);
+void configure(int proto_idx, int num_groups, Handler handler = nullptr);
 
 // Broadcasts a kernel message to the given netlink multicast group.
 void broadcast(int proto_idx, int grp_idx, std::string buffer);
@@ -0,0 +1,124 @@
+#include <errno.h>
+#include <linux/netlink.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <protocols/posix/data.hpp>
+
+#include "nl-socket.hpp"
+#include "nl-stats.hpp"
+#include "process.hpp"
+
+namespace nl_stats {
+
+namespace {
+
+void appendMessage(std::string &buffer, const struct nlmsghdr &request,
+		uint16_t type, uint16_t flags, const void *payload, size_t size) {
+	struct nlmsghdr hdr;
+	memset(&hdr, 0, sizeof(struct nlmsghdr));
+	hdr.nlmsg_len = NLMSG_LENGTH(size);
+	hdr.nlmsg_type = type;
+	hdr.nlmsg_flags = flags;
+	hdr.nlmsg_seq = request.nlmsg_seq;
+	hdr.nlmsg_pid = request.nlmsg_pid;
+
+	auto offset = buffer.size();
+	buffer.resize(offset + NLMSG_SPACE(size));
+	memcpy(buffer.data() + offset, &hdr, sizeof(struct nlmsghdr));
+	memcpy(buffer.data() + offset + NLMSG_HDRLEN, payload, size);
+}
+
+std::vector<std::string> replyError(const struct nlmsghdr &request, int error) {
+	struct nlmsgerr err;
+	memset(&err, 0, sizeof(struct nlmsgerr));
+	err.error = -error;
+	err.msg = request;
+
+	std::string buffer;
+	appendMessage(buffer, request, NLMSG_ERROR, 0, &err, sizeof(struct nlmsgerr));
+	return {std::move(buffer)};
+}
+
+posix::ProcessStats collectStats(Process *process) {
+	posix::ProcessStats stats;
+	memset(&stats, 0, sizeof(posix::ProcessStats));
+	stats.pid = process->pid();
+	auto parent = process->getParent();
+	stats.ppid = parent ? parent->pid() : 0;
+
+	auto path = process->path();
+	auto slash = path.rfind('/');
+	auto comm = slash != std::string::npos ? path.substr(slash + 1) : path;
+	strncpy(stats.comm, comm.c_str(), sizeof(stats.comm) - 1);
+
+	// Zombies do not have a thread or an address space anymore.
+	auto threadHandle = process->threadDescriptor().getHandle();
+	if(threadHandle != kHelNullHandle) {
+		HelThreadStats threadStats;
+		HEL_CHECK(helQueryThreadStats(threadHandle, &threadStats));
+		stats.userTime = threadStats.userTime;
+		stats.kernelTime = threadStats.kernelTime;
+		stats.waitTime = threadStats.waitTime;
+		stats.voluntarySwitches = threadStats.voluntarySwitches;
+		stats.involuntarySwitches = threadStats.involuntarySwitches;
+		stats.minorFaults = threadStats.minorFaults;
+		stats.majorFaults = threadStats.majorFaults;
+		stats.lastCpu = threadStats.lastCpu;
+	}else{
+		stats.lastCpu = -1;
+	}
+
+	if(auto vmContext = process->vmContext(); vmContext) {
+		HelSpaceStats spaceStats;
+		HEL_CHECK(helQuerySpaceStats(vmContext->getSpace().getHandle(), &spaceStats));
+		stats.mappedSize = spaceStats.mappedSize;
+		stats.anonymousRss = spaceStats.anonymousRss;
+		stats.fileRss = spaceStats.fileRss;
+		stats.sharedRss = spaceStats.sharedRss;
+		stats.pageTableSize = spaceStats.pageTableSize;
+	}
+	return stats;
+}
+
+std::vector<std::string> handleRequest(Process *, const void *data, size_t length) {
+	if(length < sizeof(struct nlmsghdr))
+		return {};
+	struct nlmsghdr request;
+	memcpy(&request, data, sizeof(struct nlmsghdr));
+
+	if(request.nlmsg_type != posix::statsGetProcesses || !(request.nlmsg_flags & NLM_F_DUMP))
+		return replyError(request, EOPNOTSUPP);
+
+	// Pack as many records into each datagram as possible.
+	std::vector<std::string> datagrams;
+	std::string current;
+	for(auto &process : Process::listProcesses()) {
+		auto stats = collectStats(process.get());
+		if(current.size() + NLMSG_SPACE(sizeof(posix::ProcessStats))
+				> posix::statsMaxDatagramSize) {
+			datagrams.push_back(std::move(current));
+			current.clear();
+		}
+		appendMessage(current, request, posix::statsProcess, NLM_F_MULTI,
+				&stats, sizeof(posix::ProcessStats));
+	}
+
+	int status = 0;
+	if(current.size() + NLMSG_SPACE(sizeof(int)) > posix::statsMaxDatagramSize) {
+		datagrams.push_back(std::move(current));
+		current.clear();
+	}
+	appendMessage(current, request, NLMSG_DONE, NLM_F_MULTI, &status, sizeof(int));
+	datagrams.push_back(std::move(current));
+	return datagrams;
+}
+
+} // anonymous namespace
+
+void initialize() {
+	nl_socket::configure(posix::netlinkStats, 0, handleRequest);
+}
+
+} // namespace nl_stats
@@ -0,0 +1,8 @@
+#pragma once
+
+namespace nl_stats {
+
+// Registers the posix::netlinkStats protocol (see protocols/posix/data.hpp).
+void initialize();
+
+} // namespace nl_stats
@@ -47,7 +47,7 @@ std::shared_ptr<VmContext> VmContext::clone(std::shared_ptr<VmContext> original)
 			void *pointer;
 			HEL_CHECK(helMapMemory(copyView.getHandle(), context->_space.getHandle(),
 					reinterpret_cast<void *>(address),
-					0, area.areaSize, area.nativeFlags, &pointer));
+					area.copyOffset, area.areaSize, area.nativeFlags, &pointer));
 		}else{
 			void *pointer;
 			HEL_CHECK(helMapMemory(area.fileView.getHandle(), context->_space.getHandle(),
@@ -61,6 +61,7 @@ std::shared_ptr<VmContext> VmContext::clone(std::shared_ptr<VmContext> original)
 		copy.nativeFlags = area.nativeFlags;
 		copy.fileView = area.fileView.dup();
 		copy.copyView = std::move(copyView);
+		copy.copyOffset = area.copyOffset;
 		copy.file = area.file;
 		copy.offset = area.offset;
 		context->_areaTree.emplace(address, std::move(copy));
@@ -97,6 +98,7 @@ auto VmContext::splitAreaOn_(uintptr_t addr, size_t size) ->
 			right.nativeFlags = area.nativeFlags;
 			right.fileView = area.fileView.dup();
 			right.copyView = area.copyView.dup();
+			right.copyOffset = area.copyOffset + (addr - base);
 			right.file = area.file;
 			right.offset = area.offset + (addr - base);
 
@@ -170,40 +172,68 @@ VmContext::mapFile(uintptr_t hint, helix::UniqueDescriptor memory,
 	co_return pointer;
 }
 
-async::result<void *> VmContext::remapFile(void *oldPointer,
+async::result<frg::expected<Error, void *>> VmContext::remapFile(void *oldPointer,
 		size_t oldSize, size_t newSize) {
 	size_t alignedOldSize = (oldSize + 0xFFF) & ~size_t(0xFFF);
 	size_t alignedNewSize = (newSize + 0xFFF) & ~size_t(0xFFF);
 
 //	std::cout << "posix: Remapping " << oldPointer << std::endl;
 	auto it = _areaTree.find(reinterpret_cast<uintptr_t>(oldPointer));
-	assert(it != _areaTree.end());
-	assert(it->second.areaSize == alignedOldSize);
-
-	assert(!it->second.copyOnWrite);
-
-	auto memory = co_await it->second.file->accessMemory();
+	if(it == _areaTree.end() || it->second.areaSize != alignedOldSize)
+		co_return Error::illegalArguments;
+	auto &oldArea = it->second;
+
+	// The kernel moves the mapping (including its page table entries) without
+	// copying pages. The mapping can grow up to the current size of its memory.
+	helix::UniqueDescriptor memory;
+	if(oldArea.copyOnWrite) {
+		if(alignedNewSize > alignedOldSize) {
+			size_t copySize;
+			HEL_CHECK(helMemoryInfo(oldArea.copyView.getHandle(), &copySize));
+			if(oldArea.copyOffset + alignedNewSize > copySize) {
+				// Other (split) areas may use the memory beyond this area.
+				// For private file mappings, we would have to grow the copy-on-write
+				// memory beyond the file, hence we only grow anonymous memory.
+				if(oldArea.copyOffset + alignedOldSize != copySize || oldArea.file)
+					co_return Error::illegalArguments;
+				HEL_CHECK(helResizeMemory(oldArea.copyView.getHandle(),
+						oldArea.copyOffset + alignedNewSize));
+			}
+		}
+		memory = oldArea.copyView.dup();
+	}else{
+		memory = co_await oldArea.file->accessMemory();
+	}
 
-	// Perform the actual mapping.
-	// POSIX specifies that non-page-size mappings are rounded up and filled with zeros.
 	void *pointer;
-	HEL_CHECK(helMapMemory(memory.getHandle(), _space.getHandle(),
-			nullptr, it->second.offset, alignedNewSize,
-			it->second.nativeFlags, &pointer));
+	auto error = helRemapMemory(memory.getHandle(), _space.getHandle(),
+			oldPointer, alignedOldSize, alignedNewSize, kHelRemapMayMove, &pointer);
+	if(error == kHelErrIllegalArgs || error == kHelErrBufferTooSmall) {
+		if(oldArea.copyOnWrite)
+			co_return Error::illegalArguments;
+
+		// The file's memory object was replaced (or does not cover the new size);
+		// map the new memory object instead.
+		// POSIX specifies that non-page-size mappings are rounded up and filled with zeros.
+		HEL_CHECK(helMapMemory(memory.getHandle(), _space.getHandle(),
+				nullptr, oldArea.offset, alignedNewSize,
+				oldArea.nativeFlags, &pointer));
+		HEL_CHECK(helUnmapMemory(_space.getHandle(), oldPointer, alignedOldSize));
+	}else{
+		HEL_CHECK(error);
+	}
 //	std::cout << "posix: VM_REMAP returns " << pointer << std::endl;
 
-	// Unmap the old area.
-	HEL_CHECK(helUnmapMemory(_space.getHandle(), oldPointer, alignedOldSize));
-
 	// Construct the new area from the old one.
 	Area area;
-	area.copyOnWrite = it->second.copyOnWrite;
+	area.copyOnWrite = oldArea.copyOnWrite;
 	area.areaSize = alignedNewSize;
-	area.nativeFlags = it->second.nativeFlags;
-	area.fileView = std::move(it->second.fileView);
-	area.copyView = std::move(it->second.copyView);
-	area.file = std::move(it->second.file);
-	area.offset = it->second.offset;
+	area.nativeFlags = oldArea.nativeFlags;
+	area.fileView = std::move(oldArea.fileView);
+	area.copyView = std::move(oldArea.copyView);
+	area.copyOffset = oldArea.copyOffset;
+	area.file = std::move(oldArea.file);
+	area.offset = oldArea.offset;
 	_areaTree.erase(it);
 
 	// Perform some sanity checking.
@@ -258,6 +288,66 @@ void VmContext::unmapFile(void *pointer, size_t size) {
 	}
 }
 
+void VmContext::adviseFile(void *pointer, size_t size, int advice) {
+	size_t alignedSize = (size + 0xFFF) & ~size_t(0xFFF);
+	auto address = reinterpret_cast<uintptr_t>(pointer);
+	auto limit = address + alignedSize;
+
+	auto it = _areaTree.upper_bound(address);
+	if(it != _areaTree.begin())
+		it = std::prev(it);
+
+	for(; it != _areaTree.end() && it->first < limit; ++it) {
+		auto &[addr, area] = *it;
+		if(addr + area.areaSize <= address || !area.file)
+			continue;
+		auto begin = std::max(addr, address);
+		auto end = std::min(addr + area.areaSize, limit);
+		// This is only a hint, hence we ignore errors.
+		helAdviseMemory(area.fileView.getHandle(),
+				area.offset + (begin - addr), end - begin, advice);
+	}
+}
+
+void VmContext::discardPages(void *pointer, size_t size, bool lazy) {
+	size_t alignedSize = (size + 0xFFF) & ~size_t(0xFFF);
+	auto address = reinterpret_cast<uintptr_t>(pointer);
+	auto limit = address + alignedSize;
+
+	auto it = _areaTree.upper_bound(address);
+	if(it != _areaTree.begin())
+		it = std::prev(it);
+
+	for(; it != _areaTree.end() && it->first < limit; ++it) {
+		auto &[addr, area] = *it;
+		if(addr + area.areaSize <= address || !area.copyOnWrite)
+			continue;
+		auto begin = std::max(addr, address);
+		auto end = std::min(addr + area.areaSize, limit);
+		HEL_CHECK(helDiscardMemory(area.copyView.getHandle(),
+				area.copyOffset + (begin - addr), end - begin, lazy ? kHelDiscardLazy : 0));
+	}
+}
+
+void VmContext::adviseMergeable(void *pointer, size_t size, bool mergeable) {
+	size_t alignedSize = (size + 0xFFF) & ~size_t(0xFFF);
+	auto address = reinterpret_cast<uintptr_t>(pointer);
+	auto limit = address + alignedSize;
+
+	auto it = _areaTree.upper_bound(address);
+	if(it != _areaTree.begin())
+		it = std::prev(it);
+
+	for(; it != _areaTree.end() && it->first < limit; ++it) {
+		auto &[addr, area] = *it;
+		if(addr + area.areaSize <= address || !area.copyOnWrite)
+			continue;
+		// The kernel tracks mergeability per memory object, hence we advise the entire area.
+		helAdviseMemory(area.copyView.getHandle(), 0, area.areaSize,
+				mergeable ? kHelAdviseMergeable : kHelAdviseUnmergeable);
+	}
+}
+
 // ----------------------------------------------------------------------------
 // FsContext.
 // ----------------------------------------------------------------------------
@@ -317,9 +407,9 @@ std::shared_ptr<FileContext> FileContext::create() {
 
 	HelHandle memory;
 	void *window;
-	HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &memory));
+	HEL_CHECK(helAllocateMemory(fileTableSize, kHelAllocOnDemand, nullptr, &memory));
 	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
-			0, 0x1000, kHelMapProtRead | kHelMapProtWrite, &window));
+			0, fileTableSize, kHelMapProtRead | kHelMapProtWrite, &window));
 	context->_fileTableMemory = helix::UniqueDescriptor(memory);
 	context->_fileTableWindow = reinterpret_cast<HelHandle *>(window);
 
@@ -338,16 +428,16 @@ std::shared_ptr<FileContext> FileContext::clone(std::shared_ptr<FileContext> ori
 
 	HelHandle memory;
 	void *window;
-	HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &memory));
+	HEL_CHECK(helAllocateMemory(fileTableSize, kHelAllocOnDemand, nullptr, &memory));
 	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
-			0, 0x1000, kHelMapProtRead | kHelMapProtWrite, &window));
+			0, fileTableSize, kHelMapProtRead | kHelMapProtWrite, &window));
 	context->_fileTableMemory = helix::UniqueDescriptor(memory);
 	context->_fileTableWindow = reinterpret_cast<HelHandle *>(window);
 
-	for(auto entry : original->_fileTable) {
-		//std::cout << "Clone FD " << entry.first << std::endl;
-		context->attachFile(entry.first, entry.second.file, entry.second.closeOnExec);
-	}
+	original->_usedFds.for_each_set([&] (size_t fd) {
+		context->attachFile(fd, original->_fileTable[fd],
+				original->_closeOnExecFds.test(fd));
+	});
 
 	HEL_CHECK(helTransferDescriptor(posixMbusClient,
 			context->_universe.getHandle(), &context->_clientMbusLane));
@@ -362,25 +452,20 @@ FileContext::~FileContext() {
 
 int FileContext::attachFile(smarter::shared_ptr<File, FileHandle> file,
 		bool close_on_exec) {
-	HelHandle handle;
-	HEL_CHECK(helTransferDescriptor(file->getPassthroughLane().getHandle(),
-			_universe.getHandle(), &handle));
+	int fd = _usedFds.find_first_clear();
+	if(fd >= maxFileDescriptors)
+		return -1;
 
-	for(int fd = 0; ; fd++) {
-		if(_fileTable.find(fd) != _fileTable.end())
-			continue;
-
-		if(logFileAttach)
-			std::cout << "posix: Attaching FD " << fd << std::endl;
+	if(logFileAttach)
+		std::cout << "posix: Attaching FD " << fd << std::endl;
 
-		_fileTable.insert({fd, {std::move(file), close_on_exec}});
-		_fileTableWindow[fd] = handle;
-		return fd;
-	}
+	attachFile(fd, std::move(file), close_on_exec);
+	return fd;
 }
 
 void FileContext::attachFile(int fd, smarter::shared_ptr<File, FileHandle> file,
 		bool close_on_exec) {
+	assert(fd >= 0 && fd < maxFileDescriptors);
 	HelHandle handle;
 	HEL_CHECK(helTransferDescriptor(file->getPassthroughLane().getHandle(),
 			_universe.getHandle(), &handle));
@@ -388,43 +473,50 @@ void FileContext::attachFile(int fd, smarter::shared_ptr<File, FileHandle> file,
 	if(logFileAttach)
 		std::cout << "posix: Attaching fixed FD " << fd << std::endl;
 
-	auto it = _fileTable.find(fd);
-	if(it != _fileTable.end()) {
-		it->second = {std::move(file), close_on_exec};
+	if(static_cast<size_t>(fd) >= _fileTable.size())
+		_fileTable.resize(std::max(_fileTable.size() * 2, static_cast<size_t>(fd) + 1));
+
+	// Replacing an fd closes the old handle (as for dup2()).
+	if(_usedFds.test(fd))
+		HEL_CHECK(helCloseDescriptor(_universe.getHandle(), _fileTableWindow[fd]));
+
+	_fileTable[fd] = std::move(file);
+	_usedFds.set(fd);
+	if(close_on_exec) {
+		_closeOnExecFds.set(fd);
 	}else{
-		_fileTable.insert({fd, {std::move(file), close_on_exec}});
+		_closeOnExecFds.reset(fd);
 	}
 	_fileTableWindow[fd] = handle;
 }
 
 std::optional<FileDescriptor> FileContext::getDescriptor(int fd) {
-	auto file = _fileTable.find(fd);
-	if(file == _fileTable.end())
+	if(fd < 0 || !_usedFds.test(fd))
 		return std::nullopt;
-	return file->second;
+	return FileDescriptor{_fileTable[fd], _closeOnExecFds.test(fd)};
 }
 
 Error FileContext::setDescriptor(int fd, bool close_on_exec) {
-	auto it = _fileTable.find(fd);
-	if(it == _fileTable.end()) {
+	if(fd < 0 || !_usedFds.test(fd))
 		return Error::noSuchFile;
+	if(close_on_exec) {
+		_closeOnExecFds.set(fd);
+	}else{
+		_closeOnExecFds.reset(fd);
 	}
-	it->second.closeOnExec = close_on_exec;
 	return Error::success;
 }
 
 smarter::shared_ptr<File, FileHandle> FileContext::getFile(int fd) {
-	auto file = _fileTable.find(fd);
-	if(file == _fileTable.end())
+	if(fd < 0 || !_usedFds.test(fd))
 		return smarter::shared_ptr<File, FileHandle>{};
-	return file->second.file;
+	return _fileTable[fd];
 }
 
 void FileContext::closeFile(int fd) {
 	if(logFileAttach)
 		std::cout << "posix: Closing FD " << fd << std::endl;
-	auto it = _fileTable.find(fd);
-	if(it == _fileTable.end()) {
+	if(fd < 0 || !_usedFds.test(fd)) {
 		std::cout << "\e[31m" "posix: Trying to close non-existant FD "
 				<< fd << "\e[39m" << std::endl;
 		return;
@@ -433,21 +525,20 @@ void FileContext::closeFile(int fd) {
 	HEL_CHECK(helCloseDescriptor(_universe.getHandle(), _fileTableWindow[fd]));
 
 	_fileTableWindow[fd] = 0;
-	_fileTable.erase(it);
+	_fileTable[fd] = nullptr;
+	_usedFds.reset(fd);
+	_closeOnExecFds.reset(fd);
 }
 
 void FileContext::closeOnExec() {
-	auto it = _fileTable.begin();
-	while(it != _fileTable.end()) {
-		if(it->second.closeOnExec) {
-			HEL_CHECK(helCloseDescriptor(_universe.getHandle(), _fileTableWindow[it->first]));
+	_closeOnExecFds.for_each_set([&] (size_t fd) {
+		HEL_CHECK(helCloseDescriptor(_universe.getHandle(), _fileTableWindow[fd]));
 
-			_fileTableWindow[it->first] = 0;
-			it = _fileTable.erase(it);
-		}else{
-			it++;
-		}
-	}
+		_fileTableWindow[fd] = 0;
+		_fileTable[fd] = nullptr;
+		_usedFds.reset(fd);
+	});
+	_closeOnExecFds.clear();
 }
 
 // ----------------------------------------------------------------------------
@@ -469,7 +560,10 @@ struct CompileSignalInfo {
 } // anonymous namespace
 
 SignalContext::SignalContext()
-: _currentSeq{1}, _activeSet{0} { }
+: _currentSeq{1}, _activeSet{0} {
+	for(int i = 0; i < rtQueueSize; i++)
+		_rtPool[i].next = (i + 1 < rtQueueSize) ? i + 1 : -1;
+}
 
 std::shared_ptr<SignalContext> SignalContext::create() {
 	auto context = std::make_shared<SignalContext>();
@@ -486,7 +580,7 @@ std::shared_ptr<SignalContext> SignalContext::clone(std::shared_ptr<SignalContex
 
 	// Copy the current signal handler table.
 	for(int sn = 1; sn <= 64; sn++)
-		context->_handlers[sn - 1] = original->_handlers[sn];
+		context->_handlers[sn - 1] = original->_handlers[sn - 1];
 
 	return context;
 }
@@ -507,14 +601,32 @@ SignalHandler SignalContext::changeHandler(int sn, SignalHandler handler) {
 }
 
 void SignalContext::issueSignal(int sn, SignalInfo info) {
-	assert(sn - 1 < 64);
-	auto item = new SignalItem;
-	item->signalNumber = sn;
-	item->info = info;
+	assert(sn >= 1 && sn <= 64);
+	auto bit = UINT64_C(1) << (sn - 1);
+
+	if(sn < firstRtSignal) {
+		// Standard signals are not queued.
+		if(_activeSet & bit)
+			return;
+		_standardInfo[sn - 1] = info;
+	}else if(_rtFree >= 0) {
+		auto index = std::exchange(_rtFree, _rtPool[_rtFree].next);
+		_rtPool[index].next = -1;
+		_rtPool[index].info = info;
+
+		auto &queue = _rtQueues[sn - firstRtSignal];
+		if(queue.tail >= 0) {
+			_rtPool[queue.tail].next = index;
+		}else{
+			queue.head = index;
+		}
+		queue.tail = index;
+	}else if(_activeSet & bit) {
+		return;
+	}
 
-	_slots[sn - 1].raiseSeq = ++_currentSeq;
-	_slots[sn - 1].asyncQueue.push_back(*item);
-	_activeSet |= (UINT64_C(1) << (sn - 1));
+	_raiseSeqs[sn - 1] = ++_currentSeq;
+	_activeSet |= bit;
 	_signalBell.raise();
 }
 
@@ -532,7 +644,7 @@ SignalContext::pollSignal(uint64_t in_seq, uint64_t mask,
 
 	uint64_t edges = 0;
 	for(int sn = 1; sn <= 64; sn++)
-		if(_slots[sn - 1].raiseSeq > in_seq)
+		if(_raiseSeqs[sn - 1] > in_seq)
 			edges |= UINT64_C(1) << (sn - 1);
 
 	co_return PollSignalResult{_currentSeq, edges};
@@ -542,27 +654,42 @@ CheckSignalResult SignalContext::checkSignal() {
 	return CheckSignalResult(_currentSeq, _activeSet);
 }
 
-async::result<SignalItem *> SignalContext::fetchSignal(uint64_t mask, bool nonBlock) {
-	int sn;
-	while(true) {
-		for(sn = 1; sn <= 64; sn++) {
-			if(!(mask & (UINT64_C(1) << (sn - 1))))
-				continue;
-			if(!_slots[sn - 1].asyncQueue.empty())
-				break;
-		}
-		if(sn - 1 != 64)
-			break;
+async::result<std::optional<SignalItem>>
+SignalContext::fetchSignal(uint64_t mask, bool nonBlock) {
+	while(!(_activeSet & mask)) {
 		if(nonBlock)
-			co_return nullptr;
+			co_return std::nullopt;
 		co_await _signalBell.async_wait();
 	}
 
-	assert(!_slots[sn - 1].asyncQueue.empty());
-	auto item = &_slots[sn - 1].asyncQueue.front();
-	_slots[sn - 1].asyncQueue.pop_front();
-	if(_slots[sn - 1].asyncQueue.empty())
-		_activeSet &= ~(UINT64_C(1) << (sn - 1));
+	// Deliver the lowest pending signal first (like Linux).
+	int sn = __builtin_ctzll(_activeSet & mask) + 1;
+	auto bit = UINT64_C(1) << (sn - 1);
+
+	SignalItem item;
+	item.signalNumber = sn;
+	if(sn < firstRtSignal) {
+		item.info = _standardInfo[sn - 1];
+		_activeSet &= ~bit;
+		co_return item;
+	}
+
+	auto &queue = _rtQueues[sn - firstRtSignal];
+	if(queue.head < 0) {
+		// The signal was coalesced since the pool was exhausted.
+		item.info = UserSignal{};
+		_activeSet &= ~bit;
+		co_return item;
+	}
+
+	auto index = queue.head;
+	item.info = _rtPool[index].info;
+	queue.head = _rtPool[index].next;
+	if(queue.head < 0) {
+		queue.tail = -1;
+		_activeSet &= ~bit;
+	}
+	_rtPool[index].next = std::exchange(_rtFree, index);
 
 	co_return item;
 }
@@ -611,28 +738,28 @@ static const auto simdStateSize = [] () -> size_t {
 	return regInfo.setSize;
 }();
 
-async::result<void> SignalContext::raiseContext(SignalItem *item, Process *process,
+async::result<void> SignalContext::raiseContext(SignalItem item, Process *process,
 		bool &killed) {
 	auto thread = process->threadDescriptor();
 
-	SignalHandler handler = _handlers[item->signalNumber - 1];
+	SignalHandler handler = _handlers[item.signalNumber - 1];
 
 	process->enterSignal();
 
 	// Implement SA_RESETHAND by resetting the signal disposition to default.
 	if(handler.flags & signalOnce)
-		_handlers[item->signalNumber].disposition = SignalDisposition::none;
+		_handlers[item.signalNumber - 1].disposition = SignalDisposition::none;
 
 	if(handler.disposition == SignalDisposition::none) {
-		if(item->signalNumber == SIGCHLD) { // TODO: Handle default actions generically.
+		if(item.signalNumber == SIGCHLD) { // TODO: Handle default actions generically.
 			// Ignore the signal.
 			killed = false;
 			co_return;
 		}else{
 			std::cout << "posix: Thread killed as the result of signal "
-							<< item->signalNumber << std::endl;
+							<< item.signalNumber << std::endl;
 			killed = true;
-			co_await process->terminate(TerminationBySignal{item->signalNumber});
+			co_await process->terminate(TerminationBySignal{item.signalNumber});
 			co_return;
 		}
 	} else if(handler.disposition == SignalDisposition::ignore) {
@@ -658,8 +785,8 @@ async::result<void> SignalContext::raiseContext(SignalItem *item, Process *proce
 
 	// Once compile siginfo_t if that is neccessary (matches Linux behavior).
 	if(handler.flags & signalInfo) {
-		sf.info.si_signo = item->signalNumber;
-		std::visit(CompileSignalInfo{&sf.info}, item->info);
+		sf.info.si_signo = item.signalNumber;
+		std::visit(CompileSignalInfo{&sf.info}, item.info);
 	}
 
 	// Setup the stack frame.
@@ -696,11 +823,11 @@ async::result<void> SignalContext::raiseContext(SignalItem *item, Process *proce
 	// Setup the new register image and resume.
 	// TODO: Linux sets rdx to the ucontext.
 #if defined(__x86_64__)
-	sf.gprs[kHelRegRdi] = item->signalNumber;
+	sf.gprs[kHelRegRdi] = item.signalNumber;
 	sf.gprs[kHelRegRsi] = frame + offsetof(SignalFrame, info);
 	sf.gprs[kHelRegRax] = 0; // Number of variable arguments.
 #elif defined(__aarch64__)
-	sf.gprs[kHelRegX0] = item->signalNumber;
+	sf.gprs[kHelRegX0] = item.signalNumber;
 	sf.gprs[kHelRegX1] = frame + offsetof(SignalFrame, info);
 
 	// Return address for the 'ret' instruction
@@ -712,8 +839,6 @@ async::result<void> SignalContext::raiseContext(SignalItem *item, Process *proce
 
 	HEL_CHECK(helStoreRegisters(thread.getHandle(), kHelRegsGeneral, &sf.gprs));
 	HEL_CHECK(helStoreRegisters(thread.getHandle(), kHelRegsProgram, &sf.pcrs));
-
-	delete item;
 }
 
 async::result<void> SignalContext::restoreContext(helix::BorrowedDescriptor thread) {
@@ -801,6 +926,15 @@ std::shared_ptr<Process> Process::findProcess(ProcessId pid) {
 	return it->second->getProcess();
 }
 
+std::vector<std::shared_ptr<Process>> Process::listProcesses() {
+	std::vector<std::shared_ptr<Process>> processes;
+	for(auto &[pid, hull] : globalPidMap) {
+		if(auto process = hull->getProcess(); process)
+			processes.push_back(std::move(process));
+	}
+	return processes;
+}
+
 Process::Process(std::shared_ptr<PidHull> hull, Process *parent)
 : _parent{parent}, _hull{std::move(hull)},
 		_clientPosixLane{kHelNullHandle}, _clientFileTable{nullptr},
@@ -833,6 +967,41 @@ bool Process::checkOrRequestSignalRaise() {
 	return false;
 }
 
+void Process::_setupIdentityPage() {
+	HelHandle memory;
+	HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &memory));
+	_identityPageMemory = helix::UniqueDescriptor{memory};
+	_identityPageMapping = helix::Mapping{_identityPageMemory, 0, 0x1000};
+
+	HEL_CHECK(helMapMemory(_identityPageMemory.getHandle(),
+			_vmContext->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead,
+			&_clientIdentityPage));
+	_publishIdentity();
+}
+
+void Process::_publishIdentity() {
+	auto page = reinterpret_cast<posix::IdentityPage *>(_identityPageMapping.get());
+	if(!page)
+		return;
+
+	// Start the seqlock write.
+	auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_RELAXED);
+	assert(!(seqlock & 1));
+	__atomic_store_n(&page->seqlock, seqlock + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__atomic_store_n(&page->pid, pid(), __ATOMIC_RELAXED);
+	__atomic_store_n(&page->tid, tid(), __ATOMIC_RELAXED);
+	__atomic_store_n(&page->uid, _uid, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->euid, _euid, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->gid, _gid, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->egid, _egid, __ATOMIC_RELAXED);
+
+	// Finish the seqlock write.
+	__atomic_store_n(&page->seqlock, seqlock + 2, __ATOMIC_RELEASE);
+}
+
 async::result<std::shared_ptr<Process>> Process::init(std::string path) {
 	auto hull = std::make_shared<PidHull>(1);
 	auto process = std::make_shared<Process>(std::move(hull), nullptr);
@@ -863,7 +1032,7 @@ async::result<std::shared_ptr<Process>> Process::init(std::string path) {
 			&process->_clientThreadPage));
 	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
 			process->_vmContext->getSpace().getHandle(),
-			nullptr, 0, 0x1000, kHelMapProtRead,
+			nullptr, 0, FileContext::fileTableSize, kHelMapProtRead,
 			&process->_clientFileTable));
 	HEL_CHECK(helMapMemory(clk::trackerPageMemory().getHandle(),
 			process->_vmContext->getSpace().getHandle(),
@@ -875,6 +1044,7 @@ async::result<std::shared_ptr<Process>> Process::init(std::string path) {
 	process->_gid = 0;
 	process->_egid = 0;
 	process->_hull->initializeProcess(process.get());
+	process->_setupIdentityPage();
 
 	// TODO: Do not pass an empty argument vector?
 	auto execOutcome = co_await execute(process->_fsContext->getRoot(),
@@ -934,7 +1104,7 @@ std::shared_ptr<Process> Process::fork(std::shared_ptr<Process> original) {
 			&process->_clientThreadPage));
 	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
 			process->_vmContext->getSpace().getHandle(),
-			nullptr, 0, 0x1000, kHelMapProtRead,
+			nullptr, 0, FileContext::fileTableSize, kHelMapProtRead,
 			&process->_clientFileTable));
 	HEL_CHECK(helMapMemory(clk::trackerPageMemory().getHandle(),
 			process->_vmContext->getSpace().getHandle(),
@@ -949,6 +1119,7 @@ std::shared_ptr<Process> Process::fork(std::shared_ptr<Process> original) {
 	process->_egid = original->_egid;
 	original->_children.push_back(process);
 	process->_hull->initializeProcess(process.get());
+	process->_setupIdentityPage();
 	process->_didExecute = false;
 
 	auto procfs_root = std::static_pointer_cast<procfs::DirectoryNode>(getProcfs()->getTarget());
@@ -1009,6 +1180,7 @@ std::shared_ptr<Process> Process::clone(std::shared_ptr<Process> original, void
 	process->_egid = original->_egid;
 	original->_children.push_back(process);
 	process->_hull->initializeProcess(process.get());
+	process->_setupIdentityPage();
 	process->_didExecute = false;
 
 	HelHandle new_thread;
@@ -1025,6 +1197,86 @@ std::shared_ptr<Process> Process::clone(std::shared_ptr<Process> original, void
 	return process;
 }
 
+std::shared_ptr<Process> Process::vfork(std::shared_ptr<Process> original) {
+	auto hull = std::make_shared<PidHull>(nextPid++);
+	auto process = std::make_shared<Process>(std::move(hull), original.get());
+	process->_path = original->path();
+	process->_vmContext = original->_vmContext;
+	process->_fsContext = FsContext::clone(original->_fsContext);
+	process->_fileContext = FileContext::clone(original->_fileContext);
+	process->_signalContext = SignalContext::clone(original->_signalContext);
+	process->_vforkPending = true;
+
+	original->_pgPointer->reassociateProcess(process.get());
+
+	HelHandle thread_memory;
+	HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &thread_memory));
+	process->_threadPageMemory = helix::UniqueDescriptor{thread_memory};
+	process->_threadPageMapping = helix::Mapping{process->_threadPageMemory, 0, 0x1000};
+
+	// Signal masks are copied on vfork().
+	process->_signalMask = original->_signalMask;
+
+	auto [server_lane, client_lane] = helix::createStream();
+	HEL_CHECK(helTransferDescriptor(client_lane.getHandle(),
+			process->_fileContext->getUniverse().getHandle(), &process->_clientPosixLane));
+	client_lane.release();
+
+	// The child's pages are mapped into the shared space; they are unmapped again
+	// in _releaseVforkParent().
+	HEL_CHECK(helMapMemory(process->_threadPageMemory.getHandle(),
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead | kHelMapProtWrite,
+			&process->_clientThreadPage));
+	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, FileContext::fileTableSize, kHelMapProtRead,
+			&process->_clientFileTable));
+	process->_clientClkTrackerPage = original->_clientClkTrackerPage;
+
+	process->_clientAuxBegin = original->_clientAuxBegin;
+	process->_clientAuxEnd = original->_clientAuxEnd;
+	process->_uid = original->_uid;
+	process->_euid = original->_euid;
+	process->_gid = original->_gid;
+	process->_egid = original->_egid;
+	original->_children.push_back(process);
+	process->_hull->initializeProcess(process.get());
+	process->_setupIdentityPage();
+	process->_didExecute = false;
+
+	auto procfs_root = std::static_pointer_cast<procfs::DirectoryNode>(getProcfs()->getTarget());
+	process->_procfs_dir = procfs_root->createProcDirectory(std::to_string(process->_hull->getPid()), process.get());
+
+	HelHandle new_thread;
+	HEL_CHECK(helCreateThread(process->fileContext()->getUniverse().getHandle(),
+			process->vmContext()->getSpace().getHandle(), kHelAbiSystemV,
+			0, 0, kHelThreadStopped, &new_thread));
+	process->_threadDescriptor = helix::UniqueDescriptor{new_thread};
+	process->_posixLane = std::move(server_lane);
+
+	auto generation = std::make_shared<Generation>();
+	process->_currentGeneration = generation;
+	async::detach(serve(process, std::move(generation)));
+
+	return process;
+}
+
+void Process::_releaseVforkParent() {
+	if(!_vforkPending)
+		return;
+	_vforkPending = false;
+
+	auto space = _vmContext->getSpace().getHandle();
+	HEL_CHECK(helUnmapMemory(space, _clientThreadPage, 0x1000));
+	HEL_CHECK(helUnmapMemory(space, _clientFileTable, FileContext::fileTableSize));
+	HEL_CHECK(helUnmapMemory(space, _clientIdentityPage, 0x1000));
+	_clientThreadPage = nullptr;
+	_clientFileTable = nullptr;
+	_clientIdentityPage = nullptr;
+	_vforkDone.raise();
+}
+
 async::result<Error> Process::exec(std::shared_ptr<Process> process,
 		std::string path, std::vector<std::string> args, std::vector<std::string> env) {
 	auto exec_vm_context = VmContext::create();
@@ -1047,6 +1299,7 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 	void *exec_thread_page;
 	void *exec_clk_tracker_page;
 	void *exec_client_table;
+	void *exec_identity_page;
 	HEL_CHECK(helMapMemory(process->_threadPageMemory.getHandle(),
 			exec_vm_context->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead | kHelMapProtWrite,
@@ -1055,9 +1308,13 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 			exec_vm_context->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead,
 			&exec_clk_tracker_page));
-	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
+	HEL_CHECK(helMapMemory(process->_identityPageMemory.getHandle(),
 			exec_vm_context->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead,
+			&exec_identity_page));
+	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
+			exec_vm_context->getSpace().getHandle(),
+			nullptr, 0, FileContext::fileTableSize, kHelMapProtRead,
 			&exec_client_table));
 
 	// Kill the old thread.
@@ -1071,6 +1328,7 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 
 	// Perform pre-exec() work.
 	// From here on, we can now release resources of the old process image.
+	process->_releaseVforkParent();
 	process->_fileContext->closeOnExec();
 
 	// "Commit" the exec() operation.
@@ -1083,6 +1341,7 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 	process->_clientPosixLane = exec_posix_lane;
 	process->_clientFileTable = exec_client_table;
 	process->_clientClkTrackerPage = exec_clk_tracker_page;
+	process->_clientIdentityPage = exec_identity_page;
 	process->_clientAuxBegin = execResult.auxBegin;
 	process->_clientAuxEnd = execResult.auxEnd;
 	process->_didExecute = true;
@@ -1097,7 +1356,7 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 
 void Process::retire(Process *process) {
 	assert(process->_parent);
-	process->_parent->_childrenUsage.userTime += process->_generationUsage.userTime;
+	process->_parent->_childrenUsage.accumulate(process->_generationUsage);
 }
 
 async::result<void> Process::terminate(TerminationState state) {
@@ -1115,8 +1374,9 @@ async::result<void> Process::terminate(TerminationState state) {
 	// TODO: Do the accumulation + _currentGeneration reset after the thread has really terminated?
 	HelThreadStats stats;
 	HEL_CHECK(helQueryThreadStats(_threadDescriptor.getHandle(), &stats));
-	_generationUsage.userTime += stats.userTime;
+	_generationUsage.accumulate(stats);
 
+	_releaseVforkParent();
 	_posixLane = {};
 	_threadDescriptor = {};
 	_vmContext = nullptr;
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <array>
 #include <map>
 #include <memory>
+#include <optional>
 #include <unordered_map>
+#include <vector>
 
 #include <async/result.hpp>
 #include <async/oneshot-event.hpp>
@@ -11,6 +14,7 @@
 
 #include "vfs.hpp"
 #include "procfs.hpp"
+#include "util.hpp"
 
 struct Generation;
 struct Process;
@@ -37,12 +41,26 @@ struct VmContext {
 			smarter::shared_ptr<File, FileHandle> file,
 			intptr_t offset, size_t size, bool copyOnWrite, uint32_t nativeFlags);
 
-	async::result<void *> remapFile(void *old_pointer, size_t old_size, size_t new_size);
+	// Resizes (and potentially moves) the area at old_pointer without copying its pages.
+	async::result<frg::expected<Error, void *>>
+	remapFile(void *old_pointer, size_t old_size, size_t new_size);
 
 	async::result<void> protectFile(void *pointer, size_t size, uint32_t protectionFlags);
 
 	void unmapFile(void *pointer, size_t size);
 
+	// Forwards an access pattern hint (one of HelMemoryAdvice) to the memory
+	// of all file mappings in the given range.
+	void adviseFile(void *pointer, size_t size, int advice);
+
+	// Allows (or disallows) merging of identical pages in private mappings.
+	void adviseMergeable(void *pointer, size_t size, bool mergeable);
+
+	// Drops the pages of private mappings in the given range (MADV_DONTNEED),
+	// or marks them as reclaimable under memory pressure if lazy is set (MADV_FREE).
+	// Shared mappings are not affected.
+	void discardPages(void *pointer, size_t size, bool lazy);
+
 private:
 	struct Area {
 		bool copyOnWrite;
@@ -50,6 +68,8 @@ private:
 		uint32_t nativeFlags;
 		helix::UniqueDescriptor fileView;
 		helix::UniqueDescriptor copyView;
+		// Offset of the area within copyView (non-zero if the area was split).
+		uintptr_t copyOffset = 0;
 		smarter::shared_ptr<File, FileHandle> file;
 		intptr_t offset;
 	};
@@ -61,6 +81,8 @@ private:
 
 	helix::UniqueDescriptor _space;
 
+	// Mirrors the mappings of _space. New areas are placed by the kernel
+	// (which tracks the largest hole per subtree), hence we never search for holes here.
 	std::map<uintptr_t, Area> _areaTree;
 
 public:
@@ -155,6 +177,11 @@ struct FileDescriptor {
 
 struct FileContext {
 public:
+	// Size of the table of passthrough handles that is mapped into the process.
+	// Its memory is allocated on demand, so only pages that hold fds are backed.
+	static constexpr int maxFileDescriptors = 1 << 17;
+	static constexpr size_t fileTableSize = maxFileDescriptors * sizeof(HelHandle);
+
 	static std::shared_ptr<FileContext> create();
 	static std::shared_ptr<FileContext> clone(std::shared_ptr<FileContext> original);
 
@@ -168,8 +195,10 @@ public:
 		return _fileTableMemory;
 	}
 
+	// Attaches the file to the lowest free fd. Returns -1 if all fds are in use.
 	int attachFile(smarter::shared_ptr<File, FileHandle> file, bool close_on_exec = false);
 
+	// The fd must be less than maxFileDescriptors.
 	void attachFile(int fd, smarter::shared_ptr<File, FileHandle> file, bool close_on_exec = false);
 
 	std::optional<FileDescriptor> getDescriptor(int fd);
@@ -189,8 +218,10 @@ public:
 private:
 	helix::UniqueDescriptor _universe;
 
-	// TODO: replace this by a tree that remembers gaps between keys.
-	std::unordered_map<int, FileDescriptor> _fileTable;
+	// Indexed by fd; grows on demand. Entries of closed fds are null.
+	std::vector<smarter::shared_ptr<File, FileHandle>> _fileTable;
+	hierarchical_bitmap _usedFds;
+	hierarchical_bitmap _closeOnExecFds;
 
 	helix::UniqueDescriptor _fileTableMemory;
 
@@ -232,24 +263,32 @@ struct SignalHandler {
 struct SignalItem {
 	int signalNumber;
 	SignalInfo info;
-	boost::intrusive::list_member_hook<> queueHook;
 };
 
 using PollSignalResult = std::tuple<uint64_t, uint64_t>;
 using CheckSignalResult = std::tuple<uint64_t, uint64_t>;
 
 struct SignalContext {
+	// Signals below this number are standard signals: raising them while they are
+	// already pending has no effect. Real-time signals are queued.
+	static constexpr int firstRtSignal = 32;
+	static constexpr int numRtSignals = 64 - firstRtSignal + 1;
+
+	// Size of the per-process pool of queued real-time signals.
+	// If the pool is exhausted, further real-time signals are coalesced
+	// like standard signals (and lose their SignalInfo).
+	static constexpr int rtQueueSize = 64;
+
 private:
-	struct SignalSlot {
-		uint64_t raiseSeq = 0;
-
-		boost::intrusive::list<
-			SignalItem,
-			boost::intrusive::member_hook<
-				SignalItem,
-				boost::intrusive::list_member_hook<>,
-				&SignalItem::queueHook>
-		> asyncQueue;
+	struct QueuedSignal {
+		int next;
+		SignalInfo info;
+	};
+
+	// FIFO of indices into _rtPool.
+	struct RtQueue {
+		int head = -1;
+		int tail = -1;
 	};
 
 public:
@@ -270,25 +309,39 @@ public:
 
 	CheckSignalResult checkSignal();
 
+	// Cheap check that callers can do before fetchSignal().
+	bool hasPendingSignal(uint64_t mask) {
+		return _activeSet & mask;
+	}
+
 	// TODO: If we ever need to cancel this operation, it would be better to
 	//       take a cancellation token instead of nonBlock.
-	async::result<SignalItem *> fetchSignal(uint64_t mask, bool nonBlock);
+	async::result<std::optional<SignalItem>> fetchSignal(uint64_t mask, bool nonBlock);
 
 	// ------------------------------------------------------------------------
 	// Signal context manipulation.
 	// ------------------------------------------------------------------------
 
-	async::result<void> raiseContext(SignalItem *item, Process *process,
+	async::result<void> raiseContext(SignalItem item, Process *process,
 			bool &killed);
 
 	async::result<void> restoreContext(helix::BorrowedDescriptor thread);
 
 private:
 	SignalHandler _handlers[64];
-	SignalSlot _slots[64];
+	uint64_t _raiseSeqs[64] = {};
+
+	// SignalInfo of pending standard signals.
+	SignalInfo _standardInfo[firstRtSignal - 1];
+
+	std::array<QueuedSignal, rtQueueSize> _rtPool;
+	// Head of the free list in _rtPool.
+	int _rtFree = 0;
+	RtQueue _rtQueues[numRtSignals];
 
 	async::recurring_event _signalBell;
 	uint64_t _currentSeq;
+	// Bit (sn - 1) is set if signal sn is pending.
 	uint64_t _activeSet;
 };
 
@@ -313,6 +366,29 @@ using TerminationState = std::variant<
 
 struct ResourceUsage {
 	uint64_t userTime;
+	uint64_t systemTime;
+	uint64_t minorFaults;
+	uint64_t majorFaults;
+	uint64_t voluntarySwitches;
+	uint64_t involuntarySwitches;
+
+	void accumulate(const HelThreadStats &stats) {
+		userTime += stats.userTime;
+		systemTime += stats.kernelTime;
+		minorFaults += stats.minorFaults;
+		majorFaults += stats.majorFaults;
+		voluntarySwitches += stats.voluntarySwitches;
+		involuntarySwitches += stats.involuntarySwitches;
+	}
+
+	void accumulate(const ResourceUsage &other) {
+		userTime += other.userTime;
+		systemTime += other.systemTime;
+		minorFaults += other.minorFaults;
+		majorFaults += other.majorFaults;
+		voluntarySwitches += other.voluntarySwitches;
+		involuntarySwitches += other.involuntarySwitches;
+	}
 };
 
 // This struct is mainly needed to coordinate the destruction of kernel threads
@@ -372,11 +448,19 @@ struct Process : std::enable_shared_from_this<Process> {
 
 	static std::shared_ptr<Process> findProcess(ProcessId pid);
 
+	// Returns all processes that have not been reaped yet, ordered by PID.
+	static std::vector<std::shared_ptr<Process>> listProcesses();
+
 	static async::result<std::shared_ptr<Process>> init(std::string path);
 
 	static std::shared_ptr<Process> fork(std::shared_ptr<Process> parent);
 	static std::shared_ptr<Process> clone(std::shared_ptr<Process> parent, void *ip, void *sp);
 
+	// Like fork() but the child borrows the parent's VmContext until it calls exec()
+	// or terminates. The caller must keep the parent's thread stopped until then
+	// (see vforkDone()).
+	static std::shared_ptr<Process> vfork(std::shared_ptr<Process> parent);
+
 	static async::result<Error> exec(std::shared_ptr<Process> process,
 			std::string path, std::vector<std::string> args, std::vector<std::string> env);
 
@@ -413,9 +497,11 @@ public:
 		if(_uid == 0 || _euid == 0) {
 			_uid = uid;
 			_euid = uid;
+			_publishIdentity();
 			return Error::success;
 		} else if(uid == _uid) {
 			_uid = uid;
+			_publishIdentity();
 			return Error::success;
 		}
 		return Error::accessDenied;
@@ -431,6 +517,7 @@ public:
 		}
 		if(_uid == 0 || _euid == 0 || euid == _uid) {
 			_euid = euid;
+			_publishIdentity();
 			return Error::success;
 		}
 		return Error::accessDenied;
@@ -447,9 +534,11 @@ public:
 		if(_gid == 0 || _egid == 0) {
 			_gid = gid;
 			_egid = gid;
+			_publishIdentity();
 			return Error::success;
 		} else if(gid == _gid) {
 			_egid = gid;
+			_publishIdentity();
 			return Error::success;
 		}
 		return Error::accessDenied;
@@ -465,6 +554,7 @@ public:
 		}
 		if(_gid == 0 || _egid == 0 || _gid == egid || _egid == egid) {
 			_egid = egid;
+			_publishIdentity();
 			return Error::success;
 		}
 		return Error::accessDenied;
@@ -510,6 +600,7 @@ public:
 	void *clientThreadPage() { return _clientThreadPage; }
 	void *clientFileTable() { return _clientFileTable; }
 	void *clientClkTrackerPage() { return _clientClkTrackerPage; }
+	void *clientIdentityPage() { return _clientIdentityPage; }
 	void *clientAuxBegin() { return _clientAuxBegin; }
 	void *clientAuxEnd() { return _clientAuxEnd; }
 
@@ -527,6 +618,11 @@ public:
 
 	async::result<void> terminate(TerminationState state);
 
+	// Completes once a child created by vfork() no longer uses the parent's VmContext.
+	async::result<void> vforkDone() {
+		co_await _vforkDone.wait();
+	}
+
 	async::result<int> wait(int pid, bool nonBlocking, TerminationState *state);
 
 	ResourceUsage accumulatedUsage() {
@@ -567,6 +663,16 @@ public:
 	}
 
 private:
+	// Allocates the identity page and maps it into the current VM context.
+	void _setupIdentityPage();
+
+	// Updates the identity page after the IDs changed.
+	void _publishIdentity();
+
+	// Removes the pages of a vfork() child from the parent's VmContext and
+	// lets the parent continue.
+	void _releaseVforkParent();
+
 	Process *_parent;
 
 	std::shared_ptr<PidHull> _hull;
@@ -575,6 +681,8 @@ private:
 	int _gid;
 	int _egid;
 	bool _didExecute;
+	bool _vforkPending = false;
+	async::oneshot_event _vforkDone;
 	std::string _path;
 	helix::UniqueLane _posixLane;
 	helix::UniqueDescriptor _threadDescriptor;
@@ -591,10 +699,14 @@ private:
 	helix::UniqueDescriptor _threadPageMemory;
 	helix::Mapping _threadPageMapping;
 
+	helix::UniqueDescriptor _identityPageMemory;
+	helix::Mapping _identityPageMapping;
+
 	HelHandle _clientPosixLane;
 	void *_clientThreadPage;
 	void *_clientFileTable;
 	void *_clientClkTrackerPage;
+	void *_clientIdentityPage = nullptr;
 	// Pointers to the aux vector in the client.
 	void *_clientAuxBegin = nullptr;
 	void *_clientAuxEnd = nullptr;
@@ -7,6 +7,7 @@
 #include "device.hpp"
 #include "procfs.hpp"
 #include "process.hpp"
+#include "request-stats.hpp"
 
 namespace procfs {
 
@@ -215,6 +216,10 @@ std::shared_ptr<Link> DirectoryNode::createRootDirectory() {
 
 	auto self_link = std::make_shared<Link>(the_node->shared_from_this(), "self", std::make_shared<SelfLink>());
 	the_node->_entries.insert(std::move(self_link));
+
+	auto managarm_link = the_node->directMkdir("managarm");
+	auto managarm_dir = static_cast<DirectoryNode *>(managarm_link->getTarget().get());
+	managarm_dir->directMkregular("posix-stats", std::make_shared<PosixStatsNode>());
 	return link;
 }
 
@@ -253,6 +258,10 @@ std::shared_ptr<Link> DirectoryNode::createProcDirectory(std::string name,
 
 	proc_dir->directMknode("exe", std::make_shared<ExeLink>(process));
 	proc_dir->directMkregular("maps", std::make_shared<MapNode>(process));
+	proc_dir->directMkregular("stat", std::make_shared<StatNode>(process));
+	proc_dir->directMkregular("schedstat", std::make_shared<SchedstatNode>(process));
+	proc_dir->directMkregular("statm", std::make_shared<StatmNode>(process));
+	proc_dir->directMkregular("status", std::make_shared<StatusNode>(process));
 
 	return link;
 }
@@ -371,6 +380,155 @@ async::result<void> MapNode::store(std::string) {
 	throw std::runtime_error("Can't store to a /proc/maps file!");
 }
 
+namespace {
+	// Returns all zeros if the process does not have a thread anymore (e.g., for zombies).
+	HelThreadStats queryThreadStats(Process *process) {
+		HelThreadStats stats{};
+		auto handle = process->threadDescriptor().getHandle();
+		if(handle != kHelNullHandle)
+			HEL_CHECK(helQueryThreadStats(handle, &stats));
+		return stats;
+	}
+
+	// The kernel maintains these counters incrementally; hence, this does not need to
+	// walk the mappings of the process. Returns all zeros if the process has already
+	// released its address space.
+	HelSpaceStats querySpaceStats(Process *process) {
+		HelSpaceStats stats{};
+		auto vmContext = process->vmContext();
+		if(vmContext)
+			HEL_CHECK(helQuerySpaceStats(vmContext->getSpace().getHandle(), &stats));
+		return stats;
+	}
+
+	uint64_t rssOf(const HelSpaceStats &stats) {
+		return stats.anonymousRss + stats.fileRss + stats.sharedRss;
+	}
+
+	// Linux reports times in clock ticks of sysconf(_SC_CLK_TCK) = 100 Hz.
+	uint64_t nanosToTicks(uint64_t nanos) {
+		return nanos / 10'000'000;
+	}
+}
+
+async::result<std::string> StatNode::show() {
+	auto stats = queryThreadStats(_process);
+	auto parent = _process->getParent();
+
+	std::string comm = _process->path();
+	if(auto slash = comm.rfind('/'); slash != std::string::npos)
+		comm = comm.substr(slash + 1);
+
+	// Fields that we do not track are reported as zero.
+	std::stringstream stream;
+	stream << _process->pid() // (1) pid
+		<< " (" << comm << ")" // (2) comm
+		<< " R" // (3) state
+		<< " " << (parent ? parent->pid() : 0); // (4) ppid
+	for(int i = 5; i <= 9; i++) // pgrp to flags
+		stream << " 0";
+	stream << " " << stats.minorFaults // (10) minflt
+		<< " 0" // (11) cminflt
+		<< " " << stats.majorFaults // (12) majflt
+		<< " 0" // (13) cmajflt
+		<< " " << nanosToTicks(stats.userTime) // (14) utime
+		<< " " << nanosToTicks(stats.kernelTime); // (15) stime
+	auto children = _process->accumulatedUsage();
+	stream << " " << nanosToTicks(children.userTime) // (16) cutime
+		<< " " << nanosToTicks(children.systemTime); // (17) cstime
+	for(int i = 18; i <= 22; i++) // priority to starttime
+		stream << " 0";
+	auto spaceStats = querySpaceStats(_process);
+	stream << " " << spaceStats.mappedSize // (23) vsize
+		<< " " << rssOf(spaceStats) / 0x1000; // (24) rss
+	for(int i = 25; i <= 38; i++) // rsslim to exit_signal
+		stream << " 0";
+	stream << " " << stats.lastCpu; // (39) processor
+	for(int i = 40; i <= 52; i++) // rt_priority to exit_code
+		stream << " 0";
+	stream << "\n";
+	co_return stream.str();
+}
+
+async::result<void> StatNode::store(std::string) {
+	// TODO: proper error reporting.
+	throw std::runtime_error("Can't store to a /proc/stat file!");
+}
+
+async::result<std::string> SchedstatNode::show() {
+	auto stats = queryThreadStats(_process);
+
+	std::stringstream stream;
+	stream << (stats.userTime + stats.kernelTime)
+		<< " " << stats.waitTime
+		<< " " << (stats.voluntarySwitches + stats.involuntarySwitches) << "\n";
+	co_return stream.str();
+}
+
+async::result<void> SchedstatNode::store(std::string) {
+	// TODO: proper error reporting.
+	throw std::runtime_error("Can't store to a /proc/schedstat file!");
+}
+
+async::result<std::string> StatmNode::show() {
+	auto stats = querySpaceStats(_process);
+
+	std::stringstream stream;
+	stream << stats.mappedSize / 0x1000 // size
+		<< " " << rssOf(stats) / 0x1000 // resident
+		<< " " << (stats.fileRss + stats.sharedRss) / 0x1000 // shared
+		<< " 0 0 0 0\n"; // text, lib, data, dt
+	co_return stream.str();
+}
+
+async::result<void> StatmNode::store(std::string) {
+	// TODO: proper error reporting.
+	throw std::runtime_error("Can't store to a /proc/statm file!");
+}
+
+async::result<std::string> StatusNode::show() {
+	auto stats = querySpaceStats(_process);
+	auto parent = _process->getParent();
+
+	std::string comm = _process->path();
+	if(auto slash = comm.rfind('/'); slash != std::string::npos)
+		comm = comm.substr(slash + 1);
+
+	std::stringstream stream;
+	auto kib = [&] (const char *name, uint64_t bytes) {
+		stream << name << ":\t" << std::setw(8) << (bytes / 1024) << " kB\n";
+	};
+	stream << "Name:\t" << comm << "\n";
+	stream << "State:\tR (running)\n";
+	stream << "Pid:\t" << _process->pid() << "\n";
+	stream << "PPid:\t" << (parent ? parent->pid() : 0) << "\n";
+	kib("VmSize", stats.mappedSize);
+	kib("VmRSS", rssOf(stats));
+	kib("RssAnon", stats.anonymousRss);
+	kib("RssFile", stats.fileRss);
+	kib("RssShmem", stats.sharedRss);
+	kib("VmPTE", stats.pageTableSize);
+	kib("VmSwap", 0);
+	co_return stream.str();
+}
+
+async::result<void> StatusNode::store(std::string) {
+	// TODO: proper error reporting.
+	throw std::runtime_error("Can't store to a /proc/status file!");
+}
+
+async::result<std::string> PosixStatsNode::show() {
+	co_return formatRequestStats();
+}
+
+async::result<void> PosixStatsNode::store(std::string buffer) {
+	// TODO: proper error reporting.
+	if(buffer != "reset" && buffer != "reset\n")
+		throw std::runtime_error("posix: Only \"reset\" can be written to posix-stats");
+	resetRequestStats();
+	co_return;
+}
+
 } // namespace procfs
 
 std::shared_ptr<FsLink> getProcfs() {
@@ -180,6 +180,61 @@ private:
 	Process *_process;
 };
 
+// /proc/<pid>/stat. Scheduling fields (e.g., priority, nice) are not reported yet.
+struct StatNode final : RegularNode {
+	StatNode(Process *process)
+	: _process(process)
+	{ }
+
+	async::result<std::string> show() override;
+	async::result<void> store(std::string) override;
+private:
+	Process *_process;
+};
+
+// /proc/<pid>/schedstat: run time, wait time (both in nanoseconds) and number of time slices.
+struct SchedstatNode final : RegularNode {
+	SchedstatNode(Process *process)
+	: _process(process)
+	{ }
+
+	async::result<std::string> show() override;
+	async::result<void> store(std::string) override;
+private:
+	Process *_process;
+};
+
+// /proc/<pid>/statm: memory usage in pages. The text, lib and data fields are not reported.
+struct StatmNode final : RegularNode {
+	StatmNode(Process *process)
+	: _process(process)
+	{ }
+
+	async::result<std::string> show() override;
+	async::result<void> store(std::string) override;
+private:
+	Process *_process;
+};
+
+// /proc/<pid>/status. Only the identity and Vm* fields are reported.
+struct StatusNode final : RegularNode {
+	StatusNode(Process *process)
+	: _process(process)
+	{ }
+
+	async::result<std::string> show() override;
+	async::result<void> store(std::string) override;
+private:
+	Process *_process;
+};
+
+// /proc/managarm/posix-stats: latency histograms of the requests that posix handles.
+// Writing "reset" clears the histograms.
+struct PosixStatsNode final : RegularNode {
+	async::result<std::string> show() override;
+	async::result<void> store(std::string) override;
+};
+
 } // namespace procfs
 
 std::shared_ptr<FsLink> getProcfs();
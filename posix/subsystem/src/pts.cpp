@@ -1,7 +1,9 @@
 #include <asm/ioctls.h>
 #include <termios.h>
+#include <string.h>
 #include <sys/epoll.h>
-#include <sstream>
+#include <algorithm>
+#include <vector>
 
 #include <async/recurring-event.hpp>
 
@@ -28,11 +30,65 @@ extern std::shared_ptr<RootLink> globalRootLink;
 
 //-----------------------------------------------------------------------------
 
-struct Packet {
-	// The actual octet data that the packet consists of.
-	std::vector<char> buffer;
+// Queue of octets; the backing ring doubles in size whenever it runs full.
+// Unlike a queue of per-write buffers, this does not allocate on every write
+// and lets reads consume data of multiple writes at once.
+struct ByteRing {
+	bool empty() const {
+		return !_size;
+	}
+
+	void push(const char *data, size_t length) {
+		if(!length)
+			return;
+		if(_size + length > _buffer.size())
+			_grow(_size + length);
+		size_t tail = (_head + _size) % _buffer.size();
+		size_t chunk = std::min(length, _buffer.size() - tail);
+		memcpy(_buffer.data() + tail, data, chunk);
+		memcpy(_buffer.data(), data + chunk, length - chunk);
+		_size += length;
+	}
 
-	size_t offset = 0;
+	// Removes up to maxLength octets. If stopAtNewline is set, stops after the first '\n'.
+	size_t pop(char *data, size_t maxLength, bool stopAtNewline) {
+		size_t progress = 0;
+		while(progress < maxLength && _size) {
+			size_t chunk = std::min({maxLength - progress, _size, _buffer.size() - _head});
+			auto p = _buffer.data() + _head;
+			bool foundNewline = false;
+			if(stopAtNewline) {
+				if(auto nl = static_cast<const char *>(memchr(p, '\n', chunk)); nl) {
+					chunk = nl - p + 1;
+					foundNewline = true;
+				}
+			}
+			memcpy(data + progress, p, chunk);
+			_head = (_head + chunk) % _buffer.size();
+			_size -= chunk;
+			progress += chunk;
+			if(foundNewline)
+				break;
+		}
+		return progress;
+	}
+
+private:
+	void _grow(size_t required) {
+		size_t capacity = std::max(_buffer.size(), size_t{4096});
+		while(capacity < required)
+			capacity *= 2;
+
+		std::vector<char> buffer(capacity);
+		auto size = pop(buffer.data(), _size, false);
+		_buffer = std::move(buffer);
+		_head = 0;
+		_size = size;
+	}
+
+	std::vector<char> _buffer;
+	size_t _head = 0;
+	size_t _size = 0;
 };
 
 struct Channel {
@@ -78,9 +134,9 @@ struct Channel {
 	uint64_t masterInSeq;
 	uint64_t slaveInSeq;
 
-	// The actual queue of this pipe.
-	std::deque<Packet> masterQueue;
-	std::deque<Packet> slaveQueue;
+	// Data written by the slave (masterQueue) and by the master (slaveQueue).
+	ByteRing masterQueue;
+	ByteRing slaveQueue;
 };
 
 //-----------------------------------------------------------------------------
@@ -464,13 +520,8 @@ MasterFile::readSome(Process *, void *data, size_t maxLength) {
 	while(_channel->masterQueue.empty())
 		co_await _channel->statusBell.async_wait();
 
-	auto packet = &_channel->masterQueue.front();
-	size_t chunk = std::min(packet->buffer.size() - packet->offset, maxLength);
+	auto chunk = _channel->masterQueue.pop(reinterpret_cast<char *>(data), maxLength, false);
 	assert(chunk); // Otherwise, we return above due to !maxLength.
-	memcpy(data, packet->buffer.data() + packet->offset, chunk);
-	packet->offset += chunk;
-	if(packet->offset == packet->buffer.size())
-		_channel->masterQueue.pop_front();
 	co_return chunk;
 }
 
@@ -479,27 +530,27 @@ MasterFile::writeAll(Process *, const void *data, size_t length) {
 	if(logReadWrite)
 		std::cout << "posix: Write to tty " << structName() << std::endl;
 
-	Packet packet;
-	packet.buffer.reserve(length);
-	packet.offset = 0;
-
+	// Runs of characters that are not special are emitted to the slave as a whole.
 	auto s = reinterpret_cast<const char *>(data);
+	bool emitted = false;
+	size_t run = 0;
 	for(size_t i = 0; i < length; i++) {
 		if(_channel->activeSettings.c_lflag & ISIG) {
 			if(s[i] == static_cast<char>(_channel->activeSettings.c_cc[VINTR])) {
+				_channel->slaveQueue.push(s + run, i - run);
+				emitted |= i > run;
+				run = i + 1;
+
 				UserSignal info;
 				_channel->cts.issueSignalToForegroundGroup(SIGINT, info);
-				continue;
 			}
 		}
-
-		// Not a special character. Emit to the slave.
-		packet.buffer.push_back(s[i]);
 	}
+	_channel->slaveQueue.push(s + run, length - run);
+	emitted |= length > run;
 
 	// Check whether all data was discarded above.
-	if(packet.buffer.size()) {
-		_channel->slaveQueue.push_back(std::move(packet));
+	if(emitted) {
 		_channel->slaveInSeq = ++_channel->currentSeq;
 		_channel->statusBell.raise();
 	}
@@ -615,13 +666,11 @@ SlaveFile::readSome(Process *, void *data, size_t maxLength) {
 	while(_channel->slaveQueue.empty())
 		co_await _channel->statusBell.async_wait();
 
-	auto packet = &_channel->slaveQueue.front();
-	auto chunk = std::min(packet->buffer.size() - packet->offset, maxLength);
+	// There is no full line discipline yet but in canonical mode,
+	// at least do not return more than a single line.
+	auto chunk = _channel->slaveQueue.pop(reinterpret_cast<char *>(data), maxLength,
+			_channel->activeSettings.c_lflag & ICANON);
 	assert(chunk); // Otherwise, we return above due to !maxLength.
-	memcpy(data, packet->buffer.data() + packet->offset, chunk);
-	packet->offset += chunk;
-	if(packet->offset == packet->buffer.size())
-		_channel->slaveQueue.pop_front();
 	co_return chunk;
 }
 
@@ -635,28 +684,21 @@ SlaveFile::writeAll(Process *, const void *data, size_t length) {
 		co_return {};
 
 	// Perform output processing.
-	std::stringstream ss;
-	for(size_t i = 0; i < length; i++) {
-		char c;
-		memcpy(&c, reinterpret_cast<const char *>(data) + i, 1);
-		if((_channel->activeSettings.c_oflag & ONLCR) && c == '\n') {
-//			std::cout << "Mapping NL -> CR,NL" << std::endl;
-			ss << "\r\n";
-		}else{
-//			std::cout << "c: " << (int)c << std::endl;
-			ss << c;
+	auto s = reinterpret_cast<const char *>(data);
+	if(_channel->activeSettings.c_oflag & ONLCR) {
+		size_t run = 0;
+		for(size_t i = 0; i < length; i++) {
+			if(s[i] != '\n')
+				continue;
+			_channel->masterQueue.push(s + run, i - run);
+			_channel->masterQueue.push("\r\n", 2);
+			run = i + 1;
 		}
+		_channel->masterQueue.push(s + run, length - run);
+	}else{
+		_channel->masterQueue.push(s, length);
 	}
 
-	// TODO: This is very inefficient.
-	auto str = ss.str();
-
-	Packet packet;
-	packet.buffer.resize(str.size());
-	memcpy(packet.buffer.data(), str.data(), str.size());
-	packet.offset = 0;
-
-	_channel->masterQueue.push_back(std::move(packet));
 	_channel->masterInSeq = ++_channel->currentSeq;
 	_channel->statusBell.raise();
 	co_return length;
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include "request-stats.hpp"
+
+namespace {
+
+// Keyed by the (static) kind and name strings themselves, which avoids
+// building a string for every request.
+std::map<std::pair<const char *, const char *>, LatencyHistogram> histograms;
+
+} // anonymous namespace
+
+int LatencyHistogram::bucketOf(uint64_t nanos) {
+	if(nanos < numSubBuckets)
+		return nanos;
+	int msb = 63 - __builtin_clzll(nanos);
+	int group = msb - subBucketBits + 1;
+	if(group >= numGroups)
+		return numBuckets - 1;
+	int sub = (nanos >> (msb - subBucketBits)) & (numSubBuckets - 1);
+	return group * numSubBuckets + sub;
+}
+
+uint64_t LatencyHistogram::upperBoundOf(int bucket) {
+	int group = bucket / numSubBuckets;
+	int sub = bucket % numSubBuckets;
+	if(!group)
+		return sub;
+	int msb = group + subBucketBits - 1;
+	uint64_t width = uint64_t{1} << (msb - subBucketBits);
+	return (uint64_t{1} << msb) + (sub + 1) * width - 1;
+}
+
+void LatencyHistogram::record(uint64_t nanos) {
+	buckets_[bucketOf(nanos)]++;
+	count_++;
+	sum_ += nanos;
+	max_ = std::max(max_, nanos);
+}
+
+void LatencyHistogram::reset() {
+	buckets_.fill(0);
+	count_ = 0;
+	sum_ = 0;
+	max_ = 0;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+	if(!count_)
+		return 0;
+	auto target = std::max(uint64_t{1}, static_cast<uint64_t>(std::ceil(p * count_)));
+	uint64_t seen = 0;
+	for(int i = 0; i < numBuckets; i++) {
+		seen += buckets_[i];
+		if(seen >= target)
+			return std::min(upperBoundOf(i), max_);
+	}
+	return max_;
+}
+
+LatencyHistogram &requestHistogram(const char *kind, const char *name) {
+	return histograms[{kind, name}];
+}
+
+std::string formatRequestStats() {
+	std::vector<std::pair<std::string, const LatencyHistogram *>> entries;
+	for(auto &[key, histogram] : histograms) {
+		if(!histogram.count())
+			continue;
+		entries.push_back({std::string{key.first} + ":" + key.second, &histogram});
+	}
+	std::sort(entries.begin(), entries.end());
+
+	std::stringstream ss;
+	ss << "# All latencies are in nanoseconds. Write \"reset\" to this file to clear it.\n";
+	ss << "# name count mean p50 p90 p99 p99.9 max\n";
+	for(auto &[name, histogram] : entries) {
+		ss << name << " " << histogram->count() << " " << histogram->mean()
+			<< " " << histogram->percentile(0.5)
+			<< " " << histogram->percentile(0.9)
+			<< " " << histogram->percentile(0.99)
+			<< " " << histogram->percentile(0.999)
+			<< " " << histogram->max() << "\n";
+	}
+	return ss.str();
+}
+
+void resetRequestStats() {
+	for(auto &[key, histogram] : histograms)
+		histogram.reset();
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <string>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+// Log-linear latency histogram (in the style of HdrHistogram): values are grouped by
+// their highest set bit and each group is split into numSubBuckets linear sub-buckets.
+// Hence, reported percentiles overestimate the true value by at most 1 / numSubBuckets.
+struct LatencyHistogram {
+	static constexpr int subBucketBits = 3;
+	static constexpr int numSubBuckets = 1 << subBucketBits;
+	// Covers latencies of up to 2^40 ns (roughly 18 minutes); longer ones end up in the last bucket.
+	static constexpr int numGroups = 40 - subBucketBits + 1;
+	static constexpr int numBuckets = numGroups * numSubBuckets;
+
+	void record(uint64_t nanos);
+	void reset();
+
+	uint64_t count() const {
+		return count_;
+	}
+
+	uint64_t mean() const {
+		return count_ ? sum_ / count_ : 0;
+	}
+
+	uint64_t max() const {
+		return max_;
+	}
+
+	// Upper bound of the bucket that contains the given percentile (0 < p <= 1).
+	uint64_t percentile(double p) const;
+
+private:
+	static int bucketOf(uint64_t nanos);
+	static uint64_t upperBoundOf(int bucket);
+
+	std::array<uint64_t, numBuckets> buckets_{};
+	uint64_t count_ = 0;
+	uint64_t sum_ = 0;
+	uint64_t max_ = 0;
+};
+
+// Returns the histogram of the given request type. Names are prefixed by the kind of
+// request, e.g., "request:OpenAt" or "supercall:FORK".
+LatencyHistogram &requestHistogram(const char *kind, const char *name);
+
+// Contents of /proc/managarm/posix-stats.
+std::string formatRequestStats();
+
+void resetRequestStats();
+
+// Records the time from construction to destruction into a histogram.
+struct RequestTimer {
+	RequestTimer(LatencyHistogram &histogram)
+	: histogram_{histogram} {
+		HEL_CHECK(helGetClock(&start_));
+	}
+
+	RequestTimer(const RequestTimer &) = delete;
+
+	RequestTimer &operator= (const RequestTimer &) = delete;
+
+	~RequestTimer() {
+		uint64_t end;
+		HEL_CHECK(helGetClock(&end));
+		histogram_.record(end - start_);
+	}
+
+private:
+	LatencyHistogram &histogram_;
+	uint64_t start_;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <helix/ipc.hpp>
+#include <helix/memory.hpp>
+#include <protocols/posix/data.hpp>
+
+// Counter in shared memory (see posix::CounterPage), such that clients can map it
+// and access it without a round trip to the server.
+struct SharedCounter {
+	// Keeps serverWaiters raised while the server waits for changes of the counter.
+	struct WaitGuard {
+		WaitGuard(SharedCounter *counter)
+		: _counter{counter} {
+			__atomic_fetch_add(&_counter->_page()->serverWaiters, 1, __ATOMIC_SEQ_CST);
+		}
+
+		WaitGuard(const WaitGuard &) = delete;
+
+		~WaitGuard() {
+			__atomic_fetch_sub(&_counter->_page()->serverWaiters, 1, __ATOMIC_RELEASE);
+		}
+
+		WaitGuard &operator= (const WaitGuard &) = delete;
+
+	private:
+		SharedCounter *_counter;
+	};
+
+	SharedCounter(uint64_t initial)
+	: _observed{initial} {
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &handle));
+		_memory = helix::UniqueDescriptor{handle};
+		_mapping = helix::Mapping{_memory, 0, 0x1000};
+		_page()->counter = initial;
+	}
+
+	helix::UniqueDescriptor dupMemory() {
+		return _memory.dup();
+	}
+
+	uint64_t load() {
+		// Pairs with the serverWaiters increment in WaitGuard: either we see the
+		// client's change or the client sees the waiter and notifies us.
+		return __atomic_load_n(&_page()->counter, __ATOMIC_SEQ_CST);
+	}
+
+	// Replaces the counter by desired if it is equal to expected.
+	// Otherwise, expected is updated to the current value.
+	bool compareExchange(uint64_t &expected, uint64_t desired) {
+		auto page = _page();
+		if(!__atomic_compare_exchange_n(&page->counter, &expected, desired,
+				false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			return false;
+		_observed = desired;
+
+		__atomic_fetch_add(&page->counterFutex, 1, __ATOMIC_RELEASE);
+		if(__atomic_load_n(&page->waiters, __ATOMIC_ACQUIRE))
+			HEL_CHECK(helFutexWake(&page->counterFutex));
+		return true;
+	}
+
+	// Determines whether clients changed the counter since the server last saw it.
+	// Returns a positive (negative) value if the counter increased (decreased)
+	// and zero if it did not change.
+	int synchronize() {
+		auto value = load();
+		if(value == _observed)
+			return 0;
+		int change = value > _observed ? 1 : -1;
+		_observed = value;
+		return change;
+	}
+
+private:
+	posix::CounterPage *_page() {
+		return reinterpret_cast<posix::CounterPage *>(_mapping.get());
+	}
+
+	// Value of the counter when the server last accessed it.
+	uint64_t _observed;
+	helix::UniqueDescriptor _memory;
+	helix::Mapping _mapping;
+};
@@ -6,6 +6,7 @@
 #include <async/result.hpp>
 #include <async/recurring-event.hpp>
 #include <helix/ipc.hpp>
+#include "shared-counter.hpp"
 #include "timerfd.hpp"
 
 namespace {
@@ -38,9 +39,7 @@ private:
 			tick += timer->initial;
 
 			if(_activeTimer == timer) {
-				_expirations++;
-				_theSeq++;
-				_seqBell.raise();
+				_expire();
 			}else{
 				delete timer;
 				co_return;
@@ -65,9 +64,7 @@ private:
 			tick += timer->interval;
 
 			if(_activeTimer == timer) {
-				_expirations++;
-				_theSeq++;
-				_seqBell.raise();
+				_expire();
 			}else{
 				delete timer;
 				co_return;
@@ -75,6 +72,14 @@ private:
 		}
 	}
 
+	void _expire() {
+		auto expirations = _expirations.load();
+		while(!_expirations.compareExchange(expirations, expirations + 1))
+			;
+		_theSeq++;
+		_seqBell.raise();
+	}
+
 public:
 	static void serve(smarter::shared_ptr<OpenFile> file) {
 //TODO:		assert(!file->_passthrough);
@@ -87,9 +92,7 @@ public:
 
 	OpenFile(bool non_block)
 	: File{StructName::get("timerfd")}, _nonBlock{non_block},
-			_activeTimer{nullptr}, _expirations{0}, _theSeq{0} {
-		(void)_nonBlock;
-	}
+			_activeTimer{nullptr}, _expirations{0}, _theSeq{0} { }
 
 	~OpenFile() {
 		// Nothing to do here.
@@ -102,12 +105,22 @@ public:
 
 	async::result<frg::expected<Error, size_t>>
 	readSome(Process *, void *data, size_t max_length) override {
-		assert(max_length == sizeof(uint64_t));
-		assert(_expirations);
+		if(max_length < sizeof(uint64_t))
+			co_return Error::illegalArguments;
+
+		while(true) {
+			auto expirations = _expirations.load();
+			if(expirations) {
+				if(!_expirations.compareExchange(expirations, 0))
+					continue;
+				memcpy(data, &expirations, sizeof(uint64_t));
+				co_return sizeof(uint64_t);
+			}
 
-		memcpy(data, &_expirations, sizeof(uint64_t));
-		_expirations = 0;
-		co_return sizeof(uint64_t);
+			if(_nonBlock)
+				co_return Error::wouldBlock;
+			co_await _seqBell.async_wait();
+		}
 	}
 	
 	async::result<frg::expected<Error, PollWaitResult>>
@@ -129,7 +142,11 @@ public:
 
 	async::result<frg::expected<Error, PollStatusResult>>
 	pollStatus(Process *) override {
-		co_return PollStatusResult(_theSeq, _expirations ? EPOLLIN : 0);
+		co_return PollStatusResult(_theSeq, _expirations.load() ? EPOLLIN : 0);
+	}
+
+	FutureMaybe<helix::UniqueDescriptor> accessMemory() override {
+		co_return _expirations.dupMemory();
 	}
 
 	helix::BorrowedDescriptor getPassthroughLane() override {
@@ -160,8 +177,9 @@ private:
 	// Currently active timer.
 	Timer *_activeTimer;
 
-	// Number of expirations since last read().
-	uint64_t _expirations;
+	// Number of expirations since last read(). Clients can read (and reset) it directly
+	// (see posix::CounterPage); as they can only reset it, they do not notify us.
+	SharedCounter _expirations;
 
 	uint64_t _theSeq;
 	async::recurring_event _seqBell;
@@ -1,6 +1,9 @@
 #include <fcntl.h>
 #include <unistd.h>
-#include <set>
+#include <algorithm>
+#include <list>
+#include <string_view>
+#include <unordered_map>
 
 #include <helix/memory.hpp>
 #include <protocols/fs/client.hpp>
@@ -211,25 +214,52 @@ public:
 		return _target;
 	}
 
+	// Like getName() but avoids the copy.
+	const std::string &name() const {
+		return _name;
+	}
+
 private:
 	std::shared_ptr<FsNode> _owner;
 	std::string _name;
 	std::shared_ptr<FsNode> _target;
 };
 
-struct LinkCompare {
-	struct is_transparent { };
+// Entries of a DirectoryNode. Entries are kept in a list such that the iterators of
+// DirectoryFile remain valid while entries are added; lookups go through a hash map.
+struct EntryTable {
+	using iterator = std::list<std::shared_ptr<Link>>::iterator;
 
-	bool operator() (const std::shared_ptr<Link> &link, const std::string &name) const {
-		return link->getName() < name;
+	iterator begin() {
+		return _links.begin();
 	}
-bool operator() (const std::string &name, const std::shared_ptr<Link> &link) const {
-	return name < link->getName();
-}
 
-bool operator() (const std::shared_ptr<Link> &a, const std::shared_ptr<Link> &b) const {
-	return a->getName() < b->getName();
-}
+	iterator end() {
+		return _links.end();
+	}
+
+	iterator find(std::string_view name) {
+		auto it = _index.find(name);
+		if(it == _index.end())
+			return _links.end();
+		return it->second;
+	}
+
+	void insert(std::shared_ptr<Link> link) {
+		assert(find(link->name()) == end());
+		auto it = _links.insert(_links.end(), std::move(link));
+		_index.emplace((*it)->name(), it);
+	}
+
+	void erase(iterator it) {
+		_index.erase((*it)->name());
+		_links.erase(it);
+	}
+
+private:
+	std::list<std::shared_ptr<Link>> _links;
+	// Keys point into the name of the respective Link.
+	std::unordered_map<std::string_view, iterator> _index;
 };
 
 struct DirectoryNode;
@@ -252,7 +282,7 @@ private:
 	helix::UniqueLane _passthrough;
 	async::cancellation_event _cancelServe;
 
-	std::set<std::shared_ptr<Link>, LinkCompare>::iterator _iter;
+	EntryTable::iterator _iter;
 };
 
 struct DirectoryNode final : Node, std::enable_shared_from_this<DirectoryNode> {
@@ -336,7 +366,7 @@ public:
 private:
 	// TODO: This creates a circular reference -- fix this.
 	std::shared_ptr<Link> _treeLink;
-	std::set<std::shared_ptr<Link>, LinkCompare> _entries;
+	EntryTable _entries;
 };
 
 // TODO: Remove this class in favor of MemoryNode.
@@ -449,6 +479,9 @@ private:
 		size_t aligned_size = (new_size + 0xFFF) & ~size_t(0xFFF);
 		if(aligned_size <= _areaSize)
 			return;
+		// Grow geometrically, otherwise appending to a file resizes and remaps the memory
+		// object for every page. Pages are only allocated once they are touched.
+		aligned_size = std::max(aligned_size, 2 * _areaSize);
 
 		if(_memory) {
 			HEL_CHECK(helResizeMemory(_memory.getHandle(), aligned_size));
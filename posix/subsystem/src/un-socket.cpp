@@ -12,6 +12,7 @@
 #include "sockutil.hpp"
 #include "un-socket.hpp"
 #include "process.hpp"
+#include "util.hpp"
 #include "vfs.hpp"
 
 namespace un_socket {
@@ -26,16 +27,19 @@ std::map<std::weak_ptr<FsNode>, OpenFile *,
 		std::owner_less<std::weak_ptr<FsNode>>> globalBindMap;
 std::unordered_map<std::string, OpenFile *> abstractSocketsBindMap;
 
+// Same as the default socket buffer size on Linux (net.core.wmem_default).
+constexpr size_t socketCapacity = 212992;
+
+// The data of packets is stored in the ring buffer of the receiving socket;
+// this only keeps track of packet boundaries and ancillary data.
 struct Packet {
 	// Sender process information.
 	int senderPid;
 
-	// The actual octet data that the packet consists of.
-	std::vector<char> buffer;
+	// Number of bytes of this packet that are still in the ring buffer.
+	size_t size;
 
 	std::vector<smarter::shared_ptr<File, FileHandle>> files;
-
-	size_t offset = 0;
 };
 
 struct OpenFile : File {
@@ -76,7 +80,7 @@ public:
 
 	OpenFile(Process *process = nullptr, bool nonBlock = false)
 	: File{StructName::get("un-socket"), File::defaultPipeLikeSeek}, _currentState{State::null},
-			_currentSeq{1}, _inSeq{0}, _ownerPid{0},
+			_currentSeq{1}, _inSeq{0}, _recvBuffer{socketCapacity}, _ownerPid{0},
 			_remote{nullptr}, _passCreds{false}, nonBlock_{nonBlock},
 			_sockpath{}, _nameType{NameType::unnamed}, _isInherited{false} {
 		if(process)
@@ -120,12 +124,10 @@ public:
 
 		// TODO: Truncate packets (for SOCK_DGRAM) here.
 		auto packet = &_recvQueue.front();
-		assert(!packet->offset);
 		assert(packet->files.empty());
-		auto size = packet->buffer.size();
+		auto size = packet->size;
 		assert(max_length >= size);
-		memcpy(data, packet->buffer.data(), size);
-		_recvQueue.pop_front();
+		_consume(data, size);
 		co_return size;
 	}
 
@@ -137,16 +139,18 @@ public:
 		if(logSockets)
 			std::cout << "posix: Write to socket \e[1;34m" << structName() << "\e[0m" << std::endl;
 
-		Packet packet;
-		packet.senderPid = process->pid();
-		packet.buffer.resize(length);
-		memcpy(packet.buffer.data(), data, length);
-		packet.offset = 0;
-
-		_remote->_recvQueue.push_back(std::move(packet));
-		_remote->_inSeq = ++_remote->_currentSeq;
-		_remote->_statusBell.raise();
-		co_return length;
+		auto result = co_await _transmit(process, data, length, {}, nonBlock_);
+		if(!result) {
+			switch(result.error()) {
+			case protocols::fs::Error::wouldBlock:
+				co_return Error::wouldBlock;
+			case protocols::fs::Error::brokenPipe:
+				co_return Error::brokenPipe;
+			default:
+				co_return Error::notConnected;
+			}
+		}
+		co_return result.value();
 	}
 
 	async::result<protocols::fs::RecvResult>
@@ -186,24 +190,31 @@ public:
 		}
 
 		if(!packet->files.empty()) {
-			if(ctrl.message(SOL_SOCKET, SCM_RIGHTS, sizeof(int) * packet->files.size())) {
-				for(auto &file : packet->files)
-					ctrl.write<int>(process->fileContext()->attachFile(std::move(file),
-							flags & MSG_CMSG_CLOEXEC));
-			}else{
-				throw std::runtime_error("posix: CMSG truncation is not implemented");
+			// As on Linux, files that do not fit into the file table are dropped
+			// (Linux also sets MSG_CTRUNC in this case).
+			std::vector<int> fds;
+			for(auto &file : packet->files) {
+				auto fd = process->fileContext()->attachFile(std::move(file),
+						flags & MSG_CMSG_CLOEXEC);
+				if(fd < 0)
+					break;
+				fds.push_back(fd);
 			}
-
 			packet->files.clear();
+
+			if(!fds.empty()) {
+				if(ctrl.message(SOL_SOCKET, SCM_RIGHTS, sizeof(int) * fds.size())) {
+					for(auto fd : fds)
+						ctrl.write<int>(fd);
+				}else{
+					throw std::runtime_error("posix: CMSG truncation is not implemented");
+				}
+			}
 		}
 
 		// TODO: Truncate packets (for SOCK_DGRAM) here.
-		auto chunk = std::min(packet->buffer.size() - packet->offset, max_length);
-		memcpy(data, packet->buffer.data() + packet->offset, chunk);
-		packet->offset += chunk;
-
-		if(packet->offset == packet->buffer.size())
-			_recvQueue.pop_front();
+		auto chunk = std::min(packet->size, max_length);
+		_consume(data, chunk);
 		co_return protocols::fs::RecvResult { protocols::fs::RecvData { chunk, 0, ctrl.buffer() } };
 	}
 
@@ -221,20 +232,8 @@ public:
 		if(logSockets)
 			std::cout << "posix: Send to socket \e[1;34m" << structName() << "\e[0m" << std::endl;
 
-		// We ignore MSG_DONTWAIT here as we never block anyway.
-
-		Packet packet;
-		packet.senderPid = process->pid();
-		packet.buffer.resize(max_length);
-		memcpy(packet.buffer.data(), data, max_length);
-		packet.files = std::move(files);
-		packet.offset = 0;
-
-		_remote->_recvQueue.push_back(std::move(packet));
-		_remote->_inSeq = ++_remote->_currentSeq;
-		_remote->_statusBell.raise();
-
-		co_return max_length;
+		co_return co_await _transmit(process, data, max_length, std::move(files),
+				(flags & MSG_DONTWAIT) || nonBlock_);
 	}
 
 	async::result<int> getOption(int option) override {
@@ -288,8 +287,9 @@ public:
 		if(_currentState == State::closed)
 			co_return Error::fileClosed;
 
-		// For now making sockets always writable is sufficient.
-		int edges = EPOLLOUT;
+		int edges = 0;
+		if(_outSeq > past_seq)
+			edges |= EPOLLOUT;
 		if(_hupSeq > past_seq)
 			edges |= EPOLLHUP;
 		if(_inSeq > past_seq)
@@ -304,7 +304,9 @@ public:
 
 	async::result<frg::expected<Error, PollStatusResult>>
 	pollStatus(Process *) override {
-		int events = EPOLLOUT;
+		int events = 0;
+		if(_currentState != State::connected || _remote->_recvBuffer.space())
+			events |= EPOLLOUT;
 		if(_currentState == State::remoteShutDown)
 			events |= EPOLLHUP;
 		if(!_acceptQueue.empty() || !_recvQueue.empty())
@@ -462,8 +464,7 @@ public:
 				} else if(_recvQueue.empty()) {
 					resp.set_fionread_count(0);
 				} else {
-					auto packet = &_recvQueue.front();
-					resp.set_fionread_count(packet->buffer.size() - packet->offset);
+					resp.set_fionread_count(_recvQueue.front().size);
 				}
 				break;
 			}
@@ -484,6 +485,65 @@ public:
 	}
 
 private:
+	// Sends data to the remote socket. If the remote's buffer is full, this blocks (unless
+	// nonBlock is set). Data that does not fit into the buffer is split into multiple packets;
+	// files are attached to the first one.
+	async::result<frg::expected<protocols::fs::Error, size_t>>
+	_transmit(Process *process, const void *data, size_t length,
+			std::vector<smarter::shared_ptr<File, FileHandle>> files, bool nonBlock) {
+		size_t written = 0;
+		do {
+			if(_currentState == State::remoteShutDown) {
+				if(written)
+					break;
+				co_return protocols::fs::Error::brokenPipe;
+			}
+			if(_currentState != State::connected)
+				co_return protocols::fs::Error::notConnected;
+
+			auto &buffer = _remote->_recvBuffer;
+			if(length && !buffer.space()) {
+				if(nonBlock) {
+					if(written)
+						break;
+					if(logSockets)
+						std::cout << "posix: UNIX socket would block" << std::endl;
+					co_return protocols::fs::Error::wouldBlock;
+				}
+				co_await _statusBell.async_wait();
+				continue;
+			}
+
+			auto chunk = buffer.write(static_cast<const char *>(data) + written, length - written);
+			written += chunk;
+
+			_remote->_recvQueue.push_back(Packet{process->pid(), chunk, std::move(files)});
+			files.clear();
+			_remote->_inSeq = ++_remote->_currentSeq;
+			_remote->_statusBell.raise();
+		} while(written < length);
+
+		co_return written;
+	}
+
+	// Removes data from the front packet, i.e., the packet's data must
+	// be at the front of the ring buffer.
+	void _consume(void *data, size_t length) {
+		auto packet = &_recvQueue.front();
+		assert(length <= packet->size);
+		auto n = _recvBuffer.read(data, length);
+		assert(n == length);
+		packet->size -= n;
+		if(!packet->size)
+			_recvQueue.pop_front();
+
+		// Wake up the remote if it waits for space.
+		if(n && _remote) {
+			_remote->_outSeq = ++_remote->_currentSeq;
+			_remote->_statusBell.raise();
+		}
+	}
+
 	static size_t getNameFor(OpenFile *sock, void *addrPtr, size_t maxAddrLength) {
 		sockaddr_un sa;
 		size_t outSize = offsetof(sockaddr_un, sun_path) + sock->_sockpath.size() + 1;
@@ -536,12 +596,15 @@ private:
 	uint64_t _currentSeq;
 	uint64_t _hupSeq = 0;
 	uint64_t _inSeq;
+	// Sockets are initially writable.
+	uint64_t _outSeq = 1;
 
 	// TODO: Use weak_ptrs here!
 	std::deque<OpenFile *> _acceptQueue;
 
 	// The actual receive queue of the socket.
 	std::deque<Packet> _recvQueue;
+	ring_buffer _recvBuffer;
 
 	int _ownerPid;
 
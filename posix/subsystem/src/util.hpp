@@ -1,11 +1,18 @@
+#pragma once
+
 
 // ----------------------------------------------------------------
 // Sequential ID allocator
 // ----------------------------------------------------------------
 
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
 #include <limits>
+#include <memory>
 #include <set>
+#include <vector>
 
 // Allocator for integral IDs. Provides O(log n) allocation and deallocation.
 // Allocation always returns the smallest available ID.
@@ -47,4 +54,158 @@ private:
 	std::set<node> _nodes;
 };
 
+// ----------------------------------------------------------------
+// Byte ring buffer
+// ----------------------------------------------------------------
+
+// Fixed-capacity FIFO of bytes. Storage is only allocated on the first write,
+// so idle pipes and sockets do not consume memory.
+struct ring_buffer {
+	explicit ring_buffer(size_t capacity)
+	: _capacity{capacity} {
+		assert(capacity);
+	}
+
+	size_t capacity() const {
+		return _capacity;
+	}
+
+	size_t size() const {
+		return _size;
+	}
+
+	size_t space() const {
+		return _capacity - _size;
+	}
+
+	bool empty() const {
+		return !_size;
+	}
+
+	// Appends up to length bytes. Returns the number of bytes that were appended.
+	size_t write(const void *data, size_t length) {
+		auto n = std::min(length, space());
+		if(!n)
+			return 0;
+		if(!_storage)
+			_storage = std::make_unique<char[]>(_capacity);
+
+		auto tail = (_head + _size) % _capacity;
+		auto first = std::min(n, _capacity - tail);
+		memcpy(_storage.get() + tail, data, first);
+		memcpy(_storage.get(), static_cast<const char *>(data) + first, n - first);
+		_size += n;
+		return n;
+	}
+
+	// Removes up to length bytes. Returns the number of bytes that were removed.
+	size_t read(void *data, size_t length) {
+		auto n = std::min(length, _size);
+		if(!n)
+			return 0;
+		auto first = std::min(n, _capacity - _head);
+		memcpy(data, _storage.get() + _head, first);
+		memcpy(static_cast<char *>(data) + first, _storage.get(), n - first);
+		_head = (_head + n) % _capacity;
+		_size -= n;
+		return n;
+	}
+
+private:
+	std::unique_ptr<char[]> _storage;
+	size_t _capacity;
+	size_t _head = 0;
+	size_t _size = 0;
+};
+
+// ----------------------------------------------------------------
+// Hierarchical bitmap
+// ----------------------------------------------------------------
+
+// Growable bitmap that finds its lowest clear bit in O(log_64 n).
+// Level 0 stores the bits themselves; each bit of level k + 1 is set
+// iff the corresponding word of level k is full.
+struct hierarchical_bitmap {
+	hierarchical_bitmap() {
+		_rebuild(1);
+	}
+
+	size_t capacity() const {
+		return _levels[0].size() * 64;
+	}
+
+	bool test(size_t n) const {
+		if(n >= capacity())
+			return false;
+		return _levels[0][n / 64] & (uint64_t(1) << (n % 64));
+	}
+
+	void set(size_t n) {
+		if(n >= capacity())
+			_rebuild(std::max(_levels[0].size() * 2, n / 64 + 1));
+		for(auto &level : _levels) {
+			auto &word = level[n / 64];
+			word |= uint64_t(1) << (n % 64);
+			if(word != ~uint64_t(0))
+				break;
+			n /= 64;
+		}
+	}
+
+	void reset(size_t n) {
+		if(n >= capacity())
+			return;
+		for(auto &level : _levels) {
+			auto &word = level[n / 64];
+			bool was_full = word == ~uint64_t(0);
+			word &= ~(uint64_t(1) << (n % 64));
+			if(!was_full)
+				break;
+			n /= 64;
+		}
+	}
+
+	// Returns the lowest clear bit. This is capacity() if all bits are set.
+	size_t find_first_clear() const {
+		if(_levels.back()[0] == ~uint64_t(0))
+			return capacity();
+		size_t n = 0;
+		for(size_t k = _levels.size(); k-- > 0; )
+			n = n * 64 + __builtin_ctzll(~_levels[k][n]);
+		return n;
+	}
+
+	// Calls f(n) for each set bit n in ascending order.
+	template<typename F>
+	void for_each_set(F f) const {
+		for(size_t i = 0; i < _levels[0].size(); i++) {
+			auto word = _levels[0][i];
+			while(word) {
+				f(i * 64 + __builtin_ctzll(word));
+				word &= word - 1;
+			}
+		}
+	}
+
+	void clear() {
+		_rebuild(1);
+	}
+
+private:
+	// Resizes level 0 to the given number of words and recomputes the upper levels.
+	// Bits of upper levels that do not correspond to a word are set.
+	void _rebuild(size_t num_words) {
+		_levels.resize(1);
+		_levels[0].resize(num_words);
+		while(_levels.back().size() > 1) {
+			auto &lower = _levels.back();
+			std::vector<uint64_t> upper((lower.size() + 63) / 64, ~uint64_t(0));
+			for(size_t i = 0; i < lower.size(); i++)
+				if(lower[i] != ~uint64_t(0))
+					upper[i / 64] &= ~(uint64_t(1) << (i % 64));
+			_levels.push_back(std::move(upper));
+		}
+	}
 
+	std::vector<std::vector<uint64_t>> _levels;
+};
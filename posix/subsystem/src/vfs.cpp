@@ -4,6 +4,8 @@
 #include <unistd.h>
 #include <experimental/coroutine>
 #include <future>
+#include <optional>
+#include <vector>
 
 #include "common.hpp"
 #include "fs.bragi.hpp"
@@ -255,7 +257,23 @@ async::result<frg::expected<protocols::fs::Error, void>> PathResolver::resolve(R
 				_currentPath = ViewPath{_currentPath.first, owner->treeLink()};
 			}
 		}else{
-			if (_currentPath.second->getTarget()->hasTraverseLinks()) {
+			auto directory = _currentPath.second->getTarget();
+			auto &cache = DentryCache::global();
+			auto cacheGeneration = cache.generation();
+			std::optional<std::shared_ptr<FsLink>> cached;
+			if(directory->cachesLinks())
+				cached = cache.lookup(directory.get(), name);
+
+			if(cached && !*cached) {
+				// Negative entry.
+				_currentPath = ViewPath{_currentPath.first, nullptr};
+				co_return protocols::fs::Error::fileNotFound;
+			}
+
+			// On a cache hit, we resolve a single component like getLink() does.
+			// Otherwise, cached prefixes are resolved component by component and
+			// traverseLinks() is only used for the remaining components.
+			if (!cached && directory->hasTraverseLinks()) {
 				_components.push_front(name);
 				std::string end;
 
@@ -263,13 +281,18 @@ async::result<frg::expected<protocols::fs::Error, void>> PathResolver::resolve(R
 					end = _components.back();
 					_components.pop_back();
 				}
+				size_t numRequested = _components.size();
 
-				auto result = co_await _currentPath.second->getTarget()->traverseLinks(_components);
+				auto result = co_await directory->traverseLinks(_components);
 
 				if (!result) {
 					assert(result.error() == Error::illegalOperationTarget
 							|| result.error() == Error::noSuchFile
 							|| result.error() == Error::notDirectory);
+					// We only know which component is missing if we asked for one.
+					if(result.error() == Error::noSuchFile && numRequested == 1
+							&& directory->cachesLinks())
+						cache.insert(directory, name, nullptr, cacheGeneration);
 					_currentPath = ViewPath{_currentPath.first, nullptr};
 					if(result.error() == Error::illegalOperationTarget) {
 						std::cout << "\e[33mposix: Illegal operation target in PathResolver::resolve\e[39m" << std::endl;
@@ -281,7 +304,29 @@ async::result<frg::expected<protocols::fs::Error, void>> PathResolver::resolve(R
 					}
 				}
 
-				auto [child, nLinks] = result.value();
+				auto [links, nLinks] = result.value();
+
+				// Cache the traversed links. Tree links of directories that were renamed
+				// can be outdated; caching stops at the first such link.
+				if(directory->cachesLinks()) {
+					std::vector<std::string> names;
+					for(size_t i = 0; i < nLinks; i++) {
+						if(_components[i] == "..")
+							names.pop_back();
+						else if(_components[i] != ".")
+							names.push_back(_components[i]);
+					}
+					assert(names.size() == links.size());
+
+					auto owner = directory;
+					for(size_t i = 0; i < links.size(); i++) {
+						auto &link = links[i];
+						if(link->getOwner() != owner || link->getName() != names[i])
+							break;
+						cache.insert(owner, link->getName(), link, cacheGeneration);
+						owner = link->getTarget();
+					}
+				}
 
 				if (flags & resolvePrefix) {
 					_components.push_back(end);
@@ -292,10 +337,11 @@ async::result<frg::expected<protocols::fs::Error, void>> PathResolver::resolve(R
 				while (nLinks--)
 					_components.pop_front();
 
-				if(!child) {
-					_currentPath = ViewPath{_currentPath.first, nullptr};
-					co_return protocols::fs::Error::fileNotFound;
-				}
+				// The components led back to the directory (e.g., "a/..").
+				if(links.empty())
+					continue;
+
+				auto child = links.back();
 
 				// Next, we might need to traverse mount boundaries.
 				ViewPath next;
@@ -333,19 +379,26 @@ async::result<frg::expected<protocols::fs::Error, void>> PathResolver::resolve(R
 					_currentPath = std::move(next);
 				}
 			} else {
-				auto childResult = co_await _currentPath.second->getTarget()->getLink(std::move(name));
-				if(!childResult) {
-					assert(childResult.error() == Error::notDirectory
-							|| childResult.error() == Error::illegalOperationTarget);
-					_currentPath = ViewPath{_currentPath.first, nullptr};
-					if(childResult.error() == Error::notDirectory) {
-						co_return protocols::fs::Error::notDirectory;
-					} else if(childResult.error() == Error::illegalOperationTarget) {
-						std::cout << "\e[33mposix: Illegal operation target in PathResolver::resolve\e[39m" << std::endl;
-						co_return protocols::fs::Error::fileNotFound;
+				std::shared_ptr<FsLink> child;
+				if(cached) {
+					child = *cached;
+				}else{
+					auto childResult = co_await directory->getLink(name);
+					if(!childResult) {
+						assert(childResult.error() == Error::notDirectory
+								|| childResult.error() == Error::illegalOperationTarget);
+						_currentPath = ViewPath{_currentPath.first, nullptr};
+						if(childResult.error() == Error::notDirectory) {
+							co_return protocols::fs::Error::notDirectory;
+						} else if(childResult.error() == Error::illegalOperationTarget) {
+							std::cout << "\e[33mposix: Illegal operation target in PathResolver::resolve\e[39m" << std::endl;
+							co_return protocols::fs::Error::fileNotFound;
+						}
 					}
+					child = childResult.value();
+					if(directory->cachesLinks())
+						cache.insert(directory, name, child, cacheGeneration);
 				}
-				auto child = childResult.value();
 
 				if(!child) {
 					_currentPath = ViewPath{_currentPath.first, nullptr};
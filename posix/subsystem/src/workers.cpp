@@ -0,0 +1,111 @@
+#include "workers.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+std::vector<std::unique_ptr<Worker>> workers;
+
+thread_local Worker *thisWorker = nullptr;
+
+std::atomic<size_t> nextStatelessWorker = 0;
+
+} // anonymous namespace
+
+Worker::Worker(size_t index)
+: index_{index} {
+	auto [wakeLane, drainLane] = helix::createStream();
+	wakeLane_ = std::move(wakeLane);
+	drainLane_ = std::move(drainLane);
+}
+
+void Worker::launchThread() {
+	thread_ = std::thread{[this] {
+		attachToCurrentThread();
+		async::run_forever(helix::currentDispatcher);
+	}};
+}
+
+void Worker::attachToCurrentThread() {
+	assert(!thisWorker);
+	thisWorker = this;
+	drainTasks_();
+}
+
+void Worker::enqueue_(std::unique_ptr<Task> task) {
+	{
+		std::lock_guard lock{mutex_};
+		tasks_.push_back(std::move(task));
+	}
+
+	if(wakeupPending_.exchange(true, std::memory_order_acq_rel))
+		return;
+
+	// The message is sent from the caller's dispatcher. Since the wakeup lane is
+	// owned by the worker, it outlives the send operation.
+	async::detach([] (helix::BorrowedLane lane) -> async::result<void> {
+		char dummy = 0;
+		auto [send] = co_await helix_ng::exchangeMsgs(lane,
+			helix_ng::sendBuffer(&dummy, sizeof(dummy))
+		);
+		HEL_CHECK(send.error());
+	}(wakeLane_));
+}
+
+async::detached Worker::drainTasks_() {
+	while(true) {
+		auto [recv] = co_await helix_ng::exchangeMsgs(drainLane_,
+			helix_ng::recvInline()
+		);
+		HEL_CHECK(recv.error());
+
+		// Clear the flag before draining so that tasks posted from now on send a wakeup.
+		wakeupPending_.store(false, std::memory_order_release);
+
+		while(true) {
+			std::unique_ptr<Task> task;
+			{
+				std::lock_guard lock{mutex_};
+				if(tasks_.empty())
+					break;
+				task = std::move(tasks_.front());
+				tasks_.pop_front();
+			}
+			task->run();
+		}
+	}
+}
+
+void initWorkers(size_t count) {
+	assert(count >= 1 && workers.empty());
+	std::cout << "posix: Using " << count << " worker thread(s)" << std::endl;
+
+	for(size_t i = 0; i < count; i++)
+		workers.push_back(std::make_unique<Worker>(i));
+
+	workers[0]->attachToCurrentThread();
+	for(size_t i = 1; i < count; i++)
+		workers[i]->launchThread();
+}
+
+size_t numWorkers() {
+	return workers.size();
+}
+
+Worker &mainWorker() {
+	return *workers[0];
+}
+
+Worker &currentWorker() {
+	assert(thisWorker);
+	return *thisWorker;
+}
+
+Worker &pickStatelessWorker() {
+	if(workers.size() == 1)
+		return *workers[0];
+	auto n = nextStatelessWorker.fetch_add(1, std::memory_order_relaxed);
+	return *workers[1 + n % (workers.size() - 1)];
+}
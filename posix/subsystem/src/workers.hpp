@@ -0,0 +1,84 @@
+#pragma once
+
+#include <async/result.hpp>
+#include <helix/ipc.hpp>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// posix-subsystem runs one event loop per worker thread. Worker 0 is the main thread;
+// it owns all global state (processes, the VFS, sockets, etc.). The other workers
+// only serve requests that do not touch global state (see File::statelessFileOperations).
+struct Worker {
+	Worker(size_t index);
+
+	Worker(const Worker &) = delete;
+
+	Worker &operator= (const Worker &) = delete;
+
+	size_t index() {
+		return index_;
+	}
+
+	// Runs f on this worker. Can be called from any thread; tasks run in FIFO order.
+	template<typename F>
+	void post(F f) {
+		struct Impl final : Task {
+			Impl(F f)
+			: f{std::move(f)} { }
+
+			void run() override {
+				f();
+			}
+
+			F f;
+		};
+
+		enqueue_(std::make_unique<Impl>(std::move(f)));
+	}
+
+	// Starts the event loop of the worker on a new thread.
+	void launchThread();
+
+	// Starts processing tasks on the current thread (only used for worker 0).
+	void attachToCurrentThread();
+
+private:
+	struct Task {
+		virtual ~Task() = default;
+		virtual void run() = 0;
+	};
+
+	void enqueue_(std::unique_ptr<Task> task);
+
+	async::detached drainTasks_();
+
+	size_t index_;
+	std::thread thread_;
+
+	std::mutex mutex_;
+	std::deque<std::unique_ptr<Task>> tasks_;
+	// Set if a wakeup is already in flight; avoids one message per task.
+	std::atomic<bool> wakeupPending_ = false;
+
+	// Wakeups are messages over this stream; this works across threads since
+	// each thread submits to its own dispatcher.
+	helix::UniqueLane wakeLane_;
+	helix::UniqueLane drainLane_;
+};
+
+// Sets up the workers; must be called on the main thread before anything else.
+void initWorkers(size_t count);
+
+size_t numWorkers();
+
+Worker &mainWorker();
+
+// Worker of the calling thread.
+Worker &currentWorker();
+
+// Picks the worker that serves a new stateless file. Files are distributed round-robin
+// over all workers except for the main one (unless there is only a single worker).
+Worker &pickStatelessWorker();
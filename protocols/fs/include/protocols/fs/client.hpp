@@ -3,7 +3,9 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include <async/result.hpp>
 #include <async/cancellation.hpp>
@@ -19,6 +21,25 @@ namespace fs {
 
 namespace _detail {
 
+struct PipelineState;
+
+// Shuts the pipeline down when the File goes out of scope.
+struct Pipeline {
+	Pipeline() = default;
+
+	Pipeline(Pipeline &&) = default;
+
+	~Pipeline();
+
+	Pipeline &operator= (Pipeline &&) = delete;
+
+	explicit operator bool () const {
+		return static_cast<bool>(state);
+	}
+
+	std::shared_ptr<PipelineState> state;
+};
+
 struct File {
 	File(helix::UniqueDescriptor lane);
 
@@ -26,7 +47,15 @@ struct File {
 		return _lane;
 	}
 
+	// Opens a lane for pipelined requests (see PT_OPEN_PIPELINE). Afterwards,
+	// seekAbsolute(), seekRelative(), readSome() and writeSome() are sent over that lane
+	// instead of creating a conversation per request.
+	// Returns false if the server does not support pipelining.
+	async::result<bool> openPipeline();
+
 	async::result<void> seekAbsolute(int64_t offset);
+	// Returns the new file offset.
+	async::result<int64_t> seekRelative(int64_t offset);
 
 	async::result<size_t> readSome(void *data, size_t max_length);
 	async::result<size_t> writeSome(const void *data, size_t max_length);
@@ -39,12 +68,41 @@ struct File {
 
 	async::result<helix::UniqueDescriptor> accessMemory();
 
+	// Server and id of this file for pollStatusBatch().
+	// Both are only known after the first successful pollStatus();
+	// pollServer() returns zero before that or if the server does not support batching.
+	uint64_t pollServer() {
+		return _pollServer;
+	}
+
+	uint64_t pollId() {
+		return _pollId;
+	}
+
 private:
 	helix::UniqueDescriptor _lane;
+	Pipeline _pipeline;
+	uint64_t _pollServer = 0;
+	uint64_t _pollId = 0;
 };
 
 } // namespace _detail
 
 using _detail::File;
 
+// Queries the status of multiple files with a single request.
+// All files must report the same non-zero pollServer().
+async::result<std::vector<frg::expected<Error, PollStatusResult>>>
+pollStatusBatch(const std::vector<File *> &files);
+
+// Writes length bytes at the given offset of a memory object (e.g., a file's page cache)
+// to the file behind a passthrough lane. The receiver maps the memory object,
+// so the data is not copied through the caller. Like WRITE, this may write less data.
+async::result<frg::expected<Error, size_t>>
+writeFromMemory(helix::BorrowedDescriptor lane, helix::BorrowedDescriptor memory,
+		uint64_t offset, size_t length);
+
+// Asks the server behind a passthrough lane to write the file back to stable storage.
+async::result<frg::expected<Error>> sync(helix::BorrowedDescriptor lane);
+
 } } // namespace protocols::fs
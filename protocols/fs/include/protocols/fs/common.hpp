@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 #include <optional>
 #include <variant>
 #include <vector>
@@ -38,6 +40,13 @@ using ReadResult = std::variant<Error, size_t>;
 
 using ReadEntriesResult = std::optional<std::string>;
 
+// Size of the record that an entry occupies in a getdents64() buffer,
+// i.e., the 19 byte header followed by the NUL-terminated name, padded to 8 bytes.
+// PT_READ_ENTRY_BATCH returns as many entries as fit into the requested size.
+inline size_t direntRecordSize(size_t nameLength) {
+	return (19 + nameLength + 1 + 7) & ~size_t(7);
+}
+
 using PollResult = std::tuple<uint64_t, int, int>;
 using PollWaitResult = std::tuple<uint64_t, int>;
 using PollStatusResult = std::tuple<uint64_t, int>;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 namespace protocols::fs {
@@ -11,4 +12,13 @@ struct StatusPage {
 	int status;
 };
 
+// Number of counters in the memory that SB_GET_ATTRIBUTE_GENERATIONS returns.
+// Each counter is a uint64_t that is shared by all inodes that hash to it;
+// it is incremented whenever the attributes of one of these inodes change.
+constexpr size_t numAttributeGenerations = 512;
+
+inline size_t attributeGenerationSlot(uint64_t inode) {
+	return inode % numAttributeGenerations;
+}
+
 } // namespace protocols::fs
@@ -39,6 +39,19 @@ struct FileStats {
 	struct timespec anyChangeTime;
 };
 
+// Entry of a directory as returned by readEntryBatch().
+struct DirectoryEntry {
+	std::string name;
+	// Zero if the inode number is not known.
+	uint64_t inode;
+	FileType type;
+	// Only present if the entries were requested together with their stats.
+	std::optional<FileStats> stats;
+};
+
+// Returns an empty vector at the end of the directory.
+using ReadEntryBatchResult = frg::expected<Error, std::vector<DirectoryEntry>>;
+
 using SeekResult = std::variant<Error, int64_t>;
 
 using GetLinkResult = std::tuple<std::shared_ptr<void>, int64_t, FileType>;
@@ -80,6 +93,11 @@ struct FileOperations {
 		readEntries = f;
 		return *this;
 	}
+	constexpr FileOperations &withReadEntryBatch(async::result<ReadEntryBatchResult> (*f)(void *object,
+			size_t maxSize, bool withStats)) {
+		readEntryBatch = f;
+		return *this;
+	}
 	constexpr FileOperations &withAccessMemory(async::result<helix::BorrowedDescriptor>(*f)(void *object)) {
 		accessMemory = f;
 		return *this;
@@ -94,6 +112,11 @@ struct FileOperations {
 		fallocate = f;
 		return *this;
 	}
+	constexpr FileOperations &withSync(async::result<frg::expected<protocols::fs::Error>>
+			(*f)(void *object)) {
+		sync = f;
+		return *this;
+	}
 	constexpr FileOperations &withIoctl(async::result<void> (*f)(void *object,
 			managarm::fs::CntRequest req, helix::UniqueLane conversation)) {
 		ioctl = f;
@@ -133,6 +156,11 @@ struct FileOperations {
 		listen = f;
 		return *this;
 	}
+	constexpr FileOperations &withAccept(
+			async::result<frg::expected<Error, helix::UniqueLane>> (*f)(void *object)) {
+		accept = f;
+		return *this;
+	}
 
 	constexpr FileOperations &withPeername(async::result<frg::expected<Error, size_t>> (*f)(void *object,
 			void *addr_ptr, size_t max_addr_length)) {
@@ -150,9 +178,16 @@ struct FileOperations {
 	async::result<frg::expected<protocols::fs::Error, size_t>> (*write)(void *object, const char *credentials,
 			const void *buffer, size_t length);
 	async::result<ReadEntriesResult> (*readEntries)(void *object);
+	// Returns as many entries as fit into maxSize bytes (see direntRecordSize()).
+	// Fails with illegalArguments if not even the next entry fits.
+	// If withStats is true, the stats of all returned entries are filled in.
+	async::result<ReadEntryBatchResult> (*readEntryBatch)(void *object, size_t maxSize,
+			bool withStats);
 	async::result<helix::BorrowedDescriptor>(*accessMemory)(void *object);
 	async::result<frg::expected<protocols::fs::Error>> (*truncate)(void *object, size_t size);
 	async::result<void> (*fallocate)(void *object, int64_t offset, size_t size);
+	// Writes the file's data and metadata back to stable storage (i.e., fsync()).
+	async::result<frg::expected<protocols::fs::Error>> (*sync)(void *object);
 	async::result<void> (*ioctl)(void *object, managarm::fs::CntRequest req,
 			helix::UniqueLane conversation);
 	async::result<protocols::fs::Error> (*flock)(void *object, int flags);
@@ -166,11 +201,16 @@ struct FileOperations {
 	async::result<Error> (*bind)(void *object, const char *credentials,
 			const void *addr_ptr, size_t addr_length);
 	async::result<Error> (*listen)(void *object);
+	// Returns a passthrough lane to the accepted connection.
+	async::result<frg::expected<Error, helix::UniqueLane>> (*accept)(void *object);
 	async::result<Error> (*connect)(void *object, const char *credentials,
 			const void *addr_ptr, size_t addr_length);
 	async::result<size_t> (*sockname)(void *object, void *addr_ptr, size_t max_addr_length);
 	async::result<int> (*getFileFlags)(void *object);
 	async::result<void> (*setFileFlags)(void *object, int flags);
+	// Seals are managarm::fs::FileSeals flags (i.e., F_ADD_SEALS and F_GET_SEALS).
+	async::result<frg::expected<Error>> (*addSeals)(void *object, int seals);
+	async::result<frg::expected<Error, int>> (*getSeals)(void *object);
 	async::result<RecvResult> (*recvMsg)(void *object, const char *creds,
 			uint32_t flags, void *data, size_t len,
 			void *addr_buf, size_t addr_size, size_t max_ctrl_len);
@@ -195,6 +235,24 @@ private:
 	helix::Mapping _mapping;
 };
 
+// Provides the memory that SB_GET_ATTRIBUTE_GENERATIONS returns.
+// Servers call bump() after changing the attributes of an inode (and before
+// replying to the request that changed them); clients may use cached
+// FileStats as long as the inode's counter does not change.
+struct AttributeGenerationProvider {
+	AttributeGenerationProvider();
+
+	helix::BorrowedDescriptor getMemory() {
+		return _memory;
+	}
+
+	void bump(uint64_t inode);
+
+private:
+	helix::UniqueDescriptor _memory;
+	helix::Mapping _mapping;
+};
+
 struct NodeOperations {
 	async::result<FileStats> (*getStats)(std::shared_ptr<void> object);
 
@@ -1,28 +1,207 @@
 
 #include <iostream>
 
+#include <async/mutex.hpp>
+#include <async/oneshot-event.hpp>
 #include "fs.bragi.hpp"
 #include "protocols/fs/client.hpp"
 
 namespace protocols {
 namespace fs {
 
+namespace _detail {
+
+// Client side of the protocol that is described in src/server.cpp.
+struct PipelineState {
+	struct Request {
+		managarm::fs::SvrResponse resp;
+		// Destination of the data of READ.
+		void *data = nullptr;
+		size_t length = 0;
+		size_t actualLength = 0;
+		async::oneshot_event done;
+	};
+
+	// Sends the request (and the data of WRITE) and waits for the response.
+	async::result<void> submit(Request &request, managarm::fs::CntRequest &req,
+			const void *data = nullptr, size_t length = 0);
+
+	helix::UniqueLane lane;
+	// Ensures that the data of WRITE directly follows its request.
+	async::mutex sendMutex;
+	uint64_t nextTag = 1;
+	std::unordered_map<uint64_t, Request *> pending;
+};
+
+async::result<void> PipelineState::submit(Request &request, managarm::fs::CntRequest &req,
+		const void *data, size_t length) {
+	auto tag = nextTag++;
+	req.set_pipeline_tag(tag);
+	pending.insert({tag, &request});
+
+	co_await sendMutex.async_lock();
+	if(req.req_type() == managarm::fs::CntReqType::WRITE) {
+		auto [send_req, send_data] = co_await helix_ng::exchangeMsgs(
+			lane,
+			helix_ng::sendBragiHeadInline(req),
+			helix_ng::sendBuffer(data, length)
+		);
+		HEL_CHECK(send_req.error());
+		HEL_CHECK(send_data.error());
+	}else{
+		auto [send_req] = co_await helix_ng::exchangeMsgs(
+			lane,
+			helix_ng::sendBragiHeadInline(req)
+		);
+		HEL_CHECK(send_req.error());
+	}
+	sendMutex.unlock();
+
+	co_await request.done.wait();
+}
+
+// Matches responses to their requests until the pipeline is shut down.
+async::detached receivePipeline(std::shared_ptr<PipelineState> pipeline) {
+	while(true) {
+		auto [recv_resp] = co_await helix_ng::exchangeMsgs(
+			pipeline->lane,
+			helix_ng::recvInline()
+		);
+		if(recv_resp.error() == kHelErrLaneShutdown)
+			co_return;
+		if(recv_resp.error() == kHelErrEndOfLane) {
+			// The server closed the file; fail all outstanding requests.
+			for(auto [tag, request] : pipeline->pending) {
+				request->resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+				request->done.raise();
+			}
+			pipeline->pending.clear();
+			co_return;
+		}
+		HEL_CHECK(recv_resp.error());
+
+		managarm::fs::SvrResponse resp;
+		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+		recv_resp.reset();
+
+		auto it = pipeline->pending.find(resp.pipeline_tag());
+		assert(it != pipeline->pending.end());
+		auto request = it->second;
+		pipeline->pending.erase(it);
+
+		if(request->data && resp.error() == managarm::fs::Errors::SUCCESS) {
+			auto [recv_data] = co_await helix_ng::exchangeMsgs(
+				pipeline->lane,
+				helix_ng::recvBuffer(request->data, request->length)
+			);
+			HEL_CHECK(recv_data.error());
+			request->actualLength = recv_data.actualLength();
+		}
+
+		request->resp = std::move(resp);
+		request->done.raise();
+	}
+}
+
+Pipeline::~Pipeline() {
+	if(state)
+		HEL_CHECK(helShutdownLane(state->lane.getHandle()));
+}
+
+} // namespace _detail
+
 File::File(helix::UniqueDescriptor lane)
 : _lane(std::move(lane)) { }
 
+async::result<bool> File::openPipeline() {
+	assert(!_pipeline);
+
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::PT_OPEN_PIPELINE);
+
+	auto [offer, send_req, imbue_creds, recv_resp, pull_lane] =
+		co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::sendBragiHeadInline(req),
+				helix_ng::imbueCredentials(),
+				helix_ng::recvInline(),
+				helix_ng::pullDescriptor()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	// Servers that do not know PT_OPEN_PIPELINE dismiss the conversation.
+	if(imbue_creds.error() == kHelErrDismissed)
+		co_return false;
+	HEL_CHECK(imbue_creds.error());
+	HEL_CHECK(recv_resp.error());
+	HEL_CHECK(pull_lane.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	if(resp.error() != managarm::fs::Errors::SUCCESS)
+		co_return false;
+
+	auto pipeline = std::make_shared<PipelineState>();
+	pipeline->lane = pull_lane.descriptor();
+	receivePipeline(pipeline);
+	_pipeline.state = std::move(pipeline);
+	co_return true;
+}
+
 async::result<void> File::seekAbsolute(int64_t offset) {
 	managarm::fs::CntRequest req;
 	req.set_req_type(managarm::fs::CntReqType::SEEK_ABS);
 	req.set_rel_offset(offset);
 
-	auto ser = req.SerializeAsString();
+	if(_pipeline) {
+		PipelineState::Request request;
+		co_await _pipeline.state->submit(request, req);
+		assert(request.resp.error() == managarm::fs::Errors::SUCCESS);
+		co_return;
+	}
+
 	uint8_t buffer[128];
 
 	auto [offer, send_req, recv_resp] =
 		co_await helix_ng::exchangeMsgs(
 			_lane,
 			helix_ng::offer(
-				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::sendBragiHeadInline(req),
+				helix_ng::recvBuffer(buffer, 128)
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(buffer, recv_resp.actualLength());
+	assert(resp.error() == managarm::fs::Errors::SUCCESS);
+}
+
+async::result<int64_t> File::seekRelative(int64_t offset) {
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::SEEK_REL);
+	req.set_rel_offset(offset);
+
+	if(_pipeline) {
+		PipelineState::Request request;
+		co_await _pipeline.state->submit(request, req);
+		assert(request.resp.error() == managarm::fs::Errors::SUCCESS);
+		co_return request.resp.offset();
+	}
+
+	uint8_t buffer[128];
+
+	auto [offer, send_req, recv_resp] =
+		co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::sendBragiHeadInline(req),
 				helix_ng::recvBuffer(buffer, 128)
 			)
 		);
@@ -34,6 +213,7 @@ async::result<void> File::seekAbsolute(int64_t offset) {
 	managarm::fs::SvrResponse resp;
 	resp.ParseFromArray(buffer, recv_resp.actualLength());
 	assert(resp.error() == managarm::fs::Errors::SUCCESS);
+	co_return resp.offset();
 }
 
 async::result<size_t> File::readSome(void *data, size_t max_length) {
@@ -41,14 +221,24 @@ async::result<size_t> File::readSome(void *data, size_t max_length) {
 	req.set_req_type(managarm::fs::CntReqType::READ);
 	req.set_size(max_length);
 
-	auto ser = req.SerializeAsString();
+	if(_pipeline) {
+		PipelineState::Request request;
+		request.data = data;
+		request.length = max_length;
+		co_await _pipeline.state->submit(request, req);
+		if(request.resp.error() == managarm::fs::Errors::END_OF_FILE)
+			co_return 0;
+		assert(request.resp.error() == managarm::fs::Errors::SUCCESS);
+		co_return request.actualLength;
+	}
+
 	uint8_t buffer[128];
 
 	auto [offer, send_req, imbue_creds, recv_resp, recv_data] =
 		co_await helix_ng::exchangeMsgs(
 			_lane,
 			helix_ng::offer(
-				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::sendBragiHeadInline(req),
 				helix_ng::imbueCredentials(),
 				helix_ng::recvBuffer(buffer, 128),
 				helix_ng::recvBuffer(data, max_length)
@@ -75,13 +265,20 @@ async::result<size_t> File::writeSome(const void *data, size_t maxLength) {
 	req.set_req_type(managarm::fs::CntReqType::WRITE);
 	req.set_size(maxLength);
 
-	auto ser = req.SerializeAsString();
+	if(_pipeline) {
+		PipelineState::Request request;
+		co_await _pipeline.state->submit(request, req, data, maxLength);
+		if(request.resp.error() == managarm::fs::Errors::END_OF_FILE)
+			co_return 0;
+		assert(request.resp.error() == managarm::fs::Errors::SUCCESS);
+		co_return request.resp.size();
+	}
 
 	auto [offer, sendReq, imbueCreds, sendData, recvResp] =
 		co_await helix_ng::exchangeMsgs(
 			_lane,
 			helix_ng::offer(
-				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::sendBragiHeadInline(req),
 				helix_ng::imbueCredentials(),
 				helix_ng::sendBuffer(data, maxLength),
 				helix_ng::recvInline()
@@ -119,14 +316,13 @@ async::result<frg::expected<Error, PollWaitResult>> File::pollWait(uint64_t sequ
 	req.set_sequence(sequence);
 	req.set_event_mask(mask);
 
-	auto ser = req.SerializeAsString();
 	uint8_t buffer[128];
 
 	auto [offer, send_req, push_cancel, recv_resp] =
 		co_await helix_ng::exchangeMsgs(
 			_lane,
 			helix_ng::offer(
-				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::sendBragiHeadInline(req),
 				helix_ng::pushDescriptor(cancel_event),
 				helix_ng::recvBuffer(buffer, 128)
 			)
@@ -149,14 +345,13 @@ async::result<frg::expected<Error, PollStatusResult>> File::pollStatus() {
 	managarm::fs::CntRequest req;
 	req.set_req_type(managarm::fs::CntReqType::FILE_POLL_STATUS);
 
-	auto ser = req.SerializeAsString();
 	uint8_t buffer[128];
 
 	auto [offer, send_req, recv_resp] =
 		co_await helix_ng::exchangeMsgs(
 			_lane,
 			helix_ng::offer(
-				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::sendBragiHeadInline(req),
 				helix_ng::recvBuffer(buffer, 128)
 			)
 		);
@@ -170,21 +365,126 @@ async::result<frg::expected<Error, PollStatusResult>> File::pollStatus() {
 
 	if(resp.error() != managarm::fs::Errors::SUCCESS)
 		co_return static_cast<Error>(resp.error());
+	if(resp.poll_server()) {
+		_pollServer = resp.poll_server();
+		_pollId = resp.poll_id();
+	}
 	co_return PollStatusResult(resp.sequence(), resp.status());
 }
 
+async::result<std::vector<frg::expected<Error, PollStatusResult>>>
+pollStatusBatch(const std::vector<File *> &files) {
+	assert(!files.empty());
+
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::FILE_POLL_STATUS_BATCH);
+	for(auto file : files) {
+		assert(file->pollServer() && file->pollServer() == files.front()->pollServer());
+		req.add_poll_ids(file->pollId());
+	}
+
+	// Any lane of the server can be used for the request.
+	auto ser = req.SerializeAsString();
+	auto [offer, send_req, recv_resp] =
+		co_await helix_ng::exchangeMsgs(
+			files.front()->getLane(),
+			helix_ng::offer(
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::recvInline()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	assert(resp.error() == managarm::fs::Errors::SUCCESS);
+	assert(resp.poll_errors_size() == files.size());
+
+	std::vector<frg::expected<Error, PollStatusResult>> results;
+	results.reserve(files.size());
+	for(size_t i = 0; i < files.size(); i++) {
+		auto error = static_cast<managarm::fs::Errors>(resp.poll_errors(i));
+		if(error != managarm::fs::Errors::SUCCESS) {
+			results.push_back(static_cast<Error>(error));
+		}else{
+			results.push_back(PollStatusResult(resp.poll_sequences(i), resp.poll_statuses(i)));
+		}
+	}
+	co_return results;
+}
+
+async::result<frg::expected<Error, size_t>>
+writeFromMemory(helix::BorrowedDescriptor lane, helix::BorrowedDescriptor memory,
+		uint64_t offset, size_t length) {
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::PT_WRITE_FROM_MEMORY);
+	req.set_offset(offset);
+	req.set_size(length);
+
+	auto [offer, send_req, imbue_creds, push_memory, recv_resp] =
+		co_await helix_ng::exchangeMsgs(
+			lane,
+			helix_ng::offer(
+				helix_ng::sendBragiHeadInline(req),
+				helix_ng::imbueCredentials(),
+				helix_ng::pushDescriptor(memory),
+				helix_ng::recvInline()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(imbue_creds.error());
+	HEL_CHECK(push_memory.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	recv_resp.reset();
+	if(resp.error() != managarm::fs::Errors::SUCCESS)
+		co_return static_cast<Error>(resp.error());
+	co_return resp.size();
+}
+
+async::result<frg::expected<Error>> sync(helix::BorrowedDescriptor lane) {
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::PT_FSYNC);
+
+	auto [offer, send_req, recv_resp] =
+		co_await helix_ng::exchangeMsgs(
+			lane,
+			helix_ng::offer(
+				helix_ng::sendBragiHeadInline(req),
+				helix_ng::recvInline()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	recv_resp.reset();
+	if(resp.error() != managarm::fs::Errors::SUCCESS)
+		co_return static_cast<Error>(resp.error());
+	co_return {};
+}
+
 async::result<helix::UniqueDescriptor> File::accessMemory() {
 	managarm::fs::CntRequest req;
 	req.set_req_type(managarm::fs::CntReqType::MMAP);
 
-	auto ser = req.SerializeAsString();
 	uint8_t buffer[128];
 
 	auto [offer, send_req, recv_resp, recv_memory] =
 		co_await helix_ng::exchangeMsgs(
 			_lane,
 			helix_ng::offer(
-				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::sendBragiHeadInline(req),
 				helix_ng::recvBuffer(buffer, 128),
 				helix_ng::pullDescriptor()
 			)
@@ -2,12 +2,19 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <algorithm>
+#include <array>
 #include <iostream>
+#include <unordered_map>
 #include <vector>
 
+#include <async/mutex.hpp>
+#include <async/recurring-event.hpp>
 #include <helix/ipc.hpp>
 
 #include <protocols/fs/server.hpp>
+#include <protocols/ostrace/ostrace.hpp>
 #include "fs.bragi.hpp"
 
 namespace protocols {
@@ -15,18 +22,371 @@ namespace fs {
 
 namespace {
 
-async::detached handlePassthrough(smarter::shared_ptr<void> file,
-		const FileOperations *file_ops,
+// Maximal number of requests that are handled concurrently on a passthrough lane
+// of a seekable file. Further requests are only accepted once one of them completes.
+constexpr size_t maxRequestsInFlight = 64;
+
+struct PipelineState;
+
+// State that is shared by all requests on a passthrough lane.
+struct PassthroughState {
+	// Seekable files have a file offset that READ, WRITE and SEEK_* use or update;
+	// these requests are handled in the order in which they were accepted.
+	// Other requests (e.g. PT_PREAD) run concurrently.
+	// Non-seekable files (sockets, pipes, TTYs) may block in READ indefinitely;
+	// we neither order nor bound their requests.
+	bool seekable = false;
+	async::mutex offsetMutex;
+
+	size_t inFlight = 0;
+	async::recurring_event completionEvent;
+
+	// Key of the file in pollTargets.
+	uint64_t pollId = 0;
+
+	// Lanes opened by PT_OPEN_PIPELINE; they are shut down together with the passthrough lane.
+	std::vector<std::weak_ptr<PipelineState>> pipelines;
+};
+
+// State of a lane opened by PT_OPEN_PIPELINE. Clients send requests on this lane
+// without offer, such that no conversation needs to be created per request:
+// * Each request is a CntRequest with a pipeline_tag; WRITE is followed by its data.
+// * Each response is a SvrResponse with the pipeline_tag of its request;
+//   successful READs are followed by the data.
+// Responses are sent in completion order. Requests that use the file offset
+// are still ordered with respect to all other requests on the passthrough lane.
+struct PipelineState {
+	helix::UniqueLane lane;
+	// Credentials of the client that opened the pipeline; used for all of its requests.
+	std::array<char, 16> credentials;
+	// Held while a response is sent, such that no other response ends up between
+	// the head and the data of READ.
+	async::mutex sendMutex;
+};
+
+// Files that are currently served by servePassthrough(), indexed by their poll id.
+// FILE_POLL_STATUS_BATCH refers to files by these ids.
+struct PollTarget {
+	smarter::shared_ptr<void> file;
+	const FileOperations *fileOps;
+};
+
+std::unordered_map<uint64_t, PollTarget> pollTargets;
+uint64_t nextPollId = 1;
+
+// Poll ids are only meaningful within this server; clients compare this
+// random value to decide which files can be queried together.
+uint64_t pollServerId() {
+	static uint64_t id = [] {
+		uint64_t value = 0;
+		size_t progress = 0;
+		while(progress < sizeof(uint64_t)) {
+			size_t chunk;
+			HEL_CHECK(helGetRandomBytes(reinterpret_cast<char *>(&value) + progress,
+					sizeof(uint64_t) - progress, &chunk));
+			progress += chunk;
+		}
+		// Zero means that batching is not supported.
+		return value ? value : 1;
+	}();
+	return id;
+}
+
+bool usesFileOffset(const managarm::fs::CntRequest &req) {
+	switch(req.req_type()) {
+	case managarm::fs::CntReqType::PT_PREADV:
+	case managarm::fs::CntReqType::PT_PWRITEV:
+		return req.offset() < 0;
+	case managarm::fs::CntReqType::SEEK_ABS:
+	case managarm::fs::CntReqType::SEEK_REL:
+	case managarm::fs::CntReqType::SEEK_EOF:
+	case managarm::fs::CntReqType::READ:
+	case managarm::fs::CntReqType::WRITE:
+	case managarm::fs::CntReqType::PT_READ_ENTRIES:
+	case managarm::fs::CntReqType::PT_READ_ENTRY_BATCH:
+	case managarm::fs::CntReqType::PT_READ_ENTRIES_PLUS:
+	case managarm::fs::CntReqType::PT_WRITE_FROM_MEMORY:
+		return true;
+	default:
+		return false;
+	}
+}
+
+async::result<void> handlePassthroughRequest(smarter::shared_ptr<void> file,
+		const FileOperations *file_ops, uint64_t poll_id,
+		managarm::fs::CntRequest req, helix::UniqueLane conversation);
+
+// Flags of PT_PREADV and PT_PWRITEV; the values match Linux's RWF_HIPRI and RWF_NOWAIT.
+constexpr uint32_t rwfHighPriority = 0x01;
+constexpr uint32_t rwfNoWait = 0x08;
+
+// Limits of PT_PREADV and PT_PWRITEV (IOV_MAX and the size of the bounce buffer).
+constexpr size_t maxVectoredBuffers = 1024;
+constexpr size_t maxVectoredLength = size_t(64) << 20;
+
+// Validates PT_PREADV and PT_PWRITEV and implements RWF_NOWAIT: if the file reports
+// its status, we fail with WOULD_BLOCK unless one of readyEvents is active.
+// Files without pollStatus() (e.g., files in a page cache) are always ready.
+// RWF_HIPRI is only a hint since none of our drivers complete I/O by polling.
+async::result<managarm::fs::Errors> checkVectoredRequest(void *object,
+		const FileOperations *file_ops, const managarm::fs::CntRequest &req, int readyEvents) {
+	if(req.iov_sizes_size() > maxVectoredBuffers
+			|| (req.rw_flags() & ~(rwfHighPriority | rwfNoWait)))
+		co_return managarm::fs::Errors::ILLEGAL_ARGUMENT;
+
+	size_t length = 0;
+	for(size_t i = 0; i < req.iov_sizes_size(); i++) {
+		if(req.iov_sizes(i) > maxVectoredLength - length)
+			co_return managarm::fs::Errors::ILLEGAL_ARGUMENT;
+		length += req.iov_sizes(i);
+	}
+
+	if((req.rw_flags() & rwfNoWait) && file_ops->pollStatus) {
+		auto status = co_await file_ops->pollStatus(object);
+		if(status && !(std::get<1>(status.value()) & readyEvents))
+			co_return managarm::fs::Errors::WOULD_BLOCK;
+	}
+	co_return managarm::fs::Errors::SUCCESS;
+}
+
+// Implements PT_READ_ENTRY_BATCH for files that only provide readEntries().
+// Since readEntries() cannot put back entries that do not fit, we only keep
+// reading while an entry with the longest possible name still fits.
+async::result<ReadEntryBatchResult> readEntriesAsBatch(const FileOperations *file_ops,
+		void *object, size_t maxSize) {
+	if(maxSize < direntRecordSize(255))
+		co_return Error::illegalArguments;
+
+	std::vector<DirectoryEntry> entries;
+	size_t size = 0;
+	while(size + direntRecordSize(255) <= maxSize) {
+		auto name = co_await file_ops->readEntries(object);
+		if(!name)
+			break;
+		size += direntRecordSize(name->size());
+		entries.push_back({std::move(*name), 0, FileType::unknown});
+	}
+	co_return std::move(entries);
+}
+
+async::detached handlePassthrough(std::shared_ptr<PassthroughState> state,
+		smarter::shared_ptr<void> file, const FileOperations *file_ops,
+		managarm::fs::CntRequest req, helix::UniqueLane conversation) {
+	if(!state->seekable) {
+		co_await handlePassthroughRequest(std::move(file), file_ops, state->pollId,
+				std::move(req), std::move(conversation));
+		co_return;
+	}
+
+	// This runs synchronously until the lock is taken or queued,
+	// so requests acquire the mutex in the order in which they were accepted.
+	bool ordered = usesFileOffset(req);
+	if(ordered)
+		co_await state->offsetMutex.async_lock();
+
+	co_await handlePassthroughRequest(std::move(file), file_ops, state->pollId,
+			std::move(req), std::move(conversation));
+
+	if(ordered)
+		state->offsetMutex.unlock();
+	state->inFlight--;
+	state->completionEvent.raise();
+}
+
+async::result<void> handlePipelinedRequest(std::shared_ptr<PipelineState> pipeline,
+		smarter::shared_ptr<void> file, const FileOperations *file_ops,
+		managarm::fs::CntRequest req, std::vector<uint8_t> data) {
+	managarm::fs::SvrResponse resp;
+	resp.set_pipeline_tag(req.pipeline_tag());
+
+	std::vector<uint8_t> readBuffer;
+	size_t readLength = 0;
+	bool sendsData = false;
+
+	if(req.req_type() == managarm::fs::CntReqType::SEEK_ABS
+			|| req.req_type() == managarm::fs::CntReqType::SEEK_REL
+			|| req.req_type() == managarm::fs::CntReqType::SEEK_EOF) {
+		auto seek = file_ops->seekAbs;
+		if(req.req_type() == managarm::fs::CntReqType::SEEK_REL)
+			seek = file_ops->seekRel;
+		if(req.req_type() == managarm::fs::CntReqType::SEEK_EOF)
+			seek = file_ops->seekEof;
+
+		if(!seek) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		}else{
+			auto result = co_await seek(file.get(), req.rel_offset());
+			if(auto error = std::get_if<Error>(&result); error) {
+				resp.set_error(static_cast<managarm::fs::Errors>(*error));
+			}else{
+				resp.set_error(managarm::fs::Errors::SUCCESS);
+				resp.set_offset(std::get<int64_t>(result));
+			}
+		}
+	}else if(req.req_type() == managarm::fs::CntReqType::READ) {
+		if(!file_ops->read) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		}else{
+			readBuffer.resize(std::min(size_t(req.size()), maxVectoredLength));
+			auto result = co_await file_ops->read(file.get(), pipeline->credentials.data(),
+					readBuffer.data(), readBuffer.size());
+			if(auto error = std::get_if<Error>(&result); error) {
+				resp.set_error(static_cast<managarm::fs::Errors>(*error));
+			}else{
+				resp.set_error(managarm::fs::Errors::SUCCESS);
+				readLength = std::get<size_t>(result);
+				sendsData = true;
+			}
+		}
+	}else if(req.req_type() == managarm::fs::CntReqType::WRITE) {
+		if(!file_ops->write) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		}else if(size_t(req.size()) > maxVectoredLength) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+		}else{
+			auto result = co_await file_ops->write(file.get(), pipeline->credentials.data(),
+					data.data(), data.size());
+			if(!result) {
+				resp.set_error(static_cast<managarm::fs::Errors>(result.error()));
+			}else{
+				resp.set_error(managarm::fs::Errors::SUCCESS);
+				resp.set_size(result.value());
+			}
+		}
+	}else{
+		std::cout << "protocols/fs: Unexpected request "
+			<< static_cast<unsigned int>(req.req_type())
+			<< " in pipeline" << std::endl;
+		resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+	}
+
+	// Sending fails if the client closed the pipeline in the meantime.
+	co_await pipeline->sendMutex.async_lock();
+	if(sendsData) {
+		auto [send_resp, send_data] = co_await helix_ng::exchangeMsgs(
+			pipeline->lane,
+			helix_ng::sendBragiHeadInline(resp),
+			helix_ng::sendBufferDirect(readBuffer.data(), readLength)
+		);
+		if(send_resp.error() != kHelErrEndOfLane && send_resp.error() != kHelErrLaneShutdown) {
+			HEL_CHECK(send_resp.error());
+			HEL_CHECK(send_data.error());
+		}
+	}else{
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			pipeline->lane,
+			helix_ng::sendBragiHeadInline(resp)
+		);
+		if(send_resp.error() != kHelErrEndOfLane && send_resp.error() != kHelErrLaneShutdown)
+			HEL_CHECK(send_resp.error());
+	}
+	pipeline->sendMutex.unlock();
+}
+
+async::detached handlePipelined(std::shared_ptr<PassthroughState> state,
+		std::shared_ptr<PipelineState> pipeline,
+		smarter::shared_ptr<void> file, const FileOperations *file_ops,
+		managarm::fs::CntRequest req, std::vector<uint8_t> data) {
+	// Same ordering as in handlePassthrough().
+	bool ordered = state->seekable && usesFileOffset(req);
+	if(ordered)
+		co_await state->offsetMutex.async_lock();
+
+	co_await handlePipelinedRequest(std::move(pipeline), std::move(file), file_ops,
+			std::move(req), std::move(data));
+
+	if(ordered)
+		state->offsetMutex.unlock();
+	if(state->seekable) {
+		state->inFlight--;
+		state->completionEvent.raise();
+	}
+}
+
+async::detached servePipeline(std::shared_ptr<PassthroughState> state,
+		smarter::shared_ptr<void> file, const FileOperations *file_ops,
+		helix::UniqueLane conversation) {
+	auto [extract_creds] = co_await helix_ng::exchangeMsgs(
+		conversation,
+		helix_ng::extractCredentials()
+	);
+	HEL_CHECK(extract_creds.error());
+
+	auto pipeline = std::make_shared<PipelineState>();
+	memcpy(pipeline->credentials.data(), extract_creds.credentials(), 16);
+	helix::UniqueLane remoteLane;
+	std::tie(pipeline->lane, remoteLane) = helix::createStream();
+	std::erase_if(state->pipelines, [] (const auto &p) { return p.expired(); });
+	state->pipelines.push_back(pipeline);
+
+	managarm::fs::SvrResponse resp;
+	resp.set_error(managarm::fs::Errors::SUCCESS);
+
+	auto [send_resp, push_lane] = co_await helix_ng::exchangeMsgs(
+		conversation,
+		helix_ng::sendBragiHeadInline(resp),
+		helix_ng::pushDescriptor(remoteLane)
+	);
+	HEL_CHECK(send_resp.error());
+	HEL_CHECK(push_lane.error());
+	remoteLane = {};
+
+	while(true) {
+		// Like servePassthrough(), bound the number of requests of seekable files.
+		if(state->seekable) {
+			while(state->inFlight >= maxRequestsInFlight)
+				co_await state->completionEvent.async_wait();
+		}
+
+		auto [recv_req] = co_await helix_ng::exchangeMsgs(
+			pipeline->lane,
+			helix_ng::recvInline()
+		);
+		if(recv_req.error() == kHelErrEndOfLane || recv_req.error() == kHelErrLaneShutdown)
+			co_return;
+		HEL_CHECK(recv_req.error());
+
+		managarm::fs::CntRequest req;
+		req.ParseFromArray(recv_req.data(), recv_req.length());
+		recv_req.reset();
+
+		// The data of WRITE directly follows the request. If it is larger than our
+		// buffer, both sides fail with bufferTooSmall, which keeps the lane in sync.
+		std::vector<uint8_t> data;
+		if(req.req_type() == managarm::fs::CntReqType::WRITE) {
+			data.resize(std::min(size_t(req.size()), maxVectoredLength));
+			auto [recv_data] = co_await helix_ng::exchangeMsgs(
+				pipeline->lane,
+				helix_ng::recvBuffer(data.data(), data.size())
+			);
+			if(recv_data.error() == kHelErrEndOfLane || recv_data.error() == kHelErrLaneShutdown)
+				co_return;
+			if(recv_data.error() == kHelErrBufferTooSmall) {
+				assert(size_t(req.size()) > maxVectoredLength);
+				data.clear();
+			}else{
+				HEL_CHECK(recv_data.error());
+				data.resize(recv_data.actualLength());
+			}
+		}
+
+		if(state->seekable)
+			state->inFlight++;
+		handlePipelined(state, pipeline, file, file_ops, std::move(req), std::move(data));
+	}
+}
+
+async::result<void> handlePassthroughRequest(smarter::shared_ptr<void> file,
+		const FileOperations *file_ops, uint64_t poll_id,
 		managarm::fs::CntRequest req, helix::UniqueLane conversation) {
 	if(req.req_type() == managarm::fs::CntReqType::SEEK_ABS) {
 		if(!file_ops->seekAbs) {
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -37,10 +397,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 		resp.set_offset(std::get<int64_t>(result));
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::SEEK_REL) {
@@ -48,10 +407,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -68,10 +426,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			resp.set_offset(std::get<int64_t>(result));
 		}
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::SEEK_EOF) {
@@ -79,10 +436,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -93,10 +449,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 		resp.set_offset(std::get<int64_t>(result));
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::READ) {
@@ -110,10 +465,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -129,30 +483,27 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		if(error && *error == Error::wouldBlock) {
 			resp.set_error(managarm::fs::Errors::WOULD_BLOCK);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 		}else if(error && *error == Error::illegalArguments) {
 			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 		}else{
 			assert(!error);
 			resp.set_error(managarm::fs::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp, send_data] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size()),
-				helix_ng::sendBuffer(data.data(), std::get<size_t>(res))
+				helix_ng::sendBragiHeadInline(resp),
+				helix_ng::sendBufferDirect(data.data(), std::get<size_t>(res))
 			);
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(send_data.error());
@@ -168,10 +519,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -187,30 +537,27 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		if(error && *error == Error::wouldBlock) {
 			resp.set_error(managarm::fs::Errors::WOULD_BLOCK);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 		}else if(error && *error == Error::illegalArguments) {
 			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 		}else{
 			assert(!error);
 			resp.set_error(managarm::fs::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp, send_data] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size()),
-				helix_ng::sendBuffer(data.data(), std::get<size_t>(res))
+				helix_ng::sendBragiHeadInline(resp),
+				helix_ng::sendBufferDirect(data.data(), std::get<size_t>(res))
 			);
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(send_data.error());
@@ -231,10 +578,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -249,36 +595,240 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 				resp.set_error(managarm::fs::Errors::NO_SPACE_LEFT);
 			} else if(res.error() == Error::wouldBlock) {
 				resp.set_error(managarm::fs::Errors::WOULD_BLOCK);
+			} else if(res.error() == Error::brokenPipe) {
+				resp.set_error(managarm::fs::Errors::BROKEN_PIPE);
 			} else {
 				std::cout << "Unknown error from write()" << std::endl;
 				co_return;
 			}	
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
+			);
+			HEL_CHECK(send_resp.error());
+		}else{
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+			resp.set_size(res.value());
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadInline(resp)
+			);
+			HEL_CHECK(send_resp.error());
+		}
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_WRITE_FROM_MEMORY) {
+		auto [extract_creds, pull_memory] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::extractCredentials(),
+			helix_ng::pullDescriptor()
+		);
+		HEL_CHECK(extract_creds.error());
+		HEL_CHECK(pull_memory.error());
+
+		if(!file_ops->write || req.offset() < 0 || req.size() <= 0) {
+			managarm::fs::SvrResponse resp;
+			resp.set_error(file_ops->write ? managarm::fs::Errors::ILLEGAL_ARGUMENT
+					: managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
+			co_return;
+		}
+
+		// The data is written directly from the sender's memory object (e.g., the page cache
+		// of another file system server); it is never copied through the sender.
+		size_t misalign = req.offset() & 0xFFF;
+		size_t mapSize = (misalign + req.size() + 0xFFF) & ~size_t(0xFFF);
+		helix::Mapping window{pull_memory.descriptor(),
+				static_cast<ptrdiff_t>(req.offset() - misalign), mapSize, kHelMapProtRead};
+
+		auto res = co_await file_ops->write(file.get(), extract_creds.credentials(),
+				reinterpret_cast<char *>(window.get()) + misalign, req.size());
+
+		managarm::fs::SvrResponse resp;
+		if(!res) {
+			if(res.error() == Error::noSpaceLeft) {
+				resp.set_error(managarm::fs::Errors::NO_SPACE_LEFT);
+			}else if(res.error() == Error::wouldBlock) {
+				resp.set_error(managarm::fs::Errors::WOULD_BLOCK);
+			}else if(res.error() == Error::brokenPipe) {
+				resp.set_error(managarm::fs::Errors::BROKEN_PIPE);
+			}else{
+				resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+			}
 		}else{
 			resp.set_error(managarm::fs::Errors::SUCCESS);
 			resp.set_size(res.value());
+		}
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp)
+		);
+		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_PREADV) {
+		auto [extract_creds] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::extractCredentials()
+		);
+		HEL_CHECK(extract_creds.error());
+
+		managarm::fs::SvrResponse resp;
+		if(req.offset() < 0 ? !file_ops->read : !file_ops->pread) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		}else{
+			resp.set_error(co_await checkVectoredRequest(file.get(), file_ops, req, EPOLLIN));
+		}
+		if(resp.error() != managarm::fs::Errors::SUCCESS) {
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadInline(resp)
+			);
+			HEL_CHECK(send_resp.error());
+			co_return;
+		}
+
+		// Read everything with a single call; the data is then split into the client's buffers.
+		size_t length = 0;
+		for(size_t i = 0; i < req.iov_sizes_size(); i++)
+			length += req.iov_sizes(i);
+
+		std::string data;
+		data.resize(length);
+		ReadResult res = size_t{0};
+		if(length) {
+			if(req.offset() < 0) {
+				res = co_await file_ops->read(file.get(), extract_creds.credentials(),
+						data.data(), length);
+			}else{
+				res = co_await file_ops->pread(file.get(), req.offset(),
+						extract_creds.credentials(), data.data(), length);
+			}
+		}
+
+		auto error = std::get_if<Error>(&res);
+		if(error) {
+			if(*error == Error::wouldBlock) {
+				resp.set_error(managarm::fs::Errors::WOULD_BLOCK);
+			}else{
+				assert(*error == Error::illegalArguments);
+				resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+			}
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadInline(resp)
+			);
+			HEL_CHECK(send_resp.error());
+			co_return;
+		}
+
+		size_t size = std::get<size_t>(res);
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+		resp.set_size(size);
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp)
+		);
+		HEL_CHECK(send_resp.error());
+
+		// The client posts one receive per buffer; buffers after a short read stay empty.
+		size_t progress = 0;
+		for(size_t i = 0; i < req.iov_sizes_size(); i++) {
+			auto chunk = std::min<size_t>(req.iov_sizes(i), size - progress);
+			auto [send_data] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBufferDirect(data.data() + progress, chunk)
+			);
+			HEL_CHECK(send_data.error());
+			progress += chunk;
+		}
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_PWRITEV) {
+		auto [extract_creds] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::extractCredentials()
+		);
+		HEL_CHECK(extract_creds.error());
 
-			auto ser = resp.SerializeAsString();
+		// Check the limits before we allocate the buffer.
+		managarm::fs::SvrResponse resp;
+		if(req.offset() >= 0) {
+			// There is no positional write operation (yet).
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		}else if(req.iov_sizes_size() > maxVectoredBuffers) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+		}
+		size_t length = 0;
+		for(size_t i = 0; i < req.iov_sizes_size(); i++) {
+			if(req.iov_sizes(i) > maxVectoredLength - length) {
+				resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+				break;
+			}
+			length += req.iov_sizes(i);
+		}
+		if(resp.error() != managarm::fs::Errors::SUCCESS) {
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
+			co_return;
+		}
+
+		std::vector<uint8_t> buffer;
+		buffer.resize(length);
+		size_t progress = 0;
+		for(size_t i = 0; i < req.iov_sizes_size(); i++) {
+			auto [recv_data] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::recvBuffer(buffer.data() + progress, req.iov_sizes(i))
+			);
+			HEL_CHECK(recv_data.error());
+			progress += recv_data.actualLength();
+		}
+
+		if(!file_ops->write) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		}else{
+			resp.set_error(co_await checkVectoredRequest(file.get(), file_ops, req, EPOLLOUT));
+		}
+
+		// All buffers are passed to a single write(); for sockets, they form a single send.
+		if(resp.error() == managarm::fs::Errors::SUCCESS && progress) {
+			auto res = co_await file_ops->write(file.get(), extract_creds.credentials(),
+					buffer.data(), progress);
+			if(!res) {
+				if(res.error() == Error::noSpaceLeft) {
+					resp.set_error(managarm::fs::Errors::NO_SPACE_LEFT);
+				}else if(res.error() == Error::wouldBlock) {
+					resp.set_error(managarm::fs::Errors::WOULD_BLOCK);
+				}else if(res.error() == Error::brokenPipe) {
+					resp.set_error(managarm::fs::Errors::BROKEN_PIPE);
+				}else{
+					resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+				}
+			}else{
+				resp.set_size(res.value());
+			}
 		}
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp)
+		);
+		HEL_CHECK(send_resp.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::FLOCK) {
 		if(!file_ops->flock) {
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -294,10 +844,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			resp.set_error(managarm::fs::Errors::SUCCESS);
 		}
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::PT_READ_ENTRIES) {
@@ -305,10 +854,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -323,6 +871,76 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			resp.set_error(managarm::fs::Errors::END_OF_FILE);
 		}
 
+		auto ser = resp.SerializeAsString();
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBuffer(ser.data(), ser.size()));
+		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_READ_ENTRY_BATCH
+			|| req.req_type() == managarm::fs::CntReqType::PT_READ_ENTRIES_PLUS) {
+		// Stats are only available from servers that implement readEntryBatch().
+		bool withStats = req.req_type() == managarm::fs::CntReqType::PT_READ_ENTRIES_PLUS;
+		if(!file_ops->readEntryBatch && (withStats || !file_ops->readEntries)) {
+			managarm::fs::SvrResponse resp;
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadInline(resp)
+			);
+			HEL_CHECK(send_resp.error());
+			co_return;
+		}
+
+		size_t maxSize = req.size() > 0 ? req.size() : 0;
+		auto result = co_await (file_ops->readEntryBatch
+				? file_ops->readEntryBatch(file.get(), maxSize, withStats)
+				: readEntriesAsBatch(file_ops, file.get(), maxSize));
+
+		managarm::fs::SvrResponse resp;
+		if(!result) {
+			assert(result.error() == Error::illegalArguments);
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+		}else if(result.value().empty()) {
+			resp.set_error(managarm::fs::Errors::END_OF_FILE);
+		}else{
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+			for(auto &entry : result.value()) {
+				resp.add_entry_names(std::move(entry.name));
+				resp.add_entry_inodes(entry.inode);
+				switch(entry.type) {
+				case FileType::directory:
+					resp.add_entry_types(managarm::fs::FileType::DIRECTORY);
+					break;
+				case FileType::regular:
+					resp.add_entry_types(managarm::fs::FileType::REGULAR);
+					break;
+				case FileType::symlink:
+					resp.add_entry_types(managarm::fs::FileType::SYMLINK);
+					break;
+				default:
+					resp.add_entry_types(0);
+				}
+
+				if(withStats) {
+					assert(entry.stats);
+					managarm::fs::EntryStats stats;
+					stats.set_file_size(entry.stats->fileSize);
+					stats.set_num_links(entry.stats->linkCount);
+					stats.set_mode(entry.stats->mode);
+					stats.set_uid(entry.stats->uid);
+					stats.set_gid(entry.stats->gid);
+					stats.set_atime_secs(entry.stats->accessTime.tv_sec);
+					stats.set_atime_nanos(entry.stats->accessTime.tv_nsec);
+					stats.set_mtime_secs(entry.stats->dataModifyTime.tv_sec);
+					stats.set_mtime_nanos(entry.stats->dataModifyTime.tv_nsec);
+					stats.set_ctime_secs(entry.stats->anyChangeTime.tv_sec);
+					stats.set_ctime_nanos(entry.stats->anyChangeTime.tv_nsec);
+					resp.add_entry_stats(std::move(stats));
+				}
+			}
+		}
+
 		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
@@ -333,10 +951,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -347,10 +964,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		managarm::fs::SvrResponse resp;
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp, push_memory] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size()),
+			helix_ng::sendBragiHeadInline(resp),
 			helix_ng::pushDescriptor(memory)
 		);
 		HEL_CHECK(send_resp.error());
@@ -360,10 +976,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -374,24 +989,37 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		if(result) {
 			resp.set_error(managarm::fs::Errors::SUCCESS);
 		}else{
-			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+			resp.set_error(static_cast<managarm::fs::Errors>(result.error()));
 		}
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
-	}else if(req.req_type() == managarm::fs::CntReqType::PT_FALLOCATE) {
-		if(!file_ops->fallocate) {
-			managarm::fs::SvrResponse resp;
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_FSYNC) {
+		managarm::fs::SvrResponse resp;
+		if(!file_ops->sync) {
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
-
-			auto ser = resp.SerializeAsString();
+		}else if(auto result = co_await file_ops->sync(file.get()); !result) {
+			resp.set_error(static_cast<managarm::fs::Errors>(result.error()));
+		}else{
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+		}
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp)
+		);
+		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_FALLOCATE) {
+		if(!file_ops->fallocate) {
+			managarm::fs::SvrResponse resp;
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -401,10 +1029,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		managarm::fs::SvrResponse resp;
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::PT_IOCTL) {
@@ -421,10 +1048,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -435,10 +1061,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 		resp.set_pid(result);
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::PT_SET_OPTION) {
@@ -446,10 +1071,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -459,10 +1083,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		managarm::fs::SvrResponse resp;
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::FILE_POLL_WAIT) {
@@ -476,10 +1099,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -492,10 +1114,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(static_cast<managarm::fs::Errors>(resultOrError.error()));
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -508,10 +1129,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_sequence(std::get<0>(result));
 		resp.set_edges(std::get<1>(result));
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::FILE_POLL_STATUS) {
@@ -519,10 +1139,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -533,10 +1152,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(static_cast<managarm::fs::Errors>(resultOrError.error()));
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -548,13 +1166,48 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 		resp.set_sequence(std::get<0>(result));
 		resp.set_status(std::get<1>(result));
+		resp.set_poll_server(pollServerId());
+		resp.set_poll_id(poll_id);
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::FILE_POLL_STATUS_BATCH) {
+		managarm::fs::SvrResponse resp;
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+		for(size_t i = 0; i < req.poll_ids_size(); i++) {
+			auto it = pollTargets.find(req.poll_ids(i));
+			if(it == pollTargets.end() || !it->second.fileOps->pollStatus) {
+				resp.add_poll_errors(static_cast<int32_t>(it == pollTargets.end()
+						? managarm::fs::Errors::ILLEGAL_ARGUMENT
+						: managarm::fs::Errors::ILLEGAL_OPERATION_TARGET));
+				resp.add_poll_sequences(0);
+				resp.add_poll_statuses(0);
+				continue;
+			}
+			// Take a reference since the file may be closed while we wait for pollStatus().
+			auto target = it->second;
+
+			auto resultOrError = co_await target.fileOps->pollStatus(target.file.get());
+			if(!resultOrError) {
+				resp.add_poll_errors(static_cast<int32_t>(resultOrError.error()));
+				resp.add_poll_sequences(0);
+				resp.add_poll_statuses(0);
+				continue;
+			}
+
+			resp.add_poll_errors(static_cast<int32_t>(managarm::fs::Errors::SUCCESS));
+			resp.add_poll_sequences(std::get<0>(resultOrError.value()));
+			resp.add_poll_statuses(std::get<1>(resultOrError.value()));
+		}
+
+		auto ser = resp.SerializeAsString();
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBuffer(ser.data(), ser.size()));
+		HEL_CHECK(send_resp.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::PT_BIND) {
 		auto [extract_creds, recv_addr] = co_await helix_ng::exchangeMsgs(
 			conversation,
@@ -568,10 +1221,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -585,10 +1237,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		managarm::fs::SvrResponse resp;
 		resp.set_error(static_cast<managarm::fs::Errors>(error));
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::PT_CONNECT) {
@@ -604,10 +1255,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -621,10 +1271,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		managarm::fs::SvrResponse resp;
 		resp.set_error(static_cast<managarm::fs::Errors>(error));
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::PT_SOCKNAME) {
@@ -632,10 +1281,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -650,10 +1298,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 		resp.set_file_size(actual_length);
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp, send_data] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size()),
+			helix_ng::sendBragiHeadInline(resp),
 			helix_ng::sendBuffer(addr.data(),
 					std::min(size_t(req.size()), actual_length))
 		);
@@ -675,10 +1322,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(static_cast<managarm::fs::Errors>(result.error()));
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 
@@ -692,10 +1338,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 		resp.set_file_size(actual_length);
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp, send_data] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size()),
+			helix_ng::sendBragiHeadInline(resp),
 			helix_ng::sendBuffer(addr.data(),
 					std::min(size_t(req.size()), actual_length))
 		);
@@ -706,10 +1351,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -721,10 +1365,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 		resp.set_flags(flags);
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::PT_SET_FILE_FLAGS) {
@@ -732,10 +1375,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -746,10 +1388,40 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		managarm::fs::SvrResponse resp;
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
+		);
+		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_ADD_SEALS) {
+		managarm::fs::SvrResponse resp;
+		if(!file_ops->addSeals) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		}else if(auto result = co_await file_ops->addSeals(file.get(), req.flags()); !result) {
+			resp.set_error(static_cast<managarm::fs::Errors>(result.error()));
+		}else{
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+		}
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp)
+		);
+		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_GET_SEALS) {
+		managarm::fs::SvrResponse resp;
+		if(!file_ops->getSeals) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		}else if(auto result = co_await file_ops->getSeals(file.get()); !result) {
+			resp.set_error(static_cast<managarm::fs::Errors>(result.error()));
+		}else{
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+			resp.set_flags(result.value());
+		}
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::PT_LISTEN) {
@@ -757,10 +1429,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -771,12 +1442,47 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		managarm::fs::SvrResponse resp;
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
+		);
+		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_ACCEPT) {
+		if(!file_ops->accept) {
+			managarm::fs::SvrResponse resp;
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadInline(resp)
+			);
+			HEL_CHECK(send_resp.error());
+			co_return;
+		}
+
+		auto result = co_await file_ops->accept(file.get());
+		if(!result) {
+			managarm::fs::SvrResponse resp;
+			resp.set_error(static_cast<managarm::fs::Errors>(result.error()));
+
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadInline(resp)
+			);
+			HEL_CHECK(send_resp.error());
+			co_return;
+		}
+
+		managarm::fs::SvrResponse resp;
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+
+		auto [send_resp, push_lane] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp),
+			helix_ng::pushDescriptor(result.value())
 		);
 		HEL_CHECK(send_resp.error());
+		HEL_CHECK(push_lane.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::PT_RECVMSG) {
 		auto [extract_creds] = co_await helix_ng::exchangeMsgs(
 			conversation,
@@ -788,10 +1494,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -814,10 +1519,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		if (error) {
 			resp.set_error(static_cast<managarm::fs::Errors>(*error));
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -856,10 +1560,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
 			co_return;
@@ -880,10 +1583,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			if(res.error() == Error::wouldBlock) {
 				resp.set_error(managarm::fs::Errors::WOULD_BLOCK);
 
-				auto ser = resp.SerializeAsString();
 				auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size())
+					helix_ng::sendBragiHeadInline(resp)
 				);
 				HEL_CHECK(send_resp.error());
 			} else {
@@ -895,10 +1597,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		resp.set_error(managarm::fs::Errors::SUCCESS);
 		resp.set_size(res.value());
 
-		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
-			helix_ng::sendBuffer(ser.data(), ser.size())
+			helix_ng::sendBragiHeadInline(resp)
 		);
 		HEL_CHECK(send_resp.error());
 	} else {
@@ -939,7 +1640,17 @@ async::result<void> servePassthrough(helix::UniqueLane lane,
 		HEL_CHECK(helShutdownLane(lane.getHandle()));
 	}};
 
+	auto state = std::make_shared<PassthroughState>();
+	state->seekable = file_ops->seekAbs || file_ops->seekRel || file_ops->seekEof;
+	state->pollId = nextPollId++;
+	pollTargets.insert({state->pollId, PollTarget{file, file_ops}});
+
 	while(true) {
+		if(state->seekable) {
+			while(state->inFlight >= maxRequestsInFlight)
+				co_await state->completionEvent.async_wait();
+		}
+
 		auto [accept, recv_req] = co_await helix_ng::exchangeMsgs(
 			lane,
 			helix_ng::accept(
@@ -948,8 +1659,14 @@ async::result<void> servePassthrough(helix::UniqueLane lane,
 
 		// TODO: Handle end-of-lane correctly. Why does it even happen here?
 		if(accept.error() == kHelErrLaneShutdown
-				|| accept.error() == kHelErrEndOfLane)
+				|| accept.error() == kHelErrEndOfLane) {
+			pollTargets.erase(state->pollId);
+			for(auto &weakPipeline : state->pipelines) {
+				if(auto pipeline = weakPipeline.lock(); pipeline)
+					HEL_CHECK(helShutdownLane(pipeline->lane.getHandle()));
+			}
 			co_return;
+		}
 
 		HEL_CHECK(accept.error());
 		HEL_CHECK(recv_req.error());
@@ -958,7 +1675,14 @@ async::result<void> servePassthrough(helix::UniqueLane lane,
 		managarm::fs::CntRequest req;
 		req.ParseFromArray(recv_req.data(), recv_req.length());
 		recv_req.reset();
-		handlePassthrough(file, file_ops, std::move(req), std::move(conversation));
+		if(req.req_type() == managarm::fs::CntReqType::PT_OPEN_PIPELINE) {
+			servePipeline(state, file, file_ops, std::move(conversation));
+			continue;
+		}
+
+		if(state->seekable)
+			state->inFlight++;
+		handlePassthrough(state, file, file_ops, std::move(req), std::move(conversation));
 	}
 }
 
@@ -971,6 +1695,19 @@ StatusPageProvider::StatusPageProvider() {
 	_mapping = helix::Mapping{_memory, 0, page_size};
 }
 
+AttributeGenerationProvider::AttributeGenerationProvider() {
+	size_t size = (numAttributeGenerations * sizeof(uint64_t) + 0xFFF) & ~size_t(0xFFF);
+	HelHandle handle;
+	HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
+	_memory = helix::UniqueDescriptor{handle};
+	_mapping = helix::Mapping{_memory, 0, size};
+}
+
+void AttributeGenerationProvider::bump(uint64_t inode) {
+	auto generations = reinterpret_cast<uint64_t *>(_mapping.get());
+	__atomic_fetch_add(&generations[attributeGenerationSlot(inode)], 1, __ATOMIC_RELEASE);
+}
+
 void StatusPageProvider::update(uint64_t sequence, int status) {
 	auto page = reinterpret_cast<protocols::fs::StatusPage *>(_mapping.get());
 
@@ -988,132 +1725,56 @@ void StatusPageProvider::update(uint64_t sequence, int status) {
 	__atomic_store_n(&page->seqlock, seqlock + 2, __ATOMIC_RELEASE);
 }
 
-async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
-		const NodeOperations *node_ops) {
-	while(true) {
-		auto [accept, recv_req] = co_await helix_ng::exchangeMsgs(
-			lane,
-			helix_ng::accept(
-				helix_ng::recvInline())
-		);
-		if(accept.error() == kHelErrEndOfLane)
-			co_return;
-
-		HEL_CHECK(accept.error());
-		HEL_CHECK(recv_req.error());
+namespace {
 
-		auto conversation = accept.descriptor();
+async::result<void> handleNodeRequest(std::shared_ptr<void> &node, const NodeOperations *node_ops,
+		managarm::fs::CntRequest &req, helix::UniqueDescriptor conversation) {
+	if(req.req_type() == managarm::fs::CntReqType::NODE_GET_STATS) {
+		assert(node_ops->getStats);
+		auto result = co_await node_ops->getStats(node);
 
-		managarm::fs::CntRequest req;
-		req.ParseFromArray(recv_req.data(), recv_req.length());
-		recv_req.reset();
-		if(req.req_type() == managarm::fs::CntReqType::NODE_GET_STATS) {
-			assert(node_ops->getStats);
-			auto result = co_await node_ops->getStats(node);
+		managarm::fs::SvrResponse resp;
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+		resp.set_file_size(result.fileSize);
+		resp.set_num_links(result.linkCount);
+		resp.set_mode(result.mode);
+		resp.set_uid(result.uid);
+		resp.set_gid(result.gid);
+		resp.set_atime_secs(result.accessTime.tv_sec);
+		resp.set_atime_nanos(result.accessTime.tv_nsec);
+		resp.set_mtime_secs(result.dataModifyTime.tv_sec);
+		resp.set_mtime_nanos(result.dataModifyTime.tv_nsec);
+		resp.set_ctime_secs(result.anyChangeTime.tv_sec);
+		resp.set_ctime_nanos(result.anyChangeTime.tv_nsec);
 
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp)
+		);
+		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::NODE_GET_LINK) {
+		auto result = co_await node_ops->getLink(node, req.path());
+		if(!result) {
 			managarm::fs::SvrResponse resp;
-			resp.set_error(managarm::fs::Errors::SUCCESS);
-			resp.set_file_size(result.fileSize);
-			resp.set_num_links(result.linkCount);
-			resp.set_mode(result.mode);
-			resp.set_uid(result.uid);
-			resp.set_gid(result.gid);
-			resp.set_atime_secs(result.accessTime.tv_sec);
-			resp.set_atime_nanos(result.accessTime.tv_nsec);
-			resp.set_mtime_secs(result.dataModifyTime.tv_sec);
-			resp.set_mtime_nanos(result.dataModifyTime.tv_nsec);
-			resp.set_ctime_secs(result.anyChangeTime.tv_sec);
-			resp.set_ctime_nanos(result.anyChangeTime.tv_nsec);
-
-			auto ser = resp.SerializeAsString();
+			assert(result.error() == protocols::fs::Error::notDirectory);
+			resp.set_error(managarm::fs::Errors::NOT_DIRECTORY);
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
-		}else if(req.req_type() == managarm::fs::CntReqType::NODE_GET_LINK) {
-			auto result = co_await node_ops->getLink(node, req.path());
-			if(!result) {
-				managarm::fs::SvrResponse resp;
-				assert(result.error() == protocols::fs::Error::notDirectory);
-				resp.set_error(managarm::fs::Errors::NOT_DIRECTORY);
-				auto ser = resp.SerializeAsString();
-				auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size())
-				);
-				HEL_CHECK(send_resp.error());
-				continue;
-			}
-
-			if(std::get<0>(result.value())) {
-				helix::UniqueLane local_lane, remote_lane;
-				std::tie(local_lane, remote_lane) = helix::createStream();
-				serveNode(std::move(local_lane), std::move(std::get<0>(result.value())), node_ops);
-
-				managarm::fs::SvrResponse resp;
-				resp.set_error(managarm::fs::Errors::SUCCESS);
-				resp.set_id(std::get<1>(result.value()));
-				switch(std::get<2>(result.value())) {
-				case FileType::directory:
-					resp.set_file_type(managarm::fs::FileType::DIRECTORY);
-					break;
-				case FileType::regular:
-					resp.set_file_type(managarm::fs::FileType::REGULAR);
-					break;
-				case FileType::symlink:
-					resp.set_file_type(managarm::fs::FileType::SYMLINK);
-					break;
-				default:
-					throw std::runtime_error("Unexpected file type");
-				}
-
-				auto ser = resp.SerializeAsString();
-				auto [send_resp, push_node] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size()),
-					helix_ng::pushDescriptor(remote_lane)
-				);
-				HEL_CHECK(send_resp.error());
-				HEL_CHECK(push_node.error());
-			}else{
-				managarm::fs::SvrResponse resp;
-				resp.set_error(managarm::fs::Errors::FILE_NOT_FOUND);
-
-				auto ser = resp.SerializeAsString();
-				auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size())
-				);
-				HEL_CHECK(send_resp.error());
-			}
-		}else if(req.req_type() == managarm::fs::CntReqType::NODE_TRAVERSE_LINKS) {
-			auto result = co_await node_ops->traverseLinks(node, std::deque(req.path_segments().begin(), req.path_segments().end()));
-
-			if (!result) {
-				managarm::fs::SvrResponse resp;
-				if (result.error() == protocols::fs::Error::notDirectory) {
-					resp.set_error(managarm::fs::Errors::NOT_DIRECTORY);
-				} else {
-					assert(result.error() == protocols::fs::Error::fileNotFound);
-					resp.set_error(managarm::fs::Errors::FILE_NOT_FOUND);
-				}
-
-				auto ser = resp.SerializeAsString();
-				auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size())
-				);
-				HEL_CHECK(send_resp.error());
-				continue;
-			}
+			co_return;
+		}
 
-			auto [nodes, type, processedComponents] = result.value();
+		if(std::get<0>(result.value())) {
+			helix::UniqueLane local_lane, remote_lane;
+			std::tie(local_lane, remote_lane) = helix::createStream();
+			serveNode(std::move(local_lane), std::move(std::get<0>(result.value())), node_ops);
 
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::SUCCESS);
-			resp.set_links_traversed(processedComponents);
-			switch(type) {
+			resp.set_id(std::get<1>(result.value()));
+			switch(std::get<2>(result.value())) {
 			case FileType::directory:
 				resp.set_file_type(managarm::fs::FileType::DIRECTORY);
 				break;
@@ -1127,268 +1788,338 @@ async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
 				throw std::runtime_error("Unexpected file type");
 			}
 
-			// TODO: this is a workaround for not being able to get the offer lane on the offer side
-			helix::UniqueLane local_push, remote_push;
-			std::tie(local_push, remote_push) = helix::createStream();
-
-			for (auto &[_, id] : nodes) {
-				resp.add_ids(id);
-			}
-
-			auto ser = resp.SerializeAsString();
-			auto [send_resp, push_desc] = co_await helix_ng::exchangeMsgs(
+			auto [send_resp, push_node] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size()),
-				helix_ng::pushDescriptor(remote_push)
+				helix_ng::sendBragiHeadInline(resp),
+				helix_ng::pushDescriptor(remote_lane)
 			);
-
 			HEL_CHECK(send_resp.error());
-			HEL_CHECK(push_desc.error());
-
-			for (auto &[node, _] : nodes) {
-				helix::UniqueLane local_lane, remote_lane;
-				std::tie(local_lane, remote_lane) = helix::createStream();
-				serveNode(std::move(local_lane), std::move(node), node_ops);
+			HEL_CHECK(push_node.error());
+		}else{
+			managarm::fs::SvrResponse resp;
+			resp.set_error(managarm::fs::Errors::FILE_NOT_FOUND);
 
-				auto [push_node] = co_await helix_ng::exchangeMsgs(
-					local_push,
-					helix_ng::pushDescriptor(remote_lane)
-				);
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadInline(resp)
+			);
+			HEL_CHECK(send_resp.error());
+		}
+	}else if(req.req_type() == managarm::fs::CntReqType::NODE_TRAVERSE_LINKS) {
+		auto result = co_await node_ops->traverseLinks(node, std::deque(req.path_segments().begin(), req.path_segments().end()));
 
-				HEL_CHECK(push_node.error());
+		if (!result) {
+			managarm::fs::SvrResponse resp;
+			if (result.error() == protocols::fs::Error::notDirectory) {
+				resp.set_error(managarm::fs::Errors::NOT_DIRECTORY);
+			} else {
+				assert(result.error() == protocols::fs::Error::fileNotFound);
+				resp.set_error(managarm::fs::Errors::FILE_NOT_FOUND);
 			}
-		}else if(req.req_type() == managarm::fs::CntReqType::NODE_MKDIR) {
-			auto result = co_await node_ops->mkdir(node, req.path());
 
-			if (std::get<0>(result)) {
-				helix::UniqueLane local_lane, remote_lane;
-				std::tie(local_lane, remote_lane) = helix::createStream();
-				serveNode(std::move(local_lane), std::move(std::get<0>(result)), node_ops);
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadInline(resp)
+			);
+			HEL_CHECK(send_resp.error());
+			co_return;
+		}
 
-				managarm::fs::SvrResponse resp;
-				resp.set_error(managarm::fs::Errors::SUCCESS);
-				resp.set_id(std::get<1>(result));
+		auto [nodes, type, processedComponents] = result.value();
 
-				auto ser = resp.SerializeAsString();
-				auto [send_resp, push_node] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size()),
-					helix_ng::pushDescriptor(remote_lane)
-				);
-				HEL_CHECK(send_resp.error());
-				HEL_CHECK(push_node.error());
-			}else{
-				managarm::fs::SvrResponse resp;
-				resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT); // TODO
+		managarm::fs::SvrResponse resp;
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+		resp.set_links_traversed(processedComponents);
+		switch(type) {
+		case FileType::directory:
+			resp.set_file_type(managarm::fs::FileType::DIRECTORY);
+			break;
+		case FileType::regular:
+			resp.set_file_type(managarm::fs::FileType::REGULAR);
+			break;
+		case FileType::symlink:
+			resp.set_file_type(managarm::fs::FileType::SYMLINK);
+			break;
+		default:
+			throw std::runtime_error("Unexpected file type");
+		}
 
-				auto ser = resp.SerializeAsString();
-				auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size())
-				);
-				HEL_CHECK(send_resp.error());
-			}
-		}else if(req.req_type() == managarm::fs::CntReqType::NODE_SYMLINK) {
-			std::string name;
-			std::string target;
-			name.resize(req.name_length());
-			target.resize(req.target_length());
+		// TODO: this is a workaround for not being able to get the offer lane on the offer side
+		helix::UniqueLane local_push, remote_push;
+		std::tie(local_push, remote_push) = helix::createStream();
 
-			auto [recvName, recvTarget] = co_await helix_ng::exchangeMsgs(
-				conversation,
-				helix_ng::recvBuffer(name.data(), name.size()),
-				helix_ng::recvBuffer(target.data(), target.size())
-			);
-			HEL_CHECK(recvName.error());
-			HEL_CHECK(recvTarget.error());
+		for (auto &[_, id] : nodes) {
+			resp.add_ids(id);
+		}
 
-			auto result = co_await node_ops->symlink(node, std::move(name), std::move(target));
+		auto ser = resp.SerializeAsString();
+		auto [send_resp, push_desc] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBuffer(ser.data(), ser.size()),
+			helix_ng::pushDescriptor(remote_push)
+		);
 
-			if (std::get<0>(result)) {
-				helix::UniqueLane local_lane, remote_lane;
-				std::tie(local_lane, remote_lane) = helix::createStream();
-				serveNode(std::move(local_lane), std::move(std::get<0>(result)), node_ops);
+		HEL_CHECK(send_resp.error());
+		HEL_CHECK(push_desc.error());
 
-				managarm::fs::SvrResponse resp;
-				resp.set_error(managarm::fs::Errors::SUCCESS);
-				resp.set_id(std::get<1>(result));
+		for (auto &[node, _] : nodes) {
+			helix::UniqueLane local_lane, remote_lane;
+			std::tie(local_lane, remote_lane) = helix::createStream();
+			serveNode(std::move(local_lane), std::move(node), node_ops);
 
-				auto ser = resp.SerializeAsString();
-				auto [sendResp, pushNode] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size()),
-					helix_ng::pushDescriptor(remote_lane)
-				);
-				HEL_CHECK(sendResp.error());
-				HEL_CHECK(pushNode.error());
-			}else{
-				managarm::fs::SvrResponse resp;
-				resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT); // TODO
+			auto [push_node] = co_await helix_ng::exchangeMsgs(
+				local_push,
+				helix_ng::pushDescriptor(remote_lane)
+			);
 
-				auto ser = resp.SerializeAsString();
-				auto [sendResp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size())
-				);
-				HEL_CHECK(sendResp.error());
-			}
-		}else if(req.req_type() == managarm::fs::CntReqType::NODE_LINK) {
-			auto result = co_await node_ops->link(node, req.path(), req.fd());
-			if(std::get<0>(result)) {
-				helix::UniqueLane local_lane, remote_lane;
-				std::tie(local_lane, remote_lane) = helix::createStream();
-				serveNode(std::move(local_lane), std::move(std::get<0>(result)), node_ops);
-
-				managarm::fs::SvrResponse resp;
-				resp.set_error(managarm::fs::Errors::SUCCESS);
-				resp.set_id(std::get<1>(result));
-				switch(std::get<2>(result)) {
-				case FileType::directory:
-					resp.set_file_type(managarm::fs::FileType::DIRECTORY);
-					break;
-				case FileType::regular:
-					resp.set_file_type(managarm::fs::FileType::REGULAR);
-					break;
-				case FileType::symlink:
-					resp.set_file_type(managarm::fs::FileType::SYMLINK);
-					break;
-				default:
-					throw std::runtime_error("Unexpected file type");
-				}
+			HEL_CHECK(push_node.error());
+		}
+	}else if(req.req_type() == managarm::fs::CntReqType::NODE_MKDIR) {
+		auto result = co_await node_ops->mkdir(node, req.path());
 
-				auto ser = resp.SerializeAsString();
-				auto [send_resp, push_node] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size()),
-					helix_ng::pushDescriptor(remote_lane)
-				);
-				HEL_CHECK(send_resp.error());
-				HEL_CHECK(push_node.error());
-			}else{
-				managarm::fs::SvrResponse resp;
-				resp.set_error(managarm::fs::Errors::FILE_NOT_FOUND);
+		if (std::get<0>(result)) {
+			helix::UniqueLane local_lane, remote_lane;
+			std::tie(local_lane, remote_lane) = helix::createStream();
+			serveNode(std::move(local_lane), std::move(std::get<0>(result)), node_ops);
 
-				auto ser = resp.SerializeAsString();
-				auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size())
-				);
-				HEL_CHECK(send_resp.error());
-			}
-		}else if(req.req_type() == managarm::fs::CntReqType::NODE_UNLINK) {
-			auto result = co_await node_ops->unlink(node, req.path());
 			managarm::fs::SvrResponse resp;
-			if(!result) {
-				assert(result.error() == protocols::fs::Error::fileNotFound);
-				resp.set_error(managarm::fs::Errors::FILE_NOT_FOUND);
-				auto ser = resp.SerializeAsString();
-				auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size())
-				);
-				HEL_CHECK(send_resp.error());
-				continue;
-			}
 			resp.set_error(managarm::fs::Errors::SUCCESS);
+			resp.set_id(std::get<1>(result));
 
-			auto ser = resp.SerializeAsString();
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			auto [send_resp, push_node] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp),
+				helix_ng::pushDescriptor(remote_lane)
 			);
 			HEL_CHECK(send_resp.error());
-		}else if(req.req_type() == managarm::fs::CntReqType::NODE_RMDIR) {
-			// TODO: This should probably be it's own operation, for now, let it be
-			auto result = co_await node_ops->unlink(node, req.path());
+			HEL_CHECK(push_node.error());
+		}else{
 			managarm::fs::SvrResponse resp;
-			if(!result) {
-				assert(result.error() == protocols::fs::Error::fileNotFound);
-				resp.set_error(managarm::fs::Errors::FILE_NOT_FOUND);
-				auto ser = resp.SerializeAsString();
-				auto [send_resp] = co_await helix_ng::exchangeMsgs(
-					conversation,
-					helix_ng::sendBuffer(ser.data(), ser.size())
-				);
-				HEL_CHECK(send_resp.error());
-				continue;
-			}
-			resp.set_error(managarm::fs::Errors::SUCCESS);
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT); // TODO
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
-		}else if(req.req_type() == managarm::fs::CntReqType::NODE_OPEN) {
-			auto result = co_await node_ops->open(node);
+		}
+	}else if(req.req_type() == managarm::fs::CntReqType::NODE_SYMLINK) {
+		std::string name;
+		std::string target;
+		name.resize(req.name_length());
+		target.resize(req.target_length());
+
+		auto [recvName, recvTarget] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::recvBuffer(name.data(), name.size()),
+			helix_ng::recvBuffer(target.data(), target.size())
+		);
+		HEL_CHECK(recvName.error());
+		HEL_CHECK(recvTarget.error());
+
+		auto result = co_await node_ops->symlink(node, std::move(name), std::move(target));
+
+		if (std::get<0>(result)) {
+			helix::UniqueLane local_lane, remote_lane;
+			std::tie(local_lane, remote_lane) = helix::createStream();
+			serveNode(std::move(local_lane), std::move(std::get<0>(result)), node_ops);
 
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::SUCCESS);
+			resp.set_id(std::get<1>(result));
 
-			auto ser = resp.SerializeAsString();
-			auto [send_resp, push_file, push_pt] = co_await helix_ng::exchangeMsgs(
+			auto [sendResp, pushNode] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size()),
-				helix_ng::pushDescriptor(std::get<0>(result)),
-				helix_ng::pushDescriptor(std::get<1>(result))
+				helix_ng::sendBragiHeadInline(resp),
+				helix_ng::pushDescriptor(remote_lane)
 			);
-			HEL_CHECK(send_resp.error());
-			HEL_CHECK(push_file.error());
-			HEL_CHECK(push_pt.error());
-		}else if(req.req_type() == managarm::fs::CntReqType::NODE_READ_SYMLINK) {
-			auto link = co_await node_ops->readSymlink(node);
-
+			HEL_CHECK(sendResp.error());
+			HEL_CHECK(pushNode.error());
+		}else{
 			managarm::fs::SvrResponse resp;
-			resp.set_error(managarm::fs::Errors::SUCCESS);
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT); // TODO
 
-			auto ser = resp.SerializeAsString();
-			auto [send_resp, send_link] = co_await helix_ng::exchangeMsgs(
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size()),
-				helix_ng::sendBuffer(link.data(), link.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
-			HEL_CHECK(send_resp.error());
-			HEL_CHECK(send_link.error());
-		}else if(req.req_type() == managarm::fs::CntReqType::NODE_CHMOD) {
-			co_await node_ops->chmod(node, req.mode());
+			HEL_CHECK(sendResp.error());
+		}
+	}else if(req.req_type() == managarm::fs::CntReqType::NODE_LINK) {
+		auto result = co_await node_ops->link(node, req.path(), req.fd());
+		if(std::get<0>(result)) {
+			helix::UniqueLane local_lane, remote_lane;
+			std::tie(local_lane, remote_lane) = helix::createStream();
+			serveNode(std::move(local_lane), std::move(std::get<0>(result)), node_ops);
 
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::SUCCESS);
+			resp.set_id(std::get<1>(result));
+			switch(std::get<2>(result)) {
+			case FileType::directory:
+				resp.set_file_type(managarm::fs::FileType::DIRECTORY);
+				break;
+			case FileType::regular:
+				resp.set_file_type(managarm::fs::FileType::REGULAR);
+				break;
+			case FileType::symlink:
+				resp.set_file_type(managarm::fs::FileType::SYMLINK);
+				break;
+			default:
+				throw std::runtime_error("Unexpected file type");
+			}
 
-			auto ser = resp.SerializeAsString();
-			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			auto [send_resp, push_node] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp),
+				helix_ng::pushDescriptor(remote_lane)
 			);
 			HEL_CHECK(send_resp.error());
-		}else if(req.req_type() == managarm::fs::CntReqType::NODE_UTIMENSAT) {
-			co_await node_ops->utimensat(node, req.atime_sec(), req.atime_nsec(), req.mtime_sec(), req.mtime_nsec());
-
+			HEL_CHECK(push_node.error());
+		}else{
 			managarm::fs::SvrResponse resp;
-			resp.set_error(managarm::fs::Errors::SUCCESS);
+			resp.set_error(managarm::fs::Errors::FILE_NOT_FOUND);
 
-			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
-		}else if(req.req_type() == managarm::fs::CntReqType::NODE_OBSTRUCT_LINK) {
-			co_await node_ops->obstructLink(node, req.link_name());
-
-			managarm::fs::SvrResponse resp;
-			resp.set_error(managarm::fs::Errors::SUCCESS);
+		}
+	}else if(req.req_type() == managarm::fs::CntReqType::NODE_UNLINK) {
+		auto result = co_await node_ops->unlink(node, req.path());
+		managarm::fs::SvrResponse resp;
+		if(!result) {
+			assert(result.error() == protocols::fs::Error::fileNotFound);
+			resp.set_error(managarm::fs::Errors::FILE_NOT_FOUND);
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadInline(resp)
+			);
+			HEL_CHECK(send_resp.error());
+			co_return;
+		}
+		resp.set_error(managarm::fs::Errors::SUCCESS);
 
-			auto ser = resp.SerializeAsString();
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp)
+		);
+		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::NODE_RMDIR) {
+		// TODO: This should probably be it's own operation, for now, let it be
+		auto result = co_await node_ops->unlink(node, req.path());
+		managarm::fs::SvrResponse resp;
+		if(!result) {
+			assert(result.error() == protocols::fs::Error::fileNotFound);
+			resp.set_error(managarm::fs::Errors::FILE_NOT_FOUND);
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBuffer(ser.data(), ser.size())
+				helix_ng::sendBragiHeadInline(resp)
 			);
 			HEL_CHECK(send_resp.error());
-		}else{
-			throw std::runtime_error("libfs_protocol: Unexpected request type in serveNode");
+			co_return;
 		}
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp)
+		);
+		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::NODE_OPEN) {
+		auto result = co_await node_ops->open(node);
+
+		managarm::fs::SvrResponse resp;
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+
+		auto [send_resp, push_file, push_pt] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp),
+			helix_ng::pushDescriptor(std::get<0>(result)),
+			helix_ng::pushDescriptor(std::get<1>(result))
+		);
+		HEL_CHECK(send_resp.error());
+		HEL_CHECK(push_file.error());
+		HEL_CHECK(push_pt.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::NODE_READ_SYMLINK) {
+		auto link = co_await node_ops->readSymlink(node);
+
+		managarm::fs::SvrResponse resp;
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+
+		auto [send_resp, send_link] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp),
+			helix_ng::sendBuffer(link.data(), link.size())
+		);
+		HEL_CHECK(send_resp.error());
+		HEL_CHECK(send_link.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::NODE_CHMOD) {
+		co_await node_ops->chmod(node, req.mode());
+
+		managarm::fs::SvrResponse resp;
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp)
+		);
+		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::NODE_UTIMENSAT) {
+		co_await node_ops->utimensat(node, req.atime_sec(), req.atime_nsec(), req.mtime_sec(), req.mtime_nsec());
+
+		managarm::fs::SvrResponse resp;
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp)
+		);
+		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::NODE_OBSTRUCT_LINK) {
+		co_await node_ops->obstructLink(node, req.link_name());
+
+		managarm::fs::SvrResponse resp;
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBragiHeadInline(resp)
+		);
+		HEL_CHECK(send_resp.error());
+	}else{
+		throw std::runtime_error("libfs_protocol: Unexpected request type in serveNode");
+	}
+}
+
+} // anonymous namespace
+
+async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
+		const NodeOperations *node_ops) {
+	while(true) {
+		auto [accept, recv_req] = co_await helix_ng::exchangeMsgs(
+			lane,
+			helix_ng::accept(
+				helix_ng::recvInline())
+		);
+		if(accept.error() == kHelErrEndOfLane)
+			co_return;
+
+		HEL_CHECK(accept.error());
+		HEL_CHECK(recv_req.error());
+
+		auto conversation = accept.descriptor();
+
+		managarm::fs::CntRequest req;
+		req.ParseFromArray(recv_req.data(), recv_req.length());
+		recv_req.reset();
+
+		protocols::ostrace::Span span{protocols::ostrace::defaultContext(), "fs.node",
+				{req.trace_id(), req.trace_parent()}, static_cast<int64_t>(req.req_type())};
+		co_await span.begin();
+		co_await handleNodeRequest(node, node_ops, req, std::move(conversation));
+		co_await span.end();
 	}
 }
 
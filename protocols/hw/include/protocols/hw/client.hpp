@@ -2,6 +2,8 @@
 
 #include <async/result.hpp>
 #include <helix/ipc.hpp>
+#include <helix/memory.hpp>
+#include <optional>
 #include <vector>
 
 namespace protocols {
@@ -23,6 +25,8 @@ struct BarInfo {
 
 struct Capability {
 	unsigned int type;
+	// Offset of the capability in the configuration space.
+	size_t offset;
 };
 
 struct PciInfo {
@@ -53,15 +57,34 @@ struct Device {
 	async::result<void> enableMsi();
 	async::result<void> enableBusmaster();
 
+	// Loads are served from the memory-mapped configuration space if the kernel
+	// grants it (see accessPciSpace()); otherwise, they require an IPC round trip.
 	async::result<uint32_t> loadPciSpace(size_t offset, unsigned int size);
 	async::result<void> storePciSpace(size_t offset, unsigned int size, uint32_t word);
 	async::result<uint32_t> loadPciCapability(unsigned int index, size_t offset, unsigned int size);
 
+	// Returns the 4 KiB configuration space of the function (to be mapped read-only),
+	// or an empty descriptor if it is not memory-mapped (i.e., without ECAM).
+	async::result<helix::UniqueDescriptor> accessPciSpace();
+
 	async::result<FbInfo> getFbInfo();
 	async::result<helix::UniqueDescriptor> accessFbMemory();
 
+	// Returns an empty descriptor if the device is not behind an IOMMU.
+	// Memory is mapped into the DMA space with helMapDmaSpace().
+	async::result<helix::UniqueDescriptor> accessDmaSpace();
+
 private:
+	// Maps the configuration space on first use. Returns nullptr if it cannot be mapped.
+	async::result<const volatile std::byte *> _mapPciSpace();
+
 	helix::UniqueLane _lane;
+
+	// The PCI information does not change, hence getPciInfo() only requests it once.
+	std::optional<PciInfo> _pciInfo;
+
+	bool _triedPciSpace = false;
+	helix::Mapping _pciSpace;
 };
 
 } } // namespace protocols::hw
@@ -17,7 +17,30 @@
 namespace protocols {
 namespace hw {
 
+namespace {
+	constexpr size_t pciSpaceSize = 0x1000;
+
+	bool isMappableAccess(size_t offset, unsigned int size) {
+		return (size == 1 || size == 2 || size == 4)
+				&& !(offset & (size - 1)) && offset + size <= pciSpaceSize;
+	}
+
+	uint32_t loadMappedPciSpace(const volatile std::byte *space, size_t offset,
+			unsigned int size) {
+		switch(size) {
+		case 1: return *reinterpret_cast<const volatile uint8_t *>(space + offset);
+		case 2: return *reinterpret_cast<const volatile uint16_t *>(space + offset);
+		default:
+			assert(size == 4);
+			return *reinterpret_cast<const volatile uint32_t *>(space + offset);
+		}
+	}
+}
+
 async::result<PciInfo> Device::getPciInfo() {
+	if(_pciInfo)
+		co_return *_pciInfo;
+
 	managarm::hw::GetPciInfoRequest req;
 
 	auto [offer, send_req, recv_head] = co_await helix_ng::exchangeMsgs(
@@ -54,7 +77,7 @@ async::result<PciInfo> Device::getPciInfo() {
 	};
 
 	for(size_t i = 0; i < resp.capabilities_size(); i++)
-		info.caps.push_back({resp.capabilities(i).type()});
+		info.caps.push_back({resp.capabilities(i).type(), resp.capabilities(i).offset()});
 
 	for(int i = 0; i < 6; i++) {
 		if(resp.bars(i).io_type() == managarm::hw::IoType::NO_BAR) {
@@ -81,6 +104,7 @@ async::result<PciInfo> Device::getPciInfo() {
 		info.barInfo[i].offset = resp.bars(i).offset();
 	}
 
+	_pciInfo = info;
 	co_return info;
 }
 
@@ -330,7 +354,25 @@ async::result<void> Device::enableBusmaster() {
 	assert(resp.error() == managarm::hw::Errors::SUCCESS);
 }
 
+async::result<const volatile std::byte *> Device::_mapPciSpace() {
+	if(!_triedPciSpace) {
+		// Set this before suspending so that concurrent loads do not map the space twice.
+		_triedPciSpace = true;
+		auto memory = co_await accessPciSpace();
+		if(memory)
+			_pciSpace = helix::Mapping{memory, 0, pciSpaceSize, kHelMapProtRead};
+	}
+	if(!_pciSpace)
+		co_return nullptr;
+	co_return reinterpret_cast<const volatile std::byte *>(_pciSpace.get());
+}
+
 async::result<uint32_t> Device::loadPciSpace(size_t offset, unsigned int size) {
+	if(isMappableAccess(offset, size)) {
+		if(auto space = co_await _mapPciSpace(); space)
+			co_return loadMappedPciSpace(space, offset, size);
+	}
+
 	managarm::hw::LoadPciSpaceRequest req;
 	req.set_offset(offset);
 	req.set_size(size);
@@ -404,6 +446,15 @@ async::result<void> Device::storePciSpace(size_t offset, unsigned int size, uint
 }
 
 async::result<uint32_t> Device::loadPciCapability(unsigned int index, size_t offset, unsigned int size) {
+	// Capabilities can be read directly once their offsets are known.
+	if(_pciInfo && index < _pciInfo->caps.size()) {
+		auto capOffset = _pciInfo->caps[index].offset + offset;
+		if(isMappableAccess(capOffset, size) && !(offset & (size - 1))) {
+			if(auto space = co_await _mapPciSpace(); space)
+				co_return loadMappedPciSpace(space, capOffset, size);
+		}
+	}
+
 	managarm::hw::LoadPciCapabilityRequest req;
 	req.set_index(index);
 	req.set_offset(offset);
@@ -522,5 +573,83 @@ async::result<helix::UniqueDescriptor> Device::accessFbMemory() {
 	co_return std::move(bar);
 }
 
+async::result<helix::UniqueDescriptor> Device::accessDmaSpace() {
+	managarm::hw::AccessDmaSpaceRequest req;
+
+	auto [offer, send_req, recv_head] = co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::want_lane,
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_head.error());
+
+	auto preamble = bragi::read_preamble(recv_head);
+	assert(!preamble.error());
+	recv_head.reset();
+
+	std::vector<std::byte> tailBuffer(preamble.tail_size());
+	auto [recv_tail, pull_space] = co_await helix_ng::exchangeMsgs(
+			offer.descriptor(),
+			helix_ng::recvBuffer(tailBuffer.data(), tailBuffer.size()),
+			helix_ng::pullDescriptor()
+		);
+
+	HEL_CHECK(recv_tail.error());
+	HEL_CHECK(pull_space.error());
+
+	auto resp = *bragi::parse_head_tail<managarm::hw::SvrResponse>(recv_head, tailBuffer);
+
+	if(resp.error() == managarm::hw::Errors::NO_HARDWARE_SUPPORT)
+		co_return helix::UniqueDescriptor{};
+	assert(resp.error() == managarm::hw::Errors::SUCCESS);
+
+	co_return pull_space.descriptor();
+}
+
+async::result<helix::UniqueDescriptor> Device::accessPciSpace() {
+	managarm::hw::AccessPciSpaceRequest req;
+
+	auto [offer, send_req, recv_head] = co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::want_lane,
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_head.error());
+
+	auto preamble = bragi::read_preamble(recv_head);
+	assert(!preamble.error());
+	recv_head.reset();
+
+	std::vector<std::byte> tailBuffer(preamble.tail_size());
+	auto [recv_tail, pull_memory] = co_await helix_ng::exchangeMsgs(
+			offer.descriptor(),
+			helix_ng::recvBuffer(tailBuffer.data(), tailBuffer.size()),
+			helix_ng::pullDescriptor()
+		);
+
+	HEL_CHECK(recv_tail.error());
+	HEL_CHECK(pull_memory.error());
+
+	auto resp = *bragi::parse_head_tail<managarm::hw::SvrResponse>(recv_head, tailBuffer);
+
+	if(resp.error() == managarm::hw::Errors::NO_HARDWARE_SUPPORT)
+		co_return helix::UniqueDescriptor{};
+	assert(resp.error() == managarm::hw::Errors::SUCCESS);
+
+	co_return pull_memory.descriptor();
+}
+
 } } // namespace protocols::hw
 
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace protocols::logging {
+
+enum class Level : uint8_t {
+	trace,
+	debug,
+	info,
+	warning,
+	error
+};
+
+const char *levelName(Level level);
+
+// A component that logs under a common name (e.g. "posix.epoll").
+// Subsystems must have static storage duration; they register themselves on construction.
+// Messages below the subsystem's level are discarded before their arguments are evaluated.
+struct Subsystem {
+	Subsystem(const char *name, Level level = Level::info);
+
+	Subsystem(const Subsystem &) = delete;
+	Subsystem &operator= (const Subsystem &) = delete;
+
+	const char *name() const {
+		return name_;
+	}
+
+	Level level() const {
+		return level_.load(std::memory_order_relaxed);
+	}
+
+	void setLevel(Level level) {
+		level_.store(level, std::memory_order_relaxed);
+	}
+
+	bool isEnabled(Level level) const {
+		return level >= this->level();
+	}
+
+private:
+	friend struct Registry;
+
+	const char *name_;
+	std::atomic<Level> level_;
+	Subsystem *next_ = nullptr;
+};
+
+// Sets the level of all subsystems whose name starts with the given prefix,
+// including subsystems that are only constructed later.
+void setLevel(std::string_view prefix, Level level);
+
+// Applies a comma-separated list of prefix=level pairs, e.g. "posix.epoll=debug,virtio=trace".
+// A pair without prefix applies to all subsystems.
+// On startup, the MANAGARM_LOG environment variable is applied in the same way.
+// Returns false if the specification contains an invalid level.
+bool configureLevels(std::string_view spec);
+
+namespace detail {
+	consteval size_t countPlaceholders(std::string_view format) {
+		size_t n = 0;
+		for(size_t i = 0; i < format.size(); i++) {
+			if(format[i] == '{') {
+				if(i + 1 < format.size() && format[i + 1] == '{') {
+					i++;
+					continue;
+				}
+				auto end = format.find('}', i);
+				if(end == std::string_view::npos)
+					throw "Unterminated placeholder in log format string";
+				auto spec = format.substr(i + 1, end - i - 1);
+				if(spec != "" && spec != ":x")
+					throw "Unsupported placeholder in log format string";
+				i += spec.size() + 1;
+				n++;
+			}else if(format[i] == '}') {
+				if(i + 1 >= format.size() || format[i + 1] != '}')
+					throw "Unmatched '}' in log format string";
+				i++;
+			}
+		}
+		return n;
+	}
+} // namespace detail
+
+// Format string that is checked against the arguments at compile time.
+// Supports {} and {:x} (hexadecimal integers) placeholders; {{ and }} are escapes.
+template<typename... Args>
+struct FormatString {
+	template<typename T>
+	requires std::convertible_to<const T &, std::string_view>
+	consteval FormatString(const T &s)
+	: str{s} {
+		if(detail::countPlaceholders(str) != sizeof...(Args))
+			throw "Number of placeholders does not match number of log arguments";
+	}
+
+	std::string_view str;
+};
+
+// A single MLOG() invocation. The collector learns the format string of each site
+// once; afterwards, messages only carry the site's ID and the encoded arguments.
+struct Site {
+	const Subsystem *subsystem;
+	Level level;
+	const char *format;
+	std::atomic<uint32_t> id{0};
+};
+
+namespace detail {
+	enum class ArgType : uint8_t {
+		sint = 1,
+		uint,
+		pointer,
+		string,
+		boolean,
+		character
+	};
+
+	// Size of the buffer that messages are encoded into (including the record header).
+	inline constexpr size_t maxRecordSize = 1024;
+	inline constexpr size_t recordHeaderSize = 12;
+
+	struct Encoder {
+		void put(const void *data, size_t size) {
+			if(overflow || size > sizeof(buffer) - offset) {
+				overflow = true;
+				return;
+			}
+			memcpy(buffer + offset, data, size);
+			offset += size;
+		}
+
+		void putTag(ArgType type) {
+			put(&type, 1);
+		}
+
+		void putString(std::string_view s) {
+			putTag(ArgType::string);
+			// Truncate strings to the space that is left in the record.
+			size_t space = sizeof(buffer) - offset;
+			space = space > 2 ? space - 2 : 0;
+			uint16_t length = s.size() < space ? s.size() : space;
+			put(&length, 2);
+			put(s.data(), length);
+		}
+
+		template<typename T>
+		void encode(const T &arg) {
+			using D = std::remove_cvref_t<T>;
+			if constexpr (std::is_same_v<D, bool>) {
+				putTag(ArgType::boolean);
+				uint8_t v = arg;
+				put(&v, 1);
+			}else if constexpr (std::is_same_v<D, char>) {
+				putTag(ArgType::character);
+				put(&arg, 1);
+			}else if constexpr (std::is_enum_v<D>) {
+				encode(static_cast<std::underlying_type_t<D>>(arg));
+			}else if constexpr (std::is_integral_v<D> && std::is_signed_v<D>) {
+				putTag(ArgType::sint);
+				int64_t v = arg;
+				put(&v, 8);
+			}else if constexpr (std::is_integral_v<D>) {
+				putTag(ArgType::uint);
+				uint64_t v = arg;
+				put(&v, 8);
+			}else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+				putString(std::string_view{arg});
+			}else if constexpr (std::is_pointer_v<std::decay_t<T>>) {
+				putTag(ArgType::pointer);
+				uint64_t v = reinterpret_cast<uintptr_t>(arg);
+				put(&v, 8);
+			}else{
+				// Fall back to operator<< for types that do not have a binary encoding.
+				std::ostringstream os;
+				os << arg;
+				putString(os.str());
+			}
+		}
+
+		// The record header is filled in when the record is submitted.
+		char buffer[maxRecordSize];
+		size_t offset = recordHeaderSize;
+		bool overflow = false;
+	};
+
+	void submit(Site &site, Encoder &encoder);
+} // namespace detail
+
+template<typename... Args>
+void emit(Site &site, FormatString<std::type_identity_t<Args>...> format, const Args &...args) {
+	(void)format;
+	detail::Encoder encoder;
+	(encoder.encode(args), ...);
+	detail::submit(site, encoder);
+}
+
+// Formats a message from its format string and encoded arguments.
+// Used by the collector, and for synchronous output before the collector is available.
+std::string formatMessage(std::string_view format, const char *args, size_t size);
+
+// Formats the line that is printed for a message.
+std::string formatLine(Level level, std::string_view subsystem, std::string_view message);
+
+} // namespace protocols::logging
+
+// Logs a message to the given subsystem, e.g.:
+//     MLOG_DEBUG(epollLog, "Adding item {} with mask {:x}", file->structName(), mask);
+// The arguments are only evaluated if the level is enabled.
+#define MLOG(subsys, lvl, fmt, ...) \
+	do { \
+		static ::protocols::logging::Site mlogSite_{&(subsys), (lvl), (fmt)}; \
+		if((subsys).isEnabled(lvl)) \
+			::protocols::logging::emit(mlogSite_, fmt __VA_OPT__(,) __VA_ARGS__); \
+	} while(0)
+
+#define MLOG_TRACE(subsys, ...) MLOG(subsys, ::protocols::logging::Level::trace, __VA_ARGS__)
+#define MLOG_DEBUG(subsys, ...) MLOG(subsys, ::protocols::logging::Level::debug, __VA_ARGS__)
+#define MLOG_INFO(subsys, ...) MLOG(subsys, ::protocols::logging::Level::info, __VA_ARGS__)
+#define MLOG_WARNING(subsys, ...) MLOG(subsys, ::protocols::logging::Level::warning, __VA_ARGS__)
+#define MLOG_ERROR(subsys, ...) MLOG(subsys, ::protocols::logging::Level::error, __VA_ARGS__)
@@ -0,0 +1,425 @@
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#include <async/oneshot-event.hpp>
+#include <bragi/helpers-std.hpp>
+#include <frg/std_compat.hpp>
+#include <helix/ipc.hpp>
+#include <protocols/logging/logging.hpp>
+#include <protocols/mbus/client.hpp>
+#include <logging.bragi.hpp>
+
+namespace protocols::logging {
+
+using managarm::logging::RingLayout;
+using managarm::logging::RecordKind;
+
+static_assert(detail::maxRecordSize == RingLayout::RING_MAX_RECORD);
+
+const char *levelName(Level level) {
+	switch(level) {
+	case Level::trace: return "trace";
+	case Level::debug: return "debug";
+	case Level::info: return "info";
+	case Level::warning: return "warning";
+	case Level::error: return "error";
+	}
+	return "?";
+}
+
+// --------------------------------------------------------
+// Level configuration.
+// --------------------------------------------------------
+
+struct Rule {
+	std::string prefix;
+	Level level;
+};
+
+struct Registry {
+	static Registry &get() {
+		static Registry registry;
+		return registry;
+	}
+
+	void add(Subsystem *subsystem) {
+		std::lock_guard lock{mutex};
+		subsystem->next_ = subsystems;
+		subsystems = subsystem;
+		applyRules(subsystem);
+	}
+
+	void addRule(std::string_view prefix, Level level) {
+		std::lock_guard lock{mutex};
+		rules.push_back({std::string{prefix}, level});
+		for(auto s = subsystems; s; s = s->next_)
+			applyRules(s);
+	}
+
+private:
+	Registry() {
+		if(auto spec = getenv("MANAGARM_LOG"); spec)
+			parse(spec);
+	}
+
+	// Later rules override earlier ones.
+	void applyRules(Subsystem *subsystem) {
+		for(auto &rule : rules) {
+			if(std::string_view{subsystem->name()}.starts_with(rule.prefix))
+				subsystem->setLevel(rule.level);
+		}
+	}
+
+public:
+	bool parse(std::string_view spec);
+
+private:
+	std::mutex mutex;
+	Subsystem *subsystems = nullptr;
+	std::vector<Rule> rules;
+};
+
+namespace {
+
+bool parseLevel(std::string_view s, Level &level) {
+	for(auto l : {Level::trace, Level::debug, Level::info, Level::warning, Level::error}) {
+		if(s == levelName(l)) {
+			level = l;
+			return true;
+		}
+	}
+	return false;
+}
+
+} // anonymous namespace
+
+bool Registry::parse(std::string_view spec) {
+	bool success = true;
+	while(!spec.empty()) {
+		auto comma = spec.find(',');
+		auto pair = spec.substr(0, comma);
+		spec = (comma == std::string_view::npos) ? std::string_view{} : spec.substr(comma + 1);
+		if(pair.empty())
+			continue;
+
+		std::string_view prefix;
+		auto equals = pair.find('=');
+		if(equals != std::string_view::npos) {
+			prefix = pair.substr(0, equals);
+			pair = pair.substr(equals + 1);
+		}
+
+		Level level;
+		if(!parseLevel(pair, level)) {
+			success = false;
+			continue;
+		}
+		addRule(prefix, level);
+	}
+	return success;
+}
+
+Subsystem::Subsystem(const char *name, Level level)
+: name_{name}, level_{level} {
+	Registry::get().add(this);
+}
+
+void setLevel(std::string_view prefix, Level level) {
+	Registry::get().addRule(prefix, level);
+}
+
+bool configureLevels(std::string_view spec) {
+	return Registry::get().parse(spec);
+}
+
+// --------------------------------------------------------
+// Formatting.
+// --------------------------------------------------------
+
+std::string formatMessage(std::string_view format, const char *args, size_t size) {
+	std::string out;
+	size_t offset = 0;
+	auto read = [&] (void *dest, size_t n) -> bool {
+		if(n > size - offset)
+			return false;
+		memcpy(dest, args + offset, n);
+		offset += n;
+		return true;
+	};
+
+	auto formatArg = [&] (bool hex) {
+		detail::ArgType type;
+		if(!read(&type, 1)) {
+			out += "<missing>";
+			return;
+		}
+
+		char buf[32];
+		switch(type) {
+		case detail::ArgType::sint: {
+			int64_t v = 0;
+			read(&v, 8);
+			snprintf(buf, sizeof(buf), hex ? "%lx" : "%ld", v);
+			out += buf;
+			break;
+		}
+		case detail::ArgType::uint: {
+			uint64_t v = 0;
+			read(&v, 8);
+			snprintf(buf, sizeof(buf), hex ? "%lx" : "%lu", v);
+			out += buf;
+			break;
+		}
+		case detail::ArgType::pointer: {
+			uint64_t v = 0;
+			read(&v, 8);
+			snprintf(buf, sizeof(buf), "0x%lx", v);
+			out += buf;
+			break;
+		}
+		case detail::ArgType::string: {
+			uint16_t length = 0;
+			read(&length, 2);
+			if(length > size - offset)
+				length = size - offset;
+			out.append(args + offset, length);
+			offset += length;
+			break;
+		}
+		case detail::ArgType::boolean: {
+			uint8_t v = 0;
+			read(&v, 1);
+			out += v ? "true" : "false";
+			break;
+		}
+		case detail::ArgType::character: {
+			char c = 0;
+			read(&c, 1);
+			out += c;
+			break;
+		}
+		default:
+			// We cannot know the size of unknown arguments; skip the rest of the message.
+			out += "<invalid>";
+			offset = size;
+		}
+	};
+
+	for(size_t i = 0; i < format.size(); i++) {
+		if(format[i] == '{') {
+			if(i + 1 < format.size() && format[i + 1] == '{') {
+				out += '{';
+				i++;
+				continue;
+			}
+			auto end = format.find('}', i);
+			if(end == std::string_view::npos)
+				break;
+			formatArg(format.substr(i + 1, end - i - 1) == ":x");
+			i = end;
+		}else if(format[i] == '}') {
+			out += '}';
+			if(i + 1 < format.size() && format[i + 1] == '}')
+				i++;
+		}else{
+			out += format[i];
+		}
+	}
+	return out;
+}
+
+std::string formatLine(Level level, std::string_view subsystem, std::string_view message) {
+	std::string out{subsystem};
+	if(level >= Level::warning) {
+		out += level == Level::warning ? ": \e[33mwarning\e[39m: " : ": \e[31merror\e[39m: ";
+	}else{
+		out += ": ";
+	}
+	out += message;
+	return out;
+}
+
+// --------------------------------------------------------
+// Ring that is shared with the collector.
+// --------------------------------------------------------
+
+namespace {
+
+struct ProcessRing {
+	// Serializes producers. Only held while records are copied into the ring.
+	std::mutex mutex;
+	std::atomic<bool> connecting{false};
+	// Messages are printed synchronously until the collector maps the ring.
+	bool attached = false;
+	char *window = nullptr;
+	uint32_t nextSiteId = 1;
+	helix::UniqueLane lane;
+	helix::UniqueLane conversation;
+};
+
+ProcessRing &processRing() {
+	static ProcessRing ring;
+	return ring;
+}
+
+void writeHeader(char *record, uint32_t size, uint32_t kind, uint32_t id) {
+	memcpy(record, &size, 4);
+	memcpy(record + 4, &kind, 4);
+	memcpy(record + 8, &id, 4);
+}
+
+// Must be called with the ring's mutex held. Returns false if the record does not fit.
+bool pushToRing(ProcessRing *ring, const char *data, size_t size) {
+	constexpr size_t capacity = RingLayout::RING_SIZE - RingLayout::RING_DATA;
+	auto headPtr = reinterpret_cast<uint64_t *>(ring->window + RingLayout::RING_HEAD);
+	auto tailPtr = reinterpret_cast<uint64_t *>(ring->window + RingLayout::RING_TAIL);
+
+	auto head = __atomic_load_n(headPtr, __ATOMIC_RELAXED);
+	auto tail = __atomic_load_n(tailPtr, __ATOMIC_ACQUIRE);
+	if(head - tail + size > capacity)
+		return false;
+
+	auto offset = head % capacity;
+	auto chunk = std::min(size, capacity - offset);
+	memcpy(ring->window + RingLayout::RING_DATA + offset, data, chunk);
+	memcpy(ring->window + RingLayout::RING_DATA, data + chunk, size - chunk);
+
+	__atomic_store_n(headPtr, head + size, __ATOMIC_RELEASE);
+	return true;
+}
+
+void countDropped(ProcessRing *ring) {
+	auto droppedPtr = reinterpret_cast<uint64_t *>(ring->window + RingLayout::RING_DROPPED);
+	__atomic_fetch_add(droppedPtr, 1, __ATOMIC_RELAXED);
+}
+
+// Must be called with the ring's mutex held.
+bool announceSite(ProcessRing *ring, Site &site) {
+	std::string_view subsystem{site.subsystem->name()};
+	std::string_view format{site.format};
+
+	char record[detail::maxRecordSize];
+	size_t size = detail::recordHeaderSize + 5;
+	if(size + subsystem.size() + format.size() > sizeof(record))
+		format = format.substr(0, sizeof(record) - size - subsystem.size());
+
+	uint32_t id = ring->nextSiteId;
+	uint8_t level = static_cast<uint8_t>(site.level);
+	uint16_t subsystemLength = subsystem.size();
+	uint16_t formatLength = format.size();
+	memcpy(record + detail::recordHeaderSize, &level, 1);
+	memcpy(record + detail::recordHeaderSize + 1, &subsystemLength, 2);
+	memcpy(record + detail::recordHeaderSize + 3, &formatLength, 2);
+	memcpy(record + size, subsystem.data(), subsystem.size());
+	size += subsystem.size();
+	memcpy(record + size, format.data(), format.size());
+	size += format.size();
+	writeHeader(record, size, RecordKind::SITE, id);
+
+	if(!pushToRing(ring, record, size))
+		return false;
+	ring->nextSiteId++;
+	site.id.store(id, std::memory_order_relaxed);
+	return true;
+}
+
+async::detached connectCollector(ProcessRing *ring) {
+	auto root = co_await mbus::Instance::global().getRoot();
+
+	auto filter = mbus::Conjunction({
+		mbus::EqualsFilter("class", "logd")
+	});
+
+	async::oneshot_event foundObject;
+
+	auto handler = mbus::ObserverHandler{}
+	.withAttach([ring, &foundObject] (mbus::Entity entity, mbus::Properties)
+			-> async::detached {
+		ring->lane = helix::UniqueLane(co_await entity.bind());
+		foundObject.raise();
+	});
+
+	co_await root.linkObserver(std::move(filter), std::move(handler));
+	co_await foundObject.wait();
+
+	HelHandle handle;
+	HEL_CHECK(helAllocateMemory(RingLayout::RING_SIZE, 0, nullptr, &handle));
+	helix::UniqueDescriptor memory{handle};
+
+	void *window;
+	HEL_CHECK(helMapMemory(memory.getHandle(), kHelNullHandle,
+			nullptr, 0, RingLayout::RING_SIZE, kHelMapProtRead | kHelMapProtWrite, &window));
+
+	managarm::logging::AttachRingReq req;
+
+	auto [offer, sendReq, pushMemory, recvResp] =
+		co_await helix_ng::exchangeMsgs(
+			ring->lane,
+			helix_ng::offer(
+				helix_ng::want_lane,
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::pushDescriptor(memory),
+				helix_ng::recvInline()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(sendReq.error());
+	HEL_CHECK(pushMemory.error());
+	HEL_CHECK(recvResp.error());
+
+	auto maybeResp = bragi::parse_head_only<managarm::logging::Response>(recvResp);
+	recvResp.reset();
+	assert(maybeResp);
+	if(maybeResp->error() != managarm::logging::Error::SUCCESS) {
+		std::cout << "logging: logd refused to attach the log ring" << std::endl;
+		co_return;
+	}
+
+	// The collector drains the ring until this conversation is closed, i.e., until we exit.
+	std::lock_guard lock{ring->mutex};
+	ring->conversation = offer.descriptor();
+	ring->window = reinterpret_cast<char *>(window);
+	ring->attached = true;
+}
+
+void printSynchronously(Site &site, detail::Encoder &encoder) {
+	static std::mutex coutMutex;
+
+	auto message = formatMessage(site.format, encoder.buffer + detail::recordHeaderSize,
+			encoder.offset - detail::recordHeaderSize);
+	auto line = formatLine(site.level, site.subsystem->name(), message);
+	std::lock_guard lock{coutMutex};
+	std::cout << line << std::endl;
+}
+
+} // anonymous namespace
+
+void detail::submit(Site &site, Encoder &encoder) {
+	auto ring = &processRing();
+	if(!ring->connecting.exchange(true, std::memory_order_relaxed))
+		connectCollector(ring);
+
+	{
+		std::lock_guard lock{ring->mutex};
+		if(ring->attached) {
+			if(!site.id.load(std::memory_order_relaxed) && !announceSite(ring, site)) {
+				countDropped(ring);
+				return;
+			}
+
+			writeHeader(encoder.buffer, encoder.offset, RecordKind::MESSAGE,
+					site.id.load(std::memory_order_relaxed));
+			if(!pushToRing(ring, encoder.buffer, encoder.offset))
+				countDropped(ring);
+			return;
+		}
+	}
+
+	printSynchronously(site, encoder);
+}
+
+} // namespace protocols::logging
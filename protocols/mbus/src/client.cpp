@@ -182,9 +182,10 @@ async::detached handleObserver(std::shared_ptr<Connection> connection,
 	while(true) {
 		helix::RecvBuffer recv_req;
 
-		char buffer[1024];
+		// mbus limits ATTACH_BATCH messages to this size.
+		char buffer[4096];
 		auto &&header = helix::submitAsync(lane, helix::Dispatcher::global(),
-				helix::action(&recv_req, buffer, 1024));
+				helix::action(&recv_req, buffer, 4096));
 		co_await header.async_wait();
 		HEL_CHECK(recv_req.error());
 
@@ -196,6 +197,14 @@ async::detached handleObserver(std::shared_ptr<Connection> connection,
 				properties.insert({ kv.name(), StringItem{kv.item().string_item().value()} });
 
 			handler.attach(Entity{connection, req.id()}, std::move(properties));
+		}else if(req.req_type() == managarm::mbus::SvrReqType::ATTACH_BATCH) {
+			for(auto &attachment : req.attachments()) {
+				Properties properties;
+				for(auto &kv : attachment.properties())
+					properties.insert({ kv.name(), StringItem{kv.item().string_item().value()} });
+
+				handler.attach(Entity{connection, attachment.id()}, std::move(properties));
+			}
 		}else{
 			throw std::runtime_error("Unexpected request type");
 		}
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <optional>
 #include <string>
+#include <unordered_map>
 
 #include <async/result.hpp>
 #include <helix/ipc.hpp>
@@ -27,9 +29,34 @@ struct Context {
 	async::result<EventId> announceEvent(std::string_view name);
 	async::result<ItemId> announceItem(std::string_view name);
 
+	// New traces are started for one in samplingRate() root requests.
+	inline uint64_t samplingRate() {
+		return samplingRate_;
+	}
+
+	inline void setSamplingRate(uint64_t rate) {
+		samplingRate_ = rate;
+	}
+
 private:
+	friend struct Span;
+
+	struct SpanItems {
+		ItemId traceId;
+		ItemId spanId;
+		ItemId parentId;
+		ItemId phase;
+		ItemId op;
+	};
+
+	// Like announceEvent() but only announces each name once.
+	async::result<EventId> spanEvent_(std::string_view name);
+
 	helix::UniqueLane lane_;
 	bool enabled_;
+	uint64_t samplingRate_;
+	std::optional<SpanItems> spanItems_;
+	std::unordered_map<std::string, EventId> spanEvents_;
 };
 
 struct Event {
@@ -37,14 +64,69 @@ struct Event {
 
 	void withCounter(ItemId id, int64_t value);
 
+	// Usually only writes the event to a ring that is shared with the kernel.
 	async::result<void> emit();
 
 private:
+	bool emitToRing_();
+
 	Context *ctx_;
 	bool live_; // Whether we emit an event at all.
 	managarm::ostrace::EmitEventReq req_;
 };
 
+// Identifies a span of a traced request. Servers receive it in the trace_id and
+// trace_parent tags of request heads and forward the context() of their own span
+// in the requests that they issue on behalf of the traced request.
+struct TraceContext {
+	uint64_t traceId = 0; // Zero if the request is not traced.
+	uint64_t spanId = 0;
+
+	explicit operator bool () const {
+		return traceId;
+	}
+};
+
+inline constexpr uint64_t defaultSamplingRate = 1000;
+
+// A span covers the handling of a single request by a single server.
+// It is recorded as a pair of events that carry the trace.* items;
+// extract-ostrace pairs them up again.
+struct Span {
+	Span() = default;
+
+	// Spans are always recorded if the parent is traced. Otherwise, a new trace is
+	// started with probability 1 / ctx->samplingRate(). ctx may be null.
+	// op distinguishes the requests that are recorded under the same name.
+	Span(Context *ctx, std::string_view name, TraceContext parent, int64_t op = 0);
+
+	inline bool isLive() {
+		return static_cast<bool>(self_);
+	}
+
+	// Context to propagate to requests issued while handling this span.
+	inline TraceContext context() {
+		return self_;
+	}
+
+	async::result<void> begin();
+	async::result<void> end();
+
+private:
+	async::result<void> emit_(int64_t phase);
+
+	Context *ctx_ = nullptr;
+	std::string_view name_;
+	TraceContext self_;
+	uint64_t parentId_ = 0;
+	int64_t op_ = 0;
+};
+
 async::result<Context> createContext();
 
+// Context that library code (such as the fs protocol server) records spans into.
+// Null until the program calls setDefaultContext().
+Context *defaultContext();
+void setDefaultContext(Context *ctx);
+
 } // namespace protocols::ostrace
@@ -1,5 +1,11 @@
+#include <algorithm>
+#include <random>
+#include <string.h>
+
 #include <async/oneshot-event.hpp>
+#include <bragi/helpers-all.hpp>
 #include <bragi/helpers-std.hpp>
+#include <frg/span.hpp>
 #include <frg/std_compat.hpp>
 #include <protocols/mbus/client.hpp>
 #include <protocols/ostrace/ostrace.hpp>
@@ -7,11 +13,120 @@
 
 namespace protocols::ostrace {
 
+namespace {
+
+Context *globalDefaultContext = nullptr;
+
+// Trace and span IDs only need to be unique within a trace file,
+// hence a PRNG that is seeded once per process is good enough.
+// Note that std::random_device is not an option: in posix-subsystem,
+// it would end up sending requests to itself.
+std::mt19937_64 &idPrng() {
+	static std::mt19937_64 prng{[] {
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		return now;
+	}()};
+	return prng;
+}
+
+uint64_t generateId() {
+	uint64_t id;
+	do {
+		id = idPrng()();
+	} while(!id);
+	return id;
+}
+
+using managarm::ostrace::RingLayout;
+
+// Each thread emits the events of (at most) one Context through a ring that is
+// shared with the kernel. The kernel drains the ring asynchronously.
+struct ThreadRing {
+	enum class State {
+		none,
+		pending, // SetupRingReq is in flight.
+		ready,
+		unavailable
+	};
+
+	Context *ctx = nullptr;
+	State state = State::none;
+	helix::UniqueDescriptor memory;
+	char *window = nullptr;
+};
+
+thread_local ThreadRing threadRing;
+
+async::detached setupThreadRing(Context *ctx) {
+	auto ring = &threadRing;
+	ring->ctx = ctx;
+	ring->state = ThreadRing::State::pending;
+
+	managarm::ostrace::SetupRingReq req;
+
+	auto [offer, sendReq, recvResp, pullMemory] =
+		co_await helix_ng::exchangeMsgs(
+			ctx->getLane(),
+			helix_ng::offer(
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline(),
+				helix_ng::pullDescriptor()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(sendReq.error());
+	HEL_CHECK(recvResp.error());
+
+	auto maybeResp = bragi::parse_head_only<managarm::ostrace::Response>(recvResp);
+	recvResp.reset();
+	assert(maybeResp);
+	auto &resp = maybeResp.value();
+
+	// Older kernels do not know SetupRingReq; keep using EmitEventReq in that case.
+	if(resp.error() != managarm::ostrace::Error::SUCCESS) {
+		ring->state = ThreadRing::State::unavailable;
+		co_return;
+	}
+	HEL_CHECK(pullMemory.error());
+
+	void *window;
+	HEL_CHECK(helMapMemory(pullMemory.descriptor().getHandle(), kHelNullHandle,
+			nullptr, 0, RingLayout::RING_SIZE, kHelMapProtRead | kHelMapProtWrite, &window));
+	ring->memory = pullMemory.descriptor();
+	ring->window = reinterpret_cast<char *>(window);
+	ring->state = ThreadRing::State::ready;
+}
+
+// Returns false if the record does not fit into the ring.
+bool pushToRing(ThreadRing *ring, const char *data, size_t size) {
+	constexpr size_t capacity = RingLayout::RING_SIZE - RingLayout::RING_DATA;
+	auto headPtr = reinterpret_cast<uint64_t *>(ring->window + RingLayout::RING_HEAD);
+	auto tailPtr = reinterpret_cast<uint64_t *>(ring->window + RingLayout::RING_TAIL);
+
+	// Only this thread writes the head.
+	auto head = __atomic_load_n(headPtr, __ATOMIC_RELAXED);
+	auto tail = __atomic_load_n(tailPtr, __ATOMIC_ACQUIRE);
+	if(head - tail + size > capacity)
+		return false;
+
+	auto offset = head % capacity;
+	auto chunk = std::min(size, capacity - offset);
+	memcpy(ring->window + RingLayout::RING_DATA + offset, data, chunk);
+	memcpy(ring->window + RingLayout::RING_DATA, data + chunk, size - chunk);
+
+	__atomic_store_n(headPtr, head + size, __ATOMIC_RELEASE);
+	return true;
+}
+
+} // anonymous namespace
+
 Context::Context()
-: enabled_{false} { }
+: enabled_{false}, samplingRate_{defaultSamplingRate} { }
 
 Context::Context(helix::UniqueLane lane, bool enabled)
-: lane_{std::move(lane)}, enabled_{enabled} { }
+: lane_{std::move(lane)}, enabled_{enabled}, samplingRate_{defaultSamplingRate} { }
 
 async::result<EventId> Context::announceEvent(std::string_view name) {
 	managarm::ostrace::AnnounceEventReq req;
@@ -65,6 +180,16 @@ async::result<ItemId> Context::announceItem(std::string_view name) {
 	co_return ItemId{resp.id()};
 }
 
+async::result<EventId> Context::spanEvent_(std::string_view name) {
+	std::string key{name};
+	if(auto it = spanEvents_.find(key); it != spanEvents_.end())
+		co_return it->second;
+
+	auto id = co_await announceEvent(name);
+	spanEvents_.insert({std::move(key), id});
+	co_return id;
+}
+
 Event::Event(Context *ctx, EventId id)
 : ctx_{ctx} {
 	live_ = ctx->isActive();
@@ -81,10 +206,43 @@ void Event::withCounter(ItemId id, int64_t value) {
 	req_.add_ctrs(std::move(item));
 }
 
+bool Event::emitToRing_() {
+	auto ring = &threadRing;
+	if(ring->state == ThreadRing::State::none)
+		setupThreadRing(ctx_);
+	if(ring->state != ThreadRing::State::ready || ring->ctx != ctx_)
+		return false;
+
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+
+	managarm::ostrace::EventRecord record;
+	record.set_ts(now);
+	record.set_id(req_.id());
+	for(size_t i = 0; i < req_.ctrs_size(); ++i)
+		record.add_ctrs(req_.ctrs(i));
+
+	auto tailSize = record.size_of_tail();
+	if(8 + tailSize > RingLayout::RING_MAX_RECORD)
+		return false;
+
+	char ser[RingLayout::RING_MAX_RECORD];
+	bool encodeSuccess = bragi::write_head_tail(record,
+			frg::span<char>(ser, 8),
+			frg::span<char>(ser + 8, tailSize));
+	assert(encodeSuccess);
+
+	return pushToRing(ring, ser, 8 + tailSize);
+}
+
 async::result<void> Event::emit() {
 	if(!live_)
 		co_return;
 
+	// Fall back to IPC while the ring is not set up yet (or if it is full).
+	if(emitToRing_())
+		co_return;
+
 	auto [offer, sendReq, recvResp] =
 		co_await helix_ng::exchangeMsgs(
 			ctx_->getLane(),
@@ -105,6 +263,54 @@ async::result<void> Event::emit() {
 	assert(resp.error() == managarm::ostrace::Error::SUCCESS);
 }
 
+Span::Span(Context *ctx, std::string_view name, TraceContext parent, int64_t op)
+: ctx_{ctx}, name_{name}, op_{op} {
+	if(!ctx || !ctx->isActive())
+		return;
+
+	if(parent) {
+		self_.traceId = parent.traceId;
+		parentId_ = parent.spanId;
+	}else{
+		auto rate = ctx->samplingRate();
+		if(!rate || idPrng()() % rate)
+			return;
+		self_.traceId = generateId();
+	}
+	self_.spanId = generateId();
+}
+
+async::result<void> Span::begin() {
+	if(self_)
+		co_await emit_(1);
+}
+
+async::result<void> Span::end() {
+	if(self_)
+		co_await emit_(2);
+}
+
+async::result<void> Span::emit_(int64_t phase) {
+	if(!ctx_->spanItems_) {
+		Context::SpanItems items;
+		items.traceId = co_await ctx_->announceItem("trace.id");
+		items.spanId = co_await ctx_->announceItem("trace.span");
+		items.parentId = co_await ctx_->announceItem("trace.parent");
+		items.phase = co_await ctx_->announceItem("trace.phase");
+		items.op = co_await ctx_->announceItem("trace.op");
+		ctx_->spanItems_ = items;
+	}
+	auto &items = *ctx_->spanItems_;
+
+	Event event{ctx_, co_await ctx_->spanEvent_(name_)};
+	event.withCounter(items.traceId, static_cast<int64_t>(self_.traceId));
+	event.withCounter(items.spanId, static_cast<int64_t>(self_.spanId));
+	event.withCounter(items.parentId, static_cast<int64_t>(parentId_));
+	event.withCounter(items.phase, phase);
+	event.withCounter(items.op, op_);
+	co_await event.emit();
+}
+
 async::result<Context> createContext() {
 	auto root = co_await mbus::Instance::global().getRoot();
 
@@ -158,4 +364,12 @@ async::result<Context> createContext() {
 	co_return Context{std::move(lane), true};
 }
 
+Context *defaultContext() {
+	return globalDefaultContext;
+}
+
+void setDefaultContext(Context *ctx) {
+	globalDefaultContext = ctx;
+}
+
 } // namespace protocols::ostrace
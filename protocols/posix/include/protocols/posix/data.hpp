@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
 #include <hel.h>
 
 namespace posix {
@@ -10,6 +12,91 @@ struct ManagarmProcessData {
 	void *threadPage;
 	HelHandle *fileTable;
 	void *clockTrackerPage;
+	void *identityPage;
+};
+
+// Read-only page that publishes the identity of a thread, so that libc can
+// answer getpid(), gettid(), getuid() etc. without a round trip to the server.
+// The time base for clock_gettime() is already published through clockTrackerPage.
+// The server makes seqlock odd while it updates the page; readers retry
+// if seqlock is odd or if it changed during the read.
+struct IdentityPage {
+	unsigned int seqlock;
+	int pid;
+	int tid;
+	int uid;
+	int euid;
+	int gid;
+	int egid;
+};
+
+// Header of the shared-memory ring that backs a pipe. Clients obtain the ring by
+// mmap()ing either end of the pipe; the data area of capacity bytes starts at
+// pipeRingDataOffset. head and tail are free-running byte counters that are advanced
+// by the reader and by the writer, respectively.
+// dataFutex is incremented when tail changes and spaceFutex when head changes.
+// Waiters increment waiters while they are blocked on either futex;
+// otherwise, no wakeup is issued.
+struct PipeRing {
+	uint64_t capacity;
+	uint64_t head;
+	uint64_t tail;
+	int dataFutex;
+	int spaceFutex;
+	int waiters;
+};
+
+inline constexpr size_t pipeRingDataOffset = 0x1000;
+
+// Page that holds the counter of an eventfd or the number of expirations of a timerfd.
+// Clients obtain the page by mmap()ing the file. They can then read (and, for eventfds,
+// write) without a round trip to the server by updating counter with compare-and-swap.
+// counterFutex is incremented when the server changes counter; clients that block
+// on it increment waiters while they are blocked (as for PipeRing).
+// serverWaiters is non-zero while the server has pending poll() or blocking calls on
+// the file. A client that changes the counter of an eventfd while serverWaiters is
+// non-zero must notify the server by write()ing zero through the server.
+// Clients can only reset the counter of a timerfd, which never requires a notification.
+struct CounterPage {
+	uint64_t counter;
+	int counterFutex;
+	int waiters;
+	int serverWaiters;
+};
+
+// Private netlink protocol that answers bulk queries for statistics. A client sends one
+// request (i.e., a nlmsghdr of type statsGetProcesses with NLM_F_DUMP) to port 0. The server
+// replies with multipart (NLM_F_MULTI) messages of type statsProcess, each one carrying
+// a ProcessStats payload, and terminates the dump with NLMSG_DONE. Replies are packed into
+// datagrams of at most statsMaxDatagramSize bytes; the receive buffer must be that large.
+inline constexpr int netlinkStats = 30;
+inline constexpr size_t statsMaxDatagramSize = 8192;
+
+enum StatsMessageTypes : uint16_t {
+	statsGetProcesses = 0x100,
+	statsProcess = 0x101
+};
+
+// Times are in nanoseconds, sizes are in bytes.
+struct ProcessStats {
+	int32_t pid;
+	int32_t ppid;
+	// Basename of the executable; NUL-terminated (possibly truncated).
+	char comm[16];
+	uint64_t userTime;
+	uint64_t kernelTime;
+	uint64_t waitTime;
+	uint64_t voluntarySwitches;
+	uint64_t involuntarySwitches;
+	uint64_t minorFaults;
+	uint64_t majorFaults;
+	int32_t lastCpu;
+	uint32_t reserved;
+	uint64_t mappedSize;
+	uint64_t anonymousRss;
+	uint64_t fileRss;
+	uint64_t sharedRss;
+	uint64_t pageTableSize;
 };
 
 struct ManagarmServerData {
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 
 #include <arch/dma_structs.hpp>
+#include <async/oneshot-event.hpp>
 #include <async/result.hpp>
 #include <frg/expected.hpp>
 
@@ -10,7 +12,13 @@
 
 enum class UsbError {
 	none,
-	stall
+	stall,
+	babble,
+	transactionError,
+	// The host controller could not service an isochronous packet in its (micro)frame.
+	missedService,
+	// The host controller does not implement the type of transfer.
+	unsupported
 };
 
 enum XferFlags {
@@ -50,6 +58,58 @@ struct BulkTransfer {
 	bool lazyNotification;
 };
 
+// The buffer is split into packets of packetSize bytes (the last packet may be shorter).
+// Each packet is transferred in its own service interval, as soon as possible.
+struct IsochronousTransfer {
+	IsochronousTransfer(XferFlags flags, arch::dma_buffer_view buffer, size_t packetSize)
+	: flags{flags}, buffer{buffer}, packetSize{packetSize} { }
+
+	XferFlags flags;
+	arch::dma_buffer_view buffer;
+	size_t packetSize;
+
+	size_t numPackets() const {
+		return (buffer.size() + packetSize - 1) / packetSize;
+	}
+};
+
+// Isochronous transfers do not retry; each packet reports its own status.
+struct IsochronousPacket {
+	UsbError status;
+	// Number of bytes that were actually transferred.
+	size_t length;
+};
+
+// Shared between the HCD and the owner of a QueuedTransfer.
+struct TransferCompletion {
+	async::oneshot_event done;
+	frg::expected<UsbError, size_t> result{size_t{0}};
+	// Only used by isochronous transfers.
+	std::vector<IsochronousPacket> packets;
+
+	void complete(frg::expected<UsbError, size_t> r) {
+		result = std::move(r);
+		done.raise();
+	}
+};
+
+// Handle to a transfer that was queued by Endpoint::submit().
+struct QueuedTransfer {
+	explicit QueuedTransfer(std::shared_ptr<TransferCompletion> completion)
+	: _completion{std::move(completion)} { }
+
+	// Returns the number of transferred bytes.
+	async::result<frg::expected<UsbError, size_t>> wait() const;
+
+	// Per-packet status of an isochronous transfer. Only valid after wait() completed.
+	const std::vector<IsochronousPacket> &packets() const {
+		return _completion->packets;
+	}
+
+private:
+	std::shared_ptr<TransferCompletion> _completion;
+};
+
 enum class PipeType {
 	null, in, out, control
 };
@@ -66,6 +126,19 @@ public:
 	virtual async::result<frg::expected<UsbError>> transfer(ControlTransfer info) = 0;
 	virtual async::result<frg::expected<UsbError, size_t>> transfer(InterruptTransfer info) = 0;
 	virtual async::result<frg::expected<UsbError, size_t>> transfer(BulkTransfer info) = 0;
+
+	// The default implementation returns UsbError::unsupported.
+	virtual async::result<frg::expected<UsbError, std::vector<IsochronousPacket>>>
+	transfer(IsochronousTransfer info);
+
+	// Queue the transfer and return immediately. Transfers that are queued on the same
+	// endpoint are retired in submission order; this allows callers to keep the endpoint
+	// busy without waiting for each transfer. The endpoint and the buffer must stay
+	// alive until the transfer completes.
+	// The default implementations run transfer() in the background.
+	virtual void submit(InterruptTransfer info, std::shared_ptr<TransferCompletion> completion);
+	virtual void submit(BulkTransfer info, std::shared_ptr<TransferCompletion> completion);
+	virtual void submit(IsochronousTransfer info, std::shared_ptr<TransferCompletion> completion);
 };
 
 
@@ -75,6 +148,12 @@ struct Endpoint {
 	async::result<frg::expected<UsbError>> transfer(ControlTransfer info) const;
 	async::result<frg::expected<UsbError, size_t>> transfer(InterruptTransfer info) const;
 	async::result<frg::expected<UsbError, size_t>> transfer(BulkTransfer info) const;
+	async::result<frg::expected<UsbError, std::vector<IsochronousPacket>>>
+	transfer(IsochronousTransfer info) const;
+
+	QueuedTransfer submit(InterruptTransfer info) const;
+	QueuedTransfer submit(BulkTransfer info) const;
+	QueuedTransfer submit(IsochronousTransfer info) const;
 
 private:
 	std::shared_ptr<EndpointData> _state;
@@ -52,6 +52,61 @@ Interface::getEndpoint(PipeType type, int number) const {
 	return _state->getEndpoint(type, number);
 }
 
+// ----------------------------------------------------------------------------
+// QueuedTransfer.
+// ----------------------------------------------------------------------------
+
+async::result<frg::expected<UsbError, size_t>> QueuedTransfer::wait() const {
+	co_await _completion->done.wait();
+	co_return _completion->result;
+}
+
+// ----------------------------------------------------------------------------
+// EndpointData.
+// ----------------------------------------------------------------------------
+
+namespace {
+
+template<typename T>
+async::detached runQueued(EndpointData *state, T info,
+		std::shared_ptr<TransferCompletion> completion) {
+	completion->complete(co_await state->transfer(info));
+}
+
+async::detached runQueuedIsochronous(EndpointData *state, IsochronousTransfer info,
+		std::shared_ptr<TransferCompletion> completion) {
+	auto outcome = co_await state->transfer(info);
+	if(!outcome) {
+		completion->complete(outcome.error());
+		co_return;
+	}
+
+	size_t length = 0;
+	for(auto &packet : outcome.value())
+		length += packet.length;
+	completion->packets = std::move(outcome.value());
+	completion->complete(length);
+}
+
+} // anonymous namespace
+
+async::result<frg::expected<UsbError, std::vector<IsochronousPacket>>>
+EndpointData::transfer(IsochronousTransfer) {
+	co_return UsbError::unsupported;
+}
+
+void EndpointData::submit(InterruptTransfer info, std::shared_ptr<TransferCompletion> completion) {
+	runQueued(this, info, std::move(completion));
+}
+
+void EndpointData::submit(BulkTransfer info, std::shared_ptr<TransferCompletion> completion) {
+	runQueued(this, info, std::move(completion));
+}
+
+void EndpointData::submit(IsochronousTransfer info, std::shared_ptr<TransferCompletion> completion) {
+	runQueuedIsochronous(this, info, std::move(completion));
+}
+
 // ----------------------------------------------------------------------------
 // Endpoint.
 // ----------------------------------------------------------------------------
@@ -67,3 +122,26 @@ async::result<frg::expected<UsbError, size_t>> Endpoint::transfer(BulkTransfer i
 	return _state->transfer(info);
 }
 
+
+async::result<frg::expected<UsbError, std::vector<IsochronousPacket>>>
+Endpoint::transfer(IsochronousTransfer info) const {
+	return _state->transfer(info);
+}
+
+QueuedTransfer Endpoint::submit(InterruptTransfer info) const {
+	auto completion = std::make_shared<TransferCompletion>();
+	_state->submit(info, completion);
+	return QueuedTransfer{std::move(completion)};
+}
+
+QueuedTransfer Endpoint::submit(BulkTransfer info) const {
+	auto completion = std::make_shared<TransferCompletion>();
+	_state->submit(info, completion);
+	return QueuedTransfer{std::move(completion)};
+}
+
+QueuedTransfer Endpoint::submit(IsochronousTransfer info) const {
+	auto completion = std::make_shared<TransferCompletion>();
+	_state->submit(info, completion);
+	return QueuedTransfer{std::move(completion)};
+}
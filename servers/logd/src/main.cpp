@@ -0,0 +1,231 @@
+// logd collects the binary log records of other servers and formats them.
+// Each client shares a ring with logd (see logging.bragi); logd polls all rings,
+// such that logging does not require a syscall on the client side.
+
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+#include <async/oneshot-event.hpp>
+#include <bragi/helpers-std.hpp>
+#include <frg/std_compat.hpp>
+#include <helix/ipc.hpp>
+#include <helix/memory.hpp>
+#include <helix/timer.hpp>
+#include <protocols/logging/logging.hpp>
+#include <protocols/mbus/client.hpp>
+#include <logging.bragi.hpp>
+
+namespace logging = protocols::logging;
+using managarm::logging::RingLayout;
+using managarm::logging::RecordKind;
+
+namespace {
+
+// Polling intervals between passes over a ring. The interval is reset
+// whenever the ring contains records and grows while it is empty.
+constexpr uint64_t minPollInterval = 1'000'000;
+constexpr uint64_t maxPollInterval = 64'000'000;
+
+struct SiteInfo {
+	logging::Level level;
+	std::string subsystem;
+	std::string format;
+};
+
+struct Client {
+	Client(helix::UniqueDescriptor memory)
+	: memory{std::move(memory)}, mapping{this->memory, 0, RingLayout::RING_SIZE} { }
+
+	char *window() {
+		return reinterpret_cast<char *>(mapping.get());
+	}
+
+	// Copies data out of the ring. Handles records that wrap around.
+	void copyOut(void *dest, uint64_t position, size_t size) {
+		constexpr size_t capacity = RingLayout::RING_SIZE - RingLayout::RING_DATA;
+		auto offset = position % capacity;
+		auto chunk = std::min(size, capacity - offset);
+		memcpy(dest, window() + RingLayout::RING_DATA + offset, chunk);
+		memcpy(reinterpret_cast<char *>(dest) + chunk, window() + RingLayout::RING_DATA,
+				size - chunk);
+	}
+
+	// Formats all records up to the current head. Returns the number of records.
+	size_t drain();
+
+	helix::UniqueDescriptor memory;
+	helix::Mapping mapping;
+	std::unordered_map<uint32_t, SiteInfo> sites;
+	uint64_t reportedDrops = 0;
+	bool closed = false;
+};
+
+size_t Client::drain() {
+	auto headPtr = reinterpret_cast<uint64_t *>(window() + RingLayout::RING_HEAD);
+	auto tailPtr = reinterpret_cast<uint64_t *>(window() + RingLayout::RING_TAIL);
+	auto droppedPtr = reinterpret_cast<uint64_t *>(window() + RingLayout::RING_DROPPED);
+
+	auto head = __atomic_load_n(headPtr, __ATOMIC_ACQUIRE);
+	auto tail = __atomic_load_n(tailPtr, __ATOMIC_RELAXED);
+
+	size_t n = 0;
+	char record[RingLayout::RING_MAX_RECORD];
+	while(tail != head) {
+		uint32_t header[3];
+		copyOut(header, tail, sizeof(header));
+		auto [size, kind, id] = header;
+		if(size < sizeof(header) || size > sizeof(record) || size > head - tail) {
+			std::cout << "logd: Client wrote a corrupted record" << std::endl;
+			tail = head;
+			break;
+		}
+		copyOut(record, tail, size);
+		tail += size;
+		n++;
+
+		if(kind == RecordKind::SITE) {
+			if(size < sizeof(header) + 5)
+				continue;
+			uint8_t level;
+			uint16_t subsystemLength, formatLength;
+			memcpy(&level, record + sizeof(header), 1);
+			memcpy(&subsystemLength, record + sizeof(header) + 1, 2);
+			memcpy(&formatLength, record + sizeof(header) + 3, 2);
+			size_t offset = sizeof(header) + 5;
+			if(offset + subsystemLength + formatLength > size)
+				continue;
+			sites[id] = SiteInfo{
+				static_cast<logging::Level>(level),
+				std::string{record + offset, subsystemLength},
+				std::string{record + offset + subsystemLength, formatLength}
+			};
+		}else if(kind == RecordKind::MESSAGE) {
+			auto it = sites.find(id);
+			if(it == sites.end()) {
+				std::cout << "logd: Message refers to unknown site " << id << std::endl;
+				continue;
+			}
+			auto &site = it->second;
+			auto message = logging::formatMessage(site.format,
+					record + sizeof(header), size - sizeof(header));
+			std::cout << logging::formatLine(site.level, site.subsystem, message) << '\n';
+		}
+	}
+
+	// Publish the new tail only after the records are copied out.
+	__atomic_store_n(tailPtr, tail, __ATOMIC_RELEASE);
+
+	auto dropped = __atomic_load_n(droppedPtr, __ATOMIC_RELAXED);
+	if(dropped != reportedDrops) {
+		std::cout << "logd: Client dropped " << (dropped - reportedDrops)
+				<< " messages" << '\n';
+		reportedDrops = dropped;
+	}
+
+	if(n)
+		std::cout << std::flush;
+	return n;
+}
+
+// Waits until the client closes the conversation (usually because it exits).
+async::detached watchClient(Client *client, helix::UniqueLane conversation) {
+	auto [recvMsg] = co_await helix_ng::exchangeMsgs(
+		conversation,
+		helix_ng::recvInline()
+	);
+	if(recvMsg.error() != kHelErrEndOfLane)
+		HEL_CHECK(recvMsg.error());
+	client->closed = true;
+}
+
+async::detached drainClient(helix::UniqueLane conversation, helix::UniqueDescriptor memory) {
+	Client client{std::move(memory)};
+
+	managarm::logging::Response resp;
+	resp.set_error(managarm::logging::Error::SUCCESS);
+	auto [sendResp] = co_await helix_ng::exchangeMsgs(
+		conversation,
+		helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+	);
+	HEL_CHECK(sendResp.error());
+
+	watchClient(&client, std::move(conversation));
+
+	uint64_t interval = minPollInterval;
+	while(!client.closed) {
+		if(client.drain()) {
+			interval = minPollInterval;
+		}else{
+			interval = std::min(interval * 2, maxPollInterval);
+		}
+		co_await helix::sleepFor(interval);
+	}
+
+	// Print the records that the client wrote before it exited.
+	client.drain();
+}
+
+async::detached serve(helix::UniqueLane lane) {
+	while(true) {
+		auto [accept, recvReq, pullMemory] =
+			co_await helix_ng::exchangeMsgs(
+				lane,
+				helix_ng::accept(
+					helix_ng::recvInline(),
+					helix_ng::pullDescriptor()
+				)
+			);
+		if(accept.error() == kHelErrEndOfLane)
+			co_return;
+		HEL_CHECK(accept.error());
+		HEL_CHECK(recvReq.error());
+
+		auto conversation = accept.descriptor();
+
+		auto preamble = bragi::read_preamble(recvReq);
+		if(preamble.id() == managarm::logging::AttachRingReq::message_id) {
+			HEL_CHECK(pullMemory.error());
+			recvReq.reset();
+			drainClient(std::move(conversation), pullMemory.descriptor());
+		}else{
+			recvReq.reset();
+			managarm::logging::Response resp;
+			resp.set_error(managarm::logging::Error::ILLEGAL_REQUEST);
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+			HEL_CHECK(sendResp.error());
+		}
+	}
+}
+
+async::detached advertise() {
+	auto root = co_await mbus::Instance::global().getRoot();
+
+	mbus::Properties descriptor {
+		{"class", mbus::StringItem{"logd"}}
+	};
+
+	auto handler = mbus::ObjectHandler{}
+	.withBind([=] () -> async::result<helix::UniqueDescriptor> {
+		auto [localLane, remoteLane] = helix::createStream();
+
+		serve(std::move(localLane));
+		co_return std::move(remoteLane);
+	});
+
+	co_await root.createObject("logd", descriptor, std::move(handler));
+}
+
+} // anonymous namespace
+
+int main() {
+	std::cout << "logd: Starting log collector" << std::endl;
+
+	advertise();
+	async::run_forever(helix::currentDispatcher);
+}
@@ -0,0 +1,160 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arch/bit.hpp>
+#include <arch/dma_pool.hpp>
+#include <async/result.hpp>
+#include <smarter.hpp>
+
+#include "ip/checksum.hpp"
+#include "ip/ip4.hpp"
+#include "ip/tcp4.hpp"
+#include "shard.hpp"
+
+#include <netserver/nic.hpp>
+
+// Floods synthetic packets through the demultiplexing code of the TCP layer
+// and through the route lookup. Nothing is ever sent on a real link.
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+constexpr auto benchmarkDuration = std::chrono::seconds{1};
+
+// Address of the local end of all synthetic connections.
+constexpr uint32_t localIp = 0x0a0a020f;
+
+struct NullLink : nic::Link {
+	NullLink()
+	: nic::Link{1500, nullptr} { }
+
+	async::result<nic::RxInfo> receive(arch::dma_buffer_view, size_t) override {
+		std::cout << "netserver-bench: NullLink cannot receive" << std::endl;
+		abort();
+	}
+
+	async::result<void> send(const arch::dma_buffer_view, size_t) override {
+		co_return;
+	}
+};
+
+void store16(uint8_t *p, uint16_t v) {
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+void store32(uint8_t *p, uint32_t v) {
+	store16(p, v >> 16);
+	store16(p + 2, v);
+}
+
+// Builds a pure ACK packet (IPv4 + TCP, no options) for the given flow.
+// The TCP checksum is left zero, so the TCP layer does not verify it; this
+// benchmark measures the lookup, not the checksum code.
+smarter::shared_ptr<const Ip4Packet> makeAckPacket(arch::dma_pool *pool, TcpFlow flow) {
+	constexpr size_t size = 40;
+	arch::dma_buffer buffer{pool, size};
+	auto p = reinterpret_cast<uint8_t *>(buffer.data());
+	memset(p, 0, size);
+
+	// IPv4 header; remote -> local.
+	p[0] = 0x45;
+	store16(p + 2, size);
+	p[8] = 64;
+	p[9] = static_cast<uint8_t>(IpProto::tcp);
+	store32(p + 12, flow.remoteIp);
+	store32(p + 16, flow.localIp);
+	Checksum csum;
+	csum.update(p, 20);
+	store16(p + 10, csum.finalize());
+
+	// TCP header.
+	auto tcp = p + 20;
+	store16(tcp, flow.remotePort);
+	store16(tcp + 2, flow.localPort);
+	tcp[12] = 5 << 4; // Header length in words.
+	tcp[13] = 0x10; // ACK.
+	store16(tcp + 14, 0xFFFF);
+
+	Ip4Packet packet;
+	auto view = buffer.subview(0);
+	if(!packet.parse(std::move(buffer), view)) {
+		std::cout << "netserver-bench: Failed to parse synthetic packet" << std::endl;
+		abort();
+	}
+	return smarter::allocate_shared<const Ip4Packet>(PacketAllocator{}, std::move(packet));
+}
+
+void benchmarkTcpDemux(arch::dma_pool *pool, size_t numFlows) {
+	std::mt19937 prng;
+	Tcp4 tcp;
+
+	std::vector<smarter::shared_ptr<const Ip4Packet>> packets;
+	for(size_t i = 0; i < numFlows; i++) {
+		TcpFlow flow{localIp, static_cast<uint32_t>(prng()),
+				static_cast<uint16_t>(32768 + i % 28232), static_cast<uint16_t>(prng())};
+		tcp.addSyntheticConnection(flow);
+		packets.push_back(makeAckPacket(pool, flow));
+	}
+
+	uint64_t n = 0;
+	auto start = clock::now();
+	while(clock::now() - start < benchmarkDuration) {
+		// Check the clock only once per batch.
+		for(int k = 0; k < 1024; k++)
+			tcp.feedDatagram(packets[n++ % packets.size()]);
+	}
+	auto elapsed = std::chrono::duration<double>(clock::now() - start).count();
+	std::cout << "tcp-demux, " << numFlows << " connections: "
+			<< static_cast<uint64_t>(n / elapsed) << " packets per second" << std::endl;
+}
+
+void benchmarkRouteLookup(size_t numRoutes) {
+	std::mt19937 prng;
+	Ip4Router router;
+	auto link = std::make_shared<NullLink>();
+
+	router.addRoute({{0, 0}, link});
+	for(size_t i = 0; i < numRoutes; i++) {
+		uint8_t prefix = 8 + prng() % 25;
+		router.addRoute({{static_cast<uint32_t>(prng()), prefix}, link});
+	}
+
+	std::vector<uint32_t> addresses(4096);
+	for(auto &address : addresses)
+		address = prng();
+
+	uint64_t n = 0;
+	auto start = clock::now();
+	while(clock::now() - start < benchmarkDuration) {
+		for(int k = 0; k < 1024; k++) {
+			auto route = router.resolveRoute(addresses[n++ % addresses.size()]);
+			if(!route) {
+				std::cout << "netserver-bench: Default route not found" << std::endl;
+				abort();
+			}
+		}
+	}
+	auto elapsed = std::chrono::duration<double>(clock::now() - start).count();
+	std::cout << "route-lookup, " << numRoutes << " routes: "
+			<< static_cast<uint64_t>(n / elapsed) << " lookups per second" << std::endl;
+}
+
+} // anonymous namespace
+
+int main() {
+	// The protocol layers expect to run on a shard.
+	initShards(1);
+	auto pool = currentShard().dmaPool();
+
+	for(size_t numFlows : {1, 64, 4096, 65536})
+		benchmarkTcpDemux(pool, numFlows);
+	for(size_t numRoutes : {1, 64, 4096, 65536})
+		benchmarkRouteLookup(numRoutes);
+}
@@ -3,6 +3,7 @@
 #include <arch/dma_pool.hpp>
 #include <async/result.hpp>
 #include <cstdint>
+#include <memory>
 
 namespace nic {
 struct MacAddress {
@@ -34,8 +35,41 @@ enum EtherType : uint16_t {
 	ETHER_TYPE_ARP = 0x0806,
 };
 
-// TODO(arsen): Expose interface for csum offloading, constructing frames, and
-// other features of NICs
+// Offload capabilities of a Link, see Link::features.
+namespace features {
+	// TCP/UDP checksums of outgoing frames can be offloaded (TxOffload::needsChecksum).
+	inline constexpr uint32_t txChecksum = 1 << 0;
+	// The link validates TCP/UDP checksums of incoming frames (RxInfo::checksumValid).
+	inline constexpr uint32_t rxChecksum = 1 << 1;
+	// TCP/IPv4 segmentation can be offloaded (TxOffload::gsoSize). Implies txChecksum.
+	inline constexpr uint32_t tso4 = 1 << 2;
+	// Packets are delivered to the local stack without Ethernet framing or ARP,
+	// see nic::loopback(). Such links are never driven by runDevice().
+	inline constexpr uint32_t loopback = 1 << 3;
+}
+
+// Per-frame offload requests for Link::sendOffloaded(). Offsets are relative to the frame.
+struct TxOffload {
+	// The link computes the checksum from csumStart to the end of the frame and stores it
+	// at csumStart + csumOffset. The checksum field must contain the pseudo header sum.
+	bool needsChecksum = false;
+	uint16_t csumStart = 0;
+	uint16_t csumOffset = 0;
+
+	// If non-zero, the frame is a TCP/IPv4 super-segment that the link splits into
+	// segments with gsoSize bytes of payload each. headerLength covers all headers.
+	uint16_t gsoSize = 0;
+	uint16_t headerLength = 0;
+};
+
+// Per-frame information returned by Link::receive().
+struct RxInfo {
+	// The TCP/UDP checksum of this frame does not need to be validated in software.
+	bool checksumValid = false;
+	// Length of the frame.
+	size_t length = 0;
+};
+
 struct Link {
 	struct AllocatedBuffer {
 		arch::dma_buffer frame;
@@ -44,20 +78,50 @@ struct Link {
 	inline Link(unsigned int mtu, arch::dma_pool *dmaPool)
 		: mtu(mtu), dmaPool_(dmaPool) {}
 	virtual ~Link() = default;
+	//! Number of RX/TX queue pairs. Each queue must only be used by one
+	//! coroutine at a time. Devices usually receive the frames of a flow on
+	//! the queue that the flow was transmitted on.
+	virtual size_t numQueues();
 	//! Receives an entire frame from the network
-	virtual async::result<void> receive(arch::dma_buffer_view) = 0;
+	virtual async::result<RxInfo> receive(arch::dma_buffer_view, size_t queue) = 0;
 	//! Sends an entire ethernet frame
-	virtual async::result<void> send(const arch::dma_buffer_view) = 0;
+	virtual async::result<void> send(const arch::dma_buffer_view, size_t queue) = 0;
+	//! Sends an entire ethernet frame, applying offloads. The default
+	//! implementation computes checksums in software and cannot segment.
+	virtual async::result<void> sendOffloaded(const arch::dma_buffer_view, TxOffload,
+		size_t queue);
 	arch::dma_pool *dmaPool();
 	AllocatedBuffer allocateFrame(MacAddress to, EtherType type,
 		size_t payloadSize);
+	//! Changes the destination of a frame that was obtained from allocateFrame().
+	void setFrameDestination(arch::dma_buffer_view frame, MacAddress to);
 
 	MacAddress deviceMac();
 	unsigned int mtu;
+	// Bitmask of nic::features.
+	uint32_t features = 0;
 protected:
 	arch::dma_pool *dmaPool_;
 	MacAddress mac_;
 };
 
+// The loopback device. Checksums are neither computed nor validated since packets
+// never leave the host.
+struct LoopbackLink final : Link {
+	LoopbackLink();
+
+	async::result<RxInfo> receive(arch::dma_buffer_view, size_t queue) override;
+	async::result<void> send(const arch::dma_buffer_view, size_t queue) override;
+};
+
 async::detached runDevice(std::shared_ptr<Link> dev);
+
+//! Feeds an IPv4 packet (without Ethernet header) that was sent over a loopback link
+//! back into the stack. The packet must be allocated from the pool of the current shard.
+void loopback(arch::dma_buffer packet);
+
+//! Transmits a frame that was obtained from Link::allocateFrame() on the current shard.
+//! Links are only driven from the NIC shard; other shards hand their frames over to it.
+async::result<void> transmit(std::shared_ptr<Link> link, arch::dma_buffer frame,
+	TxOffload offload = {});
 } // namespace nic
@@ -65,7 +65,7 @@ async::result<void> sendArp(uint16_t op,
 
 	appendData(targetHw);
 	appendData(targetProto);
-	co_await link->send(std::move(buffer.frame));
+	co_await nic::transmit(std::move(link), std::move(buffer.frame));
 }
 }
 
@@ -131,66 +131,117 @@ void Neighbours::feedArp(nic::MacAddress, arch::dma_buffer_view view) {
 	async::detach(sendArp(2, targetProto, senderHw, senderProto));
 }
 
-Neighbours::Entry &Neighbours::getEntry(uint32_t ip) {
+namespace {
+uint64_t currentTime() {
 	uint64_t time;
 	HEL_CHECK(helGetClock(&time));
-	if (auto f = table_.find(ip); f != table_.end()) {
-		if (time + staleTimeMs * 1'000'000 <= f->second.mtime_ns) {
-			f->second.state = State::stale;
-		}
-		return f->second;
+	return time;
+}
+} // namespace
+
+Neighbours::Entry &Neighbours::getEntry(uint32_t ip, uint64_t now) {
+	auto [it, inserted] = table_.try_emplace(ip);
+	auto &entry = it->second;
+	if (inserted) {
+		entry.mtime_ns = now;
+	} else if (entry.state == State::reachable
+			&& entry.mtime_ns + staleTimeMs * 1'000'000 <= now) {
+		entry.state = State::stale;
 	}
-	auto &entry = table_.emplace(std::piecewise_construct,
-		std::make_tuple(ip), std::make_tuple()).first->second;
-	entry.mtime_ns = time;
 	return entry;
 }
 
 void Neighbours::updateTable(uint32_t ip, nic::MacAddress mac) {
-	auto &entry = getEntry(ip);
+	auto &entry = getEntry(ip, currentTime());
 	entry.mac = mac;
+	entry.mtime_ns = currentTime();
 	entry.state = State::reachable;
+	entry.seq++;
 	entry.change.raise();
+
+	// Flush all frames that waited for this address at once.
+	while (!entry.pending.empty()) {
+		auto p = std::move(entry.pending.front());
+		entry.pending.pop_front();
+		p.link->setFrameDestination(p.frame, mac);
+		async::detach(nic::transmit(std::move(p.link), std::move(p.frame), p.offload));
+	}
 }
 
-namespace {
-async::detached entryProber(uint32_t ip, Neighbours::Entry &e, uint32_t sender) {
-	e.state = Neighbours::State::probe;
+void Neighbours::startProbe_(uint32_t ip, Entry &entry, uint32_t sender) {
+	if (entry.probing)
+		return;
+	entry.probing = true;
+	if (entry.state == State::none || entry.state == State::failed)
+		entry.state = State::probe;
+	runProbe_(ip, entry, sender);
+}
+
+async::detached Neighbours::runProbe_(uint32_t ip, Entry &e, uint32_t sender) {
+	auto seq = e.seq;
 	for (int i = 0; i < 3; i++) {
 		co_await sendArp(1, sender, {}, ip);
-		std::cout << "netserver: sent arp req" << std::endl;
 
 		async::cancellation_event ev;
 		helix::TimeoutCancellation timer { 1'000'000'000, ev };
 		co_await e.change.async_wait(ev);
 		co_await timer.retire();
 
-		if (e.state != Neighbours::State::probe) {
+		if (e.seq != seq) {
+			e.probing = false;
 			co_return;
 		}
 	}
-	e.state = Neighbours::State::failed;
+	std::cout << "netserver: ARP resolution failed" << std::endl;
+	e.probing = false;
+	e.state = State::failed;
+	e.mtime_ns = currentTime();
+	e.pending.clear();
 	e.change.raise();
 }
-} // namespace
 
-async::result<std::optional<nic::MacAddress>> Neighbours::tryResolve(uint32_t ip,
-		uint32_t sender) {
-	auto &entry = getEntry(ip);
-	if (entry.state == State::reachable) {
-		co_return entry.mac;
+std::optional<nic::MacAddress> Neighbours::lookup(uint32_t ip, uint32_t sender) {
+	auto now = currentTime();
+	auto &entry = getEntry(ip, now);
+	switch (entry.state) {
+	case State::reachable:
+		if (entry.mtime_ns + refreshTimeMs * 1'000'000 <= now)
+			startProbe_(ip, entry, sender);
+		return entry.mac;
+	case State::stale:
+		// Keep using the old address while it is confirmed.
+		startProbe_(ip, entry, sender);
+		return entry.mac;
+	case State::failed:
+		if (entry.mtime_ns + failedTimeMs * 1'000'000 <= now)
+			startProbe_(ip, entry, sender);
+		return std::nullopt;
+	default:
+		startProbe_(ip, entry, sender);
+		return std::nullopt;
 	}
-	if (entry.state != State::probe) {
-		entryProber(ip, entry, sender);
-	}
-	co_await entry.change.async_wait();
-	if (entry.state != State::reachable) {
-		co_return std::nullopt;
+}
+
+bool Neighbours::sendWhenResolved(uint32_t ip, uint32_t sender,
+		std::shared_ptr<nic::Link> link, arch::dma_buffer frame, nic::TxOffload offload) {
+	auto &entry = getEntry(ip, currentTime());
+	if (entry.state == State::reachable || entry.state == State::stale) {
+		link->setFrameDestination(frame, entry.mac);
+		async::detach(nic::transmit(std::move(link), std::move(frame), offload));
+		return true;
 	}
-	co_return entry.mac;
+	if (entry.state != State::probe)
+		return false;
+
+	// Like Linux, drop the oldest frame if too many frames are waiting.
+	if (entry.pending.size() == maxPending)
+		entry.pending.pop_front();
+	entry.pending.push_back({std::move(link), std::move(frame), offload});
+	return true;
 }
 
+// Each shard resolves addresses on its own; ARP frames are delivered to all shards.
 Neighbours &neigh4() {
-	static Neighbours neigh;
+	thread_local Neighbours neigh;
 	return neigh;
 }
@@ -2,11 +2,20 @@
 
 #include <async/recurring-event.hpp>
 #include <netserver/nic.hpp>
-#include <map>
+#include <deque>
 #include <optional>
+#include <unordered_map>
 
 struct Neighbours {
 	static constexpr uint64_t staleTimeMs = 30'000;
+	// Reachable entries are re-probed in the background once they are this old,
+	// such that they (usually) never become stale while they are in use.
+	static constexpr uint64_t refreshTimeMs = 25'000;
+	// Failed entries are not probed again for this long.
+	static constexpr uint64_t failedTimeMs = 1'000;
+	// Maximal number of frames that wait for the resolution of a single address.
+	static constexpr size_t maxPending = 16;
+
 	enum class State {
 		none,
 		probe,
@@ -14,19 +23,39 @@ struct Neighbours {
 		reachable,
 		stale
 	};
+	struct PendingFrame {
+		std::shared_ptr<nic::Link> link;
+		arch::dma_buffer frame;
+		nic::TxOffload offload;
+	};
 	struct Entry {
 		uint64_t mtime_ns;
 		nic::MacAddress mac;
 		async::recurring_event change;
 		State state = State::none;
+		// Incremented whenever the address is confirmed by an ARP packet.
+		uint64_t seq = 0;
+		bool probing = false;
+		std::deque<PendingFrame> pending;
 	};
-	async::result<std::optional<nic::MacAddress>> tryResolve(uint32_t addr,
-		uint32_t sender);
+
+	// Returns the hardware address if it is known (possibly from a stale entry).
+	// Starts a probe in the background if the address is unknown or old.
+	std::optional<nic::MacAddress> lookup(uint32_t addr, uint32_t sender);
+	// Sends the frame once addr is resolved. The frame must be obtained from
+	// Link::allocateFrame(); its destination is overwritten. Returns false if
+	// addr is known to be unreachable.
+	bool sendWhenResolved(uint32_t addr, uint32_t sender, std::shared_ptr<nic::Link> link,
+		arch::dma_buffer frame, nic::TxOffload offload);
+
 	void feedArp(nic::MacAddress destination, arch::dma_buffer_view arpData);
 	void updateTable(uint32_t proto, nic::MacAddress hardware);
 private:
-	Entry &getEntry(uint32_t addr);
-	std::map<uint32_t, Entry> table_;
+	Entry &getEntry(uint32_t addr, uint64_t now);
+	void startProbe_(uint32_t addr, Entry &entry, uint32_t sender);
+	async::detached runProbe_(uint32_t addr, Entry &entry, uint32_t sender);
+	// Entries are never removed, so references to them stay valid.
+	std::unordered_map<uint32_t, Entry> table_;
 };
 
 Neighbours &neigh4();
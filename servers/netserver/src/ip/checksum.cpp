@@ -1,6 +1,171 @@
 #include "checksum.hpp"
 
 #include <arch/bit.hpp>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// All sum*() functions below compute the one's complement sum of 16-bit words in
+// *native* byte order (RFC 1071 sums are byte order independent up to a final swap).
+// The result is not folded to 16 bits yet.
+
+uint64_t addWithCarry(uint64_t sum, uint64_t value) {
+	sum += value;
+	return sum + (sum < value);
+}
+
+uint64_t sumScalar(const unsigned char *p, size_t size, uint64_t sum = 0) {
+	while (size >= 8) {
+		uint64_t w;
+		memcpy(&w, p, 8);
+		sum = addWithCarry(sum, w);
+		p += 8;
+		size -= 8;
+	}
+	if (size >= 4) {
+		uint32_t w;
+		memcpy(&w, p, 4);
+		sum = addWithCarry(sum, w);
+		p += 4;
+		size -= 4;
+	}
+	if (size >= 2) {
+		uint16_t w;
+		memcpy(&w, p, 2);
+		sum = addWithCarry(sum, w);
+		p += 2;
+		size -= 2;
+	}
+	if (size) {
+		// A trailing byte is padded with a zero byte on the right.
+		uint16_t w = 0;
+		memcpy(&w, p, 1);
+		sum = addWithCarry(sum, w);
+	}
+	return sum;
+}
+
+#if defined(__x86_64__)
+
+// 16-bit words are widened to 32-bit lanes; each lane can absorb this many
+// blocks before it can overflow.
+constexpr size_t blocksPerFlush = 0x8000;
+
+uint64_t sumSse2(const unsigned char *p, size_t size) {
+	uint64_t sum = 0;
+	const __m128i zero = _mm_setzero_si128();
+	while (size >= 16) {
+		__m128i acc = _mm_setzero_si128();
+		size_t n = 0;
+		for (; n < blocksPerFlush && size >= 16; n++) {
+			auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+			acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+			acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+			p += 16;
+			size -= 16;
+		}
+
+		alignas(16) uint32_t lanes[4];
+		_mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc);
+		for (auto lane : lanes)
+			sum = addWithCarry(sum, lane);
+	}
+	return sumScalar(p, size, sum);
+}
+
+[[gnu::target("avx2")]]
+uint64_t sumAvx2(const unsigned char *p, size_t size) {
+	uint64_t sum = 0;
+	const __m256i zero = _mm256_setzero_si256();
+	while (size >= 32) {
+		__m256i acc = _mm256_setzero_si256();
+		size_t n = 0;
+		for (; n < blocksPerFlush && size >= 32; n++) {
+			auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+			acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+			acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+			p += 32;
+			size -= 32;
+		}
+
+		alignas(32) uint32_t lanes[8];
+		_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc);
+		for (auto lane : lanes)
+			sum = addWithCarry(sum, lane);
+	}
+	return addWithCarry(sum, sumSse2(p, size));
+}
+
+bool cpuHasAvx2() {
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	// The OS needs to save the YMM state (OSXSAVE, XCR0.SSE and XCR0.AVX).
+	if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+		return false;
+	uint32_t xcr0Lo, xcr0Hi;
+	asm volatile ("xgetbv" : "=a"(xcr0Lo), "=d"(xcr0Hi) : "c"(0));
+	if ((xcr0Lo & 6) != 6)
+		return false;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return false;
+	return ebx & bit_AVX2;
+}
+
+#elif defined(__aarch64__)
+
+uint64_t sumNeon(const unsigned char *p, size_t size) {
+	uint64x2_t acc = vdupq_n_u64(0);
+	while (size >= 16) {
+		// Pairwise widening adds cannot overflow: u16 -> u32 -> u64.
+		auto v = vreinterpretq_u16_u8(vld1q_u8(p));
+		acc = vpadalq_u32(acc, vpaddlq_u16(v));
+		p += 16;
+		size -= 16;
+	}
+	auto sum = addWithCarry(vgetq_lane_u64(acc, 0), vgetq_lane_u64(acc, 1));
+	return sumScalar(p, size, sum);
+}
+
+#endif
+
+using SumFunction = uint64_t (*)(const unsigned char *, size_t);
+
+SumFunction selectSumFunction() {
+#if defined(__x86_64__)
+	// SSE2 is part of the x86_64 baseline.
+	if (cpuHasAvx2())
+		return &sumAvx2;
+	return &sumSse2;
+#elif defined(__aarch64__)
+	// NEON is part of the aarch64 baseline.
+	return &sumNeon;
+#else
+	return [] (const unsigned char *p, size_t size) { return sumScalar(p, size); };
+#endif
+}
+
+const SumFunction sumFunction = selectSumFunction();
+
+// Folds a 64-bit sum to 16 bits and converts it to network byte order.
+uint16_t foldToBigEndian(uint64_t sum) {
+	sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+	sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+	sum = (sum >> 16) + (sum & 0xFFFF);
+	sum = (sum >> 16) + (sum & 0xFFFF);
+	sum = (sum >> 16) + (sum & 0xFFFF);
+	return arch::convert_endian<arch::endian::big, arch::endian::native>(
+		static_cast<uint16_t>(sum));
+}
+
+} // anonymous namespace
 
 void Checksum::update(uint16_t word)  {
 	state_ += word;
@@ -10,16 +175,17 @@ void Checksum::update(uint16_t word)  {
 }
 
 void Checksum::update(const void *data, size_t size) {
-	using namespace arch;
-	auto iter = static_cast<const unsigned char*>(data);
-	if (size % 2 != 0) {
-		size--;
-		update(iter[size] << 8);
-	}
-	auto end = iter + size;
-	for (; iter < end; iter += 2) {
-		update(iter[0] << 8 | iter[1]);
-	}
+	if (!size)
+		return;
+	auto sum = foldToBigEndian(sumFunction(static_cast<const unsigned char *>(data), size));
+
+	// If the previous fragments ended at an odd offset, the bytes of this fragment
+	// are shifted by one position; this corresponds to byte swapping its sum.
+	if (odd_)
+		sum = static_cast<uint16_t>(sum << 8 | sum >> 8);
+	odd_ ^= size & 1;
+
+	update(sum);
 }
 
 void Checksum::update(arch::dma_buffer_view view) {
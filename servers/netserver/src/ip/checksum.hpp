@@ -2,7 +2,9 @@
 
 #include <arch/dma_structs.hpp>
 
-// 16-bit one's compliment sum checksum, as described in RFC791, amongst others
+// 16-bit one's compliment sum checksum, as described in RFC791, amongst others.
+// Data can be fed in arbitrary fragments (including odd-sized ones);
+// the result is the same as if it was fed in a single update().
 struct Checksum {
 	void update(uint16_t word);
 	void update(const void *mem, size_t size);
@@ -11,4 +13,6 @@ struct Checksum {
 
 private:
 	uint32_t state_ = 0;
+	// Whether the data so far had an odd number of bytes.
+	bool odd_ = false;
 };
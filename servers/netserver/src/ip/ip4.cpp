@@ -2,10 +2,13 @@
 
 #include "arp.hpp"
 #include "checksum.hpp"
+#include "../shard.hpp"
 #include <async/recurring-event.hpp>
+#include <helix/timer.hpp>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <algorithm>
+#include <cassert>
 #include <cstring>
 #include <iostream>
 #include <iomanip>
@@ -16,36 +19,60 @@ using namespace protocols::fs;
 
 using Route = Ip4Router::Route;
 
+// The protocol state is per shard; configuration is applied to all shards.
 Ip4Router &ip4Router() {
-	static Ip4Router inst;
+	thread_local Ip4Router inst;
 	return inst;
 }
 
 Ip4 &ip4() {
-	static Ip4 inst;
+	thread_local Ip4 inst;
 	return inst;
 }
 
 bool Ip4Router::addRoute(Route r) {
-	return routes.emplace(std::move(r)).second;
+	auto node = &root;
+	auto net = r.network.ip & r.network.mask();
+	for (unsigned int i = 0; i < r.network.prefix; i++) {
+		auto bit = (net >> (31 - i)) & 1;
+		if (!node->children[bit])
+			node->children[bit] = std::make_unique<Node>();
+		node = node->children[bit].get();
+	}
+
+	auto it = std::lower_bound(node->routes.begin(), node->routes.end(), r);
+	if (it != node->routes.end() && !(r < *it))
+		return false;
+	node->routes.insert(it, std::move(r));
+	return true;
 }
 
 std::optional<Route> Ip4Router::resolveRoute(uint32_t ip) {
-	for (auto i = routes.begin(); i != routes.end(); i++) {
-		const auto &r = *i;
-		if (r.network.sameNet(ip)) {
-			if (r.link.expired()) {
-				i = routes.erase(i);
+	const Route *best = nullptr;
+	auto node = &root;
+	for (unsigned int i = 0; node; i++) {
+		auto &routes = node->routes;
+		for (auto it = routes.begin(); it != routes.end(); ) {
+			if (it->link.expired()) {
+				it = routes.erase(it);
 				continue;
 			}
-			return { r };
+			best = &*it;
+			break;
 		}
+
+		if (i == 32)
+			break;
+		node = node->children[(ip >> (31 - i)) & 1].get();
 	}
-	return {};
+
+	if (!best)
+		return {};
+	return { *best };
 }
 
-bool operator<(const CidrAddress &lhs, const CidrAddress &) {
-	return std::tie(lhs.prefix, lhs.ip) < std::tie(lhs.prefix, lhs.ip);
+bool operator<(const CidrAddress &lhs, const CidrAddress &rhs) {
+	return std::tie(lhs.prefix, lhs.ip) < std::tie(rhs.prefix, rhs.ip);
 }
 
 bool operator<(const Route &lhs, const Route &rhs) {
@@ -54,6 +81,117 @@ bool operator<(const Route &lhs, const Route &rhs) {
 		std::tie(rhs.network, rhs.metric, lhs.mtu);
 }
 
+namespace {
+
+// Free blocks of PacketAllocator. Packets can be freed on a different shard than
+// the one that allocated them; the blocks are simply adopted by that shard.
+struct PacketFreeList {
+	// Enough for a full RX ring worth of in-flight packets.
+	static constexpr size_t maxCached = 1024;
+
+	~PacketFreeList() {
+		while(head) {
+			auto next = head->next;
+			operator delete(head);
+			head = next;
+		}
+	}
+
+	struct Block {
+		Block *next;
+	};
+
+	Block *head = nullptr;
+	size_t numCached = 0;
+};
+
+thread_local PacketFreeList packetFreeList;
+
+} // anonymous namespace
+
+void *PacketAllocator::allocate(size_t size) {
+	assert(size <= blockSize);
+	auto &list = packetFreeList;
+	if(!list.head)
+		return operator new(blockSize);
+	auto block = list.head;
+	list.head = block->next;
+	list.numCached--;
+	return block;
+}
+
+void PacketAllocator::deallocate(void *pointer, size_t) {
+	free(pointer);
+}
+
+void PacketAllocator::free(void *pointer) {
+	if(!pointer)
+		return;
+	auto &list = packetFreeList;
+	if(list.numCached >= PacketFreeList::maxCached) {
+		operator delete(pointer);
+		return;
+	}
+	auto block = static_cast<PacketFreeList::Block *>(pointer);
+	block->next = list.head;
+	list.head = block;
+	list.numCached++;
+}
+
+static_assert(sizeof(Ip4Packet) + 64 <= PacketAllocator::blockSize,
+		"PacketAllocator blocks are too small for Ip4Packet");
+
+size_t Ip4Packet::payloadSize() const {
+	size_t size = 0;
+	forEachChunk([&] (arch::dma_buffer_view chunk) {
+		size += chunk.size();
+	});
+	return size;
+}
+
+void Ip4Packet::copyPayload(void *dest, size_t offset, size_t size) const {
+	auto p = static_cast<char *>(dest);
+	forEachChunk([&] (arch::dma_buffer_view chunk) {
+		if (offset >= chunk.size()) {
+			offset -= chunk.size();
+			return;
+		}
+		auto n = std::min(chunk.size() - offset, size);
+		std::memcpy(p, static_cast<const char *>(chunk.data()) + offset, n);
+		p += n;
+		size -= n;
+		offset = 0;
+	});
+	assert(!size);
+}
+
+arch::dma_buffer_view Ip4Packet::contiguousData() const {
+	if (fragments.empty())
+		return data;
+
+	if (!linear_.size()) {
+		size_t headerSize = header.ihl * 4;
+		size_t payload = payloadSize();
+		linear_ = arch::dma_buffer{currentShard().dmaPool(), headerSize + payload};
+		auto p = static_cast<uint8_t *>(linear_.data());
+		std::memcpy(p, data.data(), headerSize);
+		copyPayload(p + headerSize, 0, payload);
+
+		// The header is the one of the first fragment; fix up the length, the flags
+		// and the checksum.
+		auto length = arch::convert_endian<arch::endian::big>(
+				static_cast<uint16_t>(headerSize + payload));
+		std::memcpy(p + 2, &length, sizeof(uint16_t));
+		std::memset(p + 6, 0, sizeof(uint16_t));
+		std::memset(p + 10, 0, sizeof(uint16_t));
+		Checksum csum;
+		csum.update(p, headerSize);
+		auto sum = arch::convert_endian<arch::endian::big>(csum.finalize());
+		std::memcpy(p + 10, &sum, sizeof(uint16_t));
+	}
+	return linear_.subview(0);
+}
+
 bool Ip4Packet::parse(arch::dma_buffer owner, arch::dma_buffer_view frame) {
 	buffer_ = std::move(owner);
 	data = frame;
@@ -113,7 +251,7 @@ struct Ip4Socket {
 		}
 		auto element = std::move(self->pqueue.front());
 		self->pqueue.pop();
-		auto packet = element->data;
+		auto packet = element->contiguousData();
 		auto copy_size = std::min(packet.size(), len);
 		std::memcpy(data, packet.data(), copy_size);
 		sockaddr_in addr {
@@ -244,7 +382,17 @@ bool Ip4::hasIp(uint32_t addr) {
 }
 
 async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
-		void *data, size_t len, uint16_t proto) {
+		void *data, size_t len, uint16_t proto, nic::TxOffload offload) {
+	return sendFrameInPlace(std::move(ti), len, proto,
+		[data, len] (arch::dma_buffer_view payload) {
+			std::memcpy(payload.data(), data, len);
+		}, offload);
+}
+
+async::result<protocols::fs::Error> Ip4::sendFrameInPlace(Ip4TargetInfo ti,
+		size_t len, uint16_t proto,
+		std::function<void(arch::dma_buffer_view)> fill,
+		nic::TxOffload offload) {
 	using arch::convert_endian;
 	using arch::endian;
 
@@ -259,21 +407,16 @@ async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
 	}
 
 	auto &target = ti.link;
-	if (target->mtu < packet_size) {
+	if (offload.gsoSize) {
+		// The link segments the packet, so only the IP length field limits its size.
+		assert(target->features & nic::features::tso4);
+		if (packet_size > 0xFFFF)
+			co_return protocols::fs::Error::messageSize;
+	} else if (target->mtu < packet_size) {
 		std::cout << "netserver: cant fragment 2" << std::endl;
 		co_return protocols::fs::Error::messageSize;
 	}
 
-	auto macTarget = ti.route.gateway;
-	if (macTarget == 0) {
-		macTarget = ti.remote;
-	}
-
-	auto mac = co_await neigh4().tryResolve(macTarget, ti.source);
-	if (!mac) {
-		co_return protocols::fs::Error::hostUnreachable;
-	}
-
 	Ip4Packet::Header hdr;
 	// TODO(arsen): options
 	hdr.ihl = 0x45;
@@ -295,23 +438,63 @@ async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
 	chk.update(reinterpret_cast<void *>(&hdr), sizeof(hdr));
 	hdr.checksum = convert_endian<endian::big>(chk.finalize());
 
-	auto fb = target->allocateFrame(*mac, nic::ETHER_TYPE_IP4, packet_size);
+	// Loopback packets skip Ethernet framing and ARP. The L4 checksum is left as-is,
+	// the link advertises checksum offloading.
+	if (target->features & nic::features::loopback) {
+		arch::dma_buffer packet{currentShard().dmaPool(), packet_size};
+		std::memcpy(packet.data(), &hdr, sizeof(hdr));
+		fill(packet.subview(header_size));
+		nic::loopback(std::move(packet));
+		co_return protocols::fs::Error::none;
+	}
+
+	auto macTarget = ti.route.gateway;
+	if (macTarget == 0) {
+		macTarget = ti.remote;
+	}
+
+	// Unresolved addresses do not block the sender; the frame is queued instead.
+	auto mac = neigh4().lookup(macTarget, ti.source);
+	auto fb = target->allocateFrame(mac.value_or(nic::MacAddress{}),
+		nic::ETHER_TYPE_IP4, packet_size);
 
 	std::memcpy(fb.payload.data(), &hdr, sizeof(hdr));
-	std::memcpy(fb.payload.subview(header_size).byte_data(), data, len);
+	fill(fb.payload.subview(header_size));
 
-	co_await target->send(std::move(fb.frame));
+	if (offload.needsChecksum || offload.gsoSize) {
+		auto l4Offset = static_cast<char *>(fb.payload.data())
+			- static_cast<char *>(fb.frame.data()) + header_size;
+		offload.csumStart += l4Offset;
+		offload.headerLength += l4Offset;
+	}
+	if (!mac) {
+		if (!neigh4().sendWhenResolved(macTarget, ti.source, std::move(target),
+				std::move(fb.frame), offload))
+			co_return protocols::fs::Error::hostUnreachable;
+		co_return protocols::fs::Error::none;
+	}
+	co_await nic::transmit(std::move(target), std::move(fb.frame), offload);
 	co_return protocols::fs::Error::none;
 }
 
 void Ip4::feedPacket(nic::MacAddress, nic::MacAddress,
-		arch::dma_buffer owner, arch::dma_buffer_view frame) {
+		arch::dma_buffer owner, arch::dma_buffer_view frame,
+		nic::RxInfo info) {
 	Ip4Packet hdr;
 	if (!hdr.parse(std::move(owner), frame)) {
 		std::cout << "netserver: runt, or otherwise invalid, ip4 frame received"
 			<< std::endl;
 		return;
 	}
+	hdr.checksumValid = info.checksumValid;
+
+	// MF flag or fragment offset.
+	if (hdr.header.flags_offset & 0x3FFF) {
+		auto datagram = reassemble_(std::move(hdr));
+		if (!datagram)
+			return;
+		hdr = std::move(*datagram);
+	}
 	auto proto = hdr.header.protocol;
 
 	auto begin = sockets.lower_bound(proto);
@@ -321,7 +504,7 @@ void Ip4::feedPacket(nic::MacAddress, nic::MacAddress,
 		return;
 	}
 
-	auto hdrs = smarter::make_shared<const Ip4Packet>(std::move(hdr));
+	auto hdrs = smarter::allocate_shared<const Ip4Packet>(PacketAllocator{}, std::move(hdr));
 
 	switch (static_cast<IpProto>(proto)) {
 	case IpProto::udp: udp.feedDatagram(hdrs); break;
@@ -335,6 +518,162 @@ void Ip4::feedPacket(nic::MacAddress, nic::MacAddress,
 	}
 }
 
+namespace {
+
+// Limits of the reassembly table (per shard; only the NIC shard receives fragments).
+// Incomplete datagrams are dropped after the timeout of RFC 791 (as on Linux).
+constexpr uint64_t reassemblyTimeout = 30'000'000'000;
+constexpr size_t maxReassemblies = 256;
+constexpr size_t maxReassembliesPerSource = 16;
+constexpr size_t maxFragmentsPerDatagram = 64;
+constexpr size_t maxReassemblyMemory = 4 << 20;
+
+uint64_t currentClock() {
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	return now;
+}
+
+} // anonymous namespace
+
+size_t Ip4::FragmentKeyHash::operator()(const FragmentKey &key) const {
+	uint64_t x = (uint64_t{key.source} << 32 | key.destination)
+			^ (uint64_t{key.ident} << 8 | key.protocol) * 0x9E3779B97F4A7C15;
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCD;
+	x ^= x >> 33;
+	return x;
+}
+
+std::optional<Ip4Packet> Ip4::reassemble_(Ip4Packet fragment) {
+	auto &hdr = fragment.header;
+	bool more = hdr.flags_offset & 0x2000;
+	size_t offset = size_t{hdr.flags_offset & 0x1FFFu} * 8;
+	size_t size = fragment.payloadSize();
+	size_t headerSize = hdr.ihl * 4;
+
+	// All fragments but the last one carry a multiple of 8 bytes.
+	if ((more && (size % 8 || !size)) || headerSize + offset + size > 0xFFFF)
+		return std::nullopt;
+
+	FragmentKey key{hdr.source, hdr.destination, hdr.ident,
+			static_cast<uint8_t>(hdr.protocol)};
+	auto drop = [&] (auto victim) {
+		reassemblyMemory_ -= victim->second.memory;
+		auto sit = reassembliesPerSource_.find(victim->first.source);
+		if (!--sit->second)
+			reassembliesPerSource_.erase(sit);
+		reassemblies_.erase(victim);
+	};
+
+	auto it = reassemblies_.find(key);
+	if (it == reassemblies_.end()) {
+		auto sit = reassembliesPerSource_.find(key.source);
+		if (sit != reassembliesPerSource_.end() && sit->second >= maxReassembliesPerSource)
+			return std::nullopt;
+		// Make room by dropping the datagram that is closest to its timeout.
+		if (reassemblies_.size() >= maxReassemblies) {
+			auto oldest = std::min_element(reassemblies_.begin(), reassemblies_.end(),
+					[] (const auto &a, const auto &b) {
+						return a.second.deadline < b.second.deadline;
+					});
+			drop(oldest);
+		}
+		reassembliesPerSource_[key.source]++;
+		it = reassemblies_.emplace(key, Reassembly{}).first;
+		it->second.deadline = currentClock() + reassemblyTimeout;
+
+		if (!expiryRunning_) {
+			expiryRunning_ = true;
+			expireFragments_();
+		}
+		reassemblyEvent_.raise();
+	}
+	auto &entry = it->second;
+
+	// Overlapping fragments are not legitimate; drop the entire datagram
+	// (like RFC 5722 demands for IPv6). Exact duplicates are ignored.
+	auto pos = std::lower_bound(entry.pieces.begin(), entry.pieces.end(), offset,
+			[] (const Reassembly::Piece &p, size_t o) { return p.offset < o; });
+	if (pos != entry.pieces.end() && pos->offset == offset && pos->size == size)
+		return std::nullopt;
+	if ((pos != entry.pieces.end() && offset + size > pos->offset)
+			|| (pos != entry.pieces.begin() && std::prev(pos)->offset
+					+ std::prev(pos)->size > offset)
+			|| (entry.totalSize && offset + size > *entry.totalSize)
+			|| (!more && (entry.totalSize
+					|| (!entry.pieces.empty() && entry.pieces.back().offset
+							+ entry.pieces.back().size > offset + size)))) {
+		drop(it);
+		return std::nullopt;
+	}
+
+	// We keep the entire frame of each fragment.
+	size_t memory = fragment.data.size() + 64;
+	if (entry.pieces.size() >= maxFragmentsPerDatagram
+			|| reassemblyMemory_ + memory > maxReassemblyMemory) {
+		drop(it);
+		return std::nullopt;
+	}
+	entry.memory += memory;
+	reassemblyMemory_ += memory;
+
+	if (!more)
+		entry.totalSize = offset + size;
+	entry.received += size;
+	entry.pieces.insert(pos, Reassembly::Piece{offset, size, std::move(fragment)});
+
+	if (!entry.totalSize || entry.received != *entry.totalSize)
+		return std::nullopt;
+
+	// All fragments arrived; chain their payloads behind the first fragment's header.
+	auto pieces = std::move(entry.pieces);
+	auto totalSize = *entry.totalSize;
+	drop(it);
+
+	Ip4Packet datagram = std::move(pieces.front().packet);
+	auto firstHeaderSize = datagram.header.ihl * 4;
+	datagram.fragments.reserve(pieces.size());
+	datagram.fragments.push_back({{}, datagram.data.subview(firstHeaderSize)});
+	datagram.data = datagram.data.subview(0, firstHeaderSize);
+	for (size_t i = 1; i < pieces.size(); i++) {
+		auto payload = pieces[i].packet.payload();
+		datagram.fragments.push_back({pieces[i].packet.takeBuffer(), payload});
+	}
+	datagram.header.length = firstHeaderSize + totalSize;
+	datagram.header.flags_offset = 0;
+	// The link cannot validate checksums across fragments.
+	datagram.checksumValid = false;
+	return datagram;
+}
+
+async::detached Ip4::expireFragments_() {
+	while (true) {
+		if (reassemblies_.empty()) {
+			co_await reassemblyEvent_.async_wait();
+			continue;
+		}
+
+		auto now = currentClock();
+		uint64_t next = UINT64_MAX;
+		for (auto it = reassemblies_.begin(); it != reassemblies_.end(); ) {
+			auto &entry = it->second;
+			if (entry.deadline > now) {
+				next = std::min(next, entry.deadline);
+				++it;
+				continue;
+			}
+			reassemblyMemory_ -= entry.memory;
+			auto sit = reassembliesPerSource_.find(it->first.source);
+			if (!--sit->second)
+				reassembliesPerSource_.erase(sit);
+			it = reassemblies_.erase(it);
+		}
+		if (next != UINT64_MAX)
+			co_await helix::sleepFor(next - now);
+	}
+}
+
 void Ip4::setLink(CidrAddress addr, std::weak_ptr<nic::Link> l) {
 	ips.emplace(addr, std::move(l));
 }
@@ -2,6 +2,7 @@
 
 #include <arch/bit.hpp>
 #include <arch/dma_structs.hpp>
+#include <async/recurring-event.hpp>
 #include <helix/ipc.hpp>
 #include <map>
 #include <smarter.hpp>
@@ -9,8 +10,11 @@
 #include <protocols/fs/common.hpp>
 #include <set>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <optional>
+#include <unordered_map>
+#include <vector>
 
 #include "udp4.hpp"
 #include "tcp4.hpp"
@@ -57,13 +61,23 @@ struct Ip4Router {
 
 	// false if insertion fails
 	bool addRoute(Route r);
+	// returns the most preferred route of the longest matching prefix
 	std::optional<Route> resolveRoute(uint32_t ip);
 private:
-	std::set<Route> routes;
+	// Binary trie over the bits of the network address. Each node holds the
+	// routes of exactly one prefix, sorted by preference.
+	struct Node {
+		std::unique_ptr<Node> children[2];
+		std::vector<Route> routes;
+	};
+
+	Node root;
 };
 
 class Ip4Packet {
 	arch::dma_buffer buffer_;
+	// Contiguous copy of a reassembled datagram, see contiguousData().
+	mutable arch::dma_buffer linear_;
 public:
 	struct Header {
 		uint8_t ihl;
@@ -95,10 +109,44 @@ public:
 		}
 	} header;
 	static_assert(sizeof(header) == 20, "bad header size");
+	// For reassembled datagrams, this only covers the header of the first fragment.
 	arch::dma_buffer_view data;
 
+	// The link already validated the TCP/UDP checksum of this packet.
+	bool checksumValid = false;
+
+	// Payloads of the fragments of a reassembled datagram, ordered by offset.
+	// Empty if the datagram was not fragmented.
+	struct Fragment {
+		// Empty if the payload is part of buffer_.
+		arch::dma_buffer owner;
+		arch::dma_buffer_view payload;
+	};
+	std::vector<Fragment> fragments;
+
+	size_t payloadSize() const;
+
+	// Calls f on each contiguous chunk of the payload.
+	template<typename F>
+	void forEachChunk(F f) const {
+		if (fragments.empty()) {
+			f(data.subview(header.ihl * 4));
+			return;
+		}
+		for (auto &fragment : fragments)
+			f(fragment.payload);
+	}
+
+	// Copies part of the payload. Unlike payload(), this does not linearize
+	// reassembled datagrams.
+	void copyPayload(void *dest, size_t offset, size_t size) const;
+
+	// Returns the entire datagram (including the header).
+	// Reassembled datagrams are copied into a contiguous buffer on the first call.
+	arch::dma_buffer_view contiguousData() const;
+
 	inline arch::dma_buffer_view payload() const {
-		return data.subview(header.ihl * 4);
+		return contiguousData().subview(header.ihl * 4);
 	}
 
 	inline arch::dma_buffer_view header_view() const {
@@ -107,6 +155,23 @@ public:
 
 	// assumes frame is a valid view into owner
 	bool parse(arch::dma_buffer owner, arch::dma_buffer_view frame);
+
+	arch::dma_buffer takeBuffer() {
+		return std::move(buffer_);
+	}
+};
+
+// Allocator for the shared_ptr control blocks of received Ip4Packets.
+// A packet is allocated for every received datagram (the frame itself comes
+// from the shard's DMA pool); blocks are recycled through a per-thread free list
+// instead of going through malloc() each time.
+struct PacketAllocator {
+	// Size of each block; must fit an Ip4Packet together with smarter's control block.
+	static constexpr size_t blockSize = 320;
+
+	void *allocate(size_t size);
+	void deallocate(void *pointer, size_t size);
+	void free(void *pointer);
 };
 
 struct Ip4TargetInfo {
@@ -121,7 +186,8 @@ struct Ip4 {
 	managarm::fs::Errors serveSocket(helix::UniqueLane lane, int type, int proto, int flags);
 	// frame is a view into the owner buffer, stripping away eth bits
 	void feedPacket(nic::MacAddress dest, nic::MacAddress src,
-		arch::dma_buffer owner, arch::dma_buffer_view frame);
+		arch::dma_buffer owner, arch::dma_buffer_view frame,
+		nic::RxInfo info);
 
 	bool hasIp(uint32_t ip);
 	std::shared_ptr<nic::Link> getLink(uint32_t ip);
@@ -129,10 +195,58 @@ struct Ip4 {
 	std::optional<uint32_t> findLinkIp(uint32_t ipOnNet, nic::Link *link);
 
 	async::result<std::optional<Ip4TargetInfo>> targetByRemote(uint32_t);
+	// Offsets in offload are relative to the IP payload; they are adjusted
+	// to the frame before the frame is handed to the link.
 	async::result<protocols::fs::Error> sendFrame(Ip4TargetInfo,
 		void*, size_t,
-		uint16_t);
+		uint16_t, nic::TxOffload offload = {});
+	// Like sendFrame(), but fill() writes the len bytes of payload directly into the
+	// frame. This avoids staging the payload in a temporary buffer.
+	async::result<protocols::fs::Error> sendFrameInPlace(Ip4TargetInfo,
+		size_t len, uint16_t proto,
+		std::function<void(arch::dma_buffer_view)> fill,
+		nic::TxOffload offload = {});
 private:
+	// Returns the datagram once all of its fragments have arrived.
+	std::optional<Ip4Packet> reassemble_(Ip4Packet fragment);
+
+	async::detached expireFragments_();
+
+	struct FragmentKey {
+		friend bool operator==(const FragmentKey &, const FragmentKey &) = default;
+
+		uint32_t source;
+		uint32_t destination;
+		uint16_t ident;
+		uint8_t protocol;
+	};
+
+	struct FragmentKeyHash {
+		size_t operator()(const FragmentKey &key) const;
+	};
+
+	struct Reassembly {
+		uint64_t deadline;
+		// Sorted by offset; offsets and sizes are in bytes.
+		struct Piece {
+			size_t offset;
+			size_t size;
+			Ip4Packet packet;
+		};
+		std::vector<Piece> pieces;
+		// Known once the last fragment arrived.
+		std::optional<size_t> totalSize;
+		size_t received = 0;
+		size_t memory = 0;
+	};
+
+	std::unordered_map<FragmentKey, Reassembly, FragmentKeyHash> reassemblies_;
+	// Number of incomplete datagrams per source address.
+	std::unordered_map<uint32_t, size_t> reassembliesPerSource_;
+	size_t reassemblyMemory_ = 0;
+	bool expiryRunning_ = false;
+	async::recurring_event reassemblyEvent_;
+
 	std::multimap<int, smarter::shared_ptr<Ip4Socket>> sockets;
 	std::map<CidrAddress, std::weak_ptr<nic::Link>> ips;
 
@@ -3,11 +3,20 @@
 #include <async/result.hpp>
 #include <arch/bit.hpp>
 #include <arch/variable.hpp>
+#include <hel.h>
+#include <hel-syscalls.h>
+#include <helix/timer.hpp>
 #include <protocols/fs/server.hpp>
+#include <algorithm>
+#include <cstddef>
 #include <cstring>
+#include <atomic>
 #include <deque>
+#include <mutex>
 #include <iomanip>
+#include <optional>
 #include <random>
+#include <unordered_map>
 #include <fcntl.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
@@ -17,6 +26,7 @@
 #include "checksum.hpp"
 #include "ip4.hpp"
 #include "tcp4.hpp"
+#include "../shard.hpp"
 
 namespace {
 
@@ -54,6 +64,10 @@ struct RingBuffer {
 
 	RingBuffer &operator= (const RingBuffer &) = delete;
 
+	size_t size() {
+		return size_t{1} << shift_;
+	}
+
 	size_t spaceForEnqueue() {
 		return (size_t{1} << shift_) - (enqPtr_ - deqPtr_);
 	}
@@ -92,6 +106,22 @@ struct RingBuffer {
 		deqPtr_ += size;
 	}
 
+	// Absolute position (i.e., the number of bytes dequeued so far) of the front of the ring.
+	uint64_t dequeuePosition() {
+		return deqPtr_;
+	}
+
+	// Copies data from an absolute position. Unlike dequeueLookahead(), the data may already
+	// have been dequeued (and overwritten) in the meantime; the caller must tolerate that.
+	void copyAt(uint64_t position, void *data, size_t size) {
+		size_t ringSize = size_t{1} << shift_;
+		auto wrappedPtr = position & (ringSize - 1);
+		auto p = reinterpret_cast<char *>(data);
+		size_t bytesUntilEnd = std::min(size, ringSize - wrappedPtr);
+		memcpy(p, storage_ + wrappedPtr, bytesUntilEnd);
+		memcpy(p + bytesUntilEnd, storage_, size - bytesUntilEnd);
+	}
+
 private:
 	char *storage_;
 	int shift_;
@@ -100,7 +130,68 @@ private:
 };
 
 // TODO: Use a CSPRNG, see also UDP.
-static std::mt19937 globalPrng;
+static thread_local std::mt19937 globalPrng;
+
+// Serial number arithmetic on sequence numbers.
+bool seqLess(uint32_t a, uint32_t b) {
+	return static_cast<int32_t>(a - b) < 0;
+}
+
+bool seqLessEqual(uint32_t a, uint32_t b) {
+	return static_cast<int32_t>(a - b) <= 0;
+}
+
+uint64_t clockNanos() {
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	return now;
+}
+
+// Clock used for TCP timestamps (RFC 7323), in milliseconds.
+uint32_t timestampClock() {
+	return clockNanos() / 1'000'000;
+}
+
+// MSS that we assume if the remote does not send an MSS option (RFC 879).
+constexpr uint32_t defaultMss = 536;
+
+// Bounds of the retransmission timeout (RFC 6298). Like other stacks, we use a lower
+// minimum than the 1s recommended by the RFC.
+constexpr uint64_t initialRto = 1'000'000'000;
+constexpr uint64_t minRto = 200'000'000;
+constexpr uint64_t maxRto = 60'000'000'000;
+
+// In-order data is acknowledged after at most this delay, or once two full-sized
+// segments are unacknowledged (RFC 1122, section 4.2.3.2; RFC 5681, section 4.2).
+constexpr uint64_t delayedAckTimeout = 40'000'000;
+
+// Option kinds.
+enum : uint8_t {
+	tcpOptEnd = 0,
+	tcpOptNop = 1,
+	tcpOptMss = 2,
+	tcpOptWindowScale = 3,
+	tcpOptSackPermitted = 4,
+	tcpOptSack = 5,
+	tcpOptTimestamps = 8
+};
+
+// Maximum window scale (RFC 7323).
+constexpr unsigned int maxWindowShift = 14;
+
+struct SackBlock {
+	uint32_t left;
+	uint32_t right;
+};
+
+struct TcpOptions {
+	std::optional<uint16_t> mss;
+	std::optional<uint8_t> windowShift;
+	bool sackPermitted = false;
+	std::optional<std::pair<uint32_t, uint32_t>> timestamps; // TSval, TSecr.
+	size_t numSackBlocks = 0;
+	SackBlock sackBlocks[4];
+};
 
 } // namespace
 
@@ -122,6 +213,9 @@ struct TcpHeader {
 
 static_assert(sizeof(TcpHeader) == 20);
 
+// Largest TCP payload that fits into a single IPv4 packet (used for TSO).
+constexpr size_t maxSuperSegment = 0xFFFF - sizeof(Ip4Packet::Header) - sizeof(TcpHeader);
+
 struct TcpPacket {
 	arch::dma_buffer_view payload() {
 		auto words = header.flags.load() & TcpHeader::headerWords;
@@ -140,7 +234,7 @@ struct TcpPacket {
 		if (ipPayload.size() < words * 4)
 			return false;
 
-		if (header.checksum.load()) {
+		if (header.checksum.load() && !packet->checksumValid) {
 			PseudoHeader pseudo {
 				.src = packet->header.source,
 				.dst = packet->header.destination,
@@ -159,6 +253,65 @@ struct TcpPacket {
 		return true;
 	}
 
+	// Returns false if the options are malformed.
+	bool parseOptions(TcpOptions &options) {
+		auto words = header.flags.load() & TcpHeader::headerWords;
+		auto view = packet->payload().subview(sizeof(TcpHeader), words * 4 - sizeof(TcpHeader));
+		auto p = reinterpret_cast<const uint8_t *>(view.data());
+		size_t n = view.size();
+
+		auto load16 = [] (const uint8_t *q) -> uint16_t {
+			return (q[0] << 8) | q[1];
+		};
+		auto load32 = [] (const uint8_t *q) -> uint32_t {
+			return (uint32_t(q[0]) << 24) | (uint32_t(q[1]) << 16) | (uint32_t(q[2]) << 8) | q[3];
+		};
+
+		size_t i = 0;
+		while (i < n) {
+			auto kind = p[i];
+			if (kind == tcpOptEnd)
+				break;
+			if (kind == tcpOptNop) {
+				i++;
+				continue;
+			}
+			if (i + 1 >= n)
+				return false;
+			size_t length = p[i + 1];
+			if (length < 2 || i + length > n)
+				return false;
+
+			auto body = p + i + 2;
+			switch (kind) {
+			case tcpOptMss:
+				if (length == 4)
+					options.mss = load16(body);
+				break;
+			case tcpOptWindowScale:
+				if (length == 3)
+					options.windowShift = std::min(unsigned(body[0]), maxWindowShift);
+				break;
+			case tcpOptSackPermitted:
+				options.sackPermitted = true;
+				break;
+			case tcpOptSack:
+				for (size_t k = 0; k + 8 <= length - 2 && options.numSackBlocks < 4; k += 8)
+					options.sackBlocks[options.numSackBlocks++] = SackBlock{
+						load32(body + k), load32(body + k + 4)};
+				break;
+			case tcpOptTimestamps:
+				if (length == 10)
+					options.timestamps = std::make_pair(load32(body), load32(body + 4));
+				break;
+			default:
+				break;
+			}
+			i += length;
+		}
+		return true;
+	}
+
 	TcpHeader header;
 	smarter::shared_ptr<const Ip4Packet> packet;
 };
@@ -179,20 +332,201 @@ protocols::fs::Error checkAddress(const void *addrPtr, size_t addrLength, TcpEnd
 	return protocols::fs::Error::none;
 }
 
+// Maximal number of connections that are in the handshake (and, separately, that wait
+// to be accepted) per listening socket. If the handshake backlog is full, we answer
+// SYNs with SYN cookies instead.
+constexpr size_t listenBacklog = 128;
+
+// Number of SYN-ACK retransmissions before a handshake is abandoned.
+constexpr unsigned int maxSynAckRetries = 5;
+
+// Options of the TCP level (IPPROTO_TCP), as on Linux. As options are passed without
+// their level, these shadow SO_DEBUG and SO_TYPE.
+constexpr int optTcpNoDelay = 1;
+constexpr int optTcpCork = 3;
+
+} // anonymous namespace
+
+// Listeners are registered for all shards since SYNs are steered to shards by their
+// flow hash. Handshakes are processed on the shard that receives them; established
+// connections are then handed over to the listener's shard.
+struct Tcp4Listener {
+	Tcp4Listener(size_t shard, TcpEndpoint localEp, bool reusePort, Tcp4Socket *socket)
+	: shard{shard}, localEp{localEp}, reusePort{reusePort}, socket{socket} { }
+
+	const size_t shard;
+	const TcpEndpoint localEp;
+	const bool reusePort;
+
+	// Updated by all shards.
+	std::atomic<size_t> numEmbryonic = 0;
+	std::atomic<size_t> numQueued = 0;
+
+	// Only accessed on the listener's shard. Null once the socket is gone.
+	Tcp4Socket *socket;
+	std::deque<helix::UniqueLane> acceptQueue;
+};
+
+namespace {
+
+std::mutex globalListenersMutex;
+std::unordered_map<uint16_t, std::vector<std::shared_ptr<Tcp4Listener>>> globalListeners;
+
+void registerListener(std::shared_ptr<Tcp4Listener> listener) {
+	std::lock_guard lock{globalListenersMutex};
+	globalListeners[listener->localEp.port].push_back(std::move(listener));
+}
+
+void unregisterListener(Tcp4Listener *listener) {
+	std::lock_guard lock{globalListenersMutex};
+	auto it = globalListeners.find(listener->localEp.port);
+	assert(it != globalListeners.end());
+	auto &listeners = it->second;
+	listeners.erase(std::find_if(listeners.begin(), listeners.end(),
+			[&] (const auto &l) { return l.get() == listener; }));
+	if (listeners.empty())
+		globalListeners.erase(it);
+}
+
+// Selects the listener for a new connection. Listeners on specific addresses take
+// precedence over wildcard listeners. With SO_REUSEPORT, connections are distributed
+// over the listeners by their flow hash, preferring listeners on the current shard.
+std::shared_ptr<Tcp4Listener> findListener(const TcpFlow &flow) {
+	std::lock_guard lock{globalListenersMutex};
+	auto it = globalListeners.find(flow.localPort);
+	if (it == globalListeners.end())
+		return nullptr;
+
+	std::vector<std::shared_ptr<Tcp4Listener>> candidates;
+	for (bool wildcard : {false, true}) {
+		for (auto &l : it->second) {
+			if (l->localEp.ipAddress == (wildcard ? INADDR_ANY : flow.localIp))
+				candidates.push_back(l);
+		}
+		if (!candidates.empty())
+			break;
+	}
+	if (candidates.empty())
+		return nullptr;
+
+	auto here = std::partition(candidates.begin(), candidates.end(),
+			[] (const auto &l) { return l->shard == currentShard().index(); });
+	size_t n = here - candidates.begin();
+	if (!n)
+		n = candidates.size();
+	// The low bits of the hash select the shard; use the high bits here.
+	return candidates[(TcpFlowHash{}(flow) >> 32) % n];
+}
+
+// SYN cookies (RFC 4987). The ISN of the SYN-ACK encodes the connection: the top 5 bits
+// are a counter that advances every 64 seconds, the next 3 bits select the MSS and
+// the low 24 bits are a keyed hash of the flow. Other options are not preserved.
+constexpr uint16_t cookieMssTable[] = {216, 536, 1024, 1220, 1360, 1440, 1460, 8960};
+
+uint32_t cookieCounter() {
+	return clockNanos() / 64'000'000'000;
+}
+
+uint32_t cookieHash(const TcpFlow &flow, uint32_t counter, uint32_t remoteSn) {
+	static const uint64_t secret = (uint64_t{std::random_device{}()} << 32)
+			| std::random_device{}();
+	uint64_t x = TcpFlowHash{}(flow) ^ secret ^ (uint64_t{counter} << 32 | remoteSn);
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCD;
+	x ^= x >> 33;
+	x *= 0xC4CEB9FE1A85EC53;
+	x ^= x >> 33;
+	return x & 0xFFFFFF;
+}
+
+uint32_t makeCookie(const TcpFlow &flow, uint32_t remoteSn, uint16_t mss) {
+	uint32_t index = 0;
+	while (index + 1 < std::size(cookieMssTable) && cookieMssTable[index + 1] <= mss)
+		index++;
+	auto counter = cookieCounter();
+	return ((counter & 0x1F) << 27) | (index << 24) | cookieHash(flow, counter, remoteSn);
+}
+
+// Returns the MSS if the cookie is valid (and at most two minutes old).
+std::optional<uint16_t> checkCookie(const TcpFlow &flow, uint32_t remoteSn, uint32_t cookie) {
+	auto counter = cookieCounter();
+	for (uint32_t age = 0; age < 2; age++) {
+		auto c = counter - age;
+		if ((c & 0x1F) == (cookie >> 27)
+				&& cookieHash(flow, c, remoteSn) == (cookie & 0xFFFFFF))
+			return cookieMssTable[(cookie >> 24) & 7];
+	}
+	return std::nullopt;
+}
+
+// Sends a SYN-ACK without creating a socket. As the window scale is not preserved,
+// the window that we announce is not scaled.
+async::detached sendCookieSynAck(TcpFlow flow, uint32_t cookie, uint32_t ackNumber) {
+	auto targetInfo = co_await ip4().targetByRemote(flow.remoteIp);
+	if (!targetInfo)
+		co_return;
+	uint16_t mss = targetInfo->link->mtu - sizeof(Ip4Packet::Header) - sizeof(TcpHeader);
+
+	uint8_t options[4] = {tcpOptMss, 4, static_cast<uint8_t>(mss >> 8),
+			static_cast<uint8_t>(mss)};
+	size_t segmentLength = sizeof(TcpHeader) + sizeof(options);
+	TcpHeader header {
+		.srcPort = flow.localPort,
+		.destPort = flow.remotePort,
+		.seqNumber = cookie,
+		.ackNumber = ackNumber,
+		.window = 0xFFFF,
+		.checksum = 0,
+		.urgentPointer = 0
+	};
+	header.flags.store(TcpHeader::headerWords(segmentLength / 4)
+			| TcpHeader::synFlag(true) | TcpHeader::ackFlag(true));
+	PseudoHeader pseudo {
+		.src = targetInfo->source,
+		.dst = flow.remoteIp,
+		.len = segmentLength
+	};
+
+	co_await ip4().sendFrameInPlace(std::move(*targetInfo),
+		segmentLength, static_cast<uint16_t>(IpProto::tcp),
+		[&] (arch::dma_buffer_view segment) {
+			auto p = reinterpret_cast<char *>(segment.data());
+			memcpy(p, &header, sizeof(TcpHeader));
+			memcpy(p + sizeof(TcpHeader), options, sizeof(options));
+			Checksum csum;
+			csum.update(&pseudo, sizeof(PseudoHeader));
+			csum.update(p, segmentLength);
+			reinterpret_cast<TcpHeader *>(p)->checksum = csum.finalize();
+		});
+}
+
 } // anonymous namespace
 
 struct Tcp4Socket {
 	Tcp4Socket(Tcp4 *parent, bool nonBlock)
-	: parent_(parent), nonBlock_{nonBlock}, recvRing_{14}, sendRing_{14} {}
+	: parent_(parent), nonBlock_{nonBlock}, recvRing_{18}, sendRing_{18} {
+		// Offer the smallest window scale that lets us announce the entire ring.
+		while(offeredWindowShift_ < maxWindowShift
+				&& (recvRing_.size() >> offeredWindowShift_) > 0xFFFF)
+			++offeredWindowShift_;
+	}
 
 	~Tcp4Socket() {
-		parent_->unbind(localEp_);
+		if(listening_) {
+			unregisterListener(listening_.get());
+			listening_->socket = nullptr;
+		}
+		if(flowRegistered_)
+			parent_->unregisterFlow(flow_);
+		parent_->unbind(this, localEp_);
 	}
 
 	static auto makeSocket(Tcp4 *parent, bool nonBlock) {
 		auto s = smarter::make_shared<Tcp4Socket>(parent, nonBlock);
 		s->holder_ = s;
 		async::detach(s->flushOutPackets_());
+		async::detach(s->retransmitTimer_());
+		async::detach(s->delayedAckTimer_());
 		return s;
 	}
 
@@ -248,10 +582,21 @@ struct Tcp4Socket {
 			co_return protocols::fs::Error::accessDenied;
 		}
 
-		// Bind the socket if necessary.
-		if (!self->localEp_.port && !self->bindAvailable()) {
-			std::cout << "netserver: No source port" << std::endl;
-			co_return protocols::fs::Error::addressNotAvailable;
+		// Bind the socket if necessary. We prefer ports for which the flow hash
+		// steers the connection to the current shard.
+		if (!self->localEp_.port) {
+			auto targetInfo = co_await ip4().targetByRemote(connectEp.ipAddress);
+			bool bound = false;
+			if (targetInfo)
+				bound = self->bindAvailable(INADDR_ANY, [&] (uint16_t port) {
+					TcpFlow flow{targetInfo->source, connectEp.ipAddress,
+							port, connectEp.port};
+					return Tcp4::shardOf(flow) == currentShard().index();
+				});
+			if (!bound && !self->bindAvailable()) {
+				std::cout << "netserver: No source port" << std::endl;
+				co_return protocols::fs::Error::addressNotAvailable;
+			}
 		}
 
 		// Connect to the remote.
@@ -267,6 +612,78 @@ struct Tcp4Socket {
 		co_return protocols::fs::Error::none;
 	}
 
+	static async::result<protocols::fs::Error> listen(void *object) {
+		auto self = static_cast<Tcp4Socket *>(object);
+
+		if (self->connectState_ != ConnectState::none)
+			co_return protocols::fs::Error::illegalArguments;
+		if (self->listening_)
+			co_return protocols::fs::Error::none;
+
+		if (!self->localEp_.port && !self->bindAvailable()) {
+			std::cout << "netserver: No source port" << std::endl;
+			co_return protocols::fs::Error::addressInUse;
+		}
+
+		self->listening_ = std::make_shared<Tcp4Listener>(currentShard().index(),
+				self->localEp_, self->reusePort_, self);
+		registerListener(self->listening_);
+		co_return protocols::fs::Error::none;
+	}
+
+	static async::result<frg::expected<protocols::fs::Error, helix::UniqueLane>>
+	accept(void *object) {
+		auto self = static_cast<Tcp4Socket *>(object);
+		auto listener = self->listening_;
+		if (!listener)
+			co_return protocols::fs::Error::illegalArguments;
+
+		while (listener->acceptQueue.empty()) {
+			if (self->nonBlock_)
+				co_return protocols::fs::Error::wouldBlock;
+			co_await self->acceptEvent_.async_wait();
+		}
+
+		auto lane = std::move(listener->acceptQueue.front());
+		listener->acceptQueue.pop_front();
+		listener->numQueued.fetch_sub(1, std::memory_order_relaxed);
+		co_return std::move(lane);
+	}
+
+	static async::result<int> getOption(void *object, int option) {
+		auto self = static_cast<Tcp4Socket *>(object);
+		switch (option) {
+		case SO_REUSEPORT: co_return self->reusePort_;
+		case optTcpNoDelay: co_return self->noDelay_;
+		case optTcpCork: co_return self->cork_;
+		default:
+			std::cout << "netserver: Unsupported TCP option " << option << std::endl;
+			co_return 0;
+		}
+	}
+
+	static async::result<void> setOption(void *object, int option, int value) {
+		auto self = static_cast<Tcp4Socket *>(object);
+		switch (option) {
+		case SO_REUSEPORT:
+			// Like on Linux, this only affects later bind() calls.
+			self->reusePort_ = value;
+			break;
+		case optTcpNoDelay:
+			self->noDelay_ = value;
+			self->flushEvent_.raise();
+			break;
+		case optTcpCork:
+			// Uncorking sends out partial segments.
+			self->cork_ = value;
+			self->flushEvent_.raise();
+			break;
+		default:
+			std::cout << "netserver: Unsupported TCP option " << option << std::endl;
+		}
+		co_return;
+	}
+
 	static async::result<protocols::fs::ReadResult> read(void *object, const char *creds,
 			void *data, size_t size) {
 		auto result = co_await recvMsg(object, creds, 0, data, size, nullptr, 0, {});
@@ -342,8 +759,8 @@ struct Tcp4Socket {
 			}
 			size_t chunk = std::min(space, size - progress);
 			self->sendRing_.enqueue(p + progress, chunk);
-			self->flushEvent_.raise();
 			progress += chunk;
+			self->scheduleFlush_(chunk);
 		}
 
 		co_return progress;
@@ -381,6 +798,8 @@ struct Tcp4Socket {
 		int active = 0;
 		if(self->recvRing_.availableToDequeue())
 			active |= EPOLLIN;
+		if(self->listening_ && !self->listening_->acceptQueue.empty())
+			active |= EPOLLIN;
 		if(self->sendRing_.spaceForEnqueue())
 			active |= EPOLLOUT;
 		if(self->remoteClosed_)
@@ -413,9 +832,13 @@ struct Tcp4Socket {
 	constexpr static protocols::fs::FileOperations ops {
 		.read = &read,
 		.write = &write,
+		.getOption = &getOption,
+		.setOption = &setOption,
 		.pollWait = &pollWait,
 		.pollStatus = &pollStatus,
 		.bind = &bind,
+		.listen = &listen,
+		.accept = &accept,
 		.connect = &connect,
 		.getFileFlags = &getFileFlags,
 		.setFileFlags = &setFileFlags,
@@ -424,7 +847,13 @@ struct Tcp4Socket {
 	};
 
 	bool bindAvailable(uint32_t ipAddress = INADDR_ANY) {
-		static std::uniform_int_distribution<uint16_t> dist {
+		return bindAvailable(ipAddress, [] (uint16_t) { return true; });
+	}
+
+	// Binds to an ephemeral port that satisfies the predicate.
+	template<typename F>
+	bool bindAvailable(uint32_t ipAddress, F predicate) {
+		static thread_local std::uniform_int_distribution<uint16_t> dist {
 			32768, 60999
 		};
 		auto number = dist(globalPrng);
@@ -432,6 +861,8 @@ struct Tcp4Socket {
 		auto self = holder_.lock();
 		for (int i = 0; i < range; i++) {
 			uint16_t port = dist.a() + ((number + i) % range);
+			if (!predicate(port))
+				continue;
 			if (parent_->tryBind(self, { ipAddress, port }))
 				return true;
 		}
@@ -441,8 +872,84 @@ struct Tcp4Socket {
 private:
 	async::result<void> flushOutPackets_();
 
+	async::result<void> retransmitTimer_();
+
+	async::result<void> delayedAckTimer_();
+
+	// Builds and transmits a segment that starts at the given offset into sendRing_.
+	// Returns the number of payload bytes sent (at most one MSS unless TSO is available).
+	async::result<frg::expected<protocols::fs::Error, size_t>> sendSegment_(
+			Ip4TargetInfo targetInfo, uint32_t seqNumber, size_t offset, size_t size, bool syn);
+
 	void handleInPacket_(TcpPacket packet);
 
+	// Passive open: enters the sendSynAck state in response to a SYN.
+	void acceptSyn_(std::shared_ptr<Tcp4Listener> listener, const TcpFlow &flow,
+			TcpPacket &packet, TcpOptions &options);
+
+	// Passive open: enters the connected state in response to an ACK of a SYN cookie.
+	void acceptCookie_(std::shared_ptr<Tcp4Listener> listener, const TcpFlow &flow,
+			TcpPacket packet, uint32_t cookie, uint16_t mss);
+
+	// Hands the connection over to the shard of listener_.
+	void establish_(bool embryonic);
+
+	void abortHandshake_();
+
+	// Called on the listener's shard.
+	void queueAccept_(helix::UniqueLane lane);
+
+	// Initial window as in RFC 5681.
+	size_t initialWindow_() {
+		return sendMss_ > 2190 ? 2 * sendMss_ : (sendMss_ > 1095 ? 3 * sendMss_ : 4 * sendMss_);
+	}
+
+	void handleAck_(TcpPacket &packet, TcpOptions &options);
+
+	void handleRetransmitTimeout_();
+
+	void updateRtt_(uint64_t sample);
+
+	void enterRecovery_();
+
+	// Returns the offset (relative to localSettledSn_) and the size of the next chunk
+	// that should be retransmitted during loss recovery, or a size of zero.
+	std::pair<size_t, size_t> nextRetransmission_();
+
+	void addSackedRange_(uint32_t left, uint32_t right);
+
+	void enqueueOutOfOrder_(uint32_t seqNumber, arch::dma_buffer_view payload, bool fin);
+
+	size_t buildSackBlocks_(SackBlock *blocks, size_t maxBlocks);
+
+	// Window that we can announce, rounded to the granularity of the window scale.
+	size_t announceableWindow_() {
+		return std::min(recvRing_.spaceForEnqueue() >> recvWindowShift_, size_t{0xFFFF})
+				<< recvWindowShift_;
+	}
+
+	// Autocorking: while data is in flight, small writes do not trigger a flush right
+	// away. Instead, we flush once the shard is done with its current batch of
+	// requests, such that back-to-back writes share segments.
+	void scheduleFlush_(size_t written) {
+		if(written >= sendMss_ || localFlushedSn_ == localSettledSn_) {
+			flushEvent_.raise();
+			return;
+		}
+		if(autocorkPending_)
+			return;
+		autocorkPending_ = true;
+		currentShard().post([self = holder_.lock()] {
+			self->autocorkPending_ = false;
+			self->flushEvent_.raise();
+		});
+	}
+
+	void armRetransmitTimer_() {
+		rtoDeadline_ = clockNanos() + rto_;
+		timerEvent_.raise();
+	}
+
 private:
 	friend struct Tcp4;
 
@@ -453,19 +960,41 @@ private:
 		connected,
 	};
 
+	// Data that arrived ahead of remoteKnownSn_.
+	struct OutOfOrderSegment {
+		uint32_t seqNumber;
+		std::vector<char> data;
+		bool fin;
+	};
+
 	Tcp4 *parent_;
 	bool nonBlock_;
 	TcpEndpoint remoteEp_;
 	TcpEndpoint localEp_;
 	smarter::weak_ptr<Tcp4Socket> holder_;
 
+	// Key of this socket in Tcp4::connections.
+	TcpFlow flow_;
+	bool flowRegistered_ = false;
+
 	ConnectState connectState_ = ConnectState::none;
 	bool remoteClosed_ = false;
 
+	bool reusePort_ = false;
+	// Set if this socket listens.
+	std::shared_ptr<Tcp4Listener> listening_;
+	async::recurring_event acceptEvent_;
+	// Listener that accepted this connection (for passive opens).
+	std::shared_ptr<Tcp4Listener> listener_;
+	unsigned int synRetries_ = 0;
+
 	// Out-SN corresponding to the front of sendRing_.
 	uint32_t localSettledSn_ = 0;
 	// Out-SN that has already been flushed to the IP layer (>= localSettledSn_).
+	// This is rewound on retransmission timeouts.
 	uint32_t localFlushedSn_ = 0;
+	// Highest Out-SN that was ever flushed (>= localFlushedSn_).
+	uint32_t localMaxSn_ = 0;
 	// Out-SN of the end of the remote window (>= localSettledSn_).
 	uint32_t localWindowSn_ = 0;
 	// In-SN that we already acknowledged.
@@ -475,6 +1004,62 @@ private:
 	// Size of received window that we announced to the remote side.
 	uint32_t announcedWindow_ = 0;
 
+	// Options negotiated during the handshake (RFC 7323, RFC 2018).
+	unsigned int offeredWindowShift_ = 0;
+	unsigned int recvWindowShift_ = 0;
+	unsigned int sendWindowShift_ = 0;
+	bool useWindowScale_ = false;
+	bool useTimestamps_ = false;
+	bool useSack_ = false;
+	// Most recent TSval that we need to echo.
+	uint32_t tsRecent_ = 0;
+	// MSS that we announced and MSS that the remote accepts.
+	uint32_t recvMss_ = defaultMss;
+	uint32_t sendMss_ = defaultMss;
+
+	// Congestion control state (RFC 5681, NewReno as in RFC 6582).
+	size_t cwnd_ = 0;
+	size_t ssthresh_ = SIZE_MAX;
+	unsigned int dupAcks_ = 0;
+	bool inRecovery_ = false;
+	uint32_t recoverSn_ = 0;
+
+	// Scoreboard of SACKed ranges above localSettledSn_, sorted and disjoint.
+	std::vector<std::pair<uint32_t, uint32_t>> sackedRanges_;
+	// Everything below this Out-SN was already retransmitted during the current recovery.
+	uint32_t highRetransmitSn_ = 0;
+	bool retransmitPending_ = false;
+
+	// Retransmission timer (RFC 6298). All times are in nanoseconds.
+	uint64_t srtt_ = 0;
+	uint64_t rttvar_ = 0;
+	bool haveRtt_ = false;
+	uint64_t rto_ = initialRto;
+	uint64_t rtoDeadline_ = 0; // Zero if the timer is not armed.
+	bool resendSyn_ = false;
+	async::recurring_event timerEvent_;
+
+	// RTT measurement for connections without timestamps (Karn's algorithm).
+	bool rttTiming_ = false;
+	uint32_t rttTimingSn_ = 0;
+	uint64_t rttTimingStart_ = 0;
+
+	// Sorted by sequence number.
+	std::deque<OutOfOrderSegment> outOfOrder_;
+	// In-SN of the most recently received out-of-order segment (it is reported first).
+	uint32_t lastOutOfOrderSn_ = 0;
+	// Set if the remote needs an immediate (possibly duplicate) ACK.
+	bool forceAck_ = false;
+	// Deadline of the delayed ACK timer (zero if it is not armed).
+	uint64_t ackDeadline_ = 0;
+	bool ackDelayExpired_ = false;
+	async::recurring_event ackTimerEvent_;
+
+	// TCP_NODELAY disables Nagle's algorithm, TCP_CORK holds back partial segments.
+	bool noDelay_ = false;
+	bool cork_ = false;
+	bool autocorkPending_ = false;
+
 	RingBuffer recvRing_;
 	RingBuffer sendRing_;
 
@@ -491,6 +1076,181 @@ private:
 	async::recurring_event pollEvent_;
 };
 
+// Upper bound on the number of out-of-order segments that we buffer.
+constexpr size_t maxOutOfOrderSegments = 256;
+
+async::result<frg::expected<protocols::fs::Error, size_t>> Tcp4Socket::sendSegment_(
+		Ip4TargetInfo targetInfo, uint32_t seqNumber, size_t offset, size_t size, bool syn) {
+	// With TSO, we send super-segments that the link splits into MSS-sized segments.
+	auto &link = targetInfo.link;
+	bool useTso = link->features & nic::features::tso4;
+	bool useCsumOffload = useTso || (link->features & nic::features::txChecksum);
+
+	// Assemble the options.
+	uint8_t options[40];
+	size_t optionsLength = 0;
+	auto put8 = [&] (uint8_t v) {
+		options[optionsLength++] = v;
+	};
+	auto put16 = [&] (uint16_t v) {
+		put8(v >> 8);
+		put8(v);
+	};
+	auto put32 = [&] (uint32_t v) {
+		put16(v >> 16);
+		put16(v);
+	};
+
+	// A SYN-ACK only includes the options that the remote offered.
+	bool synAck = syn && connectState_ == ConnectState::sendSynAck;
+	if(syn && !synAck) {
+		put8(tcpOptMss);
+		put8(4);
+		put16(recvMss_);
+		put8(tcpOptSackPermitted);
+		put8(2);
+		put8(tcpOptTimestamps);
+		put8(10);
+		put32(timestampClock());
+		put32(0);
+		put8(tcpOptNop);
+		put8(tcpOptWindowScale);
+		put8(3);
+		put8(offeredWindowShift_);
+	}else if(synAck) {
+		put8(tcpOptMss);
+		put8(4);
+		put16(recvMss_);
+		if(useSack_ && useTimestamps_) {
+			put8(tcpOptSackPermitted);
+			put8(2);
+		}else if(useSack_) {
+			put8(tcpOptNop);
+			put8(tcpOptNop);
+			put8(tcpOptSackPermitted);
+			put8(2);
+		}else if(useTimestamps_) {
+			put8(tcpOptNop);
+			put8(tcpOptNop);
+		}
+		if(useTimestamps_) {
+			put8(tcpOptTimestamps);
+			put8(10);
+			put32(timestampClock());
+			put32(tsRecent_);
+		}
+		if(useWindowScale_) {
+			put8(tcpOptNop);
+			put8(tcpOptWindowScale);
+			put8(3);
+			put8(recvWindowShift_);
+		}
+	}else{
+		if(useTimestamps_) {
+			put8(tcpOptNop);
+			put8(tcpOptNop);
+			put8(tcpOptTimestamps);
+			put8(10);
+			put32(timestampClock());
+			put32(tsRecent_);
+		}
+		if(useSack_ && !outOfOrder_.empty()) {
+			SackBlock blocks[4];
+			auto numBlocks = buildSackBlocks_(blocks, useTimestamps_ ? 3 : 4);
+			put8(tcpOptNop);
+			put8(tcpOptNop);
+			put8(tcpOptSack);
+			put8(2 + 8 * numBlocks);
+			for(size_t i = 0; i < numBlocks; i++) {
+				put32(blocks[i].left);
+				put32(blocks[i].right);
+			}
+		}
+	}
+	assert(!(optionsLength % 4));
+	size_t headerLength = sizeof(TcpHeader) + optionsLength;
+
+	// The MSS also covers the options (RFC 6691).
+	size_t mss = sendMss_ - optionsLength;
+	if(!useTso)
+		size = std::min(size, mss);
+
+	// The segment is assembled directly in the frame, see the fill callback below.
+	alignas(TcpHeader) char headerBuffer[sizeof(TcpHeader) + sizeof(options)];
+	size_t segmentLength = headerLength + size;
+
+	size_t window;
+	if(syn) {
+		// The window of SYN segments is never scaled.
+		window = std::min(recvRing_.spaceForEnqueue(), size_t{0xFFFF});
+	}else{
+		window = announceableWindow_();
+	}
+
+	auto header = new (headerBuffer) TcpHeader {
+		.srcPort = localEp_.port,
+		.destPort = remoteEp_.port,
+		.seqNumber = seqNumber,
+		.ackNumber = (syn && !synAck) ? 0 : remoteKnownSn_,
+		.window = static_cast<uint16_t>(syn ? window : window >> recvWindowShift_),
+		.checksum = 0,
+		.urgentPointer = 0
+	};
+	header->flags.store(TcpHeader::headerWords(headerLength / 4)
+			| TcpHeader::synFlag(syn) | TcpHeader::ackFlag(!syn || synAck));
+	memcpy(headerBuffer + sizeof(TcpHeader), options, optionsLength);
+
+	// With checksum offload, the link sums up the segment;
+	// it expects the pseudo header sum in the checksum field.
+	PseudoHeader pseudo {
+		.src = targetInfo.source,
+		.dst = remoteEp_.ipAddress,
+		.len = segmentLength
+	};
+	Checksum csum;
+	csum.update(&pseudo, sizeof(PseudoHeader));
+	nic::TxOffload offload;
+	if(useCsumOffload) {
+		offload.needsChecksum = true;
+		offload.csumOffset = offsetof(TcpHeader, checksum);
+		header->checksum = static_cast<uint16_t>(~csum.finalize());
+	}
+	if(useTso && size > mss) {
+		offload.gsoSize = mss;
+		offload.headerLength = headerLength;
+	}
+
+	if(!syn) {
+		remoteAckedSn_ = remoteKnownSn_;
+		announcedWindow_ = window;
+		forceAck_ = false;
+		ackDeadline_ = 0;
+		ackDelayExpired_ = false;
+	}
+
+	if(debugTcp)
+		std::cout << "netserver: Sending TCP segment (" << size << " bytes)" << std::endl;
+	// The payload is copied straight from sendRing_ into the frame. Since sendFrameInPlace()
+	// can block on ARP, we remember the absolute ring position; if the data is acknowledged
+	// in the meantime, the segment is stale anyway and the receiver ignores its contents.
+	assert(offset + size <= sendRing_.availableToDequeue());
+	auto position = sendRing_.dequeuePosition() + offset;
+	auto error = co_await ip4().sendFrameInPlace(std::move(targetInfo),
+		segmentLength, static_cast<uint16_t>(IpProto::tcp),
+		[&] (arch::dma_buffer_view segment) {
+			auto p = reinterpret_cast<char *>(segment.data());
+			memcpy(p, headerBuffer, headerLength);
+			sendRing_.copyAt(position, p + headerLength, size);
+			if(!useCsumOffload) {
+				csum.update(p, segmentLength);
+				reinterpret_cast<TcpHeader *>(p)->checksum = csum.finalize();
+			}
+		}, offload);
+	if (error != protocols::fs::Error::none)
+		co_return error;
+	co_return size;
+}
+
 async::result<void> Tcp4Socket::flushOutPackets_() {
 	while(true) {
 		if(connectState_ == ConnectState::none) {
@@ -498,16 +1258,20 @@ async::result<void> Tcp4Socket::flushOutPackets_() {
 			continue;
 		}
 
-		if(connectState_ == ConnectState::sendSyn) {
-			if(localSettledSn_ != localFlushedSn_) {
+		if(connectState_ == ConnectState::sendSyn
+				|| connectState_ == ConnectState::sendSynAck) {
+			if(localSettledSn_ != localFlushedSn_ && !resendSyn_) {
 				co_await flushEvent_.async_wait();
 				continue;
 			}
 
-			// Obtain a new random sequence number.
-			auto randomSn = globalPrng();
-			localSettledSn_ = randomSn;
-			localFlushedSn_ = randomSn;
+			// Obtain a new random sequence number (unless we retransmit the SYN).
+			if(!resendSyn_) {
+				auto randomSn = globalPrng();
+				localSettledSn_ = randomSn;
+				localFlushedSn_ = randomSn;
+				recoverSn_ = randomSn;
+			}
 
 			// Construct and transmit the initial SYN packet.
 			auto targetInfo = co_await ip4().targetByRemote(remoteEp_.ipAddress);
@@ -516,59 +1280,78 @@ async::result<void> Tcp4Socket::flushOutPackets_() {
 				std::cout << "netserver: Destination unreachable" << std::endl;
 				co_return;
 			}
+			recvMss_ = targetInfo->link->mtu - sizeof(Ip4Packet::Header) - sizeof(TcpHeader);
+			if(connectState_ == ConnectState::sendSynAck)
+				sendMss_ = std::min(sendMss_, recvMss_);
+
+			// Now that we know our source address, incoming packets can be demultiplexed
+			// by their 4-tuple.
+			if(!flowRegistered_) {
+				flow_ = TcpFlow{targetInfo->source, remoteEp_.ipAddress,
+						localEp_.port, remoteEp_.port};
+				flowRegistered_ = parent_->registerFlow(holder_.lock(), flow_);
+			}
 
-			std::vector<char> buf;
-			buf.resize(sizeof(TcpHeader));
-
-			auto header = new (buf.data()) TcpHeader {
-				.srcPort = localEp_.port,
-				.destPort = remoteEp_.port,
-				.seqNumber = localFlushedSn_,
-				.ackNumber = 0,
-				.window = 0,
-				.checksum = 0,
-				.urgentPointer = 0
-			};
-			header->flags.store(TcpHeader::headerWords(sizeof(TcpHeader) / 4)
-					| TcpHeader::synFlag(true));
-
-			// Fill in the checksum.
-			PseudoHeader pseudo {
-				.src = targetInfo->source,
-				.dst = remoteEp_.ipAddress,
-				.len = buf.size()
-			};
-			Checksum csum;
-			csum.update(&pseudo, sizeof(PseudoHeader));
-			csum.update(buf.data(), buf.size());
-			header->checksum = csum.finalize();
-
-			++localFlushedSn_;
+			// Karn's algorithm: do not sample the RTT of retransmitted SYNs.
+			rttTiming_ = !resendSyn_;
+			rttTimingSn_ = localSettledSn_ + 1;
+			rttTimingStart_ = clockNanos();
+			resendSyn_ = false;
 
 			if(debugTcp)
-				std::cout << "netserver: Sending TCP SYN" << std::endl;
-			auto error = co_await ip4().sendFrame(std::move(*targetInfo),
-				buf.data(), buf.size(), static_cast<uint16_t>(IpProto::tcp));
-			if (error != protocols::fs::Error::none) {
+				std::cout << "netserver: Sending TCP SYN"
+						<< (connectState_ == ConnectState::sendSynAck ? "-ACK" : "") << std::endl;
+			auto result = co_await sendSegment_(std::move(*targetInfo),
+					localSettledSn_, 0, 0, true);
+			if (!result) {
 				// TODO: Return an error to users.
 				std::cout << "netserver: Could not send TCP packet" << std::endl;
 				co_return;
 			}
+
+			localFlushedSn_ = localSettledSn_ + 1; // SYN counts as one byte.
+			localMaxSn_ = localFlushedSn_;
+			armRetransmitTimer_();
 		}else{
-			assert(connectState_ == ConnectState::connected);
+			if(connectState_ != ConnectState::connected) {
+				co_await flushEvent_.async_wait();
+				continue;
+			}
 			size_t flushPointer = localFlushedSn_ - localSettledSn_;
-			size_t windowPointer = localWindowSn_ - localSettledSn_;
+			// We may not exceed the window of the remote, nor the congestion window.
+			size_t windowPointer = std::min(size_t(localWindowSn_ - localSettledSn_), cwnd_);
 
 			size_t bytesAvailable = sendRing_.availableToDequeue();
 			assert(bytesAvailable >= flushPointer);
 
 			// Check whether we need to send a packet.
-			// TODO: Add retransmission here.
+			bool wantRetransmit = retransmitPending_;
 			bool wantData = (bytesAvailable > flushPointer && windowPointer > flushPointer);
-			bool wantAck = (remoteAckedSn_ != remoteKnownSn_);
-			bool wantWindowUpdate = (announcedWindow_ < recvRing_.spaceForEnqueue());
 
-			if(!wantData && !wantAck && !wantWindowUpdate) {
+			// Nagle's algorithm (RFC 896): hold back partial segments while data is in flight.
+			// With TCP_CORK, partial segments are held back unconditionally.
+			if(wantData && bytesAvailable - flushPointer < sendMss_
+					&& (cork_ || (!noDelay_ && localFlushedSn_ != localSettledSn_)))
+				wantData = false;
+
+			// Delayed ACKs: in-order data is acknowledged by the next outgoing segment,
+			// by every second full-sized segment, or when the timer expires.
+			bool ackPending = (remoteAckedSn_ != remoteKnownSn_);
+			bool wantAck = forceAck_ || (ackPending && (ackDelayExpired_
+					|| remoteKnownSn_ - remoteAckedSn_ >= 2 * recvMss_));
+			// Avoid silly window syndrome (RFC 1122, section 4.2.3.3): only announce
+			// significant increases of the window.
+			size_t windowIncrease = announceableWindow_() - std::min(size_t{announcedWindow_},
+					announceableWindow_());
+			bool wantWindowUpdate = windowIncrease
+					&& (!announcedWindow_ || windowIncrease >= std::min(size_t{recvMss_},
+							recvRing_.size() / 2));
+
+			if(!wantRetransmit && !wantData && !wantAck && !wantWindowUpdate) {
+				if(ackPending && !ackDeadline_) {
+					ackDeadline_ = clockNanos() + delayedAckTimeout;
+					ackTimerEvent_.raise();
+				}
 				co_await flushEvent_.async_wait();
 				continue;
 			}
@@ -581,59 +1364,266 @@ async::result<void> Tcp4Socket::flushOutPackets_() {
 				co_return;
 			}
 
-			auto chunk = std::min({
-				bytesAvailable - flushPointer,
-				windowPointer - flushPointer,
-				size_t{1000} // TODO: Perform path MTU discovery.
-			});
-
-			std::vector<char> buf;
-			buf.resize(sizeof(TcpHeader) + chunk);
-
-			auto header = new (buf.data()) TcpHeader {
-				.srcPort = localEp_.port,
-				.destPort = remoteEp_.port,
-				.seqNumber = localFlushedSn_,
-				.ackNumber = remoteKnownSn_,
-				.window = std::min(recvRing_.spaceForEnqueue(), size_t{0xFFFF}),
-				.checksum = 0,
-				.urgentPointer = 0
-			};
-			header->flags.store(TcpHeader::headerWords(sizeof(TcpHeader) / 4)
-					| TcpHeader::ackFlag(true));
-
-			sendRing_.dequeueLookahead(flushPointer, buf.data() + sizeof(TcpHeader), chunk);
-
-			// Fill in the checksum.
-			PseudoHeader pseudo {
-				.src = targetInfo->source,
-				.dst = remoteEp_.ipAddress,
-				.len = buf.size()
-			};
-			Checksum csum;
-			csum.update(&pseudo, sizeof(PseudoHeader));
-			csum.update(buf.data(), buf.size());
-			header->checksum = csum.finalize();
+			if(wantRetransmit) {
+				retransmitPending_ = false;
+				auto [offset, chunk] = nextRetransmission_();
+				if(chunk) {
+					auto result = co_await sendSegment_(std::move(*targetInfo),
+							localSettledSn_ + offset, offset, chunk, false);
+					if (!result) {
+						// TODO: Return an error to users.
+						std::cout << "netserver: Could not send TCP packet" << std::endl;
+						co_return;
+					}
+					highRetransmitSn_ = localSettledSn_ + offset + result.value();
+					rttTiming_ = false;
+					continue;
+				}
+				if(!wantData && !wantAck && !wantWindowUpdate)
+					continue;
+			}
 
-			localFlushedSn_ += chunk;
-			remoteAckedSn_ = remoteKnownSn_;
-			announcedWindow_ = recvRing_.spaceForEnqueue();
+			size_t chunk = 0;
+			if(wantData)
+				chunk = std::min(bytesAvailable - flushPointer, windowPointer - flushPointer);
+			chunk = std::min(chunk, maxSuperSegment);
 
-			if(debugTcp)
-				std::cout << "netserver: Sending TCP data (" << chunk << " bytes)" << std::endl;
-			auto error = co_await ip4().sendFrame(std::move(*targetInfo),
-				buf.data(), buf.size(),
-				static_cast<uint16_t>(IpProto::tcp));
-			if (error != protocols::fs::Error::none) {
+			auto result = co_await sendSegment_(std::move(*targetInfo),
+					localFlushedSn_, flushPointer, chunk, false);
+			if (!result) {
 				// TODO: Return an error to users.
 				std::cout << "netserver: Could not send TCP packet" << std::endl;
 				co_return;
 			}
+
+			if(auto sent = result.value(); sent) {
+				// Only time segments that are not retransmissions.
+				if(!rttTiming_ && !seqLess(localFlushedSn_, localMaxSn_)) {
+					rttTiming_ = true;
+					rttTimingSn_ = localFlushedSn_ + sent;
+					rttTimingStart_ = clockNanos();
+				}
+				localFlushedSn_ += sent;
+				if(seqLess(localMaxSn_, localFlushedSn_))
+					localMaxSn_ = localFlushedSn_;
+				if(!rtoDeadline_)
+					armRetransmitTimer_();
+			}
 		}
 	}
 }
 
+async::result<void> Tcp4Socket::delayedAckTimer_() {
+	while(true) {
+		if(!ackDeadline_) {
+			co_await ackTimerEvent_.async_wait();
+			continue;
+		}
+
+		auto now = clockNanos();
+		if(now < ackDeadline_) {
+			co_await helix::sleepFor(ackDeadline_ - now);
+			continue;
+		}
+
+		ackDeadline_ = 0;
+		ackDelayExpired_ = true;
+		flushEvent_.raise();
+	}
+}
+
+async::result<void> Tcp4Socket::retransmitTimer_() {
+	while(true) {
+		if(!rtoDeadline_) {
+			co_await timerEvent_.async_wait();
+			continue;
+		}
+
+		auto now = clockNanos();
+		if(now < rtoDeadline_) {
+			// The deadline can move while we sleep; we simply re-check it afterwards.
+			co_await helix::sleepFor(rtoDeadline_ - now);
+			continue;
+		}
+
+		rtoDeadline_ = 0;
+		handleRetransmitTimeout_();
+	}
+}
+
+void Tcp4Socket::handleRetransmitTimeout_() {
+	rto_ = std::min(rto_ * 2, maxRto);
+	rttTiming_ = false;
+
+	if(connectState_ == ConnectState::sendSyn
+			|| connectState_ == ConnectState::sendSynAck) {
+		if(debugTcp)
+			std::cout << "netserver: TCP SYN timed out" << std::endl;
+		if(connectState_ == ConnectState::sendSynAck && ++synRetries_ > maxSynAckRetries) {
+			abortHandshake_();
+			return;
+		}
+		resendSyn_ = true;
+		flushEvent_.raise();
+		return;
+	}
+	if(connectState_ != ConnectState::connected)
+		return;
+
+	size_t flight = localMaxSn_ - localSettledSn_;
+	if(!flight)
+		return;
+	if(debugTcp)
+		std::cout << "netserver: TCP retransmission timeout" << std::endl;
+
+	// Collapse the congestion window and go back to the first unacknowledged byte.
+	// The remote may have reneged on SACKed data, so we forget about it (RFC 2018).
+	ssthresh_ = std::max(flight / 2, size_t{2} * sendMss_);
+	cwnd_ = sendMss_;
+	localFlushedSn_ = localSettledSn_;
+	recoverSn_ = localMaxSn_;
+	inRecovery_ = false;
+	dupAcks_ = 0;
+	sackedRanges_.clear();
+	highRetransmitSn_ = localSettledSn_;
+	retransmitPending_ = false;
+	flushEvent_.raise();
+}
+
+void Tcp4Socket::updateRtt_(uint64_t sample) {
+	if(!haveRtt_) {
+		srtt_ = sample;
+		rttvar_ = sample / 2;
+		haveRtt_ = true;
+	}else{
+		uint64_t delta = srtt_ > sample ? srtt_ - sample : sample - srtt_;
+		rttvar_ = (3 * rttvar_ + delta) / 4;
+		srtt_ = (7 * srtt_ + sample) / 8;
+	}
+	// The clock granularity G of RFC 6298 is the 1ms granularity of our timestamps.
+	rto_ = std::clamp(srtt_ + std::max(uint64_t{1'000'000}, 4 * rttvar_), minRto, maxRto);
+}
+
+void Tcp4Socket::enterRecovery_() {
+	size_t flight = localMaxSn_ - localSettledSn_;
+	ssthresh_ = std::max(flight / 2, size_t{2} * sendMss_);
+	cwnd_ = ssthresh_ + 3 * sendMss_;
+	inRecovery_ = true;
+	recoverSn_ = localMaxSn_;
+	highRetransmitSn_ = localSettledSn_;
+	retransmitPending_ = true;
+	rttTiming_ = false;
+	if(debugTcp)
+		std::cout << "netserver: TCP enters fast recovery" << std::endl;
+}
+
+std::pair<size_t, size_t> Tcp4Socket::nextRetransmission_() {
+	size_t limit = localMaxSn_ - localSettledSn_;
+	size_t offset = 0;
+	if(seqLess(localSettledSn_, highRetransmitSn_))
+		offset = highRetransmitSn_ - localSettledSn_;
+
+	// Skip over SACKed data; everything below a SACKed range is considered lost.
+	for(auto [left, right] : sackedRanges_) {
+		size_t leftOffset = left - localSettledSn_;
+		size_t rightOffset = right - localSettledSn_;
+		if(offset < leftOffset)
+			return {offset, std::min(leftOffset - offset, size_t(sendMss_))};
+		if(offset < rightOffset)
+			offset = rightOffset;
+	}
+
+	// Without SACK information, NewReno retransmits the first unacknowledged segment.
+	if(!sackedRanges_.empty() || offset >= limit)
+		return {offset, 0};
+	return {offset, std::min(limit - offset, size_t(sendMss_))};
+}
+
+void Tcp4Socket::addSackedRange_(uint32_t left, uint32_t right) {
+	// Ignore blocks that are not within the data that is in flight.
+	if(!seqLess(left, right))
+		return;
+	if(seqLess(left, localSettledSn_))
+		left = localSettledSn_;
+	if(seqLess(localMaxSn_, right))
+		right = localMaxSn_;
+	if(!seqLess(left, right))
+		return;
+
+	auto it = sackedRanges_.begin();
+	while(it != sackedRanges_.end() && seqLess(it->second, left))
+		++it;
+	// Merge with all overlapping or adjacent ranges.
+	while(it != sackedRanges_.end() && seqLessEqual(it->first, right)) {
+		if(seqLess(it->first, left))
+			left = it->first;
+		if(seqLess(right, it->second))
+			right = it->second;
+		it = sackedRanges_.erase(it);
+	}
+	sackedRanges_.insert(it, {left, right});
+}
+
+void Tcp4Socket::enqueueOutOfOrder_(uint32_t seqNumber, arch::dma_buffer_view payload, bool fin) {
+	// Do not buffer data beyond the window that we announced.
+	if(seqLessEqual(remoteKnownSn_ + announcedWindow_, seqNumber))
+		return;
+	size_t size = std::min(payload.size(),
+			size_t(remoteKnownSn_ + announcedWindow_ - seqNumber));
+	if(size < payload.size())
+		fin = false;
+
+	auto it = outOfOrder_.begin();
+	while(it != outOfOrder_.end() && seqLess(it->seqNumber, seqNumber))
+		++it;
+	if(it != outOfOrder_.end() && it->seqNumber == seqNumber && it->data.size() >= size)
+		return;
+	if(outOfOrder_.size() >= maxOutOfOrderSegments)
+		return;
+
+	auto p = static_cast<const char *>(payload.data());
+	outOfOrder_.insert(it, OutOfOrderSegment{seqNumber, std::vector<char>(p, p + size), fin});
+	lastOutOfOrderSn_ = seqNumber;
+}
+
+size_t Tcp4Socket::buildSackBlocks_(SackBlock *blocks, size_t maxBlocks) {
+	// Merge out-of-order segments into contiguous blocks.
+	std::vector<SackBlock> merged;
+	for(auto &segment : outOfOrder_) {
+		uint32_t end = segment.seqNumber + segment.data.size();
+		if(!merged.empty() && seqLessEqual(segment.seqNumber, merged.back().right)) {
+			if(seqLess(merged.back().right, end))
+				merged.back().right = end;
+		}else{
+			merged.push_back(SackBlock{segment.seqNumber, end});
+		}
+	}
+
+	// The first block must contain the most recently received segment (RFC 2018).
+	size_t n = 0;
+	for(auto &block : merged) {
+		if(seqLessEqual(block.left, lastOutOfOrderSn_) && seqLess(lastOutOfOrderSn_, block.right)) {
+			blocks[n++] = block;
+			break;
+		}
+	}
+	for(auto &block : merged) {
+		if(n == maxBlocks)
+			break;
+		if(n && block.left == blocks[0].left)
+			continue;
+		blocks[n++] = block;
+	}
+	return n;
+}
+
 void Tcp4Socket::handleInPacket_(TcpPacket packet) {
+	TcpOptions options;
+	if(!packet.parseOptions(options)) {
+		std::cout << "netserver: Rejecting TCP packet with malformed options" << std::endl;
+		return;
+	}
+
 	if(connectState_ == ConnectState::sendSyn) {
 		if(localSettledSn_ == localFlushedSn_) {
 			std::cout << "netserver: Rejecting packet before SYN is sent [sendSyn]"
@@ -657,63 +1647,355 @@ void Tcp4Socket::handleInPacket_(TcpPacket packet) {
 			return;
 		}
 
+		// Options only take effect if both sides offer them.
+		sendMss_ = std::min(uint32_t{options.mss.value_or(defaultMss)}, recvMss_);
+		if(options.windowShift) {
+			useWindowScale_ = true;
+			sendWindowShift_ = *options.windowShift;
+			recvWindowShift_ = offeredWindowShift_;
+		}
+		useSack_ = options.sackPermitted;
+		if(options.timestamps) {
+			useTimestamps_ = true;
+			tsRecent_ = options.timestamps->first;
+		}
+
+		if(rttTiming_)
+			updateRtt_(clockNanos() - rttTimingStart_);
+		rttTiming_ = false;
+		rtoDeadline_ = 0;
+
+		cwnd_ = initialWindow_();
+
 		++localSettledSn_;
+		highRetransmitSn_ = localSettledSn_;
 		localWindowSn_ = localSettledSn_ + packet.header.window.load();
 		remoteAckedSn_ = packet.header.seqNumber.load();
 		remoteKnownSn_ = packet.header.seqNumber.load() + 1; // SYN counts as one byte.
 		connectState_ = ConnectState::connected;
+		forceAck_ = true;
 		flushEvent_.raise();
 		settleEvent_.raise();
+	}else if(connectState_ == ConnectState::sendSynAck) {
+		auto flags = packet.header.flags.load();
+		if(flags & TcpHeader::synFlag) {
+			// The remote retransmitted its SYN; our SYN-ACK was probably lost.
+			if(localSettledSn_ != localFlushedSn_) {
+				resendSyn_ = true;
+				flushEvent_.raise();
+			}
+			return;
+		}
+		if(!(flags & TcpHeader::ackFlag) || localSettledSn_ == localFlushedSn_
+				|| packet.header.ackNumber.load() != localSettledSn_ + 1) {
+			std::cout << "netserver: Rejecting packet with bad ack-number [sendSynAck]"
+					<< std::endl;
+			return;
+		}
+
+		if(rttTiming_)
+			updateRtt_(clockNanos() - rttTimingStart_);
+		rttTiming_ = false;
+		rtoDeadline_ = 0;
+
+		cwnd_ = initialWindow_();
+
+		++localSettledSn_;
+		highRetransmitSn_ = localSettledSn_;
+		localWindowSn_ = localSettledSn_
+				+ (size_t{packet.header.window.load()} << sendWindowShift_);
+		connectState_ = ConnectState::connected;
+		establish_(true);
+
+		// The ACK may already carry data.
+		handleInPacket_(std::move(packet));
 	}else if(connectState_ == ConnectState::connected) {
-		if(packet.header.seqNumber.load() == remoteKnownSn_) {
+		auto seqNumber = packet.header.seqNumber.load();
+		auto payload = packet.payload();
+		bool fin = packet.header.flags.load() & TcpHeader::finFlag;
+
+		// Remember the timestamp to echo (RFC 7323, section 4.3).
+		if(useTimestamps_ && options.timestamps && seqLessEqual(seqNumber, remoteAckedSn_))
+			tsRecent_ = options.timestamps->first;
+
+		if(payload.size() || fin) {
 			bool gotUpdate = false;
 
-			auto payload = packet.payload();
-			size_t chunk = std::min(payload.size(), recvRing_.spaceForEnqueue());
-			if(chunk) {
-				recvRing_.enqueue(payload.data(), chunk);
-				remoteKnownSn_ += chunk;
-				if(announcedWindow_ < chunk) {
-					announcedWindow_ = 0;
-				}else{
-					announcedWindow_ -= chunk;
+			if(seqLessEqual(seqNumber, remoteKnownSn_)
+					&& seqLess(remoteKnownSn_, seqNumber + payload.size() + fin)) {
+				// Trim data that we already received.
+				size_t overlap = remoteKnownSn_ - seqNumber;
+				auto data = payload.subview(std::min(overlap, payload.size()));
+
+				size_t chunk = std::min(data.size(), recvRing_.spaceForEnqueue());
+				if(chunk) {
+					recvRing_.enqueue(data.data(), chunk);
+					remoteKnownSn_ += chunk;
+					gotUpdate = true;
 				}
+				bool gotFin = fin && chunk == data.size();
 
-				inSeq_ = ++currentSeq_;
-				gotUpdate = true;
-			}
+				// Deliver buffered segments that are now in order.
+				while(!gotFin && !outOfOrder_.empty()) {
+					auto &segment = outOfOrder_.front();
+					if(seqLess(remoteKnownSn_, segment.seqNumber))
+						break;
+					size_t segmentOverlap = remoteKnownSn_ - segment.seqNumber;
+					if(segmentOverlap < segment.data.size()) {
+						size_t n = std::min(segment.data.size() - segmentOverlap,
+								recvRing_.spaceForEnqueue());
+						recvRing_.enqueue(segment.data.data() + segmentOverlap, n);
+						remoteKnownSn_ += n;
+						gotUpdate = true;
+						if(segmentOverlap + n < segment.data.size())
+							break;
+					}
+					gotFin = segment.fin;
+					outOfOrder_.pop_front();
+				}
 
-			if(packet.header.flags.load() & TcpHeader::finFlag) {
-				++remoteKnownSn_; // FIN counts as one byte.
-				remoteClosed_ = true;
+				if(chunk) {
+					if(announcedWindow_ < chunk) {
+						announcedWindow_ = 0;
+					}else{
+						announcedWindow_ -= chunk;
+					}
+				}
+				if(gotUpdate)
+					inSeq_ = ++currentSeq_;
+
+				if(gotFin) {
+					++remoteKnownSn_; // FIN counts as one byte.
+					remoteClosed_ = true;
+					forceAck_ = true;
+					outOfOrder_.clear();
+
+					hupSeq_ = ++currentSeq_;
+					gotUpdate = true;
+				}
 
-				hupSeq_ = ++currentSeq_;
-				gotUpdate = true;
+				// Acknowledge immediately while there is still a gap (RFC 5681, section 4.2).
+				if(!outOfOrder_.empty())
+					forceAck_ = true;
+			}else if(seqLess(remoteKnownSn_, seqNumber)) {
+				// Buffer the segment and send a duplicate ACK to trigger fast retransmit.
+				enqueueOutOfOrder_(seqNumber, payload, fin);
+				forceAck_ = true;
+			}else{
+				// Old duplicate, probably because our ACK was lost.
+				forceAck_ = true;
 			}
 
 			if(gotUpdate) {
 				inEvent_.raise();
-				flushEvent_.raise();
 				pollEvent_.raise();
 			}
+			flushEvent_.raise();
 		}
 
-		if(packet.header.flags.load() & TcpHeader::ackFlag) {
-			size_t validWindow = localFlushedSn_ - localSettledSn_;
-			size_t ackPointer = packet.header.ackNumber.load() - localSettledSn_;
-			if(ackPointer <= validWindow) {
-				localSettledSn_ += ackPointer;
-				localWindowSn_ = localSettledSn_ + packet.header.window.load();
-				sendRing_.dequeueAdvance(ackPointer);
-				outSeq_ = ++currentSeq_;
-				settleEvent_.raise();
-				pollEvent_.raise();
+		if(packet.header.flags.load() & TcpHeader::ackFlag)
+			handleAck_(packet, options);
+	}
+}
+
+void Tcp4Socket::acceptSyn_(std::shared_ptr<Tcp4Listener> listener, const TcpFlow &flow,
+		TcpPacket &packet, TcpOptions &options) {
+	listener_ = std::move(listener);
+	localEp_ = {flow.localIp, flow.localPort};
+	remoteEp_ = {flow.remoteIp, flow.remotePort};
+
+	// Options only take effect if both sides offer them; we offer all of them.
+	// sendMss_ is clamped to recvMss_ once we know the link.
+	sendMss_ = options.mss.value_or(defaultMss);
+	if(options.windowShift) {
+		useWindowScale_ = true;
+		sendWindowShift_ = *options.windowShift;
+		recvWindowShift_ = offeredWindowShift_;
+	}
+	useSack_ = options.sackPermitted;
+	if(options.timestamps) {
+		useTimestamps_ = true;
+		tsRecent_ = options.timestamps->first;
+	}
+
+	remoteAckedSn_ = packet.header.seqNumber.load();
+	remoteKnownSn_ = packet.header.seqNumber.load() + 1; // SYN counts as one byte.
+	connectState_ = ConnectState::sendSynAck;
+
+	flow_ = flow;
+	flowRegistered_ = parent_->registerFlow(holder_.lock(), flow_);
+	flushEvent_.raise();
+}
+
+void Tcp4Socket::acceptCookie_(std::shared_ptr<Tcp4Listener> listener, const TcpFlow &flow,
+		TcpPacket packet, uint32_t cookie, uint16_t mss) {
+	listener_ = std::move(listener);
+	localEp_ = {flow.localIp, flow.localPort};
+	remoteEp_ = {flow.remoteIp, flow.remotePort};
+	sendMss_ = mss;
+
+	localSettledSn_ = cookie + 1; // SYN counts as one byte.
+	localFlushedSn_ = localSettledSn_;
+	localMaxSn_ = localSettledSn_;
+	highRetransmitSn_ = localSettledSn_;
+	recoverSn_ = cookie;
+	localWindowSn_ = localSettledSn_ + packet.header.window.load();
+	remoteAckedSn_ = packet.header.seqNumber.load();
+	remoteKnownSn_ = packet.header.seqNumber.load();
+	cwnd_ = initialWindow_();
+	connectState_ = ConnectState::connected;
+
+	flow_ = flow;
+	flowRegistered_ = parent_->registerFlow(holder_.lock(), flow_);
+	establish_(false);
+
+	handleInPacket_(std::move(packet));
+}
+
+void Tcp4Socket::establish_(bool embryonic) {
+	auto listener = listener_;
+	if(embryonic)
+		listener->numEmbryonic.fetch_sub(1, std::memory_order_relaxed);
+	listener->numQueued.fetch_add(1, std::memory_order_relaxed);
+
+	auto [localLane, remoteLane] = helix::createStream();
+	async::detach(protocols::fs::servePassthrough(std::move(localLane),
+			holder_.lock(), &ops));
+
+	getShard(listener->shard).post([listener, lane = std::move(remoteLane)] () mutable {
+		if(!listener->socket) {
+			listener->numQueued.fetch_sub(1, std::memory_order_relaxed);
+			return;
+		}
+		listener->socket->queueAccept_(std::move(lane));
+	});
+}
+
+void Tcp4Socket::abortHandshake_() {
+	if(debugTcp)
+		std::cout << "netserver: Abandoning TCP handshake" << std::endl;
+	connectState_ = ConnectState::none;
+	listener_->numEmbryonic.fetch_sub(1, std::memory_order_relaxed);
+
+	// Only the flow keeps the socket alive. Drop the last reference outside of
+	// the coroutine that called us.
+	auto self = holder_.lock();
+	parent_->unregisterFlow(flow_);
+	flowRegistered_ = false;
+	currentShard().post([self = std::move(self)] { });
+}
+
+void Tcp4Socket::queueAccept_(helix::UniqueLane lane) {
+	listening_->acceptQueue.push_back(std::move(lane));
+	inSeq_ = ++currentSeq_;
+	acceptEvent_.raise();
+	pollEvent_.raise();
+}
+
+void Tcp4Socket::handleAck_(TcpPacket &packet, TcpOptions &options) {
+	auto ackNumber = packet.header.ackNumber.load();
+	size_t validWindow = localMaxSn_ - localSettledSn_;
+	size_t ackPointer = ackNumber - localSettledSn_;
+	if(ackPointer > validWindow) {
+		std::cout << "netserver: Rejecting ack-number outside of valid window"
+				<< std::endl;
+		return;
+	}
+
+	size_t window = size_t{packet.header.window.load()} << sendWindowShift_;
+	bool windowChanged = (static_cast<uint32_t>(ackNumber + window) != localWindowSn_);
+
+	if(useSack_) {
+		for(size_t i = 0; i < options.numSackBlocks; i++)
+			addSackedRange_(options.sackBlocks[i].left, options.sackBlocks[i].right);
+	}
+
+	if(ackPointer) {
+		// Take an RTT sample. ACKs of retransmitted data are excluded since the sender
+		// stops timing (and TSecr still refers to the original transmission).
+		if(useTimestamps_ && options.timestamps && options.timestamps->second) {
+			updateRtt_(uint64_t{timestampClock() - options.timestamps->second} * 1'000'000);
+		}else if(rttTiming_ && seqLessEqual(rttTimingSn_, ackNumber)) {
+			updateRtt_(clockNanos() - rttTimingStart_);
+		}
+		if(rttTiming_ && seqLessEqual(rttTimingSn_, ackNumber))
+			rttTiming_ = false;
+
+		localSettledSn_ = ackNumber;
+		sendRing_.dequeueAdvance(ackPointer);
+		// After a timeout, the remote may acknowledge data that we did not re-flush yet.
+		if(seqLess(localFlushedSn_, localSettledSn_))
+			localFlushedSn_ = localSettledSn_;
+		if(seqLess(highRetransmitSn_, localSettledSn_))
+			highRetransmitSn_ = localSettledSn_;
+		while(!sackedRanges_.empty() && seqLessEqual(sackedRanges_.front().second, localSettledSn_))
+			sackedRanges_.erase(sackedRanges_.begin());
+		if(!sackedRanges_.empty() && seqLess(sackedRanges_.front().first, localSettledSn_))
+			sackedRanges_.front().first = localSettledSn_;
+
+		if(inRecovery_) {
+			if(seqLessEqual(recoverSn_, ackNumber)) {
+				// Full ACK: leave fast recovery (RFC 6582, section 3.2, step 3).
+				size_t flight = localMaxSn_ - localSettledSn_;
+				cwnd_ = std::min(ssthresh_, std::max(flight, size_t{sendMss_}) + sendMss_);
+				inRecovery_ = false;
 			}else{
-				std::cout << "netserver: Rejecting ack-number outside of valid window"
-						<< std::endl;
+				// Partial ACK: retransmit the next hole and deflate the window.
+				cwnd_ -= std::min(cwnd_, ackPointer);
+				cwnd_ += sendMss_;
+				retransmitPending_ = true;
 			}
+		}else if(cwnd_ < ssthresh_) {
+			cwnd_ += std::min(ackPointer, size_t{sendMss_});
+		}else{
+			cwnd_ += std::max(size_t{1}, size_t{sendMss_} * sendMss_ / cwnd_);
+		}
+		cwnd_ = std::min(cwnd_, size_t{1} << 30);
+		dupAcks_ = 0;
+
+		// Restart the timer for the remaining data (RFC 6298, section 5).
+		if(localSettledSn_ == localMaxSn_) {
+			rtoDeadline_ = 0;
+		}else{
+			armRetransmitTimer_();
+		}
+
+		outSeq_ = ++currentSeq_;
+		settleEvent_.raise();
+		pollEvent_.raise();
+	}else if(validWindow && !packet.payload().size()
+			&& !(packet.header.flags.load() & TcpHeader::finFlag) && !windowChanged) {
+		// Duplicate ACK (RFC 5681, section 2).
+		++dupAcks_;
+		if(!inRecovery_) {
+			// Enter recovery at most once per window of data (RFC 6582, section 3.2).
+			size_t sacked = 0;
+			for(auto [left, right] : sackedRanges_)
+				sacked += right - left;
+			if((dupAcks_ >= 3 || sacked > 3 * size_t{sendMss_})
+					&& seqLess(recoverSn_, localSettledSn_))
+				enterRecovery_();
+		}else{
+			cwnd_ += sendMss_;
+			if(useSack_)
+				retransmitPending_ = true;
 		}
 	}
+
+	localWindowSn_ = localSettledSn_ + window;
+	flushEvent_.raise();
+}
+
+size_t TcpFlowHash::operator()(const TcpFlow &flow) const {
+	uint64_t x = (uint64_t{flow.remoteIp} << 32 | flow.localIp)
+			^ (uint64_t{flow.remotePort} << 16 | flow.localPort) * 0x9E3779B97F4A7C15;
+	// Finalizer of MurmurHash3; mixes all bits of x into the low bits.
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCD;
+	x ^= x >> 33;
+	x *= 0xC4CEB9FE1A85EC53;
+	x ^= x >> 33;
+	return x;
 }
 
 void Tcp4::feedDatagram(smarter::shared_ptr<const Ip4Packet> packet) {
@@ -727,33 +2009,192 @@ void Tcp4::feedDatagram(smarter::shared_ptr<const Ip4Packet> packet) {
 		std::cout << "netserver: Received TCP packet at port " << tcp.header.destPort.load()
 				<< " (" << tcp.payload().size() << " bytes)" << std::endl;
 
-	auto it = binds.lower_bound({ 0, tcp.header.destPort.load() });
-	for (; it != binds.end() && it->first.port == tcp.header.destPort.load(); it++) {
-		auto existingEp = it->first;
+	TcpFlow flow{tcp.packet->header.destination, tcp.packet->header.source,
+			tcp.header.destPort.load(), tcp.header.srcPort.load()};
+	if (auto it = connections.find(flow); it != connections.end()) {
+		it->second->handleInPacket_(std::move(tcp));
+		return;
+	}
+
+	if (handleListen_(tcp, flow))
+		return;
+
+	auto it = binds.find(tcp.header.destPort.load());
+	if (it == binds.end())
+		return;
+	for (auto &socket : it->second) {
+		auto existingEp = socket->localEp_;
 		if (existingEp.ipAddress == tcp.packet->header.destination
 				|| existingEp.ipAddress == INADDR_ANY) {
-			it->second->handleInPacket_(std::move(tcp));
+			socket->handleInPacket_(std::move(tcp));
 			break;
 		}
 	}
 }
 
-bool Tcp4::tryBind(smarter::shared_ptr<Tcp4Socket> socket, TcpEndpoint wantedEp) {
-	auto it = binds.lower_bound(wantedEp);
-	for (; it != binds.end() && it->first.port == wantedEp.port; it++) {
-		auto existingEp = it->first;
-		if (existingEp.ipAddress == INADDR_ANY || wantedEp.ipAddress == INADDR_ANY
-				|| existingEp.ipAddress == wantedEp.ipAddress) {
+bool Tcp4::handleListen_(TcpPacket &tcp, const TcpFlow &flow) {
+	auto flags = tcp.header.flags.load();
+	bool syn = flags & TcpHeader::synFlag;
+	bool ack = flags & TcpHeader::ackFlag;
+	if (syn == ack)
+		return false;
+
+	auto listener = findListener(flow);
+	if (!listener)
+		return false;
+
+	if (syn) {
+		TcpOptions options;
+		if (!tcp.parseOptions(options))
+			return true;
+
+		// Drop the SYN if the accept queue is full; the remote will retry.
+		if (listener->numQueued.load(std::memory_order_relaxed) >= listenBacklog)
+			return true;
+
+		auto remoteSn = tcp.header.seqNumber.load();
+		if (listener->numEmbryonic.fetch_add(1, std::memory_order_relaxed) >= listenBacklog) {
+			listener->numEmbryonic.fetch_sub(1, std::memory_order_relaxed);
+			sendCookieSynAck(flow, makeCookie(flow, remoteSn, options.mss.value_or(defaultMss)),
+					remoteSn + 1);
+			return true;
+		}
+
+		auto socket = Tcp4Socket::makeSocket(this, false);
+		socket->acceptSyn_(std::move(listener), flow, tcp, options);
+		return true;
+	}
+
+	// An ACK without a connection can complete a handshake that used a SYN cookie.
+	auto cookie = tcp.header.ackNumber.load() - 1;
+	auto mss = checkCookie(flow, tcp.header.seqNumber.load() - 1, cookie);
+	if (!mss)
+		return false;
+	if (listener->numQueued.load(std::memory_order_relaxed) >= listenBacklog)
+		return true;
+
+	if(debugTcp)
+		std::cout << "netserver: Accepted TCP connection with SYN cookie" << std::endl;
+	auto socket = Tcp4Socket::makeSocket(this, false);
+	socket->acceptCookie_(std::move(listener), flow, std::move(tcp), cookie, *mss);
+	return true;
+}
+
+namespace {
+
+struct PortClaim {
+	uint32_t address;
+	bool reusePort;
+};
+
+// Ports are shared between all shards.
+std::mutex globalPortsMutex;
+std::unordered_map<uint16_t, std::vector<PortClaim>> globalPorts;
+
+// Connections that are not processed by the shard that their flow hash selects,
+// i.e., connections of sockets that were explicitly bound before connect().
+std::mutex steeringExceptionsMutex;
+std::unordered_map<TcpFlow, size_t, TcpFlowHash> steeringExceptions;
+std::atomic<size_t> numSteeringExceptions = 0;
+
+// With SO_REUSEPORT, multiple sockets can bind to the same endpoint
+// as long as all of them set the option.
+bool claimPort(TcpEndpoint wantedEp, bool reusePort) {
+	std::lock_guard lock{globalPortsMutex};
+	auto &claims = globalPorts[wantedEp.port];
+	for (auto claim : claims) {
+		if (claim.reusePort && reusePort && claim.address == wantedEp.ipAddress)
+			continue;
+		if (claim.address == INADDR_ANY || wantedEp.ipAddress == INADDR_ANY
+				|| claim.address == wantedEp.ipAddress) {
 			return false;
 		}
 	}
+	claims.push_back({wantedEp.ipAddress, reusePort});
+	return true;
+}
+
+void releasePort(TcpEndpoint e) {
+	std::lock_guard lock{globalPortsMutex};
+	auto it = globalPorts.find(e.port);
+	assert(it != globalPorts.end());
+	auto &claims = it->second;
+	claims.erase(std::find_if(claims.begin(), claims.end(),
+			[&] (const PortClaim &c) { return c.address == e.ipAddress; }));
+	if (claims.empty())
+		globalPorts.erase(it);
+}
+
+} // anonymous namespace
+
+size_t Tcp4::shardOf(const TcpFlow &flow) {
+	if (numSteeringExceptions.load(std::memory_order_relaxed)) {
+		std::lock_guard lock{steeringExceptionsMutex};
+		if (auto it = steeringExceptions.find(flow); it != steeringExceptions.end())
+			return it->second;
+	}
+	return TcpFlowHash{}(flow) % numShards();
+}
+
+bool Tcp4::tryBind(smarter::shared_ptr<Tcp4Socket> socket, TcpEndpoint wantedEp) {
+	if (!claimPort(wantedEp, socket->reusePort_))
+		return false;
 	socket->localEp_ = wantedEp;
-	binds.emplace(wantedEp, std::move(socket));
+	binds[wantedEp.port].push_back(std::move(socket));
+	return true;
+}
+
+bool Tcp4::unbind(Tcp4Socket *socket, TcpEndpoint e) {
+	auto it = binds.find(e.port);
+	if (it == binds.end())
+		return false;
+	auto &sockets = it->second;
+	auto sit = std::find_if(sockets.begin(), sockets.end(),
+			[&] (const auto &s) { return s.get() == socket; });
+	if (sit == sockets.end())
+		return false;
+	sockets.erase(sit);
+	if (sockets.empty())
+		binds.erase(it);
+	releasePort(e);
+	return true;
+}
+
+bool Tcp4::registerFlow(smarter::shared_ptr<Tcp4Socket> socket, TcpFlow flow) {
+	if (!connections.emplace(flow, std::move(socket)).second)
+		return false;
+
+	auto shard = currentShard().index();
+	if (TcpFlowHash{}(flow) % numShards() != shard) {
+		std::lock_guard lock{steeringExceptionsMutex};
+		steeringExceptions.emplace(flow, shard);
+		numSteeringExceptions.store(steeringExceptions.size(), std::memory_order_relaxed);
+	}
+	return true;
+}
+
+bool Tcp4::unregisterFlow(TcpFlow flow) {
+	if (!connections.erase(flow))
+		return false;
+
+	if (numSteeringExceptions.load(std::memory_order_relaxed)) {
+		std::lock_guard lock{steeringExceptionsMutex};
+		steeringExceptions.erase(flow);
+		numSteeringExceptions.store(steeringExceptions.size(), std::memory_order_relaxed);
+	}
 	return true;
 }
 
-bool Tcp4::unbind(TcpEndpoint e) {
-	return binds.erase(e) != 0;
+void Tcp4::addSyntheticConnection(TcpFlow flow) {
+	auto socket = Tcp4Socket::makeSocket(this, true);
+	socket->localEp_ = {flow.localIp, flow.localPort};
+	socket->remoteEp_ = {flow.remoteIp, flow.remotePort};
+	socket->connectState_ = Tcp4Socket::ConnectState::connected;
+	socket->cwnd_ = socket->sendMss_;
+	// Pretend that we are up to date; otherwise, the socket tries to send ACKs.
+	socket->announcedWindow_ = socket->announceableWindow_();
+	socket->flow_ = flow;
+	socket->flowRegistered_ = registerFlow(socket, flow);
 }
 
 void Tcp4::serveSocket(int flags, helix::UniqueLane lane) {
@@ -2,9 +2,11 @@
 
 #include <helix/ipc.hpp>
 #include <smarter.hpp>
-#include <map>
+#include <unordered_map>
+#include <vector>
 
 class Ip4Packet;
+struct TcpPacket;
 
 struct TcpEndpoint {
 	friend bool operator<(const TcpEndpoint &l, const TcpEndpoint &r) {
@@ -15,14 +17,49 @@ struct TcpEndpoint {
 	uint16_t port = 0;
 };
 
+// Identifies a connection by its 4-tuple.
+struct TcpFlow {
+	friend bool operator==(const TcpFlow &, const TcpFlow &) = default;
+
+	uint32_t localIp = 0;
+	uint32_t remoteIp = 0;
+	uint16_t localPort = 0;
+	uint16_t remotePort = 0;
+};
+
+struct TcpFlowHash {
+	size_t operator()(const TcpFlow &flow) const;
+};
+
 struct Tcp4Socket;
 
 struct Tcp4 {
 	void feedDatagram(smarter::shared_ptr<const Ip4Packet>);
 	bool tryBind(smarter::shared_ptr<Tcp4Socket> socket, TcpEndpoint ipAddress);
-	bool unbind(TcpEndpoint remote);
+	bool unbind(Tcp4Socket *socket, TcpEndpoint local);
 	void serveSocket(int flags, helix::UniqueLane lane);
 
+	// Shard that processes the packets of a connection. This is determined by the flow
+	// hash, unless the connection was explicitly assigned to another shard.
+	static size_t shardOf(const TcpFlow &flow);
+
+	// Creates a socket in the connected state without performing a handshake.
+	// This is only used to benchmark packet demultiplexing.
+	void addSyntheticConnection(TcpFlow flow);
+
 private:
-	std::map<TcpEndpoint, smarter::shared_ptr<Tcp4Socket>> binds;
+	friend struct Tcp4Socket;
+
+	bool registerFlow(smarter::shared_ptr<Tcp4Socket> socket, TcpFlow flow);
+	bool unregisterFlow(TcpFlow flow);
+
+	// Handles SYNs to listening sockets and ACKs that complete a handshake with
+	// a SYN cookie. Returns false if the packet does not belong to a listener.
+	bool handleListen_(TcpPacket &packet, const TcpFlow &flow);
+
+	// Sockets that have a remote endpoint (on this shard); these are looked up first.
+	std::unordered_map<TcpFlow, smarter::shared_ptr<Tcp4Socket>, TcpFlowHash> connections;
+	// Bound sockets, indexed by port. Packets that do not belong to a connection
+	// are delivered to the socket that is bound to the destination.
+	std::unordered_map<uint16_t, std::vector<smarter::shared_ptr<Tcp4Socket>>> binds;
 };
@@ -4,27 +4,29 @@
 #include "checksum.hpp"
 
 #include <async/basic.hpp>
+#include <async/recurring-event.hpp>
 #include <async/result.hpp>
-#include <async/queue.hpp>
 #include <arch/bit.hpp>
 #include <protocols/fs/server.hpp>
+#include <algorithm>
+#include <cstddef>
 #include <cstring>
+#include <deque>
 #include <iomanip>
 #include <random>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
 
+// Socket options of the UDP level (SOL_UDP), as on Linux.
+constexpr int optUdpSegment = 103;
+constexpr int optUdpGro = 104;
+
 namespace {
-struct stl_allocator {
-	void *allocate(size_t size) {
-		return operator new(size);
-	}
+constexpr bool logDatagrams = false;
 
-	void deallocate(void *p, size_t) {
-		return operator delete(p);
-	}
-};
+// Upper bound on the number of datagrams that GSO or GRO combine.
+constexpr size_t maxSegments = 64;
 
 template<typename T>
 void maybeFlip(T &x) {
@@ -64,31 +66,39 @@ struct Udp {
 	} header;
 	static_assert(sizeof(header) == 8, "udp header size wrong");
 
-	arch::dma_buffer_view payload() const {
-		return packet->payload().subview(sizeof(header));
+	// Size of the UDP payload.
+	size_t size() const {
+		return packet->payloadSize() - sizeof(header);
+	}
+
+	// Copies the UDP payload; reassembled datagrams are not linearized.
+	void copyTo(void *dest, size_t n) const {
+		packet->copyPayload(dest, sizeof(header), n);
 	}
 
 	bool parse(smarter::shared_ptr<const Ip4Packet> packet) {
 		Checksum chk;
-		auto payload = packet->payload();
-		if (payload.size() < sizeof(header)) {
+		auto payloadSize = packet->payloadSize();
+		if (payloadSize < sizeof(header)) {
 			return false;
 		}
-		std::memcpy(&header, payload.data(), sizeof(header));
+		packet->copyPayload(&header, 0, sizeof(header));
 		header.ensureEndian();
-		if (payload.size() < header.len) {
+		if (payloadSize < header.len) {
 			return false;
 		}
-		if (header.chk != 0) {
+		if (header.chk != 0 && !packet->checksumValid) {
 			PseudoHeader phdr;
 			phdr.src = packet->header.source;
 			phdr.dst = packet->header.destination;
 			phdr.proto = packet->header.protocol;
-			phdr.len = payload.size();
+			phdr.len = payloadSize;
 			phdr.ensureEndian();
 
 			chk.update(&phdr, sizeof(phdr));
-			chk.update(payload);
+			packet->forEachChunk([&] (arch::dma_buffer_view chunk) {
+				chk.update(chunk);
+			});
 			auto fin = chk.finalize();
 			if (fin != 0 && ~fin != 0) {
 				return false;
@@ -222,20 +232,84 @@ struct Udp4Socket {
 		using arch::convert_endian;
 		using arch::endian;
 		auto self = static_cast<Udp4Socket *>(obj);
-		auto element = co_await self->queue_.async_get();
-		auto packet = element->payload();
-		auto copy_size = std::min(packet.size(), len);
-		std::memcpy(data, packet.data(), copy_size);
+		while (self->queue_.empty())
+			co_await self->queueBell_.async_wait();
+
+		auto element = std::move(self->queue_.front());
+		self->queue_.pop_front();
+		auto copy_size = std::min(element.size(), len);
+		element.copyTo(data, copy_size);
 		sockaddr_in addr {
 			.sin_family = AF_INET,
-			.sin_port = convert_endian<endian::big>(element->header.src),
+			.sin_port = convert_endian<endian::big>(element.header.src),
 			.sin_addr = {
-				convert_endian<endian::big>(element->packet->header.source)
+				convert_endian<endian::big>(element.packet->header.source)
 			}
 		};
 		std::memset(addr_buf, 0, addr_size);
 		std::memcpy(addr_buf, &addr, std::min(addr_size, sizeof(addr)));
-		co_return RecvData { copy_size, sizeof(addr), {} };
+
+		// With UDP_GRO, append queued datagrams of the same flow as long as they have
+		// the same size as the first one; only the last one can be shorter (as on Linux).
+		auto segment_size = element.size();
+		size_t num_segments = 1;
+		if (self->gro_ && copy_size == segment_size && segment_size) {
+			while (!self->queue_.empty() && num_segments < maxSegments) {
+				auto &next = self->queue_.front();
+				auto next_size = next.size();
+				if (next.header.src != element.header.src
+						|| next.packet->header.source != element.packet->header.source
+						|| next_size > segment_size
+						|| copy_size + next_size > len)
+					break;
+
+				next.copyTo(static_cast<char *>(data) + copy_size, next_size);
+				copy_size += next_size;
+				num_segments++;
+				self->queue_.pop_front();
+				if (next_size < segment_size)
+					break;
+			}
+		}
+
+		std::vector<char> ctrl;
+		if (num_segments > 1 && max_ctrl_len >= CMSG_SPACE(sizeof(int))) {
+			ctrl.resize(CMSG_SPACE(sizeof(int)));
+			auto cmsg = reinterpret_cast<struct cmsghdr *>(ctrl.data());
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			cmsg->cmsg_level = static_cast<int>(IpProto::udp);
+			cmsg->cmsg_type = optUdpGro;
+			int gso_size = segment_size;
+			std::memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(int));
+		}
+
+		co_return RecvData { copy_size, sizeof(addr), std::move(ctrl) };
+	}
+
+	static async::result<int> getOption(void *obj, int option) {
+		auto self = static_cast<Udp4Socket *>(obj);
+		switch (option) {
+		case optUdpSegment: co_return self->segmentSize_;
+		case optUdpGro: co_return self->gro_;
+		default:
+			std::cout << "netserver: unsupported UDP option " << option << std::endl;
+			co_return 0;
+		}
+	}
+
+	static async::result<void> setOption(void *obj, int option, int value) {
+		auto self = static_cast<Udp4Socket *>(obj);
+		switch (option) {
+		case optUdpSegment:
+			self->segmentSize_ = std::max(value, 0);
+			break;
+		case optUdpGro:
+			self->gro_ = value;
+			break;
+		default:
+			std::cout << "netserver: unsupported UDP option " << option << std::endl;
+		}
+		co_return;
 	}
 
 	static async::result<frg::expected<protocols::fs::Error, size_t>> sendmsg(void *obj,
@@ -275,16 +349,6 @@ struct Udp4Socket {
 			co_return protocols::fs::Error::accessDenied;
 		}
 
-		std::vector<char> buf;
-		buf.resize(sizeof(Udp::Header) + len);
-		Udp::Header header {
-			.src = source.port,
-			.dst = target.port,
-			.len = static_cast<uint16_t>(len + sizeof(Udp::Header)),
-			.chk = 0,
-		};
-		header.ensureEndian();
-
 		// native endian target IP
 		auto targetIpNe = target.addr;
 		source.ensureEndian();
@@ -295,47 +359,92 @@ struct Udp4Socket {
 			co_return protocols::fs::Error::netUnreachable;
 		}
 
+		// With UDP_SEGMENT, a single request carries a train of datagrams.
+		size_t segment_size = len;
+		if (self->segmentSize_ && len > static_cast<size_t>(self->segmentSize_)) {
+			segment_size = self->segmentSize_;
+			if ((len + segment_size - 1) / segment_size > maxSegments)
+				co_return protocols::fs::Error::illegalArguments;
+		}
+
+		size_t progress = 0;
+		do {
+			auto chunk = std::min(len - progress, segment_size);
+			auto error = co_await sendDatagram_(*ti, source, target,
+					static_cast<char *>(data) + progress, chunk);
+			if (error != protocols::fs::Error::none)
+				co_return error;
+			progress += chunk;
+		} while (progress < len);
+		co_return len;
+	}
+
+	// source and target are in network byte order.
+	static async::result<protocols::fs::Error> sendDatagram_(Ip4TargetInfo ti,
+			Endpoint source, Endpoint target, const void *data, size_t len) {
+		using arch::convert_endian;
+		using arch::endian;
+
+		Udp::Header header {
+			.src = source.port,
+			.dst = target.port,
+			.len = static_cast<uint16_t>(len + sizeof(Udp::Header)),
+			.chk = 0,
+		};
+		// Only the length is still in native byte order.
+		header.len = convert_endian<endian::big>(header.len);
+
 		Checksum chk;
 		PseudoHeader psh {
-			.src = convert_endian<endian::big>(ti->source),
+			.src = convert_endian<endian::big>(ti.source),
 			.dst = target.addr,
 			.len = header.len
 		};
 		chk.update(&psh, sizeof(psh));
-		chk.update(&header, sizeof(header));
-		chk.update(data, len);
-		header.chk = convert_endian<endian::big>(chk.finalize());
 
-		std::cout << "netserver:" << std::endl << std::hex
-			<< std::setw(8) << psh.src << std::endl
-			<< std::setw(8) << psh.dst << std::endl
-			<< std::setw(8) << psh.len << std::endl
+		// With checksum offload, the link sums up the header and data;
+		// it expects the pseudo header sum in the checksum field.
+		nic::TxOffload offload;
+		if (ti.link->features & nic::features::txChecksum) {
+			offload.needsChecksum = true;
+			offload.csumOffset = offsetof(Udp::Header, chk);
+			header.chk = convert_endian<endian::big>(
+				static_cast<uint16_t>(~chk.finalize()));
+		} else {
+			chk.update(&header, sizeof(header));
+			chk.update(data, len);
+			header.chk = convert_endian<endian::big>(chk.finalize());
+		}
+
+		if (logDatagrams)
+			std::cout << "netserver:" << std::endl << std::hex
+				<< std::setw(8) << psh.src << std::endl
+				<< std::setw(8) << psh.dst << std::endl
+				<< std::setw(8) << psh.len << std::endl
 
-			<< std::setw(8) << header.src << std::endl
-			<< std::setw(8) << header.dst << std::endl
-			<< std::setw(8) << header.len << std::endl
-			<< std::setw(8) << header.chk << std::endl << std::dec;
+				<< std::setw(8) << header.src << std::endl
+				<< std::setw(8) << header.dst << std::endl
+				<< std::setw(8) << header.len << std::endl
+				<< std::setw(8) << header.chk << std::endl << std::dec;
 
-		if (header.chk == 0) {
+		if (!offload.needsChecksum && header.chk == 0) {
 			header.chk = ~header.chk;
 		}
 
-		std::memcpy(buf.data(), &header, sizeof(header));
-		std::memcpy(buf.data() + sizeof(header), data, len);
-
-		auto error = co_await ip4().sendFrame(std::move(*ti),
-			buf.data(), buf.size(),
-			static_cast<uint16_t>(IpProto::udp));
-		if (error != protocols::fs::Error::none) {
-			co_return error;
-		}
-		co_return len;
+		co_return co_await ip4().sendFrameInPlace(std::move(ti),
+			sizeof(header) + len, static_cast<uint16_t>(IpProto::udp),
+			[&] (arch::dma_buffer_view payload) {
+				std::memcpy(payload.data(), &header, sizeof(header));
+				std::memcpy(payload.subview(sizeof(header)).data(), data, len);
+			}, offload);
 	}
 
 
 	constexpr static FileOperations ops {
 		.bind = &bind,
 		.connect = &connect,
+		.getOption = &getOption,
+		.setOption = &setOption,
 		.recvMsg = &recvmsg,
 		.sendMsg = &sendmsg,
 	};
@@ -351,11 +460,6 @@ struct Udp4Socket {
 		auto number = dist(rng);
 		auto range_size = dist.b() - dist.a();
 		auto shared_from_this = holder_.lock();
-		// TODO(arsen): optimize to not call lower_bound every time?
-		// I believe that such a thing is not needed right now: nearly
-		// (read: absolutely) every case is is an immediate miss: we are
-		// using next to nothing in this region, or any other region for
-		// that manner
 		for (int i = 0; i < range_size; i++) {
 			uint16_t port = dist.a() + ((number + i) % range_size);
 			if (parent_->tryBind(shared_from_this, { addr, port })) {
@@ -368,7 +472,11 @@ struct Udp4Socket {
 private:
 	friend struct Udp4;
 
-	async::queue<Udp, stl_allocator> queue_;
+	std::deque<Udp> queue_;
+	async::recurring_event queueBell_;
+	// UDP_SEGMENT and UDP_GRO.
+	int segmentSize_ = 0;
+	bool gro_ = false;
 	Endpoint remote_;
 	Endpoint local_;
 	Udp4 *parent_;
@@ -382,35 +490,50 @@ void Udp4::feedDatagram(smarter::shared_ptr<const Ip4Packet> packet) {
 		return;
 	}
 
-	std::cout << "received udp datagram to port " << udp.header.dst << std::endl;
+	if (logDatagrams)
+		std::cout << "received udp datagram to port " << udp.header.dst << std::endl;
 
-	auto i = binds.lower_bound({ 0, udp.header.dst });
-	for (; i != binds.end() && i->first.port == udp.header.dst; i++) {
-		auto ep = i->first;
+	auto it = binds.find(udp.header.dst);
+	if (it == binds.end())
+		return;
+	for (auto &socket : it->second) {
+		auto ep = socket->local_;
 		if (ep.addr == udp.packet->header.destination
 			|| ep.addr == INADDR_ANY) {
-			i->second->queue_.emplace(std::move(udp));
+			socket->queue_.push_back(std::move(udp));
+			socket->queueBell_.raise();
 			break;
 		}
 	}
 }
 
 bool Udp4::tryBind(smarter::shared_ptr<Udp4Socket> socket, Endpoint addr) {
-	auto i = binds.lower_bound(addr);
-	for (; i != binds.end() && i->first.port == addr.port; i++) {
-		auto ep = i->first;
+	auto &sockets = binds[addr.port];
+	for (auto &existing : sockets) {
+		auto ep = existing->local_;
 		if (ep.addr == INADDR_ANY || addr.addr == INADDR_ANY
 			|| ep.addr == addr.addr) {
 			return false;
 		}
 	}
 	socket->local_ = addr;
-	binds.emplace(addr, std::move(socket));
+	sockets.push_back(std::move(socket));
 	return true;
 }
 
 bool Udp4::unbind(Endpoint e) {
-	return binds.erase(e) != 0;
+	auto it = binds.find(e.port);
+	if (it == binds.end())
+		return false;
+	auto &sockets = it->second;
+	auto sit = std::find_if(sockets.begin(), sockets.end(),
+		[&] (const auto &s) { return s->local_.addr == e.addr; });
+	if (sit == sockets.end())
+		return false;
+	sockets.erase(sit);
+	if (sockets.empty())
+		binds.erase(it);
+	return true;
 }
 
 void Udp4::serveSocket(helix::UniqueLane lane) {
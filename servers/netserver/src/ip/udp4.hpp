@@ -2,7 +2,8 @@
 
 #include <helix/ipc.hpp>
 #include <smarter.hpp>
-#include <map>
+#include <unordered_map>
+#include <vector>
 
 class Ip4Packet;
 
@@ -23,5 +24,7 @@ struct Udp4 {
 	bool unbind(Endpoint remote);
 	void serveSocket(helix::UniqueLane lane);
 private:
-	std::map<Endpoint, smarter::shared_ptr<Udp4Socket>> binds;
+	// Bound sockets, indexed by port. Usually, each port has a single socket; there are
+	// multiple ones only if the sockets are bound to different addresses.
+	std::unordered_map<uint16_t, std::vector<smarter::shared_ptr<Udp4Socket>>> binds;
 };
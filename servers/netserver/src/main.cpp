@@ -3,9 +3,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <queue>
+#include <thread>
 #include <vector>
 
 #include <async/result.hpp>
@@ -20,35 +22,60 @@
 #include "fs.bragi.hpp"
 
 #include "ip/ip4.hpp"
+#include "shard.hpp"
 
 #include <netserver/nic.hpp>
+#include <nic/intel/intel.hpp>
 #include <nic/virtio/virtio.hpp>
 
+// Upper bound on the number of worker threads.
+constexpr unsigned int maxShards = 16;
+
 // Maps mbus IDs to device objects
 std::unordered_map<int64_t, std::shared_ptr<nic::Link>> baseDeviceMap;
 
-async::result<void> doBind(mbus::Entity base_entity, virtio_core::DiscoverMode discover_mode) {
-	protocols::hw::Device hwDevice(co_await base_entity.bind());
-	co_await hwDevice.enableBusmaster();
-	auto transport = co_await virtio_core::discover(std::move(hwDevice), discover_mode);
+std::shared_ptr<nic::Link> loopbackLink = std::make_shared<nic::LoopbackLink>();
 
-	auto device = nic::virtio::makeShared(std::move(transport));
+// The first device becomes the default route, see the configuration below.
+void addDevice(mbus::Entity base_entity, std::shared_ptr<nic::Link> device) {
 	if (baseDeviceMap.empty()) {
-		// default via 10.0.2.2 src 10.10.2.15
-		Ip4Router::Route wan { { 0, 0 }, device };
-		wan.gateway = 0x0a000202;
-		wan.source = 0x0a0a020f;
-		ip4Router().addRoute(std::move(wan));
-
-		// 10.0.2.0/24
-		ip4Router().addRoute({ { 0x0a000200, 24 }, device });
-		// inet 10.10.2.15/24
-		ip4().setLink({ 0x0a0a020f, 24 }, device);
+		// Each shard has its own copy of the configuration.
+		forEachShard([device] {
+			// default via 10.0.2.2 src 10.10.2.15
+			Ip4Router::Route wan { { 0, 0 }, device };
+			wan.gateway = 0x0a000202;
+			wan.source = 0x0a0a020f;
+			ip4Router().addRoute(std::move(wan));
+
+			// 10.0.2.0/24
+			ip4Router().addRoute({ { 0x0a000200, 24 }, device });
+			// inet 10.10.2.15/24
+			ip4().setLink({ 0x0a0a020f, 24 }, device);
+
+			// Traffic to our own address does not leave the host.
+			Ip4Router::Route self { { 0x0a0a020f, 32 }, loopbackLink };
+			self.source = 0x0a0a020f;
+			ip4Router().addRoute(std::move(self));
+		});
 	}
 	baseDeviceMap.insert({base_entity.getId(), device});
 	nic::runDevice(device);
 }
 
+async::result<void> doBind(mbus::Entity base_entity, virtio_core::DiscoverMode discover_mode) {
+	protocols::hw::Device hwDevice(co_await base_entity.bind());
+	co_await hwDevice.enableBusmaster();
+	auto transport = co_await virtio_core::discover(std::move(hwDevice), discover_mode);
+
+	addDevice(base_entity, nic::virtio::makeShared(std::move(transport), numShards()));
+}
+
+async::result<void> doBindIntel(mbus::Entity base_entity, uint16_t device_id) {
+	protocols::hw::Device hwDevice(co_await base_entity.bind());
+	auto device = co_await nic::intel::makeShared(std::move(hwDevice), device_id, numShards());
+	addDevice(base_entity, std::move(device));
+}
+
 async::result<protocols::svrctl::Error> bindDevice(int64_t base_id) {
 	std::cout << "netserver: Binding to device " << base_id << std::endl;
 	auto base_entity = co_await mbus::Instance::global().getEntity(base_id);
@@ -59,8 +86,19 @@ async::result<protocols::svrctl::Error> bindDevice(int64_t base_id) {
 
 	// Make sure that we only bind to supported devices.
 	auto properties = co_await base_entity.getProperties();
-	if(auto vendor_str = std::get_if<mbus::StringItem>(&properties["pci-vendor"]);
-			!vendor_str || vendor_str->value != "1af4")
+	auto vendor_str = std::get_if<mbus::StringItem>(&properties["pci-vendor"]);
+	if(vendor_str && vendor_str->value == "8086") {
+		auto device_str = std::get_if<mbus::StringItem>(&properties["pci-device"]);
+		if(!device_str)
+			co_return protocols::svrctl::Error::deviceNotSupported;
+		auto device_id = std::stoul(device_str->value, nullptr, 16);
+		if(!nic::intel::supportsDevice(device_id))
+			co_return protocols::svrctl::Error::deviceNotSupported;
+
+		co_await doBindIntel(base_entity, device_id);
+		co_return protocols::svrctl::Error::success;
+	}
+	if(!vendor_str || vendor_str->value != "1af4")
 		co_return protocols::svrctl::Error::deviceNotSupported;
 
 	virtio_core::DiscoverMode discover_mode;
@@ -79,6 +117,9 @@ async::result<protocols::svrctl::Error> bindDevice(int64_t base_id) {
 	co_return protocols::svrctl::Error::success;
 }
 
+// Shard that receives the next TCP socket.
+size_t nextTcpShard = 0;
+
 async::detached serve(helix::UniqueLane lane) {
 	while (true) {
 		auto [accept, recv_req] =
@@ -118,11 +159,21 @@ async::detached serve(helix::UniqueLane lane) {
 				continue;
 			}
 
-			auto err = ip4().serveSocket(std::move(local_lane),
-					req.type(), req.protocol(), req.flags());
-			if (err != managarm::fs::Errors::SUCCESS) {
-				co_await sendError(err);
-				continue;
+			if (req.type() == SOCK_STREAM) {
+				// TCP sockets are distributed over all shards. Raw and UDP sockets
+				// stay on the NIC shard, which processes all non-TCP packets.
+				auto &shard = getShard(nextTcpShard++ % numShards());
+				shard.post([lane = std::move(local_lane), type = req.type(),
+						proto = req.protocol(), flags = req.flags()] () mutable {
+					ip4().serveSocket(std::move(lane), type, proto, flags);
+				});
+			} else {
+				auto err = ip4().serveSocket(std::move(local_lane),
+						req.type(), req.protocol(), req.flags());
+				if (err != managarm::fs::Errors::SUCCESS) {
+					co_await sendError(err);
+					continue;
+				}
 			}
 
 			auto ser = resp.SerializeAsString();
@@ -178,6 +229,14 @@ int main() {
 
 //	HEL_CHECK(helSetPriority(kHelThisThread, 3));
 
+	initShards(std::clamp(std::thread::hardware_concurrency(), 1u, maxShards));
+	forEachShard([] {
+		// 127.0.0.0/8
+		ip4Router().addRoute({ { 0x7f000000, 8 }, loopbackLink });
+		// inet 127.0.0.1/8
+		ip4().setLink({ 0x7f000001, 8 }, loopbackLink);
+	});
+
 	async::detach(protocols::svrctl::serveControl(&controlOps));
 	advertise();
 	async::run_forever(helix::currentDispatcher);
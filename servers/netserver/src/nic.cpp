@@ -1,10 +1,16 @@
 #include <netserver/nic.hpp>
 
 #include <algorithm>
+#include <cassert>
+#include <cstdlib>
 #include <cstring>
+#include <vector>
 #include <arch/bit.hpp>
-#include "ip/ip4.hpp"
 #include "ip/arp.hpp"
+#include "ip/checksum.hpp"
+#include "ip/ip4.hpp"
+#include "ip/tcp4.hpp"
+#include "shard.hpp"
 
 namespace nic {
 uint8_t &MacAddress::operator[](size_t idx) {
@@ -32,12 +38,18 @@ arch::dma_pool *Link::dmaPool() {
 	return dmaPool_;
 }
 
+size_t Link::numQueues() {
+	return 1;
+}
+
 Link::AllocatedBuffer Link::allocateFrame(MacAddress to, EtherType type,
 		size_t payloadSize) {
 	// default implementation assume an Ethernet II frame
+	// The frame is allocated from the pool of the current shard, so that it can
+	// be freed without synchronizing with other shards.
 	using namespace arch;
 	Link::AllocatedBuffer buf {
-		dma_buffer { dmaPool(), 14 + payloadSize }, {}
+		dma_buffer { currentShard().dmaPool(), 14 + payloadSize }, {}
 	};
 
 	uint16_t et = static_cast<uint16_t>(type);
@@ -51,23 +63,117 @@ Link::AllocatedBuffer Link::allocateFrame(MacAddress to, EtherType type,
 	return buf;
 }
 
-async::detached runDevice(std::shared_ptr<nic::Link> dev) {
+void Link::setFrameDestination(arch::dma_buffer_view frame, MacAddress to) {
+	std::memcpy(frame.data(), to.data(), sizeof(MacAddress));
+}
+
+async::result<void> Link::sendOffloaded(const arch::dma_buffer_view frame,
+		TxOffload offload, size_t queue) {
+	assert(!offload.gsoSize && "link does not support segmentation offload");
+	if (offload.needsChecksum) {
+		Checksum csum;
+		csum.update(frame.subview(offload.csumStart));
+		auto sum = arch::convert_endian<arch::endian::big>(csum.finalize());
+		std::memcpy(frame.subview(offload.csumStart + offload.csumOffset).data(),
+			&sum, sizeof(sum));
+	}
+	co_await send(frame, queue);
+}
+
+LoopbackLink::LoopbackLink()
+: Link{0xFFFF, nullptr} {
+	features = nic::features::txChecksum | nic::features::rxChecksum
+		| nic::features::loopback;
+}
+
+async::result<RxInfo> LoopbackLink::receive(arch::dma_buffer_view, size_t) {
+	assert(!"loopback links are not driven by runDevice()");
+	abort();
+}
+
+async::result<void> LoopbackLink::send(const arch::dma_buffer_view, size_t) {
+	assert(!"Ip4 does not send frames over loopback links");
+	abort();
+}
+
+namespace {
+
+uint16_t load16(const uint8_t *p) {
+	return (p[0] << 8) | p[1];
+}
+
+uint32_t load32(const uint8_t *p) {
+	return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+// Determines the shard that processes an IPv4 packet. Only TCP is sharded;
+// everything else (and all fragments) is processed by the NIC shard.
+size_t steerIp4(arch::dma_buffer_view packet) {
+	auto p = reinterpret_cast<const uint8_t *>(packet.data());
+	if (packet.size() < sizeof(Ip4Packet::Header))
+		return nicShard;
+	size_t headerSize = (p[0] & 0x0F) * 4;
+	bool isFragment = load16(p + 6) & 0x3FFF; // MF flag or fragment offset.
+	if (p[9] != static_cast<uint8_t>(IpProto::tcp) || isFragment
+			|| packet.size() < headerSize + 4)
+		return nicShard;
+
+	auto l4 = p + headerSize;
+	return Tcp4::shardOf(TcpFlow{load32(p + 16), load32(p + 12),
+			load16(l4 + 2), load16(l4)});
+}
+
+// Hands a received frame over to another shard. The frame is copied since receive
+// buffers belong to the pool of the NIC shard.
+void deliverToShard(Shard &shard, EtherType type, MacAddress destination,
+		MacAddress source, arch::dma_buffer_view frame, RxInfo info) {
+	auto p = reinterpret_cast<const char *>(frame.data());
+	shard.post([type, destination, source, info,
+			copy = std::vector<char>(p, p + frame.size())] {
+		arch::dma_buffer owner{currentShard().dmaPool(), copy.size()};
+		std::memcpy(owner.data(), copy.data(), copy.size());
+		auto capsule = owner.subview(14);
+		if (type == ETHER_TYPE_IP4) {
+			ip4().feedPacket(destination, source, std::move(owner), capsule, info);
+		} else {
+			neigh4().feedArp(destination, capsule);
+		}
+	});
+}
+
+async::detached runQueue(std::shared_ptr<Link> dev, size_t queue) {
 	using namespace arch;
 	while(true) {
 		dma_buffer frameBuffer { dev->dmaPool(), 1514 };
-		co_await dev->receive(frameBuffer);
-		auto capsule = frameBuffer.subview(14);
-		auto data = reinterpret_cast<uint8_t*>(frameBuffer.data());
+		auto info = co_await dev->receive(frameBuffer, queue);
+		auto frame = frameBuffer.subview(0, std::min(info.length, frameBuffer.size()));
+		if (frame.size() < 14)
+			continue;
+		auto capsule = frame.subview(14);
+		auto data = reinterpret_cast<uint8_t*>(frame.data());
 		uint16_t ethertype = data[12] << 8 | data[13];
 		nic::MacAddress dstsrc[2];
 		std::memcpy(dstsrc, data, sizeof(dstsrc));
 
 		switch (ethertype) {
-		case ETHER_TYPE_IP4:
+		case ETHER_TYPE_IP4: {
+			auto target = steerIp4(capsule);
+			if (target != nicShard) {
+				deliverToShard(getShard(target), ETHER_TYPE_IP4,
+					dstsrc[0], dstsrc[1], frame, info);
+				break;
+			}
 			ip4().feedPacket(dstsrc[0], dstsrc[1],
-				std::move(frameBuffer), capsule);
+				std::move(frameBuffer), capsule, info);
 			break;
+		}
 		case ETHER_TYPE_ARP:
+			// Every shard keeps its own neighbour table.
+			for (size_t i = 0; i < numShards(); i++) {
+				if (i != nicShard)
+					deliverToShard(getShard(i), ETHER_TYPE_ARP,
+						dstsrc[0], dstsrc[1], frame, info);
+			}
 			neigh4().feedArp(dstsrc[0], capsule);
 			break;
 		default:
@@ -75,4 +181,69 @@ async::detached runDevice(std::shared_ptr<nic::Link> dev) {
 		}
 	}
 }
+
+async::result<void> sendOnNicShard(std::shared_ptr<Link> link,
+		arch::dma_buffer_view frame, TxOffload offload, size_t queue) {
+	if (offload.needsChecksum || offload.gsoSize) {
+		co_await link->sendOffloaded(frame, offload, queue);
+	} else {
+		co_await link->send(frame, queue);
+	}
+}
+
+} // anonymous namespace
+
+void loopback(arch::dma_buffer packet) {
+	RxInfo info{.checksumValid = true, .length = packet.size()};
+
+	// The receiving end of a flow is usually processed by another shard than the
+	// sending end, so we need to steer the packet like a received frame.
+	auto &shard = getShard(steerIp4(packet));
+	if (&shard != &currentShard()) {
+		auto p = reinterpret_cast<const char *>(packet.data());
+		shard.post([info, copy = std::vector<char>(p, p + packet.size())] {
+			arch::dma_buffer owner{currentShard().dmaPool(), copy.size()};
+			std::memcpy(owner.data(), copy.data(), copy.size());
+			auto view = owner.subview(0);
+			ip4().feedPacket({}, {}, std::move(owner), view, info);
+		});
+		return;
+	}
+
+	// Do not process the packet synchronously: the sender may still be in the middle
+	// of updating its socket state.
+	shard.post([info, packet = std::move(packet)] () mutable {
+		auto view = packet.subview(0);
+		ip4().feedPacket({}, {}, std::move(packet), view, info);
+	});
+}
+
+async::detached runDevice(std::shared_ptr<Link> dev) {
+	assert(currentShard().index() == nicShard);
+	for (size_t i = 0; i < dev->numQueues(); i++)
+		runQueue(dev, i);
+	co_return;
+}
+
+async::result<void> transmit(std::shared_ptr<Link> link, arch::dma_buffer frame,
+		TxOffload offload) {
+	// Each shard transmits on its own queue, such that the device (usually) steers
+	// replies back to the same queue.
+	auto &origin = currentShard();
+	auto queue = origin.index() % link->numQueues();
+	if (origin.index() == nicShard) {
+		co_await sendOnNicShard(std::move(link), frame, offload, queue);
+		co_return;
+	}
+
+	// We do not wait for the NIC shard; the frame is freed by its origin shard.
+	getShard(nicShard).post([link = std::move(link), frame = std::move(frame),
+			offload, queue, &origin] () mutable {
+		async::detach([] (std::shared_ptr<Link> link, arch::dma_buffer frame,
+				TxOffload offload, size_t queue, Shard *origin) -> async::result<void> {
+			co_await sendOnNicShard(std::move(link), frame, offload, queue);
+			origin->post([frame = std::move(frame)] { });
+		}(std::move(link), std::move(frame), offload, queue, &origin));
+	});
+}
 } // namespace nic
@@ -0,0 +1,104 @@
+#include "shard.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+std::vector<std::unique_ptr<Shard>> shards;
+
+thread_local Shard *thisShard = nullptr;
+
+} // anonymous namespace
+
+Shard::Shard(size_t index)
+: index_{index} {
+	auto [wakeLane, drainLane] = helix::createStream();
+	wakeLane_ = std::move(wakeLane);
+	drainLane_ = std::move(drainLane);
+}
+
+void Shard::launchThread() {
+	thread_ = std::thread{[this] {
+		attachToCurrentThread();
+		async::run_forever(helix::currentDispatcher);
+	}};
+}
+
+void Shard::attachToCurrentThread() {
+	assert(!thisShard);
+	thisShard = this;
+	drainTasks_();
+}
+
+void Shard::enqueue_(std::unique_ptr<Task> task) {
+	{
+		std::lock_guard lock{mutex_};
+		tasks_.push_back(std::move(task));
+	}
+
+	if(wakeupPending_.exchange(true, std::memory_order_acq_rel))
+		return;
+
+	// The message is sent from the caller's dispatcher. Since the wakeup lane is
+	// owned by the shard, it outlives the send operation.
+	async::detach([] (helix::BorrowedLane lane) -> async::result<void> {
+		char dummy = 0;
+		auto [send] = co_await helix_ng::exchangeMsgs(lane,
+			helix_ng::sendBuffer(&dummy, sizeof(dummy))
+		);
+		HEL_CHECK(send.error());
+	}(wakeLane_));
+}
+
+async::detached Shard::drainTasks_() {
+	while(true) {
+		auto [recv] = co_await helix_ng::exchangeMsgs(drainLane_,
+			helix_ng::recvInline()
+		);
+		HEL_CHECK(recv.error());
+
+		// Clear the flag before draining so that tasks posted from now on send a wakeup.
+		wakeupPending_.store(false, std::memory_order_release);
+
+		while(true) {
+			std::unique_ptr<Task> task;
+			{
+				std::lock_guard lock{mutex_};
+				if(tasks_.empty())
+					break;
+				task = std::move(tasks_.front());
+				tasks_.pop_front();
+			}
+			task->run();
+		}
+	}
+}
+
+void initShards(size_t count) {
+	assert(count >= 1 && shards.empty());
+	std::cout << "netserver: Using " << count << " shard(s)" << std::endl;
+
+	for(size_t i = 0; i < count; i++)
+		shards.push_back(std::make_unique<Shard>(i));
+
+	shards[nicShard]->attachToCurrentThread();
+	for(size_t i = 0; i < count; i++) {
+		if(i != nicShard)
+			shards[i]->launchThread();
+	}
+}
+
+size_t numShards() {
+	return shards.size();
+}
+
+Shard &getShard(size_t index) {
+	return *shards[index];
+}
+
+Shard &currentShard() {
+	assert(thisShard);
+	return *thisShard;
+}
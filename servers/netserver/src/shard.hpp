@@ -0,0 +1,100 @@
+#pragma once
+
+#include <arch/dma_pool.hpp>
+#include <async/result.hpp>
+#include <core/dma/slab-pool.hpp>
+#include <helix/ipc.hpp>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// The network stack is sharded across worker threads. Each shard runs its own event
+// loop and owns a full copy of the protocol state (see ip4(), ip4Router(), neigh4());
+// TCP connections are assigned to shards by their flow hash.
+// Shard 0 runs on the main thread; it is the NIC shard that drives all links.
+struct Shard {
+	Shard(size_t index);
+
+	Shard(const Shard &) = delete;
+
+	Shard &operator= (const Shard &) = delete;
+
+	size_t index() {
+		return index_;
+	}
+
+	// Pool for DMA buffers that are allocated on this shard. Frames are churned
+	// constantly; the slab pool serves them from per-size free lists.
+	arch::dma_pool *dmaPool() {
+		return &dmaPool_;
+	}
+
+	// Runs f on this shard. Can be called from any thread; tasks run in FIFO order.
+	template<typename F>
+	void post(F f) {
+		struct Impl final : Task {
+			Impl(F f)
+			: f{std::move(f)} { }
+
+			void run() override {
+				f();
+			}
+
+			F f;
+		};
+
+		enqueue_(std::make_unique<Impl>(std::move(f)));
+	}
+
+	// Starts the event loop of a worker shard on a new thread.
+	void launchThread();
+
+	// Starts processing tasks on the current thread (only used for shard 0).
+	void attachToCurrentThread();
+
+private:
+	struct Task {
+		virtual ~Task() = default;
+		virtual void run() = 0;
+	};
+
+	void enqueue_(std::unique_ptr<Task> task);
+
+	async::detached drainTasks_();
+
+	size_t index_;
+	dma_core::SlabPool dmaPool_;
+	std::thread thread_;
+
+	std::mutex mutex_;
+	std::deque<std::unique_ptr<Task>> tasks_;
+	// Set if a wakeup is already in flight; avoids one message per task.
+	std::atomic<bool> wakeupPending_ = false;
+
+	// Wakeups are messages over this stream; this works across threads since
+	// each thread submits to its own dispatcher.
+	helix::UniqueLane wakeLane_;
+	helix::UniqueLane drainLane_;
+};
+
+// Index of the shard that drives all links.
+inline constexpr size_t nicShard = 0;
+
+// Sets up the shards; must be called on the main thread before anything else.
+void initShards(size_t count);
+
+size_t numShards();
+
+Shard &getShard(size_t index);
+
+// Shard of the calling thread.
+Shard &currentShard();
+
+// Runs f on every shard (including the current one).
+template<typename F>
+void forEachShard(F f) {
+	for(size_t i = 0; i < numShards(); i++)
+		getShard(i).post(f);
+}
@@ -0,0 +1,261 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// fio-like jobs against a directory on the file system under test. Run the same
+// jobs on each file system (e.g., tmpfs, ext2 on virtio-blk, ext2 on nvme) and pass
+// a --label to tell the reports apart.
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+// If set, results are printed as one JSON object per line instead of human-readable text.
+bool machineReadable = false;
+std::string label = "fs";
+std::string directory;
+
+size_t fileSize = 64 << 20;
+int numMetadataFiles = 10'000;
+int numReaddirEntries = 100'000;
+
+void check(bool condition, const char *what) {
+	if(!condition) {
+		std::cerr << "fs-bench: " << what << " failed: " << strerror(errno) << std::endl;
+		abort();
+	}
+}
+
+std::string pathOf(const std::string &name) {
+	return directory + "/" + name;
+}
+
+void report(const std::string &job, double seconds, uint64_t ops, uint64_t bytes) {
+	if(machineReadable) {
+		std::cout << "{\"fs\": \"" << label << "\", \"job\": \"" << job << "\""
+				<< ", \"seconds\": " << seconds
+				<< ", \"ops_per_sec\": " << static_cast<uint64_t>(ops / seconds);
+		if(bytes)
+			std::cout << ", \"mib_per_sec\": " << bytes / seconds / (1 << 20);
+		std::cout << "}" << std::endl;
+	}else{
+		std::cout << "fs-bench: " << label << " " << job << ": "
+				<< static_cast<uint64_t>(ops / seconds) << " ops/s";
+		if(bytes)
+			std::cout << ", " << bytes / seconds / (1 << 20) << " MiB/s";
+		std::cout << std::endl;
+	}
+}
+
+double secondsSince(clock::time_point start) {
+	return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+// Creates the data file that the read jobs operate on.
+void prepareDataFile(const std::string &path) {
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	check(fd >= 0, "open()");
+	std::vector<char> buffer(1 << 20, 'x');
+	for(size_t offset = 0; offset < fileSize; offset += buffer.size()) {
+		auto written = write(fd, buffer.data(), std::min(buffer.size(), fileSize - offset));
+		check(written > 0, "write()");
+	}
+	check(!fsync(fd), "fsync()");
+	close(fd);
+}
+
+// Each of the queueDepth threads issues synchronous I/O; together they keep up to
+// queueDepth requests in flight.
+void doIoJob(bool isWrite, bool isRandom, size_t blockSize, int queueDepth) {
+	// Skip jobs that would not give each thread at least one block.
+	if(fileSize / blockSize < static_cast<size_t>(queueDepth))
+		return;
+
+	auto path = pathOf("fs-bench.data");
+	prepareDataFile(path);
+
+	int fd = open(path.c_str(), isWrite ? O_RDWR : O_RDONLY);
+	check(fd >= 0, "open()");
+
+	size_t numBlocks = fileSize / blockSize;
+	size_t blocksPerThread = numBlocks / queueDepth;
+
+	auto start = clock::now();
+	std::vector<std::thread> threads;
+	for(int t = 0; t < queueDepth; t++) {
+		threads.emplace_back([=] {
+			std::vector<char> buffer(blockSize, 'y');
+			std::mt19937 prng{static_cast<unsigned int>(t)};
+			for(size_t i = 0; i < blocksPerThread; i++) {
+				size_t block = isRandom ? prng() % numBlocks : t * blocksPerThread + i;
+				off_t offset = block * blockSize;
+				ssize_t n = isWrite ? pwrite(fd, buffer.data(), blockSize, offset)
+						: pread(fd, buffer.data(), blockSize, offset);
+				check(n == static_cast<ssize_t>(blockSize), isWrite ? "pwrite()" : "pread()");
+			}
+		});
+	}
+	for(auto &thread : threads)
+		thread.join();
+	if(isWrite)
+		check(!fsync(fd), "fsync()");
+	auto seconds = secondsSince(start);
+	close(fd);
+	check(!unlink(path.c_str()), "unlink()");
+
+	uint64_t ops = blocksPerThread * queueDepth;
+	std::string job = std::string{isRandom ? "rand" : "seq"} + (isWrite ? "-write" : "-read")
+			+ " bs=" + std::to_string(blockSize >> 10) + "k qd=" + std::to_string(queueDepth);
+	report(job, seconds, ops, ops * blockSize);
+}
+
+void doMetadataJob() {
+	auto dir = pathOf("fs-bench.meta");
+	check(!mkdir(dir.c_str(), 0755), "mkdir()");
+
+	auto timePhase = [&] (const char *phase, auto fn) {
+		auto start = clock::now();
+		for(int i = 0; i < numMetadataFiles; i++)
+			fn(dir + "/f" + std::to_string(i));
+		report(std::string{"metadata-"} + phase + " n=" + std::to_string(numMetadataFiles),
+				secondsSince(start), numMetadataFiles, 0);
+	};
+
+	timePhase("create", [] (const std::string &path) {
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+		check(fd >= 0, "open()");
+		close(fd);
+	});
+	timePhase("stat", [] (const std::string &path) {
+		struct stat st;
+		check(!stat(path.c_str(), &st), "stat()");
+	});
+	timePhase("unlink", [] (const std::string &path) {
+		check(!unlink(path.c_str()), "unlink()");
+	});
+
+	check(!rmdir(dir.c_str()), "rmdir()");
+}
+
+void doReaddirJob() {
+	auto dir = pathOf("fs-bench.readdir");
+	check(!mkdir(dir.c_str(), 0755), "mkdir()");
+	for(int i = 0; i < numReaddirEntries; i++) {
+		auto path = dir + "/e" + std::to_string(i);
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+		check(fd >= 0, "open()");
+		close(fd);
+	}
+
+	auto start = clock::now();
+	DIR *d = opendir(dir.c_str());
+	check(d, "opendir()");
+	uint64_t numEntries = 0;
+	while(readdir(d))
+		numEntries++;
+	closedir(d);
+	auto seconds = secondsSince(start);
+	// Includes . and .. (as long as the file system reports them).
+	check(numEntries >= static_cast<uint64_t>(numReaddirEntries), "readdir()");
+	report("readdir n=" + std::to_string(numReaddirEntries), seconds, numEntries, 0);
+
+	// Same as ls -l: stat every entry while iterating over the directory.
+	start = clock::now();
+	d = opendir(dir.c_str());
+	check(d, "opendir()");
+	numEntries = 0;
+	while(auto entry = readdir(d)) {
+		struct stat st;
+		check(!fstatat(dirfd(d), entry->d_name, &st, AT_SYMLINK_NOFOLLOW), "fstatat()");
+		numEntries++;
+	}
+	closedir(d);
+	seconds = secondsSince(start);
+	report("readdir-stat n=" + std::to_string(numReaddirEntries), seconds, numEntries, 0);
+
+	for(int i = 0; i < numReaddirEntries; i++)
+		check(!unlink((dir + "/e" + std::to_string(i)).c_str()), "unlink()");
+	check(!rmdir(dir.c_str()), "rmdir()");
+}
+
+// Touches one byte per page of a file mapping, i.e., measures page fault throughput
+// of file-backed memory.
+void doMmapJob() {
+	auto path = pathOf("fs-bench.mmap");
+	prepareDataFile(path);
+
+	int fd = open(path.c_str(), O_RDONLY);
+	check(fd >= 0, "open()");
+
+	auto start = clock::now();
+	auto window = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+	check(window != MAP_FAILED, "mmap()");
+	auto p = static_cast<volatile const char *>(window);
+	uint64_t sum = 0;
+	for(size_t offset = 0; offset < fileSize; offset += 0x1000)
+		sum += p[offset];
+	munmap(window, fileSize);
+	auto seconds = secondsSince(start);
+	check(sum == 'x' * (fileSize / 0x1000), "mmap() contents");
+
+	close(fd);
+	check(!unlink(path.c_str()), "unlink()");
+	report("mmap-scan", seconds, fileSize / 0x1000, fileSize);
+}
+
+void printUsage() {
+	std::cerr << "usage: fs-bench [--json] [--label NAME] [--file-size MIB]"
+			" [--files N] [--entries N] DIRECTORY" << std::endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--json")) {
+			machineReadable = true;
+		}else if(!strcmp(argv[i], "--label") && i + 1 < argc) {
+			label = argv[++i];
+		}else if(!strcmp(argv[i], "--file-size") && i + 1 < argc) {
+			fileSize = strtoull(argv[++i], nullptr, 10) << 20;
+		}else if(!strcmp(argv[i], "--files") && i + 1 < argc) {
+			numMetadataFiles = atoi(argv[++i]);
+		}else if(!strcmp(argv[i], "--entries") && i + 1 < argc) {
+			numReaddirEntries = atoi(argv[++i]);
+		}else if(argv[i][0] != '-' && directory.empty()) {
+			directory = argv[i];
+		}else{
+			printUsage();
+			return 1;
+		}
+	}
+	if(directory.empty() || !fileSize) {
+		printUsage();
+		return 1;
+	}
+
+	// Note that reads may be served from the page cache since the data file was just written.
+	for(size_t blockSize : {4 << 10, 64 << 10, 1 << 20}) {
+		for(int queueDepth : {1, 4, 16}) {
+			for(bool isWrite : {false, true}) {
+				for(bool isRandom : {false, true})
+					doIoJob(isWrite, isRandom, blockSize, queueDepth);
+			}
+		}
+	}
+	doMetadataJob();
+	doReaddirJob();
+	doMmapJob();
+}
@@ -1,4 +1,11 @@
 #include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <async/result.hpp>
 #include <async/algorithm.hpp>
@@ -6,9 +13,22 @@
 
 namespace {
 
+// If set, results are printed as one JSON object per line instead of human-readable text.
+bool machineReadable = false;
+
+void announceBenchmark(const std::string &name) {
+	if(!machineReadable)
+		std::cout << name << std::endl;
+}
+
 struct IterationsPerSecondBenchmark {
 	using clock = std::chrono::high_resolution_clock;
 
+	IterationsPerSecondBenchmark(std::string name)
+	: name_{std::move(name)} {
+		announceBenchmark(name_);
+	}
+
 	void launchRepetition() {
 		ref_ = clock::now();
 	}
@@ -20,7 +40,8 @@ struct IterationsPerSecondBenchmark {
 	}
 
 	void announceIterations(uint64_t iters) {
-		std::cout << "    " << iters << " iterations per second" << std::endl;
+		if(!machineReadable)
+			std::cout << "    " << iters << " iterations per second" << std::endl;
 		results_.push_back(iters);
 	}
 
@@ -35,19 +56,122 @@ struct IterationsPerSecondBenchmark {
 			var += (n - avg) * (n - avg);
 		var /= results_.size();
 
-		std::cout << "    avg: " << static_cast<uint64_t>(avg)
-				<< ", std: " << static_cast<uint64_t>(sqrt(var)) << std::endl;
+		if(machineReadable) {
+			std::cout << "{\"name\": \"" << name_ << "\", \"kind\": \"throughput\""
+					<< ", \"avg_per_sec\": " << static_cast<uint64_t>(avg)
+					<< ", \"std_per_sec\": " << static_cast<uint64_t>(sqrt(var))
+					<< "}" << std::endl;
+		}else{
+			std::cout << "    avg: " << static_cast<uint64_t>(avg)
+					<< ", std: " << static_cast<uint64_t>(sqrt(var)) << std::endl;
+		}
 	}
 
 private:
+	std::string name_;
 	std::vector<double> results_;
 	std::chrono::time_point<clock> ref_;
 };
 
-void doNopBenchmark() {
-	std::cout << "syscall ops" << std::endl;
+// Records the duration of individual operations and reports percentiles.
+struct LatencyBenchmark {
+	using clock = std::chrono::high_resolution_clock;
+
+	// Upper bound on the number of samples; also bounds the memory that we use.
+	static constexpr size_t maxSamples = 1 << 20;
+
+	LatencyBenchmark(std::string name)
+	: name_{std::move(name)} {
+		announceBenchmark(name_);
+		samples_.reserve(maxSamples);
+		start_ = clock::now();
+	}
+
+	bool isDone() {
+		auto elapsed = duration_cast<std::chrono::nanoseconds>(clock::now() - start_);
+		return elapsed.count() > 2'000'000'000 || samples_.size() == maxSamples;
+	}
+
+	void beginSample() {
+		ref_ = clock::now();
+	}
+
+	// If numOps > 1, the sample is taken as numOps operations of equal duration.
+	void endSample(uint64_t numOps = 1) {
+		auto elapsed = duration_cast<std::chrono::nanoseconds>(clock::now() - ref_);
+		addSample(elapsed.count() / numOps);
+	}
 
-	IterationsPerSecondBenchmark bench;
+	void addSample(uint64_t nanos) {
+		if(samples_.size() < maxSamples)
+			samples_.push_back(nanos);
+	}
+
+	void finalizeStatistics() {
+		if(samples_.empty()) {
+			if(!machineReadable)
+				std::cout << "    no samples" << std::endl;
+			return;
+		}
+		std::sort(samples_.begin(), samples_.end());
+
+		double avg = 0;
+		for(uint64_t n : samples_)
+			avg += n;
+		avg /= samples_.size();
+
+		auto percentile = [&] (double p) -> uint64_t {
+			auto k = static_cast<size_t>(p * samples_.size());
+			return samples_[std::min(k, samples_.size() - 1)];
+		};
+
+		if(machineReadable) {
+			std::cout << "{\"name\": \"" << name_ << "\", \"kind\": \"latency\""
+					<< ", \"samples\": " << samples_.size()
+					<< ", \"avg_ns\": " << static_cast<uint64_t>(avg)
+					<< ", \"p50_ns\": " << percentile(0.5)
+					<< ", \"p99_ns\": " << percentile(0.99)
+					<< ", \"p999_ns\": " << percentile(0.999)
+					<< ", \"max_ns\": " << samples_.back()
+					<< "}" << std::endl;
+		}else{
+			std::cout << "    " << samples_.size() << " samples"
+					<< ", avg: " << static_cast<uint64_t>(avg) << " ns"
+					<< ", p50: " << percentile(0.5) << " ns"
+					<< ", p99: " << percentile(0.99) << " ns"
+					<< ", p999: " << percentile(0.999) << " ns"
+					<< ", max: " << samples_.back() << " ns" << std::endl;
+		}
+	}
+
+private:
+	std::string name_;
+	std::vector<uint64_t> samples_;
+	std::chrono::time_point<clock> start_;
+	std::chrono::time_point<clock> ref_;
+};
+
+std::string formatSize(size_t size) {
+	if(size < 1024) {
+		return std::to_string(size) + " B";
+	}else if(size < 1024 * 1024) {
+		return std::to_string(size / 1024) + " KiB";
+	}else{
+		return std::to_string(size / (1024 * 1024)) + " MiB";
+	}
+}
+
+// Returns false if the CPU does not exist.
+bool pinToCpu(int cpu) {
+	uint8_t mask[8]{};
+	if(cpu >= 64)
+		return false;
+	mask[cpu / 8] = 1 << (cpu % 8);
+	return helSetAffinity(kHelThisThread, mask, sizeof(mask)) == kHelErrNone;
+}
+
+void doNopBenchmark() {
+	IterationsPerSecondBenchmark bench{"syscall ops"};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
@@ -63,9 +187,7 @@ void doNopBenchmark() {
 }
 
 async::result<void> doAsyncNopBenchmark() {
-	std::cout << "ipc ops" << std::endl;
-
-	IterationsPerSecondBenchmark bench;
+	IterationsPerSecondBenchmark bench{"ipc ops"};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
@@ -81,10 +203,35 @@ async::result<void> doAsyncNopBenchmark() {
 	bench.finalizeStatistics();
 }
 
-void doFutexBenchmark() {
-	std::cout << "futex waits" << std::endl;
+// Keeps 8 operations in flight such that the kernel can coalesce their completions.
+async::result<void> doBatchedAsyncNopBenchmark() {
+	IterationsPerSecondBenchmark bench{"batched ipc ops (8 in flight)"};
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			for(int i = 0; i < 100; ++i) {
+				auto check = [] (auto result) { HEL_CHECK(result.error()); };
+				co_await async::when_all(
+					async::transform(helix_ng::asyncNop(), check),
+					async::transform(helix_ng::asyncNop(), check),
+					async::transform(helix_ng::asyncNop(), check),
+					async::transform(helix_ng::asyncNop(), check),
+					async::transform(helix_ng::asyncNop(), check),
+					async::transform(helix_ng::asyncNop(), check),
+					async::transform(helix_ng::asyncNop(), check),
+					async::transform(helix_ng::asyncNop(), check)
+				);
+				n += 8;
+			}
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+}
 
-	IterationsPerSecondBenchmark bench;
+void doFutexBenchmark() {
+	IterationsPerSecondBenchmark bench{"futex waits"};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
@@ -100,10 +247,43 @@ void doFutexBenchmark() {
 	bench.finalizeStatistics();
 }
 
-void doAllocateBenchmark(size_t size) {
-	std::cout << "allocate memory, size = " << (size / (1024 * 1024)) << " MiB" << std::endl;
+void doGetClockBenchmark() {
+	IterationsPerSecondBenchmark bench{"clock reads"};
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			for(int i = 0; i < 100; ++i) {
+				uint64_t counter;
+				HEL_CHECK(helGetClock(&counter));
+				++n;
+			}
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+}
 
-	IterationsPerSecondBenchmark bench;
+// Wakes a futex without waiters, i.e., measures the cost of the syscall itself.
+void doFutexWakeBenchmark() {
+	IterationsPerSecondBenchmark bench{"futex wakes"};
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			for(int i = 0; i < 100; ++i) {
+				int futex = 0;
+				HEL_CHECK(helFutexWake(&futex));
+				++n;
+			}
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+}
+
+void doAllocateBenchmark(size_t size) {
+	IterationsPerSecondBenchmark bench{"allocate memory, size = " + formatSize(size)};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
@@ -119,9 +299,7 @@ void doAllocateBenchmark(size_t size) {
 }
 
 void doMapBenchmark(size_t size) {
-	std::cout << "memory mapping, size = " << (size / (1024 * 1024)) << " MiB" << std::endl;
-
-	IterationsPerSecondBenchmark bench;
+	IterationsPerSecondBenchmark bench{"memory mapping, size = " + formatSize(size)};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
@@ -141,8 +319,6 @@ void doMapBenchmark(size_t size) {
 }
 
 void doMapPopulatedBenchmark(size_t size) {
-	std::cout << "populated mapping, size = " << (size / (1024 * 1024)) << " MiB" << std::endl;
-
 	HelHandle handle;
 	HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
 	void *window;
@@ -156,7 +332,7 @@ void doMapPopulatedBenchmark(size_t size) {
 
 	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
 
-	IterationsPerSecondBenchmark bench;
+	IterationsPerSecondBenchmark bench{"populated mapping, size = " + formatSize(size)};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
@@ -175,91 +351,464 @@ void doMapPopulatedBenchmark(size_t size) {
 }
 
 void doPageFaultBenchmark(size_t size) {
-	std::cout << "page faults (mapping size = " << (size / (1024 * 1024)) << " MiB)" << std::endl;
+	LatencyBenchmark bench{"page faults, mapping size = " + formatSize(size)};
+	while(!bench.isDone()) {
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
+		void *window;
+		HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, size,
+				kHelMapProtRead | kHelMapProtWrite, &window));
+
+		// Touch all mapped pages.
+		auto p = reinterpret_cast<volatile std::byte *>(window);
+		for(size_t progress = 0; progress < size; progress += 0x1000) {
+			bench.beginSample();
+			p[progress] = static_cast<std::byte>(0);
+			bench.endSample();
+		}
 
-	IterationsPerSecondBenchmark bench;
-	for(int k = 0; k < 5; ++k) {
-		uint64_t n = 0;
-		bench.launchRepetition();
-		while(!bench.isRepetitionDone()) {
-			HelHandle handle;
-			HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
-			void *window;
-			HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, size,
-					kHelMapProtRead | kHelMapProtWrite, &window));
+		HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
+		HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+	}
+	bench.finalizeStatistics();
+}
 
-			// Touch all mapped pages.
-			auto p = reinterpret_cast<volatile std::byte *>(window);
-			for(size_t progress = 0; progress < size; progress += 0x1000) {
-				p[progress] = static_cast<std::byte>(0);
-				++n;
-			}
+// Handles initialization requests until all size bytes of the managed memory were requested.
+async::result<void> serveManagedMemory(helix::UniqueDescriptor backing, size_t size) {
+	size_t progress = 0;
+	while(progress < size) {
+		helix::ManageMemory manage;
+		auto &&submit = helix::submitManageMemory(backing, &manage,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(manage.error());
+		assert(manage.type() == kHelManageInitialize);
+
+		HEL_CHECK(helUpdateMemory(backing.getHandle(), kHelManageInitialize,
+				manage.offset(), manage.length()));
+		progress += manage.length();
+	}
+}
 
-			HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
-			HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+void doManagedPageFaultBenchmark(size_t size) {
+	LatencyBenchmark bench{"managed page faults, mapping size = " + formatSize(size)};
+	while(!bench.isDone()) {
+		HelHandle backing, frontal;
+		HEL_CHECK(helCreateManagedMemory(size, 0, &backing, &frontal));
+
+		// Faults block the faulting thread, hence we need another thread to serve them.
+		std::thread manager{[&] {
+			async::run(serveManagedMemory(helix::UniqueDescriptor{backing}, size),
+					helix::currentDispatcher);
+		}};
+
+		void *window;
+		HEL_CHECK(helMapMemory(frontal, kHelNullHandle, nullptr, 0, size,
+				kHelMapProtRead | kHelMapProtWrite, &window));
+
+		// Touch all mapped pages.
+		auto p = reinterpret_cast<volatile std::byte *>(window);
+		for(size_t progress = 0; progress < size; progress += 0x1000) {
+			bench.beginSample();
+			p[progress] = static_cast<std::byte>(0);
+			bench.endSample();
 		}
-		bench.announceIterations(n);
+
+		HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
+		HEL_CHECK(helCloseDescriptor(kHelThisUniverse, frontal));
+		manager.join();
 	}
 	bench.finalizeStatistics();
 }
 
-async::result<void> doSendRecvBufferBenchmark(size_t size) {
+async::result<void> runSendRecvBuffer(std::string name, void *sBuf, void *rBuf,
+		size_t size, bool direct) {
 	auto [lane1, lane2] = helix::createStream();
+
+	LatencyBenchmark bench{std::move(name)};
+	while(!bench.isDone()) {
+		bench.beginSample();
+		co_await async::when_all(
+			async::transform(
+				helix_ng::exchangeMsgs(lane1, direct
+						? helix_ng::sendBufferDirect(sBuf, size)
+						: helix_ng::sendBuffer(sBuf, size)
+			), [&] (auto result) {
+				auto [send] = std::move(result);
+				HEL_CHECK(send.error());
+			}),
+			async::transform(
+				helix_ng::exchangeMsgs(lane2, helix_ng::recvBuffer(rBuf, size)
+			), [&] (auto result) {
+				auto [recv] = std::move(result);
+				HEL_CHECK(recv.error());
+				assert(recv.actualLength() == size);
+			})
+		);
+		bench.endSample();
+	}
+	bench.finalizeStatistics();
+}
+
+async::result<void> doSendRecvBufferBenchmark(size_t size, bool direct) {
 	std::vector<std::byte> sBuf(size);
 	std::vector<std::byte> rBuf(size);
 
-	if(size < 1024) {
-		std::cout << "size = " << size << std::endl;
-	}else if(size < 1024 * 1024) {
-		std::cout << "size = " << (size / 1024) << " KiB" << std::endl;
-	}else{
-		std::cout << "size = " << (size / (1024 * 1024)) << " MiB" << std::endl;
+	co_await runSendRecvBuffer(std::string{direct ? "direct send/recv buffer" : "send/recv buffer"}
+			+ ", size = " + formatSize(size), sBuf.data(), rBuf.data(), size, direct);
+}
+
+// Like the direct send/recv buffer benchmark, but both buffers are physically contiguous.
+// This measures the kernel's copy routine without the per-page overhead.
+async::result<void> doContiguousSendRecvBufferBenchmark(size_t size) {
+	void *windows[2];
+	for(auto &window : windows) {
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(size, kHelAllocContinuous, nullptr, &handle));
+		HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, size,
+				kHelMapProtRead | kHelMapProtWrite, &window));
+		HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+		memset(window, 0, size);
 	}
 
-	IterationsPerSecondBenchmark bench;
-	for(int k = 0; k < 5; ++k) {
-		uint64_t n = 0;
-		bench.launchRepetition();
-		while(!bench.isRepetitionDone()) {
-			for(int i = 0; i < 100; ++i) {
-				co_await async::when_all(
-					async::transform(
-						helix_ng::exchangeMsgs(lane1, helix_ng::sendBuffer(sBuf.data(), size)
-					), [&] (auto result) {
-						auto [send] = std::move(result);
-						HEL_CHECK(send.error());
-					}),
-					async::transform(
-						helix_ng::exchangeMsgs(lane2, helix_ng::recvBuffer(rBuf.data(), size)
-					), [&] (auto result) {
-						auto [recv] = std::move(result);
-						HEL_CHECK(recv.error());
-						assert(recv.actualLength() == size);
-					})
+	co_await runSendRecvBuffer("contiguous send/recv buffer, size = " + formatSize(size),
+			windows[0], windows[1], size, true);
+
+	for(auto window : windows)
+		HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
+}
+
+async::result<void> doOfferAcceptBenchmark() {
+	auto [lane1, lane2] = helix::createStream();
+
+	LatencyBenchmark bench{"offer/accept"};
+	while(!bench.isDone()) {
+		bench.beginSample();
+		co_await async::when_all(
+			async::transform(
+				helix_ng::exchangeMsgs(lane1, helix_ng::offer()
+			), [&] (auto result) {
+				auto [offer] = std::move(result);
+				HEL_CHECK(offer.error());
+			}),
+			async::transform(
+				helix_ng::exchangeMsgs(lane2, helix_ng::accept()
+			), [&] (auto result) {
+				auto [accept] = std::move(result);
+				HEL_CHECK(accept.error());
+			})
+		);
+		bench.endSample();
+	}
+	bench.finalizeStatistics();
+}
+
+async::result<void> doPushPullDescriptorBenchmark() {
+	auto [lane1, lane2] = helix::createStream();
+
+	HelHandle memoryHandle;
+	HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &memoryHandle));
+	helix::UniqueDescriptor memory{memoryHandle};
+
+	LatencyBenchmark bench{"push/pull descriptor"};
+	while(!bench.isDone()) {
+		bench.beginSample();
+		co_await async::when_all(
+			async::transform(
+				helix_ng::exchangeMsgs(lane1, helix_ng::pushDescriptor(memory)
+			), [&] (auto result) {
+				auto [push] = std::move(result);
+				HEL_CHECK(push.error());
+			}),
+			async::transform(
+				helix_ng::exchangeMsgs(lane2, helix_ng::pullDescriptor()
+			), [&] (auto result) {
+				auto [pull] = std::move(result);
+				HEL_CHECK(pull.error());
+			})
+		);
+		bench.endSample();
+	}
+	bench.finalizeStatistics();
+}
+
+uint64_t nanosSinceEpoch() {
+	return duration_cast<std::chrono::nanoseconds>(
+			std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+}
+
+// Blocks until the futex word is at least value or negative; returns the word.
+int waitForFutex(int *word, int value) {
+	while(true) {
+		auto current = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+		if(current < 0 || current >= value)
+			return current;
+		HEL_CHECK(helFutexWait(word, current, -1));
+	}
+}
+
+void setFutex(int *word, int value) {
+	__atomic_store_n(word, value, __ATOMIC_RELEASE);
+	HEL_CHECK(helFutexWake(word));
+}
+
+// Runs the peer thread of the cross-CPU benchmarks on the given CPU (CPU 1 by default).
+// Returns false if the peer thread could not be pinned.
+// status is used to report back from the peer and must outlive the peer thread.
+template<typename F>
+bool runOnPeerCpu(std::thread &peer, int &status, F fn, int cpu = 1) {
+	peer = std::thread{[&status, fn, cpu] {
+		if(!pinToCpu(cpu)) {
+			setFutex(&status, -1);
+			return;
+		}
+		setFutex(&status, 1);
+		fn();
+	}};
+	if(waitForFutex(&status, 1) < 0) {
+		peer.join();
+		return false;
+	}
+	return true;
+}
+
+void doFutexPingPongBenchmark() {
+	LatencyBenchmark bench{"futex ping-pong, cross-CPU round trip"};
+
+	int word = 0;
+	int status = 0;
+	std::thread peer;
+	auto pong = [&word] {
+		for(int seq = 1; ; seq += 2) {
+			if(waitForFutex(&word, seq) < 0)
+				return;
+			setFutex(&word, seq + 1);
+		}
+	};
+	if(!pinToCpu(0) || !runOnPeerCpu(peer, status, pong)) {
+		if(!machineReadable)
+			std::cout << "    skipped, needs two CPUs" << std::endl;
+		return;
+	}
+
+	// Odd values are the peer's turn, even values are ours.
+	for(int seq = 1; !bench.isDone(); seq += 2) {
+		bench.beginSample();
+		setFutex(&word, seq);
+		waitForFutex(&word, seq + 1);
+		bench.endSample();
+	}
+
+	setFutex(&word, -1);
+	peer.join();
+	bench.finalizeStatistics();
+}
+
+void doWakeupLatencyBenchmark() {
+	LatencyBenchmark bench{"cross-CPU thread wakeup"};
+
+	int word = 0;
+	int ack = 0;
+	uint64_t wakeTime = 0;
+	int status = 0;
+	std::thread peer;
+	auto sleeper = [&] {
+		for(int seq = 1; ; ++seq) {
+			if(waitForFutex(&word, seq) < 0)
+				return;
+			bench.addSample(nanosSinceEpoch() - __atomic_load_n(&wakeTime, __ATOMIC_ACQUIRE));
+			setFutex(&ack, seq);
+		}
+	};
+	if(!pinToCpu(0) || !runOnPeerCpu(peer, status, sleeper)) {
+		if(!machineReadable)
+			std::cout << "    skipped, needs two CPUs" << std::endl;
+		return;
+	}
+
+	for(int seq = 1; !bench.isDone(); ++seq) {
+		// Give the peer time to block in helFutexWait().
+		auto ref = nanosSinceEpoch();
+		while(nanosSinceEpoch() - ref < 100'000)
+			;
+
+		__atomic_store_n(&wakeTime, nanosSinceEpoch(), __ATOMIC_RELEASE);
+		setFutex(&word, seq);
+		waitForFutex(&ack, seq);
+	}
+
+	setFutex(&word, -1);
+	peer.join();
+	bench.finalizeStatistics();
+}
+
+// Synchronous request/reply round trip to a server thread on the same CPU.
+// Both threads block while they wait for each other, as in a POSIX syscall;
+// this measures the kernel's wakeup path including the switch to the woken thread.
+void doIpcRoundTripBenchmark() {
+	LatencyBenchmark bench{"IPC round trip, same CPU"};
+
+	auto [clientLane, serverLane] = helix::createStream();
+	int status = 0;
+	std::thread peer;
+	auto serve = [&serverLane] {
+		async::run([] (helix::UniqueLane &lane) -> async::result<void> {
+			while(true) {
+				char buffer[16];
+				auto [accept, recv] = co_await helix_ng::exchangeMsgs(lane,
+					helix_ng::accept(
+						helix_ng::recvBuffer(buffer, sizeof(buffer))
+					)
 				);
-				++n;
+				if(accept.error() == kHelErrEndOfLane)
+					co_return;
+				HEL_CHECK(accept.error());
+				HEL_CHECK(recv.error());
+
+				auto conversation = accept.descriptor();
+				auto [send] = co_await helix_ng::exchangeMsgs(conversation,
+						helix_ng::sendBuffer(buffer, recv.actualLength()));
+				HEL_CHECK(send.error());
 			}
+		}(serverLane), helix::currentDispatcher);
+	};
+	if(!pinToCpu(0) || !runOnPeerCpu(peer, status, serve, 0)) {
+		if(!machineReadable)
+			std::cout << "    skipped, could not pin threads" << std::endl;
+		return;
+	}
+
+	async::run([&] () -> async::result<void> {
+		char request[8]{};
+		char reply[8];
+		while(!bench.isDone()) {
+			bench.beginSample();
+			auto [offer, send, recv] = co_await helix_ng::exchangeMsgs(clientLane,
+				helix_ng::offer(
+					helix_ng::sendBuffer(request, sizeof(request)),
+					helix_ng::recvBuffer(reply, sizeof(reply))
+				)
+			);
+			HEL_CHECK(offer.error());
+			HEL_CHECK(send.error());
+			HEL_CHECK(recv.error());
+			bench.endSample();
 		}
-		bench.announceIterations(n);
+	}(), helix::currentDispatcher);
+
+	// Closing our end of the stream stops the server.
+	clientLane = helix::UniqueLane{};
+	peer.join();
+	bench.finalizeStatistics();
+}
+
+void doSameCpuFutexPingPongBenchmark() {
+	LatencyBenchmark bench{"futex ping-pong, same-CPU round trip"};
+
+	int word = 0;
+	int status = 0;
+	std::thread peer;
+	auto pong = [&word] {
+		for(int seq = 1; ; seq += 2) {
+			if(waitForFutex(&word, seq) < 0)
+				return;
+			setFutex(&word, seq + 1);
+		}
+	};
+	if(!pinToCpu(0) || !runOnPeerCpu(peer, status, pong, 0)) {
+		if(!machineReadable)
+			std::cout << "    skipped, could not pin threads" << std::endl;
+		return;
 	}
+
+	for(int seq = 1; !bench.isDone(); seq += 2) {
+		bench.beginSample();
+		setFutex(&word, seq);
+		waitForFutex(&word, seq + 1);
+		bench.endSample();
+	}
+
+	setFutex(&word, -1);
+	peer.join();
+	bench.finalizeStatistics();
+}
+
+// Measures how late a thread wakes up from a timed wait while another thread
+// keeps the same CPU busy (similar to cyclictest).
+void doTimerLatencyBenchmark(bool realtime) {
+	LatencyBenchmark bench{realtime
+			? "timer wakeup latency, real-time thread vs. CPU hog"
+			: "timer wakeup latency, fair thread vs. CPU hog"};
+
+	int stop = 0;
+	int status = 0;
+	std::thread hog;
+	auto spin = [&stop] {
+		while(!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+			;
+	};
+	if(!pinToCpu(0) || !runOnPeerCpu(hog, status, spin, 0)) {
+		if(!machineReadable)
+			std::cout << "    skipped, could not pin threads" << std::endl;
+		return;
+	}
+	if(realtime)
+		HEL_CHECK(helSetSchedulingPolicy(kHelThisThread, kHelSchedFifo, 1));
+
+	int word = 0;
+	while(!bench.isDone()) {
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		auto deadline = now + 1'000'000;
+		HEL_CHECK(helFutexWait(&word, 0, deadline));
+		HEL_CHECK(helGetClock(&now));
+		bench.addSample(now - deadline);
+	}
+
+	if(realtime)
+		HEL_CHECK(helSetSchedulingPolicy(kHelThisThread, kHelSchedFair, 0));
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	hog.join();
 	bench.finalizeStatistics();
 }
 
 } // anonymous namespace
 
-int main() {
+int main(int argc, char **argv) {
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--json")) {
+			machineReadable = true;
+		}else{
+			std::cerr << "usage: kernel-bench [--json]" << std::endl;
+			return 1;
+		}
+	}
+
 	doNopBenchmark();
+	doGetClockBenchmark();
 	doFutexBenchmark();
+	doFutexWakeBenchmark();
 	async::run(doAsyncNopBenchmark(), helix::currentDispatcher);
+	async::run(doBatchedAsyncNopBenchmark(), helix::currentDispatcher);
 	doAllocateBenchmark(1 << 20);
 	doMapBenchmark(1 << 20);
 	doMapPopulatedBenchmark(1 << 20);
 	doPageFaultBenchmark(1 << 20);
-	async::run(doSendRecvBufferBenchmark(1), helix::currentDispatcher);
-	async::run(doSendRecvBufferBenchmark(32), helix::currentDispatcher);
-	async::run(doSendRecvBufferBenchmark(128), helix::currentDispatcher);
-	async::run(doSendRecvBufferBenchmark(4096), helix::currentDispatcher);
-	async::run(doSendRecvBufferBenchmark(16 * 1024), helix::currentDispatcher);
-	async::run(doSendRecvBufferBenchmark(64 * 1024), helix::currentDispatcher);
-	async::run(doSendRecvBufferBenchmark(1024 * 1024), helix::currentDispatcher);
+	doManagedPageFaultBenchmark(1 << 20);
+	async::run(doOfferAcceptBenchmark(), helix::currentDispatcher);
+	async::run(doPushPullDescriptorBenchmark(), helix::currentDispatcher);
+	for(size_t size = 64; size <= 1024 * 1024; size *= 4)
+		async::run(doSendRecvBufferBenchmark(size, false), helix::currentDispatcher);
+	for(size_t size = 16 * 1024; size <= 1024 * 1024; size *= 4)
+		async::run(doSendRecvBufferBenchmark(size, true), helix::currentDispatcher);
+	for(size_t size = 4 * 1024; size <= 1024 * 1024; size *= 4)
+		async::run(doContiguousSendRecvBufferBenchmark(size), helix::currentDispatcher);
+
+	// These pin the main thread to CPU 0; hence, they run last.
+	doIpcRoundTripBenchmark();
+	doSameCpuFutexPingPongBenchmark();
+	doFutexPingPongBenchmark();
+	doWakeupLatencyBenchmark();
+	doTimerLatencyBenchmark(false);
+	doTimerLatencyBenchmark(true);
 }
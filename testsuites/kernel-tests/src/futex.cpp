@@ -0,0 +1,81 @@
+#include <cassert>
+#include <thread>
+#include <unistd.h>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "testsuite.hpp"
+
+DEFINE_TEST(futexRequeueRace, ([] {
+	int from = 1;
+	int to = 0;
+	assert(helFutexRequeue(&from, 0, &to, 1, 1) == kHelErrIllegalState);
+	HEL_CHECK(helFutexRequeue(&from, 1, &to, 1, 1));
+}))
+
+DEFINE_TEST(futexRequeueWaiter, ([] {
+	int from = 0;
+	int to = 0;
+	int stage = 0;
+
+	std::thread waiter{[&] {
+		HEL_CHECK(helFutexWait(&from, 0, -1));
+		// We must only be woken up through the target futex.
+		assert(__atomic_load_n(&stage, __ATOMIC_ACQUIRE) == 2);
+	}};
+
+	// Give the waiter time to block.
+	usleep(100'000);
+
+	// Move the waiter without waking it.
+	HEL_CHECK(helFutexRequeue(&from, 0, &to, 0, 1));
+
+	__atomic_store_n(&stage, 1, __ATOMIC_RELEASE);
+	HEL_CHECK(helFutexWake(&from));
+	usleep(100'000);
+
+	__atomic_store_n(&stage, 2, __ATOMIC_RELEASE);
+	HEL_CHECK(helFutexWake(&to));
+	waiter.join();
+}))
+
+DEFINE_TEST(futexPiOwnership, ([] {
+	unsigned int id;
+	HEL_CHECK(helGetFutexOwnerId(&id));
+	assert(id && !(id & ~kHelFutexPiOwnerMask));
+
+	int word = 0;
+	// Unlocked futexes are taken by the kernel, too.
+	HEL_CHECK(helFutexLockPi(&word, -1));
+	assert(static_cast<unsigned int>(word) == id);
+	assert(helFutexLockPi(&word, -1) == kHelErrIllegalState);
+
+	HEL_CHECK(helFutexUnlockPi(&word));
+	assert(!word);
+	assert(helFutexUnlockPi(&word) == kHelErrIllegalState);
+}))
+
+DEFINE_TEST(futexPiHandoff, ([] {
+	unsigned int id;
+	HEL_CHECK(helGetFutexOwnerId(&id));
+
+	int word = id;
+	unsigned int waiterId = 0;
+
+	std::thread waiter{[&] {
+		HEL_CHECK(helGetFutexOwnerId(&waiterId));
+		HEL_CHECK(helFutexLockPi(&word, -1));
+		// Ownership is handed over by the kernel.
+		assert(static_cast<unsigned int>(word & kHelFutexPiOwnerMask) == waiterId);
+		HEL_CHECK(helFutexUnlockPi(&word));
+	}};
+
+	// Give the waiter time to block.
+	usleep(100'000);
+	assert(word & kHelFutexPiWaiters);
+
+	HEL_CHECK(helFutexUnlockPi(&word));
+	waiter.join();
+	assert(!word);
+}))
@@ -0,0 +1,305 @@
+// Concurrent stress tests for the memory management and futex code.
+// Besides checking correctness, each test reports its throughput per thread count,
+// such that scalability regressions show up when comparing runs.
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "testsuite.hpp"
+
+namespace {
+
+constexpr size_t pageSize = 0x1000;
+
+// Runs with 1, 2, 4, ... threads up to twice the number of CPUs (to also cover oversubscription).
+std::vector<unsigned int> threadCounts() {
+	auto numCpus = std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<unsigned int> counts;
+	for(unsigned int n = 1; n <= 2 * numCpus && n <= 16; n *= 2)
+		counts.push_back(n);
+	return counts;
+}
+
+// Runs functor(i) for i in [0, n) on n threads that start at the same time.
+// Returns the time (in seconds) until all threads are done.
+template<typename F>
+double runConcurrently(unsigned int n, F functor) {
+	unsigned int numReady = 0;
+	bool start = false;
+
+	std::vector<std::thread> threads;
+	for(unsigned int i = 0; i < n; i++)
+		threads.emplace_back([&, i] {
+			__atomic_add_fetch(&numReady, 1, __ATOMIC_ACQ_REL);
+			while(!__atomic_load_n(&start, __ATOMIC_ACQUIRE))
+				;
+			functor(i);
+		});
+
+	while(__atomic_load_n(&numReady, __ATOMIC_ACQUIRE) != n)
+		;
+	auto before = std::chrono::steady_clock::now();
+	__atomic_store_n(&start, true, __ATOMIC_RELEASE);
+	for(auto &thread : threads)
+		thread.join();
+	auto elapsed = std::chrono::steady_clock::now() - before;
+	return std::chrono::duration<double>(elapsed).count();
+}
+
+void reportThroughput(const char *test, unsigned int n, uint64_t ops, double seconds,
+		const char *unit) {
+	std::cout << "kernel-tests: " << test << " with " << n << " threads: "
+			<< static_cast<uint64_t>(ops / seconds) << " " << unit << "/s ("
+			<< static_cast<uint64_t>(ops / seconds / n) << " per thread)" << std::endl;
+}
+
+struct Window {
+	Window(size_t size)
+	: size{size} {
+		HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
+		void *window;
+		HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, size,
+				kHelMapProtRead | kHelMapProtWrite, &window));
+		p = reinterpret_cast<volatile std::byte *>(window);
+	}
+
+	Window(const Window &) = delete;
+
+	~Window() {
+		HEL_CHECK(helUnmapMemory(kHelNullHandle, const_cast<std::byte *>(p), size));
+		HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+	}
+
+	Window &operator= (const Window &) = delete;
+
+	HelHandle handle;
+	size_t size;
+	volatile std::byte *p;
+};
+
+// Value that we expect to find in the given page.
+std::byte pageValue(size_t page) {
+	return static_cast<std::byte>((page * 7 + 1) & 0xFF);
+}
+
+} // anonymous namespace
+
+// Each thread faults in its own part of a mapping.
+DEFINE_TEST(stressFaultDisjoint, ([] {
+	constexpr size_t pagesPerThread = 1024;
+
+	for(auto n : threadCounts()) {
+		Window window{n * pagesPerThread * pageSize};
+
+		auto seconds = runConcurrently(n, [&] (unsigned int i) {
+			for(size_t k = 0; k < pagesPerThread; k++) {
+				auto page = i * pagesPerThread + k;
+				window.p[page * pageSize] = pageValue(page);
+			}
+		});
+
+		for(size_t page = 0; page < n * pagesPerThread; page++)
+			assert(window.p[page * pageSize] == pageValue(page));
+		reportThroughput("stressFaultDisjoint", n, n * pagesPerThread, seconds, "faults");
+	}
+}))
+
+// All threads fault in the same pages. Each thread starts at a different offset,
+// such that threads race on faults of the same pages.
+DEFINE_TEST(stressFaultOverlapping, ([] {
+	constexpr size_t numPages = 2048;
+
+	for(auto n : threadCounts()) {
+		Window window{numPages * pageSize};
+
+		auto seconds = runConcurrently(n, [&] (unsigned int i) {
+			for(size_t k = 0; k < numPages; k++) {
+				auto page = (k + i * numPages / n) % numPages;
+				window.p[page * pageSize] = pageValue(page);
+			}
+		});
+
+		for(size_t page = 0; page < numPages; page++)
+			assert(window.p[page * pageSize] == pageValue(page));
+		reportThroughput("stressFaultOverlapping", n, n * numPages, seconds, "accesses");
+	}
+}))
+
+// Threads concurrently map, protect and unmap memory in the same address space.
+// Odd iterations go through helMapMemory() and partial helUnmapMemory() calls;
+// even iterations use POSIX mmap() and mprotect(). Another thread keeps faulting
+// in a separate mapping to check that its pages are not affected.
+DEFINE_TEST(stressMapUnmapProtect, ([] {
+	constexpr int iterations = 200;
+	constexpr size_t numPages = 16;
+	constexpr size_t faultPages = 512;
+
+	for(auto n : threadCounts()) {
+		Window faultWindow{faultPages * pageSize};
+		bool done = false;
+
+		std::thread faulter{[&] {
+			size_t round = 0;
+			while(!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+				for(size_t page = 0; page < faultPages; page++)
+					faultWindow.p[page * pageSize] = pageValue(page + round);
+				for(size_t page = 0; page < faultPages; page++)
+					assert(faultWindow.p[page * pageSize] == pageValue(page + round));
+				round++;
+			}
+		}};
+
+		auto seconds = runConcurrently(n, [&] (unsigned int) {
+			for(int k = 0; k < iterations; k++) {
+				if(k & 1) {
+					HelHandle handle;
+					HEL_CHECK(helAllocateMemory(numPages * pageSize, 0, nullptr, &handle));
+					void *window;
+					HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0,
+							numPages * pageSize, kHelMapProtRead | kHelMapProtWrite, &window));
+					auto p = reinterpret_cast<volatile std::byte *>(window);
+					for(size_t page = 0; page < numPages; page++)
+						p[page * pageSize] = pageValue(page);
+
+					// Punch a hole into the middle of the mapping.
+					auto hole = const_cast<std::byte *>(p) + 4 * pageSize;
+					HEL_CHECK(helUnmapMemory(kHelNullHandle, hole, 8 * pageSize));
+					for(size_t page = 0; page < 4; page++)
+						assert(p[page * pageSize] == pageValue(page));
+					for(size_t page = 12; page < numPages; page++)
+						assert(p[page * pageSize] == pageValue(page));
+
+					HEL_CHECK(helUnmapMemory(kHelNullHandle,
+							const_cast<std::byte *>(p), 4 * pageSize));
+					HEL_CHECK(helUnmapMemory(kHelNullHandle,
+							const_cast<std::byte *>(p) + 12 * pageSize, 4 * pageSize));
+					HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+				}else{
+					auto window = mmap(nullptr, numPages * pageSize, PROT_READ | PROT_WRITE,
+							MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+					assert(window != MAP_FAILED);
+					auto p = reinterpret_cast<volatile std::byte *>(window);
+					for(size_t page = 0; page < numPages; page++)
+						p[page * pageSize] = pageValue(page);
+
+					// Make the mapping read-only and back; the contents must survive.
+					assert(!mprotect(window, numPages * pageSize, PROT_READ));
+					for(size_t page = 0; page < numPages; page++)
+						assert(p[page * pageSize] == pageValue(page));
+					assert(!mprotect(window, numPages * pageSize, PROT_READ | PROT_WRITE));
+					p[0] = pageValue(1);
+
+					assert(!munmap(window, numPages * pageSize));
+				}
+			}
+		});
+
+		__atomic_store_n(&done, true, __ATOMIC_RELEASE);
+		faulter.join();
+		reportThroughput("stressMapUnmapProtect", n, n * iterations, seconds, "iterations");
+	}
+}))
+
+// Forks while other threads fault. The child must see the memory as it was at the time
+// of the fork (at least for pages that are not written concurrently).
+// This uses POSIX mappings since fork() only copies mappings that POSIX knows about.
+DEFINE_TEST(stressForkWhileFaulting, ([] {
+	constexpr int numForks = 16;
+	constexpr size_t stablePages = 256;
+	constexpr size_t pagesPerThread = 256;
+
+	for(auto n : threadCounts()) {
+		auto stableWindow = mmap(nullptr, stablePages * pageSize, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		assert(stableWindow != MAP_FAILED);
+		auto stable = reinterpret_cast<volatile std::byte *>(stableWindow);
+		for(size_t page = 0; page < stablePages; page++)
+			stable[page * pageSize] = pageValue(page);
+
+		bool done = false;
+		std::vector<std::thread> faulters;
+		for(unsigned int i = 0; i < n; i++)
+			faulters.emplace_back([&] {
+				while(!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+					auto window = mmap(nullptr, pagesPerThread * pageSize, PROT_READ | PROT_WRITE,
+							MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+					assert(window != MAP_FAILED);
+					auto p = reinterpret_cast<volatile std::byte *>(window);
+					for(size_t page = 0; page < pagesPerThread; page++)
+						p[page * pageSize] = pageValue(page);
+					assert(!munmap(window, pagesPerThread * pageSize));
+				}
+			});
+
+		auto before = std::chrono::steady_clock::now();
+		for(int k = 0; k < numForks; k++) {
+			auto child = fork();
+			assert(child >= 0);
+			if(!child) {
+				for(size_t page = 0; page < stablePages; page++) {
+					if(stable[page * pageSize] != pageValue(page))
+						_exit(1);
+				}
+				// The page must be private to the child.
+				stable[0] = pageValue(1);
+				_exit(0);
+			}
+
+			int status;
+			assert(waitpid(child, &status, 0) == child);
+			assert(WIFEXITED(status) && !WEXITSTATUS(status));
+			assert(stable[0] == pageValue(0));
+		}
+		auto elapsed = std::chrono::steady_clock::now() - before;
+
+		__atomic_store_n(&done, true, __ATOMIC_RELEASE);
+		for(auto &thread : faulters)
+			thread.join();
+		assert(!munmap(stableWindow, stablePages * pageSize));
+		reportThroughput("stressForkWhileFaulting", n, numForks,
+				std::chrono::duration<double>(elapsed).count(), "forks");
+	}
+}))
+
+// Threads hammer a small number of futexes with waits and wakes.
+// Each thread waits until its neighbor has made progress, hence missed wakeups
+// would cause the test to hang.
+DEFINE_TEST(stressFutexStorm, ([] {
+	constexpr int rounds = 2000;
+
+	for(auto n : threadCounts()) {
+		if(n < 2)
+			continue;
+		std::vector<int> words(n);
+
+		auto seconds = runConcurrently(n, [&] (unsigned int i) {
+			auto own = &words[i];
+			auto neighbor = &words[(i + 1) % n];
+			for(int k = 0; k < rounds; k++) {
+				__atomic_store_n(own, k + 1, __ATOMIC_RELEASE);
+				HEL_CHECK(helFutexWake(own));
+
+				// Wait until the neighbor has completed the same round.
+				while(true) {
+					auto value = __atomic_load_n(neighbor, __ATOMIC_ACQUIRE);
+					if(value > k)
+						break;
+					HEL_CHECK(helFutexWait(neighbor, value, -1));
+				}
+			}
+		});
+
+		reportThroughput("stressFutexStorm", n, uint64_t{n} * rounds, seconds, "rounds");
+	}
+}))
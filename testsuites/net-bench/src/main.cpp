@@ -0,0 +1,466 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// netperf-like benchmark for the network stack. One side runs "net-bench server",
+// the other side runs the client tests against it. Either side (or both) can be managarm;
+// the client can run on the host to benchmark the receive path of a guest, and vice versa.
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+// If set, results are printed as one JSON object per line instead of human-readable text.
+bool machineReadable = false;
+uint16_t port = 5201;
+double duration = 5;
+size_t messageSize = 1;
+// If non-zero, the CPU time of this (local) process is reported per byte or transaction.
+pid_t serverPid = 0;
+// Used to convert CPU time to cycles.
+double cpuMhz = 0;
+
+// Connection modes; sent as the first byte of each TCP connection.
+constexpr char modeStream = 'S';
+constexpr char modeRr = 'R';
+
+void check(bool condition, const char *what) {
+	if(!condition) {
+		std::cerr << "net-bench: " << what << " failed: " << strerror(errno) << std::endl;
+		exit(1);
+	}
+}
+
+double secondsSince(clock::time_point start) {
+	return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+bool readAll(int fd, void *buffer, size_t size) {
+	auto p = static_cast<char *>(buffer);
+	while(size) {
+		auto n = read(fd, p, size);
+		if(n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool writeAll(int fd, const void *buffer, size_t size) {
+	auto p = static_cast<const char *>(buffer);
+	while(size) {
+		auto n = write(fd, p, size);
+		if(n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+// CPU time (user + system) of the given process in nanoseconds, from /proc/<pid>/stat.
+uint64_t cpuTimeOf(pid_t pid) {
+	auto path = "/proc/" + std::to_string(pid) + "/stat";
+	FILE *f = fopen(path.c_str(), "r");
+	check(f, "fopen(/proc/<pid>/stat)");
+	unsigned long long utime, stime;
+	int e = fscanf(f, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+			&utime, &stime);
+	fclose(f);
+	check(e == 2, "parsing /proc/<pid>/stat");
+	return (utime + stime) * (1'000'000'000 / sysconf(_SC_CLK_TCK));
+}
+
+// A named result, e.g., {"p99_us", 15}.
+using Fields = std::vector<std::pair<std::string, double>>;
+
+struct CpuMeter {
+	CpuMeter() {
+		if(serverPid)
+			start_ = cpuTimeOf(serverPid);
+	}
+
+	// CPU cost per unit (e.g., per byte or per transaction).
+	Fields measure(uint64_t units, const std::string &unit) {
+		if(!serverPid || !units)
+			return {};
+		double nanos = static_cast<double>(cpuTimeOf(serverPid) - start_) / units;
+		Fields fields{{"cpu_ns_per_" + unit, nanos}};
+		if(cpuMhz)
+			fields.push_back({"cycles_per_" + unit, nanos * cpuMhz / 1000});
+		return fields;
+	}
+
+private:
+	uint64_t start_ = 0;
+};
+
+void report(const std::string &test, Fields fields, const Fields &cpu) {
+	fields.insert(fields.end(), cpu.begin(), cpu.end());
+	if(machineReadable) {
+		std::cout << "{\"test\": \"" << test << "\"";
+		for(auto &[name, value] : fields)
+			std::cout << ", \"" << name << "\": " << value;
+		std::cout << "}" << std::endl;
+	}else{
+		std::cout << "net-bench: " << test << ":";
+		for(auto &[name, value] : fields)
+			std::cout << " " << name << "=" << value;
+		std::cout << std::endl;
+	}
+}
+
+uint64_t percentileOf(std::vector<uint64_t> &samples, double p) {
+	if(samples.empty())
+		return 0;
+	auto k = std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()));
+	std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+	return samples[k];
+}
+
+// --------------------------------------------------------
+// Server.
+// --------------------------------------------------------
+
+struct ServerConnection {
+	char mode = 0;
+	uint32_t size = 0;
+	size_t headerBytes = 0;
+	char header[4];
+	std::vector<char> buffer;
+	size_t filled = 0;
+};
+
+// Single-threaded poll() loop that serves TCP sinks and echoes, and UDP echoes.
+void runServer() {
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	check(listener >= 0, "socket()");
+	int one = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	check(!bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), "bind()");
+	check(!listen(listener, 1024), "listen()");
+
+	int udp = socket(AF_INET, SOCK_DGRAM, 0);
+	check(udp >= 0, "socket()");
+	check(!bind(udp, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), "bind()");
+
+	std::cout << "net-bench: Serving on port " << port << std::endl;
+
+	std::map<int, ServerConnection> connections;
+	std::vector<char> sink(1 << 16);
+	while(true) {
+		std::vector<pollfd> fds{{listener, POLLIN, 0}, {udp, POLLIN, 0}};
+		for(auto &[fd, conn] : connections)
+			fds.push_back({fd, POLLIN, 0});
+		check(poll(fds.data(), fds.size(), -1) > 0, "poll()");
+
+		if(fds[0].revents & POLLIN) {
+			int fd = accept(listener, nullptr, nullptr);
+			check(fd >= 0, "accept()");
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			connections[fd] = {};
+		}
+
+		if(fds[1].revents & POLLIN) {
+			sockaddr_in peer;
+			socklen_t peerLength = sizeof(peer);
+			auto n = recvfrom(udp, sink.data(), sink.size(), 0,
+					reinterpret_cast<sockaddr *>(&peer), &peerLength);
+			if(n > 0)
+				sendto(udp, sink.data(), n, 0, reinterpret_cast<sockaddr *>(&peer), peerLength);
+		}
+
+		for(size_t i = 2; i < fds.size(); i++) {
+			if(!fds[i].revents)
+				continue;
+			int fd = fds[i].fd;
+			auto &conn = connections[fd];
+
+			bool closed = false;
+			if(!conn.mode) {
+				closed = read(fd, &conn.mode, 1) != 1;
+			}else if(conn.mode == modeStream) {
+				closed = read(fd, sink.data(), sink.size()) <= 0;
+			}else if(conn.headerBytes < sizeof(conn.header)) {
+				auto n = read(fd, conn.header + conn.headerBytes,
+						sizeof(conn.header) - conn.headerBytes);
+				closed = n <= 0;
+				if(!closed)
+					conn.headerBytes += n;
+				if(conn.headerBytes == sizeof(conn.header)) {
+					memcpy(&conn.size, conn.header, sizeof(conn.size));
+					conn.size = ntohl(conn.size);
+					conn.buffer.resize(std::max(conn.size, uint32_t{1}));
+				}
+			}else{
+				// Echo each complete message back.
+				auto n = read(fd, conn.buffer.data() + conn.filled, conn.size - conn.filled);
+				closed = n <= 0;
+				if(!closed) {
+					conn.filled += n;
+					if(conn.filled == conn.size) {
+						closed = !writeAll(fd, conn.buffer.data(), conn.size);
+						conn.filled = 0;
+					}
+				}
+			}
+
+			if(closed) {
+				close(fd);
+				connections.erase(fd);
+			}
+		}
+	}
+}
+
+// --------------------------------------------------------
+// Client tests.
+// --------------------------------------------------------
+
+sockaddr_in serverAddr;
+
+int connectToServer(char mode) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	check(fd >= 0, "socket()");
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	check(!connect(fd, reinterpret_cast<sockaddr *>(&serverAddr), sizeof(serverAddr)),
+			"connect()");
+	check(writeAll(fd, &mode, 1), "write()");
+	if(mode == modeRr) {
+		uint32_t size = htonl(messageSize);
+		check(writeAll(fd, &size, sizeof(size)), "write()");
+	}
+	return fd;
+}
+
+// Bulk transfer from the client to the server.
+void doTcpStream() {
+	size_t chunkSize = messageSize > 1 ? messageSize : 64 << 10;
+	std::vector<char> buffer(chunkSize, 'x');
+	int fd = connectToServer(modeStream);
+
+	CpuMeter cpu;
+	uint64_t bytes = 0;
+	auto start = clock::now();
+	while(secondsSince(start) < duration) {
+		check(writeAll(fd, buffer.data(), buffer.size()), "write()");
+		bytes += buffer.size();
+	}
+	auto seconds = secondsSince(start);
+	close(fd);
+
+	report("tcp-stream", {{"mib_per_sec", bytes / seconds / (1 << 20)}},
+			cpu.measure(bytes, "byte"));
+}
+
+// Transactions of messageSize bytes in each direction over a single connection.
+void doTcpRr() {
+	std::vector<char> buffer(messageSize, 'x');
+	int fd = connectToServer(modeRr);
+
+	CpuMeter cpu;
+	std::vector<uint64_t> latencies;
+	auto start = clock::now();
+	while(secondsSince(start) < duration) {
+		auto ref = clock::now();
+		check(writeAll(fd, buffer.data(), buffer.size()), "write()");
+		check(readAll(fd, buffer.data(), buffer.size()), "read()");
+		latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				clock::now() - ref).count());
+	}
+	auto seconds = secondsSince(start);
+	close(fd);
+
+	uint64_t n = latencies.size();
+	report("tcp-rr", {
+		{"transactions_per_sec", n / seconds},
+		{"p50_us", percentileOf(latencies, 0.5) / 1000.0},
+		{"p99_us", percentileOf(latencies, 0.99) / 1000.0}
+	}, cpu.measure(n, "transaction"));
+}
+
+void doUdpRr() {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	check(fd >= 0, "socket()");
+	check(!connect(fd, reinterpret_cast<sockaddr *>(&serverAddr), sizeof(serverAddr)),
+			"connect()");
+	std::vector<char> buffer(messageSize, 'x');
+
+	CpuMeter cpu;
+	std::vector<uint64_t> latencies;
+	uint64_t lost = 0;
+	auto start = clock::now();
+	while(secondsSince(start) < duration) {
+		auto ref = clock::now();
+		check(send(fd, buffer.data(), buffer.size(), 0) >= 0, "send()");
+		// Datagrams may be dropped; give up on a transaction after 100ms.
+		pollfd pfd{fd, POLLIN, 0};
+		if(poll(&pfd, 1, 100) != 1) {
+			lost++;
+			continue;
+		}
+		check(recv(fd, buffer.data(), buffer.size(), 0) >= 0, "recv()");
+		latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				clock::now() - ref).count());
+	}
+	auto seconds = secondsSince(start);
+	close(fd);
+
+	uint64_t n = latencies.size();
+	report("udp-rr", {
+		{"transactions_per_sec", n / seconds},
+		{"p50_us", percentileOf(latencies, 0.5) / 1000.0},
+		{"p99_us", percentileOf(latencies, 0.99) / 1000.0},
+		{"lost", static_cast<double>(lost)}
+	}, cpu.measure(n, "transaction"));
+}
+
+// Connect, one transaction, close; measures connection setup and teardown.
+void doTcpCrr() {
+	std::vector<char> buffer(messageSize, 'x');
+
+	CpuMeter cpu;
+	uint64_t n = 0;
+	auto start = clock::now();
+	while(secondsSince(start) < duration) {
+		int fd = connectToServer(modeRr);
+		check(writeAll(fd, buffer.data(), buffer.size()), "write()");
+		check(readAll(fd, buffer.data(), buffer.size()), "read()");
+		close(fd);
+		n++;
+	}
+	auto seconds = secondsSince(start);
+
+	report("tcp-crr", {{"connections_per_sec", n / seconds}}, cpu.measure(n, "connection"));
+}
+
+// Keeps one transaction in flight on each of numConnections connections.
+void doTcpManyRr(int numConnections) {
+	std::vector<int> fds;
+	for(int i = 0; i < numConnections; i++)
+		fds.push_back(connectToServer(modeRr));
+	std::vector<char> buffer(messageSize, 'x');
+	std::vector<size_t> received(numConnections, 0);
+
+	CpuMeter cpu;
+	for(auto fd : fds)
+		check(writeAll(fd, buffer.data(), buffer.size()), "write()");
+
+	uint64_t n = 0;
+	std::vector<pollfd> pfds;
+	for(auto fd : fds)
+		pfds.push_back({fd, POLLIN, 0});
+	auto start = clock::now();
+	while(secondsSince(start) < duration) {
+		check(poll(pfds.data(), pfds.size(), 1000) >= 0, "poll()");
+		for(int i = 0; i < numConnections; i++) {
+			if(!(pfds[i].revents & POLLIN))
+				continue;
+			auto r = read(fds[i], buffer.data(), messageSize - received[i]);
+			check(r > 0, "read()");
+			received[i] += r;
+			if(received[i] < messageSize)
+				continue;
+			received[i] = 0;
+			n++;
+			check(writeAll(fds[i], buffer.data(), buffer.size()), "write()");
+		}
+	}
+	auto seconds = secondsSince(start);
+	for(auto fd : fds)
+		close(fd);
+
+	report("tcp-rr-" + std::to_string(numConnections) + "-conns",
+			{{"transactions_per_sec", n / seconds}}, cpu.measure(n, "transaction"));
+}
+
+void printUsage() {
+	std::cerr << "usage: net-bench [--json] [--port PORT] server\n"
+			"       net-bench [--json] [--port PORT] [--duration SECONDS] [--size BYTES]\n"
+			"                 [--server-pid PID [--cpu-mhz MHZ]] client ADDRESS [TEST...]\n"
+			"tests: tcp-stream tcp-rr udp-rr tcp-crr tcp-conns (default: all)\n"
+			"--server-pid reports the CPU time of a local process (e.g., netserver)\n"
+			"per byte or transaction." << std::endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	std::vector<std::string> positional;
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--json")) {
+			machineReadable = true;
+		}else if(!strcmp(argv[i], "--port") && i + 1 < argc) {
+			port = atoi(argv[++i]);
+		}else if(!strcmp(argv[i], "--duration") && i + 1 < argc) {
+			duration = atof(argv[++i]);
+		}else if(!strcmp(argv[i], "--size") && i + 1 < argc) {
+			messageSize = std::max(1L, atol(argv[++i]));
+		}else if(!strcmp(argv[i], "--server-pid") && i + 1 < argc) {
+			serverPid = atoi(argv[++i]);
+		}else if(!strcmp(argv[i], "--cpu-mhz") && i + 1 < argc) {
+			cpuMhz = atof(argv[++i]);
+		}else if(argv[i][0] != '-') {
+			positional.push_back(argv[i]);
+		}else{
+			printUsage();
+			return 1;
+		}
+	}
+
+	if(positional.size() == 1 && positional[0] == "server") {
+		runServer();
+		return 0;
+	}
+	if(positional.size() < 2 || positional[0] != "client") {
+		printUsage();
+		return 1;
+	}
+
+	serverAddr.sin_family = AF_INET;
+	serverAddr.sin_port = htons(port);
+	if(inet_pton(AF_INET, positional[1].c_str(), &serverAddr.sin_addr) != 1) {
+		std::cerr << "net-bench: Invalid address " << positional[1] << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> tests{positional.begin() + 2, positional.end()};
+	if(tests.empty())
+		tests = {"tcp-stream", "tcp-rr", "udp-rr", "tcp-crr", "tcp-conns"};
+	for(auto &test : tests) {
+		if(test == "tcp-stream") {
+			doTcpStream();
+		}else if(test == "tcp-rr") {
+			doTcpRr();
+		}else if(test == "udp-rr") {
+			doUdpRr();
+		}else if(test == "tcp-crr") {
+			doTcpCrr();
+		}else if(test == "tcp-conns") {
+			for(int n : {1, 16, 256, 1024})
+				doTcpManyRr(n);
+		}else{
+			printUsage();
+			return 1;
+		}
+	}
+}
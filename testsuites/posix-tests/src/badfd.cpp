@@ -2,6 +2,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <vector>
 
 #include "testsuite.hpp"
 
@@ -42,3 +43,64 @@ DEFINE_TEST(stat_badfd, ([] {
 	assert(ret == -1);
 	assert(errno == EBADF);
 }))
+
+DEFINE_TEST(dup2_bad_newfd, ([] {
+	int fd = dup2(STDOUT_FILENO, BOGUS_FD);
+	assert(fd == -1);
+	assert(errno == EBADF);
+}))
+
+DEFINE_TEST(dup_lowest_free, ([] {
+	// Use more fds than fit into a single page of passthrough handles
+	// (but stay below the usual RLIMIT_NOFILE of 1024).
+	constexpr int numFds = 1000;
+	std::vector<int> fds;
+	for(int i = 0; i < numFds; i++) {
+		int fd = dup(STDOUT_FILENO);
+		assert(fd >= 0);
+		fds.push_back(fd);
+	}
+
+	// The highest fd is usable.
+	struct stat st;
+	assert(!fstat(fds.back(), &st));
+
+	// Freed fds are reused lowest first.
+	int hole = fds[numFds / 2];
+	assert(!close(fds[numFds / 4]));
+	assert(!close(hole));
+	int fd = dup(STDOUT_FILENO);
+	assert(fd == fds[numFds / 4]);
+	fd = dup(STDOUT_FILENO);
+	assert(fd == hole);
+
+	for(auto fd : fds)
+		assert(!close(fd));
+}))
+
+DEFINE_TEST(dup_exhaust_fds, ([] {
+	std::vector<int> fds;
+	while(true) {
+		int fd = dup(STDOUT_FILENO);
+		if(fd == -1) {
+			assert(errno == EMFILE);
+			break;
+		}
+		fds.push_back(fd);
+	}
+	assert(!fds.empty());
+
+	// With a single free slot, pipe() fails without leaking its first end.
+	int hole = fds.back();
+	fds.pop_back();
+	assert(!close(hole));
+	int pipefds[2];
+	assert(pipe(pipefds) == -1);
+	assert(errno == EMFILE);
+	int fd = dup(STDOUT_FILENO);
+	assert(fd == hole);
+	fds.push_back(fd);
+
+	for(auto fd : fds)
+		assert(!close(fd));
+}))
@@ -47,3 +47,91 @@ DEFINE_TEST(epoll_mod_active, ([] {
 	close(epfd);
 	close(fd);
 }))
+
+DEFINE_TEST(epoll_edge_triggered, ([] {
+	int pending;
+
+	int fd = eventfd(0, EFD_NONBLOCK);
+	assert(fd >= 0);
+
+	int epfd = epoll_create1(0);
+	assert(epfd >= 0);
+
+	epoll_event evt;
+	memset(&evt, 0, sizeof(epoll_event));
+	evt.events = EPOLLIN | EPOLLET;
+	int e = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &evt);
+	assert(!e);
+
+	uint64_t n = 1;
+	auto written = write(fd, &n, sizeof(uint64_t));
+	assert(written == sizeof(uint64_t));
+
+	memset(&evt, 0, sizeof(epoll_event));
+	pending = epoll_wait(epfd, &evt, 1, 0);
+	assert(pending == 1);
+	assert(evt.events & EPOLLIN);
+
+	// The FD is still readable but there is no new edge.
+	memset(&evt, 0, sizeof(epoll_event));
+	pending = epoll_wait(epfd, &evt, 1, 0);
+	assert(!pending);
+
+	// A second write is a new edge.
+	written = write(fd, &n, sizeof(uint64_t));
+	assert(written == sizeof(uint64_t));
+
+	memset(&evt, 0, sizeof(epoll_event));
+	pending = epoll_wait(epfd, &evt, 1, 100);
+	assert(pending == 1);
+	assert(evt.events & EPOLLIN);
+
+	close(epfd);
+	close(fd);
+}))
+
+DEFINE_TEST(epoll_oneshot, ([] {
+	int pending;
+
+	int fd = eventfd(0, EFD_NONBLOCK);
+	assert(fd >= 0);
+
+	int epfd = epoll_create1(0);
+	assert(epfd >= 0);
+
+	epoll_event evt;
+	memset(&evt, 0, sizeof(epoll_event));
+	evt.events = EPOLLIN | EPOLLONESHOT;
+	int e = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &evt);
+	assert(!e);
+
+	uint64_t n = 1;
+	auto written = write(fd, &n, sizeof(uint64_t));
+	assert(written == sizeof(uint64_t));
+
+	memset(&evt, 0, sizeof(epoll_event));
+	pending = epoll_wait(epfd, &evt, 1, 0);
+	assert(pending == 1);
+
+	// The item is disabled after the event, even if there are new edges.
+	written = write(fd, &n, sizeof(uint64_t));
+	assert(written == sizeof(uint64_t));
+
+	memset(&evt, 0, sizeof(epoll_event));
+	pending = epoll_wait(epfd, &evt, 1, 0);
+	assert(!pending);
+
+	// EPOLL_CTL_MOD re-arms the item.
+	memset(&evt, 0, sizeof(epoll_event));
+	evt.events = EPOLLIN | EPOLLONESHOT;
+	e = epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &evt);
+	assert(!e);
+
+	memset(&evt, 0, sizeof(epoll_event));
+	pending = epoll_wait(epfd, &evt, 1, 0);
+	assert(pending == 1);
+	assert(evt.events & EPOLLIN);
+
+	close(epfd);
+	close(fd);
+}))
@@ -0,0 +1,132 @@
+#include <cassert>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "testsuite.hpp"
+
+namespace {
+
+sockaddr_in loopbackAddress(in_port_t port) {
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	return addr;
+}
+
+} // anonymous namespace
+
+DEFINE_TEST(inet_tcp_loopback, ([] {
+	int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(server_fd == -1)
+		assert(!"server socket() failed");
+
+	auto server_addr = loopbackAddress(5432);
+	if(bind(server_fd, reinterpret_cast<sockaddr *>(&server_addr), sizeof(server_addr)))
+		assert(!"bind() failed");
+	if(listen(server_fd, 1))
+		assert(!"listen() failed");
+
+	pid_t child = fork();
+	if(!child) {
+		int client_fd = socket(AF_INET, SOCK_STREAM, 0);
+		if(client_fd == -1)
+			assert(!"client socket() failed");
+		if(connect(client_fd, reinterpret_cast<sockaddr *>(&server_addr), sizeof(server_addr)))
+			assert(!"connect() to server failed");
+
+		char buf[5];
+		if(write(client_fd, "hello", 5) != 5)
+			assert(!"write() failed");
+		if(recv(client_fd, buf, 5, MSG_WAITALL) != 5)
+			assert(!"recv() failed");
+		assert(!memcmp(buf, "olleh", 5));
+		exit(0);
+	}
+
+	int peer_fd = accept(server_fd, nullptr, nullptr);
+	if(peer_fd == -1)
+		assert(!"accept() failed");
+
+	char buf[5];
+	if(recv(peer_fd, buf, 5, MSG_WAITALL) != 5)
+		assert(!"recv() failed");
+	assert(!memcmp(buf, "hello", 5));
+	if(write(peer_fd, "olleh", 5) != 5)
+		assert(!"write() failed");
+
+	int status;
+	if(waitpid(child, &status, 0) != child)
+		assert(!"waitpid() failed");
+	assert(WIFEXITED(status) && !WEXITSTATUS(status));
+
+	close(peer_fd);
+	close(server_fd);
+}));
+
+DEFINE_TEST(inet_udp_loopback, ([] {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd == -1)
+		assert(!"socket() failed");
+
+	auto addr = loopbackAddress(5433);
+	if(bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)))
+		assert(!"bind() failed");
+	if(sendto(fd, "ping", 4, 0, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 4)
+		assert(!"sendto() failed");
+
+	char buf[8];
+	sockaddr_in source;
+	socklen_t source_length = sizeof(source);
+	auto n = recvfrom(fd, buf, sizeof(buf), 0,
+			reinterpret_cast<sockaddr *>(&source), &source_length);
+	assert(n == 4);
+	assert(!memcmp(buf, "ping", 4));
+	assert(source.sin_port == htons(5433));
+	assert(source.sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+
+	close(fd);
+}));
+
+DEFINE_TEST(inet_poll_many_udp, ([] {
+	constexpr int numSockets = 32;
+	pollfd pfds[numSockets];
+	for(int i = 0; i < numSockets; i++) {
+		int fd = socket(AF_INET, SOCK_DGRAM, 0);
+		if(fd == -1)
+			assert(!"socket() failed");
+		auto addr = loopbackAddress(5500 + i);
+		if(bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)))
+			assert(!"bind() failed");
+
+		memset(&pfds[i], 0, sizeof(pollfd));
+		pfds[i].fd = fd;
+		pfds[i].events = POLLIN;
+	}
+
+	// Nothing was received yet.
+	int e = poll(pfds, numSockets, 0);
+	assert(!e);
+
+	for(int i = 0; i < numSockets; i++) {
+		auto addr = loopbackAddress(5500 + i);
+		if(sendto(pfds[i].fd, "ping", 4, 0, reinterpret_cast<sockaddr *>(&addr),
+				sizeof(addr)) != 4)
+			assert(!"sendto() failed");
+	}
+
+	// All sockets must be reported, not only a subset of them.
+	e = poll(pfds, numSockets, 1000);
+	assert(e == numSockets);
+	for(int i = 0; i < numSockets; i++)
+		assert(pfds[i].revents & POLLIN);
+
+	for(int i = 0; i < numSockets; i++)
+		close(pfds[i].fd);
+}));
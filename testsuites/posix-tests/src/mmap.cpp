@@ -1,6 +1,7 @@
 #include <cassert>
 
 #include <signal.h>
+#include <string.h>
 #include <setjmp.h>
 #include <unistd.h>
 #include <sys/mman.h>
@@ -376,3 +377,78 @@ DEFINE_TEST(mmap_unmap_range_before_first, ([] {
 		assert(ensureNotWritable(mem));
 	});
 }))
+
+DEFINE_TEST(mmap_madvise_mergeable, ([] {
+	constexpr size_t numPages = 16;
+	auto mem = static_cast<unsigned char *>(mmap(nullptr, pageSize * numPages,
+			PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
+	assert_errno("mmap", mem != MAP_FAILED);
+
+	for(size_t i = 0; i < pageSize * numPages; i++)
+		mem[i] = static_cast<unsigned char>(i);
+
+	int ret = madvise(mem, pageSize * numPages, MADV_MERGEABLE);
+	assert_errno("madvise", ret != -1);
+
+	// Give the kernel an opportunity to merge the pages.
+	usleep(500'000);
+
+	// Writing to one page must not affect the other ones.
+	mem[3 * pageSize] = 0xAA;
+	for(size_t i = 0; i < pageSize * numPages; i++)
+		assert(mem[i] == (i == 3 * pageSize ? 0xAA : static_cast<unsigned char>(i)));
+
+	ret = madvise(mem, pageSize * numPages, MADV_UNMERGEABLE);
+	assert_errno("madvise", ret != -1);
+
+	ret = munmap(mem, pageSize * numPages);
+	assert_errno("munmap", ret != -1);
+}))
+
+DEFINE_TEST(mmap_madvise_dontneed, ([] {
+	constexpr size_t numPages = 4;
+	auto mem = static_cast<unsigned char *>(mmap(nullptr, pageSize * numPages,
+			PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
+	assert_errno("mmap", mem != MAP_FAILED);
+
+	memset(mem, 0xAA, pageSize * numPages);
+
+	// Discard the middle pages only.
+	int ret = madvise(mem + pageSize, pageSize * 2, MADV_DONTNEED);
+	assert_errno("madvise", ret != -1);
+
+	// Discarded pages of private anonymous mappings read back as zeros.
+	for(size_t i = 0; i < pageSize * numPages; i++) {
+		bool discarded = i >= pageSize && i < 3 * pageSize;
+		assert(mem[i] == (discarded ? 0 : 0xAA));
+	}
+
+	ret = munmap(mem, pageSize * numPages);
+	assert_errno("munmap", ret != -1);
+}))
+
+DEFINE_TEST(mmap_mremap_grow_anonymous, ([] {
+	constexpr size_t oldPages = 4;
+	constexpr size_t newPages = 64;
+	auto mem = static_cast<unsigned char *>(mmap(nullptr, pageSize * oldPages,
+			PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
+	assert_errno("mmap", mem != MAP_FAILED);
+
+	for(size_t i = 0; i < pageSize * oldPages; i++)
+		mem[i] = static_cast<unsigned char>(i);
+
+	auto grown = static_cast<unsigned char *>(mremap(mem, pageSize * oldPages,
+			pageSize * newPages, MREMAP_MAYMOVE));
+	assert_errno("mremap", grown != MAP_FAILED);
+
+	// The old contents are preserved and the new part reads as zeros.
+	for(size_t i = 0; i < pageSize * newPages; i++)
+		assert(grown[i] == (i < pageSize * oldPages ? static_cast<unsigned char>(i) : 0));
+
+	// The new part is writable.
+	grown[pageSize * newPages - 1] = 0xAA;
+	assert(grown[pageSize * newPages - 1] == 0xAA);
+
+	int ret = munmap(grown, pageSize * newPages);
+	assert_errno("munmap", ret != -1);
+}))
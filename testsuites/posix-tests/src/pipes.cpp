@@ -1,6 +1,7 @@
 #include <cassert>
 #include <cstring>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <poll.h>
 
@@ -37,3 +38,42 @@ DEFINE_TEST(pipe_close_reader, ([] {
 	assert(pfd.revents & POLLERR);
 	assert(!(pfd.revents & POLLHUP));
 }))
+
+DEFINE_TEST(pipe_fill_nonblocking, ([] {
+	int fds[2];
+	int e = pipe2(fds, O_NONBLOCK);
+	assert(!e);
+
+	// Fill the pipe until writes fail.
+	char buffer[4096];
+	memset(buffer, 0x42, sizeof(buffer));
+	size_t total = 0;
+	while(true) {
+		auto n = write(fds[1], buffer, sizeof(buffer));
+		if(n < 0) {
+			assert(errno == EAGAIN);
+			break;
+		}
+		total += n;
+	}
+	assert(total);
+
+	pollfd pfd;
+	memset(&pfd, 0, sizeof(pollfd));
+	pfd.fd = fds[1];
+	pfd.events = POLLOUT;
+	e = poll(&pfd, 1, 0);
+	assert(!e);
+
+	// Reads are not limited to the size of a single write.
+	char out[2 * sizeof(buffer)];
+	auto n = read(fds[0], out, sizeof(out));
+	assert(n == sizeof(out));
+
+	e = poll(&pfd, 1, 0);
+	assert(e == 1);
+	assert(pfd.revents & POLLOUT);
+
+	close(fds[0]);
+	close(fds[1]);
+}))
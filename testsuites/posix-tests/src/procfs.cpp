@@ -0,0 +1,115 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "testsuite.hpp"
+
+DEFINE_TEST(procfs_self_stat, ([] {
+	FILE *f = fopen("/proc/self/stat", "r");
+	assert(f);
+
+	int pid, ppid;
+	char state;
+	int e = fscanf(f, "%d %*s %c %d", &pid, &state, &ppid);
+	assert(e == 3);
+	assert(pid == getpid());
+	assert(ppid == getppid());
+
+	fclose(f);
+}))
+
+DEFINE_TEST(procfs_self_schedstat, ([] {
+	FILE *f = fopen("/proc/self/schedstat", "r");
+	assert(f);
+
+	unsigned long long runTime, waitTime, slices;
+	int e = fscanf(f, "%llu %llu %llu", &runTime, &waitTime, &slices);
+	assert(e == 3);
+	// We are running right now, so we must have been scheduled at least once.
+	assert(runTime > 0);
+	assert(slices > 0);
+
+	fclose(f);
+}))
+
+namespace {
+	std::string readPosixStats() {
+		FILE *f = fopen("/proc/managarm/posix-stats", "r");
+		assert(f);
+		std::string contents;
+		char buffer[256];
+		size_t n;
+		while((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+			contents.append(buffer, n);
+		fclose(f);
+		return contents;
+	}
+}
+
+DEFINE_TEST(procfs_posix_stats, ([] {
+	// access() is handled by posix via ACCESSAT.
+	int e = access("/", F_OK);
+	assert(!e);
+	assert(readPosixStats().find("request:ACCESSAT ") != std::string::npos);
+
+	int fd = open("/proc/managarm/posix-stats", O_WRONLY);
+	assert(fd >= 0);
+	assert(write(fd, "reset", 5) == 5);
+	close(fd);
+
+	assert(readPosixStats().find("request:ACCESSAT ") == std::string::npos);
+}))
+
+DEFINE_TEST(netlink_process_stats, ([] {
+	// Constants from protocols/posix/data.hpp.
+	constexpr int netlinkStats = 30;
+	constexpr uint16_t statsGetProcesses = 0x100;
+	constexpr uint16_t statsProcess = 0x101;
+
+	int fd = socket(AF_NETLINK, SOCK_DGRAM, netlinkStats);
+	assert(fd >= 0);
+
+	struct nlmsghdr request;
+	memset(&request, 0, sizeof(struct nlmsghdr));
+	request.nlmsg_len = NLMSG_LENGTH(0);
+	request.nlmsg_type = statsGetProcesses;
+	request.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	request.nlmsg_seq = 1;
+
+	struct sockaddr_nl sa;
+	memset(&sa, 0, sizeof(struct sockaddr_nl));
+	sa.nl_family = AF_NETLINK;
+	auto sent = sendto(fd, &request, request.nlmsg_len, 0,
+			reinterpret_cast<struct sockaddr *>(&sa), sizeof(struct sockaddr_nl));
+	assert(sent == static_cast<ssize_t>(request.nlmsg_len));
+
+	bool done = false;
+	bool foundSelf = false;
+	while(!done) {
+		alignas(struct nlmsghdr) char buffer[8192];
+		auto n = recv(fd, buffer, sizeof(buffer), 0);
+		assert(n > 0);
+
+		auto hdr = reinterpret_cast<struct nlmsghdr *>(buffer);
+		for(int len = n; NLMSG_OK(hdr, len); hdr = NLMSG_NEXT(hdr, len)) {
+			assert(hdr->nlmsg_seq == 1);
+			if(hdr->nlmsg_type == NLMSG_DONE) {
+				done = true;
+				break;
+			}
+			assert(hdr->nlmsg_type == statsProcess);
+			int32_t pid;
+			memcpy(&pid, NLMSG_DATA(hdr), sizeof(int32_t));
+			if(pid == getpid())
+				foundSelf = true;
+		}
+	}
+	assert(foundSelf);
+
+	close(fd);
+}))
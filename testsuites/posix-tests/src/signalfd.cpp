@@ -42,3 +42,53 @@ DEFINE_TEST(signalfd_nonblock, ([] {
 
 	close(fd);
 }))
+
+DEFINE_TEST(signalfd_queueing, ([] {
+	int e;
+	int rtSignal = SIGRTMIN + 1;
+
+	sigset_t sigSet;
+	sigemptyset(&sigSet);
+	sigaddset(&sigSet, SIGUSR2);
+	sigaddset(&sigSet, rtSignal);
+
+	sigset_t oldSet;
+	e = sigprocmask(SIG_BLOCK, &sigSet, &oldSet);
+	assert(!e);
+
+	int fd = signalfd(-1, &sigSet, SFD_NONBLOCK);
+	assert(fd >= 0);
+
+	// Standard signals are coalesced while real-time signals are queued.
+	for(int i = 0; i < 3; i++) {
+		e = kill(getpid(), SIGUSR2);
+		assert(!e);
+		e = kill(getpid(), rtSignal);
+		assert(!e);
+	}
+
+	int numStandard = 0;
+	int numRt = 0;
+	while(true) {
+		signalfd_siginfo si;
+		ssize_t sz = read(fd, &si, sizeof(signalfd_siginfo));
+		if(sz < 0) {
+			assert(errno == EAGAIN);
+			break;
+		}
+		assert(sz == sizeof(signalfd_siginfo));
+		if(static_cast<int>(si.ssi_signo) == SIGUSR2) {
+			numStandard++;
+		}else{
+			assert(static_cast<int>(si.ssi_signo) == rtSignal);
+			numRt++;
+		}
+	}
+	assert(numStandard == 1);
+	assert(numRt == 3);
+
+	e = sigprocmask(SIG_SETMASK, &oldSet, nullptr);
+	assert(!e);
+
+	close(fd);
+}))
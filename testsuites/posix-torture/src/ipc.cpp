@@ -0,0 +1,35 @@
+#include <cassert>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "testsuite.hpp"
+
+DEFINE_TEST(pipe_ping, ([] {
+	int fds[2];
+	int e = pipe(fds);
+	assert(!e);
+
+	char c = 42;
+	auto written = write(fds[1], &c, 1);
+	assert(written == 1);
+	auto received = read(fds[0], &c, 1);
+	assert(received == 1 && c == 42);
+
+	close(fds[0]);
+	close(fds[1]);
+}))
+
+DEFINE_TEST(unix_socketpair_ping, ([] {
+	int fds[2];
+	int e = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	assert(!e);
+
+	char c = 42;
+	auto sent = send(fds[0], &c, 1, 0);
+	assert(sent == 1);
+	auto received = recv(fds[1], &c, 1, 0);
+	assert(received == 1 && c == 42);
+
+	close(fds[0]);
+	close(fds[1]);
+}))
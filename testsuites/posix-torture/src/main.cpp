@@ -1,4 +1,15 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "testsuite.hpp"
@@ -12,7 +23,155 @@ void abstract_test_case::register_case(abstract_test_case *tcp) {
 	test_case_ptrs().push_back(tcp);
 }
 
-int main() {
+namespace {
+
+uint64_t nanosNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+// Log-linear latency histogram: each power of two is split into 8 linear sub-buckets.
+// This is a plain struct since workers that run as processes share it through memory.
+struct LatencyHistogram {
+	static constexpr int subBucketBits = 3;
+	static constexpr int numSubBuckets = 1 << subBucketBits;
+	static constexpr int numGroups = 40 - subBucketBits + 1;
+	static constexpr int numBuckets = numGroups * numSubBuckets;
+
+	void record(uint64_t nanos) {
+		buckets[bucketOf(nanos)]++;
+		count++;
+	}
+
+	void merge(const LatencyHistogram &other) {
+		for(int i = 0; i < numBuckets; i++)
+			buckets[i] += other.buckets[i];
+		count += other.count;
+	}
+
+	// Upper bound of the bucket that contains the given percentile.
+	uint64_t percentile(double p) const {
+		uint64_t target = std::max(uint64_t{1}, static_cast<uint64_t>(p * count));
+		uint64_t seen = 0;
+		for(int i = 0; i < numBuckets; i++) {
+			seen += buckets[i];
+			if(seen >= target)
+				return upperBoundOf(i);
+		}
+		return 0;
+	}
+
+	uint64_t buckets[numBuckets];
+	uint64_t count;
+
+private:
+	static int bucketOf(uint64_t nanos) {
+		if(nanos < numSubBuckets)
+			return nanos;
+		int msb = 63 - __builtin_clzll(nanos);
+		int group = msb - subBucketBits + 1;
+		if(group >= numGroups)
+			return numBuckets - 1;
+		return group * numSubBuckets + ((nanos >> (msb - subBucketBits)) & (numSubBuckets - 1));
+	}
+
+	static uint64_t upperBoundOf(int bucket) {
+		int group = bucket / numSubBuckets;
+		int sub = bucket % numSubBuckets;
+		if(!group)
+			return sub;
+		int msb = group + subBucketBits - 1;
+		uint64_t width = uint64_t{1} << (msb - subBucketBits);
+		return (uint64_t{1} << msb) + (sub + 1) * width - 1;
+	}
+};
+
+struct LoadConfig {
+	std::vector<abstract_test_case *> ops;
+	bool useProcesses = false;
+	uint64_t durationNanos = 1'000'000'000;
+	uint64_t opsPerWorker = 0; // If non-zero, this overrides durationNanos.
+};
+
+// Each worker runs the ops of the mix in turn until it runs out of time or ops.
+// stats points to one histogram per op.
+void runWorker(const LoadConfig &config, LatencyHistogram *stats) {
+	auto deadline = nanosNow() + config.durationNanos;
+	for(uint64_t n = 0; ; n++) {
+		if(config.opsPerWorker) {
+			if(n == config.opsPerWorker)
+				break;
+		}else if(!(n % config.ops.size()) && nanosNow() >= deadline) {
+			break;
+		}
+
+		auto k = n % config.ops.size();
+		auto start = nanosNow();
+		config.ops[k]->run();
+		stats[k].record(nanosNow() - start);
+	}
+}
+
+// Returns the total throughput in ops per second.
+double runLoad(const LoadConfig &config, int numWorkers, bool printOps) {
+	// Shared such that workers that run as processes can report back.
+	size_t size = numWorkers * config.ops.size() * sizeof(LatencyHistogram);
+	auto window = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	assert(window != MAP_FAILED);
+	auto stats = static_cast<LatencyHistogram *>(window);
+	memset(stats, 0, size);
+
+	auto start = nanosNow();
+	if(config.useProcesses) {
+		std::vector<pid_t> pids;
+		for(int i = 0; i < numWorkers; i++) {
+			auto pid = fork();
+			assert(pid >= 0);
+			if(!pid) {
+				runWorker(config, stats + i * config.ops.size());
+				_exit(0);
+			}
+			pids.push_back(pid);
+		}
+		for(auto pid : pids) {
+			int status;
+			auto res = waitpid(pid, &status, 0);
+			assert(res == pid);
+			assert(WIFEXITED(status) && !WEXITSTATUS(status));
+		}
+	}else{
+		std::vector<std::thread> threads;
+		for(int i = 0; i < numWorkers; i++)
+			threads.emplace_back([&, i] {
+				runWorker(config, stats + i * config.ops.size());
+			});
+		for(auto &thread : threads)
+			thread.join();
+	}
+	double elapsed = (nanosNow() - start) / 1e9;
+
+	uint64_t totalOps = 0;
+	for(size_t k = 0; k < config.ops.size(); k++) {
+		LatencyHistogram merged{};
+		for(int i = 0; i < numWorkers; i++)
+			merged.merge(stats[i * config.ops.size() + k]);
+		totalOps += merged.count;
+
+		if(printOps)
+			std::cout << "posix-torture:     " << std::left << std::setw(24) << config.ops[k]->name()
+					<< std::right << std::setw(10) << static_cast<uint64_t>(merged.count / elapsed)
+					<< " ops/s, p50 " << merged.percentile(0.5) / 1000
+					<< " us, p99 " << merged.percentile(0.99) / 1000 << " us" << std::endl;
+	}
+
+	munmap(window, size);
+	return totalOps / elapsed;
+}
+
+// The original mode: run all tests for exponentially increasing numbers of iterations.
+void runTorture() {
 	for(int s = 10; s < 24; s++) {
 		int n = 1 << s;
 		for(abstract_test_case *tcp : test_case_ptrs()) {
@@ -23,3 +182,101 @@ int main() {
 		}
 	}
 }
+
+void printUsage() {
+	std::cerr << "usage: posix-torture [--workers N | --scale] [--processes]"
+			" [--duration SECONDS | --ops N] [--mix OP,OP,...]\n"
+			"With no arguments, all ops are run in a single-threaded loop.\n"
+			"Available ops:";
+	for(abstract_test_case *tcp : test_case_ptrs())
+		std::cerr << " " << tcp->name();
+	std::cerr << std::endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	// Used by the fork_exec_waitpid op.
+	if(argc == 2 && !strcmp(argv[1], "--exit"))
+		return 0;
+
+	if(argc == 1) {
+		runTorture();
+		return 0;
+	}
+
+	LoadConfig config;
+	int numWorkers = 1;
+	bool scale = false;
+	std::string mix;
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--workers") && i + 1 < argc) {
+			numWorkers = atoi(argv[++i]);
+		}else if(!strcmp(argv[i], "--scale")) {
+			scale = true;
+		}else if(!strcmp(argv[i], "--processes")) {
+			config.useProcesses = true;
+		}else if(!strcmp(argv[i], "--duration") && i + 1 < argc) {
+			config.durationNanos = static_cast<uint64_t>(atof(argv[++i]) * 1e9);
+		}else if(!strcmp(argv[i], "--ops") && i + 1 < argc) {
+			config.opsPerWorker = strtoull(argv[++i], nullptr, 10);
+		}else if(!strcmp(argv[i], "--mix") && i + 1 < argc) {
+			mix = argv[++i];
+		}else{
+			printUsage();
+			return 1;
+		}
+	}
+
+	if(mix.empty()) {
+		config.ops = test_case_ptrs();
+	}else{
+		size_t pos = 0;
+		while(pos <= mix.size()) {
+			auto end = std::min(mix.find(',', pos), mix.size());
+			auto name = mix.substr(pos, end - pos);
+			auto it = std::find_if(test_case_ptrs().begin(), test_case_ptrs().end(),
+					[&] (abstract_test_case *tcp) { return name == tcp->name(); });
+			if(it == test_case_ptrs().end()) {
+				std::cerr << "posix-torture: Unknown op " << name << std::endl;
+				printUsage();
+				return 1;
+			}
+			config.ops.push_back(*it);
+			pos = end + 1;
+		}
+	}
+	if(numWorkers < 1) {
+		printUsage();
+		return 1;
+	}
+
+	std::vector<int> workerCounts;
+	if(scale) {
+		int numCpus = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+		for(int n = 1; n < numCpus; n *= 2)
+			workerCounts.push_back(n);
+		workerCounts.push_back(numCpus);
+	}else{
+		workerCounts.push_back(numWorkers);
+	}
+
+	std::vector<double> throughputs;
+	for(auto n : workerCounts) {
+		std::cout << "posix-torture: Running " << n
+				<< (config.useProcesses ? " worker processes" : " worker threads") << std::endl;
+		auto throughput = runLoad(config, n, true);
+		std::cout << "posix-torture:     total " << static_cast<uint64_t>(throughput)
+				<< " ops/s" << std::endl;
+		throughputs.push_back(throughput);
+	}
+
+	if(scale) {
+		std::cout << "posix-torture: Scaling (workers, ops/s, speedup over 1 worker)" << std::endl;
+		for(size_t i = 0; i < workerCounts.size(); i++)
+			std::cout << "posix-torture:     " << workerCounts[i]
+					<< " " << static_cast<uint64_t>(throughputs[i])
+					<< " " << std::fixed << std::setprecision(2)
+					<< throughputs[i] / throughputs[0] << std::endl;
+	}
+}
@@ -1,4 +1,5 @@
 #include <cassert>
+#include <fcntl.h>
 #include <linux/netlink.h>
 #include <sys/socket.h>
 #include <sys/timerfd.h>
@@ -23,3 +24,9 @@ DEFINE_TEST(open_close_unix, ([] {
 	assert(fd > 0);
 	close(fd);
 }))
+
+DEFINE_TEST(open_close_devnull, ([] {
+	int fd = open("/dev/null", O_RDONLY);
+	assert(fd > 0);
+	close(fd);
+}))
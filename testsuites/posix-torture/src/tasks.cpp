@@ -1,4 +1,5 @@
 #include <cassert>
+#include <pthread.h>
 #include <stdlib.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -16,3 +17,29 @@ DEFINE_TEST(fork_exit_waitpid, ([] {
 		assert(res > 0);
 	}
 }))
+
+DEFINE_TEST(fork_exec_waitpid, ([] {
+	int pid = fork();
+	assert(pid >= 0);
+	if(!pid) {
+		// main() exits immediately when it is passed --exit.
+		char *args[] = {const_cast<char *>("posix-torture"), const_cast<char *>("--exit"), nullptr};
+		execv("/proc/self/exe", args);
+		_exit(1);
+	}else{
+		int status;
+		auto res = waitpid(pid, &status, 0);
+		assert(res > 0);
+		assert(WIFEXITED(status) && !WEXITSTATUS(status));
+	}
+}))
+
+DEFINE_TEST(pthread_create_join, ([] {
+	pthread_t thread;
+	auto res = pthread_create(&thread, nullptr, [] (void *) -> void * {
+		return nullptr;
+	}, nullptr);
+	assert(!res);
+	res = pthread_join(thread, nullptr);
+	assert(!res);
+}))
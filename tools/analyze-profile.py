@@ -12,10 +12,16 @@ parser.add_argument('--aggregate-by',
 	help="aggregate samples by source line of code or by symbol inside the binary")
 parser.add_argument('--line', action='store_true')
 parser.add_argument('--isn', action='store_true')
+parser.add_argument('--folded', action='store_true',
+	help="emit folded stacks (one line per stack, for flamegraph.pl and speedscope)")
 
 args = parser.parse_args()
 
 profile = dict()
+folded = dict()
+
+# Must match the ProfileSample struct in thor-internal/profile.hpp.
+header = struct.Struct('QQQII')
 
 if args.aggregate_by == 'symbol':
 	nm = subprocess.check_output(
@@ -43,37 +49,57 @@ n_user = 0
 n_kernel = 0
 n_resolved = 0
 
+def resolve(ip):
+	if args.aggregate_by == 'symbol':
+		idx = bisect.bisect_left(sym_index, ip)
+		if idx == 0:
+			return None
+		start, symbol = sym_table[idx - 1];
+		assert ip >= start
+
+		return symbol, 0
+	else:
+		addr2line.stdin.write(hex(ip) + '\n')
+		addr2line.stdin.flush()
+		func = addr2line.stdout.readline().rstrip()
+		line = addr2line.stdout.readline().rstrip()
+		if args.line:
+			return (func, line)
+		elif args.isn:
+			return (func, line.split(':')[0] + ':' + hex(ip))
+		else:
+			return (func, line.split(':')[0])
+
 with open(args.profile_path, 'rb') as f:
 	while True:
-		rec = f.read(8)
-		if not rec:
+		rec = f.read(header.size)
+		if len(rec) < header.size:
 			break
-		ip = struct.unpack('Q', rec)[0]
+		ip, thread, universe, event, n_frames = header.unpack(rec)
+		frames = struct.unpack('{}Q'.format(n_frames), f.read(8 * n_frames))
+
+		if args.folded:
+			# User-space frames are not symbolized since the profile does not contain
+			# the mappings of the interrupted address space.
+			stack = ['universe {:#x}'.format(universe)] if universe else ['kernel']
+			stack += [hex(frame) for frame in reversed(frames)]
+			if ip < (1 << 63):
+				stack.append(hex(ip))
+			else:
+				loc = resolve(ip)
+				stack.append(loc[0] if loc else hex(ip))
+			key = ';'.join(stack)
+			folded[key] = folded.get(key, 0) + 1
+
 		if ip < (1 << 63):
 			n_user += 1
 			continue
 		else:
 			n_kernel += 1
 
-		if args.aggregate_by == 'symbol':
-			idx = bisect.bisect_left(sym_index, ip)
-			if idx == 0:
-				continue
-			start, symbol = sym_table[idx - 1];
-			assert ip >= start
-
-			loc = symbol, 0
-		else:
-			addr2line.stdin.write(hex(ip) + '\n')
-			addr2line.stdin.flush()
-			func = addr2line.stdout.readline().rstrip()
-			line = addr2line.stdout.readline().rstrip()
-			if args.line:
-				loc = (func, line)
-			elif args.isn:
-				loc = (func, line.split(':')[0] + ':' + hex(ip))
-			else:
-				loc = (func, line.split(':')[0])
+		loc = resolve(ip)
+		if loc is None:
+			continue
 
 		if loc in profile:
 			profile[loc] += 1
@@ -81,6 +107,11 @@ with open(args.profile_path, 'rb') as f:
 			profile[loc] = 1
 		n_resolved += 1
 
+if args.folded:
+	for key in sorted(folded.keys()):
+		print("{} {}".format(key, folded[key]))
+	exit(0)
+
 n_all = n_user + n_kernel
 
 out = sorted(profile.keys(), key=lambda loc: profile[loc])
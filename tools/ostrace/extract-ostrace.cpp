@@ -1,9 +1,15 @@
 #include <err.h>
 #include <fcntl.h>
+#include <stdio.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cinttypes>
 #include <iostream>
+#include <numeric>
+#include <optional>
+#include <unordered_map>
 
 #include <bragi/helpers-std.hpp>
 #include <CLI/App.hpp>
@@ -15,15 +21,251 @@
 enum class ExtractMode {
 	none,
 	eventOnly,
-	specificItem
+	specificItem,
+	chromeTrace,
+	bootChart
 };
 
 
 std::unordered_map<std::string, ExtractMode> stringToExtractMode{
 	{"event-only", ExtractMode::eventOnly},
 	{"specific-item", ExtractMode::specificItem},
+	{"chrome-trace", ExtractMode::chromeTrace},
+	{"boot-chart", ExtractMode::bootChart},
 };
 
+// Event that carries counters; kept for chrome-trace since the trace.* items are
+// only resolved after all announcements have been read.
+struct RawEvent {
+	uint64_t ts;
+	uint64_t id;
+	std::vector<std::pair<uint64_t, int64_t>> ctrs;
+};
+
+struct SpanInfo {
+	std::string name;
+	uint64_t traceId;
+	uint64_t spanId;
+	uint64_t parentId;
+	int64_t op;
+	uint64_t begin;
+	uint64_t end;
+};
+
+std::string formatId(uint64_t id) {
+	char buf[19];
+	snprintf(buf, sizeof(buf), "0x%016" PRIx64, id);
+	return buf;
+}
+
+// Chrome's trace format uses microseconds.
+std::string formatUs(uint64_t ns) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%" PRIu64 ".%03" PRIu64, ns / 1000, ns % 1000);
+	return buf;
+}
+
+// Pairs up the begin and end events of the spans emitted by protocols::ostrace::Span
+// and prints them as Chrome trace JSON (which Perfetto can also import).
+// Each trace is shown as a separate thread.
+void printChromeTrace(const std::vector<RawEvent> &events,
+		const std::unordered_map<uint64_t, std::string> &eventNames,
+		const std::unordered_map<uint64_t, std::string> &itemNames) {
+	std::vector<SpanInfo> spans;
+	std::unordered_map<uint64_t, size_t> openSpans;
+	size_t numUnmatched = 0;
+
+	for(auto &event : events) {
+		uint64_t traceId = 0, spanId = 0, parentId = 0;
+		int64_t phase = 0, op = 0;
+		for(auto [id, value] : event.ctrs) {
+			auto it = itemNames.find(id);
+			if(it == itemNames.end())
+				continue;
+			if(it->second == "trace.id")
+				traceId = static_cast<uint64_t>(value);
+			else if(it->second == "trace.span")
+				spanId = static_cast<uint64_t>(value);
+			else if(it->second == "trace.parent")
+				parentId = static_cast<uint64_t>(value);
+			else if(it->second == "trace.phase")
+				phase = value;
+			else if(it->second == "trace.op")
+				op = value;
+		}
+		if(!traceId || !spanId)
+			continue;
+
+		if(phase == 1) {
+			auto nameIt = eventNames.find(event.id);
+			spans.push_back({nameIt != eventNames.end() ? nameIt->second : "unknown",
+					traceId, spanId, parentId, op, event.ts, 0});
+			openSpans[spanId] = spans.size() - 1;
+		}else if(phase == 2) {
+			auto it = openSpans.find(spanId);
+			if(it == openSpans.end()) {
+				numUnmatched++;
+				continue;
+			}
+			spans[it->second].end = event.ts;
+			openSpans.erase(it);
+		}
+	}
+	numUnmatched += openSpans.size();
+
+	std::unordered_map<uint64_t, size_t> traceIndices;
+	std::cout << "{\"traceEvents\": [\n";
+	bool first = true;
+	for(auto &span : spans) {
+		if(!span.end)
+			continue;
+
+		auto [it, isNew] = traceIndices.insert({span.traceId, traceIndices.size() + 1});
+		if(isNew) {
+			std::cout << (first ? "" : ",\n")
+					<< "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1"
+					<< ", \"tid\": " << it->second
+					<< ", \"args\": {\"name\": \"trace " << formatId(span.traceId) << "\"}}";
+			first = false;
+		}
+
+		std::cout << (first ? "" : ",\n")
+				<< "{\"name\": \"" << span.name << "\", \"cat\": \"ostrace\", \"ph\": \"X\""
+				<< ", \"ts\": " << formatUs(span.begin)
+				<< ", \"dur\": " << formatUs(span.end - span.begin)
+				<< ", \"pid\": 1, \"tid\": " << it->second
+				<< ", \"args\": {\"span\": \"" << formatId(span.spanId) << "\""
+				<< ", \"parent\": \"" << formatId(span.parentId) << "\""
+				<< ", \"op\": " << span.op << "}}";
+		first = false;
+	}
+	std::cout << "\n]}" << std::endl;
+
+	std::cerr << "found " << spans.size() << " spans in "
+			<< traceIndices.size() << " traces" << std::endl;
+	if(numUnmatched)
+		std::cerr << "ignored " << numUnmatched << " unmatched span events" << std::endl;
+}
+
+struct BootPhase {
+	std::string kind;
+	std::string name;
+	uint64_t begin;
+	uint64_t end;
+	bool critical = false;
+};
+
+// Renders the boot phases that thor (and mbus) report as "boot.<kind>:<name>" events
+// with boot.begin and boot.end items. Each kind is shown as a separate thread.
+// The critical path is shown as an additional thread: starting from the phase that
+// ends last, we repeatedly step to the phase that ended last before the current one began.
+void printBootChart(const std::vector<RawEvent> &events,
+		const std::unordered_map<uint64_t, std::string> &eventNames,
+		const std::unordered_map<uint64_t, std::string> &itemNames) {
+	std::vector<BootPhase> phases;
+
+	for(auto &event : events) {
+		auto nameIt = eventNames.find(event.id);
+		if(nameIt == eventNames.end() || nameIt->second.compare(0, 5, "boot."))
+			continue;
+		auto colon = nameIt->second.find(':');
+		if(colon == std::string::npos)
+			continue;
+
+		std::optional<uint64_t> begin, end;
+		for(auto [id, value] : event.ctrs) {
+			auto it = itemNames.find(id);
+			if(it == itemNames.end())
+				continue;
+			if(it->second == "boot.begin")
+				begin = static_cast<uint64_t>(value);
+			else if(it->second == "boot.end")
+				end = static_cast<uint64_t>(value);
+		}
+		if(!begin || !end || *end < *begin)
+			continue;
+
+		phases.push_back({nameIt->second.substr(5, colon - 5),
+				nameIt->second.substr(colon + 1), *begin, *end});
+	}
+
+	if(phases.empty()) {
+		std::cerr << "found no boot phases" << std::endl;
+		return;
+	}
+
+	std::stable_sort(phases.begin(), phases.end(), [] (const BootPhase &a, const BootPhase &b) {
+		return a.end < b.end;
+	});
+
+	// Phases are sorted by their end, hence the predecessor of a phase
+	// is the last phase in front of it that ends before it begins.
+	std::vector<size_t> criticalPath;
+	size_t current = phases.size() - 1;
+	while(true) {
+		phases[current].critical = true;
+		criticalPath.push_back(current);
+
+		auto it = std::upper_bound(phases.begin(), phases.begin() + current,
+				phases[current].begin, [] (uint64_t ts, const BootPhase &phase) {
+			return ts < phase.end;
+		});
+		if(it == phases.begin())
+			break;
+		current = it - phases.begin() - 1;
+	}
+	std::reverse(criticalPath.begin(), criticalPath.end());
+
+	auto origin = std::min_element(phases.begin(), phases.end(),
+			[] (const BootPhase &a, const BootPhase &b) {
+		return a.begin < b.begin;
+	})->begin;
+
+	std::unordered_map<std::string, size_t> kindIndices;
+	std::cout << "{\"traceEvents\": [\n";
+	std::cout << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0"
+			<< ", \"args\": {\"name\": \"critical path\"}}";
+
+	auto printPhase = [&] (const BootPhase &phase, size_t tid) {
+		std::cout << ",\n{\"name\": \"" << phase.name << "\", \"cat\": \"" << phase.kind << "\"";
+		if(phase.end == phase.begin) {
+			std::cout << ", \"ph\": \"i\", \"s\": \"t\"";
+		}else{
+			std::cout << ", \"ph\": \"X\", \"dur\": " << formatUs(phase.end - phase.begin);
+		}
+		std::cout << ", \"ts\": " << formatUs(phase.begin - origin)
+				<< ", \"pid\": 1, \"tid\": " << tid
+				<< ", \"args\": {\"critical\": " << (phase.critical ? "true" : "false") << "}}";
+	};
+
+	for(auto &phase : phases) {
+		auto [it, isNew] = kindIndices.insert({phase.kind, kindIndices.size() + 1});
+		if(isNew)
+			std::cout << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1"
+					<< ", \"tid\": " << it->second
+					<< ", \"args\": {\"name\": \"" << phase.kind << "\"}}";
+		printPhase(phase, it->second);
+	}
+	for(auto index : criticalPath)
+		printPhase(phases[index], 0);
+	std::cout << "\n]}" << std::endl;
+
+	// Also summarize the critical path. Gaps are times in which no phase was running,
+	// e.g., because a driver waited for hardware.
+	std::cerr << "critical path (" << criticalPath.size() << " of "
+			<< phases.size() << " phases):" << std::endl;
+	uint64_t previousEnd = phases[criticalPath.front()].begin;
+	for(auto index : criticalPath) {
+		auto &phase = phases[index];
+		fprintf(stderr, "  %12s us  %10s us gap  %-8s %s\n",
+				formatUs(phase.end - phase.begin).c_str(),
+				formatUs(phase.begin - previousEnd).c_str(),
+				phase.kind.c_str(), phase.name.c_str());
+		previousEnd = phase.end;
+	}
+	std::cerr << "total: " << formatUs(phases.back().end - origin) << " us" << std::endl;
+}
+
 int main(int argc, char **argv) {
 	ExtractMode mode{};
 	std::string path{"virtio-trace.bin"};
@@ -67,6 +309,10 @@ int main(int argc, char **argv) {
 	std::vector<uint64_t> ts;
 	std::vector<uint64_t> value;
 
+	std::vector<RawEvent> rawEvents;
+	std::unordered_map<uint64_t, std::string> eventNames;
+	std::unordered_map<uint64_t, std::string> itemNames;
+
 	auto extractRecord = [&] () -> bool {
 		auto preamble = bragi::read_preamble(buffer);
 		if(preamble.error()) {
@@ -88,7 +334,14 @@ int main(int argc, char **argv) {
 			}
 			auto &record = maybeRecord.value();
 
-			if(record.id() == filteredEventId) {
+			if(mode == ExtractMode::chromeTrace || mode == ExtractMode::bootChart) {
+				if(record.ctrs_size()) {
+					RawEvent event{record.ts(), record.id(), {}};
+					for(size_t i = 0; i < record.ctrs_size(); ++i)
+						event.ctrs.push_back({record.ctrs(i).id(), record.ctrs(i).value()});
+					rawEvents.push_back(std::move(event));
+				}
+			}else if(record.id() == filteredEventId) {
 				if(mode == ExtractMode::eventOnly) {
 					ts.push_back(record.ts());
 				}else if(mode == ExtractMode::specificItem) {
@@ -107,6 +360,7 @@ int main(int argc, char **argv) {
 			assert(maybeRecord);
 			auto &record = maybeRecord.value();
 
+			eventNames[record.id()] = record.name();
 			if(record.name() == eventName)
 				filteredEventId = record.id();
 		} break;
@@ -116,6 +370,7 @@ int main(int argc, char **argv) {
 			assert(maybeRecord);
 			auto &record = maybeRecord.value();
 
+			itemNames[record.id()] = record.name();
 			if(record.name() == itemName)
 				desiredItemId = record.id();
 		} break;
@@ -135,16 +390,42 @@ int main(int argc, char **argv) {
 		++nRecords;
 	}
 
+	if(mode == ExtractMode::bootChart) {
+		printBootChart(rawEvents, eventNames, itemNames);
+		std::cerr << "extracted " << nRecords << " records"
+				<< " (" << buffer.size() << " bytes remain)" << std::endl;
+		return 0;
+	}
+
+	if(mode == ExtractMode::chromeTrace) {
+		// Same as below: restore the timestamp order across CPUs.
+		std::stable_sort(rawEvents.begin(), rawEvents.end(), [] (const RawEvent &a, const RawEvent &b) {
+			return a.ts < b.ts;
+		});
+		printChromeTrace(rawEvents, eventNames, itemNames);
+		std::cerr << "extracted " << nRecords << " records"
+				<< " (" << buffer.size() << " bytes remain)" << std::endl;
+		return 0;
+	}
+
+	// The kernel buffers events per CPU, hence the log interleaves the streams of all CPUs.
+	// Merge them by timestamp (the sort is stable such that each stream stays in order).
+	std::vector<size_t> order(ts.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&] (size_t a, size_t b) {
+		return ts[a] < ts[b];
+	});
+
 	std::cout << "{\n";
 	std::cout << "\"ts\": [";
-	for(size_t i = 0; i < ts.size(); ++i)
-		std::cout << (i ? ", " : "") << ts[i];
+	for(size_t i = 0; i < order.size(); ++i)
+		std::cout << (i ? ", " : "") << ts[order[i]];
 	std::cout << "]\n";
 	if(mode == ExtractMode::specificItem) {
 		std::cout << ",\n";
 		std::cout << "\"value\": [";
-		for(size_t i = 0; i < value.size(); ++i)
-			std::cout << (i ? ", " : "") << value[i];
+		for(size_t i = 0; i < order.size(); ++i)
+			std::cout << (i ? ", " : "") << value[order[i]];
 		std::cout << "]\n";
 	}
 	std::cout << "}" << std::endl;
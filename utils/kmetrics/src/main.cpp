@@ -0,0 +1,136 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <async/promise.hpp>
+#include <frg/std_compat.hpp>
+#include <protocols/mbus/client.hpp>
+#include <kerncfg.pb.h>
+
+// Prints a snapshot of the kernel's metrics. If arguments are given, only metrics
+// whose names start with one of the arguments are printed.
+
+namespace {
+
+async::result<helix::UniqueLane> enumerateKerncfg() {
+	auto root = co_await mbus::Instance::global().getRoot();
+
+	auto filter = mbus::EqualsFilter("class", "kerncfg");
+
+	async::promise<helix::UniqueLane, frg::stl_allocator> promise;
+	auto future = promise.get_future();
+
+	auto handler = mbus::ObserverHandler{}
+	.withAttach([&promise] (mbus::Entity entity,
+			mbus::Properties) mutable -> async::detached {
+		promise.set_value(helix::UniqueLane(co_await entity.bind()));
+	});
+
+	co_await root.linkObserver(std::move(filter), std::move(handler));
+	co_return std::move(*(co_await future.get()));
+}
+
+async::result<managarm::kerncfg::MetricsSnapshot> getSnapshot(helix::BorrowedLane lane) {
+	std::vector<char> buffer(1 << 14);
+	while(true) {
+		managarm::kerncfg::CntRequest req;
+		req.set_req_type(managarm::kerncfg::CntReqType::GET_METRICS);
+		req.set_size(buffer.size());
+
+		auto ser = req.SerializeAsString();
+		auto [offer, send_req, recv_resp, recv_snapshot] =
+			co_await helix_ng::exchangeMsgs(lane,
+				helix_ng::offer(
+					helix_ng::sendBuffer(ser.data(), ser.size()),
+					helix_ng::recvInline(),
+					helix_ng::recvBuffer(buffer.data(), buffer.size())
+				)
+			);
+		HEL_CHECK(offer.error());
+		HEL_CHECK(send_req.error());
+		HEL_CHECK(recv_resp.error());
+		HEL_CHECK(recv_snapshot.error());
+
+		managarm::kerncfg::SvrResponse resp;
+		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+		assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+
+		// The snapshot did not fit, retry with a larger buffer.
+		if(resp.size() > buffer.size()) {
+			buffer.resize(resp.size() + resp.size() / 4);
+			continue;
+		}
+
+		assert(recv_snapshot.actualLength() == resp.size());
+		managarm::kerncfg::MetricsSnapshot snapshot;
+		snapshot.ParseFromArray(buffer.data(), recv_snapshot.actualLength());
+		co_return snapshot;
+	}
+}
+
+bool isSelected(const std::string &name, const std::vector<std::string> &prefixes) {
+	if(prefixes.empty())
+		return true;
+	for(auto &prefix : prefixes) {
+		if(!name.compare(0, prefix.size(), prefix))
+			return true;
+	}
+	return false;
+}
+
+void printMetric(const managarm::kerncfg::Metric &metric) {
+	switch(metric.type()) {
+	case managarm::kerncfg::MetricType::COUNTER:
+		std::cout << metric.name() << " " << metric.counter_value() << "\n";
+		break;
+	case managarm::kerncfg::MetricType::GAUGE:
+		std::cout << metric.name() << " " << metric.gauge_value() << "\n";
+		break;
+	case managarm::kerncfg::MetricType::HISTOGRAM: {
+		uint64_t count = 0;
+		for(auto bucket : metric.buckets())
+			count += bucket;
+		std::cout << metric.name() << " count " << count << ", sum " << metric.sum() << "\n";
+		for(int i = 0; i < metric.buckets_size(); i++) {
+			if(!metric.buckets(i))
+				continue;
+			std::cout << "\t[2^" << i << ", 2^" << (i + 1) << "): "
+					<< metric.buckets(i) << "\n";
+		}
+		break;
+	}
+	default:
+		std::cout << metric.name() << " (unknown type)\n";
+	}
+}
+
+async::detached dumpMetrics(std::vector<std::string> prefixes) {
+	auto lane = co_await enumerateKerncfg();
+	auto snapshot = co_await getSnapshot(lane);
+
+	// The kernel reports metrics in reverse order of registration.
+	std::vector<const managarm::kerncfg::Metric *> metrics;
+	for(auto &metric : snapshot.metrics())
+		metrics.push_back(&metric);
+	std::sort(metrics.begin(), metrics.end(), [] (auto a, auto b) {
+		return a->name() < b->name();
+	});
+
+	for(auto metric : metrics) {
+		if(isSelected(metric->name(), prefixes))
+			printMetric(*metric);
+	}
+	std::cout << std::flush;
+	exit(0);
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	std::vector<std::string> prefixes{argv + 1, argv + argc};
+	dumpMetrics(std::move(prefixes));
+	async::run_forever(helix::currentDispatcher);
+}